@@ -118,6 +118,18 @@ struct
   unsigned long max_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl_ssh; /* for SSH. */
 
+  /* The maximum number of entries and the lifetime in seconds of
+     the cache of unprotected private keys.  */
+  unsigned int key_cache_size;
+  unsigned long key_cache_ttl;
+
+  /* Do not keep an index of the private keys directory.  */
+  int no_key_index;
+
+  /* The number of threads used to generate keys announced with the
+     PREGEN command; 0 disables that command.  */
+  unsigned int genkey_threads;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
 
@@ -432,6 +444,8 @@ void *get_agent_daemon_notify_event (void);
 void agent_sighup_action (void);
 int map_pk_openpgp_to_gcry (int openpgp_algo);
 void agent_kick_the_loop (void);
+void agent_unlock_npth (void);
+void agent_lock_npth (void);
 
 /*-- command.c --*/
 gpg_error_t agent_inq_pinentry_launched (ctrl_t ctrl, unsigned long pid,
@@ -544,6 +558,36 @@ int agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
 char *agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode);
 void agent_store_cache_hit (const char *key);
 
+/*-- keycache.c --*/
+/* The properties of a key file used to detect changes.  */
+struct keycache_stamp_s
+{
+  unsigned long long size;
+  unsigned long long ino;
+  time_t mtime;
+};
+void initialize_module_keycache (void);
+void agent_keycache_expire (void);
+void agent_keycache_flush (void);
+void agent_keycache_drop (const unsigned char *grip);
+void agent_keycache_put (const unsigned char *grip,
+                         const struct keycache_stamp_s *stamp,
+                         const unsigned char *key, int protected,
+                         time_t timestamp);
+gpg_error_t agent_keycache_get (const unsigned char *grip,
+                                const struct keycache_stamp_s *stamp,
+                                unsigned char **r_key, int *r_protected,
+                                time_t *r_timestamp);
+
+/*-- keyindex.c --*/
+void initialize_module_keyindex (void);
+void agent_keyindex_flush (void);
+unsigned long agent_keyindex_generation (void);
+int agent_keyindex_lookup (const unsigned char *grip, int *r_keytype);
+void agent_keyindex_set_keytype (const unsigned char *grip, int keytype);
+gpg_error_t agent_keyindex_grips (unsigned char **r_grips,
+                                  unsigned int *r_count);
+
 
 /*-- pksign.c --*/
 gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
@@ -554,11 +598,24 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text, int mdalgo,
+                                const unsigned char *digests,
+                                size_t digestlen, unsigned int count,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
                              const unsigned char *ciphertext, size_t ciphertextlen,
                              membuf_t *outbuf, int *r_padding);
+gpg_error_t agent_pkdecrypt_multi (ctrl_t ctrl, const char *desc_text,
+                                   const unsigned char *ciphertexts,
+                                   size_t ciphertextslen, unsigned int count,
+                                   membuf_t *outbuf, int *r_padding);
+gpg_error_t agent_pkdecrypt_any (ctrl_t ctrl, const unsigned char (*grips)[20],
+                                 const unsigned char *ciphertexts,
+                                 size_t ciphertextslen, unsigned int count,
+                                 membuf_t *outbuf);
 
 enum kemids
   {
@@ -579,6 +636,7 @@ gpg_error_t agent_kem_decrypt (ctrl_t ctrl, const char *desc_text, int kemid,
 #define GENKEY_FLAG_NO_PROTECTION 1
 #define GENKEY_FLAG_PRESET        2
 
+void initialize_module_genkey (void);
 void clear_ephemeral_keys (ctrl_t ctrl);
 
 int check_passphrase_constraints (ctrl_t ctrl, const char *pw,
@@ -586,6 +644,8 @@ int check_passphrase_constraints (ctrl_t ctrl, const char *pw,
 				  char **failed_constraint);
 gpg_error_t agent_ask_new_passphrase (ctrl_t ctrl, const char *prompt,
                                       char **r_passphrase);
+gpg_error_t agent_genkey_pregen (const char *keyparam, size_t keyparamlen,
+                                 unsigned long count);
 int agent_genkey (ctrl_t ctrl, unsigned int flags,
                   const char *cache_nonce, time_t timestamp,
                   const char *keyparam, size_t keyparmlen,
@@ -596,6 +656,11 @@ gpg_error_t agent_protect_and_store (ctrl_t ctrl, gcry_sexp_t s_skey,
 
 /*-- protect.c --*/
 void set_s2k_calibration_time (unsigned int milliseconds);
+void enable_s2k_calibration_cache (void);
+int s2k_calibration_needed (void);
+unsigned long measure_s2k_count (unsigned int *r_milliseconds);
+void set_calibrated_s2k_count (unsigned long count,
+                               unsigned int milliseconds);
 unsigned long get_calibrated_s2k_count (void);
 unsigned long get_standard_s2k_count (void);
 unsigned char get_standard_s2k_count_rfc4880 (void);
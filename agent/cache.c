@@ -26,6 +26,8 @@
 #include <npth.h>
 
 #include "agent.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
 
 /* The default TTL for DATA items.  This has no configure
  * option because it is expected that clients provide a TTL.  */
@@ -56,11 +58,18 @@ struct secret_data_s {
 /* The type of cache object.  */
 typedef struct cache_item_s *ITEM;
 
-/* The timer entry in a linked list.  */
+/* The timer entry of a cache object.  TV_SEC is the relative
+ * expiration time as computed by compute_expiration; WHEN is the
+ * absolute time in seconds of the clock used by the main loop at
+ * which the entry expires.  A WHEN of 0 indicates that the entry is
+ * not in the timer wheel.  */
 struct timer_s {
   ITEM next;
+  ITEM prev;
+  time_t when;
   int tv_sec;
   int reason;
+  int overflow;  /* The item is in the overflow list.  */
 };
 #define CACHE_EXPIRE_UNUSED      0
 #define CACHE_EXPIRE_LAST_ACCESS 1
@@ -68,7 +77,7 @@ struct timer_s {
 
 /* The cache object.  */
 struct cache_item_s {
-  ITEM next;
+  ITEM next;  /* Next item in the same hash bucket.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
@@ -79,17 +88,44 @@ struct cache_item_s {
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The cache himself.  This is a hash table indexed by the KEY of the
+ * items; the cache mode and the restricted flag are not part of the
+ * hash because the matching rules for them depend on the mode of the
+ * lookup.  Newer items are kept in front of older items with the
+ * same key.  The table grows with the number of items.  */
+#define CACHE_TABLE_MIN_SIZE 64  /* Must be a power of 2.  */
+static ITEM *cache_table;
+static unsigned int cache_table_size;
+static unsigned int cache_items;
+
+/* The timer wheel.  Slot N keeps the items with an expiration time
+ * WHEN for which WHEN modulo TIMER_WHEEL_SLOTS is N.  Only items
+ * expiring within the next TIMER_WHEEL_SLOTS seconds are kept in the
+ * wheel; all others are kept in the overflow list and moved to the
+ * wheel when their time comes closer.  Thus the first non-empty slot
+ * always gives the next expiration time.  */
+#define TIMER_WHEEL_SLOTS 1024  /* Must be a power of 2.  */
+static ITEM timer_wheel[TIMER_WHEEL_SLOTS];
+static ITEM timer_overflow;
+/* The lowest expiration time in the overflow list.  This may be
+ * lower than the actual value after items have been removed.  */
+static time_t timer_overflow_min;
+/* The number of items in the wheel and the overflow list.  */
+static unsigned int timer_count;
+/* The last second processed by agent_cache_expiration.  */
+static time_t timer_now;
+/* The time the main loop will call us next or 0 if it waits for an
+ * event.  */
+static time_t timer_armed;
 
-/* The timer list of expiration, in active.  */
-static ITEM the_timer_list;
-/* Newly created entries, to be inserted into the timer list.  */
-static ITEM the_timer_list_new;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
 
+/* The metrics of agent_get_cache.  */
+static metric_t metric_cache_hits;
+static metric_t metric_cache_misses;
+
 
 /* This function must be called once to initialize this module. It
    has to be done before a second thread is spawned.  */
@@ -102,6 +138,11 @@ initialize_module_cache (void)
 
   if (err)
     log_fatal ("error initializing cache module: %s\n", strerror (err));
+
+  metric_cache_hits = metrics_counter ("cache_hits_total",
+                                       "Lookups found in the cache.");
+  metric_cache_misses = metrics_counter ("cache_misses_total",
+                                         "Lookups not found in the cache.");
 }
 
 
@@ -158,6 +199,8 @@ init_encryption (void)
 static void
 release_data (struct secret_data_s *data)
 {
+   if (data)
+     memstat_free (MEMSTAT_AGENT_CACHE, sizeof *data + data->totallen - 1);
    xfree (data);
 }
 
@@ -206,112 +249,207 @@ new_data (const char *string, struct secret_data_s **r_data)
       xfree (d_enc);
       return err;
     }
+  memstat_alloc (MEMSTAT_AGENT_CACHE, sizeof *d_enc + total - 1);
   *r_data = d_enc;
   return 0;
 }
 
 
+/* Return the current time of the clock used by the main loop.  */
+static time_t
+timer_clock (void)
+{
+  struct timespec curtime;
+
+  npth_clock_gettime (&curtime);
+  return curtime.tv_sec;
+}
+
+
+/* Return the list head for ENTRY which must have its WHEN set.  */
+static ITEM *
+timer_slot (ITEM entry)
+{
+  if (entry->t.overflow)
+    return &timer_overflow;
+  return &timer_wheel[entry->t.when & (TIMER_WHEEL_SLOTS - 1)];
+}
+
+
+/* Link ENTRY with an already set WHEN into the wheel.  */
 static void
-insert_to_timer_list_new (ITEM entry)
+link_timer (ITEM entry)
 {
-  entry->t.next = the_timer_list_new;
-  the_timer_list_new = entry;
+  ITEM *slotp;
+
+  entry->t.overflow = (entry->t.when - timer_now >= TIMER_WHEEL_SLOTS);
+  if (entry->t.overflow
+      && (!timer_overflow || entry->t.when < timer_overflow_min))
+    timer_overflow_min = entry->t.when;
+
+  slotp = timer_slot (entry);
+  entry->t.prev = NULL;
+  entry->t.next = *slotp;
+  if (*slotp)
+    (*slotp)->t.prev = entry;
+  *slotp = entry;
 }
 
-/* Insert to the active timer list.  */
+
+static void
+unlink_timer (ITEM entry)
+{
+  if (entry->t.next)
+    entry->t.next->t.prev = entry->t.prev;
+  if (entry->t.prev)
+    entry->t.prev->t.next = entry->t.next;
+  else
+    *timer_slot (entry) = entry->t.next;
+  entry->t.next = entry->t.prev = NULL;
+}
+
+
+/* Insert ENTRY into the timer wheel using its relative expiration
+ * time.  NOW is the current time as returned by timer_clock.  */
 static void
-insert_to_timer_list (struct timespec *ts, ITEM entry)
+insert_to_timer_wheel (ITEM entry, time_t now)
 {
-  ITEM e, eprev;
+  if (!timer_count && timer_now < now)
+    timer_now = now;  /* Nothing to process before NOW.  */
 
-  if (!the_timer_list || ts->tv_sec >= entry->t.tv_sec)
+  entry->t.when = now + entry->t.tv_sec;
+  /* Slots up to TIMER_NOW have already been processed.  */
+  if (entry->t.when <= timer_now)
+    entry->t.when = timer_now + 1;
+
+  link_timer (entry);
+  timer_count++;
+}
+
+
+static void
+remove_from_timer_wheel (ITEM entry)
+{
+  if (!entry->t.when)
+    return;  /* Not in the wheel.  */
+
+  unlink_timer (entry);
+  entry->t.when = 0;
+  timer_count--;
+}
+
+
+/* Move the items of the overflow list which expire within the range
+ * of the wheel to the wheel.  To avoid walking the list too often
+ * this is only done when the first of them is half the range of the
+ * wheel away.  */
+static void
+cascade_timer_overflow (void)
+{
+  ITEM e, enext;
+  time_t newmin = 0;
+
+  if (!timer_overflow
+      || timer_overflow_min - timer_now >= TIMER_WHEEL_SLOTS / 2)
+    return;
+
+  for (e = timer_overflow; e; e = enext)
     {
-      if (the_timer_list)
+      enext = e->t.next;
+      if (e->t.when <= timer_now)
+        e->t.when = timer_now + 1;
+      if (e->t.when - timer_now < TIMER_WHEEL_SLOTS)
         {
-          the_timer_list->t.tv_sec += ts->tv_sec - entry->t.tv_sec;
-          if (ts->tv_nsec >= 500000000)
-            the_timer_list->t.tv_sec++;
+          unlink_timer (e);
+          link_timer (e);
         }
+      else if (!newmin || e->t.when < newmin)
+        newmin = e->t.when;
+    }
+  timer_overflow_min = newmin;
+}
 
-      ts->tv_sec = entry->t.tv_sec;
-      ts->tv_nsec = 0;
 
-      entry->t.tv_sec = 0;
-      entry->t.next = the_timer_list;
-      the_timer_list = entry;
-      return;
-    }
+/* Return a hash value for the cache KEY.  */
+static unsigned int
+hash_key (const char *key)
+{
+  unsigned int h = 2166136261u;  /* FNV-1a.  */
 
-  entry->t.tv_sec -= ts->tv_sec;
-  eprev = NULL;
-  for (e = the_timer_list; e; e = e->t.next)
+  for (; *key; key++)
     {
-      if (e->t.tv_sec > entry->t.tv_sec)
-        break;
-
-      eprev = e;
-      entry->t.tv_sec -= e->t.tv_sec;
+      h ^= *(const unsigned char *)key;
+      h *= 16777619u;
     }
+  return h;
+}
 
-  entry->t.next = e;
-  if (e)
-    e->t.tv_sec -= entry->t.tv_sec;
 
-  if (eprev)
-    eprev->t.next = entry;
-  else
-    the_timer_list = entry;
+/* Return the address of the bucket for KEY.  The table must exist.  */
+static ITEM *
+cache_bucket (const char *key)
+{
+  return &cache_table[hash_key (key) & (cache_table_size - 1)];
 }
 
-static void
-remove_from_timer_list (ITEM entry)
+
+/* Make sure that the hash table can take another item.  */
+static gpg_error_t
+grow_cache_table (void)
 {
-  ITEM e, eprev;
+  ITEM *newtbl, *tail, r, rnext;
+  unsigned int newsize, i;
 
-  eprev = NULL;
-  for (e = the_timer_list; e; e = e->t.next)
-    if (e != entry)
-      eprev = e;
-    else
-      {
-        if (e->t.next)
-          e->t.next->t.tv_sec += e->t.tv_sec;
+  if (cache_table && cache_items < cache_table_size)
+    return 0;
 
-        if (eprev)
-          eprev->t.next = e->t.next;
-        else
-          the_timer_list = e->t.next;
+  newsize = cache_table? cache_table_size * 2 : CACHE_TABLE_MIN_SIZE;
+  newtbl = xtrycalloc (newsize, sizeof *newtbl);
+  if (!newtbl)
+    return cache_table? 0 : gpg_error_from_syserror ();
 
-        break;
+  for (i=0; i < cache_table_size; i++)
+    for (r = cache_table[i]; r; r = rnext)
+      {
+        rnext = r->next;
+        /* Append to keep the order of items with the same key.  */
+        for (tail = &newtbl[hash_key (r->key) & (newsize - 1)];
+             *tail; tail = &(*tail)->next)
+          ;
+        r->next = NULL;
+        *tail = r;
       }
 
-  entry->t.next = NULL;
-  entry->t.tv_sec = 0;
+  memstat_free (MEMSTAT_AGENT_CACHE, cache_table_size * sizeof *cache_table);
+  memstat_alloc (MEMSTAT_AGENT_CACHE, newsize * sizeof *newtbl);
+  xfree (cache_table);
+  cache_table = newtbl;
+  cache_table_size = newsize;
+  return 0;
 }
 
+
+/* Remove the item E from the hash table and release it.  */
 static void
-remove_from_timer_list_new (ITEM entry)
+remove_cache_item (ITEM e)
 {
-  ITEM e, eprev;
+  ITEM *rp;
 
-  eprev = NULL;
-  for (e = the_timer_list_new; e; e = e->t.next)
-    if (e != entry)
-      eprev = e;
-    else
+  for (rp = cache_bucket (e->key); *rp; rp = &(*rp)->next)
+    if (*rp == e)
       {
-        if (eprev)
-          eprev->t.next = e->t.next;
-        else
-          the_timer_list_new = e->t.next;
-
+        *rp = e->next;
+        cache_items--;
         break;
       }
 
-  entry->t.next = NULL;
-  entry->t.tv_sec = 0;
+  remove_from_timer_wheel (e);
+  release_data (e->pw);
+  memstat_free (MEMSTAT_AGENT_CACHE, sizeof *e + strlen (e->key));
+  xfree (e);
 }
 
+
 static int
 compute_expiration (ITEM r)
 {
@@ -375,15 +513,18 @@ static void
 update_expiration (ITEM entry, int is_new_entry)
 {
   if (!is_new_entry)
-    {
-      remove_from_timer_list (entry);
-      remove_from_timer_list_new (entry);
-    }
+    remove_from_timer_wheel (entry);
 
   if (compute_expiration (entry))
     {
-      insert_to_timer_list_new (entry);
-      agent_kick_the_loop ();
+      insert_to_timer_wheel (entry, timer_clock ());
+      /* Only wake up the main loop if it would otherwise sleep past
+       * the new expiration time.  */
+      if (!timer_armed || entry->t.when < timer_armed)
+        {
+          timer_armed = entry->t.when;
+          agent_kick_the_loop ();
+        }
     }
 }
 
@@ -415,90 +556,77 @@ do_expire (ITEM e)
   e->accessed = 0;
 
   if (compute_expiration (e))
-    insert_to_timer_list_new (e);
+    insert_to_timer_wheel (e, timer_clock ());
 
   return 0;
 }
 
 
+/* Expire all due cache entries and return the timeout for the next
+ * call or NULL if there is no entry which may expire.  This is
+ * called by the main loop.  */
 struct timespec *
 agent_cache_expiration (void)
 {
-  static struct timespec abstime;
   static struct timespec timeout;
   struct timespec *tp;
-  struct timespec curtime;
+  time_t now, t;
   int res;
-  int expired = 0;
   ITEM e, enext;
 
+  agent_keycache_expire ();
+
   res = npth_mutex_lock (&cache_lock);
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  npth_clock_gettime (&curtime);
-  if (the_timer_list)
-    {
-      if (npth_timercmp (&abstime, &curtime, <))
-        expired = 1;
-      else
-        npth_timersub (&abstime, &curtime, &timeout);
-    }
-
-  if (expired && (e = the_timer_list) && e->t.tv_sec == 0)
+  now = timer_clock ();
+  if (timer_count && timer_now < now)
     {
-      the_timer_list = e->t.next;
-      e->t.next = NULL;
-
-      if (do_expire (e))
-        {
-          ITEM r, rprev;
-
-          if (DBG_CACHE)
-            log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
-                       e->key, e->restricted, e->cache_mode);
-
-          rprev = NULL;
-          for (r = thecache; r; r = r->next)
-            if (r == e)
+      /* Process all slots which became due since the last call.
+       * After a long sleep looking at each slot once is sufficient.  */
+      if (now - timer_now > TIMER_WHEEL_SLOTS)
+        timer_now = now - TIMER_WHEEL_SLOTS;
+      for (t = timer_now + 1; t <= now && timer_count; t++)
+        for (e = timer_wheel[t & (TIMER_WHEEL_SLOTS - 1)]; e; e = enext)
+          {
+            enext = e->t.next;
+            if (e->t.when > now)
+              continue;  /* Inserted after TIMER_NOW was updated.  */
+            remove_from_timer_wheel (e);
+            /* Note that do_expire may re-insert E in front of a slot;
+             * thus it won't be visited again here.  */
+            if (do_expire (e))
               {
-                if (!rprev)
-                  thecache = r->next;
-                else
-                  rprev->next = r->next;
-                break;
+                if (DBG_CACHE)
+                  log_debug ("  removed '%s'.%d (mode %d)"
+                             " (slot not used for 30m)\n",
+                             e->key, e->restricted, e->cache_mode);
+                remove_cache_item (e);
               }
-            else
-              rprev = r;
-
-          remove_from_timer_list_new (e);
-
-          xfree (e);
-        }
-    }
-
-  if (expired || !the_timer_list)
-    timeout.tv_sec = timeout.tv_nsec = 0;
-
-  for (e = the_timer_list_new; e; e = enext)
-    {
-      enext = e->t.next;
-      e->t.next = NULL;
-      insert_to_timer_list (&timeout, e);
+          }
     }
-  the_timer_list_new = NULL;
-
-  if (!the_timer_list)
-    tp = NULL;
-  else
+  if (timer_now < now)
+    timer_now = now;
+  cascade_timer_overflow ();
+
+  /* Compute the time for the next call: the first non-empty slot or
+   * the time the overflow list needs to be cascaded.  */
+  tp = NULL;
+  timer_armed = 0;
+  if (timer_count)
     {
-      if (the_timer_list->t.tv_sec != 0)
-        {
-          timeout.tv_sec += the_timer_list->t.tv_sec;
-          the_timer_list->t.tv_sec = 0;
-        }
-
-      npth_timeradd (&timeout, &curtime, &abstime);
+      for (t = now + 1; t < now + TIMER_WHEEL_SLOTS; t++)
+        if (timer_wheel[t & (TIMER_WHEEL_SLOTS - 1)])
+          break;
+      if (timer_overflow
+          && timer_overflow_min - TIMER_WHEEL_SLOTS / 2 < t)
+        t = timer_overflow_min - TIMER_WHEEL_SLOTS / 2;
+      if (t <= now)
+        t = now + 1;
+      timer_armed = t;
+      timeout.tv_sec = t - now;
+      timeout.tv_nsec = 0;
       tp = &timeout;
     }
 
@@ -514,29 +642,34 @@ void
 agent_flush_cache (int pincache_only)
 {
   ITEM r;
+  unsigned int i;
   int res;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
 
+  if (!pincache_only)
+    agent_keycache_flush ();
+
   res = npth_mutex_lock (&cache_lock);
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-          update_expiration (r, 0);
-        }
-    }
+  for (i=0; i < cache_table_size; i++)
+    for (r=cache_table[i]; r; r = r->next)
+      {
+        if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+          continue;
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+            release_data (r->pw);
+            r->pw = NULL;
+            r->accessed = 0;
+            update_expiration (r, 0);
+          }
+      }
 
   res = npth_mutex_unlock (&cache_lock);
   if (res)
@@ -593,7 +726,15 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  if (data && (err = grow_cache_table ()))
+    {
+      log_error ("error inserting cache item: %s\n", gpg_strerror (err));
+      goto out;
+    }
+  if (!cache_table)
+    goto out;  /* Nothing to delete.  */
+
+  for (r = *cache_bucket (key); r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN && data)
         {
@@ -650,8 +791,12 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              memstat_alloc (MEMSTAT_AGENT_CACHE, sizeof *r + strlen (key));
+              ITEM *bucket = cache_bucket (key);
+
+              r->next = *bucket;
+              *bucket = r;
+              cache_items++;
               update_expiration (r, 1);
             }
         }
@@ -701,7 +846,10 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
                key, restricted, cache_mode,
                last_stored? " (stored cache key)":"");
 
-  for (r=thecache; r; r = r->next)
+  if (!cache_table)
+    goto out;
+
+  for (r = *cache_bucket (key); r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN)
         yes = (r->pw && !strcmp (r->key, key));
@@ -753,6 +901,7 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
     log_debug ("... miss\n");
 
  out:
+  metric_add (value? metric_cache_hits : metric_cache_misses, 1);
   res = npth_mutex_unlock (&cache_lock);
   if (res)
     log_fatal ("failed to release cache mutex: %s\n", strerror (res));
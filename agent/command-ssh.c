@@ -247,6 +247,21 @@ struct key_collection_s
 };
 
 
+/* A cache for the answer to the "request_identities" command.  The
+ * answer stays valid as long as neither the key files, the sshcontrol
+ * file nor the set of keys on the cards change.  */
+static struct
+{
+  int valid;
+  unsigned long keyindex_gen;          /* Generation of the key index.  */
+  struct keycache_stamp_s sshcontrol;  /* State of the sshcontrol file.  */
+  char *cards;                         /* Keygrips and S/Ns of card keys.  */
+  void *blobs;                         /* The encoded keys.  */
+  size_t blobslen;
+  u32 count;                           /* Number of keys in BLOBS.  */
+} identities_cache;
+
+
 /* Prototypes.  */
 static gpg_error_t ssh_handler_request_identities (ctrl_t ctrl,
 						   estream_t request,
@@ -2573,6 +2588,113 @@ compare_key_collection_items (const void *arg_a, const void *arg_b)
 }
 
 
+/* Store the state of the sshcontrol file at STAMP.  If the file
+ * does not exist a cleared STAMP is returned.  */
+static void
+sshcontrol_stamp (struct keycache_stamp_s *stamp)
+{
+  char *fname;
+  struct stat st;
+
+  memset (stamp, 0, sizeof *stamp);
+  fname = make_filename_try (gnupg_homedir (), SSH_CONTROL_FILE_NAME, NULL);
+  if (fname && !gnupg_stat (fname, &st))
+    {
+      stamp->size = st.st_size;
+      stamp->ino = st.st_ino;
+      stamp->mtime = st.st_mtime;
+    }
+  xfree (fname);
+}
+
+
+/* Return a string describing the keys in the list of card keys
+ * LIST.  Returns NULL if out of core.  */
+static char *
+card_keys_string (struct card_key_info_s *list)
+{
+  membuf_t mb;
+  struct card_key_info_s *l;
+
+  init_membuf (&mb, 256);
+  for (l = list; l; l = l->next)
+    {
+      put_membuf_str (&mb, l->keygrip);
+      put_membuf (&mb, ":", 1);
+      if (l->serialno)
+        put_membuf_str (&mb, l->serialno);
+      put_membuf (&mb, ";", 1);
+    }
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Drop the cached identities.  */
+static void
+flush_identities_cache (void)
+{
+  identities_cache.valid = 0;
+  xfree (identities_cache.cards);
+  identities_cache.cards = NULL;
+  xfree (identities_cache.blobs);
+  identities_cache.blobs = NULL;
+  identities_cache.blobslen = 0;
+  identities_cache.count = 0;
+}
+
+
+/* Store the COUNT keys written to KEY_BLOBS starting at offset START
+ * in the identities cache.  GEN, STAMP and CARDS describe the state
+ * used to create them.  The function takes ownership of CARDS.  */
+static void
+put_identities_cache (estream_t key_blobs, gpgrt_off_t start, u32 count,
+                      unsigned long gen, const struct keycache_stamp_s *stamp,
+                      char *cards)
+{
+  gpgrt_off_t end;
+  size_t len, nread;
+  void *blobs = NULL;
+
+  flush_identities_cache ();
+
+  /* Do not cache if the key index is not available or if sshcontrol
+   * has been changed so recently that another change might not be
+   * detectable by its modification time.  */
+  if (!gen || (stamp->mtime && stamp->mtime + 1 >= time (NULL)))
+    goto leave;
+
+  end = es_ftello (key_blobs);
+  if (end < start)
+    goto leave;
+  len = end - start;
+  blobs = xtrymalloc (len? len : 1);
+  if (!blobs)
+    goto leave;
+  if (es_fseeko (key_blobs, start, SEEK_SET)
+      || es_read (key_blobs, blobs, len, &nread) || nread != len
+      || es_fseeko (key_blobs, end, SEEK_SET))
+    {
+      es_fseeko (key_blobs, end, SEEK_SET);
+      goto leave;
+    }
+
+  identities_cache.keyindex_gen = gen;
+  identities_cache.sshcontrol = *stamp;
+  identities_cache.cards = cards;
+  cards = NULL;
+  identities_cache.blobs = blobs;
+  blobs = NULL;
+  identities_cache.blobslen = len;
+  identities_cache.count = count;
+  identities_cache.valid = 1;
+
+ leave:
+  xfree (blobs);
+  xfree (cards);
+}
+
+
 static gpg_error_t
 ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
 {
@@ -2587,14 +2709,47 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
   gcry_sexp_t key_public = NULL;
   int count, skipped;
   struct key_collection_s keyarray = { NULL };
-
-  err = open_control_file (&cf, 0);
-  if (err)
-    return err;
+  unsigned long keyindex_gen;
+  struct keycache_stamp_s stamp;
+  char *cards;
+  gpgrt_off_t start;
 
   /* First, get information keys available on cards on-line. */
   keyinfo_on_cards = get_ssh_keyinfo_on_cards (ctrl);
 
+  /* Use the cached answer if nothing has changed since it was
+   * created.  The state is taken before reading anything so that a
+   * concurrent change invalidates the new answer.  */
+  keyindex_gen = agent_keyindex_generation ();
+  sshcontrol_stamp (&stamp);
+  cards = card_keys_string (keyinfo_on_cards);
+  if (identities_cache.valid && cards
+      && identities_cache.keyindex_gen == keyindex_gen
+      && identities_cache.sshcontrol.size == stamp.size
+      && identities_cache.sshcontrol.ino == stamp.ino
+      && identities_cache.sshcontrol.mtime == stamp.mtime
+      && !strcmp (identities_cache.cards, cards))
+    {
+      if (DBG_CACHE)
+        log_debug ("ssh: using cached identities\n");
+      xfree (cards);
+      agent_card_free_keyinfo (keyinfo_on_cards);
+      if (es_write (key_blobs, identities_cache.blobs,
+                    identities_cache.blobslen, NULL))
+        return gpg_error_from_syserror ();
+      *r_key_counter = identities_cache.count;
+      return 0;
+    }
+  start = es_ftello (key_blobs);
+
+  err = open_control_file (&cf, 0);
+  if (err)
+    {
+      xfree (cards);
+      agent_card_free_keyinfo (keyinfo_on_cards);
+      return err;
+    }
+
   /* Look at all the registered and non-disabled keys, in sshcontrol.  */
   /* And, look at all keys with "Use-for-ssh:" flag.  */
   dirname = make_filename_try (gnupg_homedir (),
@@ -2604,6 +2759,7 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
       err = gpg_error_from_syserror ();
       ssh_close_control_file (cf);
       agent_card_free_keyinfo (keyinfo_on_cards);
+      xfree (cards);
       return err;
     }
   dir = gnupg_opendir (dirname);
@@ -2613,6 +2769,7 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
       xfree (dirname);
       ssh_close_control_file (cf);
       agent_card_free_keyinfo (keyinfo_on_cards);
+      xfree (cards);
       return err;
     }
   xfree (dirname);
@@ -2776,7 +2933,13 @@ ssh_send_available_keys (ctrl_t ctrl, estream_t key_blobs, u32 *r_key_counter)
     }
   *r_key_counter = count - skipped;
 
+  if (cards)
+    put_identities_cache (key_blobs, start, *r_key_counter,
+                          keyindex_gen, &stamp, cards);
+  cards = NULL;
+
  leave:
+  xfree (cards);
   agent_card_free_keyinfo (keyinfo_on_cards);
   free_key_array (&keyarray);
   return err;
@@ -3690,6 +3853,8 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
   unsigned char *request_data = NULL;
   u32 request_data_size;
   u32 response_size;
+  void *response_data = NULL;
+  size_t response_data_len;
 
   /* Create memory streams for request/response data.  The entire
      request will be stored in secure memory, since it might contain
@@ -3728,10 +3893,10 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
       /* Unknown request; FIXME.  */
     }
 
-  if (spec->secret_input)
-    request = es_mopen (NULL, 0, 0, 1, realloc_secure, gcry_free, "r+b");
-  else
-    request = es_mopen (NULL, 0, 0, 1, gcry_realloc, gcry_free, "r+b");
+  /* The request has already been read into secure memory; the
+     handler parses it in place without the request type.  */
+  request = es_mopen (request_data + 1, request_data_size - 1,
+                      request_data_size - 1, 0, NULL, NULL, "rb");
   if (! request)
     {
       err = gpg_error_from_syserror ();
@@ -3743,10 +3908,6 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
       err = gpg_error_from_syserror ();
       goto out;
     }
-  err = stream_write_data (request, request_data + 1, request_data_size - 1);
-  if (err)
-    goto out;
-  es_rewind (request);
 
   response = es_fopenmem (0, "r+b");
   if (! response)
@@ -3754,6 +3915,11 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
       err = gpg_error_from_syserror ();
       goto out;
     }
+  /* Reserve space for the length of the response so that the entire
+     message can be sent with one write.  */
+  err = stream_write_uint32 (response, 0);
+  if (err)
+    goto out;
 
   if (opt.verbose)
     log_info ("ssh request handler for %s (%u) started\n",
@@ -3777,26 +3943,24 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
       goto out;
     }
 
-  response_size = es_ftell (response);
+  response_size = es_ftell (response) - 4;
   if (opt.verbose > 1)
     log_info ("sending ssh response of length %u\n",
               (unsigned int)response_size);
 
   err = es_fseek (response, 0, SEEK_SET);
+  if (!err)
+    err = stream_write_uint32 (response, response_size);
+  if (!err && es_fclose_snatch (response, &response_data, &response_data_len))
+    err = gpg_error_from_syserror ();
+  response = NULL;
   if (err)
     {
       send_err = 1;
       goto out;
     }
 
-  err = stream_write_uint32 (stream_sock, response_size);
-  if (err)
-    {
-      send_err = 1;
-      goto out;
-    }
-
-  err = stream_copy (stream_sock, response);
+  err = stream_write_data (stream_sock, response_data, response_data_len);
   if (err)
     goto out;
 
@@ -3812,12 +3976,12 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
 
   if (send_err)
     {
+      static const unsigned char failure[5] =
+        { 0, 0, 0, 1, SSH_RESPONSE_FAILURE };
+
       if (opt.verbose > 1)
         log_info ("sending ssh error response\n");
-      err = stream_write_uint32 (stream_sock, 1);
-      if (err)
-	goto leave;
-      err = stream_write_byte (stream_sock, SSH_RESPONSE_FAILURE);
+      err = stream_write_data (stream_sock, failure, sizeof failure);
       if (err)
 	goto leave;
     }
@@ -3826,6 +3990,7 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
 
   es_fclose (request);
   es_fclose (response);
+  es_free (response_data);
   xfree (request_data);
 
   return !!err;
@@ -41,6 +41,8 @@
 #include "../common/ssh-utils.h"
 #include "../common/asshelp.h"
 #include "../common/server-help.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
 
 
 /* Maximum allowed size of the inquired ciphertext.  */
@@ -49,6 +51,12 @@
 #define MAXLEN_KEYPARAM 1024
 /* Maximum allowed size of key data as used in inquiries (bytes). */
 #define MAXLEN_KEYDATA 8192
+/* Maximum number of digests for one PKSIGN_MULTI command.  */
+#define MAX_PKSIGN_MULTI 1024
+/* Maximum number of ciphertexts for one PKDECRYPT_MULTI command.  */
+#define MAX_PKDECRYPT_MULTI 256
+/* Maximum number of keys for one PKDECRYPT_ANY command.  */
+#define MAX_PKDECRYPT_ANY 64
 /* Maximum length of a secret to store under one key.  */
 #define MAXLEN_PUT_SECRET 4096
 /* The size of the import/export KEK key (in bytes).  */
@@ -476,6 +484,66 @@ get_keyinfo_on_cards (ctrl_t ctrl)
 }
 
 
+/* Store the keygrips of all keys in the private key directory as an
+ * array of R_COUNT items of KEYGRIP_LEN bytes each at R_GRIPS.  The
+ * caller must release the array.  The keygrips are taken from the
+ * key index if available.  */
+static gpg_error_t
+list_key_grips (unsigned char **r_grips, unsigned int *r_count)
+{
+  gpg_error_t err;
+  char *dirname;
+  gnupg_dir_t dir;
+  gnupg_dirent_t dir_entry;
+  char hexgrip[41];
+  unsigned char grip[KEYGRIP_LEN];
+  membuf_t mb;
+  unsigned int count;
+
+  err = agent_keyindex_grips (r_grips, r_count);
+  if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+    return err;
+
+  /* No index - read the directory.  */
+  dirname = make_filename_try (gnupg_homedir (),
+                               GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!dirname)
+    return gpg_error_from_syserror ();
+  dir = gnupg_opendir (dirname);
+  if (!dir)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (dirname);
+      return err;
+    }
+  xfree (dirname);
+
+  init_membuf (&mb, 1024);
+  count = 0;
+  while ((dir_entry = gnupg_readdir (dir)))
+    {
+      if (strlen (dir_entry->d_name) != 44
+          || strcmp (dir_entry->d_name + 40, ".key"))
+        continue;
+      strncpy (hexgrip, dir_entry->d_name, 40);
+      hexgrip[40] = 0;
+
+      if ( hex2bin (hexgrip, grip, 20) < 0 )
+        continue; /* Bad hex string.  */
+
+      put_membuf (&mb, grip, KEYGRIP_LEN);
+      count++;
+    }
+  gnupg_closedir (dir);
+
+  *r_grips = get_membuf (&mb, NULL);
+  if (!*r_grips)
+    return gpg_error_from_syserror ();
+  *r_count = count;
+  return 0;
+}
+
+
 
 static const char hlp_geteventcounter[] =
   "GETEVENTCOUNTER\n"
@@ -655,10 +723,8 @@ cmd_havekey (assuan_context_t ctx, char *line)
   int list_mode = 0;  /* Less than 0 for no limit.  */
   int info_mode = 0;
   int counter;
-  char *dirname = NULL;
-  gnupg_dir_t dir = NULL;
-  gnupg_dirent_t dir_entry;
-  char hexgrip[41];
+  unsigned char *grips = NULL;
+  unsigned int ngrips, idx;
   struct card_key_info_s *keyinfo_on_cards, *l;
 
   if (has_option (line, "--info"))
@@ -724,48 +790,26 @@ cmd_havekey (assuan_context_t ctx, char *line)
     }
 
   /* List mode.  */
-  dir = NULL;
-  dirname = NULL;
-
   if (ctrl->restricted)
     {
       err = gpg_error (GPG_ERR_FORBIDDEN);
       goto leave;
     }
 
-  dirname = make_filename_try (gnupg_homedir (),
-                               GNUPG_PRIVATE_KEYS_DIR, NULL);
-  if (!dirname)
-    {
-      err = gpg_error_from_syserror ();
-      goto leave;
-    }
-  dir = gnupg_opendir (dirname);
-  if (!dir)
-    {
-      err = gpg_error_from_syserror ();
-      goto leave;
-    }
+  err = list_key_grips (&grips, &ngrips);
+  if (err)
+    goto leave;
 
   counter = 0;
-  while ((dir_entry = gnupg_readdir (dir)))
+  for (idx=0; idx < ngrips; idx++)
     {
-      if (strlen (dir_entry->d_name) != 44
-          || strcmp (dir_entry->d_name + 40, ".key"))
-        continue;
-      strncpy (hexgrip, dir_entry->d_name, 40);
-      hexgrip[40] = 0;
-
-      if ( hex2bin (hexgrip, grip, 20) < 0 )
-        continue; /* Bad hex string.  */
-
       if (list_mode > 0 && ++counter > list_mode)
         {
           err = gpg_error (GPG_ERR_TRUNCATED);
           goto leave;
         }
 
-      err = assuan_send_data (ctx, grip, 20);
+      err = assuan_send_data (ctx, grips + idx * KEYGRIP_LEN, KEYGRIP_LEN);
       if (err)
         goto leave;
     }
@@ -791,8 +835,7 @@ cmd_havekey (assuan_context_t ctx, char *line)
   err = 0;
 
  leave:
-  gnupg_closedir (dir);
-  xfree (dirname);
+  xfree (grips);
   return leave_cmd (ctx, err);
 }
 
@@ -1050,6 +1093,98 @@ cmd_pksign (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_pksign_multi[] =
+  "PKSIGN_MULTI <algonumber> <n> [<cache_nonce>]\n"
+  "\n"
+  "Sign N digests, all computed with the hash algorithm ALGONUMBER,\n"
+  "using the key set by SIGKEY.  The digests are inquired using the\n"
+  "keyword DIGESTS and must be sent concatenated in binary form.  The\n"
+  "signatures are returned in the same order as one data block of\n"
+  "concatenated canonical encoded S-expressions.  The key is\n"
+  "unprotected only once for all digests.  Neither input nor output\n"
+  "are sensitive to eavesdropping.";
+static gpg_error_t
+cmd_pksign_multi (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  cache_mode_t cache_mode = CACHE_MODE_NORMAL;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  membuf_t outbuf;
+  char *cache_nonce = NULL;
+  unsigned char *digests = NULL;
+  size_t digestslen;
+  size_t dlen;
+  unsigned long count;
+  int algo;
+  char *p, *endp;
+
+  line = skip_options (line);
+
+  algo = (int)strtoul (line, &endp, 10);
+  if (endp == line || !algo || gcry_md_test_algo (algo))
+    {
+      err = set_error (GPG_ERR_UNSUPPORTED_ALGORITHM, NULL);
+      goto leave;
+    }
+  dlen = gcry_md_get_algo_dlen (algo);
+  if (!dlen || dlen > MAX_DIGEST_LEN)
+    {
+      err = set_error (GPG_ERR_UNSUPPORTED_ALGORITHM, NULL);
+      goto leave;
+    }
+  for (line = endp; *line == ' ' || *line == '\t'; line++)
+    ;
+  count = strtoul (line, &endp, 10);
+  if (endp == line || !count || count > MAX_PKSIGN_MULTI)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER, "invalid number of digests");
+      goto leave;
+    }
+  for (line = endp; *line == ' ' || *line == '\t'; line++)
+    ;
+  for (p=line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  *p = '\0';
+  if (*line)
+    cache_nonce = xtrystrdup (line);
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%zu", count * dlen);
+  if (!err)
+    err = assuan_inquire (ctx, "DIGESTS", &digests, &digestslen,
+                          count * dlen);
+  if (err)
+    goto leave;
+  if (digestslen != count * dlen)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER,
+                       "length of digests does not match");
+      goto leave;
+    }
+
+  if (opt.ignore_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+  else if (!ctrl->server_local->use_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+
+  init_membuf (&outbuf, 512 * count);
+
+  err = agent_pksign_multi (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                            algo, digests, dlen, (unsigned int)count,
+                            &outbuf, cache_mode);
+  if (err)
+    clear_outbuf (&outbuf);
+  else
+    err = write_and_clear_outbuf (ctx, &outbuf);
+
+ leave:
+  xfree (digests);
+  xfree (cache_nonce);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_pkdecrypt[] =
   "PKDECRYPT [--kem[=<kemid>] [<options>]\n"
   "\n"
@@ -1131,6 +1266,214 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_pkdecrypt_multi[] =
+  "PKDECRYPT_MULTI <n>\n"
+  "\n"
+  "Decrypt N ciphertexts using the key set by SETKEY.  The ciphertexts\n"
+  "are inquired using the keyword CIPHERTEXTS and must be sent as\n"
+  "concatenated canonical encoded S-expressions as used by PKDECRYPT.\n"
+  "The results are returned in the same order as one data block of\n"
+  "concatenated canonical encoded S-expressions; an item which could\n"
+  "not be decrypted is returned as \"(error <errorcode>)\".  For items\n"
+  "with a known padding the status line \"PADDING <index> <padding>\" is\n"
+  "emitted.  The key is unprotected only once for all ciphertexts.\n"
+  "KEM decryption is not supported by this command.  Input is not\n"
+  "sensitive to eavesdropping.";
+static gpg_error_t
+cmd_pkdecrypt_multi (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  unsigned char *value = NULL;
+  size_t valuelen;
+  membuf_t outbuf;
+  int *padding = NULL;
+  unsigned long count;
+  unsigned int i;
+  char *endp;
+
+  line = skip_options (line);
+  count = strtoul (line, &endp, 10);
+  if (endp == line || !count || count > MAX_PKDECRYPT_MULTI)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER,
+                       "invalid number of ciphertexts");
+      goto leave;
+    }
+
+  padding = xtrycalloc (count, sizeof *padding);
+  if (!padding)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%lu",
+                             count * MAXLEN_CIPHERTEXT);
+  if (!err)
+    err = assuan_inquire (ctx, "CIPHERTEXTS", &value, &valuelen,
+                          count * MAXLEN_CIPHERTEXT);
+  if (err)
+    goto leave;
+
+  init_membuf (&outbuf, 512 * count);
+
+  err = agent_pkdecrypt_multi (ctrl, ctrl->server_local->keydesc,
+                               value, valuelen, (unsigned int)count,
+                               &outbuf, padding);
+  if (err)
+    clear_outbuf (&outbuf);
+  else
+    {
+      for (i=0; !err && i < count; i++)
+        if (padding[i] != -1)
+          err = print_assuan_status (ctx, "PADDING", "%u %d", i, padding[i]);
+      if (!err)
+        err = write_and_clear_outbuf (ctx, &outbuf);
+      else
+        clear_outbuf (&outbuf);
+    }
+
+ leave:
+  xfree (value);
+  xfree (padding);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, err);
+}
+
+
+static const char hlp_pkdecrypt_any[] =
+  "PKDECRYPT_ANY <n>\n"
+  "\n"
+  "Try to decrypt with N keys, for example to find the key for a\n"
+  "message with an anonymous recipient.  The keygrips are inquired using\n"
+  "the keyword KEYGRIPS as hex strings separated by white space; the\n"
+  "ciphertexts using the keyword CIPHERTEXTS as concatenated canonical\n"
+  "encoded S-expressions as used by PKDECRYPT, the first for the first\n"
+  "key and so on.  The results are returned as done by PKDECRYPT_MULTI.\n"
+  "Only keys which can be used without a pinentry or a smartcard are\n"
+  "tried; the other keys are returned with the error code for \"Not\n"
+  "supported\" and need to be tried using PKDECRYPT.  The decryptions\n"
+  "run concurrently.  Which result is a session key needs to be checked\n"
+  "by the client.  KEM decryption is not supported by this command.";
+static gpg_error_t
+cmd_pkdecrypt_any (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  unsigned char *value = NULL;
+  unsigned char *grips = NULL;
+  unsigned char (*bingrips)[20] = NULL;
+  size_t valuelen, gripslen;
+  membuf_t outbuf;
+  unsigned long count;
+  unsigned int i;
+  char *string = NULL;
+  char *p, *endp;
+  int n;
+
+  line = skip_options (line);
+  count = strtoul (line, &endp, 10);
+  if (endp == line || !count || count > MAX_PKDECRYPT_ANY)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER, "invalid number of keys");
+      goto leave;
+    }
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%lu", count * 41);
+  if (!err)
+    err = assuan_inquire (ctx, "KEYGRIPS", &grips, &gripslen, count * 41);
+  if (!err)
+    err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%lu",
+                               count * MAXLEN_CIPHERTEXT);
+  if (!err)
+    err = assuan_inquire (ctx, "CIPHERTEXTS", &value, &valuelen,
+                          count * MAXLEN_CIPHERTEXT);
+  if (err)
+    goto leave;
+
+  string = xtrymalloc (gripslen + 1);
+  bingrips = xtrycalloc (count, sizeof *bingrips);
+  if (!string || !bingrips)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (string, grips, gripslen);
+  string[gripslen] = 0;
+  for (i=0, p=string; i < count; i++, p += n)
+    {
+      while (spacep (p) || *p == '\n')
+        p++;
+      n = hex2bin (p, bingrips[i], 20);
+      if (n < 0)
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid keygrip");
+          goto leave;
+        }
+    }
+
+  init_membuf (&outbuf, 512 * count);
+
+  err = agent_pkdecrypt_any (ctrl, (const unsigned char (*)[20])bingrips,
+                             value, valuelen, (unsigned int)count, &outbuf);
+  if (err)
+    clear_outbuf (&outbuf);
+  else
+    err = write_and_clear_outbuf (ctx, &outbuf);
+
+ leave:
+  xfree (value);
+  xfree (grips);
+  xfree (string);
+  xfree (bingrips);
+  return leave_cmd (ctx, err);
+}
+
+
+static const char hlp_pregen[] =
+  "PREGEN <n>\n"
+  "\n"
+  "Announce that N keys with the same parameters will soon be created\n"
+  "with GENKEY.  The parameters are inquired using the keyword KEYPARAM\n"
+  "and must be sent exactly as they will later be sent to GENKEY.  The\n"
+  "keys are generated in the background and a GENKEY with these\n"
+  "parameters takes one of them instead of generating a new key.  This\n"
+  "command fails with GPG_ERR_NOT_ENABLED unless gpg-agent has been\n"
+  "started with --genkey-threads.";
+static gpg_error_t
+cmd_pregen (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  unsigned long count;
+  char *endp;
+
+  if (ctrl->restricted)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
+
+  line = skip_options (line);
+  count = strtoul (line, &endp, 10);
+  if (endp == line || !count)
+    return leave_cmd (ctx, set_error (GPG_ERR_ASS_PARAMETER,
+                                      "invalid number of keys"));
+  if (!opt.genkey_threads)
+    return leave_cmd (ctx, gpg_error (GPG_ERR_NOT_ENABLED));
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_KEYPARAM);
+  if (!err)
+    err = assuan_inquire (ctx, "KEYPARAM", &value, &valuelen,
+                          MAXLEN_KEYPARAM);
+  if (!err)
+    err = agent_genkey_pregen ((char*)value, valuelen, count);
+  xfree (value);
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_genkey[] =
   "GENKEY [--no-protection] [--preset] [--timestamp=<isodate>]\n"
   "       [--inq-passwd] [--passwd-nonce=<s>] [<cache_nonce>]\n"
@@ -1378,7 +1721,9 @@ static const char hlp_readkey[] =
   "                    --card <keyid>\n"
   "\n"
   "Return the public key for the given keygrip or keyid.\n"
-  "With --card, private key file with card information will be created.";
+  "With --card, private key file with card information will be created.\n"
+  "If an OUTPUT descriptor has been set, the key is written to it instead\n"
+  "of being returned as D lines.";
 static gpg_error_t
 cmd_readkey (assuan_context_t ctx, char *line)
 {
@@ -1502,7 +1847,7 @@ cmd_readkey (assuan_context_t ctx, char *line)
         }
     }
 
-  rc = opt_no_data? 0 : assuan_send_data (ctx, pkbuf, pkbuflen);
+  rc = opt_no_data? 0 : send_data_or_output (ctx, pkbuf, pkbuflen);
 
  leave:
   xfree (pkbuf);
@@ -1761,7 +2106,7 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   int err;
   unsigned char grip[20];
-  gnupg_dir_t dir = NULL;
+  unsigned char *grips = NULL;
   int list_mode;
   int opt_data, opt_ssh_fpr, opt_with_ssh;
   ssh_control_file_t cf = NULL;
@@ -1847,35 +2192,16 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
     }
   else if (list_mode)
     {
-      char *dirname;
-      gnupg_dirent_t dir_entry;
+      unsigned int ngrips, idx;
 
-      dirname = make_filename_try (gnupg_homedir (),
-                                   GNUPG_PRIVATE_KEYS_DIR, NULL);
-      if (!dirname)
-        {
-          err = gpg_error_from_syserror ();
-          goto leave;
-        }
-      dir = gnupg_opendir (dirname);
-      if (!dir)
-        {
-          err = gpg_error_from_syserror ();
-          xfree (dirname);
-          goto leave;
-        }
-      xfree (dirname);
+      err = list_key_grips (&grips, &ngrips);
+      if (err)
+        goto leave;
 
-      while ( (dir_entry = gnupg_readdir (dir)) )
+      for (idx=0; idx < ngrips; idx++)
         {
-          if (strlen (dir_entry->d_name) != 44
-              || strcmp (dir_entry->d_name + 40, ".key"))
-            continue;
-          strncpy (hexgrip, dir_entry->d_name, 40);
-          hexgrip[40] = 0;
-
-          if ( hex2bin (hexgrip, grip, 20) < 0 )
-            continue; /* Bad hex string.  */
+          memcpy (grip, grips + idx * KEYGRIP_LEN, KEYGRIP_LEN);
+          bin2hex (grip, KEYGRIP_LEN, hexgrip);
 
           disabled = ttl = confirm = is_ssh = 0;
           if (opt_with_ssh)
@@ -1932,7 +2258,7 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
  leave:
   xfree (need_attr);
   ssh_close_control_file (cf);
-  gnupg_closedir (dir);
+  xfree (grips);
   if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
     leave_cmd (ctx, err);
   return err;
@@ -3037,7 +3363,10 @@ static const char hlp_export_key[] =
   "compatible passphrase-protected form.  In --mode1003 the secret key\n"
   "is exported as s-expression as stored locally.  Without those options,\n"
   "the secret key material will be exported in the clear (after prompting\n"
-  "the user to unlock it, if needed).\n";
+  "the user to unlock it, if needed).\n"
+  "\n"
+  "If an OUTPUT descriptor has been set, the wrapped key is written to it\n"
+  "instead of being returned as D lines.\n";
 static gpg_error_t
 cmd_export_key (assuan_context_t ctx, char *line)
 {
@@ -3189,7 +3518,7 @@ cmd_export_key (assuan_context_t ctx, char *line)
   cipherhd = NULL;
 
   assuan_begin_confidential (ctx);
-  err = assuan_send_data (ctx, wrappedkey, wrappedkeylen);
+  err = send_data_or_output (ctx, wrappedkey, wrappedkeylen);
   assuan_end_confidential (ctx);
 
 
@@ -3922,6 +4251,11 @@ static const char hlp_getinfo[] =
   "  std_startup_env - List the standard startup environment.\n"
   "  getenv NAME     - Return value of envvar NAME.\n"
   "  connections     - Return number of active connections.\n"
+  "  metrics         - Return the metrics in the Prometheus text format.\n"
+  "  cmdstats [--reset]\n"
+  "                  - Return the statistics of the commands and\n"
+  "                    optionally reset them.\n"
+  "  memstat         - Return the memory used by the subsystems.\n"
   "  jent_active     - Returns OK if Libgcrypt's JENT is active.\n"
   "  ephemeral       - Returns OK if the connection is in ephemeral mode.\n"
   "  restricted      - Returns OK if the connection is in restricted mode.\n"
@@ -4087,6 +4421,38 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 get_agent_active_connection_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *buf = metrics_format ();
+
+      if (!buf)
+        rc = gpg_error_from_syserror ();
+      else
+        rc = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+    }
+  else if (!strcmp (line, "cmdstats") || !strcmp (line, "cmdstats --reset"))
+    {
+      char *buf = metrics_format_cmdstats ();
+
+      if (!buf)
+        rc = gpg_error_from_syserror ();
+      else
+        rc = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+      if (!rc && line[8])
+        metrics_reset_commands ();
+    }
+  else if (!strcmp (line, "memstat"))
+    {
+      char *buf = memstat_format ();
+
+      if (!buf)
+        rc = gpg_error_from_syserror ();
+      else
+        rc = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+    }
   else if (!strcmp (line, "jent_active"))
     {
       char *buf;
@@ -4244,17 +4610,34 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  metrics_command_begin (ctx, cmd);
+  return 0;
+}
+
+
 /* Called by libassuan after all commands. ERR is the error from the
    last assuan operation and not the one returned from the command. */
 static void
 post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
+  const char *name;
 
   (void)err;
 
+  metrics_command_end (ctx);
+
   /* Switch off any I/O monitor controlled logging pausing. */
   ctrl->server_local->pause_io_logging = 0;
+
+  /* An output descriptor is only used by the next command.  */
+  name = assuan_get_command_name (ctx);
+  if (!name || strcmp (name, "OUTPUT"))
+    assuan_close_output_fd (ctx);
 }
 
 
@@ -4348,8 +4731,12 @@ register_commands (assuan_context_t ctx)
     { "SETKEYDESC",     cmd_setkeydesc,hlp_setkeydesc },
     { "SETHASH",        cmd_sethash,   hlp_sethash },
     { "PKSIGN",         cmd_pksign,    hlp_pksign },
+    { "PKSIGN_MULTI",   cmd_pksign_multi, hlp_pksign_multi },
     { "PKDECRYPT",      cmd_pkdecrypt, hlp_pkdecrypt },
+    { "PKDECRYPT_MULTI", cmd_pkdecrypt_multi, hlp_pkdecrypt_multi },
+    { "PKDECRYPT_ANY",  cmd_pkdecrypt_any, hlp_pkdecrypt_any },
     { "GENKEY",         cmd_genkey,    hlp_genkey },
+    { "PREGEN",         cmd_pregen,    hlp_pregen },
     { "READKEY",        cmd_readkey,   hlp_readkey },
     { "GET_PASSPHRASE", cmd_get_passphrase, hlp_get_passphrase },
     { "PRESET_PASSPHRASE", cmd_preset_passphrase, hlp_preset_passphrase },
@@ -4388,6 +4775,7 @@ register_commands (assuan_context_t ctx)
       if (rc)
         return rc;
     }
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
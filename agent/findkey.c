@@ -42,9 +42,18 @@
 
 static gpg_error_t read_key_file (ctrl_t ctrl, const unsigned char *grip,
                                   gcry_sexp_t *result, nvc_t *r_keymeta,
+                                  const char * const *metanames,
                                   char **r_orig_key_value);
 static gpg_error_t is_shadowed_key (gcry_sexp_t s_skey);
 
+/* The meta data items used by agent_key_from_file and the functions
+ * it calls.  */
+static const char * const key_from_file_metanames[] =
+  { "Created:", "Confirm:", "Label:", "Prompt:", NULL };
+
+/* The meta data items used by public_key_from_file for ssh.  */
+static const char * const for_ssh_metanames[] = { "Use-for-ssh:", NULL };
+
 
 /* Helper to pass data to the check callback of the unprotect function. */
 struct try_unprotect_arg_s
@@ -73,6 +82,54 @@ fname_from_keygrip (const unsigned char *grip, int for_new)
 }
 
 
+/* Store the state of the key file for GRIP at STAMP.  This is used
+ * to detect changes of the file behind the back of the key cache.  */
+static gpg_error_t
+key_file_stamp (const unsigned char *grip, struct keycache_stamp_s *stamp)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  struct stat st;
+
+  fname = fname_from_keygrip (grip, 0);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  if (gnupg_stat (fname, &st))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      stamp->size = st.st_size;
+      stamp->ino = st.st_ino;
+      stamp->mtime = st.st_mtime;
+    }
+  xfree (fname);
+  return err;
+}
+
+
+/* Return true if the passphrase for the key with GRIP is available
+ * in the passphrase cache for CACHE_MODE.  */
+static int
+passphrase_cached_p (ctrl_t ctrl, const unsigned char *grip,
+                     cache_mode_t cache_mode)
+{
+  char hexgrip[40+1];
+  char *pw;
+
+  if (cache_mode == CACHE_MODE_IGNORE)
+    return 0;
+
+  bin2hex (grip, 20, hexgrip);
+  pw = agent_get_cache (ctrl, hexgrip, cache_mode);
+  if (!pw)
+    return 0;
+  xfree (pw);
+  if (cache_mode == CACHE_MODE_NORMAL)
+    agent_store_cache_hit (hexgrip);
+  return 1;
+}
+
+
 /* Helper until we have a "wipe" mode flag in es_fopen.  */
 static void
 wipe_and_fclose (estream_t fp)
@@ -165,7 +222,9 @@ agent_write_private_key (ctrl_t ctrl,
   if (!fname)
     return gpg_error_from_syserror ();
 
-  err = read_key_file (ctrl, grip, &key, &pk, &orig_key_value);
+  agent_keycache_drop (grip);
+
+  err = read_key_file (ctrl, grip, &key, &pk, NULL, &orig_key_value);
   if (err)
     {
       if (gpg_err_code (err) == GPG_ERR_ENOENT)
@@ -445,6 +504,8 @@ agent_update_private_key (ctrl_t ctrl, const unsigned char *grip, nvc_t pk)
   int removetmp = 0;
   int blocksigs = 0;
 
+  agent_keycache_drop (grip);
+
   if (ctrl->ephemeral_mode)
     {
       ephemeral_private_key_t ek;
@@ -1027,11 +1088,14 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
  * items are stored there.  However the "Key:" item is removed from
  * it.  If R_ORIG_KEY_VALUE is non-NULL and the Key item was removed,
  * its original value is stored at that R_ORIG_KEY_VALUE and the
- * caller must free it.  On failure returns an error code and stores
- * NULL at RESULT and R_KEYMETA. */
+ * caller must free it.  If METANAMES is not NULL only the meta data
+ * items listed in this NULL terminated array are stored at R_KEYMETA;
+ * the other items are skipped while parsing.  On failure returns an
+ * error code and stores NULL at RESULT and R_KEYMETA. */
 static gpg_error_t
 read_key_file (ctrl_t ctrl, const unsigned char *grip,
-               gcry_sexp_t *result, nvc_t *r_keymeta, char **r_orig_key_value)
+               gcry_sexp_t *result, nvc_t *r_keymeta,
+               const char * const *metanames, char **r_orig_key_value)
 {
   gpg_error_t err;
   char *fname;
@@ -1106,7 +1170,10 @@ read_key_file (ctrl_t ctrl, const unsigned char *grip,
       /* Key is in extended format.  */
       int line;
 
-      err = nvc_parse_private_key (&pk, &line, fp);
+      if (r_keymeta && !metanames)
+        err = nvc_parse_private_key (&pk, &line, fp);
+      else /* Do not store items nobody will look at.  */
+        err = nvc_parse_private_key_filtered (&pk, &line, fp, metanames);
 
       if (err)
         log_error ("error parsing '%s' line %d: %s\n",
@@ -1210,6 +1277,7 @@ remove_key_file (const unsigned char *grip)
     {
       return gpg_error_from_syserror ();
     }
+  agent_keycache_drop (grip);
   if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
   xfree (fname);
@@ -1375,6 +1443,11 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   gcry_sexp_t s_skey;
   nvc_t keymeta = NULL;
   char *desc_text_buffer = NULL;  /* Used in case we extend DESC_TEXT.  */
+  const unsigned char *keygrip;
+  struct keycache_stamp_s stamp;
+  int use_keycache;
+  int key_type;
+  time_t key_timestamp = (time_t)(-1);
 
   *result = NULL;
   if (shadow_info)
@@ -1386,9 +1459,36 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
 
   if (!grip && !ctrl->have_keygrip)
     return gpg_error (GPG_ERR_NO_SECKEY);
+  keygrip = grip? grip : ctrl->keygrip;
+
+  /* Try the cache of unprotected keys first.  A protected key is
+   * only used from there if its passphrase is still cached; thus the
+   * expiration and clearing of the passphrase cache also applies to
+   * the key cache.  If the caller wants the passphrase we need to go
+   * the long way.  The stamp is taken before the file is read so
+   * that a change while we are reading it does not go unnoticed.  */
+  use_keycache = (!ctrl->ephemeral_mode && !key_file_stamp (keygrip, &stamp));
+  if (use_keycache && !r_passphrase)
+    {
+      int is_protected;
 
-  err = read_key_file (ctrl, grip? grip : ctrl->keygrip,
-                       &s_skey, &keymeta, NULL);
+      if (!agent_keycache_get (keygrip, &stamp, &buf, &is_protected,
+                               &key_timestamp))
+        {
+          if (!is_protected || passphrase_cached_p (ctrl, keygrip, cache_mode))
+            {
+              if (r_timestamp)
+                *r_timestamp = key_timestamp;
+              goto have_key;
+            }
+          xfree (buf);
+          buf = NULL;
+          key_timestamp = (time_t)(-1);
+        }
+    }
+
+  err = read_key_file (ctrl, keygrip, &s_skey, &keymeta,
+                       key_from_file_metanames, NULL);
   if (err)
     {
       if (gpg_err_code (err) == GPG_ERR_ENOENT)
@@ -1410,12 +1510,14 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
       return err;
     }
 
-  if (r_timestamp && keymeta)
+  if (keymeta)
     {
       const char *created = nvc_get_string (keymeta, "Created:");
 
       if (created)
-        *r_timestamp = isotime2epoch (created);
+        key_timestamp = isotime2epoch (created);
+      if (r_timestamp)
+        *r_timestamp = key_timestamp;
     }
 
   if (!grip && keymeta)
@@ -1457,7 +1559,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
         }
     }
 
-  switch (agent_private_key_type (buf))
+  key_type = agent_private_key_type (buf);
+  switch (key_type)
     {
     case PRIVATE_KEY_CLEAR:
       break; /* no unprotection needed */
@@ -1521,7 +1624,7 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
         if (!err)
           {
             err = unprotect (ctrl, cache_nonce, desc_text_final, &buf,
-                             grip? grip : ctrl->keygrip,
+                             keygrip,
                              cache_mode, lookup_ttl, r_passphrase);
             if (err)
               log_error ("failed to unprotect the secret key: %s\n",
@@ -1590,6 +1693,14 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
       return err;
     }
 
+  /* Shadowed keys are cheap to read and keys which require a
+   * confirmation are not cached to keep that check simple.  */
+  if (use_keycache && key_type != PRIVATE_KEY_SHADOWED
+      && !(keymeta && nvc_get_string (keymeta, "Confirm:")))
+    agent_keycache_put (keygrip, &stamp, buf,
+                        key_type == PRIVATE_KEY_PROTECTED, key_timestamp);
+
+ have_key:
   err = sexp_sscan_private_key (result, &erroff, buf);
   xfree (buf);
   nvc_release (keymeta);
@@ -1647,7 +1758,7 @@ agent_raw_key_from_file (ctrl_t ctrl, const unsigned char *grip,
 
   *result = NULL;
 
-  err = read_key_file (ctrl, grip, &s_skey, r_keymeta, NULL);
+  err = read_key_file (ctrl, grip, &s_skey, r_keymeta, NULL, NULL);
   if (!err)
     *result = s_skey;
   return err;
@@ -1690,7 +1801,8 @@ public_key_from_file (ctrl_t ctrl, const unsigned char *grip,
   if (r_sshorder)
     *r_sshorder = 0;
 
-  err = read_key_file (ctrl, grip, &s_skey, for_ssh? &keymeta : NULL, NULL);
+  err = read_key_file (ctrl, grip, &s_skey, for_ssh? &keymeta : NULL,
+                       for_ssh_metanames, NULL);
   if (err)
     return err;
 
@@ -1836,6 +1948,13 @@ agent_key_available (ctrl_t ctrl, const unsigned char *grip)
       return -1;
     }
 
+  switch (agent_keyindex_lookup (grip, NULL))
+    {
+    case 1: return 0;
+    case 0: return -1;
+    default: break; /* No index.  */
+    }
+
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
 
@@ -1861,17 +1980,37 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
   size_t len;
   int keytype;
 
-  (void)ctrl;
-
   if (r_keytype)
     *r_keytype = PRIVATE_KEY_UNKNOWN;
   if (r_shadow_info)
     *r_shadow_info = NULL;
 
+  /* The key index knows the type of most keys.  For shadowed keys we
+   * need to read the file to get the shadow info.  */
+  if (!ctrl->ephemeral_mode)
+    {
+      switch (agent_keyindex_lookup (grip, &keytype))
+        {
+        case 0:
+          return gpg_error (GPG_ERR_NOT_FOUND);
+        case 1:
+          if (keytype != PRIVATE_KEY_UNKNOWN
+              && !(keytype == PRIVATE_KEY_SHADOWED && r_shadow_info))
+            {
+              if (r_keytype)
+                *r_keytype = keytype;
+              return 0;
+            }
+          break;
+        default:
+          break;
+        }
+    }
+
   {
     gcry_sexp_t sexp;
 
-    err = read_key_file (ctrl, grip, &sexp, NULL, NULL);
+    err = read_key_file (ctrl, grip, &sexp, NULL, NULL, NULL);
     if (err)
       {
         if (gpg_err_code (err) == GPG_ERR_ENOENT)
@@ -1921,6 +2060,8 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
 
   if (!err && r_keytype)
     *r_keytype = keytype;
+  if (!err && !ctrl->ephemeral_mode)
+    agent_keyindex_set_keytype (grip, keytype);
 
   xfree (buf);
   return err;
@@ -1961,7 +2102,7 @@ agent_delete_key (ctrl_t ctrl, const char *desc_text,
       goto leave;
     }
 
-  err = read_key_file (ctrl, grip, &s_skey, NULL, NULL);
+  err = read_key_file (ctrl, grip, &s_skey, NULL, NULL, NULL);
   if (gpg_err_code (err) == GPG_ERR_ENOENT)
     err = gpg_error (GPG_ERR_NO_SECKEY);
   if (err)
@@ -24,10 +24,326 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <npth.h>
 
 #include "agent.h"
 #include "../common/i18n.h"
 #include "../common/sysutils.h"
+#include "../common/gettime.h"
+
+
+/* The maximum number of keys generated ahead of time which are kept
+ * at once.  The private parts are in secure memory and thus this is
+ * a small number.  */
+#define PREGEN_MAX_KEYS 16
+
+/* The maximum number of keys which may be waiting for generation for
+ * one set of parameters.  */
+#define PREGEN_MAX_PENDING 10000
+
+/* Keys not taken after this many seconds are dropped.  */
+#define PREGEN_TTL (10*60)
+
+/* A key generated ahead of time.  */
+struct pregen_key_s
+{
+  struct pregen_key_s *next;
+  gcry_sexp_t key;        /* The result of gcry_pk_genkey.  */
+};
+
+/* The keys announced with agent_genkey_pregen for one set of key
+ * parameters.  */
+struct pregen_s
+{
+  struct pregen_s *next;
+  unsigned int pending;   /* Keys still to generate.  */
+  unsigned int running;   /* Keys being generated right now.  */
+  struct pregen_key_s *keys;  /* The generated keys.  */
+  time_t last_used;       /* Time of the last announcement or take.  */
+  size_t keyparamlen;
+  char keyparam[1];
+};
+
+/* A mutex to protect the pool and a condition signaled when a key
+ * has been generated.  */
+static npth_mutex_t pregen_lock;
+static npth_cond_t pregen_cond;
+
+/* The pool and the total number of generated and running keys.  */
+static struct pregen_s *pregen_list;
+static unsigned int pregen_nkeys;
+static unsigned int pregen_nrunning;
+
+/* The number of worker threads.  */
+static unsigned int pregen_nworkers;
+
+
+/* This function must be called once to initialize this module. It
+   has to be done before a second thread is spawned.  */
+void
+initialize_module_genkey (void)
+{
+  int err;
+
+  err = npth_mutex_init (&pregen_lock, NULL);
+  if (!err)
+    err = npth_cond_init (&pregen_cond, NULL);
+  if (err)
+    log_fatal ("error initializing genkey module: %s\n", strerror (err));
+}
+
+
+static void
+lock_pregen (void)
+{
+  int res;
+
+  res = npth_mutex_lock (&pregen_lock);
+  if (res)
+    log_fatal ("failed to acquire pregen mutex: %s\n", strerror (res));
+}
+
+
+static void
+unlock_pregen (void)
+{
+  int res;
+
+  res = npth_mutex_unlock (&pregen_lock);
+  if (res)
+    log_fatal ("failed to release pregen mutex: %s\n", strerror (res));
+}
+
+
+/* Return the pool entry for KEYPARAM.  Must be called with the lock
+ * held.  */
+static struct pregen_s *
+find_pregen (const char *keyparam, size_t keyparamlen)
+{
+  struct pregen_s *pg;
+
+  for (pg = pregen_list; pg; pg = pg->next)
+    if (pg->keyparamlen == keyparamlen
+        && !memcmp (pg->keyparam, keyparam, keyparamlen))
+      break;
+  return pg;
+}
+
+
+/* Remove the entries which are not used anymore or have not been
+ * used for a while.  Must be called with the lock held.  */
+static void
+expire_pregen (void)
+{
+  struct pregen_s *pg, **pgp;
+  struct pregen_key_s *k;
+  time_t now = gnupg_get_time ();
+
+  for (pgp = &pregen_list; (pg = *pgp); )
+    {
+      if (pg->last_used + PREGEN_TTL < now)
+        {
+          pg->pending = 0;
+          while ((k = pg->keys))
+            {
+              pg->keys = k->next;
+              gcry_sexp_release (k->key);
+              xfree (k);
+              pregen_nkeys--;
+            }
+        }
+      if (!pg->pending && !pg->running && !pg->keys)
+        {
+          *pgp = pg->next;
+          xfree (pg);
+        }
+      else
+        pgp = &pg->next;
+    }
+}
+
+
+/* Return an entry with keys to generate if there is room for another
+ * key.  Must be called with the lock held.  */
+static struct pregen_s *
+next_pregen_job (void)
+{
+  struct pregen_s *pg;
+
+  if (pregen_nkeys + pregen_nrunning >= PREGEN_MAX_KEYS)
+    return NULL;
+  for (pg = pregen_list; pg; pg = pg->next)
+    if (pg->pending)
+      break;
+  return pg;
+}
+
+
+/* The worker thread generating the announced keys.  */
+static void *
+pregen_worker (void *arg)
+{
+  struct pregen_s *pg;
+  struct pregen_key_s *k;
+  gcry_sexp_t s_keyparam, s_key;
+  gpg_error_t err;
+
+  (void)arg;
+
+  lock_pregen ();
+  while ((pg = next_pregen_job ()))
+    {
+      /* The entry is not removed while RUNNING is not zero.  */
+      pg->pending--;
+      pg->running++;
+      pregen_nrunning++;
+      unlock_pregen ();
+
+      s_key = NULL;
+      err = gcry_sexp_sscan (&s_keyparam, NULL, pg->keyparam, pg->keyparamlen);
+      if (!err)
+        {
+          agent_unlock_npth ();
+          err = gcry_pk_genkey (&s_key, s_keyparam);
+          agent_lock_npth ();
+          gcry_sexp_release (s_keyparam);
+        }
+
+      lock_pregen ();
+      pg->running--;
+      pregen_nrunning--;
+      if (err)
+        {
+          log_error ("key generation failed: %s\n", gpg_strerror (err));
+          pg->pending = 0;
+        }
+      else if (!(k = xtrycalloc (1, sizeof *k)))
+        gcry_sexp_release (s_key);
+      else
+        {
+          k->key = s_key;
+          k->next = pg->keys;
+          pg->keys = k;
+          pregen_nkeys++;
+        }
+      npth_cond_broadcast (&pregen_cond);
+    }
+  pregen_nworkers--;
+  unlock_pregen ();
+  return NULL;
+}
+
+
+/* Start worker threads for the pending keys.  Must be called with
+ * the lock held.  */
+static void
+start_pregen_workers (void)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int err;
+
+  if (pregen_nworkers >= opt.genkey_threads || !next_pregen_job ())
+    return;
+
+  err = npth_attr_init (&tattr);
+  if (err)
+    {
+      log_error ("error creating thread attributes: %s\n", strerror (err));
+      return;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  while (pregen_nworkers < opt.genkey_threads)
+    {
+      err = npth_create (&thread, &tattr, pregen_worker, NULL);
+      if (err)
+        {
+          log_error ("error spawning pregen_worker: %s\n", strerror (err));
+          break;
+        }
+      pregen_nworkers++;
+    }
+  npth_attr_destroy (&tattr);
+}
+
+
+/* Announce that COUNT keys with the parameters KEYPARAM will soon be
+ * requested.  They are generated by background threads and taken by
+ * agent_genkey.  */
+gpg_error_t
+agent_genkey_pregen (const char *keyparam, size_t keyparamlen,
+                     unsigned long count)
+{
+  struct pregen_s *pg;
+
+  if (!opt.genkey_threads)
+    return gpg_error (GPG_ERR_NOT_ENABLED);
+
+  lock_pregen ();
+  expire_pregen ();
+  pg = find_pregen (keyparam, keyparamlen);
+  if (!pg)
+    {
+      pg = xtrycalloc (1, sizeof *pg + keyparamlen);
+      if (!pg)
+        {
+          gpg_error_t err = gpg_error_from_syserror ();
+          unlock_pregen ();
+          return err;
+        }
+      memcpy (pg->keyparam, keyparam, keyparamlen);
+      pg->keyparamlen = keyparamlen;
+      pg->next = pregen_list;
+      pregen_list = pg;
+    }
+  if (count > PREGEN_MAX_PENDING - pg->pending)
+    pg->pending = PREGEN_MAX_PENDING;
+  else
+    pg->pending += count;
+  pg->last_used = gnupg_get_time ();
+  start_pregen_workers ();
+  unlock_pregen ();
+  return 0;
+}
+
+
+/* Take a key with the parameters KEYPARAM from the pool.  If such a
+ * key is being generated, wait for it unless the caller can do this
+ * as fast by itself.  Returns NULL if the caller needs to generate
+ * the key.  */
+static gcry_sexp_t
+take_pregen_key (const char *keyparam, size_t keyparamlen)
+{
+  struct pregen_s *pg;
+  struct pregen_key_s *k;
+  gcry_sexp_t s_key = NULL;
+
+  if (!pregen_list)
+    return NULL;
+
+  lock_pregen ();
+  expire_pregen ();
+  while ((pg = find_pregen (keyparam, keyparamlen))
+         && !pg->keys && !pg->pending && pg->running)
+    npth_cond_wait (&pregen_cond, &pregen_lock);
+  if (pg && (k = pg->keys))
+    {
+      pg->keys = k->next;
+      pregen_nkeys--;
+      s_key = k->key;
+      xfree (k);
+    }
+  else if (pg && pg->pending)
+    pg->pending--;  /* We generate this one.  */
+  if (pg)
+    {
+      pg->last_used = gnupg_get_time ();
+      start_pregen_workers ();
+    }
+  expire_pregen ();
+  unlock_pregen ();
+  return s_key;
+}
 
 
 void
@@ -574,7 +890,15 @@ agent_genkey (ctrl_t ctrl, unsigned int flags,
       passphrase = passphrase_buffer;
     }
 
-  rc = gcry_pk_genkey (&s_key, s_keyparam );
+  s_key = take_pregen_key (keyparam, keyparamlen);
+  if (s_key)
+    rc = 0;
+  else
+    {
+      agent_unlock_npth ();
+      rc = gcry_pk_genkey (&s_key, s_keyparam );
+      agent_lock_npth ();
+    }
   gcry_sexp_release (s_keyparam);
   if (rc)
     {
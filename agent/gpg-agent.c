@@ -61,6 +61,10 @@
 #include "../common/asshelp.h"
 #include "../common/comopt.h"
 #include "../common/init.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
+#include "../common/thread-pool.h"
+#include "../common/starttrace.h"
 
 
 enum cmd_and_opt_values
@@ -109,6 +113,10 @@ enum cmd_and_opt_values
   oDefCacheTTLSSH,
   oMaxCacheTTL,
   oMaxCacheTTLSSH,
+  oKeyCacheSize,
+  oKeyCacheTTL,
+  oNoKeyIndex,
+  oGenkeyThreads,
   oEnforcePassphraseConstraints,
   oMinPassphraseLen,
   oMinPassphraseNonalpha,
@@ -252,6 +260,10 @@ static gpgrt_opt_t opts[] = {
                 /* */     N_("|N|set maximum PIN cache lifetime to N seconds")),
   ARGPARSE_s_u (oMaxCacheTTLSSH, "max-cache-ttl-ssh",
                 /* */     N_("|N|set maximum SSH key lifetime to N seconds")),
+  ARGPARSE_s_u (oKeyCacheSize,   "key-cache-size", "@"),
+  ARGPARSE_s_u (oKeyCacheTTL,    "key-cache-ttl", "@"),
+  ARGPARSE_s_n (oNoKeyIndex,     "no-key-index", "@"),
+  ARGPARSE_s_u (oGenkeyThreads,  "genkey-threads", "@"),
   ARGPARSE_s_n (oIgnoreCacheForSigning, "ignore-cache-for-signing",
                 /* */    N_("do not use the PIN cache when signing")),
   ARGPARSE_s_n (oNoAllowExternalCache,  "no-allow-external-cache",
@@ -338,6 +350,9 @@ static struct debug_flags_s debug_flags [] =
 #define DEFAULT_CACHE_TTL_SSH (30*60)  /* 30 minutes */
 #define MAX_CACHE_TTL         (120*60) /* 2 hours */
 #define MAX_CACHE_TTL_SSH     (120*60) /* 2 hours */
+#define DEFAULT_KEY_CACHE_SIZE (16)
+#define DEFAULT_KEY_CACHE_TTL (10*60)  /* 10 minutes */
+#define DEFAULT_GENKEY_THREADS (2)
 #define MIN_PASSPHRASE_LEN    (8)
 #define MIN_PASSPHRASE_NONALPHA (1)
 #define MAX_PASSPHRASE_DAYS   (0)
@@ -507,6 +522,10 @@ struct progress_dispatch_s
 };
 struct progress_dispatch_s *progress_dispatch_list;
 
+/* Thread local key to mark a thread which runs a crypto operation
+ * outside of the nPth lock; see agent_unlock_npth.  */
+static npth_key_t my_tlskey_unprotected;
+
 
 
 
@@ -536,6 +555,7 @@ static int check_for_running_agent (int silent);
 static void *check_own_socket_thread (void *arg);
 #endif
 static void *check_others_thread (void *arg);
+static void *s2k_calibration_thread (void *arg);
 
 /*
    Functions.
@@ -892,6 +912,10 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.def_cache_ttl_ssh = DEFAULT_CACHE_TTL_SSH;
       opt.max_cache_ttl = MAX_CACHE_TTL;
       opt.max_cache_ttl_ssh = MAX_CACHE_TTL_SSH;
+      opt.key_cache_size = DEFAULT_KEY_CACHE_SIZE;
+      opt.key_cache_ttl = DEFAULT_KEY_CACHE_TTL;
+      opt.no_key_index = 0;
+      opt.genkey_threads = DEFAULT_GENKEY_THREADS;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
@@ -969,6 +993,10 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
     case oDefCacheTTLSSH: opt.def_cache_ttl_ssh = pargs->r.ret_ulong; break;
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTLSSH: opt.max_cache_ttl_ssh = pargs->r.ret_ulong; break;
+    case oKeyCacheSize: opt.key_cache_size = pargs->r.ret_ulong; break;
+    case oKeyCacheTTL: opt.key_cache_ttl = pargs->r.ret_ulong; break;
+    case oNoKeyIndex: opt.no_key_index = 1; break;
+    case oGenkeyThreads: opt.genkey_threads = pargs->r.ret_ulong; break;
 
     case oEnforcePassphraseConstraints:
       opt.enforce_passphrase_constraints=1;
@@ -1049,6 +1077,31 @@ finalize_rereadable_options (void)
 }
 
 
+/* The system call clamp used by libgpg-error, Libassuan and
+ * Libgcrypt.  Other than npth_unprotect and npth_protect it may also
+ * be called by a thread which already released the nPth lock using
+ * agent_unlock_npth.  */
+static void
+agent_pre_syscall (void)
+{
+  if (!npth_getspecific (my_tlskey_unprotected))
+    npth_unprotect ();
+}
+
+static void
+agent_post_syscall (void)
+{
+  unsigned long long start;
+
+  if (!npth_getspecific (my_tlskey_unprotected))
+    {
+      start = metrics_clock ();
+      npth_protect ();
+      metrics_lock_wait (start);
+    }
+}
+
+
 static void
 thread_init_once (void)
 {
@@ -1058,8 +1111,11 @@ thread_init_once (void)
     {
       npth_initialized++;
       npth_init ();
+      if (npth_key_create (&my_tlskey_unprotected, NULL))
+        log_fatal ("error creating thread key: %s\n",
+                   strerror (errno));
     }
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  gpgrt_set_syscall_clamp (agent_pre_syscall, agent_post_syscall);
   /* Now that we have set the syscall clamp we need to tell Libgcrypt
    * that it should get them from libgpg-error.  Note that Libgcrypt
    * has already been initialized but at that point nPth was not
@@ -1070,14 +1126,29 @@ thread_init_once (void)
 }
 
 
+static unsigned long long
+metric_connections (void)
+{
+  return active_connections;
+}
+
+
 static void
 initialize_modules (void)
 {
   thread_init_once ();
+  metrics_init ("lcr_agent");
+  metrics_fnc ("connections", METRIC_GAUGE,
+               "Number of active connections.", metric_connections);
   initialize_module_cache ();
+  initialize_module_keycache ();
+  initialize_module_keyindex ();
+  initialize_module_genkey ();
+  enable_s2k_calibration_cache ();
   initialize_module_call_pinentry ();
   initialize_module_daemon ();
   initialize_module_trustlist ();
+  STARTTRACE_MARK ("modules");
 }
 
 
@@ -1211,6 +1282,7 @@ main (int argc, char **argv)
     }
   /* Reset the flags.  */
   pargs.flags &= ~(ARGPARSE_FLAG_KEEP | ARGPARSE_FLAG_NOVERSION);
+  STARTTRACE_MARK ("command line");
 
   /* Initialize the secure memory. */
   gcry_control (GCRYCTL_INIT_SECMEM, SECMEM_BUFFER_SIZE, 0);
@@ -1370,6 +1442,7 @@ main (int argc, char **argv)
     }
 
   gpgrt_argparse (NULL, &pargs, NULL);  /* Release internal state.  */
+  STARTTRACE_MARK ("option files");
 
   if (!last_configname)
     config_filename = gpgrt_fnameconcat (gnupg_homedir (),
@@ -1392,6 +1465,7 @@ main (int argc, char **argv)
       logfile = comopt.logfile;
       comopt.logfile = NULL;
     }
+  STARTTRACE_MARK ("common options");
 
 #ifdef ENABLE_NLS
   /* gpg-agent usually does not output any messages because it runs in
@@ -1545,6 +1619,7 @@ main (int argc, char **argv)
           agent_exit (1);
         }
       agent_init_default_ctrl (ctrl);
+      starttrace_dump ();
       start_command_handler (ctrl, GNUPG_INVALID_FD, GNUPG_INVALID_FD);
       agent_deinit_default_ctrl (ctrl);
       xfree (ctrl);
@@ -1601,6 +1676,7 @@ main (int argc, char **argv)
 
       log_info ("listening on: std=%d extra=%d browser=%d ssh=%d\n",
                 fd, fd_extra, fd_browser, fd_ssh);
+      starttrace_dump ();
       handle_connections (fd, fd_extra, fd_browser, fd_ssh, 1);
 #endif /*!HAVE_W32_SYSTEM*/
     }
@@ -1667,6 +1743,7 @@ main (int argc, char **argv)
       fd_ssh = create_server_socket (socket_name_ssh, 0, 1,
                                      &redir_socket_name_ssh,
                                      &socket_nonce_ssh);
+      STARTTRACE_MARK ("sockets");
 
       /* If we are going to exec a program in the parent, we record
          the PID, so that the child may check whether the program is
@@ -1855,6 +1932,7 @@ main (int argc, char **argv)
         }
 
       log_info ("%s %s started\n", gpgrt_strusage(11), gpgrt_strusage(13) );
+      starttrace_dump ();
       handle_connections (fd, fd_extra, fd_browser, fd_ssh,
                           reliable_homedir_inotify);
       assuan_sock_close (fd);
@@ -1880,6 +1958,7 @@ agent_exit (int rc)
   /* at this time a bit annoying */
   if (opt.debug & DBG_MEMSTAT_VALUE)
     {
+      memstat_dump ();
       gcry_control( GCRYCTL_DUMP_MEMORY_STATS );
       gcry_control( GCRYCTL_DUMP_RANDOM_STATS );
     }
@@ -1901,14 +1980,21 @@ agent_libgcrypt_progress_cb (void *data, const char *what, int printchar,
 {
   struct progress_dispatch_s *dispatch;
   npth_t mytid = npth_self ();
+  int unprotected = !!npth_getspecific (my_tlskey_unprotected);
 
   (void)data;
 
+  /* The callback may be called from within a crypto operation run
+   * with agent_unlock_npth; the dispatcher needs the lock.  */
+  if (unprotected)
+    agent_lock_npth ();
   for (dispatch = progress_dispatch_list; dispatch; dispatch = dispatch->next)
     if (dispatch->ctrl && dispatch->tid == mytid)
       break;
   if (dispatch && dispatch->cb)
     dispatch->cb (dispatch->ctrl, what, printchar, current, total);
+  if (unprotected)
+    agent_unlock_npth ();
 }
 
 
@@ -2462,6 +2548,7 @@ agent_sighup_action (void)
             "re-reading configuration and flushing cache\n");
 
   agent_flush_cache (0);
+  agent_keyindex_flush ();
   reread_configuration ();
   agent_reload_trustlist ();
   /* We flush the module name cache so that after installing a
@@ -2947,6 +3034,30 @@ start_connection_thread_ssh (void *arg)
 }
 
 
+/* Release the nPth lock so that a long running computation, like
+ * a private key operation, can run in parallel to the other
+ * threads.  Between this call and agent_lock_npth the caller may not
+ * touch any data shared with other threads and may not call any
+ * nPth or Libassuan function; pure Libgcrypt operations on local
+ * objects are fine.  Calls do not nest.  */
+void
+agent_unlock_npth (void)
+{
+  npth_setspecific (my_tlskey_unprotected, (void *)1);
+  npth_unprotect ();
+}
+
+
+/* Re-acquire the nPth lock released by agent_unlock_npth.  */
+void
+agent_lock_npth (void)
+{
+  npth_protect ();
+  npth_setspecific (my_tlskey_unprotected, NULL);
+}
+
+
+
 void
 agent_kick_the_loop (void)
 {
@@ -3085,6 +3196,16 @@ handle_connections (gnupg_fd_t listen_fd,
         log_error ("error spawning check_others_thread: %s\n", strerror (err));
     }
 
+  if (!opt.s2k_count)
+    {
+      npth_t thread;
+
+      err = npth_create (&thread, &tattr, s2k_calibration_thread, NULL);
+      if (err)
+        log_error ("error spawning s2k_calibration_thread: %s\n",
+                   strerror (err));
+    }
+
   /* On Windows we need to fire up a separate thread to listen for
      requests from Putty (an SSH client), so we can replace Putty's
      Pageant (its ssh-agent implementation). */
@@ -3287,7 +3408,6 @@ handle_connections (gnupg_fd_t listen_fd,
         {
           int idx;
           ctrl_t ctrl;
-          npth_t thread;
 
           for (idx=0; idx < DIM(listentbl); idx++)
             {
@@ -3320,8 +3440,7 @@ handle_connections (gnupg_fd_t listen_fd,
               else
                 {
                   ctrl->thread_startup.fd = fd;
-                  ret = npth_create (&thread, &tattr,
-                                     listentbl[idx].func, ctrl);
+                  ret = thread_pool_run (&tattr, listentbl[idx].func, ctrl);
                   if (ret)
                     {
                       log_error ("error spawning connection handler for %s:"
@@ -3485,6 +3604,27 @@ check_others_thread (void *arg)
   return NULL;
 }
 
+
+/* The thread calibrating the S2K count in the background so that
+ * the first protect operation does not need to wait for it.  */
+static void *
+s2k_calibration_thread (void *arg)
+{
+  unsigned long count;
+  unsigned int ms;
+
+  (void)arg;
+
+  if (!s2k_calibration_needed ())
+    return NULL;  /* Cached value is still valid.  */
+
+  agent_unlock_npth ();
+  count = measure_s2k_count (&ms);
+  agent_lock_npth ();
+  set_calibrated_s2k_count (count, ms);
+  return NULL;
+}
+
 /* Figure out whether an agent is available and running. Prints an
    error if not.  If SILENT is true, no messages are printed.
    Returns 0 if the agent is running. */
@@ -0,0 +1,352 @@
+/* keycache.c - keep a cache of unprotected private keys
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Reading a key from the private-keys-v1.d directory requires to
+ * parse the key file and, for protected keys, to run the S2K and to
+ * decrypt the key even if the passphrase is cached.  For operations
+ * done in a row this cost dominates the actual private key
+ * operation.  This module keeps the canonical encoded unprotected
+ * keys in secure memory so that agent_key_from_file can skip these
+ * steps.  The entries are bound to the state of the key file and
+ * have a limited lifetime; a protected key is only taken from here
+ * while its passphrase is still in the passphrase cache.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "agent.h"
+
+/* The number of bytes of secure memory we are willing to use for
+ * the cache.  The secure memory pool is small and shared with all
+ * other operations; thus we take only a fraction of it.  */
+#ifdef SECMEM_BUFFER_SIZE
+# define KEYCACHE_MAX_BYTES (SECMEM_BUFFER_SIZE / 4)
+#else
+# define KEYCACHE_MAX_BYTES (8192)
+#endif
+
+/* The cache object.  */
+typedef struct keycache_item_s *KCITEM;
+struct keycache_item_s
+{
+  KCITEM next;
+  unsigned char grip[KEYGRIP_LEN];
+  struct keycache_stamp_s stamp;  /* State of the key file.  */
+  time_t created;      /* Time the entry was stored.  */
+  time_t timestamp;    /* The creation time of the key or -1.  */
+  int protected;       /* The key file is passphrase protected.  */
+  size_t keylen;
+  unsigned char *key;  /* The canonical encoded key in secure memory.  */
+};
+
+/* A mutex used to serialize access to the cache.  */
+static npth_mutex_t keycache_lock;
+
+/* The cache himself, most recently used entries first.  */
+static KCITEM thekeycache;
+
+/* The number of items and the secure memory used by the cache.  */
+static unsigned int keycache_items;
+static size_t keycache_bytes;
+
+
+
+/* This function must be called once to initialize this module. It
+   has to be done before a second thread is spawned.  */
+void
+initialize_module_keycache (void)
+{
+  int err;
+
+  err = npth_mutex_init (&keycache_lock, NULL);
+  if (err)
+    log_fatal ("error initializing keycache module: %s\n", strerror (err));
+}
+
+
+static void
+lock_keycache (void)
+{
+  int res;
+
+  res = npth_mutex_lock (&keycache_lock);
+  if (res)
+    log_fatal ("failed to acquire keycache mutex: %s\n", strerror (res));
+}
+
+
+static void
+unlock_keycache (void)
+{
+  int res;
+
+  res = npth_mutex_unlock (&keycache_lock);
+  if (res)
+    log_fatal ("failed to release keycache mutex: %s\n", strerror (res));
+}
+
+
+/* Release the item R which must already be unlinked.  */
+static void
+release_item (KCITEM r)
+{
+  if (!r)
+    return;
+  keycache_items--;
+  keycache_bytes -= r->keylen;
+  wipememory (r->key, r->keylen);
+  xfree (r->key);
+  xfree (r);
+}
+
+
+/* Unlink and release the item at *RP.  */
+static void
+remove_item (KCITEM *rp)
+{
+  KCITEM r = *rp;
+
+  *rp = r->next;
+  if (DBG_CACHE)
+    log_printhex (r->grip, KEYGRIP_LEN, "keycache: removing");
+  release_item (r);
+}
+
+
+/* Return true if the entry R has expired.  */
+static int
+item_expired_p (KCITEM r, time_t now)
+{
+  return (!opt.key_cache_ttl
+          || now < r->created
+          || now - r->created >= opt.key_cache_ttl);
+}
+
+
+/* Remove the least recently used entries until the cache has room
+ * for another entry with a key of length KEYLEN.  Must be called
+ * with the lock held.  */
+static void
+make_room (size_t keylen)
+{
+  KCITEM *rp, *lastp;
+
+  while (thekeycache
+         && (keycache_items >= opt.key_cache_size
+             || keycache_bytes + keylen > KEYCACHE_MAX_BYTES))
+    {
+      lastp = NULL;
+      for (rp = &thekeycache; *rp; rp = &(*rp)->next)
+        lastp = rp;
+      remove_item (lastp);
+    }
+}
+
+
+/* Remove all expired entries.  This is called from the main loop so
+ * that no key lingers in memory much longer than its lifetime.  */
+void
+agent_keycache_expire (void)
+{
+  KCITEM *rp;
+  time_t now;
+
+  if (!thekeycache)
+    return; /* Shortcut - nothing to do.  */
+
+  now = gnupg_get_time ();
+  lock_keycache ();
+  for (rp = &thekeycache; *rp; )
+    if (item_expired_p (*rp, now))
+      remove_item (rp);
+    else
+      rp = &(*rp)->next;
+  unlock_keycache ();
+}
+
+
+/* Remove all entries from the cache.  */
+void
+agent_keycache_flush (void)
+{
+  if (DBG_CACHE)
+    log_debug ("agent_keycache_flush\n");
+
+  lock_keycache ();
+  while (thekeycache)
+    remove_item (&thekeycache);
+  unlock_keycache ();
+}
+
+
+/* Remove the entry for the key with GRIP.  This must be called
+ * whenever the key file is changed or deleted.  */
+void
+agent_keycache_drop (const unsigned char *grip)
+{
+  KCITEM *rp;
+
+  if (!thekeycache)
+    return; /* Shortcut - nothing to do.  */
+
+  lock_keycache ();
+  for (rp = &thekeycache; *rp; rp = &(*rp)->next)
+    if (!memcmp ((*rp)->grip, grip, KEYGRIP_LEN))
+      {
+        remove_item (rp);
+        break;
+      }
+  unlock_keycache ();
+}
+
+
+/* Store the canonical encoded unprotected KEY with GRIP in the cache.
+ * STAMP describes the key file as it was before it was read.
+ * PROTECTED tells whether the key file is protected by a passphrase
+ * and TIMESTAMP is the creation time of the key or -1.  Failing to
+ * store the key is not an error; the cache is then just not used.  */
+void
+agent_keycache_put (const unsigned char *grip,
+                    const struct keycache_stamp_s *stamp,
+                    const unsigned char *key, int protected,
+                    time_t timestamp)
+{
+  KCITEM r;
+  size_t keylen;
+
+  if (!opt.key_cache_size || !opt.key_cache_ttl)
+    return;
+
+  keylen = gcry_sexp_canon_len (key, 0, NULL, NULL);
+  if (!keylen || keylen > KEYCACHE_MAX_BYTES)
+    return;
+
+  r = xtrycalloc (1, sizeof *r);
+  if (!r)
+    return;
+  r->key = xtrymalloc_secure (keylen);
+  if (!r->key)
+    {
+      xfree (r);
+      return;
+    }
+  memcpy (r->grip, grip, KEYGRIP_LEN);
+  r->stamp = *stamp;
+  r->created = gnupg_get_time ();
+  r->timestamp = timestamp;
+  r->protected = protected;
+  r->keylen = keylen;
+  memcpy (r->key, key, keylen);
+
+  if (DBG_CACHE)
+    log_printhex (grip, KEYGRIP_LEN, "keycache: storing");
+
+  lock_keycache ();
+  /* Replace an existing entry for the same key.  */
+  {
+    KCITEM *rp;
+
+    for (rp = &thekeycache; *rp; rp = &(*rp)->next)
+      if (!memcmp ((*rp)->grip, grip, KEYGRIP_LEN))
+        {
+          remove_item (rp);
+          break;
+        }
+  }
+  make_room (keylen);
+  r->next = thekeycache;
+  thekeycache = r;
+  keycache_items++;
+  keycache_bytes += keylen;
+  unlock_keycache ();
+}
+
+
+/* Look up the key with GRIP in the cache.  STAMP describes the
+ * current state of the key file; if it does not match the state at
+ * the time the key was stored the entry is removed.  On success a
+ * copy of the canonical encoded key in secure memory is stored at
+ * R_KEY, R_PROTECTED is set to true if the key file is protected and
+ * R_TIMESTAMP, if not NULL, receives the creation time of the key.
+ * Returns GPG_ERR_NOT_FOUND if the key is not cached.  */
+gpg_error_t
+agent_keycache_get (const unsigned char *grip,
+                    const struct keycache_stamp_s *stamp,
+                    unsigned char **r_key, int *r_protected,
+                    time_t *r_timestamp)
+{
+  gpg_error_t err;
+  KCITEM *rp, r;
+
+  *r_key = NULL;
+  *r_protected = 0;
+
+  if (!thekeycache)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  lock_keycache ();
+  for (rp = &thekeycache; *rp; rp = &(*rp)->next)
+    if (!memcmp ((*rp)->grip, grip, KEYGRIP_LEN))
+      break;
+  r = *rp;
+  if (!r)
+    {
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  if (item_expired_p (r, gnupg_get_time ())
+      || r->stamp.size != stamp->size
+      || r->stamp.ino != stamp->ino
+      || r->stamp.mtime != stamp->mtime)
+    {
+      remove_item (rp);
+      err = gpg_error (GPG_ERR_NOT_FOUND);
+      goto leave;
+    }
+
+  *r_key = xtrymalloc_secure (r->keylen);
+  if (!*r_key)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (*r_key, r->key, r->keylen);
+  *r_protected = r->protected;
+  if (r_timestamp)
+    *r_timestamp = r->timestamp;
+
+  /* Move the entry to the front.  */
+  *rp = r->next;
+  r->next = thekeycache;
+  thekeycache = r;
+
+  if (DBG_CACHE)
+    log_printhex (grip, KEYGRIP_LEN, "keycache: hit");
+  err = 0;
+
+ leave:
+  unlock_keycache ();
+  return err;
+}
@@ -0,0 +1,497 @@
+/* keyindex.c - in-memory index of the private keys directory
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Commands like HAVEKEY and KEYINFO --list need to know which keys
+ * are in the private-keys-v1.d directory and of what type they are.
+ * Answering this from the file system requires an access or a full
+ * read of each key file.  This module keeps the set of keygrips and
+ * the key types in memory.  The index is kept in sync with the
+ * directory using inotify; where this is not available, or if the
+ * index has been disabled, all functions report that the index is
+ * not available and the callers use the file system.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_INOTIFY_INIT
+# include <sys/inotify.h>
+#endif
+#include <npth.h>
+
+#include "agent.h"
+#include "../common/host2net.h"
+
+/* The initial number of hash buckets.  */
+#define KEYINDEX_MIN_SIZE 64
+
+/* An entry of the index.  */
+typedef struct keyindex_item_s *KIITEM;
+struct keyindex_item_s
+{
+  KIITEM next;
+  unsigned char grip[KEYGRIP_LEN];
+  int keytype;  /* One of the PRIVATE_KEY_ values.  */
+};
+
+/* A mutex used to serialize access to the index.  */
+static npth_mutex_t keyindex_lock;
+
+/* The hash table with the entries and its size.  */
+static KIITEM *keyindex_table;
+static unsigned int keyindex_size;
+static unsigned int keyindex_count;
+
+/* The inotify descriptor watching the directory or -1.  The index
+ * is only valid while this is open.  */
+static int keyindex_fd = -1;
+
+/* Changed with each modification of the index; never zero.  */
+static unsigned long keyindex_generation = 1;
+
+
+
+/* This function must be called once to initialize this module. It
+   has to be done before a second thread is spawned.  */
+void
+initialize_module_keyindex (void)
+{
+  int err;
+
+  err = npth_mutex_init (&keyindex_lock, NULL);
+  if (err)
+    log_fatal ("error initializing keyindex module: %s\n", strerror (err));
+}
+
+
+static void
+lock_keyindex (void)
+{
+  int res;
+
+  res = npth_mutex_lock (&keyindex_lock);
+  if (res)
+    log_fatal ("failed to acquire keyindex mutex: %s\n", strerror (res));
+}
+
+
+static void
+unlock_keyindex (void)
+{
+  int res;
+
+  res = npth_mutex_unlock (&keyindex_lock);
+  if (res)
+    log_fatal ("failed to release keyindex mutex: %s\n", strerror (res));
+}
+
+
+/* Record a change of the index.  */
+static void
+bump_generation (void)
+{
+  if (!++keyindex_generation)
+    keyindex_generation = 1;
+}
+
+
+/* Release all entries and stop watching the directory.  */
+static void
+clear_index (void)
+{
+  KIITEM r, r2;
+  unsigned int i;
+
+  bump_generation ();
+  for (i=0; i < keyindex_size; i++)
+    for (r = keyindex_table[i]; r; r = r2)
+      {
+        r2 = r->next;
+        xfree (r);
+      }
+  xfree (keyindex_table);
+  keyindex_table = NULL;
+  keyindex_size = 0;
+  keyindex_count = 0;
+  if (keyindex_fd != -1)
+    {
+      close (keyindex_fd);
+      keyindex_fd = -1;
+    }
+}
+
+
+/* Return the address of the bucket for GRIP.  A keygrip is a hash
+ * value and thus its first bytes are good enough.  */
+static KIITEM *
+index_bucket (const unsigned char *grip)
+{
+  return keyindex_table + (buf32_to_uint (grip) & (keyindex_size - 1));
+}
+
+
+/* Return the address of the pointer to the entry for GRIP or the
+ * address of the NULL pointer at the end of its bucket.  */
+static KIITEM *
+find_item (const unsigned char *grip)
+{
+  KIITEM *rp;
+
+  for (rp = index_bucket (grip); *rp; rp = &(*rp)->next)
+    if (!memcmp ((*rp)->grip, grip, KEYGRIP_LEN))
+      break;
+  return rp;
+}
+
+
+/* Double the size of the hash table.  Failing to do so is not an
+ * error; the chains just get longer.  */
+static void
+grow_index (void)
+{
+  KIITEM *oldtable = keyindex_table;
+  unsigned int oldsize = keyindex_size;
+  KIITEM *newtable, r, r2;
+  unsigned int i;
+
+  newtable = xtrycalloc (2 * oldsize, sizeof *newtable);
+  if (!newtable)
+    return;
+  keyindex_table = newtable;
+  keyindex_size = 2 * oldsize;
+  for (i=0; i < oldsize; i++)
+    for (r = oldtable[i]; r; r = r2)
+      {
+        KIITEM *rp = index_bucket (r->grip);
+
+        r2 = r->next;
+        r->next = *rp;
+        *rp = r;
+      }
+  xfree (oldtable);
+}
+
+
+/* Add GRIP to the index or reset the key type of an existing entry.
+ * Returns an error if we are out of core.  */
+static gpg_error_t
+add_item (const unsigned char *grip)
+{
+  KIITEM *rp, r;
+
+  bump_generation ();
+  rp = find_item (grip);
+  if (*rp)
+    {
+      (*rp)->keytype = PRIVATE_KEY_UNKNOWN;
+      return 0;
+    }
+
+  r = xtrycalloc (1, sizeof *r);
+  if (!r)
+    return gpg_error_from_syserror ();
+  memcpy (r->grip, grip, KEYGRIP_LEN);
+  r->keytype = PRIVATE_KEY_UNKNOWN;
+  r->next = *rp;
+  *rp = r;
+  if (++keyindex_count > keyindex_size)
+    grow_index ();
+  return 0;
+}
+
+
+/* Remove GRIP from the index.  */
+static void
+remove_item (const unsigned char *grip)
+{
+  KIITEM *rp, r;
+
+  rp = find_item (grip);
+  if ((r = *rp))
+    {
+      *rp = r->next;
+      xfree (r);
+      keyindex_count--;
+      bump_generation ();
+    }
+}
+
+
+/* If NAME is the name of a key file store its keygrip at GRIP and
+ * return true.  */
+static int
+grip_from_filename (const char *name, unsigned char *grip)
+{
+  char hexgrip[41];
+
+  if (strlen (name) != 44 || strcmp (name + 40, ".key"))
+    return 0;
+  memcpy (hexgrip, name, 40);
+  hexgrip[40] = 0;
+  return hex2bin (hexgrip, grip, KEYGRIP_LEN) >= 0;
+}
+
+
+#ifdef HAVE_INOTIFY_INIT
+/* Read all pending events from the inotify descriptor and update
+ * the index.  If the index cannot be kept in sync it is cleared.  */
+static void
+process_events (void)
+{
+  union {
+    struct inotify_event ev;
+    char _buf[16 * (sizeof (struct inotify_event) + 255 + 1)];
+  } buf;
+  struct inotify_event *evp;
+  unsigned char grip[KEYGRIP_LEN];
+  ssize_t n;
+  size_t off;
+
+  while (keyindex_fd != -1)
+    {
+      n = read (keyindex_fd, &buf, sizeof buf);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;  /* No more events.  */
+      if (n <= 0)
+        {
+          clear_index ();
+          break;
+        }
+
+      for (off = 0; off + sizeof *evp <= n; off += sizeof *evp + evp->len)
+        {
+          evp = (struct inotify_event *)(buf._buf + off);
+          if ((evp->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF
+                            | IN_UNMOUNT | IN_IGNORED)))
+            {
+              if (DBG_CACHE)
+                log_debug ("keyindex: directory changed - dropping index\n");
+              clear_index ();
+              return;
+            }
+          if (!evp->len || !grip_from_filename (evp->name, grip))
+            continue;
+          if ((evp->mask & (IN_DELETE | IN_MOVED_FROM)))
+            remove_item (grip);
+          else if (add_item (grip))
+            {
+              clear_index ();
+              return;
+            }
+        }
+    }
+}
+#endif /*HAVE_INOTIFY_INIT*/
+
+
+/* Make sure that the index is valid.  Returns true if the index can
+ * be used.  Must be called with the lock held.  */
+static int
+ensure_index (void)
+{
+#ifdef HAVE_INOTIFY_INIT
+  char *dirname;
+  gnupg_dir_t dir;
+  gnupg_dirent_t dir_entry;
+  unsigned char grip[KEYGRIP_LEN];
+
+  if (opt.no_key_index)
+    {
+      if (keyindex_fd != -1)
+        clear_index ();
+      return 0;
+    }
+
+  if (keyindex_fd != -1)
+    {
+      process_events ();
+      if (keyindex_fd != -1)
+        return 1;
+    }
+
+  /* (Re-)build the index.  The watch is set up first so that no
+   * change done while reading the directory is lost.  */
+  dirname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!dirname)
+    return 0;
+  keyindex_fd = inotify_init ();
+  if (keyindex_fd == -1)
+    {
+      xfree (dirname);
+      return 0;
+    }
+  if (fcntl (keyindex_fd, F_SETFL, O_NONBLOCK) == -1
+      || fcntl (keyindex_fd, F_SETFD, FD_CLOEXEC) == -1
+      || inotify_add_watch (keyindex_fd, dirname,
+                            (IN_CREATE | IN_DELETE | IN_MOVED_FROM
+                             | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB
+                             | IN_DELETE_SELF | IN_MOVE_SELF
+                             | IN_ONLYDIR)) == -1
+      || !(dir = gnupg_opendir (dirname)))
+    {
+      xfree (dirname);
+      clear_index ();
+      return 0;
+    }
+  xfree (dirname);
+
+  keyindex_table = xtrycalloc (KEYINDEX_MIN_SIZE, sizeof *keyindex_table);
+  if (!keyindex_table)
+    {
+      gnupg_closedir (dir);
+      clear_index ();
+      return 0;
+    }
+  keyindex_size = KEYINDEX_MIN_SIZE;
+
+  while ((dir_entry = gnupg_readdir (dir)))
+    if (grip_from_filename (dir_entry->d_name, grip) && add_item (grip))
+      {
+        gnupg_closedir (dir);
+        clear_index ();
+        return 0;
+      }
+  gnupg_closedir (dir);
+
+  if (DBG_CACHE)
+    log_debug ("keyindex: indexed %u keys\n", keyindex_count);
+
+  /* Apply the changes done while we were reading.  */
+  process_events ();
+  return keyindex_fd != -1;
+
+#else /*!HAVE_INOTIFY_INIT*/
+
+  return 0;
+
+#endif /*!HAVE_INOTIFY_INIT*/
+}
+
+
+/* Drop the index.  It is rebuilt on the next use.  */
+void
+agent_keyindex_flush (void)
+{
+  lock_keyindex ();
+  clear_index ();
+  unlock_keyindex ();
+}
+
+
+/* Return a value which changes whenever a key file is added,
+ * removed or modified.  Returns 0 if the index is not available.  */
+unsigned long
+agent_keyindex_generation (void)
+{
+  unsigned long result;
+
+  lock_keyindex ();
+  result = ensure_index ()? keyindex_generation : 0;
+  unlock_keyindex ();
+  return result;
+}
+
+
+/* Look up the key file for GRIP in the index.  Returns 1 if the key
+ * file exists, 0 if it does not exist and -1 if the index is not
+ * available.  If R_KEYTYPE is not NULL the key type is stored there;
+ * this is PRIVATE_KEY_UNKNOWN if the type has not yet been
+ * recorded.  */
+int
+agent_keyindex_lookup (const unsigned char *grip, int *r_keytype)
+{
+  KIITEM r;
+  int result;
+
+  if (r_keytype)
+    *r_keytype = PRIVATE_KEY_UNKNOWN;
+
+  lock_keyindex ();
+  if (!ensure_index ())
+    result = -1;
+  else if ((r = *find_item (grip)))
+    {
+      if (r_keytype)
+        *r_keytype = r->keytype;
+      result = 1;
+    }
+  else
+    result = 0;
+  unlock_keyindex ();
+  return result;
+}
+
+
+/* Record the KEYTYPE of the existing key file for GRIP.  */
+void
+agent_keyindex_set_keytype (const unsigned char *grip, int keytype)
+{
+  KIITEM r;
+
+  lock_keyindex ();
+  if (ensure_index () && (r = *find_item (grip)))
+    r->keytype = keytype;
+  unlock_keyindex ();
+}
+
+
+/* Store the keygrips of all key files as an array of R_COUNT items
+ * of KEYGRIP_LEN bytes each at R_GRIPS.  The caller must release
+ * the array.  Returns GPG_ERR_NOT_SUPPORTED if the index is not
+ * available.  */
+gpg_error_t
+agent_keyindex_grips (unsigned char **r_grips, unsigned int *r_count)
+{
+  gpg_error_t err = 0;
+  unsigned char *grips;
+  unsigned int i, n;
+  KIITEM r;
+
+  *r_grips = NULL;
+  *r_count = 0;
+
+  lock_keyindex ();
+  if (!ensure_index ())
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  grips = xtrymalloc ((keyindex_count? keyindex_count : 1) * KEYGRIP_LEN);
+  if (!grips)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (i = n = 0; i < keyindex_size; i++)
+    for (r = keyindex_table[i]; r; r = r->next)
+      memcpy (grips + KEYGRIP_LEN * n++, r->grip, KEYGRIP_LEN);
+  *r_grips = grips;
+  *r_count = n;
+
+ leave:
+  unlock_keyindex ();
+  return err;
+}
@@ -25,11 +25,16 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <npth.h>
 
 #include "agent.h"
 #include "../common/openpgpdefs.h"
 
 
+/* The maximum number of threads used by agent_pkdecrypt_any.  */
+#define PKDECRYPT_ANY_THREADS 8
+
+
 /* Table with parameters for KEM decryption.  Use get_ecc_parms to
  * find an entry.  */
 struct ecc_params
@@ -104,6 +109,33 @@ get_ecc_params (const char *curve)
 
 
 
+/* Append the canonical encoding of the decrypted value S_PLAIN to
+ * OUTBUF.  */
+static void
+put_plain_into_membuf (gcry_sexp_t s_plain, membuf_t *outbuf)
+{
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, NULL, 0);
+  log_assert (len);
+  buf = xmalloc (len);
+  len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, buf, len);
+  log_assert (len);
+  if (*buf == '(')
+    put_membuf (outbuf, buf, len);
+  else
+    {
+      /* Old style libgcrypt: This is only an S-expression
+         part. Turn it into a complete S-expression. */
+      put_membuf (outbuf, "(5:value", 8);
+      put_membuf (outbuf, buf, len);
+      put_membuf (outbuf, ")", 2);
+    }
+  xfree (buf);
+}
+
+
 /* DECRYPT the stuff in ciphertext which is expected to be a S-Exp.
    Try to get the key from CTRL and write the decoded stuff back to
    OUTFP.   The padding information is stored at R_PADDING with -1
@@ -189,7 +221,9 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
 /*           gcry_sexp_dump (s_skey); */
 /*         } */
 
+      agent_unlock_npth ();
       err = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+      agent_lock_npth ();
       if (err)
         {
           log_error ("decryption failed: %s\n", gpg_strerror (err));
@@ -201,21 +235,7 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
           log_debug ("plain: ");
           gcry_sexp_dump (s_plain);
         }
-      len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, NULL, 0);
-      log_assert (len);
-      buf = xmalloc (len);
-      len = gcry_sexp_sprint (s_plain, GCRYSEXP_FMT_CANON, buf, len);
-      log_assert (len);
-      if (*buf == '(')
-        put_membuf (outbuf, buf, len);
-      else
-        {
-          /* Old style libgcrypt: This is only an S-expression
-             part. Turn it into a complete S-expression. */
-          put_membuf (outbuf, "(5:value", 8);
-          put_membuf (outbuf, buf, len);
-          put_membuf (outbuf, ")", 2);
-        }
+      put_plain_into_membuf (s_plain, outbuf);
     }
 
 
@@ -229,6 +249,312 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
 }
 
 
+/* Append an S-expression describing the error ERR of one item of a
+ * multi decryption to OUTBUF.  */
+static void
+put_error_into_membuf (gpg_error_t err, membuf_t *outbuf)
+{
+  char numbuf[35];
+
+  snprintf (numbuf, sizeof numbuf, "%u", (unsigned int)err);
+  put_membuf_printf (outbuf, "(5:error%u:%s)",
+                     (unsigned int)strlen (numbuf), numbuf);
+}
+
+
+/* Decrypt the COUNT ciphertexts at CIPHERTEXTS which are given as
+ * concatenated canonical encoded S-expressions of CIPHERTEXTSLEN
+ * bytes in total, using the key set in CTRL.  The results are
+ * appended in the same order to OUTBUF in the format used by
+ * agent_pkdecrypt; the ciphertexts which could not be decrypted are
+ * represented by "(error <errorcode>)".  R_PADDING must be an array
+ * of COUNT items which receive the padding information for the
+ * items.  Other than calling agent_pkdecrypt for each ciphertext,
+ * the key is read and unprotected only once.  Keys on a smartcard or
+ * a TPM are handled by agent_pkdecrypt for each ciphertext.  An
+ * error is only returned if the key can't be used at all or the
+ * input is malformed.  */
+gpg_error_t
+agent_pkdecrypt_multi (ctrl_t ctrl, const char *desc_text,
+                       const unsigned char *ciphertexts,
+                       size_t ciphertextslen, unsigned int count,
+                       membuf_t *outbuf, int *r_padding)
+{
+  gcry_sexp_t s_skey = NULL, s_cipher = NULL, s_plain = NULL;
+  unsigned char *shadow_info = NULL;
+  gpg_error_t err, itemerr;
+  const unsigned char *p;
+  size_t n, off;
+  unsigned int i;
+
+  for (i=0; i < count; i++)
+    r_padding[i] = -1;
+
+  if (!ctrl->have_keygrip)
+    {
+      log_error ("speculative decryption not yet supported\n");
+      return gpg_error (GPG_ERR_NO_SECKEY);
+    }
+
+  /* Check the framing before doing any expensive work.  */
+  for (i=0, off=0; i < count; i++, off += n)
+    {
+      n = (off < ciphertextslen
+           ? gcry_sexp_canon_len (ciphertexts + off, ciphertextslen - off,
+                                  NULL, NULL)
+           : 0);
+      if (!n)
+        return gpg_error (GPG_ERR_INV_SEXP);
+    }
+  if (off != ciphertextslen)
+    return gpg_error (GPG_ERR_INV_SEXP);
+
+  err = agent_key_from_file (ctrl, NULL, desc_text,
+                             NULL, &shadow_info,
+                             CACHE_MODE_NORMAL, NULL, &s_skey, NULL, NULL);
+  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY || (!err && shadow_info))
+    {
+      /* Divert each ciphertext to the card; the card or scdaemon
+       * takes care of caching the PIN.  */
+      err = 0;
+      for (i=0, p=ciphertexts; i < count; i++, p += n)
+        {
+          n = gcry_sexp_canon_len (p, ciphertextslen - (p - ciphertexts),
+                                   NULL, NULL);
+          itemerr = agent_pkdecrypt (ctrl, desc_text, p, n, outbuf,
+                                     &r_padding[i]);
+          if (gpg_err_code (itemerr) == GPG_ERR_NO_SECKEY
+              || gpg_err_code (itemerr) == GPG_ERR_CANCELED
+              || gpg_err_code (itemerr) == GPG_ERR_FULLY_CANCELED)
+            {
+              err = itemerr;
+              break;
+            }
+          else if (itemerr)
+            put_error_into_membuf (itemerr, outbuf);
+        }
+      goto leave;
+    }
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  for (i=0, p=ciphertexts; i < count; i++, p += n)
+    {
+      n = gcry_sexp_canon_len (p, ciphertextslen - (p - ciphertexts),
+                               NULL, NULL);
+      itemerr = gcry_sexp_sscan (&s_cipher, NULL, (const char*)p, n);
+      if (!itemerr)
+        {
+          agent_unlock_npth ();
+          itemerr = gcry_pk_decrypt (&s_plain, s_cipher, s_skey);
+          agent_lock_npth ();
+        }
+      if (itemerr)
+        {
+          if (opt.verbose)
+            log_info ("decryption of item %u failed: %s\n",
+                      i, gpg_strerror (itemerr));
+          put_error_into_membuf (itemerr, outbuf);
+        }
+      else
+        put_plain_into_membuf (s_plain, outbuf);
+      gcry_sexp_release (s_plain);
+      s_plain = NULL;
+      gcry_sexp_release (s_cipher);
+      s_cipher = NULL;
+    }
+
+ leave:
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  return err;
+}
+
+
+/* A job of agent_pkdecrypt_any.  */
+struct pkdecrypt_any_job_s
+{
+  gcry_sexp_t s_skey;
+  gcry_sexp_t s_cipher;
+  gcry_sexp_t s_plain;
+  gpg_error_t err;
+};
+
+/* The state shared by the threads of agent_pkdecrypt_any.  */
+struct pkdecrypt_any_s
+{
+  npth_mutex_t mutex;
+  unsigned int next;       /* The next job to process.  */
+  unsigned int count;
+  struct pkdecrypt_any_job_s *jobs;
+};
+
+
+/* Run the decryptions of agent_pkdecrypt_any until all are done.
+ * This is run by the worker threads and by the connection thread.  */
+static void *
+pkdecrypt_any_worker (void *arg)
+{
+  struct pkdecrypt_any_s *state = arg;
+  struct pkdecrypt_any_job_s *job;
+
+  for (;;)
+    {
+      npth_mutex_lock (&state->mutex);
+      job = NULL;
+      while (state->next < state->count && !job)
+        {
+          job = state->jobs + state->next++;
+          if (job->err)
+            job = NULL;
+        }
+      npth_mutex_unlock (&state->mutex);
+      if (!job)
+        break;
+
+      agent_unlock_npth ();
+      job->err = gcry_pk_decrypt (&job->s_plain, job->s_cipher, job->s_skey);
+      agent_lock_npth ();
+    }
+
+  return NULL;
+}
+
+
+/* Try to decrypt the COUNT ciphertexts at CIPHERTEXTS, which are
+ * given as concatenated canonical encoded S-expressions of
+ * CIPHERTEXTSLEN bytes in total, the I-th with the I-th of the COUNT
+ * binary keygrips at GRIPS.  This is used by a client which does not
+ * know which of its keys is the one for a message.  Only keys which
+ * can be used without user interaction are tried; the other keys -
+ * those which need a passphrase which is not cached, a confirmation
+ * or a smartcard - are reported with the error code
+ * GPG_ERR_NOT_SUPPORTED so that the client can use agent_pkdecrypt
+ * for them.  The keys are read one after the other but the
+ * decryptions run concurrently on up to PKDECRYPT_ANY_THREADS
+ * threads.  The results are appended in the same order to OUTBUF as
+ * done by agent_pkdecrypt_multi; the client needs to check which of
+ * them is a valid session key.  An error is only returned if the
+ * input is malformed.  */
+gpg_error_t
+agent_pkdecrypt_any (ctrl_t ctrl, const unsigned char (*grips)[20],
+                     const unsigned char *ciphertexts,
+                     size_t ciphertextslen, unsigned int count,
+                     membuf_t *outbuf)
+{
+  struct pkdecrypt_any_s state;
+  struct pkdecrypt_any_job_s *job;
+  npth_t thds[PKDECRYPT_ANY_THREADS];
+  npth_attr_t tattr;
+  unsigned int nthds = 0;
+  unsigned int nthreads = 0;
+  unsigned char *shadow_info;
+  pinentry_mode_t save_pinentry_mode;
+  const unsigned char *p;
+  gpg_error_t err;
+  size_t n, off;
+  unsigned int i;
+
+  for (i=0, off=0; i < count; i++, off += n)
+    {
+      n = (off < ciphertextslen
+           ? gcry_sexp_canon_len (ciphertexts + off, ciphertextslen - off,
+                                  NULL, NULL)
+           : 0);
+      if (!n)
+        return gpg_error (GPG_ERR_INV_SEXP);
+    }
+  if (off != ciphertextslen)
+    return gpg_error (GPG_ERR_INV_SEXP);
+
+  memset (&state, 0, sizeof state);
+  state.count = count;
+  state.jobs = xtrycalloc (count, sizeof *state.jobs);
+  if (!state.jobs)
+    return gpg_error_from_syserror ();
+
+  /* Read the keys.  A pinentry would pop up for keys which need
+   * interaction; we tell it to cancel instead.  */
+  save_pinentry_mode = ctrl->pinentry_mode;
+  ctrl->pinentry_mode = PINENTRY_MODE_CANCEL;
+  for (i=0, p=ciphertexts; i < count; i++, p += n)
+    {
+      job = state.jobs + i;
+      n = gcry_sexp_canon_len (p, ciphertextslen - (p - ciphertexts),
+                               NULL, NULL);
+      err = agent_key_from_file (ctrl, NULL, NULL, grips[i], &shadow_info,
+                                 CACHE_MODE_NORMAL, NULL, &job->s_skey,
+                                 NULL, NULL);
+      if (err || shadow_info)
+        {
+          if (opt.verbose)
+            log_info ("key %u needs to be used with PKDECRYPT: %s\n",
+                      i, err? gpg_strerror (err) : "shadowed");
+          job->err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+      else
+        {
+          job->err = gcry_sexp_sscan (&job->s_cipher, NULL,
+                                      (const char*)p, n);
+          if (!job->err)
+            nthreads++;
+        }
+      xfree (shadow_info);
+    }
+  ctrl->pinentry_mode = save_pinentry_mode;
+
+  /* The connection thread is one of the workers.  */
+  if (nthreads > PKDECRYPT_ANY_THREADS)
+    nthreads = PKDECRYPT_ANY_THREADS;
+  if (nthreads > 1 && !npth_mutex_init (&state.mutex, NULL))
+    {
+      if (!npth_attr_init (&tattr))
+        {
+          npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+          for (; nthds < nthreads - 1; nthds++)
+            if (npth_create (thds + nthds, &tattr,
+                             pkdecrypt_any_worker, &state))
+              break;
+          npth_attr_destroy (&tattr);
+        }
+      pkdecrypt_any_worker (&state);
+      for (i=0; i < nthds; i++)
+        npth_join (thds[i], NULL);
+      npth_mutex_destroy (&state.mutex);
+    }
+  else
+    {
+      for (i=0; i < count; i++)
+        {
+          job = state.jobs + i;
+          if (job->err)
+            continue;
+          agent_unlock_npth ();
+          job->err = gcry_pk_decrypt (&job->s_plain, job->s_cipher,
+                                      job->s_skey);
+          agent_lock_npth ();
+        }
+    }
+
+  for (i=0; i < count; i++)
+    {
+      job = state.jobs + i;
+      if (job->err)
+        put_error_into_membuf (job->err, outbuf);
+      else
+        put_plain_into_membuf (job->s_plain, outbuf);
+      gcry_sexp_release (job->s_plain);
+      gcry_sexp_release (job->s_cipher);
+      gcry_sexp_release (job->s_skey);
+    }
+  xfree (state.jobs);
+  return 0;
+}
+
+
 /* Reverse BUFFER to change the endianness.  */
 static void
 reverse_buffer (unsigned char *buffer, unsigned int length)
@@ -352,9 +678,11 @@ ecc_raw_kem (const struct ecc_params *ecc, gcry_sexp_t s_skey,
   if (err)
     goto leave;
 
+  agent_unlock_npth ();
   err = gcry_kem_decap (ecc->kem_algo, ecc_sk, ecc->scalar_len,
                         ecc_ct, ecc->point_len, ecc_ecdh, ecc->point_len,
                         NULL, 0);
+  agent_lock_npth ();
   if (err)
     {
       if (opt.verbose)
@@ -367,60 +695,48 @@ ecc_raw_kem (const struct ecc_params *ecc, gcry_sexp_t s_skey,
   return err;
 }
 
-static gpg_error_t
-get_cardkey (ctrl_t ctrl, const char *keygrip, gcry_sexp_t *r_s_pk)
-{
-  gpg_error_t err;
-  unsigned char *pkbuf;
-  size_t pkbuflen;
-
-  err = agent_card_readkey (ctrl, keygrip, &pkbuf, NULL);
-  if (err)
-    return err;
-
-  pkbuflen = gcry_sexp_canon_len (pkbuf, 0, NULL, NULL);
-  err = gcry_sexp_sscan (r_s_pk, NULL, (char*)pkbuf, pkbuflen);
-  if (err)
-    log_error ("failed to build S-Exp from received card key: %s\n",
-               gpg_strerror (err));
-
-  xfree (pkbuf);
-  return err;
-}
-
 static gpg_error_t
 ecc_get_curve (ctrl_t ctrl, gcry_sexp_t s_skey, const char **r_curve)
 {
-  gpg_error_t err = 0;
-  gcry_sexp_t s_skey_card = NULL;
-  const char *curve = NULL;
-  gcry_sexp_t key;
+  gpg_error_t err;
+  const char *curve;
 
   *r_curve = NULL;
 
   if (!s_skey)
     {
-      err = get_cardkey (ctrl, ctrl->keygrip, &s_skey_card);
+      unsigned char *pkbuf;
+      size_t pkbuflen;
+      char hexgrip[2*KEYGRIP_LEN+1];
+
+      /* We only need the curve of the card key, thus we look at the
+       * canonical encoding in place instead of building an S-expression
+       * object.  */
+      bin2hex (ctrl->keygrip, KEYGRIP_LEN, hexgrip);
+      err = agent_card_readkey (ctrl, hexgrip, &pkbuf, NULL);
       if (err)
-        goto leave;
+        return err;
 
-      key = s_skey_card;
+      pkbuflen = gcry_sexp_canon_len (pkbuf, 0, NULL, NULL);
+      if (!pkbuflen)
+        {
+          err = gpg_error (GPG_ERR_INV_SEXP);
+          log_error ("failed to build S-Exp from received card key: %s\n",
+                     gpg_strerror (err));
+          xfree (pkbuf);
+          return err;
+        }
+      curve = get_ecc_curve_from_canon_sexp (pkbuf, pkbuflen);
+      xfree (pkbuf);
     }
   else
-    key = s_skey;
+    curve = get_ecc_curve_from_key (s_skey);
 
-  curve = get_ecc_curve_from_key (key);
   if (!curve)
-    {
-      err = gpg_error (GPG_ERR_BAD_SECKEY);
-      goto leave;
-    }
+    return gpg_error (GPG_ERR_BAD_SECKEY);
 
   *r_curve = curve;
-
- leave:
-  gcry_sexp_release (s_skey_card);
-  return err;
+  return 0;
 }
 
 /* Given a private key in SEXP by S_SKEY0 and a cipher text by ECC_CT
@@ -680,9 +996,11 @@ composite_pgp_kem_decrypt (ctrl_t ctrl, const char *desc_text,
       err = gpg_error (GPG_ERR_INV_DATA);
       goto leave;
     }
+  agent_unlock_npth ();
   err = gcry_kem_decap (mlkem_kem_algo, mlkem_sk, mlkem_sk_len,
                         mlkem_ct, mlkem_ct_len, mlkem_ss, mlkem_ss_len,
                         NULL, 0);
+  agent_lock_npth ();
   if (err)
     {
       if (opt.verbose)
@@ -267,6 +267,42 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 }
 
 
+/* Encode the DATALEN bytes at DATA, as the hash to be signed with
+ * the private key S_SKEY of the public key algorithm ALGO, into a
+ * new S-expression stored at R_HASH.  The hash algorithm and the
+ * encoding flags are taken from CTRL.  */
+static gpg_error_t
+encode_hash_for_key (ctrl_t ctrl, int algo, gcry_sexp_t s_skey,
+                     const unsigned char *data, size_t datalen,
+                     gcry_sexp_t *r_hash)
+{
+  gpg_error_t err;
+
+  if (algo == GCRY_PK_EDDSA)
+    err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
+                           r_hash);
+  else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+    err = do_encode_raw_pkcs1 (data, datalen,
+                               gcry_pk_get_nbits (s_skey),
+                               r_hash);
+  else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
+    err = do_encode_dsa (data, datalen,
+                         algo, s_skey,
+                         r_hash);
+  else if (ctrl->digest.is_pss)
+    {
+      log_info ("signing with rsaPSS is currently only supported"
+                " for (some) smartcards\n");
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  else
+    err = do_encode_md (data, datalen,
+                        ctrl->digest.algo,
+                        r_hash,
+                        ctrl->digest.raw_value);
+  return err;
+}
+
 
 /* SIGN whatever information we have accumulated in CTRL and return
  * the signature S-expression.  LOOKUP is an optional function to
@@ -496,28 +532,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
       /* No smartcard, but a private key (in S_SKEY). */
 
       /* Put the hash into a sexp */
-      if (algo == GCRY_PK_EDDSA)
-        err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
-                               &s_hash);
-      else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
-        err = do_encode_raw_pkcs1 (data, datalen,
-                                   gcry_pk_get_nbits (s_skey),
-                                   &s_hash);
-      else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
-        err = do_encode_dsa (data, datalen,
-                             algo, s_skey,
-                             &s_hash);
-      else if (ctrl->digest.is_pss)
-        {
-          log_info ("signing with rsaPSS is currently only supported"
-                    " for (some) smartcards\n");
-          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
-        }
-      else
-        err = do_encode_md (data, datalen,
-                            ctrl->digest.algo,
-                            &s_hash,
-                            ctrl->digest.raw_value);
+      err = encode_hash_for_key (ctrl, algo, s_skey, data, datalen, &s_hash);
       if (err)
         goto leave;
 
@@ -528,7 +543,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
 
       /* sign */
+      agent_unlock_npth ();
       err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+      agent_lock_npth ();
       if (err)
         {
           log_error ("signing failed: %s\n", gpg_strerror (err));
@@ -567,7 +584,11 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
 
       if (!err)
-        err = gcry_pk_verify (s_sig, s_hash, sexp_key);
+        {
+          agent_unlock_npth ();
+          err = gcry_pk_verify (s_sig, s_hash, sexp_key);
+          agent_lock_npth ();
+        }
 
       if (err)
         {
@@ -597,6 +618,26 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+/* Append the canonical encoding of the signature S_SIG to OUTBUF.  */
+static gpg_error_t
+put_sig_into_membuf (gcry_sexp_t s_sig, membuf_t *outbuf)
+{
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+  log_assert (len);
+  buf = xtrymalloc (len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+  log_assert (len);
+  put_membuf (outbuf, buf, len);
+  xfree (buf);
+  return 0;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and write it
  * back to OUTFP.  If a CACHE_NONCE is given that cache item is first
  * tried to get a passphrase.  */
@@ -606,29 +647,103 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 {
   gpg_error_t err;
   gcry_sexp_t s_sig = NULL;
-  char *buf = NULL;
-  size_t len = 0;
 
   err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig, cache_mode,
                          NULL, NULL, 0);
-  if (err)
-    goto leave;
+  if (!err)
+    err = put_sig_into_membuf (s_sig, outbuf);
 
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
-  log_assert (len);
-  buf = xtrymalloc (len);
-  if (!buf)
+  gcry_sexp_release (s_sig);
+  return err;
+}
+
+
+/* Sign the COUNT digests of DIGESTLEN bytes each at DIGESTS, all
+ * computed with MDALGO, using the key set in CTRL and append the
+ * canonical encoded signatures in the same order to OUTBUF.  Other
+ * than calling agent_pksign for each digest, the key is read and
+ * unprotected only once; thus there is at most one passphrase or
+ * confirmation prompt for the whole batch.  Keys on a smartcard or a
+ * TPM are handled by agent_pksign for each digest.  */
+gpg_error_t
+agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text, int mdalgo,
+                    const unsigned char *digests, size_t digestlen,
+                    unsigned int count, membuf_t *outbuf,
+                    cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_hash = NULL;
+  gcry_sexp_t s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  unsigned int i;
+  int algo;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+  if (!digestlen || digestlen > MAX_DIGEST_LEN)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+
+  xfree (ctrl->digest.data);
+  ctrl->digest.data = NULL;
+  ctrl->digest.algo = mdalgo;
+  ctrl->digest.valuelen = digestlen;
+  ctrl->digest.raw_value = 0;
+  ctrl->digest.is_pss = 0;
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, NULL,
+                             &shadow_info, cache_mode, NULL,
+                             &s_skey, NULL, NULL);
+  if (gpg_err_code (err) == GPG_ERR_NO_SECKEY || (!err && shadow_info))
     {
-      err = gpg_error_from_syserror ();
+      /* Divert each digest to the card; the card or scdaemon takes
+       * care of caching the PIN.  */
+      for (i=0; i < count; i++)
+        {
+          memcpy (ctrl->digest.value, digests + i * digestlen, digestlen);
+          err = agent_pksign (ctrl, cache_nonce, desc_text,
+                              outbuf, cache_mode);
+          if (err)
+            break;
+        }
+      goto leave;
+    }
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
       goto leave;
     }
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
-  log_assert (len);
-  put_membuf (outbuf, buf, len);
 
- leave:
-  gcry_sexp_release (s_sig);
-  xfree (buf);
+  algo = get_pk_algo_from_key (s_skey);
+  for (i=0; i < count; i++)
+    {
+      err = encode_hash_for_key (ctrl, algo, s_skey,
+                                 digests + i * digestlen, digestlen,
+                                 &s_hash);
+      if (err)
+        goto leave;
 
+      agent_unlock_npth ();
+      err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+      agent_lock_npth ();
+      gcry_sexp_release (s_hash);
+      s_hash = NULL;
+      if (err)
+        {
+          log_error ("signing failed: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+
+      err = put_sig_into_membuf (s_sig, outbuf);
+      gcry_sexp_release (s_sig);
+      s_sig = NULL;
+      if (err)
+        goto leave;
+    }
+
+ leave:
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
   return err;
 }
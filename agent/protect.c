@@ -75,6 +75,19 @@ static const struct {
 static unsigned int s2k_calibration_time = AGENT_S2K_CALIBRATION;
 static unsigned long s2k_calibrated_count;
 
+/* The calibrated counts are cached per host in this file in the
+ * homedir.  A cached count is recalibrated after the given number of
+ * seconds and the file holds at most the given number of hosts.  */
+#define S2K_CALIBRATION_FILE      "s2k-calibration"
+#define S2K_CALIBRATION_MAX_AGE   (30*24*60*60)
+#define S2K_CALIBRATION_MAX_HOSTS 16
+
+/* Flags telling whether the cache file is used, has already been
+ * read and whether the count read from it needs a recalibration.  */
+static int s2k_calibration_cache;
+static int s2k_calibration_loaded;
+static int s2k_calibration_stale;
+
 
 /* A helper object for time measurement.  */
 struct calibrate_time_s
@@ -214,6 +227,186 @@ calibrate_s2k_count (void)
   return count;
 }
 
+/* Return the name of this host in BUFFER of SIZE bytes.  This is
+ * used as the key for the calibration cache.  */
+static void
+get_s2k_hostname (char *buffer, size_t size)
+{
+  char *p;
+
+  if (gethostname (buffer, size) || !*buffer)
+    snprintf (buffer, size, "-");
+  buffer[size-1] = 0;
+  for (p = buffer; *p; p++)
+    if (spacep (p) || *p == '#')
+      *p = '_';
+}
+
+
+/* Read the calibrated count for this host and the current
+ * calibration time from the cache file.  */
+static void
+load_s2k_calibration (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[512];
+  char myhost[256], host[256];
+  unsigned int ms;
+  unsigned long count, stamp;
+  time_t now;
+
+  s2k_calibration_loaded = 1;
+
+  fname = make_filename_try (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  if (!fname)
+    return;
+  fp = es_fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    return;
+
+  get_s2k_hostname (myhost, sizeof myhost);
+  while (es_fgets (line, sizeof line, fp))
+    {
+      if (*line == '#')
+        continue;
+      if (sscanf (line, "%255s %u %lu %lu", host, &ms, &count, &stamp) != 4
+          || strcmp (host, myhost)
+          || ms != s2k_calibration_time
+          || count < 65536)
+        continue;
+
+      s2k_calibrated_count = count;
+      now = gnupg_get_time ();
+      s2k_calibration_stale = (stamp > now
+                               || now - stamp > S2K_CALIBRATION_MAX_AGE);
+      if (opt.verbose)
+        log_info ("S2K calibration: using cached count %lu%s\n",
+                  count, s2k_calibration_stale? " (stale)":"");
+      break;
+    }
+  es_fclose (fp);
+}
+
+
+/* Store COUNT as the calibrated count for this host in the cache
+ * file.  Entries of other hosts are kept.  Errors are not fatal;
+ * the calibration is then just done again next time.  */
+static void
+store_s2k_calibration (unsigned long count)
+{
+  char *fname, *tmpfname = NULL;
+  estream_t fp = NULL, outfp = NULL;
+  char line[512];
+  char myhost[256], host[256];
+  int nhosts = 1;
+  int block = 0;
+  gpg_error_t err = 0;
+
+  fname = make_filename_try (gnupg_homedir (), S2K_CALIBRATION_FILE, NULL);
+  if (!fname)
+    return;
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    goto leave;
+
+  outfp = es_fopen (tmpfname, "w,mode=-rw-r");
+  if (!outfp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  get_s2k_hostname (myhost, sizeof myhost);
+  es_fprintf (outfp, "# Calibrated S2K counts - created by gpg-agent\n"
+              "# <host> <calibration-ms> <count> <timestamp>\n"
+              "%s %u %lu %lu\n",
+              myhost, s2k_calibration_time, count,
+              (unsigned long)gnupg_get_time ());
+
+  /* Copy the entries of the other hosts.  */
+  fp = es_fopen (fname, "r");
+  while (fp && es_fgets (line, sizeof line, fp)
+         && nhosts < S2K_CALIBRATION_MAX_HOSTS)
+    {
+      if (*line == '#' || sscanf (line, "%255s", host) != 1
+          || !strcmp (host, myhost) || !strchr (line, '\n'))
+        continue;
+      es_fputs (line, outfp);
+      nhosts++;
+    }
+  es_fclose (fp);
+
+  if (es_fclose (outfp))
+    {
+      outfp = NULL;
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  outfp = NULL;
+  err = gnupg_rename_file (tmpfname, fname, &block);
+  if (block)
+    gnupg_unblock_all_signals ();
+
+ leave:
+  if (outfp)
+    {
+      es_fclose (outfp);
+      gnupg_remove (tmpfname);
+    }
+  if (tmpfname && err && opt.verbose)
+    log_info ("error writing '%s': %s\n", fname, gpg_strerror (err));
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Enable the use of the calibration cache file in the homedir.  */
+void
+enable_s2k_calibration_cache (void)
+{
+  s2k_calibration_cache = 1;
+}
+
+
+/* Return true if the S2K count needs to be calibrated.  This is the
+ * case if there is no calibrated count or if the cached count is
+ * stale.  */
+int
+s2k_calibration_needed (void)
+{
+  if (!s2k_calibrated_count && s2k_calibration_cache
+      && !s2k_calibration_loaded)
+    load_s2k_calibration ();
+  return !s2k_calibrated_count || s2k_calibration_stale;
+}
+
+
+/* Calibrate the S2K count without changing the current value.  This
+ * only uses Libgcrypt and may thus be run without the nPth lock.
+ * The calibration time used is stored at R_MILLISECONDS.  */
+unsigned long
+measure_s2k_count (unsigned int *r_milliseconds)
+{
+  *r_milliseconds = s2k_calibration_time;
+  return calibrate_s2k_count ();
+}
+
+
+/* Set the calibrated S2K count to COUNT as returned by
+ * measure_s2k_count for MILLISECONDS.  */
+void
+set_calibrated_s2k_count (unsigned long count, unsigned int milliseconds)
+{
+  if (milliseconds != s2k_calibration_time)
+    return;  /* The calibration time has been changed meanwhile.  */
+  s2k_calibrated_count = count;
+  s2k_calibration_stale = 0;
+  if (s2k_calibration_cache)
+    store_s2k_calibration (count);
+}
+
 
 /* Set the calibration time.  This may be called early at startup or
  * at any time.  Thus it should one set variables.  */
@@ -226,6 +419,8 @@ set_s2k_calibration_time (unsigned int milliseconds)
     milliseconds = 60 * 1000;  /* Cap at 60 seconds.  */
   s2k_calibration_time = milliseconds;
   s2k_calibrated_count = 0;  /* Force re-calibration.  */
+  s2k_calibration_loaded = 0;
+  s2k_calibration_stale = 0;
 }
 
 
@@ -234,8 +429,16 @@ set_s2k_calibration_time (unsigned int milliseconds)
 unsigned long
 get_calibrated_s2k_count (void)
 {
+  if (!s2k_calibrated_count && s2k_calibration_cache
+      && !s2k_calibration_loaded)
+    load_s2k_calibration ();
   if (!s2k_calibrated_count)
-    s2k_calibrated_count = calibrate_s2k_count ();
+    {
+      unsigned int ms;
+      unsigned long count = measure_s2k_count (&ms);
+
+      set_calibrated_s2k_count (count, ms);
+    }
 
   /* Enforce a lower limit.  */
   return s2k_calibrated_count < 65536 ? 65536 : s2k_calibrated_count;
@@ -48,12 +48,33 @@ struct trustitem_s
     unsigned int de_vs:1;          /* Root CA for de-vs compliant PKI.    */
   } flags;
   unsigned char fpr[20];  /* The binary fingerprint. */
+  int next;               /* Index of the next item in the same hash
+                             bucket or -1.  */
 };
 typedef struct trustitem_s trustitem_t;
 
 /* Malloced table and its allocated size with all trust items. */
 static trustitem_t *trusttable;
 static size_t trusttablesize;
+
+/* The hash index into the trusttable.  Each bucket holds the index of
+   the first item with a fingerprint hashing to the bucket or -1; the
+   items of a bucket are chained in the order of the table.  */
+#define TRUSTINDEX_SIZE 1024
+static int trustindex[TRUSTINDEX_SIZE];
+
+/* The state of the trust files at the time they were read.  The
+   table is read again if one of them changed.  We look at the files
+   at most once per second.  */
+struct trustfile_stamp_s
+{
+  int exists;
+  time_t mtime;
+  off_t size;
+};
+static struct trustfile_stamp_s user_trustfile_stamp;
+static struct trustfile_stamp_s sys_trustfile_stamp;
+static time_t trustfiles_checked;
 /* A mutex used to protect the table. */
 static npth_mutex_t trusttable_lock;
 
@@ -118,6 +139,37 @@ unlock_trusttable (void)
 }
 
 
+/* Return the hash bucket for the binary fingerprint FPR.  */
+static inline unsigned int
+trustindex_bucket (const unsigned char *fpr)
+{
+  return ((fpr[0] << 8) | fpr[1]) % TRUSTINDEX_SIZE;
+}
+
+
+/* Build the hash index for the trusttable.  The caller needs to make
+   sure that the trusttable is locked.  */
+static void
+build_trustindex (void)
+{
+  unsigned int bucket;
+  size_t idx;
+  int i;
+
+  for (bucket=0; bucket < TRUSTINDEX_SIZE; bucket++)
+    trustindex[bucket] = -1;
+  /* Insert in reverse order so that a chain lists its items in the
+     order of the table.  */
+  for (idx = trusttablesize; idx; idx--)
+    {
+      i = idx - 1;
+      bucket = trustindex_bucket (trusttable[i].fpr);
+      trusttable[i].next = trustindex[bucket];
+      trustindex[bucket] = i;
+    }
+}
+
+
 /* Clear the trusttable.  The caller needs to make sure that the
    trusttable is locked.  */
 static inline void
@@ -147,6 +199,89 @@ make_sys_trustlist_name (void)
 }
 
 
+/* Store the state of the file FNAME at STAMP.  */
+static void
+get_trustfile_stamp (const char *fname, struct trustfile_stamp_s *stamp)
+{
+  struct stat st;
+
+  memset (stamp, 0, sizeof *stamp);
+  if (fname && !gnupg_stat (fname, &st))
+    {
+      stamp->exists = 1;
+      stamp->mtime = st.st_mtime;
+      stamp->size = st.st_size;
+    }
+}
+
+
+/* Return the name of the user trustlist or NULL if it is not used.
+   Caller must free.  */
+static char *
+make_user_trustlist_name (void)
+{
+  if (opt.no_user_trustlist)
+    return NULL;
+  return make_filename_try (gnupg_homedir (), "trustlist.txt", NULL);
+}
+
+
+/* Record the state of the trust files.  This is called before they
+   are read so that a change while reading triggers another read.  */
+static void
+stamp_trustfiles (void)
+{
+  char *fname;
+
+  fname = make_user_trustlist_name ();
+  get_trustfile_stamp (fname, &user_trustfile_stamp);
+  xfree (fname);
+  fname = make_sys_trustlist_name ();
+  get_trustfile_stamp (fname, &sys_trustfile_stamp);
+  xfree (fname);
+  trustfiles_checked = gnupg_get_time ();
+}
+
+
+/* Clear the trusttable if one of the trust files changed since they
+   were read.  The caller needs to make sure that the trusttable is
+   locked.  */
+static void
+check_trustfiles (void)
+{
+  struct trustfile_stamp_s stamp;
+  time_t now;
+  char *fname;
+  int changed;
+
+  if (!trusttable)
+    return;
+  now = gnupg_get_time ();
+  if (now == trustfiles_checked)
+    return;
+  trustfiles_checked = now;
+
+  fname = make_user_trustlist_name ();
+  get_trustfile_stamp (fname, &stamp);
+  xfree (fname);
+  changed = memcmp (&stamp, &user_trustfile_stamp, sizeof stamp);
+  if (!changed)
+    {
+      fname = make_sys_trustlist_name ();
+      get_trustfile_stamp (fname, &stamp);
+      xfree (fname);
+      changed = memcmp (&stamp, &sys_trustfile_stamp, sizeof stamp);
+    }
+  if (changed)
+    {
+      if (opt.verbose)
+        log_info ("trustlist changed - reloading\n");
+      clear_trusttable ();
+      bump_key_eventcounter ();
+    }
+}
+
+
 static gpg_error_t
 read_one_trustfile (const char *fname, int systrust,
                     trustitem_t **addr_of_table,
@@ -369,17 +504,13 @@ read_trustfiles (void)
     return gpg_error_from_syserror ();
   tableidx = 0;
 
-  if (opt.no_user_trustlist)
-    fname = NULL;
-  else
+  stamp_trustfiles ();
+  fname = make_user_trustlist_name ();
+  if (!fname && !opt.no_user_trustlist)
     {
-      fname = make_filename_try (gnupg_homedir (), "trustlist.txt", NULL);
-      if (!fname)
-        {
-          err = gpg_error_from_syserror ();
-          xfree (table);
-          return err;
-        }
+      err = gpg_error_from_syserror ();
+      xfree (table);
+      return err;
     }
 
   if (!fname || (ec = gnupg_access (fname, F_OK)))
@@ -412,7 +543,7 @@ read_trustfiles (void)
       return err;
     }
 
-  /* Fixme: we should drop duplicates and sort the table. */
+  /* Fixme: we should drop duplicates. */
   ti = xtryrealloc (table, (tableidx?tableidx:1) * sizeof *table);
   if (!ti)
     {
@@ -425,6 +556,7 @@ read_trustfiles (void)
   xfree (trusttable);
   trusttable = ti;
   trusttablesize = tableidx;
+  build_trustindex ();
   return 0;
 }
 
@@ -442,7 +574,7 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int listmode, int *r_disabled,
   gpg_error_t err = 0;
   int locked = already_locked;
   trustitem_t *ti;
-  size_t len;
+  int idx;
   unsigned char fprbin[20];
 
   if (r_disabled)
@@ -460,6 +592,7 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int listmode, int *r_disabled,
       locked = 1;
     }
 
+  check_trustfiles ();
   if (!trusttable)
     {
       err = read_trustfiles ();
@@ -472,43 +605,46 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int listmode, int *r_disabled,
 
   if (trusttable)
     {
-      for (ti=trusttable, len = trusttablesize; len; ti++, len--)
-        if (!memcmp (ti->fpr, fprbin, 20))
-          {
-            if (listmode && ti->flags.disabled)
-              continue;
-            if (ti->flags.disabled && r_disabled)
-              *r_disabled = 1;
-
-            /* Print status messages only if we have not been called
-               in a locked state.  */
-            if (already_locked)
-              ;
-            else if (listmode || ti->flags.relax || ti->flags.cm
-                     || ti->flags.qual || ti->flags.de_vs)
-              {
-                unlock_trusttable ();
-                locked = 0;
-                err = 0;
-                if (listmode)
-                  {
-                    char hexfpr[2*20+1];
-                    bin2hex (ti->fpr, 20, hexfpr);
-                    err = agent_write_status (ctrl,"TRUSTLISTFPR", hexfpr,NULL);
-                  }
-                if (!err && ti->flags.relax)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "relax",NULL);
-                if (!err && ti->flags.cm)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "cm", NULL);
-                if (!err && ti->flags.qual)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "qual",NULL);
-                if (!err && ti->flags.de_vs)
-                  err = agent_write_status (ctrl,"TRUSTLISTFLAG", "de-vs",NULL);
-              }
-
-            if (!err)
-              err = ti->flags.disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
-            goto leave;
+      for (idx = trustindex[trustindex_bucket (fprbin)]; idx != -1;
+           idx = ti->next)
+        {
+          ti = trusttable + idx;
+          if (memcmp (ti->fpr, fprbin, 20))
+            continue;
+          if (listmode && ti->flags.disabled)
+            continue;
+          if (ti->flags.disabled && r_disabled)
+            *r_disabled = 1;
+
+          /* Print status messages only if we have not been called
+             in a locked state.  */
+          if (already_locked)
+            ;
+          else if (listmode || ti->flags.relax || ti->flags.cm
+                   || ti->flags.qual || ti->flags.de_vs)
+            {
+              unlock_trusttable ();
+              locked = 0;
+              err = 0;
+              if (listmode)
+                {
+                  char hexfpr[2*20+1];
+                  bin2hex (ti->fpr, 20, hexfpr);
+                  err = agent_write_status (ctrl,"TRUSTLISTFPR", hexfpr,NULL);
+                }
+              if (!err && ti->flags.relax)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "relax",NULL);
+              if (!err && ti->flags.cm)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "cm", NULL);
+              if (!err && ti->flags.qual)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "qual",NULL);
+              if (!err && ti->flags.de_vs)
+                err = agent_write_status (ctrl,"TRUSTLISTFLAG", "de-vs",NULL);
+            }
+
+          if (!err)
+            err = ti->flags.disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
+          goto leave;
           }
     }
   err = gpg_error (GPG_ERR_NOT_TRUSTED);
@@ -543,6 +679,7 @@ agent_listtrusted (ctrl_t ctrl, void *assuan_context, int status_mode)
 
   lock_trusttable ();
   table_locked = 1;
+  check_trustfiles ();
   if (!trusttable)
     {
       err = read_trustfiles ();
@@ -35,6 +35,7 @@
 #include <assuan.h>
 
 #include "util.h"
+#include "sysutils.h"
 #include "asshelp.h"
 #include "status.h"
 
@@ -194,3 +195,35 @@ status_no_printf (ctrl_t ctrl, int no, const char *format, ...)
   va_end (arg_ptr);
   return err;
 }
+
+
+/* Send (DATA,DATALEN) as the result of the current command of the
+ * server CTX.  If the client has set an output descriptor with the
+ * OUTPUT command, the data is written there without escaping and
+ * line framing and the descriptor is closed; otherwise the data is
+ * sent with D lines.  */
+gpg_error_t
+send_data_or_output (assuan_context_t ctx, const void *data, size_t datalen)
+{
+  gpg_error_t err;
+  gnupg_fd_t fd;
+  estream_t fp;
+
+  fd = assuan_get_output_fd (ctx);
+  if (fd == GNUPG_INVALID_FD)
+    return assuan_send_data (ctx, data, datalen);
+
+  fp = open_stream_nc (fd, "wb");
+  if (!fp)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      if (es_write (fp, data, datalen, NULL) || es_fflush (fp))
+        err = gpg_error_from_syserror ();
+      else
+        err = 0;
+      es_fclose (fp);
+    }
+  assuan_close_output_fd (ctx);
+  return err;
+}
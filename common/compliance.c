@@ -47,6 +47,32 @@ static int module;
 static unsigned int min_compliant_rsa_length;
 
 
+/* The de-vs decisions for ciphers and digests depend only on the
+ * module and are thus computed once by gnupg_initialize_compliance.
+ * The cipher tables are indexed by the cipher algorithm and hold a
+ * bit for each allowed cipher mode; the digest table is indexed by
+ * the digest algorithm and holds DIGEST_FLAG_ values.  Algorithms
+ * not covered by the tables are neither compliant nor allowed.  */
+#define COMPLIANCE_TABLE_SIZE 16
+#define DIGEST_FLAG_COMPLIANT 1
+#define DIGEST_FLAG_CONSUMER  2
+#define DIGEST_FLAG_PRODUCER  4
+static unsigned int de_vs_cipher_compliant_modes[COMPLIANCE_TABLE_SIZE];
+static unsigned int de_vs_cipher_allowed_modes[2][COMPLIANCE_TABLE_SIZE];
+static unsigned char de_vs_digest_flags[COMPLIANCE_TABLE_SIZE];
+
+
+/* The OIDs of the Brainpool curves in OpenPGP format.  Comparing
+ * them directly avoids converting the OID of each key to a string
+ * and then mapping it to a curve name.  */
+static const unsigned char oid_brainpoolp256r1[] =
+  { 0x09, 0x2b, 0x24, 0x03, 0x03, 0x02, 0x08, 0x01, 0x01, 0x07 };
+static const unsigned char oid_brainpoolp384r1[] =
+  { 0x09, 0x2b, 0x24, 0x03, 0x03, 0x02, 0x08, 0x01, 0x01, 0x0b };
+static const unsigned char oid_brainpoolp512r1[] =
+  { 0x09, 0x2b, 0x24, 0x03, 0x03, 0x02, 0x08, 0x01, 0x01, 0x0d };
+
+
 /* Kludge to allow testing of the compliance options while not yet
  * approved. */
 static int
@@ -114,6 +140,153 @@ get_compliance_cache (enum gnupg_compliance_mode compliance, int for_rng)
 }
 
 
+/* Return true if CURVENAME or, if that is NULL, the curve OID in
+ * KEY[0] denotes one of the curves approved for de-vs.  */
+static int
+de_vs_curve_p (gcry_mpi_t key[], const char *curvename)
+{
+  const unsigned char *buf;
+  unsigned int nbits;
+  size_t len;
+
+  if (curvename)
+    return (!strcmp (curvename, "brainpoolP256r1")
+            || !strcmp (curvename, "brainpoolP384r1")
+            || !strcmp (curvename, "brainpoolP512r1"));
+
+  if (!key || !key[0] || !gcry_mpi_get_flag (key[0], GCRYMPI_FLAG_OPAQUE))
+    return 0;
+  buf = gcry_mpi_get_opaque (key[0], &nbits);
+  len = (nbits+7)/8;
+  return (buf && len == DIM (oid_brainpoolp256r1)
+          && (!memcmp (buf, oid_brainpoolp256r1, len)
+              || !memcmp (buf, oid_brainpoolp384r1, len)
+              || !memcmp (buf, oid_brainpoolp512r1, len)));
+}
+
+
+/* Return true if an RSA key of NBITS is compliant to de-vs.  */
+static int
+de_vs_rsa_length_p (unsigned int nbits)
+{
+  return ((nbits == 2048 || nbits == 3072 || nbits == 4096)
+          && nbits >= min_compliant_rsa_length);
+}
+
+
+/* The de-vs rule for gnupg_cipher_is_compliant.  */
+static int
+de_vs_cipher_compliant (cipher_algo_t cipher, enum gcry_cipher_modes mode)
+{
+  switch (cipher)
+    {
+    case CIPHER_ALGO_AES:
+    case CIPHER_ALGO_AES192:
+    case CIPHER_ALGO_AES256:
+    case CIPHER_ALGO_3DES:
+      switch (module)
+        {
+        case GNUPG_MODULE_NAME_GPG:
+          return mode == GCRY_CIPHER_MODE_CFB;
+        case GNUPG_MODULE_NAME_GPGSM:
+          return mode == GCRY_CIPHER_MODE_CBC;
+        }
+      log_assert (!"reached");
+
+    default:
+      return 0;
+    }
+}
+
+
+/* The de-vs rule for gnupg_cipher_is_allowed.  */
+static int
+de_vs_cipher_allowed (int producer, cipher_algo_t cipher,
+                      enum gcry_cipher_modes mode)
+{
+  switch (cipher)
+    {
+    case CIPHER_ALGO_AES:
+    case CIPHER_ALGO_AES192:
+    case CIPHER_ALGO_AES256:
+    case CIPHER_ALGO_3DES:
+      switch (module)
+        {
+        case GNUPG_MODULE_NAME_GPG:
+          return (mode == GCRY_CIPHER_MODE_NONE
+                  || mode == GCRY_CIPHER_MODE_CFB);
+        case GNUPG_MODULE_NAME_GPGSM:
+          return (mode == GCRY_CIPHER_MODE_NONE
+                  || mode == GCRY_CIPHER_MODE_CBC
+                  || (mode == GCRY_CIPHER_MODE_GCM && !producer));
+        }
+      log_assert (!"reached");
+
+    case CIPHER_ALGO_BLOWFISH:
+    case CIPHER_ALGO_CAMELLIA128:
+    case CIPHER_ALGO_CAMELLIA192:
+    case CIPHER_ALGO_CAMELLIA256:
+    case CIPHER_ALGO_CAST5:
+    case CIPHER_ALGO_IDEA:
+    case CIPHER_ALGO_TWOFISH:
+      return (module == GNUPG_MODULE_NAME_GPG
+              && (mode == GCRY_CIPHER_MODE_NONE
+                  || mode == GCRY_CIPHER_MODE_CFB)
+              && ! producer);
+    default:
+      return 0;
+    }
+}
+
+
+/* The de-vs rules for the digest predicates.  Returns a set of
+ * DIGEST_FLAG_ values.  */
+static unsigned int
+de_vs_digest_flags_for (digest_algo_t digest)
+{
+  switch (digest)
+    {
+    case DIGEST_ALGO_SHA256:
+    case DIGEST_ALGO_SHA384:
+    case DIGEST_ALGO_SHA512:
+      return (DIGEST_FLAG_COMPLIANT
+              | DIGEST_FLAG_CONSUMER | DIGEST_FLAG_PRODUCER);
+    case DIGEST_ALGO_SHA1:
+    case DIGEST_ALGO_SHA224:
+    case DIGEST_ALGO_RMD160:
+      return DIGEST_FLAG_CONSUMER;
+    case DIGEST_ALGO_MD5:
+      return module == GNUPG_MODULE_NAME_GPGSM? DIGEST_FLAG_CONSUMER : 0;
+    default:
+      return 0;
+    }
+}
+
+
+/* Fill the de-vs decision tables for the current module.  */
+static void
+build_de_vs_tables (void)
+{
+  int algo, mode, producer;
+
+  for (algo = 0; algo < COMPLIANCE_TABLE_SIZE; algo++)
+    {
+      de_vs_cipher_compliant_modes[algo] = 0;
+      de_vs_cipher_allowed_modes[0][algo] = 0;
+      de_vs_cipher_allowed_modes[1][algo] = 0;
+      for (mode = 0; mode < 32; mode++)
+        {
+          if (de_vs_cipher_compliant (algo, mode))
+            de_vs_cipher_compliant_modes[algo] |= (1u << mode);
+          for (producer = 0; producer < 2; producer++)
+            if (de_vs_cipher_allowed (producer, algo, mode))
+              de_vs_cipher_allowed_modes[producer][algo] |= (1u << mode);
+        }
+      de_vs_digest_flags[algo] = de_vs_digest_flags_for (algo);
+    }
+}
+
+
 /* Initializes the module.  Must be called with the current
  * GNUPG_MODULE_NAME.  Checks a few invariants, and tunes the policies
  * for the given module.  */
@@ -164,6 +337,7 @@ gnupg_initialize_compliance (int gnupg_module_name)
     }
 
   module = gnupg_module_name;
+  build_de_vs_tables ();
   initialized = 1;
 }
 
@@ -223,8 +397,6 @@ gnupg_pk_is_compliant (enum gnupg_compliance_mode compliance, int algo,
 
   if (compliance == CO_DE_VS)
     {
-      char *curve = NULL;
-
       switch (algotype)
         {
         case is_elg:
@@ -232,10 +404,7 @@ gnupg_pk_is_compliant (enum gnupg_compliance_mode compliance, int algo,
           break;
 
         case is_rsa:
-          result = ((keylength == 2048
-                     || keylength == 3072
-                     || keylength == 4096)
-                    && keylength >= min_compliant_rsa_length);
+          result = de_vs_rsa_length_p (keylength);
           /* Although rsaPSS was not part of the original evaluation
            * we got word that we can claim compliance.  */
           (void)algo_flags;
@@ -253,45 +422,22 @@ gnupg_pk_is_compliant (enum gnupg_compliance_mode compliance, int algo,
 	  break;
 
         case is_ecc:
-          if (!curvename && key)
-            {
-              curve = openpgp_oid_to_str (key[0]);
-              curvename = openpgp_oid_to_curve (curve, 0);
-              if (!curvename)
-                curvename = curve;
-            }
-
-          result = (curvename
-                    && (algo == PUBKEY_ALGO_ECDH
-                        || algo == PUBKEY_ALGO_ECDSA
-                        || algo == GCRY_PK_ECDH
-                        || algo == GCRY_PK_ECDSA)
-                    && (!strcmp (curvename, "brainpoolP256r1")
-                        || !strcmp (curvename, "brainpoolP384r1")
-                        || !strcmp (curvename, "brainpoolP512r1")));
+          result = ((algo == PUBKEY_ALGO_ECDH
+                     || algo == PUBKEY_ALGO_ECDSA
+                     || algo == GCRY_PK_ECDH
+                     || algo == GCRY_PK_ECDSA)
+                    && de_vs_curve_p (key, curvename));
           break;
 
         case is_kem:
-          if (!curvename && key)
-            {
-              curve = openpgp_oid_to_str (key[0]);
-              curvename = openpgp_oid_to_curve (curve, 0);
-              if (!curvename)
-                curvename = curve;
-            }
-
-          result = (curvename
-                    && (keylength == 768 || keylength == 1024)
-                    && (algo == PUBKEY_ALGO_KYBER)
-                    && (!strcmp (curvename, "brainpoolP256r1")
-                        || !strcmp (curvename, "brainpoolP384r1")
-                        || !strcmp (curvename, "brainpoolP512r1")));
+          result = ((keylength == 768 || keylength == 1024)
+                    && algo == PUBKEY_ALGO_KYBER
+                    && de_vs_curve_p (key, curvename));
           break;
 
         default:
           result = 0;
         }
-      xfree (curve);
     }
   else
     {
@@ -340,10 +486,7 @@ gnupg_pk_is_allowed (enum gnupg_compliance_mode compliance,
               break;
 	    case PK_USE_ENCRYPTION:
 	    case PK_USE_SIGNING:
-	      result = ((keylength == 2048
-                         || keylength == 3072
-                         || keylength == 4096)
-                        && keylength >= min_compliant_rsa_length);
+	      result = de_vs_rsa_length_p (keylength);
               break;
 	    default:
 	      log_assert (!"reached");
@@ -373,24 +516,7 @@ gnupg_pk_is_allowed (enum gnupg_compliance_mode compliance,
 	  if (use == PK_USE_DECRYPTION)
             result = 1;
           else if (use == PK_USE_ENCRYPTION)
-            {
-              char *curve = NULL;
-
-              if (!curvename && key)
-                {
-                  curve = openpgp_oid_to_str (key[0]);
-                  curvename = openpgp_oid_to_curve (curve, 0);
-                  if (!curvename)
-                    curvename = curve;
-                }
-
-              result = (curvename
-                        && (!strcmp (curvename, "brainpoolP256r1")
-                            || !strcmp (curvename, "brainpoolP384r1")
-                            || !strcmp (curvename, "brainpoolP512r1")));
-
-              xfree (curve);
-            }
+            result = de_vs_curve_p (key, curvename);
           break;
 
 	case PUBKEY_ALGO_ECDSA:
@@ -398,24 +524,8 @@ gnupg_pk_is_allowed (enum gnupg_compliance_mode compliance,
           if (use == PK_USE_VERIFICATION)
             result = 1;
           else
-            {
-              char *curve = NULL;
-
-              if (! curvename && key)
-	      {
-		curve = openpgp_oid_to_str (key[0]);
-		curvename = openpgp_oid_to_curve (curve, 0);
-		if (!curvename)
-		  curvename = curve;
-	      }
-
-              result = (use == PK_USE_SIGNING
-                         && curvename
-                         && (!strcmp (curvename, "brainpoolP256r1")
-                             || !strcmp (curvename, "brainpoolP384r1")
-                             || !strcmp (curvename, "brainpoolP512r1")));
-              xfree (curve);
-            }
+            result = (use == PK_USE_SIGNING
+                      && de_vs_curve_p (key, curvename));
           break;
 
 
@@ -430,25 +540,8 @@ gnupg_pk_is_allowed (enum gnupg_compliance_mode compliance,
 	  if (use == PK_USE_DECRYPTION)
             result = 1;
           else if (use == PK_USE_ENCRYPTION)
-            {
-              char *curve = NULL;
-
-              if (!curvename && key)
-                {
-                  curve = openpgp_oid_to_str (key[0]);
-                  curvename = openpgp_oid_to_curve (curve, 0);
-                  if (!curvename)
-                    curvename = curve;
-                }
-
-              result = (curvename
-                        && (keylength == 768 || keylength == 1024)
-                        && (!strcmp (curvename, "brainpoolP256r1")
-                            || !strcmp (curvename, "brainpoolP384r1")
-                            || !strcmp (curvename, "brainpoolP512r1")));
-
-              xfree (curve);
-            }
+            result = ((keylength == 768 || keylength == 1024)
+                      && de_vs_curve_p (key, curvename));
           break;
 
 	default:
@@ -477,31 +570,14 @@ gnupg_cipher_is_compliant (enum gnupg_compliance_mode compliance,
   switch (compliance)
     {
     case CO_DE_VS:
-      switch (cipher)
-	{
-	case CIPHER_ALGO_AES:
-	case CIPHER_ALGO_AES192:
-	case CIPHER_ALGO_AES256:
-	case CIPHER_ALGO_3DES:
-	  switch (module)
-	    {
-	    case GNUPG_MODULE_NAME_GPG:
-	      return mode == GCRY_CIPHER_MODE_CFB;
-	    case GNUPG_MODULE_NAME_GPGSM:
-	      return mode == GCRY_CIPHER_MODE_CBC;
-	    }
-	  log_assert (!"reached");
-
-	default:
-	  return 0;
-	}
-      log_assert (!"reached");
+      if ((unsigned int)cipher >= COMPLIANCE_TABLE_SIZE
+          || (unsigned int)mode >= 32)
+        return 0;
+      return !!(de_vs_cipher_compliant_modes[cipher] & (1u << mode));
 
     default:
       return 0;
     }
-
-  log_assert (!"reached");
 }
 
 
@@ -520,46 +596,16 @@ gnupg_cipher_is_allowed (enum gnupg_compliance_mode compliance, int producer,
   switch (compliance)
     {
     case CO_DE_VS:
-      switch (cipher)
-	{
-	case CIPHER_ALGO_AES:
-	case CIPHER_ALGO_AES192:
-	case CIPHER_ALGO_AES256:
-	case CIPHER_ALGO_3DES:
-	  switch (module)
-	    {
-	    case GNUPG_MODULE_NAME_GPG:
-	      return (mode == GCRY_CIPHER_MODE_NONE
-                      || mode == GCRY_CIPHER_MODE_CFB);
-	    case GNUPG_MODULE_NAME_GPGSM:
-	      return (mode == GCRY_CIPHER_MODE_NONE
-                      || mode == GCRY_CIPHER_MODE_CBC
-                      || (mode == GCRY_CIPHER_MODE_GCM && !producer));
-	    }
-	  log_assert (!"reached");
-
-	case CIPHER_ALGO_BLOWFISH:
-	case CIPHER_ALGO_CAMELLIA128:
-	case CIPHER_ALGO_CAMELLIA192:
-	case CIPHER_ALGO_CAMELLIA256:
-	case CIPHER_ALGO_CAST5:
-	case CIPHER_ALGO_IDEA:
-	case CIPHER_ALGO_TWOFISH:
-	  return (module == GNUPG_MODULE_NAME_GPG
-		  && (mode == GCRY_CIPHER_MODE_NONE
-                      || mode == GCRY_CIPHER_MODE_CFB)
-		  && ! producer);
-	default:
-	  return 0;
-	}
-      log_assert (!"reached");
+      if ((unsigned int)cipher >= COMPLIANCE_TABLE_SIZE
+          || (unsigned int)mode >= 32)
+        return 0;
+      return !!(de_vs_cipher_allowed_modes[!!producer][cipher]
+                & (1u << mode));
 
     default:
       /* The default policy is to allow all algorithms.  */
       return 1;
     }
-
-  log_assert (!"reached");
 }
 
 
@@ -574,22 +620,13 @@ gnupg_digest_is_compliant (enum gnupg_compliance_mode compliance,
   switch (compliance)
     {
     case CO_DE_VS:
-      switch (digest)
-	{
-	case DIGEST_ALGO_SHA256:
-	case DIGEST_ALGO_SHA384:
-	case DIGEST_ALGO_SHA512:
-	  return 1;
-	default:
-	  return 0;
-	}
-      log_assert (!"reached");
+      if ((unsigned int)digest >= COMPLIANCE_TABLE_SIZE)
+        return 0;
+      return !!(de_vs_digest_flags[digest] & DIGEST_FLAG_COMPLIANT);
 
     default:
       return 0;
     }
-
-  log_assert (!"reached");
 }
 
 
@@ -607,29 +644,15 @@ gnupg_digest_is_allowed (enum gnupg_compliance_mode compliance, int producer,
   switch (compliance)
     {
     case CO_DE_VS:
-      switch (digest)
-	{
-	case DIGEST_ALGO_SHA256:
-	case DIGEST_ALGO_SHA384:
-	case DIGEST_ALGO_SHA512:
-	  return 1;
-	case DIGEST_ALGO_SHA1:
-	case DIGEST_ALGO_SHA224:
-	case DIGEST_ALGO_RMD160:
-	  return ! producer;
-	case DIGEST_ALGO_MD5:
-	  return ! producer && module == GNUPG_MODULE_NAME_GPGSM;
-	default:
-	  return 0;
-	}
-      log_assert (!"reached");
+      if ((unsigned int)digest >= COMPLIANCE_TABLE_SIZE)
+        return 0;
+      return !!(de_vs_digest_flags[digest]
+                & (producer? DIGEST_FLAG_PRODUCER : DIGEST_FLAG_CONSUMER));
 
     default:
       /* The default policy is to allow all algorithms.  */
       return 1;
     }
-
-  log_assert (!"reached");
 }
 
 
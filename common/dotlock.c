@@ -412,6 +412,10 @@ struct dotlock_handle
   char *tname;         /* Name of the lockfile template.        */
   size_t nodename_off; /* Offset in TNAME of the nodename part. */
   size_t nodename_len; /* Length of the nodename part.          */
+  int gate_fd;         /* The open gate file or -1.             */
+  unsigned int use_ofd:1;     /* Serialize via the gate file.   */
+  unsigned int gate_locked:1; /* We hold the gate lock.         */
+  unsigned int shared:1;      /* Only the gate is read locked.  */
 #endif /*!HAVE_DOSISH_SYSTEM */
 };
 
@@ -439,6 +443,13 @@ static pthread_mutex_t all_lockfiles_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int never_lock;
 
 
+#ifdef HAVE_POSIX_SYSTEM
+static void ofd_gate_setup (dotlock_t h);
+static int ofd_gate_take (dotlock_t h, long *timeout, int type);
+static void ofd_gate_release (dotlock_t h);
+#endif
+
+
 
 
 #ifdef HAVE_DOSISH_SYSTEM
@@ -771,6 +782,7 @@ dotlock_create_unix (dotlock_t h, const char *file_to_lock)
   struct utsname utsbuf;
   size_t tnamelen;
   int pid;
+  int hardlinks = 0;
 
   pid = dotlock_get_process_id (h);
   snprintf (pidstr, sizeof pidstr, "%10d\n", pid);
@@ -861,6 +873,7 @@ dotlock_create_unix (dotlock_t h, const char *file_to_lock)
   switch (use_hardlinks_p (h->tname))
     {
     case 0: /* Yes.  */
+      hardlinks = 1;
       break;
     case 1: /* No.  */
       unlink (h->tname);
@@ -896,6 +909,12 @@ dotlock_create_unix (dotlock_t h, const char *file_to_lock)
   strcpy (stpcpy (h->lockname, file_to_lock), EXTSEP_S "lock");
   UNLOCK_all_lockfiles ();
 
+  /* Hardlinks indicate a sane file system; there we also try to use
+   * a gate file with open file description locks so that waiting for
+   * other processes does not need polling.  */
+  if (hardlinks && !h->by_parent)
+    ofd_gate_setup (h);
+
   if (h->no_write)
     {
       if (dotlock_detect_tname (h) < 0)
@@ -1071,6 +1090,7 @@ dotlock_create (const char *file_to_lock, unsigned int flags)
     return NULL;
   h->extra_fd = -1;
 #ifndef HAVE_DOSISH_SYSTEM
+  h->gate_fd = -1;
   h->by_parent = by_parent;
   h->no_write = no_write;
 #endif
@@ -1153,7 +1173,7 @@ dotlock_set_info_cb (dotlock_t h,
 static void
 dotlock_destroy_unix (dotlock_t h)
 {
-  if (h->locked && h->lockname)
+  if (h->locked && h->lockname && !h->shared)
     unlink (h->lockname);
   if (h->tname && !h->use_o_excl)
     unlink (h->tname);
@@ -1221,6 +1241,8 @@ dotlock_destroy (dotlock_t h)
     if (h->tname && !h->use_o_excl)
       unlink (h->tname);
 
+  if (h->gate_fd != -1)
+    close (h->gate_fd);
   xfree (h->tname);
 #endif
   xfree (h->lockname);
@@ -1272,10 +1294,150 @@ next_wait_interval (int *wtime, long *timeout)
 
 
 #ifdef HAVE_POSIX_SYSTEM
-/* Unix specific code of make_dotlock.  Returns 0 on success and -1 on
-   error.  */
+/* Open file description locks are bound to an open file and not to
+ * the process; thus unlike Posix record locks they work between
+ * threads and they are released if the process dies.  We use them on
+ * a gate file, which is never removed, so that processes wait in the
+ * kernel instead of polling the lock file.  */
+static void
+ofd_gate_setup (dotlock_t h)
+{
+#ifdef F_OFD_SETLKW
+  struct flock fl;
+  char *gname;
+  int fd;
+
+  gname = xtrymalloc (strlen (h->lockname) + 5 + 1);
+  if (!gname)
+    return;
+  strcpy (stpcpy (gname, h->lockname), EXTSEP_S "gate");
+  do
+    fd = open (gname, O_RDWR|O_CREAT, S_IRUSR|S_IRGRP|S_IROTH|S_IWUSR);
+  while (fd == -1 && errno == EINTR);
+  xfree (gname);
+  if (fd == -1)
+    return;  /* Eg. a read-only directory - use only the lock file.  */
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+  /* Check that the kernel and the file system support them.  */
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+  if (fcntl (fd, F_OFD_GETLK, &fl))
+    {
+      close (fd);
+      return;
+    }
+
+  h->gate_fd = fd;
+  h->use_ofd = 1;
+#else
+  (void)h;
+#endif /*!F_OFD_SETLKW*/
+}
+
+
+/* Take the gate lock of H; TYPE is F_WRLCK or F_RDLCK.  TIMEOUT has
+ * the semantics of dotlock_take and is updated by the time spent
+ * here.  Returns 0 on success or if the gate shall not be used
+ * anymore; -1 on error.  */
 static int
-dotlock_take_unix (dotlock_t h, long timeout)
+ofd_gate_take (dotlock_t h, long *timeout, int type)
+{
+#ifdef F_OFD_SETLKW
+  struct flock fl;
+  int wtime = 0;
+  int timedout = 0;
+  int blocking = 0;
+  int rc;
+
+ again:
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  rc = fcntl (h->gate_fd, blocking? F_OFD_SETLKW : F_OFD_SETLK, &fl);
+  if (!rc)
+    {
+      h->gate_locked = 1;
+      return 0;
+    }
+  if (errno == EINTR)
+    goto again;
+  if (errno != EAGAIN && errno != EACCES)
+    {
+      /* Eg. ENOLCK - fall back to the lock file only.  */
+      close (h->gate_fd);
+      h->gate_fd = -1;
+      h->use_ofd = 0;
+      return 0;
+    }
+
+  /* Wait in the kernel if we may wait forever.  With an info
+   * callback the caller wants to see the waiting messages and may
+   * cancel; thus we poll as for the lock file.  */
+  if (*timeout < 0 && !h->info_cb)
+    {
+      blocking = 1;
+      goto again;
+    }
+
+  if (*timeout)
+    {
+      struct timeval tv;
+      int wtimereal;
+
+      wtimereal = next_wait_interval (&wtime, timeout);
+      if (!*timeout)
+        timedout = 1;  /* remember.  */
+
+      tv.tv_sec = wtimereal / 1000;
+      tv.tv_usec = (wtimereal % 1000) * 1000;
+      select (0, NULL, NULL, NULL, &tv);
+      goto again;
+    }
+
+  my_set_errno (timedout? ETIMEDOUT : EACCES);
+  return -1;
+#else
+  (void)h;
+  (void)timeout;
+  (void)type;
+  return 0;
+#endif /*!F_OFD_SETLKW*/
+}
+
+
+/* Release the gate lock of H if we hold it.  ERRNO is not changed.  */
+static void
+ofd_gate_release (dotlock_t h)
+{
+#ifdef F_OFD_SETLKW
+  struct flock fl;
+  int saveerrno;
+
+  if (!h->gate_locked)
+    return;
+
+  saveerrno = errno;
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_UNLCK;
+  fl.l_whence = SEEK_SET;
+  fcntl (h->gate_fd, F_OFD_SETLK, &fl);
+  h->gate_locked = 0;
+  my_set_errno (saveerrno);
+#else
+  (void)h;
+#endif /*!F_OFD_SETLKW*/
+}
+#endif /*HAVE_POSIX_SYSTEM*/
+
+
+
+#ifdef HAVE_POSIX_SYSTEM
+/* Create the lock file for H using a hardlink or O_EXCL.  Returns 0
+   on success and -1 on error.  */
+static int
+dotlock_take_link (dotlock_t h, long timeout)
 {
   int wtime = 0;
   int timedout = 0;
@@ -1484,6 +1646,26 @@ dotlock_take_unix (dotlock_t h, long timeout)
   my_set_errno (timedout? ETIMEDOUT : EACCES);
   return -1;
 }
+
+
+/* Unix specific code of make_dotlock.  Returns 0 on success and -1 on
+   error.  */
+static int
+dotlock_take_unix (dotlock_t h, long timeout)
+{
+  int rc;
+
+  /* Processes using the gate wait for each other in the kernel; the
+   * lock file is still required for other implementations.  */
+  if (h->use_ofd && !h->gate_locked
+      && ofd_gate_take (h, &timeout, F_WRLCK))
+    return -1;
+
+  rc = dotlock_take_link (h, timeout);
+  if (rc)
+    ofd_gate_release (h);
+  return rc;
+}
 #endif /*HAVE_POSIX_SYSTEM*/
 
 
@@ -1578,6 +1760,48 @@ dotlock_take (dotlock_t h, long timeout)
 }
 
 
+/* Take a shared lock on H.  A shared lock only excludes the locks
+   taken with dotlock_take; it is meant for processes which only read
+   the file.  This requires the gate file; without it, or if a lock
+   file of an implementation not using the gate exists, an exclusive
+   lock is taken instead.  TIMEOUT and the return value are as with
+   dotlock_take; the lock is released with dotlock_release.  */
+int
+dotlock_take_shared (dotlock_t h, long timeout)
+{
+  if ( h->disable )
+    return 0; /* Locks are completely disabled.  Return success. */
+
+  if ( h->locked )
+    {
+      my_debug_1 ("Oops, '%s' is already locked\n", h->lockname);
+      return 0;
+    }
+
+#ifdef HAVE_POSIX_SYSTEM
+  if (h->use_ofd)
+    {
+      struct stat sb;
+
+      if (ofd_gate_take (h, &timeout, F_RDLCK))
+        return -1;
+      if (h->gate_locked)
+        {
+          if (stat (h->lockname, &sb) && errno == ENOENT)
+            {
+              h->locked = 1;
+              h->shared = 1;
+              return 0;
+            }
+          ofd_gate_release (h);
+        }
+    }
+#endif /*HAVE_POSIX_SYSTEM*/
+
+  return dotlock_take (h, timeout);
+}
+
+
 
 #ifdef HAVE_POSIX_SYSTEM
 /* Unix specific code of release_dotlock.  */
@@ -1587,6 +1811,13 @@ dotlock_release_unix (dotlock_t h)
   int pid, same_node;
   int saveerrno;
 
+  if (h->shared)
+    {
+      ofd_gate_release (h);
+      h->shared = 0;
+      return 0;
+    }
+
   pid = read_lockfile (h, &same_node, NULL);
   if ( pid == -1 )
     {
@@ -1622,6 +1853,7 @@ dotlock_release_unix (dotlock_t h)
     }
   /* Fixme: As an extra check we could check whether the link count is
      now really at 1. */
+  ofd_gate_release (h);
   return 0;
 }
 #endif /*HAVE_POSIX_SYSTEM */
@@ -81,6 +81,7 @@
 # define dotlock_get_fd           _DOTLOCK_PREFIX(dotlock_get_fd)
 # define dotlock_destroy          _DOTLOCK_PREFIX(dotlock_destroy)
 # define dotlock_take             _DOTLOCK_PREFIX(dotlock_take)
+# define dotlock_take_shared      _DOTLOCK_PREFIX(dotlock_take_shared)
 # define dotlock_release          _DOTLOCK_PREFIX(dotlock_release)
 # define dotlock_remove_lockfiles _DOTLOCK_PREFIX(dotlock_remove_lockfiles)
 #endif /*DOTLOCK_EXT_SYM_PREFIX*/
@@ -125,6 +126,7 @@ void dotlock_set_info_cb (dotlock_t h,
                           void *opaque);
 void dotlock_destroy (dotlock_t h);
 int dotlock_take (dotlock_t h, long timeout);
+int dotlock_take_shared (dotlock_t h, long timeout);
 int dotlock_is_locked (dotlock_t h);
 int dotlock_release (dotlock_t h);
 void dotlock_remove_lockfiles (void);
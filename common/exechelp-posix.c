@@ -177,6 +177,40 @@ get_max_fds (void)
 }
 
 
+/* Try to close all file descriptors starting with FIRST except for
+ * those in EXCEPT using close_range or closefrom.  This takes only a
+ * few system calls even with a huge RLIMIT_NOFILE.  Returns 0 on
+ * success and -1 if the caller needs to close them one by one.  */
+static int
+close_fds_fast (int first, const int *except)
+{
+#ifdef HAVE_CLOSE_RANGE
+  unsigned int lo = first;
+
+  if (except)
+    for (; *except != -1; except++)
+      {
+        if (*except < 0 || (unsigned int)*except < lo)
+          continue;
+        if ((unsigned int)*except > lo
+            && close_range (lo, *except - 1, 0))
+          return -1;  /* Eg. ENOSYS from an old kernel.  */
+        lo = *except + 1;
+      }
+  return close_range (lo, ~0U, 0)? -1 : 0;
+#elif defined(HAVE_CLOSEFROM)
+  if (except)
+    return -1;
+  closefrom (first);
+  return 0;
+#else
+  (void)first;
+  (void)except;
+  return -1;
+#endif
+}
+
+
 /* Close all file descriptors starting with descriptor FIRST.  If
    EXCEPT is not NULL, it is expected to be a list of file descriptors
    which shall not be closed.  This list shall be sorted in ascending
@@ -184,9 +218,16 @@ get_max_fds (void)
 void
 close_all_fds (int first, const int *except)
 {
-  int max_fd = get_max_fds ();
+  int max_fd;
   int fd, i, except_start;
 
+  if (!close_fds_fast (first, except))
+    {
+      gpg_err_set_errno (0);
+      return;
+    }
+
+  max_fd = get_max_fds ();
   if (except)
     {
       except_start = 0;
@@ -44,6 +44,7 @@
 #include "util.h"
 #include "i18n.h"
 #include "w32help.h"
+#include "starttrace.h"
 
 /* This object is used to register memory cleanup functions.
    Technically they are not needed but they can avoid frequent
@@ -132,6 +133,7 @@ writestring_via_estream (int mode, const char *string)
 void
 early_system_init (void)
 {
+  starttrace_init ();
 }
 
 
@@ -153,6 +155,9 @@ _init_common_subsystems (gpg_err_source_t errsource, int *argcp, char ***argvp)
   /* Store the error source in a global variable. */
   default_errsource = errsource;
 
+  starttrace_check_args (argcp, argvp);
+  STARTTRACE_MARK ("early init");
+
   atexit (run_mem_cleanup);
 
   /* Try to auto set the character set.  */
@@ -174,6 +179,7 @@ _init_common_subsystems (gpg_err_source_t errsource, int *argcp, char ***argvp)
       log_fatal (_("%s is too old (need %s, have %s)\n"), "libgcrypt",
                  NEED_LIBGCRYPT_VERSION, gcry_check_version (NULL));
     }
+  STARTTRACE_MARK ("libgcrypt");
 
   /* Initialize the Estream library. */
   gpgrt_init ();
@@ -234,11 +240,11 @@ _init_common_subsystems (gpg_err_source_t errsource, int *argcp, char ***argvp)
   /* On Windows we use our own parser for the command line
    * so that we can return an array of utf-8 encoded strings.  */
   prepare_w32_commandline (argcp, argvp);
-#else
-  (void)argcp;
-  (void)argvp;
+  /* The new command line may again have the option.  */
+  starttrace_check_args (argcp, argvp);
 #endif
 
+  STARTTRACE_MARK ("common subsystems");
 }
 
 
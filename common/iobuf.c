@@ -31,15 +31,23 @@
  */
 
 #include <config.h>
+#ifdef WITHOUT_NPTH /* Give the Makefile a chance to build without Pth.  */
+# undef HAVE_NPTH
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_MMAP_INPUT 1
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -52,16 +60,33 @@
 #endif /* __riscos__ */
 
 #include <assuan.h>
+#if defined(HAVE_NPTH) && !defined(HAVE_W32_SYSTEM)
+# include <npth.h>
+# define USE_ASYNC_IO 1
+#endif
 
 #include "util.h"
 #include "sysutils.h"
 #include "iobuf.h"
+#ifdef USE_ASYNC_IO
+# include "thread-pool.h"
+#endif
+#include "tstats.h"
+#include "memstat.h"
 
 /*-- Begin configurable part.  --*/
 
 /* The standard size of the internal buffers.  */
 #define DEFAULT_IOBUF_BUFFER_SIZE  (64*1024)
 
+/* The size of the internal buffers for streams carrying bulk data,
+ * that is large regular files and pipes.  */
+#define BULK_IOBUF_BUFFER_SIZE  (1024*1024)
+
+/* The initial size of the buffers of temp streams.  They are mostly
+ * used for single packets and keyblocks and grow as needed.  */
+#define TEMP_IOBUF_BUFFER_SIZE  (4*1024)
+
 /* To avoid a potential DoS with compression packets we better limit
    the number of filters in a chain.  */
 #define MAX_NESTING_FILTER 64
@@ -70,12 +95,31 @@
    instead of the internal buffers. */
 #define IOBUF_ZEROCOPY_THRESHOLD_SIZE 1024
 
+/* With async I/O the cached pages of a streamed regular file are
+ * dropped in steps of this size.  */
+#define AIO_DONTNEED_CHUNK (8*1024*1024)
+
 /*-- End configurable part.  --*/
 
 /* The size of the iobuffers.  This can be changed using the
  * iobuf_set_buffer_size function.  */
 static unsigned int iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
 
+/* Set if the size has been set using iobuf_set_buffer_size.  All
+ * streams then use that size.  */
+static int iobuf_buffer_size_fixed;
+
+/* Regular input files of at least this size are mapped into memory
+ * instead of being read with read(2).  A value of 0 disables the
+ * mapped input mode.  This can be changed using the
+ * iobuf_set_mmap_threshold function.  */
+static unsigned int iobuf_mmap_threshold;
+
+/* If set the reads and writes of file streams carrying bulk data are
+ * done on a helper thread.  This can be changed using the
+ * iobuf_set_async_io function.  */
+static int iobuf_async_io;
+
 
 #ifdef HAVE_W32_SYSTEM
 # define FD_FOR_STDIN  (GetStdHandle (STD_INPUT_HANDLE))
@@ -98,9 +142,43 @@ typedef struct
   char peeked[32];     /* Read ahead buffer.  */
   byte npeeked;        /* Number of bytes valid in peeked.  */
   byte upeeked;        /* Number of bytes used from peeked.  */
+#ifdef USE_MMAP_INPUT
+  byte *map;           /* If not NULL the file is mapped at this address.  */
+  size_t maplen;       /* Length of the mapping.  */
+  size_t mappos;       /* Current read offset into the mapping.  */
+#endif
+#ifdef USE_ASYNC_IO
+  struct file_aio_s *aio; /* The async I/O state or NULL.  */
+  int no_aio;          /* Do not use async I/O for this stream.  */
+#endif
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
+#ifdef USE_ASYNC_IO
+/* The state of the async I/O of a file filter.  One read or write is
+ * in flight at a time; it runs on a thread of the thread pool while
+ * the caller processes the data of the previous one.  The fields
+ * other than BUSY and ERR are owned by the helper thread while BUSY
+ * is set.  */
+struct file_aio_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;    /* Signaled when an operation has finished.  */
+  int fd;
+  int use;             /* IOBUF_INPUT or IOBUF_OUTPUT.  */
+  int busy;            /* An operation is in flight.  */
+  int eof;             /* The last read hit the end of the file.  */
+  int err;             /* The errno of the last failed operation.  */
+  int reported;        /* The write error has already been logged.  */
+  byte *buffer;
+  size_t size;         /* Allocated size of BUFFER.  */
+  size_t len;          /* Number of bytes in BUFFER.  */
+  size_t pos;          /* Number of bytes already consumed.  */
+  off_t offset;        /* File offset or -1 if not a regular file.  */
+  off_t advised;       /* Offset up to which DONTNEED has been given.  */
+};
+#endif /*USE_ASYNC_IO*/
+
 /* The context used by the estream filter.  */
 typedef struct
 {
@@ -147,6 +225,11 @@ typedef struct
 #define OP_MIN_PARTIAL_CHUNK	  512
 #define OP_MIN_PARTIAL_CHUNK_2POW 9
 
+/* The largest chunk a partial length header can describe (1 GiB).
+ * Larger chunks are only written if the data was handed to the
+ * filter in one go, for example from a large external buffer.  */
+#define OP_MAX_PARTIAL_CHUNK_2POW 30
+
 /* The context we use for the block filter (used to handle OpenPGP
    length information header).  */
 typedef struct
@@ -455,6 +538,420 @@ fd_cache_open (const char *fname, const char *mode)
 }
 
 
+#ifdef USE_MMAP_INPUT
+/* Try to map the regular file described by the file filter context
+ * A into memory.  On success the underflow handler serves the data
+ * directly from the page cache instead of issuing read(2) calls.  A
+ * failure is not an error; we then silently fall back to the read
+ * path.  */
+static void
+file_filter_map (file_filter_ctx_t *a)
+{
+  struct stat st;
+  off_t offset;
+  void *p;
+
+  if (!iobuf_mmap_threshold || a->print_only_name)
+    return;
+  if (fstat (a->fp, &st) || !S_ISREG (st.st_mode))
+    return;
+  if (st.st_size < iobuf_mmap_threshold || (uint64_t)st.st_size > SIZE_MAX)
+    return;
+  offset = lseek (a->fp, 0, SEEK_CUR);
+  if (offset == (off_t)-1 || offset > st.st_size)
+    return;
+
+  p = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, a->fp, 0);
+  if (p == MAP_FAILED)
+    {
+      if (DBG_IOBUF)
+        log_debug ("%s: mmap failed: %s\n", a->fname, strerror (errno));
+      return;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise (p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+  a->map = p;
+  a->maplen = (size_t)st.st_size;
+  a->mappos = (size_t)offset;
+  if (DBG_IOBUF)
+    log_debug ("%s: mapped %zu bytes\n", a->fname, a->maplen);
+}
+
+
+/* Release the mapping of the file filter context A.  The file
+ * position of the underlying descriptor is set to the current read
+ * position so that the descriptor can be used as if the data had
+ * been read the regular way.  */
+static void
+file_filter_unmap (file_filter_ctx_t *a)
+{
+  if (!a->map)
+    return;
+  munmap (a->map, a->maplen);
+  a->map = NULL;
+  if (lseek (a->fp, (off_t)a->mappos, SEEK_SET) == (off_t)-1 && DBG_IOBUF)
+    log_debug ("%s: lseek after munmap failed: %s\n",
+               a->fname, strerror (errno));
+}
+#endif /*USE_MMAP_INPUT*/
+
+
+#ifndef HAVE_W32_SYSTEM
+/* Wrappers for read and write which release the npth lock, if a
+ * syscall clamp has been installed, so that other threads can run
+ * while we are blocked.  ERRNO is preserved.  */
+static ssize_t
+read_clamped (int fd, void *buf, size_t n)
+{
+  void (*pre)(void), (*post)(void);
+  ssize_t nread;
+  int saved_errno;
+
+  gpgrt_get_syscall_clamp (&pre, &post);
+  if (pre)
+    pre ();
+  nread = read (fd, buf, n);
+  if (post)
+    {
+      saved_errno = errno;
+      post ();
+      errno = saved_errno;
+    }
+  return nread;
+}
+
+static ssize_t
+write_clamped (int fd, const void *buf, size_t n)
+{
+  void (*pre)(void), (*post)(void);
+  ssize_t nwritten;
+  int saved_errno;
+
+  gpgrt_get_syscall_clamp (&pre, &post);
+  if (pre)
+    pre ();
+  nwritten = write (fd, buf, n);
+  if (post)
+    {
+      saved_errno = errno;
+      post ();
+      errno = saved_errno;
+    }
+  return nwritten;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+#ifdef USE_ASYNC_IO
+/* Attributes for the detached helper threads.  */
+static npth_attr_t aio_tattr;
+static int aio_tattr_ready;
+
+
+/* Give the DONTNEED hint for the part of the file of AIO which has
+ * been processed.  Written pages are dirty for a while and can't be
+ * dropped right away; for output we thus lag one chunk behind.  */
+static void
+aio_advise (struct file_aio_s *aio, int final)
+{
+#ifdef HAVE_POSIX_FADVISE
+  off_t end;
+
+  if (aio->offset == (off_t)-1)
+    return;
+  end = aio->offset;
+  if (aio->use == IOBUF_OUTPUT)
+    end -= AIO_DONTNEED_CHUNK;
+  if (end > aio->advised && (final || end - aio->advised >= AIO_DONTNEED_CHUNK))
+    {
+      posix_fadvise (aio->fd, aio->advised, end - aio->advised,
+                     POSIX_FADV_DONTNEED);
+      aio->advised = end;
+    }
+#else
+  (void)aio;
+  (void)final;
+#endif
+}
+
+
+/* The helper thread function: Fill the buffer of the AIO object
+ * ARG or write it out.  */
+static void *
+aio_job (void *arg)
+{
+  struct file_aio_s *aio = arg;
+  size_t nbytes = 0;
+  ssize_t n;
+  int err = 0;
+  int eof = 0;
+
+  if (aio->use == IOBUF_INPUT)
+    {
+      while (nbytes < aio->size)
+        {
+          do
+            n = read_clamped (aio->fd, aio->buffer + nbytes,
+                              aio->size - nbytes);
+          while (n == -1 && errno == EINTR);
+          if (n > 0)
+            nbytes += n;
+          else
+            {
+              if (!n)
+                eof = 1;
+              else
+                err = errno;
+              break;
+            }
+        }
+    }
+  else
+    {
+      while (nbytes < aio->len)
+        {
+          do
+            n = write_clamped (aio->fd, aio->buffer + nbytes,
+                               aio->len - nbytes);
+          while (n == -1 && errno == EINTR);
+          if (n == -1)
+            {
+              err = errno;
+              break;
+            }
+          nbytes += n;
+        }
+    }
+  if (aio->offset != (off_t)-1)
+    {
+      aio->offset += nbytes;
+      aio_advise (aio, 0);
+    }
+
+  npth_mutex_lock (&aio->lock);
+  if (aio->use == IOBUF_INPUT)
+    {
+      aio->len = nbytes;
+      aio->pos = 0;
+      aio->eof = eof;
+    }
+  if (err)
+    aio->err = err;
+  aio->busy = 0;
+  npth_cond_signal (&aio->cond);
+  npth_mutex_unlock (&aio->lock);
+  return NULL;
+}
+
+
+/* Start the next read or write of AIO.  If no thread is available
+ * the operation is done right here.  */
+static void
+aio_submit (struct file_aio_s *aio)
+{
+  aio->busy = 1;
+  if (thread_pool_run (&aio_tattr, aio_job, aio))
+    aio_job (aio);
+}
+
+
+/* Wait until the operation in flight of AIO has finished.  */
+static void
+aio_wait (struct file_aio_s *aio)
+{
+  npth_mutex_lock (&aio->lock);
+  while (aio->busy)
+    npth_cond_wait (&aio->cond, &aio->lock);
+  npth_mutex_unlock (&aio->lock);
+}
+
+
+/* Set up the async I/O of the file filter context A for USE with
+ * buffers of SIZE bytes.  Returns true if async I/O is to be used
+ * for the stream.  This is only done for pipes, sockets, large input
+ * files and output files.  */
+static int
+file_filter_aio_start (file_filter_ctx_t *a, int use, size_t size)
+{
+  struct file_aio_s *aio;
+  struct stat st;
+  int regular;
+
+  if (a->aio)
+    return 1;
+  if (!iobuf_async_io || a->no_aio)
+    return 0;
+
+  a->no_aio = 1;  /* Try only once.  */
+  if (fstat (a->fp, &st))
+    return 0;
+  regular = S_ISREG (st.st_mode);
+  if (!S_ISFIFO (st.st_mode) && !S_ISSOCK (st.st_mode)
+      && !(regular && (use == IOBUF_OUTPUT
+                       || st.st_size >= BULK_IOBUF_BUFFER_SIZE)))
+    return 0;
+
+  if (!aio_tattr_ready)
+    {
+      if (npth_attr_init (&aio_tattr))
+        return 0;
+      npth_attr_setdetachstate (&aio_tattr, NPTH_CREATE_DETACHED);
+      aio_tattr_ready = 1;
+    }
+
+  aio = xtrycalloc (1, sizeof *aio);
+  if (!aio)
+    return 0;
+  if (use == IOBUF_INPUT || size < iobuf_buffer_size)
+    size = use == IOBUF_INPUT? BULK_IOBUF_BUFFER_SIZE : iobuf_buffer_size;
+  aio->buffer = xtrymalloc (size);
+  if (!aio->buffer)
+    {
+      xfree (aio);
+      return 0;
+    }
+  if (npth_mutex_init (&aio->lock, NULL))
+    {
+      xfree (aio->buffer);
+      xfree (aio);
+      return 0;
+    }
+  if (npth_cond_init (&aio->cond, NULL))
+    {
+      npth_mutex_destroy (&aio->lock);
+      xfree (aio->buffer);
+      xfree (aio);
+      return 0;
+    }
+  aio->fd = a->fp;
+  aio->use = use;
+  aio->size = size;
+  aio->offset = regular? lseek (a->fp, 0, SEEK_CUR) : (off_t)-1;
+  aio->advised = aio->offset;
+#ifdef HAVE_POSIX_FADVISE
+  if (regular && use == IOBUF_INPUT)
+    posix_fadvise (a->fp, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  a->aio = aio;
+  a->no_aio = 0;
+  if (DBG_IOBUF)
+    log_debug ("%s: using async I/O\n", a->fname);
+  return 1;
+}
+
+
+/* Wait for the operation in flight of the file filter context A.  For
+ * an output stream the error of a failed write is returned.  */
+static int
+file_filter_aio_wait (file_filter_ctx_t *a)
+{
+  struct file_aio_s *aio = a->aio;
+  int rc = 0;
+
+  aio_wait (aio);
+  if (aio->use == IOBUF_OUTPUT && aio->err)
+    {
+      rc = gpg_error_from_errno (aio->err);
+      if (!aio->reported)
+        log_error ("%s: write error: %s\n", a->fname, gpg_strerror (rc));
+      aio->reported = 1;
+    }
+  return rc;
+}
+
+
+/* Wait for the operation in flight of the file filter context A and
+ * release the async I/O state.  Data read ahead is discarded.  */
+static void
+file_filter_aio_release (file_filter_ctx_t *a)
+{
+  struct file_aio_s *aio = a->aio;
+
+  if (!aio)
+    return;
+  aio_wait (aio);
+  if (aio->use == IOBUF_INPUT)
+    aio_advise (aio, 1);
+  wipememory (aio->buffer, aio->size);
+  xfree (aio->buffer);
+  npth_cond_destroy (&aio->cond);
+  npth_mutex_destroy (&aio->lock);
+  xfree (aio);
+  a->aio = NULL;
+}
+
+
+/* The underflow handler for async I/O: Copy up to SIZE bytes of the
+ * data read ahead to BUF and start reading the next block as soon as
+ * the buffer has been consumed.  */
+static int
+file_filter_aio_read (file_filter_ctx_t *a, byte *buf, size_t size,
+                      size_t *ret_len)
+{
+  struct file_aio_s *aio = a->aio;
+  size_t n;
+  int rc = 0;
+
+  if (!aio->busy && aio->pos == aio->len && !aio->eof && !aio->err)
+    aio_submit (aio);
+  aio_wait (aio);
+  n = aio->len - aio->pos;
+  if (n)
+    {
+      if (n > size)
+        n = size;
+      memcpy (buf, aio->buffer + aio->pos, n);
+      aio->pos += n;
+      if (aio->pos == aio->len && !aio->eof && !aio->err)
+        aio_submit (aio);
+    }
+  else if (aio->err)
+    {
+      rc = gpg_error_from_errno (aio->err);
+      aio->err = 0;
+      if (gpg_err_code (rc) != GPG_ERR_EPIPE)
+        log_error ("%s: read error: %s\n", a->fname, gpg_strerror (rc));
+    }
+  else
+    {
+      a->eof_seen = 1;
+      rc = -1;
+    }
+  *ret_len = n;
+  return rc;
+}
+
+
+/* The flush handler for async I/O: Wait for the previous write,
+ * copy SIZE bytes from BUF and write them in the background.  */
+static int
+file_filter_aio_write (file_filter_ctx_t *a, const byte *buf, size_t size)
+{
+  struct file_aio_s *aio = a->aio;
+  byte *p;
+  int rc;
+
+  rc = file_filter_aio_wait (a);
+  if (rc)
+    return rc;
+  if (size > aio->size)
+    {
+      p = xtrymalloc (size);
+      if (!p)
+        return gpg_error_from_syserror ();
+      wipememory (aio->buffer, aio->size);
+      xfree (aio->buffer);
+      aio->buffer = p;
+      aio->size = size;
+    }
+  memcpy (aio->buffer, buf, size);
+  aio->len = size;
+  aio_submit (aio);
+  return 0;
+}
+#endif /*USE_ASYNC_IO*/
+
+
 static int
 file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	     size_t * ret_len)
@@ -484,6 +981,25 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	  rc = -1;
 	  *ret_len = 0;
 	}
+#ifdef USE_MMAP_INPUT
+      else if (a->map)
+        {
+          nbytes = a->maplen - a->mappos;
+          if (nbytes > size)
+            nbytes = size;
+          if (!nbytes)
+            {
+              a->eof_seen = 1;
+              rc = -1;
+            }
+          else
+            {
+              memcpy (buf, a->map + a->mappos, nbytes);
+              a->mappos += nbytes;
+            }
+          *ret_len = nbytes;
+        }
+#endif /*USE_MMAP_INPUT*/
       else if (a->delayed_rc)
         {
           rc = a->delayed_rc;
@@ -492,6 +1008,10 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
             a->eof_seen = -1;
 	  *ret_len = 0;
         }
+#ifdef USE_ASYNC_IO
+      else if (file_filter_aio_start (a, IOBUF_INPUT, size))
+        rc = file_filter_aio_read (a, buf, size, ret_len);
+#endif
       else
 	{
 #ifdef HAVE_W32_SYSTEM
@@ -526,7 +1046,7 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
         read_more:
           do
             {
-              n = read (f, buf + nbytes, size - nbytes);
+              n = read_clamped (f, buf + nbytes, size - nbytes);
             }
           while (n == -1 && errno == EINTR);
           if (n > 0)
@@ -562,6 +1082,14 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FLUSH)
     {
+#ifdef USE_ASYNC_IO
+      if (size && file_filter_aio_start (a, IOBUF_OUTPUT, size))
+        {
+          rc = file_filter_aio_write (a, buf, size);
+          nbytes = rc? 0 : size;
+        }
+      else
+#endif
       if (size)
 	{
 #ifdef HAVE_W32_SYSTEM
@@ -593,7 +1121,7 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	    {
 	      do
 		{
-		  n = write (f, p, nbytes);
+		  n = write_clamped (f, p, nbytes);
 		}
 	      while (n == -1 && errno == EINTR);
 	      if (n > 0)
@@ -621,10 +1149,30 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->no_cache = 0;
       a->npeeked = 0;
       a->upeeked = 0;
+#ifdef USE_MMAP_INPUT
+      a->map = NULL;
+      a->maplen = 0;
+      a->mappos = 0;
+#endif
+#ifdef USE_ASYNC_IO
+      a->aio = NULL;
+      a->no_aio = 0;
+#endif
     }
   else if (control == IOBUFCTRL_PEEK)
     {
       /* Peek on the input.  */
+#ifdef USE_MMAP_INPUT
+      if (a->map)
+        {
+          nbytes = a->maplen - a->mappos;
+          if (nbytes > size)
+            nbytes = size;
+          memcpy (buf, a->map + a->mappos, nbytes);
+          *ret_len = nbytes;
+          return 0;
+        }
+#endif /*USE_MMAP_INPUT*/
 #ifdef HAVE_W32_SYSTEM
       unsigned long nread;
 
@@ -694,6 +1242,16 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+#ifdef USE_MMAP_INPUT
+      file_filter_unmap (a);
+#endif
+#ifdef USE_ASYNC_IO
+      if (a->aio)
+        {
+          rc = file_filter_aio_wait (a);
+          file_filter_aio_release (a);
+        }
+#endif
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -1082,15 +1640,17 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 	      do
 		{
 		  /* find the best matching block length - this is limited
-		   * by the size of the internal buffering */
+		   * by the size of the internal buffering and by the
+		   * largest length a partial header can encode */
 		  for (blen = OP_MIN_PARTIAL_CHUNK * 2,
-		       c = OP_MIN_PARTIAL_CHUNK_2POW + 1; blen <= nbytes;
+		       c = OP_MIN_PARTIAL_CHUNK_2POW + 1;
+		       blen <= nbytes && c <= OP_MAX_PARTIAL_CHUNK_2POW;
 		       blen *= 2, c++)
 		    ;
 		  blen /= 2;
 		  c--;
 		  /* write the partial length header */
-		  log_assert (c <= 0x1f);	/*;-) */
+		  log_assert (c <= OP_MAX_PARTIAL_CHUNK_2POW);
 		  c |= 0xe0;
 		  iobuf_put (chain, c);
 		  if ((n = a->buflen))
@@ -1212,9 +1772,7 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 unsigned int
 iobuf_set_buffer_size (unsigned int kilobyte)
 {
-  static int used;
-
-  if (!used && kilobyte)
+  if (!iobuf_buffer_size_fixed && kilobyte)
     {
       if (kilobyte < 4)
         kilobyte = 4;
@@ -1222,12 +1780,84 @@ iobuf_set_buffer_size (unsigned int kilobyte)
         kilobyte = 16*1024;
 
       iobuf_buffer_size = kilobyte * 1024;
-      used = 1;
+      iobuf_buffer_size_fixed = 1;
     }
   return iobuf_buffer_size / 1024;
 }
 
 
+/* Return the buffer size for a new stream of type USE on the file
+ * descriptor FD.  Regular files and pipes get a large buffer unless
+ * it is a small input file; everything else, in particular ttys,
+ * gets the standard size.  */
+static size_t
+buffer_size_for_fd (gnupg_fd_t fd, int use)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)fd;
+  (void)use;
+  return iobuf_buffer_size;
+#else
+  struct stat st;
+
+  if (iobuf_buffer_size_fixed || fd == GNUPG_INVALID_FD || fstat (fd, &st))
+    return iobuf_buffer_size;
+
+  if (S_ISFIFO (st.st_mode) || S_ISSOCK (st.st_mode))
+    return BULK_IOBUF_BUFFER_SIZE;
+  if (!S_ISREG (st.st_mode))
+    return iobuf_buffer_size;
+  if (use != IOBUF_INPUT || st.st_size >= BULK_IOBUF_BUFFER_SIZE)
+    return BULK_IOBUF_BUFFER_SIZE;
+  if (st.st_size > iobuf_buffer_size)
+    /* One more byte so that the EOF is seen by the first read.  */
+    return st.st_size + 1;
+  return iobuf_buffer_size;
+#endif
+}
+
+
+/* Set the minimum size of a regular file to be mapped into memory
+ * by iobuf_open to KILOBYTE.  A value of 0 disables the mapped input
+ * mode, which is also the default.  This needs to be called before
+ * any iobufs are used.  Returns the previous value.  This is a no-op
+ * on systems without mmap.  */
+unsigned int
+iobuf_set_mmap_threshold (unsigned int kilobyte)
+{
+  unsigned int old = iobuf_mmap_threshold / 1024;
+
+#ifdef USE_MMAP_INPUT
+  if (kilobyte > UINT_MAX / 1024)
+    kilobyte = UINT_MAX / 1024;
+  iobuf_mmap_threshold = kilobyte * 1024;
+#else
+  (void)kilobyte;
+#endif
+  return old;
+}
+
+
+/* Enable the async I/O for file streams carrying bulk data if ONOFF
+ * is true.  The reads of such streams are then done ahead and the
+ * writes in the background by a helper thread, and streamed regular
+ * files are not kept in the page cache.  nPth must be initialized
+ * before the first stream is used.  Returns the previous value.
+ * This is a no-op in programs without nPth.  */
+int
+iobuf_set_async_io (int onoff)
+{
+  int old = iobuf_async_io;
+
+#ifdef USE_ASYNC_IO
+  iobuf_async_io = !!onoff;
+#else
+  (void)onoff;
+#endif
+  return old;
+}
+
+
 #define MAX_IOBUF_DESC 32
 /*
  * Fill the buffer by the description of iobuf A.
@@ -1247,6 +1877,26 @@ iobuf_desc (iobuf_t a, byte *buf)
   return buf;
 }
 
+
+/* Call the filter of A for the data transfer CONTROL and account the
+ * time with --timing-stats.  */
+static int
+call_filter (iobuf_t a, int control, byte *buf, size_t *len)
+{
+  const void *key = (const void *)a->filter;
+  byte desc[MAX_IOBUF_DESC];
+  int rc;
+
+  if (!tstat_enabled)
+    return a->filter (a->filter_ov, control, a->chain, buf, len);
+
+  tstat_enter_filter (key, (tstat_filter_known (key)
+                            ? NULL : iobuf_desc (a, desc)));
+  rc = a->filter (a->filter_ov, control, a->chain, buf, len);
+  tstat_leave_filter (key);
+  return rc;
+}
+
 static void
 print_chain (iobuf_t a)
 {
@@ -1269,6 +1919,26 @@ iobuf_print_chain (iobuf_t a)
   return 0;
 }
 
+
+/* Return a new buffer of N bytes for an iobuf.  */
+static byte *
+alloc_buffer (size_t n)
+{
+  memstat_alloc (MEMSTAT_IOBUF, n);
+  return xmalloc (n);
+}
+
+
+/* Release the buffer of the iobuf A.  */
+static void
+free_buffer (iobuf_t a)
+{
+  if (a->d.buf)
+    memstat_free (MEMSTAT_IOBUF, a->d.size);
+  xfree (a->d.buf);
+}
+
+
 iobuf_t
 iobuf_alloc (int use, size_t bufsize)
 {
@@ -1285,7 +1955,7 @@ iobuf_alloc (int use, size_t bufsize)
 
   a = xcalloc (1, sizeof *a);
   a->use = use;
-  a->d.buf = xmalloc (bufsize);
+  a->d.buf = alloc_buffer (bufsize);
   a->d.size = bufsize;
   a->e_d.buf = NULL;
   a->e_d.len = 0;
@@ -1330,7 +2000,7 @@ iobuf_close (iobuf_t a)
       if (a->d.buf)
 	{
 	  memset (a->d.buf, 0, a->d.size);	/* erase the buffer */
-	  xfree (a->d.buf);
+	  free_buffer (a);
 	}
       xfree (a);
     }
@@ -1386,7 +2056,9 @@ iobuf_cancel (iobuf_t a)
 iobuf_t
 iobuf_temp (void)
 {
-  return iobuf_alloc (IOBUF_OUTPUT_TEMP, iobuf_buffer_size);
+  return iobuf_alloc (IOBUF_OUTPUT_TEMP, (iobuf_buffer_size_fixed
+                                          ? iobuf_buffer_size
+                                          : TEMP_IOBUF_BUFFER_SIZE));
 }
 
 iobuf_t
@@ -1460,7 +2132,7 @@ do_open (const char *fname, int special_filenames,
 	return NULL;
     }
 
-  a = iobuf_alloc (use, iobuf_buffer_size);
+  a = iobuf_alloc (use, buffer_size_for_fd (fp, use));
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1470,6 +2142,10 @@ do_open (const char *fname, int special_filenames,
   a->filter = file_filter;
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+#ifdef USE_MMAP_INPUT
+  if (use == IOBUF_INPUT)
+    file_filter_map (fcx);
+#endif
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: open '%s' desc=%s fd=%d\n",
 	       a->no, a->subno, fname, iobuf_desc (a, desc),
@@ -1503,9 +2179,10 @@ do_iobuf_fdopen (gnupg_fd_t fp, const char *mode, int keep_open)
   iobuf_t a;
   file_filter_ctx_t *fcx;
   size_t len = 0;
+  int use;
 
-  a = iobuf_alloc (strchr (mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-		   iobuf_buffer_size);
+  use = strchr (mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT;
+  a = iobuf_alloc (use, buffer_size_for_fd (fp, use));
   fcx = xmalloc (sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
@@ -1811,7 +2488,7 @@ iobuf_push_filter2 (iobuf_t a,
      the new filter (A) means that data that has read from (B), but
      not yet read from the pipeline won't be processed by the new
      filter (A)!  That's certainly not what we want.  */
-  a->d.buf = xmalloc (a->d.size);
+  a->d.buf = alloc_buffer (a->d.size);
   a->d.len = 0;
   a->d.start = 0;
 
@@ -1870,7 +2547,7 @@ iobuf_pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
     {				/* this is simple */
       b = a->chain;
       log_assert (b);
-      xfree (a->d.buf);
+      free_buffer (a);
       xfree (a->real_fname);
       memcpy (a, b, sizeof *a);
       xfree (b);
@@ -1912,7 +2589,7 @@ iobuf_pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
        * a flush has been done on the to be removed entry
        */
       b = a->chain;
-      xfree (a->d.buf);
+      free_buffer (a);
       xfree (a->real_fname);
       memcpy (a, b, sizeof *a);
       xfree (b);
@@ -1996,7 +2673,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	  if (DBG_IOBUF)
 	    log_debug ("iobuf-%d.%d: filter popped (pending EOF returned)\n",
 		       a->no, a->subno);
-	  xfree (a->d.buf);
+	  free_buffer (a);
 	  xfree (a->real_fname);
 	  memcpy (a, b, sizeof *a);
 	  xfree (b);
@@ -2053,8 +2730,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      log_debug ("iobuf-%d.%d: underflow: A->FILTER (%lu bytes, to external drain)\n",
 			 a->no, a->subno, (ulong)len);
 
-	    rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-			    a->e_d.buf, &len);
+	    rc = call_filter (a, IOBUFCTRL_UNDERFLOW, a->e_d.buf, &len);
 	    a->e_d.used = len;
 	    len = 0;
 	  }
@@ -2064,8 +2740,8 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      log_debug ("iobuf-%d.%d: underflow: A->FILTER (%lu bytes)\n",
 			 a->no, a->subno, (ulong)len);
 
-	    rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-			    &a->d.buf[a->d.len], &len);
+	    rc = call_filter (a, IOBUFCTRL_UNDERFLOW,
+                              &a->d.buf[a->d.len], &len);
 	  }
       }
       a->d.len += len;
@@ -2110,7 +2786,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      if (DBG_IOBUF)
 		log_debug ("iobuf-%d.%d: pop in underflow (nothing buffered, got EOF)\n",
 			   a->no, a->subno);
-	      xfree (a->d.buf);
+	      free_buffer (a);
 	      xfree (a->real_fname);
 	      memcpy (a, b, sizeof *a);
 	      xfree (b);
@@ -2159,12 +2835,23 @@ filter_flush (iobuf_t a)
 
   if (a->use == IOBUF_OUTPUT_TEMP)
     {				/* increase the temp buffer */
-      size_t newsize = a->d.size + iobuf_buffer_size;
+      size_t newsize;
+
+      /* Grow geometrically so that small temp buffers stay small but
+       * large ones do not need too many reallocations.  */
+      if (iobuf_buffer_size_fixed)
+        newsize = a->d.size + iobuf_buffer_size;
+      else if (a->d.size < BULK_IOBUF_BUFFER_SIZE)
+        newsize = 2 * a->d.size;
+      else
+        newsize = a->d.size + BULK_IOBUF_BUFFER_SIZE;
 
       if (DBG_IOBUF)
 	log_debug ("increasing temp iobuf from %lu to %lu\n",
 		   (ulong) a->d.size, (ulong) newsize);
 
+      memstat_free (MEMSTAT_IOBUF, a->d.size);
+      memstat_alloc (MEMSTAT_IOBUF, newsize);
       a->d.buf = xrealloc (a->d.buf, newsize);
       a->d.size = newsize;
       return 0;
@@ -2188,7 +2875,7 @@ filter_flush (iobuf_t a)
     }
 
   len = src_len;
-  rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, src_buf, &len);
+  rc = call_filter (a, IOBUFCTRL_FLUSH, src_buf, &len);
   if (!rc && len != src_len)
     {
       log_info ("filter_flush did not write all!\n");
@@ -2237,6 +2924,118 @@ iobuf_readbyte (iobuf_t a)
 }
 
 
+/* Pass the remaining data of the unfiltered input stream A to FNC,
+ * bypassing the internal buffer.  See iobuf.h for details.  */
+gpg_error_t
+iobuf_read_direct (iobuf_t a,
+                   void (*fnc) (void *opaque, const void *buf, size_t len),
+                   void *opaque)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)a;
+  (void)fnc;
+  (void)opaque;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#else
+  file_filter_ctx_t *b;
+  gpg_error_t err = 0;
+  byte *buffer;
+  size_t n;
+  ssize_t nread;
+
+  if (a->use != IOBUF_INPUT || a->chain || a->filter != file_filter
+      || a->nlimit || a->d.start < a->d.len || a->error)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  b = a->filter_ov;
+  if (b->npeeked > b->upeeked)
+    {
+      n = b->npeeked - b->upeeked;
+      fnc (opaque, b->peeked + b->upeeked, n);
+      b->upeeked = b->npeeked;
+      a->ntotal += n;
+    }
+  if (b->eof_seen || b->delayed_rc)
+    return b->delayed_rc == -1? 0 : b->delayed_rc;
+
+#ifdef USE_ASYNC_IO
+  if (b->aio)
+    {
+      /* Hand over the data read ahead and go on without a helper.  */
+      aio_wait (b->aio);
+      n = b->aio->len - b->aio->pos;
+      if (n)
+        {
+          fnc (opaque, b->aio->buffer + b->aio->pos, n);
+          b->aio->pos = b->aio->len;
+          a->ntotal += n;
+        }
+      if (b->aio->err)
+        err = gpg_error_from_errno (b->aio->err);
+      else if (b->aio->eof)
+        b->eof_seen = 1;
+      file_filter_aio_release (b);
+      b->no_aio = 1;
+      if (err)
+        {
+          log_error ("%s: read error: %s\n", b->fname, gpg_strerror (err));
+          a->error = err;
+          return err;
+        }
+      if (b->eof_seen)
+        return 0;
+    }
+#endif /*USE_ASYNC_IO*/
+
+#ifdef USE_MMAP_INPUT
+  if (b->map)
+    {
+      while (b->mappos < b->maplen)
+        {
+          n = b->maplen - b->mappos;
+          if (n > BULK_IOBUF_BUFFER_SIZE)
+            n = BULK_IOBUF_BUFFER_SIZE;
+          fnc (opaque, b->map + b->mappos, n);
+          b->mappos += n;
+          a->ntotal += n;
+        }
+      b->eof_seen = 1;
+      return 0;
+    }
+#endif /*USE_MMAP_INPUT*/
+
+  buffer = xtrymalloc (BULK_IOBUF_BUFFER_SIZE);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+  for (;;)
+    {
+      do
+        nread = read_clamped (b->fp, buffer, BULK_IOBUF_BUFFER_SIZE);
+      while (nread == -1 && errno == EINTR);
+      if (nread > 0)
+        {
+          fnc (opaque, buffer, nread);
+          a->ntotal += nread;
+        }
+      else if (!nread)
+        {
+          b->eof_seen = 1;
+          break;
+        }
+      else
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("%s: read error: %s\n", b->fname, gpg_strerror (err));
+          a->error = err;
+          break;
+        }
+    }
+  xfree (buffer);
+  return err;
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
 int
 iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 {
@@ -2713,6 +3512,17 @@ iobuf_seek (iobuf_t a, off_t newpos)
 
       b = a->filter_ov;
 
+#ifdef USE_ASYNC_IO
+      /* Finish the I/O in flight; it is restarted at the new
+       * position.  */
+      if (b->aio)
+        {
+          if (file_filter_aio_wait (b))
+            return -1;
+          file_filter_aio_release (b);
+        }
+#endif
+
 #ifdef HAVE_W32_SYSTEM
       if (SetFilePointer (b->fp, newpos, NULL, FILE_BEGIN) == 0xffffffff)
 	{
@@ -2726,6 +3536,15 @@ iobuf_seek (iobuf_t a, off_t newpos)
 	  log_error ("can't lseek: %s\n", strerror (errno));
 	  return -1;
 	}
+#endif
+      /* A pending EOF from a read up to the end is no longer
+       * valid.  */
+      b->eof_seen = 0;
+      b->delayed_rc = 0;
+#ifdef USE_MMAP_INPUT
+      if (b->map)
+        b->mappos = ((uint64_t)newpos < b->maplen
+                     ? (size_t)newpos : b->maplen);
 #endif
       /* Discard the buffer it is not a temp stream.  */
       a->d.len = 0;
@@ -2947,6 +3766,49 @@ iobuf_read_line (iobuf_t a, byte ** addr_of_buffer,
 }
 
 
+unsigned int
+iobuf_scan_line (iobuf_t a, const byte **r_line, byte **addr_of_buffer,
+                 unsigned *length_of_buffer, unsigned *max_length)
+{
+  unsigned size;
+  byte *newline_pos;
+
+  if (!a->nofast && *max_length >= 2)
+    {
+      if (a->d.start == a->d.len
+          && underflow_target (a, 0, 1) != -1)
+        {
+          /* Underflow consumes the first character; unget it the
+             same way iobuf_peek does.  */
+          log_assert (a->d.start == 1);
+          a->d.start = 0;
+        }
+
+      if (a->d.start < a->d.len)
+        {
+          size = a->d.len - a->d.start;
+          if (size > *max_length - 1)
+            size = *max_length - 1;
+          newline_pos = memchr (a->d.buf + a->d.start, '\n', size);
+          if (newline_pos)
+            {
+              /* The complete line is in the buffer; lend it.  */
+              size = (newline_pos - (a->d.buf + a->d.start)) + 1;
+              *r_line = a->d.buf + a->d.start;
+              a->d.start += size;
+              a->nbytes += size;
+              return size;
+            }
+        }
+    }
+
+  /* The line crosses the end of the buffer: copy it.  */
+  size = iobuf_read_line (a, addr_of_buffer, length_of_buffer, max_length);
+  *r_line = *addr_of_buffer;
+  return size;
+}
+
+
 void
 iobuf_skip_rest (iobuf_t a, unsigned long n, int partial)
 {
@@ -277,9 +277,20 @@ extern int iobuf_debug_mode;
 /* Change the default size for all IOBUFs to KILOBYTE.  This needs to
  * be called before any iobufs are used and can only be used once.
  * Returns the current value.  Using 0 has no effect except for
- * returning the current value.  */
+ * returning the current value.  Without calling this, streams on
+ * pipes and large regular files use larger buffers and temp streams
+ * start with a small buffer.  */
 unsigned int iobuf_set_buffer_size (unsigned int kilobyte);
 
+/* Set the minimum size of regular files which are mapped into memory
+ * by iobuf_open to KILOBYTE; 0 disables this mode.  Returns the
+ * previous value.  */
+unsigned int iobuf_set_mmap_threshold (unsigned int kilobyte);
+
+/* Do the reads and writes of file streams carrying bulk data on a
+ * helper thread if ONOFF is true.  Returns the previous value.  */
+int iobuf_set_async_io (int onoff);
+
 /* Returns whether the specified filename corresponds to a pipe.  In
    particular, this function checks if FNAME is "-" and, if special
    filenames are enabled (see check_special_filename), whether
@@ -508,6 +519,19 @@ int iobuf_readbyte (iobuf_t a);
    bytes read.  */
 int iobuf_read (iobuf_t a, void *buf, unsigned buflen);
 
+/* Pass all remaining data of the input stream A to FNC without
+   copying it into the internal buffer: a mapped file is passed in
+   large pieces of the mapping; otherwise the data is read in large
+   blocks directly from the file descriptor.  This only works for a
+   plain file stream without any filters and without buffered data;
+   GPG_ERR_NOT_SUPPORTED is returned otherwise and A is not changed.
+   On success A is at EOF.  A read error is logged, also stored as
+   the error of A, and returned.  */
+gpg_error_t iobuf_read_direct (iobuf_t a,
+                               void (*fnc) (void *opaque,
+                                            const void *buf, size_t len),
+                               void *opaque);
+
 /* Read a line of input (including the '\n') from the pipeline.
 
    The semantics are the same as for fgets(), but if the buffer is too
@@ -531,6 +555,17 @@ int iobuf_read (iobuf_t a, void *buf, unsigned buflen);
 unsigned iobuf_read_line (iobuf_t a, byte ** addr_of_buffer,
 			  unsigned *length_of_buffer, unsigned *max_length);
 
+/* Same as iobuf_read_line but store a pointer to the line at R_LINE
+   and avoid the copy if possible.  If the complete line is in the
+   internal buffer of A, R_LINE points into that buffer; this line is
+   only valid until the next read from A.  Otherwise the line is read
+   into the buffer described by the other arguments exactly like
+   iobuf_read_line does.  The caller must not modify the line and
+   must not expect a terminating NUL.  */
+unsigned iobuf_scan_line (iobuf_t a, const byte **r_line,
+                          byte **addr_of_buffer,
+                          unsigned *length_of_buffer, unsigned *max_length);
+
 /* Read up to BUFLEN bytes from pipeline A.  Note: this function can't
    return more than the pipeline's internal buffer size.  The return
    value is the number of bytes actually written to BUF.  If the
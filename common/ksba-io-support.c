@@ -496,6 +496,32 @@ simple_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
         }
     }
 
+  /* Fast path: Read as much as possible directly into BUFFER.  The
+   * per-byte loop below is only required to handle the read limit
+   * and the replay of zero padding.  Note that MAXREAD is one larger
+   * than the number of bytes left.  */
+  if (!parm->nzeroes && (!parm->use_maxread || parm->maxread > 1))
+    {
+      size_t want = count;
+
+      if (parm->use_maxread && want > parm->maxread - 1)
+        want = parm->maxread - 1;
+      if (es_read (parm->fp, buffer, want, &n))
+        {
+          parm->eof_seen = 1;
+          return -1;
+        }
+      if (parm->use_maxread)
+        parm->maxread -= n;
+      if (n < want)
+        {
+          parm->eof_seen = 1;
+          if (!n)
+            return -1;
+        }
+      goto leave;
+    }
+
   for (n=0; n < count; n++)
     {
       if (parm->use_maxread && !--parm->maxread)
@@ -41,7 +41,9 @@
    create a buffer, put_membuf to append bytes and get_membuf to
    release and return the buffer.  Allocation errors are detected but
    only returned at the final get_membuf(), this helps not to clutter
-   the code with out of core checks.  */
+   the code with out of core checks.  INITIALLEN should be a good
+   guess of the final length; the buffer grows geometrically if it
+   is too short.  */
 
 void
 init_membuf (membuf_t *mb, int initiallen)
@@ -49,6 +51,8 @@ init_membuf (membuf_t *mb, int initiallen)
   mb->len = 0;
   mb->size = initiallen;
   mb->out_of_core = 0;
+  mb->secure = 0;
+  mb->in_arena = 0;
   mb->buf = xtrymalloc (initiallen);
   if (!mb->buf)
     mb->out_of_core = errno;
@@ -61,11 +65,28 @@ init_membuf_secure (membuf_t *mb, int initiallen)
   mb->len = 0;
   mb->size = initiallen;
   mb->out_of_core = 0;
+  mb->secure = 1;
+  mb->in_arena = 0;
   mb->buf = xtrymalloc_secure (initiallen);
   if (!mb->buf)
     mb->out_of_core = errno;
 }
 
+/* Same as init_membuf but use the caller provided buffer ARENA of
+   ARENASIZE bytes until more space is required.  ARENA must stay
+   valid until get_membuf has been called.  This avoids any
+   allocation for the common case of short data.  */
+void
+init_membuf_arena (membuf_t *mb, void *arena, size_t arenasize)
+{
+  mb->len = 0;
+  mb->size = arenasize;
+  mb->out_of_core = 0;
+  mb->secure = 0;
+  mb->in_arena = 1;
+  mb->buf = arena;
+}
+
 
 /* Shift the content of the membuf MB by AMOUNT bytes.  The next
    operation will then behave as if AMOUNT bytes had not been put into
@@ -96,9 +117,25 @@ put_membuf (membuf_t *mb, const void *buf, size_t len)
   if (mb->len + len >= mb->size)
     {
       char *p;
-
-      mb->size += len + 1024;
-      p = xtryrealloc (mb->buf, mb->size);
+      size_t newsize;
+
+      /* Grow geometrically so that many small appends do not result
+         in a quadratic number of copied bytes.  Secure memory is a
+         scarce resource and thus we keep on growing it linearly.  */
+      newsize = mb->len + len + 1024;
+      if (!mb->secure && newsize < 2 * mb->size)
+        newsize = 2 * mb->size;
+      if (mb->in_arena)
+        {
+          p = xtrymalloc (newsize);
+          if (p)
+            {
+              memcpy (p, mb->buf, mb->len);
+              mb->in_arena = 0;
+            }
+        }
+      else
+        p = xtryrealloc (mb->buf, newsize);
       if (!p)
         {
           mb->out_of_core = errno ? errno : ENOMEM;
@@ -110,6 +147,7 @@ put_membuf (membuf_t *mb, const void *buf, size_t len)
           return;
         }
       mb->buf = p;
+      mb->size = newsize;
     }
   if (buf)
     memcpy (mb->buf + mb->len, buf, len);
@@ -170,14 +208,29 @@ get_membuf (membuf_t *mb, size_t *len)
       if (mb->buf)
         {
           wipememory (mb->buf, mb->len);
-          xfree (mb->buf);
+          if (!mb->in_arena)
+            xfree (mb->buf);
           mb->buf = NULL;
         }
       gpg_err_set_errno (mb->out_of_core);
       return NULL;
     }
 
-  p = mb->buf;
+  if (mb->in_arena)
+    {
+      /* The caller expects a malloced buffer.  */
+      p = xtrymalloc (mb->len? mb->len : 1);
+      if (!p)
+        {
+          mb->out_of_core = errno ? errno : ENOMEM;
+          mb->buf = NULL;
+          return NULL;
+        }
+      memcpy (p, mb->buf, mb->len);
+      mb->in_arena = 0;
+    }
+  else
+    p = mb->buf;
   if (len)
     *len = mb->len;
   mb->buf = NULL;
@@ -40,6 +40,8 @@ struct private_membuf_s
   size_t size;
   char *buf;
   int out_of_core;
+  unsigned int secure:1;   /* BUF is in secure memory.  */
+  unsigned int in_arena:1; /* BUF is the caller provided arena.  */
 };
 
 typedef struct private_membuf_s membuf_t;
@@ -47,10 +49,11 @@ typedef struct private_membuf_s membuf_t;
 /* Return the current length of the membuf.  */
 #define get_membuf_len(a)  ((a)->len)
 #define is_membuf_ready(a) ((a)->buf || (a)->out_of_core)
-#define MEMBUF_ZERO        { 0, 0, NULL, 0}
+#define MEMBUF_ZERO        { 0, 0, NULL, 0, 0, 0}
 
 void init_membuf (membuf_t *mb, int initiallen);
 void init_membuf_secure (membuf_t *mb, int initiallen);
+void init_membuf_arena (membuf_t *mb, void *arena, size_t arenasize);
 void clear_membuf (membuf_t *mb, size_t amount);
 void put_membuf  (membuf_t *mb, const void *buf, size_t len);
 gpg_error_t put_membuf_cb (void *opaque, const void *buf, size_t len);
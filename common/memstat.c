@@ -0,0 +1,137 @@
+/* memstat.c - Memory accounting per subsystem
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This module keeps the current and peak number of bytes and the
+ * number of allocations and releases of the larger memory consumers
+ * of our programs.  The subsystems account their allocations
+ * themselves at the places where the size is known; the module does
+ * not interpose the allocator.  The statistics are printed with
+ * --debug memstat and the daemons return them with "GETINFO
+ * memstat".  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "membuf.h"
+#include "memstat.h"
+
+
+struct memstat_s
+{
+  size_t cur;
+  size_t peak;
+  unsigned long allocs;
+  unsigned long frees;
+};
+
+static const char *tag_names[MEMSTAT_NTAGS] =
+  {
+    "iobuf",
+    "kbnode",
+    "packet",
+    "keydb",
+    "objcache",
+    "agent-cache",
+    "certcache",
+    "crlcache",
+    "kbx-cache"
+  };
+
+static struct memstat_s stats[MEMSTAT_NTAGS];
+
+
+
+void
+memstat_alloc (memstat_tag_t tag, size_t n)
+{
+  struct memstat_s *s;
+
+  if ((unsigned int)tag >= MEMSTAT_NTAGS || !n)
+    return;
+  s = stats + tag;
+  s->cur += n;
+  if (s->cur > s->peak)
+    s->peak = s->cur;
+  s->allocs++;
+}
+
+
+void
+memstat_free (memstat_tag_t tag, size_t n)
+{
+  struct memstat_s *s;
+
+  if ((unsigned int)tag >= MEMSTAT_NTAGS || !n)
+    return;
+  s = stats + tag;
+  s->cur = s->cur > n? s->cur - n : 0;
+  s->frees++;
+}
+
+
+/* Return a malloced string with lines of the form
+ *
+ *   TAG cur=BYTES peak=BYTES allocs=N frees=N
+ *
+ * for all tags which have been used or NULL on error.  */
+char *
+memstat_format (void)
+{
+  membuf_t mb;
+  int i;
+
+  init_membuf (&mb, 512);
+  for (i = 0; i < MEMSTAT_NTAGS; i++)
+    if (stats[i].allocs)
+      put_membuf_printf (&mb, "%s cur=%lu peak=%lu allocs=%lu frees=%lu\n",
+                         tag_names[i],
+                         (unsigned long)stats[i].cur,
+                         (unsigned long)stats[i].peak,
+                         stats[i].allocs, stats[i].frees);
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+void
+memstat_dump (void)
+{
+  int i;
+
+  for (i = 0; i < MEMSTAT_NTAGS; i++)
+    if (stats[i].allocs)
+      log_info ("memstat: %-12s %10lu bytes %10lu peak"
+                " %9lu allocs %9lu frees\n",
+                tag_names[i],
+                (unsigned long)stats[i].cur, (unsigned long)stats[i].peak,
+                stats[i].allocs, stats[i].frees);
+}
@@ -0,0 +1,63 @@
+/* memstat.h - Memory accounting per subsystem
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_MEMSTAT_H
+#define GNUPG_COMMON_MEMSTAT_H
+
+/* The subsystems whose memory is accounted.  */
+typedef enum
+  {
+    MEMSTAT_IOBUF,        /* IOBUF buffers.                        */
+    MEMSTAT_KBNODE,       /* Slabs of keyblock nodes.              */
+    MEMSTAT_PACKET,       /* Packet structures kept for reuse.     */
+    MEMSTAT_KEYDB,        /* Keydb handles and the not-found cache. */
+    MEMSTAT_OBJCACHE,     /* The key and user id object cache.     */
+    MEMSTAT_AGENT_CACHE,  /* The passphrase cache of the agent.    */
+    MEMSTAT_CERTCACHE,    /* Non-permanent certificates (dirmngr). */
+    MEMSTAT_CRLCACHE,     /* Bloom filters of the CRL cache.       */
+    MEMSTAT_KBX_CACHE,    /* The keyboxd key cache.                */
+    MEMSTAT_NTAGS
+  } memstat_tag_t;
+
+
+/*-- memstat.c --*/
+
+/* Account the allocation or release of N bytes for TAG.  The caller
+ * must hold the nPth lock or be single threaded.  */
+void memstat_alloc (memstat_tag_t tag, size_t n);
+void memstat_free (memstat_tag_t tag, size_t n);
+
+/* Return a malloced string with one line per used tag or NULL on
+ * error.  */
+char *memstat_format (void);
+
+/* Print the statistics to the log.  */
+void memstat_dump (void);
+
+#endif /*GNUPG_COMMON_MEMSTAT_H*/
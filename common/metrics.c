@@ -0,0 +1,474 @@
+/* metrics.c - A registry of daemon metrics
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This module keeps counters and gauges of a daemon together with a
+ * histogram of the durations of the Assuan commands and formats them
+ * in the Prometheus text exposition format.  The daemons return them
+ * with "GETINFO metrics".  A more detailed per-command view along
+ * with the time spent waiting for the nPth lock is returned by
+ * "GETINFO cmdstats".
+ *
+ * There is no locking: All daemons use nPth and update and format
+ * the metrics only while holding the global nPth lock.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "membuf.h"
+#include "metrics.h"
+
+/* The maximum number of registered metrics.  */
+#define MAX_METRICS 32
+
+/* The maximum number of different commands we account.  */
+#define MAX_COMMANDS 96
+
+/* The maximum number of commands in progress; one per connection.  */
+#define MAX_PENDING 64
+
+/* The number of histogram buckets without the "+Inf" bucket.  */
+#define N_BUCKETS 6
+
+/* The number of the fine grained slots used to estimate the
+ * percentiles.  Durations below 8us have their own slot; all larger
+ * durations are put into four slots per power of two.  This allows
+ * for durations of up to 2^40us with an error of less than 25%.  */
+#define N_SLOTS (8 + 38*4)
+
+
+struct metric_s
+{
+  const char *name;
+  const char *help;
+  metric_type_t type;
+  metric_fnc_t fnc;
+  unsigned long long value;
+};
+
+
+struct command_stat_s
+{
+  char name[32];
+  unsigned long long buckets[N_BUCKETS+1];
+  unsigned long long sum;    /* Microseconds.  */
+  unsigned long long max;    /* Microseconds.  */
+  unsigned long long count;
+  unsigned int slots[N_SLOTS];
+};
+
+
+struct lock_wait_s
+{
+  unsigned long long sum;    /* Microseconds.  */
+  unsigned long long max;    /* Microseconds.  */
+  unsigned long long count;
+};
+
+
+struct pending_s
+{
+  const void *key;
+  struct command_stat_s *cmd;
+  unsigned long long start;
+};
+
+
+/* The upper bounds of the buckets in microseconds and as label.  */
+static const unsigned long long bucket_bounds[N_BUCKETS] =
+  { 100, 1000, 10000, 100000, 1000000, 10000000 };
+static const char *bucket_labels[N_BUCKETS+1] =
+  { "0.0001", "0.001", "0.01", "0.1", "1", "10", "+Inf" };
+
+static const char *prefix = "lcr";
+static unsigned long long start_time;
+
+static struct metric_s metrics[MAX_METRICS];
+static int nmetrics;
+
+static struct command_stat_s commands[MAX_COMMANDS];
+static int ncommands;
+
+static struct pending_s pending[MAX_PENDING];
+
+static struct lock_wait_s lock_wait;
+
+
+
+/* Return a monotonic time in microseconds.  */
+unsigned long long
+metrics_clock (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  return (unsigned long long)gnupg_get_time () * 1000000;
+}
+
+
+void
+metrics_init (const char *aprefix)
+{
+  prefix = aprefix;
+  start_time = metrics_clock ();
+}
+
+
+static metric_t
+register_metric (const char *name, metric_type_t type, const char *help,
+                 metric_fnc_t fnc)
+{
+  metric_t m;
+
+  if (nmetrics == MAX_METRICS)
+    {
+      log_error ("metrics: no space for '%s'\n", name);
+      return NULL;
+    }
+  m = metrics + nmetrics++;
+  m->name = name;
+  m->help = help;
+  m->type = type;
+  m->fnc = fnc;
+  return m;
+}
+
+
+metric_t
+metrics_counter (const char *name, const char *help)
+{
+  return register_metric (name, METRIC_COUNTER, help, NULL);
+}
+
+
+metric_t
+metrics_gauge (const char *name, const char *help)
+{
+  return register_metric (name, METRIC_GAUGE, help, NULL);
+}
+
+
+/* Register a metric whose value is returned by FNC.  */
+void
+metrics_fnc (const char *name, metric_type_t type, const char *help,
+             metric_fnc_t fnc)
+{
+  register_metric (name, type, help, fnc);
+}
+
+
+void
+metric_add (metric_t m, unsigned long long n)
+{
+  if (m)
+    m->value += n;
+}
+
+
+void
+metric_sub (metric_t m, unsigned long long n)
+{
+  if (m)
+    m->value = m->value > n? m->value - n : 0;
+}
+
+
+void
+metric_set (metric_t m, unsigned long long value)
+{
+  if (m)
+    m->value = value;
+}
+
+
+/* Return the slot for a duration of USEC microseconds.  */
+static unsigned int
+duration_to_slot (unsigned long long usec)
+{
+  unsigned int e;
+
+  if (usec < 8)
+    return usec;
+  for (e = 3; e < 63 && (usec >> (e + 1)); e++)
+    ;
+  e = 8 + (e - 3) * 4 + ((usec >> (e - 2)) & 3);
+  return e < N_SLOTS? e : N_SLOTS - 1;
+}
+
+
+/* Return the largest duration which is put into SLOT.  */
+static unsigned long long
+slot_to_duration (unsigned int slot)
+{
+  unsigned int e;
+
+  if (slot < 8)
+    return slot;
+  e = (slot - 8) / 4 + 3;
+  return ((unsigned long long)(4 + (slot - 8) % 4 + 1) << (e - 2)) - 1;
+}
+
+
+/* Account the time since START, as returned by metrics_clock, as
+ * time spent waiting for the nPth lock.  This is to be called right
+ * after npth_protect returned.  */
+void
+metrics_lock_wait (unsigned long long start)
+{
+  unsigned long long elapsed = metrics_clock () - start;
+
+  lock_wait.sum += elapsed;
+  lock_wait.count++;
+  if (elapsed > lock_wait.max)
+    lock_wait.max = elapsed;
+}
+
+
+static struct command_stat_s *
+find_command (const char *name)
+{
+  int i;
+
+  for (i = 0; i < ncommands; i++)
+    if (!strcmp (commands[i].name, name))
+      return commands + i;
+  if (ncommands == MAX_COMMANDS || strlen (name) >= sizeof commands->name)
+    return NULL;
+  strcpy (commands[ncommands].name, name);
+  return commands + ncommands++;
+}
+
+
+void
+metrics_command_begin (const void *key, const char *command)
+{
+  struct pending_s *p = NULL;
+  int i;
+
+  if (!key || !command)
+    return;
+  for (i = 0; i < MAX_PENDING; i++)
+    if (pending[i].key == key)
+      {
+        p = pending + i;
+        break;
+      }
+    else if (!p && !pending[i].key)
+      p = pending + i;
+  if (!p)
+    return;  /* Too many connections; don't account.  */
+
+  p->cmd = find_command (command);
+  if (!p->cmd)
+    {
+      p->key = NULL;
+      return;
+    }
+  p->key = key;
+  p->start = metrics_clock ();
+}
+
+
+void
+metrics_command_end (const void *key)
+{
+  struct command_stat_s *cmd;
+  unsigned long long elapsed;
+  int i;
+
+  if (!key)
+    return;
+  for (i = 0; i < MAX_PENDING; i++)
+    if (pending[i].key == key)
+      break;
+  if (i == MAX_PENDING)
+    return;
+
+  cmd = pending[i].cmd;
+  elapsed = metrics_clock () - pending[i].start;
+  pending[i].key = NULL;
+
+  for (i = 0; i < N_BUCKETS && elapsed > bucket_bounds[i]; i++)
+    ;
+  cmd->buckets[i]++;
+  cmd->sum += elapsed;
+  cmd->count++;
+  if (elapsed > cmd->max)
+    cmd->max = elapsed;
+  cmd->slots[duration_to_slot (elapsed)]++;
+}
+
+
+/* Return an estimate of the 99th percentile of the durations of CMD
+ * in microseconds.  */
+static unsigned long long
+command_p99 (struct command_stat_s *cmd)
+{
+  unsigned long long n, rank;
+  unsigned int i;
+
+  rank = cmd->count - cmd->count / 100;
+  for (n = i = 0; i < N_SLOTS; i++)
+    {
+      n += cmd->slots[i];
+      if (n >= rank)
+        break;
+    }
+  if (i == N_SLOTS)
+    return cmd->max;
+  n = slot_to_duration (i);
+  return n < cmd->max? n : cmd->max;
+}
+
+
+/* Reset the statistics of the commands and of the lock waits.  */
+void
+metrics_reset_commands (void)
+{
+  int i;
+
+  for (i = 0; i < ncommands; i++)
+    {
+      memset (commands[i].buckets, 0, sizeof commands[i].buckets);
+      memset (commands[i].slots, 0, sizeof commands[i].slots);
+      commands[i].sum = commands[i].max = commands[i].count = 0;
+    }
+  memset (&lock_wait, 0, sizeof lock_wait);
+}
+
+
+static void
+format_header (membuf_t *mb, const char *name, const char *type,
+               const char *help)
+{
+  put_membuf_printf (mb, "# HELP %s_%s %s\n", prefix, name, help);
+  put_membuf_printf (mb, "# TYPE %s_%s %s\n", prefix, name, type);
+}
+
+
+char *
+metrics_format (void)
+{
+  membuf_t mb;
+  metric_t m;
+  unsigned long long n;
+  int i, j;
+
+  init_membuf (&mb, 4096);
+
+  n = (metrics_clock () - start_time) / 1000000;
+  format_header (&mb, "uptime_seconds", "gauge",
+                 "Seconds since the daemon was started.");
+  put_membuf_printf (&mb, "%s_uptime_seconds %llu\n", prefix, n);
+
+  for (i = 0; i < nmetrics; i++)
+    {
+      m = metrics + i;
+      format_header (&mb, m->name,
+                     m->type == METRIC_COUNTER? "counter" : "gauge", m->help);
+      put_membuf_printf (&mb, "%s_%s %llu\n", prefix, m->name,
+                         m->fnc? m->fnc () : m->value);
+    }
+
+  if (ncommands)
+    format_header (&mb, "command_duration_seconds", "histogram",
+                   "Duration of the Assuan commands.");
+  for (i = 0; i < ncommands; i++)
+    {
+      for (n = j = 0; j <= N_BUCKETS; j++)
+        {
+          n += commands[i].buckets[j];
+          put_membuf_printf (&mb, "%s_command_duration_seconds_bucket"
+                             "{command=\"%s\",le=\"%s\"} %llu\n",
+                             prefix, commands[i].name, bucket_labels[j], n);
+        }
+      put_membuf_printf (&mb, "%s_command_duration_seconds_sum"
+                         "{command=\"%s\"} %llu.%06llu\n",
+                         prefix, commands[i].name,
+                         commands[i].sum / 1000000,
+                         commands[i].sum % 1000000);
+      put_membuf_printf (&mb, "%s_command_duration_seconds_count"
+                         "{command=\"%s\"} %llu\n",
+                         prefix, commands[i].name, commands[i].count);
+    }
+
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Print the microseconds USEC as milliseconds.  */
+static void
+put_msec (membuf_t *mb, const char *name, unsigned long long usec)
+{
+  put_membuf_printf (mb, " %s=%llu.%03llu", name, usec / 1000, usec % 1000);
+}
+
+
+/* Return a malloced string with one line for each command and the
+ * waits for the nPth lock or NULL on error.  The lines are of the
+ * form
+ *
+ *   NAME count=N total_ms=T max_ms=M p99_ms=P
+ *
+ * with the pseudo command "npth_wait" for the waits; that line has
+ * no p99_ms item.  */
+char *
+metrics_format_cmdstats (void)
+{
+  membuf_t mb;
+  int i;
+
+  init_membuf (&mb, 1024);
+
+  for (i = 0; i < ncommands; i++)
+    {
+      if (!commands[i].count)
+        continue;
+      put_membuf_printf (&mb, "%s count=%llu",
+                         commands[i].name, commands[i].count);
+      put_msec (&mb, "total_ms", commands[i].sum);
+      put_msec (&mb, "max_ms", commands[i].max);
+      put_msec (&mb, "p99_ms", command_p99 (commands + i));
+      put_membuf (&mb, "\n", 1);
+    }
+
+  put_membuf_printf (&mb, "npth_wait count=%llu", lock_wait.count);
+  put_msec (&mb, "total_ms", lock_wait.sum);
+  put_msec (&mb, "max_ms", lock_wait.max);
+  put_membuf (&mb, "\n", 1);
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
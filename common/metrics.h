@@ -0,0 +1,88 @@
+/* metrics.h - A registry of daemon metrics
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_METRICS_H
+#define GNUPG_COMMON_METRICS_H
+
+/* The type of a metric.  */
+typedef enum
+  {
+    METRIC_COUNTER,  /* A value which only increases.  */
+    METRIC_GAUGE     /* A value which may go up and down.  */
+  } metric_type_t;
+
+typedef struct metric_s *metric_t;
+
+/* A function returning the current value of a metric.  */
+typedef unsigned long long (*metric_fnc_t) (void);
+
+
+/*-- metrics.c --*/
+
+/* Set the prefix of all metric names; this should be called once at
+ * startup.  */
+void metrics_init (const char *prefix);
+
+/* Register metrics.  NAME and HELP must be string constants.  The
+ * functions return NULL if the registry is full; the metric_*
+ * functions accept NULL for M.  */
+metric_t metrics_counter (const char *name, const char *help);
+metric_t metrics_gauge (const char *name, const char *help);
+void metrics_fnc (const char *name, metric_type_t type, const char *help,
+                  metric_fnc_t fnc);
+
+/* Update a metric.  */
+void metric_add (metric_t m, unsigned long long n);
+void metric_sub (metric_t m, unsigned long long n);
+void metric_set (metric_t m, unsigned long long value);
+
+/* Account the duration of an Assuan command.  KEY identifies the
+ * connection, usually the Assuan context, and COMMAND is the name of
+ * the command as given to a pre_cmd_notify handler.  */
+void metrics_command_begin (const void *key, const char *command);
+void metrics_command_end (const void *key);
+
+/* Return a malloced string with all metrics in the Prometheus text
+ * exposition format or NULL on error.  */
+char *metrics_format (void);
+
+/* Return a malloced string with the count, total, maximum and 99th
+ * percentile of the duration of each command and the time spent
+ * waiting for the nPth lock or NULL on error.  */
+char *metrics_format_cmdstats (void);
+void metrics_reset_commands (void);
+
+/* Return a monotonic time in microseconds.  */
+unsigned long long metrics_clock (void);
+
+/* Account the time since START as taken by metrics_clock as waiting
+ * for the nPth lock.  */
+void metrics_lock_wait (unsigned long long start);
+
+#endif /*GNUPG_COMMON_METRICS_H*/
@@ -764,9 +764,27 @@ nvc_set_private_key (nvc_t pk, gcry_sexp_t sexp)
 
 /* Parsing and serialization.  */
 
+/* Return true if the entry NAME shall be stored.  NAMES is NULL for
+ * all entries or a NULL terminated array of wanted names.  */
+static int
+wanted_name (const char *name, size_t name_len, int for_private_key,
+             const char * const *names)
+{
+  if (!names)
+    return 1;
+  if (for_private_key && name_len == 4 && !ascii_memcasecmp (name, "Key:", 4))
+    return 1;
+  for (; *names; names++)
+    if (strlen (*names) == name_len
+        && !ascii_memcasecmp (name, *names, name_len))
+      return 1;
+  return 0;
+}
+
+
 static gpg_error_t
 do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
-              int for_private_key)
+              int for_private_key, const char * const *names)
 {
   gpg_error_t err = 0;
   gpgrt_ssize_t len;
@@ -774,6 +792,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
   size_t buf_len = 0;
   char *name = NULL;
   strlist_t raw_value = NULL;
+  int skipping = 0;
 
   *result = for_private_key? nvc_new_private_key () : nvc_new ();
   if (*result == NULL)
@@ -791,9 +810,11 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
       for (p = buf; *p && ascii_isspace (*p); p++)
 	/* Do nothing.  */;
 
-      if (name && (spacep (buf) || *p == 0))
+      if ((name || skipping) && (spacep (buf) || *p == 0))
 	{
 	  /* A continuation.  */
+	  if (skipping)
+	    continue;
 	  if (append_to_strlist_try (&raw_value, buf) == NULL)
 	    {
 	      err = my_error_from_syserror ();
@@ -814,6 +835,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
       /* And prepare for the next one.  */
       name = NULL;
       raw_value = NULL;
+      skipping = 0;
 
       if (*p != 0 && *p != '#')
 	{
@@ -827,6 +849,11 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
 	    }
 
 	  value = colon + 1;
+	  if (!wanted_name (p, value - p, for_private_key, names))
+	    {
+	      skipping = 1;
+	      continue;
+	    }
 	  tmp = *value;
 	  *value = 0;
 	  name = xtrystrdup (p);
@@ -846,6 +873,8 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
 	  continue;
 	}
 
+      if (names)
+        continue;  /* Comments and blank lines are not wanted.  */
       if (append_to_strlist_try (&raw_value, buf) == NULL)
 	{
 	  err = my_error_from_syserror ();
@@ -884,7 +913,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
 gpg_error_t
 nvc_parse (nvc_t *result, int *errlinep, estream_t stream)
 {
-  return do_nvc_parse (result, errlinep, stream, 0);
+  return do_nvc_parse (result, errlinep, stream, 0, NULL);
 }
 
 
@@ -895,7 +924,22 @@ nvc_parse (nvc_t *result, int *errlinep, estream_t stream)
 gpg_error_t
 nvc_parse_private_key (nvc_t *result, int *errlinep, estream_t stream)
 {
-  return do_nvc_parse (result, errlinep, stream, 1);
+  return do_nvc_parse (result, errlinep, stream, 1, NULL);
+}
+
+
+/* Same as nvc_parse_private_key but store only the "Key:" item and
+   the items listed in the NULL terminated array NAMES.  All other
+   items, comments and blank lines are skipped without storing them.
+   This is for readers which need only a few items of a key file; a
+   container returned by this function must not be written back.  */
+gpg_error_t
+nvc_parse_private_key_filtered (nvc_t *result, int *errlinep,
+                                estream_t stream, const char * const *names)
+{
+  static const char * const nonames[] = { NULL };
+
+  return do_nvc_parse (result, errlinep, stream, 1, names? names : nonames);
 }
 
 
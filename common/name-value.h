@@ -130,6 +130,12 @@ gpg_error_t nvc_parse (nvc_t *result, int *errlinep, estream_t stream);
 gpg_error_t nvc_parse_private_key (nvc_t *result, int *errlinep,
                                    estream_t stream);
 
+/* Same as nvc_parse_private_key but store only the "Key:" item and the
+   items listed in the NULL terminated array NAMES.  */
+gpg_error_t nvc_parse_private_key_filtered (nvc_t *result, int *errlinep,
+                                            estream_t stream,
+                                            const char * const *names);
+
 /* Write a representation of PK to STREAM.  */
 gpg_error_t nvc_write (nvc_t pk, estream_t stream);
 
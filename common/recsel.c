@@ -65,7 +65,10 @@ struct recsel_expr_s
   unsigned int disjun:1;/* Start of a disjunction.  */
   unsigned int xcase:1; /* String match is case sensitive.  */
   const char *value;    /* (Points into NAME.)  */
+  size_t valuelen;      /* strlen of VALUE.  */
   long numvalue;        /* strtol of VALUE.  */
+  recsel_expr_t nextdisjun; /* First term of the next disjunction.  */
+  unsigned int nameidx; /* Index of the first term with the same NAME.  */
   char name[1];         /* Name of the property.  */
 };
 
@@ -85,6 +88,33 @@ my_error (gpg_err_code_t ec)
 }
 
 
+/* Precompute the data used by recsel_select for the entire chain
+ * SELECTOR.  This needs to be done after each change to the chain.  */
+static void
+compile_chain (recsel_expr_t selector)
+{
+  recsel_expr_t se, se2, disjun;
+  unsigned int idx, idx2;
+
+  for (se = selector, idx = 0; se; se = se->next, idx++)
+    {
+      se->valuelen = strlen (se->value);
+
+      for (disjun = se->next; disjun && !disjun->disjun; disjun = disjun->next)
+        ;
+      se->nextdisjun = disjun;
+
+      se->nameidx = idx;
+      for (se2 = selector, idx2 = 0; se2 != se; se2 = se2->next, idx2++)
+        if (!strcmp (se2->name, se->name))
+          {
+            se->nameidx = idx2;
+            break;
+          }
+    }
+}
+
+
 /* Return a pointer to the next logical connection operator or NULL if
  * none.  */
 static char *
@@ -437,6 +467,7 @@ recsel_parse_expr (recsel_expr_t *selector, const char *expression)
         ;
       se2->next = se_head;
     }
+  compile_chain (*selector);
 
   xfree (expr_buffer);
   return 0;
@@ -489,24 +520,35 @@ recsel_dump (recsel_expr_t selector)
 
 /* Return true if the record RECORD has been selected.  The GETVAL
  * function is called with COOKIE and the NAME of a property used in
- * the expression.  */
+ * the expression.  Consecutive terms on the same property use the
+ * value from one call to GETVAL.  */
 int
 recsel_select (recsel_expr_t selector,
                const char *(*getval)(void *cookie, const char *propname),
                void *cookie)
 {
   recsel_expr_t se;
-  const char *value;
-  size_t selen, valuelen;
-  long numvalue;
+  const char *value = NULL;
+  size_t valuelen = 0;
+  long numvalue = 0;
+  int have_valuelen = 0;
+  int have_numvalue = 0;
+  unsigned int lastidx = (unsigned int)(-1);
   int result = 1;
 
   se = selector;
   while (se)
     {
-      value = getval? getval (cookie, se->name) : NULL;
-      if (!value)
-        value = "";
+      if (!value || se->nameidx != lastidx)
+        {
+          /* The value returned by GETVAL may be in a static buffer
+           * and is thus only valid until the next call.  */
+          value = getval? getval (cookie, se->name) : NULL;
+          if (!value)
+            value = "";
+          lastidx = se->nameidx;
+          have_valuelen = have_numvalue = 0;
+        }
 
       if (!*value)
         {
@@ -515,20 +557,47 @@ recsel_select (recsel_expr_t selector,
         }
       else /* Field has a value.  */
         {
-          valuelen = strlen (value);
-          numvalue = strtol (value, NULL, 0);
-          selen = strlen (se->value);
+          switch (se->op)
+            {
+            case SELECT_SAME:
+            case SELECT_SUB:
+            case SELECT_NONEMPTY:
+              if (!have_valuelen)
+                {
+                  valuelen = strlen (value);
+                  have_valuelen = 1;
+                }
+              break;
+            case SELECT_ISTRUE:
+            case SELECT_EQ:
+            case SELECT_GT:
+            case SELECT_GE:
+            case SELECT_LT:
+            case SELECT_LE:
+              if (!have_numvalue)
+                {
+                  numvalue = strtol (value, NULL, 0);
+                  have_numvalue = 1;
+                }
+              break;
+            default:
+              break;
+            }
 
           switch (se->op)
             {
             case SELECT_SAME:
-              if (se->xcase)
-                result = (valuelen==selen && !memcmp (value,se->value,selen));
+              if (valuelen != se->valuelen)
+                result = 0;
+              else if (se->xcase)
+                result = !memcmp (value, se->value, valuelen);
               else
-                result = (valuelen==selen && !memicmp (value,se->value,selen));
+                result = !memicmp (value, se->value, valuelen);
               break;
             case SELECT_SUB:
-              if (se->xcase)
+              if (valuelen < se->valuelen)
+                result = 0;
+              else if (se->xcase)
                 result = !!gnupg_memstr (value, valuelen, se->value);
               else
                 result = !!memistr (value, valuelen, se->value);
@@ -598,9 +667,7 @@ recsel_select (recsel_expr_t selector,
            * conjunction evaluates to false.  We skip over the
            * remaining expressions of this conjunction and continue
            * with the next disjunction if any.  */
-          do
-            se = se->next;
-          while (se && !se->disjun);
+          se = se->nextdisjun;
         }
     }
 
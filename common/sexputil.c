@@ -1041,21 +1041,189 @@ get_pk_algo_from_key (gcry_sexp_t key)
 }
 
 
+/* Start walking the canonical encoded key at *BUF with length
+ * *BUFLEN in place.  On success *BUF is positioned right behind the
+ * algorithm name, which is stored as a slice borrowed from the buffer
+ * at R_ALGO and R_ALGOLEN.  The key type (e.g. "public-key") is stored
+ * the same way at R_TYPE and R_TYPELEN.  *DEPTH is set for use with
+ * canon_key_next_param.  */
+static gpg_error_t
+canon_key_start (const unsigned char **buf, size_t *buflen, int *depth,
+                 const unsigned char **r_type, size_t *r_typelen,
+                 const unsigned char **r_algo, size_t *r_algolen)
+{
+  gpg_error_t err;
+  const unsigned char *tok;
+  size_t toklen;
+
+  *depth = 0;
+  if ((err = parse_sexp (buf, buflen, depth, &tok, &toklen)))
+    return err;
+  if (tok || *depth != 1)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  if ((err = parse_sexp (buf, buflen, depth, &tok, &toklen)))
+    return err;
+  if (!tok)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  *r_type = tok;
+  *r_typelen = toklen;
+  if ((err = parse_sexp (buf, buflen, depth, &tok, &toklen)))
+    return err;
+  if (tok || *depth != 2)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  if ((err = parse_sexp (buf, buflen, depth, &tok, &toklen)))
+    return err;
+  if (!tok)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  *r_algo = tok;
+  *r_algolen = toklen;
+  return 0;
+}
+
+
+/* Advance to the next parameter list of the algorithm list.  *BUF,
+ * *BUFLEN and *DEPTH must have been set by canon_key_start.  On
+ * success the name of the parameter (e.g. "curve") is stored at
+ * R_NAME and R_NAMELEN and the remaining content of its list at
+ * R_LIST and R_LISTLEN; both are borrowed from the buffer.  Returns
+ * GPG_ERR_EOF at the end of the algorithm list.  */
+static gpg_error_t
+canon_key_next_param (const unsigned char **buf, size_t *buflen, int *depth,
+                      const unsigned char **r_name, size_t *r_namelen,
+                      const unsigned char **r_list, size_t *r_listlen)
+{
+  gpg_error_t err;
+  const unsigned char *tok, *start, *end;
+  size_t toklen;
+  int algodepth = 2;
+
+  for (;;)
+    {
+      if ((err = parse_sexp (buf, buflen, depth, &tok, &toklen)))
+        return err;
+      if (*depth < algodepth)
+        return gpg_error (GPG_ERR_EOF);
+      if (!tok && *depth == algodepth + 1)
+        break;  /* Start of a parameter list.  */
+      /* Skip other atoms of the algorithm list.  */
+    }
+
+  if ((err = parse_sexp (buf, buflen, depth, &tok, &toklen)))
+    return err;
+  if (!tok)
+    return gpg_error (GPG_ERR_INV_SEXP);
+  *r_name = tok;
+  *r_namelen = toklen;
+
+  start = *buf;
+  do
+    {
+      end = *buf;
+      if ((err = parse_sexp (buf, buflen, depth, &tok, &toklen)))
+        return err;
+    }
+  while (*depth > algodepth);
+  *r_list = start;
+  *r_listlen = end - start;
+  return 0;
+}
+
+
+/* Return the first value of the parameter NAME of the key
+ * KEYDATA/KEYDATALEN; for example the curve name for NAME "curve".
+ * The value is stored as a slice borrowed from KEYDATA at R_VALUE and
+ * R_VALUELEN; nothing is allocated.  Returns GPG_ERR_NOT_FOUND if the
+ * key has no such parameter.  */
+gpg_error_t
+get_param_from_canon_sexp (const unsigned char *keydata, size_t keydatalen,
+                           const char *name,
+                           unsigned char const **r_value, size_t *r_valuelen)
+{
+  gpg_error_t err;
+  const unsigned char *buf, *tok, *list;
+  size_t buflen, toklen, listlen;
+  size_t namelen = strlen (name);
+  int depth;
+
+  *r_value = NULL;
+  *r_valuelen = 0;
+
+  buf = keydata;
+  buflen = keydatalen;
+  err = canon_key_start (&buf, &buflen, &depth, &tok, &toklen, &tok, &toklen);
+  if (err)
+    return err;
+  while (!(err = canon_key_next_param (&buf, &buflen, &depth,
+                                       &tok, &toklen, &list, &listlen)))
+    {
+      if (toklen == namelen && !memcmp (tok, name, namelen))
+        {
+          int d = 0;
+
+          if (listlen
+              && !parse_sexp (&list, &listlen, &d, &tok, &toklen) && tok)
+            {
+              *r_value = tok;
+              *r_valuelen = toklen;
+              return 0;
+            }
+          break;
+        }
+    }
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
+    return err;
+  return gpg_error (GPG_ERR_NOT_FOUND);
+}
+
+
 /* This is a variant of get_pk_algo_from_key but takes an canonical
  * encoded S-expression as input.  Returns a GCRYPT public key
- * identiier or 0 on error.  */
+ * identiier or 0 on error.  The key is inspected in place.  */
 int
 get_pk_algo_from_canon_sexp (const unsigned char *keydata, size_t keydatalen)
 {
-  gcry_sexp_t sexp;
+  const unsigned char *buf, *tok, *name, *list;
+  size_t buflen, toklen, namelen, listlen;
+  char algoname[10];
+  int depth, d;
   int algo;
+  int eddsa = 0;
+  gpg_error_t err;
 
-  if (gcry_sexp_sscan (&sexp, NULL, keydata, keydatalen))
+  buf = keydata;
+  buflen = keydatalen;
+  if (canon_key_start (&buf, &buflen, &depth, &tok, &toklen, &tok, &toklen))
+    return 0;
+  if (toklen >= sizeof (algoname))
     return 0;
+  memcpy (algoname, tok, toklen);
+  algoname[toklen] = 0;
 
-  algo = get_pk_algo_from_key (sexp);
-  gcry_sexp_release (sexp);
-  return algo;
+  algo = gcry_pk_map_name (algoname);
+  if (algo != GCRY_PK_ECC)
+    return algo;
+
+  while (!(err = canon_key_next_param (&buf, &buflen, &depth,
+                                       &name, &namelen, &list, &listlen)))
+    {
+      d = 0;
+      if (namelen == 5 && !memcmp (name, "flags", 5))
+        {
+          while (listlen && !parse_sexp (&list, &listlen, &d, &tok, &toklen))
+            if (tok && toklen == 5 && !memcmp (tok, "eddsa", 5))
+              eddsa = 1;
+        }
+      else if (namelen == 5 && !memcmp (name, "curve", 5))
+        {
+          if (listlen && !parse_sexp (&list, &listlen, &d, &tok, &toklen)
+              && tok && toklen == 5 && !memcmp (tok, "Ed448", 5))
+            eddsa = 1;
+        }
+    }
+  if (gpg_err_code (err) != GPG_ERR_EOF)
+    return 0;  /* Invalid S-expression.  */
+
+  return eddsa? GCRY_PK_EDDSA : algo;
 }
 
 
@@ -1194,7 +1362,8 @@ cipher_mode_to_string (int mode)
     }
 }
 
-/* Return the canonical name of the ECC curve in KEY.  */
+/* Return the canonical name of the ECC curve in KEY.  See also
+ * get_ecc_curve_from_canon_sexp.  */
 const char *
 get_ecc_curve_from_key (gcry_sexp_t key)
 {
@@ -1237,3 +1406,51 @@ get_ecc_curve_from_key (gcry_sexp_t key)
   gcry_sexp_release (list);
   return curve_name;
 }
+
+
+/* This is a variant of get_ecc_curve_from_key but takes a canonical
+ * encoded S-expression as input and inspects it in place.  */
+const char *
+get_ecc_curve_from_canon_sexp (const unsigned char *keydata,
+                               size_t keydatalen)
+{
+  const unsigned char *buf, *keytype, *tok, *name, *list;
+  size_t buflen, keytypelen, toklen, namelen, listlen;
+  char buffer[64];
+  int depth, d;
+
+  buf = keydata;
+  buflen = keydatalen;
+  if (canon_key_start (&buf, &buflen, &depth,
+                       &keytype, &keytypelen, &tok, &toklen))
+    return NULL;
+  if (!((keytypelen == 10 && !memcmp (keytype, "public-key", 10))
+        || (keytypelen == 11 && !memcmp (keytype, "private-key", 11))
+        || (keytypelen == 21
+            && !memcmp (keytype, "protected-private-key", 21))
+        || (keytypelen == 20
+            && !memcmp (keytype, "shadowed-private-key", 20))))
+    return NULL;
+  if (toklen >= sizeof buffer)
+    return NULL;
+  memcpy (buffer, tok, toklen);
+  buffer[toklen] = 0;
+  if (gcry_pk_map_name (buffer) != GCRY_PK_ECC)
+    return NULL;
+
+  while (!canon_key_next_param (&buf, &buflen, &depth,
+                                &name, &namelen, &list, &listlen))
+    {
+      if (!(namelen == 5 && !memcmp (name, "curve", 5)))
+        continue;
+      d = 0;
+      if (!listlen || parse_sexp (&list, &listlen, &d, &tok, &toklen)
+          || !tok || toklen >= sizeof buffer)
+        return NULL;
+      memcpy (buffer, tok, toklen);
+      buffer[toklen] = 0;
+      return openpgp_oid_or_name_to_curve (buffer, 1);
+    }
+
+  return NULL;
+}
@@ -0,0 +1,204 @@
+/* starttrace.c - Trace the startup phases of a program
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/* This module accounts the time a program spends before it starts
+ * with its real work, for example initializing Libgcrypt, reading
+ * the configuration files, or registering the keyrings.  The program
+ * sets marks at the end of each phase; the time between two marks is
+ * accounted to the phase named by the later mark.  Phases which may
+ * happen later, like connecting to the agent, are accounted by
+ * starttrace_phase.  The trace is enabled by the option
+ * --startup-trace which is removed from the command line by
+ * init_common_subsystems so that any program using that function
+ * supports it.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "starttrace.h"
+
+/* The maximum number of phases we record.  */
+#define MAX_PHASES 32
+
+
+struct phase_s
+{
+  const char *name;
+  unsigned long long duration;  /* Microseconds.  */
+  unsigned long long at;        /* End of the phase since the start.  */
+};
+
+
+int starttrace_enabled;
+
+static unsigned long long start_time;
+static unsigned long long last_mark;
+
+static struct phase_s phases[MAX_PHASES];
+static unsigned int nphases;
+
+/* Set once the trace has been printed.  */
+static int dumped;
+
+
+
+/* Return a monotonic time in microseconds.  */
+unsigned long long
+starttrace_clock (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  return (unsigned long long)gnupg_get_time () * 1000000;
+}
+
+
+/* Remember the start time.  This is called by early_system_init.  */
+void
+starttrace_init (void)
+{
+  start_time = last_mark = starttrace_clock ();
+}
+
+
+/* Enable the trace if the option --startup-trace is given before a
+ * "--" in the command line described by ARGCP and ARGVP and remove
+ * the option.  */
+void
+starttrace_check_args (int *argcp, char ***argvp)
+{
+  char **argv = *argvp;
+  int i, j;
+
+  for (i = j = 1; i < *argcp; i++)
+    {
+      if (!strcmp (argv[i], "--"))
+        {
+          for (; i < *argcp; i++)
+            argv[j++] = argv[i];
+          break;
+        }
+      if (!strcmp (argv[i], "--startup-trace"))
+        {
+          if (!starttrace_enabled)
+            atexit (starttrace_dump);
+          starttrace_enabled = 1;
+        }
+      else
+        argv[j++] = argv[i];
+    }
+  if (j < *argcp)
+    {
+      argv[j] = NULL;
+      *argcp = j;
+    }
+}
+
+
+static void
+print_phase (const char *name, unsigned long long duration,
+             unsigned long long at)
+{
+  log_info ("startup: %-24s %9.3f ms (at %9.3f ms)\n",
+            name, duration / 1000.0, at / 1000.0);
+}
+
+
+/* Account the time since the last mark to the phase NAME.  */
+void
+starttrace_mark (const char *name)
+{
+  unsigned long long now;
+
+  if (!starttrace_enabled)
+    return;
+
+  now = starttrace_clock ();
+  if (dumped)
+    print_phase (name, now - last_mark, now - start_time);
+  else if (nphases < MAX_PHASES)
+    {
+      phases[nphases].name = name;
+      phases[nphases].duration = now - last_mark;
+      phases[nphases].at = now - start_time;
+      nphases++;
+    }
+  last_mark = now;
+}
+
+
+/* Account the time since START, as returned by starttrace_clock, to
+ * the phase NAME.  Unlike starttrace_mark this does not set a mark;
+ * it is used for phases which may happen at any time.  If the trace
+ * has already been printed the phase is printed right away.  */
+void
+starttrace_phase (const char *name, unsigned long long start)
+{
+  unsigned long long now;
+
+  if (!starttrace_enabled)
+    return;
+
+  now = starttrace_clock ();
+  if (dumped)
+    print_phase (name, now - start, now - start_time);
+  else if (nphases < MAX_PHASES)
+    {
+      phases[nphases].name = name;
+      phases[nphases].duration = now - start;
+      phases[nphases].at = now - start_time;
+      nphases++;
+    }
+}
+
+
+/* Print the trace.  This should be called when the program starts
+ * with its real work; it is also called at exit.  */
+void
+starttrace_dump (void)
+{
+  unsigned int i;
+
+  if (!starttrace_enabled || dumped)
+    return;
+  dumped = 1;
+
+  for (i = 0; i < nphases; i++)
+    print_phase (phases[i].name, phases[i].duration, phases[i].at);
+  log_info ("startup: %-24s %9.3f ms\n", "total",
+            (starttrace_clock () - start_time) / 1000.0);
+}
@@ -0,0 +1,52 @@
+/* starttrace.h - Trace the startup phases of a program
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef GNUPG_COMMON_STARTTRACE_H
+#define GNUPG_COMMON_STARTTRACE_H
+
+/* Set if the startup trace is enabled; only the starttrace_*
+ * functions shall modify it.  */
+extern int starttrace_enabled;
+
+/* Account the time since the last mark to the phase NAME, which must
+ * be a string constant.  The macro costs only a test of
+ * STARTTRACE_ENABLED if the trace is not enabled.  */
+#define STARTTRACE_MARK(name) \
+  do { if (starttrace_enabled) starttrace_mark ((name)); } while (0)
+
+/*-- starttrace.c --*/
+void starttrace_init (void);
+void starttrace_check_args (int *argcp, char ***argvp);
+void starttrace_mark (const char *name);
+unsigned long long starttrace_clock (void);
+void starttrace_phase (const char *name, unsigned long long start);
+void starttrace_dump (void);
+
+#endif /*GNUPG_COMMON_STARTTRACE_H*/
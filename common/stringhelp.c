@@ -297,26 +297,20 @@ trim_trailing_spaces( char *string )
 }
 
 
+/* Remove the trailing characters in TRIMCHARS from the LEN bytes of
+ * LINE and return the new length.  The line is scanned from its end
+ * so that only the trailing characters need to be looked at.  */
 unsigned
 trim_trailing_chars( byte *line, unsigned len, const char *trimchars )
 {
-    byte *p, *mark;
     unsigned n;
 
-    for(mark=NULL, p=line, n=0; n < len; n++, p++ ) {
-	if( strchr(trimchars, *p ) ) {
-	    if( !mark )
-		mark = p;
-	}
-	else
-	    mark = NULL;
-    }
+    for (n = len; n && strchr (trimchars, line[n-1]); n--)
+	;
 
-    if( mark ) {
-	*mark = 0;
-	return mark - line;
-    }
-    return len;
+    if( n < len )
+	line[n] = 0;
+    return n;
 }
 
 /****************
@@ -332,23 +326,11 @@ size_t
 length_sans_trailing_chars (const unsigned char *line, size_t len,
                             const char *trimchars )
 {
-  const unsigned char *p, *mark;
   size_t n;
 
-  for( mark=NULL, p=line, n=0; n < len; n++, p++ )
-    {
-      if (strchr (trimchars, *p ))
-        {
-          if( !mark )
-            mark = p;
-        }
-      else
-        mark = NULL;
-    }
-
-  if (mark)
-    return mark - line;
-  return len;
+  for (n = len; n && strchr (trimchars, line[n-1]); n--)
+    ;
+  return n;
 }
 
 /*
@@ -173,6 +173,26 @@ content_filter (void *opaque, int control,
   return 0;
 }
 
+
+/* State for collect_direct.  */
+struct direct_state
+{
+  char *buffer;
+  size_t len;
+  size_t size;
+};
+
+/* Callback for iobuf_read_direct.  */
+static void
+collect_direct (void *opaque, const void *buf, size_t len)
+{
+  struct direct_state *state = opaque;
+
+  assert (state->len + len <= state->size);
+  memcpy (state->buffer + state->len, buf, len);
+  state->len += len;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -318,6 +338,55 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Check that iobuf_scan_line lends complete lines and otherwise
+     works like iobuf_read_line.  */
+  {
+    char *content = "abc\ndefg\nhijkl\nmnopq";
+    iobuf_t iobuf;
+    const byte *line;
+    byte *buffer = NULL;
+    unsigned size = 0;
+    unsigned max_len;
+    int n;
+
+    iobuf = iobuf_temp_with_content (content, strlen(content));
+
+    max_len = 100;
+    n = iobuf_scan_line (iobuf, &line, &buffer, &size, &max_len);
+    assert (n == 4);
+    assert (memcmp (line, "abc\n", 4) == 0);
+    assert (!buffer);
+    assert (max_len == 100);
+
+    max_len = 100;
+    n = iobuf_scan_line (iobuf, &line, &buffer, &size, &max_len);
+    assert (n == 5);
+    assert (memcmp (line, "defg\n", 5) == 0);
+    assert (!buffer);
+
+    /* A truncated line is copied.  */
+    max_len = 5;
+    n = iobuf_scan_line (iobuf, &line, &buffer, &size, &max_len);
+    assert (n == 4);
+    assert (line == buffer);
+    assert (strcmp (buffer, "hij\n") == 0);
+    assert (max_len == 0);
+
+    /* So is the last line without a LF.  */
+    max_len = 100;
+    n = iobuf_scan_line (iobuf, &line, &buffer, &size, &max_len);
+    assert (n == 5);
+    assert (line == buffer);
+    assert (strcmp (buffer, "mnopq") == 0);
+
+    max_len = 100;
+    n = iobuf_scan_line (iobuf, &line, &buffer, &size, &max_len);
+    assert (n == 0);
+
+    free (buffer);
+    iobuf_close (iobuf);
+  }
+
   {
     /* - 10 characters, EOF
        - 17 characters, EOF
@@ -436,5 +505,146 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Check that reading a regular file gives the same result with
+     and without the mapped input mode.  */
+  {
+    const char fname[] = "t-iobuf-mmap.tmp";
+    size_t size = 200 * 1024 + 17;
+    char *content, *buffer;
+    FILE *fp;
+    iobuf_t iobuf;
+    int round, n;
+    size_t i;
+
+    content = xmalloc (size);
+    buffer = xmalloc (size);
+    for (i = 0; i < size; i++)
+      content[i] = (char)(i * 7 + (i >> 9));
+    fp = fopen (fname, "wb");
+    assert (fp);
+    assert (fwrite (content, size, 1, fp) == 1);
+    assert (!fclose (fp));
+
+    for (round = 0; round < 2; round++)
+      {
+        iobuf_set_mmap_threshold (round? 1 : 0);
+        iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+        iobuf = iobuf_open (fname);
+        assert (iobuf);
+
+        n = iobuf_ioctl (iobuf, IOBUF_IOCTL_PEEK, 8, buffer);
+        assert (n == 8 && !memcmp (buffer, content, 8));
+        assert (iobuf_get (iobuf) == (byte)content[0]);
+        n = iobuf_read (iobuf, buffer, size);
+        assert (n == size - 1);
+        assert (!memcmp (buffer, content + 1, size - 1));
+        assert (iobuf_get (iobuf) == -1);
+        iobuf_close (iobuf);
+
+        iobuf = iobuf_open (fname);
+        assert (iobuf);
+        assert (!iobuf_seek (iobuf, 4711));
+        n = iobuf_read (iobuf, buffer, 1000);
+        assert (n == 1000);
+        assert (!memcmp (buffer, content + 4711, 1000));
+        assert (!iobuf_seek (iobuf, size - 10));
+        n = iobuf_read (iobuf, buffer, 1000);
+        assert (n == 10);
+        assert (!memcmp (buffer, content + size - 10, 10));
+        iobuf_close (iobuf);
+      }
+
+    iobuf_set_mmap_threshold (0);
+    iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+    remove (fname);
+    free (buffer);
+    free (content);
+  }
+
+  /* Check that temp buffers start small and grow as needed and that
+     large files get a large buffer.  */
+  {
+    const char fname[] = "t-iobuf-bulk.tmp";
+    size_t size = 2 * 1024 * 1024 + 5;
+    char *content, *buffer;
+    FILE *fp;
+    iobuf_t iobuf;
+    size_t i, off;
+    int round, n;
+
+    content = xmalloc (size);
+    buffer = xmalloc (size);
+    for (i = 0; i < size; i++)
+      content[i] = (char)(i * 13 + (i >> 11));
+
+    iobuf = iobuf_temp ();
+    assert (iobuf->d.size <= 4096);
+    for (off = 0; off < size; off += 1000)
+      assert (!iobuf_write (iobuf, content + off,
+                            size - off < 1000? size - off : 1000));
+    assert (iobuf_get_temp_length (iobuf) == size);
+    assert (!memcmp (iobuf_get_temp_buffer (iobuf), content, size));
+    iobuf_close (iobuf);
+
+    fp = fopen (fname, "wb");
+    assert (fp);
+    assert (fwrite (content, size, 1, fp) == 1);
+    assert (!fclose (fp));
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    assert (iobuf->d.size >= 1024 * 1024);
+    for (off = 0; (n = iobuf_read (iobuf, buffer, 100000)) != -1; off += n)
+      assert (!memcmp (buffer, content + off, n));
+    assert (off == size);
+    iobuf_close (iobuf);
+    iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+
+    /* Read the file directly, with and without mapping, after
+       peeking at it.  */
+    for (round = 0; round < 2; round++)
+      {
+        struct direct_state state;
+
+        iobuf_set_mmap_threshold (round? 1 : 0);
+        iobuf = iobuf_open (fname);
+        assert (iobuf);
+        n = iobuf_ioctl (iobuf, IOBUF_IOCTL_PEEK, 8, buffer);
+        assert (n == 8 && !memcmp (buffer, content, 8));
+        state.buffer = buffer;
+        state.len = 0;
+        state.size = size;
+        assert (!iobuf_read_direct (iobuf, collect_direct, &state));
+        assert (state.len == size && !memcmp (buffer, content, size));
+        assert (iobuf_get (iobuf) == -1);
+        iobuf_close (iobuf);
+        iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+
+        /* Not possible with a filter or buffered data.  */
+        iobuf = iobuf_open (fname);
+        assert (iobuf);
+        assert (iobuf_get (iobuf) == (byte)content[0]);
+        assert (gpg_err_code (iobuf_read_direct (iobuf, collect_direct,
+                                                 &state))
+                == GPG_ERR_NOT_SUPPORTED);
+        iobuf_close (iobuf);
+        iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+      }
+    iobuf_set_mmap_threshold (0);
+
+    fp = fopen (fname, "wb");
+    assert (fp);
+    assert (fwrite (content, 100, 1, fp) == 1);
+    assert (!fclose (fp));
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+    assert (iobuf->d.size < 1024 * 1024);
+    iobuf_close (iobuf);
+    iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)fname);
+
+    remove (fname);
+    free (buffer);
+    free (content);
+  }
+
   return 0;
 }
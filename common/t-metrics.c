@@ -0,0 +1,145 @@
+/* t-metrics.c - Regression tests for metrics.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#include "t-support.h"
+
+static int verbose;
+
+
+static unsigned long long
+get_seven (void)
+{
+  return 7;
+}
+
+
+static void
+test_metrics_format (void)
+{
+  metric_t counter, gauge;
+  int conn1, conn2;
+  char *s;
+
+  metrics_init ("t");
+  counter = metrics_counter ("hits_total", "Hits.");
+  gauge = metrics_gauge ("used", "Used.");
+  metrics_fnc ("seven", METRIC_GAUGE, "Seven.", get_seven);
+  if (!counter || !gauge)
+    fail (1);
+
+  metric_add (counter, 3);
+  metric_add (counter, 2);
+  metric_set (gauge, 10);
+  metric_sub (gauge, 4);
+  metric_add (NULL, 1);
+
+  metrics_command_begin (&conn1, "GETINFO");
+  metrics_command_begin (&conn2, "PKSIGN");
+  metrics_command_end (&conn1);
+  metrics_command_end (&conn2);
+  metrics_command_begin (&conn1, "GETINFO");
+  metrics_command_end (&conn1);
+  metrics_command_end (&conn1);  /* Unbalanced; must be ignored.  */
+
+  s = metrics_format ();
+  if (!s)
+    fail (2);
+  if (!strstr (s, "# TYPE t_hits_total counter\nt_hits_total 5\n"))
+    fail (3);
+  if (!strstr (s, "# TYPE t_used gauge\nt_used 6\n"))
+    fail (4);
+  if (!strstr (s, "\nt_seven 7\n"))
+    fail (5);
+  if (!strstr (s, "# TYPE t_command_duration_seconds histogram\n"))
+    fail (6);
+  if (!strstr (s, "t_command_duration_seconds_bucket"
+               "{command=\"GETINFO\",le=\"+Inf\"} 2\n"))
+    fail (7);
+  if (!strstr (s, "t_command_duration_seconds_count{command=\"GETINFO\"} 2\n"))
+    fail (8);
+  if (!strstr (s, "t_command_duration_seconds_count{command=\"PKSIGN\"} 1\n"))
+    fail (9);
+  if (verbose)
+    fputs (s, stdout);
+  xfree (s);
+}
+
+
+/* This test relies on the commands run by test_metrics_format.  */
+static void
+test_metrics_cmdstats (void)
+{
+  char *s;
+
+  metrics_lock_wait (metrics_clock ());
+
+  s = metrics_format_cmdstats ();
+  if (!s)
+    fail (1);
+  if (strncmp (s, "GETINFO count=2 total_ms=", 25))
+    fail (2);
+  if (!strstr (s, "\nPKSIGN count=1 total_ms="))
+    fail (3);
+  if (!strstr (s, " p99_ms="))
+    fail (4);
+  if (!strstr (s, "\nnpth_wait count=1 total_ms="))
+    fail (5);
+  if (verbose)
+    fputs (s, stdout);
+  xfree (s);
+
+  metrics_reset_commands ();
+  s = metrics_format_cmdstats ();
+  if (!s)
+    fail (6);
+  if (strcmp (s, "npth_wait count=0 total_ms=0.000 max_ms=0.000\n"))
+    fail (7);
+  xfree (s);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  test_metrics_format ();
+  test_metrics_cmdstats ();
+
+  return 0;
+}
@@ -428,6 +428,50 @@ run_modification_tests (void)
 }
 
 
+void
+run_filter_tests (void)
+{
+  static const char source_text[] =
+    "# Comment\n"
+    "Label: Some\n"
+    "  label\n"
+    "Foo: bar\n"
+    "  more foo\n"
+    "\n"
+    "Key: (hello\n"
+    "  world)\n"
+    "Created: 20250101T000000\n";
+  static const char * const names[] = { "label:", "Created:", NULL };
+  gpg_error_t err;
+  estream_t source;
+  nvc_t pk;
+  gcry_sexp_t key;
+  char *buf;
+  size_t len;
+
+  len = strlen (source_text);
+  source = es_mopen ((void *)source_text, len, len,
+                     0, dummy_realloc, dummy_free, "r");
+  assert (source);
+  err = nvc_parse_private_key_filtered (&pk, NULL, source, names);
+  assert (err == 0);
+  es_fclose (source);
+
+  buf = nvc_to_string (pk);
+  assert (strcmp (buf, "Label: Some\n  label\nCreated: 20250101T000000\n"
+                  "Key: (hello\n  world)\n") == 0);
+  xfree (buf);
+  assert (!nvc_lookup (pk, "Foo:"));
+  assert (strcmp (nvc_get_string (pk, "Label:"), "Some label") == 0);
+
+  err = nvc_get_private_key (pk, &key);
+  assert (err == 0);
+  assert (key);
+  gcry_sexp_release (key);
+  nvc_release (pk);
+}
+
+
 void
 convert (const char *fname)
 {
@@ -598,6 +642,7 @@ main (int argc, char **argv)
       private_key_mode = 1;
       run_tests ();
       run_modification_tests ();
+      run_filter_tests ();
       break;
 
     case CONVERT:
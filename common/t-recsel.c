@@ -382,6 +382,68 @@ run_test_2 (void)
 }
 
 
+/* Returns the values in a static buffer as done by the real getval
+ * functions and counts the calls.  */
+static const char *
+test_3_getval (void *cookie, const char *name)
+{
+  static char buffer[20];
+  int *ncalls = cookie;
+
+  (*ncalls)++;
+  if (!strcmp (name, "num"))
+    strcpy (buffer, "42");
+  else if (!strcmp (name, "str"))
+    strcpy (buffer, "Hello");
+  else
+    *buffer = 0;
+  return buffer;
+}
+
+static void
+run_test_3 (void)
+{
+  gpg_error_t err;
+  recsel_expr_t se = NULL;
+  int ncalls;
+
+  ADDEXPR ("num > 40 && num < 50 && num != 41");
+  ncalls = 0;
+  if (!recsel_select (se, test_3_getval, &ncalls))
+    fail (0, 0);
+  if (ncalls != 1)
+    fail (0, 0);
+
+  FREEEXPR();
+  ADDEXPR ("num == 42 && str = hello && num -t && str =~ ell");
+  ncalls = 0;
+  if (!recsel_select (se, test_3_getval, &ncalls))
+    fail (0, 0);
+  if (ncalls != 4)
+    fail (0, 0);
+
+  FREEEXPR();
+  ADDEXPR ("num == 1 && str = hello && nix -n || str -n && num >= 42");
+  ncalls = 0;
+  if (!recsel_select (se, test_3_getval, &ncalls))
+    fail (0, 0);
+  if (ncalls != 3)
+    fail (0, 0);
+
+  FREEEXPR();
+  ADDEXPR ("str = hello && nix -n");
+  ADDEXPR ("|| num < 42");
+  ADDEXPR ("|| -c str =~ hell");
+  ncalls = 0;
+  if (recsel_select (se, test_3_getval, &ncalls))
+    fail (0, 0);
+  if (ncalls != 4)
+    fail (0, 0);
+
+  FREEEXPR();
+}
+
+
 
 int
 main (int argc, char **argv)
@@ -430,6 +492,7 @@ main (int argc, char **argv)
   run_test_1 ();
   run_test_1b ();
   run_test_2 ();
+  run_test_3 ();
   /* Fixme: We should add test for complex conditions.  */
 
   return 0;
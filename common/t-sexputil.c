@@ -499,6 +499,75 @@ test_ecc_uncompress (void)
 
 
 
+/* Check that the in-place inspection of canonical keys gives the same
+ * results as the functions working on gcry_sexp_t objects.  */
+static void
+test_canon_key_inspection (void)
+{
+  static const char *tests[] = {
+    "(public-key(rsa(n #00C0FFEE#)(e #010001#)))",
+    "(public-key(ecc(curve Ed25519)(flags eddsa)(q #40AABBCC#)))",
+    "(public-key(ecc(curve Ed448)(q #AABBCC#)))",
+    "(public-key(ecc(curve \"NIST P-256\")(q #04AABBCC#)))",
+    "(private-key(ecc(curve Curve25519)(flags djb-tweak)(q #40AB#)(d #12#)))",
+    "(shadowed-private-key(ecc(curve brainpoolP256r1)(q #04AB#)"
+    "(shadowed t1-v1 (#AB# OPENPGP.2))))",
+    "(public-key(dsa(p #0B#)(q #0C#)(g #0D#)(y #0E#)))",
+    "(foo-key(ecc(curve Ed25519)(q #40AB#)))"
+  };
+  gpg_error_t err;
+  gcry_sexp_t sexp;
+  unsigned char *canon;
+  size_t canonlen;
+  const unsigned char *value;
+  size_t valuelen;
+  const char *curve1, *curve2;
+  int idx;
+
+  for (idx=0; idx < DIM (tests); idx++)
+    {
+      err = gcry_sexp_new (&sexp, tests[idx], 0, 1);
+      if (err)
+        fail2 (idx, err);
+      err = make_canon_sexp (sexp, &canon, &canonlen);
+      if (err)
+        fail2 (idx, err);
+
+      if (get_pk_algo_from_canon_sexp (canon, canonlen)
+          != get_pk_algo_from_key (sexp))
+        fail (idx);
+
+      curve1 = get_ecc_curve_from_key (sexp);
+      curve2 = get_ecc_curve_from_canon_sexp (canon, canonlen);
+      if (!curve1 != !curve2 || (curve1 && strcmp (curve1, curve2)))
+        fail (idx);
+
+      err = get_param_from_canon_sexp (canon, canonlen, "q",
+                                       &value, &valuelen);
+      if (!idx)
+        {
+          if (gpg_err_code (err) != GPG_ERR_NOT_FOUND || value)
+            fail (idx);
+        }
+      else if (err || !valuelen || value < canon
+               || value + valuelen > canon + canonlen)
+        fail2 (idx, err);
+
+      xfree (canon);
+      gcry_sexp_release (sexp);
+    }
+
+  /* A canonical key with a truncated parameter.  */
+  if (get_pk_algo_from_canon_sexp
+      ((const unsigned char *)"(10:public-key(3:ecc(5:flags5:eddsa", 35))
+    fail (0);
+  if (!get_param_from_canon_sexp
+      ((const unsigned char *)"(10:public-key(3:ecc(5:curve", 28,
+       "curve", &value, &valuelen))
+    fail (0);
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -509,6 +578,7 @@ main (int argc, char **argv)
   test_make_canon_sexp_from_rsa_pk ();
   test_cmp_canon_sexp ();
   test_ecc_uncompress ();
+  test_canon_key_inspection ();
 
   return 0;
 }
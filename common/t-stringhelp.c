@@ -1295,6 +1295,46 @@ test_substitute_envvars (void)
 }
 
 
+static void
+test_trim_trailing_chars (void)
+{
+  struct {
+    const char *string;
+    unsigned int len;
+    unsigned int result;
+  } tests[] = {
+    { "", 0, 0 },
+    { "abc", 3, 3 },
+    { "abc \t\r\n", 7, 3 },
+    { " \t\r\n", 4, 0 },
+    { "a b\t c \n", 8, 6 },
+    { "a\n\nb", 4, 4 },
+    { "ab\0 ", 4, 2 }
+  };
+  int idx;
+  byte buf[16];
+  unsigned int n;
+
+  for (idx=0; idx < DIM (tests); idx++)
+    {
+      if (length_sans_trailing_chars ((const unsigned char *)tests[idx].string,
+                                      tests[idx].len, " \t\r\n")
+          != tests[idx].result)
+        fail (idx);
+
+      memcpy (buf, tests[idx].string, tests[idx].len);
+      buf[tests[idx].len] = 'x';
+      n = trim_trailing_chars (buf, tests[idx].len, " \t\r\n");
+      if (n != tests[idx].result)
+        fail (idx);
+      else if (n < tests[idx].len && buf[n])
+        fail (idx);
+      else if (memcmp (buf, tests[idx].string, n))
+        fail (idx);
+    }
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -1315,6 +1355,7 @@ main (int argc, char **argv)
   test_compare_version_strings ();
   test_format_text ();
   test_substitute_envvars ();
+  test_trim_trailing_chars ();
 
   xfree (home_buffer);
   return !!errcount;
@@ -0,0 +1,177 @@
+/* t-utf8conv.c - Module test for utf8conv.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t-support.h"
+#include "utf8conv.h"
+
+
+static void
+test_utf8_to_native (void)
+{
+  static struct {
+    const char *string;
+    int delim;
+    const char *expected;
+  } tests[] = {
+    { "", 0, "" },
+    { "Joe Random Hacker <joe@example.org>", 0,
+      "Joe Random Hacker <joe@example.org>" },
+    { "Joe Random Hacker <joe@example.org>", ':',
+      "Joe Random Hacker <joe@example.org>" },
+    { "Joe Random Hacker: <joe@example.org>", ':',
+      "Joe Random Hacker\\x3a <joe@example.org>" },
+    { "Joe Random Hacker: <joe@example.org>", 0,
+      "Joe Random Hacker: <joe@example.org>" },
+    { "Joe Random\nHacker <joe@example.org>", 0,
+      "Joe Random\\nHacker <joe@example.org>" },
+    { "Joe Random\nHacker <joe@example.org>", -1,
+      "Joe Random\nHacker <joe@example.org>" },
+    { "Joe Random Hacker <joe\\example.org>", 0,
+      "Joe Random Hacker <joe\\example.org>" },
+    { "Joe Random Hacker <joe\\example.org>", ':',
+      "Joe Random Hacker <joe\\x5cexample.org>" },
+    { "Joe Random Hacker <joe@example.org>\x7f", 0,
+      "Joe Random Hacker <joe@example.org>\\x7f" },
+    { "J\xc3\xb6rg Random Hacker <joe@example.org>", 0,
+      "J\xf6rg Random Hacker <joe@example.org>" }
+  };
+  int testno;
+  char buffer[64];
+  char small[8];
+  char *result;
+
+  for (testno=0; testno < DIM(tests); testno++)
+    {
+      result = utf8_to_native (tests[testno].string,
+                               strlen (tests[testno].string),
+                               tests[testno].delim);
+      if (strcmp (result, tests[testno].expected))
+        fail (testno);
+      xfree (result);
+
+      result = utf8_to_native_buf (tests[testno].string,
+                                   strlen (tests[testno].string),
+                                   tests[testno].delim,
+                                   buffer, sizeof buffer);
+      if (strcmp (result, tests[testno].expected))
+        fail (testno);
+      if ((result == buffer)
+          != !strcmp (tests[testno].string, tests[testno].expected))
+        fail (testno);
+      if (result != buffer)
+        xfree (result);
+
+      result = utf8_to_native_buf (tests[testno].string,
+                                   strlen (tests[testno].string),
+                                   tests[testno].delim,
+                                   small, sizeof small);
+      if (strcmp (result, tests[testno].expected))
+        fail (testno);
+      if (result != small)
+        xfree (result);
+    }
+}
+
+
+/* Put each character which needs a conversion or quoting at each
+ * position of a string so that all cases of the word at a time
+ * check are covered.  */
+static void
+test_special_positions (void)
+{
+  static const char specials[] = "\x01\x1f\x7f:\\\x80\xff";
+  char string[40];
+  char *result;
+  int i, pos;
+
+  for (i=0; specials[i]; i++)
+    for (pos = 0; pos < sizeof string; pos++)
+      {
+        memset (string, 'a' + pos % 26, sizeof string);
+        string[pos] = specials[i];
+
+        if (is_ascii_buffer (string, sizeof string)
+            != !(specials[i] & 0x80))
+          fail (i * 100 + pos);
+        if (is_ascii_buffer (string, pos) != 1)
+          fail (i * 100 + pos);
+
+        result = utf8_to_native (string, sizeof string, ':');
+        if (strlen (result) == sizeof string)
+          fail (i * 100 + pos);
+        xfree (result);
+      }
+
+  /* Characters next to the special ones are not quoted.  */
+  memset (string, '~', sizeof string);
+  string[3] = ' ';
+  string[11] = ';';
+  string[20] = '[';
+  string[33] = ']';
+  result = utf8_to_native (string, sizeof string, ':');
+  if (strlen (result) != sizeof string || memcmp (result, string, sizeof string))
+    fail (0);
+  xfree (result);
+}
+
+
+static void
+test_native_to_utf8 (void)
+{
+  char *result;
+
+  result = native_to_utf8 ("Joe Random Hacker <joe@example.org>");
+  if (strcmp (result, "Joe Random Hacker <joe@example.org>"))
+    fail (1);
+  xfree (result);
+  result = native_to_utf8 ("J\xf6rg Random Hacker <joe@example.org>");
+  if (strcmp (result, "J\xc3\xb6rg Random Hacker <joe@example.org>"))
+    fail (2);
+  xfree (result);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  /* The tests expect the default charset Latin-1.  */
+  test_utf8_to_native ();
+  test_special_positions ();
+  test_native_to_utf8 ();
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+/* thread-pool.c - Reusable threads for the daemons' connections
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Creating a thread for each accepted connection is one of the major
+ * costs of a daemon which serves many short-lived clients.  Instead
+ * of terminating, a thread which has finished with its connection
+ * waits for a while to be handed the next one.  The threads are
+ * created detached and are only used with nPth.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "util.h"
+#include "thread-pool.h"
+
+/* The number of idle threads we keep at most.  */
+#define MAX_IDLE_THREADS 16
+
+/* The number of seconds an idle thread waits for a new job.  */
+#define IDLE_TIMEOUT 60
+
+
+struct pool_thread_s
+{
+  struct pool_thread_s *next;  /* Link for the list of idle threads.  */
+  npth_cond_t cond;            /* Signaled when a job is assigned.  */
+  void *(*fnc) (void *arg);    /* The job or NULL.  */
+  void *arg;
+};
+typedef struct pool_thread_s *pool_thread_t;
+
+
+static npth_mutex_t pool_lock = NPTH_MUTEX_INITIALIZER;
+static pool_thread_t idle_threads;
+static unsigned int n_idle;
+static unsigned int n_threads;
+
+/* Statistics.  */
+static unsigned long n_created;
+static unsigned long n_reused;
+
+
+/* Remove PT from the list of idle threads.  Must be called with the
+ * lock held.  */
+static void
+unlink_idle (pool_thread_t pt)
+{
+  pool_thread_t *ptp;
+
+  for (ptp = &idle_threads; *ptp; ptp = &(*ptp)->next)
+    if (*ptp == pt)
+      {
+        *ptp = pt->next;
+        n_idle--;
+        break;
+      }
+}
+
+
+static void *
+pool_thread_main (void *arg)
+{
+  pool_thread_t pt = arg;
+  struct timespec abstime;
+
+  for (;;)
+    {
+      pt->fnc (pt->arg);
+
+      npth_mutex_lock (&pool_lock);
+      pt->fnc = NULL;
+      if (n_idle >= MAX_IDLE_THREADS)
+        break;
+      pt->next = idle_threads;
+      idle_threads = pt;
+      n_idle++;
+      memset (&abstime, 0, sizeof abstime);
+      abstime.tv_sec = time (NULL) + IDLE_TIMEOUT;
+      while (!pt->fnc)
+        if (npth_cond_timedwait (&pt->cond, &pool_lock, &abstime))
+          break;
+      if (!pt->fnc)
+        {
+          /* Timed out.  Note that a job may have been assigned after
+           * the timeout but before we got the lock again.  */
+          unlink_idle (pt);
+          break;
+        }
+      npth_mutex_unlock (&pool_lock);
+    }
+  n_threads--;
+  npth_mutex_unlock (&pool_lock);
+  npth_cond_destroy (&pt->cond);
+  xfree (pt);
+  return NULL;
+}
+
+
+/* Run FNC with ARG on an idle thread or on a new detached thread with
+ * the attributes TATTR.  Returns 0 on success or an errno value like
+ * npth_create.  */
+int
+thread_pool_run (npth_attr_t *tattr, void *(*fnc) (void *arg), void *arg)
+{
+  pool_thread_t pt;
+  npth_t thread;
+  int ret;
+
+  npth_mutex_lock (&pool_lock);
+  if ((pt = idle_threads))
+    {
+      idle_threads = pt->next;
+      n_idle--;
+      n_reused++;
+      pt->fnc = fnc;
+      pt->arg = arg;
+      npth_cond_signal (&pt->cond);
+      npth_mutex_unlock (&pool_lock);
+      return 0;
+    }
+  npth_mutex_unlock (&pool_lock);
+
+  pt = xtrycalloc (1, sizeof *pt);
+  if (!pt)
+    return errno? errno : ENOMEM;
+  ret = npth_cond_init (&pt->cond, NULL);
+  if (ret)
+    {
+      xfree (pt);
+      return ret;
+    }
+  pt->fnc = fnc;
+  pt->arg = arg;
+  npth_mutex_lock (&pool_lock);
+  n_threads++;
+  n_created++;
+  npth_mutex_unlock (&pool_lock);
+  ret = npth_create (&thread, tattr, pool_thread_main, pt);
+  if (ret)
+    {
+      npth_mutex_lock (&pool_lock);
+      n_threads--;
+      n_created--;
+      npth_mutex_unlock (&pool_lock);
+      npth_cond_destroy (&pt->cond);
+      xfree (pt);
+      return ret;
+    }
+  npth_setname_np (thread, "conn");
+  return 0;
+}
+
+
+/* Return a malloced string with the statistics of the pool.  */
+char *
+thread_pool_stats (void)
+{
+  char *result;
+
+  npth_mutex_lock (&pool_lock);
+  result = xtryasprintf ("threads=%u idle=%u created=%lu reused=%lu",
+                         n_threads, n_idle, n_created, n_reused);
+  npth_mutex_unlock (&pool_lock);
+  return result;
+}
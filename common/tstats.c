@@ -0,0 +1,272 @@
+/* tstats.c - Per-phase timing statistics
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This module accounts the time spent in the phases of an operation,
+ * for example key lookups, signature checks or the IPC with the
+ * agent.  Each phase records the number of calls, the time spent in
+ * the phase itself ("self") and the time including nested phases
+ * ("total").  Recursive calls of the same phase are accounted only
+ * once to the total.  The IOBUF filters are accounted like phases,
+ * keyed by their filter function.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+#include "tstats.h"
+
+/* The maximum nesting of phases we account.  */
+#define MAX_DEPTH 32
+
+/* The maximum number of different filters; the time of any further
+ * filters is accounted to the last entry.  */
+#define MAX_FILTERS 24
+
+
+struct tstat_entry_s
+{
+  const char *name;
+  unsigned long calls;
+  unsigned long long self;   /* Microseconds without nested phases.  */
+  unsigned long long total;  /* Microseconds including nested phases.  */
+  unsigned int active;       /* Number of frames of this entry.  */
+};
+
+
+struct tstat_filter_s
+{
+  const void *key;
+  char name[32];
+  struct tstat_entry_s e;
+};
+
+
+struct tstat_frame_s
+{
+  struct tstat_entry_s *e;
+  unsigned long long start;
+  unsigned long long nested;  /* Time spent in nested frames.  */
+};
+
+
+int tstat_enabled;
+
+static unsigned long long start_time;
+
+static struct tstat_entry_s phases[TSTAT_NPHASES] =
+  {
+    { "keydb search" },
+    { "packet parsing" },
+    { "signature check" },
+    { "trustdb" },
+    { "agent IPC" },
+    { "dirmngr IPC" },
+    { "keyboxd IPC" }
+  };
+
+static struct tstat_filter_s filters[MAX_FILTERS];
+static int nfilters;
+
+static struct tstat_frame_s stack[MAX_DEPTH];
+static unsigned int depth;
+
+
+
+/* Return a monotonic time in microseconds.  */
+static unsigned long long
+tstat_now (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  return (unsigned long long)gnupg_get_time () * 1000000;
+}
+
+
+/* Start collecting the statistics.  */
+void
+tstat_enable (void)
+{
+  start_time = tstat_now ();
+  tstat_enabled = 1;
+}
+
+
+static void
+enter_entry (struct tstat_entry_s *e)
+{
+  e->calls++;
+  if (depth < MAX_DEPTH)
+    {
+      stack[depth].e = e;
+      stack[depth].start = tstat_now ();
+      stack[depth].nested = 0;
+      e->active++;
+    }
+  depth++;
+}
+
+
+static void
+leave_entry (struct tstat_entry_s *e)
+{
+  struct tstat_frame_s *fr;
+  unsigned long long elapsed;
+
+  if (!depth)
+    return;  /* Enabled while in a phase.  */
+  depth--;
+  if (depth >= MAX_DEPTH)
+    return;
+
+  fr = stack + depth;
+  if (fr->e != e)
+    {
+      /* Unbalanced calls; this is a bug but we better don't die.  */
+      log_debug ("tstats: leaving '%s' but '%s' expected\n",
+                 e->name, fr->e->name);
+      e = fr->e;
+    }
+  elapsed = tstat_now () - fr->start;
+  e->self += elapsed > fr->nested? elapsed - fr->nested : 0;
+  if (!--e->active)
+    e->total += elapsed;
+  if (depth)
+    stack[depth-1].nested += elapsed;
+}
+
+
+void
+tstat_enter (tstat_phase_t phase)
+{
+  if ((unsigned int)phase < TSTAT_NPHASES)
+    enter_entry (phases + phase);
+}
+
+
+void
+tstat_leave (tstat_phase_t phase)
+{
+  if ((unsigned int)phase < TSTAT_NPHASES)
+    leave_entry (phases + phase);
+}
+
+
+static struct tstat_filter_s *
+find_filter (const void *key)
+{
+  int i;
+
+  for (i = 0; i < nfilters; i++)
+    if (filters[i].key == key)
+      return filters + i;
+  return nfilters == MAX_FILTERS? filters + MAX_FILTERS - 1 : NULL;
+}
+
+
+/* Return true if the filter KEY has already been entered once and
+ * thus needs no name.  */
+int
+tstat_filter_known (const void *key)
+{
+  return !!find_filter (key);
+}
+
+
+/* Enter the filter identified by KEY.  NAME is the description of
+ * the filter and only required if tstat_filter_known returned false;
+ * everything from the first '(' is ignored.  */
+void
+tstat_enter_filter (const void *key, const char *name)
+{
+  struct tstat_filter_s *f;
+  size_t n;
+
+  f = find_filter (key);
+  if (!f)
+    {
+      f = filters + nfilters++;
+      f->key = key;
+      if (nfilters == MAX_FILTERS)
+        name = "other filters";
+      else if (!name)
+        name = "?";
+      n = strcspn (name, "(");
+      if (n >= sizeof f->name)
+        n = sizeof f->name - 1;
+      memcpy (f->name, name, n);
+      f->name[n] = 0;
+      f->e.name = f->name;
+    }
+  enter_entry (&f->e);
+}
+
+
+void
+tstat_leave_filter (const void *key)
+{
+  struct tstat_filter_s *f = find_filter (key);
+
+  if (f)
+    leave_entry (&f->e);
+}
+
+
+static void
+dump_entry (const char *prefix, struct tstat_entry_s *e)
+{
+  if (!e->calls)
+    return;
+  log_info ("timing: %-8s %-20s %9lu calls %11.3f ms self %11.3f ms total\n",
+            prefix, e->name, e->calls, e->self / 1000.0, e->total / 1000.0);
+}
+
+
+/* Print the statistics.  */
+void
+tstat_dump (void)
+{
+  int i;
+
+  if (!tstat_enabled)
+    return;
+
+  log_info ("timing: %.3f ms since start\n",
+            (tstat_now () - start_time) / 1000.0);
+  for (i = 0; i < TSTAT_NPHASES; i++)
+    dump_entry ("phase", phases + i);
+  for (i = 0; i < nfilters; i++)
+    dump_entry ("filter", &filters[i].e);
+}
@@ -0,0 +1,69 @@
+/* tstats.h - Per-phase timing statistics
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_TSTATS_H
+#define GNUPG_COMMON_TSTATS_H
+
+/* The phases for which the time is accounted.  */
+typedef enum
+  {
+    TSTAT_KEYDB_SEARCH,
+    TSTAT_PARSE_PACKET,
+    TSTAT_SIG_CHECK,
+    TSTAT_TRUSTDB,
+    TSTAT_AGENT,
+    TSTAT_DIRMNGR,
+    TSTAT_KEYBOXD,
+    TSTAT_NPHASES
+  } tstat_phase_t;
+
+
+/* Set if the statistics are collected; only the tstat_* functions
+ * shall modify it.  */
+extern int tstat_enabled;
+
+/* Enter and leave a phase.  Phases may be nested; the time of an
+ * inner phase is not accounted to the outer phase.  The macros cost
+ * only a test of TSTAT_ENABLED if the statistics are not enabled.
+ * These functions may only be used by the main thread.  */
+#define TSTAT_ENTER(phase) \
+  do { if (tstat_enabled) tstat_enter ((phase)); } while (0)
+#define TSTAT_LEAVE(phase) \
+  do { if (tstat_enabled) tstat_leave ((phase)); } while (0)
+
+/*-- tstats.c --*/
+void tstat_enable (void);
+void tstat_enter (tstat_phase_t phase);
+void tstat_leave (tstat_phase_t phase);
+int  tstat_filter_known (const void *key);
+void tstat_enter_filter (const void *key, const char *name);
+void tstat_leave_filter (const void *key);
+void tstat_dump (void);
+
+#endif /*GNUPG_COMMON_TSTATS_H*/
@@ -34,6 +34,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <stdint.h>
 #ifdef HAVE_LANGINFO_CODESET
 #include <langinfo.h>
 #endif
@@ -312,6 +313,66 @@ is_native_utf8 (void)
 }
 
 
+/* Return the length of the longest prefix of the LENGTH bytes at
+   BUFFER which consists of plain ASCII characters not requiring any
+   quoting by utf8_to_native with DELIM.  With a DELIM of -1 only the
+   eighth bit is checked.  All native charsets are supersets of ASCII
+   and thus such a prefix needs no conversion.  The bulk of the check
+   is done a word at a time.  */
+static size_t
+plain_ascii_prefix (const unsigned char *buffer, size_t length, int delim)
+{
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  uint64_t word, x, bad;
+  size_t n;
+
+  for (n = 0; n + 8 <= length; n += 8)
+    {
+      memcpy (&word, buffer + n, 8);
+      bad = word & highs;
+      if (!bad && delim != -1)
+        {
+          /* Any byte below 0x20.  This is exact because no byte has
+             the high bit set.  */
+          bad = (word - 0x20 * ones) & ~word & highs;
+          /* Any byte equal to 0x7f, DELIM or a backslash.  */
+          x = word ^ (0x7f * ones);
+          bad |= (x - ones) & ~x & highs;
+          if (delim)
+            {
+              x = word ^ ((uint64_t)(delim & 0x7f) * ones);
+              bad |= (x - ones) & ~x & highs;
+              x = word ^ ('\\' * ones);
+              bad |= (x - ones) & ~x & highs;
+            }
+        }
+      if (bad)
+        break;
+    }
+
+  for (; n < length; n++)
+    {
+      if ((buffer[n] & 0x80))
+        break;
+      if (delim != -1
+          && (buffer[n] < 0x20 || buffer[n] == 0x7f || buffer[n] == delim
+              || (delim && buffer[n] == '\\')))
+        break;
+    }
+  return n;
+}
+
+
+/* Return true if the LENGTH bytes at BUFFER are all plain ASCII
+   characters.  */
+int
+is_ascii_buffer (const void *buffer, size_t length)
+{
+  return plain_ascii_prefix (buffer, length, -1) == length;
+}
+
+
 /* Convert string, which is in native encoding to UTF8 and return a
    new allocated UTF-8 string.  This function terminates the process
    on memory shortage.  */
@@ -324,7 +385,7 @@ native_to_utf8 (const char *orig_string)
   unsigned char *p;
   size_t length = 0;
 
-  if (no_translation)
+  if (no_translation || is_ascii_buffer (string, strlen (orig_string)))
     {
       /* Already utf-8 encoded. */
       buffer = xstrdup (orig_string);
@@ -420,6 +481,15 @@ do_utf8_to_native (const char *string, size_t length, int delim,
   size_t slen;
   int resync = 0;
 
+  /* Plain ASCII needs neither a conversion nor quoting.  */
+  if (plain_ascii_prefix (string, length, delim) == length)
+    {
+      buffer = xmalloc (length + 1);
+      memcpy (buffer, string, length);
+      buffer[length] = 0;
+      return buffer;
+    }
+
   /* First pass (p==NULL): count the extended utf-8 characters.  */
   /* Second pass (p!=NULL): create string.  */
   for (;;)
@@ -691,6 +761,25 @@ utf8_to_native (const char *string, size_t length, int delim)
 }
 
 
+/* Same as utf8_to_native but store the result in the caller provided
+   BUFFER of size BUFSIZE if it is plain ASCII and fits.  Returns
+   BUFFER or, for all other strings, a malloced string.  Thus the
+   caller needs to release the result if it is not BUFFER.  */
+char *
+utf8_to_native_buf (const char *string, size_t length, int delim,
+                    char *buffer, size_t bufsize)
+{
+  if (length < bufsize
+      && plain_ascii_prefix (string, length, delim) == length)
+    {
+      memcpy (buffer, string, length);
+      buffer[length] = 0;
+      return buffer;
+    }
+  return do_utf8_to_native (string, length, delim, use_iconv);
+}
+
+
 
 
 /* Wrapper function for iconv_open, required for W32 as we dlopen that
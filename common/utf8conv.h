@@ -35,8 +35,11 @@ int set_native_charset (const char *newset);
 const char *get_native_charset (void);
 int is_native_utf8 (void);
 
+int is_ascii_buffer (const void *buffer, size_t length);
 char *native_to_utf8 (const char *string);
 char *utf8_to_native (const char *string, size_t length, int delim);
+char *utf8_to_native_buf (const char *string, size_t length, int delim,
+                          char *buffer, size_t bufsize);
 
 
 /* Silly wrappers, required for W32 portability.  */
@@ -189,6 +189,11 @@ gpg_error_t uncompress_ecc_q_in_canon_sexp (const unsigned char *keydata,
                                             unsigned char **r_newkeydata,
                                             size_t *r_newkeydatalen);
 
+gpg_error_t get_param_from_canon_sexp (const unsigned char *keydata,
+                                       size_t keydatalen, const char *name,
+                                       unsigned char const **r_value,
+                                       size_t *r_valuelen);
+
 int get_pk_algo_from_key (gcry_sexp_t key);
 int get_pk_algo_from_canon_sexp (const unsigned char *keydata,
                                  size_t keydatalen);
@@ -197,6 +202,8 @@ const char *pubkey_algo_to_string (int algo);
 const char *hash_algo_to_string (int algo);
 const char *cipher_mode_to_string (int mode);
 const char *get_ecc_curve_from_key (gcry_sexp_t key);
+const char *get_ecc_curve_from_canon_sexp (const unsigned char *keydata,
+                                           size_t keydatalen);
 
 /*-- convert.c --*/
 int hex2bin (const char *string, void *buffer, size_t length);
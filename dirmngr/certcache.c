@@ -30,11 +30,22 @@
 #include "dirmngr.h"
 #include "misc.h"
 #include "../common/ksba-io-support.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
 #include "crlfetch.h"
 #include "certcache.h"
 
 #define MAX_NONPERM_CACHED_CERTS 1000
 
+/* The file in the cache directory which keeps an index of the
+ * system's trust store and the version of its format.  */
+#define SYSTRUST_INDEX_FILE     "systrust.txt"
+#define SYSTRUST_INDEX_VERSION  1
+
+/* The number of buckets of the secondary indices; must be a power
+ * of 2.  */
+#define CERTIDX_SIZE 1024
+
 /* Constants used to classify search patterns.  */
 enum pattern_class
   {
@@ -56,16 +67,32 @@ enum pattern_class
 /* A certificate cache item.  This consists of a the KSBA cert object
    and some meta data for easier lookup.  We use a hash table to keep
    track of all items and use the (randomly distributed) first byte of
-   the fingerprint directly as the hash which makes it pretty easy. */
+   the fingerprint directly as the hash which makes it pretty easy.
+   Valid items are also linked into secondary hash indices for the
+   lookup by subject, issuer, issuer and serial number, and subject
+   key identifier.  Items taken from the index of the system's trust
+   store have only the DER encoded certificate in IMAGE; the KSBA
+   cert object is created on the first use.  */
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
+  struct cert_item_s *next_subject; /* Next items in the buckets of  */
+  struct cert_item_s *next_issuer;  /* the secondary indices.        */
+  struct cert_item_s *next_sn;
+  struct cert_item_s *next_ski;
+  struct cert_item_s *lru_prev;     /* Links of the LRU list of the  */
+  struct cert_item_s *lru_next;     /* non-permanent certificates.   */
+  size_t size;              /* Approximate memory used by this item.  */
   ksba_cert_t cert;         /* The KSBA cert object or NULL is this is
-                               not a valid item.  */
+                               not a valid item or not yet parsed.  */
+  unsigned char *image;     /* The malloced DER encoded certificate of
+                               a not yet parsed item or NULL.  */
+  size_t imagelen;          /* The length of IMAGE.  */
   unsigned char fpr[20];    /* The fingerprint of this object. */
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t ski;          /* The malloced subject key id - maybe NULL. */
 
   /* If this field is set the certificate has been taken from some
    * configuration and shall not be flushed from the cache.  */
@@ -74,13 +101,27 @@ struct cert_item_s
   /* If this field is set the certificate is trusted.  The actual
    * value is a (possible) combination of CERTTRUST_CLASS values.  */
   unsigned int trustclasses:4;
+
+  /* This field is set if the item is linked into the LRU list.  */
+  unsigned int in_lru:1;
 };
 typedef struct cert_item_s *cert_item_t;
 
+/* True if the item CI is in use.  */
+#define SLOT_VALID(ci) ((ci)->cert || (ci)->image)
+
 /* The actual cert cache consisting of 256 slots for items indexed by
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* The secondary indices.  The buckets are selected by hashing the
+   subject DN, the issuer DN, the issuer DN and the serial number, and
+   the subject key identifier.  */
+static cert_item_t subject_index[CERTIDX_SIZE];
+static cert_item_t issuer_index[CERTIDX_SIZE];
+static cert_item_t sn_index[CERTIDX_SIZE];
+static cert_item_t ski_index[CERTIDX_SIZE];
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -94,6 +135,21 @@ static int initialization_done;
 /* Total number of non-permanent certificates.  */
 static unsigned int total_nonperm_certificates;
 
+/* The approximate memory used by the non-permanent certificates.  */
+static size_t total_nonperm_bytes;
+
+/* The non-permanent certificates ordered by their last use; the most
+ * recently used one first.  The list is updated by the lookup
+ * functions while holding only the read lock; that is fine because
+ * no other thread can run while we don't call any npth function.  */
+static cert_item_t lru_head;
+static cert_item_t lru_tail;
+
+/* Statistics about the lookups and evictions.  */
+static unsigned long cache_hits;
+static unsigned long cache_misses;
+static unsigned long cache_evictions;
+
 /* For each cert class the corresponding bit is set if at least one
  * certificate of that class is loaded permanetly.  */
 static unsigned int any_cert_of_class;
@@ -225,6 +281,197 @@ cert_compute_fpr (ksba_cert_t cert, unsigned char *digest)
 
 
 
+/* Return the data part of the simple canonical S-expression SEXP and
+ * store its length at R_LEN.  Returns NULL for an invalid SEXP.  */
+static const unsigned char *
+simple_sexp_data (const unsigned char *sexp, size_t *r_len)
+{
+  unsigned long n;
+  char *endp;
+
+  *r_len = 0;
+  if (!sexp || *sexp != '(')
+    return NULL;
+  n = strtoul ((const char *)sexp+1, &endp, 10);
+  if (*endp != ':')
+    return NULL;
+  *r_len = n;
+  return (const unsigned char *)endp + 1;
+}
+
+
+/* Update the FNV-1a hash value H with LEN bytes of BUFFER.  */
+static unsigned int
+hash_buffer (unsigned int h, const void *buffer, size_t len)
+{
+  const unsigned char *p = buffer;
+
+  for (; len; len--, p++)
+    {
+      h ^= *p;
+      h *= 16777619;
+    }
+  return h;
+}
+
+
+/* Return the index bucket for the DN string STRING.  */
+static unsigned int
+hash_dn (const char *string)
+{
+  return hash_buffer (2166136261, string, strlen (string)) & (CERTIDX_SIZE-1);
+}
+
+
+/* Return the index bucket for the ISSUER_DN and the serial number SN.  */
+static unsigned int
+hash_issuer_sn (const char *issuer_dn, ksba_sexp_t sn)
+{
+  const unsigned char *data;
+  size_t datalen;
+  unsigned int h;
+
+  h = hash_buffer (2166136261, issuer_dn, strlen (issuer_dn));
+  data = simple_sexp_data (sn, &datalen);
+  return hash_buffer (h, data, datalen) & (CERTIDX_SIZE-1);
+}
+
+
+/* Return the index bucket for the subject key identifier KEYID.  */
+static unsigned int
+hash_keyid (ksba_const_sexp_t keyid)
+{
+  const unsigned char *data;
+  size_t datalen;
+
+  data = simple_sexp_data (keyid, &datalen);
+  return hash_buffer (2166136261, data, datalen) & (CERTIDX_SIZE-1);
+}
+
+
+/* Remove the item CI from the LRU list.  */
+static void
+lru_unlink (cert_item_t ci)
+{
+  if (!ci->in_lru)
+    return;
+  if (ci->lru_prev)
+    ci->lru_prev->lru_next = ci->lru_next;
+  else
+    lru_head = ci->lru_next;
+  if (ci->lru_next)
+    ci->lru_next->lru_prev = ci->lru_prev;
+  else
+    lru_tail = ci->lru_prev;
+  ci->lru_prev = ci->lru_next = NULL;
+  ci->in_lru = 0;
+  total_nonperm_bytes -= ci->size;
+  memstat_free (MEMSTAT_CERTCACHE, ci->size);
+}
+
+
+/* Insert the item CI at the head of the LRU list.  */
+static void
+lru_push (cert_item_t ci)
+{
+  ci->lru_prev = NULL;
+  ci->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = ci;
+  else
+    lru_tail = ci;
+  lru_head = ci;
+  ci->in_lru = 1;
+  total_nonperm_bytes += ci->size;
+  memstat_alloc (MEMSTAT_CERTCACHE, ci->size);
+}
+
+
+/* Create the KSBA cert object of the not yet parsed item CI.  This
+ * does not call any npth function and may thus be used while holding
+ * only the read lock.  */
+static void
+parse_cache_slot (cert_item_t ci)
+{
+  gpg_error_t err;
+  ksba_cert_t cert;
+
+  err = ksba_cert_new (&cert);
+  if (!err)
+    err = ksba_cert_init_from_mem (cert, ci->image, ci->imagelen);
+  if (err)
+    {
+      log_error (_("can't parse certificate '%s': %s\n"),
+                 SYSTRUST_INDEX_FILE, gpg_strerror (err));
+      ksba_cert_release (cert);
+      return;
+    }
+  ci->cert = cert;
+  xfree (ci->image);
+  ci->image = NULL;
+  ci->imagelen = 0;
+}
+
+
+/* Note that the item CI has been used.  Returns CI->CERT which is
+ * NULL if the certificate could not be parsed.  */
+static ksba_cert_t
+touch_cache_slot (cert_item_t ci)
+{
+  cache_hits++;
+  if (!ci->cert)
+    parse_cache_slot (ci);
+  if (ci->in_lru && ci != lru_head)
+    {
+      lru_unlink (ci);
+      lru_push (ci);
+    }
+  return ci->cert;
+}
+
+
+/* Unlink the item CI from the index list HEAD which uses FIELD as the
+ * link.  */
+#define INDEX_UNLINK(head, ci, field)                          \
+  do {                                                          \
+    cert_item_t *_p;                                            \
+    for (_p = &(head); *_p; _p = &(*_p)->field)                 \
+      if (*_p == (ci))                                          \
+        {                                                       \
+          *_p = (ci)->field;                                    \
+          break;                                                \
+        }                                                       \
+    (ci)->field = NULL;                                         \
+  } while (0)
+
+
+/* Insert the valid item CI into the secondary indices.  */
+static void
+index_cache_slot (cert_item_t ci)
+{
+  unsigned int h;
+
+  if (ci->subject_dn)
+    {
+      h = hash_dn (ci->subject_dn);
+      ci->next_subject = subject_index[h];
+      subject_index[h] = ci;
+    }
+  h = hash_dn (ci->issuer_dn);
+  ci->next_issuer = issuer_index[h];
+  issuer_index[h] = ci;
+  h = hash_issuer_sn (ci->issuer_dn, ci->sn);
+  ci->next_sn = sn_index[h];
+  sn_index[h] = ci;
+  if (ci->ski)
+    {
+      h = hash_keyid (ci->ski);
+      ci->next_ski = ski_index[h];
+      ski_index[h] = ci;
+    }
+}
+
+
 /* Cleanup one slot.  This releases all resources but keeps the actual
    slot in the cache marked for reuse. */
 static void
@@ -232,15 +479,31 @@ clean_cache_slot (cert_item_t ci)
 {
   ksba_cert_t cert;
 
-  if (!ci->cert)
+  if (!SLOT_VALID (ci))
     return; /* Already cleaned.  */
 
+  lru_unlink (ci);
+  if (ci->subject_dn)
+    INDEX_UNLINK (subject_index[hash_dn (ci->subject_dn)], ci, next_subject);
+  if (ci->issuer_dn)
+    INDEX_UNLINK (issuer_index[hash_dn (ci->issuer_dn)], ci, next_issuer);
+  if (ci->issuer_dn && ci->sn)
+    INDEX_UNLINK (sn_index[hash_issuer_sn (ci->issuer_dn, ci->sn)],
+                  ci, next_sn);
+  if (ci->ski)
+    INDEX_UNLINK (ski_index[hash_keyid (ci->ski)], ci, next_ski);
+
   ksba_free (ci->sn);
   ci->sn = NULL;
   ksba_free (ci->issuer_dn);
   ci->issuer_dn = NULL;
   ksba_free (ci->subject_dn);
   ci->subject_dn = NULL;
+  ksba_free (ci->ski);
+  ci->ski = NULL;
+  xfree (ci->image);
+  ci->image = NULL;
+  ci->imagelen = 0;
   cert = ci->cert;
   ci->cert = NULL;
 
@@ -251,6 +514,70 @@ clean_cache_slot (cert_item_t ci)
 }
 
 
+/* Drop the least recently used non-permanent certificates until the
+ * number and the memory limits are met again.  KEEP is an item which
+ * shall not be dropped.  */
+static void
+evict_nonperm_certs (cert_item_t keep)
+{
+  size_t limit = (size_t)opt.max_cert_cache_size * 1024;
+  unsigned int count = 0;
+  cert_item_t ci;
+
+  while (total_nonperm_certificates > MAX_NONPERM_CACHED_CERTS
+         || (limit && total_nonperm_bytes > limit))
+    {
+      ci = lru_tail;
+      if (!ci || ci == keep)
+        break;
+      clean_cache_slot (ci);
+      total_nonperm_certificates--;
+      cache_evictions++;
+      count++;
+    }
+  if (count && opt.verbose)
+    log_info (_("dropping %u certificates from the cache\n"), count);
+}
+
+
+/* Return an unused slot for the certificate with the fingerprint FPR
+ * at R_CI.  Returns GPG_ERR_NOT_ENABLED if the certificate shall be
+ * ignored and GPG_ERR_DUP_VALUE if it is already cached.  */
+static gpg_error_t
+get_cache_slot (const unsigned char *fpr, cert_item_t *r_ci)
+{
+  cert_item_t ci;
+  fingerprint_list_t ignored;
+
+  /* Compare against the list of to be ignored certificates.  */
+  for (ignored = opt.ignored_certs; ignored; ignored = ignored->next)
+    if (ignored->binlen == 20 && !memcmp (fpr, ignored->hexfpr, 20))
+      {
+        /* We are configured not to use this certificate.  */
+        return gpg_error (GPG_ERR_NOT_ENABLED);
+      }
+
+  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
+    if (SLOT_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
+      return gpg_error (GPG_ERR_DUP_VALUE);
+  /* Try to reuse an existing entry.  */
+  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
+    if (!SLOT_VALID (ci))
+      break;
+  if (!ci)
+    { /* No: Create a new entry.  */
+      ci = xtrycalloc (1, sizeof *ci);
+      if (!ci)
+        return gpg_error_from_errno (errno);
+      ci->next = cert_cache[*fpr];
+      cert_cache[*fpr] = ci;
+    }
+
+  *r_ci = ci;
+  return 0;
+}
+
+
 /* Put the certificate CERT into the cache.  It is assumed that the
  * cache is locked while this function is called.
  *
@@ -268,9 +595,9 @@ static gpg_error_t
 put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
           void *fpr_buffer)
 {
+  gpg_error_t err;
   unsigned char help_fpr_buffer[20], *fpr;
   cert_item_t ci;
-  fingerprint_list_t ignored;
 
   /* Do not keep expired certificates in the permanent cache.  */
   if (permanent && !opt.debug_cache_expired_certs)
@@ -289,74 +616,10 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
 
   fpr = fpr_buffer? fpr_buffer : &help_fpr_buffer;
 
-  /* If we already reached the caching limit, drop a couple of certs
-   * from the cache.  Our dropping strategy is simple: We keep a
-   * static index counter and use this to start looking for
-   * certificates, then we drop 5 percent of the oldest certificates
-   * starting at that index.  For a large cache this is a fair way of
-   * removing items.  An LRU strategy would be better of course.
-   * Because we append new entries to the head of the list and we want
-   * to remove old ones first, we need to do this from the tail.  The
-   * implementation is not very efficient but compared to the long
-   * time it takes to retrieve a certificate from an external resource
-   * it seems to be reasonable.  */
-  if (!permanent && total_nonperm_certificates >= MAX_NONPERM_CACHED_CERTS)
-    {
-      static int idx;
-      cert_item_t ci_mark;
-      int i;
-      unsigned int drop_count;
-
-      drop_count = MAX_NONPERM_CACHED_CERTS / 20;
-      if (drop_count < 2)
-        drop_count = 2;
-
-      log_info (_("dropping %u certificates from the cache\n"), drop_count);
-      assert (idx < 256);
-      for (i=idx; drop_count; i = ((i+1)%256))
-        {
-          ci_mark = NULL;
-          for (ci = cert_cache[i]; ci; ci = ci->next)
-            if (ci->cert && !ci->permanent)
-              ci_mark = ci;
-          if (ci_mark)
-            {
-              clean_cache_slot (ci_mark);
-              drop_count--;
-              total_nonperm_certificates--;
-            }
-        }
-      if (i==idx)
-        idx++;
-      else
-        idx = i;
-      idx %= 256;
-    }
-
   cert_compute_fpr (cert, fpr);
-  /* Compare against the list of to be ignored certificates.  */
-  for (ignored = opt.ignored_certs; ignored; ignored = ignored->next)
-    if (ignored->binlen == 20 && !memcmp (fpr, ignored->hexfpr, 20))
-      {
-        /* We are configured not to use this certificate.  */
-        return gpg_error (GPG_ERR_NOT_ENABLED);
-      }
-
-  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
-      return gpg_error (GPG_ERR_DUP_VALUE);
-  /* Try to reuse an existing entry.  */
-  for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (!ci->cert)
-      break;
-  if (!ci)
-    { /* No: Create a new entry.  */
-      ci = xtrycalloc (1, sizeof *ci);
-      if (!ci)
-        return gpg_error_from_errno (errno);
-      ci->next = cert_cache[*fpr];
-      cert_cache[*fpr] = ci;
-    }
+  err = get_cache_slot (fpr, &ci);
+  if (err)
+    return err;
 
   ksba_cert_ref (cert);
   ci->cert = cert;
@@ -369,13 +632,28 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
       return gpg_error (GPG_ERR_INV_CERT_OBJ);
     }
   ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ci->ski))
+    ci->ski = NULL;
   ci->permanent = !!permanent;
   ci->trustclasses = trustclass;
+  index_cache_slot (ci);
 
   if (permanent)
     any_cert_of_class |= trustclass;
   else
-    total_nonperm_certificates++;
+    {
+      const unsigned char *image;
+      size_t imagelen;
+
+      image = ksba_cert_get_image (cert, &imagelen);
+      ci->size = sizeof *ci + (image? imagelen : 0);
+      ci->size += strlen (ci->issuer_dn) + 1;
+      if (ci->subject_dn)
+        ci->size += strlen (ci->subject_dn) + 1;
+      lru_push (ci);
+      total_nonperm_certificates++;
+      evict_nonperm_certs (ci);
+    }
 
   return 0;
 }
@@ -479,15 +757,102 @@ load_certs_from_dir (const char *dirname, unsigned int trustclass)
 }
 
 
+/* Append STRING to MB with colons, percent signs and linefeeds
+ * percent escaped.  */
+static void
+put_membuf_percented (membuf_t *mb, const char *string)
+{
+  char buf[4];
+
+  for (; *string; string++)
+    if (*string == ':' || *string == '%' || *string == '\n'
+        || *string == '\r')
+      {
+        snprintf (buf, sizeof buf, "%%%02X", *(const unsigned char *)string);
+        put_membuf (mb, buf, 3);
+      }
+    else
+      put_membuf (mb, string, 1);
+}
+
+
+/* Append the buffer (BUFFER,LENGTH) to MB in hex notation.  */
+static void
+put_membuf_hex (membuf_t *mb, const void *buffer, size_t length)
+{
+  const unsigned char *s = buffer;
+  char buf[3];
+
+  for (; length; length--, s++)
+    {
+      bin2hex (s, 1, buf);
+      put_membuf (mb, buf, 2);
+    }
+}
+
+
+/* Append an index record for CERT to MB.  The record has these colon
+ * delimited fields:
+ *
+ *   c:FPR:NOT_AFTER:SERIALNO:SKI:ISSUER:SUBJECT:IMAGE
+ *
+ * FPR, SERIALNO, SKI, and IMAGE are hex encoded with SERIALNO and SKI
+ * being canonical S-expressions; SKI and SUBJECT may be empty.
+ * ISSUER and SUBJECT are percent escaped.  */
+static void
+put_index_record (membuf_t *mb, ksba_cert_t cert)
+{
+  unsigned char fpr[20];
+  ksba_isotime_t not_after;
+  ksba_sexp_t sn, ski;
+  char *issuer, *subject;
+  const unsigned char *image;
+  size_t imagelen;
+
+  image = ksba_cert_get_image (cert, &imagelen);
+  sn = ksba_cert_get_serial (cert);
+  issuer = ksba_cert_get_issuer (cert, 0);
+  subject = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ski))
+    ski = NULL;
+  if (!image || !sn || !issuer || ksba_cert_get_validity (cert, 1, not_after))
+    goto leave;  /* Such a certificate won't be cached anyway.  */
+  cert_compute_fpr (cert, fpr);
+
+  put_membuf_str (mb, "c:");
+  put_membuf_hex (mb, fpr, 20);
+  put_membuf_printf (mb, ":%s:", not_after);
+  put_membuf_hex (mb, sn, gcry_sexp_canon_len (sn, 0, NULL, NULL));
+  put_membuf_str (mb, ":");
+  if (ski)
+    put_membuf_hex (mb, ski, gcry_sexp_canon_len (ski, 0, NULL, NULL));
+  put_membuf_str (mb, ":");
+  put_membuf_percented (mb, issuer);
+  put_membuf_str (mb, ":");
+  if (subject)
+    put_membuf_percented (mb, subject);
+  put_membuf_str (mb, ":");
+  put_membuf_hex (mb, image, imagelen);
+  put_membuf_str (mb, "\n");
+
+ leave:
+  ksba_free (sn);
+  ksba_free (ski);
+  ksba_free (issuer);
+  ksba_free (subject);
+}
+
+
 /* Load certificates from FILE.  The certificates are expected to be
  * PEM encoded so that it is possible to load several certificates.
  * TRUSTCLASSES is used to mark the certificates as trusted.  The
  * cache should be in a locked state when calling this function.
  * NO_ERROR repalces an error message when FNAME was not found by an
- * information message.  */
+ * information message.  If INDEX is not NULL an index record for
+ * each certificate is appended to it.  */
 static gpg_error_t
 load_certs_from_file (const char *fname, unsigned int trustclasses,
-                      int no_error)
+                      int no_error, membuf_t *index)
 {
   gpg_error_t err;
   estream_t fp = NULL;
@@ -534,6 +899,8 @@ load_certs_from_file (const char *fname, unsigned int trustclasses,
           goto leave;
         }
 
+      if (index)
+        put_index_record (index, cert);
       err = put_cert (cert, 1, trustclasses, NULL);
       if (gpg_err_code (err) == GPG_ERR_DUP_VALUE)
         log_info (_("certificate '%s' already cached\n"), fname);
@@ -568,6 +935,313 @@ load_certs_from_file (const char *fname, unsigned int trustclasses,
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+/* Return a malloced buffer with the binary value of the hex string
+ * HEXSTR and store its length at R_LEN.  Returns NULL if HEXSTR is
+ * empty or not a valid hex string.  */
+static unsigned char *
+unhex_alloc (const char *hexstr, size_t *r_len)
+{
+  size_t n = strlen (hexstr);
+  unsigned char *buffer;
+  size_t i;
+
+  if (!n || (n & 1))
+    return NULL;
+  for (i=0; i < n; i++)
+    if (!hexdigitp (hexstr + i))
+      return NULL;
+  buffer = xtrymalloc (n/2);
+  if (!buffer)
+    return NULL;
+  for (i=0; i < n/2; i++, hexstr += 2)
+    buffer[i] = xtoi_2 (hexstr);
+  *r_len = n/2;
+  return buffer;
+}
+
+
+/* Parse the index record LINE and store it in the unused item CI
+ * which is not yet linked into the cache.  CURRENT_TIME is used to
+ * skip expired certificates.  Returns GPG_ERR_CERT_EXPIRED for an
+ * expired certificate and GPG_ERR_INV_RECORD for an invalid one.  */
+static gpg_error_t
+parse_index_record (char *line, cert_item_t ci,
+                    const ksba_isotime_t current_time)
+{
+  char *field[8];
+  char *p;
+  size_t n;
+  int i;
+
+  for (i=0, p=line; i < DIM (field); i++)
+    {
+      field[i] = p;
+      p = p? strchr (p, ':') : NULL;
+      if (p)
+        *p++ = 0;
+    }
+  if (!field[7] || strcmp (field[0], "c")
+      || strlen (field[1]) != 40 || hex2bin (field[1], ci->fpr, 20) < 0)
+    return gpg_error (GPG_ERR_INV_RECORD);
+
+  if (!opt.debug_cache_expired_certs
+      && *field[2] && strcmp (current_time, field[2]) > 0)
+    return gpg_error (GPG_ERR_CERT_EXPIRED);
+
+  percent_unescape_inplace (field[5], 0);
+  percent_unescape_inplace (field[6], 0);
+  ci->sn = unhex_alloc (field[3], &n);
+  if (!ci->sn || gcry_sexp_canon_len (ci->sn, n, NULL, NULL) != n)
+    return gpg_error (GPG_ERR_INV_RECORD);
+  if (*field[4])
+    {
+      ci->ski = unhex_alloc (field[4], &n);
+      if (!ci->ski || gcry_sexp_canon_len (ci->ski, n, NULL, NULL) != n)
+        return gpg_error (GPG_ERR_INV_RECORD);
+    }
+  ci->issuer_dn = xtrystrdup (field[5]);
+  if (*field[6])
+    ci->subject_dn = xtrystrdup (field[6]);
+  ci->image = unhex_alloc (field[7], &ci->imagelen);
+  if (!ci->issuer_dn || (*field[6] && !ci->subject_dn) || !ci->image)
+    return gpg_error (GPG_ERR_INV_RECORD);
+
+  return 0;
+}
+
+
+/* Release the list of not yet cached items CI.  */
+static void
+release_index_items (cert_item_t ci)
+{
+  cert_item_t ci2;
+
+  for (; ci; ci = ci2)
+    {
+      ci2 = ci->next;
+      xfree (ci->sn);
+      xfree (ci->ski);
+      xfree (ci->issuer_dn);
+      xfree (ci->subject_dn);
+      xfree (ci->image);
+      xfree (ci);
+    }
+}
+
+
+/* Load the certificates of the system's trust store FNAME from the
+ * index file IDXNAME.  STATLINE is the expected header line
+ * describing FNAME.  Returns true if the index could be used.  The
+ * cache should be in a locked state when calling this function.  */
+static int
+load_certs_from_index (const char *idxname, const char *statline)
+{
+  gpg_error_t err;
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  ssize_t n;
+  unsigned int lineno = 0;
+  unsigned int count = 0;
+  cert_item_t items = NULL;
+  cert_item_t ci, dst;
+  ksba_isotime_t current_time;
+  int okay = 0;
+
+  fp = es_fopen (idxname, "r");
+  if (!fp)
+    return 0;
+
+  gnupg_get_isotime (current_time);
+  while ((n = es_read_line (fp, &line, &linelen, NULL)) > 0)
+    {
+      lineno++;
+      if (line[n-1] == '\n')
+        line[--n] = 0;
+      if (lineno == 1)
+        {
+          if (strncmp (line, "v:", 2)
+              || atoi (line+2) != SYSTRUST_INDEX_VERSION)
+            goto leave;
+          continue;
+        }
+      if (lineno == 2)
+        {
+          if (strcmp (line, statline))
+            goto leave;  /* The trust store has been changed.  */
+          continue;
+        }
+      if (*line == '#')
+        continue;
+
+      ci = xtrycalloc (1, sizeof *ci);
+      if (!ci)
+        goto leave;
+      ci->next = items;
+      items = ci;
+      err = parse_index_record (line, ci, current_time);
+      if (gpg_err_code (err) == GPG_ERR_CERT_EXPIRED)
+        {
+          items = ci->next;
+          ci->next = NULL;
+          release_index_items (ci);
+        }
+      else if (err)
+        {
+          log_info ("invalid record in '%s' line %u\n", idxname, lineno);
+          goto leave;
+        }
+    }
+  if (n < 0 || lineno < 2)
+    goto leave;
+
+  /* The index is valid; move the items into the cache.  */
+  while ((ci = items))
+    {
+      items = ci->next;
+      ci->next = NULL;
+      err = get_cache_slot (ci->fpr, &dst);
+      if (err)
+        {
+          if (gpg_err_code (err) == GPG_ERR_NOT_ENABLED)
+            log_info ("certificate '%s' skipped due to configuration\n",
+                      idxname);
+          release_index_items (ci);
+          continue;
+        }
+      memcpy (dst->fpr, ci->fpr, 20);
+      dst->sn = ci->sn;
+      dst->ski = ci->ski;
+      dst->issuer_dn = ci->issuer_dn;
+      dst->subject_dn = ci->subject_dn;
+      dst->image = ci->image;
+      dst->imagelen = ci->imagelen;
+      dst->permanent = 1;
+      dst->trustclasses = CERTTRUST_CLASS_SYSTEM;
+      index_cache_slot (dst);
+      any_cert_of_class |= CERTTRUST_CLASS_SYSTEM;
+      xfree (ci);
+      count++;
+    }
+  okay = 1;
+  if (DBG_X509)
+    log_debug ("number of certs taken from '%s': %u\n", idxname, count);
+
+ leave:
+  release_index_items (items);
+  es_free (line);
+  es_fclose (fp);
+  return okay;
+}
+
+
+/* Write the index records in MB for the system's trust store to the
+ * index file IDXNAME.  STATLINE is the header line describing the
+ * trust store.  */
+static void
+write_certs_index (const char *idxname, const char *statline, membuf_t *mb)
+{
+  gpg_error_t err;
+  char *tmpname;
+  char *buffer;
+  size_t buflen;
+  estream_t fp;
+
+  buffer = get_membuf (mb, &buflen);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  tmpname = strconcat (idxname, ".tmp", NULL);
+  if (!tmpname)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (buffer);
+      goto leave;
+    }
+
+  fp = es_fopen (tmpname, "w");
+  if (!fp)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      es_fprintf (fp, "v:%d\n%s\n", SYSTRUST_INDEX_VERSION, statline);
+      es_write (fp, buffer, buflen, NULL);
+      err = es_ferror (fp)? gpg_error_from_syserror () : 0;
+      if (es_fclose (fp) && !err)
+        err = gpg_error_from_syserror ();
+      if (!err)
+        err = gnupg_rename_file (tmpname, idxname, NULL);
+      if (err)
+        gnupg_remove (tmpname);
+    }
+  xfree (tmpname);
+  xfree (buffer);
+
+ leave:
+  if (err)
+    log_info ("error writing '%s': %s\n", idxname, gpg_strerror (err));
+}
+
+
+/* Load the system's trust store FNAME.  To avoid parsing all the
+ * certificates at each start an index of the store is kept in the
+ * cache directory which is used as long as the store has not been
+ * changed.  The certificates from the index are only parsed when they
+ * are actually used.  The cache should be in a locked state when
+ * calling this function.  */
+static gpg_error_t
+load_certs_from_system_file (const char *fname)
+{
+  gpg_error_t err;
+  struct stat st;
+  char *idxname = NULL;
+  char *statline = NULL;
+  membuf_t mb;
+
+  if (gnupg_stat (fname, &st) || !opt.homedir_cache)
+    return load_certs_from_file (fname, CERTTRUST_CLASS_SYSTEM, 0, NULL);
+
+  idxname = make_filename_try (opt.homedir_cache, SYSTRUST_INDEX_FILE, NULL);
+  {
+    char *tmp = percent_plus_escape (fname);
+
+    if (tmp)
+      statline = xtryasprintf ("f:%s:%lu:%lu", tmp,
+                               (unsigned long)st.st_mtime,
+                               (unsigned long)st.st_size);
+    xfree (tmp);
+  }
+  if (!idxname || !statline)
+    {
+      err = load_certs_from_file (fname, CERTTRUST_CLASS_SYSTEM, 0, NULL);
+      goto leave;
+    }
+
+  if (load_certs_from_index (idxname, statline))
+    {
+      err = 0;
+      goto leave;
+    }
+
+  init_membuf (&mb, 256*1024);
+  err = load_certs_from_file (fname, CERTTRUST_CLASS_SYSTEM, 0, &mb);
+  if (!err)
+    write_certs_index (idxname, statline, &mb);
+  else
+    xfree (get_membuf (&mb, NULL));
+
+ leave:
+  xfree (statline);
+  xfree (idxname);
+  return err;
+}
+
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 #ifdef HAVE_W32_SYSTEM
 /* Load all certificates from the Windows store named STORENAME.  All
  * certificates are considered to be system provided trusted
@@ -720,7 +1394,7 @@ load_certs_from_system (void)
     if (!gnupg_access (table[idx].name, F_OK))
       {
         /* Take the first available bundle.  */
-        err = load_certs_from_file (table[idx].name, CERTTRUST_CLASS_SYSTEM, 0);
+        err = load_certs_from_system_file (table[idx].name);
         break;
       }
 
@@ -764,7 +1438,7 @@ cert_cache_init (strlist_t hkp_cacerts)
   /* xfree (fname); */
 
   for (sl = hkp_cacerts; sl; sl = sl->next)
-    load_certs_from_file (sl->d, CERTTRUST_CLASS_HKP, 0);
+    load_certs_from_file (sl->d, CERTTRUST_CLASS_HKP, 0, NULL);
 
   initialization_done = 1;
   release_cache_lock ();
@@ -805,11 +1479,56 @@ cert_cache_deinit (int full)
   http_register_cfg_ca (NULL);
 
   total_nonperm_certificates = 0;
+  memstat_free (MEMSTAT_CERTCACHE, total_nonperm_bytes);
+  total_nonperm_bytes = 0;
+  lru_head = lru_tail = NULL;
   any_cert_of_class = 0;
   initialization_done = 0;
   release_cache_lock ();
 }
 
+static unsigned long long
+metric_hits (void)
+{
+  return cache_hits;
+}
+
+static unsigned long long
+metric_misses (void)
+{
+  return cache_misses;
+}
+
+static unsigned long long
+metric_evictions (void)
+{
+  return cache_evictions;
+}
+
+static unsigned long long
+metric_nonperm (void)
+{
+  return total_nonperm_certificates;
+}
+
+
+/* Register the statistics with the metrics module.  This must be
+ * called only once.  */
+void
+cert_cache_register_metrics (void)
+{
+  metrics_fnc ("certcache_hits_total", METRIC_COUNTER,
+               "Certificate lookups found in the cache.", metric_hits);
+  metrics_fnc ("certcache_misses_total", METRIC_COUNTER,
+               "Certificate lookups not found in the cache.", metric_misses);
+  metrics_fnc ("certcache_evictions_total", METRIC_COUNTER,
+               "Certificates evicted from the cache.", metric_evictions);
+  metrics_fnc ("certcache_nonperm_certificates", METRIC_GAUGE,
+               "Number of non-permanent certificates in the cache.",
+               metric_nonperm);
+}
+
+
 /* Print some statistics to the log file.  */
 void
 cert_cache_print_stats (ctrl_t ctrl)
@@ -827,7 +1546,7 @@ cert_cache_print_stats (ctrl_t ctrl)
   acquire_cache_read_lock ();
   for (idx = 0; idx < 256; idx++)
     for (ci=cert_cache[idx]; ci; ci = ci->next)
-      if (ci->cert)
+      if (SLOT_VALID (ci))
         {
           if (ci->permanent)
             n_permanent++;
@@ -862,6 +1581,13 @@ cert_cache_print_stats (ctrl_t ctrl)
                         n_trustclass_config,
                         n_trustclass_hkp,
                         n_trustclass_hkpspool);
+  dirmngr_status_helpf (ctrl,
+                 _("     runtime cache memory usage: %lu of %lu KiB\n"),
+                        (unsigned long)(total_nonperm_bytes + 1023) / 1024,
+                        (unsigned long)opt.max_cert_cache_size);
+  dirmngr_status_helpf (ctrl,
+                 _("    cache hits/misses/evictions: %lu/%lu/%lu\n"),
+                        cache_hits, cache_misses, cache_evictions);
 }
 
 
@@ -929,16 +1655,20 @@ ksba_cert_t
 get_cert_byfpr (const unsigned char *fpr)
 {
   cert_item_t ci;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
+    if (SLOT_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
       {
-        ksba_cert_ref (ci->cert);
+        cert = touch_cache_slot (ci);
+        if (cert)
+          ksba_cert_ref (cert);
         release_cache_lock ();
-        return ci->cert;
+        return cert;
       }
 
+  cache_misses++;
   release_cache_lock ();
   return NULL;
 }
@@ -989,23 +1719,22 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci=sn_index[hash_issuer_sn (issuer_dn, serialno)]; ci; ci = ci->next_sn)
+    if (SLOT_VALID (ci) && !strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        cert = touch_cache_slot (ci);
+        if (cert)
+          ksba_cert_ref (cert);
+        release_cache_lock ();
+        return cert;
+      }
 
+  cache_misses++;
   release_cache_lock ();
   return NULL;
 }
@@ -1016,23 +1745,23 @@ get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 ksba_cert_t
 get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=issuer_index[hash_dn (issuer_dn)]; ci; ci = ci->next_issuer)
+    if (SLOT_VALID (ci) && !strcmp (ci->issuer_dn, issuer_dn))
+      if (!seq--)
+        {
+          cert = touch_cache_slot (ci);
+          if (cert)
+            ksba_cert_ref (cert);
+          release_cache_lock ();
+          return cert;
+        }
 
+  if (!seq)
+    cache_misses++;
   release_cache_lock ();
   return NULL;
 }
@@ -1043,27 +1772,27 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
+  ksba_cert_t cert;
 
   if (!subject_dn)
     return NULL;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=subject_index[hash_dn (subject_dn)]; ci; ci = ci->next_subject)
+    if (SLOT_VALID (ci) && ci->subject_dn
+        && !strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          cert = touch_cache_slot (ci);
+          if (cert)
+            ksba_cert_ref (cert);
+          release_cache_lock ();
+          return cert;
+        }
 
+  if (!seq)
+    cache_misses++;
   release_cache_lock ();
   return NULL;
 }
@@ -1503,24 +2232,24 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ocsp_certs\n", __func__);
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci=subject_index[hash_dn (subject_dn)]; ci; ci = ci->next_subject)
+        if (SLOT_VALID (ci) && ci->subject_dn
+            && !strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                cert = touch_cache_slot (ci);
+                if (cert)
+                  ksba_cert_ref (cert);
+                release_cache_lock ();
+                if (DBG_LOOKUP)
+                  log_debug ("%s: certificate found in the cache"
+                             " via ocsp_certs\n", __func__);
+                return cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
@@ -1572,27 +2301,22 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
    * by keyid.  */
   if (!subject_dn && keyid)
     {
-      int i;
       cert_item_t ci;
-      ksba_sexp_t ski;
 
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && !ksba_cert_get_subj_key_id (ci->cert, NULL, &ski))
-            {
-              if (!cmp_simple_canon_sexp (keyid, ski))
-                {
-                  ksba_free (ski);
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ski\n", __func__);
-                  return ci->cert;
-                }
-              ksba_free (ski);
-            }
+      for (ci=ski_index[hash_keyid (keyid)]; ci; ci = ci->next_ski)
+        if (SLOT_VALID (ci) && ci->ski
+            && !cmp_simple_canon_sexp (keyid, ci->ski))
+          {
+            cert = touch_cache_slot (ci);
+            if (cert)
+              ksba_cert_ref (cert);
+            release_cache_lock ();
+            if (DBG_LOOKUP)
+              log_debug ("%s: certificate found in the cache"
+                         " via ski\n", __func__);
+            return cert;
+          }
       release_cache_lock ();
     }
 
@@ -1719,7 +2443,7 @@ is_trusted_cert (ksba_cert_t cert, unsigned int trustclasses)
 
   acquire_cache_read_lock ();
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
-    if (ci->cert && !memcmp (ci->fpr, fpr, 20))
+    if (SLOT_VALID (ci) && !memcmp (ci->fpr, fpr, 20))
       {
         if ((ci->trustclasses & trustclasses))
           {
@@ -39,6 +39,9 @@ void cert_cache_deinit (int full);
 /* Print some statistics to the log file.  */
 void cert_cache_print_stats (ctrl_t ctrl);
 
+/* Register the statistics with the metrics module.  */
+void cert_cache_register_metrics (void);
+
 /* Return true if any cert of a class in MASK is permanently loaded.  */
 int cert_cache_any_in_class (unsigned int mask);
 
@@ -102,6 +102,8 @@
 #include <sys/utsname.h>
 #endif
 
+#include <npth.h>
+
 #include "dirmngr.h"
 #include "validate.h"
 #include "certcache.h"
@@ -109,6 +111,7 @@
 #include "crlfetch.h"
 #include "misc.h"
 #include "cdb.h"
+#include "../common/memstat.h"
 
 /* Change this whenever the format changes */
 #define DBDIR_D "crls.d"
@@ -118,8 +121,32 @@
 /* The number of DB files we may have open at one time.  We need to
    limit this because there is no guarantee that the number of issuers
    has a upper limit.  We are currently using mmap, so it is a good
-   idea anyway to limit the number of opened cache files. */
-#define MAX_OPEN_DB_FILES 5
+   idea anyway to limit the number of opened cache files.  Checking
+   many certificates from different issuers thrashes the mapped files
+   if this is too low. */
+#define MAX_OPEN_DB_FILES 16
+
+/* For each CRL we keep a Bloom filter of the listed serial numbers so
+   that the common lookup of a not revoked certificate does not need
+   to access the cache file.  With 10 bits per entry and 7 hash
+   functions about 1% of the lookups for unlisted serial numbers still
+   need to consult the file.  The filter size is limited to
+   BLOOM_MAX_BYTES; a larger CRL gets a higher false positive rate. */
+#define BLOOM_BITS_PER_ENTRY 10
+#define BLOOM_HASHES         7
+#define BLOOM_MAX_BYTES      (4*1024*1024)
+
+/* The housekeeping refreshes a CRL which has been used since it was
+   loaded if its nextUpdate is less than CRL_PREFETCH_WINDOW seconds
+   ahead; for a CRL with a short validity period a quarter of that
+   period is used instead.  After a refresh or a failed attempt the
+   CRL is not tried again for CRL_PREFETCH_RETRY seconds.  */
+#define CRL_PREFETCH_WINDOW  (60*60)
+#define CRL_PREFETCH_RETRY   (30*60)
+
+/* The maximum number of distribution points we fetch from at the
+   same time.  */
+#define MAX_PARALLEL_DP_FETCHES 4
 
 #ifndef O_BINARY
 # define O_BINARY 0
@@ -133,6 +160,7 @@
 
 
 static const char oidstr_crlNumber[] = "2.5.29.20";
+static const char oidstr_deltaCRLIndicator[] = "2.5.29.27";
 /* static const char oidstr_issuingDistributionPoint[] = "2.5.29.28"; */
 static const char oidstr_authorityKeyIdentifier[] = "2.5.29.35";
 
@@ -165,6 +193,13 @@ struct crl_cache_entry_s
   unsigned int cdb_lru_count;  /* Used for LRU purposes. */
   int dbfile_checked;          /* Set to true if the dbfile_hash value has
                                   been checked once. */
+
+  unsigned char *bloom;        /* Bloom filter of the serial numbers or
+                                  NULL if not yet built.  */
+  cdbi_t bloom_bits;           /* Size of BLOOM in bits.  */
+
+  unsigned int hits;           /* Number of lookups since loaded.  */
+  time_t last_prefetch;        /* Time of the last refresh attempt.  */
 };
 
 
@@ -380,6 +415,9 @@ release_one_cache_entry (crl_cache_entry_t entry)
         }
       xfree (entry->release_ptr);
       xfree (entry->check_trust_anchor);
+      if (entry->bloom)
+        memstat_free (MEMSTAT_CRLCACHE, entry->bloom_bits / 8);
+      xfree (entry->bloom);
       xfree (entry);
     }
 }
@@ -1070,6 +1108,116 @@ check_dbfile (const char *fname, const char *md5hexvalue)
 }
 
 
+/* Compute the Bloom filter hashes for the serial number SN/SNLEN.  */
+static void
+bloom_hashes (const unsigned char *sn, size_t snlen, cdbi_t *r_h1, cdbi_t *r_h2)
+{
+  cdbi_t h2 = 2166136261u;  /* FNV-1a as the second hash.  */
+  size_t i;
+
+  for (i=0; i < snlen; i++)
+    h2 = (h2 ^ sn[i]) * 16777619u;
+  *r_h1 = cdb_hash (sn, snlen);
+  *r_h2 = h2 | 1;
+}
+
+
+/* Add the serial number SN/SNLEN to the Bloom filter of ENTRY.  */
+static void
+bloom_add (crl_cache_entry_t entry, const unsigned char *sn, size_t snlen)
+{
+  cdbi_t h1, h2, bit;
+  int i;
+
+  bloom_hashes (sn, snlen, &h1, &h2);
+  for (i=0; i < BLOOM_HASHES; i++, h1 += h2)
+    {
+      bit = h1 % entry->bloom_bits;
+      entry->bloom[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+
+/* Return true if the serial number SN/SNLEN may be listed in the CRL
+   of ENTRY and false if it is definitely not listed.  */
+static int
+bloom_maybe_listed_p (crl_cache_entry_t entry,
+                      const unsigned char *sn, size_t snlen)
+{
+  cdbi_t h1, h2, bit;
+  int i;
+
+  if (!entry->bloom)
+    return 1;
+  bloom_hashes (sn, snlen, &h1, &h2);
+  for (i=0; i < BLOOM_HASHES; i++, h1 += h2)
+    {
+      bit = h1 % entry->bloom_bits;
+      if (!(entry->bloom[bit / 8] & (1 << (bit % 8))))
+        return 0;
+    }
+  return 1;
+}
+
+
+/* Build the Bloom filter for ENTRY from the open cache file CDB.  On
+   error no filter is used.  */
+static void
+bloom_build (crl_cache_entry_t entry, struct cdb *cdb)
+{
+  struct cdb_find cdbfp;
+  unsigned char keyrecord[256];
+  unsigned long count = 0;
+  size_t nbytes;
+  cdbi_t n;
+  int rc;
+
+  rc = cdb_findinit (&cdbfp, cdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext (&cdbfp)) > 0)
+    {
+      count++;
+      rc = 0;
+    }
+  if (rc)
+    return;
+
+  if (count > BLOOM_MAX_BYTES * 8 / BLOOM_BITS_PER_ENTRY)
+    nbytes = BLOOM_MAX_BYTES;
+  else
+    nbytes = (count * BLOOM_BITS_PER_ENTRY + 7) / 8 + 1;
+  entry->bloom = xtrycalloc (1, nbytes);
+  if (!entry->bloom)
+    return;
+  entry->bloom_bits = nbytes * 8;
+
+  rc = cdb_findinit (&cdbfp, cdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext (&cdbfp)) > 0)
+    {
+      rc = 0;
+      n = cdb_keylen (cdb);
+      if (n > sizeof keyrecord
+          || cdb_read (cdb, keyrecord, n, cdb_keypos (cdb)))
+        {
+          rc = -1;
+          break;
+        }
+      bloom_add (entry, keyrecord, n);
+    }
+  if (rc)
+    {
+      /* We can't use an incomplete filter.  */
+      xfree (entry->bloom);
+      entry->bloom = NULL;
+      return;
+    }
+  memstat_alloc (MEMSTAT_CRLCACHE, nbytes);
+
+  if (opt.verbose)
+    log_info ("CRL for issuer id %s: using a %zu byte filter for %lu entries\n",
+              entry->issuer_hash, nbytes, count);
+}
+
+
 /* Open the cache file for ENTRY.  This function implements a caching
    strategy and might close unused cache files. It is required to use
    unlock_db_file after using the file. */
@@ -1170,6 +1318,9 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   entry->cdb_use_count = 1;
   entry->cdb_lru_count = 0;
 
+  if (!entry->bloom && entry->dbfile_checked)
+    bloom_build (entry, entry->cdb);
+
   return entry->cdb;
 }
 
@@ -1294,6 +1445,7 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
       log_info (_("no CRL available for issuer id %s\n"), issuer_hash );
       return CRL_CACHE_DONTKNOW;
     }
+  entry->hits++;
 
   gnupg_get_isotime (current_time);
   if (strcmp (entry->next_update, current_time) < 0 )
@@ -1334,19 +1486,35 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
       return CRL_CACHE_CANTUSE;
     }
 
-  cdb = lock_db_file (cache, entry);
-  if (!cdb)
-    return CRL_CACHE_DONTKNOW; /* Hmmm, not the best error code. */
-
-  if (!entry->dbfile_checked)
+  /* The filter is only built from a checked cache file; thus we can
+     tell that a serial number is not listed without opening the
+     file.  */
+  if (entry->bloom && !bloom_maybe_listed_p (entry, sn, snlen))
     {
-      log_error (_("cached CRL for issuer id %s tampered; we need to update\n")
-                 , issuer_hash);
-      unlock_db_file (cache, entry);
-      return CRL_CACHE_DONTKNOW;
+      cdb = NULL;
+      rc = 0;
     }
+  else
+    {
+      cdb = lock_db_file (cache, entry);
+      if (!cdb)
+        return CRL_CACHE_DONTKNOW; /* Hmmm, not the best error code. */
+
+      if (!entry->dbfile_checked)
+        {
+          log_error (_("cached CRL for issuer id %s tampered;"
+                       " we need to update\n"), issuer_hash);
+          unlock_db_file (cache, entry);
+          return CRL_CACHE_DONTKNOW;
+        }
 
-  rc = cdb_find (cdb, sn, snlen);
+      rc = cdb_find (cdb, sn, snlen);
+    }
+  if (rc == 1 && cdb_datalen (cdb) == 1)
+    {
+      /* A serial number removed from the CRL by a delta CRL.  */
+      rc = 0;
+    }
   if (rc == 1)
     {
       n = cdb_datalen (cdb);
@@ -1411,7 +1579,8 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
         }
     }
 
-  unlock_db_file (cache, entry);
+  if (cdb)
+    unlock_db_file (cache, entry);
 
   return retval;
 }
@@ -1987,7 +2156,13 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
               BUG ();
             record[0] = (reason & 0xff);
             memcpy (record+1, rdate, 15);
-            rc = cdb_make_add (cdb, p, n, record, 1+15);
+            /* The removeFromCRL reason is only used by delta CRLs
+               and tells that the certificate is not revoked anymore.
+               We mark this with a record of just one byte.  */
+            if ((reason & KSBA_CRLREASON_REMOVE_FROM_CRL))
+              rc = cdb_make_add (cdb, p, n, record, 1);
+            else
+              rc = cdb_make_add (cdb, p, n, record, 1+15);
             if (rc)
               {
                 err = gpg_error_from_errno (errno);
@@ -2187,6 +2362,212 @@ get_auth_key_id (ksba_crl_t crl, char **serialno)
 
 
 
+/* Return the BaseCRLNumber from the deltaCRLIndicator extension
+   value DER/DERLEN as an allocated hex string or NULL on error.  */
+static char *
+get_delta_base_number (const unsigned char *der, size_t derlen)
+{
+  size_t len;
+
+  if (derlen < 3 || der[0] != 0x02 /* INTEGER */)
+    return NULL;
+  len = der[1];
+  der += 2;
+  derlen -= 2;
+  if (len == 0x81 && derlen)
+    {
+      len = der[0];
+      der++;
+      derlen--;
+    }
+  else if (len >= 0x80)
+    return NULL;  /* We don't expect such long numbers.  */
+  if (!len || len > derlen)
+    return NULL;
+  return bin2hex (der, len, NULL);
+}
+
+
+/* Compare the two unsigned numbers A and B given as hex strings.
+   Returns a value less than, equal to or greater than zero.  */
+static int
+compare_hex_numbers (const char *a, const char *b)
+{
+  size_t alen, blen;
+
+  while (*a == '0')
+    a++;
+  while (*b == '0')
+    b++;
+  alen = strlen (a);
+  blen = strlen (b);
+  if (alen != blen)
+    return alen < blen? -1 : 1;
+  return ascii_strcasecmp (a, b);
+}
+
+
+/* Apply the delta CRL stored in the cache file DELTAFNAME to the
+   cached CRL BASE and store the result in a new cache file.  Its name
+   is returned at R_FNAME.  A record in the delta replaces the base
+   record with the same serial number; a record of one byte is a
+   removeFromCRL entry and drops the serial number.  */
+static gpg_error_t
+merge_delta_crl (crl_cache_t cache, crl_cache_entry_t base,
+                 const char *deltafname, char **r_fname)
+{
+  gpg_error_t err = 0;
+  struct cdb *basecdb;
+  struct cdb deltacdb;
+  struct cdb_make outcdb;
+  struct cdb_find cdbfp;
+  unsigned char keyrecord[256];
+  unsigned char record[16];
+  char *fname;
+  int fd_delta = -1;
+  int fd_out = -1;
+  int rc;
+  cdbi_t n;
+  unsigned long count = 0;
+
+  *r_fname = NULL;
+
+  fname = strconcat (deltafname, ".merge", NULL);
+  if (!fname)
+    return gpg_error_from_syserror ();
+
+  basecdb = lock_db_file (cache, base);
+  if (!basecdb)
+    {
+      xfree (fname);
+      return gpg_error (GPG_ERR_INV_CRL);
+    }
+  if (!base->dbfile_checked)
+    {
+      log_error (_("cached CRL for issuer id %s tampered; we need to update\n"),
+                 base->issuer_hash);
+      err = gpg_error (GPG_ERR_CHECKSUM);
+      goto leave;
+    }
+
+  fd_delta = gnupg_open (deltafname, O_RDONLY | O_BINARY, 0);
+  if (fd_delta == -1 || cdb_init (&deltacdb, fd_delta))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error opening cache file '%s': %s\n"),
+                 deltafname, gpg_strerror (err));
+      if (fd_delta != -1)
+        close (fd_delta);
+      fd_delta = -1;
+      goto leave;
+    }
+
+  fd_out = gnupg_open (fname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  if (fd_out == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error creating temporary cache file '%s': %s\n"),
+                 fname, gpg_strerror (err));
+      goto leave;
+    }
+  cdb_make_start (&outcdb, fd_out);
+
+  /* Copy the base records not listed in the delta.  */
+  rc = cdb_findinit (&cdbfp, basecdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext (&cdbfp)) > 0)
+    {
+      rc = 0;
+      n = cdb_keylen (basecdb);
+      if (cdb_datalen (basecdb) == 1)
+        continue;  /* Not listed.  */
+      if (n > sizeof keyrecord
+          || cdb_datalen (basecdb) != 16
+          || cdb_read (basecdb, keyrecord, n, cdb_keypos (basecdb))
+          || cdb_read (basecdb, record, 16, cdb_datapos (basecdb)))
+        {
+          rc = -1;
+          break;
+        }
+      rc = cdb_find (&deltacdb, keyrecord, n);
+      if (rc == 1)
+        rc = 0;  /* Superseded by the delta.  */
+      else if (!rc)
+        {
+          rc = cdb_make_add (&outcdb, keyrecord, n, record, 16);
+          count++;
+        }
+    }
+
+  /* Add the records of the delta.  */
+  if (!rc)
+    rc = cdb_findinit (&cdbfp, &deltacdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext (&cdbfp)) > 0)
+    {
+      rc = 0;
+      n = cdb_keylen (&deltacdb);
+      if (cdb_datalen (&deltacdb) == 1)
+        continue;  /* removeFromCRL */
+      if (n > sizeof keyrecord
+          || cdb_datalen (&deltacdb) != 16
+          || cdb_read (&deltacdb, keyrecord, n, cdb_keypos (&deltacdb))
+          || cdb_read (&deltacdb, record, 16, cdb_datapos (&deltacdb)))
+        {
+          rc = -1;
+          break;
+        }
+      rc = cdb_make_add (&outcdb, keyrecord, n, record, 16);
+      count++;
+    }
+
+  if (rc)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error merging delta CRL into cache file '%s': %s\n"),
+                 fname, gpg_strerror (err));
+      cdb_make_finish (&outcdb);
+      goto leave;
+    }
+  if (cdb_make_finish (&outcdb))
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("error finishing temporary cache file '%s': %s\n"),
+                 fname, gpg_strerror (err));
+      goto leave;
+    }
+  if (close (fd_out))
+    {
+      fd_out = -1;
+      err = gpg_error_from_syserror ();
+      log_error (_("error closing temporary cache file '%s': %s\n"),
+                 fname, gpg_strerror (err));
+      goto leave;
+    }
+  fd_out = -1;
+
+  if (opt.verbose)
+    log_info ("delta CRL applied to CRL for issuer id %s; %lu entries\n",
+              base->issuer_hash, count);
+  *r_fname = fname;
+  fname = NULL;
+
+ leave:
+  if (fd_delta != -1)
+    {
+      cdb_free (&deltacdb);
+      close (fd_delta);
+    }
+  if (fd_out != -1)
+    close (fd_out);
+  if (fname)
+    {
+      gnupg_remove (fname);
+      xfree (fname);
+    }
+  unlock_db_file (cache, base);
+  return err;
+}
+
+
 /* Insert the CRL retrieved using URL into the cache specified by
    CACHE.  The CRL itself will be read from the stream FP and is
    expected in binary format.
@@ -2224,10 +2605,13 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   const char *oid;
   int critical;
   char *trust_anchor = NULL;
+  char *delta_base = NULL;
+  char *mergedfname;
+  const unsigned char *extder;
+  size_t extderlen;
 
-  /* FIXME: We should acquire a mutex for the URL, so that we don't
-     simultaneously enter the same CRL twice.  However this needs to be
-     interweaved with the checking function.*/
+  /* Note that crl_cache_reload_crl makes sure that the same CRL is
+     not loaded twice at the same time.  */
 
   err2 = 0;
 
@@ -2323,19 +2707,6 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   fd_cdb = -1;
 
 
-  /* Create a checksum. */
-  {
-    unsigned char md5buf[16];
-
-    if (hash_dbfile (fname, md5buf))
-      {
-        err = gpg_error (GPG_ERR_CHECKSUM);
-        goto leave;
-      }
-    checksum = hexify_data (md5buf, 16, 0);
-  }
-
-
   /* Check whether that new CRL is still not expired. */
   gnupg_get_isotime (current_time);
   if (strcmp (nextupdate, current_time) < 0 )
@@ -2355,10 +2726,24 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
 
   /* Check for unknown critical extensions. */
   for (idx=0; !(err=ksba_crl_get_extension (crl, idx, &oid, &critical,
-                                              NULL, NULL)); idx++)
+                                              &extder, &extderlen)); idx++)
     {
       strlist_t sl;
 
+      if (!strcmp (oid, oidstr_deltaCRLIndicator))
+        {
+          xfree (delta_base);
+          delta_base = get_delta_base_number (extder, extderlen);
+          if (!delta_base)
+            {
+              log_error ("invalid deltaCRLIndicator in CRL\n");
+              if (!err2)
+                err2 = gpg_error (GPG_ERR_INV_CRL);
+              invalidate_crl |= INVCRL_GENERAL;
+            }
+          continue;
+        }
+
       if (!critical
           || !strcmp (oid, oidstr_authorityKeyIdentifier)
           || !strcmp (oid, oidstr_crlNumber) )
@@ -2390,6 +2775,49 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
      used as the key for the cache. */
   issuer_hash = hashify_data (issuer, strlen (issuer));
 
+  /* A delta CRL (RFC-5280 5.2.4) is applied to the cached complete
+     CRL of the same issuer with a number of at least BaseCRLNumber.  */
+  if (delta_base && !invalidate_crl && !err)
+    {
+      char *crlnumber = get_crl_number (crl);
+
+      e = find_entry (cache->entries, issuer_hash);
+      if (!e || e->invalid || !e->crl_number
+          || compare_hex_numbers (e->crl_number, delta_base) < 0)
+        {
+          log_error ("no suitable base CRL for delta CRL"
+                     " with base number %s\n", delta_base);
+          err = gpg_error (GPG_ERR_INV_CRL);
+        }
+      else if (!crlnumber || compare_hex_numbers (crlnumber,
+                                                  e->crl_number) <= 0)
+        {
+          log_info ("delta CRL number %s is not newer than cached CRL %s\n",
+                    crlnumber? crlnumber : "[none]", e->crl_number);
+          err = gpg_error (GPG_ERR_INV_CRL);
+        }
+      else
+        err = merge_delta_crl (cache, e, fname, &mergedfname);
+      xfree (crlnumber);
+      if (err)
+        goto leave;
+      gnupg_remove (fname);
+      xfree (fname);
+      fname = mergedfname;
+    }
+
+  /* Create a checksum. */
+  {
+    unsigned char md5buf[16];
+
+    if (hash_dbfile (fname, md5buf))
+      {
+        err = gpg_error (GPG_ERR_CHECKSUM);
+        goto leave;
+      }
+    checksum = hexify_data (md5buf, 16, 0);
+  }
+
   /* Create an ENTRY. */
   entry = xtrycalloc (1, sizeof *entry);
   if (!entry)
@@ -2499,6 +2927,7 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   xfree (issuer_hash);
   xfree (checksum);
   xfree (trust_anchor);
+  xfree (delta_base);
   return err ? err : err2;
 }
 
@@ -2575,6 +3004,8 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
 
       rc = 0;
       n = cdb_datalen (cdb);
+      if (n == 1)
+        continue;  /* Removed by a delta CRL.  */
       if (n != 16)
         {
           log_error (_(" WARNING: invalid cache record length\n"));
@@ -2686,6 +3117,264 @@ crl_cache_load (ctrl_t ctrl, const char *filename)
 }
 
 
+/* The URLs of the CRLs which are currently fetched and inserted.  */
+static strlist_t crl_loads_in_progress;
+
+
+/* Register URL as being loaded.  If another thread is already loading
+   the CRL from URL wait until it is done and return true; the caller
+   should then use the CRL loaded by that thread instead of fetching
+   it again.  If false is returned end_crl_load must be called.  */
+static int
+begin_crl_load (const char *url)
+{
+  int waited = 0;
+
+  while (strlist_find (crl_loads_in_progress, url))
+    {
+      if (!waited && opt.verbose)
+        log_info ("waiting for concurrent load of CRL '%s'\n", url);
+      waited = 1;
+      npth_sleep (1);
+    }
+  if (!waited)
+    add_to_strlist (&crl_loads_in_progress, url);
+  return waited;
+}
+
+
+/* Unregister URL which was registered by begin_crl_load.  */
+static void
+end_crl_load (const char *url)
+{
+  strlist_t *slp, sl;
+
+  for (slp = &crl_loads_in_progress; (sl = *slp); slp = &sl->next)
+    if (!strcmp (sl->d, url))
+      {
+        *slp = sl->next;
+        sl->next = NULL;
+        free_strlist (sl);
+        break;
+      }
+}
+
+
+/* Return true if the CRL distribution point URL uses a scheme we
+   support and which is not disabled.  */
+static int
+dp_url_usable (const char *url)
+{
+  if (!strncmp (url, "ldap:", 5) || !strncmp (url, "ldaps:", 6))
+    return !opt.ignore_ldap_dp;
+  if (!strncmp (url, "http:", 5) || !strncmp (url, "https:", 6))
+    return !opt.ignore_http_dp;
+  return 0; /* Unknown scheme.  */
+}
+
+
+/* One distribution point for fetch_dp_crls.  */
+struct dp_fetch_job_s
+{
+  const char *url;
+  ksba_reader_t reader;
+  gpg_error_t err;
+  int done;      /* The fetch has finished.  */
+  int taken;     /* The result has been processed.  */
+};
+
+/* The parameter block for fetch_dp_crls and its workers.  */
+struct dp_fetch_parm_s
+{
+  ctrl_t ctrl;
+  struct dp_fetch_job_s *jobs;
+  unsigned int njobs;
+  unsigned int next;      /* Index of the next job to start.  */
+  unsigned int nthreads;  /* Number of running workers.  */
+  int stop;               /* Do not start new jobs.  */
+  npth_mutex_t lock;
+  npth_cond_t cond;
+};
+
+
+/* Worker thread for fetch_dp_crls.  */
+static void *
+dp_fetch_worker (void *arg)
+{
+  struct dp_fetch_parm_s *parm = arg;
+  struct dp_fetch_job_s *job;
+
+  npth_mutex_lock (&parm->lock);
+  while (!parm->stop && parm->next < parm->njobs)
+    {
+      job = parm->jobs + parm->next++;
+      npth_mutex_unlock (&parm->lock);
+
+      job->err = crl_fetch (parm->ctrl, job->url, &job->reader);
+
+      npth_mutex_lock (&parm->lock);
+      job->done = 1;
+      npth_cond_broadcast (&parm->cond);
+    }
+  parm->nthreads--;
+  npth_cond_broadcast (&parm->cond);
+  npth_mutex_unlock (&parm->lock);
+  return NULL;
+}
+
+
+/* Fetch the CRL from the distribution points URLS and insert the
+   first one we get into the cache.  The downloads are started
+   concurrently so that an unreachable distribution point does not
+   delay the others; the remaining downloads are dropped as soon as
+   one CRL has been inserted.  */
+static gpg_error_t
+fetch_dp_crls (ctrl_t ctrl, strlist_t urls)
+{
+  gpg_error_t err = 0;
+  gpg_error_t last_err = 0;
+  struct dp_fetch_parm_s parm;
+  struct dp_fetch_job_s *job;
+  npth_attr_t tattr;
+  npth_t thread;
+  strlist_t sl;
+  unsigned int i, n;
+  int got_it = 0;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = ctrl;
+  for (sl = urls; sl; sl = sl->next)
+    parm.njobs++;
+  parm.jobs = xtrycalloc (parm.njobs, sizeof *parm.jobs);
+  if (!parm.jobs)
+    return gpg_error_from_syserror ();
+
+  /* If another session is already loading one of these CRLs there is
+     no need to download and process it a second time.  */
+  for (i=0, sl = urls; sl; sl = sl->next, i++)
+    {
+      if (begin_crl_load (sl->d))
+        {
+          while (i--)
+            end_crl_load (parm.jobs[i].url);
+          xfree (parm.jobs);
+          return 0;
+        }
+      parm.jobs[i].url = sl->d;
+    }
+
+  if (npth_mutex_init (&parm.lock, NULL))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (npth_cond_init (&parm.cond, NULL))
+    {
+      err = gpg_error_from_syserror ();
+      npth_mutex_destroy (&parm.lock);
+      goto leave;
+    }
+
+  n = MAX_PARALLEL_DP_FETCHES;
+  if (n > parm.njobs)
+    n = parm.njobs;
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  npth_mutex_lock (&parm.lock);
+  for (i=0; i < n; i++)
+    {
+      parm.nthreads++;
+      if (npth_create (&thread, &tattr, dp_fetch_worker, &parm))
+        {
+          parm.nthreads--;
+          break;
+        }
+    }
+  npth_mutex_unlock (&parm.lock);
+  npth_attr_destroy (&tattr);
+  if (!parm.nthreads)
+    {
+      /* No thread at all - fetch one after the other ourself.  */
+      parm.nthreads++;
+      dp_fetch_worker (&parm);
+    }
+
+  /* Process the results in the order they arrive.  */
+  for (;;)
+    {
+      npth_mutex_lock (&parm.lock);
+      for (;;)
+        {
+          for (job = NULL, i=0; i < parm.njobs; i++)
+            if (parm.jobs[i].done && !parm.jobs[i].taken)
+              {
+                job = parm.jobs + i;
+                break;
+              }
+          if (job || !parm.nthreads)
+            break;
+          npth_cond_wait (&parm.cond, &parm.lock);
+        }
+      if (job)
+        job->taken = 1;
+      npth_mutex_unlock (&parm.lock);
+      if (!job)
+        break;
+
+      if (job->err)
+        {
+          log_error (_("crl_fetch via DP failed: %s\n"),
+                     gpg_strerror (job->err));
+          last_err = job->err;
+        }
+      else if (!got_it)
+        {
+          if (opt.verbose)
+            log_info ("inserting CRL (reader %p)\n", job->reader);
+          err = crl_cache_insert (ctrl, job->url, job->reader);
+          if (err)
+            {
+              log_error (_("crl_cache_insert via DP failed: %s\n"),
+                         gpg_strerror (err));
+              last_err = err;
+            }
+          else
+            {
+              got_it = 1;
+              npth_mutex_lock (&parm.lock);
+              parm.stop = 1;
+              npth_mutex_unlock (&parm.lock);
+            }
+        }
+      crl_close_reader (job->reader);
+      job->reader = NULL;
+      end_crl_load (job->url);
+      job->url = NULL;
+    }
+
+  /* Wait for the workers to terminate.  */
+  npth_mutex_lock (&parm.lock);
+  parm.stop = 1;
+  while (parm.nthreads)
+    npth_cond_wait (&parm.cond, &parm.lock);
+  npth_mutex_unlock (&parm.lock);
+  npth_cond_destroy (&parm.cond);
+  npth_mutex_destroy (&parm.lock);
+
+  err = got_it? 0 : last_err;
+
+ leave:
+  for (i=0; i < parm.njobs; i++)
+    {
+      crl_close_reader (parm.jobs[i].reader);
+      if (parm.jobs[i].url)
+        end_crl_load (parm.jobs[i].url);
+    }
+  xfree (parm.jobs);
+  return err;
+}
+
+
 /* Locate the corresponding CRL for the certificate CERT, read and
    verify the CRL and store it in the cache.  */
 gpg_error_t
@@ -2697,12 +3386,11 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   ksba_name_t distpoint = NULL;
   ksba_name_t issuername = NULL;
   char *distpoint_uri = NULL;
-  int any_dist_point = 0;
+  strlist_t dpurls = NULL;
   int seq;
-  gpg_error_t last_err = 0;
 
-  /* Loop over all distribution points, get the CRLs and put them into
-     the cache. */
+  /* Collect the URIs of all distribution points and fetch the CRL
+     from them.  */
   if (opt.verbose)
     log_info ("checking distribution points\n");
   seq = 0;
@@ -2728,91 +3416,49 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
         {
           xfree (distpoint_uri);
           distpoint_uri = ksba_name_get_uri (distpoint, name_seq);
-          if (!distpoint_uri)
+          if (!distpoint_uri || !dp_url_usable (distpoint_uri))
             continue;
-
-          if (!strncmp (distpoint_uri, "ldap:", 5)
-              || !strncmp (distpoint_uri, "ldaps:", 6))
-            {
-              if (opt.ignore_ldap_dp)
-                continue;
-            }
-          else if (!strncmp (distpoint_uri, "http:", 5)
-                   || !strncmp (distpoint_uri, "https:", 6))
-            {
-              if (opt.ignore_http_dp)
-                continue;
-            }
-          else
-            continue; /* Skip unknown schemes. */
-
-          any_dist_point = 1;
-
-          crl_close_reader (reader);
-          err = crl_fetch (ctrl, distpoint_uri, &reader);
-          if (err)
-            {
-              log_error (_("crl_fetch via DP failed: %s\n"),
-                         gpg_strerror (err));
-              last_err = err;
-              continue; /* with the next name. */
-            }
-
-          if (opt.verbose)
-            log_info ("inserting CRL (reader %p)\n", reader);
-          err = crl_cache_insert (ctrl, distpoint_uri, reader);
-          if (err)
-            {
-              log_error (_("crl_cache_insert via DP failed: %s\n"),
-                         gpg_strerror (err));
-              last_err = err;
-              continue; /* with the next name. */
-            }
-          goto leave; /* Ready - we got the CRL. */
+          if (!strlist_find (dpurls, distpoint_uri))
+            append_to_strlist (&dpurls, distpoint_uri);
         }
     }
   if (gpg_err_code (err) == GPG_ERR_EOF)
     err = 0;
-  if (!err && last_err)
+  if (dpurls)
     {
-      err = last_err;
+      err = fetch_dp_crls (ctrl, dpurls);
       goto leave;
     }
 
   /* If we did not found any distpoint, try something reasonable. */
-  if (!any_dist_point )
-    {
-      if (opt.verbose)
-        log_info ("no distribution point - trying issuer name\n");
+  if (opt.verbose)
+    log_info ("no distribution point - trying issuer name\n");
 
-      issuer = ksba_cert_get_issuer (cert, 0);
-      if (!issuer)
-        {
-          log_error ("oops: issuer missing in certificate\n");
-          err = gpg_error (GPG_ERR_INV_CERT_OBJ);
-          goto leave;
-        }
+  issuer = ksba_cert_get_issuer (cert, 0);
+  if (!issuer)
+    {
+      log_error ("oops: issuer missing in certificate\n");
+      err = gpg_error (GPG_ERR_INV_CERT_OBJ);
+      goto leave;
+    }
 
-      if (opt.verbose)
-        log_info ("fetching CRL from default location\n");
-      crl_close_reader (reader);
-      err = crl_fetch_default (ctrl, issuer, &reader);
-      if (err)
-          {
-            log_error ("crl_fetch via issuer failed: %s\n",
-                       gpg_strerror (err));
-            goto leave;
-          }
+  if (opt.verbose)
+    log_info ("fetching CRL from default location\n");
+  err = crl_fetch_default (ctrl, issuer, &reader);
+  if (err)
+    {
+      log_error ("crl_fetch via issuer failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
 
-      if (opt.verbose)
-        log_info ("inserting CRL (reader %p)\n", reader);
-      err = crl_cache_insert (ctrl, "default location(s)", reader);
-      if (err)
-        {
-          log_error (_("crl_cache_insert via issuer failed: %s\n"),
-                     gpg_strerror (err));
-          goto leave;
-        }
+  if (opt.verbose)
+    log_info ("inserting CRL (reader %p)\n", reader);
+  err = crl_cache_insert (ctrl, "default location(s)", reader);
+  if (err)
+    {
+      log_error (_("crl_cache_insert via issuer failed: %s\n"),
+                 gpg_strerror (err));
+      goto leave;
     }
 
  leave:
@@ -2821,5 +3467,76 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   ksba_name_release (distpoint);
   ksba_name_release (issuername);
   ksba_free (issuer);
+  free_strlist (dpurls);
   return err;
 }
+
+
+/* Refresh the cached CRLs which have been used since they were loaded
+   and whose nextUpdate is near.  This is called by the housekeeping
+   thread so that a validation rarely needs to wait for a CRL
+   download.  The old CRL is used until the new one has been
+   inserted.  */
+void
+crl_cache_housekeeping (ctrl_t ctrl)
+{
+  crl_cache_t cache = current_cache;
+  crl_cache_entry_t e;
+  strlist_t urls = NULL;
+  strlist_t sl;
+  time_t now, this_update, next_update, last_refresh, window;
+  ksba_reader_t reader;
+  gpg_error_t err;
+
+  if (!cache)
+    return;
+
+  /* First collect the URLs because inserting a CRL changes the list
+     of entries.  */
+  now = gnupg_get_time ();
+  for (e = cache->entries; e; e = e->next)
+    {
+      if (e->deleted || e->invalid || !e->hits || !dp_url_usable (e->url))
+        continue;
+      if (e->last_prefetch && e->last_prefetch + CRL_PREFETCH_RETRY > now)
+        continue;
+      last_refresh = isotime2epoch (e->last_refresh);
+      if (last_refresh != (time_t)(-1)
+          && last_refresh + CRL_PREFETCH_RETRY > now)
+        continue;
+      next_update = isotime2epoch (e->next_update);
+      if (next_update == (time_t)(-1))
+        continue;
+      this_update = isotime2epoch (e->this_update);
+      window = CRL_PREFETCH_WINDOW;
+      if (this_update != (time_t)(-1) && this_update < next_update
+          && (next_update - this_update) / 4 < window)
+        window = (next_update - this_update) / 4;
+      if (next_update - window > now)
+        continue;
+
+      e->last_prefetch = now;
+      if (!strlist_find (urls, e->url))
+        add_to_strlist (&urls, e->url);
+    }
+
+  for (sl = urls; sl; sl = sl->next)
+    {
+      if (begin_crl_load (sl->d))
+        continue;  /* Another session has just loaded it.  */
+      if (opt.verbose)
+        log_info ("refreshing CRL from '%s'\n", sl->d);
+      err = crl_fetch (ctrl, sl->d, &reader);
+      if (!err)
+        {
+          err = crl_cache_insert (ctrl, sl->d, reader);
+          crl_close_reader (reader);
+        }
+      end_crl_load (sl->d);
+      if (err)
+        log_info ("refreshing CRL from '%s' failed: %s\n",
+                  sl->d, gpg_strerror (err));
+    }
+
+  free_strlist (urls);
+}
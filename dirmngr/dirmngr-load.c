@@ -0,0 +1,596 @@
+/* dirmngr-load.c - Replay a workload against a running dirmngr
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This tool sends the Assuan commands of a workload file to the
+ * dirmngr over several connections in parallel and reports the
+ * latency of the commands for each engine.  The workload file has
+ * one command per line, for example
+ *
+ *   KS_GET -- 0x5B0E9E3CDA8C9C5A
+ *   WKD_GET -- alice@example.org
+ *   ISVALID --only-ocsp 8E7EB4E1.../31 ...
+ *
+ * Empty lines and lines starting with '#' are ignored.  A log of a
+ * dirmngr running with "--debug ipc" may be used directly; only the
+ * commands received by the dirmngr ("<- " lines) are taken from it.
+ * Commands changing the state of a connection (OPTION, RESET, BYE)
+ * and data lines are skipped.  Inquiries by the dirmngr, for example
+ * for certificates, are answered with empty data.
+ *
+ * The connection and DNS counts are the differences of the metrics
+ * of the dirmngr before and after the run and thus include the
+ * requests of other clients.  It is built on request:
+ *
+ *   make -C dirmngr dirmngr-load
+ *   dirmngr/dirmngr-load --concurrency 16 workload.txt
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <npth.h>
+
+#include <gpg-error.h>
+#include <assuan.h>
+
+#include "../common/logging.h"
+#include "../common/stringhelp.h"
+#include "../common/asshelp.h"
+#include "../common/i18n.h"
+#include "../common/util.h"
+#include "../common/membuf.h"
+#include "../common/init.h"
+
+
+/* Constants for the options.  */
+enum
+  {
+    oQuiet	  = 'q',
+    oVerbose	  = 'v',
+    oConcurrency  = 'j',
+
+    oRepeat       = 500
+  };
+
+
+/* The list of options as used by the argparse.c code.  */
+static gpgrt_opt_t opts[] = {
+  { oVerbose,  "verbose",   0, N_("verbose") },
+  { oQuiet,    "quiet",     0, N_("be somewhat more quiet") },
+  { oConcurrency, "concurrency", 1, N_("|N|use N connections in parallel")},
+  { oRepeat,   "repeat",    1, N_("|N|replay the workload N times")},
+  ARGPARSE_end ()
+};
+
+
+/* The usual structure for the program flags.  */
+static struct
+{
+  int quiet;
+  int verbose;
+  unsigned int concurrency;
+  unsigned int repeat;
+} opt;
+
+
+/* The engines for which the latencies are reported.  */
+enum engine_e
+  {
+    ENGINE_KS,
+    ENGINE_WKD,
+    ENGINE_OCSP,
+    ENGINE_CRL,
+    ENGINE_LDAP,
+    ENGINE_DNS,
+    ENGINE_OTHER,
+    N_ENGINES
+  };
+
+static const char *engine_names[N_ENGINES] =
+  { "ks", "wkd", "ocsp", "crl", "ldap", "dns", "other" };
+
+
+/* The results for one engine.  */
+struct engine_stat_s
+{
+  unsigned int count;
+  unsigned int errors;
+  unsigned long long bytes;
+  unsigned long long *durations;  /* Microseconds of each command.  */
+};
+
+
+/* A command of the workload.  */
+struct command_s
+{
+  enum engine_e engine;
+  char *line;
+};
+
+
+/* The workload and the results.  Worker threads access them only
+ * while holding the nPth lock and thus need no extra locking.  */
+static struct command_s *commands;
+static unsigned int ncommands;
+static unsigned int next_command;
+static struct engine_stat_s engines[N_ENGINES];
+
+
+/* The metrics of the dirmngr used for the report.  */
+enum snapshot_e
+  {
+    SNAP_CONNECTS,
+    SNAP_REUSED,
+    SNAP_DNS_QUERIES,
+    SNAP_DNS_TIME,
+    SNAP_CONNECTIONS,
+    N_SNAPS
+  };
+
+static const char *snapshot_names[N_SNAPS] =
+  {
+    "lcr_dirmngr_http_connects_total",
+    "lcr_dirmngr_http_reused_connections_total",
+    "lcr_dirmngr_dns_queries_total",
+    "lcr_dirmngr_dns_query_microseconds_total",
+    "lcr_dirmngr_connections"
+  };
+
+
+
+/* Function called by argparse.c to display information.  */
+static const char *
+my_strusage (int level)
+{
+  const char *p;
+
+  switch(level)
+    {
+    case  9: p = "GPL-3.0-or-later"; break;
+    case 11: p = "dirmngr-load (@GNUPG@)";
+      break;
+    case 13: p = VERSION; break;
+    case 14: p = GNUPG_DEF_COPYRIGHT_LINE; break;
+    case 17: p = PRINTABLE_OS_NAME; break;
+    case 19: p = _("Please report bugs to <@EMAIL@>.\n"); break;
+    case 49: p = PACKAGE_BUGREPORT; break;
+    case 1:
+    case 40: p =
+                 _("Usage: dirmngr-load [options] [workload] (-h for help)\n");
+      break;
+    case 41: p =
+          _("Syntax: dirmngr-load [options] [workload]\n"
+            "Replay a workload against a running dirmngr\n");
+      break;
+
+    default: p = NULL;
+    }
+  return p;
+}
+
+
+/* Return a monotonic time in microseconds.  */
+static unsigned long long
+now_us (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  return (unsigned long long)gnupg_get_time () * 1000000;
+}
+
+
+/* Return the engine used by the command LINE.  */
+static enum engine_e
+classify_command (const char *line)
+{
+  size_t n = strcspn (line, " \t");
+
+  if (n > 3 && !ascii_strncasecmp (line, "KS_", 3))
+    return ENGINE_KS;
+  if (n == 7 && !ascii_strncasecmp (line, "WKD_GET", 7))
+    return ENGINE_WKD;
+  if (n == 9 && !ascii_strncasecmp (line, "CHECKOCSP", 9))
+    return ENGINE_OCSP;
+  if (n == 7 && !ascii_strncasecmp (line, "ISVALID", 7))
+    return strstr (line, "--only-ocsp")? ENGINE_OCSP : ENGINE_CRL;
+  if ((n == 8 && !ascii_strncasecmp (line, "CHECKCRL", 8))
+      || (n == 7 && !ascii_strncasecmp (line, "LOADCRL", 7))
+      || (n == 8 && !ascii_strncasecmp (line, "LISTCRLS", 8)))
+    return ENGINE_CRL;
+  if (n == 6 && !ascii_strncasecmp (line, "LOOKUP", 6))
+    return ENGINE_LDAP;
+  if (n == 8 && !ascii_strncasecmp (line, "DNS_CERT", 8))
+    return ENGINE_DNS;
+  return ENGINE_OTHER;
+}
+
+
+/* Return true if LINE shall not be replayed.  */
+static int
+skip_command (const char *line)
+{
+  static const char *const skipped[] =
+    { "OPTION", "RESET", "BYE", "END", "CAN", "D", "OK", "ERR", "S",
+      "INQUIRE", "GETINFO", "NOP", NULL };
+  size_t n = strcspn (line, " \t");
+  int i;
+
+  for (i = 0; skipped[i]; i++)
+    if (n == strlen (skipped[i]) && !ascii_strncasecmp (line, skipped[i], n))
+      return 1;
+  return 0;
+}
+
+
+/* Read the workload from the file FNAME or stdin if FNAME is NULL.  */
+static gpg_error_t
+read_workload (const char *fname)
+{
+  gpg_error_t err = 0;
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  const char *s, *p;
+  size_t allocated = 0;
+  ssize_t n;
+
+  fp = fname? es_fopen (fname, "r") : es_stdin;
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  while ((n = es_read_line (fp, &line, &linelen, NULL)) > 0)
+    {
+      trim_spaces (line);
+      s = line;
+      if ((p = strstr (s, " <- ")))
+        s = p + 4;
+      if (!*s || *s == '#' || skip_command (s))
+        continue;
+      if (ncommands == allocated)
+        {
+          struct command_s *tmp;
+
+          allocated = allocated? allocated * 2 : 256;
+          tmp = xtryrealloc (commands, allocated * sizeof *commands);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          commands = tmp;
+        }
+      commands[ncommands].engine = classify_command (s);
+      commands[ncommands].line = xtrystrdup (s);
+      if (!commands[ncommands].line)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      ncommands++;
+    }
+  if (!err && n < 0)
+    err = gpg_error_from_syserror ();
+  es_free (line);
+  if (fp != es_stdin)
+    es_fclose (fp);
+  return err;
+}
+
+
+/* Data callback for the replayed commands.  */
+static gpg_error_t
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  *(unsigned long long *)opaque += length;
+  (void)buffer;
+  return 0;
+}
+
+
+/* Inquire callback for the replayed commands.  We have no data for
+ * the inquiries and thus return empty data.  */
+static gpg_error_t
+inq_cb (void *opaque, const char *line)
+{
+  (void)opaque;
+  if (opt.verbose > 1)
+    log_info ("inquiry '%s' answered with empty data\n", line);
+  return 0;
+}
+
+
+/* Record the result of a command.  */
+static void
+record_result (enum engine_e engine, gpg_error_t err,
+               unsigned long long duration, unsigned long long bytes)
+{
+  struct engine_stat_s *e = engines + engine;
+
+  e->durations[e->count++] = duration;
+  if (err)
+    e->errors++;
+  e->bytes += bytes;
+}
+
+
+/* The worker thread.  ARG is the Assuan context of the
+ * connection.  */
+static void *
+worker_thread (void *arg)
+{
+  assuan_context_t ctx = arg;
+  struct command_s *cmd;
+  unsigned long long start, duration, bytes;
+  gpg_error_t err;
+
+  while (next_command < ncommands * opt.repeat)
+    {
+      cmd = commands + (next_command++ % ncommands);
+      bytes = 0;
+      start = now_us ();
+      err = assuan_transact (ctx, cmd->line, data_cb, &bytes,
+                             inq_cb, NULL, NULL, NULL);
+      duration = now_us () - start;
+      if (err && opt.verbose)
+        log_info ("'%s' failed: %s\n", cmd->line, gpg_strerror (err));
+      record_result (cmd->engine, err, duration, bytes);
+    }
+  return NULL;
+}
+
+
+/* Store the values of the metrics of the dirmngr at VALUES.  Metrics
+ * not known by the dirmngr are stored as 0.  */
+static gpg_error_t
+take_snapshot (assuan_context_t ctx, unsigned long long *values)
+{
+  gpg_error_t err;
+  membuf_t mb;
+  char *buf, *line, *next;
+  size_t n;
+  int i;
+
+  init_membuf (&mb, 4096);
+  err = assuan_transact (ctx, "GETINFO metrics", put_membuf_cb, &mb,
+                         NULL, NULL, NULL, NULL);
+  if (err)
+    {
+      xfree (get_membuf (&mb, NULL));
+      return err;
+    }
+  put_membuf (&mb, "", 1);
+  buf = get_membuf (&mb, NULL);
+  if (!buf)
+    return gpg_error_from_syserror ();
+
+  memset (values, 0, N_SNAPS * sizeof *values);
+  for (line = buf; line; line = next)
+    {
+      if ((next = strchr (line, '\n')))
+        *next++ = 0;
+      for (i = 0; i < N_SNAPS; i++)
+        {
+          n = strlen (snapshot_names[i]);
+          if (!strncmp (line, snapshot_names[i], n) && line[n] == ' ')
+            values[i] = strtoull (line + n + 1, NULL, 10);
+        }
+    }
+  xfree (buf);
+  return 0;
+}
+
+
+static int
+cmp_duration (const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Return the milliseconds of the percentile PCT of the sorted
+ * durations of E.  */
+static double
+percentile (struct engine_stat_s *e, unsigned int pct)
+{
+  unsigned int idx = (unsigned int)(((unsigned long long)e->count * pct
+                                     + 99) / 100);
+
+  return e->durations[idx? idx - 1 : 0] / 1000.0;
+}
+
+
+/* Print the report.  AFTER is NULL if the metrics of the dirmngr are
+ * not available.  */
+static void
+print_report (unsigned long long elapsed, unsigned long long *before,
+              unsigned long long *after)
+{
+  struct engine_stat_s *e;
+  unsigned int total = 0;
+  int i;
+
+  es_printf ("%-6s %8s %7s %10s %9s %9s %9s %9s %9s\n",
+             "engine", "count", "errors", "bytes",
+             "min_ms", "p50_ms", "p90_ms", "p99_ms", "max_ms");
+  for (i = 0; i < N_ENGINES; i++)
+    {
+      e = engines + i;
+      if (!e->count)
+        continue;
+      total += e->count;
+      qsort (e->durations, e->count, sizeof *e->durations, cmp_duration);
+      es_printf ("%-6s %8u %7u %10llu %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                 engine_names[i], e->count, e->errors, e->bytes,
+                 e->durations[0] / 1000.0,
+                 percentile (e, 50), percentile (e, 90), percentile (e, 99),
+                 e->durations[e->count - 1] / 1000.0);
+    }
+  es_printf ("total: %u commands over %u connections in %.3f s"
+             " (%.1f/s)\n", total, opt.concurrency, elapsed / 1e6,
+             elapsed? total * 1e6 / elapsed : 0.0);
+  if (!after)
+    {
+      es_printf ("dirmngr: metrics not available\n");
+      return;
+    }
+  es_printf ("dirmngr: connections=%llu http_connects=%llu"
+             " http_reused=%llu dns_queries=%llu dns_ms=%.3f\n",
+             after[SNAP_CONNECTIONS],
+             after[SNAP_CONNECTS] - before[SNAP_CONNECTS],
+             after[SNAP_REUSED] - before[SNAP_REUSED],
+             after[SNAP_DNS_QUERIES] - before[SNAP_DNS_QUERIES],
+             (after[SNAP_DNS_TIME] - before[SNAP_DNS_TIME]) / 1000.0);
+}
+
+
+int
+main (int argc, char **argv )
+{
+  gpgrt_argparse_t pargs;
+  gpg_error_t err;
+  assuan_context_t ctx;
+  assuan_context_t *conns;
+  npth_t *threads;
+  npth_attr_t tattr;
+  unsigned long long before[N_SNAPS], after[N_SNAPS];
+  unsigned long long start, elapsed;
+  unsigned int i, nconns;
+  int have_metrics;
+
+  early_system_init ();
+  gpgrt_set_strusage (my_strusage);
+  log_set_prefix ("dirmngr-load", GPGRT_LOG_WITH_PREFIX);
+  gpgrt_set_fixed_string_mapper (map_static_macro_string);
+
+  assuan_set_assuan_log_prefix (log_get_prefix (NULL));
+  assuan_set_gpg_err_source (GPG_ERR_SOURCE_DEFAULT);
+
+  i18n_init();
+
+  opt.concurrency = 4;
+  opt.repeat = 1;
+
+  pargs.argc = &argc;
+  pargs.argv = &argv;
+  pargs.flags= ARGPARSE_FLAG_KEEP;
+  while (gpgrt_argparse (NULL, &pargs, opts))
+    {
+      switch (pargs.r_opt)
+        {
+        case oVerbose: opt.verbose++; break;
+        case oQuiet: opt.quiet++; break;
+        case oConcurrency: opt.concurrency = pargs.r.ret_int; break;
+        case oRepeat: opt.repeat = pargs.r.ret_int; break;
+
+        default : pargs.err = ARGPARSE_PRINT_ERROR; break;
+	}
+    }
+  gpgrt_argparse (NULL, &pargs, NULL);
+
+  if (log_get_errorcount (0))
+    exit (2);
+  if (argc > 1 || opt.concurrency < 1 || opt.concurrency > 1024
+      || opt.repeat < 1)
+    gpgrt_usage (1);
+
+  err = read_workload (argc? *argv : NULL);
+  if (err)
+    {
+      log_error ("error reading the workload: %s\n", gpg_strerror (err));
+      exit (2);
+    }
+  if (!ncommands)
+    {
+      log_error ("no commands in the workload\n");
+      exit (2);
+    }
+  for (i = 0; i < N_ENGINES; i++)
+    engines[i].durations = xcalloc (ncommands * opt.repeat,
+                                    sizeof *engines[i].durations);
+
+  npth_init ();
+  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+
+  /* The first connection also takes the snapshots of the metrics.  */
+  conns = xcalloc (opt.concurrency, sizeof *conns);
+  threads = xcalloc (opt.concurrency, sizeof *threads);
+  for (nconns = 0; nconns < opt.concurrency; nconns++)
+    {
+      err = start_new_dirmngr (conns + nconns, GPG_ERR_SOURCE_DEFAULT,
+                               gnupg_module_name (GNUPG_MODULE_NAME_DIRMNGR),
+                               nconns? 0 : ASSHELP_FLAG_AUTOSTART,
+                               opt.verbose, 0, NULL, NULL);
+      if (err)
+        {
+          log_error (_("can't connect to the dirmngr: %s\n"),
+                     gpg_strerror (err));
+          exit (2);
+        }
+    }
+  ctx = conns[0];
+
+  err = take_snapshot (ctx, before);
+  if (err)
+    log_info ("error reading the metrics of the dirmngr: %s\n",
+              gpg_strerror (err));
+  have_metrics = !err;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  start = now_us ();
+  for (i = 0; i < nconns; i++)
+    {
+      err = gpg_error (npth_create (threads + i, &tattr,
+                                    worker_thread, conns[i]));
+      if (err)
+        log_fatal ("error creating a thread: %s\n", gpg_strerror (err));
+    }
+  for (i = 0; i < nconns; i++)
+    npth_join (threads[i], NULL);
+  elapsed = now_us () - start;
+  npth_attr_destroy (&tattr);
+
+  if (have_metrics && take_snapshot (ctx, after))
+    have_metrics = 0;
+  for (i = 0; i < nconns; i++)
+    assuan_release (conns[i]);
+  xfree (conns);
+  xfree (threads);
+
+  print_report (elapsed, before, have_metrics? after : NULL);
+
+  for (i = 0; i < N_ENGINES; i++)
+    xfree (engines[i].durations);
+  for (i = 0; i < ncommands; i++)
+    xfree (commands[i].line);
+  xfree (commands);
+  return 0;
+}
@@ -63,6 +63,7 @@
 #include "certcache.h"
 #include "crlcache.h"
 #include "crlfetch.h"
+#include "ocsp.h"
 #include "misc.h"
 #if USE_LDAP
 # include "ldapserver.h"
@@ -73,6 +74,9 @@
 #endif
 #include "../common/comopt.h"
 #include "../common/init.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
+#include "../common/thread-pool.h"
 #include "../common/gc-opt-flags.h"
 #include "dns-stuff.h"
 #include "http-common.h"
@@ -126,6 +130,7 @@ enum cmd_and_opt_values {
   oHTTPProxy,
   oLDAPProxy,
   oOnlyLDAPProxy,
+  oLDAPUseWrapper,
   oLDAPServer,
   oLDAPFile,
   oLDAPTimeout,
@@ -151,6 +156,8 @@ enum cmd_and_opt_values {
   oUseTor,
   oNoUseTor,
   oKeyServer,
+  oKeyServerParallel,
+  oMaxCertCacheSize,
   oNameServer,
   oDisableCheckOwnSocket,
   oStandardResolver,
@@ -221,6 +228,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
   ARGPARSE_s_i (oMaxReplies, "max-replies",
                 N_("|N|do not return more than N items in one query")),
+  ARGPARSE_s_u (oMaxCertCacheSize, "max-cert-cache-size", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oIgnoreCert,"ignore-cert", "@"),
@@ -257,6 +265,7 @@ static gpgrt_opt_t opts[] = {
 
   ARGPARSE_s_s (oKeyServer, "keyserver",
                 N_("|URL|use keyserver at URL")),
+  ARGPARSE_s_i (oKeyServerParallel, "keyserver-parallel", "@"),
   ARGPARSE_s_s (oHkpCaCert, "hkp-cacert",
                 N_("|FILE|use the CA certificates in FILE for HKP over TLS")),
 
@@ -269,6 +278,7 @@ static gpgrt_opt_t opts[] = {
                 N_("|HOST|use HOST for LDAP queries")),
   ARGPARSE_s_n (oOnlyLDAPProxy, "only-ldap-proxy",
                 N_("do not use fallback hosts with --ldap-proxy")),
+  ARGPARSE_s_n (oLDAPUseWrapper, "ldap-use-wrapper", "@"),
   ARGPARSE_s_s (oLDAPServer, "ldapserver",
                 N_("|SPEC|use this keyserver to lookup keys")),
   ARGPARSE_s_s (oLDAPFile, "ldapserverlist-file",
@@ -343,6 +353,9 @@ static struct compatibility_flags_s compatibility_flags [] =
 
 #define DEFAULT_MAX_REPLIES 10
 #define DEFAULT_LDAP_TIMEOUT 15  /* seconds */
+#define DEFAULT_KEYSERVER_PARALLEL 4
+#define MAX_KEYSERVER_PARALLEL    16
+#define DEFAULT_MAX_CERT_CACHE_SIZE 4096  /* KiB */
 
 #define DEFAULT_CONNECT_TIMEOUT       (15*1000)  /* 15 seconds */
 #define DEFAULT_CONNECT_QUICK_TIMEOUT ( 2*1000)  /*  2 seconds */
@@ -685,6 +698,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.http_proxy = NULL;
       opt.ldap_proxy = NULL;
       opt.only_ldap_proxy = 0;
+      opt.ldap_use_wrapper = 0;
       opt.ignore_http_dp = 0;
       opt.ignore_ldap_dp = 0;
       opt.ignore_ocsp_service_url = 0;
@@ -695,6 +709,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.ocsp_max_period = 90 * 86400;       /* 90 days.  */
       opt.ocsp_current_period = 3 * 60 * 60;  /* 3 hours. */
       opt.max_replies = DEFAULT_MAX_REPLIES;
+      opt.max_cert_cache_size = DEFAULT_MAX_CERT_CACHE_SIZE;
       while (opt.ocsp_signer)
         {
           fingerprint_list_t tmp = opt.ocsp_signer->next;
@@ -721,6 +736,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.connect_timeout = 0;
       opt.connect_quick_timeout = 0;
       opt.ldaptimeout = DEFAULT_LDAP_TIMEOUT;
+      opt.keyserver_parallel = DEFAULT_KEYSERVER_PARALLEL;
       ldapserver_list_needs_reset = 1;
       opt.debug_cache_expired_certs = 0;
       xfree (opt.fake_crl);
@@ -769,6 +785,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
     case oHTTPProxy: opt.http_proxy = pargs->r.ret_str; break;
     case oLDAPProxy: opt.ldap_proxy = pargs->r.ret_str; break;
     case oOnlyLDAPProxy: opt.only_ldap_proxy = 1; break;
+    case oLDAPUseWrapper: opt.ldap_use_wrapper = 1; break;
     case oIgnoreHTTPDP: opt.ignore_http_dp = 1; break;
     case oIgnoreLDAPDP: opt.ignore_ldap_dp = 1; break;
     case oIgnoreOCSPSvcUrl: opt.ignore_ocsp_service_url = 1; break;
@@ -785,6 +802,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
     case oOCSPCurrentPeriod: opt.ocsp_current_period = pargs->r.ret_int; break;
 
     case oMaxReplies: opt.max_replies = pargs->r.ret_int; break;
+    case oMaxCertCacheSize: opt.max_cert_cache_size = pargs->r.ret_ulong; break;
 
     case oHkpCaCert:
       {
@@ -868,6 +886,14 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
         add_to_strlist (&opt.keyserver, pargs->r.ret_str);
       break;
 
+    case oKeyServerParallel:
+      opt.keyserver_parallel = pargs->r.ret_int;
+      if (opt.keyserver_parallel < 1)
+        opt.keyserver_parallel = 1;
+      else if (opt.keyserver_parallel > MAX_KEYSERVER_PARALLEL)
+        opt.keyserver_parallel = MAX_KEYSERVER_PARALLEL;
+      break;
+
     case oNameServer:
       set_dns_nameserver (pargs->r.ret_str);
       break;
@@ -976,11 +1002,30 @@ my_ntbtls_log_handler (void *opaque, int level, const char *fmt, va_list argv)
 #endif
 
 
+static unsigned long long
+metric_connections (void)
+{
+  return active_connections;
+}
+
+
+/* The post system call clamp.  This also accounts the time spent
+ * waiting for the nPth lock.  */
+static void
+post_syscall (void)
+{
+  unsigned long long start = metrics_clock ();
+
+  npth_protect ();
+  metrics_lock_wait (start);
+}
+
+
 static void
 thread_init (void)
 {
   npth_init ();
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  gpgrt_set_syscall_clamp (npth_unprotect, post_syscall);
 
   /* Now with NPth running we can set the logging callback.  Our
      windows implementation does not yet feature the NPth TLS
@@ -990,6 +1035,13 @@ thread_init (void)
     if (npth_setspecific (my_tlskey_current_fd, NULL) == 0)
       log_set_pid_suffix_cb (pid_suffix_callback);
 #endif /*!HAVE_W32_SYSTEM*/
+
+  metrics_init ("lcr_dirmngr");
+  metrics_fnc ("connections", METRIC_GAUGE,
+               "Number of active connections.", metric_connections);
+  cert_cache_register_metrics ();
+  dns_stuff_register_metrics ();
+  http_register_metrics ();
 }
 
 
@@ -1693,6 +1745,7 @@ cleanup (void)
   crl_cache_deinit ();
   cert_cache_deinit (1);
   reload_dns_stuff (1);
+  domaininfo_save ();
 
 #if USE_LDAP
   ldapserver_list_free (opt.ldapservers);
@@ -1714,6 +1767,8 @@ void
 dirmngr_exit (int rc)
 {
   cleanup ();
+  if (opt.debug & DBG_MEMSTAT_VALUE)
+    memstat_dump ();
   exit (rc);
 }
 
@@ -2046,9 +2101,13 @@ dirmngr_sighup_action (void)
   crl_cache_deinit ();
   cert_cache_init (hkp_cacert_filenames);
   crl_cache_init ();
+  ocsp_cache_flush ();
   http_reinitialize ();
   reload_dns_stuff (0);
   ks_hkp_reload ();
+#if USE_LDAP
+  ks_ldap_reload ();
+#endif
 }
 
 
@@ -2139,6 +2198,12 @@ housekeeping_thread (void *arg)
 
   dns_stuff_housekeeping ();
   ks_hkp_housekeeping (curtime);
+#if USE_LDAP
+  ks_ldap_housekeeping ();
+#endif
+  ocsp_cache_housekeeping (&ctrlbuf);
+  crl_cache_housekeeping (&ctrlbuf);
+  domaininfo_save ();
   if (network_activity_seen)
     {
       network_activity_seen = 0;
@@ -2488,24 +2553,18 @@ handle_connections (assuan_fd_t listen_fd)
 	    }
           else
             {
-              char threadname[50];
               union int_and_ptr_u argval;
-	      npth_t thread;
 
               memset (&argval, 0, sizeof argval);
               argval.afd = fd;
-              snprintf (threadname, sizeof threadname,
-                        "conn fd=%d", FD_DBG (fd));
-
-              ret = npth_create (&thread, &tattr,
-                                 start_connection_thread, argval.aptr);
+              ret = thread_pool_run (&tattr, start_connection_thread,
+                                     argval.aptr);
 	      if (ret)
                 {
                   log_error ("error spawning connection handler: %s\n",
                              strerror (ret) );
                   assuan_sock_close (fd);
                 }
-	      npth_setname_np (thread, threadname);
             }
 	}
     }
@@ -110,6 +110,8 @@ struct
   unsigned int connect_timeout;       /* Timeout for connect.  */
   unsigned int connect_quick_timeout; /* Shorter timeout for connect.  */
 
+  int keyserver_parallel; /* Max. number of concurrent key requests.  */
+
   int disable_http;       /* Do not use HTTP at all.  */
   int disable_ldap;       /* Do not use LDAP at all.  */
   int disable_ipv4;       /* Do not use legacy IP addresses.  */
@@ -118,6 +120,7 @@ struct
   const char *http_proxy; /* The default HTTP proxy.  */
   const char *ldap_proxy; /* Use given LDAP proxy.  */
   int only_ldap_proxy;    /* Only use the LDAP proxy; no fallback.  */
+  int ldap_use_wrapper;   /* Use the wrapper process for cert lookups.  */
   int ignore_http_dp;     /* Ignore HTTP CRL distribution points.  */
   int ignore_ldap_dp;     /* Ignore LDAP CRL distribution points.  */
   int ignore_ocsp_service_url; /* Ignore OCSP service URLs as given in
@@ -143,6 +146,7 @@ struct
   int allow_ocsp;     /* Allow using OCSP. */
 
   int max_replies;
+  unsigned int max_cert_cache_size; /* In KiB; for non-permanent certs.  */
   unsigned int ldaptimeout;
 
   ldap_server_t ldapservers;
@@ -263,6 +267,8 @@ int dirmngr_never_use_tor_p (void);
 void ks_hkp_housekeeping (time_t curtime);
 void ks_hkp_reload (void);
 void ks_hkp_init (void);
+void ks_ldap_housekeeping (void);
+void ks_ldap_reload (void);
 
 /*-- server.c --*/
 void release_uri_item_list (uri_item_t list);
@@ -294,6 +300,7 @@ gpg_error_t dirmngr_load_swdb (ctrl_t ctrl, int force);
 
 /*-- domaininfo.c --*/
 void domaininfo_print_stats (ctrl_t ctrl);
+void domaininfo_save (void);
 int  domaininfo_is_wkd_not_supported (const char *domain);
 void domaininfo_set_no_name (const char *domain);
 void domaininfo_set_wkd_supported (const char *domain);
@@ -303,9 +310,15 @@ void domaininfo_set_wkd_not_found (const char *domain);
 /*-- workqueue.c --*/
 typedef const char *(*wqtask_t)(ctrl_t ctrl, const char *args);
 
+/* Priorities for workqueue tasks; lower values run first.  */
+#define WQ_PRIO_HIGH    0
+#define WQ_PRIO_NORMAL  1
+#define WQ_PRIO_LOW     2
+
 void workqueue_dump_queue (ctrl_t ctrl);
 gpg_error_t workqueue_add_task (wqtask_t func, const char *args,
-                                unsigned int session_id, int need_network);
+                                unsigned int session_id, int need_network,
+                                int priority);
 void workqueue_run_global_tasks (ctrl_t ctrl, int with_network);
 void workqueue_run_post_session_tasks (unsigned int session_id);
 
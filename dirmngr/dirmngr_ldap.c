@@ -72,6 +72,9 @@ static void npth_protect (void) { }
 
 #define DEFAULT_LDAP_TIMEOUT 15 /* Arbitrary long timeout. */
 
+/* The page size requested from the server in multi mode.  */
+#define PAGE_SIZE  100
+
 
 /* Constants for the options.  */
 enum
@@ -759,14 +762,26 @@ print_ldap_entries (LDAP *ld, LDAPMessage *msg, char *want_attr)
 
 
 
-/* Fetch data from the server at LD using FILTER.  */
+/* Fetch data from the server at LD using FILTER.  In multi mode the
+ * results are requested in pages (RFC 2696) and each page is written
+ * out as soon as it has been received.  This keeps the memory use
+ * bounded even for very large result sets.  The paged mode is not
+ * critical so that servers without support for it deliver all
+ * results at once.  */
 static int
 fetch_ldap (LDAP *ld, const char *base, int scope, const char *filter)
 {
-  gpg_error_t err;
-  int lerr;
+  int lerr, reserr;
   LDAPMessage *msg;
   char *attrs[2];
+  LDAPControl *srvctrls[2] = { NULL, NULL };
+  LDAPControl *pagectrl = NULL;
+  LDAPControl **resctrls = NULL;
+  struct berval *pagecookie = NULL;
+  unsigned int pageno = 0;
+  unsigned int totalcount;
+  int any = 0;
+  int rc = 0;
 
   if (filter && !*filter)
     filter = NULL;
@@ -784,37 +799,100 @@ fetch_ldap (LDAP *ld, const char *base, int scope, const char *filter)
   attrs[0] = opt.attr;
   attrs[1] = NULL;
 
-  set_timeout ();
-  npth_unprotect ();
-  lerr = ldap_search_st (ld, base, scope, filter,
-                         attrs,
-                         0,
-                         &opt.timeout, &msg);
-  npth_protect ();
-  if (lerr == LDAP_SIZELIMIT_EXCEEDED && opt.multi)
+  do
     {
-      if (es_fwrite ("E\0\0\0\x09truncated", 14, 1, opt.outstream) != 1)
+      if (opt.multi)
         {
-          log_error ("error writing to stdout: %s\n", strerror (errno));
-          return -1;
+          lerr = ldap_create_page_control (ld, PAGE_SIZE, pagecookie, 0,
+                                           &pagectrl);
+          if (lerr)
+            {
+              log_error ("create_page_control failed: %s\n",
+                         ldap_err2string (lerr));
+              rc = -1;
+              goto leave;
+            }
+          srvctrls[0] = pagectrl;
         }
-    }
-  else if (lerr)
-    {
-      log_error ("searching '%s' failed: %s\n",
-                 filter, ldap_err2string (lerr));
-      if (lerr != LDAP_NO_SUCH_OBJECT)
+
+      set_timeout ();
+      npth_unprotect ();
+      lerr = ldap_search_ext_s (ld, base, scope, filter, attrs, 0,
+                                srvctrls[0]? srvctrls : NULL, NULL,
+                                &opt.timeout, 0, &msg);
+      npth_protect ();
+      if (pagectrl)
+        {
+          ldap_control_free (pagectrl);
+          pagectrl = NULL;
+          srvctrls[0] = NULL;
+        }
+      if (pagecookie)
         {
-          /* FIXME: Need deinit (ld)?  */
-          /* Hmmm: Do we need to released MSG in case of an error? */
-          return -1;
+          ber_bvfree (pagecookie);
+          pagecookie = NULL;
+        }
+
+      if (lerr == LDAP_SIZELIMIT_EXCEEDED && opt.multi)
+        {
+          if (es_fwrite ("E\0\0\0\x09truncated", 14, 1, opt.outstream) != 1)
+            {
+              log_error ("error writing to stdout: %s\n", strerror (errno));
+              ldap_msgfree (msg);
+              rc = -1;
+              goto leave;
+            }
+        }
+      else if (lerr)
+        {
+          log_error ("searching '%s' failed: %s\n",
+                     filter, ldap_err2string (lerr));
+          if (lerr != LDAP_NO_SUCH_OBJECT)
+            {
+              /* FIXME: Need deinit (ld)?  */
+              /* Hmmm: Do we need to released MSG in case of an error? */
+              rc = -1;
+              goto leave;
+            }
+        }
+
+      /* Get the cookie for the next page.  */
+      if (opt.multi && !lerr
+          && !ldap_parse_result (ld, msg, &reserr, NULL, NULL, NULL,
+                                 &resctrls, 0))
+        {
+          totalcount = 0;
+          if (resctrls
+              && !ldap_parse_page_control (ld, resctrls, &totalcount,
+                                           &pagecookie)
+              && opt.verbose > 1)
+            log_info ("received result page %u (%u)\n", pageno+1, totalcount);
+          if (resctrls)
+            {
+              ldap_controls_free (resctrls);
+              resctrls = NULL;
+            }
+        }
+      pageno++;
+
+      if (!print_ldap_entries (ld, msg, opt.multi? NULL:opt.attr))
+        any = 1;
+      ldap_msgfree (msg);
+      if (es_fflush (opt.outstream))
+        {
+          log_error ("error writing to stdout: %s\n", strerror (errno));
+          rc = -1;
+          goto leave;
         }
     }
+  while (pagecookie && pagecookie->bv_val && pagecookie->bv_len);
 
-  err = print_ldap_entries (ld, msg, opt.multi? NULL:opt.attr);
+  rc = any? 0 : -1;
 
-  ldap_msgfree (msg);
-  return err;
+ leave:
+  if (pagecookie)
+    ber_bvfree (pagecookie);
+  return rc;
 }
 
 
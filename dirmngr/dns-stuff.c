@@ -74,6 +74,7 @@
 #include "./dirmngr-err.h"
 #include "../common/util.h"
 #include "../common/host2net.h"
+#include "../common/metrics.h"
 #include "dirmngr-status.h"
 #include "dns-stuff.h"
 
@@ -142,6 +143,11 @@ static int recursive_resolver;
 /* If set Tor mode shall be used.  */
 static int tor_mode;
 
+/* The number of queries not answered by the DNS cache and the time
+ * spent in them.  */
+static metric_t metric_queries;
+static metric_t metric_query_time;
+
 /* A string with the nameserver IP address used with Tor.
   (40 should be sufficient for v6 but we add some extra for a scope.) */
 static char tor_nameserver[40+20];
@@ -236,6 +242,7 @@ enable_dns_tormode (int new_circuit)
       gpgrt_snprintf (tor_socks_password, sizeof tor_socks_password,
                       "p%u", counter);
       counter++;
+      dns_cache_flush ();
     }
   tor_mode = 1;
 }
@@ -321,6 +328,336 @@ free_dns_addrinfo (dns_addrinfo_t ai)
 }
 
 
+/* The DNS cache.  Answers are kept for their TTL but not longer than
+ * DNSCACHE_MAX_TTL.  The system resolver and the libdns address
+ * lookup do not tell us the TTL; for them DNSCACHE_DEFAULT_TTL is
+ * used.  Names which do not exist are remembered for DNSCACHE_NEG_TTL
+ * so that a repeated lookup for a missing name does not again wait
+ * for the network.  */
+#define DNSCACHE_MAX_ITEMS   512
+#define DNSCACHE_MAX_TTL     3600
+#define DNSCACHE_DEFAULT_TTL 300
+#define DNSCACHE_NEG_TTL     60
+
+enum dnscache_types
+  {
+    DNSCACHE_ADDR,
+    DNSCACHE_SRV,
+    DNSCACHE_CERT,
+    DNSCACHE_CNAME
+  };
+
+/* The parameters of a query in addition to the name.  */
+struct dnscache_key_s
+{
+  enum dnscache_types type;
+  unsigned short port;  /* ADDR: The port.  */
+  int family;           /* ADDR: The requested address family.  */
+  int socktype;         /* ADDR: The requested socket type.  */
+  int flags;            /* ADDR: Canonname requested; CERT: key requested.  */
+  int certtype;         /* CERT: The requested certtype.  */
+};
+
+struct dnscache_item_s
+{
+  struct dnscache_item_s *next;
+  struct dnscache_key_s k;
+  time_t expires;
+  gpg_error_t err;      /* The cached negative answer or 0.  */
+  unsigned int hits;
+
+  dns_addrinfo_t dai;        /* ADDR */
+  char *canonname;           /* ADDR */
+  struct srventry *srvlist;  /* SRV  */
+  unsigned int srvcount;     /* SRV  */
+  void *key;                 /* CERT */
+  size_t keylen;             /* CERT */
+  unsigned char *fpr;        /* CERT */
+  size_t fprlen;             /* CERT */
+  char *url;                 /* CERT: the URL; CNAME: the cname.  */
+
+  char name[1];
+};
+typedef struct dnscache_item_s *dnscache_item_t;
+
+/* The cache, most recently used entries first.  */
+static dnscache_item_t dnscache;
+static unsigned int dnscache_items;
+
+
+/* Release the cache item R which must already be unlinked.  */
+static void
+dnscache_release_item (dnscache_item_t r)
+{
+  if (!r)
+    return;
+  dnscache_items--;
+  free_dns_addrinfo (r->dai);
+  xfree (r->canonname);
+  xfree (r->srvlist);
+  xfree (r->key);
+  xfree (r->fpr);
+  xfree (r->url);
+  xfree (r);
+}
+
+
+/* Remove all items from the DNS cache.  */
+void
+dns_cache_flush (void)
+{
+  dnscache_item_t r;
+
+  while ((r = dnscache))
+    {
+      dnscache = r->next;
+      dnscache_release_item (r);
+    }
+}
+
+
+/* Remove all expired items from the DNS cache.  */
+static void
+dnscache_expire (void)
+{
+  dnscache_item_t *rp, r;
+  time_t now = gnupg_get_time ();
+
+  for (rp = &dnscache; (r = *rp); )
+    if (r->expires <= now)
+      {
+        *rp = r->next;
+        dnscache_release_item (r);
+      }
+    else
+      rp = &r->next;
+}
+
+
+/* Return true if an error code ERR is a definitive answer from the
+ * DNS which may be cached.  */
+static int
+dnscache_negative_p (gpg_error_t err)
+{
+  switch (gpg_err_code (err))
+    {
+    case GPG_ERR_NO_NAME:
+    case GPG_ERR_NOT_FOUND:
+    case GPG_ERR_NO_DATA:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+/* Return the address of the link to the cache item for the query
+ * NAME with the parameters K or NULL if there is no such item.  */
+static dnscache_item_t *
+dnscache_find (const char *name, const struct dnscache_key_s *k)
+{
+  dnscache_item_t *rp, r;
+
+  for (rp = &dnscache; (r = *rp); rp = &r->next)
+    if (r->k.type == k->type
+        && r->k.port == k->port
+        && r->k.family == k->family
+        && r->k.socktype == k->socktype
+        && r->k.flags == k->flags
+        && r->k.certtype == k->certtype
+        && !ascii_strcasecmp (r->name, name))
+      return rp;
+  return NULL;
+}
+
+
+/* Look up the query NAME with the parameters K in the cache.  If
+ * found and not expired the item is moved to the front and
+ * returned.  */
+static dnscache_item_t
+dnscache_lookup (const char *name, const struct dnscache_key_s *k)
+{
+  dnscache_item_t *rp, r;
+
+  if (!dnscache)
+    return NULL;  /* Shortcut - nothing to do.  */
+
+  rp = dnscache_find (name, k);
+  if (!rp)
+    return NULL;
+  r = *rp;
+  *rp = r->next;
+  if (r->expires <= gnupg_get_time ())
+    {
+      dnscache_release_item (r);
+      return NULL;
+    }
+  r->next = dnscache;
+  dnscache = r;
+  r->hits++;
+  if (opt_debug)
+    log_debug ("dns: cache hit for '%s'\n", name);
+  return r;
+}
+
+
+/* Create a new cache item for NAME with the parameters K, to be
+ * valid for TTL seconds, and the result ERR.  For a positive answer
+ * the caller needs to fill in the data and then to call
+ * dnscache_insert.  Returns NULL if the answer shall not be
+ * cached.  */
+static dnscache_item_t
+dnscache_new_item (const char *name, const struct dnscache_key_s *k,
+                   unsigned int ttl, gpg_error_t err)
+{
+  dnscache_item_t r;
+
+  if (err)
+    {
+      if (!dnscache_negative_p (err))
+        return NULL;
+      ttl = DNSCACHE_NEG_TTL;
+    }
+  if (!ttl)
+    return NULL;
+  if (ttl > DNSCACHE_MAX_TTL)
+    ttl = DNSCACHE_MAX_TTL;
+
+  r = xtrycalloc (1, sizeof *r + strlen (name));
+  if (!r)
+    return NULL;
+  strcpy (r->name, name);
+  r->k = *k;
+  r->expires = gnupg_get_time () + ttl;
+  r->err = err;
+  dnscache_items++;
+  return r;
+}
+
+
+/* Put the item R into the cache, replacing an older item for the
+ * same query.  */
+static void
+dnscache_insert (dnscache_item_t r)
+{
+  dnscache_item_t old, *rp;
+
+  rp = dnscache_find (r->name, &r->k);
+  if (rp)
+    {
+      old = *rp;
+      *rp = old->next;
+      dnscache_release_item (old);
+    }
+  r->next = dnscache;
+  dnscache = r;
+
+  if (dnscache_items > DNSCACHE_MAX_ITEMS)
+    dnscache_expire ();
+  while (dnscache_items > DNSCACHE_MAX_ITEMS)
+    {
+      /* Drop the least recently used item.  */
+      for (rp = &dnscache; (*rp)->next; rp = &(*rp)->next)
+        ;
+      old = *rp;
+      *rp = NULL;
+      dnscache_release_item (old);
+    }
+}
+
+
+/* Return a copy of the address list DAI or NULL on error.  */
+static dns_addrinfo_t
+dnscache_copy_addrinfo (dns_addrinfo_t dai)
+{
+  dns_addrinfo_t list = NULL;
+  dns_addrinfo_t *tail = &list;
+
+  for (; dai; dai = dai->next)
+    {
+      *tail = xtrymalloc (sizeof **tail);
+      if (!*tail)
+        {
+          free_dns_addrinfo (list);
+          return NULL;
+        }
+      memcpy (*tail, dai, sizeof **tail);
+      (*tail)->next = NULL;
+      tail = &(*tail)->next;
+    }
+  return list;
+}
+
+
+/* Print the content of the DNS cache as status lines to CTRL.  */
+void
+dns_cache_dump (ctrl_t ctrl)
+{
+  static const char *typestr[] = { "addr", "srv", "cert", "cname" };
+  dnscache_item_t saved, r;
+  dns_addrinfo_t dai;
+  time_t now;
+  unsigned int n;
+
+  /* Temporarily detach the cache because the status output may yield
+   * to other threads.  */
+  saved = dnscache;
+  dnscache = NULL;
+  now = gnupg_get_time ();
+
+  dirmngr_status_helpf (ctrl, "dnscache: number of entries: %u",
+                        dnscache_items);
+  for (r = saved; r; r = r->next)
+    {
+      if (r->err)
+        dirmngr_status_helpf (ctrl, "dnscache: %s %s ttl=%ld hits=%u %s",
+                              typestr[r->k.type], r->name,
+                              (long)(r->expires - now), r->hits,
+                              gpg_strerror (r->err));
+      else if (r->k.type == DNSCACHE_ADDR)
+        {
+          for (n=0, dai = r->dai; dai; dai = dai->next)
+            n++;
+          dirmngr_status_helpf (ctrl, "dnscache: %s %s ttl=%ld hits=%u"
+                                " -> %u addresses%s%s",
+                                typestr[r->k.type], r->name,
+                                (long)(r->expires - now), r->hits, n,
+                                r->canonname? " ":"",
+                                r->canonname? r->canonname:"");
+        }
+      else if (r->k.type == DNSCACHE_SRV)
+        dirmngr_status_helpf (ctrl, "dnscache: %s %s ttl=%ld hits=%u"
+                              " -> %u records",
+                              typestr[r->k.type], r->name,
+                              (long)(r->expires - now), r->hits,
+                              r->srvcount);
+      else if (r->k.type == DNSCACHE_CERT)
+        dirmngr_status_helpf (ctrl, "dnscache: %s %s ttl=%ld hits=%u"
+                              " -> %s%s",
+                              typestr[r->k.type], r->name,
+                              (long)(r->expires - now), r->hits,
+                              r->key? "key":"fpr",
+                              r->url? " and url":"");
+      else
+        dirmngr_status_helpf (ctrl, "dnscache: %s %s ttl=%ld hits=%u -> %s",
+                              typestr[r->k.type], r->name,
+                              (long)(r->expires - now), r->hits,
+                              r->url? r->url : "");
+    }
+
+  /* Restore the cache.  Items added in the meantime are kept in
+   * front.  */
+  if (!(r = dnscache))
+    dnscache = saved;
+  else
+    {
+      while (r->next)
+        r = r->next;
+      r->next = saved;
+    }
+}
+
+
 #ifndef HAVE_W32_SYSTEM
 /* Return H_ERRNO mapped to a gpg-error code.  Will never return 0. */
 static gpg_error_t
@@ -697,8 +1034,10 @@ reload_dns_stuff (int force)
   (void)force;
 #endif
 
-  /* We also flush the IPv4/v6 support flag cache.  */
+  /* We also flush the IPv4/v6 support flag cache and the DNS
+   * cache.  */
   cached_inet_support.valid = 0;
+  dns_cache_flush ();
 }
 
 
@@ -711,6 +1050,28 @@ dns_stuff_housekeeping (void)
    * later than 10 minutes after it changed.  This way the user does
    * not need a reload.  */
   cached_inet_support.valid = 0;
+
+  dnscache_expire ();
+}
+
+
+/* Register the statistics of this module with the metrics module.  */
+void
+dns_stuff_register_metrics (void)
+{
+  metric_queries = metrics_counter
+    ("dns_queries_total", "DNS queries not answered by the DNS cache.");
+  metric_query_time = metrics_counter
+    ("dns_query_microseconds_total", "Time spent in DNS queries.");
+}
+
+
+/* Account a DNS query which started at START.  */
+static void
+account_query (unsigned long long start)
+{
+  metric_add (metric_queries, 1);
+  metric_add (metric_query_time, metrics_clock () - start);
 }
 
 
@@ -1100,7 +1461,42 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
                   dns_addrinfo_t *r_ai, char **r_canonname)
 {
   gpg_error_t err;
+  struct dnscache_key_s key;
+  dnscache_item_t item;
+  int cacheable;
+  unsigned long long start;
 
+  *r_ai = NULL;
+  if (r_canonname)
+    *r_canonname = NULL;
+
+  memset (&key, 0, sizeof key);
+  key.type = DNSCACHE_ADDR;
+  key.port = port;
+  key.family = want_family;
+  key.socktype = want_socktype;
+  key.flags = !!r_canonname;
+  cacheable = !is_ip_address (name);
+  if (cacheable && (item = dnscache_lookup (name, &key)))
+    {
+      err = item->err;
+      if (!err)
+        {
+          *r_ai = dnscache_copy_addrinfo (item->dai);
+          if (!*r_ai)
+            err = gpg_error_from_syserror ();
+          else if (r_canonname && item->canonname
+                   && !(*r_canonname = xtrystrdup (item->canonname)))
+            {
+              err = gpg_error_from_syserror ();
+              free_dns_addrinfo (*r_ai);
+              *r_ai = NULL;
+            }
+        }
+      goto leave;
+    }
+
+  start = metrics_clock ();
 #ifdef USE_LIBDNS
   if (!standard_resolver)
     {
@@ -1114,6 +1510,22 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
 #endif /*USE_LIBDNS*/
     err = resolve_name_standard (ctrl, name, port, want_family, want_socktype,
                                  r_ai, r_canonname);
+  if (cacheable)
+    account_query (start);
+
+  if (cacheable
+      && (item = dnscache_new_item (name, &key, DNSCACHE_DEFAULT_TTL, err)))
+    {
+      if (!err
+          && (!(item->dai = dnscache_copy_addrinfo (*r_ai))
+              || (r_canonname && *r_canonname
+                  && !(item->canonname = xtrystrdup (*r_canonname)))))
+        dnscache_release_item (item);
+      else
+        dnscache_insert (item);
+    }
+
+ leave:
   if (opt_debug)
     log_debug ("dns: resolve_dns_name(%s): %s\n", name, gpg_strerror (err));
   return err;
@@ -1427,12 +1839,14 @@ is_onion_address (const char *name)
 }
 
 
-/* libdns version of get_dns_cert.  */
+/* libdns version of get_dns_cert.  The TTL of the returned record is
+ * stored at R_TTL.  */
 #ifdef USE_LIBDNS
 static gpg_error_t
 get_dns_cert_libdns (ctrl_t ctrl, const char *name, int want_certtype,
                      void **r_key, size_t *r_keylen,
-                     unsigned char **r_fpr, size_t *r_fprlen, char **r_url)
+                     unsigned char **r_fpr, size_t *r_fprlen, char **r_url,
+                     unsigned int *r_ttl)
 {
   gpg_error_t err;
   struct dns_resolver *res = NULL;
@@ -1443,6 +1857,8 @@ get_dns_cert_libdns (ctrl_t ctrl, const char *name, int want_certtype,
   int derr;
   int qtype;
 
+  *r_ttl = 0;
+
   /* Get the query type from WANT_CERTTYPE (which in general indicates
    * the subtype we want). */
   qtype = (want_certtype < DNS_CERTTYPE_RRBASE
@@ -1498,7 +1914,8 @@ get_dns_cert_libdns (ctrl_t ctrl, const char *name, int want_certtype,
       unsigned short len = rr.rd.len;
       u16 subtype;
 
-       if (!len)
+      *r_ttl = rr.ttl;
+      if (!len)
         {
           /* Definitely too short - skip.  */
         }
@@ -1821,6 +2238,9 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
               unsigned char **r_fpr, size_t *r_fprlen, char **r_url)
 {
   gpg_error_t err;
+  unsigned int ttl = DNSCACHE_DEFAULT_TTL;
+  struct dnscache_key_s key;
+  dnscache_item_t item;
 
   if (r_key)
     *r_key = NULL;
@@ -1830,20 +2250,90 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
   *r_fprlen = 0;
   *r_url = NULL;
 
+  memset (&key, 0, sizeof key);
+  key.type = DNSCACHE_CERT;
+  key.certtype = want_certtype;
+  key.flags = !!(r_key && r_keylen);
+  if ((item = dnscache_lookup (name, &key)))
+    {
+      err = item->err;
+      if (!err && item->key
+          && !(*r_key = xtrymalloc (item->keylen)))
+        err = gpg_error_from_syserror ();
+      else if (!err && item->key)
+        {
+          memcpy (*r_key, item->key, item->keylen);
+          *r_keylen = item->keylen;
+        }
+      if (!err && item->fpr
+          && !(*r_fpr = xtrymalloc (item->fprlen)))
+        err = gpg_error_from_syserror ();
+      else if (!err && item->fpr)
+        {
+          memcpy (*r_fpr, item->fpr, item->fprlen);
+          *r_fprlen = item->fprlen;
+        }
+      if (!err && item->url && !(*r_url = xtrystrdup (item->url)))
+        err = gpg_error_from_syserror ();
+      if (err && !item->err)
+        {
+          if (r_key)
+            {
+              xfree (*r_key);
+              *r_key = NULL;
+            }
+          xfree (*r_fpr);
+          *r_fpr = NULL;
+          *r_fprlen = 0;
+        }
+      goto leave;
+    }
+
 #ifdef USE_LIBDNS
   if (!standard_resolver)
     {
       err = get_dns_cert_libdns (ctrl, name, want_certtype, r_key, r_keylen,
-                                 r_fpr, r_fprlen, r_url);
+                                 r_fpr, r_fprlen, r_url, &ttl);
       if (err && libdns_switch_port_p (err))
         err = get_dns_cert_libdns (ctrl, name, want_certtype, r_key, r_keylen,
-                                   r_fpr, r_fprlen, r_url);
+                                   r_fpr, r_fprlen, r_url, &ttl);
     }
   else
 #endif /*USE_LIBDNS*/
     err = get_dns_cert_standard (name, want_certtype, r_key, r_keylen,
                                  r_fpr, r_fprlen, r_url);
 
+  if ((item = dnscache_new_item (name, &key, ttl, err)))
+    {
+      if (!err && r_key && *r_key)
+        {
+          item->key = xtrymalloc (*r_keylen);
+          if (item->key)
+            {
+              memcpy (item->key, *r_key, *r_keylen);
+              item->keylen = *r_keylen;
+            }
+        }
+      if (!err && *r_fpr)
+        {
+          item->fpr = xtrymalloc (*r_fprlen);
+          if (item->fpr)
+            {
+              memcpy (item->fpr, *r_fpr, *r_fprlen);
+              item->fprlen = *r_fprlen;
+            }
+        }
+      if (!err && *r_url)
+        item->url = xtrystrdup (*r_url);
+      if ((r_key && *r_key && !item->key)
+          || (*r_fpr && !item->fpr)
+          || (*r_url && !item->url))
+        dnscache_release_item (item);
+      else
+        dnscache_insert (item);
+    }
+
+ leave:
   if (opt_debug)
     log_debug ("dns: get_dns_cert(%s): %s\n", name, gpg_strerror (err));
   return err;
@@ -1865,11 +2355,12 @@ priosort(const void *a,const void *b)
 
 /* Libdns based helper for getsrv.  Note that it is expected that NULL
  * is stored at the address of LIST and 0 is stored at the address of
- * R_COUNT.  */
+ * R_COUNT.  The lowest TTL of the records is stored at R_TTL.  */
 #ifdef USE_LIBDNS
 static gpg_error_t
 getsrv_libdns (ctrl_t ctrl,
-               const char *name, struct srventry **list, unsigned int *r_count)
+               const char *name, struct srventry **list, unsigned int *r_count,
+               unsigned int *r_ttl)
 {
   gpg_error_t err;
   struct dns_resolver *res = NULL;
@@ -1931,6 +2422,9 @@ getsrv_libdns (ctrl_t ctrl,
       if (err)
         goto leave;
 
+      if (!srvcount || rr.ttl < *r_ttl)
+        *r_ttl = rr.ttl;
+
       newlist = xtryrealloc (*list, (srvcount+1)*sizeof(struct srventry));
       if (!newlist)
         {
@@ -2106,6 +2600,9 @@ get_dns_srv (ctrl_t ctrl,
   gpg_error_t err;
   char *namebuffer = NULL;
   unsigned int srvcount;
+  unsigned int ttl = DNSCACHE_DEFAULT_TTL;
+  struct dnscache_key_s key;
+  dnscache_item_t item;
   int i;
 
   *list = NULL;
@@ -2126,16 +2623,54 @@ get_dns_srv (ctrl_t ctrl,
     }
 
 
-#ifdef USE_LIBDNS
-  if (!standard_resolver)
+  memset (&key, 0, sizeof key);
+  key.type = DNSCACHE_SRV;
+  if ((item = dnscache_lookup (name, &key)))
     {
-      err = getsrv_libdns (ctrl, name, list, &srvcount);
-      if (err && libdns_switch_port_p (err))
-        err = getsrv_libdns (ctrl, name, list, &srvcount);
+      err = item->err;
+      if (!err && item->srvcount)
+        {
+          *list = xtrymalloc (item->srvcount * sizeof **list);
+          if (!*list)
+            err = gpg_error_from_syserror ();
+          else
+            {
+              memcpy (*list, item->srvlist, item->srvcount * sizeof **list);
+              srvcount = item->srvcount;
+            }
+        }
     }
   else
+    {
+      unsigned long long start = metrics_clock ();
+
+#ifdef USE_LIBDNS
+      if (!standard_resolver)
+        {
+          err = getsrv_libdns (ctrl, name, list, &srvcount, &ttl);
+          if (err && libdns_switch_port_p (err))
+            err = getsrv_libdns (ctrl, name, list, &srvcount, &ttl);
+        }
+      else
 #endif /*USE_LIBDNS*/
-    err = getsrv_standard (name, list, &srvcount);
+        err = getsrv_standard (name, list, &srvcount);
+      account_query (start);
+
+      /* Cache the records before they are shuffled.  */
+      if ((item = dnscache_new_item (name, &key, ttl, err)))
+        {
+          if (!err && srvcount
+              && !(item->srvlist = xtrymalloc (srvcount * sizeof **list)))
+            dnscache_release_item (item);
+          else
+            {
+              if (srvcount)
+                memcpy (item->srvlist, *list, srvcount * sizeof **list);
+              item->srvcount = srvcount;
+              dnscache_insert (item);
+            }
+        }
+    }
 
   if (err)
     {
@@ -2392,6 +2927,8 @@ gpg_error_t
 get_dns_cname (ctrl_t ctrl, const char *name, char **r_cname)
 {
   gpg_error_t err;
+  struct dnscache_key_s key;
+  dnscache_item_t item;
 
   *r_cname = NULL;
 
@@ -2405,7 +2942,25 @@ get_dns_cname (ctrl_t ctrl, const char *name, char **r_cname)
     }
 #endif /*USE_LIBDNS*/
 
-  err = get_dns_cname_standard (name, r_cname);
+  memset (&key, 0, sizeof key);
+  key.type = DNSCACHE_CNAME;
+  if ((item = dnscache_lookup (name, &key)))
+    {
+      err = item->err;
+      if (!err && !(*r_cname = xtrystrdup (item->url)))
+        err = gpg_error_from_syserror ();
+    }
+  else
+    {
+      err = get_dns_cname_standard (name, r_cname);
+      if ((item = dnscache_new_item (name, &key, DNSCACHE_DEFAULT_TTL, err)))
+        {
+          if (!err && !(item->url = xtrystrdup (*r_cname)))
+            dnscache_release_item (item);
+          else
+            dnscache_insert (item);
+        }
+    }
   if (opt_debug)
     log_debug ("get_dns_cname(%s)%s%s\n", name,
                err ? ": " : " -> ",
@@ -137,8 +137,17 @@ void reload_dns_stuff (int force);
 /* Housekeeping for this module.  */
 void dns_stuff_housekeeping (void);
 
+/* Register the statistics of this module with the metrics module.  */
+void dns_stuff_register_metrics (void);
+
 void free_dns_addrinfo (dns_addrinfo_t ai);
 
+/* Remove all entries from the DNS cache.  */
+void dns_cache_flush (void);
+
+/* Print the content of the DNS cache as status lines.  */
+void dns_cache_dump (ctrl_t ctrl);
+
 /* Function similar to getaddrinfo.  */
 gpg_error_t resolve_dns_name (ctrl_t ctrl,
                               const char *name, unsigned short port,
@@ -22,6 +22,7 @@
 #include <config.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "dirmngr.h"
 
@@ -38,6 +39,18 @@
 #define NO_OF_DOMAINBUCKETS  103
 #define MAX_DOMAINBUCKET_LEN  20
 
+/* The time in seconds we trust the information about a domain.  A
+ * failed DNS lookup is often a temporary problem and is thus not
+ * cached as long as the result of a WKD query.  */
+#define TTL_NO_NAME             (3600)
+#define TTL_WKD_NOT_SUPPORTED  (86400)
+#define TTL_WKD_SUPPORTED    (7*86400)
+
+/* The file below the cache directory used to keep the information
+ * across restarts and the version of its format.  */
+#define DOMAININFO_FILE     "domaininfo.txt"
+#define DOMAININFO_VERSION  1
+
 
 /* Object to keep track of a domain name.  */
 struct domaininfo_s
@@ -48,6 +61,7 @@ struct domaininfo_s
   unsigned int wkd_supported:1;      /* One WKD entry was found.          */
   unsigned int wkd_not_supported:1;  /* Definitely does not support WKD.  */
   unsigned int keepmark:1;           /* Private to insert_or_update().    */
+  time_t stamp;                      /* Time of the last update.          */
   char name[1];
 };
 typedef struct domaininfo_s *domaininfo_t;
@@ -55,6 +69,12 @@ typedef struct domaininfo_s *domaininfo_t;
 /* And the hashed array.  */
 static domaininfo_t domainbuckets[NO_OF_DOMAINBUCKETS];
 
+/* Set once DOMAININFO_FILE has been read.  */
+static int table_loaded;
+
+/* Set if the table has changed since the last save.  */
+static int table_dirty;
+
 
 /* The hash function we use.  Must not call a system function.  */
 static inline u32
@@ -80,6 +100,262 @@ hash_domain (const char *domain)
 }
 
 
+/* Return true if the information in DI is too old to be used.  NOW
+ * is the current time.  */
+static int
+is_expired (domaininfo_t di, time_t now)
+{
+  time_t ttl;
+
+  if (di->no_name)
+    ttl = TTL_NO_NAME;
+  else if (di->wkd_supported)
+    ttl = TTL_WKD_SUPPORTED;
+  else
+    ttl = TTL_WKD_NOT_SUPPORTED;
+
+  return di->stamp + ttl < now;
+}
+
+
+/* Parse a LINE from DOMAININFO_FILE and return a new item or NULL if
+ * the line is not valid or has expired.  The format of a line is
+ *
+ *   <flags>:<stamp>:<domain>
+ *
+ * with FLAGS being a string of the letters 'n' (no_name), 'f'
+ * (wkd_not_found), 's' (wkd_supported), and 'u' (wkd_not_supported)
+ * and STAMP the time of the last update in seconds since Epoch.  */
+static domaininfo_t
+parse_file_line (char *line, time_t now)
+{
+  domaininfo_t di;
+  char *stamp, *name, *endp;
+  unsigned long value;
+
+  stamp = strchr (line, ':');
+  if (!stamp)
+    return NULL;
+  *stamp++ = 0;
+  name = strchr (stamp, ':');
+  if (!name)
+    return NULL;
+  *name++ = 0;
+  value = strtoul (stamp, &endp, 10);
+  if (endp == stamp || *endp || !*name || strchr (name, ':'))
+    return NULL;
+
+  di = xtrycalloc (1, sizeof *di + strlen (name));
+  if (!di)
+    return NULL;
+  strcpy (di->name, name);
+  ascii_strlwr (di->name);
+  di->stamp = (time_t)value;
+  for (; *line; line++)
+    switch (*line)
+      {
+      case 'n': di->no_name = 1; break;
+      case 'f': di->wkd_not_found = 1; break;
+      case 's': di->wkd_supported = 1; break;
+      case 'u': di->wkd_not_supported = 1; break;
+      default: break; /* Ignore unknown flags.  */
+      }
+
+  if (is_expired (di, now))
+    {
+      xfree (di);
+      return NULL;
+    }
+  return di;
+}
+
+
+/* Read DOMAININFO_FILE into the table.  This is done on the first
+ * access to the table so that a dirmngr which never does WKD lookups
+ * does not need to read the file.  Entries already in the table take
+ * precedence over those from the file.  */
+static void
+load_table (void)
+{
+  char *fname;
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  ssize_t n;
+  int lineno = 0;
+  int nloaded = 0;
+  domaininfo_t list = NULL;
+  domaininfo_t drop = NULL;
+  domaininfo_t di, dinext, d;
+  time_t now;
+  u32 hash;
+  int count;
+
+  if (table_loaded)
+    return;
+  /* Set the flag first because reading the file may switch to
+   * another thread.  */
+  table_loaded = 1;
+  if (!opt.homedir_cache)
+    return;
+
+  now = gnupg_get_time ();
+  fname = make_filename (opt.homedir_cache, DOMAININFO_FILE, NULL);
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_info ("domaininfo: can't open '%s': %s\n",
+                  fname, gpg_strerror (gpg_error_from_syserror ()));
+      xfree (fname);
+      return;
+    }
+
+  while ((n = es_read_line (fp, &line, &linelen, NULL)) > 0)
+    {
+      lineno++;
+      trim_spaces (line);
+      if (!*line || *line == '#')
+        continue;
+      if (lineno == 1 || *line == 'v')
+        {
+          if (strncmp (line, "v:", 2) || atoi (line+2) != DOMAININFO_VERSION)
+            {
+              log_info ("domaininfo: ignoring '%s': %s\n",
+                        fname, "unknown version");
+              break;
+            }
+          continue;
+        }
+      di = parse_file_line (line, now);
+      if (di)
+        {
+          di->next = list;
+          list = di;
+        }
+    }
+  if (n < 0)
+    log_info ("domaininfo: error reading '%s': %s\n",
+              fname, gpg_strerror (gpg_error_from_syserror ()));
+  es_fclose (fp);
+  es_free (line);
+
+  /* Now insert the items.  This does not do any syscalls and thus no
+   * other thread can change the table in the meantime.  */
+  for (di = list; di; di = dinext)
+    {
+      dinext = di->next;
+      hash = hash_domain (di->name);
+      for (count=0, d = domainbuckets[hash]; d; d = d->next, count++)
+        if (!strcmp (d->name, di->name))
+          break;
+      if (d || count >= MAX_DOMAINBUCKET_LEN)
+        {
+          di->next = drop;
+          drop = di;
+        }
+      else
+        {
+          di->next = domainbuckets[hash];
+          domainbuckets[hash] = di;
+          nloaded++;
+        }
+    }
+
+  while (drop)
+    {
+      di = drop->next;
+      xfree (drop);
+      drop = di;
+    }
+
+  if (DBG_CACHE)
+    log_debug ("domaininfo: loaded %d items from '%s'\n", nloaded, fname);
+  xfree (fname);
+}
+
+
+/* Write the table to DOMAININFO_FILE if it has been changed.  This
+ * should be called at shutdown and may be called at any time to
+ * checkpoint the table.  */
+void
+domaininfo_save (void)
+{
+  gpg_error_t err;
+  membuf_t mb;
+  int bidx;
+  domaininfo_t di;
+  time_t now;
+  char *buffer = NULL;
+  size_t buflen;
+  char *fname = NULL;
+  char *tmpfname = NULL;
+  estream_t fp;
+
+  if (!table_loaded || !table_dirty || !opt.homedir_cache)
+    return;
+  table_dirty = 0;
+
+  /* Take a copy of the table first; writing the file may switch to
+   * another thread which might then modify the table.  */
+  now = gnupg_get_time ();
+  init_membuf (&mb, 4096);
+  put_membuf_printf (&mb, "# Domain information of dirmngr\n"
+                     "v:%d\n", DOMAININFO_VERSION);
+  for (bidx = 0; bidx < NO_OF_DOMAINBUCKETS; bidx++)
+    for (di = domainbuckets[bidx]; di; di = di->next)
+      if (!is_expired (di, now))
+        put_membuf_printf (&mb, "%s%s%s%s:%lu:%s\n",
+                           di->no_name?           "n":"",
+                           di->wkd_not_found?     "f":"",
+                           di->wkd_supported?     "s":"",
+                           di->wkd_not_supported? "u":"",
+                           (unsigned long)di->stamp, di->name);
+  buffer = get_membuf (&mb, &buflen);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  fname = make_filename (opt.homedir_cache, DOMAININFO_FILE, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (es_write (fp, buffer, buflen, NULL))
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+
+ leave:
+  if (err)
+    log_info ("domaininfo: error writing '%s': %s\n",
+              fname? fname : DOMAININFO_FILE, gpg_strerror (err));
+  xfree (buffer);
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
 void
 domaininfo_print_stats (ctrl_t ctrl)
 {
@@ -127,18 +403,42 @@ int
 domaininfo_is_wkd_not_supported (const char *domain)
 {
   domaininfo_t di;
+  time_t now;
 
+  load_table ();
+  now = gnupg_get_time ();
   for (di = domainbuckets[hash_domain (domain)]; di; di = di->next)
     if (!strcmp (di->name, domain))
-      return !!di->wkd_not_supported;
+      return !is_expired (di, now) && di->wkd_not_supported;
 
   return 0;  /* We don't know.  */
 }
 
 
+/* Helper for insert_or_update to update the existing item DI.  */
+static void
+update_item (domaininfo_t di,
+             void (*callback)(domaininfo_t di, int insert_mode), time_t now)
+{
+  if (is_expired (di, now))
+    {
+      di->no_name = 0;
+      di->wkd_not_found = 0;
+      di->wkd_supported = 0;
+      di->wkd_not_supported = 0;
+      callback (di, 1);
+    }
+  else
+    callback (di, 0);
+  di->stamp = now;
+  table_dirty = 1;
+}
+
+
 /* Core update function.  DOMAIN is expected to be lowercase.
  * CALLBACK is called to update the existing or the newly inserted
- * item.  */
+ * item.  An existing but expired item is reset and handled like a
+ * new one.  */
 static void
 insert_or_update (const char *domain,
                   void (*callback)(domaininfo_t di, int insert_mode))
@@ -151,12 +451,15 @@ insert_or_update (const char *domain,
   int ndropped = 0;
   u32 hash;
   int count;
+  time_t now;
 
+  load_table ();
+  now = gnupg_get_time ();
   hash = hash_domain (domain);
   for (di = domainbuckets[hash]; di; di = di->next)
     if (!strcmp (di->name, domain))
       {
-        callback (di, 0);  /* Update */
+        update_item (di, callback, now);
         return;
       }
 
@@ -170,7 +473,7 @@ insert_or_update (const char *domain,
   for (count=0, di = domainbuckets[hash]; di; di = di->next, count++)
     if (!strcmp (di->name, domain))
       {
-        callback (di, 0);  /* Update */
+        update_item (di, callback, now);
         xfree (di_new);
         return;
       }
@@ -263,6 +566,8 @@ insert_or_update (const char *domain,
 
   /* Insert */
   callback (di_new, 1);
+  di_new->stamp = now;
+  table_dirty = 1;
   di = di_new;
   di->next = domainbuckets[hash];
   domainbuckets[hash] = di;
@@ -102,6 +102,7 @@
 #include "../common/util.h"
 #include "../common/i18n.h"
 #include "../common/sysutils.h" /* (gnupg_fd_t) */
+#include "../common/metrics.h"
 #include "dns-stuff.h"
 #include "dirmngr-status.h"    /* (dirmngr_status_printf)  */
 #include "http.h"
@@ -131,6 +132,11 @@
 
 #define HTTP_PROXY_ENV           "http_proxy"
 #define MAX_LINELEN 20000  /* Max. length of a HTTP header line. */
+#define MAX_IDLE_CONNS 8   /* Max. number of connections kept for reuse. */
+#define IDLE_CONN_TTL  30  /* Seconds an idle connection is kept.  */
+#define MAX_DRAIN_LEN  4096 /* Max. length of an unread body to skip.  */
+#define MAX_TLS_RESUME 16  /* Max. number of cached TLS sessions.  */
+#define TLS_RESUME_TTL 3600 /* Seconds TLS session data is kept.  */
 #define VALID_URI_CHARS "abcdefghijklmnopqrstuvwxyz"   \
                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"   \
                         "01234567890@"                 \
@@ -230,6 +236,15 @@ struct cookie_s
   unsigned int up_to_empty_line:1;
   unsigned int last_was_lf:1;      /* Helper to detect empty line.  */
   unsigned int last_was_lfcr:1;    /* Helper to detect empty line.  */
+
+  /* Set if the entire body as given by the content length has been
+   * read.  */
+  unsigned int body_done:1;
+
+  /* If not NULL the server agreed to keep the connection alive and
+   * this is the prepared pool entry to store the connection when the
+   * stream is closed.  */
+  struct idle_conn_s *keepalive;
 };
 typedef struct cookie_s *cookie_t;
 
@@ -341,6 +356,8 @@ struct http_context_s
   unsigned int in_data:1;
   unsigned int is_http_0_9:1;
   unsigned int keep_alive:1;  /* Keep the connection alive.  */
+  unsigned int want_keepalive:1; /* Connection may be reused.  */
+  unsigned int reused_conn:1;    /* Connection was taken from the pool.  */
   estream_t fp_read;
   estream_t fp_write;
   void *write_cookie;
@@ -355,6 +372,53 @@ struct http_context_s
 };
 
 
+/* A connection kept open after a request so that another request to
+ * the same server can skip the TCP and TLS handshakes.  The HTTP/1.0
+ * keep-alive mechanism is used because we can then rely on the
+ * Content-Length to find the end of a response.  */
+struct idle_conn_s
+{
+  struct idle_conn_s *next;
+  my_socket_t sock;           /* The socket or NULL if not yet stored.  */
+  tls_session_t tls_session;  /* The TLS session or NULL for plain http.  */
+#ifdef HTTP_USE_GNUTLS
+  gnutls_certificate_credentials_t certcred;
+#endif
+  struct {
+    int done;
+    int rc;
+    unsigned int status;
+  } verify;                   /* Verification state of the TLS session.  */
+  char *servername;           /* The SNI used for the TLS session.  */
+  unsigned int sessflags;     /* The flags of the session.  */
+  http_verify_cb_t verify_cb; /* The verify callback of the session.  */
+  unsigned short port;
+  int use_tls;
+  time_t stored;              /* Time the connection became idle.  */
+  char host[1];               /* The server's name.  */
+};
+
+/* The list of idle connections, most recently used first.  */
+static struct idle_conn_s *idle_conns;
+
+#if HTTP_USE_GNUTLS
+/* Data to resume an earlier TLS session with a server so that a new
+ * connection does not need a full handshake.  */
+struct tls_resume_s
+{
+  struct tls_resume_s *next;
+  gnutls_datum_t data;        /* The session data from GNUTLS.  */
+  time_t stored;              /* Time the data was stored.  */
+  unsigned short port;
+  char *servername;           /* The SNI used for the session.  */
+  char host[1];               /* The server's name.  */
+};
+
+/* The cache of TLS session data, most recently used first.  */
+static struct tls_resume_s *tls_resume_cache;
+#endif /*HTTP_USE_GNUTLS*/
+
+
 /* Two flags to enable verbose and debug mode.  Although currently not
  * set-able a value > 1 for OPT_DEBUG enables debugging of the session
  * reference counting.  */
@@ -373,6 +437,10 @@ static strlist_t cfg_ca_certlist;
 /* The global callback for net activity.  */
 static void (*netactivity_cb)(void);
 
+/* The number of new and of reused connections.  */
+static metric_t metric_connects;
+static metric_t metric_reused;
+
 
 
 #if defined(HAVE_W32_SYSTEM) && !defined(HTTP_NO_WSASTARTUP)
@@ -715,6 +783,17 @@ http_register_netactivity_cb (void (*cb)(void))
 }
 
 
+/* Register the statistics of this module with the metrics module.  */
+void
+http_register_metrics (void)
+{
+  metric_connects = metrics_counter
+    ("http_connects_total", "New connections to HTTP servers.");
+  metric_reused = metrics_counter
+    ("http_reused_connections_total", "Requests using a kept connection.");
+}
+
+
 /* Call the netactivity callback if any.  */
 static void
 notify_netactivity (void)
@@ -782,6 +861,379 @@ http_session_release (http_session_t sess)
 }
 
 
+/* Close the connection of the unlinked pool entry CONN and release
+ * it.  */
+static void
+release_idle_conn (struct idle_conn_s *conn)
+{
+  if (!conn)
+    return;
+
+#if HTTP_USE_GNUTLS
+  if (conn->tls_session)
+    {
+      my_socket_t sock = gnutls_transport_get_ptr (conn->tls_session);
+
+      gnutls_bye (conn->tls_session, GNUTLS_SHUT_WR);
+      my_socket_unref (sock, NULL, NULL);
+      gnutls_deinit (conn->tls_session);
+      if (conn->certcred)
+        gnutls_certificate_free_credentials (conn->certcred);
+    }
+#endif /*HTTP_USE_GNUTLS*/
+  my_socket_unref (conn->sock, NULL, NULL);
+  xfree (conn->servername);
+  xfree (conn);
+}
+
+
+/* Close all idle connections.  */
+static void
+flush_idle_connections (void)
+{
+  struct idle_conn_s *conn;
+
+  while ((conn = idle_conns))
+    {
+      idle_conns = conn->next;
+      release_idle_conn (conn);
+    }
+}
+
+
+#if HTTP_USE_GNUTLS
+/* Release the unlinked cache item R.  */
+static void
+release_tls_resume (struct tls_resume_s *r)
+{
+  if (!r)
+    return;
+  gnutls_free (r->data.data);
+  xfree (r->servername);
+  xfree (r);
+}
+
+
+/* Return the pointer to the link of the item for HOST, PORT, and
+ * SERVERNAME in the TLS session cache.  The item is at *RETURN_VALUE
+ * if it exists.  */
+static struct tls_resume_s **
+find_tls_resume (const char *host, unsigned short port,
+                 const char *servername)
+{
+  struct tls_resume_s **rp;
+
+  for (rp = &tls_resume_cache; *rp; rp = &(*rp)->next)
+    if ((*rp)->port == port
+        && !ascii_strcasecmp ((*rp)->host, host)
+        && !strcmp ((*rp)->servername, servername))
+      break;
+  return rp;
+}
+
+
+/* Prepare the TLS session of HD to resume an earlier session with
+ * SERVER.  Must be called before the handshake.  */
+static void
+set_tls_resume (http_t hd, const char *server)
+{
+  struct tls_resume_s **rp, *r;
+  time_t now;
+  int rc;
+
+  if (!hd->session->servername)
+    return;
+  rp = find_tls_resume (server, hd->uri->port, hd->session->servername);
+  if (!(r = *rp))
+    return;
+
+  now = gnupg_get_time ();
+  if (now < r->stored || now - r->stored >= TLS_RESUME_TTL)
+    {
+      *rp = r->next;
+      release_tls_resume (r);
+      return;
+    }
+
+  rc = gnutls_session_set_data (hd->session->tls_session,
+                                r->data.data, r->data.size);
+  if (rc < 0)
+    {
+      if (opt_debug)
+        log_debug ("http.c:gnutls_session_set_data failed: %s\n",
+                   gnutls_strerror (rc));
+      *rp = r->next;
+      release_tls_resume (r);
+    }
+}
+
+
+/* Store the data to resume the TLS session of HD with SERVER.  This
+ * is called after a response has been received because with TLS 1.3
+ * the server sends the data only after the handshake.  */
+static void
+store_tls_resume (http_t hd, const char *server)
+{
+  struct tls_resume_s **rp, *r;
+  gnutls_datum_t data;
+  unsigned int count;
+  int rc;
+
+  if (!hd->session || !hd->session->tls_session || !hd->session->servername)
+    return;
+  if (gnutls_session_is_resumed (hd->session->tls_session))
+    return;  /* The cached data is still valid.  */
+
+  rc = gnutls_session_get_data2 (hd->session->tls_session, &data);
+  if (rc < 0 || !data.size)
+    return;
+
+  rp = find_tls_resume (server, hd->uri->port, hd->session->servername);
+  if ((r = *rp))
+    {
+      *rp = r->next;
+      gnutls_free (r->data.data);
+    }
+  else
+    {
+      r = xtrycalloc (1, sizeof *r + strlen (server));
+      if (r)
+        {
+          strcpy (r->host, server);
+          r->port = hd->uri->port;
+          r->servername = xtrystrdup (hd->session->servername);
+        }
+      if (!r || !r->servername)
+        {
+          if (r)
+            xfree (r);
+          gnutls_free (data.data);
+          return;
+        }
+    }
+  r->data = data;
+  r->stored = gnupg_get_time ();
+  r->next = tls_resume_cache;
+  tls_resume_cache = r;
+
+  /* Limit the size of the cache.  */
+  for (count=0, rp = &tls_resume_cache; *rp && count < MAX_TLS_RESUME;
+       count++)
+    rp = &(*rp)->next;
+  while ((r = *rp))
+    {
+      *rp = r->next;
+      release_tls_resume (r);
+    }
+}
+#endif /*HTTP_USE_GNUTLS*/
+
+
+/* Return true if the idle connection CONN can still be used.  An
+ * idle connection is not expected to be readable; if it is, the
+ * server has closed it or sent something we can't handle.  */
+static int
+idle_conn_usable_p (struct idle_conn_s *conn, time_t now)
+{
+  fd_set rfds;
+  struct timeval tv;
+
+  if (now < conn->stored || now - conn->stored >= IDLE_CONN_TTL)
+    return 0;
+
+  FD_ZERO (&rfds);
+  FD_SET (FD2INT (conn->sock->fd), &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  return !my_select (FD2NUM (conn->sock->fd)+1, &rfds, NULL, NULL, &tv);
+}
+
+
+/* Take a connection to SERVER at PORT suitable for HD from the pool
+ * of idle connections and transfer it to HD.  Returns true if a
+ * connection has been taken.  */
+static int
+take_idle_conn (http_t hd, const char *server, unsigned short port)
+{
+  struct idle_conn_s *conn, **connp;
+  http_session_t sess = hd->session;
+  const char *servername;
+  time_t now;
+
+  servername = (hd->uri->use_tls && sess)? sess->servername : NULL;
+  for (connp = &idle_conns; (conn = *connp); connp = &conn->next)
+    if (conn->port == port
+        && conn->use_tls == !!hd->uri->use_tls
+        && !ascii_strcasecmp (conn->host, server)
+        && (!conn->use_tls
+            || (conn->sessflags == sess->flags
+                && conn->verify_cb == sess->verify_cb
+                && servername && conn->servername
+                && !strcmp (conn->servername, servername))))
+      break;
+  if (!conn)
+    return 0;
+  *connp = conn->next;  /* Unlink.  */
+
+  /* The check may yield to other threads; thus we do it only after
+   * the entry has been unlinked.  */
+  now = gnupg_get_time ();
+  if (!idle_conn_usable_p (conn, now))
+    {
+      if (opt_debug)
+        log_debug ("http.c:dropping stale connection to %s:%hu\n",
+                   conn->host, conn->port);
+      release_idle_conn (conn);
+      return 0;
+    }
+
+  if (opt_debug)
+    log_debug ("http.c:reusing connection to %s:%hu\n",
+               conn->host, conn->port);
+
+  hd->sock = conn->sock;
+  conn->sock = NULL;
+#if HTTP_USE_GNUTLS
+  if (conn->tls_session)
+    {
+      /* Replace the fresh TLS session of the session object by the
+       * one of the kept connection.  */
+      close_tls_session (sess);
+      sess->tls_session = conn->tls_session;
+      sess->certcred = conn->certcred;
+      sess->servername = conn->servername;
+      sess->verify.done = conn->verify.done;
+      sess->verify.rc = conn->verify.rc;
+      sess->verify.status = conn->verify.status;
+      conn->tls_session = NULL;
+      conn->certcred = NULL;
+      conn->servername = NULL;
+    }
+#endif /*HTTP_USE_GNUTLS*/
+  hd->reused_conn = 1;
+  release_idle_conn (conn);
+  metric_add (metric_reused, 1);
+  return 1;
+}
+
+
+/* Prepare a pool entry for the connection of HD after the server
+ * sent the response header.  The connection is actually stored when
+ * the read stream is closed.  */
+static void
+prepare_keepalive (http_t hd)
+{
+  cookie_t cookie = hd->read_cookie;
+  struct idle_conn_s *conn;
+  const char *server, *s;
+
+  if (hd->is_http_0_9 || !cookie || !cookie->content_length_valid)
+    return;
+  s = http_get_header (hd, "Connection", 0);
+  if (!s || ascii_strcasecmp (s, "keep-alive"))
+    return;
+
+  server = *hd->uri->host ? hd->uri->host : "localhost";
+  conn = xtrycalloc (1, sizeof *conn + strlen (server));
+  if (!conn)
+    return;
+  strcpy (conn->host, server);
+  conn->port = hd->uri->port ? hd->uri->port : 80;
+  conn->use_tls = !!hd->uri->use_tls;
+  if (hd->session)
+    {
+      conn->sessflags = hd->session->flags;
+      conn->verify_cb = hd->session->verify_cb;
+    }
+  xfree (cookie->keepalive);
+  cookie->keepalive = conn;
+}
+
+
+/* Store the connection of the read cookie C in the pool if the
+ * response has been read completely.  Called when the read stream is
+ * closed.  */
+static void
+store_idle_conn (cookie_t c)
+{
+  struct idle_conn_s *conn = c->keepalive;
+  struct idle_conn_s **connp, *tmp, *drop = NULL;
+  unsigned int count;
+  char buffer[512];
+
+  c->keepalive = NULL;
+
+  /* Skip a short unread body (e.g. of an error response) so that the
+   * connection is positioned at the next response.  */
+  if (!c->body_done && c->content_length_valid
+      && c->content_length <= MAX_DRAIN_LEN)
+    while (!c->body_done && cookie_read (c, buffer, sizeof buffer) > 0)
+      ;
+
+  if (!c->body_done || c->pending.len || !c->sock
+      || (conn->use_tls && !(c->session && c->session->tls_session)))
+    {
+      xfree (conn);
+      return;
+    }
+
+#if HTTP_USE_GNUTLS
+  if (conn->use_tls)
+    {
+      http_session_t sess = c->session;
+
+      conn->tls_session = sess->tls_session;
+      conn->certcred = sess->certcred;
+      conn->servername = sess->servername;
+      conn->verify.done = sess->verify.done;
+      conn->verify.rc = sess->verify.rc;
+      conn->verify.status = sess->verify.status;
+      sess->tls_session = NULL;
+      sess->certcred = NULL;
+      sess->servername = NULL;
+    }
+#else
+  if (conn->use_tls)
+    {
+      xfree (conn);
+      return;
+    }
+#endif
+  conn->sock = my_socket_ref (c->sock);
+  conn->stored = gnupg_get_time ();
+
+  if (opt_debug)
+    log_debug ("http.c:keeping connection to %s:%hu\n",
+               conn->host, conn->port);
+
+  conn->next = idle_conns;
+  idle_conns = conn;
+
+  /* Limit the size of the pool and remove expired entries.  They
+   * are released only after the list has been updated because
+   * closing a connection may yield to other threads.  */
+  for (count=0, connp = &idle_conns; (tmp = *connp); )
+    if (count >= MAX_IDLE_CONNS
+        || tmp->stored > conn->stored
+        || conn->stored - tmp->stored >= IDLE_CONN_TTL)
+      {
+        *connp = tmp->next;
+        tmp->next = drop;
+        drop = tmp;
+      }
+    else
+      {
+        count++;
+        connp = &tmp->next;
+      }
+  while ((tmp = drop))
+    {
+      drop = tmp->next;
+      release_idle_conn (tmp);
+    }
+}
+
+
 /* Create a write stream and store it in the fp_write member.  Also
  * store the tls flag and the session.  */
 static gpg_error_t
@@ -1271,6 +1723,12 @@ http_wait_response (http_t hd)
     }
 
   err = parse_response (hd);
+#if HTTP_USE_GNUTLS
+  if (!err && use_tls)
+    store_tls_resume (hd, *hd->uri->host ? hd->uri->host : "localhost");
+#endif
+  if (!err && hd->want_keepalive && hd->req_type != HTTP_REQ_HEAD)
+    prepare_keepalive (hd);
 
   if (!err && newfpread)
     err = es_onclose (hd->fp_read, 1, fp_onclose_notification, hd);
@@ -2304,6 +2762,7 @@ run_gnutls_handshake (http_t hd, const char *server)
                                           my_gnutls_read);
       gnutls_transport_set_push_function (hd->session->tls_session,
                                           my_gnutls_write);
+      set_tls_resume (hd, server);
 
     handshake_again:
       do
@@ -2337,6 +2796,9 @@ run_gnutls_handshake (http_t hd, const char *server)
           goto leave;
         }
 
+      if (opt_debug && gnutls_session_is_resumed (hd->session->tls_session))
+        log_debug ("http.c:TLS session resumed\n");
+
       hd->session->verify.done = 0;
       if (tls_callback)
         err = tls_callback (hd, hd->session, 0);
@@ -2809,13 +3271,14 @@ mk_std_request (http_t hd,
   else
     snprintf (portstr, sizeof portstr, ":%u", port);
 
-  request = es_bsprintf ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s",
+  request = es_bsprintf ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s%s",
                          hd->req_type == HTTP_REQ_GET ? "GET" :
                          hd->req_type == HTTP_REQ_HEAD ? "HEAD" :
                          hd->req_type == HTTP_REQ_POST ? "POST" : "OOPS",
                          *relpath == '/' ? "" : "/", relpath,
                          httphost? httphost : server,
                          portstr,
+                         hd->want_keepalive? "Connection: keep-alive\r\n":"",
                          authstr? authstr:"");
   if (!request)
     {
@@ -2874,6 +3337,19 @@ send_request (ctrl_t ctrl,
   if ((err = get_proxy_for_url (hd, override_proxy, &proxy)))
     goto leave;
 
+  /* Connections are only reused if they go directly to the server.  */
+  hd->want_keepalive = (!proxy && !srvtag
+                        && !(hd->flags & (HTTP_FLAG_FORCE_TOR
+                                          | HTTP_FLAG_SHUTDOWN
+                                          | HTTP_FLAG_IGNORE_CL))
+#if HTTP_USE_NTBTLS
+                        && !hd->uri->use_tls
+#endif
+                        && (hd->req_type == HTTP_REQ_GET
+                            || hd->req_type == HTTP_REQ_POST));
+  if (hd->want_keepalive && take_idle_conn (hd, server, port))
+    goto connected;
+
   if (proxy && proxy->is_http_proxy)
     {
       use_http_proxy = 1;  /* We want to use a proxy for the connection.  */
@@ -2889,6 +3365,7 @@ send_request (ctrl_t ctrl,
     }
   if (err)
     goto leave;
+  metric_add (metric_connects, 1);
 
   hd->sock = my_socket_new (sock);
   if (!hd->sock)
@@ -2919,6 +3396,7 @@ send_request (ctrl_t ctrl,
   if (err)
     goto leave;
 
+ connected:
   if (auth || hd->uri->auth)
     {
       char *myauth;
@@ -3315,6 +3793,7 @@ parse_response (http_t hd)
         {
           cookie->content_length_valid = 1;
           cookie->content_length = string_to_u64 (s);
+          cookie->body_done = !cookie->content_length;
         }
     }
 
@@ -3610,12 +4089,305 @@ connect_with_timeout (assuan_fd_t sock,
 }
 
 
+/* The delay in milliseconds before the next connection attempt is
+ * started while the previous ones are still pending ("Connection
+ * Attempt Delay" of RFC 8305).  */
+#define CONNECT_ATTEMPT_DELAY 250
+
+/* The maximum number of concurrently pending connection attempts.  */
+#define MAX_CONNECT_ATTEMPTS  8
+
+
+/* Switch SOCK into non-blocking mode if NONBLOCK is set or back into
+ * blocking mode.  */
+static gpg_error_t
+set_socket_nonblocking (assuan_fd_t sock, int nonblock)
+{
+#ifdef HAVE_W32_SYSTEM
+  unsigned long along = !!nonblock;
+
+  if (ioctlsocket (FD2INT (sock), FIONBIO, &along))
+    return my_wsagetlasterror ();
+#else
+  int oflags;
+
+  oflags = fcntl (sock, F_GETFL, 0);
+  if (oflags == -1
+      || fcntl (sock, F_SETFL, (nonblock? (oflags | O_NONBLOCK)
+                                : (oflags & ~O_NONBLOCK))))
+    return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+#endif
+  return 0;
+}
+
+
+/* Return the pending error of the socket SOCK after a non-blocking
+ * connect.  */
+static gpg_error_t
+get_connect_result (assuan_fd_t sock)
+{
+  int syserr;
+  socklen_t slen;
+
+  slen = sizeof (syserr);
+  if (getsockopt (FD2INT(sock), SOL_SOCKET, SO_ERROR,
+                  (void*)&syserr, &slen) < 0)
+    {
+      /* Assume that this is Solaris which returns the error in ERRNO.  */
+      return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+    }
+  if (syserr)
+    return gpg_err_make (default_errsource, gpg_err_code_from_errno (syserr));
+  return 0; /* Connected.  */
+}
+
+
+/* Connect to one of the addresses in AIBUF the way RFC 8305
+ * ("Happy Eyeballs") describes it.  The addresses are tried with
+ * alternating address families and a new attempt is started every
+ * CONNECT_ATTEMPT_DELAY milliseconds or as soon as an attempt fails,
+ * while the earlier attempts are kept pending.  The first
+ * established connection wins.  FLAGS, V4_VALID, and V6_VALID select
+ * the address families; the latter two are cleared if the system
+ * does not support the family.  TIMEOUT is the connect timeout in
+ * milliseconds for each attempt with 0 for the system's default.
+ *
+ * On success the socket is stored at R_SOCK and 0 is returned.  If
+ * no connection could be established ASSUAN_INVALID_FD is stored at
+ * R_SOCK, the last error at R_LAST_ERR, and 0 is returned.  Other
+ * errors are returned directly.  R_ANYHOSTADDR is set if at least
+ * one socket has been created.  */
+static gpg_error_t
+connect_parallel (dns_addrinfo_t aibuf, unsigned int flags,
+                  int *v4_valid, int *v6_valid, unsigned int timeout,
+                  int *r_anyhostaddr, gpg_error_t *r_last_err,
+                  assuan_fd_t *r_sock)
+{
+  gpg_error_t err = 0;
+  struct {
+    assuan_fd_t sock;
+    unsigned long long deadline;  /* In milliseconds or 0.  */
+  } pending[MAX_CONNECT_ATTEMPTS];
+  int npending = 0;
+  dns_addrinfo_t ai, *cand = NULL;
+  int ncand, nextcand, i, j, n;
+  int family;
+  unsigned long long now, next_start, wakeup;
+  assuan_fd_t sock;
+  fd_set wset;
+#ifdef HAVE_W32_SYSTEM
+  fd_set eset;
+#endif
+  struct timeval tval;
+  int maxfd;
+
+  *r_sock = ASSUAN_INVALID_FD;
+
+  /* Build the list of candidates.  Starting with the family of the
+   * first address the families are alternated.  */
+  for (ncand=0, ai = aibuf; ai; ai = ai->next)
+    ncand++;
+  if (!ncand)
+    return 0;
+  cand = xtrycalloc (ncand, sizeof *cand);
+  if (!cand)
+    return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+  family = aibuf->family;
+  for (n=0; n < ncand; family = (family == AF_INET6? AF_INET : AF_INET6))
+    {
+      /* Take the first unused address of FAMILY; if there is none
+       * take the first unused one of any family.  */
+      for (j=0; j < 2; j++)
+        {
+          for (ai = aibuf; ai; ai = ai->next)
+            if (j || ai->family == family)
+              {
+                for (i=0; i < n && cand[i] != ai; i++)
+                  ;
+                if (i == n)
+                  break;
+              }
+          if (ai)
+            break;
+        }
+      cand[n++] = ai;
+    }
+
+  now = next_start = metrics_clock () / 1000;
+  nextcand = 0;
+  for (;;)
+    {
+      /* Start the next attempt if it is due.  */
+      if (nextcand < ncand && npending < MAX_CONNECT_ATTEMPTS
+          && (now >= next_start || !npending))
+        {
+          ai = cand[nextcand++];
+          if (ai->family == AF_INET
+              && ((flags & HTTP_FLAG_IGNORE_IPv4) || !*v4_valid))
+            continue;
+          if (ai->family == AF_INET6
+              && ((flags & HTTP_FLAG_IGNORE_IPv6) || !*v6_valid))
+            continue;
+
+          sock = my_sock_new_for_addr (ai->addr, ai->socktype, ai->protocol);
+          if (sock == ASSUAN_INVALID_FD)
+            {
+              if (errno == EAFNOSUPPORT)
+                {
+                  if (ai->family == AF_INET)
+                    *v4_valid = 0;
+                  if (ai->family == AF_INET6)
+                    *v6_valid = 0;
+                  continue;
+                }
+
+              err = gpg_err_make (default_errsource,
+                                  gpg_err_code_from_syserror ());
+              log_error ("error creating socket: %s\n", gpg_strerror (err));
+              goto leave;
+            }
+          *r_anyhostaddr = 1;
+
+          if (use_socks (ai->addr))
+            {
+              /* The Tor proxy is always connected on its own.  */
+              err = connect_with_timeout (sock, (struct sockaddr *)ai->addr,
+                                          ai->addrlen, timeout);
+              if (!err)
+                goto connected;
+              *r_last_err = err;
+              err = 0;
+              assuan_sock_close (sock);
+              continue;
+            }
+
+          err = set_socket_nonblocking (sock, 1);
+          if (!err && !assuan_sock_connect (sock, (struct sockaddr *)ai->addr,
+                                            ai->addrlen))
+            goto connected;  /* Immediate connect.  */
+          if (!err)
+            err = gpg_err_make (default_errsource,
+                                gpg_err_code_from_syserror ());
+          if (gpg_err_code (err) != GPG_ERR_EINPROGRESS
+#ifdef HAVE_W32_SYSTEM
+              && gpg_err_code (err) != GPG_ERR_EAGAIN
+#endif
+              )
+            {
+              *r_last_err = err;
+              err = 0;
+              assuan_sock_close (sock);
+              continue;  /* Proceed with the next address.  */
+            }
+          err = 0;
+
+          if (opt_debug)
+            log_debug ("http.c:connect_server: attempt %d started\n",
+                       nextcand);
+          pending[npending].sock = sock;
+          pending[npending].deadline = timeout? now + timeout : 0;
+          npending++;
+          next_start = now + CONNECT_ATTEMPT_DELAY;
+        }
+
+      if (!npending)
+        {
+          if (nextcand < ncand)
+            continue;
+          break;  /* All attempts failed.  */
+        }
+
+      /* Wait until an attempt finishes, a timeout expires, or it is
+       * time to start the next attempt.  */
+      FD_ZERO (&wset);
+      maxfd = 0;
+      wakeup = nextcand < ncand? next_start : 0;
+      for (i=0; i < npending; i++)
+        {
+          FD_SET (FD2INT (pending[i].sock), &wset);
+          if (FD2NUM (pending[i].sock) > maxfd)
+            maxfd = FD2NUM (pending[i].sock);
+          if (pending[i].deadline
+              && (!wakeup || pending[i].deadline < wakeup))
+            wakeup = pending[i].deadline;
+        }
+#ifdef HAVE_W32_SYSTEM
+      /* Windows reports a failed connect via the exception set.  */
+      eset = wset;
+#endif
+      if (wakeup)
+        {
+          wakeup = wakeup > now? wakeup - now : 0;
+          tval.tv_sec = wakeup / 1000;
+          tval.tv_usec = (wakeup % 1000) * 1000;
+        }
+#ifdef HAVE_W32_SYSTEM
+      n = my_select (maxfd+1, NULL, &wset, &eset, wakeup? &tval : NULL);
+#else
+      n = my_select (maxfd+1, NULL, &wset, NULL, wakeup? &tval : NULL);
+#endif
+      if (n < 0 && errno != EINTR)
+        {
+          *r_last_err = gpg_err_make (default_errsource,
+                                      gpg_err_code_from_syserror ());
+          break;
+        }
+      now = metrics_clock () / 1000;
+
+      for (i=0; i < npending; i++)
+        {
+          sock = pending[i].sock;
+          if (n > 0 && (FD_ISSET (FD2INT (sock), &wset)
+#ifdef HAVE_W32_SYSTEM
+                        || FD_ISSET (FD2INT (sock), &eset)
+#endif
+                        ))
+            {
+              err = get_connect_result (sock);
+              if (!err)
+                {
+                  pending[i] = pending[--npending];
+                  set_socket_nonblocking (sock, 0);
+                  goto connected;
+                }
+            }
+          else if (pending[i].deadline && now >= pending[i].deadline)
+            err = gpg_err_make (default_errsource, GPG_ERR_ETIMEDOUT);
+          else
+            continue;
+
+          /* This attempt failed; start the next one right away.  */
+          *r_last_err = err;
+          err = 0;
+          assuan_sock_close (sock);
+          pending[i--] = pending[--npending];
+          next_start = now;
+        }
+    }
+  goto leave;
+
+ connected:
+  if (opt_debug)
+    log_debug ("http.c:connect_server: connected after %d attempt(s)\n",
+               nextcand);
+  notify_netactivity ();
+  *r_sock = sock;
+
+ leave:
+  for (i=0; i < npending; i++)
+    assuan_sock_close (pending[i].sock);
+  xfree (cand);
+  return err;
+}
+
+
 /* Actually connect to a server.  On success 0 is returned and the
  * file descriptor for the socket is stored at R_SOCK; on error an
  * error code is returned and ASSUAN_INVALID_FD is stored at R_SOCK.
  * TIMEOUT is the connect timeout in milliseconds.  Note that the
  * function tries to connect to all known addresses and the timeout is
- * for each one. */
+ * for each one; the attempts for the addresses of one host are run in
+ * parallel with staggered starts.  */
 static gpg_error_t
 connect_server (ctrl_t ctrl, const char *server, unsigned short port,
                 unsigned int flags, const char *srvtag, unsigned int timeout,
@@ -3697,7 +4469,7 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
   connected = 0;
   for (srv=0; srv < srvcount && !connected; srv++)
     {
-      dns_addrinfo_t aibuf, ai;
+      dns_addrinfo_t aibuf;
 
       if (opt_debug)
         log_debug ("http.c:connect_server: trying name='%s' port=%hu\n",
@@ -3714,50 +4486,16 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
         }
       hostfound = 1;
 
-      for (ai = aibuf; ai && !connected; ai = ai->next)
+      err = connect_parallel (aibuf, flags, &v4_valid, &v6_valid, timeout,
+                              &anyhostaddr, &last_err, &sock);
+      if (err)
         {
-          if (ai->family == AF_INET
-              && ((flags & HTTP_FLAG_IGNORE_IPv4) || !v4_valid))
-            continue;
-          if (ai->family == AF_INET6
-              && ((flags & HTTP_FLAG_IGNORE_IPv6) || !v6_valid))
-            continue;
-
-          if (sock != ASSUAN_INVALID_FD)
-            assuan_sock_close (sock);
-          sock = my_sock_new_for_addr (ai->addr, ai->socktype, ai->protocol);
-          if (sock == ASSUAN_INVALID_FD)
-            {
-              if (errno == EAFNOSUPPORT)
-                {
-                  if (ai->family == AF_INET)
-                    v4_valid = 0;
-                  if (ai->family == AF_INET6)
-                    v6_valid = 0;
-                  continue;
-                }
-
-              err = gpg_err_make (default_errsource,
-                                  gpg_err_code_from_syserror ());
-              log_error ("error creating socket: %s\n", gpg_strerror (err));
-              free_dns_addrinfo (aibuf);
-              xfree (serverlist);
-              return err;
-            }
-
-          anyhostaddr = 1;
-          err = connect_with_timeout (sock, (struct sockaddr *)ai->addr,
-                                      ai->addrlen, timeout);
-          if (err)
-            {
-              last_err = err;
-            }
-          else
-            {
-              connected = 1;
-              notify_netactivity ();
-            }
+          free_dns_addrinfo (aibuf);
+          xfree (serverlist);
+          return err;
         }
+      if (sock != ASSUAN_INVALID_FD)
+        connected = 1;
       free_dns_addrinfo (aibuf);
     }
 
@@ -4049,7 +4787,10 @@ cookie_read (void *cookie, void *buffer, size_t size)
       if (nread < c->content_length)
         c->content_length -= nread;
       else
-        c->content_length = 0;
+        {
+          c->content_length = 0;
+          c->body_done = 1;
+        }
     }
 
   return (gpgrt_ssize_t)nread;
@@ -4184,6 +4925,9 @@ cookie_close (void *cookie)
   if (!c)
     return 0;
 
+  if (c->keepalive)
+    store_idle_conn (c);
+
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -4600,6 +5344,18 @@ http_status2string (unsigned int status)
 void
 http_reinitialize (void)
 {
+  flush_idle_connections ();
+#if HTTP_USE_GNUTLS
+  {
+    struct tls_resume_s *r;
+
+    while ((r = tls_resume_cache))
+      {
+        tls_resume_cache = r->next;
+        release_tls_resume (r);
+      }
+  }
+#endif /*HTTP_USE_GNUTLS*/
 #ifdef HAVE_W32_SYSTEM
   w32_get_internet_session (1);  /* Clear our session.  */
 #endif /*HAVE_W32_SYSTEM*/
@@ -138,6 +138,7 @@ void http_register_tls_ca (const char *fname);
 void http_register_cfg_ca (const char *fname);
 
 void http_register_netactivity_cb (void (*cb)(void));
+void http_register_metrics (void);
 
 
 gpg_error_t http_session_new (http_session_t *r_session,
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "misc.h"
@@ -333,17 +334,401 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
 }
 
 
+/* Write the key data from INFP to OUTFP for KS_GET --if-changed.
+ * NAME identifies the key and VAL has the validators of the response.
+ * If the data is the same as returned by the last fetch of NAME
+ * nothing is written and R_UNCHANGED is incremented; otherwise
+ * R_ANY_DATA is set.  */
+static gpg_error_t
+copy_if_changed (const char *name, ks_validators_t val,
+                 estream_t infp, estream_t outfp,
+                 int *r_any_data, unsigned int *r_unchanged)
+{
+  gpg_error_t err;
+  estream_t memfp;
+  void *data;
+  size_t datalen;
+
+  memfp = es_fopenmem (0, "w+b");
+  if (!memfp)
+    return gpg_error_from_syserror ();
+  err = copy_stream (infp, memfp);
+  if (err)
+    {
+      es_fclose (memfp);
+      return err;
+    }
+  if (es_fclose_snatch (memfp, &data, &datalen))
+    return gpg_error_from_syserror ();
+
+  if (ks_validator_update (name, val, data, datalen))
+    (*r_unchanged)++;
+  else if (es_write (outfp, data, datalen, NULL))
+    err = gpg_error_from_syserror ();
+  else
+    *r_any_data = 1;
+  es_free (data);
+  return err;
+}
+
+
+/* A job for hkp_get_parallel; one for each pattern.  */
+struct hkp_get_job_s
+{
+  const char *pattern;
+  char *name;          /* The validator name or NULL.  */
+  struct ks_validators_s val;
+  estream_t fp;        /* Memory stream with the fetched data.  */
+  gpg_error_t err;
+  int fetched;         /* ks_hkp_get succeeded.  */
+  int done;
+};
+
+/* The state shared by the worker threads of hkp_get_parallel.  */
+struct hkp_get_parm_s
+{
+  ctrl_t ctrl;
+  parsed_uri_t uri;
+  struct hkp_get_job_s *jobs;
+  unsigned int njobs;
+  unsigned int next;      /* Index of the next job to start.  */
+  unsigned int nthreads;  /* Number of running workers.  */
+  int stop;               /* Do not start new jobs.  */
+  npth_mutex_t lock;
+  npth_cond_t cond;
+};
+
+
+/* Worker thread for hkp_get_parallel.  The fetched keys are buffered
+ * in memory so that they can be written out in the order of the
+ * patterns.  */
+static void *
+hkp_get_worker (void *arg)
+{
+  struct hkp_get_parm_s *parm = arg;
+  struct hkp_get_job_s *job;
+  estream_t infp;
+
+  npth_mutex_lock (&parm->lock);
+  while (!parm->stop && parm->next < parm->njobs)
+    {
+      job = parm->jobs + parm->next++;
+      npth_mutex_unlock (&parm->lock);
+
+      job->err = ks_hkp_get (parm->ctrl, parm->uri, job->pattern,
+                             job->name? &job->val : NULL, &infp);
+      if (!job->err && !infp)
+        job->fetched = 1;  /* Not modified.  */
+      else if (!job->err)
+        {
+          job->fetched = 1;
+          job->fp = es_fopenmem (0, "w+b");
+          if (!job->fp)
+            job->err = gpg_error_from_syserror ();
+          else
+            job->err = copy_stream (infp, job->fp);
+          es_fclose (infp);
+        }
+
+      npth_mutex_lock (&parm->lock);
+      job->done = 1;
+      npth_cond_broadcast (&parm->cond);
+    }
+  parm->nthreads--;
+  npth_cond_broadcast (&parm->cond);
+  npth_mutex_unlock (&parm->lock);
+  return NULL;
+}
+
+
+/* Get the keys for all PATTERNS from the HKP keyserver URI using up
+ * to opt.keyserver_parallel concurrent requests.  The results are
+ * written to OUTFP in the order of PATTERNS.  As with the sequential
+ * loop in ks_action_get the error of a failed lookup is stored at
+ * R_FIRST_ERR and R_ANY_DATA is set if any key was written; only a
+ * failure to read or write the data is returned.  With IF_CHANGED
+ * keys which did not change are not written but counted at
+ * R_UNCHANGED.  */
+static gpg_error_t
+hkp_get_parallel (ctrl_t ctrl, parsed_uri_t uri, strlist_t patterns,
+                  int if_changed, estream_t outfp, gpg_error_t *r_first_err,
+                  int *r_any_data, unsigned int *r_unchanged)
+{
+  gpg_error_t err = 0;
+  struct hkp_get_parm_s parm;
+  struct hkp_get_job_s *job;
+  npth_attr_t tattr;
+  npth_t thread;
+  strlist_t sl;
+  unsigned int i, n;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = ctrl;
+  parm.uri = uri;
+  for (sl = patterns; sl; sl = sl->next)
+    parm.njobs++;
+  parm.jobs = xtrycalloc (parm.njobs, sizeof *parm.jobs);
+  if (!parm.jobs)
+    return gpg_error_from_syserror ();
+  for (i=0, sl = patterns; sl; sl = sl->next, i++)
+    {
+      parm.jobs[i].pattern = sl->d;
+      if (if_changed)
+        {
+          parm.jobs[i].name = strconcat (uri->original, " ", sl->d, NULL);
+          if (!parm.jobs[i].name)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          ks_validator_get (parm.jobs[i].name, &parm.jobs[i].val);
+        }
+    }
+
+  if (npth_mutex_init (&parm.lock, NULL))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (npth_cond_init (&parm.cond, NULL))
+    {
+      err = gpg_error_from_syserror ();
+      npth_mutex_destroy (&parm.lock);
+      goto leave;
+    }
+
+  n = opt.keyserver_parallel;
+  if (n > parm.njobs)
+    n = parm.njobs;
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  npth_mutex_lock (&parm.lock);
+  for (i=0; i < n; i++)
+    {
+      parm.nthreads++;
+      if (npth_create (&thread, &tattr, hkp_get_worker, &parm))
+        {
+          parm.nthreads--;
+          break;
+        }
+    }
+  npth_mutex_unlock (&parm.lock);
+  npth_attr_destroy (&tattr);
+  if (!parm.nthreads)
+    {
+      /* No thread at all - do all the work ourself.  */
+      parm.nthreads++;
+      hkp_get_worker (&parm);
+    }
+
+  /* Write out the results as soon as they are available.  */
+  for (i=0; i < parm.njobs && !err; i++)
+    {
+      job = parm.jobs + i;
+      npth_mutex_lock (&parm.lock);
+      while (!job->done)
+        npth_cond_wait (&parm.cond, &parm.lock);
+      npth_mutex_unlock (&parm.lock);
+
+      if (job->err && !job->fetched)
+        *r_first_err = job->err;  /* No such key on the server.  */
+      else if (job->err)
+        err = job->err;
+      else if (!job->fp)
+        (*r_unchanged)++;  /* Not modified.  */
+      else if (job->name)
+        {
+          es_rewind (job->fp);
+          err = copy_if_changed (job->name, &job->val, job->fp, outfp,
+                                 r_any_data, r_unchanged);
+        }
+      else
+        {
+          es_rewind (job->fp);
+          err = copy_stream (job->fp, outfp);
+          if (!err)
+            *r_any_data = 1;
+        }
+      es_fclose (job->fp);
+      job->fp = NULL;
+    }
+
+  /* Wait for the workers to terminate.  After an error no new
+   * requests are started.  */
+  npth_mutex_lock (&parm.lock);
+  parm.stop = 1;
+  while (parm.nthreads)
+    npth_cond_wait (&parm.cond, &parm.lock);
+  npth_mutex_unlock (&parm.lock);
+
+  for (i=0; i < parm.njobs; i++)
+    es_fclose (parm.jobs[i].fp);
+  npth_cond_destroy (&parm.cond);
+  npth_mutex_destroy (&parm.lock);
+
+ leave:
+  for (i=0; i < parm.njobs; i++)
+    xfree (parm.jobs[i].name);
+  xfree (parm.jobs);
+  return err;
+}
+
+
+/* A request which is currently being processed.  Concurrent
+ * identical requests from other sessions do not start their own fetch
+ * but wait for the first one and then write out its result.  */
+struct inflight_s
+{
+  struct inflight_s *next;
+  unsigned int refcount;  /* The leader and all waiting sessions.  */
+  int done;               /* The result is available.  */
+  gpg_error_t err;        /* The result of the request.  */
+  void *data;             /* The fetched data or NULL.  */
+  size_t datalen;
+  char key[1];            /* Identifies the request.  */
+};
+static struct inflight_s *inflight_list;
+static npth_mutex_t inflight_lock = NPTH_MUTEX_INITIALIZER;
+static npth_cond_t inflight_cond = NPTH_COND_INITIALIZER;
+
+/* Statistics.  */
+static unsigned long inflight_coalesced;
+
+typedef gpg_error_t (*inflight_fnc_t) (ctrl_t ctrl, void *opaque,
+                                       estream_t outfp);
+
+
+/* Run FNC (CTRL, OPAQUE, OUTFP) unless a request with KEY is already
+ * in flight in which case we wait for that request and write its
+ * data to OUTFP.  The key includes the per-session settings which
+ * affect a fetch.  OUTFP may be NULL.  */
+static gpg_error_t
+coalesce_request (ctrl_t ctrl, const char *request, inflight_fnc_t fnc,
+                  void *opaque, estream_t outfp)
+{
+  gpg_error_t err;
+  struct inflight_s *fl;
+  estream_t memfp;
+  void *data = NULL;
+  size_t datalen = 0;
+  char *key;
+  int leader = 0;
+
+  key = strconcat (ctrl->http_proxy? ctrl->http_proxy : "",
+                   ctrl->http_no_crl? "\n1\n" : "\n0\n", request, NULL);
+  if (!key)
+    return gpg_error_from_syserror ();
+
+  npth_mutex_lock (&inflight_lock);
+  for (fl = inflight_list; fl; fl = fl->next)
+    if (!strcmp (fl->key, key))
+      break;
+  if (fl)
+    {
+      fl->refcount++;
+      inflight_coalesced++;
+      if (opt.verbose)
+        log_info ("waiting for an identical request in flight\n");
+      while (!fl->done)
+        npth_cond_wait (&inflight_cond, &inflight_lock);
+    }
+  else if ((fl = xtrycalloc (1, sizeof *fl + strlen (key))))
+    {
+      strcpy (fl->key, key);
+      fl->refcount = 1;
+      fl->next = inflight_list;
+      inflight_list = fl;
+      leader = 1;
+    }
+  npth_mutex_unlock (&inflight_lock);
+  xfree (key);
+
+  if (!fl)  /* Out of core - do the request without coalescing.  */
+    return fnc (ctrl, opaque, outfp);
+
+  if (leader)
+    {
+      memfp = es_fopenmem (0, "w+b");
+      if (!memfp)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = fnc (ctrl, opaque, memfp);
+          if (es_fclose_snatch (memfp, &data, &datalen))
+            {
+              if (!err)
+                err = gpg_error_from_syserror ();
+              data = NULL;
+              datalen = 0;
+            }
+        }
+
+      npth_mutex_lock (&inflight_lock);
+      fl->err = err;
+      fl->data = data;
+      fl->datalen = datalen;
+      fl->done = 1;
+      /* Remove it from the list so that a new request fetches a
+       * fresh copy.  */
+      if (inflight_list == fl)
+        inflight_list = fl->next;
+      else
+        {
+          struct inflight_s *prev;
+
+          for (prev = inflight_list; prev->next != fl; prev = prev->next)
+            ;
+          prev->next = fl->next;
+        }
+      npth_cond_broadcast (&inflight_cond);
+      npth_mutex_unlock (&inflight_lock);
+    }
+
+  /* FL can't go away while we hold a reference.  */
+  if (outfp && fl->datalen
+      && es_write (outfp, fl->data, fl->datalen, NULL))
+    err = gpg_error_from_syserror ();
+  else
+    err = fl->err;
+
+  npth_mutex_lock (&inflight_lock);
+  if (!--fl->refcount)
+    {
+      es_free (fl->data);
+      xfree (fl);
+    }
+  npth_mutex_unlock (&inflight_lock);
+  return err;
+}
+
+
+/* Print the coalescing statistics.  */
+void
+ks_action_print_stats (ctrl_t ctrl)
+{
+  dirmngr_status_helpf (ctrl, "ks-action: coalesced=%lu\n",
+                        inflight_coalesced);
+}
+
+
 /* Get the requested keys (matching PATTERNS) using all configured
-   keyservers and write the result to the provided output stream.  */
-gpg_error_t
-ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
-	       strlist_t patterns, unsigned int ks_get_flags,
-               gnupg_isotime_t newer, estream_t outfp)
+   keyservers and write the result to the provided output stream.
+   With KS_GET_FLAG_IF_CHANGED keys from HKP and HTTP keyservers
+   which did not change since the last fetch are not written; their
+   number is sent with an UNCHANGED status line.  */
+static gpg_error_t
+do_ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
+                  strlist_t patterns, unsigned int ks_get_flags,
+                  gnupg_isotime_t newer, estream_t outfp)
 {
   gpg_error_t err = 0;
   gpg_error_t first_err = 0;
   int any_server = 0;
   int any_data = 0;
+  unsigned int unchanged = 0;
+  int if_changed = !!(ks_get_flags & KS_GET_FLAG_IF_CHANGED);
+  struct ks_validators_s val;
+  char *name = NULL;
   strlist_t sl;
   uri_item_t uri;
   estream_t infp;
@@ -377,11 +762,33 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
       (void)newer;
 #endif
 
-      if (is_hkp_s || is_http_s || is_ldap)
+      if (is_hkp_s && patterns->next && opt.keyserver_parallel > 1)
+        {
+          any_server = 1;
+          err = hkp_get_parallel (ctrl, uri->parsed_uri, patterns,
+                                  if_changed, outfp, &first_err, &any_data,
+                                  &unchanged);
+        }
+      else if (is_hkp_s || is_http_s || is_ldap)
         {
           any_server = 1;
           for (sl = patterns; !err && sl; sl = sl->next)
             {
+              /* The validators are only used for HKP and HTTP.  */
+              xfree (name);
+              name = NULL;
+              if (if_changed && !is_ldap)
+                {
+                  name = strconcat (uri->parsed_uri->original, " ", sl->d,
+                                    NULL);
+                  if (!name)
+                    {
+                      err = gpg_error_from_syserror ();
+                      break;
+                    }
+                  ks_validator_get (name, &val);
+                }
+
 #if USE_LDAP
 	      if (is_ldap)
 		err = ks_ldap_get (ctrl, uri->parsed_uri, sl->d, ks_get_flags,
@@ -389,11 +796,12 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 	      else
 #endif
               if (is_hkp_s)
-                err = ks_hkp_get (ctrl, uri->parsed_uri, sl->d, &infp);
+                err = ks_hkp_get (ctrl, uri->parsed_uri, sl->d,
+                                  name? &val : NULL, &infp);
               else if (is_http_s)
-                err = ks_http_fetch (ctrl, uri->parsed_uri->original,
-                                     KS_HTTP_FETCH_NOCACHE,
-                                     &infp);
+                err = ks_http_fetch_cond (ctrl, uri->parsed_uri->original,
+                                          KS_HTTP_FETCH_NOCACHE,
+                                          name? &val : NULL, &infp);
               else
                 BUG ();
 
@@ -407,6 +815,15 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
                   first_err = err;
                   err = 0;
                 }
+              else if (!infp)
+                unchanged++;  /* Not modified.  */
+              else if (name)
+                {
+                  err = copy_if_changed (name, &val, infp, outfp,
+                                         &any_data, &unchanged);
+                  es_fclose (infp);
+                  infp = NULL;
+                }
               else
                 {
                   err = copy_stream (infp, outfp);
@@ -419,14 +836,90 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
                 }
             }
         }
-      if (any_data)
+      if (any_data || unchanged)
         break; /* Stop loop after a keyserver returned something.  */
     }
+  xfree (name);
 
   if (!any_server)
     err = gpg_error (GPG_ERR_NO_KEYSERVER);
-  else if (!err && first_err && !any_data)
+  else if (!err && first_err && !any_data && !unchanged)
     err = first_err;
+  if (!err && if_changed)
+    err = dirmngr_status_printf (ctrl, "UNCHANGED", "%u", unchanged);
+  return err;
+}
+
+
+/* The arguments of do_ks_action_get for coalesce_request.  */
+struct ks_get_parm_s
+{
+  uri_item_t keyservers;
+  strlist_t patterns;
+  unsigned int ks_get_flags;
+  const char *newer;
+};
+
+static gpg_error_t
+ks_get_cb (ctrl_t ctrl, void *opaque, estream_t outfp)
+{
+  struct ks_get_parm_s *parm = opaque;
+
+  return do_ks_action_get (ctrl, parm->keyservers, parm->patterns,
+                           parm->ks_get_flags, (char *)parm->newer, outfp);
+}
+
+
+/* Get the requested keys (matching PATTERNS) using all configured
+   keyservers and write the result to the provided output stream.
+   Concurrent identical requests are coalesced; this is not done with
+   KS_GET_FLAG_IF_CHANGED because the validators are per session nor
+   with the LDAP --first and --next state.  */
+gpg_error_t
+ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
+	       strlist_t patterns, unsigned int ks_get_flags,
+               gnupg_isotime_t newer, estream_t outfp)
+{
+  gpg_error_t err;
+  struct ks_get_parm_s parm;
+  membuf_t mb;
+  char numbuf[20];
+  char *key;
+  uri_item_t uri;
+  strlist_t sl;
+
+  if (!patterns
+      || (ks_get_flags & (KS_GET_FLAG_IF_CHANGED
+                          | KS_GET_FLAG_FIRST | KS_GET_FLAG_NEXT)))
+    return do_ks_action_get (ctrl, keyservers, patterns, ks_get_flags,
+                             newer, outfp);
+
+  init_membuf (&mb, 256);
+  snprintf (numbuf, sizeof numbuf, "get %u ", ks_get_flags);
+  put_membuf_str (&mb, numbuf);
+  put_membuf_str (&mb, newer? newer : "");
+  for (uri = keyservers; uri; uri = uri->next)
+    {
+      put_membuf_str (&mb, "\n");
+      put_membuf_str (&mb, uri->uri);
+    }
+  put_membuf_str (&mb, "\n");
+  for (sl = patterns; sl; sl = sl->next)
+    {
+      put_membuf_str (&mb, "\n");
+      put_membuf_str (&mb, sl->d);
+    }
+  put_membuf (&mb, "", 1);
+  key = get_membuf (&mb, NULL);
+  if (!key)
+    return gpg_error_from_syserror ();
+
+  parm.keyservers = keyservers;
+  parm.patterns = patterns;
+  parm.ks_get_flags = ks_get_flags;
+  parm.newer = newer;
+  err = coalesce_request (ctrl, key, ks_get_cb, &parm, outfp);
+  xfree (key);
   return err;
 }
 
@@ -434,8 +927,8 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 /* Retrieve keys from URL and write the result to the provided output
  * stream OUTFP.  If OUTFP is NULL the data is written to the bit
  * bucket. */
-gpg_error_t
-ks_action_fetch (ctrl_t ctrl, const char *url, estream_t outfp)
+static gpg_error_t
+do_ks_action_fetch (ctrl_t ctrl, const char *url, estream_t outfp)
 {
   gpg_error_t err = 0;
   estream_t infp;
@@ -487,6 +980,33 @@ ks_action_fetch (ctrl_t ctrl, const char *url, estream_t outfp)
 }
 
 
+static gpg_error_t
+ks_fetch_cb (ctrl_t ctrl, void *opaque, estream_t outfp)
+{
+  return do_ks_action_fetch (ctrl, opaque, outfp);
+}
+
+
+/* Same as do_ks_action_fetch but concurrent requests for the same
+ * URL, as they are in particular done for WKD, share one fetch.  */
+gpg_error_t
+ks_action_fetch (ctrl_t ctrl, const char *url, estream_t outfp)
+{
+  gpg_error_t err;
+  char *key;
+
+  if (!url)
+    return gpg_error (GPG_ERR_INV_URI);
+
+  key = strconcat ("fetch ", url, NULL);
+  if (!key)
+    return gpg_error_from_syserror ();
+  err = coalesce_request (ctrl, key, ks_fetch_cb, (void *)url, outfp);
+  xfree (key);
+  return err;
+}
+
+
 
 /* Send an OpenPGP key to all keyservers.  The key in {DATA,DATALEN}
    is expected to be in OpenPGP binary transport format.  The metadata
@@ -71,6 +71,14 @@
 /* Number of retries done in case of transient errors.  */
 #define SEND_REQUEST_EXTRA_RETRIES 5
 
+/* The response time and error rate of a host are tracked as
+ * exponentially weighted moving averages; a new sample contributes
+ * 1/HOST_EWMA_WEIGHT.  Measurements older than HOST_RTT_MAXAGE
+ * seconds are ignored for the host selection so that a host which
+ * was slow once gets another chance.  */
+#define HOST_EWMA_WEIGHT 8
+#define HOST_RTT_MAXAGE  (15*60)
+
 
 enum ks_protocol { KS_PROTOCOL_HKP, KS_PROTOCOL_HKPS, KS_PROTOCOL_MAX };
 
@@ -99,6 +107,10 @@ struct hostinfo_s
                                      lookup.  */
   time_t died_at;    /* The time the host was marked dead.  If this is
                         0 the host has been manually marked dead.  */
+  unsigned int rtt;  /* Average response time in milliseconds.  */
+  unsigned int errrate; /* Average failure rate in 1/1000.  */
+  unsigned int nreq; /* Number of measured requests.  */
+  time_t measured_at;/* Time of the last measurement.  */
   char *cname;       /* Canonical name of the host.  Only set if this
                         is a pool or NAME has a numerical IP address.  */
   char *iporname;    /* Numeric IP address or name for printing.  */
@@ -148,6 +160,10 @@ create_new_hostinfo (const char *name)
   hi->did_srv_lookup = 0;
   hi->iporname_valid = 0;
   hi->died_at = 0;
+  hi->rtt = 0;
+  hi->errrate = 0;
+  hi->nreq = 0;
+  hi->measured_at = 0;
   hi->cname = NULL;
   hi->iporname = NULL;
   hi->port[KS_PROTOCOL_HKP] = 0;
@@ -222,9 +238,23 @@ host_in_pool_p (hostinfo_t hi, int tblidx)
 }
 
 
-/* Select a random host.  Consult HI->pool which indices into the global
-   hosttable.  Returns index into HI->pool or -1 if no host could be
-   selected.  */
+/* Return the selection score of the host HI; lower is better.  A
+ * host without a recent measurement scores best so that it gets
+ * measured.  */
+static unsigned long
+host_score (hostinfo_t hi, time_t now)
+{
+  if (!hi->nreq || now - hi->measured_at > HOST_RTT_MAXAGE)
+    return 0;
+  /* Each percent of failures counts as 2% of additional latency.  */
+  return (unsigned long)(hi->rtt + 1) * (1000 + 2 * hi->errrate) / 1000;
+}
+
+
+/* Select a host.  Consult HI->pool which indices into the global
+   hosttable.  Two random alive hosts are picked and the one with the
+   better response time and error rate is used.  Returns index into
+   HI->pool or -1 if no host could be selected.  */
 static int
 select_random_host (hostinfo_t hi)
 {
@@ -257,7 +287,19 @@ select_random_host (hostinfo_t hi)
   if (tblsize == 1)  /* Save a get_uint_nonce.  */
     pidx = tbl[0];
   else
-    pidx = tbl[get_uint_nonce () % tblsize];
+    {
+      unsigned int r = get_uint_nonce ();
+      int pidx2;
+      time_t now = gnupg_get_time ();
+
+      /* Use two distinct random indices from one nonce.  */
+      pidx  = tbl[r % tblsize];
+      pidx2 = tbl[((r % tblsize) + 1 + (r / tblsize) % (tblsize - 1))
+                  % tblsize];
+      if (host_score (hosttable[pidx2], now)
+          < host_score (hosttable[pidx], now))
+        pidx = pidx2;
+    }
 
   xfree (tbl);
   return pidx;
@@ -722,16 +764,15 @@ map_host (ctrl_t ctrl, const char *name, const char *srvtag, int force_reselect,
 }
 
 
-/* Mark the host NAME as dead.  NAME may be given as an URL.  Returns
-   true if a host was really marked as dead or was already marked dead
-   (e.g. by a concurrent session).  */
+/* Return the index into the hosttable for the host NAME or -1 if not
+   found.  NAME may be given as an URL; localhost is never found.  */
 static int
-mark_host_dead (const char *name)
+find_hostinfo_by_url (const char *name)
 {
   const char *host;
   char *host_buffer = NULL;
   parsed_uri_t parsed_uri = NULL;
-  int done = 0;
+  int idx = -1;
 
   if (name && *name
       && !http_parse_uri (&parsed_uri, name, HTTP_PARSE_NO_SCHEME_CHECK))
@@ -740,7 +781,7 @@ mark_host_dead (const char *name)
         {
           host_buffer = strconcat ("[", parsed_uri->host, "]", NULL);
           if (!host_buffer)
-            log_error ("out of core in mark_host_dead");
+            log_error ("out of core in find_hostinfo_by_url");
           host = host_buffer;
         }
       else
@@ -750,27 +791,86 @@ mark_host_dead (const char *name)
     host = name;
 
   if (host && *host && strcmp (host, "localhost"))
-    {
-      hostinfo_t hi;
-      int idx;
-
-      idx = find_hostinfo (host);
-      if (idx != -1)
-        {
-          hi = hosttable[idx];
-          log_info ("marking host '%s' as dead%s\n",
-                    hi->name, hi->dead? " (again)":"");
-          hi->dead = 1;
-          hi->died_at = gnupg_get_time ();
-          if (!hi->died_at)
-            hi->died_at = 1;
-          done = 1;
-        }
-    }
+    idx = find_hostinfo (host);
 
   http_release_parsed_uri (parsed_uri);
   xfree (host_buffer);
-  return done;
+  return idx;
+}
+
+
+/* Mark the host NAME as dead.  NAME may be given as an URL.  Returns
+   true if a host was really marked as dead or was already marked dead
+   (e.g. by a concurrent session).  */
+static int
+mark_host_dead (const char *name)
+{
+  hostinfo_t hi;
+  int idx;
+
+  idx = find_hostinfo_by_url (name);
+  if (idx == -1)
+    return 0;
+
+  hi = hosttable[idx];
+  log_info ("marking host '%s' as dead%s\n",
+            hi->name, hi->dead? " (again)":"");
+  hi->dead = 1;
+  hi->died_at = gnupg_get_time ();
+  if (!hi->died_at)
+    hi->died_at = 1;
+  return 1;
+}
+
+
+/* Return a monotonic time in milliseconds.  */
+static unsigned long
+get_msec_time (void)
+{
+  struct timespec ts;
+
+  npth_clock_gettime (&ts);
+  return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* Record the response time of MSEC milliseconds for a request to the
+   host NAME which may be given as an URL.  FAILED is true if the
+   request failed due to the host or the network; the time is then not
+   recorded.  */
+static void
+note_host_response (const char *name, unsigned long msec, int failed)
+{
+  hostinfo_t hi;
+  int idx;
+
+  if (npth_mutex_lock (&hosttable_lock))
+    log_fatal ("failed to acquire mutex\n");
+
+  idx = find_hostinfo_by_url (name);
+  if (idx != -1)
+    {
+      hi = hosttable[idx];
+      if (msec > 60*60*1000)
+        msec = 60*60*1000;
+      if (!failed && !hi->nreq)
+        hi->rtt = msec;
+      else if (!failed)
+        hi->rtt = ((HOST_EWMA_WEIGHT - 1) * (unsigned long)hi->rtt + msec)
+                   / HOST_EWMA_WEIGHT;
+      hi->errrate = ((HOST_EWMA_WEIGHT - 1) * hi->errrate
+                     + (failed? 1000 : 0)) / HOST_EWMA_WEIGHT;
+      if (!failed || hi->nreq)
+        hi->nreq++;
+      hi->measured_at = gnupg_get_time ();
+      if (DBG_NETWORK)
+        log_debug ("hkp: host '%s' %s after %lums (avg %ums, %u.%u%% errors)\n",
+                   hi->name, failed? "failed":"responded", msec,
+                   hi->rtt, hi->errrate / 10, hi->errrate % 10);
+    }
+
+  if (npth_mutex_unlock (&hosttable_lock))
+    log_fatal ("failed to release mutex\n");
 }
 
 
@@ -872,8 +972,10 @@ ks_hkp_print_hosttable (ctrl_t ctrl)
   time_t curtime;
   char *p, *died;
   const char *diedstr;
+  char rttbuf[50];
 
-  err = ks_print_help (ctrl, "hosttable (idx, ipv6, ipv4, dead, name, time):");
+  err = ks_print_help (ctrl, "hosttable (idx, ipv6, ipv4, dead, name, time,"
+                       " [rtt, errors]):");
   if (err)
     return err;
 
@@ -958,7 +1060,12 @@ ks_hkp_print_hosttable (ctrl_t ctrl)
             hi->iporname_valid = 1;
           }
 
-        err = ks_printf_help (ctrl, "%3d %s %s %s %s%s%s%s%s%s%s\n",
+        if (hi->nreq)
+          snprintf (rttbuf, sizeof rttbuf, "  [%ums, %u.%u%% errors]",
+                    hi->rtt, hi->errrate / 10, hi->errrate % 10);
+        else
+          *rttbuf = 0;
+        err = ks_printf_help (ctrl, "%3d %s %s %s %s%s%s%s%s%s%s%s\n",
                               idx,
                               hi->onion? "O" : hi->v6? "6":" ",
                               hi->v4? "4":" ",
@@ -969,7 +1076,8 @@ ks_hkp_print_hosttable (ctrl_t ctrl)
                               hi->iporname? ")":"",
                               diedstr? "  (":"",
                               diedstr? diedstr:"",
-                              diedstr? ")":""   );
+                              diedstr? ")":"",
+                              rttbuf);
         xfree (died);
         if (err)
 	  goto leave;
@@ -1218,12 +1326,16 @@ ks_hkp_reload (void)
    not NULL it will be used as HTTP "Host" header.  If POST_CB is not
    NULL a post request is used and that callback is called to allow
    writing the post data.  If R_HTTP_STATUS is not NULL, the http
-   status code will be stored there.  */
+   status code will be stored there.  If VAL is not NULL a conditional
+   request is sent; if the server tells that the resource was not
+   modified, VAL->NOT_MODIFIED is set and NULL is stored at R_FP.
+   Otherwise the validators of the response are stored at VAL.  */
 static gpg_error_t
 send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
               const char *httphost, unsigned int httpflags,
               gpg_error_t (*post_cb)(void *, http_t), void *post_cb_value,
-              estream_t *r_fp, unsigned int *r_http_status)
+              ks_validators_t val, estream_t *r_fp,
+              unsigned int *r_http_status)
 {
   gpg_error_t err;
   http_session_t session = NULL;
@@ -1232,6 +1344,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
   estream_t fp = NULL;
   char *request_buffer = NULL;
   parsed_uri_t uri = NULL;
+  unsigned long started;
 
   *r_fp = NULL;
 
@@ -1256,6 +1369,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
   http_session_set_log_cb (session, cert_log_cb);
   http_session_set_timeout (session, ctrl->timeout);
 
+  started = get_msec_time ();
   err = http_open (ctrl, &http,
                    post_cb? HTTP_REQ_POST : HTTP_REQ_GET,
                    request,
@@ -1278,6 +1392,8 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
          we're good with both HTTP 1.0 and 1.1.  */
       es_fputs ("Pragma: no-cache\r\n"
                 "Cache-Control: no-cache\r\n", fp);
+      if (val)
+        ks_validator_put_headers (val, fp);
       if (post_cb)
         err = post_cb (post_cb_value, http);
       if (!err)
@@ -1292,6 +1408,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
       /* Fixme: After a redirection we show the old host name.  */
       log_error (_("error connecting to '%s': %s\n"),
                  hostportstr, gpg_strerror (err));
+      note_host_response (request, 0, 1);
       goto leave;
     }
 
@@ -1302,8 +1419,11 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
     {
       log_error (_("error reading HTTP response for '%s': %s\n"),
                  hostportstr, gpg_strerror (err));
+      note_host_response (request, 0, 1);
       goto leave;
     }
+  note_host_response (request, get_msec_time () - started,
+                      http_get_status_code (http) >= 500);
 
   if (http_get_tls_info (http, NULL))
     {
@@ -1319,8 +1439,17 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
     {
     case 200:
       err = 0;
+      if (val)
+        ks_validator_set_from_response (val, http);
       break; /* Success.  */
 
+    case 304:
+      if (!val)
+        goto bad_status;
+      val->not_modified = 1;
+      err = 0;
+      goto leave;
+
     case 301:
     case 302:
     case 307:
@@ -1341,6 +1470,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
       goto once_more;
 
     default:
+    bad_status:
       log_error (_("error accessing '%s': http status %u\n"),
                  request, http_get_status_code (http));
       switch (http_get_status_code (http))
@@ -1585,7 +1715,7 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 
   /* Send the request.  */
   err = send_request (ctrl, request, hostport, httphost, httpflags,
-                      NULL, NULL, &fp, &http_status);
+                      NULL, NULL, NULL, &fp, &http_status);
   if (handle_send_request_error (ctrl, err, request, http_status,
                                  &tries, &extra_tries))
     {
@@ -1641,9 +1771,12 @@ ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 /* Get the key described key the KEYSPEC string from the keyserver
    identified by URI.  On success R_FP has an open stream to read the
    data.  The data will be provided in a format GnuPG can import
-   (either a binary OpenPGP message or an armored one).  */
+   (either a binary OpenPGP message or an armored one).  If VAL is not
+   NULL a conditional request is sent; see send_request.  If the key
+   was not modified NULL is stored at R_FP.  */
 gpg_error_t
-ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
+ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
+            ks_validators_t val, estream_t *r_fp)
 {
   gpg_error_t err;
   KEYDB_SEARCH_DESC desc;
@@ -1750,7 +1883,7 @@ ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec, estream_t *r_fp)
 
   /* Send the request.  */
   err = send_request (ctrl, request, hostport, httphost, httpflags,
-                      NULL, NULL, &fp, &http_status);
+                      NULL, NULL, val, &fp, &http_status);
   if (handle_send_request_error (ctrl, err, request, http_status,
                                  &tries, &extra_tries))
     {
@@ -1867,7 +2000,7 @@ ks_hkp_put (ctrl_t ctrl, parsed_uri_t uri, const void *data, size_t datalen)
 
   /* Send the request.  */
   err = send_request (ctrl, request, hostport, httphost, 0,
-                      put_post_cb, &parm, &fp, &http_status);
+                      put_post_cb, &parm, NULL, &fp, &http_status);
   if (handle_send_request_error (ctrl, err, request, http_status,
                                  &tries, &extra_tries))
     {
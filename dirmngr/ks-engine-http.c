@@ -69,6 +69,18 @@ ks_http_help (ctrl_t ctrl, parsed_uri_t uri)
 gpg_error_t
 ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
                estream_t *r_fp)
+{
+  return ks_http_fetch_cond (ctrl, url, flags, NULL, r_fp);
+}
+
+
+/* Same as ks_http_fetch but if VAL is not NULL a conditional request
+ * is sent.  If the server tells that the data was not modified,
+ * VAL->NOT_MODIFIED is set and NULL is stored at R_FP.  Otherwise the
+ * validators of the response are stored at VAL.  */
+gpg_error_t
+ks_http_fetch_cond (ctrl_t ctrl, const char *url, unsigned int flags,
+                    ks_validators_t val, estream_t *r_fp)
 {
   gpg_error_t err;
   http_session_t session = NULL;
@@ -130,6 +142,8 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
       if ((flags & KS_HTTP_FETCH_NOCACHE))
         es_fputs ("Pragma: no-cache\r\n"
                   "Cache-Control: no-cache\r\n", fp);
+      if (val)
+        ks_validator_put_headers (val, fp);
       http_start_data (http);
       if (es_ferror (fp))
         err = gpg_error_from_syserror ();
@@ -172,8 +186,17 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
     {
     case 200:
       err = 0;
+      if (val)
+        ks_validator_set_from_response (val, http);
       break; /* Success.  */
 
+    case 304:
+      if (!val)
+        goto bad_status;
+      val->not_modified = 1;
+      err = 0;
+      goto leave;
+
     case 301:
     case 302:
     case 307:
@@ -194,6 +217,7 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
       goto once_more;
 
     default:
+    bad_status:
       log_error (_("error accessing '%s': http status %u\n"),
                  url, http_get_status_code (http));
       switch (http_get_status_code (http))
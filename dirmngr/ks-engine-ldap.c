@@ -34,6 +34,8 @@
 # include <winldap.h>
 # include <winber.h>
 # include <sddl.h>
+#else
+# include <poll.h>
 #endif
 
 
@@ -85,6 +87,7 @@ struct ks_engine_ldap_local_s
 /*-- prototypes --*/
 static char *map_rid_to_dn (ctrl_t ctrl, const char *rid);
 static char *basedn_from_rootdse (ctrl_t ctrl, parsed_uri_t uri);
+static void my_ldap_release (LDAP *ldap_conn);
 
 
 
@@ -330,7 +333,7 @@ ks_ldap_clear_state (struct ks_engine_ldap_local_s *state)
 {
   if (state->ldap_conn)
     {
-      ldap_unbind (state->ldap_conn);
+      my_ldap_release (state->ldap_conn);
       state->ldap_conn = NULL;
     }
   if (state->message)
@@ -532,6 +535,228 @@ keyspec_to_ldap_filter (const char *keyspec, char **filter, int only_exact,
 
 
 
+/* Bound connections are kept in a pool so that a series of short
+ * queries to the same server does not need to connect, bind and
+ * interrogate the server again and again.  A connection is taken
+ * from the idle list by my_ldap_connect_1 and put back by
+ * my_ldap_release.  The key describes all connection parameters
+ * including the credentials.  */
+#define LDAP_POOL_MAX_IDLE     8
+#define LDAP_POOL_IDLE_TIMEOUT 120  /* seconds */
+
+struct ldap_pool_item_s
+{
+  struct ldap_pool_item_s *next;
+  LDAP *ldap_conn;
+  char *key;
+  char *basedn;              /* The basedn as returned by my_ldap_connect.  */
+  unsigned int serverinfo;
+  time_t stamp;              /* Time the connection was put back.  */
+};
+typedef struct ldap_pool_item_s *ldap_pool_item_t;
+
+/* The connections in use and the idle connections, most recently
+ * used first.  */
+static ldap_pool_item_t ldap_pool_busy;
+static ldap_pool_item_t ldap_pool_idle;
+static unsigned int ldap_pool_nidle;
+
+
+/* Close the connection of the unlinked pool item R and release R.  */
+static void
+ldap_pool_release_item (ldap_pool_item_t r)
+{
+  if (!r)
+    return;
+  if (r->ldap_conn)
+    ldap_unbind (r->ldap_conn);
+  xfree (r->key);
+  xfree (r->basedn);
+  xfree (r);
+}
+
+
+/* Return true if the idle connection LDAP_CONN is still usable.  An
+ * idle connection must not have any pending input; if it is readable
+ * the server closed it or sent a notice of disconnection.  */
+static int
+ldap_pool_conn_alive_p (LDAP *ldap_conn)
+{
+#if defined(HAVE_LDAP_GET_OPTION) && defined(LDAP_OPT_DESC) \
+    && !defined(HAVE_W32_SYSTEM)
+  int fd = -1;
+  struct pollfd pfd;
+
+  if (ldap_get_option (ldap_conn, LDAP_OPT_DESC, &fd) || fd == -1)
+    return 0;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if (poll (&pfd, 1, 0))
+    return 0;
+#else
+  (void)ldap_conn;
+#endif
+  return 1;
+}
+
+
+/* Take an idle connection for KEY from the pool.  On success the
+ * connection, a malloced copy of its basedn and the server info are
+ * stored at the provided addresses and true is returned.  */
+static int
+ldap_pool_take (const char *key, LDAP **r_conn, char **r_basedn,
+                unsigned int *r_serverinfo)
+{
+  ldap_pool_item_t *rp, r;
+  time_t now = gnupg_get_time ();
+
+  for (rp = &ldap_pool_idle; (r = *rp); )
+    {
+      if (strcmp (r->key, key))
+        {
+          rp = &r->next;
+          continue;
+        }
+      *rp = r->next;
+      ldap_pool_nidle--;
+      if (r->stamp + LDAP_POOL_IDLE_TIMEOUT <= now || r->stamp > now
+          || !ldap_pool_conn_alive_p (r->ldap_conn))
+        {
+          ldap_pool_release_item (r);
+          continue;
+        }
+
+      *r_basedn = NULL;
+      if (r->basedn && !(*r_basedn = xtrystrdup (r->basedn)))
+        {
+          ldap_pool_release_item (r);
+          return 0;
+        }
+      *r_conn = r->ldap_conn;
+      *r_serverinfo = r->serverinfo;
+      r->next = ldap_pool_busy;
+      ldap_pool_busy = r;
+      return 1;
+    }
+  return 0;
+}
+
+
+/* Register the new connection LDAP_CONN as being in use.  KEY is
+ * malloced and its ownership is transferred to this function.  */
+static void
+ldap_pool_register (LDAP *ldap_conn, char *key, const char *basedn,
+                    unsigned int serverinfo)
+{
+  ldap_pool_item_t r;
+
+  r = xtrycalloc (1, sizeof *r);
+  if (!r || (basedn && !(r->basedn = xtrystrdup (basedn))))
+    {
+      /* Without an item the connection is closed on release.  */
+      xfree (r);
+      xfree (key);
+      return;
+    }
+  r->ldap_conn = ldap_conn;
+  r->key = key;
+  r->serverinfo = serverinfo;
+  r->next = ldap_pool_busy;
+  ldap_pool_busy = r;
+}
+
+
+/* Release the connection LDAP_CONN as returned by my_ldap_connect.
+ * The connection is put into the pool unless the last operation
+ * indicated a connection problem.  */
+static void
+my_ldap_release (LDAP *ldap_conn)
+{
+  ldap_pool_item_t *rp, r, old;
+  int rc = LDAP_SUCCESS;
+
+  if (!ldap_conn)
+    return;
+
+  for (rp = &ldap_pool_busy; (r = *rp); rp = &r->next)
+    if (r->ldap_conn == ldap_conn)
+      break;
+  if (!r)
+    {
+      ldap_unbind (ldap_conn);
+      return;
+    }
+  *rp = r->next;
+
+#if defined(HAVE_LDAP_GET_OPTION) && defined(LDAP_OPT_RESULT_CODE)
+  if (ldap_get_option (ldap_conn, LDAP_OPT_RESULT_CODE, &rc))
+    rc = LDAP_OTHER;
+#endif
+  if (rc == LDAP_SERVER_DOWN || rc == LDAP_TIMEOUT
+      || rc == LDAP_CONNECT_ERROR || rc == LDAP_UNAVAILABLE
+      || rc == LDAP_BUSY || rc == LDAP_OTHER)
+    {
+      ldap_pool_release_item (r);
+      return;
+    }
+
+  r->stamp = gnupg_get_time ();
+  r->next = ldap_pool_idle;
+  ldap_pool_idle = r;
+  ldap_pool_nidle++;
+  while (ldap_pool_nidle > LDAP_POOL_MAX_IDLE)
+    {
+      /* Close the least recently used connection.  */
+      for (rp = &ldap_pool_idle; (*rp)->next; rp = &(*rp)->next)
+        ;
+      old = *rp;
+      *rp = NULL;
+      ldap_pool_nidle--;
+      ldap_pool_release_item (old);
+    }
+}
+
+
+/* Close idle connections which have not been used for some time.  If
+ * ALL is set all idle connections are closed.  */
+static void
+ldap_pool_expire (int all)
+{
+  ldap_pool_item_t *rp, r;
+  time_t now = gnupg_get_time ();
+
+  for (rp = &ldap_pool_idle; (r = *rp); )
+    {
+      if (all || r->stamp + LDAP_POOL_IDLE_TIMEOUT <= now || r->stamp > now)
+        {
+          *rp = r->next;
+          ldap_pool_nidle--;
+          ldap_pool_release_item (r);
+        }
+      else
+        rp = &r->next;
+    }
+}
+
+
+/* Housekeeping function called from the housekeeping thread.  */
+void
+ks_ldap_housekeeping (void)
+{
+  ldap_pool_expire (0);
+}
+
+
+/* Reload (SIGHUP) action for this module.  */
+void
+ks_ldap_reload (void)
+{
+  ldap_pool_expire (1);
+}
+
+
+
 /* Helper for my_ldap_connect.  */
 static char *
 interrogate_ldap_dn (LDAP *ldap_conn, const char *basedn_search,
@@ -613,20 +838,25 @@ interrogate_ldap_dn (LDAP *ldap_conn, const char *basedn_search,
  * to the base DN for the PGP key space, several flags will be stored
  * at SERVERINFO, If you pass NULL, then the value won't be returned.
  * It is the caller's responsibility to release *LDAP_CONNP with
- * ldap_unbind and to xfree *BASEDNP.  On error these variables are
- * cleared.
+ * my_ldap_release and to xfree *BASEDNP.  On error these variables
+ * are cleared.  If GIVEN_SERVER is not NULL it is used instead of
+ * URI.  The connection may be taken from the pool of idle
+ * connections.
  *
  * Note: On success, you still need to check that *BASEDNP is valid.
  * If it is NULL, then the server does not appear to be an OpenPGP
  * keyserver.  */
 static gpg_error_t
-my_ldap_connect (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
-                 char **r_basedn, char **r_host, int *r_use_tls,
-                 unsigned int *r_serverinfo)
+my_ldap_connect_1 (parsed_uri_t uri, ldap_server_t given_server,
+                   unsigned int generic, LDAP **ldap_connp,
+                   char **r_basedn, char **r_host, int *r_use_tls,
+                   unsigned int *r_serverinfo)
 {
   gpg_error_t err = 0;
   int lerr;
   ldap_server_t server = NULL;
+  char *poolkey = NULL;
+  int pooled = 0;
   LDAP *ldap_conn = NULL;
   char *basedn = NULL;
   char *host = NULL;   /* Host to use.  */
@@ -649,9 +879,12 @@ my_ldap_connect (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
     *r_use_tls = 0;
   *r_serverinfo = 0;
 
-  if (uri->opaque)
+  if (given_server || uri->opaque)
     {
-      server = ldapserver_parse_one (uri->path, NULL, 0);
+      if (given_server)
+        server = given_server;
+      else
+        server = ldapserver_parse_one (uri->path, NULL, 0);
       if (!server)
         return gpg_error (GPG_ERR_LDAP_OTHER);
       host = server->host;
@@ -688,6 +921,20 @@ my_ldap_connect (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
         }
     }
 
+  /* Reuse an idle connection established with the same parameters.  */
+  poolkey = xtryasprintf ("%u|%s|%d|%s|%s|%s|%d%d%d",
+                          generic, host? host : "", port,
+                          bindname? bindname : "", password? password : "",
+                          basedn_arg? basedn_arg : "",
+                          use_tls, use_ntds, use_areconly);
+  if (poolkey && ldap_pool_take (poolkey, &ldap_conn, &basedn, r_serverinfo))
+    {
+      if (opt.verbose)
+        log_info ("ldap reusing connection to '%s:%d'\n", host, port);
+      pooled = 1;
+      goto out;
+    }
+
   if (opt.verbose)
     log_info ("ldap connect to '%s:%d:%s:%s:%s:%s%s%s'%s\n",
               host, port,
@@ -1016,7 +1263,15 @@ my_ldap_connect (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
                    (*r_serverinfo & SERVERINFO_PGPKEYV2)? "pgpKeyV2":"pgpKey");
     }
 
-  ldapserver_list_free (server);
+  if (server != given_server)
+    ldapserver_list_free (server);
+
+  if (!err && !pooled && poolkey)
+    {
+      ldap_pool_register (ldap_conn, poolkey, basedn, *r_serverinfo);
+      poolkey = NULL;
+    }
+  xfree (poolkey);
 
   if (err)
     {
@@ -1041,6 +1296,18 @@ my_ldap_connect (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
   return err;
 }
 
+
+/* Connect to the LDAP server described by URI.  See my_ldap_connect_1
+ * for a description.  */
+static gpg_error_t
+my_ldap_connect (parsed_uri_t uri, unsigned int generic, LDAP **ldap_connp,
+                 char **r_basedn, char **r_host, int *r_use_tls,
+                 unsigned int *r_serverinfo)
+{
+  return my_ldap_connect_1 (uri, NULL, generic, ldap_connp,
+                            r_basedn, r_host, r_use_tls, r_serverinfo);
+}
+
 /* Extract keys from an LDAP reply and write them out to the output
    stream OUTPUT in a format GnuPG can import (either the OpenPGP
    binary format or armored format).  */
@@ -1839,7 +2106,7 @@ ks_ldap_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
   xfree (host);
 
   if (ldap_conn)
-    ldap_unbind (ldap_conn);
+    my_ldap_release (ldap_conn);
 
   xfree (filter);
 
@@ -2139,7 +2406,7 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
   xfree (basedn);
 
   if (ldap_conn)
-    ldap_unbind (ldap_conn);
+    my_ldap_release (ldap_conn);
 
   xfree (filter);
 
@@ -2971,7 +3238,7 @@ ks_ldap_put (ctrl_t ctrl, parsed_uri_t uri,
     es_fclose (dump);
 
   if (ldap_conn)
-    ldap_unbind (ldap_conn);
+    my_ldap_release (ldap_conn);
 
   xfree (basedn);
 
@@ -3237,10 +3504,157 @@ ks_ldap_query (ctrl_t ctrl, parsed_uri_t uri, unsigned int ks_get_flags,
   xfree (host);
 
   if (ldap_conn)
-    ldap_unbind (ldap_conn);
+    my_ldap_release (ldap_conn);
 
   xfree (filter);
   xfree (filter_arg_buffer);
 
   return err;
 }
+
+
+/* Write a record of TYPE with LENGTH bytes of DATA to FP using the
+ * format of "dirmngr_ldap --multi".  */
+static gpg_error_t
+write_multi_record (estream_t fp, int type, const void *data, size_t length)
+{
+  unsigned char hdr[5];
+
+  hdr[0] = type;
+  hdr[1] = (length >> 24);
+  hdr[2] = (length >> 16);
+  hdr[3] = (length >> 8);
+  hdr[4] = length;
+  if (es_fwrite (hdr, 5, 1, fp) != 1
+      || (length && es_fwrite (data, length, 1, fp) != 1))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Run the LDAP searches given by FILTERS against SERVER using a
+ * pooled connection.  Each filter may use the extended syntax of
+ * ldap_parse_extfilter.  All returned attributes are written to a
+ * new memory stream stored at R_FP using the same format as
+ * "dirmngr_ldap --multi" so that the caller can parse it like the
+ * output of the wrapper process.  */
+gpg_error_t
+ks_ldap_fetch_certs (ctrl_t ctrl, ldap_server_t server, strlist_t filters,
+                     estream_t *r_fp)
+{
+  gpg_error_t err;
+  int lerr;
+  LDAP *ldap_conn = NULL;
+  char *basedn = NULL;
+  unsigned int serverinfo;
+  estream_t fp = NULL;
+  LDAPMessage *message = NULL;
+  LDAPMessage *item;
+  struct timeval tv;
+  char *base, *filter;
+  int scope;
+
+  (void)ctrl;
+
+  *r_fp = NULL;
+
+  err = my_ldap_connect_1 (NULL, server, 1 /*generic*/, &ldap_conn,
+                           &basedn, NULL, NULL, &serverinfo);
+  if (err)
+    goto leave;
+
+  fp = es_fopenmem (0, "rw");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (; filters && !err; filters = filters->next)
+    {
+      scope = -1;
+      err = ldap_parse_extfilter (filters->d, 0, &base, &scope, &filter);
+      if (err)
+        break;
+      if (filter && !*filter)
+        {
+          xfree (filter);
+          filter = NULL;
+        }
+
+      if (opt.verbose)
+        log_info ("ldap fetching using base '%s' filter '%s'\n",
+                  base? base : basedn? basedn : "", filter? filter : "");
+
+      tv.tv_sec = opt.ldaptimeout;
+      tv.tv_usec = 0;
+      npth_unprotect ();
+      lerr = ldap_search_st (ldap_conn, base? base : basedn,
+                             scope == -1? LDAP_SCOPE_SUBTREE : scope,
+                             filter, NULL, 0,
+                             opt.ldaptimeout? &tv : NULL, &message);
+      npth_protect ();
+      if (lerr == LDAP_SIZELIMIT_EXCEEDED)
+        err = write_multi_record (fp, 'E', "truncated", 9);
+      else if (lerr && lerr != LDAP_NO_SUCH_OBJECT)
+        {
+          log_error ("searching '%s' failed: %s\n",
+                     filter, ldap_err2string (lerr));
+          err = gpg_error (ldap_err_to_gpg_err (lerr));
+        }
+      xfree (base);
+      xfree (filter);
+
+      for (npth_unprotect (), item = ldap_first_entry (ldap_conn, message),
+             npth_protect ();
+           item && !err;
+           npth_unprotect (), item = ldap_next_entry (ldap_conn, item),
+             npth_protect ())
+        {
+          BerElement *berctx;
+          char *attr;
+          struct berval **values;
+          int idx;
+
+          err = write_multi_record (fp, 'I', NULL, 0);
+          for (npth_unprotect (),
+                 attr = ldap_first_attribute (ldap_conn, item, &berctx),
+                 npth_protect ();
+               attr && !err;
+               npth_unprotect (),
+                 attr = ldap_next_attribute (ldap_conn, item, berctx),
+                 npth_protect ())
+            {
+              npth_unprotect ();
+              values = ldap_get_values_len (ldap_conn, item, attr);
+              npth_protect ();
+              if (values)
+                {
+                  err = write_multi_record (fp, 'A', attr, strlen (attr));
+                  for (idx=0; values[idx] && !err; idx++)
+                    err = write_multi_record (fp, 'V', values[idx]->bv_val,
+                                              values[idx]->bv_len);
+                  ldap_value_free_len (values);
+                }
+              ldap_memfree (attr);
+            }
+          ber_free (berctx, 0);
+        }
+      ldap_msgfree (message);
+      message = NULL;
+    }
+
+  if (!err)
+    {
+      es_rewind (fp);
+      *r_fp = fp;
+      fp = NULL;
+    }
+
+ leave:
+  es_fclose (fp);
+  xfree (basedn);
+  if (ldap_conn)
+    my_ldap_release (ldap_conn);
+  return err;
+}
@@ -30,6 +30,18 @@
 #define KS_GET_FLAG_ONLY_AD   8  /* Do this only if we have an AD.  */
 #define KS_GET_FLAG_ROOTDSE  16  /* Get the rootDSE.  */
 #define KS_GET_FLAG_SUBST    32  /* Substiture variables.  */
+#define KS_GET_FLAG_IF_CHANGED 64 /* Skip keys not changed since last.  */
+
+
+/* The validators of a fetched key used for a conditional request.
+ * Values which do not fit are not used.  */
+struct ks_validators_s
+{
+  char etag[128];               /* The ETag or an empty string.       */
+  char last_modified[40];       /* The Last-Modified date or empty.   */
+  unsigned int not_modified:1;  /* The server answered 304.           */
+};
+typedef struct ks_validators_s *ks_validators_t;
 
 
 /*-- ks-action.c --*/
@@ -45,7 +57,8 @@ gpg_error_t ks_hkp_help (ctrl_t ctrl, parsed_uri_t uri);
 gpg_error_t ks_hkp_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
                            estream_t *r_fp, unsigned int *r_http_status);
 gpg_error_t ks_hkp_get (ctrl_t ctrl, parsed_uri_t uri,
-                        const char *keyspec, estream_t *r_fp);
+                        const char *keyspec, ks_validators_t val,
+                        estream_t *r_fp);
 gpg_error_t ks_hkp_put (ctrl_t ctrl, parsed_uri_t uri,
                         const void *data, size_t datalen);
 
@@ -60,6 +73,16 @@ gpg_error_t ks_hkp_put (ctrl_t ctrl, parsed_uri_t uri,
 gpg_error_t ks_http_help (ctrl_t ctrl, parsed_uri_t uri);
 gpg_error_t ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
                            estream_t *r_fp);
+gpg_error_t ks_http_fetch_cond (ctrl_t ctrl, const char *url,
+                                unsigned int flags, ks_validators_t val,
+                                estream_t *r_fp);
+
+/*-- ks-validator.c --*/
+void ks_validator_get (const char *name, ks_validators_t val);
+void ks_validator_put_headers (ks_validators_t val, estream_t fp);
+void ks_validator_set_from_response (ks_validators_t val, http_t http);
+int  ks_validator_update (const char *name, ks_validators_t val,
+                          const void *data, size_t datalen);
 
 
 /*-- ks-engine-finger.c --*/
@@ -86,6 +109,8 @@ gpg_error_t ks_ldap_query (ctrl_t ctrl, parsed_uri_t uri,
                            unsigned int ks_get_flags,
                            const char *filter, char **attrs,
                            gnupg_isotime_t newer, estream_t *r_fp);
+gpg_error_t ks_ldap_fetch_certs (ctrl_t ctrl, ldap_server_t server,
+                                 strlist_t filters, estream_t *r_fp);
 
 
 #endif /*DIRMNGR_KS_ENGINE_H*/
@@ -0,0 +1,223 @@
+/* ks-validator.c - Validators for conditional keyserver requests
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* For each key fetched with KS_GET --if-changed we remember the ETag
+ * and the Last-Modified date sent by the server and a hash of the
+ * returned data.  The next fetch of the same key sends a conditional
+ * request and a server which supports this answers with "304 Not
+ * Modified".  For other servers the hash tells whether the data
+ * changed.  The items are kept in memory only and are identified by
+ * the keyserver and the pattern.  Like domaininfo.c this module does
+ * not use locks; the table is never accessed across a system call.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirmngr.h"
+#include "ks-engine.h"
+
+
+/* Number of buckets for the hash array and limit for the length of a
+ * bucket chain.  */
+#define NO_OF_VALIDATOR_BUCKETS  509
+#define MAX_VALIDATOR_BUCKET_LEN  16
+
+/* The algorithm to hash the returned data.  */
+#define VALIDATOR_DIGEST_ALGO GCRY_MD_SHA256
+#define VALIDATOR_DIGEST_LEN  32
+
+
+struct validator_item_s
+{
+  struct validator_item_s *next;
+  struct ks_validators_s val;
+  unsigned char digest[VALIDATOR_DIGEST_LEN];
+  char name[1];
+};
+typedef struct validator_item_s *validator_item_t;
+
+/* And the hashed array.  */
+static validator_item_t validator_buckets[NO_OF_VALIDATOR_BUCKETS];
+
+
+/* The hash function we use.  Must not call a system function.  */
+static inline u32
+hash_name (const char *name)
+{
+  const unsigned char *s = (const unsigned char*)name;
+  u32 hashval = 0;
+  u32 carry;
+
+  for (; *s; s++)
+    {
+      hashval = (hashval << 4) + *s;
+      if ((carry = (hashval & 0xf0000000)))
+        {
+          hashval ^= (carry >> 24);
+          hashval ^= carry;
+        }
+    }
+
+  return hashval % NO_OF_VALIDATOR_BUCKETS;
+}
+
+
+/* Return the item for NAME and move it to the front of its bucket.
+ * Returns NULL if there is none.  */
+static validator_item_t
+find_item (const char *name, u32 hash)
+{
+  validator_item_t item, prev;
+
+  for (prev = NULL, item = validator_buckets[hash]; item;
+       prev = item, item = item->next)
+    if (!strcmp (item->name, name))
+      {
+        if (prev)
+          {
+            prev->next = item->next;
+            item->next = validator_buckets[hash];
+            validator_buckets[hash] = item;
+          }
+        return item;
+      }
+  return NULL;
+}
+
+
+/* Copy the string VALUE to the buffer BUFFER of size BUFSIZE.  An
+ * overlong value is not stored at all because a truncated validator
+ * is not of any use.  */
+static void
+copy_validator (char *buffer, size_t bufsize, const char *value)
+{
+  if (value && strlen (value) < bufsize)
+    strcpy (buffer, value);
+  else
+    *buffer = 0;
+}
+
+
+/* Store the validators known for NAME at VAL.  If there are none
+ * empty strings are stored.  */
+void
+ks_validator_get (const char *name, ks_validators_t val)
+{
+  validator_item_t item;
+
+  memset (val, 0, sizeof *val);
+  item = find_item (name, hash_name (name));
+  if (item)
+    {
+      strcpy (val->etag, item->val.etag);
+      strcpy (val->last_modified, item->val.last_modified);
+    }
+}
+
+
+/* Write the conditional request headers for VAL to the request
+ * stream FP.  */
+void
+ks_validator_put_headers (ks_validators_t val, estream_t fp)
+{
+  if (*val->etag)
+    es_fprintf (fp, "If-None-Match: %s\r\n", val->etag);
+  if (*val->last_modified)
+    es_fprintf (fp, "If-Modified-Since: %s\r\n", val->last_modified);
+}
+
+
+/* Take the validators from the response of HTTP and store them at
+ * VAL.  A response without validators clears VAL.  */
+void
+ks_validator_set_from_response (ks_validators_t val, http_t http)
+{
+  copy_validator (val->etag, sizeof val->etag,
+                  http_get_header (http, "ETag", 0));
+  copy_validator (val->last_modified, sizeof val->last_modified,
+                  http_get_header (http, "Last-Modified", 0));
+}
+
+
+/* Remember the validators VAL and the DATALEN bytes of DATA received
+ * for NAME.  Returns true if DATA is the same as returned by the
+ * last fetch for NAME.  */
+int
+ks_validator_update (const char *name, ks_validators_t val,
+                     const void *data, size_t datalen)
+{
+  validator_item_t item, prev, drop;
+  unsigned char digest[VALIDATOR_DIGEST_LEN];
+  int count;
+  int same;
+  u32 hash;
+
+  gcry_md_hash_buffer (VALIDATOR_DIGEST_ALGO, digest, data, datalen);
+
+  hash = hash_name (name);
+  item = find_item (name, hash);
+  if (!item)
+    {
+      item = xtrycalloc (1, sizeof *item + strlen (name));
+      if (!item)
+        return 0;  /* Out of core - we ignore this.  */
+      strcpy (item->name, name);
+
+      /* Need to do another lookup because the malloc is a system call
+       * and thus the hash array may have been changed by another
+       * thread.  */
+      if (find_item (name, hash))
+        {
+          xfree (item);
+          item = find_item (name, hash);
+        }
+      else
+        {
+          item->next = validator_buckets[hash];
+          validator_buckets[hash] = item;
+
+          /* Drop the least recently used items if the chain gets too
+           * long.  They are unlinked before the free.  */
+          drop = NULL;
+          for (count = 0, prev = item; prev->next; prev = prev->next)
+            if (++count >= MAX_VALIDATOR_BUCKET_LEN)
+              {
+                drop = prev->next;
+                prev->next = NULL;
+                break;
+              }
+          while (drop)
+            {
+              prev = drop->next;
+              xfree (drop);
+              drop = prev;
+            }
+          /* A new item has no data to compare.  */
+          memcpy (item->digest, digest, sizeof digest);
+          item->val = *val;
+          return 0;
+        }
+    }
+
+  same = !memcmp (item->digest, digest, sizeof digest);
+  memcpy (item->digest, digest, sizeof digest);
+  item->val = *val;
+  return same;
+}
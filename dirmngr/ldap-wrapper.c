@@ -41,6 +41,11 @@
  * 4. Given that we are going out to the network and usually get back
  *    a long response, the fork/exec overhead is acceptable.
  *
+ * Certificate lookups by pattern are short and frequent; they are
+ * thus done in-process using pooled connections (see
+ * ks_ldap_fetch_certs) unless --ldap-use-wrapper or an LDAP proxy is
+ * used.
+ *
  * Note that under WindowsCE the number of processes is strongly
  * limited (32 processes including the kernel processes) and thus we
  * don't use the process approach but implement a different wrapper in
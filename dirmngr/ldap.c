@@ -36,6 +36,7 @@
 #include "misc.h"
 #include "ldap-wrapper.h"
 #include "ldap-url.h"
+#include "ks-engine.h"
 #include "../common/host2net.h"
 
 
@@ -53,6 +54,7 @@
 struct cert_fetch_context_s
 {
   ksba_reader_t reader;  /* The reader used (shallow copy). */
+  estream_t fp;          /* The in-process result or NULL.  */
   unsigned char *tmpbuf; /* Helper buffer.  */
   size_t tmpbufsize;     /* Allocated size of tmpbuf.  */
   int truncated;         /* Flag to indicate a truncated output.  */
@@ -650,6 +652,65 @@ start_cacert_fetch_ldap (ctrl_t ctrl, cert_fetch_context_t *r_context,
 }
 
 
+/* Callback for the ksba reader used with in-process lookups.  */
+static int
+memory_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
+{
+  estream_t fp = cb_value;
+
+  if (!buffer && !count && !nread)
+    return -1; /* Rewind is not supported. */
+
+  if (es_read (fp, buffer, count, nread) || !*nread)
+    {
+      *nread = 0;
+      return -1;
+    }
+  return 0;
+}
+
+
+/* Run the lookup for FILTERS in-process using a pooled connection to
+ * SERVER and setup CONTEXT to read the result.  */
+static gpg_error_t
+start_cert_fetch_inproc (ctrl_t ctrl, cert_fetch_context_t context,
+                         char **filters, const ldap_server_t server)
+{
+  gpg_error_t err;
+  strlist_t list = NULL;
+
+  for (; *filters; filters++)
+    if (!append_to_strlist_try (&list, *filters))
+      {
+        err = gpg_error_from_syserror ();
+        goto leave;
+      }
+  if (!list && !append_to_strlist_try (&list, "(objectClass=*)"))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = ks_ldap_fetch_certs (ctrl, server, list, &context->fp);
+  if (err)
+    goto leave;
+  err = ksba_reader_new (&context->reader);
+  if (!err)
+    err = ksba_reader_set_cb (context->reader, memory_reader_cb, context->fp);
+  if (err)
+    {
+      ksba_reader_release (context->reader);
+      context->reader = NULL;
+      es_fclose (context->fp);
+      context->fp = NULL;
+    }
+
+ leave:
+  free_strlist (list);
+  return err;
+}
+
+
 /* Prepare an LDAP query to return certificates matching PATTERNS
  * using the SERVER.  This function returns an error code or 0 and
  * stores a newly allocated object at R_CONTEXT on success. */
@@ -799,7 +860,13 @@ start_cert_fetch_ldap (ctrl_t ctrl, cert_fetch_context_t *r_context,
       goto leave;
     }
 
-  err = ldap_wrapper (ctrl, &(*r_context)->reader, (const char**)argv);
+  /* Short lookups are done in-process with a pooled connection
+   * unless a proxy is used.  */
+  if (!opt.ldap_use_wrapper && !(proxy && *proxy))
+    err = start_cert_fetch_inproc (ctrl, *r_context,
+                                   argv + argc_malloced, server);
+  else
+    err = ldap_wrapper (ctrl, &(*r_context)->reader, (const char**)argv);
   if (err)
     {
       xfree (*r_context);
@@ -1019,8 +1086,16 @@ end_cert_fetch_ldap (cert_fetch_context_t context)
       ksba_reader_t reader = context->reader;
 
       xfree (context->tmpbuf);
+      if (context->fp)
+        {
+          ksba_reader_release (reader);
+          es_fclose (context->fp);
+        }
+      else
+        {
+          ldap_wrapper_release_context (reader);
+          ksba_reader_release (reader);
+        }
       xfree (context);
-      ldap_wrapper_release_context (reader);
-      ksba_reader_release (reader);
     }
 }
@@ -29,6 +29,7 @@
 #include "http.h"
 #include "validate.h"
 #include "certcache.h"
+#include "dirmngr-status.h"
 #include "ocsp.h"
 
 /* The maximum size we allow as a response from an OCSP responder. */
@@ -647,20 +648,262 @@ check_signature (ctrl_t ctrl,
 }
 
 
-/* Check whether the certificate either given by fingerprint CERT_FPR
-   or directly through the CERT object is valid by running an OCSP
-   transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
-   default responder is used.  If R_REVOKED_AT or R_REASON are not
-   NULL and the certificate has been revoked the revocation time and
-   the reasons are stored there. */
-gpg_error_t
-ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
-              int force_default_responder, ksba_isotime_t r_revoked_at,
-              const char **r_reason)
+/* The OCSP response cache.  Validated responses are kept in memory,
+ * keyed by the fingerprint of the issuer certificate and the serial
+ * number of the target certificate, so that repeated checks of the
+ * same certificate do not need a network round-trip.  An entry is
+ * used until the nextUpdate time of the response, limited to
+ * OCSP_CACHE_MAX_TTL, or for OCSP_CACHE_DEFAULT_TTL if the responder
+ * did not give a nextUpdate.  Entries which have been used and will
+ * expire within OCSP_CACHE_PREFETCH seconds are refreshed by the
+ * housekeeping, at most OCSP_CACHE_MAX_PREFETCH per run.  */
+#define OCSP_CACHE_MAX_ITEMS    1024
+#define OCSP_CACHE_MAX_TTL      86400
+#define OCSP_CACHE_DEFAULT_TTL  300
+#define OCSP_CACHE_PREFETCH     1800
+#define OCSP_CACHE_MAX_PREFETCH 32
+
+struct ocsp_cache_item_s
+{
+  struct ocsp_cache_item_s *next;
+  unsigned char issuer_fpr[20];
+  int force_default_responder;
+  ksba_cert_t cert;         /* The target certificate and its issuer  */
+  ksba_cert_t issuer_cert;  /* for the prefetch.                      */
+  gpg_error_t result;       /* 0, GPG_ERR_CERT_REVOKED or GPG_ERR_NO_DATA.  */
+  ksba_isotime_t revoked_at;
+  const char *reason;       /* Static string.  */
+  ksba_isotime_t this_update;
+  ksba_isotime_t next_update;
+  time_t expires;
+  unsigned int hits;
+  unsigned int used:1;      /* Looked up since the last prefetch.  */
+  char serial[1];           /* The serial number as hex string.  */
+};
+typedef struct ocsp_cache_item_s *ocsp_cache_item_t;
+
+/* The cache, most recently used entries first.  */
+static ocsp_cache_item_t ocsp_cache;
+static unsigned int ocsp_cache_items;
+
+
+/* Release the cache item R which must already be unlinked.  */
+static void
+ocsp_cache_release_item (ocsp_cache_item_t r)
+{
+  if (!r)
+    return;
+  ocsp_cache_items--;
+  ksba_cert_release (r->cert);
+  ksba_cert_release (r->issuer_cert);
+  xfree (r);
+}
+
+
+/* Remove all items from the OCSP cache.  */
+void
+ocsp_cache_flush (void)
+{
+  ocsp_cache_item_t r;
+
+  while ((r = ocsp_cache))
+    {
+      ocsp_cache = r->next;
+      ocsp_cache_release_item (r);
+    }
+}
+
+
+/* Remove all expired items from the OCSP cache.  */
+static void
+ocsp_cache_expire (void)
+{
+  ocsp_cache_item_t *rp, r;
+  time_t now = gnupg_get_time ();
+
+  for (rp = &ocsp_cache; (r = *rp); )
+    {
+      if (r->expires <= now)
+        {
+          *rp = r->next;
+          ocsp_cache_release_item (r);
+        }
+      else
+        rp = &r->next;
+    }
+}
+
+
+/* Return the address of the link to the item for the key given by
+ * ISSUER_FPR, SERIAL and FORCE_DEFAULT_RESPONDER or NULL if there is
+ * none.  */
+static ocsp_cache_item_t *
+ocsp_cache_find (const unsigned char *issuer_fpr, const char *serial,
+                 int force_default_responder)
+{
+  ocsp_cache_item_t *rp, r;
+
+  for (rp = &ocsp_cache; (r = *rp); rp = &r->next)
+    if (!memcmp (r->issuer_fpr, issuer_fpr, 20)
+        && r->force_default_responder == force_default_responder
+        && !strcmp (r->serial, serial))
+      return rp;
+  return NULL;
+}
+
+
+/* Look up a cached response.  Expired items are removed; a found
+ * item is moved to the front of the cache.  */
+static ocsp_cache_item_t
+ocsp_cache_lookup (const unsigned char *issuer_fpr, const char *serial,
+                   int force_default_responder)
+{
+  ocsp_cache_item_t *rp, r;
+
+  rp = ocsp_cache_find (issuer_fpr, serial, force_default_responder);
+  if (!rp)
+    return NULL;
+  r = *rp;
+  *rp = r->next;
+  if (r->expires <= gnupg_get_time ())
+    {
+      ocsp_cache_release_item (r);
+      return NULL;
+    }
+  r->next = ocsp_cache;
+  ocsp_cache = r;
+  r->hits++;
+  r->used = 1;
+  return r;
+}
+
+
+/* Store the validated response for CERT into the cache.  RESULT is
+ * the status as returned by ocsp_isvalid.  */
+static void
+ocsp_cache_insert (ksba_cert_t cert, ksba_cert_t issuer_cert,
+                   const unsigned char *issuer_fpr, const char *serial,
+                   int force_default_responder, gpg_error_t result,
+                   const ksba_isotime_t revoked_at, const char *reason,
+                   const ksba_isotime_t this_update,
+                   const ksba_isotime_t next_update)
+{
+  ocsp_cache_item_t r, old, *rp;
+  time_t now, expires;
+  int used = 0;
+
+  now = gnupg_get_time ();
+  expires = *next_update? isotime2epoch (next_update) : (time_t)(-1);
+  if (expires == (time_t)(-1))
+    expires = now + OCSP_CACHE_DEFAULT_TTL;
+  else if (expires > now + OCSP_CACHE_MAX_TTL)
+    expires = now + OCSP_CACHE_MAX_TTL;
+  if (expires <= now)
+    return;
+
+  r = xtrymalloc (sizeof *r + strlen (serial));
+  if (!r)
+    return;
+  memset (r, 0, sizeof *r);
+  memcpy (r->issuer_fpr, issuer_fpr, 20);
+  strcpy (r->serial, serial);
+  r->force_default_responder = force_default_responder;
+  ksba_cert_ref (cert);
+  r->cert = cert;
+  ksba_cert_ref (issuer_cert);
+  r->issuer_cert = issuer_cert;
+  r->result = result;
+  if (revoked_at)
+    gnupg_copy_time (r->revoked_at, revoked_at);
+  r->reason = reason;
+  gnupg_copy_time (r->this_update, this_update);
+  if (*next_update)
+    gnupg_copy_time (r->next_update, next_update);
+  r->expires = expires;
+  ocsp_cache_items++;
+
+  rp = ocsp_cache_find (issuer_fpr, serial, force_default_responder);
+  if (rp)
+    {
+      old = *rp;
+      *rp = old->next;
+      r->hits = old->hits;
+      used = old->used;
+      ocsp_cache_release_item (old);
+    }
+  r->used = used;
+  r->next = ocsp_cache;
+  ocsp_cache = r;
+
+  if (ocsp_cache_items > OCSP_CACHE_MAX_ITEMS)
+    ocsp_cache_expire ();
+  while (ocsp_cache_items > OCSP_CACHE_MAX_ITEMS)
+    {
+      /* Drop the least recently used item.  */
+      for (rp = &ocsp_cache; (*rp)->next; rp = &(*rp)->next)
+        ;
+      old = *rp;
+      *rp = NULL;
+      ocsp_cache_release_item (old);
+    }
+}
+
+
+/* Print the content of the OCSP cache as status lines to CTRL.  */
+void
+ocsp_cache_dump (ctrl_t ctrl)
+{
+  ocsp_cache_item_t saved, r;
+  time_t now;
+
+  /* Temporarily detach the cache because the status output may yield
+   * to other threads.  */
+  saved = ocsp_cache;
+  ocsp_cache = NULL;
+  now = gnupg_get_time ();
+
+  dirmngr_status_helpf (ctrl, "ocspcache: number of entries: %u",
+                        ocsp_cache_items);
+  for (r = saved; r; r = r->next)
+    {
+      char *fpr = hexify_data (r->issuer_fpr, 20, 0);
+
+      dirmngr_status_helpf (ctrl, "ocspcache: %s/%s%s ttl=%ld hits=%u"
+                            " this=%s next=%s -> %s",
+                            fpr? fpr : "?", r->serial,
+                            r->force_default_responder? " (default)":"",
+                            (long)(r->expires - now), r->hits,
+                            r->this_update,
+                            *r->next_update? r->next_update : "none",
+                            r->result? gpg_strerror (r->result) : "good");
+      xfree (fpr);
+    }
+
+  /* Restore the cache.  Items added in the meantime are kept in
+   * front.  */
+  if (!(r = ocsp_cache))
+    ocsp_cache = saved;
+  else
+    {
+      while (r->next)
+        r = r->next;
+      r->next = saved;
+    }
+}
+
+
+/* Run an OCSP transaction for CERT which has been issued by
+   ISSUER_CERT.  ISSUER_FPR and SERIAL are used as the key to cache
+   the response; if SERIAL is NULL the response is not cached.  See
+   ocsp_isvalid for the other arguments.  */
+static gpg_error_t
+do_ocsp_check (ctrl_t ctrl, ksba_cert_t cert, ksba_cert_t issuer_cert,
+               const unsigned char *issuer_fpr, const char *serial,
+               int force_default_responder, ksba_isotime_t r_revoked_at,
+               const char **r_reason)
 {
   gpg_error_t err;
   ksba_ocsp_t ocsp = NULL;
-  ksba_cert_t issuer_cert = NULL;
   ksba_sexp_t sigval = NULL;
   gcry_sexp_t s_sig = NULL;
   ksba_isotime_t current_time;
@@ -676,42 +919,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   ksba_name_t name;
   fingerprint_list_t default_signer = NULL;
   const char *sreason;
-
-  if (r_revoked_at)
-    *r_revoked_at = 0;
-  if (r_reason)
-    *r_reason = NULL;
-
-  /* Get the certificate.  */
-  if (cert)
-    {
-      ksba_cert_ref (cert);
-
-      err = find_issuing_cert (ctrl, cert, &issuer_cert);
-      if (err)
-        {
-          log_error (_("issuer certificate not found: %s\n"),
-                     gpg_strerror (err));
-          goto leave;
-        }
-    }
-  else
-    {
-      cert = get_cert_local (ctrl, cert_fpr);
-      if (!cert)
-        {
-          log_error (_("caller did not return the target certificate\n"));
-          err = gpg_error (GPG_ERR_GENERAL);
-          goto leave;
-        }
-      issuer_cert = get_issuing_cert_local (ctrl, NULL);
-      if (!issuer_cert)
-        {
-          log_error (_("caller did not return the issuing certificate\n"));
-          err = gpg_error (GPG_ERR_GENERAL);
-          goto leave;
-        }
-    }
+  int time_ok = 1;
 
   /* Create an OCSP instance.  */
   err = ksba_ocsp_new (&ocsp);
@@ -918,6 +1126,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
     {
       log_error (_("OCSP responder returned a status in the future\n"));
       log_info ("used now: %s  this_update: %s\n", current_time, this_update);
+      time_ok = 0;
       if (!err)
         err = gpg_error (GPG_ERR_TIME_CONFLICT);
     }
@@ -931,6 +1140,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
       log_error (_("OCSP responder returned a non-current status\n"));
       log_info ("used now: %s  this_update: %s\n",
                 current_time, this_update);
+      time_ok = 0;
       if (!err)
         err = gpg_error (GPG_ERR_TIME_CONFLICT);
     }
@@ -946,24 +1156,192 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
           log_error (_("OCSP responder returned an too old status\n"));
           log_info ("used now: %s  next_update: %s\n",
                     current_time, next_update);
+          time_ok = 0;
           if (!err)
             err = gpg_error (GPG_ERR_TIME_CONFLICT);
         }
     }
 
+  /* Remember a definite answer.  */
+  if (serial && time_ok
+      && (!err
+          || gpg_err_code (err) == GPG_ERR_CERT_REVOKED
+          || gpg_err_code (err) == GPG_ERR_NO_DATA))
+    ocsp_cache_insert (cert, issuer_cert, issuer_fpr, serial,
+                       force_default_responder, err,
+                       status == KSBA_STATUS_REVOKED? revocation_time : NULL,
+                       sreason, this_update, next_update);
 
  leave:
   gcry_md_close (md);
   gcry_sexp_release (s_sig);
   xfree (sigval);
-  ksba_cert_release (issuer_cert);
-  ksba_cert_release (cert);
   ksba_ocsp_release (ocsp);
   xfree (url_buffer);
   return err;
 }
 
 
+
+
+/* Check whether the certificate either given by fingerprint CERT_FPR
+   or directly through the CERT object is valid by running an OCSP
+   transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
+   default responder is used.  If R_REVOKED_AT or R_REASON are not
+   NULL and the certificate has been revoked the revocation time and
+   the reasons are stored there.  A cached response is used if it is
+   still current. */
+gpg_error_t
+ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
+              int force_default_responder, ksba_isotime_t r_revoked_at,
+              const char **r_reason)
+{
+  gpg_error_t err;
+  ksba_cert_t issuer_cert = NULL;
+  unsigned char issuer_fpr[20];
+  ksba_sexp_t sn;
+  char *serial = NULL;
+  ocsp_cache_item_t item;
+
+  if (r_revoked_at)
+    *r_revoked_at = 0;
+  if (r_reason)
+    *r_reason = NULL;
+
+  /* Get the certificate.  */
+  if (cert)
+    {
+      ksba_cert_ref (cert);
+
+      err = find_issuing_cert (ctrl, cert, &issuer_cert);
+      if (err)
+        {
+          log_error (_("issuer certificate not found: %s\n"),
+                     gpg_strerror (err));
+          goto leave;
+        }
+    }
+  else
+    {
+      cert = get_cert_local (ctrl, cert_fpr);
+      if (!cert)
+        {
+          log_error (_("caller did not return the target certificate\n"));
+          err = gpg_error (GPG_ERR_GENERAL);
+          goto leave;
+        }
+      issuer_cert = get_issuing_cert_local (ctrl, NULL);
+      if (!issuer_cert)
+        {
+          log_error (_("caller did not return the issuing certificate\n"));
+          err = gpg_error (GPG_ERR_GENERAL);
+          goto leave;
+        }
+    }
+
+  /* Look into the cache.  */
+  cert_compute_fpr (issuer_cert, issuer_fpr);
+  sn = ksba_cert_get_serial (cert);
+  if (sn)
+    serial = serial_hex (sn);
+  ksba_free (sn);
+  if (serial
+      && (item = ocsp_cache_lookup (issuer_fpr, serial,
+                                    force_default_responder)))
+    {
+      if (opt.verbose)
+        log_info (_("using cached OCSP status (this=%s  next=%s)\n"),
+                  item->this_update,
+                  *item->next_update? item->next_update : "none");
+      err = item->result;
+      if (gpg_err_code (err) == GPG_ERR_CERT_REVOKED)
+        {
+          time_t validated_at = 0;
+
+          if (ksba_cert_set_user_data (cert, "validated_at",
+                                       &validated_at, sizeof (validated_at)))
+            log_error ("set_user_data(validated_at) failed\n");
+          if (r_revoked_at)
+            gnupg_copy_time (r_revoked_at, item->revoked_at);
+          if (r_reason)
+            *r_reason = item->reason;
+        }
+      goto leave;
+    }
+
+  err = do_ocsp_check (ctrl, cert, issuer_cert, issuer_fpr, serial,
+                       force_default_responder, r_revoked_at, r_reason);
+
+ leave:
+  xfree (serial);
+  ksba_cert_release (issuer_cert);
+  ksba_cert_release (cert);
+  return err;
+}
+
+
+/* Expire old items of the OCSP cache and refresh those which have
+   been used recently and will expire soon.  This is called by the
+   housekeeping thread with its own CTRL object.  */
+void
+ocsp_cache_housekeeping (ctrl_t ctrl)
+{
+  struct {
+    ksba_cert_t cert;
+    ksba_cert_t issuer_cert;
+    unsigned char issuer_fpr[20];
+    int force_default_responder;
+    char *serial;
+  } jobs[OCSP_CACHE_MAX_PREFETCH];
+  ocsp_cache_item_t r;
+  time_t now;
+  int njobs, i;
+  gpg_error_t err;
+
+  ocsp_cache_expire ();
+  if (!opt.allow_ocsp)
+    return;
+
+  /* Collect the items first because the OCSP requests yield to other
+   * threads which may then change the cache.  */
+  now = gnupg_get_time ();
+  njobs = 0;
+  for (r = ocsp_cache; r && njobs < OCSP_CACHE_MAX_PREFETCH; r = r->next)
+    {
+      if (!r->used || r->expires - now > OCSP_CACHE_PREFETCH)
+        continue;
+      jobs[njobs].serial = xtrystrdup (r->serial);
+      if (!jobs[njobs].serial)
+        break;
+      r->used = 0;
+      ksba_cert_ref (r->cert);
+      jobs[njobs].cert = r->cert;
+      ksba_cert_ref (r->issuer_cert);
+      jobs[njobs].issuer_cert = r->issuer_cert;
+      memcpy (jobs[njobs].issuer_fpr, r->issuer_fpr, 20);
+      jobs[njobs].force_default_responder = r->force_default_responder;
+      njobs++;
+    }
+
+  for (i=0; i < njobs; i++)
+    {
+      if (opt.verbose)
+        log_info ("refreshing OCSP status of %s\n", jobs[i].serial);
+      err = do_ocsp_check (ctrl, jobs[i].cert, jobs[i].issuer_cert,
+                           jobs[i].issuer_fpr, jobs[i].serial,
+                           jobs[i].force_default_responder, NULL, NULL);
+      if (err && gpg_err_code (err) != GPG_ERR_CERT_REVOKED
+          && gpg_err_code (err) != GPG_ERR_NO_DATA)
+        log_info ("refreshing OCSP status of %s failed: %s\n",
+                  jobs[i].serial, gpg_strerror (err));
+      xfree (jobs[i].serial);
+      ksba_cert_release (jobs[i].cert);
+      ksba_cert_release (jobs[i].issuer_cert);
+    }
+  release_ctrl_ocsp_certs (ctrl);
+}
+
+
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void
 release_ctrl_ocsp_certs (ctrl_t ctrl)
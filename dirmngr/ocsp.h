@@ -30,4 +30,9 @@ gpg_error_t ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void release_ctrl_ocsp_certs (ctrl_t ctrl);
 
+/* Functions to manage the OCSP response cache.  */
+void ocsp_cache_flush (void);
+void ocsp_cache_dump (ctrl_t ctrl);
+void ocsp_cache_housekeeping (ctrl_t ctrl);
+
 #endif /*OCSP_H*/
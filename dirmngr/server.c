@@ -64,6 +64,9 @@
 #include "../common/mbox-util.h"
 #include "../common/zb32.h"
 #include "../common/server-help.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
+#include "../common/thread-pool.h"
 
 /* To avoid DoS attacks we limit the size of a certificate to
    something reasonable.  The DoS was actually only an issue back when
@@ -1090,7 +1093,8 @@ proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
                 /* Mark that and schedule a check.  */
                 domaininfo_set_wkd_not_found (domain_orig);
                 workqueue_add_task (task_check_wkd_support, domain_orig,
-                                    ctrl->server_local->session_id, 1);
+                                    ctrl->server_local->session_id, 1,
+                                    WQ_PRIO_LOW);
               }
             else if (opt_policy_flags) /* No policy file - no support.  */
               domaininfo_set_wkd_not_supported (domain_orig);
@@ -2489,14 +2493,17 @@ cmd_ks_search (assuan_context_t ctx, char *line)
 
 
 static const char hlp_ks_get[] =
-  "KS_GET [--quick] [--newer=TIME] [--ldap] [--first|--next] {<pattern>}\n"
+  "KS_GET [--quick] [--newer=TIME] [--ldap] [--first|--next]\n"
+  "       [--if-changed] {<pattern>}\n"
   "\n"
   "Get the keys matching PATTERN from the configured OpenPGP keyservers\n"
   "(see command KEYSERVER).  Each pattern should be a keyid, a fingerprint,\n"
   "or an exact name indicated by the '=' prefix.  Option --quick uses a\n"
   "shorter timeout; --ldap will use only ldap servers.  With --first only\n"
   "the first item is returned; --next is used to return the next item\n"
-  "Option --newer works only with certain LDAP servers.";
+  "Option --newer works only with certain LDAP servers.  With --if-changed\n"
+  "keys which did not change since they were last fetched are not\n"
+  "returned; the status line UNCHANGED tells their number.";
 static gpg_error_t
 cmd_ks_get (assuan_context_t ctx, char *line)
 {
@@ -2520,6 +2527,8 @@ cmd_ks_get (assuan_context_t ctx, char *line)
     flags |= KS_GET_FLAG_FIRST;
   if (has_option (line, "--next"))
     flags |= KS_GET_FLAG_NEXT;
+  if (has_option (line, "--if-changed"))
+    flags |= KS_GET_FLAG_IF_CHANGED;
   if ((s = option_value (line, "--newer"))
       && !string2isotime (opt_newer, s))
     {
@@ -2865,10 +2874,16 @@ static const char hlp_getinfo[] =
   "pid         - Return the process id of the server\n"
   "tor         - Return OK if running in Tor mode\n"
   "dnsinfo     - Return info about the DNS resolver\n"
+  "dnscache    - Inspect the DNS cache; with --flush empty it\n"
+  "ocspcache   - Inspect the OCSP cache; with --flush empty it\n"
   "socket_name - Return the name of the socket\n"
   "session_id  - Return the current session_id\n"
   "workqueue   - Inspect the work queue\n"
   "stats       - Print stats\n"
+  "metrics     - Return the metrics in the Prometheus text format\n"
+  "cmdstats    - Return the statistics of the commands; with --reset\n"
+  "              reset them\n"
+  "memstat     - Return the memory used by the subsystems\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -2932,6 +2947,26 @@ cmd_getinfo (assuan_context_t ctx, char *line)
         }
       err = 0;
     }
+  else if (!strcmp (line, "dnscache"))
+    {
+      dns_cache_dump (ctrl);
+      err = 0;
+    }
+  else if (!strcmp (line, "dnscache --flush"))
+    {
+      dns_cache_flush ();
+      err = 0;
+    }
+  else if (!strcmp (line, "ocspcache"))
+    {
+      ocsp_cache_dump (ctrl);
+      err = 0;
+    }
+  else if (!strcmp (line, "ocspcache --flush"))
+    {
+      ocsp_cache_flush ();
+      err = 0;
+    }
   else if (!strcmp (line, "workqueue"))
     {
       workqueue_dump_queue (ctrl);
@@ -2941,8 +2976,48 @@ cmd_getinfo (assuan_context_t ctx, char *line)
     {
       cert_cache_print_stats (ctrl);
       domaininfo_print_stats (ctrl);
+      ks_action_print_stats (ctrl);
+      {
+        char *tmpstr = thread_pool_stats ();
+
+        if (tmpstr)
+          dirmngr_status_helpf (ctrl, "threads: %s\n", tmpstr);
+        xfree (tmpstr);
+      }
       err = 0;
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *buf = metrics_format ();
+
+      if (!buf)
+        err = gpg_error_from_syserror ();
+      else
+        err = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+    }
+  else if (!strcmp (line, "cmdstats") || !strcmp (line, "cmdstats --reset"))
+    {
+      char *buf = metrics_format_cmdstats ();
+
+      if (!buf)
+        err = gpg_error_from_syserror ();
+      else
+        err = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+      if (!err && line[8])
+        metrics_reset_commands ();
+    }
+  else if (!strcmp (line, "memstat"))
+    {
+      char *buf = memstat_format ();
+
+      if (!buf)
+        err = gpg_error_from_syserror ();
+      else
+        err = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+    }
   else if (!strncmp (line, "getenv", 6)
            && (line[6] == ' ' || line[6] == '\t' || !line[6]))
     {
@@ -3103,6 +3178,25 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  metrics_command_begin (ctx, cmd);
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  (void)err;
+
+  metrics_command_end (ctx);
+}
+
+
 /* This function is called by our assuan log handler to test whether a
  * log message shall really be printed.  The function must return
  * false to inhibit the logging of MSG.  CAT gives the requested log
@@ -3207,6 +3301,8 @@ start_command_handler (assuan_fd_t fd, unsigned int session_id)
   assuan_set_hello_line (ctx, hello_line);
   assuan_register_option_handler (ctx, option_handler);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
 
   ctrl->server_local->session_id = session_id;
 
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <ctype.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "certcache.h"
@@ -47,6 +48,11 @@ enum cert_usage_modes
   };
 
 
+/* The maximum number of additional threads used to check the
+ * signatures of a chain.  */
+#define MAX_SIG_THREADS 3
+
+
 /* While running the validation function we need to keep track of the
    certificates and the validation outcome of each.  We use this type
    for it.  */
@@ -57,6 +63,13 @@ struct chain_item_s
   unsigned char fpr[20]; /* Fingerprint of the certificate.  */
   int is_self_signed;    /* This certificate is self-signed.  */
   int is_valid;          /* The certificate is valid except for revocations.  */
+
+  /* The prepared check of the signature on CERT; NULL for the root.  */
+  gcry_sexp_t s_sig;
+  gcry_sexp_t s_hash;
+  gcry_sexp_t s_pkey;
+  gpg_error_t sig_err;   /* The result of the signature check.  */
+  gpg_error_t crl_err;   /* The result of the revocation check.  */
 };
 typedef struct chain_item_s *chain_item_t;
 
@@ -71,7 +84,9 @@ static const char oid_kp_ocspSigning[]    = "1.3.6.1.5.5.7.3.9";
 
 
 /* Prototypes.  */
-static gpg_error_t check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert);
+static gpg_error_t prepare_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert,
+                                     gcry_sexp_t *r_sig, gcry_sexp_t *r_hash,
+                                     gcry_sexp_t *r_pkey);
 
 
 /* Make sure that the values defined in the headers are correct.  We
@@ -247,7 +262,143 @@ allowed_ca (ksba_cert_t cert, int *chainlen)
   return 0;
 }
 
-/* Helper for validate_cert_chain.  */
+/* Worker for check_chain_sigs.  ARG points to the next item of the
+ * chain to consider.  Taking an item needs no lock because we hold
+ * the npth lock except while running gcry_pk_verify.  */
+static void *
+check_sigs_worker (void *arg)
+{
+  chain_item_t *nextp = arg;
+  chain_item_t ci;
+
+  for (;;)
+    {
+      for (ci = *nextp; ci && !ci->s_sig; ci = ci->next)
+        ;
+      if (!ci)
+        break;
+      *nextp = ci->next;
+
+      npth_unprotect ();
+      ci->sig_err = gcry_pk_verify (ci->s_sig, ci->s_hash, ci->s_pkey);
+      npth_protect ();
+      if (DBG_X509)
+        log_debug ("%s: gcry_pk_verify: %s\n", __func__,
+                   gpg_strerror (ci->sig_err));
+    }
+
+  return NULL;
+}
+
+
+/* Helper for validate_cert_chain.  Check all prepared signatures of
+ * CHAIN.  The checks are independent of each other and thus run in
+ * parallel which cuts the time for a long chain down to that of the
+ * slowest check.  */
+static gpg_error_t
+check_chain_sigs (chain_item_t chain)
+{
+  npth_t thds[MAX_SIG_THREADS];
+  npth_attr_t tattr;
+  unsigned int nthds = 0;
+  unsigned int njobs = 0;
+  unsigned int i;
+  chain_item_t ci, next;
+
+  for (ci = chain; ci; ci = ci->next)
+    if (ci->s_sig)
+      njobs++;
+
+  next = chain;
+  if (njobs > 1 && !npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; nthds < njobs - 1 && nthds < MAX_SIG_THREADS; nthds++)
+        if (npth_create (thds + nthds, &tattr, check_sigs_worker, &next))
+          break;
+      npth_attr_destroy (&tattr);
+    }
+  /* The current thread is one of the workers.  */
+  check_sigs_worker (&next);
+  for (i = 0; i < nthds; i++)
+    npth_join (thds[i], NULL);
+
+  for (ci = chain; ci; ci = ci->next)
+    if (ci->s_sig && ci->sig_err)
+      {
+        if (opt.verbose)
+          cert_log_name ("  certificate", ci->cert);
+        return ci->sig_err;
+      }
+  return 0;
+}
+
+
+/* Check CERT for revocations and store the result at CI.  */
+static void
+check_crl_of_item (ctrl_t ctrl, chain_item_t ci)
+{
+  gpg_error_t err;
+
+  if (opt.verbose)
+    cert_log_name (_("checking CRL for"), ci->cert);
+  err = crl_cache_cert_isvalid (ctrl, ci->cert, 0);
+  if (gpg_err_code (err) == GPG_ERR_NO_CRL_KNOWN)
+    {
+      err = crl_cache_reload_crl (ctrl, ci->cert);
+      if (!err)
+        err = crl_cache_cert_isvalid (ctrl, ci->cert, 0);
+    }
+  if (opt.verbose)
+    log_info ("[%d] result of checking this CRL: %s\n",
+              ctrl->check_revocations_nest_level, gpg_strerror (err));
+  ci->crl_err = err;
+}
+
+
+/* Object passed to check_crl_worker.  */
+struct crl_job_s
+{
+  ctrl_t ctrl;        /* The control object of the caller.  */
+  chain_item_t ci;    /* The item to check.  */
+};
+
+
+/* Thread to run check_crl_of_item for another chain item.  The
+ * thread uses its own control object so that nested validations do
+ * not mess up the nesting level of the caller.  Status lines can't be
+ * send from such a thread.  */
+static void *
+check_crl_worker (void *arg)
+{
+  struct crl_job_s *job = arg;
+  struct server_control_s ctrlbuf;
+
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl (&ctrlbuf);
+  xfree (ctrlbuf.http_proxy);
+  ctrlbuf.http_proxy = NULL;
+  if (job->ctrl->http_proxy
+      && !(ctrlbuf.http_proxy = xtrystrdup (job->ctrl->http_proxy)))
+    job->ci->crl_err = gpg_error_from_syserror ();
+  else
+    {
+      ctrlbuf.force_crl_refresh = job->ctrl->force_crl_refresh;
+      ctrlbuf.timeout = job->ctrl->timeout;
+      ctrlbuf.http_no_crl = job->ctrl->http_no_crl;
+      ctrlbuf.check_revocations_nest_level
+        = job->ctrl->check_revocations_nest_level;
+      check_crl_of_item (&ctrlbuf, job->ci);
+    }
+  dirmngr_deinit_default_ctrl (&ctrlbuf);
+  return NULL;
+}
+
+
+/* Helper for validate_cert_chain.  The revocation checks of the
+ * certificates are independent of each other and are thus run in
+ * parallel at the top nesting level.  This lets the CRL fetches
+ * overlap.  */
 static gpg_error_t
 check_revocations (ctrl_t ctrl, chain_item_t chain)
 {
@@ -257,6 +408,12 @@ check_revocations (ctrl_t ctrl, chain_item_t chain)
   int any_crl_too_old = 0;
   int any_not_trusted = 0;
   chain_item_t ci;
+  struct crl_job_s *jobs = NULL;
+  npth_t *thds = NULL;
+  npth_attr_t tattr;
+  unsigned int njobs = 0;
+  unsigned int nthds = 0;
+  unsigned int i;
 
   log_assert (ctrl->check_revocations_nest_level >= 0);
   log_assert (chain);
@@ -270,34 +427,52 @@ check_revocations (ctrl_t ctrl, chain_item_t chain)
   if (opt.verbose)
     log_info ("[%d] start checking CRLs\n", ctrl->check_revocations_nest_level);
 
-  for (ci=chain; ci; ci = ci->next)
+  /* It does not make sense to check the root certificate for
+     revocations.  In almost all cases this will lead to a catch-22 as
+     the root certificate is the final trust anchor for the
+     certificates and the CRLs.  We expect the user to remove root
+     certificates from the list of trusted certificates in case they
+     have been revoked. */
+  if (opt.verbose)
+    cert_log_name (_("not checking CRL for"), chain->cert);
+  for (ci = chain->next; ci; ci = ci->next)
+    njobs++;
+
+  if (ctrl->check_revocations_nest_level == 1 && njobs > 1)
     {
-      assert (ci->cert);
-      if (ci == chain)
+      jobs = xtrycalloc (njobs, sizeof *jobs);
+      thds = xtrycalloc (njobs, sizeof *thds);
+    }
+  ci = njobs? chain->next->next : NULL;
+  if (jobs && thds && !npth_attr_init (&tattr))
+    {
+      /* Start a thread for all but the first item; that one is done
+       * by the current thread.  */
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; ci; ci = ci->next)
         {
-          /* It does not make sense to check the root certificate for
-             revocations.  In almost all cases this will lead to a
-             catch-22 as the root certificate is the final trust
-             anchor for the certificates and the CRLs.  We expect the
-             user to remove root certificates from the list of trusted
-             certificates in case they have been revoked. */
-          if (opt.verbose)
-            cert_log_name (_("not checking CRL for"), ci->cert);
-          continue;
+          jobs[nthds].ctrl = ctrl;
+          jobs[nthds].ci = ci;
+          if (npth_create (thds + nthds, &tattr,
+                           check_crl_worker, jobs + nthds))
+            break;
+          nthds++;
         }
+      npth_attr_destroy (&tattr);
+    }
 
-      if (opt.verbose)
-        cert_log_name (_("checking CRL for"), ci->cert);
-      err = crl_cache_cert_isvalid (ctrl, ci->cert, 0);
-      if (gpg_err_code (err) == GPG_ERR_NO_CRL_KNOWN)
-        {
-          err = crl_cache_reload_crl (ctrl, ci->cert);
-          if (!err)
-            err = crl_cache_cert_isvalid (ctrl, ci->cert, 0);
-        }
-      if (opt.verbose)
-        log_info ("[%d] result of checking this CRL: %s\n",
-                  ctrl->check_revocations_nest_level, gpg_strerror (err));
+  if (njobs)
+    check_crl_of_item (ctrl, chain->next);
+  for (; ci; ci = ci->next)  /* Not run by a thread.  */
+    check_crl_of_item (ctrl, ci);
+  for (i = 0; i < nthds; i++)
+    npth_join (thds[i], NULL);
+  xfree (thds);
+  xfree (jobs);
+
+  for (ci = chain->next; ci; ci = ci->next)
+    {
+      err = ci->crl_err;
       switch (gpg_err_code (err))
         {
         case 0: err = 0; break;
@@ -426,6 +601,9 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
   int any_expired = 0;
   int any_no_policy_match = 0;
   chain_item_t chain;
+  gcry_sexp_t s_sig = NULL;
+  gcry_sexp_t s_hash = NULL;
+  gcry_sexp_t s_pkey = NULL;
 
   check_header_constants ();
 
@@ -670,10 +848,11 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
           dump_cert ("issuer", issuer_cert);
         }
 
-      /* Now check the signature of the certificate.  FIXME: we should
-       * delay this until later so that faked certificates can't be
-       * turned into a DoS easily.  */
-      err = check_cert_sig (issuer_cert, subject_cert);
+      /* Prepare the check of the signature of the certificate.  The
+       * actual checks of all signatures are done after the chain has
+       * been assembled.  */
+      err = prepare_cert_sig (issuer_cert, subject_cert,
+                              &s_sig, &s_hash, &s_pkey);
       if (err)
         {
           log_error (_("certificate has a BAD signature"));
@@ -750,18 +929,28 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
         ksba_cert_ref (subject_cert);
         ci->cert = subject_cert;
         cert_compute_fpr (subject_cert, ci->fpr);
+        ci->s_sig = s_sig;
+        ci->s_hash = s_hash;
+        ci->s_pkey = s_pkey;
+        s_sig = s_hash = s_pkey = NULL;
         ci->next = chain;
         chain = ci;
       }
 
-      if (opt.verbose)
-        log_info (_("certificate is good\n"));
-
       /* Now to the next level up.  */
       subject_cert = issuer_cert;
       issuer_cert = NULL;
     }
 
+  /* Now check the signatures of the entire chain.  */
+  err = check_chain_sigs (chain);
+  if (err)
+    {
+      log_error (_("certificate has a BAD signature"));
+      err = gpg_error (GPG_ERR_BAD_CERT_CHAIN);
+      goto leave;
+    }
+
   /* Even if we have no error here we need to check whether we
    * encountered an error somewhere during the checks.  Set the error
    * code to the most critical one.  */
@@ -845,6 +1034,9 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
     gnupg_copy_time (r_exptime, exptime);
   ksba_free (issuer);
   ksba_free (subject);
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_hash);
+  gcry_sexp_release (s_pkey);
   ksba_cert_release (issuer_cert);
   if (subject_cert != cert)
     ksba_cert_release (subject_cert);
@@ -853,6 +1045,9 @@ validate_cert_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t r_exptime,
       chain_item_t ci_next = chain->next;
       if (chain->cert)
         ksba_cert_release (chain->cert);
+      gcry_sexp_release (chain->s_sig);
+      gcry_sexp_release (chain->s_hash);
+      gcry_sexp_release (chain->s_pkey);
       xfree (chain);
       chain = ci_next;
     }
@@ -948,11 +1143,16 @@ uint_from_buffer (const void *buffer, size_t buflen)
 }
 
 
-/* Check the signature on CERT using the ISSUER_CERT.  This function
- * does only test the cryptographic signature and nothing else.  It is
- * assumed that the ISSUER_CERT is valid.  */
+/* Prepare the check of the signature on CERT using the ISSUER_CERT.
+ * On success the signature value, the hash and the public key are
+ * stored at R_SIG, R_HASH and R_PKEY; the actual check is then a
+ * gcry_pk_verify of them, which does not need access to the
+ * certificates and can thus be run on any thread.  This function
+ * does only consider the cryptographic signature and nothing else.
+ * It is assumed that the ISSUER_CERT is valid.  */
 static gpg_error_t
-check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
+prepare_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert,
+                  gcry_sexp_t *r_sig, gcry_sexp_t *r_hash, gcry_sexp_t *r_pkey)
 {
   gpg_error_t err;
   const char *algoid;
@@ -968,6 +1168,8 @@ check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
   int use_pss = 0;
   unsigned int saltlen = 0;  /* (use is actually controlled by use_pss) */
 
+  *r_sig = *r_hash = *r_pkey = NULL;
+
   /* Hash the target certificate using the algorithm from that certificate.  */
   algoid = ksba_cert_get_digest_algo (cert);
   algo = gcry_md_map_name (algoid);
@@ -1172,9 +1374,12 @@ check_cert_sig (ksba_cert_t issuer_cert, ksba_cert_t cert)
     }
 
   if (!err)
-    err = gcry_pk_verify (s_sig, s_hash, s_pkey);
-  if (DBG_X509)
-    log_debug ("%s: gcry_pk_verify: %s\n", __func__, gpg_strerror (err));
+    {
+      *r_sig = s_sig;
+      *r_hash = s_hash;
+      *r_pkey = s_pkey;
+      s_sig = s_hash = s_pkey = NULL;
+    }
 
  leave:
   gcry_md_close (md);
@@ -22,10 +22,27 @@
 #include <config.h>
 #include <stdlib.h>
 #include <string.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 
 
+/* The maximum number of worker threads per lane.  Tasks requiring
+ * network access and local tasks use separate lanes so that a slow
+ * network task does not hold up local tasks.  The limits also make
+ * sure that background tasks do not compete too much with the
+ * interactive sessions.  */
+#define MAX_NETWORK_WORKERS 2
+#define MAX_LOCAL_WORKERS   1
+
+enum wq_lanes
+  {
+    WQ_LANE_LOCAL,
+    WQ_LANE_NETWORK,
+    WQ_N_LANES
+  };
+
+
 /* An object for one item in the workqueue.  */
 struct wqitem_s
 {
@@ -34,10 +51,21 @@ struct wqitem_s
   /* This flag is set if the task requires network access.  */
   unsigned int need_network:1;
 
+  /* This flag is set if the task may be picked up by a worker.  */
+  unsigned int runnable:1;
+
+  /* The priority of the task; lower values run first.  */
+  int priority;
+
   /* The id of the session which created this task.  If this is 0 the
    * task is not associated with a specific session.  */
   unsigned int session_id;
 
+  /* The times the task was added and became runnable in
+   * milliseconds.  */
+  unsigned long queued_at;
+  unsigned long runnable_at;
+
   /* The function to perform the background task.  */
   wqtask_t func;
 
@@ -47,53 +75,135 @@ struct wqitem_s
 typedef struct wqitem_s *wqitem_t;
 
 
-/* The workque is a simple linked list.  */
+/* Statistics for one lane.  */
+struct wqstats_s
+{
+  unsigned int added;      /* Number of tasks added.  */
+  unsigned int deduped;    /* Number of tasks not added as duplicates.  */
+  unsigned int done;       /* Number of tasks run.  */
+  unsigned long waitsum;   /* Total and maximum time tasks waited  */
+  unsigned long waitmax;   /* after they became runnable (ms).     */
+  unsigned long runsum;    /* Total and maximum run time (ms).  */
+  unsigned long runmax;
+};
+
+
+/* The workqueue is a linked list sorted by priority.  Tasks with the
+ * same priority are kept in the order they were added.  */
 static wqitem_t workqueue;
 
+/* The number of active workers per lane.  */
+static unsigned int active_workers[WQ_N_LANES];
+
+/* The statistics per lane.  */
+static struct wqstats_s wqstats[WQ_N_LANES];
+
+
+/* Return the current time in milliseconds.  */
+static unsigned long
+get_msec_time (void)
+{
+  struct timespec ts;
+
+  npth_clock_gettime (&ts);
+  return (unsigned long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* Return the lane for ITEM.  */
+static int
+lane_of (wqitem_t item)
+{
+  return item->need_network? WQ_LANE_NETWORK : WQ_LANE_LOCAL;
+}
+
 
 /* Dump the queue using Assuan status comments.  */
 void
 workqueue_dump_queue (ctrl_t ctrl)
 {
+  static const char *lanestr[WQ_N_LANES] = { "local", "network" };
   wqitem_t saved_workqueue;
   wqitem_t item;
-  unsigned int count;
+  unsigned int count[WQ_N_LANES];
+  unsigned long now;
+  struct wqstats_s *st;
+  int lane;
 
   /* Temporarily detach the entire workqueue so that other threads don't
    * get into our way.  */
   saved_workqueue = workqueue;
   workqueue = NULL;
+  now = get_msec_time ();
 
-  for (count=0, item = saved_workqueue; item; item = item->next)
-    count++;
+  memset (count, 0, sizeof count);
+  for (item = saved_workqueue; item; item = item->next)
+    count[lane_of (item)]++;
 
-  dirmngr_status_helpf (ctrl, "wq: number of entries: %u", count);
+  dirmngr_status_helpf (ctrl, "wq: number of entries: %u",
+                        count[WQ_LANE_LOCAL] + count[WQ_LANE_NETWORK]);
+  for (lane=0; lane < WQ_N_LANES; lane++)
+    {
+      st = wqstats + lane;
+      dirmngr_status_helpf (ctrl, "wq: lane %s: queued=%u workers=%u/%u"
+                            " added=%u deduped=%u done=%u"
+                            " wait(avg/max)=%lu/%lums"
+                            " run(avg/max)=%lu/%lums",
+                            lanestr[lane], count[lane], active_workers[lane],
+                            lane == WQ_LANE_NETWORK? MAX_NETWORK_WORKERS
+                            /**/                   : MAX_LOCAL_WORKERS,
+                            st->added, st->deduped, st->done,
+                            st->done? st->waitsum / st->done : 0, st->waitmax,
+                            st->done? st->runsum / st->done : 0, st->runmax);
+    }
   for (item = saved_workqueue; item; item = item->next)
-    dirmngr_status_helpf (ctrl, "wq: sess=%u net=%d %s(\"%.100s%s\")",
+    dirmngr_status_helpf (ctrl, "wq: sess=%u net=%d prio=%d%s age=%lus"
+                          " %s(\"%.100s%s\")",
                           item->session_id, item->need_network,
+                          item->priority, item->runnable? " runnable":"",
+                          (now - item->queued_at) / 1000,
                           item->func? item->func (NULL, NULL): "nop",
                           item->args, strlen (item->args) > 100? "[...]":"");
 
-  /* Restore the workqueue.  Actually we append the saved queue to
-   * handle a possibly updated workqueue.  */
-  if (!(item=workqueue))
-    workqueue = saved_workqueue;
-  else
+  /* Restore the workqueue.  Tasks added in the meantime are merged
+   * into the saved queue to keep the order by priority.  */
+  item = workqueue;
+  workqueue = saved_workqueue;
+  while (item)
     {
-      while (item->next)
-        item = item->next;
-      item->next = saved_workqueue;
+      wqitem_t next = item->next;
+      wqitem_t *wip;
+
+      for (wip = &workqueue; *wip; wip = &(*wip)->next)
+        if ((*wip)->priority > item->priority)
+          break;
+      item->next = *wip;
+      *wip = item;
+      item = next;
     }
 }
 
 
 /* Append the task (FUNC,ARGS) to the work queue.  FUNC shall return
- * its name when called with (NULL, NULL).  */
+ * its name when called with (NULL, NULL).  PRIORITY is one of the
+ * WQ_PRIO_ values.  A task is not added if the same task is already
+ * pending.  */
 gpg_error_t
 workqueue_add_task (wqtask_t func, const char *args, unsigned int session_id,
-                    int need_network)
+                    int need_network, int priority)
 {
-  wqitem_t item, wi;
+  wqitem_t item, *wip;
+
+  need_network = !!need_network;
+  for (item = workqueue; item; item = item->next)
+    if (item->func == func && !strcmp (item->args, args))
+      {
+        if (opt.verbose)
+          log_info ("session %u: task %s(\"%.100s\") already queued\n",
+                    session_id, func? func (NULL, NULL): "nop", args);
+        wqstats[need_network? WQ_LANE_NETWORK : WQ_LANE_LOCAL].deduped++;
+        return 0;
+      }
 
   item = xtrycalloc (1, sizeof *item + strlen (args));
   if (!item)
@@ -101,16 +211,16 @@ workqueue_add_task (wqtask_t func, const char *args, unsigned int session_id,
   strcpy (item->args, args);
   item->func = func;
   item->session_id = session_id;
-  item->need_network = !!need_network;
-
-  if (!(wi=workqueue))
-    workqueue = item;
-  else
-    {
-      while (wi->next)
-        wi = wi->next;
-      wi->next = item;
-    }
+  item->need_network = need_network;
+  item->priority = priority;
+  item->queued_at = get_msec_time ();
+
+  for (wip = &workqueue; *wip; wip = &(*wip)->next)
+    if ((*wip)->priority > priority)
+      break;
+  item->next = *wip;
+  *wip = item;
+  wqstats[lane_of (item)].added++;
   return 0;
 }
 
@@ -120,95 +230,175 @@ workqueue_add_task (wqtask_t func, const char *args, unsigned int session_id,
 static void
 run_a_task (ctrl_t ctrl, wqitem_t item)
 {
+  struct wqstats_s *st = wqstats + lane_of (item);
+  unsigned long started, msec;
+
   log_assert (!item->next);
 
+  started = get_msec_time ();
+  msec = started - item->runnable_at;
+  st->waitsum += msec;
+  if (msec > st->waitmax)
+    st->waitmax = msec;
+
   if (opt.verbose)
-    log_info ("session %u: running %s(\"%s%s\")\n",
+    log_info ("session %u: running %s(\"%s%s\") after %lums\n",
               item->session_id,
               item->func? item->func (NULL, NULL): "nop",
-              item->args, strlen (item->args) > 100? "[...]":"");
+              item->args, strlen (item->args) > 100? "[...]":"", msec);
   if (item->func)
     item->func (ctrl, item->args);
 
+  msec = get_msec_time () - started;
+  st->runsum += msec;
+  if (msec > st->runmax)
+    st->runmax = msec;
+  st->done++;
+
   xfree (item);
 }
 
 
+/* Detach and return the first runnable task for LANE or NULL if none
+ * is available.  */
+static wqitem_t
+take_a_task (int lane)
+{
+  wqitem_t item, *wip;
+
+  for (wip = &workqueue; (item = *wip); wip = &item->next)
+    if (item->runnable && lane_of (item) == lane)
+      {
+        *wip = item->next;
+        item->next = NULL;
+        return item;
+      }
+  return NULL;
+}
+
+
+/* The thread running the tasks of the lane given by ARG until no
+ * runnable task is left.  */
+static void *
+worker_thread (void *arg)
+{
+  int lane = (int)(long)arg;
+  struct server_control_s ctrlbuf;
+  wqitem_t item;
+
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl (&ctrlbuf);
+
+  while ((item = take_a_task (lane)))
+    run_a_task (&ctrlbuf, item);
+  active_workers[lane]--;
+
+  dirmngr_deinit_default_ctrl (&ctrlbuf);
+  return NULL;
+}
+
+
+/* Start workers for all lanes with runnable tasks as long as the
+ * limits allow.  If no thread can be created the tasks are run by
+ * the caller using CTRL.  */
+static void
+dispatch_tasks (ctrl_t ctrl)
+{
+  static const unsigned int maxworkers[WQ_N_LANES] =
+    { MAX_LOCAL_WORKERS, MAX_NETWORK_WORKERS };
+  unsigned int want[WQ_N_LANES];
+  wqitem_t item;
+  npth_t thread;
+  npth_attr_t tattr;
+  int lane, err;
+
+  memset (want, 0, sizeof want);
+  for (item = workqueue; item; item = item->next)
+    if (item->runnable)
+      want[lane_of (item)]++;
+
+  for (lane=0; lane < WQ_N_LANES; lane++)
+    {
+      while (want[lane] && active_workers[lane] < maxworkers[lane])
+        {
+          err = npth_attr_init (&tattr);
+          if (!err)
+            {
+              npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+              err = npth_create (&thread, &tattr, worker_thread,
+                                 (void *)(long)lane);
+              npth_attr_destroy (&tattr);
+            }
+          if (err)
+            {
+              log_error ("error spawning workqueue thread: %s\n",
+                         strerror (err));
+              if (!ctrl)
+                break;
+              while ((item = take_a_task (lane)))
+                run_a_task (ctrl, item);
+              break;
+            }
+          active_workers[lane]++;
+          want[lane]--;
+        }
+    }
+}
+
+
 /* Run tasks not associated with a session.  This is called from the
  * ticker every few minutes.  If WITH_NETWORK is not set tasks which
- * require the network are not run.  */
+ * require the network are not run.  The tasks are run by worker
+ * threads.  */
 void
 workqueue_run_global_tasks (ctrl_t ctrl, int with_network)
 {
-  wqitem_t item, prev;
-
-  with_network = !!with_network;
+  wqitem_t item;
+  unsigned long now = get_msec_time ();
 
   if (opt.verbose)
     log_info ("running scheduled tasks%s\n", with_network?" (with network)":"");
 
-  for (;;)
-    {
-      prev = NULL;
-      for (item = workqueue; item; prev = item, item = item->next)
-        if (!item->session_id
-            && (!item->need_network || (item->need_network && with_network)))
-          break;
-      if (!item)
-        break;  /* No more tasks to run.  */
-
-      /* Detach that item from the workqueue.  */
-      if (!prev)
-        workqueue = item->next;
-      else
-        prev->next = item->next;
-      item->next = NULL;
-
-      /* Run the task.  */
-      run_a_task (ctrl, item);
-    }
+  for (item = workqueue; item; item = item->next)
+    if (!item->runnable && !item->session_id
+        && (!item->need_network || with_network))
+      {
+        item->runnable = 1;
+        item->runnable_at = now;
+      }
+
+  dispatch_tasks (ctrl);
 }
 
 
 /* Run tasks scheduled for running after a session.  Those tasks are
- * identified by the SESSION_ID.  */
+ * identified by the SESSION_ID.  The tasks are run by worker threads
+ * in the order of their priority together with other runnable
+ * tasks.  */
 void
 workqueue_run_post_session_tasks (unsigned int session_id)
 {
   struct server_control_s ctrlbuf;
-  ctrl_t ctrl = NULL;
-  wqitem_t item, prev;
+  wqitem_t item;
+  unsigned long now;
+  int any = 0;
 
   if (!session_id)
     return;
 
-  for (;;)
-    {
-      prev = NULL;
-      for (item = workqueue; item; prev = item, item = item->next)
-        if (item->session_id == session_id)
-          break;
-      if (!item)
-        break;  /* No more tasks for this session.  */
-
-      /* Detach that item from the workqueue.  */
-      if (!prev)
-        workqueue = item->next;
-      else
-        prev->next = item->next;
-      item->next = NULL;
-
-      /* Create a CTRL object the first time we need it.  */
-      if (!ctrl)
-        {
-          memset (&ctrlbuf, 0, sizeof ctrlbuf);
-          ctrl = &ctrlbuf;
-          dirmngr_init_default_ctrl (ctrl);
-        }
-
-      /* Run the task.  */
-      run_a_task (ctrl, item);
-    }
+  now = get_msec_time ();
+  for (item = workqueue; item; item = item->next)
+    if (item->session_id == session_id && !item->runnable)
+      {
+        item->runnable = 1;
+        item->runnable_at = now;
+        any = 1;
+      }
+  if (!any)
+    return;
 
-  dirmngr_deinit_default_ctrl (ctrl);
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl (&ctrlbuf);
+  dispatch_tasks (&ctrlbuf);
+  dirmngr_deinit_default_ctrl (&ctrlbuf);
 }
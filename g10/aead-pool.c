@@ -0,0 +1,448 @@
+/* aead-pool.c - Worker threads for AEAD chunk processing
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Each AEAD chunk has its own nonce and tag and can thus be
+ * processed independently of the other chunks.  This module runs a
+ * set of worker threads, each with its own cipher handle, which
+ * encrypt or decrypt complete chunks.  The caller fills jobs in
+ * chunk order and retrieves the results in the same order, so that
+ * the output stream is identical to the one created by the
+ * sequential code.
+ *
+ * The jobs are kept in a ring.  HEAD is the oldest submitted job and
+ * NSUBMITTED jobs starting at HEAD are either queued, being processed
+ * or done.  The job following them is the one the caller may fill.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/openpgpdefs.h"
+#include "aead-pool.h"
+
+
+/* The states of a job.  */
+enum
+  {
+    JOB_FREE = 0,
+    JOB_QUEUED,
+    JOB_BUSY,
+    JOB_DONE
+  };
+
+
+struct aead_worker_s
+{
+  aead_pool_t pool;
+  npth_t thd;
+  unsigned int started : 1;
+  gcry_cipher_hd_t hd;
+};
+
+
+struct aead_pool_s
+{
+  struct aead_pool_parm_s parm;
+  byte startiv[16];
+  size_t chunksize;
+
+  npth_mutex_t mutex;
+  npth_cond_t work_cond;      /* Signaled when a job has been queued.  */
+  npth_cond_t done_cond;      /* Signaled when a job is done.  */
+  unsigned int stop : 1;      /* Tell the workers to terminate.  */
+
+  unsigned int head;
+  unsigned int nsubmitted;
+  unsigned int njobs;
+  struct aead_pool_job_s *jobs;
+
+  unsigned int nworkers;
+  struct aead_worker_s workers[1];
+};
+
+
+static void
+lock_pool (aead_pool_t pool)
+{
+  int rc = npth_mutex_lock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pool (aead_pool_t pool)
+{
+  int rc = npth_mutex_unlock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Set the nonce and the additional data for the chunk CHUNKINDEX on
+ * the handle HD.  Same as the code in cipher-aead.c and
+ * decrypt-data.c but without debug output because this runs in a
+ * worker thread.  */
+static gpg_error_t
+set_nonce_and_ad (aead_pool_t pool, gcry_cipher_hd_t hd, uint64_t chunkindex)
+{
+  gpg_error_t err;
+  unsigned char nonce[16];
+  unsigned char ad[13];
+  int i;
+
+  switch (pool->parm.aead_algo)
+    {
+    case AEAD_ALGO_OCB:
+      memcpy (nonce, pool->startiv, 15);
+      i = 7;
+      break;
+
+    case AEAD_ALGO_EAX:
+      memcpy (nonce, pool->startiv, 16);
+      i = 8;
+      break;
+
+    default:
+      return gpg_error (GPG_ERR_INV_CIPHER_MODE);
+    }
+
+  nonce[i++] ^= chunkindex >> 56;
+  nonce[i++] ^= chunkindex >> 48;
+  nonce[i++] ^= chunkindex >> 40;
+  nonce[i++] ^= chunkindex >> 32;
+  nonce[i++] ^= chunkindex >> 24;
+  nonce[i++] ^= chunkindex >> 16;
+  nonce[i++] ^= chunkindex >>  8;
+  nonce[i++] ^= chunkindex;
+  err = gcry_cipher_setiv (hd, nonce, i);
+  if (err)
+    return err;
+
+  ad[0] = (0xc0 | PKT_ENCRYPTED_AEAD);
+  ad[1] = 1;
+  ad[2] = pool->parm.cipher_algo;
+  ad[3] = pool->parm.aead_algo;
+  ad[4] = pool->parm.chunkbyte;
+  ad[5] = chunkindex >> 56;
+  ad[6] = chunkindex >> 48;
+  ad[7] = chunkindex >> 40;
+  ad[8] = chunkindex >> 32;
+  ad[9] = chunkindex >> 24;
+  ad[10]= chunkindex >> 16;
+  ad[11]= chunkindex >>  8;
+  ad[12]= chunkindex;
+  return gcry_cipher_authenticate (hd, ad, 13);
+}
+
+
+/* Encrypt or decrypt the chunk described by JOB in place.  */
+static gpg_error_t
+process_job (aead_pool_t pool, gcry_cipher_hd_t hd, aead_pool_job_t job)
+{
+  gpg_error_t err;
+
+  err = set_nonce_and_ad (pool, hd, job->chunkindex);
+  if (err)
+    return err;
+  gcry_cipher_final (hd);
+  if (pool->parm.decrypt)
+    {
+      err = gcry_cipher_decrypt (hd, job->buffer, job->len, NULL, 0);
+      if (!err)
+        err = gcry_cipher_checktag (hd, job->tag, 16);
+    }
+  else
+    {
+      err = gcry_cipher_encrypt (hd, job->buffer, job->len, NULL, 0);
+      if (!err)
+        err = gcry_cipher_gettag (hd, job->tag, 16);
+    }
+  return err;
+}
+
+
+/* Return the first queued job or NULL.  Must be called with the
+ * lock held.  */
+static aead_pool_job_t
+find_queued_job (aead_pool_t pool)
+{
+  unsigned int i;
+  aead_pool_job_t job;
+
+  for (i = 0; i < pool->nsubmitted; i++)
+    {
+      job = pool->jobs + (pool->head + i) % pool->njobs;
+      if (job->state == JOB_QUEUED)
+        return job;
+    }
+  return NULL;
+}
+
+
+static void *
+aead_worker (void *arg)
+{
+  struct aead_worker_s *wk = arg;
+  aead_pool_t pool = wk->pool;
+  aead_pool_job_t job;
+  gpg_error_t err;
+
+  for (;;)
+    {
+      lock_pool (pool);
+      while (!pool->stop && !(job = find_queued_job (pool)))
+        npth_cond_wait (&pool->work_cond, &pool->mutex);
+      if (pool->stop)
+        {
+          unlock_pool (pool);
+          break;
+        }
+      job->state = JOB_BUSY;
+      unlock_pool (pool);
+
+      npth_unprotect ();
+      err = process_job (pool, wk->hd, job);
+      npth_protect ();
+
+      lock_pool (pool);
+      job->err = err;
+      job->state = JOB_DONE;
+      npth_cond_broadcast (&pool->done_cond);
+      unlock_pool (pool);
+    }
+
+  return NULL;
+}
+
+
+/* Create a new pool with NTHREADS worker threads for the AEAD packet
+ * described by PARM.  NTHREADS is limited to AEAD_POOL_MAX_THREADS.  The start IV is copied; the key is only used
+ * to set up the workers' cipher handles.  */
+gpg_error_t
+aead_pool_new (aead_pool_t *r_pool, unsigned int nthreads,
+               const struct aead_pool_parm_s *parm)
+{
+  gpg_error_t err = 0;
+  aead_pool_t pool;
+  npth_attr_t tattr;
+  unsigned int i;
+  int rc;
+
+  *r_pool = NULL;
+  if (!nthreads || parm->chunkbyte > AEAD_POOL_MAX_CHUNKBYTE)
+    return gpg_error (GPG_ERR_INV_ARG);
+  if (nthreads > AEAD_POOL_MAX_THREADS)
+    nthreads = AEAD_POOL_MAX_THREADS;
+
+  pool = xtrycalloc (1, sizeof *pool + (nthreads - 1) * sizeof *pool->workers);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->parm = *parm;
+  memcpy (pool->startiv, parm->startiv, 16);
+  pool->parm.startiv = pool->startiv;
+  pool->parm.key = NULL;
+  pool->chunksize = (size_t)1 << (parm->chunkbyte + 6);
+
+  rc = npth_mutex_init (&pool->mutex, NULL);
+  if (rc)
+    {
+      xfree (pool);
+      return gpg_error_from_errno (rc);
+    }
+  npth_cond_init (&pool->work_cond, NULL);
+  npth_cond_init (&pool->done_cond, NULL);
+
+  /* Two extra jobs so that the workers are kept busy while the
+   * caller fills one job and writes out another.  */
+  pool->njobs = nthreads + 2;
+  pool->jobs = xtrycalloc (pool->njobs, sizeof *pool->jobs);
+  if (!pool->jobs)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (i = 0; i < pool->njobs; i++)
+    {
+      pool->jobs[i].buffer = xtrymalloc (pool->chunksize);
+      if (!pool->jobs[i].buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  for (i = 0; i < nthreads; i++)
+    {
+      struct aead_worker_s *wk = pool->workers + i;
+
+      wk->pool = pool;
+      err = gcry_cipher_open (&wk->hd, parm->gcry_algo, parm->gcry_mode,
+                              GCRY_CIPHER_SECURE);
+      if (!err)
+        err = gcry_cipher_setkey (wk->hd, parm->key, parm->keylen);
+      if (gpg_err_code (err) == GPG_ERR_WEAK_KEY)
+        err = 0;  /* The caller already printed a warning.  */
+      if (err)
+        goto leave;
+      pool->nworkers++;
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i = 0; i < pool->nworkers; i++)
+    {
+      rc = npth_create (&pool->workers[i].thd, &tattr, aead_worker,
+                        pool->workers + i);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          break;
+        }
+      pool->workers[i].started = 1;
+    }
+  npth_attr_destroy (&tattr);
+
+ leave:
+  if (err)
+    {
+      log_error ("error creating AEAD worker pool: %s\n", gpg_strerror (err));
+      aead_pool_release (pool);
+    }
+  else
+    *r_pool = pool;
+  return err;
+}
+
+
+/* Stop all workers and release POOL.  Jobs not yet retrieved are
+ * discarded.  */
+void
+aead_pool_release (aead_pool_t pool)
+{
+  unsigned int i;
+
+  if (!pool)
+    return;
+
+  lock_pool (pool);
+  pool->stop = 1;
+  npth_cond_broadcast (&pool->work_cond);
+  unlock_pool (pool);
+  for (i = 0; i < pool->nworkers; i++)
+    {
+      if (pool->workers[i].started)
+        npth_join (pool->workers[i].thd, NULL);
+      gcry_cipher_close (pool->workers[i].hd);
+    }
+
+  if (pool->jobs)
+    {
+      for (i = 0; i < pool->njobs; i++)
+        if (pool->jobs[i].buffer)
+          {
+            /* The buffers may hold plaintext.  */
+            wipememory (pool->jobs[i].buffer, pool->chunksize);
+            xfree (pool->jobs[i].buffer);
+          }
+      xfree (pool->jobs);
+    }
+  npth_cond_destroy (&pool->work_cond);
+  npth_cond_destroy (&pool->done_cond);
+  npth_mutex_destroy (&pool->mutex);
+  xfree (pool);
+}
+
+
+/* Return the next job for filling or NULL if all jobs are in use; in
+ * the latter case the caller needs to retrieve a result first.  The
+ * job's BUFFER has room for a complete chunk; LEN is set to 0 and
+ * CHUNKINDEX must be set by the caller.  */
+aead_pool_job_t
+aead_pool_get_job (aead_pool_t pool)
+{
+  aead_pool_job_t job;
+
+  if (pool->nsubmitted == pool->njobs)
+    return NULL;
+  job = pool->jobs + (pool->head + pool->nsubmitted) % pool->njobs;
+  log_assert (job->state == JOB_FREE);
+  job->len = 0;
+  job->err = 0;
+  return job;
+}
+
+
+/* Hand the filled JOB, which must be the one returned by the last
+ * call of aead_pool_get_job, to the workers.  */
+void
+aead_pool_submit (aead_pool_t pool, aead_pool_job_t job)
+{
+  log_assert (job == pool->jobs + ((pool->head + pool->nsubmitted)
+                                   % pool->njobs));
+  lock_pool (pool);
+  job->state = JOB_QUEUED;
+  pool->nsubmitted++;
+  npth_cond_signal (&pool->work_cond);
+  unlock_pool (pool);
+}
+
+
+/* Wait for the oldest submitted job and return it.  Returns NULL if
+ * no job has been submitted.  The caller must check the job's ERR
+ * and return it using aead_pool_put_job after consuming the data.  */
+aead_pool_job_t
+aead_pool_next_result (aead_pool_t pool)
+{
+  aead_pool_job_t job;
+
+  if (!pool->nsubmitted)
+    return NULL;
+  job = pool->jobs + pool->head;
+  lock_pool (pool);
+  while (job->state != JOB_DONE)
+    npth_cond_wait (&pool->done_cond, &pool->mutex);
+  unlock_pool (pool);
+  return job;
+}
+
+
+/* Give the JOB returned by aead_pool_next_result back to POOL.  */
+void
+aead_pool_put_job (aead_pool_t pool, aead_pool_job_t job)
+{
+  log_assert (job == pool->jobs + pool->head && job->state == JOB_DONE);
+  lock_pool (pool);
+  job->state = JOB_FREE;
+  pool->head = (pool->head + 1) % pool->njobs;
+  pool->nsubmitted--;
+  unlock_pool (pool);
+}
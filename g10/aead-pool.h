@@ -0,0 +1,71 @@
+/* aead-pool.h - Worker threads for AEAD chunk processing
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_AEAD_POOL_H
+#define G10_AEAD_POOL_H
+
+/* The largest chunkbyte we process with a pool.  Each job holds a
+ * complete chunk and thus larger chunks would require too much
+ * memory; this limit corresponds to the default chunk size of 4
+ * MiB.  */
+#define AEAD_POOL_MAX_CHUNKBYTE 16
+
+/* The maximum number of worker threads.  */
+#define AEAD_POOL_MAX_THREADS 64
+
+/* The parameters of the AEAD packet.  */
+struct aead_pool_parm_s
+{
+  int decrypt;             /* True for decryption.  */
+  int gcry_algo;           /* The Libgcrypt cipher algorithm.  */
+  int gcry_mode;           /* The Libgcrypt cipher mode.  */
+  byte cipher_algo;        /* The OpenPGP cipher algorithm.  */
+  byte aead_algo;          /* The OpenPGP AEAD algorithm.  */
+  byte chunkbyte;          /* The encoded chunk size.  */
+  const byte *startiv;     /* The start IV (16 bytes).  */
+  const void *key;         /* The key and its length.  */
+  size_t keylen;
+};
+
+/* A job to process one chunk.  */
+struct aead_pool_job_s
+{
+  byte *buffer;            /* The data; room for a full chunk.  */
+  size_t len;              /* The used length of BUFFER.  */
+  uint64_t chunkindex;     /* The index of this chunk.  */
+  byte tag[16];            /* The tag; computed by encryption or
+                            * checked by decryption.  */
+  gpg_error_t err;         /* The result of the job.  */
+  int state;               /* Internal.  */
+};
+typedef struct aead_pool_job_s *aead_pool_job_t;
+
+struct aead_pool_s;
+typedef struct aead_pool_s *aead_pool_t;
+
+
+/*-- aead-pool.c --*/
+gpg_error_t aead_pool_new (aead_pool_t *r_pool, unsigned int nthreads,
+                           const struct aead_pool_parm_s *parm);
+void aead_pool_release (aead_pool_t pool);
+aead_pool_job_t aead_pool_get_job (aead_pool_t pool);
+void aead_pool_submit (aead_pool_t pool, aead_pool_job_t job);
+aead_pool_job_t aead_pool_next_result (aead_pool_t pool);
+void aead_pool_put_job (aead_pool_t pool, aead_pool_job_t job);
+
+#endif /*G10_AEAD_POOL_H*/
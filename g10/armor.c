@@ -34,6 +34,7 @@
 #include "options.h"
 #include "main.h"
 #include "../common/i18n.h"
+#include "radix64.h"
 
 #define MAX_LINELEN 20000
 
@@ -114,20 +115,11 @@ armor_filter_context_t *
 new_armor_context (void)
 {
   armor_filter_context_t *afx;
-  gpg_error_t err;
 
   afx = xcalloc (1, sizeof *afx);
   if (afx)
     {
-      err = gcry_md_open (&afx->crc_md, GCRY_MD_CRC24_RFC2440, 0);
-      if (err != 0)
-	{
-	  log_error ("gcry_md_open failed for GCRY_MD_CRC24_RFC2440: %s",
-		    gpg_strerror (err));
-	  xfree (afx);
-	  return NULL;
-	}
-
+      afx->crc = RADIX64_CRC24_INIT;
       afx->refcount = 1;
     }
 
@@ -144,7 +136,6 @@ release_armor_context (armor_filter_context_t *afx)
   log_assert (afx->refcount);
   if ( --afx->refcount )
     return;
-  gcry_md_close (afx->crc_md);
   xfree (afx);
 }
 
@@ -194,24 +185,6 @@ initialize(void)
 }
 
 
-static inline u32
-get_afx_crc (armor_filter_context_t *afx)
-{
-  const byte *crc_buf;
-  u32 crc;
-
-  crc_buf = gcry_md_read (afx->crc_md, GCRY_MD_CRC24_RFC2440);
-
-  crc = crc_buf[0];
-  crc <<= 8;
-  crc |= crc_buf[1];
-  crc <<= 8;
-  crc |= crc_buf[2];
-
-  return crc;
-}
-
-
 /*
  * Check whether this is an armored file.  See also
  * parse-packet.c for details on this code.
@@ -631,7 +604,7 @@ check_input( armor_filter_context_t *afx, IOBUF a )
 	afx->faked = 1;
     else {
 	afx->inp_checked = 1;
-	gcry_md_reset (afx->crc_md);
+	afx->crc = RADIX64_CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -823,7 +796,7 @@ fake_packet( armor_filter_context_t *afx, IOBUF a,
 	    }
 	}
 	afx->inp_checked = 1;
-	gcry_md_reset (afx->crc_md);
+	afx->crc = RADIX64_CRC24_INIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -855,6 +828,11 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     size_t n = 0;
     int idx, onlypad=0;
     int skip_fast = 0;
+    size_t crcpos = 0;
+    /* The CRC is optional (RFC-9580 even says that it must not be
+       used to reject a message); thus we do not compute it if the
+       user asked us to ignore CRC errors.  */
+    int docrc = !opt.ignore_crc_error;
 
     idx = afx->idx;
     val = afx->radbuf[0];
@@ -883,98 +861,41 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 		&& afx->buffer_pos + (16 - 1) < afx->buffer_len
 		&& n + 12 < size)
 	      {
-		/* Fast path for radix64 to binary conversion.  */
-		u32 b0,b1,b2,b3;
-
-		/* Speculatively load 15 more input bytes.  */
-		b0 = binc << (3 * 6);
-		b0 |= asctobin[2][afx->buffer[afx->buffer_pos + 0]];
-		b0 |= asctobin[1][afx->buffer[afx->buffer_pos + 1]];
-		b0 |= asctobin[0][afx->buffer[afx->buffer_pos + 2]];
-		b1  = asctobin[3][afx->buffer[afx->buffer_pos + 3]];
-		b1 |= asctobin[2][afx->buffer[afx->buffer_pos + 4]];
-		b1 |= asctobin[1][afx->buffer[afx->buffer_pos + 5]];
-		b1 |= asctobin[0][afx->buffer[afx->buffer_pos + 6]];
-		b2  = asctobin[3][afx->buffer[afx->buffer_pos + 7]];
-		b2 |= asctobin[2][afx->buffer[afx->buffer_pos + 8]];
-		b2 |= asctobin[1][afx->buffer[afx->buffer_pos + 9]];
-		b2 |= asctobin[0][afx->buffer[afx->buffer_pos + 10]];
-		b3  = asctobin[3][afx->buffer[afx->buffer_pos + 11]];
-		b3 |= asctobin[2][afx->buffer[afx->buffer_pos + 12]];
-		b3 |= asctobin[1][afx->buffer[afx->buffer_pos + 13]];
-		b3 |= asctobin[0][afx->buffer[afx->buffer_pos + 14]];
-
-		/* Check if any of the input bytes were invalid. */
-		if( (b0 | b1 | b2 | b3) != 0xffffffffUL )
-		  {
-		    /* All 16 bytes are valid. */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    buf[n + 9] = b3 >> (2 * 8);
-		    buf[n + 10] = b3 >> (1 * 8);
-		    buf[n + 11] = b3 >> (0 * 8);
-		    afx->buffer_pos += 16 - 1;
-		    n += 12;
-		    continue;
-		  }
-		else if( b0 == 0xffffffffUL )
-		  {
-		    /* byte[1..3] have invalid character(s).  Switch to slow
-		       path.  */
-		    skip_fast = 1;
-		  }
-		else if( b1 == 0xffffffffUL )
+		/* Fast path for radix64 to binary conversion.  We hand
+		   the rest of the line, including the already fetched
+		   character, to the block decoder which stops at the
+		   first group with an invalid character.  */
+		size_t avail, used;
+
+		avail = afx->buffer_len - afx->buffer_pos + 1;
+		if (avail > (size - n) / 3 * 4)
+		  avail = (size - n) / 3 * 4;
+		if (docrc)
 		  {
-		    /* byte[4..7] have invalid character(s), first 4 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    afx->buffer_pos += 4 - 1;
-		    n += 3;
-		    skip_fast = 1;
-		    continue;
+		    /* Checksum what the slow path decoded so far and
+		       let the block decoder update the CRC on the fly. */
+		    afx->crc = radix64_crc24 (afx->crc, buf + crcpos,
+					      n - crcpos);
+		    used = radix64_decode_block_crc
+		      (buf + n, afx->buffer + afx->buffer_pos - 1, avail,
+		       &afx->crc);
+		    crcpos = n + used / 4 * 3;
 		  }
-		else if( b2 == 0xffffffffUL )
-		  {
-		    /* byte[8..11] have invalid character(s), first 8 bytes are
-		       valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    afx->buffer_pos += 8 - 1;
-		    n += 6;
-		    skip_fast = 1;
-		    continue;
-		  }
-		else /*if( b3 == 0xffffffffUL )*/
+		else
+		  used = radix64_decode_block (buf + n,
+					       afx->buffer+afx->buffer_pos-1,
+					       avail);
+		if (used)
 		  {
-		    /* byte[12..15] have invalid character(s), first 12 bytes
-		       are valid.  */
-		    buf[n + 0] = b0 >> (2 * 8);
-		    buf[n + 1] = b0 >> (1 * 8);
-		    buf[n + 2] = b0 >> (0 * 8);
-		    buf[n + 3] = b1 >> (2 * 8);
-		    buf[n + 4] = b1 >> (1 * 8);
-		    buf[n + 5] = b1 >> (0 * 8);
-		    buf[n + 6] = b2 >> (2 * 8);
-		    buf[n + 7] = b2 >> (1 * 8);
-		    buf[n + 8] = b2 >> (0 * 8);
-		    afx->buffer_pos += 12 - 1;
-		    n += 9;
-		    skip_fast = 1;
+		    afx->buffer_pos += used - 1;
+		    n += used / 4 * 3;
+		    if (used < avail)
+		      skip_fast = 1;
 		    continue;
 		  }
+		/* byte[1..3] have invalid character(s).  Switch to slow
+		   path.  */
+		skip_fast = 1;
 	      }
 
 	    switch(idx)
@@ -1055,12 +976,12 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 
     if( n )
       {
-        gcry_md_write (afx->crc_md, buf, n);
+        if (docrc)
+          afx->crc = radix64_crc24 (afx->crc, buf + crcpos, n - crcpos);
         afx->any_data = 1;
       }
 
     if( checkcrc ) {
-	gcry_md_final (afx->crc_md);
 	afx->inp_checked=0;
 	afx->faked = 0;
 	for(;;) { /* skip lf and pad characters */
@@ -1128,9 +1049,9 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 		log_info(_("malformed CRC\n"));
 		rc = invalid_crc();
 	    }
-	    else if( mycrc != get_afx_crc (afx) ) {
+	    else if( docrc && mycrc != afx->crc ) {
 		log_info (_("CRC error; %06lX - %06lX\n"),
-				    (ulong)get_afx_crc (afx), (ulong)mycrc);
+				    (ulong)afx->crc, (ulong)mycrc);
 		rc = invalid_crc();
 	    }
 	    else {
@@ -1175,9 +1096,8 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
   byte radbuf[sizeof (afx->radbuf)];
   byte outbuf[64 + sizeof (afx->eol)];
   unsigned int eollen = strlen (afx->eol);
-  u32 in, in2;
+  u32 in;
   int idx, idx2;
-  int i;
 
   idx = afx->idx;
   idx2 = afx->idx2;
@@ -1223,25 +1143,9 @@ armor_output_buf_as_radix64 (armor_filter_context_t *afx, IOBUF a,
 	{
 	  /* idx and idx2 == 0 */
 
-	  for (i = 0; i < (64/8); i++)
-	    {
-	      in = (u32)buf[0] << (2 * 8);
-	      in |= (u32)buf[1] << (1 * 8);
-	      in |= (u32)buf[2] << (0 * 8);
-	      in2 = (u32)buf[3] << (2 * 8);
-	      in2 |= (u32)buf[4] << (1 * 8);
-	      in2 |= (u32)buf[5] << (0 * 8);
-	      outbuf[i*8+0] = bintoasc[(in >> 18) & 077];
-	      outbuf[i*8+1] = bintoasc[(in >> 12) & 077];
-	      outbuf[i*8+2] = bintoasc[(in >> 6) & 077];
-	      outbuf[i*8+3] = bintoasc[(in >> 0) & 077];
-	      outbuf[i*8+4] = bintoasc[(in2 >> 18) & 077];
-	      outbuf[i*8+5] = bintoasc[(in2 >> 12) & 077];
-	      outbuf[i*8+6] = bintoasc[(in2 >> 6) & 077];
-	      outbuf[i*8+7] = bintoasc[(in2 >> 0) & 077];
-	      buf+=6;
-	      size-=6;
-	    }
+	  radix64_encode_block (outbuf, buf, (64/4)*3);
+	  buf += (64/4)*3;
+	  size -= (64/4)*3;
 
 	  /* pgp doesn't like 72 here */
 	  iobuf_write (a, outbuf, 64 + eollen);
@@ -1474,11 +1378,11 @@ armor_filter( void *opaque, int control,
 	    afx->status++;
 	    afx->idx = 0;
 	    afx->idx2 = 0;
-	    gcry_md_reset (afx->crc_md);
+	    afx->crc = RADIX64_CRC24_INIT;
 	}
 
 	if( size ) {
-	    gcry_md_write (afx->crc_md, buf, size);
+	    afx->crc = radix64_crc24 (afx->crc, buf, size);
 	    armor_output_buf_as_radix64 (afx, a, buf, size);
         }
     }
@@ -1506,8 +1410,7 @@ armor_filter( void *opaque, int control,
 	if( afx->cancel )
 	    ;
 	else if( afx->status ) { /* pad, write checksum, and bottom line */
-	    gcry_md_final (afx->crc_md);
-	    crc = get_afx_crc (afx);
+	    crc = afx->crc;
 	    idx = afx->idx;
 	    idx2 = afx->idx2;
 	    if( idx ) {
@@ -29,6 +29,10 @@
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
 #endif
+#if defined(HAVE_MEMFD_CREATE) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_EXPORT_MEMFD 1
+#endif
 
 #include "lcr.h"
 #include <assuan.h>
@@ -43,9 +47,14 @@
 #include "../common/shareddefs.h"
 #include "../common/host2net.h"
 #include "../common/ttyio.h"
+#include "../common/tstats.h"
+#include "../common/starttrace.h"
 
 #define CONTROL_D ('D' - 'A' + 1)
 
+/* The number of digests sent with one PKSIGN_MULTI command.  */
+#define PKSIGN_MULTI_CHUNK 256
+
 
 static assuan_context_t agent_ctx = NULL;
 static int did_early_card_test;
@@ -77,6 +86,22 @@ struct cipher_parm_s
   size_t ciphertextlen;
 };
 
+struct decrypt_any_parm_s
+{
+  struct default_inq_parm_s *dflt;
+  assuan_context_t ctx;
+  char *keygrips;
+  unsigned char *ciphertexts;
+  size_t ciphertextslen;
+};
+
+struct digests_parm_s
+{
+  struct default_inq_parm_s *dflt;
+  const unsigned char *digests;
+  size_t digestslen;
+};
+
 struct writecert_parm_s
 {
   struct default_inq_parm_s *dflt;
@@ -117,6 +142,27 @@ static gpg_error_t learn_status_cb (void *opaque, const char *line);
 
 
 
+/* Wrapper around assuan_transact to account the time for
+ * --timing-stats.  */
+static gpg_error_t
+agent_transact (assuan_context_t ctx, const char *command,
+                gpg_error_t (*data_cb)(void *, const void *, size_t),
+                void *data_cb_arg,
+                gpg_error_t (*inquire_cb)(void *, const char *),
+                void *inquire_cb_arg,
+                gpg_error_t (*status_cb)(void *, const char *),
+                void *status_cb_arg)
+{
+  gpg_error_t err;
+
+  TSTAT_ENTER (TSTAT_AGENT);
+  err = assuan_transact (ctx, command, data_cb, data_cb_arg,
+                         inquire_cb, inquire_cb_arg, status_cb, status_cb_arg);
+  TSTAT_LEAVE (TSTAT_AGENT);
+  return err;
+}
+
+
 /* If RC is not 0, write an appropriate status message. */
 static void
 status_sc_op_failure (int rc)
@@ -246,6 +292,13 @@ start_agent (ctrl_t ctrl, int flag_for_card)
     rc = 0;
   else
     {
+      unsigned long long start = starttrace_clock ();
+
+      /* The connection is kept for the lifetime of the process; thus
+       * in server mode the handshake is done only once.  Use "--debug
+       * clock" to see what it costs for each short-lived process.  */
+      if (DBG_CLOCK)
+        log_clock ("enter agent session setup");
       rc = start_new_gpg_agent (&agent_ctx,
                                 GPG_ERR_SOURCE_DEFAULT,
                                 opt.agent_program,
@@ -270,18 +323,18 @@ start_agent (ctrl_t ctrl, int flag_for_card)
           /* Tell the agent that we support Pinentry notifications.
              No error checking so that it will work also with older
              agents.  */
-          assuan_transact (agent_ctx, "OPTION allow-pinentry-notify",
-                           NULL, NULL, NULL, NULL, NULL, NULL);
+          agent_transact (agent_ctx, "OPTION allow-pinentry-notify",
+                          NULL, NULL, NULL, NULL, NULL, NULL);
           /* Tell the agent about what version we are aware.  This is
              here used to indirectly enable GPG_ERR_FULLY_CANCELED.  */
-          assuan_transact (agent_ctx, "OPTION agent-awareness=2.1.0",
-                           NULL, NULL, NULL, NULL, NULL, NULL);
+          agent_transact (agent_ctx, "OPTION agent-awareness=2.1.0",
+                          NULL, NULL, NULL, NULL, NULL, NULL);
           /* Pass on the pinentry mode.  */
           if (opt.pinentry_mode)
             {
               char *tmp = xasprintf ("OPTION pinentry-mode=%s",
                                      str_pinentry_mode (opt.pinentry_mode));
-              rc = assuan_transact (agent_ctx, tmp,
+              rc = agent_transact (agent_ctx, tmp,
                                NULL, NULL, NULL, NULL, NULL, NULL);
               xfree (tmp);
               if (rc)
@@ -298,7 +351,7 @@ start_agent (ctrl_t ctrl, int flag_for_card)
             {
               char *tmp = xasprintf ("OPTION pretend-request-origin=%s",
                                      str_request_origin (opt.request_origin));
-              rc = assuan_transact (agent_ctx, tmp,
+              rc = agent_transact (agent_ctx, tmp,
                                NULL, NULL, NULL, NULL, NULL, NULL);
               xfree (tmp);
               if (rc)
@@ -315,8 +368,8 @@ start_agent (ctrl_t ctrl, int flag_for_card)
 #ifdef HAVE_W32_SYSTEM
           if (!rc && opt.compliance == CO_DE_VS)
             {
-              if (assuan_transact (agent_ctx, "GETINFO jent_active",
-                                   NULL, NULL, NULL, NULL, NULL, NULL))
+              if (agent_transact (agent_ctx, "GETINFO jent_active",
+                                  NULL, NULL, NULL, NULL, NULL, NULL))
                 {
                   rc = gpg_error (GPG_ERR_FORBIDDEN);
                   log_error (_("%s is not compliant with %s mode\n"),
@@ -328,6 +381,9 @@ start_agent (ctrl_t ctrl, int flag_for_card)
 #endif /*HAVE_W32_SYSTEM*/
 
         }
+      if (DBG_CLOCK)
+        log_clock ("leave agent session setup");
+      starttrace_phase ("agent connect", start);
     }
 
   if (!rc && flag_for_card && !did_early_card_test)
@@ -340,11 +396,11 @@ start_agent (ctrl_t ctrl, int flag_for_card)
       if (!(flag_for_card & FLAG_FOR_CARD_SUPPRESS_ERRORS))
         rc = warn_version_mismatch (agent_ctx, SCDAEMON_NAME, 2);
       if (!rc)
-        rc = assuan_transact (agent_ctx,
-                              opt.flags.use_only_openpgp_card?
-                              "SCD SERIALNO openpgp" : "SCD SERIALNO",
-                              NULL, NULL, NULL, NULL,
-                              learn_status_cb, &info);
+        rc = agent_transact (agent_ctx,
+                             opt.flags.use_only_openpgp_card?
+                             "SCD SERIALNO openpgp" : "SCD SERIALNO",
+                             NULL, NULL, NULL, NULL,
+                             learn_status_cb, &info);
       if (rc && !(flag_for_card & FLAG_FOR_CARD_SUPPRESS_ERRORS))
         {
           switch (gpg_err_code (rc))
@@ -383,6 +439,14 @@ start_agent (ctrl_t ctrl, int flag_for_card)
 }
 
 
+/* Return true if a connection to the agent has been established.  */
+int
+agent_is_connected (void)
+{
+  return !!agent_ctx;
+}
+
+
 /* Return a new malloced string by unescaping the string S.  Escaping
    is percent escaping and '+'/space mapping.  A binary nul will
    silently be replaced by a 0xFF.  Function returns NULL to indicate
@@ -810,10 +874,10 @@ agent_scd_learn (struct agent_card_info_s *info, int force)
     return rc;
 
   parm.ctx = agent_ctx;
-  rc = assuan_transact (agent_ctx,
-                        force ? "LEARN --sendinfo --force" : "LEARN --sendinfo",
-                        dummy_data_cb, NULL, default_inq_cb, &parm,
-                        learn_status_cb, info);
+  rc = agent_transact (agent_ctx,
+                       force ? "LEARN --sendinfo --force" : "LEARN --sendinfo",
+                       dummy_data_cb, NULL, default_inq_cb, &parm,
+                       learn_status_cb, info);
   /* Also try to get the key attributes.  */
   if (!rc)
     agent_scd_getattr ("KEY-ATTR", info);
@@ -969,10 +1033,10 @@ agent_scd_keypairinfo (ctrl_t ctrl, const char *keyref, keypair_info_t *r_list)
   else
     snprintf (line, DIM(line), "SCD LEARN --keypairinfo");
 
-  err = assuan_transact (agent_ctx, line,
-                         NULL, NULL,
-                         default_inq_cb, &inq_parm,
-                         scd_keypairinfo_status_cb, &parm);
+  err = agent_transact (agent_ctx, line,
+                        NULL, NULL,
+                        default_inq_cb, &inq_parm,
+                        scd_keypairinfo_status_cb, &parm);
   if (!err && !parm.kpinfo)
     err = gpg_error (GPG_ERR_NO_DATA);
 
@@ -1012,34 +1076,34 @@ agent_scd_apdu (const char *hexapdu, unsigned int *r_sw)
 
   if (!hexapdu)
     {
-      err = assuan_transact (agent_ctx, "SCD RESET",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "SCD RESET",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
 
     }
   else if (!strcmp (hexapdu, "reset-keep-lock"))
     {
-      err = assuan_transact (agent_ctx, "SCD RESET --keep-lock",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "SCD RESET --keep-lock",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
     }
   else if (!strcmp (hexapdu, "lock"))
     {
-      err = assuan_transact (agent_ctx, "SCD LOCK --wait",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "SCD LOCK --wait",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
     }
   else if (!strcmp (hexapdu, "trylock"))
     {
-      err = assuan_transact (agent_ctx, "SCD LOCK",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "SCD LOCK",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
     }
   else if (!strcmp (hexapdu, "unlock"))
     {
-      err = assuan_transact (agent_ctx, "SCD UNLOCK",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "SCD UNLOCK",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
     }
   else if (!strcmp (hexapdu, "undefined"))
     {
-      err = assuan_transact (agent_ctx, "SCD SERIALNO undefined",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "SCD SERIALNO undefined",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
     }
   else
     {
@@ -1051,8 +1115,8 @@ agent_scd_apdu (const char *hexapdu, unsigned int *r_sw)
       init_membuf (&mb, 256);
 
       snprintf (line, DIM(line), "SCD APDU %s", hexapdu);
-      err = assuan_transact (agent_ctx, line,
-                             put_membuf_cb, &mb, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, line,
+                            put_membuf_cb, &mb, NULL, NULL, NULL, NULL);
       if (!err)
         {
           data = get_membuf (&mb, &datalen);
@@ -1092,8 +1156,8 @@ agent_keytotpm (ctrl_t ctrl, const char *hexgrip)
   parm.ctx = agent_ctx;
   parm.ctrl = ctrl;
 
-  rc = assuan_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
-			NULL, NULL);
+  rc = agent_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
+		       NULL, NULL);
   if (rc)
     log_log (GPGRT_LOGLVL_ERROR, _("error from TPM: %s\n"), gpg_strerror (rc));
   return rc;
@@ -1131,8 +1195,8 @@ agent_keytocard (const char *hexgrip, int keyno, int force,
     return rc;
   parm.ctx = agent_ctx;
 
-  rc = assuan_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
-                        NULL, NULL);
+  rc = agent_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
+                       NULL, NULL);
   status_sc_op_failure (rc);
   return rc;
 }
@@ -1200,10 +1264,10 @@ agent_scd_getattr_one (const char *name, char **r_value)
   if (err)
     return err;
 
-  err = assuan_transact (agent_ctx, line,
-                         NULL, NULL,
-                         default_inq_cb, &inqparm,
-                         getattr_one_status_cb, &parm);
+  err = agent_transact (agent_ctx, line,
+                        NULL, NULL,
+                        default_inq_cb, &inqparm,
+                        getattr_one_status_cb, &parm);
   if (!err && parm.err)
     err = parm.err;
   else if (!err && !parm.data)
@@ -1254,17 +1318,17 @@ agent_scd_getattr (const char *name, struct agent_card_info_s *info)
     return rc;
 
   parm.ctx = agent_ctx;
-  rc = assuan_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
-                        learn_status_cb, info);
+  rc = agent_transact (agent_ctx, line, NULL, NULL, default_inq_cb, &parm,
+                       learn_status_cb, info);
   if (!rc && !strcmp (name, "KEY-FPR"))
     {
       /* Let the agent create the shadow keys if not yet done.  */
       if (info->fpr1len)
-        assuan_transact (agent_ctx, "READKEY --card --no-data -- $SIGNKEYID",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
+        agent_transact (agent_ctx, "READKEY --card --no-data -- $SIGNKEYID",
+                        NULL, NULL, NULL, NULL, NULL, NULL);
       if (info->fpr2len)
-        assuan_transact (agent_ctx, "READKEY --card --no-data -- $ENCRKEYID",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
+        agent_transact (agent_ctx, "READKEY --card --no-data -- $ENCRKEYID",
+                        NULL, NULL, NULL, NULL, NULL, NULL);
     }
 
   return rc;
@@ -1316,7 +1380,7 @@ agent_scd_setattr (const char *name, const void *value_arg, size_t valuelen)
   if (!err)
     {
       parm.ctx = agent_ctx;
-      err = assuan_transact (agent_ctx, line, NULL, NULL,
+      err = agent_transact (agent_ctx, line, NULL, NULL,
                             default_inq_cb, &parm, NULL, NULL);
     }
 
@@ -1374,8 +1438,8 @@ agent_scd_writecert (const char *certidstr,
   parms.certdata = certdata;
   parms.certdatalen = certdatalen;
 
-  rc = assuan_transact (agent_ctx, line, NULL, NULL,
-                        inq_writecert_parms, &parms, NULL, NULL);
+  rc = agent_transact (agent_ctx, line, NULL, NULL,
+                       inq_writecert_parms, &parms, NULL, NULL);
 
   return rc;
 }
@@ -1440,9 +1504,9 @@ agent_scd_genkey (int keyno, int force, u32 *createtime)
             keyno);
 
   dfltparm.ctx = agent_ctx;
-  rc = assuan_transact (agent_ctx, line,
-                        NULL, NULL, default_inq_cb, &dfltparm,
-                        scd_genkey_cb, createtime);
+  rc = agent_transact (agent_ctx, line,
+                       NULL, NULL, default_inq_cb, &dfltparm,
+                       scd_genkey_cb, createtime);
 
   status_sc_op_failure (rc);
   return rc;
@@ -1477,9 +1541,9 @@ agent_scd_serialno (char **r_serialno, const char *demand)
   else
     snprintf (line, DIM(line), "SCD SERIALNO --demand=%s", demand);
 
-  err = assuan_transact (agent_ctx, line,
-                         NULL, NULL, NULL, NULL,
-                         get_serialno_cb, &serialno);
+  err = agent_transact (agent_ctx, line,
+                        NULL, NULL, NULL, NULL,
+                        get_serialno_cb, &serialno);
   if (err)
     {
       xfree (serialno);
@@ -1522,10 +1586,10 @@ agent_scd_readcert (const char *certidstr,
   init_membuf (&data, 2048);
 
   snprintf (line, DIM(line), "SCD READCERT %s", certidstr);
-  rc = assuan_transact (agent_ctx, line,
-                        put_membuf_cb, &data,
-                        default_inq_cb, &dfltparm,
-                        NULL, NULL);
+  rc = agent_transact (agent_ctx, line,
+                       put_membuf_cb, &data,
+                       default_inq_cb, &dfltparm,
+                       NULL, NULL);
   if (rc)
     {
       xfree (get_membuf (&data, &len));
@@ -1621,10 +1685,10 @@ agent_scd_readkey (ctrl_t ctrl, const char *keyrefstr,
             "SCD READKEY --info%s -- %s",
             r_result? "":"-only", keyrefstr);
   keytime = 0;
-  err = assuan_transact (agent_ctx, line,
-                         put_membuf_cb, &data,
-                         default_inq_cb, &dfltparm,
-                         readkey_status_cb, &keytime);
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        default_inq_cb, &dfltparm,
+                        readkey_status_cb, &keytime);
   if (err)
     {
       xfree (get_membuf (&data, &len));
@@ -1704,9 +1768,9 @@ agent_scd_cardlist (strlist_t *result)
 
   strcpy (line, "SCD GETINFO card_list");
 
-  err = assuan_transact (agent_ctx, line,
-                         NULL, NULL, NULL, NULL,
-                         card_cardlist_cb, &parm);
+  err = agent_transact (agent_ctx, line,
+                        NULL, NULL, NULL, NULL,
+                        card_cardlist_cb, &parm);
   if (!err && parm.error)
     err = parm.error;
 
@@ -1737,9 +1801,9 @@ agent_scd_switchapp (const char *appname)
 
   snprintf (line, DIM(line), "SCD SWITCHAPP --%s%s",
             appname? " ":"", appname? appname:"");
-  return assuan_transact (agent_ctx, line,
-                          NULL, NULL, NULL, NULL,
-                          NULL, NULL);
+  return agent_transact (agent_ctx, line,
+                         NULL, NULL, NULL, NULL,
+                         NULL, NULL);
 }
 
 
@@ -1898,9 +1962,9 @@ agent_scd_keyinfo (const char *keygrip, int cap,
   if (err)
     return err;
 
-  err = assuan_transact (agent_ctx, line,
-                         NULL, NULL, NULL, NULL,
-                         card_keyinfo_cb, &parm);
+  err = agent_transact (agent_ctx, line,
+                        NULL, NULL, NULL, NULL,
+                        card_keyinfo_cb, &parm);
   if (!err && parm.error)
     err = parm.error;
 
@@ -1946,10 +2010,10 @@ agent_scd_change_pin (int chvno, const char *serialno)
   dfltparm.ctx = agent_ctx;
 
   snprintf (line, DIM(line), "SCD PASSWD %s %d", reset, chvno);
-  rc = assuan_transact (agent_ctx, line,
-                        NULL, NULL,
-                        default_inq_cb, &dfltparm,
-                        NULL, NULL);
+  rc = agent_transact (agent_ctx, line,
+                       NULL, NULL,
+                       default_inq_cb, &dfltparm,
+                       NULL, NULL);
   status_sc_op_failure (rc);
   return rc;
 }
@@ -1976,10 +2040,10 @@ agent_scd_checkpin  (const char *serialno)
   dfltparm.ctx = agent_ctx;
 
   snprintf (line, DIM(line), "SCD CHECKPIN %s", serialno);
-  rc = assuan_transact (agent_ctx, line,
-                        NULL, NULL,
-                        default_inq_cb, &dfltparm,
-                        NULL, NULL);
+  rc = agent_transact (agent_ctx, line,
+                       NULL, NULL,
+                       default_inq_cb, &dfltparm,
+                       NULL, NULL);
   status_sc_op_failure (rc);
   return rc;
 }
@@ -2021,11 +2085,11 @@ agent_get_passphrase (const char *cache_id,
   dfltparm.ctx = agent_ctx;
 
   /* Check that the gpg-agent understands the repeat option.  */
-  if (assuan_transact (agent_ctx,
-                       "GETINFO cmd_has_option GET_PASSPHRASE repeat",
-                       NULL, NULL, NULL, NULL, NULL, NULL))
+  if (agent_transact (agent_ctx,
+                      "GETINFO cmd_has_option GET_PASSPHRASE repeat",
+                      NULL, NULL, NULL, NULL, NULL, NULL))
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
-  have_newsymkey = !(assuan_transact
+  have_newsymkey = !(agent_transact
                      (agent_ctx,
                       "GETINFO cmd_has_option GET_PASSPHRASE newsymkey",
                       NULL, NULL, NULL, NULL, NULL, NULL));
@@ -2063,10 +2127,10 @@ agent_get_passphrase (const char *cache_id,
   init_membuf_secure (&data, 64);
   wasconf = assuan_get_flag (agent_ctx, ASSUAN_CONFIDENTIAL);
   assuan_begin_confidential (agent_ctx);
-  rc = assuan_transact (agent_ctx, line,
-                        put_membuf_cb, &data,
-                        default_inq_cb, &dfltparm,
-                        NULL, NULL);
+  rc = agent_transact (agent_ctx, line,
+                       put_membuf_cb, &data,
+                       default_inq_cb, &dfltparm,
+                       NULL, NULL);
   if (!wasconf)
     assuan_end_confidential (agent_ctx);
 
@@ -2108,10 +2172,10 @@ agent_clear_passphrase (const char *cache_id)
   dfltparm.ctx = agent_ctx;
 
   snprintf (line, DIM(line), "CLEAR_PASSPHRASE %s", cache_id);
-  return assuan_transact (agent_ctx, line,
-                          NULL, NULL,
-                          default_inq_cb, &dfltparm,
-                          NULL, NULL);
+  return agent_transact (agent_ctx, line,
+                         NULL, NULL,
+                         default_inq_cb, &dfltparm,
+                         NULL, NULL);
 }
 
 
@@ -2138,10 +2202,10 @@ gpg_agent_get_confirmation (const char *desc)
   snprintf (line, DIM(line), "GET_CONFIRMATION %s", tmp);
   xfree (tmp);
 
-  rc = assuan_transact (agent_ctx, line,
-                        NULL, NULL,
-                        default_inq_cb, &dfltparm,
-                        NULL, NULL);
+  rc = agent_transact (agent_ctx, line,
+                       NULL, NULL,
+                       default_inq_cb, &dfltparm,
+                       NULL, NULL);
   return rc;
 }
 
@@ -2161,7 +2225,7 @@ agent_get_s2k_count (void)
     goto leave;
 
   init_membuf (&data, 32);
-  err = assuan_transact (agent_ctx, "GETINFO s2k_count",
+  err = agent_transact (agent_ctx, "GETINFO s2k_count",
                         put_membuf_cb, &data,
                         NULL, NULL, NULL, NULL);
   if (err)
@@ -2271,8 +2335,8 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
 
   snprintf (line, sizeof line, "KEYINFO %s", hexgrip);
 
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
-                         keyinfo_status_cb, &keyinfo);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                        keyinfo_status_cb, &keyinfo);
   xfree (keyinfo.serialno);
   if (err)
     result = 0;
@@ -2295,8 +2359,8 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
   memset (&keyinfo, 0, sizeof keyinfo);
   snprintf (line, sizeof line, "KEYINFO %s", p);
 
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
-                         keyinfo_status_cb, &keyinfo);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                        keyinfo_status_cb, &keyinfo);
   xfree (keyinfo.serialno);
   if (err)
     result2 = 0;
@@ -2351,9 +2415,9 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
       membuf_t data;
 
       init_membuf (&data, 4096);
-      err = assuan_transact (agent_ctx, "HAVEKEY --list=1000",
-                             put_membuf_cb, &data,
-                             NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "HAVEKEY --list=1000",
+                            put_membuf_cb, &data,
+                            NULL, NULL, NULL, NULL);
       if (err)
         xfree (get_membuf (&data, NULL));
       else
@@ -2417,8 +2481,8 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
             if (nkeys
                 && ((p - line) + 4*KEYGRIP_LEN+1+1) > (ASSUAN_LINELENGTH - 2))
               {
-                err = assuan_transact (agent_ctx, line,
-                                       NULL, NULL, NULL, NULL, NULL, NULL);
+                err = agent_transact (agent_ctx, line,
+                                      NULL, NULL, NULL, NULL, NULL, NULL);
                 if (err != gpg_err_code (GPG_ERR_NO_SECKEY))
                   break; /* Seckey available or unexpected error - ready.  */
                 p = stpcpy (line, "HAVEKEY");
@@ -2452,8 +2516,8 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
       }
 
   if (!err && nkeys)
-    err = assuan_transact (agent_ctx, line,
-                           NULL, NULL, NULL, NULL, NULL, NULL);
+    err = agent_transact (agent_ctx, line,
+                          NULL, NULL, NULL, NULL, NULL, NULL);
 
   return err;
 }
@@ -2499,8 +2563,8 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
    * key in a key listing. */
   snprintf (line, DIM(line), "KEYINFO %.40s", hexkeygrip);
 
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
-                         keyinfo_status_cb, &keyinfo);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                        keyinfo_status_cb, &keyinfo);
   if (!err && keyinfo.serialno)
     {
       /* Sanity check for bad characters.  */
@@ -2630,8 +2694,8 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr, char **passwd_nonce_addr,
     ; /* A RESET would flush the passwd nonce cache.  */
   else
     {
-      err = assuan_transact (agent_ctx, "RESET",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "RESET",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
     }
@@ -2651,10 +2715,10 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr, char **passwd_nonce_addr,
             cache_nonce_addr && *cache_nonce_addr? *cache_nonce_addr:"");
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = NULL;
-  err = assuan_transact (agent_ctx, line,
-                         put_membuf_cb, &data,
-                         inq_genkey_parms, &gk_parm,
-                         cache_nonce_status_cb, &cn_parm);
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        inq_genkey_parms, &gk_parm,
+                        cache_nonce_status_cb, &cn_parm);
   if (err)
     {
       xfree (get_membuf (&data, &len));
@@ -2673,6 +2737,35 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr, char **passwd_nonce_addr,
 }
 
 
+/* Tell the agent that COUNT keys with the parameters KEYPARMS will
+ * soon be requested with agent_genkey so that it can generate them
+ * ahead of time.  Returns GPG_ERR_NOT_ENABLED if the agent has not
+ * been configured for this.  */
+gpg_error_t
+agent_pregen_keys (ctrl_t ctrl, const char *keyparms, unsigned int count)
+{
+  gpg_error_t err;
+  struct genkey_parm_s gk_parm;
+  struct default_inq_parm_s dfltparm;
+  char line[ASSUAN_LINELENGTH];
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  gk_parm.dflt     = &dfltparm;
+  gk_parm.keyparms = keyparms;
+  gk_parm.passphrase = NULL;
+  snprintf (line, sizeof line, "PREGEN %u", count);
+  return agent_transact (agent_ctx, line, NULL, NULL,
+                         inq_genkey_parms, &gk_parm, NULL, NULL);
+}
+
+
 /* Add the Link attribute to both given keys.  */
 gpg_error_t
 agent_crosslink_keys (ctrl_t ctrl, const char *hexgrip1, const char *hexgrip2)
@@ -2685,12 +2778,12 @@ agent_crosslink_keys (ctrl_t ctrl, const char *hexgrip1, const char *hexgrip2)
     goto leave;
 
   snprintf (line, sizeof line, "KEYATTR %s Link: %s", hexgrip1, hexgrip2);
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     goto leave;
 
   snprintf (line, sizeof line, "KEYATTR %s Link: %s", hexgrip2, hexgrip1);
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
 
  leave:
   return err;
@@ -2724,7 +2817,7 @@ agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
     return err;
   dfltparm.ctx = agent_ctx;
 
-  err = assuan_transact (agent_ctx, "RESET",NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, "RESET",NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
@@ -2734,10 +2827,10 @@ agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
     snprintf (line, DIM(line), "READKEY -- %s", hexkeygrip);
 
   init_membuf (&data, 1024);
-  err = assuan_transact (agent_ctx, line,
-                         put_membuf_cb, &data,
-                         default_inq_cb, &dfltparm,
-                         NULL, NULL);
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        default_inq_cb, &dfltparm,
+                        NULL, NULL);
   if (err)
     {
       xfree (get_membuf (&data, &len));
@@ -2790,20 +2883,20 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
   if (digestlen*2 + 50 > DIM(line))
     return gpg_error (GPG_ERR_GENERAL);
 
-  err = assuan_transact (agent_ctx, "RESET",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, "RESET",
+                        NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
   snprintf (line, DIM(line), "SIGKEY %s", keygrip);
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
   if (desc)
     {
       snprintf (line, DIM(line), "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                             NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -2811,7 +2904,7 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 
   snprintf (line, sizeof line, "SETHASH %d ", digestalgo);
   bin2hex (digest, digestlen, line + strlen (line));
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
@@ -2823,10 +2916,10 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 
   if (DBG_CLOCK)
     log_clock ("enter signing");
-  err = assuan_transact (agent_ctx, line,
-                         put_membuf_cb, &data,
-                         default_inq_cb, &dfltparm,
-                         NULL, NULL);
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        default_inq_cb, &dfltparm,
+                        NULL, NULL);
   if (DBG_CLOCK)
     log_clock ("leave signing");
 
@@ -2850,6 +2943,181 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+/* Handle a DIGESTS inquiry.  */
+static gpg_error_t
+inq_digests_cb (void *opaque, const char *line)
+{
+  struct digests_parm_s *parm = opaque;
+
+  if (has_leading_keyword (line, "DIGESTS"))
+    return assuan_send_data (parm->dflt->ctx,
+                             parm->digests, parm->digestslen);
+  return default_inq_cb (parm->dflt, line);
+}
+
+
+/* Sign COUNT digests, at most PKSIGN_MULTI_CHUNK, using one
+ * PKSIGN_MULTI command.  See agent_pksign_multi for the arguments.  */
+static gpg_error_t
+pksign_multi_chunk (ctrl_t ctrl, const char *cache_nonce,
+                    const char *keygrip, const char *desc,
+                    u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                    const unsigned char *digests, size_t digestlen,
+                    unsigned int count, int digestalgo,
+                    gcry_sexp_t *r_sigvals)
+{
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  membuf_t data;
+  struct default_inq_parm_s dfltparm;
+  struct digests_parm_s parm;
+  unsigned char *buf;
+  size_t len, n, off;
+  unsigned int i;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+  dfltparm.ctx = agent_ctx;
+  dfltparm.keyinfo.keyid       = keyid;
+  dfltparm.keyinfo.mainkeyid   = mainkeyid;
+  dfltparm.keyinfo.pubkey_algo = pubkey_algo;
+  parm.dflt = &dfltparm;
+  parm.digests = digests;
+  parm.digestslen = digestlen * count;
+
+  err = agent_transact (agent_ctx, "RESET",
+                        NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  snprintf (line, DIM(line), "SIGKEY %s", keygrip);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  if (desc)
+    {
+      snprintf (line, DIM(line), "SETKEYDESC %s", desc);
+      err = agent_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
+      if (err)
+        return err;
+    }
+
+  init_membuf (&data, 1024);
+
+  snprintf (line, sizeof line, "PKSIGN_MULTI %d %u%s%s",
+            digestalgo, count,
+            cache_nonce? " ":"",
+            cache_nonce? cache_nonce:"");
+
+  if (DBG_CLOCK)
+    log_clock ("enter signing");
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        inq_digests_cb, &parm,
+                        NULL, NULL);
+  if (DBG_CLOCK)
+    log_clock ("leave signing");
+
+  if (err)
+    {
+      xfree (get_membuf (&data, NULL));
+      return err;
+    }
+
+  buf = get_membuf (&data, &len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+
+  /* The signatures are returned as concatenated canonical
+   * S-expressions.  */
+  for (i=0, off=0; i < count && !err; i++, off += n)
+    {
+      n = (off < len
+           ? gcry_sexp_canon_len (buf + off, len - off, NULL, NULL) : 0);
+      if (!n)
+        err = gpg_error (GPG_ERR_INV_SEXP);
+      else
+        err = gcry_sexp_sscan (&r_sigvals[i], NULL, buf + off, n);
+    }
+  if (!err && off != len)
+    err = gpg_error (GPG_ERR_INV_SEXP);
+  xfree (buf);
+  return err;
+}
+
+
+/* Call the agent to sign COUNT digests with the key identified by
+ * the hex string KEYGRIP.  The digests are DIGESTLEN bytes each,
+ * concatenated at DIGESTS, and all computed with DIGESTALGO.  On
+ * success the signatures are stored in the same order at the array
+ * R_SIGVALS which must have space for COUNT items.  The other
+ * arguments are as for agent_pksign.  Compared to calling
+ * agent_pksign for each digest this saves most of the round trips
+ * and the agent unprotects the key only once.  An agent without the
+ * PKSIGN_MULTI command is served by calling agent_pksign.  */
+gpg_error_t
+agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                    const char *keygrip, const char *desc,
+                    u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                    const unsigned char *digests, size_t digestlen,
+                    unsigned int count, int digestalgo,
+                    gcry_sexp_t *r_sigvals)
+{
+  static int no_pksign_multi;
+  gpg_error_t err = 0;
+  unsigned int i, n;
+
+  for (i=0; i < count; i++)
+    r_sigvals[i] = NULL;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+
+  for (i=0; !no_pksign_multi && i < count; i += n)
+    {
+      n = count - i;
+      if (n > PKSIGN_MULTI_CHUNK)
+        n = PKSIGN_MULTI_CHUNK;
+      err = pksign_multi_chunk (ctrl, cache_nonce, keygrip, desc,
+                                keyid, mainkeyid, pubkey_algo,
+                                digests + i * digestlen, digestlen, n,
+                                digestalgo, r_sigvals + i);
+      if (gpg_err_code (err) == GPG_ERR_ASS_UNKNOWN_CMD)
+        {
+          no_pksign_multi = 1;  /* Old agent - use the fallback.  */
+          err = 0;
+          break;
+        }
+      else if (err)
+        goto leave;
+    }
+
+  for (; i < count; i++)
+    {
+      err = agent_pksign (ctrl, cache_nonce, keygrip, desc,
+                          keyid, mainkeyid, pubkey_algo,
+                          (unsigned char *)digests + i * digestlen,
+                          digestlen, digestalgo, &r_sigvals[i]);
+      if (err)
+        goto leave;
+    }
+
+ leave:
+  if (err)
+    {
+      for (i=0; i < count; i++)
+        {
+          gcry_sexp_release (r_sigvals[i]);
+          r_sigvals[i] = NULL;
+        }
+    }
+  return err;
+}
+
+
 
 /* Handle a CIPHERTEXT inquiry.  Note, we only send the data,
    assuan_transact takes care of flushing and writing the END. */
@@ -2941,20 +3209,20 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
     return err;
   dfltparm.ctx = agent_ctx;
 
-  err = assuan_transact (agent_ctx, "RESET",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, "RESET",
+                        NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
   snprintf (line, sizeof line, "SETKEY %.40s", keygrip);
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
+  err = agent_transact (agent_ctx, line, NULL, NULL, NULL, NULL, NULL, NULL);
   if (err)
     return err;
 
   if (*keygrip2)
     {
       snprintf (line, sizeof line, "SETKEY --another %.40s", keygrip2);
-      err = assuan_transact (agent_ctx, line, NULL, NULL,NULL,NULL,NULL,NULL);
+      err = agent_transact (agent_ctx, line, NULL, NULL,NULL,NULL,NULL,NULL);
       if (err)
         return err;
     }
@@ -2962,7 +3230,7 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
   if (desc)
     {
       snprintf (line, DIM(line), "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                             NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -2977,11 +3245,11 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
     err = make_canon_sexp (s_ciphertext, &parm.ciphertext, &parm.ciphertextlen);
     if (err)
       return err;
-    err = assuan_transact (agent_ctx,
-                           *keygrip2? "PKDECRYPT --kem=PQC-PGP":"PKDECRYPT",
-                           put_membuf_cb, &data,
-                           inq_ciphertext_cb, &parm,
-                           padding_info_cb, r_padding);
+    err = agent_transact (agent_ctx,
+                          *keygrip2? "PKDECRYPT --kem=PQC-PGP":"PKDECRYPT",
+                          put_membuf_cb, &data,
+                          inq_ciphertext_cb, &parm,
+                          padding_info_cb, r_padding);
     xfree (parm.ciphertext);
   }
   if (err)
@@ -3034,6 +3302,210 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
 }
 
 
+/* Handle the KEYGRIPS and CIPHERTEXTS inquiries of PKDECRYPT_ANY.  */
+static gpg_error_t
+inq_decrypt_any_cb (void *opaque, const char *line)
+{
+  struct decrypt_any_parm_s *parm = opaque;
+  gpg_error_t err;
+
+  if (has_leading_keyword (line, "KEYGRIPS"))
+    err = assuan_send_data (parm->ctx,
+                            parm->keygrips, strlen (parm->keygrips));
+  else if (has_leading_keyword (line, "CIPHERTEXTS"))
+    {
+      assuan_begin_confidential (parm->ctx);
+      err = assuan_send_data (parm->ctx,
+                              parm->ciphertexts, parm->ciphertextslen);
+      assuan_end_confidential (parm->ctx);
+    }
+  else
+    err = default_inq_cb (parm->dflt, line);
+
+  return err;
+}
+
+
+/* Parse one result item of PKDECRYPT_ANY at BUF of LEN bytes.  A
+ * "(value D)" is stored as a new buffer at R_BUF and R_BUFLEN, an
+ * "(error N)" as error code at R_ERR.  */
+static gpg_error_t
+parse_decrypt_any_item (const unsigned char *buf, size_t len,
+                        unsigned char **r_buf, size_t *r_buflen,
+                        gpg_error_t *r_err)
+{
+  const char *p;
+  char *endp;
+  unsigned long n;
+  int is_error;
+
+  if (len >= 8 && !memcmp (buf, "(5:value", 8))
+    is_error = 0;
+  else if (len >= 8 && !memcmp (buf, "(5:error", 8))
+    is_error = 1;
+  else
+    return gpg_error (GPG_ERR_INV_SEXP);
+
+  p = (const char *)buf + 8;
+  n = strtoul (p, &endp, 10);
+  if (!n || *endp != ':')
+    return gpg_error (GPG_ERR_INV_SEXP);
+  endp++;
+  if ((endp - (const char *)buf) + n + 1 > len)
+    return gpg_error (GPG_ERR_INV_SEXP);
+
+  if (is_error)
+    {
+      *r_err = (gpg_error_t)strtoul (endp, NULL, 10);
+      if (!*r_err)
+        *r_err = gpg_error (GPG_ERR_GENERAL);
+      return 0;
+    }
+
+  *r_buf = xtrymalloc_secure (n);
+  if (!*r_buf)
+    return gpg_error_from_syserror ();
+  memcpy (*r_buf, endp, n);
+  *r_buflen = n;
+  *r_err = 0;
+  return 0;
+}
+
+
+/* Call the agent to try the decryption of COUNT ciphertexts, at most
+ * AGENT_PKDECRYPT_ANY_MAX, the I-th of S_CIPHERTEXTS with the key
+ * identified by the I-th hex string of KEYGRIPS.  The agent tries
+ * only the keys which can be used without user interaction and runs
+ * the decryptions concurrently.  On success the decoded value of
+ * each item is stored at R_BUFS and R_BUFLENS as done by
+ * agent_pkdecrypt, or the error code of the item at R_ERRS; the
+ * error code GPG_ERR_NOT_SUPPORTED indicates that the key needs to
+ * be tried using agent_pkdecrypt.  The arrays need to have space for
+ * COUNT items.  The padding is not known.  GPG_ERR_NOT_SUPPORTED is
+ * returned if the agent does not support the command.  */
+gpg_error_t
+agent_pkdecrypt_any (ctrl_t ctrl, unsigned int count, char **keygrips,
+                     gcry_sexp_t *s_ciphertexts,
+                     unsigned char **r_bufs, size_t *r_buflens,
+                     gpg_error_t *r_errs)
+{
+  static int no_pkdecrypt_any;
+  gpg_error_t err;
+  char line[ASSUAN_LINELENGTH];
+  struct default_inq_parm_s dfltparm;
+  struct decrypt_any_parm_s parm;
+  membuf_t grips_mb, cipher_mb, data;
+  unsigned char *buf = NULL;
+  size_t n, off, len;
+  unsigned int i;
+
+  for (i=0; i < count; i++)
+    {
+      r_bufs[i] = NULL;
+      r_buflens[i] = 0;
+      r_errs[i] = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  if (no_pkdecrypt_any)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (!count || count > AGENT_PKDECRYPT_ANY_MAX)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+  memset (&parm, 0, sizeof parm);
+  parm.dflt = &dfltparm;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+  parm.ctx = agent_ctx;
+
+  err = agent_transact (agent_ctx, "RESET",
+                        NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  init_membuf (&grips_mb, 41 * count + 1);
+  init_membuf_secure (&cipher_mb, 1024);
+  init_membuf_secure (&data, 1024);
+  for (i=0; i < count; i++)
+    {
+      if (strlen (keygrips[i]) != 40)
+        {
+          err = gpg_error (GPG_ERR_INV_VALUE);
+          goto leave;
+        }
+      put_membuf_printf (&grips_mb, "%s\n", keygrips[i]);
+      err = make_canon_sexp (s_ciphertexts[i], &buf, &n);
+      if (err)
+        goto leave;
+      put_membuf (&cipher_mb, buf, n);
+      xfree (buf);
+      buf = NULL;
+    }
+  put_membuf (&grips_mb, "", 1);
+  parm.keygrips = get_membuf (&grips_mb, NULL);
+  parm.ciphertexts = get_membuf (&cipher_mb, &parm.ciphertextslen);
+  if (!parm.keygrips || !parm.ciphertexts)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  snprintf (line, sizeof line, "PKDECRYPT_ANY %u", count);
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        inq_decrypt_any_cb, &parm,
+                        NULL, NULL);
+  buf = get_membuf (&data, &len);
+  if (gpg_err_code (err) == GPG_ERR_ASS_UNKNOWN_CMD)
+    {
+      no_pkdecrypt_any = 1;  /* Old agent.  */
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  if (err)
+    goto leave;
+  if (!buf)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (i=0, off=0; i < count && !err; i++, off += n)
+    {
+      n = (off < len
+           ? gcry_sexp_canon_len (buf + off, len - off, NULL, NULL) : 0);
+      if (!n)
+        err = gpg_error (GPG_ERR_INV_SEXP);
+      else
+        err = parse_decrypt_any_item (buf + off, n, &r_bufs[i],
+                                      &r_buflens[i], &r_errs[i]);
+    }
+  if (!err && off != len)
+    err = gpg_error (GPG_ERR_INV_SEXP);
+
+ leave:
+  if (err)
+    {
+      for (i=0; i < count; i++)
+        {
+          xfree (r_bufs[i]);
+          r_bufs[i] = NULL;
+          r_errs[i] = gpg_error (GPG_ERR_NOT_SUPPORTED);
+        }
+    }
+  xfree (get_membuf (&grips_mb, NULL));
+  xfree (get_membuf (&cipher_mb, NULL));
+  if (!buf)
+    buf = get_membuf (&data, NULL);
+  xfree (parm.keygrips);
+  xfree (parm.ciphertexts);
+  xfree (buf);
+  return err;
+}
+
+
 
 /* Retrieve a key encryption key from the agent.  With FOREXPORT true
    the key shall be used for export, with false for import.  On success
@@ -3061,10 +3533,10 @@ agent_keywrap_key (ctrl_t ctrl, int forexport, void **r_kek, size_t *r_keklen)
             forexport? "--export":"--import");
 
   init_membuf_secure (&data, 64);
-  err = assuan_transact (agent_ctx, line,
-                         put_membuf_cb, &data,
-                         default_inq_cb, &dfltparm,
-                         NULL, NULL);
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        default_inq_cb, &dfltparm,
+                        NULL, NULL);
   if (err)
     {
       xfree (get_membuf (&data, &len));
@@ -3141,7 +3613,7 @@ agent_import_key (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
   if (desc)
     {
       snprintf (line, DIM(line), "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
+      err = agent_transact (agent_ctx, line,
                             NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
@@ -3159,10 +3631,10 @@ agent_import_key (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
             cache_nonce_addr && *cache_nonce_addr? *cache_nonce_addr:"");
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = NULL;
-  err = assuan_transact (agent_ctx, line,
-                         NULL, NULL,
-                         inq_import_key_parms, &parm,
-                         cache_nonce_status_cb, &cn_parm);
+  err = agent_transact (agent_ctx, line,
+                        NULL, NULL,
+                        inq_import_key_parms, &parm,
+                        cache_nonce_status_cb, &cn_parm);
   return err;
 }
 
@@ -3191,6 +3663,9 @@ agent_export_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   unsigned char *buf;
   char line[ASSUAN_LINELENGTH];
   struct default_inq_parm_s dfltparm;
+#ifdef USE_EXPORT_MEMFD
+  int outfd;
+#endif
 
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
@@ -3206,16 +3681,16 @@ agent_export_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   dfltparm.ctx = agent_ctx;
 
   /* Check that the gpg-agent supports the --mode1003 option.  */
-  if (mode1003 && assuan_transact (agent_ctx,
-                                   "GETINFO cmd_has_option EXPORT_KEY mode1003",
-                                   NULL, NULL, NULL, NULL, NULL, NULL))
+  if (mode1003 && agent_transact (agent_ctx,
+                                  "GETINFO cmd_has_option EXPORT_KEY mode1003",
+                                  NULL, NULL, NULL, NULL, NULL, NULL))
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
   if (desc)
     {
       snprintf (line, DIM(line), "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
     }
@@ -3226,13 +3701,42 @@ agent_export_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
             cache_nonce_addr && *cache_nonce_addr? *cache_nonce_addr:"",
             hexkeygrip);
 
+#ifdef USE_EXPORT_MEMFD
+  /* Let the agent write the key to a memory file instead of sending
+   * it as escaped D lines.  An agent not supporting this still sends
+   * D lines.  */
+  outfd = memfd_create ("lcr-export", MFD_CLOEXEC);
+  if (outfd != -1
+      && (assuan_sendfd (agent_ctx, outfd)
+          || agent_transact (agent_ctx, "OUTPUT FD",
+                             NULL, NULL, NULL, NULL, NULL, NULL)))
+    {
+      close (outfd);
+      outfd = -1;
+    }
+#endif
+
   init_membuf_secure (&data, 1024);
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = NULL;
-  err = assuan_transact (agent_ctx, line,
-                         put_membuf_cb, &data,
-                         default_inq_cb, &dfltparm,
-                         cache_nonce_status_cb, &cn_parm);
+  err = agent_transact (agent_ctx, line,
+                        put_membuf_cb, &data,
+                        default_inq_cb, &dfltparm,
+                        cache_nonce_status_cb, &cn_parm);
+#ifdef USE_EXPORT_MEMFD
+  if (!err && outfd != -1 && lseek (outfd, 0, SEEK_SET) != (off_t)-1)
+    {
+      char tmpbuf[8192];
+      ssize_t nread;
+
+      while ((nread = read (outfd, tmpbuf, sizeof tmpbuf)) > 0)
+        put_membuf (&data, tmpbuf, nread);
+      if (nread < 0)
+        err = gpg_error_from_syserror ();
+    }
+  if (outfd != -1)
+    close (outfd);
+#endif
   if (err)
     {
       xfree (get_membuf (&data, &len));
@@ -3302,8 +3806,8 @@ agent_delete_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   if (desc)
     {
       snprintf (line, DIM(line), "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
     }
@@ -3311,9 +3815,9 @@ agent_delete_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   /* FIXME: Shall we add support to DELETE_KEY for dual keys?  */
   snprintf (line, DIM(line), "DELETE_KEY%s %s",
             force? " --force":"", hexkeygrip);
-  err = assuan_transact (agent_ctx, line, NULL, NULL,
-                         default_inq_cb, &dfltparm,
-                         confirm_status_cb, &confirm_parm);
+  err = agent_transact (agent_ctx, line, NULL, NULL,
+                        default_inq_cb, &dfltparm,
+                        confirm_status_cb, &confirm_parm);
   xfree (confirm_parm.desc);
   xfree (confirm_parm.ok);
   xfree (confirm_parm.notok);
@@ -3352,8 +3856,8 @@ agent_passwd (ctrl_t ctrl, const char *hexkeygrip, const char *desc, int verify,
   if (desc)
     {
       snprintf (line, DIM(line), "SETKEYDESC %s", desc);
-      err = assuan_transact (agent_ctx, line,
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, line,
+                            NULL, NULL, NULL, NULL, NULL, NULL);
       if (err)
         return err;
     }
@@ -3372,9 +3876,9 @@ agent_passwd (ctrl_t ctrl, const char *hexkeygrip, const char *desc, int verify,
               hexkeygrip);
   cn_parm.cache_nonce_addr = cache_nonce_addr;
   cn_parm.passwd_nonce_addr = passwd_nonce_addr;
-  err = assuan_transact (agent_ctx, line, NULL, NULL,
-                         default_inq_cb, &dfltparm,
-                         cache_nonce_status_cb, &cn_parm);
+  err = agent_transact (agent_ctx, line, NULL, NULL,
+                        default_inq_cb, &dfltparm,
+                        cache_nonce_status_cb, &cn_parm);
   return err;
 }
 
@@ -3396,8 +3900,8 @@ agent_set_ephemeral_mode (ctrl_t ctrl, int enable, int *r_previous)
 
   if (r_previous)
     {
-      err = assuan_transact (agent_ctx, "GETINFO ephemeral",
-                             NULL, NULL, NULL, NULL, NULL, NULL);
+      err = agent_transact (agent_ctx, "GETINFO ephemeral",
+                            NULL, NULL, NULL, NULL, NULL, NULL);
       if (!err)
         *r_previous = 1;
       else if (gpg_err_code (err) == GPG_ERR_FALSE)
@@ -3410,9 +3914,9 @@ agent_set_ephemeral_mode (ctrl_t ctrl, int enable, int *r_previous)
   if (enable == -1 || (r_previous && !!*r_previous == !!enable))
     err = 0;
   else
-    err = assuan_transact (agent_ctx,
-                           enable? "OPTION ephemeral=1" : "OPTION ephemeral=0",
-                           NULL, NULL, NULL, NULL, NULL, NULL);
+    err = agent_transact (agent_ctx,
+                          enable? "OPTION ephemeral=1" : "OPTION ephemeral=0",
+                          NULL, NULL, NULL, NULL, NULL, NULL);
  leave:
   return err;
 }
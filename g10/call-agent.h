@@ -19,6 +19,9 @@
 #ifndef GNUPG_G10_CALL_AGENT_H
 #define GNUPG_G10_CALL_AGENT_H
 
+/* The maximum number of keys for one call of agent_pkdecrypt_any.  */
+#define AGENT_PKDECRYPT_ANY_MAX 64
+
 struct key_attr {
   int algo;              /* Algorithm identifier.  */
   union {
@@ -182,6 +185,9 @@ gpg_error_t gpg_agent_get_confirmation (const char *desc);
 /* Return the S2K iteration count as computed by gpg-agent.  */
 unsigned long agent_get_s2k_count (void);
 
+/* Return true if a connection to the agent has been established.  */
+int agent_is_connected (void);
+
 /* Check whether a secret key for public key PK is available.  Returns
    0 if not available, positive value if the secret key is available. */
 int agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk);
@@ -202,6 +208,10 @@ gpg_error_t agent_genkey (ctrl_t ctrl,
                           const char *passphrase, time_t timestamp,
                           gcry_sexp_t *r_pubkey);
 
+/* Announce keys to be generated soon.  */
+gpg_error_t agent_pregen_keys (ctrl_t ctrl, const char *keyparms,
+                               unsigned int count);
+
 /* Apply the Link attributes.  */
 gpg_error_t agent_crosslink_keys (ctrl_t ctrl,
                                   const char *hexgrip1, const char *hexgrip2);
@@ -218,6 +228,14 @@ gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           int digestalgo,
                           gcry_sexp_t *r_sigval);
 
+/* Create signatures for several digests.  */
+gpg_error_t agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                                const char *hexkeygrip, const char *desc,
+                                u32 *keyid, u32 *mainkeyid, int pubkey_algo,
+                                const unsigned char *digests,
+                                size_t digestlen, unsigned int count,
+                                int digestalgo, gcry_sexp_t *r_sigvals);
+
 /* Decrypt a ciphertext.  */
 gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              u32 *keyid, u32 *mainkeyid, int pubkey_algo,
@@ -225,6 +243,12 @@ gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              unsigned char **r_buf, size_t *r_buflen,
                              int *r_padding);
 
+/* Try to decrypt with several keys.  */
+gpg_error_t agent_pkdecrypt_any (ctrl_t ctrl, unsigned int count,
+                                 char **keygrips, gcry_sexp_t *s_ciphertexts,
+                                 unsigned char **r_bufs, size_t *r_buflens,
+                                 gpg_error_t *r_errs);
+
 /* Retrieve a key encryption key.  */
 gpg_error_t agent_keywrap_key (ctrl_t ctrl, int forexport,
                                void **r_kek, size_t *r_keklen);
@@ -28,6 +28,10 @@
 #ifdef HAVE_LOCALE_H
 # include <locale.h>
 #endif
+#ifndef HAVE_W32_SYSTEM
+# include <sys/socket.h>
+#endif
+#include <npth.h>
 
 #include "lcr.h"
 #include <assuan.h>
@@ -37,6 +41,7 @@
 #include "../common/i18n.h"
 #include "../common/asshelp.h"
 #include "../common/status.h"
+#include "../common/tstats.h"
 #include "keyserver-internal.h"
 #include "call-dirmngr.h"
 
@@ -53,6 +58,7 @@ struct ks_status_parm_s
 {
   const char *keyword; /* Look for this keyword or NULL for "SOURCE". */
   char *source;
+  unsigned int unchanged;  /* The count from an UNCHANGED status.  */
 };
 
 
@@ -120,7 +126,75 @@ struct dirmngr_local_s
 };
 
 
+/* The kinds of requests which can be prefetched.  */
+enum prefetch_kinds
+  {
+    PREFETCH_KS_GET,
+    PREFETCH_DNS_CERT,
+    PREFETCH_WKD_GET
+  };
+
+/* A request started by one of the gpg_dirmngr_prefetch_* functions.
+ * It runs on its own thread and connection while the caller is still
+ * busy with other things.  The next call of the regular function with
+ * the same arguments waits for the thread and takes its result.  */
+struct prefetch_s
+{
+  struct prefetch_s *next;
+  ctrl_t ctrl;
+  int kind;           /* One of the PREFETCH_ values.  */
+  char *name;         /* The pattern or name.  */
+  char *arg;          /* The keyserver or the certtype; may be NULL.  */
+  unsigned int flags; /* The flags or the quick arg.  */
+  npth_t thread;
+  int cancelled;      /* The result is not anymore needed.  */
+  assuan_context_t ctx; /* The connection used by the thread or NULL.  */
+
+  /* The result.  */
+  gpg_error_t err;
+  estream_t fp;
+  unsigned char *fpr;
+  size_t fprlen;
+  char *url;          /* The URL or the source.  */
+};
+typedef struct prefetch_s *prefetch_t;
+
+/* The list of prefetches not yet taken.  */
+static prefetch_t prefetch_list;
+
+/* The key to find the prefetch object of the current thread.  */
+static npth_key_t prefetch_tlskey;
+static int prefetch_tlskey_created;
+
+
 
+/* Wrapper around assuan_transact to account the time for
+ * --timing-stats.  */
+static gpg_error_t
+dirmngr_transact (assuan_context_t ctx, const char *command,
+                  gpg_error_t (*data_cb)(void *, const void *, size_t),
+                  void *data_cb_arg,
+                  gpg_error_t (*inquire_cb)(void *, const char *),
+                  void *inquire_cb_arg,
+                  gpg_error_t (*status_cb)(void *, const char *),
+                  void *status_cb_arg)
+{
+  gpg_error_t err;
+  int account;
+
+  /* The timing stats are not thread aware.  The time spent on the
+   * prefetch threads is accounted while waiting for them.  */
+  account = !(prefetch_tlskey_created && npth_getspecific (prefetch_tlskey));
+  if (account)
+    TSTAT_ENTER (TSTAT_DIRMNGR);
+  err = assuan_transact (ctx, command, data_cb, data_cb_arg,
+                         inquire_cb, inquire_cb_arg, status_cb, status_cb_arg);
+  if (account)
+    TSTAT_LEAVE (TSTAT_DIRMNGR);
+  return err;
+}
+
+
 /* Deinitialize all session data of dirmngr pertaining to CTRL.  */
 void
 gpg_dirmngr_deinit_session_data (ctrl_t ctrl)
@@ -194,8 +268,8 @@ create_context (ctrl_t ctrl, assuan_context_t *r_ctx)
             err = gpg_error_from_syserror ();
           else
             {
-              err = assuan_transact (ctx, line, NULL, NULL, NULL,
-                                     NULL, NULL, NULL);
+              err = dirmngr_transact (ctx, line, NULL, NULL, NULL,
+                                      NULL, NULL, NULL);
               xfree (line);
             }
         }
@@ -207,8 +281,8 @@ create_context (ctrl_t ctrl, assuan_context_t *r_ctx)
           /* Tell the dirmngr that this possibly privacy invading
              option is in use.  If Dirmngr is running in Tor mode, it
              will return an error.  */
-          err = assuan_transact (ctx, "OPTION honor-keyserver-url-used",
-                                 NULL, NULL, NULL, NULL, NULL, NULL);
+          err = dirmngr_transact (ctx, "OPTION honor-keyserver-url-used",
+                                  NULL, NULL, NULL, NULL, NULL, NULL);
           if (gpg_err_code (err) == GPG_ERR_FORBIDDEN)
             log_error (_("keyserver option \"honor-keyserver-url\""
                          " may not be used in Tor mode\n"));
@@ -239,12 +313,17 @@ open_context (ctrl_t ctrl, assuan_context_t *r_ctx)
 {
   gpg_error_t err;
   dirmngr_local_t dml;
+  prefetch_t pf;
+
+  pf = prefetch_tlskey_created? npth_getspecific (prefetch_tlskey) : NULL;
 
   *r_ctx = NULL;
   for (;;)
     {
       for (dml = ctrl->dirmngr_local; dml && dml->is_active; dml = dml->next)
         ;
+      if (pf && pf->cancelled)
+        return gpg_error (GPG_ERR_CANCELED);
       if (dml)
         {
           /* Found an inactive local session - return that.  */
@@ -271,8 +350,8 @@ open_context (ctrl_t ctrl, assuan_context_t *r_ctx)
                     err = gpg_error_from_syserror ();
                   else
                     {
-                      err = assuan_transact (dml->ctx, line, NULL, NULL, NULL,
-                                             NULL, NULL, NULL);
+                      err = dirmngr_transact (dml->ctx, line, NULL, NULL, NULL,
+                                              NULL, NULL, NULL);
                       xfree (line);
                     }
 
@@ -286,6 +365,8 @@ open_context (ctrl_t ctrl, assuan_context_t *r_ctx)
           dml->is_active = 1;
 
           *r_ctx = dml->ctx;
+          if (pf)
+            pf->ctx = dml->ctx;
           return 0;
         }
 
@@ -356,6 +437,255 @@ clear_context_flags (ctrl_t ctrl, assuan_context_t ctx)
 }
 
 
+/* Release the inactive context CTX instead of returning it to the
+ * pool.  This is used for connections which have been shut down.  */
+static void
+drop_context (ctrl_t ctrl, assuan_context_t ctx)
+{
+  dirmngr_local_t dml, *dmlp;
+
+  for (dmlp = &ctrl->dirmngr_local; (dml = *dmlp); dmlp = &dml->next)
+    {
+      if (dml->ctx == ctx)
+        {
+          if (dml->is_active)
+            log_fatal ("dropping active dirmngr context %p\n", ctx);
+          *dmlp = dml->next;
+          assuan_release (dml->ctx);
+          xfree (dml);
+          return;
+        }
+    }
+}
+
+
+
+/* Thread to run the prefetch request ARG.  */
+static void *
+prefetch_worker (void *arg)
+{
+  prefetch_t pf = arg;
+
+  npth_setspecific (prefetch_tlskey, pf);
+  switch (pf->kind)
+    {
+    case PREFETCH_KS_GET:
+      {
+        char *pattern[2];
+        struct keyserver_spec keyserver;
+
+        pattern[0] = pf->name;
+        pattern[1] = NULL;
+        memset (&keyserver, 0, sizeof keyserver);
+        keyserver.uri = pf->arg;
+        pf->err = gpg_dirmngr_ks_get (pf->ctrl, pattern,
+                                      pf->arg? &keyserver : NULL, pf->flags,
+                                      &pf->fp, &pf->url);
+      }
+      break;
+
+    case PREFETCH_DNS_CERT:
+      pf->err = gpg_dirmngr_dns_cert (pf->ctrl, pf->name, pf->arg, &pf->fp,
+                                      &pf->fpr, &pf->fprlen, &pf->url);
+      break;
+
+    case PREFETCH_WKD_GET:
+      pf->err = gpg_dirmngr_wkd_get (pf->ctrl, pf->name, pf->flags,
+                                     &pf->fp, &pf->url);
+      break;
+    }
+
+  /* A cancelled request may have left its connection shut down.  */
+  if (pf->cancelled && pf->ctx)
+    drop_context (pf->ctrl, pf->ctx);
+  pf->ctx = NULL;
+  return NULL;
+}
+
+
+static void
+release_prefetch (prefetch_t pf)
+{
+  if (!pf)
+    return;
+  es_fclose (pf->fp);
+  xfree (pf->fpr);
+  xfree (pf->url);
+  xfree (pf->name);
+  xfree (pf->arg);
+  xfree (pf);
+}
+
+
+/* Return true if PF is the request of KIND with the given args.  */
+static int
+prefetch_matches (prefetch_t pf, ctrl_t ctrl, int kind,
+                  const char *name, const char *arg, unsigned int flags)
+{
+  if (pf->ctrl != ctrl || pf->kind != kind || pf->flags != flags
+      || strcmp (pf->name, name))
+    return 0;
+  if (!pf->arg || !arg)
+    return pf->arg == arg;
+  return !strcmp (pf->arg, arg);
+}
+
+
+/* Start a thread for a request of KIND with the arguments NAME, ARG
+ * and FLAGS.  Errors are not returned because the request is then
+ * done the regular way.  */
+static void
+start_prefetch (ctrl_t ctrl, int kind, const char *name, const char *arg,
+                unsigned int flags)
+{
+  prefetch_t pf;
+  npth_attr_t tattr;
+  int rc;
+
+  if (opt.disable_dirmngr)
+    return;
+  if (!prefetch_tlskey_created)
+    {
+      if (npth_key_create (&prefetch_tlskey, NULL))
+        return;
+      prefetch_tlskey_created = 1;
+    }
+
+  for (pf = prefetch_list; pf; pf = pf->next)
+    if (prefetch_matches (pf, ctrl, kind, name, arg, flags))
+      return;  /* Already running.  */
+
+  pf = xtrycalloc (1, sizeof *pf);
+  if (!pf)
+    return;
+  pf->ctrl = ctrl;
+  pf->kind = kind;
+  pf->flags = flags;
+  pf->name = xtrystrdup (name);
+  if (!pf->name || (arg && !(pf->arg = xtrystrdup (arg))))
+    {
+      release_prefetch (pf);
+      return;
+    }
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  rc = npth_create (&pf->thread, &tattr, prefetch_worker, pf);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    {
+      log_error ("error spawning dirmngr request: %s\n", strerror (rc));
+      release_prefetch (pf);
+      return;
+    }
+  if (DBG_IPC)
+    log_debug ("dirmngr request '%s' prefetched\n", name);
+
+  pf->next = prefetch_list;
+  prefetch_list = pf;
+}
+
+
+/* Return the prefetched request of KIND with the arguments NAME, ARG
+ * and FLAGS after waiting for it.  Returns NULL if there is none.
+ * The caller takes ownership of the result.  */
+static prefetch_t
+take_prefetch (ctrl_t ctrl, int kind, const char *name, const char *arg,
+               unsigned int flags)
+{
+  prefetch_t pf, *pfp;
+
+  if (!prefetch_list || npth_getspecific (prefetch_tlskey))
+    return NULL;
+
+  for (pfp = &prefetch_list; (pf = *pfp); pfp = &pf->next)
+    if (prefetch_matches (pf, ctrl, kind, name, arg, flags))
+      break;
+  if (!pf)
+    return NULL;
+  *pfp = pf->next;
+
+  TSTAT_ENTER (TSTAT_DIRMNGR);
+  npth_join (pf->thread, NULL);
+  TSTAT_LEAVE (TSTAT_DIRMNGR);
+  if (DBG_IPC)
+    log_debug ("dirmngr request '%s' taken from prefetch: %s\n",
+               name, gpg_strerror (pf->err));
+  return pf;
+}
+
+
+/* Start a KS_GET request for PATTERN.  See gpg_dirmngr_ks_get.  */
+void
+gpg_dirmngr_prefetch_ks_get (ctrl_t ctrl, const char *pattern,
+                             keyserver_spec_t override_keyserver,
+                             unsigned int flags)
+{
+  start_prefetch (ctrl, PREFETCH_KS_GET, pattern,
+                  override_keyserver? override_keyserver->uri : NULL, flags);
+}
+
+
+/* Start a DNS_CERT request for NAME.  See gpg_dirmngr_dns_cert.  */
+void
+gpg_dirmngr_prefetch_dns_cert (ctrl_t ctrl, const char *name,
+                               const char *certtype)
+{
+  start_prefetch (ctrl, PREFETCH_DNS_CERT, name, certtype, 0);
+}
+
+
+/* Start a WKD_GET request for NAME.  See gpg_dirmngr_wkd_get.  */
+void
+gpg_dirmngr_prefetch_wkd_get (ctrl_t ctrl, const char *name, int quick)
+{
+  start_prefetch (ctrl, PREFETCH_WKD_GET, name, NULL, quick);
+}
+
+
+/* Cancel all prefetched requests of CTRL which have not been taken.
+ * Their connections are shut down so that we do not need to wait for
+ * network timeouts.  */
+void
+gpg_dirmngr_prefetch_cancel (ctrl_t ctrl)
+{
+  prefetch_t pf, *pfp, cancelled = NULL;
+
+  for (pfp = &prefetch_list; (pf = *pfp); )
+    {
+      if (pf->ctrl != ctrl)
+        {
+          pfp = &pf->next;
+          continue;
+        }
+      *pfp = pf->next;
+      pf->cancelled = 1;
+#ifndef HAVE_W32_SYSTEM
+      if (pf->ctx)
+        {
+          assuan_fd_t fds[5];
+          int i, n;
+
+          n = assuan_get_active_fds (pf->ctx, 0, fds, DIM (fds));
+          for (i = 0; i < n; i++)
+            shutdown (FD2INT (fds[i]), SHUT_RDWR);
+        }
+#endif
+      pf->next = cancelled;
+      cancelled = pf;
+    }
+
+  while ((pf = cancelled))
+    {
+      cancelled = pf->next;
+      npth_join (pf->thread, NULL);
+      if (DBG_IPC)
+        log_debug ("dirmngr request '%s' cancelled\n", pf->name);
+      release_prefetch (pf);
+    }
+}
+
+
 
 /* Status callback for ks_list, ks_get, ks_search, and wkd_get  */
 static gpg_error_t
@@ -402,6 +732,8 @@ ks_status_cb (void *opaque, const char *line)
             }
         }
     }
+  else if ((s = has_leading_keyword (line, "UNCHANGED")))
+    parm->unchanged = strtoul (s, NULL, 10);
   else if ((s = has_leading_keyword (line, "WARNING"))
            || (is_note = !!(s = has_leading_keyword (line, "NOTE"))))
     {
@@ -466,8 +798,8 @@ gpg_dirmngr_ks_list (ctrl_t ctrl, char **r_keyserver)
   if (err)
     return err;
 
-  err = assuan_transact (ctx, "KEYSERVER", NULL, NULL,
-                         NULL, NULL, ks_status_cb, &stparm);
+  err = dirmngr_transact (ctx, "KEYSERVER", NULL, NULL,
+                          NULL, NULL, ks_status_cb, &stparm);
   if (err)
     goto leave;
   if (!stparm.source)
@@ -615,7 +947,7 @@ gpg_dirmngr_ks_search (ctrl_t ctrl, const char *searchstr,
   parm.data_cb_value = cb_value;
   parm.stparm = &stparm;
 
-  err = assuan_transact (ctx, line, ks_search_data_cb, &parm,
+  err = dirmngr_transact (ctx, line, ks_search_data_cb, &parm,
                         NULL, NULL, ks_status_cb, &stparm);
   if (!err)
     err = cb (cb_value, 0, NULL);  /* Send EOF.  */
@@ -666,6 +998,9 @@ ks_get_data_cb (void *opaque, const void *data, size_t datalen)
    Bit values for FLAGS are:
    - KEYSERVER_IMPORT_FLAG_QUICK :: dirmngr shall use a shorter timeout.
    - KEYSERVER_IMPORT_FLAG_LDAP  :: dirmngr shall only use LDAP or NTDS.
+   - KEYSERVER_IMPORT_FLAG_IF_CHANGED :: dirmngr shall not return keys
+     which did not change since it fetched them the last time.  If no
+     key is returned for this reason, NULL is stored at R_FP.
 
    If R_SOURCE is not NULL the source of the data is stored as a
    malloced string there.  If a source is not known NULL is stored.
@@ -690,6 +1025,8 @@ gpg_dirmngr_ks_get (ctrl_t ctrl, char **pattern,
   membuf_t mb;
   int idx;
 
+  prefetch_t pf;
+
   memset (&stparm, 0, sizeof stparm);
   memset (&parm, 0, sizeof parm);
 
@@ -697,6 +1034,24 @@ gpg_dirmngr_ks_get (ctrl_t ctrl, char **pattern,
   if (r_source)
     *r_source = NULL;
 
+  if (pattern[0] && !pattern[1]
+      && (pf = take_prefetch (ctrl, PREFETCH_KS_GET, pattern[0],
+                              (override_keyserver
+                               ? override_keyserver->uri : NULL),
+                              flags)))
+    {
+      err = pf->err;
+      *r_fp = pf->fp;
+      pf->fp = NULL;
+      if (r_source)
+        {
+          *r_source = pf->url;
+          pf->url = NULL;
+        }
+      release_prefetch (pf);
+      return err;
+    }
+
   err = open_context (ctrl, &ctx);
   if (err)
     return err;
@@ -713,8 +1068,8 @@ gpg_dirmngr_ks_get (ctrl_t ctrl, char **pattern,
           err = gpg_error_from_syserror ();
           goto leave;
         }
-      err = assuan_transact (ctx, line, NULL, NULL, NULL,
-                             NULL, NULL, NULL);
+      err = dirmngr_transact (ctx, line, NULL, NULL, NULL,
+                              NULL, NULL, NULL);
       if (err)
         goto leave;
 
@@ -729,6 +1084,8 @@ gpg_dirmngr_ks_get (ctrl_t ctrl, char **pattern,
     put_membuf_str (&mb, " --quick");
   if ((flags & KEYSERVER_IMPORT_FLAG_LDAP))
     put_membuf_str (&mb, " --ldap");
+  if ((flags & KEYSERVER_IMPORT_FLAG_IF_CHANGED))
+    put_membuf_str (&mb, " --if-changed");
   put_membuf_str (&mb, " --");
   for (idx=0; pattern[idx]; idx++)
     {
@@ -754,11 +1111,21 @@ gpg_dirmngr_ks_get (ctrl_t ctrl, char **pattern,
       err = gpg_error_from_syserror ();
       goto leave;
     }
-  err = assuan_transact (ctx, line, ks_get_data_cb, &parm,
-                         NULL, NULL, ks_status_cb, &stparm);
+  err = dirmngr_transact (ctx, line, ks_get_data_cb, &parm,
+                          NULL, NULL, ks_status_cb, &stparm);
   if (err)
     goto leave;
 
+  if (stparm.unchanged)
+    {
+      if (opt.verbose)
+        log_info (ngettext ("%u key not changed on the keyserver\n",
+                            "%u keys not changed on the keyserver\n",
+                            stparm.unchanged), stparm.unchanged);
+      if (!es_ftell (parm.memfp))
+        goto leave;  /* Nothing to import.  */
+    }
+
   es_rewind (parm.memfp);
   *r_fp = parm.memfp;
   parm.memfp = NULL;
@@ -820,8 +1187,8 @@ gpg_dirmngr_ks_fetch (ctrl_t ctrl, const char *url, estream_t *r_fp)
       err = gpg_error_from_syserror ();
       goto leave;
     }
-  err = assuan_transact (ctx, line, ks_get_data_cb, &parm,
-                         NULL, NULL, NULL, NULL);
+  err = dirmngr_transact (ctx, line, ks_get_data_cb, &parm,
+                          NULL, NULL, NULL, NULL);
   if (err)
     goto leave;
 
@@ -1061,8 +1428,8 @@ gpg_dirmngr_ks_put (ctrl_t ctrl, void *data, size_t datalen, kbnode_t keyblock)
   parm.data = data;
   parm.datalen = datalen;
 
-  err = assuan_transact (ctx, "KS_PUT", NULL, NULL,
-                         ks_put_inq_cb, &parm, NULL, NULL);
+  err = dirmngr_transact (ctx, "KS_PUT", NULL, NULL,
+                          ks_put_inq_cb, &parm, NULL, NULL);
 
   close_context (ctrl, ctx);
   return err;
@@ -1160,6 +1527,7 @@ gpg_dirmngr_dns_cert (ctrl_t ctrl, const char *name, const char *certtype,
   assuan_context_t ctx;
   struct dns_cert_parm_s parm;
   char *line = NULL;
+  prefetch_t pf;
 
   memset (&parm, 0, sizeof parm);
   if (r_key)
@@ -1171,6 +1539,33 @@ gpg_dirmngr_dns_cert (ctrl_t ctrl, const char *name, const char *certtype,
   if (r_url)
     *r_url = NULL;
 
+  if ((pf = take_prefetch (ctrl, PREFETCH_DNS_CERT, name, certtype, 0)))
+    {
+      err = pf->err;
+      if (!err)
+        {
+          if (r_key)
+            {
+              *r_key = pf->fp;
+              pf->fp = NULL;
+            }
+          if (r_fpr)
+            {
+              *r_fpr = pf->fpr;
+              pf->fpr = NULL;
+            }
+          if (r_fprlen)
+            *r_fprlen = pf->fprlen;
+          if (r_url)
+            {
+              *r_url = pf->url;
+              pf->url = NULL;
+            }
+        }
+      release_prefetch (pf);
+      return err;
+    }
+
   err = open_context (ctrl, &ctx);
   if (err)
     return err;
@@ -1193,8 +1588,8 @@ gpg_dirmngr_dns_cert (ctrl_t ctrl, const char *name, const char *certtype,
       err = gpg_error_from_syserror ();
       goto leave;
     }
-  err = assuan_transact (ctx, line, dns_cert_data_cb, &parm,
-                         NULL, NULL, dns_cert_status_cb, &parm);
+  err = dirmngr_transact (ctx, line, dns_cert_data_cb, &parm,
+                          NULL, NULL, dns_cert_status_cb, &parm);
   if (err)
     goto leave;
 
@@ -1245,6 +1640,7 @@ gpg_dirmngr_wkd_get (ctrl_t ctrl, const char *name, int quick,
   struct ks_status_parm_s stparm = { NULL };
   struct dns_cert_parm_s parm = { NULL };
   char *line = NULL;
+  prefetch_t pf;
 
   if (r_key)
     *r_key = NULL;
@@ -1252,6 +1648,26 @@ gpg_dirmngr_wkd_get (ctrl_t ctrl, const char *name, int quick,
   if (r_url)
     *r_url = NULL;
 
+  if ((pf = take_prefetch (ctrl, PREFETCH_WKD_GET, name, NULL, quick)))
+    {
+      err = pf->err;
+      if (!err)
+        {
+          if (r_key)
+            {
+              *r_key = pf->fp;
+              pf->fp = NULL;
+            }
+          if (r_url)
+            {
+              *r_url = pf->url;
+              pf->url = NULL;
+            }
+        }
+      release_prefetch (pf);
+      return err;
+    }
+
   err = open_context (ctrl, &ctx);
   if (err)
     return err;
@@ -1274,8 +1690,8 @@ gpg_dirmngr_wkd_get (ctrl_t ctrl, const char *name, int quick,
       err = gpg_error_from_syserror ();
       goto leave;
     }
-  err = assuan_transact (ctx, line, dns_cert_data_cb, &parm,
-                         NULL, NULL, ks_status_cb, &stparm);
+  err = dirmngr_transact (ctx, line, dns_cert_data_cb, &parm,
+                          NULL, NULL, ks_status_cb, &stparm);
   if (gpg_err_code (err) == GPG_ERR_ENOSPC)
     err = gpg_error (GPG_ERR_TOO_LARGE);
   if (err)
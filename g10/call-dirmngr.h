@@ -40,6 +40,13 @@ gpg_error_t gpg_dirmngr_dns_cert (ctrl_t ctrl,
                                   char **r_url);
 gpg_error_t gpg_dirmngr_wkd_get (ctrl_t ctrl, const char *name, int quick,
                                  estream_t *r_key, char **r_url);
+void gpg_dirmngr_prefetch_ks_get (ctrl_t ctrl, const char *pattern,
+                                  keyserver_spec_t override_keyserver,
+                                  unsigned int flags);
+void gpg_dirmngr_prefetch_dns_cert (ctrl_t ctrl, const char *name,
+                                    const char *certtype);
+void gpg_dirmngr_prefetch_wkd_get (ctrl_t ctrl, const char *name, int quick);
+void gpg_dirmngr_prefetch_cancel (ctrl_t ctrl);
 
 
 #endif /*GNUPG_G10_CALL_DIRMNGR_H*/
@@ -39,12 +39,31 @@
 #include "../common/asshelp.h"
 #include "../common/host2net.h"
 #include "../common/status.h"
+#include "../common/tstats.h"
+#include "../common/memstat.h"
+#include "../common/starttrace.h"
 #include "../kbx/kbx-client-util.h"
 #include "keydb.h"
+#include "objcache.h"
 
 #include "keydb-private.h"  /* For struct keydb_handle_s */
 
 
+/* The number of results we request with one SEARCH or NEXT command
+ * when iterating over the keys.  */
+#define SEARCH_BATCH_SIZE 64
+
+
+/* The information from the PUBKEY_INFO status of one search result.  */
+struct search_result_info_s
+{
+  unsigned int valid:1;
+  unsigned char ubid[UBID_LEN];
+  int uid_no;
+  int pk_no;
+};
+
+
 /* Data used to keep track of keybox daemon sessions.  This allows us
  * to use several sessions with the keyboxd and also to reuse already
  * established sessions.  Note that gpg.h defines the type
@@ -70,6 +89,16 @@ struct keyboxd_local_s
   /* Flag indicating that a search reset is required.  */
   unsigned int need_search_reset : 1;
 
+  /* Flag indicating that the last batched search has been exhausted.  */
+  unsigned int batch_eof : 1;
+
+  /* The infos for the results of the last search command.  BATCH_LEN
+   * is the number of results announced by the keyboxd and BATCH_NEXT
+   * the index of the next result to return.  The data of results not
+   * yet returned is still queued in KCD.  */
+  unsigned int batch_len;
+  unsigned int batch_next;
+  struct search_result_info_s batch[SEARCH_BATCH_SIZE];
 };
 
 
@@ -79,6 +108,27 @@ static unsigned int in_transaction;
 
 
 
+/* Wrapper around assuan_transact to account the time for
+ * --timing-stats.  */
+static gpg_error_t
+keyboxd_transact (assuan_context_t ctx, const char *command,
+                  gpg_error_t (*data_cb)(void *, const void *, size_t),
+                  void *data_cb_arg,
+                  gpg_error_t (*inquire_cb)(void *, const char *),
+                  void *inquire_cb_arg,
+                  gpg_error_t (*status_cb)(void *, const char *),
+                  void *status_cb_arg)
+{
+  gpg_error_t err;
+
+  TSTAT_ENTER (TSTAT_KEYBOXD);
+  err = assuan_transact (ctx, command, data_cb, data_cb_arg,
+                         inquire_cb, inquire_cb_arg, status_cb, status_cb_arg);
+  TSTAT_LEAVE (TSTAT_KEYBOXD);
+  return err;
+}
+
+
 /* Deinitialize all session resources pertaining to the keyboxd.  */
 void
 gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
@@ -100,8 +150,8 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
                * connection would trigger a rollback in keyboxd.  Note
                * that transactions are not associated with a
                * connection. */
-              err = assuan_transact (kbl->ctx, "TRANSACTION commit",
-                                     NULL, NULL, NULL, NULL, NULL, NULL);
+              err = keyboxd_transact (kbl->ctx, "TRANSACTION commit",
+                                      NULL, NULL, NULL, NULL, NULL, NULL);
               if (err)
                 log_error ("error committing last transaction: %s\n",
                             gpg_strerror (err));
@@ -143,6 +193,7 @@ create_new_context (ctrl_t ctrl, assuan_context_t *r_ctx)
 {
   gpg_error_t err;
   assuan_context_t ctx;
+  unsigned long long start = starttrace_clock ();
 
   *r_ctx = NULL;
 
@@ -168,8 +219,8 @@ create_new_context (ctrl_t ctrl, assuan_context_t *r_ctx)
 
       if ((opt.import_options & IMPORT_BULK) && !in_transaction)
         {
-          err = assuan_transact (ctx, "TRANSACTION begin",
-                                 NULL, NULL, NULL, NULL, NULL, NULL);
+          err = keyboxd_transact (ctx, "TRANSACTION begin",
+                                  NULL, NULL, NULL, NULL, NULL, NULL);
           if (err)
             {
               log_error ("error enabling bulk import option: %s\n",
@@ -186,6 +237,7 @@ create_new_context (ctrl_t ctrl, assuan_context_t *r_ctx)
   else
     *r_ctx = ctx;
 
+  starttrace_phase ("keyboxd connect", start);
   return err;
 }
 
@@ -266,6 +318,9 @@ keydb_new (ctrl_t ctrl)
   if (DBG_CLOCK)
     log_clock ("keydb_new");
 
+  /* This may also enable the keyboxd.  */
+  keydb_register_deferred ();
+
   hd = xtrycalloc (1, sizeof *hd);
   if (!hd)
     {
@@ -294,6 +349,8 @@ keydb_new (ctrl_t ctrl)
         rc = gpg_err_code_to_errno (GPG_ERR_EIO);
       gpg_err_set_errno (rc);
     }
+  else
+    memstat_alloc (MEMSTAT_KEYDB, sizeof *hd);
   return hd;
 }
 
@@ -322,6 +379,7 @@ keydb_release (KEYDB_HANDLE hd)
       hd->kbl = NULL;
       hd->ctrl = NULL;
     }
+  memstat_free (MEMSTAT_KEYDB, sizeof *hd);
   xfree (hd);
 }
 
@@ -371,6 +429,7 @@ keydb_get_keyblock (KEYDB_HANDLE hd, kbnode_t *ret_kb)
   if (hd->kbl->search_result)
     {
       err = keydb_parse_keyblock (hd->kbl->search_result,
+                                  hd->parse_mask,
                                   hd->last_ubid_valid? hd->last_pk_no  : 0,
                                   hd->last_ubid_valid? hd->last_uid_no : 0,
                                   ret_kb);
@@ -466,6 +525,8 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  objcache_invalidate_file ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_update_keyblock (ctrl, hd, kb);
@@ -485,10 +546,10 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   parm.ctx = hd->kbl->ctx;
   parm.data = iobuf_get_temp_buffer (iobuf);
   parm.datalen = iobuf_get_temp_length (iobuf);
-  err = assuan_transact (hd->kbl->ctx, "STORE --update",
-                         NULL, NULL,
-                         store_inq_cb, &parm,
-                         keydb_default_status_cb, hd);
+  err = keyboxd_transact (hd->kbl->ctx, "STORE --update",
+                          NULL, NULL,
+                          store_inq_cb, &parm,
+                          keydb_default_status_cb, hd);
 
 
  leave:
@@ -518,6 +579,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  objcache_invalidate_file ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_insert_keyblock (hd, kb);
@@ -537,10 +600,10 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   parm.ctx = hd->kbl->ctx;
   parm.data = iobuf_get_temp_buffer (iobuf);
   parm.datalen = iobuf_get_temp_length (iobuf);
-  err = assuan_transact (hd->kbl->ctx, "STORE --insert",
-                         NULL, NULL,
-                         store_inq_cb, &parm,
-                         keydb_default_status_cb, hd);
+  err = keyboxd_transact (hd->kbl->ctx, "STORE --insert",
+                          NULL, NULL,
+                          store_inq_cb, &parm,
+                          keydb_default_status_cb, hd);
 
  leave:
   iobuf_close (iobuf);
@@ -563,6 +626,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
+  objcache_invalidate_file ();
+
   if (!hd->use_keyboxd)
     {
       err = internal_keydb_delete_keyblock (hd);
@@ -583,10 +648,10 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
 
   bin2hex (hd->last_ubid, UBID_LEN, hexubid);
   snprintf (line, sizeof line, "DELETE %s", hexubid);
-  err = assuan_transact (hd->kbl->ctx, line,
-                         NULL, NULL,
-                         NULL, NULL,
-                         keydb_default_status_cb, hd);
+  err = keyboxd_transact (hd->kbl->ctx, line,
+                          NULL, NULL,
+                          NULL, NULL,
+                          keydb_default_status_cb, hd);
 
  leave:
   return err;
@@ -636,25 +701,31 @@ search_status_cb (void *opaque, const char *line)
 {
   KEYDB_HANDLE hd = opaque;
   gpg_error_t err = 0;
+  struct search_result_info_s *info;
   const char *s;
   unsigned int n;
 
   if ((s = has_leading_keyword (line, "PUBKEY_INFO")))
     {
+      /* Each announced result is counted so that its data can be
+       * dropped even if we do not accept it.  */
+      if (hd->kbl->batch_len >= DIM (hd->kbl->batch))
+        return gpg_error (GPG_ERR_INV_RESPONSE);
+      info = &hd->kbl->batch[hd->kbl->batch_len++];
+      info->valid = 0;
       if (atoi (s) != PUBKEY_TYPE_OPGP)
         err = gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
       else
         {
-          hd->last_ubid_valid = 0;
           while (*s && !spacep (s))
             s++;
-          if (!(n=hex2fixedbuf (s, hd->last_ubid, sizeof hd->last_ubid)))
+          if (!(n=hex2fixedbuf (s, info->ubid, sizeof info->ubid)))
             err = gpg_error (GPG_ERR_INV_VALUE);
           else
             {
-              hd->last_ubid_valid = 1;
-              hd->last_uid_no = 0;
-              hd->last_pk_no = 0;
+              info->valid = 1;
+              info->uid_no = 0;
+              info->pk_no = 0;
               s += n;
               while (*s && !spacep (s))
                 s++;
@@ -662,17 +733,25 @@ search_status_cb (void *opaque, const char *line)
                 s++;
               if (*s)
                 {
-                  hd->last_uid_no = atoi (s);
+                  info->uid_no = atoi (s);
                   while (*s && !spacep (s))
                     s++;
                   while (spacep (s))
                     s++;
                   if (*s)
-                    hd->last_pk_no = atoi (s);
+                    info->pk_no = atoi (s);
                 }
             }
         }
     }
+  else if ((s = has_leading_keyword (line, "BATCH_INFO")))
+    {
+      while (*s && !spacep (s))
+        s++;
+      while (spacep (s))
+        s++;
+      hd->kbl->batch_eof = !!atoi (s);
+    }
   else
     err = keydb_default_status_cb (opaque, line);
 
@@ -680,6 +759,37 @@ search_status_cb (void *opaque, const char *line)
 }
 
 
+/* Take the next result of the last search command from the data
+ * queue of HD and make it the current search result.  */
+static gpg_error_t
+take_search_result (KEYDB_HANDLE hd)
+{
+  keyboxd_local_t kbl = hd->kbl;
+  struct search_result_info_s *info = &kbl->batch[kbl->batch_next++];
+  gpg_error_t err;
+  char *buffer;
+  size_t len;
+
+  err = kbx_client_data_wait (kbl->kcd, &buffer, &len);
+  if (err)
+    return err;
+  kbl->search_result = iobuf_temp_with_content (buffer, len);
+  xfree (buffer);
+
+  hd->last_ubid_valid = info->valid;
+  if (info->valid)
+    {
+      memcpy (hd->last_ubid, info->ubid, UBID_LEN);
+      hd->last_uid_no = info->uid_no;
+      hd->last_pk_no = info->pk_no;
+      if (DBG_KEYDB)
+        log_printhex (hd->last_ubid, 20, "found UBID (%d,%d):",
+                      hd->last_uid_no, hd->last_pk_no);
+    }
+  return 0;
+}
+
+
 /* Search the database for keys matching the search description.  If
  * the DB contains any legacy keys, these are silently ignored.
  *
@@ -705,8 +815,6 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   gpg_error_t err;
   int i;
   char line[ASSUAN_LINELENGTH];
-  char *buffer;
-  size_t len;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
@@ -714,6 +822,7 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   if (descindex)
     *descindex = 0; /* Make sure it is always set on return.  */
 
+  TSTAT_ENTER (TSTAT_KEYDB_SEARCH);
   if (DBG_CLOCK)
     log_clock ("%s enter", __func__);
 
@@ -744,6 +853,19 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   /* Check whether this is a NEXT search.  */
   if (!hd->kbl->need_search_reset)
     {
+      /* Return the results already received with the last batch.  */
+      hd->last_ubid_valid = 0;
+      if (hd->kbl->batch_next < hd->kbl->batch_len)
+        {
+          err = take_search_result (hd);
+          goto leave;
+        }
+      if (hd->kbl->batch_eof)
+        {
+          err = gpg_error (GPG_ERR_NOT_FOUND);
+          goto leave;
+        }
+
       /* No reset requested thus continue the search.  The keyboxd
        * keeps the context of the search and thus the NEXT operates on
        * the last search pattern.  This is how we always used the
@@ -751,7 +873,7 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
        * search pattern between searches but that is not anymore
        * supported by keyboxd and a cursory check does not show that
        * we actually made used of that misfeature.  */
-      snprintf (line, sizeof line, "NEXT");
+      snprintf (line, sizeof line, "NEXT --batch=%d", SEARCH_BATCH_SIZE);
       goto do_search;
     }
 
@@ -767,7 +889,8 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       {
         /* If any description has mode FIRST, this item trumps all
          * other descriptions.  */
-        snprintf (line, sizeof line, "SEARCH --openpgp");
+        snprintf (line, sizeof line, "SEARCH --openpgp --batch=%d",
+                  SEARCH_BATCH_SIZE);
         goto do_search;
       }
 
@@ -865,7 +988,9 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
       if (ndesc > 1)
         {
+          TSTAT_ENTER (TSTAT_KEYBOXD);
           err = kbx_client_data_simple (hd->kbl->kcd, line);
+          TSTAT_LEAVE (TSTAT_KEYBOXD);
           if (err)
             goto leave;
         }
@@ -875,18 +1000,35 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
  do_search:
   hd->last_ubid_valid = 0;
+  /* Drop the results of a previous batch not taken by the caller.  */
+  kbx_client_data_discard (hd->kbl->kcd,
+                           hd->kbl->batch_len - hd->kbl->batch_next);
+  hd->kbl->batch_len = hd->kbl->batch_next = 0;
+  hd->kbl->batch_eof = 0;
+  TSTAT_ENTER (TSTAT_KEYBOXD);
   err = kbx_client_data_cmd (hd->kbl->kcd, line, search_status_cb, hd);
-  if (!err && !(err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len)))
+  TSTAT_LEAVE (TSTAT_KEYBOXD);
+  if (err)
     {
-      hd->kbl->search_result = iobuf_temp_with_content (buffer, len);
-      xfree (buffer);
-      if (DBG_KEYDB && hd->last_ubid_valid)
-        log_printhex (hd->last_ubid, 20, "found UBID (%d,%d):",
-                      hd->last_uid_no, hd->last_pk_no);
+      /* Results already announced are still sent to us.  */
+      kbx_client_data_discard (hd->kbl->kcd, hd->kbl->batch_len);
+      hd->kbl->batch_len = 0;
+      hd->kbl->batch_eof = 0;
+    }
+  else
+    {
+      if (!hd->kbl->batch_len)
+        {
+          /* No PUBKEY_INFO status received.  */
+          hd->kbl->batch[0].valid = 0;
+          hd->kbl->batch_len = 1;
+        }
+      err = take_search_result (hd);
     }
 
  leave:
   if (DBG_CLOCK)
     log_clock ("%s leave (%sfound)", __func__, err? "not ":"");
+  TSTAT_LEAVE (TSTAT_KEYDB_SEARCH);
   return err;
 }
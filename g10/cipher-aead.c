@@ -32,12 +32,19 @@
 #include "packet.h"
 #include "options.h"
 #include "main.h"
+#include "aead-pool.h"
 
 
 /* The size of the buffer we allocate to encrypt the data.  This must
  * be a multiple of the OCB blocksize (16 byte).  */
 #define AEAD_ENC_BUFFER_SIZE (64*1024)
 
+/* The chunk size as used by --chunk-size for interactive input if
+ * that option has not been given.  The receiver can only output the
+ * data of a chunk after its tag has been checked and thus we use
+ * chunks not larger than our buffer.  */
+#define AEAD_INTERACTIVE_CHUNK_SIZE 16
+
 
 /* Wrapper around iobuf_write to make sure that a proper error code is
  * always returned.  */
@@ -149,7 +156,14 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
     goto leave;
 
   log_assert (opt.chunk_size >= 6 && opt.chunk_size <= 62);
-  cfx->chunkbyte = opt.chunk_size - 6;
+  if (cfx->interactive && !opt.explicit_chunk_size
+      && opt.chunk_size > AEAD_INTERACTIVE_CHUNK_SIZE)
+    cfx->chunkbyte = AEAD_INTERACTIVE_CHUNK_SIZE - 6;
+  else
+    cfx->chunkbyte = opt.chunk_size - 6;
+  if (DBG_FILTER)
+    log_debug ("aead chunkbyte: %u%s\n", cfx->chunkbyte,
+               cfx->interactive? " (interactive)":"");
   cfx->chunksize = (uint64_t)1 << (cfx->chunkbyte + 6);
   cfx->chunklen = 0;
   cfx->bufsize = AEAD_ENC_BUFFER_SIZE;
@@ -198,6 +212,24 @@ write_header (cipher_filter_context_t *cfx, iobuf_t a)
   if (err)
     return err;
 
+  if (opt.aead_threads > 1 && cfx->chunkbyte <= AEAD_POOL_MAX_CHUNKBYTE)
+    {
+      struct aead_pool_parm_s parm;
+
+      memset (&parm, 0, sizeof parm);
+      parm.gcry_algo   = map_cipher_openpgp_to_gcry (cfx->dek->algo);
+      parm.gcry_mode   = ciphermode;
+      parm.cipher_algo = cfx->dek->algo;
+      parm.aead_algo   = cfx->dek->use_aead;
+      parm.chunkbyte   = cfx->chunkbyte;
+      parm.startiv     = cfx->startiv;
+      parm.key         = cfx->dek->key;
+      parm.keylen      = cfx->dek->keylen;
+      err = aead_pool_new (&cfx->aead_pool, opt.aead_threads, &parm);
+      if (err)
+        goto leave;
+    }
+
   cfx->wrote_header = 1;
 
  leave:
@@ -251,6 +283,82 @@ write_final_chunk (cipher_filter_context_t *cfx, iobuf_t a)
 }
 
 
+/* Write the chunk of the finished JOB to stream A and give the job
+ * back to the pool.  */
+static gpg_error_t
+write_pool_result (cipher_filter_context_t *cfx, iobuf_t a,
+                   aead_pool_job_t job)
+{
+  gpg_error_t err;
+
+  err = job->err;
+  if (err)
+    log_error ("encrypting chunk %llu failed: %s\n",
+               (unsigned long long)job->chunkindex, gpg_strerror (err));
+  else
+    {
+      if (DBG_FILTER)
+        log_debug ("writing chunk %llu: len=%zu\n",
+                   (unsigned long long)job->chunkindex, job->len);
+      err = my_iobuf_write (a, job->buffer, job->len);
+      if (!err)
+        err = my_iobuf_write (a, job->tag, 16);
+    }
+  aead_pool_put_job (cfx->aead_pool, job);
+  return err;
+}
+
+
+/* Hand the current job to the worker pool.  */
+static void
+submit_pool_job (cipher_filter_context_t *cfx)
+{
+  aead_pool_submit (cfx->aead_pool, cfx->aead_job);
+  cfx->aead_job = NULL;
+  cfx->chunkindex++;
+}
+
+
+/* The flush function used with a worker pool.  The data is collected
+ * into complete chunks which are then encrypted by the workers.  */
+static gpg_error_t
+do_flush_pool (cipher_filter_context_t *cfx, iobuf_t a,
+               byte *buf, size_t size)
+{
+  gpg_error_t err;
+  size_t n;
+
+  while (size)
+    {
+      if (!cfx->aead_job)
+        {
+          while (!(cfx->aead_job = aead_pool_get_job (cfx->aead_pool)))
+            {
+              err = write_pool_result (cfx, a,
+                                       aead_pool_next_result (cfx->aead_pool));
+              if (err)
+                return err;
+            }
+          cfx->aead_job->chunkindex = cfx->chunkindex;
+        }
+
+      n = cfx->chunksize - cfx->aead_job->len;
+      if (n > size)
+        n = size;
+      memcpy (cfx->aead_job->buffer + cfx->aead_job->len, buf, n);
+      cfx->aead_job->len += n;
+      cfx->total += n;
+      buf += n;
+      size -= n;
+
+      if (cfx->aead_job->len == cfx->chunksize)
+        submit_pool_job (cfx);
+    }
+
+  return 0;
+}
+
+
 /* The core of the flush sub-function of cipher_filter_aead.   */
 static gpg_error_t
 do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
@@ -259,6 +367,9 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
   int finalize = 0;
   size_t n;
 
+  if (cfx->aead_pool)
+    return do_flush_pool (cfx, a, buf, size);
+
   /* Put the data into a buffer, flush and encrypt as needed.  */
   if (DBG_FILTER)
     log_debug ("flushing %zu bytes (cur buflen=%zu)\n", size, cfx->buflen);
@@ -405,7 +516,22 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   if (DBG_FILTER)
     log_debug ("do_free: buflen=%zu\n", cfx->buflen);
 
-  if (cfx->chunklen || cfx->buflen)
+  if (cfx->aead_pool)
+    {
+      aead_pool_job_t job;
+
+      /* Submit the last chunk and write out all pending chunks.  */
+      if (cfx->aead_job && cfx->aead_job->len)
+        submit_pool_job (cfx);
+      cfx->aead_job = NULL;
+      while ((job = aead_pool_next_result (cfx->aead_pool)))
+        {
+          err = write_pool_result (cfx, a, job);
+          if (err)
+            goto leave;
+        }
+    }
+  else if (cfx->chunklen || cfx->buflen)
     {
       if (DBG_FILTER)
         log_debug ("encrypting last %zu bytes of the last chunk\n",cfx->buflen);
@@ -448,6 +574,9 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
   err = write_final_chunk (cfx, a);
 
  leave:
+  aead_pool_release (cfx->aead_pool);
+  cfx->aead_pool = NULL;
+  cfx->aead_job = NULL;
   xfree (cfx->buffer);
   cfx->buffer = NULL;
   gcry_cipher_close (cfx->cipher_hd);
@@ -456,6 +585,26 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
 }
 
 
+/* Return true if the data to be encrypted is read from INP which is
+ * a terminal and no size has been announced for it.  Such a stream
+ * is encrypted with smaller chunks.  */
+int
+aead_interactive_input (iobuf_t inp)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)inp;
+  return 0;
+#else
+  gnupg_fd_t fd;
+
+  if (!inp || opt.set_filesize || opt.input_size_hint)
+    return 0;
+  fd = iobuf_get_fd (inp);
+  return fd != GNUPG_INVALID_FD && gnupg_isatty (FD2INT (fd));
+#endif
+}
+
+
 /*
  * This filter is used to encrypt data with an AEAD algorithm
  */
@@ -0,0 +1,667 @@
+/* compress-pool.c - Block parallel deflate compression
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This module compresses the input in blocks on a set of worker
+ * threads, in the way pigz does it.  Each block is compressed with
+ * its own raw deflate stream which is primed with the last window of
+ * the preceding block as dictionary and terminated with a sync
+ * flush, so that it ends on a byte boundary.  The last block is
+ * terminated with a final deflate block.  Concatenating the outputs
+ * thus gives a standard deflate stream; for ZLIB we add the header
+ * and the Adler-32 trailer ourselves.
+ *
+ * The blocks are kept in a ring of jobs which also bounds the amount
+ * of data held in memory.  HEAD is the oldest submitted job and
+ * NSUBMITTED jobs starting at HEAD are either queued, being processed
+ * or done.  The job following them is the one being filled.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+#ifdef HAVE_ZIP
+# include <zlib.h>
+#endif
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/iobuf.h"
+#include "../common/host2net.h"
+#include "../common/openpgpdefs.h"
+#include "compress-pool.h"
+
+#ifdef HAVE_ZIP
+
+#ifdef __riscos__
+#define BYTEF_CAST(a) ((Bytef *)(a))
+#else
+#define BYTEF_CAST(a) (a)
+#endif
+
+/* The size of the input blocks.  */
+#define BLOCKSIZE (128*1024)
+
+/* The states of a job.  */
+enum
+  {
+    JOB_FREE = 0,
+    JOB_QUEUED,
+    JOB_BUSY,
+    JOB_DONE
+  };
+
+
+struct compress_job_s
+{
+  byte *in;          /* The dictionary followed by the block's data.  */
+  size_t dictlen;
+  size_t inlen;      /* The length of the data following the dict.  */
+  byte *out;         /* The compressed data.   */
+  size_t outsize;
+  size_t outlen;
+  int last;          /* This is the last block.  */
+  int zrc;           /* The zlib error code or Z_OK.  */
+  int state;
+};
+typedef struct compress_job_s *compress_job_t;
+
+
+struct compress_worker_s
+{
+  compress_pool_t pool;
+  npth_t thd;
+  unsigned int started : 1;
+  unsigned int zs_valid : 1;
+  z_stream zs;
+};
+
+
+struct compress_pool_s
+{
+  int algo;
+  int level;                  /* The zlib compression level.  */
+  unsigned int adaptive : 1;  /* Store incompressible blocks.  */
+  size_t dictsize;            /* The size of the deflate window.  */
+  uLong adler;                /* The checksum for ZLIB.  */
+  unsigned int wrote_header : 1;
+
+  byte *window;               /* The last DICTSIZE bytes of input.  */
+  size_t windowlen;
+
+  npth_mutex_t mutex;
+  npth_cond_t work_cond;      /* Signaled when a job has been queued.  */
+  npth_cond_t done_cond;      /* Signaled when a job is done.  */
+  unsigned int stop : 1;      /* Tell the workers to terminate.  */
+
+  unsigned int head;
+  unsigned int nsubmitted;
+  unsigned int njobs;
+  struct compress_job_s *jobs;
+  compress_job_t fill;        /* The job being filled or NULL.  */
+
+  unsigned int nworkers;
+  struct compress_worker_s workers[1];
+};
+
+
+static void
+lock_pool (compress_pool_t pool)
+{
+  int rc = npth_mutex_lock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pool (compress_pool_t pool)
+{
+  int rc = npth_mutex_unlock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Return true if the LEN bytes at BUF look incompressible.  This is
+ * the case if the byte values are about uniformly distributed, as
+ * measured by the sum of the squared counts, and hardly any 4 byte
+ * sequence repeats, which catches the back references deflate would
+ * use.  Only the first COMPRESS_SAMPLE_LEN bytes are looked at; less
+ * than 1024 bytes are never considered incompressible.  This
+ * function is thread-safe.  */
+int
+compress_is_incompressible (const byte *buf, size_t len)
+{
+  u32 counts[256];
+  u32 seen[4096];
+  unsigned long long sumsq = 0;
+  size_t i, matches = 0;
+  u32 v;
+
+  if (len < 1024)
+    return 0;
+  if (len > COMPRESS_SAMPLE_LEN)
+    len = COMPRESS_SAMPLE_LEN;
+
+  memset (counts, 0, sizeof counts);
+  for (i = 0; i < len; i++)
+    counts[buf[i]]++;
+  for (i = 0; i < 256; i++)
+    sumsq += (unsigned long long)counts[i] * counts[i];
+  /* For random data the expected value of SUMSQ is about
+   * LEN*LEN/256 + LEN; allow for 15 percent more.  */
+  if (256 * sumsq > (unsigned long long)len * len * 115 / 100 + 256 * len)
+    return 0;
+
+  memset (seen, 0, sizeof seen);
+  for (i = 0; i + 4 <= len; i++)
+    {
+      v = buf32_to_u32 (buf + i);
+      if (seen[(v * 2654435761u) >> 20] == v && v)
+        matches++;
+      seen[(v * 2654435761u) >> 20] = v;
+    }
+  return matches < len / 64;
+}
+
+
+/* Compress the block of JOB using the stream ZS.  If LEVEL is not -1
+ * the block is compressed with that level.  This runs without the
+ * npth lock and may thus not log anything.  */
+static int
+process_job (z_stream *zs, compress_job_t job, int level)
+{
+  int zrc;
+
+  zrc = deflateReset (zs);
+  if (zrc == Z_OK && level != -1)
+    zrc = deflateParams (zs, level, Z_DEFAULT_STRATEGY);
+  if (zrc == Z_OK && job->dictlen)
+    zrc = deflateSetDictionary (zs, BYTEF_CAST (job->in), job->dictlen);
+  if (zrc != Z_OK)
+    return zrc;
+
+  zs->next_in = BYTEF_CAST (job->in + job->dictlen);
+  zs->avail_in = job->inlen;
+  job->outlen = 0;
+  for (;;)
+    {
+      if (job->outlen == job->outsize)
+        {
+          /* Should not happen because we allocated for the worst
+           * case, but zlib does not give a hard bound for flushed
+           * streams.  */
+          byte *p = realloc (job->out, job->outsize + BLOCKSIZE);
+          if (!p)
+            return Z_MEM_ERROR;
+          job->out = p;
+          job->outsize += BLOCKSIZE;
+        }
+      zs->next_out = BYTEF_CAST (job->out + job->outlen);
+      zs->avail_out = job->outsize - job->outlen;
+      zrc = deflate (zs, job->last? Z_FINISH : Z_SYNC_FLUSH);
+      job->outlen = job->outsize - zs->avail_out;
+      if (zrc == Z_STREAM_END)
+        return Z_OK;
+      if (zrc != Z_OK && zrc != Z_BUF_ERROR)
+        return zrc;
+      if (!job->last && !zs->avail_in && zs->avail_out)
+        return Z_OK;
+    }
+}
+
+
+/* Return the first queued job or NULL.  Must be called with the
+ * lock held.  */
+static compress_job_t
+find_queued_job (compress_pool_t pool)
+{
+  unsigned int i;
+  compress_job_t job;
+
+  for (i = 0; i < pool->nsubmitted; i++)
+    {
+      job = pool->jobs + (pool->head + i) % pool->njobs;
+      if (job->state == JOB_QUEUED)
+        return job;
+    }
+  return NULL;
+}
+
+
+static void *
+compress_worker (void *arg)
+{
+  struct compress_worker_s *wk = arg;
+  compress_pool_t pool = wk->pool;
+  compress_job_t job;
+  int zrc, level;
+
+  for (;;)
+    {
+      lock_pool (pool);
+      while (!pool->stop && !(job = find_queued_job (pool)))
+        npth_cond_wait (&pool->work_cond, &pool->mutex);
+      if (pool->stop)
+        {
+          unlock_pool (pool);
+          break;
+        }
+      job->state = JOB_BUSY;
+      unlock_pool (pool);
+
+      npth_unprotect ();
+      level = -1;
+      if (pool->adaptive)
+        level = compress_is_incompressible (job->in + job->dictlen,
+                                            job->inlen)? 0 : pool->level;
+      zrc = process_job (&wk->zs, job, level);
+      npth_protect ();
+
+      lock_pool (pool);
+      job->zrc = zrc;
+      job->state = JOB_DONE;
+      npth_cond_broadcast (&pool->done_cond);
+      unlock_pool (pool);
+    }
+
+  return NULL;
+}
+
+
+/* Create a new pool with NTHREADS worker threads to compress with
+ * ALGO, which must be COMPRESS_ALGO_ZIP or COMPRESS_ALGO_ZLIB, using
+ * the zlib compression level LEVEL.  NTHREADS is limited to
+ * COMPRESS_POOL_MAX_THREADS.  If ADAPTIVE is set, blocks which look
+ * incompressible are stored instead.  */
+gpg_error_t
+compress_pool_new (compress_pool_t *r_pool, int algo, int level,
+                   int adaptive, unsigned int nthreads)
+{
+  gpg_error_t err = 0;
+  compress_pool_t pool;
+  npth_attr_t tattr;
+  unsigned int i;
+  int wbits, rc;
+
+  *r_pool = NULL;
+  /* PGP uses a window size of 13 bits for ZIP; see compress.c.  */
+  if (algo == COMPRESS_ALGO_ZIP)
+    wbits = 13;
+  else if (algo == COMPRESS_ALGO_ZLIB)
+    wbits = 15;
+  else
+    return gpg_error (GPG_ERR_COMPR_ALGO);
+  if (!nthreads)
+    return gpg_error (GPG_ERR_INV_ARG);
+  if (nthreads > COMPRESS_POOL_MAX_THREADS)
+    nthreads = COMPRESS_POOL_MAX_THREADS;
+
+  pool = xtrycalloc (1, sizeof *pool + (nthreads - 1) * sizeof *pool->workers);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  pool->algo = algo;
+  pool->level = level;
+  pool->adaptive = !!adaptive;
+  pool->dictsize = (size_t)1 << wbits;
+  pool->adler = adler32 (0, NULL, 0);
+
+  rc = npth_mutex_init (&pool->mutex, NULL);
+  if (rc)
+    {
+      xfree (pool);
+      return gpg_error_from_errno (rc);
+    }
+  npth_cond_init (&pool->work_cond, NULL);
+  npth_cond_init (&pool->done_cond, NULL);
+
+  pool->window = xtrymalloc (pool->dictsize);
+  if (!pool->window)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Two extra jobs so that the workers are kept busy while we fill
+   * one job and write out another.  */
+  pool->njobs = nthreads + 2;
+  pool->jobs = xtrycalloc (pool->njobs, sizeof *pool->jobs);
+  if (!pool->jobs)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (i = 0; i < pool->njobs; i++)
+    {
+      compress_job_t job = pool->jobs + i;
+
+      /* Plain malloc because the workers may need to realloc.  */
+      job->outsize = compressBound (BLOCKSIZE) + 64;
+      job->in = malloc (pool->dictsize + BLOCKSIZE);
+      job->out = malloc (job->outsize);
+      if (!job->in || !job->out)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  for (i = 0; i < nthreads; i++)
+    {
+      struct compress_worker_s *wk = pool->workers + i;
+
+      wk->pool = pool;
+      rc = deflateInit2 (&wk->zs, level, Z_DEFLATED, -wbits, 8,
+                         Z_DEFAULT_STRATEGY);
+      if (rc != Z_OK)
+        {
+          log_error ("zlib problem: %s\n",
+                     rc == Z_MEM_ERROR ? "out of core" :
+                     rc == Z_VERSION_ERROR ? "invalid lib version" :
+                     "unknown error");
+          err = gpg_error (GPG_ERR_INTERNAL);
+          goto leave;
+        }
+      wk->zs_valid = 1;
+      pool->nworkers++;
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i = 0; i < pool->nworkers; i++)
+    {
+      rc = npth_create (&pool->workers[i].thd, &tattr, compress_worker,
+                        pool->workers + i);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          break;
+        }
+      pool->workers[i].started = 1;
+    }
+  npth_attr_destroy (&tattr);
+
+ leave:
+  if (err)
+    {
+      log_error ("error creating compression worker pool: %s\n",
+                 gpg_strerror (err));
+      compress_pool_release (pool);
+    }
+  else
+    *r_pool = pool;
+  return err;
+}
+
+
+/* Stop all workers and release POOL.  */
+void
+compress_pool_release (compress_pool_t pool)
+{
+  unsigned int i;
+
+  if (!pool)
+    return;
+
+  lock_pool (pool);
+  pool->stop = 1;
+  npth_cond_broadcast (&pool->work_cond);
+  unlock_pool (pool);
+  for (i = 0; i < pool->nworkers; i++)
+    {
+      if (pool->workers[i].started)
+        npth_join (pool->workers[i].thd, NULL);
+      if (pool->workers[i].zs_valid)
+        deflateEnd (&pool->workers[i].zs);
+    }
+
+  if (pool->jobs)
+    {
+      /* The buffers hold plaintext.  */
+      for (i = 0; i < pool->njobs; i++)
+        {
+          if (pool->jobs[i].in)
+            wipememory (pool->jobs[i].in, pool->dictsize + BLOCKSIZE);
+          free (pool->jobs[i].in);
+          free (pool->jobs[i].out);
+        }
+      xfree (pool->jobs);
+    }
+  if (pool->window)
+    wipememory (pool->window, pool->dictsize);
+  xfree (pool->window);
+  npth_cond_destroy (&pool->work_cond);
+  npth_cond_destroy (&pool->done_cond);
+  npth_mutex_destroy (&pool->mutex);
+  xfree (pool);
+}
+
+
+/* Wait for the oldest job, write its output to A and mark it as
+ * free.  */
+static gpg_error_t
+write_result (compress_pool_t pool, iobuf_t a)
+{
+  gpg_error_t err = 0;
+  compress_job_t job = pool->jobs + pool->head;
+
+  lock_pool (pool);
+  while (job->state != JOB_DONE)
+    npth_cond_wait (&pool->done_cond, &pool->mutex);
+  unlock_pool (pool);
+
+  if (job->zrc != Z_OK)
+    {
+      log_error ("zlib deflate problem: rc=%d\n", job->zrc);
+      err = gpg_error (GPG_ERR_INTERNAL);
+    }
+  else if (iobuf_write (a, job->out, job->outlen))
+    {
+      log_error ("deflate: iobuf_write failed\n");
+      err = iobuf_error (a);
+      if (!err)
+        err = gpg_error (GPG_ERR_EIO);
+    }
+
+  lock_pool (pool);
+  job->state = JOB_FREE;
+  pool->head = (pool->head + 1) % pool->njobs;
+  pool->nsubmitted--;
+  unlock_pool (pool);
+  return err;
+}
+
+
+/* Hand the job being filled to the workers.  */
+static void
+submit_fill_job (compress_pool_t pool, int last)
+{
+  compress_job_t job = pool->fill;
+  size_t n;
+
+  /* Remember the window for the next block.  The dictionary and the
+   * data are contiguous so that a short block simply extends the
+   * previous window.  */
+  n = job->dictlen + job->inlen;
+  if (n > pool->dictsize)
+    n = pool->dictsize;
+  memcpy (pool->window, job->in + job->dictlen + job->inlen - n, n);
+  pool->windowlen = n;
+
+  job->last = last;
+  pool->fill = NULL;
+  lock_pool (pool);
+  job->state = JOB_QUEUED;
+  pool->nsubmitted++;
+  npth_cond_signal (&pool->work_cond);
+  unlock_pool (pool);
+}
+
+
+/* Get a job for filling.  If all jobs are in use the oldest one is
+ * written out first.  */
+static gpg_error_t
+get_fill_job (compress_pool_t pool, iobuf_t a)
+{
+  gpg_error_t err;
+  compress_job_t job;
+
+  if (pool->nsubmitted == pool->njobs)
+    {
+      err = write_result (pool, a);
+      if (err)
+        return err;
+    }
+  job = pool->jobs + (pool->head + pool->nsubmitted) % pool->njobs;
+  log_assert (job->state == JOB_FREE);
+  job->dictlen = pool->windowlen;
+  memcpy (job->in, pool->window, pool->windowlen);
+  job->inlen = 0;
+  job->zrc = Z_OK;
+  pool->fill = job;
+  return 0;
+}
+
+
+/* Write the ZLIB header as deflateInit would do for LEVEL.  */
+static gpg_error_t
+write_zlib_header (iobuf_t a, int level)
+{
+  unsigned int header;
+  int level_flags;
+
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+  if (level < 2)
+    level_flags = 0;
+  else if (level < 6)
+    level_flags = 1;
+  else if (level == 6)
+    level_flags = 2;
+  else
+    level_flags = 3;
+  header = ((Z_DEFLATED + ((15 - 8) << 4)) << 8) | (level_flags << 6);
+  header += 31 - (header % 31);
+  if (iobuf_put (a, header >> 8) || iobuf_put (a, header & 0xff))
+    return iobuf_error (a)? iobuf_error (a) : gpg_error (GPG_ERR_EIO);
+  return 0;
+}
+
+
+/* Compress LEN bytes from BUF and write the output to A.  The output
+ * is delayed until enough blocks are in flight.  */
+gpg_error_t
+compress_pool_write (compress_pool_t pool, iobuf_t a,
+                     const byte *buf, size_t len)
+{
+  gpg_error_t err;
+  size_t n;
+
+  if (!pool->wrote_header)
+    {
+      if (pool->algo == COMPRESS_ALGO_ZLIB)
+        {
+          err = write_zlib_header (a, pool->level);
+          if (err)
+            return err;
+        }
+      pool->wrote_header = 1;
+    }
+
+  if (pool->algo == COMPRESS_ALGO_ZLIB)
+    pool->adler = adler32 (pool->adler, BYTEF_CAST (buf), len);
+
+  while (len)
+    {
+      if (!pool->fill)
+        {
+          err = get_fill_job (pool, a);
+          if (err)
+            return err;
+        }
+      n = BLOCKSIZE - pool->fill->inlen;
+      if (n > len)
+        n = len;
+      memcpy (pool->fill->in + pool->fill->dictlen + pool->fill->inlen,
+              buf, n);
+      pool->fill->inlen += n;
+      buf += n;
+      len -= n;
+      if (pool->fill->inlen == BLOCKSIZE)
+        submit_fill_job (pool, 0);
+    }
+
+  return 0;
+}
+
+
+/* Compress the remaining data, write all pending output, and the
+ * trailer to A.  */
+gpg_error_t
+compress_pool_finish (compress_pool_t pool, iobuf_t a)
+{
+  gpg_error_t err;
+  byte trailer[4];
+
+  if (!pool->wrote_header)
+    {
+      err = compress_pool_write (pool, a, NULL, 0);
+      if (err)
+        return err;
+    }
+
+  /* The last block may be empty; it then only carries the final
+   * deflate block.  */
+  if (!pool->fill)
+    {
+      err = get_fill_job (pool, a);
+      if (err)
+        return err;
+    }
+  submit_fill_job (pool, 1);
+
+  while (pool->nsubmitted)
+    {
+      err = write_result (pool, a);
+      if (err)
+        return err;
+    }
+
+  if (pool->algo == COMPRESS_ALGO_ZLIB)
+    {
+      trailer[0] = pool->adler >> 24;
+      trailer[1] = pool->adler >> 16;
+      trailer[2] = pool->adler >> 8;
+      trailer[3] = pool->adler;
+      if (iobuf_write (a, trailer, 4))
+        return iobuf_error (a)? iobuf_error (a) : gpg_error (GPG_ERR_EIO);
+    }
+  return 0;
+}
+
+#endif /*HAVE_ZIP*/
@@ -0,0 +1,41 @@
+/* compress-pool.h - Block parallel deflate compression
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_COMPRESS_POOL_H
+#define G10_COMPRESS_POOL_H
+
+/* The maximum number of worker threads.  */
+#define COMPRESS_POOL_MAX_THREADS 64
+
+/* The number of bytes looked at by compress_is_incompressible.  */
+#define COMPRESS_SAMPLE_LEN (64*1024)
+
+struct compress_pool_s;
+typedef struct compress_pool_s *compress_pool_t;
+
+
+/*-- compress-pool.c --*/
+gpg_error_t compress_pool_new (compress_pool_t *r_pool, int algo, int level,
+                               int adaptive, unsigned int nthreads);
+gpg_error_t compress_pool_write (compress_pool_t pool, iobuf_t a,
+                                 const byte *buf, size_t len);
+gpg_error_t compress_pool_finish (compress_pool_t pool, iobuf_t a);
+void compress_pool_release (compress_pool_t pool);
+int  compress_is_incompressible (const byte *buf, size_t len);
+
+#endif /*G10_COMPRESS_POOL_H*/
@@ -0,0 +1,298 @@
+/* compress-zstd.c - zstd compress filter
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* ZSTD is not an OpenPGP algorithm.  It uses an ID from the private
+ * and experimental range and is only accepted with the option
+ * --allow-zstd-compression; see check_compress_algo.  The structure
+ * of this file follows compress-bz2.c.  */
+
+#include <config.h>
+#include <string.h>
+#include <stdio.h>
+#include <zstd.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "packet.h"
+#include "filter.h"
+#include "main.h"
+#include "options.h"
+
+
+/* The state of a zstd stream.  */
+struct zstd_state_s
+{
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer in;  /* The input not yet decompressed.  */
+  int eof;           /* The end of the compressed data has been seen.  */
+  int done;          /* The last frame has been decompressed.  */
+};
+typedef struct zstd_state_s *zstd_state_t;
+
+
+/* Return the zstd level for the configured compression level.  zstd
+ * allows for higher levels than zlib.  */
+static int
+get_compress_level (void)
+{
+  if (opt.compress_level >= 1 && opt.compress_level <= ZSTD_maxCLevel ())
+    return opt.compress_level;
+  else if (opt.compress_level > ZSTD_maxCLevel ())
+    return ZSTD_maxCLevel ();
+  else if (opt.compress_level == -1)
+    return ZSTD_CLEVEL_DEFAULT;
+  log_error ("invalid compression level; using default level\n");
+  return ZSTD_CLEVEL_DEFAULT;
+}
+
+
+static void
+init_compress (compress_filter_context_t *zfx, zstd_state_t st)
+{
+  size_t ret;
+
+  st->cctx = ZSTD_createCCtx ();
+  if (!st->cctx)
+    {
+      log_error ("zstd problem: %s\n", "out of core");
+      write_status_error ("zstd.init", gpg_error (GPG_ERR_INTERNAL));
+      g10_exit (2);
+    }
+  ret = ZSTD_CCtx_setParameter (st->cctx, ZSTD_c_compressionLevel,
+                                get_compress_level ());
+  if (ZSTD_isError (ret))
+    {
+      log_error ("zstd problem: %s\n", ZSTD_getErrorName (ret));
+      write_status_error ("zstd.init", gpg_error (GPG_ERR_INTERNAL));
+      g10_exit (2);
+    }
+  /* With --compress-threads the library compresses on its own worker
+   * threads.  This fails if it has been built without support for
+   * threads; we then compress in the calling thread.  */
+  if (opt.compress_threads > 1)
+    {
+      ret = ZSTD_CCtx_setParameter (st->cctx, ZSTD_c_nbWorkers,
+                                    opt.compress_threads);
+      if (ZSTD_isError (ret) && opt.verbose)
+        log_info ("zstd: can't use %u threads: %s\n",
+                  opt.compress_threads, ZSTD_getErrorName (ret));
+    }
+
+  zfx->outbufsize = ZSTD_CStreamOutSize ();
+  zfx->outbuf = xmalloc (zfx->outbufsize);
+}
+
+
+/* Compress the SIZE bytes at BUF with the zstd directive MODE and
+ * write the output to A.  */
+static int
+do_compress (compress_filter_context_t *zfx, zstd_state_t st,
+             ZSTD_EndDirective mode, const byte *buf, size_t size, IOBUF a)
+{
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out;
+  size_t remaining;
+  int rc;
+
+  if (mode == ZSTD_e_continue && !size)
+    return 0;
+
+  in.src = buf;
+  in.size = size;
+  in.pos = 0;
+  do
+    {
+      out.dst = zfx->outbuf;
+      out.size = zfx->outbufsize;
+      out.pos = 0;
+      remaining = ZSTD_compressStream2 (st->cctx, &out, &in, mode);
+      if (ZSTD_isError (remaining))
+        {
+          log_error ("zstd compress problem: %s\n",
+                     ZSTD_getErrorName (remaining));
+          write_status_error ("zstd.deflate", gpg_error (GPG_ERR_INTERNAL));
+          g10_exit (2);
+        }
+      if (DBG_FILTER)
+        log_debug ("zstd compress: in=%zu/%zu out=%zu remaining=%zu\n",
+                   in.pos, in.size, out.pos, remaining);
+      if (out.pos && (rc = iobuf_write (a, zfx->outbuf, out.pos)))
+        {
+          log_error ("zstd compress: iobuf_write failed\n");
+          return rc;
+        }
+    }
+  while (mode == ZSTD_e_end? remaining : in.pos < in.size);
+
+  return 0;
+}
+
+
+static void
+init_uncompress (compress_filter_context_t *zfx, zstd_state_t st)
+{
+  st->dctx = ZSTD_createDCtx ();
+  if (!st->dctx)
+    {
+      log_error ("zstd problem: %s\n", "out of core");
+      write_status_error ("zstd.init.un", gpg_error (GPG_ERR_INTERNAL));
+      g10_exit (2);
+    }
+
+  zfx->inbufsize = ZSTD_DStreamInSize ();
+  zfx->inbuf = xmalloc (zfx->inbufsize);
+  st->in.src = zfx->inbuf;
+  st->in.size = 0;
+  st->in.pos = 0;
+}
+
+
+/* Decompress data read from A into the SIZE bytes at BUF and store
+ * the number of bytes in RET_LEN.  Returns -1 at the end of the
+ * data.  */
+static int
+do_uncompress (compress_filter_context_t *zfx, zstd_state_t st,
+               IOBUF a, byte *buf, size_t size, size_t *ret_len)
+{
+  ZSTD_outBuffer out;
+  size_t ret, before;
+  int nread;
+  int rc = 0;
+
+  out.dst = buf;
+  out.size = size;
+  out.pos = 0;
+  for (;;)
+    {
+      if (st->in.pos == st->in.size && !st->eof)
+        {
+          nread = iobuf_read (a, zfx->inbuf, zfx->inbufsize);
+          if (nread == -1)
+            {
+              st->eof = 1;
+              nread = 0;
+            }
+          st->in.src = zfx->inbuf;
+          st->in.size = nread;
+          st->in.pos = 0;
+        }
+      if (st->in.pos == st->in.size && st->eof && st->done)
+        {
+          rc = -1; /* eof */
+          break;
+        }
+
+      before = out.pos;
+      ret = ZSTD_decompressStream (st->dctx, &out, &st->in);
+      if (ZSTD_isError (ret))
+        {
+          log_error ("zstd decompress problem: %s\n", ZSTD_getErrorName (ret));
+          write_status_error ("zstd.inflate", gpg_error (GPG_ERR_BAD_DATA));
+          g10_exit (2);
+        }
+      /* A return value of 0 means that a frame has been completely
+       * decoded and flushed.  More frames may follow.  */
+      st->done = !ret;
+      if (out.pos == out.size)
+        break;
+      if (st->in.pos == st->in.size && st->eof && !st->done
+          && out.pos == before)
+        {
+          log_error ("unexpected EOF in zstd data\n");
+          rc = GPG_ERR_BAD_DATA;
+          break;
+        }
+    }
+
+  *ret_len = out.pos;
+  if (DBG_FILTER)
+    log_debug ("zstd do_uncompress: returning %zu bytes\n", *ret_len);
+  return rc;
+}
+
+
+int
+compress_filter_zstd (void *opaque, int control,
+                      IOBUF a, byte *buf, size_t *ret_len)
+{
+  size_t size = *ret_len;
+  compress_filter_context_t *zfx = opaque;
+  zstd_state_t st = zfx->opaque;
+  int rc = 0;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      if (!zfx->status)
+        {
+          st = zfx->opaque = xmalloc_clear (sizeof *st);
+          init_uncompress (zfx, st);
+          zfx->status = 1;
+        }
+
+      rc = do_uncompress (zfx, st, a, buf, size, ret_len);
+    }
+  else if (control == IOBUFCTRL_FLUSH)
+    {
+      if (!zfx->status)
+        {
+          PACKET pkt;
+          PKT_compressed cd;
+
+          if (zfx->algo != COMPRESS_ALGO_ZSTD)
+            BUG ();
+          memset (&cd, 0, sizeof cd);
+          cd.len = 0;
+          cd.algorithm = zfx->algo;
+          init_packet (&pkt);
+          pkt.pkttype = PKT_COMPRESSED;
+          pkt.pkt.compressed = &cd;
+          if (build_packet (a, &pkt))
+            log_bug ("build_packet(PKT_COMPRESSED) failed\n");
+          st = zfx->opaque = xmalloc_clear (sizeof *st);
+          init_compress (zfx, st);
+          zfx->status = 2;
+        }
+
+      rc = do_compress (zfx, st, ZSTD_e_continue, buf, size, a);
+    }
+  else if (control == IOBUFCTRL_FREE)
+    {
+      if (zfx->status == 1)
+        {
+          ZSTD_freeDCtx (st->dctx);
+          xfree (st);
+          zfx->opaque = NULL;
+          xfree (zfx->inbuf); zfx->inbuf = NULL;
+        }
+      else if (zfx->status == 2)
+        {
+          do_compress (zfx, st, ZSTD_e_end, NULL, 0, a);
+          ZSTD_freeCCtx (st->cctx);
+          xfree (st);
+          zfx->opaque = NULL;
+          xfree (zfx->outbuf); zfx->outbuf = NULL;
+        }
+      if (zfx->release)
+        zfx->release (zfx);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "compress_filter", *ret_len);
+  return rc;
+}
@@ -40,6 +40,7 @@
 #include "filter.h"
 #include "main.h"
 #include "options.h"
+#include "compress-pool.h"
 
 
 #ifdef __riscos__
@@ -48,26 +49,35 @@
 #define BYTEF_CAST(a) (a)
 #endif
 
+/* With --compress-adaptive the input is sampled at the start and
+ * then again after this many bytes.  */
+#define COMPRESS_SAMPLE_INTERVAL (1024*1024)
+
 
 
 int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
+int compress_filter_zstd (void *opaque, int control,
+                          IOBUF a, byte *buf, size_t *ret_len);
 
 #ifdef HAVE_ZIP
+/* Return the zlib level for the configured compression level.  */
+static int
+get_compress_level (void)
+{
+    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
+	return opt.compress_level;
+    else if( opt.compress_level == -1 )
+	return Z_DEFAULT_COMPRESSION;
+    log_error("invalid compression level; using default level\n");
+    return Z_DEFAULT_COMPRESSION;
+}
+
 static void
 init_compress( compress_filter_context_t *zfx, z_stream *zs )
 {
     int rc;
-    int level;
-
-    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
-	level = opt.compress_level;
-    else if( opt.compress_level == -1 )
-	level = Z_DEFAULT_COMPRESSION;
-    else {
-	log_error("invalid compression level; using default level\n");
-	level = Z_DEFAULT_COMPRESSION;
-    }
+    int level = get_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -83,6 +93,54 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 
     zfx->outbufsize = 65536;
     zfx->outbuf = xmalloc( zfx->outbufsize );
+    zfx->level = level;
+    zfx->sample_countdown = 0;
+}
+
+
+/* Sample the SIZE bytes of input at BUF if it is time to do so and
+ * switch between storing and compressing depending on whether the
+ * input looks compressible.  Pending output is written to A.  */
+static int
+adapt_compress_level (compress_filter_context_t *zfx, z_stream *zs,
+		      const byte *buf, size_t size, IOBUF a)
+{
+    int rc, zrc, level;
+    unsigned n;
+
+    if (zfx->sample_countdown > size) {
+	zfx->sample_countdown -= size;
+	return 0;
+    }
+    if (size < 1024)
+	return 0;  /* Too short to judge; sample the next buffer.  */
+    zfx->sample_countdown = COMPRESS_SAMPLE_INTERVAL;
+
+    level = compress_is_incompressible (buf, size)? 0 : get_compress_level ();
+    if (level == zfx->level)
+	return 0;
+    if( DBG_FILTER )
+	log_debug("compress level changed from %d to %d\n", zfx->level, level);
+
+    /* This compresses the pending input with the old level.  */
+    do {
+	zs->next_out = BYTEF_CAST (zfx->outbuf);
+	zs->avail_out = zfx->outbufsize;
+	zrc = deflateParams (zs, level, Z_DEFAULT_STRATEGY);
+	if( zrc != Z_OK && zrc != Z_BUF_ERROR ) {
+	    log_error ("zlib deflateParams problem: rc=%d\n", zrc );
+            write_status_error ("zlib.deflate", gpg_error (GPG_ERR_INTERNAL));
+            g10_exit (2);
+	}
+	n = zfx->outbufsize - zs->avail_out;
+	if( n && (rc=iobuf_write( a, zfx->outbuf, n )) ) {
+	    log_error ("deflate: iobuf_write failed\n");
+	    return rc;
+	}
+    } while( zrc == Z_BUF_ERROR && n );
+    if( zrc == Z_OK )
+	zfx->level = level;
+    return 0;
 }
 
 static int
@@ -259,14 +317,41 @@ compress_filter( void *opaque, int control,
 	    pkt.pkt.compressed = &cd;
 	    if( build_packet( a, &pkt ))
 		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
-	    zfx->status = 2;
+	    if (opt.compress_threads > 1) {
+		compress_pool_t pool;
+
+		/* On failure we silently fall back to a single stream.  */
+		if (!compress_pool_new (&pool, zfx->algo,
+					get_compress_level (),
+					opt.compress_adaptive,
+					opt.compress_threads)) {
+		    zfx->opaque = pool;
+		    zfx->status = 3;
+		}
+	    }
+	    if (!zfx->status) {
+		zs = zfx->opaque = xmalloc_clear( sizeof *zs );
+		init_compress( zfx, zs );
+		zfx->status = 2;
+	    }
 	}
 
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if (zfx->status == 3) {
+	    if (compress_pool_write (zfx->opaque, a, buf, size)) {
+		write_status_error ("zlib.deflate",
+				    gpg_error (GPG_ERR_INTERNAL));
+		g10_exit (2);
+	    }
+	}
+	else {
+	    if (opt.compress_adaptive)
+		rc = adapt_compress_level (zfx, zs, buf, size, a);
+	    if (!rc) {
+		zs->next_in = BYTEF_CAST (buf);
+		zs->avail_in = size;
+		rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	    }
+	}
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( zfx->status == 1 ) {
@@ -284,6 +369,15 @@ compress_filter( void *opaque, int control,
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
+	else if( zfx->status == 3 ) {
+	    if (compress_pool_finish (zfx->opaque, a)) {
+		write_status_error ("zlib.deflate",
+				    gpg_error (GPG_ERR_INTERNAL));
+		g10_exit (2);
+	    }
+	    compress_pool_release (zfx->opaque);
+	    zfx->opaque = NULL;
+	}
         if (zfx->release)
           zfx->release (zfx);
     }
@@ -370,6 +464,13 @@ push_compress_filter2(IOBUF out,compress_filter_context_t *zfx,
       break;
 #endif
 
+#ifdef HAVE_ZSTD
+    case COMPRESS_ALGO_ZSTD:
+      iobuf_push_filter2(out,compress_filter_zstd,zfx,rel);
+      err = 0;
+      break;
+#endif
+
     default:
       BUG();
     }
@@ -61,6 +61,61 @@ progress_cb (void *ctx, const char *what, int printchar,
 }
 
 
+/* Return true if a status line with code NO needs to be flushed even
+ * with --buffered-status.  These are lines the frontend may need to
+ * act upon while we are waiting for something.  */
+static int
+status_needs_flush (int no)
+{
+  switch (no)
+    {
+    case STATUS_GET_BOOL:
+    case STATUS_GET_LINE:
+    case STATUS_GET_HIDDEN:
+    case STATUS_GOT_IT:
+    case STATUS_PROGRESS:
+    case STATUS_NEED_PASSPHRASE:
+    case STATUS_NEED_PASSPHRASE_SYM:
+    case STATUS_NEED_PASSPHRASE_PIN:
+    case STATUS_PINENTRY_LAUNCHED:
+    case STATUS_INQUIRE_MAXLEN:
+    case STATUS_CARDCTRL:
+      return 1;
+    default:
+      break;
+    }
+  return 0;
+}
+
+
+/* Finish the status line with code NO.  Unless --buffered-status is
+ * used or the line needs to be flushed anyway, the stream is flushed
+ * so that the frontend sees each line immediately.  */
+static void
+status_line_done (int no)
+{
+  if (opt.status_buffered && !status_needs_flush (no))
+    {
+      if (es_ferror (statusfp) && opt.exit_on_status_write_error)
+        g10_exit (0);
+      return;
+    }
+
+  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
+    g10_exit (0);
+}
+
+
+/* Write out buffered status lines.  This is called before prompting
+ * and at the end of the process.  */
+void
+flush_status_fd (void)
+{
+  if (statusfp)
+    es_fflush (statusfp);
+}
+
+
 /* Return true if the status message NO may currently be issued.  We
    need this to avoid synchronization problem while auto retrieving a
    key.  There it may happen that a status NODATA is issued for a non
@@ -134,6 +189,15 @@ is_status_enabled (void)
 }
 
 
+/* Return the file descriptor of the status stream or -1 if status
+ * output is not enabled.  */
+int
+get_status_fd (void)
+{
+  return statusfp? es_fileno (statusfp) : -1;
+}
+
+
 void
 write_status ( int no )
 {
@@ -176,8 +240,7 @@ write_status_strings (int no, const char *text, ...)
       va_end (arg_ptr);
     }
   es_putc ('\n', statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 }
 
 
@@ -218,8 +281,7 @@ write_status_strings2 (ctrl_t dummy, int no, ...)
 
   va_end (arg_ptr);
 
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 
   return 0;
 }
@@ -276,8 +338,7 @@ write_status_printf (int no, const char *format, ...)
       va_end (arg_ptr);
     }
   es_putc ('\n', statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 }
 
 
@@ -290,8 +351,7 @@ write_status_error (const char *where, gpg_error_t err)
 
   es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_ERROR), where, err);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (STATUS_ERROR);
 }
 
 
@@ -304,8 +364,7 @@ write_status_errcode (const char *where, int errcode)
 
   es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_ERROR), where, gpg_err_code (errcode));
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (STATUS_ERROR);
 }
 
 
@@ -322,8 +381,7 @@ write_status_failure (const char *where, gpg_error_t err)
   any_failure_printed = 1;
   es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_FAILURE), where, err);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (STATUS_FAILURE);
 }
 
 
@@ -397,8 +455,7 @@ write_status_text_and_buffer (int no, const char *string,
   while (len);
 
   es_putc ('\n',statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 }
 
 
@@ -546,6 +603,7 @@ cpr_get_no_help( const char *keyword, const char *prompt )
 
     if( opt.command_fd != -1 )
 	return do_get_from_fd ( keyword, 0, 0 );
+    flush_status_fd ();
     for(;;) {
 	p = tty_get( prompt );
         return p;
@@ -559,6 +617,7 @@ cpr_get( const char *keyword, const char *prompt )
 
     if( opt.command_fd != -1 )
 	return do_get_from_fd ( keyword, 0, 0 );
+    flush_status_fd ();
     for(;;) {
 	p = tty_get( prompt );
 	if( *p=='?' && !p[1] && !(keyword && !*keyword)) {
@@ -591,6 +650,7 @@ cpr_get_hidden( const char *keyword, const char *prompt )
 
     if( opt.command_fd != -1 )
 	return do_get_from_fd ( keyword, 1, 0 );
+    flush_status_fd ();
     for(;;) {
 	p = tty_get_hidden( prompt );
 	if( *p == '?' && !p[1] ) {
@@ -619,6 +679,7 @@ cpr_get_answer_is_yes_def (const char *keyword, const char *prompt, int def_yes)
 
     if( opt.command_fd != -1 )
 	return !!do_get_from_fd ( keyword, 0, 1 );
+    flush_status_fd ();
     for(;;) {
 	p = tty_get( prompt );
 	trim_spaces(p); /* it is okay to do this here */
@@ -649,6 +710,7 @@ cpr_get_answer_yes_no_quit( const char *keyword, const char *prompt )
 
     if( opt.command_fd != -1 )
 	return !!do_get_from_fd ( keyword, 0, 1 );
+    flush_status_fd ();
     for(;;) {
 	p = tty_get( prompt );
 	trim_spaces(p); /* it is okay to do this here */
@@ -685,6 +747,7 @@ cpr_get_answer_okay_cancel (const char *keyword,
       return yes;
     }
 
+  flush_status_fd ();
   for(;;)
     {
       p = tty_get( prompt );
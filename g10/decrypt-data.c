@@ -31,6 +31,8 @@
 #include "../common/i18n.h"
 #include "../common/status.h"
 #include "../common/compliance.h"
+#include "aead-pool.h"
+#include "md-pool.h"
 
 
 static int aead_decode_filter (void *opaque, int control, iobuf_t a,
@@ -54,6 +56,10 @@ struct decode_filter_context_s
   /* The hash handle for use in MDC mode.  */
   gcry_md_hd_t mdc_hash;
 
+  /* With --hash-threads the MDC is instead computed by this pool on
+   * a separate thread while we decrypt the next buffer.  */
+  md_pool_t mdc_pool;
+
   /* The start IV for AEAD encryption.   */
   byte startiv[16];
 
@@ -99,6 +105,11 @@ struct decode_filter_context_s
   /* Remaining bytes in the packet according to the packet header.
    * Not used if PARTIAL is true.  */
   size_t length;
+
+  /* If AEAD chunks are decrypted by worker threads, the pool and the
+   * read offset into the oldest finished chunk.  */
+  aead_pool_t aead_pool;
+  size_t aead_pos;
 };
 typedef struct decode_filter_context_s *decode_filter_ctx_t;
 
@@ -113,6 +124,10 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      aead_pool_release (dfx->aead_pool);
+      dfx->aead_pool = NULL;
+      md_pool_release (dfx->mdc_pool);
+      dfx->mdc_pool = NULL;
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -122,6 +137,17 @@ release_dfx_context (decode_filter_ctx_t dfx)
 }
 
 
+/* Hash the LEN bytes of BUF for the MDC.  */
+static void
+mdc_write (decode_filter_ctx_t dfx, const void *buf, size_t len)
+{
+  if (dfx->mdc_pool)
+    md_pool_write (dfx->mdc_pool, buf, len);
+  else if (dfx->mdc_hash)
+    gcry_md_write (dfx->mdc_hash, buf, len);
+}
+
+
 /* Set the nonce and the additional data for the current chunk.  This
  * also reset the decryption machinery so that the handle can be
  * used for a new chunk.  If FINAL is set the final AEAD chunk is
@@ -397,6 +423,25 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
           goto leave;
         }
 
+      if (opt.aead_threads > 1 && dfx->chunkbyte <= AEAD_POOL_MAX_CHUNKBYTE)
+        {
+          struct aead_pool_parm_s parm;
+
+          memset (&parm, 0, sizeof parm);
+          parm.decrypt     = 1;
+          parm.gcry_algo   = map_cipher_openpgp_to_gcry (dfx->cipher_algo);
+          parm.gcry_mode   = ciphermode;
+          parm.cipher_algo = dfx->cipher_algo;
+          parm.aead_algo   = dfx->aead_algo;
+          parm.chunkbyte   = dfx->chunkbyte;
+          parm.startiv     = dfx->startiv;
+          parm.key         = dek->key;
+          parm.keylen      = dek->keylen;
+          rc = aead_pool_new (&dfx->aead_pool, opt.aead_threads, &parm);
+          if (rc)
+            goto leave;
+        }
+
     }
   else /* CFB encryption.  */
     {
@@ -411,10 +456,17 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
 
       if ( ed->mdc_method )
         {
-          if (gcry_md_open (&dfx->mdc_hash, ed->mdc_method, 0 ))
-            BUG ();
-          if ( DBG_HASHING )
-            gcry_md_debug (dfx->mdc_hash, "checkmdc");
+          int algo = ed->mdc_method;
+
+          /* On failure we hash in the main thread.  */
+          if (opt.hash_threads < 2 || DBG_HASHING
+              || md_pool_new (&dfx->mdc_pool, &algo, 1, 1))
+            {
+              if (gcry_md_open (&dfx->mdc_hash, ed->mdc_method, 0 ))
+                BUG ();
+              if ( DBG_HASHING )
+                gcry_md_debug (dfx->mdc_hash, "checkmdc");
+            }
         }
 
       rc = openpgp_cipher_open (&dfx->cipher_hd, dek->algo,
@@ -483,8 +535,7 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
           goto leave;
         }
 
-      if ( dfx->mdc_hash )
-        gcry_md_write (dfx->mdc_hash, temp, nprefix+2);
+      mdc_write (dfx, temp, nprefix+2);
     }
 
   dfx->refcount++;
@@ -498,6 +549,12 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
   else
     iobuf_push_filter ( ed->buf, decode_filter, dfx );
 
+  /* Read ahead from the decryption filter on a separate thread.
+   * proc_packets reads up to the EOF of the decryption filter so that
+   * all checks below see the complete data.  */
+  if (opt.pipeline_filters && !opt.unwrap_encryption)
+    push_pipe_filter (ed->buf);
+
   if (opt.unwrap_encryption)
     {
       char *filename = NULL;
@@ -556,17 +613,23 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek,
          strict format for the MDC packet so that we know that 22
          bytes are appended.  */
       int datalen = gcry_md_get_algo_dlen (ed->mdc_method);
+      gcry_md_hd_t mdc_hash = dfx->mdc_hash;
 
       log_assert (dfx->cipher_hd);
-      log_assert (dfx->mdc_hash);
+      if (dfx->mdc_pool)
+        {
+          md_pool_finish (dfx->mdc_pool);
+          mdc_hash = md_pool_get_md (dfx->mdc_pool, ed->mdc_method);
+        }
+      log_assert (mdc_hash);
       gcry_cipher_decrypt (dfx->cipher_hd, dfx->holdback, 22, NULL, 0);
-      gcry_md_write (dfx->mdc_hash, dfx->holdback, 2);
-      gcry_md_final (dfx->mdc_hash);
+      gcry_md_write (mdc_hash, dfx->holdback, 2);
+      gcry_md_final (mdc_hash);
 
       if (   dfx->holdback[0] != '\xd3'
           || dfx->holdback[1] != '\x14'
           || datalen != 20
-          || memcmp (gcry_md_read (dfx->mdc_hash, 0), dfx->holdback+2, datalen))
+          || memcmp (gcry_md_read (mdc_hash, 0), dfx->holdback+2, datalen))
         rc = gpg_error (GPG_ERR_BAD_SIGNATURE);
       /* log_printhex("MDC message:", dfx->holdback, 22); */
       /* log_printhex("MDC calc:", gcry_md_read (dfx->mdc_hash,0), datalen); */
@@ -881,6 +944,164 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
 }
 
 
+/* Read the next chunk and its tag from stream A into JOB and submit
+ * it to the worker pool.  To detect the last chunk we read 17 bytes
+ * beyond the tag: if they are available another chunk follows and
+ * the bytes are kept in the holdback buffer for the next job.
+ * Otherwise the stream ends with the tag of the last chunk and the
+ * final tag, which is then left in the holdback buffer.  */
+static gpg_error_t
+aead_fill_pool_job (decode_filter_ctx_t dfx, iobuf_t a, aead_pool_job_t job)
+{
+  size_t chunksize = dfx->chunksize;
+  byte tail[33];
+  byte last[32];
+  size_t len, tlen, n;
+
+  len = dfx->holdbacklen;
+  memcpy (job->buffer, dfx->holdback, len);
+  dfx->holdbacklen = 0;
+  len = fill_buffer (dfx, a, job->buffer, chunksize, len);
+  tlen = dfx->eof_seen? 0 : fill_buffer (dfx, a, tail, sizeof tail, 0);
+
+  if (!dfx->eof_seen || tlen == sizeof tail)
+    {
+      /* Another chunk follows.  Note that with a known packet length
+       * the EOF may already be flagged here.  */
+      log_assert (len == chunksize && tlen == sizeof tail);
+      job->len = chunksize;
+      memcpy (job->tag, tail, 16);
+      dfx->holdbacklen = sizeof tail - 16;
+      memcpy (dfx->holdback, tail + 16, dfx->holdbacklen);
+    }
+  else if (len + tlen == 16)
+    {
+      /* Only the final tag is left.  */
+      memcpy (dfx->holdback, job->buffer, len);
+      memcpy (dfx->holdback + len, tail, tlen);
+      dfx->holdbacklen = 16;
+      return 0;
+    }
+  else if (len + tlen < 32)
+    return gpg_error (GPG_ERR_TRUNCATED);
+  else
+    {
+      /* Get the last 32 bytes which may be split between the buffer
+       * and the tail.  */
+      n = 32 - tlen;
+      memcpy (last, job->buffer + len - n, n);
+      memcpy (last + n, tail, tlen);
+      job->len = len - n;
+      memcpy (job->tag, last, 16);
+      memcpy (dfx->holdback, last + 16, 16);
+      dfx->holdbacklen = 16;
+    }
+
+  job->chunkindex = dfx->chunkindex++;
+  dfx->total += job->len;
+  aead_pool_submit (dfx->aead_pool, job);
+  return 0;
+}
+
+
+/* The underflow function of the aead_decode_filter if a worker pool
+ * is used.  In contrast to the sequential code the plaintext of a
+ * chunk is returned only after its tag has been verified.  */
+static gpg_error_t
+aead_underflow_pool (decode_filter_ctx_t dfx, iobuf_t a,
+                     byte *buf, size_t *ret_len)
+{
+  const size_t size = *ret_len;
+  gpg_error_t err = 0;
+  size_t totallen = 0;
+  aead_pool_job_t job;
+  size_t n;
+
+  while (totallen < size)
+    {
+      /* Keep the workers busy.  */
+      while (!dfx->eof_seen && (job = aead_pool_get_job (dfx->aead_pool)))
+        {
+          err = aead_fill_pool_job (dfx, a, job);
+          if (err)
+            goto leave;
+        }
+
+      job = aead_pool_next_result (dfx->aead_pool);
+      if (!job)
+        break;
+      if (job->err)
+        {
+          err = job->err;
+          log_error ("gcry_cipher_checktag failed: %s\n",
+                     gpg_strerror (err));
+          write_status_error ("aead_checktag", err);
+          dfx->checktag_failed = 1;
+          goto leave;
+        }
+      n = job->len - dfx->aead_pos;
+      if (n > size - totallen)
+        n = size - totallen;
+      memcpy (buf + totallen, job->buffer + dfx->aead_pos, n);
+      totallen += n;
+      dfx->aead_pos += n;
+      if (dfx->aead_pos == job->len)
+        {
+          aead_pool_put_job (dfx->aead_pool, job);
+          dfx->aead_pos = 0;
+        }
+    }
+
+  if (totallen < size)
+    {
+      /* All chunks have been returned; check the final tag.  */
+      if (DBG_FILTER)
+        log_debug ("eof seen: holdback has the final tag\n");
+      log_assert (dfx->eof_seen);
+      if (dfx->holdbacklen != 16)
+        {
+          /* Not enough or too much data for the final tag.  */
+          err = gpg_error (GPG_ERR_TRUNCATED);
+          goto leave;
+        }
+      err = aead_set_nonce_and_ad (dfx, 1);
+      if (err)
+        goto leave;
+      gcry_cipher_final (dfx->cipher_hd);
+      err = gcry_cipher_decrypt (dfx->cipher_hd, dfx->holdback, 0, NULL, 0);
+      if (err)
+        {
+          log_error ("gcry_cipher_decrypt failed (final): %s\n",
+                     gpg_strerror (err));
+          goto leave;
+        }
+      err = aead_checktag (dfx, 1, dfx->holdback);
+      if (err)
+        goto leave;
+      aead_pool_release (dfx->aead_pool);
+      dfx->aead_pool = NULL;
+      if (!totallen)
+        err = gpg_error (GPG_ERR_EOF);
+    }
+
+ leave:
+  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
+    err = gpg_error (GPG_ERR_BAD_SIGNATURE);
+  if (err && gpg_err_code (err) != GPG_ERR_EOF)
+    {
+      /* Stop the workers and do not return any data.  */
+      aead_pool_release (dfx->aead_pool);
+      dfx->aead_pool = NULL;
+      if (!dfx->eof_seen)
+        dfx->eof_seen = 1;
+      memset (buf, 0, size);
+      totallen = 0;
+    }
+  *ret_len = totallen;
+  return err;
+}
+
+
 /* The IOBUF filter used to decrypt AEAD encrypted data.  */
 static int
 aead_decode_filter (void *opaque, int control, IOBUF a,
@@ -889,7 +1110,7 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
   decode_filter_ctx_t dfx = opaque;
   int rc = 0;
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen && !dfx->aead_pool )
     {
       *ret_len = 0;
       rc = -1;
@@ -898,7 +1119,10 @@ aead_decode_filter (void *opaque, int control, IOBUF a,
     {
       log_assert (a);
 
-      rc = aead_underflow (dfx, a, buf, ret_len);
+      if (dfx->aead_pool)
+        rc = aead_underflow_pool (dfx, a, buf, ret_len);
+      else
+        rc = aead_underflow (dfx, a, buf, ret_len);
       if (gpg_err_code (rc) == GPG_ERR_EOF)
         rc = -1; /* We need to use the old convention in the filter.  */
 
@@ -985,8 +1209,7 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
         {
           if ( dfx->cipher_hd )
             gcry_cipher_decrypt (dfx->cipher_hd, buf, n, NULL, 0);
-          if ( dfx->mdc_hash )
-            gcry_md_write (dfx->mdc_hash, buf, n);
+          mdc_write (dfx, buf, n);
 	}
       else
         {
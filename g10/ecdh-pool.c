@@ -0,0 +1,345 @@
+/* ecdh-pool.c - Pool of precomputed ephemeral ECDH keys
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The ECDH encryption to a key on Curve25519 or X448 computes the
+ * ephemeral public key k*G and the shared point k*Q, which are two
+ * scalar multiplications of about the same cost.  Only the latter
+ * depends on the recipient.  With --ephemeral-key-pool a background
+ * thread generates ephemeral keys, that is the scalar k and the point
+ * k*G, while the process is otherwise idle, for example while a
+ * long-running "lcr --server" waits for the next command.  An
+ * encryption then takes a key from the pool and only computes the
+ * shared point.  Each key is removed from the pool when it is taken
+ * and thus used only once.
+ *
+ * Other curves are not pooled because libgcrypt has no interface to
+ * compute the shared point for a given scalar on them; the composite
+ * ML-KEM keys are not pooled because gcry_kem_encap always creates
+ * its own ephemeral key.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "options.h"
+#include "ecdh-pool.h"
+
+
+/* The largest size of a scalar or a point.  */
+#define MAX_POINT_LEN 56
+
+/* An ephemeral key.  */
+struct ephem_s
+{
+  byte k[MAX_POINT_LEN];   /* The scalar in native format.  */
+  byte kg[MAX_POINT_LEN];  /* The point k*G in native format.  */
+};
+
+/* The pooled curves.  */
+static struct
+{
+  int curveid;
+  size_t len;              /* Length of a scalar and a point.  */
+  int prefix;              /* The public key is prefixed by 0x40.  */
+  struct ephem_s *items;   /* In secure memory.  */
+  unsigned int count;
+} curves[2] =
+  {
+    { GCRY_ECC_CURVE25519, 32, 1 },
+    { GCRY_ECC_CURVE448,   56, 0 }
+  };
+
+static struct
+{
+  int started;
+  unsigned int size;       /* The number of keys per curve.  */
+  npth_mutex_t mutex;      /* Protects the items of CURVES.  */
+  npth_cond_t cond;        /* Signaled when a key is taken.  */
+  unsigned long hits;
+  unsigned long misses;
+} pool;
+
+
+static void
+lock_pool (void)
+{
+  int rc = npth_mutex_lock (&pool.mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pool (void)
+{
+  int rc = npth_mutex_unlock (&pool.mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+/* Return the index of the curve with the fewest keys or -1 if all
+ * are filled.  The pool must be locked.  */
+static int
+curve_to_fill (void)
+{
+  int i, best = -1;
+
+  for (i = 0; i < DIM (curves); i++)
+    if (curves[i].count < pool.size
+        && (best == -1 || curves[i].count < curves[best].count))
+      best = i;
+  return best;
+}
+
+
+/* The thread generating the keys.  */
+static void *
+ecdh_pool_thread (void *arg)
+{
+  struct ephem_s *item;
+  gpg_error_t err;
+  int ci;
+
+  (void)arg;
+
+  item = xtrymalloc_secure (sizeof *item);
+  if (!item)
+    {
+      log_error ("%s: %s\n", __func__,
+                 gpg_strerror (gpg_error_from_syserror ()));
+      return NULL;
+    }
+
+  for (;;)
+    {
+      lock_pool ();
+      while ((ci = curve_to_fill ()) == -1)
+        npth_cond_wait (&pool.cond, &pool.mutex);
+      unlock_pool ();
+
+      npth_unprotect ();
+      gcry_randomize (item->k, curves[ci].len, GCRY_STRONG_RANDOM);
+      err = gcry_ecc_mul_point (curves[ci].curveid, item->kg, item->k, NULL);
+      npth_protect ();
+      if (err)
+        {
+          log_error ("generating an ephemeral key failed: %s\n",
+                     gpg_strerror (err));
+          break;
+        }
+
+      lock_pool ();
+      if (curves[ci].count < pool.size)
+        curves[ci].items[curves[ci].count++] = *item;
+      unlock_pool ();
+    }
+
+  wipememory (item, sizeof *item);
+  xfree (item);
+  return NULL;
+}
+
+
+/* Start the thread filling the pool with SIZE keys for each curve.
+ * SIZE is limited to ECDH_POOL_MAX_SIZE; nothing is done if it is 0
+ * or the pool has already been started.  */
+gpg_error_t
+ecdh_pool_start (unsigned int size)
+{
+  gpg_error_t err;
+  npth_attr_t tattr;
+  npth_t thread;
+  int i, rc;
+
+  if (!size || pool.started)
+    return 0;
+  if (size > ECDH_POOL_MAX_SIZE)
+    size = ECDH_POOL_MAX_SIZE;
+
+  for (i = 0; i < DIM (curves); i++)
+    {
+      curves[i].items = xtrycalloc_secure (size, sizeof *curves[i].items);
+      if (!curves[i].items)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  rc = npth_mutex_init (&pool.mutex, NULL);
+  if (!rc)
+    {
+      rc = npth_cond_init (&pool.cond, NULL);
+      if (rc)
+        npth_mutex_destroy (&pool.mutex);
+    }
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+
+  pool.size = size;
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      rc = npth_create (&thread, &tattr, ecdh_pool_thread, NULL);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      npth_cond_destroy (&pool.cond);
+      npth_mutex_destroy (&pool.mutex);
+      goto leave;
+    }
+  pool.started = 1;
+  return 0;
+
+ leave:
+  log_error ("error starting the ephemeral key pool: %s\n",
+             gpg_strerror (err));
+  for (i = 0; i < DIM (curves); i++)
+    {
+      xfree (curves[i].items);
+      curves[i].items = NULL;
+    }
+  return err;
+}
+
+
+/* Compute the ECDH shared point for the public key PKEY using a key
+ * from the pool.  On success the ephemeral public key is stored at
+ * R_PUBLIC and the x-coordinate of the shared point as a malloced
+ * buffer in secure memory at R_SHARED and R_NSHARED.  GPG_ERR_NO_DATA
+ * is returned if the pool has not been started, the curve is not
+ * pooled, or no key is available; the caller then needs to create an
+ * ephemeral key itself.  */
+gpg_error_t
+ecdh_pool_compute (gcry_mpi_t *pkey, gcry_mpi_t *r_public,
+                   byte **r_shared, size_t *r_nshared)
+{
+  gpg_error_t err;
+  struct ephem_s *item = NULL;
+  const byte *q;
+  unsigned int nbits;
+  size_t qlen, len;
+  byte *shared = NULL;
+  byte pub[1 + MAX_POINT_LEN];
+  int ci;
+
+  *r_public = NULL;
+  *r_shared = NULL;
+  *r_nshared = 0;
+
+  if (!pool.started)
+    return gpg_error (GPG_ERR_NO_DATA);
+  if (openpgp_oid_is_cv25519 (pkey[0]))
+    ci = 0;
+  else if (openpgp_oid_is_cv448 (pkey[0]))
+    ci = 1;
+  else
+    return gpg_error (GPG_ERR_NO_DATA);
+  len = curves[ci].len;
+
+  /* The public key is the native point with an optional prefix.  */
+  if (!gcry_mpi_get_flag (pkey[1], GCRYMPI_FLAG_OPAQUE)
+      || !(q = gcry_mpi_get_opaque (pkey[1], &nbits)))
+    return gpg_error (GPG_ERR_NO_DATA);
+  qlen = (nbits + 7) / 8;
+  if (qlen == len + 1 && *q == 0x40)
+    q++;
+  else if (qlen != len)
+    return gpg_error (GPG_ERR_NO_DATA);
+
+  item = xtrymalloc_secure (sizeof *item);
+  shared = xtrymalloc_secure (len);
+  if (!item || !shared)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  lock_pool ();
+  if (curves[ci].count)
+    {
+      curves[ci].count--;
+      *item = curves[ci].items[curves[ci].count];
+      wipememory (curves[ci].items + curves[ci].count, sizeof *item);
+      pool.hits++;
+      npth_cond_signal (&pool.cond);
+      unlock_pool ();
+    }
+  else
+    {
+      pool.misses++;
+      unlock_pool ();
+      err = gpg_error (GPG_ERR_NO_DATA);
+      goto leave;
+    }
+
+  err = gcry_ecc_mul_point (curves[ci].curveid, shared, item->k, q);
+  if (err)
+    goto leave;
+
+  if (curves[ci].prefix)
+    {
+      pub[0] = 0x40;
+      memcpy (pub + 1, item->kg, len);
+      *r_public = gcry_mpi_set_opaque_copy (NULL, pub, 8 * (len + 1));
+    }
+  else
+    *r_public = gcry_mpi_set_opaque_copy (NULL, item->kg, 8 * len);
+  if (!*r_public)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  *r_shared = shared;
+  *r_nshared = len;
+  shared = NULL;
+
+ leave:
+  if (item)
+    {
+      wipememory (item, sizeof *item);
+      xfree (item);
+    }
+  xfree (shared);
+  return err;
+}
+
+
+/* Print the usage of the pool.  */
+void
+ecdh_pool_dump_stats (void)
+{
+  if (pool.started)
+    log_info ("ephemeral key pool: %lu hits, %lu misses\n",
+              pool.hits, pool.misses);
+}
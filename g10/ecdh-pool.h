@@ -0,0 +1,32 @@
+/* ecdh-pool.h - Pool of precomputed ephemeral ECDH keys
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_ECDH_POOL_H
+#define G10_ECDH_POOL_H
+
+/* The maximum number of pooled keys per curve.  */
+#define ECDH_POOL_MAX_SIZE 32
+
+
+/*-- ecdh-pool.c --*/
+gpg_error_t ecdh_pool_start (unsigned int size);
+gpg_error_t ecdh_pool_compute (gcry_mpi_t *pkey, gcry_mpi_t *r_public,
+                               byte **r_shared, size_t *r_nshared);
+void ecdh_pool_dump_stats (void);
+
+#endif /*G10_ECDH_POOL_H*/
@@ -39,6 +39,7 @@
 #include "../common/i18n.h"
 #include "../common/status.h"
 #include "pkglue.h"
+#include "pkenc-pool.h"
 #include "../common/compliance.h"
 
 
@@ -46,6 +47,13 @@ static int encrypt_simple( const char *filename, int mode, int use_seskey );
 static int write_pubkey_enc_from_list (ctrl_t ctrl,
                                        PK_LIST pk_list, DEK *dek, iobuf_t out);
 
+/* The parameters for encrypt_one_file.  */
+struct encrypt_files_parm_s
+{
+  strlist_t remusr;
+  PK_LIST pk_list;    /* The recipients or NULL.  */
+};
+
 
 /* Helper for show the "encrypted for USER" during encryption.
  * PUBKEY_USAGE is used to figure out whether this is an ADSK key.  */
@@ -623,6 +631,7 @@ encrypt_simple (const char *filename, int mode, int use_seskey)
     filesize = opt.set_filesize ? opt.set_filesize : 0; /* stdin */
 
   /* Register the cipher filter. */
+  cfx.interactive = aead_interactive_input (inp);
   if (mode)
     iobuf_push_filter (out,
                        cfx.dek->use_aead? cipher_filter_aead
@@ -916,6 +925,8 @@ encrypt_crypt (ctrl_t ctrl, gnupg_fd_t filefd, const char *filename,
     {
       afx = new_armor_context ();
       push_armor_filter (afx, out);
+      if (opt.pipeline_filters)
+        push_pipe_filter (out);
     }
 
   /* Create a session key. */
@@ -970,6 +981,7 @@ encrypt_crypt (ctrl_t ctrl, gnupg_fd_t filefd, const char *filename,
     filesize = opt.set_filesize ? opt.set_filesize : 0; /* stdin */
 
   /* Register the cipher filter. */
+  cfx.interactive = aead_interactive_input (inp);
   iobuf_push_filter (out,
                      cfx.dek->use_aead? cipher_filter_aead
                      /**/             : cipher_filter_cfb,
@@ -1003,6 +1015,12 @@ encrypt_crypt (ctrl_t ctrl, gnupg_fd_t filefd, const char *filename,
   else
     cfx.datalen = filesize && !do_compress ? filesize : 0;
 
+  /* Run the cipher filter and everything below it on a separate
+   * thread.  Note that pushing flushes the cipher filter and thus it
+   * may only be done after DATALEN has been set.  */
+  if (opt.pipeline_filters)
+    push_pipe_filter (out);
+
   /* Register the compress filter. */
   if (do_compress)
     {
@@ -1031,6 +1049,8 @@ encrypt_crypt (ctrl_t ctrl, gnupg_fd_t filefd, const char *filename,
           if (cfx.dek && (cfx.dek->use_mdc || cfx.dek->use_aead))
             zfx.new_ctb = 1;
           push_compress_filter (out,&zfx,compr_algo);
+          if (opt.pipeline_filters)
+            push_pipe_filter (out);
         }
     }
 
@@ -1232,6 +1252,50 @@ encrypt_filter (void *opaque, int control,
 }
 
 
+/* Return a new pubkey-enc packet for the public key PK without the
+ * encrypted session key.  */
+static PKT_pubkey_enc *
+new_pubkey_enc (PKT_public_key *pk, int throw_keyid, DEK *dek)
+{
+  PKT_pubkey_enc *enc;
+
+  print_pubkey_algo_note ( pk->pubkey_algo );
+  enc = xmalloc_clear ( sizeof *enc );
+  enc->pubkey_algo = pk->pubkey_algo;
+  keyid_from_pk( pk, enc->keyid );
+  enc->throw_keyid = throw_keyid;
+  enc->seskey_algo = dek->algo;  /* (Used only by PUBKEY_ALGO_KYBER.) */
+  return enc;
+}
+
+
+/* Write the pubkey-enc packet ENC for PK to OUT.  RC is the result
+ * of the encryption of the session key.  */
+static int
+put_pubkey_enc (ctrl_t ctrl, PKT_public_key *pk, PKT_pubkey_enc *enc,
+                DEK *dek, int rc, iobuf_t out)
+{
+  PACKET pkt;
+
+  if (rc)
+    log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (rc) );
+  else
+    {
+      if ( opt.verbose )
+        show_encrypted_for_user_info (ctrl, pk->pubkey_usage, enc, dek);
+      /* And write it. */
+      init_packet (&pkt);
+      pkt.pkttype = PKT_PUBKEY_ENC;
+      pkt.pkt.pubkey_enc = enc;
+      rc = build_packet (out, &pkt);
+      if (rc)
+        log_error ("build_packet(pubkey_enc) failed: %s\n",
+                   gpg_strerror (rc));
+    }
+  return rc;
+}
+
+
 /*
  * Write a pubkey-enc packet for the public key PK to OUT.
  */
@@ -1239,17 +1303,11 @@ int
 write_pubkey_enc (ctrl_t ctrl,
                   PKT_public_key *pk, int throw_keyid, DEK *dek, iobuf_t out)
 {
-  PACKET pkt;
   PKT_pubkey_enc *enc;
   int rc;
   gcry_mpi_t frame;
 
-  print_pubkey_algo_note ( pk->pubkey_algo );
-  enc = xmalloc_clear ( sizeof *enc );
-  enc->pubkey_algo = pk->pubkey_algo;
-  keyid_from_pk( pk, enc->keyid );
-  enc->throw_keyid = throw_keyid;
-  enc->seskey_algo = dek->algo;  /* (Used only by PUBKEY_ALGO_KYBER.) */
+  enc = new_pubkey_enc (pk, throw_keyid, dek);
 
   /* Okay, what's going on: We have the session key somewhere in
    * the structure DEK and want to encode this session key in an
@@ -1267,22 +1325,46 @@ write_pubkey_enc (ctrl_t ctrl,
                               pubkey_nbits (pk->pubkey_algo, pk->pkey));
   rc = pk_encrypt (pk, frame, dek->algo, enc->data);
   gcry_mpi_release (frame);
-  if (rc)
-    log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (rc) );
-  else
+  rc = put_pubkey_enc (ctrl, pk, enc, dek, rc, out);
+  free_pubkey_enc(enc);
+  return rc;
+}
+
+
+/* Write the pubkey-enc packets for the N keys of PK_LIST to OUT
+ * after encrypting the session key on opt.encrypt_threads threads.
+ * The packets are written in the order of the list.  */
+static int
+write_pubkey_enc_threaded (ctrl_t ctrl, PK_LIST pk_list, unsigned int n,
+                           DEK *dek, iobuf_t out)
+{
+  PKT_public_key **pks;
+  PKT_pubkey_enc **encs;
+  gpg_error_t *rcs;
+  unsigned int i;
+  int rc = 0;
+
+  pks = xcalloc (n, sizeof *pks);
+  encs = xcalloc (n, sizeof *encs);
+  rcs = xcalloc (n, sizeof *rcs);
+  for (i = 0; i < n; i++, pk_list = pk_list->next)
     {
-      if ( opt.verbose )
-        show_encrypted_for_user_info (ctrl, pk->pubkey_usage, enc, dek);
-      /* And write it. */
-      init_packet (&pkt);
-      pkt.pkttype = PKT_PUBKEY_ENC;
-      pkt.pkt.pubkey_enc = enc;
-      rc = build_packet (out, &pkt);
-      if (rc)
-        log_error ("build_packet(pubkey_enc) failed: %s\n",
-                   gpg_strerror (rc));
+      pks[i] = pk_list->pk;
+      encs[i] = new_pubkey_enc (pks[i],
+                                (opt.throw_keyids || (pk_list->flags&1)),
+                                dek);
     }
-  free_pubkey_enc(enc);
+
+  pkenc_pool_encrypt (pks, encs, rcs, n, dek, opt.encrypt_threads);
+
+  for (i = 0; i < n && !rc; i++)
+    rc = put_pubkey_enc (ctrl, pks[i], encs[i], dek, rcs[i], out);
+
+  for (i = 0; i < n; i++)
+    free_pubkey_enc (encs[i]);
+  xfree (rcs);
+  xfree (encs);
+  xfree (pks);
   return rc;
 }
 
@@ -1293,6 +1375,9 @@ write_pubkey_enc (ctrl_t ctrl,
 static int
 write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
 {
+  PK_LIST r;
+  unsigned int n;
+
   if (opt.throw_keyids && (PGP7 || PGP8))
     {
       log_info(_("option '%s' may not be used in %s mode\n"),
@@ -1301,6 +1386,14 @@ write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
       compliance_failure();
     }
 
+  if (opt.encrypt_threads > 1)
+    {
+      for (n = 0, r = pk_list; r; r = r->next)
+        n++;
+      if (n >= PKENC_POOL_MIN_JOBS)
+        return write_pubkey_enc_threaded (ctrl, pk_list, n, dek, out);
+    }
+
   for ( ; pk_list; pk_list = pk_list->next )
     {
       PKT_public_key *pk = pk_list->pk;
@@ -1313,10 +1406,29 @@ write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
   return 0;
 }
 
+/* Encrypt the file NAME for encrypt_crypt_files.  OPAQUE is the
+ * prepared list of recipients.  */
+static gpg_error_t
+encrypt_one_file (ctrl_t ctrl, const char *name, void *opaque)
+{
+  struct encrypt_files_parm_s *parm = opaque;
+  gpg_error_t rc;
+
+  print_file_status(STATUS_FILE_START, name, 2);
+  rc = encrypt_crypt (ctrl, GNUPG_INVALID_FD, name, parm->remusr,
+                      0, parm->pk_list, GNUPG_INVALID_FD);
+  if (rc)
+    log_error ("encryption of '%s' failed: %s\n",
+               print_fname_stdin(name), gpg_strerror (rc) );
+  write_status( STATUS_FILE_DONE );
+  return rc;
+}
+
+
 void
 encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
 {
-  int rc = 0;
+  struct encrypt_files_parm_s parm;
 
   if (opt.outfile)
     {
@@ -1324,7 +1436,17 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
       return;
     }
 
-  if (!nfiles)
+  /* The recipients are the same for all files; thus look them up
+   * only once.  Each file still gets its own session key.  If that
+   * fails we try again for each file so that the errors are shown as
+   * before.  */
+  parm.remusr = remusr;
+  if (build_pk_list (ctrl, remusr, &parm.pk_list))
+    parm.pk_list = NULL;
+
+  if (multifile_usable (ctrl))
+    multifile_process (ctrl, nfiles, files, encrypt_one_file, &parm);
+  else if (!nfiles)
     {
       char line[2048];
       unsigned int lno = 0;
@@ -1334,29 +1456,17 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
           if (!*line || line[strlen(line)-1] != '\n')
             {
               log_error("input line %u too long or missing LF\n", lno);
-              return;
+              break;
             }
           line[strlen(line)-1] = '\0';
-          print_file_status(STATUS_FILE_START, line, 2);
-          rc = encrypt_crypt (ctrl, GNUPG_INVALID_FD, line, remusr,
-                              0, NULL, GNUPG_INVALID_FD);
-          if (rc)
-            log_error ("encryption of '%s' failed: %s\n",
-                       print_fname_stdin(line), gpg_strerror (rc) );
-          write_status( STATUS_FILE_DONE );
+          encrypt_one_file (ctrl, line, &parm);
         }
     }
   else
     {
       while (nfiles--)
-        {
-          print_file_status(STATUS_FILE_START, *files, 2);
-          if ((rc = encrypt_crypt (ctrl, GNUPG_INVALID_FD, *files, remusr,
-                                   0, NULL, GNUPG_INVALID_FD)))
-            log_error("encryption of '%s' failed: %s\n",
-                      print_fname_stdin(*files), gpg_strerror (rc) );
-          write_status( STATUS_FILE_DONE );
-          files++;
-        }
+        encrypt_one_file (ctrl, *files++, &parm);
     }
+
+  release_pk_list (parm.pk_list);
 }
@@ -64,6 +64,13 @@ struct export_stats_s
 };
 
 
+/* With at least this many fingerprints to export the database is
+ * read sequentially and the keys are matched against the sorted list
+ * of fingerprints.  A regular search compares each key with all
+ * fingerprints at every step.  */
+#define EXPORT_SCAN_MIN_FPRS 256
+
+
 /* Global variables to store the selectors created from
  * --export-filter keep-uid=EXPR.
  * --export-filter drop-subkey=EXPR.
@@ -1806,6 +1813,67 @@ print_dane_records (iobuf_t out, kbnode_t keyblock, PKT_public_key *pk,
 }
 
 
+/* qsort and bsearch helper for fingerprint search descriptions.  */
+static int
+compare_fpr_desc (const void *a_arg, const void *b_arg)
+{
+  const KEYDB_SEARCH_DESC *a = a_arg;
+  const KEYDB_SEARCH_DESC *b = b_arg;
+
+  if (a->fprlen != b->fprlen)
+    return a->fprlen < b->fprlen? -1 : 1;
+  return memcmp (a->u.fpr, b->u.fpr, a->fprlen);
+}
+
+
+/* Return true if all NDESC descriptions at DESC are fingerprints
+ * which may be matched by export_scan_match.  */
+static int
+export_scan_possible (KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  size_t i;
+
+  if (opt.use_keyboxd || ndesc < EXPORT_SCAN_MIN_FPRS)
+    return 0;  /* The keyboxd has its own index.  */
+  for (i = 0; i < ndesc; i++)
+    if (desc[i].mode != KEYDB_SEARCH_MODE_FPR || desc[i].exact)
+      return 0;
+  return 1;
+}
+
+
+/* Return true if the primary key or a subkey of KEYBLOCK matches one
+ * of the NDESC fingerprints at DESC, which must be sorted with
+ * compare_fpr_desc.  The index of the description is stored at
+ * R_DESCINDEX.  */
+static int
+export_scan_match (kbnode_t keyblock, KEYDB_SEARCH_DESC *desc, size_t ndesc,
+                   size_t *r_descindex)
+{
+  KEYDB_SEARCH_DESC key;
+  KEYDB_SEARCH_DESC *found;
+  kbnode_t node;
+  size_t fprlen;
+
+  memset (&key, 0, sizeof key);
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      fingerprint_from_pk (node->pkt->pkt.public_key, key.u.fpr, &fprlen);
+      key.fprlen = fprlen;
+      found = bsearch (&key, desc, ndesc, sizeof *desc, compare_fpr_desc);
+      if (found)
+        {
+          *r_descindex = found - desc;
+          return 1;
+        }
+    }
+  return 0;
+}
+
+
 /* Helper for do_export_stream which writes one keyblock to OUT.  */
 static gpg_error_t
 do_export_one_keyblock (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid,
@@ -2255,6 +2323,7 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   gcry_cipher_hd_t cipherhd = NULL;
   struct export_stats_s dummystats;
   iobuf_t out_help = NULL;
+  int scan = 0;
 
   if (!stats)
     stats = &dummystats;
@@ -2295,6 +2364,14 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
 
       keydb_disable_caching (kdbhd);  /* We are looping the search.  */
 
+      /* For a long list of fingerprints read all keys in order.  The
+       * output is the same as with the search.  */
+      if (export_scan_possible (desc, ndesc))
+        {
+          qsort (desc, ndesc, sizeof *desc, compare_fpr_desc);
+          scan = 1;
+        }
+
       /* It would be nice to see which of the given users did actually
          match one in the keyring.  To implement this we need to have
          a found flag for each entry in desc.  To set this flag we
@@ -2312,7 +2389,15 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       u32 keyid[2];
       PKT_public_key *pk;
 
-      err = keydb_search (kdbhd, desc, ndesc, &descindex);
+      if (scan == 1)
+        {
+          err = keydb_search_first (kdbhd);
+          scan = 2;
+        }
+      else if (scan)
+        err = keydb_search_next (kdbhd);
+      else
+        err = keydb_search (kdbhd, desc, ndesc, &descindex);
       if (!users)
         desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
       if (err)
@@ -2322,11 +2407,15 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       release_kbnode (keyblock);
       keyblock = NULL;
       err = keydb_get_keyblock (kdbhd, &keyblock);
+      if (scan && gpg_err_code (err) == GPG_ERR_LEGACY_KEY)
+        continue;  /* The search skips them as well.  */
       if (err)
         {
           log_error (_("error reading keyblock: %s\n"), gpg_strerror (err));
           goto leave;
 	}
+      if (scan && !export_scan_match (keyblock, desc, ndesc, &descindex))
+        continue;
 
       node = find_kbnode (keyblock, PKT_PUBLIC_KEY);
       if (!node)
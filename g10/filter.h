@@ -27,11 +27,14 @@ typedef struct {
     gcry_md_hd_t md;      /* catch all */
     gcry_md_hd_t md2;     /* if we want to calculate an alternate hash */
     size_t maxbuf_size;
+    struct md_pool_s *pool; /* if set, hash with this instead of MD */
 } md_filter_context_t;
 
 typedef struct md_thd_filter_context *md_thd_filter_context_t;
 void md_thd_filter_set_md (md_thd_filter_context_t mfx, gcry_md_hd_t md);
 
+typedef struct pipe_thd_filter_context *pipe_thd_filter_context_t;
+
 typedef struct {
     int  refcount;          /* Initialized to 1.  */
 
@@ -66,7 +69,7 @@ typedef struct {
 
     byte radbuf[4];
     int idx, idx2;
-    gcry_md_hd_t crc_md;
+    u32 crc;                /* The running CRC24.  */
 
     int status; 	    /* an internal state flag */
     int cancel;
@@ -86,6 +89,8 @@ struct compress_filter_context_s {
     int algo;	 /* compress algo */
     int algo1hack;
     int new_ctb;
+    int level;	 /* The current zlib level with --compress-adaptive.  */
+    size_t sample_countdown; /* Bytes until the input is sampled again. */
     void (*release)(struct compress_filter_context_s*);
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
@@ -106,6 +111,7 @@ typedef struct
   /* Various processing flags.  */
   unsigned int wrote_header : 1;
   unsigned int short_blklen_warn : 1;
+  unsigned int interactive : 1;  /* The input is typed at a terminal.  */
   unsigned long short_blklen_count;
 
   /* The encoded chunk byte for AEAD.  */
@@ -137,6 +143,11 @@ typedef struct
   size_t bufsize;  /* Allocated length.  */
   size_t buflen;   /* Used length.       */
 
+  /* If AEAD chunks are encrypted by worker threads, the pool and the
+   * job currently being filled.  */
+  struct aead_pool_s *aead_pool;
+  struct aead_pool_job_s *aead_job;
+
 } cipher_filter_context_t;
 
 
@@ -171,6 +182,11 @@ int md_filter( void *opaque, int control, iobuf_t a, byte *buf, size_t *ret_len)
 int md_thd_filter( void *opaque, int control, iobuf_t a, byte *buf, size_t *ret_len);
 void free_md_filter_context( md_filter_context_t *mfx );
 
+/*-- pipefilter.c --*/
+int pipe_thd_filter (void *opaque, int control,
+                     iobuf_t chain, byte *buf, size_t *ret_len);
+int push_pipe_filter (iobuf_t a);
+
 /*-- armor.c --*/
 armor_filter_context_t *new_armor_context (void);
 void release_armor_context (armor_filter_context_t *afx);
@@ -191,6 +207,7 @@ int cipher_filter_cfb (void *opaque, int control,
 /*-- cipher-aead.c --*/
 int cipher_filter_aead (void *opaque, int control,
                         iobuf_t chain, byte *buf, size_t *ret_len);
+int aead_interactive_input (iobuf_t inp);
 
 /*-- textfilter.c --*/
 int text_filter( void *opaque, int control,
@@ -97,6 +97,14 @@ struct getkey_ctx_s
   /* Hack to return the mechanism (AKL_foo) used to find the key.  */
   int found_via_akl;
 
+  /* Do not take the result from the keyblocks of getkey_prefetch.
+     This is required if the caller continues with the handle.  */
+  int no_prefetch;
+
+  /* The last result was taken from getkey_prefetch.  Thus the next
+     search result is that keyblock and needs to be skipped.  */
+  int skip_prefetched;
+
   /* Part of the search criteria: The low-level search specification
      as passed to keydb_search.  */
   int nitems;
@@ -115,6 +123,15 @@ static struct
 } lkup_stats[21];
 #endif
 
+/* A keyblock looked up in advance by getkey_prefetch.  */
+struct getkey_prefetch_s
+{
+  struct getkey_prefetch_s *next;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock;
+};
+
+
 typedef struct keyid_list
 {
   struct keyid_list *next;
@@ -125,15 +142,37 @@ typedef struct keyid_list
 
 
 #if MAX_PK_CACHE_ENTRIES
+/* The public key cache is a hash table with two indices, one by key
+ * id and one by fingerprint.  All entries are also kept on a list
+ * ordered by the time of their last use; when the cache is full the
+ * least recently used entry is evicted.  */
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *kid_next;  /* Next in the key id bucket.  */
+  struct pk_cache_entry *fpr_next;  /* Next in the fpr bucket.     */
+  struct pk_cache_entry *lru_prev;  /* More recently used entry.   */
+  struct pk_cache_entry *lru_next;  /* Less recently used entry.   */
   u32 keyid[2];
+  byte fprlen;
+  byte fpr[MAX_FINGERPRINT_LEN];
   PKT_public_key *pk;
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
-static int pk_cache_entries;	/* Number of entries in pk cache.  */
+static pk_cache_entry_t *pk_cache_kid_table;
+static pk_cache_entry_t *pk_cache_fpr_table;
+static unsigned int pk_cache_table_size;  /* Number of buckets.  */
+static unsigned int pk_cache_max;	  /* Max. number of entries.  */
+static pk_cache_entry_t pk_cache_lru_head;
+static pk_cache_entry_t pk_cache_lru_tail;
+static unsigned int pk_cache_entries;	/* Number of entries in pk cache.  */
 static int pk_cache_disabled;
+
+static struct
+{
+  unsigned int lookups;
+  unsigned int hits;
+  unsigned int added;
+  unsigned int evicted;
+} pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
@@ -168,24 +207,184 @@ print_stats ()
 #endif
 
 
+#if MAX_PK_CACHE_ENTRIES
+/* Return the bucket index for KEYID.  */
+static inline unsigned int
+pk_cache_kid_hash (const u32 *keyid)
+{
+  return keyid[1] & (pk_cache_table_size - 1);
+}
+
+
+/* Return the bucket index for the fingerprint FPR.  */
+static inline unsigned int
+pk_cache_fpr_hash (const byte *fpr)
+{
+  return buf32_to_uint (fpr) & (pk_cache_table_size - 1);
+}
+
+
+/* Allocate the hash tables for the public key cache.  The size is
+ * taken from --pk-cache-size.  Returns false if caching is not
+ * possible.  */
+static int
+pk_cache_init (void)
+{
+  unsigned int n;
+
+  if (pk_cache_kid_table)
+    return 1;
+
+  pk_cache_max = opt.pk_cache_size;
+  if (!pk_cache_max)
+    pk_cache_max = MAX_PK_CACHE_ENTRIES;
+  else if (pk_cache_max < 2)
+    pk_cache_max = 2;  /* We need the cache for key creation.  */
+  else if (pk_cache_max > 1024 * 1024)
+    pk_cache_max = 1024 * 1024;
+
+  for (n = 16; n < pk_cache_max; n <<= 1)
+    ;
+  pk_cache_kid_table = xtrycalloc (n, sizeof *pk_cache_kid_table);
+  pk_cache_fpr_table = xtrycalloc (n, sizeof *pk_cache_fpr_table);
+  if (!pk_cache_kid_table || !pk_cache_fpr_table)
+    {
+      log_error ("error allocating the public key cache: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      xfree (pk_cache_kid_table);
+      xfree (pk_cache_fpr_table);
+      pk_cache_kid_table = pk_cache_fpr_table = NULL;
+      pk_cache_disabled = 1;
+      return 0;
+    }
+  pk_cache_table_size = n;
+  return 1;
+}
+
+
+/* Mark CE as the most recently used entry.  */
+static void
+pk_cache_touch (pk_cache_entry_t ce)
+{
+  if (ce == pk_cache_lru_head)
+    return;
+
+  /* Unlink.  */
+  ce->lru_prev->lru_next = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru_tail = ce->lru_prev;
+
+  /* Insert at the head.  */
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_lru_head;
+  pk_cache_lru_head->lru_prev = ce;
+  pk_cache_lru_head = ce;
+}
+
+
+/* Remove CE from the cache and release it.  */
+static void
+pk_cache_remove (pk_cache_entry_t ce)
+{
+  pk_cache_entry_t *pp;
+
+  for (pp = &pk_cache_kid_table[pk_cache_kid_hash (ce->keyid)];
+       *pp != ce; pp = &(*pp)->kid_next)
+    ;
+  *pp = ce->kid_next;
+
+  for (pp = &pk_cache_fpr_table[pk_cache_fpr_hash (ce->fpr)];
+       *pp != ce; pp = &(*pp)->fpr_next)
+    ;
+  *pp = ce->fpr_next;
+
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_lru_head = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru_tail = ce->lru_prev;
+
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+}
+
+
+/* Return the cache entry for KEYID or NULL if there is none.  If
+ * PRIMARY_ONLY is set only primary keys are considered.  */
+static pk_cache_entry_t
+pk_cache_find_kid (const u32 *keyid, int primary_only)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache_kid_table)
+    return NULL;
+
+  pk_cache_stats.lookups++;
+  for (ce = pk_cache_kid_table[pk_cache_kid_hash (keyid)]; ce;
+       ce = ce->kid_next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
+        && (!primary_only
+            || (ce->pk->keyid[0] == ce->pk->main_keyid[0]
+                && ce->pk->keyid[1] == ce->pk->main_keyid[1])))
+      {
+        pk_cache_stats.hits++;
+        pk_cache_touch (ce);
+        return ce;
+      }
+  return NULL;
+}
+
+
+/* Return the cache entry for the fingerprint (FPR,FPRLEN) or NULL if
+ * there is none.  */
+static pk_cache_entry_t
+pk_cache_find_fpr (const byte *fpr, size_t fprlen)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache_fpr_table || fprlen < 4)
+    return NULL;
+
+  pk_cache_stats.lookups++;
+  for (ce = pk_cache_fpr_table[pk_cache_fpr_hash (fpr)]; ce;
+       ce = ce->fpr_next)
+    if (ce->fprlen == fprlen && !memcmp (ce->fpr, fpr, fprlen))
+      {
+        pk_cache_stats.hits++;
+        pk_cache_touch (ce);
+        return ce;
+      }
+  return NULL;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
 /* Cache a copy of a public key in the public key cache.  PK is not
  * cached if caching is disabled (via getkey_disable_caches), if
  * PK->FLAGS.DONT_CACHE is set, we don't know how to derive a key id
  * from the public key (e.g., unsupported algorithm), or a key with
- * the key id is already in the cache.
+ * the key id is already in the cache.  If the cache is full the
+ * least recently used entry is evicted.
  *
  * The public key packet is copied into the cache using
  * copy_public_key.  Thus, any secret parts are not copied, for
  * instance.
  *
- * This cache is filled by get_pubkey and is read by get_pubkey and
- * get_pubkey_fast.  */
+ * This cache is filled by get_pubkey and get_pubkey_for_sig and is
+ * read by those functions and get_pubkey_fast.  */
 void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
+  pk_cache_entry_t ce;
   u32 keyid[2];
+  unsigned int idx;
 
   if (pk_cache_disabled)
     return;
@@ -205,7 +404,11 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
+  if (!pk_cache_init ())
+    return;
+
+  for (ce = pk_cache_kid_table[pk_cache_kid_hash (keyid)]; ce;
+       ce = ce->kid_next)
     if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
       {
 	if (DBG_CACHE)
@@ -213,35 +416,57 @@ cache_public_key (PKT_public_key * pk)
 	return;
       }
 
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
+  while (pk_cache_entries >= pk_cache_max && pk_cache_lru_tail)
     {
-      int n;
-
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce && ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      log_assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
+      pk_cache_remove (pk_cache_lru_tail);
+      pk_cache_stats.evicted++;
     }
-  pk_cache_entries++;
+
   ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
   ce->pk = copy_public_key (NULL, pk);
   ce->keyid[0] = keyid[0];
   ce->keyid[1] = keyid[1];
+  {
+    size_t fprlen;
+
+    fingerprint_from_pk (ce->pk, ce->fpr, &fprlen);
+    ce->fprlen = fprlen;
+  }
+
+  idx = pk_cache_kid_hash (keyid);
+  ce->kid_next = pk_cache_kid_table[idx];
+  pk_cache_kid_table[idx] = ce;
+  idx = pk_cache_fpr_hash (ce->fpr);
+  ce->fpr_next = pk_cache_fpr_table[idx];
+  pk_cache_fpr_table[idx] = ce;
+
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_lru_head;
+  if (pk_cache_lru_head)
+    pk_cache_lru_head->lru_prev = ce;
+  else
+    pk_cache_lru_tail = ce;
+  pk_cache_lru_head = ce;
+
+  pk_cache_entries++;
+  pk_cache_stats.added++;
+#endif
+}
+
+
+/* Print statistics about the public key cache.  */
+void
+getkey_dump_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("pk_cache: lookups=%u hits=%u (%u%%) added=%u evicted=%u"
+            " entries=%u/%u\n",
+            pk_cache_stats.lookups, pk_cache_stats.hits,
+            pk_cache_stats.lookups
+            ? (unsigned int)((pk_cache_stats.hits * 100ULL)
+                             / pk_cache_stats.lookups) : 0,
+            pk_cache_stats.added, pk_cache_stats.evicted,
+            pk_cache_entries, pk_cache_max);
 #endif
 }
 
@@ -268,25 +493,40 @@ user_id_not_found_utf8 (void)
 void
 getkey_disable_caches (void)
 {
+  getkey_flush_caches ();
 #if MAX_PK_CACHE_ENTRIES
-  {
-    pk_cache_entry_t ce, ce2;
-
-    for (ce = pk_cache; ce; ce = ce2)
-      {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
-      }
-    pk_cache_disabled = 1;
-    pk_cache_entries = 0;
-    pk_cache = NULL;
-  }
+  pk_cache_disabled = 1;
 #endif
   /* fixme: disable user id cache ? */
 }
 
 
+/* Drop all entries of the public key cache.  Unlike
+ * getkey_disable_caches the cache is used again afterwards.  This is
+ * used by long running processes after the keyring has been changed
+ * by another process.  */
+void
+getkey_flush_caches (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  pk_cache_entry_t ce, ce2;
+
+  for (ce = pk_cache_lru_head; ce; ce = ce2)
+    {
+      ce2 = ce->lru_next;
+      free_public_key (ce->pk);
+      xfree (ce);
+    }
+  xfree (pk_cache_kid_table);
+  xfree (pk_cache_fpr_table);
+  pk_cache_kid_table = pk_cache_fpr_table = NULL;
+  pk_cache_table_size = 0;
+  pk_cache_entries = 0;
+  pk_cache_lru_head = pk_cache_lru_tail = NULL;
+#endif
+}
+
+
 /* Free a list of pubkey_t objects.  */
 void
 pubkeys_free (pubkey_t keys)
@@ -332,8 +572,24 @@ get_pubkey_for_sig (ctrl_t ctrl, PKT_public_key *pk, PKT_signature *sig,
 
   /* First try the ISSUER_FPR info.  */
   fpr = issuer_fpr_raw (sig, &fprlen);
-  if (fpr && !get_pubkey_byfpr (ctrl, pk, NULL, fpr, fprlen))
-    return 0;
+  if (fpr)
+    {
+#if MAX_PK_CACHE_ENTRIES
+      pk_cache_entry_t ce;
+
+      ce = pk_cache_find_fpr (fpr, fprlen);
+      if (ce)
+        {
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
+#endif
+      if (!get_pubkey_byfpr (ctrl, pk, NULL, fpr, fprlen))
+        {
+          cache_public_key (pk);
+          return 0;
+        }
+    }
 
   /* Fallback to use the ISSUER_KEYID.  */
   return get_pubkey (ctrl, pk, sig->keyid);
@@ -374,16 +630,15 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
          NULL as it does not guarantee that the user IDs are
          cached. */
       pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    /* XXX: We don't check PK->REQ_USAGE here, but if we don't
-	       read from the cache, we do check it!  */
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
+
+      /* XXX: We don't check PK->REQ_USAGE here, but if we don't
+         read from the cache, we do check it!  */
+      ce = pk_cache_find_kid (keyid, 0);
+      if (ce)
+        {
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
     }
 #endif
   /* More init stuff.  */
@@ -511,17 +766,13 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
     /* Try to get it from the cache */
     pk_cache_entry_t ce;
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    /* Only consider primary keys.  */
+    ce = pk_cache_find_kid (keyid, 1);
+    if (ce)
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
-	    /* Only consider primary keys.  */
-	    && ce->pk->keyid[0] == ce->pk->main_keyid[0]
-	    && ce->pk->keyid[1] == ce->pk->main_keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        if (pk)
+          copy_public_key (pk, ce->pk);
+        return 0;
       }
   }
 #endif
@@ -529,6 +780,8 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
   hd = keydb_new (ctrl);
   if (!hd)
     return gpg_error_from_syserror ();
+  /* We only need the primary key.  */
+  keydb_set_parse_mask (hd, PARSE_SKIP_ATTRIBUTES | PARSE_SKIP_SIGS);
   rc = keydb_search_kid (hd, keyid);
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
@@ -858,6 +1111,7 @@ key_byname (ctrl_t ctrl, GETKEY_CTX *retctx, strlist_t namelist,
     }
 
   ctx->want_secret = want_secret;
+  ctx->no_prefetch = !!ret_kdbhd;
   ctx->kr_handle = keydb_new (ctrl);
   if (!ctx->kr_handle)
     {
@@ -916,6 +1170,81 @@ key_byname (ctrl_t ctrl, GETKEY_CTX *retctx, strlist_t namelist,
 }
 
 
+/* Helper for get_pubkey_byname to start the network requests of the
+ * mechanisms in AKL concurrently.  They are later taken by the
+ * mechanisms in the order of AKL so that the first mechanism which
+ * yields a key still wins.  FPRDESC is the fingerprint if NAME is
+ * one; NULL otherwise.  Nothing is done if there is at most one
+ * network mechanism.  */
+static void
+prefetch_akl (ctrl_t ctrl, struct akl *akl, const char *name,
+              KEYDB_SEARCH_DESC *fprdesc)
+{
+  struct akl *a;
+  const byte *fpr = fprdesc? fprdesc->u.fpr : NULL;
+  size_t fprlen = fprdesc? fprdesc->fprlen : 0;
+  int count = 0;
+  int any_keyserver = -1;
+
+  for (a = akl; a; a = a->next)
+    if ((!fpr && (a->type == AKL_CERT || a->type == AKL_DANE
+                  || a->type == AKL_WKD))
+        || a->type == AKL_LDAP || a->type == AKL_NTDS
+        || a->type == AKL_KEYSERVER || a->type == AKL_SPEC)
+      count++;
+  if (count < 2)
+    return;
+
+  for (a = akl; a; a = a->next)
+    {
+      switch (a->type)
+        {
+        case AKL_CERT:
+        case AKL_DANE:
+          if (!fpr)
+            keyserver_prefetch_cert (ctrl, name, a->type == AKL_DANE);
+          break;
+
+        case AKL_WKD:
+          if (!fpr)
+            keyserver_prefetch_wkd (ctrl, name, 0);
+          break;
+
+        case AKL_LDAP:
+        case AKL_KEYSERVER:
+          if (any_keyserver == -1)
+            any_keyserver = keyserver_any_configured (ctrl);
+          if (!any_keyserver)
+            ;
+          else if (fpr)
+            keyserver_prefetch_fpr (ctrl, fpr, fprlen, opt.keyserver,
+                                    KEYSERVER_IMPORT_FLAG_LDAP);
+          else
+            keyserver_prefetch_mbox (ctrl, name, opt.keyserver,
+                                     (a->type == AKL_LDAP
+                                      ? KEYSERVER_IMPORT_FLAG_LDAP : 0));
+          break;
+
+        case AKL_NTDS:
+          keyserver_prefetch_ntds (ctrl, name, fpr, fprlen);
+          break;
+
+        case AKL_SPEC:
+          if (fpr)
+            keyserver_prefetch_fpr (ctrl, fpr, fprlen, opt.keyserver,
+                                    KEYSERVER_IMPORT_FLAG_LDAP);
+          else
+            keyserver_prefetch_mbox (ctrl, name, keyserver_match (a->spec),
+                                     0);
+          break;
+
+        default:
+          break;
+        }
+    }
+}
+
+
 /* Find a public key identified by NAME.
  *
  * If name appears to be a valid RFC822 mailbox (i.e., email address)
@@ -1110,7 +1439,12 @@ get_pubkey_byname (ctrl_t ctrl, enum get_pubkey_modes mode,
       /* NAME wasn't present in the local keyring (or we didn't try
        * the local keyring).  Since the auto key locate feature is
        * enabled and NAME appears to be an email address, try the auto
-       * locate feature.  */
+       * locate feature.  With --auto-key-locate-parallel the network
+       * requests are started now and the loop below only waits for
+       * them.  */
+      if (opt.flags.akl_parallel)
+        prefetch_akl (ctrl, used_akl, name, is_fpr? &fprbuf : NULL);
+
       for (akl = used_akl; akl; akl = akl->next)
 	{
 	  unsigned char *fpr = NULL;
@@ -1374,6 +1708,11 @@ get_pubkey_byname (ctrl_t ctrl, enum get_pubkey_modes mode,
 		      name, mechanism_string,
 		      no_fingerprint ? _("No fingerprint") : gpg_strerror (rc));
 	}
+
+      /* Requests of the mechanisms after the one which found the key
+       * are not needed anymore.  */
+      if (opt.flags.akl_parallel)
+        keyserver_prefetch_cancel (ctrl);
     }
 
   if (rc && retctx)
@@ -2446,6 +2785,134 @@ getkey_end (ctrl_t ctrl, getkey_ctx_t ctx)
 }
 
 
+/* Look up the keys given by fingerprint or long key id in NAMES with
+ * a single pass over the database.  The found keyblocks are kept in
+ * CTRL and used by the next lookup for exactly that fingerprint or
+ * key id, which saves a database scan for each of them.  Other names
+ * are ignored.  The keyblocks need to be released using
+ * getkey_prefetch_release once the caller is done with the lookups,
+ * and before keys might be modified.  Returns the number of keys
+ * found.  */
+int
+getkey_prefetch (ctrl_t ctrl, strlist_t names)
+{
+  gpg_error_t err;
+  KEYDB_SEARCH_DESC *desc;
+  kbnode_t *keyblocks;
+  struct getkey_prefetch_s *pf;
+  strlist_t sl;
+  size_t i, n;
+  int nfound = 0;
+
+  getkey_prefetch_release (ctrl);
+
+  for (n = 0, sl = names; sl; sl = sl->next)
+    n++;
+  if (n < 2)
+    return 0;  /* Nothing to gain.  */
+
+  desc = xtrycalloc (n, sizeof *desc);
+  keyblocks = xtrycalloc (n, sizeof *keyblocks);
+  if (!desc || !keyblocks)
+    goto leave;
+
+  for (n = 0, sl = names; sl; sl = sl->next)
+    if (!classify_user_id (sl->d, desc + n, 1)
+        && (desc[n].mode == KEYDB_SEARCH_MODE_FPR
+            || desc[n].mode == KEYDB_SEARCH_MODE_LONG_KID))
+      n++;
+  if (n < 2)
+    goto leave;
+
+  err = keydb_search_batch (ctrl, desc, n, keyblocks);
+  if (err)
+    {
+      if (DBG_LOOKUP)
+        log_debug ("%s: batch search failed: %s\n",
+                   __func__, gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Keys which are not found are not recorded so that a later
+   * lookup, for example after an auto-key-locate, finds them.  */
+  for (i = 0; i < n; i++)
+    {
+      if (!keyblocks[i])
+        continue;
+      pf = xtrycalloc (1, sizeof *pf);
+      if (!pf)
+        break;
+      pf->desc = desc[i];
+      pf->keyblock = keyblocks[i];
+      keyblocks[i] = NULL;
+      pf->next = ctrl->getkey_prefetch;
+      ctrl->getkey_prefetch = pf;
+      nfound++;
+    }
+  if (DBG_LOOKUP)
+    log_debug ("%s: %zu names, %d keys\n", __func__, n, nfound);
+
+ leave:
+  if (keyblocks)
+    for (i = 0; i < n; i++)
+      release_kbnode (keyblocks[i]);
+  xfree (keyblocks);
+  xfree (desc);
+  return nfound;
+}
+
+
+/* Release the keyblocks of getkey_prefetch which have not been used.  */
+void
+getkey_prefetch_release (ctrl_t ctrl)
+{
+  struct getkey_prefetch_s *pf;
+
+  if (!ctrl)
+    return;
+  while ((pf = ctrl->getkey_prefetch))
+    {
+      ctrl->getkey_prefetch = pf->next;
+      release_kbnode (pf->keyblock);
+      xfree (pf);
+    }
+}
+
+
+/* Remove and return the prefetched keyblock for the fingerprint or
+ * long key id DESC.  Returns NULL if there is none.  */
+static kbnode_t
+take_prefetched (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc)
+{
+  struct getkey_prefetch_s *pf, **pfp;
+  kbnode_t keyblock;
+
+  if (!ctrl || desc->skipfnc)
+    return NULL;
+  if (desc->mode != KEYDB_SEARCH_MODE_FPR
+      && desc->mode != KEYDB_SEARCH_MODE_LONG_KID)
+    return NULL;
+
+  for (pfp = &ctrl->getkey_prefetch; (pf = *pfp); pfp = &pf->next)
+    {
+      if (pf->desc.mode != desc->mode)
+        continue;
+      if (desc->mode == KEYDB_SEARCH_MODE_FPR
+          ? (pf->desc.fprlen == desc->fprlen
+             && !memcmp (pf->desc.u.fpr, desc->u.fpr, desc->fprlen))
+          : (pf->desc.u.kid[0] == desc->u.kid[0]
+             && pf->desc.u.kid[1] == desc->u.kid[1]))
+        {
+          *pfp = pf->next;
+          keyblock = pf->keyblock;
+          xfree (pf);
+          return keyblock;
+        }
+    }
+  return NULL;
+}
+
+
 
 /************************************************
  ************* Merging stuff ********************
@@ -4050,12 +4517,30 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
   if (ret_keyblock)
     *ret_keyblock = NULL;
 
+  if (!want_secret && !ctx->no_prefetch && ctx->nitems == 1)
+    keyblock = take_prefetched (ctrl, ctx->items);
+
   for (;;)
     {
+      if (keyblock)
+        {
+          rc = 0;
+          ctx->skip_prefetched = 1;
+          goto check_keyblock;
+        }
+
       rc = keydb_search (ctx->kr_handle, ctx->items, ctx->nitems, NULL);
       if (rc)
         break;
 
+      if (ctx->skip_prefetched)
+        {
+          /* We already had this keyblock from the prefetch.  */
+          ctx->skip_prefetched = 0;
+          keydb_disable_caching (ctx->kr_handle);
+          continue;
+        }
+
       /* If we are iterating over the entire database, then we need to
        * change from KEYDB_SEARCH_MODE_FIRST, which does an implicit
        * reset, to KEYDB_SEARCH_MODE_NEXT, which gets the next record.  */
@@ -4080,6 +4565,7 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
 	    goto found; /* Unexpected error.  */
 	}
 
+    check_keyblock:
       /* Warning: node flag bits 0 and 1 should be preserved by
        * merge_selfsigs.  */
       merge_selfsigs (ctrl, keyblock);
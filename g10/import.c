@@ -42,6 +42,7 @@
 #include "../common/mbox-util.h"
 #include "key-check.h"
 #include "key-clean.h"
+#include "keysig-pool.h"
 
 
 struct import_stats_s
@@ -542,10 +543,26 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
   int i;
   gpg_error_t err = 0;
   struct import_stats_s *stats = stats_handle;
+  int batch = 0;
 
   if (!stats)
     stats = import_new_stats_handle ();
 
+  /* With bulk import the key database is locked only once and the
+   * keyblocks are written in one batch.  */
+  if ((options & IMPORT_BULK) && !(options & IMPORT_DRY_RUN))
+    {
+      err = keydb_begin_batch (ctrl);
+      if (err)
+        {
+          log_info ("error starting a key database batch: %s\n",
+                    gpg_strerror (err));
+          err = 0;
+        }
+      else
+        batch = 1;
+    }
+
   if (inp)
     {
       err = import (ctrl, inp, "[stream]", stats, fpr, fpr_len, options,
@@ -587,6 +604,9 @@ import_keys_internal (ctrl_t ctrl, iobuf_t inp, char **fnames, int nnames,
 	}
     }
 
+  if (batch)
+    keydb_end_batch ();
+
   if (!stats_handle)
     {
       if ((options & (IMPORT_SHOW | IMPORT_DRY_RUN))
@@ -1276,6 +1296,98 @@ fix_bad_direct_key_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid)
 }
 
 
+/* Return true if all packets of KEYBLOCK are already in ORIG.  A
+ * signature needs to be found at the same user id or subkey.  This
+ * is a pure comparison of the packets; no signature is checked.  */
+static int
+keyblock_is_subset (kbnode_t keyblock, kbnode_t orig)
+{
+  kbnode_t node, onode;
+  kbnode_t comp = orig;
+
+  for (node = keyblock->next; node; node = node->next)
+    {
+      switch (node->pkt->pkttype)
+        {
+        case PKT_USER_ID:
+          for (onode = orig->next; onode; onode = onode->next)
+            if (onode->pkt->pkttype == PKT_USER_ID
+                && !cmp_user_ids (onode->pkt->pkt.user_id,
+                                  node->pkt->pkt.user_id))
+              break;
+          if (!onode)
+            return 0;
+          comp = onode;
+          break;
+
+        case PKT_PUBLIC_SUBKEY:
+          for (onode = orig->next; onode; onode = onode->next)
+            if (onode->pkt->pkttype == PKT_PUBLIC_SUBKEY
+                && !cmp_public_keys (onode->pkt->pkt.public_key,
+                                     node->pkt->pkt.public_key))
+              break;
+          if (!onode)
+            return 0;
+          comp = onode;
+          break;
+
+        case PKT_SIGNATURE:
+          for (onode = comp->next; onode; onode = onode->next)
+            {
+              if (onode->pkt->pkttype == PKT_USER_ID
+                  || onode->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+                {
+                  onode = NULL;
+                  break;
+                }
+              if (onode->pkt->pkttype == PKT_SIGNATURE
+                  && !cmp_signatures (onode->pkt->pkt.signature,
+                                      node->pkt->pkt.signature))
+                break;
+            }
+          if (!onode)
+            return 0;
+          break;
+
+        case PKT_RING_TRUST:
+          break;
+
+        default:
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
+
+/* Return true if the key with fingerprint FPR/FPRLEN is stored and
+ * KEYBLOCK has nothing which a merge would add to it.  This is used
+ * to skip the signature checks for keys which are imported again and
+ * again without changes.  */
+static int
+stored_key_unchanged_p (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid,
+                        const byte *fpr, size_t fprlen)
+{
+  kbnode_t orig;
+  int result;
+
+  if (get_keyblock_byfpr_fast (ctrl, &orig, NULL, 1 /*primary only */,
+                               fpr, fprlen, 0))
+    return 0;
+
+  /* A bogus direct key signature in our copy would be removed by the
+   * merge and thus the key is changed.  */
+  result = (!cmp_public_keys (orig->pkt->pkt.public_key,
+                              keyblock->pkt->pkt.public_key)
+            && !fix_bad_direct_key_sigs (ctrl, orig, keyid)
+            && keyblock_is_subset (keyblock, orig));
+
+  release_kbnode (orig);
+  return result;
+}
+
+
 static void
 print_import_ok (PKT_public_key *pk, unsigned int reason)
 {
@@ -2075,6 +2187,33 @@ import_one_real (ctrl_t ctrl,
   if ((options & IMPORT_COLLAPSE_SUBKEYS))
     collapse_subkeys (&keyblock);
 
+  /* Most keys of a bulk re-import are unchanged.  Detect this by
+   * comparing the packets against our copy before doing any of the
+   * signature checks below.  The cleaning of our copy would be a
+   * change, as would be the output modes.  */
+  if (!from_sk && !opt.dry_run
+      && !(options & (IMPORT_SHOW | IMPORT_EXPORT | IMPORT_DRY_RUN
+                      | IMPORT_RESTORE))
+      && !((options & IMPORT_CLEAN) && !(options & IMPORT_SELF_SIGS_ONLY))
+      && stored_key_unchanged_p (ctrl, keyblock, keyid, fpr2, fpr2len))
+    {
+      if (r_valid)
+        *r_valid = 1;
+      same_key = 1;
+      if (is_status_enabled ())
+        print_import_ok (pk, 0);
+
+      if (!opt.quiet && !silent)
+        {
+          char *p = get_user_id_byfpr_native (ctrl, fpr2, fpr2len);
+          log_info( _("key %s: \"%s\" not changed\n"),keystr(keyid),p);
+          xfree(p);
+        }
+
+      stats->unchanged++;
+      goto leave;
+    }
+
   /* Clean the key that we're about to import, to cut down on things
      that we have to clean later.  This has no practical impact on the
      end result, but does result in less logging which might confuse
@@ -2101,6 +2240,10 @@ import_one_real (ctrl_t ctrl,
   if ((options & IMPORT_REPAIR_KEYS))
     key_check_all_keysigs (ctrl, 1, keyblock, 0, 0);
 
+  /* Run the expensive part of the checks done by chk_self_sigs in
+   * parallel.  */
+  keysig_pool_check_self_sigs (keyblock, opt.import_threads);
+
   if (chk_self_sigs (ctrl, keyblock, keyid, &non_self_or_utk))
     return 0;  /* Invalid keyblock - error already printed.  */
 
@@ -2287,7 +2430,7 @@ import_one_real (ctrl_t ctrl,
 
           clear_ownertrusts (ctrl, pk);
           if (non_self_or_utk)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
         }
 
       /* Release the handle and thus unlock the keyring asap.  */
@@ -2380,7 +2523,7 @@ import_one_real (ctrl_t ctrl,
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (err));
           else if (non_self_or_utk)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
 
           /* Release the handle and thus unlock the keyring asap.  */
           keydb_release (hd);
@@ -3697,7 +3840,7 @@ import_revoke_cert (ctrl_t ctrl, kbnode_t node, unsigned int options,
       if (get_ownertrust (ctrl, pk) == TRUST_ULTIMATE)
         clear_ownertrusts (ctrl, pk);
 
-      revalidation_mark (ctrl);
+      revalidation_mark_key (ctrl, pk);
     }
   stats->n_revoc++;
 
@@ -26,28 +26,67 @@
 #include "lcr.h"
 #include "../common/util.h"
 #include "../common/init.h"
+#include "../common/memstat.h"
 #include "packet.h"
 #include "keydb.h"
 
 #define USE_UNUSED_NODES 1
 
+/* Nodes are carved out of slabs of this many nodes.  */
+#define NODES_PER_SLAB 128
+
+/* The maximum number of released packet structures kept for reuse.  */
+#define MAX_UNUSED_PACKETS 1024
+
+struct node_slab
+{
+  struct node_slab *next;
+  struct kbnode_struct nodes[NODES_PER_SLAB];
+};
+
 static int cleanup_registered;
 static KBNODE unused_nodes;
+static struct node_slab *node_slabs;
+
+/* Released packet structures, linked using their generic pointer.  */
+static PACKET *unused_packets;
+static unsigned int n_unused_packets;
 
 static void
 release_unused_nodes (void)
 {
 #if USE_UNUSED_NODES
-  while (unused_nodes)
+  while (node_slabs)
+    {
+      struct node_slab *next = node_slabs->next;
+      memstat_free (MEMSTAT_KBNODE, sizeof *node_slabs);
+      xfree (node_slabs);
+      node_slabs = next;
+    }
+  unused_nodes = NULL;
+  while (unused_packets)
     {
-      kbnode_t next = unused_nodes->next;
-      xfree (unused_nodes);
-      unused_nodes = next;
+      PACKET *next = unused_packets->pkt.generic;
+      memstat_free (MEMSTAT_PACKET, sizeof *unused_packets);
+      xfree (unused_packets);
+      unused_packets = next;
     }
+  n_unused_packets = 0;
 #endif /*USE_UNUSED_NODES*/
 }
 
 
+static void
+register_cleanup (void)
+{
+  if (!cleanup_registered)
+    {
+      cleanup_registered = 1;
+      register_mem_cleanup_func (release_unused_nodes);
+    }
+}
+
+
 static kbnode_t
 alloc_node (void)
 {
@@ -58,12 +97,24 @@ alloc_node (void)
     unused_nodes = n->next;
   else
     {
-      if (!cleanup_registered)
-        {
-          cleanup_registered = 1;
-          register_mem_cleanup_func (release_unused_nodes);
-        }
+#if USE_UNUSED_NODES
+      struct node_slab *slab;
+      int i;
+
+      register_cleanup ();
+      slab = xmalloc (sizeof *slab);
+      memstat_alloc (MEMSTAT_KBNODE, sizeof *slab);
+      slab->next = node_slabs;
+      node_slabs = slab;
+      for (i = 1; i < NODES_PER_SLAB - 1; i++)
+        slab->nodes[i].next = slab->nodes + i + 1;
+      slab->nodes[i].next = NULL;
+      unused_nodes = slab->nodes + 1;
+      n = slab->nodes;
+#else
       n = xmalloc (sizeof *n);
+      memstat_alloc (MEMSTAT_KBNODE, sizeof *n);
+#endif
     }
   n->next = NULL;
   n->pkt = NULL;
@@ -82,12 +133,60 @@ free_node( KBNODE n )
       n->next = unused_nodes;
       unused_nodes = n;
 #else
+      memstat_free (MEMSTAT_KBNODE, sizeof *n);
       xfree (n);
 #endif
     }
 }
 
 
+/* Release the packet PKT of a node and its structure.  */
+static void
+free_node_packet (PACKET *pkt)
+{
+  free_packet (pkt, NULL);
+#if USE_UNUSED_NODES
+  if (pkt && n_unused_packets < MAX_UNUSED_PACKETS)
+    {
+      pkt->pkt.generic = unused_packets;
+      unused_packets = pkt;
+      n_unused_packets++;
+      memstat_alloc (MEMSTAT_PACKET, sizeof *pkt);
+      return;
+    }
+#endif
+  xfree (pkt);
+}
+
+
+/* Return a new and initialized packet structure for use with
+ * new_kbnode.  Packets released with the keyblock are reused.  The
+ * packet is an ordinary allocation and may thus also be released
+ * with xfree.  Returns NULL on memory error.  */
+PACKET *
+alloc_kbnode_packet (void)
+{
+  PACKET *pkt;
+
+  pkt = unused_packets;
+  if (pkt)
+    {
+      unused_packets = pkt->pkt.generic;
+      n_unused_packets--;
+      memstat_free (MEMSTAT_PACKET, sizeof *pkt);
+    }
+  else
+    {
+      register_cleanup ();
+      pkt = xtrymalloc (sizeof *pkt);
+      if (!pkt)
+        return NULL;
+    }
+  init_packet (pkt);
+  return pkt;
+}
+
+
 
 KBNODE
 new_kbnode( PACKET *pkt )
@@ -127,15 +226,27 @@ release_kbnode( KBNODE n )
 {
     KBNODE n2;
 
-    while( n ) {
-	n2 = n->next;
-	if( !is_cloned_kbnode(n) ) {
-            free_packet (n->pkt, NULL);
-            xfree( n->pkt );
-	}
-	free_node( n );
-	n = n2;
+    if (!n)
+      return;
+
+    for (n2 = n; ; n2 = n2->next) {
+	if( !is_cloned_kbnode(n2) )
+            free_node_packet (n2->pkt);
+        if (!n2->next)
+          break;
     }
+
+    /* Return the entire list at once.  */
+#if USE_UNUSED_NODES
+    n2->next = unused_nodes;
+    unused_nodes = n;
+#else
+    while (n) {
+        n2 = n->next;
+        free_node (n);
+        n = n2;
+    }
+#endif
 }
 
 
@@ -300,10 +411,8 @@ commit_kbnode( KBNODE *root )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-                free_packet (n->pkt, NULL);
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+                free_node_packet (n->pkt);
 	    free_node( n );
 	    changed = 1;
 	}
@@ -324,10 +433,8 @@ remove_kbnode( KBNODE *root, KBNODE node )
 		*root = nl = n->next;
 	    else
 		nl->next = n->next;
-	    if( !is_cloned_kbnode(n) ) {
-                free_packet (n->pkt, NULL);
-		xfree( n->pkt );
-	    }
+	    if( !is_cloned_kbnode(n) )
+                free_node_packet (n->pkt);
 	    free_node( n );
 	}
 	else
@@ -41,6 +41,25 @@
 #define NF_REVOC     11  /* Usable revocation.   */
 #define NF_NOKEY     12  /* Key not available.   */
 
+/* The latest valid cert of a signer as used by mark_usable_uid_certs.  */
+struct best_cert_s
+{
+  struct best_cert_s *next;  /* Next cert in the same hash bucket.  */
+  kbnode_t signode;
+  u32 sigdate;
+};
+
+
+/* Return true if SIG is a nonrevocable certification which has not
+ * expired at CURTIME.  */
+static int
+is_lasting_cert (PKT_signature *sig, u32 curtime)
+{
+  return (IS_UID_SIG (sig) && !sig->flags.revocable
+          && (!sig->expiredate || sig->expiredate > curtime));
+}
+
+
 /*
  * Mark the signature of the given UID which are used to certify it.
  * To do this, we first remove all signatures which are not valid and
@@ -56,6 +75,8 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
 {
   kbnode_t node;
   PKT_signature *sig;
+  struct best_cert_s *certs, **buckets, **idx;
+  unsigned int ncerts, nbuckets, i;
 
   /* First check all signatures.  */
   for (node=uidnode->next; node; node = node->next)
@@ -103,90 +124,92 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
    * processed, bit NF_USABLE will be set for the usable signatures, and bit
    * NF_REVOC will be set for usable revocations. */
 
-  /* For each cert figure out the latest valid one.  */
+  /* For each signer figure out the latest valid cert.  A table
+   * indexed by the keyID of the signer holds the best cert seen so
+   * far so that this works in a single pass even for keys flooded
+   * with certifications.  */
+  ncerts = 0;
   for (node=uidnode->next; node; node = node->next)
     {
-      KBNODE n, signode;
-      u32 kid[2];
-      u32 sigdate;
+      if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+          || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+        break;
+      if ((node->flag & (1<<NF_CONSIDER)))
+        ncerts++;
+    }
+  if (!ncerts)
+    return;
+  for (nbuckets = 16; nbuckets < ncerts; nbuckets <<= 1)
+    ;
+  buckets = xcalloc (nbuckets, sizeof *buckets);
+  certs = xcalloc (ncerts, sizeof *certs);
+
+  ncerts = 0;
+  for (node=uidnode->next; node; node = node->next)
+    {
+      struct best_cert_s *cert;
 
       if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY
           || node->pkt->pkttype == PKT_SECRET_SUBKEY)
         break;
       if ( !(node->flag & (1<<NF_CONSIDER)) )
         continue; /* not a node to look at */
-      if ( (node->flag & (1<<NF_PROCESSED)) )
-        continue; /* signature with a keyID already processed */
       node->flag |= (1<<NF_PROCESSED); /* mark this node as processed */
       sig = node->pkt->pkt.signature;
-      signode = node;
-      sigdate = sig->timestamp;
-      kid[0] = sig->keyid[0]; kid[1] = sig->keyid[1];
 
-      /* Now find the latest and greatest signature */
-      for (n=uidnode->next; n; n = n->next)
-        {
-          if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY
-              || n->pkt->pkttype == PKT_SECRET_SUBKEY)
-            break;
-          if ( !(n->flag & (1<<NF_CONSIDER)) )
-            continue;
-          if ( (n->flag & (1<<NF_PROCESSED)) )
-            continue; /* shortcut already processed signatures */
-          sig = n->pkt->pkt.signature;
-          if (kid[0] != sig->keyid[0] || kid[1] != sig->keyid[1])
-            continue;
-          n->flag |= (1<<NF_PROCESSED); /* mark this node as processed */
-
-	  /* If signode is nonrevocable and unexpired and n isn't,
-             then take signode (skip).  It doesn't matter which is
-             older: if signode was older then we don't want to take n
-             as signode is nonrevocable.  If n was older then we're
-             automatically fine. */
-
-	  if(((IS_UID_SIG(signode->pkt->pkt.signature) &&
-	       !signode->pkt->pkt.signature->flags.revocable &&
-	       (signode->pkt->pkt.signature->expiredate==0 ||
-		signode->pkt->pkt.signature->expiredate>curtime))) &&
-	     (!(IS_UID_SIG(n->pkt->pkt.signature) &&
-		!n->pkt->pkt.signature->flags.revocable &&
-		(n->pkt->pkt.signature->expiredate==0 ||
-		 n->pkt->pkt.signature->expiredate>curtime))))
-	    continue;
-
-	  /* If n is nonrevocable and unexpired and signode isn't,
-             then take n.  Again, it doesn't matter which is older: if
-             n was older then we don't want to take signode as n is
-             nonrevocable.  If signode was older then we're
-             automatically fine. */
-
-	  if((!(IS_UID_SIG(signode->pkt->pkt.signature) &&
-		!signode->pkt->pkt.signature->flags.revocable &&
-		(signode->pkt->pkt.signature->expiredate==0 ||
-		 signode->pkt->pkt.signature->expiredate>curtime))) &&
-	     ((IS_UID_SIG(n->pkt->pkt.signature) &&
-	       !n->pkt->pkt.signature->flags.revocable &&
-	       (n->pkt->pkt.signature->expiredate==0 ||
-		n->pkt->pkt.signature->expiredate>curtime))))
-            {
-              signode = n;
-              sigdate = sig->timestamp;
-	      continue;
-            }
+      idx = &buckets[sig->keyid[1] & (nbuckets - 1)];
+      for (cert = *idx; cert; cert = cert->next)
+        if (cert->signode->pkt->pkt.signature->keyid[0] == sig->keyid[0]
+            && cert->signode->pkt->pkt.signature->keyid[1] == sig->keyid[1])
+          break;
+      if (!cert)
+        { /* First cert from this signer.  */
+          cert = certs + ncerts++;
+          cert->signode = node;
+          cert->sigdate = sig->timestamp;
+          cert->next = *idx;
+          *idx = cert;
+          continue;
+        }
 
-	  /* At this point, if it's newer, it goes in as the only
-             remaining possibilities are signode and n are both either
-             revocable or expired or both nonrevocable and unexpired.
-             If the timestamps are equal take the later ordered
-             packet, presuming that the key packets are hopefully in
-             their original order. */
+      /* If signode is nonrevocable and unexpired and node isn't,
+         then take signode (skip).  It doesn't matter which is older:
+         if signode was older then we don't want to take node as
+         signode is nonrevocable.  If node was older then we're
+         automatically fine. */
+      if (is_lasting_cert (cert->signode->pkt->pkt.signature, curtime)
+          && !is_lasting_cert (sig, curtime))
+        continue;
 
-          if (sig->timestamp >= sigdate)
-            {
-              signode = n;
-              sigdate = sig->timestamp;
-            }
+      /* If node is nonrevocable and unexpired and signode isn't, then
+         take node.  Again, it doesn't matter which is older: if node
+         was older then we don't want to take signode as node is
+         nonrevocable.  If signode was older then we're automatically
+         fine. */
+      if (!is_lasting_cert (cert->signode->pkt->pkt.signature, curtime)
+          && is_lasting_cert (sig, curtime))
+        {
+          cert->signode = node;
+          cert->sigdate = sig->timestamp;
+          continue;
+        }
+
+      /* At this point, if it's newer, it goes in as the only
+         remaining possibilities are signode and node are both either
+         revocable or expired or both nonrevocable and unexpired.  If
+         the timestamps are equal take the later ordered packet,
+         presuming that the key packets are hopefully in their
+         original order. */
+      if (sig->timestamp >= cert->sigdate)
+        {
+          cert->signode = node;
+          cert->sigdate = sig->timestamp;
         }
+    }
+
+  for (i=0; i < ncerts; i++)
+    {
+      kbnode_t signode = certs[i].signode;
 
       sig = signode->pkt->pkt.signature;
       if (IS_UID_SIG (sig))
@@ -213,6 +236,9 @@ mark_usable_uid_certs (ctrl_t ctrl, kbnode_t keyblock, kbnode_t uidnode,
       else
 	signode->flag |= (1<<NF_REVOC);
     }
+
+  xfree (certs);
+  xfree (buckets);
 }
 
 
@@ -0,0 +1,431 @@
+/* keydb-bench.c - Benchmark key lookups in large key databases
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This program fills a key database with synthetic keys and measures
+ * the time to insert them, to look them up by fingerprint, keyid,
+ * mail address and substring and to list them.  It is not run by
+ * "make check"; use for example
+ *
+ *   make -C g10 keydb-bench
+ *   g10/keydb-bench --backend keybox --keys 100000 --output kbx.json
+ *
+ * The keys are RSA keys with random moduli and a single user id
+ * "Bench Key N <keyN@dM.example.org>" but without any signatures.
+ * They are thus only usable for the storage layer, which does not
+ * check signatures; "import" measures the insertion of the keyblocks
+ * as done at the end of an import.  The backends are "keyring",
+ * "keybox" and "keyboxd"; the latter requires that a keyboxd can be
+ * started for the home directory.  Unless --homedir is given a
+ * temporary directory is used and removed at the end.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "lcr.h"
+#include "../common/util.h"
+#include "../kbx/keybox.h"
+#include "options.h"
+#include "keydb.h"
+#include "main.h"
+
+#define PGM "keydb-bench"
+
+static int verbose;
+static FILE *jsonfp;
+static int nresults;
+static const char *backend = "keybox";
+static unsigned int nkeys = 10000;
+
+
+/* A point in time for the measurements.  */
+struct stamp_s
+{
+  double wall;
+  double cpu;
+};
+
+
+static void
+get_stamp (struct stamp_s *st)
+{
+  struct timespec ts;
+  struct rusage ru;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  st->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+  getrusage (RUSAGE_SELF, &ru);
+  st->cpu = (ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+             + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+}
+
+
+/* Write the result of operation OP which was done COUNT times since
+ * START and found FOUND keys.  */
+static void
+emit_result (const char *op, const struct stamp_s *start,
+             unsigned int count, unsigned int found)
+{
+  struct stamp_s end;
+  double wall, cpu;
+
+  get_stamp (&end);
+  wall = end.wall - start->wall;
+  cpu = end.cpu - start->cpu;
+
+  fprintf (jsonfp, "%s\n    { \"op\": \"%s\", \"count\": %u, \"found\": %u,"
+           " \"wall_s\": %.4f, \"cpu_s\": %.4f, \"per_s\": %.1f,"
+           " \"us_per_op\": %.2f }",
+           nresults? ",":"", op, count, found, wall, cpu,
+           wall > 0? count / wall : 0.0,
+           count? wall * 1e6 / count : 0.0);
+  nresults++;
+
+  if (verbose)
+    fprintf (stderr, PGM ": %-10s %8u ops %8u found %10.1f/s %10.2f us/op\n",
+             op, count, found, wall > 0? count / wall : 0.0,
+             count? wall * 1e6 / count : 0.0);
+}
+
+
+/* Create synthetic key number IDX.  */
+static kbnode_t
+make_keyblock (unsigned int idx)
+{
+  PACKET *pkt;
+  PKT_public_key *pk;
+  kbnode_t keyblock;
+  char name[100];
+  size_t n;
+
+  pk = xmalloc_clear (sizeof *pk);
+  pk->version = 4;
+  pk->timestamp = 1500000000 + idx;
+  pk->pubkey_algo = PUBKEY_ALGO_RSA;
+  pk->pkey[0] = gcry_mpi_new (2048);
+  gcry_mpi_randomize (pk->pkey[0], 2048, GCRY_WEAK_RANDOM);
+  gcry_mpi_set_bit (pk->pkey[0], 2047);
+  gcry_mpi_set_bit (pk->pkey[0], 0);
+  pk->pkey[1] = gcry_mpi_set_ui (NULL, 65537);
+
+  pkt = xmalloc_clear (sizeof *pkt);
+  pkt->pkttype = PKT_PUBLIC_KEY;
+  pkt->pkt.public_key = pk;
+  keyblock = new_kbnode (pkt);
+
+  snprintf (name, sizeof name, "Bench Key %u <key%u@d%u.example.org>",
+            idx, idx, idx % 1000);
+  n = strlen (name);
+  pkt = xmalloc_clear (sizeof *pkt);
+  pkt->pkttype = PKT_USER_ID;
+  pkt->pkt.user_id = xmalloc_clear (sizeof *pkt->pkt.user_id + n);
+  pkt->pkt.user_id->len = n;
+  pkt->pkt.user_id->ref = 1;
+  strcpy (pkt->pkt.user_id->name, name);
+  add_kbnode (keyblock, new_kbnode (pkt));
+
+  return keyblock;
+}
+
+
+/* Insert NKEYS synthetic keys and store their fingerprints at FPRS.  */
+static void
+bench_import (ctrl_t ctrl, byte *fprs)
+{
+  struct stamp_s start;
+  KEYDB_HANDLE hd;
+  kbnode_t keyblock;
+  gpg_error_t err;
+  unsigned int i;
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    log_fatal ("keydb_new failed: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+
+  get_stamp (&start);
+  err = keydb_begin_batch (ctrl);
+  if (err)
+    log_fatal ("keydb_begin_batch failed: %s\n", gpg_strerror (err));
+  for (i = 0; i < nkeys; i++)
+    {
+      keyblock = make_keyblock (i);
+      fingerprint_from_pk (keyblock->pkt->pkt.public_key,
+                           fprs + i * 20, NULL);
+      err = keydb_insert_keyblock (hd, keyblock);
+      if (err)
+        log_fatal ("inserting key %u failed: %s\n", i, gpg_strerror (err));
+      release_kbnode (keyblock);
+      if (verbose && i && !(i % 10000))
+        fprintf (stderr, PGM ": %u keys inserted\n", i);
+    }
+  keydb_end_batch ();
+  emit_result ("import", &start, nkeys, nkeys);
+
+  keydb_release (hd);
+}
+
+
+/* Build the search string of kind MODE for key IDX.  */
+static void
+make_name (char *buffer, size_t size, const char *mode, unsigned int idx,
+           const byte *fprs)
+{
+  char hex[41];
+
+  if (!strcmp (mode, "fpr"))
+    bin2hex (fprs + idx * 20, 20, buffer);
+  else if (!strcmp (mode, "keyid"))
+    {
+      bin2hex (fprs + idx * 20 + 12, 8, hex);
+      snprintf (buffer, size, "0x%s", hex);
+    }
+  else if (!strcmp (mode, "mail"))
+    snprintf (buffer, size, "<key%u@d%u.example.org>", idx, idx % 1000);
+  else
+    snprintf (buffer, size, "key%u@d", idx);
+}
+
+
+/* Look up NLOOKUPS random keys using MODE.  */
+static void
+bench_search (ctrl_t ctrl, const char *mode, unsigned int nlookups,
+              const byte *fprs)
+{
+  struct stamp_s start;
+  KEYDB_SEARCH_DESC desc;
+  KEYDB_HANDLE hd;
+  char name[100];
+  unsigned int i, found = 0;
+  unsigned int *idx;
+  char op[20];
+
+  /* Pick the keys in advance so that this is not measured.  */
+  idx = xcalloc (nlookups, sizeof *idx);
+  for (i = 0; i < nlookups; i++)
+    {
+      gcry_create_nonce (idx + i, sizeof *idx);
+      idx[i] %= nkeys;
+    }
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    log_fatal ("keydb_new failed: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+
+  get_stamp (&start);
+  for (i = 0; i < nlookups; i++)
+    {
+      make_name (name, sizeof name, mode, idx[i], fprs);
+      if (classify_user_id (name, &desc, 1))
+        log_fatal ("invalid search string '%s'\n", name);
+      keydb_search_reset (hd);
+      if (!keydb_search (hd, &desc, 1, NULL))
+        found++;
+    }
+  snprintf (op, sizeof op, "search-%s", mode);
+  emit_result (op, &start, nlookups, found);
+
+  keydb_release (hd);
+  xfree (idx);
+}
+
+
+/* Walk over all keyblocks like a key listing does.  */
+static void
+bench_list (ctrl_t ctrl)
+{
+  struct stamp_s start;
+  KEYDB_SEARCH_DESC desc;
+  KEYDB_HANDLE hd;
+  kbnode_t keyblock;
+  unsigned int count = 0;
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    log_fatal ("keydb_new failed: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+  keydb_disable_caching (hd);
+
+  get_stamp (&start);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!keydb_search (hd, &desc, 1, NULL))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      if (keydb_get_keyblock (hd, &keyblock))
+        break;
+      merge_keys_and_selfsig (ctrl, keyblock);
+      release_kbnode (keyblock);
+      count++;
+    }
+  emit_result ("list", &start, count, count);
+
+  keydb_release (hd);
+}
+
+
+/* Remove the temporary home directory DIR.  */
+static void
+remove_homedir (const char *dir)
+{
+  DIR *dp;
+  struct dirent *de;
+  char *fname;
+
+  dp = opendir (dir);
+  if (dp)
+    {
+      while ((de = readdir (dp)))
+        if (strcmp (de->d_name, ".") && strcmp (de->d_name, ".."))
+          {
+            fname = make_filename (dir, de->d_name, NULL);
+            gnupg_remove (fname);
+            xfree (fname);
+          }
+      closedir (dp);
+    }
+  gnupg_rmdir (dir);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  static const char *modes[] = { "fpr", "keyid", "mail", "substr" };
+  const char *homedir = NULL;
+  const char *output = NULL;
+  unsigned int nlookups = 1000;
+  int use_index = 0;
+  char *tmpdir = NULL;
+  char *fname;
+  ctrl_t ctrl;
+  byte *fprs;
+  int i;
+
+  for (argc--, argv++; argc; argc--, argv++)
+    {
+      if (!strcmp (*argv, "--verbose"))
+        verbose = 1;
+      else if (!strcmp (*argv, "--index"))
+        use_index = 1;
+      else if (argc > 1 && !strcmp (*argv, "--backend"))
+        {
+          backend = *++argv; argc--;
+        }
+      else if (argc > 1 && !strcmp (*argv, "--keys"))
+        {
+          nkeys = strtoul (*++argv, NULL, 10); argc--;
+        }
+      else if (argc > 1 && !strcmp (*argv, "--lookups"))
+        {
+          nlookups = strtoul (*++argv, NULL, 10); argc--;
+        }
+      else if (argc > 1 && !strcmp (*argv, "--homedir"))
+        {
+          homedir = *++argv; argc--;
+        }
+      else if (argc > 1 && !strcmp (*argv, "--output"))
+        {
+          output = *++argv; argc--;
+        }
+      else
+        {
+          fputs ("usage: " PGM " [--backend keyring|keybox|keyboxd]"
+                 " [--keys N] [--lookups N]\n"
+                 "       [--index] [--homedir DIR] [--output FILE]"
+                 " [--verbose]\n", stderr);
+          exit (2);
+        }
+    }
+  if (!nkeys)
+    log_fatal ("no keys requested\n");
+  if (strcmp (backend, "keyring") && strcmp (backend, "keybox")
+      && strcmp (backend, "keyboxd"))
+    log_fatal ("unknown backend '%s'\n", backend);
+
+  log_set_prefix (PGM, GPGRT_LOG_WITH_PREFIX);
+
+  if (!homedir)
+    {
+      tmpdir = xstrdup ("/tmp/" PGM "-XXXXXX");
+      if (!gnupg_mkdtemp (tmpdir))
+        log_fatal ("can't create a temporary directory: %s\n",
+                   strerror (errno));
+      homedir = tmpdir;
+    }
+  gnupg_set_homedir (homedir);
+
+  if (use_index)
+    keybox_set_use_index (1);
+  if (!strcmp (backend, "keyboxd"))
+    opt.use_keyboxd = 1;
+  else
+    {
+      fname = make_filename (homedir, !strcmp (backend, "keyring")
+                             ? "pubring.gpg" : "pubring.kbx", NULL);
+      if (gnupg_access (fname, F_OK) != GPG_ERR_ENOENT)
+        log_fatal ("'%s' already exists\n", fname);
+      xfree (fname);
+      if (keydb_add_resource (!strcmp (backend, "keyring")
+                              ? "gnupg-ring:pubring.gpg"
+                              : "gnupg-kbx:pubring.kbx", 0))
+        log_fatal ("can't create the key database\n");
+    }
+
+  if (output)
+    {
+      jsonfp = fopen (output, "w");
+      if (!jsonfp)
+        log_fatal ("can't create '%s': %s\n", output, strerror (errno));
+    }
+  else
+    jsonfp = stdout;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+  fprs = xmalloc ((size_t)nkeys * 20);
+
+  fprintf (jsonfp, "{\n  \"backend\": \"%s\", \"keys\": %u, \"index\": %s,\n"
+           "  \"results\": [",
+           backend, nkeys, use_index? "true":"false");
+  bench_import (ctrl, fprs);
+  for (i = 0; i < DIM (modes); i++)
+    bench_search (ctrl, modes[i], nlookups, fprs);
+  bench_list (ctrl);
+  fputs ("\n  ]\n}\n", jsonfp);
+  if (jsonfp != stdout && fclose (jsonfp))
+    log_fatal ("error writing '%s': %s\n", output, strerror (errno));
+
+  xfree (fprs);
+  xfree (ctrl);
+  if (tmpdir)
+    {
+      remove_homedir (tmpdir);
+      xfree (tmpdir);
+    }
+  return 0;
+}
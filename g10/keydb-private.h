@@ -80,6 +80,9 @@ struct keydb_handle_s
   /* Flag set if this handles pertains to call-keyboxd.c.  */
   int use_keyboxd;
 
+  /* Packets to skip when parsing keyblocks (PARSE_SKIP_*).  */
+  unsigned int parse_mask;
+
   /* BEGIN USE_KEYBOXD */
   /* (These fields are only valid if USE_KEYBOXD is set.) */
 
@@ -154,7 +157,8 @@ struct keydb_handle_s
 /*-- keydb.c --*/
 
 
-gpg_error_t keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
+gpg_error_t keydb_parse_keyblock (iobuf_t iobuf, unsigned int parse_mask,
+                                  int pk_no, int uid_no,
                                   kbnode_t *r_keyblock);
 
 /* These are the functions call-keyboxd diverts to if the keyboxd is
@@ -40,6 +40,7 @@
 #include "keydb.h"
 #include "../common/i18n.h"
 #include "../common/comopt.h"
+#include "../common/memstat.h"
 
 #include "keydb-private.h"  /* For struct keydb_handle_s */
 
@@ -56,6 +57,24 @@ static void *primary_keydb;
 /* Whether we have successfully registered any resource.  */
 static int any_registered;
 
+/* The number of registered resources which are compiled keyboxes.  */
+static int compiled_resources;
+
+/* The resources added by keydb_defer_resource.  They are registered
+ * with the first use of the key database.  */
+static strlist_t deferred_resources;
+
+/* The state of the resource files as seen by the last call of
+ * keydb_check_changes.  The index is the same as for ALL_RESOURCES.  */
+static struct
+{
+  char *fname;
+  int known;
+  off_t size;
+  time_t mtime;
+  ino_t ino;
+} resource_stamps[MAX_KEYDB_RESOURCES];
+
 /* Looking up keys is expensive.  To hide the cost, we cache whether
    keys exist in the key database.  Then, if we know a key does not
    exist, we don't have to spend time looking it up.  This
@@ -105,6 +124,16 @@ struct
 } keydb_stats;
 
 
+/* The state of a batch of updates; see keydb_begin_batch.  */
+static struct
+{
+  int level;               /* The nesting level.  */
+  KEYDB_HANDLE hd;         /* The handle holding the locks.  */
+  int saved_append;        /* The previous keybox append mode.  */
+  unsigned int updates;    /* The number of updated keyblocks.  */
+} batch;
+
+
 static int lock_all (KEYDB_HANDLE hd);
 static void unlock_all (KEYDB_HANDLE hd);
 
@@ -156,6 +185,7 @@ kid_not_found_insert (u32 *kid)
     log_debug ("keydb: kid_not_found_insert (%08lx%08lx)\n",
                (ulong)kid[0], (ulong)kid[1]);
   k = xmalloc (sizeof *k);
+  memstat_alloc (MEMSTAT_KEYDB, sizeof *k);
   k->kid[0] = kid[0];
   k->kid[1] = kid[1];
   k->next = kid_not_found_cache[kid[0] % KID_NOT_FOUND_CACHE_BUCKETS];
@@ -182,6 +212,7 @@ kid_not_found_flush (void)
       for (k = kid_not_found_cache[i]; k; k = knext)
         {
           knext = k->next;
+          memstat_free (MEMSTAT_KEYDB, sizeof *k);
           xfree (k);
         }
       kid_not_found_cache[i] = NULL;
@@ -431,16 +462,18 @@ maybe_create_keyring_or_box (char *filename, int is_box, int force_create)
    Otherwise, tries to figure out the file's type.  This is either
    KEYDB_RESOURCE_TYPE_KEYBOX, KEYDB_RESOURCE_TYPE_KEYRING or
    KEYDB_RESOURCE_TYPE_KEYNONE.  If the file is a keybox and it has
-   the OpenPGP flag set, then R_OPENPGP is also set.  */
+   the OpenPGP flag set, then R_OPENPGP is also set; R_COMPILED is
+   set likewise for the compiled flag.  */
 static KeydbResourceType
-rt_from_file (const char *filename, int *r_found, int *r_openpgp)
+rt_from_file (const char *filename, int *r_found, int *r_openpgp,
+              int *r_compiled)
 {
   u32 magic;
   unsigned char verbuf[4];
   estream_t fp;
   KeydbResourceType rt = KEYDB_RESOURCE_TYPE_NONE;
 
-  *r_found = *r_openpgp = 0;
+  *r_found = *r_openpgp = *r_compiled = 0;
   fp = es_fopen (filename, "rb");
   if (fp)
     {
@@ -455,8 +488,10 @@ rt_from_file (const char *filename, int *r_found, int *r_openpgp)
                    && es_fread (&magic, 4, 1, fp) == 1
                    && !memcmp (&magic, "KBXf", 4))
             {
-              if ((verbuf[3] & 0x02))
+              if ((verbuf[3] & KEYBOX_HEADER_FLAG_OPENPGP))
                 *r_openpgp = 1;
+              if ((verbuf[3] & KEYBOX_HEADER_FLAG_COMPILED))
+                *r_compiled = 1;
               rt = KEYDB_RESOURCE_TYPE_KEYBOX;
             }
           else
@@ -590,6 +625,7 @@ keydb_add_resource (const char *url, unsigned int flags)
   gpg_error_t err = 0;
   KeydbResourceType rt = KEYDB_RESOURCE_TYPE_NONE;
   void *token;
+  int compiled = 0;
 
   /* Create the resource if it is the first registered one.  */
   create = (!read_only && !any_registered);
@@ -641,7 +677,7 @@ keydb_add_resource (const char *url, unsigned int flags)
 
     check_again:
       filenamelen = strlen (filename);
-      rt = rt_from_file (filename, &found, &openpgp_flag);
+      rt = rt_from_file (filename, &found, &openpgp_flag, &compiled);
       if (found)
         {
           /* The file exists and we have the resource type in RT.
@@ -657,7 +693,7 @@ keydb_add_resource (const char *url, unsigned int flags)
               && filenamelen > 4 && !strcmp (filename+filenamelen-4, ".gpg"))
             {
               strcpy (filename+filenamelen-4, ".kbx");
-              if ((rt_from_file (filename, &found, &openpgp_flag)
+              if ((rt_from_file (filename, &found, &openpgp_flag, &compiled)
                    == KEYDB_RESOURCE_TYPE_KEYBOX) && found && openpgp_flag)
                 rt = KEYDB_RESOURCE_TYPE_KEYBOX;
               else /* Restore filename */
@@ -673,7 +709,7 @@ keydb_add_resource (const char *url, unsigned int flags)
           KeydbResourceType rttmp;
 
           strcpy (filename+filenamelen-4, ".gpg");
-          rttmp = rt_from_file (filename, &found, &openpgp_flag);
+          rttmp = rt_from_file (filename, &found, &openpgp_flag, &compiled);
           if (found
               && ((rttmp == KEYDB_RESOURCE_TYPE_KEYBOX && openpgp_flag)
                   || (rttmp == KEYDB_RESOURCE_TYPE_KEYRING)))
@@ -722,6 +758,7 @@ keydb_add_resource (const char *url, unsigned int flags)
               all_resources[used_resources].type = rt;
               all_resources[used_resources].u.kr = NULL; /* Not used here */
               all_resources[used_resources].token = token;
+              resource_stamps[used_resources].fname = xtrystrdup (filename);
               used_resources++;
             }
         }
@@ -772,7 +809,11 @@ keydb_add_resource (const char *url, unsigned int flags)
                         keybox_release (kbxhd);
                       }
                   }
+                resource_stamps[used_resources].fname
+                  = xtrystrdup (filename);
                 used_resources++;
+                if (compiled)
+                  compiled_resources++;
               }
           }
         else if (gpg_err_code (err) == GPG_ERR_EEXIST)
@@ -810,6 +851,55 @@ keydb_add_resource (const char *url, unsigned int flags)
 }
 
 
+/* Return true if all registered resources are keyboxes written by
+ * lcrv --compile-keyring.  */
+int
+keydb_all_compiled (void)
+{
+  return used_resources && compiled_resources == used_resources;
+}
+
+
+/* Remember the resource URL with FLAGS for keydb_add_resource but
+ * defer the registration until the key database is used.  Short
+ * running commands which do not need a key database, like
+ * --print-md or --symmetric, then do not open the files and do not
+ * create the default resource.  */
+void
+keydb_defer_resource (const char *url, unsigned int flags)
+{
+  strlist_t sl;
+
+  sl = append_to_strlist (&deferred_resources, url);
+  sl->flags = flags;
+}
+
+
+/* Register the resources added with keydb_defer_resource.  This is
+ * called with the first use of the key database.  If the first
+ * resource enabled the keyboxd the remaining resources are not used.
+ * Errors have already been printed by keydb_add_resource.  */
+void
+keydb_register_deferred (void)
+{
+  strlist_t list, sl;
+  gpg_error_t err;
+
+  if (!deferred_resources)
+    return;
+
+  list = deferred_resources;
+  deferred_resources = NULL;
+  for (sl = list; sl; sl = sl->next)
+    {
+      err = keydb_add_resource (sl->d, sl->flags);
+      if (gpg_err_code (err) == GPG_ERR_TRUE && opt.use_keyboxd)
+        break;  /* The keyboxd has been enabled.  */
+    }
+  free_strlist (list);
+}
+
+
 void
 keydb_dump_stats (void)
 {
@@ -878,6 +968,8 @@ internal_keydb_init (KEYDB_HANDLE hd)
               reterrno = errno;
               die = 1;
             }
+          else /* Keyboxes are only replaced by a rename.  */
+            keybox_set_mmap (hd->active[j].u.kb, 1);
           j++;
           break;
         }
@@ -944,6 +1036,65 @@ internal_keydb_lock (KEYDB_HANDLE hd)
 }
 
 
+/* Start a batch of updates, like a bulk import.  Until the matching
+ * keydb_end_batch all resources stay locked and keyboxes are updated
+ * by appending the new keyblocks.  The space of the replaced
+ * keyblocks is reclaimed at the end with a single rewrite.  Batches
+ * may be nested.  This does nothing with the keyboxd, which uses its
+ * own transactions for this.  */
+gpg_error_t
+keydb_begin_batch (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  KEYDB_HANDLE hd;
+
+  if (opt.use_keyboxd || opt.dry_run)
+    return 0;
+  if (batch.level)
+    {
+      batch.level++;
+      return 0;
+    }
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    return gpg_error_from_syserror ();
+  err = internal_keydb_lock (hd);
+  if (err)
+    {
+      keydb_release (hd);
+      return err;
+    }
+  batch.hd = hd;
+  batch.level = 1;
+  batch.updates = 0;
+  batch.saved_append = keybox_set_append_updates (1);
+  return 0;
+}
+
+
+/* End a batch of updates started with keydb_begin_batch.  */
+void
+keydb_end_batch (void)
+{
+  KEYDB_HANDLE hd;
+  int i;
+
+  if (!batch.level || --batch.level)
+    return;
+
+  hd = batch.hd;
+  keybox_set_append_updates (batch.saved_append);
+  if (batch.updates)
+    for (i = 0; i < hd->used; i++)
+      if (hd->active[i].type == KEYDB_RESOURCE_TYPE_KEYBOX)
+        keybox_compress_now (hd->active[i].u.kb);
+
+  batch.hd = NULL;
+  keydb_release (hd);
+}
+
+
 /* Set a flag on the handle to suppress use of cached results.  This
  * is required for updating a keyring and for key listings.  Fixme:
  * Using a new parameter for keydb_new might be a better solution.  */
@@ -955,6 +1106,17 @@ keydb_disable_caching (KEYDB_HANDLE hd)
 }
 
 
+/* Skip the packets selected by MASK, a set of PARSE_SKIP_* flags,
+ * when reading keyblocks with HD.  Such keyblocks are incomplete and
+ * must not be written back.  */
+void
+keydb_set_parse_mask (KEYDB_HANDLE hd, unsigned int mask)
+{
+  if (hd)
+    hd->parse_mask = mask;
+}
+
+
 /* Return the file name of the resource in which the current search
  * result was found or, if there is no search result, the filename of
  * the current resource (i.e., the resource that the file position
@@ -1062,6 +1224,12 @@ unlock_all (KEYDB_HANDLE hd)
 
   if (!hd->locked || hd->keep_lock)
     return;
+  if (batch.hd && hd != batch.hd)
+    {
+      /* The resources stay locked by the batch.  */
+      hd->locked = 0;
+      return;
+    }
 
   for (i=hd->used-1; i >= 0; i--)
     {
@@ -1159,10 +1327,11 @@ keydb_pop_found_state (KEYDB_HANDLE hd)
 
 
 
-/* Parse the keyblock in IOBUF and return at R_KEYBLOCK.  */
+/* Parse the keyblock in IOBUF and return at R_KEYBLOCK.  Packets
+ * selected by PARSE_MASK are skipped.  */
 gpg_error_t
-keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
-                      kbnode_t *r_keyblock)
+keydb_parse_keyblock (iobuf_t iobuf, unsigned int parse_mask,
+                      int pk_no, int uid_no, kbnode_t *r_keyblock)
 {
   gpg_error_t err;
   struct parse_packet_ctx_s parsectx;
@@ -1174,11 +1343,11 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
 
   *r_keyblock = NULL;
 
-  pkt = xtrymalloc (sizeof *pkt);
+  pkt = alloc_kbnode_packet ();
   if (!pkt)
     return gpg_error_from_syserror ();
-  init_packet (pkt);
   init_parse_packet (&parsectx, iobuf);
+  parsectx.parse_mask = parse_mask;
   save_mode = set_packet_list_mode (0);
   in_cert = 0;
   tail = NULL;
@@ -1270,13 +1439,12 @@ keydb_parse_keyblock (iobuf_t iobuf, int pk_no, int uid_no,
       else
         *tail = node;
       tail = &node->next;
-      pkt = xtrymalloc (sizeof *pkt);
+      pkt = alloc_kbnode_packet ();
       if (!pkt)
         {
           err = gpg_error_from_syserror ();
           break;
         }
-      init_packet (pkt);
     }
   set_packet_list_mode (save_mode);
 
@@ -1325,6 +1493,7 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
       else
 	{
 	  err = keydb_parse_keyblock (hd->keyblock_cache.iobuf,
+				      hd->parse_mask,
 				      hd->keyblock_cache.pk_no,
 				      hd->keyblock_cache.uid_no,
 				      ret_kb);
@@ -1345,7 +1514,8 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
       err = gpg_error (GPG_ERR_GENERAL); /* oops */
       break;
     case KEYDB_RESOURCE_TYPE_KEYRING:
-      err = keyring_get_keyblock (hd->active[hd->found].u.kr, ret_kb);
+      err = keyring_get_keyblock (hd->active[hd->found].u.kr,
+                                  hd->parse_mask, ret_kb);
       break;
     case KEYDB_RESOURCE_TYPE_KEYBOX:
       {
@@ -1356,7 +1526,8 @@ internal_keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
                                    &iobuf, &pk_no, &uid_no);
         if (!err)
           {
-            err = keydb_parse_keyblock (iobuf, pk_no, uid_no, ret_kb);
+            err = keydb_parse_keyblock (iobuf, hd->parse_mask,
+                                        pk_no, uid_no, ret_kb);
             if (!err && hd->keyblock_cache.state == KEYBLOCK_CACHE_PREPARED)
               {
                 hd->keyblock_cache.state     = KEYBLOCK_CACHE_FILLED;
@@ -1469,7 +1640,11 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
 
   unlock_all (hd);
   if (!err)
-    keydb_stats.update_keyblocks++;
+    {
+      keydb_stats.update_keyblocks++;
+      if (batch.level)
+        batch.updates++;
+    }
   return err;
 }
 
@@ -1656,12 +1831,60 @@ keydb_locate_writable (KEYDB_HANDLE hd)
 }
 
 
+/* Return true if one of the key resource files has been changed
+ * since the last call.  The first call only records the state of the
+ * files.  This is used by long running processes to detect changes
+ * done by other processes; note that our own updates are reported as
+ * well.  With the keyboxd this always returns false.  */
+int
+keydb_check_changes (void)
+{
+  struct stat st;
+  int changed = 0;
+  int i;
+
+  keydb_register_deferred ();
+  if (opt.use_keyboxd)
+    return 0;
+
+  for (i=0; i < used_resources; i++)
+    {
+      if (!resource_stamps[i].fname)
+        continue;
+      if (gnupg_stat (resource_stamps[i].fname, &st))
+        memset (&st, 0, sizeof st);  /* Eg. removed.  */
+      if (resource_stamps[i].known
+          && (st.st_size != resource_stamps[i].size
+              || st.st_mtime != resource_stamps[i].mtime
+              || st.st_ino != resource_stamps[i].ino))
+        changed = 1;
+      resource_stamps[i].known = 1;
+      resource_stamps[i].size = st.st_size;
+      resource_stamps[i].mtime = st.st_mtime;
+      resource_stamps[i].ino = st.st_ino;
+    }
+
+  return changed;
+}
+
+
+/* Flush the in-memory caches about the presence of keys.  This is
+ * required after another process changed a key resource.  */
+void
+keydb_flush_caches (void)
+{
+  kid_not_found_flush ();
+  keyring_flush_present_hash ();
+}
+
+
 /* Rebuild the on-disk caches of all key resources.  */
 void
 keydb_rebuild_caches (ctrl_t ctrl, int noisy)
 {
   int i, rc;
 
+  keydb_register_deferred ();
   if (opt.use_keyboxd)
     return;  /* No need for this here.  */
 
@@ -1978,3 +2201,144 @@ keydb_search_fpr (KEYDB_HANDLE hd, const byte *fpr, size_t fprlen)
   desc.fprlen = fprlen;
   return keydb_search (hd, &desc, 1, NULL);
 }
+
+
+/* Return true if the primary key or a subkey of KEYBLOCK matches the
+ * fingerprint or key id search description DESC.  */
+static int
+keyblock_matches_desc (kbnode_t keyblock, KEYDB_SEARCH_DESC *desc)
+{
+  kbnode_t node;
+  PKT_public_key *pk;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 kid[2];
+
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      pk = node->pkt->pkt.public_key;
+      switch (desc->mode)
+        {
+        case KEYDB_SEARCH_MODE_FPR:
+          fingerprint_from_pk (pk, fpr, &fprlen);
+          if (fprlen == desc->fprlen && !memcmp (fpr, desc->u.fpr, fprlen))
+            return 1;
+          break;
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          keyid_from_pk (pk, kid);
+          if (kid[0] == desc->u.kid[0] && kid[1] == desc->u.kid[1])
+            return 1;
+          break;
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+          keyid_from_pk (pk, kid);
+          if (kid[1] == desc->u.kid[1])
+            return 1;
+          break;
+        default:
+          break;
+        }
+    }
+  return 0;
+}
+
+
+/* Look up the keyblocks for the NDESC fingerprint or key id search
+ * descriptions DESC with a single pass over the database.  The
+ * keyblock found for DESC[i] is stored at R_KEYBLOCKS[i] or NULL is
+ * stored there if no key matches.  Only the first match for each
+ * description is returned, like a fresh keydb_search would do.  The
+ * caller must release the keyblocks.  */
+gpg_error_t
+keydb_search_batch (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, size_t ndesc,
+                    kbnode_t *r_keyblocks)
+{
+  gpg_error_t err;
+  KEYDB_HANDLE hd;
+  kbnode_t keyblock;
+  char *again;
+  size_t i, nleft;
+  int used;
+
+  for (i = 0; i < ndesc; i++)
+    {
+      r_keyblocks[i] = NULL;
+      if (desc[i].mode != KEYDB_SEARCH_MODE_FPR
+          && desc[i].mode != KEYDB_SEARCH_MODE_LONG_KID
+          && desc[i].mode != KEYDB_SEARCH_MODE_SHORT_KID)
+        return gpg_error (GPG_ERR_INV_ARG);
+    }
+  if (!ndesc)
+    return 0;
+
+  again = xtrycalloc (ndesc, 1);
+  if (!again)
+    return gpg_error_from_syserror ();
+  hd = keydb_new (ctrl);
+  if (!hd)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (again);
+      return err;
+    }
+  keydb_disable_caching (hd);
+
+  /* We can't rely on the DESCINDEX of the search because the keyboxd
+   * does not return it and because one keyblock may match several
+   * descriptions.  Thus we match the keyblock ourselves.  A keyblock
+   * is handed out only once; further descriptions it matches are
+   * looked up again afterwards.  */
+  nleft = ndesc;
+  while (nleft && !(err = keydb_search (hd, desc, ndesc, NULL)))
+    {
+      err = keydb_get_keyblock (hd, &keyblock);
+      if (err)
+        goto leave;
+
+      used = 0;
+      for (i = 0; i < ndesc; i++)
+        {
+          if (r_keyblocks[i] || again[i]
+              || !keyblock_matches_desc (keyblock, desc + i))
+            continue;
+          if (!used)
+            r_keyblocks[i] = keyblock;
+          else
+            again[i] = 1;
+          used = 1;
+          nleft--;
+        }
+      if (!used)
+        release_kbnode (keyblock);
+    }
+  if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    goto leave;
+  err = 0;
+
+  for (i = 0; i < ndesc; i++)
+    {
+      if (!again[i])
+        continue;
+      keydb_search_reset (hd);
+      err = keydb_search (hd, desc + i, 1, NULL);
+      if (!err)
+        err = keydb_get_keyblock (hd, &r_keyblocks[i]);
+      if (err)
+        goto leave;
+    }
+
+ leave:
+  if (err)
+    {
+      for (i = 0; i < ndesc; i++)
+        {
+          release_kbnode (r_keyblocks[i]);
+          r_keyblocks[i] = NULL;
+        }
+    }
+  keydb_release (hd);
+  xfree (again);
+  return err;
+}
@@ -220,14 +220,28 @@ char *keydb_search_desc_dump (struct keydb_search_desc *desc);
 /* Register a resource (keyring or keybox).  */
 gpg_error_t keydb_add_resource (const char *url, unsigned int flags);
 
+/* Return true if all resources are compiled keyboxes.  */
+int keydb_all_compiled (void);
+
+/* Register a resource with the first use of the key database.  */
+void keydb_defer_resource (const char *url, unsigned int flags);
+void keydb_register_deferred (void);
+
 /* Dump some statistics to the log.  */
 void keydb_dump_stats (void);
 
+/* Hold the locks and defer the rewrites for a batch of updates.  */
+gpg_error_t keydb_begin_batch (ctrl_t ctrl);
+void keydb_end_batch (void);
+
 /* Set a flag on the handle to suppress use of cached results.  This
    is required for updating a keyring and for key listings.  Fixme:
    Using a new parameter for keydb_new might be a better solution.  */
 void keydb_disable_caching (KEYDB_HANDLE hd);
 
+/* Skip some packets when reading keyblocks.  */
+void keydb_set_parse_mask (KEYDB_HANDLE hd, unsigned int mask);
+
 /* Save the last found state and invalidate the current selection.  */
 void keydb_push_found_state (KEYDB_HANDLE hd);
 
@@ -240,6 +254,12 @@ const char *keydb_get_resource_name (KEYDB_HANDLE hd);
 /* Find the first writable resource.  */
 gpg_error_t keydb_locate_writable (KEYDB_HANDLE hd);
 
+/* Check whether a key resource file has been changed.  */
+int keydb_check_changes (void);
+
+/* Flush the in-memory caches about the presence of keys.  */
+void keydb_flush_caches (void);
+
 /* Rebuild the on-disk caches of all key resources.  */
 void keydb_rebuild_caches (ctrl_t ctrl, int noisy);
 
@@ -261,6 +281,10 @@ gpg_error_t keydb_search_kid (KEYDB_HANDLE hd, u32 *kid);
  * fingerprint.  */
 gpg_error_t keydb_search_fpr (KEYDB_HANDLE hd, const byte *fpr, size_t fprlen);
 
+/* Look up the keyblocks for many fingerprints or key ids at once.  */
+gpg_error_t keydb_search_batch (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc,
+                                size_t ndesc, kbnode_t *r_keyblocks);
+
 
 /*-- pkclist.c --*/
 void show_revocation_reason (ctrl_t ctrl, PKT_public_key *pk, int mode );
@@ -329,6 +353,12 @@ void cache_public_key( PKT_public_key *pk );
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
 
+/* Drop the public key cache but keep using it.  */
+void getkey_flush_caches (void);
+
+/* Print statistics about the public key cache.  */
+void getkey_dump_stats (void);
+
 /* Return the public key used for signature SIG and store it at PK.  */
 gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
                                 PKT_public_key *pk, PKT_signature *sig,
@@ -459,6 +489,10 @@ gpg_error_t getkey_next (ctrl_t ctrl, getkey_ctx_t ctx,
 /* Release any resources used by a key listing context.  */
 void getkey_end (ctrl_t ctrl, getkey_ctx_t ctx);
 
+/* Look up many keys by fingerprint or key id in advance.  */
+int getkey_prefetch (ctrl_t ctrl, strlist_t names);
+void getkey_prefetch_release (ctrl_t ctrl);
+
 /* Return the database handle used by this context.  The context still
    owns the handle.  */
 KEYDB_HANDLE get_ctx_handle(GETKEY_CTX ctx);
@@ -593,6 +627,7 @@ char *ecdh_param_str_from_pk (PKT_public_key *pk);
 
 
 /*-- kbnode.c --*/
+PACKET *alloc_kbnode_packet (void);
 KBNODE new_kbnode( PACKET *pkt );
 kbnode_t new_kbnode2 (kbnode_t list, PACKET *pkt);
 KBNODE clone_kbnode( KBNODE node );
@@ -2894,38 +2894,36 @@ find_by_primary_fpr (ctrl_t ctrl, const char *fpr,
 }
 
 
-/* Unattended key signing function.  If the key specified by FPR is
-   available and FPR is the primary fingerprint all user ids of the
-   key are signed using the default signing key.  If UIDS is an empty
-   list all usable UIDs are signed, if it is not empty, only those
-   user ids matching one of the entries of the list are signed.  With
-   LOCAL being true the signatures are marked as non-exportable.  */
-void
-keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
-                    strlist_t locusr, int local)
+/* Helper for keyedit_quick_sign and keyedit_quick_sign_keys.  Read
+ * the key FPR, select the user ids matching UIDS and sign them.  On
+ * success the keyblock and its handle are stored at R_KEYBLOCK and
+ * R_KDBHD and R_MODIFIED is set if the keyblock needs to be written.
+ * These are also returned on error if any.  Errors have already been
+ * reported.  */
+static gpg_error_t
+quick_sign_one (ctrl_t ctrl, const char *fpr, strlist_t uids,
+                strlist_t locusr, int local, kbnode_t *r_keyblock,
+                KEYDB_HANDLE *r_kdbhd, int *r_modified)
 {
   gpg_error_t err = 0;
   kbnode_t keyblock = NULL;
-  KEYDB_HANDLE kdbhd = NULL;
-  int modified = 0;
   PKT_public_key *pk;
   kbnode_t node;
   strlist_t sl;
   int any;
 
-#ifdef HAVE_W32_SYSTEM
-  /* See keyedit_menu for why we need this.  */
-  check_trustdb_stale (ctrl);
-#endif
+  *r_modified = 0;
 
   /* We require a fingerprint because only this uniquely identifies a
      key and may thus be used to select a key for unattended key
      signing.  */
-  if (find_by_primary_fpr (ctrl, fpr, &keyblock, &kdbhd))
-    goto leave;
+  err = find_by_primary_fpr (ctrl, fpr, r_keyblock, r_kdbhd);
+  if (err)
+    return err;
 
-  if (fix_keyblock (ctrl, &keyblock))
-    modified++;
+  if (fix_keyblock (ctrl, r_keyblock))
+    (*r_modified)++;
+  keyblock = *r_keyblock;
 
   /* Give some info in verbose.  */
   if (opt.verbose)
@@ -3025,32 +3023,200 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
     }
 
   /* Sign. */
-  sign_uids (ctrl, es_stdout, keyblock, locusr, &modified, local, 0, 0, 0, 1);
+  sign_uids (ctrl, es_stdout, keyblock, locusr, r_modified, local,
+             0, 0, 0, 1);
   es_fflush (es_stdout);
 
-  if (modified)
+ leave:
+  if (err)
+    write_status_error ("keyedit.sign-key", err);
+  return err;
+}
+
+
+/* Write the keyblock KEYBLOCK signed by quick_sign_one using KDBHD
+ * if MODIFIED is set.  */
+static gpg_error_t
+quick_sign_update (ctrl_t ctrl, KEYDB_HANDLE kdbhd, kbnode_t keyblock,
+                   int modified)
+{
+  gpg_error_t err;
+
+  if (!modified)
     {
-      err = keydb_update_keyblock (ctrl, kdbhd, keyblock);
-      if (err)
-        {
-          log_error (_("update failed: %s\n"), gpg_strerror (err));
-          goto leave;
-        }
+      log_info (_("Key not changed so no update needed.\n"));
+      return 0;
     }
-  else
-    log_info (_("Key not changed so no update needed.\n"));
+
+  err = keydb_update_keyblock (ctrl, kdbhd, keyblock);
+  if (err)
+    {
+      log_error (_("update failed: %s\n"), gpg_strerror (err));
+      write_status_error ("keyedit.sign-key", err);
+    }
+  return err;
+}
+
+
+/* Unattended key signing function.  If the key specified by FPR is
+   available and FPR is the primary fingerprint all user ids of the
+   key are signed using the default signing key.  If UIDS is an empty
+   list all usable UIDs are signed, if it is not empty, only those
+   user ids matching one of the entries of the list are signed.  With
+   LOCAL being true the signatures are marked as non-exportable.  */
+void
+keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
+                    strlist_t locusr, int local)
+{
+  kbnode_t keyblock = NULL;
+  KEYDB_HANDLE kdbhd = NULL;
+  int modified;
+
+#ifdef HAVE_W32_SYSTEM
+  /* See keyedit_menu for why we need this.  */
+  check_trustdb_stale (ctrl);
+#endif
+
+  if (quick_sign_one (ctrl, fpr, uids, locusr, local,
+                      &keyblock, &kdbhd, &modified))
+    goto leave;
+  if (quick_sign_update (ctrl, kdbhd, keyblock, modified))
+    goto leave;
 
   if (update_trust)
     revalidation_mark (ctrl);
 
  leave:
-  if (err)
-    write_status_error ("keyedit.sign-key", err);
   release_kbnode (keyblock);
   keydb_release (kdbhd);
 }
 
 
+/* The number of keys signed with one request to the agent by
+ * keyedit_quick_sign_keys.  */
+#define QUICK_SIGN_BATCH 64
+
+/* Information about one key to be signed by keyedit_quick_sign_keys.  */
+struct quick_sign_item_s
+{
+  kbnode_t keyblock;
+  KEYDB_HANDLE kdbhd;
+  int modified;
+  gpg_error_t err;
+};
+
+
+/* Sign and write the keys of the NITEMS fingerprints in FPRS.  */
+static void
+quick_sign_keys_batch (ctrl_t ctrl, char **fprs, int nitems,
+                       strlist_t locusr, int local)
+{
+  struct quick_sign_item_s items[QUICK_SIGN_BATCH];
+  gpg_error_t err;
+  int i;
+
+  memset (items, 0, sizeof items);
+
+  /* The keyblocks are kept until the batch has been signed because
+   * the collected signatures are stored in them.  */
+  keysig_batch_begin ();
+  for (i=0; i < nitems; i++)
+    items[i].err = quick_sign_one (ctrl, fprs[i], NULL, locusr, local,
+                                   &items[i].keyblock, &items[i].kdbhd,
+                                   &items[i].modified);
+  err = keysig_batch_end (ctrl);
+  if (err)
+    write_status_error ("keysig", err);
+
+  for (i=0; i < nitems; i++)
+    {
+      if (!err && !items[i].err)
+        quick_sign_update (ctrl, items[i].kdbhd, items[i].keyblock,
+                           items[i].modified);
+      release_kbnode (items[i].keyblock);
+      keydb_release (items[i].kdbhd);
+    }
+}
+
+
+/* Unattended signing of many keys.  This is keyedit_quick_sign with
+ * all user ids for each of the NFPRS fingerprints in FPRS.  If NFPRS
+ * is 0 the fingerprints are read from stdin, one per line.  The
+ * signatures for a batch of keys are created with one request to the
+ * agent and all keyblocks are written in one keydb batch.  A key
+ * given twice in a batch is signed only once.  This is used for
+ * --quick-sign-key --multifile.  */
+void
+keyedit_quick_sign_keys (ctrl_t ctrl, int nfprs, char **fprs,
+                         strlist_t locusr, int local)
+{
+  char *batch[QUICK_SIGN_BATCH];
+  int from_args = !!nfprs;
+  int nitems = 0;
+  int in_keydb_batch;
+  char line[256];
+  unsigned int lno = 0;
+  int i;
+
+#ifdef HAVE_W32_SYSTEM
+  /* See keyedit_menu for why we need this.  */
+  check_trustdb_stale (ctrl);
+#endif
+
+  in_keydb_batch = !keydb_begin_batch (ctrl);
+  for (;;)
+    {
+      char *fpr = NULL;
+
+      if (from_args)
+        {
+          if (nfprs)
+            {
+              fpr = *fprs++;
+              nfprs--;
+            }
+        }
+      else if (fgets (line, DIM(line), stdin))
+        {
+          lno++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            log_error ("input line %u too long or missing LF\n", lno);
+          else
+            {
+              line[strlen(line)-1] = '\0';
+              fpr = line;
+              trim_spaces (fpr);
+              if (!*fpr || *fpr == '#')
+                continue;
+            }
+        }
+
+      if (fpr)
+        {
+          for (i=0; i < nitems; i++)
+            if (!ascii_strcasecmp (batch[i], fpr))
+              break;
+          if (i == nitems)
+            batch[nitems++] = xstrdup (fpr);
+        }
+      if (nitems && (!fpr || nitems == QUICK_SIGN_BATCH))
+        {
+          quick_sign_keys_batch (ctrl, batch, nitems, locusr, local);
+          for (i=0; i < nitems; i++)
+            xfree (batch[i]);
+          nitems = 0;
+        }
+      if (!fpr)
+        break;
+    }
+  if (in_keydb_batch)
+    keydb_end_batch ();
+
+  if (update_trust)
+    revalidation_mark (ctrl);
+}
+
+
 /* Unattended revocation of a key signatures.  USERNAME specifies the
  * key; this should best be a fingerprint. SIGTOREV is the user-id of
  * the key for which the key signature shall be removed.  Only
@@ -49,6 +49,8 @@ void keyedit_quick_revuid (ctrl_t ctrl, const char *username,
                            const char *uidtorev);
 void keyedit_quick_sign (ctrl_t ctrl, const char *fpr,
                          strlist_t uids, strlist_t locusr, int local);
+void keyedit_quick_sign_keys (ctrl_t ctrl, int nfprs, char **fprs,
+                              strlist_t locusr, int local);
 void keyedit_quick_revsig (ctrl_t ctrl, const char *username,
                            const char *sigtorev, strlist_t affected_uids);
 void keyedit_quick_set_expire (ctrl_t ctrl,
@@ -128,6 +128,7 @@ struct output_control_s
   int dryrun;
   unsigned int keygen_flags;
   int use_files;
+  int announced;  /* The keys have been announced to the agent.  */
   struct {
     char  *fname;
     char  *newfname;
@@ -2292,50 +2293,74 @@ gen_kyber (int algo, unsigned int nbits, const char *curve, kbnode_t pub_root,
 }
 
 
-/*
- * Generate an RSA key.
- */
-static int
-gen_rsa (int algo, unsigned int nbits, KBNODE pub_root,
-         u32 timestamp, u32 expireval, int is_subkey,
-         int keygen_flags, const char *passphrase,
-         char **cache_nonce_addr, char **passwd_nonce_addr,
-         gpg_error_t (*common_gen_cb)(common_gen_cb_parm_t),
-         common_gen_cb_parm_t common_gen_cb_parm)
+/* Return the size to be used for an RSA key of NBITS.  Unless QUIET
+ * is set, changes are logged.  */
+static unsigned int
+adjust_rsa_nbits (int algo, unsigned int nbits, int quiet)
 {
-  int err;
-  char *keyparms;
-  char nbitsstr[35];
   const unsigned maxsize = (opt.flags.large_rsa ? 8192 : 4096);
 
-  log_assert (is_RSA(algo));
-
   if (!nbits)
     nbits = get_keysize_range (algo, NULL, NULL);
 
   if (nbits < 1024)
     {
       nbits = 3072;
-      log_info (_("keysize invalid; using %u bits\n"), nbits );
+      if (!quiet)
+        log_info (_("keysize invalid; using %u bits\n"), nbits );
     }
   else if (nbits > maxsize)
     {
       nbits = maxsize;
-      log_info (_("keysize invalid; using %u bits\n"), nbits );
+      if (!quiet)
+        log_info (_("keysize invalid; using %u bits\n"), nbits );
     }
 
   if ((nbits % 32))
     {
       nbits = ((nbits + 31) / 32) * 32;
-      log_info (_("keysize rounded up to %u bits\n"), nbits );
+      if (!quiet)
+        log_info (_("keysize rounded up to %u bits\n"), nbits );
     }
 
+  return nbits;
+}
+
+
+/* Return the malloced key parameters for the agent to generate an
+ * RSA key of NBITS.  */
+static char *
+rsa_keyparms (unsigned int nbits, int keygen_flags)
+{
+  char nbitsstr[35];
+
   snprintf (nbitsstr, sizeof nbitsstr, "%u", nbits);
-  keyparms = xtryasprintf ("(genkey(rsa(nbits %zu:%s)%s))",
-                           strlen (nbitsstr), nbitsstr,
-                           ((keygen_flags & KEYGEN_FLAG_TRANSIENT_KEY)
-                            && (keygen_flags & KEYGEN_FLAG_NO_PROTECTION))?
-                           "(transient-key)" : "" );
+  return xtryasprintf ("(genkey(rsa(nbits %zu:%s)%s))",
+                       strlen (nbitsstr), nbitsstr,
+                       ((keygen_flags & KEYGEN_FLAG_TRANSIENT_KEY)
+                        && (keygen_flags & KEYGEN_FLAG_NO_PROTECTION))?
+                       "(transient-key)" : "" );
+}
+
+
+/*
+ * Generate an RSA key.
+ */
+static int
+gen_rsa (int algo, unsigned int nbits, KBNODE pub_root,
+         u32 timestamp, u32 expireval, int is_subkey,
+         int keygen_flags, const char *passphrase,
+         char **cache_nonce_addr, char **passwd_nonce_addr,
+         gpg_error_t (*common_gen_cb)(common_gen_cb_parm_t),
+         common_gen_cb_parm_t common_gen_cb_parm)
+{
+  int err;
+  char *keyparms;
+
+  log_assert (is_RSA(algo));
+
+  nbits = adjust_rsa_nbits (algo, nbits, 0);
+  keyparms = rsa_keyparms (nbits, keygen_flags);
   if (!keyparms)
     err = gpg_error_from_syserror ();
   else
@@ -5172,6 +5197,193 @@ proc_parameter_file (ctrl_t ctrl, struct para_data_s *para, const char *fname,
 }
 
 
+/* The number of different RSA key parameters announced to the agent
+ * by announce_parameter_file.  */
+#define MAX_ANNOUNCED_PARMS 16
+
+struct announced_parms_s
+{
+  char *keyparms;
+  unsigned int count;
+};
+
+
+/* Helper for announce_parameter_file to count the key of type TYPE
+ * in the parameter block PARA.  */
+static void
+announce_parameter_key (ctrl_t ctrl, struct para_data_s *para,
+                        enum para_name type, enum para_name length,
+                        enum para_name grip, int keygen_flags,
+                        struct announced_parms_s *tbl, int *ntbl)
+{
+  char *keyparms;
+  int algo, is_default, i;
+
+  if (!get_parameter (para, type) || get_parameter (para, grip))
+    return;
+  algo = get_parameter_algo (ctrl, para, type, &is_default);
+  if (algo != PUBKEY_ALGO_RSA || is_default)
+    return;
+
+  keyparms = rsa_keyparms (adjust_rsa_nbits (algo,
+                                             get_parameter_uint (para, length),
+                                             1),
+                           keygen_flags);
+  if (!keyparms)
+    return;
+  for (i = 0; i < *ntbl; i++)
+    if (!strcmp (tbl[i].keyparms, keyparms))
+      break;
+  if (i < *ntbl)
+    {
+      tbl[i].count++;
+      xfree (keyparms);
+    }
+  else if (*ntbl < MAX_ANNOUNCED_PARMS)
+    {
+      tbl[i].keyparms = keyparms;
+      tbl[i].count = 1;
+      (*ntbl)++;
+    }
+  else
+    xfree (keyparms);
+}
+
+
+/* Announce the NTBL keys collected in TBL to the agent and release
+ * TBL.  */
+static void
+announce_keys (ctrl_t ctrl, struct announced_parms_s *tbl, int ntbl)
+{
+  gpg_error_t err;
+  int i;
+
+  for (i = 0; i < ntbl; i++)
+    {
+      err = agent_pregen_keys (ctrl, tbl[i].keyparms, tbl[i].count);
+      if (err && gpg_err_code (err) != GPG_ERR_NOT_ENABLED)
+        log_info ("announcing keys to the agent failed: %s\n",
+                  gpg_strerror (err));
+      else if (!err && opt.verbose)
+        log_info ("announced %u keys %s to the agent\n",
+                  tbl[i].count, tbl[i].keyparms);
+      xfree (tbl[i].keyparms);
+    }
+}
+
+
+/* Scan the parameter file FNAME for RSA keys and announce them to
+ * the agent so that it can generate them in the background while we
+ * process the file.  This is a best effort pre-pass which does not
+ * report errors; only the key type, length and grip lines and the
+ * control statements changing the key parameters are looked at.
+ * Returns true if the file has been scanned.  */
+static int
+announce_parameter_file (ctrl_t ctrl, const char *fname)
+{
+  static struct { const char *name;
+                  enum para_name key;
+  } keywords[] = {
+    { "Key-Type",       pKEYTYPE },
+    { "Key-Length",     pKEYLENGTH },
+    { "Subkey-Type",    pSUBKEYTYPE },
+    { "Subkey-Length",  pSUBKEYLENGTH },
+    { "Keygrip",        pKEYGRIP },
+    { "Key-Grip",       pKEYGRIP },
+    { "Subkey-grip",    pSUBKEYGRIP },
+    { NULL, 0 }
+  };
+  struct announced_parms_s tbl[MAX_ANNOUNCED_PARMS];
+  int ntbl = 0;
+  IOBUF fp;
+  byte *line = NULL;
+  unsigned int maxlen = 1024, nline = 0;
+  char *p, *keyword;
+  struct para_data_s *para = NULL, *r;
+  int keygen_flags = 0;
+  int i, eof;
+
+  if (!strcmp (fname, "-"))
+    return 0;
+  fp = iobuf_open (fname);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+    }
+  if (!fp)
+    return 0;
+  iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+
+  do
+    {
+      eof = !iobuf_read_line (fp, &line, &nline, &maxlen);
+      if (eof || !maxlen)
+        keyword = NULL;
+      else
+        {
+          for (p = line; isspace (*(byte*)p); p++)
+            ;
+          if (!*p || *p == '#')
+            continue;
+          keyword = p;
+          if (*keyword == '%')
+            {
+              for (; *p && !isspace (*(byte*)p); p++)
+                ;
+              *p = 0;
+              if (!ascii_strcasecmp (keyword, "%no-protection"))
+                keygen_flags |= KEYGEN_FLAG_NO_PROTECTION;
+              else if (!ascii_strcasecmp (keyword, "%transient-key"))
+                keygen_flags |= KEYGEN_FLAG_TRANSIENT_KEY;
+              if (ascii_strcasecmp (keyword, "%commit"))
+                continue;
+              keyword = NULL;
+            }
+          else if (!(p = strchr (p, ':')))
+            continue;
+          else
+            *p++ = 0;
+        }
+
+      if (!keyword || !ascii_strcasecmp (keyword, "Key-Type"))
+        {
+          /* End of a block.  */
+          announce_parameter_key (ctrl, para, pKEYTYPE, pKEYLENGTH,
+                                  pKEYGRIP, keygen_flags, tbl, &ntbl);
+          announce_parameter_key (ctrl, para, pSUBKEYTYPE, pSUBKEYLENGTH,
+                                  pSUBKEYGRIP, keygen_flags, tbl, &ntbl);
+          release_parameter_list (para);
+          para = NULL;
+          if (!keyword)
+            continue;
+        }
+
+      for (i = 0; keywords[i].name; i++)
+        if (!ascii_strcasecmp (keywords[i].name, keyword))
+          break;
+      if (!keywords[i].name)
+        continue;
+      for (; isspace (*(byte*)p); p++)
+        ;
+      trim_trailing_ws (p, strlen (p));
+      r = xmalloc_clear (sizeof *r + strlen (p));
+      r->key = keywords[i].key;
+      strcpy (r->u.value, p);
+      r->next = para;
+      para = r;
+    }
+  while (!eof && maxlen);
+
+  xfree (line);
+  release_parameter_list (para);
+  iobuf_close (fp);
+
+  announce_keys (ctrl, tbl, ntbl);
+  return 1;
+}
+
+
 /****************
  * Kludge to allow non interactive key generation controlled
  * by a parameter file.
@@ -5218,6 +5430,7 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
     struct para_data_s *para, *r;
     int i;
     struct output_control_s outctrl;
+    int batch = 0;
 
     memset( &outctrl, 0, sizeof( outctrl ) );
     outctrl.pub.afx = new_armor_context ();
@@ -5225,6 +5438,12 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
     if( !fname || !*fname)
       fname = "-";
 
+    if (opt.parallel_keygen)
+      {
+        outctrl.announced = announce_parameter_file (ctrl, fname);
+        batch = !keydb_begin_batch (ctrl);
+      }
+
     fp = iobuf_open (fname);
     if (fp && is_secured_file (iobuf_get_fd (fp)))
       {
@@ -5234,6 +5453,8 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
       }
     if (!fp) {
       log_error (_("can't open '%s': %s\n"), fname, strerror(errno) );
+      if (batch)
+        keydb_end_batch ();
       return;
     }
     iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
@@ -5393,6 +5614,8 @@ read_parameter_file (ctrl_t ctrl, const char *fname )
     release_parameter_list( para );
     iobuf_close (fp);
     release_armor_context (outctrl.pub.afx);
+    if (batch)
+      keydb_end_batch ();
 }
 
 
@@ -6450,6 +6673,22 @@ do_generate_keypair (ctrl_t ctrl, struct para_data_s *para,
   if (get_parameter_uint (para, pVERSION) == 5)
     keygen_flags |= KEYGEN_FLAG_CREATE_V5_KEY;
 
+  /* The subkey does not depend on the primary key; thus let the agent
+   * generate an RSA subkey while we wait for an RSA primary key.  The
+   * binding signature is made after both keys are available.  */
+  if (!key_from_hexgrip && !card && algo == PUBKEY_ALGO_RSA
+      && !outctrl->announced
+      && !get_parameter_value (para, pCARDBACKUPKEY))
+    {
+      struct announced_parms_s tbl[1];
+      int ntbl = 0;
+
+      announce_parameter_key (ctrl, para, pSUBKEYTYPE, pSUBKEYLENGTH,
+                              pSUBKEYGRIP, outctrl->keygen_flags,
+                              tbl, &ntbl);
+      announce_keys (ctrl, tbl, ntbl);
+    }
+
   if (key_from_hexgrip)
     err = do_create_from_keygrip (ctrl, algo, key_from_hexgrip, cardkey,
                                   pub_root,
@@ -1322,19 +1322,26 @@ format_hexfingerprint (const char *fingerprint, char *buffer, size_t buflen)
  * be 20 bytes long.  Returns 0 on success or an error code.  If
  * GET_SECOND Is one and PK has dual algorithm, the keygrip of the
  * second algorithm is return; GPG_ERR_FALSE is returned if the algo
- * is not a dual algorithm.  */
+ * is not a dual algorithm.  The keygrip is computed only once and
+ * then cached in PK.  */
 gpg_error_t
 keygrip_from_pk (PKT_public_key *pk, unsigned char *array, int get_second)
 {
   gpg_error_t err;
   gcry_sexp_t s_pkey;
 
-  if (DBG_PACKET)
-    log_debug ("get_keygrip for public key%s\n", get_second?" (second)":"");
-
   if (get_second && pk->pubkey_algo != PUBKEY_ALGO_KYBER)
     return gpg_error (GPG_ERR_FALSE);
 
+  if (get_second? pk->flags.grip2_valid : pk->flags.grip_valid)
+    {
+      memcpy (array, get_second? pk->grip2 : pk->grip, KEYGRIP_LEN);
+      return 0;
+    }
+
+  if (DBG_PACKET)
+    log_debug ("get_keygrip for public key%s\n", get_second?" (second)":"");
+
   switch (pk->pubkey_algo)
     {
     case GCRY_PK_DSA:
@@ -1431,7 +1438,16 @@ keygrip_from_pk (PKT_public_key *pk, unsigned char *array, int get_second)
     {
       if (DBG_PACKET)
         log_printhex (array, 20, "keygrip=");
-      /* FIXME: Save the keygrip in PK.  */
+      if (get_second)
+        {
+          memcpy (pk->grip2, array, KEYGRIP_LEN);
+          pk->flags.grip2_valid = 1;
+        }
+      else
+        {
+          memcpy (pk->grip, array, KEYGRIP_LEN);
+          pk->flags.grip_valid = 1;
+        }
     }
   gcry_sexp_release (s_pkey);
 
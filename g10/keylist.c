@@ -48,6 +48,12 @@
 #include "../common/recsel.h"
 #include "../common/compliance.h"
 #include "../common/pkscreening.h"
+#include "keysig-pool.h"
+
+
+/* The number of keyblocks read ahead by list_all if the signatures
+ * are checked by worker threads.  */
+#define LIST_BATCH_SIZE 32
 
 
 static void list_all (ctrl_t, int, int);
@@ -79,6 +85,17 @@ struct list_filter_s list_filter;
 /* The stream used to write attribute packets to.  */
 static estream_t attrib_fp;
 
+/* A buffer to render one record of a colon listing.  Building the
+ * record with a few inline helpers and writing it with one call is
+ * much cheaper than going through the printf machinery for each
+ * field; this matters for listings of large keyrings.  */
+static struct
+{
+  char *buf;
+  size_t len;
+  size_t size;
+} colrec;
+
 
 
 
@@ -106,6 +123,9 @@ static void
 cleanup_keylist_globals (void)
 {
   release_list_filter (&list_filter);
+  xfree (colrec.buf);
+  colrec.buf = NULL;
+  colrec.len = colrec.size = 0;
 }
 
 
@@ -733,6 +753,78 @@ print_signature_stats (struct keylist_context *s)
 }
 
 
+/* An entry of the batch of keyblocks listed by list_all.  */
+struct list_batch_s
+{
+  kbnode_t keyblock;
+  const char *resname;
+};
+
+
+/* List the NITEMS keyblocks in ITEMS and release them.  With
+ * --list-threads the signatures of all keyblocks are first checked
+ * by worker threads; the keyblocks are then listed in order by the
+ * main thread.  LASTRESNAME is updated with the last printed resource
+ * name.  Returns the error of list_keyblock.  */
+static gpg_error_t
+list_all_batch (ctrl_t ctrl, int secret, int mark_secret,
+                struct list_batch_s *items, unsigned int nitems,
+                const char **lastresname, struct keylist_context *listctx)
+{
+  kbnode_t keyblocks[LIST_BATCH_SIZE];
+  int any_secret[LIST_BATCH_SIZE];
+  unsigned int i, n;
+  gpg_error_t listerr = 0;
+
+  log_assert (nitems <= LIST_BATCH_SIZE);
+
+  /* Ask the agent first so that only the listed keyblocks are
+   * checked.  */
+  for (i = n = 0; i < nitems; i++)
+    {
+      if (secret || mark_secret)
+        any_secret[i] = !agent_probe_any_secret_key (ctrl, items[i].keyblock);
+      else
+        any_secret[i] = 0;
+      if (!secret || any_secret[i])
+        keyblocks[n++] = items[i].keyblock;
+    }
+  keysig_pool_check_keyblocks (opt.check_sigs? ctrl : NULL,
+                               keyblocks, n, opt.list_threads);
+
+  for (i = 0; i < nitems; i++)
+    {
+      if (listerr)
+        ;
+      else if (secret && !any_secret[i])
+        ; /* Secret key listing requested but this isn't one.  */
+      else
+        {
+          if (!opt.with_colons && !(opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
+            {
+              if (*lastresname != items[i].resname)
+                {
+                  int j;
+
+                  es_fprintf (es_stdout, "%s\n", items[i].resname);
+                  for (j = strlen (items[i].resname); j; j--)
+                    es_putc ('-', es_stdout);
+                  es_putc ('\n', es_stdout);
+                  *lastresname = items[i].resname;
+                }
+            }
+          merge_keys_and_selfsig (ctrl, items[i].keyblock);
+          listerr = list_keyblock (ctrl, items[i].keyblock, secret,
+                                   any_secret[i], opt.fingerprint, listctx);
+        }
+      release_kbnode (items[i].keyblock);
+      items[i].keyblock = NULL;
+    }
+
+  return listerr;
+}
+
+
 /* List all keys.  If SECRET is true only secret keys are listed.  If
    MARK_SECRET is true secret keys are indicated in a public key
    listing.  */
@@ -742,20 +834,31 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
   KEYDB_HANDLE hd;
   KBNODE keyblock = NULL;
   int rc = 0;
-  int any_secret;
-  const char *lastresname, *resname;
+  const char *lastresname;
   struct keylist_context listctx;
+  struct list_batch_s items[LIST_BATCH_SIZE];
+  unsigned int nitems = 0;
+  unsigned int batchsize;
   gpg_error_t listerr = 0;
 
   memset (&listctx, 0, sizeof (listctx));
   if (opt.check_sigs)
     listctx.check_sigs = 1;
 
+  /* Without worker threads each keyblock is listed right away.  */
+  batchsize = opt.list_threads > 1? LIST_BATCH_SIZE : 1;
+
   hd = keydb_new (ctrl);
   if (!hd)
     rc = gpg_error_from_syserror ();
   else
-    rc = keydb_search_first (hd);
+    {
+      /* Without a signature listing certifications by other keys are
+       * not used; don't parse them.  */
+      if (!opt.list_sigs && !opt.check_sigs)
+        keydb_set_parse_mask (hd, PARSE_SKIP_OTHER_CERTS);
+      rc = keydb_search_first (hd);
+    }
   if (rc)
     {
       if (gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
@@ -776,40 +879,31 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
           if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
             continue;  /* Skip legacy keys.  */
 	  log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (rc));
+          /* List the keyblocks read so far.  */
+          list_all_batch (ctrl, secret, mark_secret, items, nitems,
+                          &lastresname, &listctx);
+          nitems = 0;
 	  goto leave;
 	}
 
-      if (secret || mark_secret)
-        any_secret = !agent_probe_any_secret_key (ctrl, keyblock);
-      else
-        any_secret = 0;
-
-      if (secret && !any_secret)
-        ; /* Secret key listing requested but this isn't one.  */
-      else
+      items[nitems].keyblock = keyblock;
+      items[nitems].resname = keydb_get_resource_name (hd);
+      nitems++;
+      keyblock = NULL;
+      if (nitems == batchsize)
         {
-          if (!opt.with_colons && !(opt.list_options & LIST_SHOW_ONLY_FPR_MBOX))
-            {
-              resname = keydb_get_resource_name (hd);
-              if (lastresname != resname)
-                {
-                  int i;
-
-                  es_fprintf (es_stdout, "%s\n", resname);
-                  for (i = strlen (resname); i; i--)
-                    es_putc ('-', es_stdout);
-                  es_putc ('\n', es_stdout);
-                  lastresname = resname;
-                }
-            }
-          merge_keys_and_selfsig (ctrl, keyblock);
-          listerr = list_keyblock (ctrl, keyblock, secret, any_secret,
-                                   opt.fingerprint, &listctx);
+          listerr = list_all_batch (ctrl, secret, mark_secret, items, nitems,
+                                    &lastresname, &listctx);
+          nitems = 0;
         }
-      release_kbnode (keyblock);
-      keyblock = NULL;
     }
   while (!listerr && !(rc = keydb_search_next (hd)));
+  if (nitems)
+    {
+      listerr = list_all_batch (ctrl, secret, mark_secret, items, nitems,
+                                &lastresname, &listctx);
+      nitems = 0;
+    }
   es_fflush (es_stdout);
   if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
     log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
@@ -889,6 +983,9 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
                 es_putc ('-', es_stdout);
               es_putc ('\n', es_stdout);
             }
+          if (listctx.check_sigs)
+            keysig_pool_check_keyblocks (ctrl, &keyblock, 1,
+                                         opt.list_threads);
           listerr = list_keyblock (ctrl, keyblock, secret, any_secret,
                                    opt.fingerprint, &listctx);
         }
@@ -953,6 +1050,177 @@ locate_one (ctrl_t ctrl, strlist_t names, int no_local)
 }
 
 
+/* Make sure that N more bytes fit into the colon record buffer.  */
+static void
+colrec_reserve (size_t n)
+{
+  size_t newsize;
+
+  if (colrec.len + n <= colrec.size)
+    return;
+  newsize = colrec.size? colrec.size : 512;
+  while (newsize < colrec.len + n)
+    newsize *= 2;
+  colrec.buf = xrealloc (colrec.buf, newsize);
+  colrec.size = newsize;
+}
+
+
+static GPGRT_INLINE void
+colrec_putc (int c)
+{
+  if (colrec.len == colrec.size)
+    colrec_reserve (1);
+  colrec.buf[colrec.len++] = c;
+}
+
+
+static void
+colrec_mem (const void *buffer, size_t length)
+{
+  colrec_reserve (length);
+  memcpy (colrec.buf + colrec.len, buffer, length);
+  colrec.len += length;
+}
+
+
+static void
+colrec_puts (const char *string)
+{
+  colrec_mem (string, strlen (string));
+}
+
+
+/* Append BUFFER of LENGTH as uppercase hex digits.  */
+static void
+colrec_hex (const void *buffer, size_t length)
+{
+  static const char hexdigits[] = "0123456789ABCDEF";
+  const unsigned char *s = buffer;
+  char *d;
+
+  colrec_reserve (2 * length);
+  d = colrec.buf + colrec.len;
+  for (; length; length--, s++)
+    {
+      *d++ = hexdigits[*s >> 4];
+      *d++ = hexdigits[*s & 15];
+    }
+  colrec.len = d - colrec.buf;
+}
+
+
+/* Append the byte C as two lowercase hex digits.  */
+static void
+colrec_hexbyte (unsigned int c)
+{
+  static const char hexdigits[] = "0123456789abcdef";
+
+  colrec_reserve (2);
+  colrec.buf[colrec.len++] = hexdigits[(c >> 4) & 15];
+  colrec.buf[colrec.len++] = hexdigits[c & 15];
+}
+
+
+/* Append the keyid KEYID in the "%08lX%08lX" format.  */
+static void
+colrec_keyid (const u32 *keyid)
+{
+  unsigned char buf[8];
+
+  buf[0] = keyid[0] >> 24;
+  buf[1] = keyid[0] >> 16;
+  buf[2] = keyid[0] >> 8;
+  buf[3] = keyid[0];
+  buf[4] = keyid[1] >> 24;
+  buf[5] = keyid[1] >> 16;
+  buf[6] = keyid[1] >> 8;
+  buf[7] = keyid[1];
+  colrec_hex (buf, 8);
+}
+
+
+static void
+colrec_ulong (unsigned long value)
+{
+  char buf[24];
+  char *p = buf + sizeof buf;
+
+  do
+    *--p = '0' + (value % 10);
+  while ((value /= 10));
+  colrec_mem (p, buf + sizeof buf - p);
+}
+
+
+static void
+colrec_int (int value)
+{
+  if (value < 0)
+    {
+      colrec_putc ('-');
+      colrec_ulong (-(unsigned long)value);
+    }
+  else
+    colrec_ulong (value);
+}
+
+
+/* Append the time T as done by colon_strtime; that is nothing for 0.  */
+static void
+colrec_time (u32 t)
+{
+  if (t)
+    colrec_ulong (t);
+}
+
+
+/* Append BUFFER of LENGTH escaped exactly as es_write_sanitized does
+ * with ":" as delimiter.  */
+static void
+colrec_sanitized (const void *buffer, size_t length)
+{
+  const unsigned char *p = buffer;
+
+  for (; length; length--, p++)
+    {
+      if (*p < 0x20 || *p == 0x7f || *p == ':' || *p == '\\')
+        {
+          colrec_putc ('\\');
+          if (*p == '\n')
+            colrec_putc ('n');
+          else if (*p == '\r')
+            colrec_putc ('r');
+          else if (*p == '\f')
+            colrec_putc ('f');
+          else if (*p == '\v')
+            colrec_putc ('v');
+          else if (*p == '\b')
+            colrec_putc ('b');
+          else if (!*p)
+            colrec_putc ('0');
+          else
+            {
+              colrec_putc ('x');
+              colrec_hexbyte (*p);
+            }
+        }
+      else
+        colrec_putc (*p);
+    }
+}
+
+
+/* Write out the colon record and reset the buffer.  */
+static void
+colrec_flush (estream_t fp)
+{
+  if (colrec.len)
+    es_write (fp, colrec.buf, colrec.len, NULL);
+  colrec.len = 0;
+}
+
+
 static void
 print_key_data (PKT_public_key * pk)
 {
@@ -970,8 +1238,8 @@ print_key_data (PKT_public_key * pk)
 
 
 /* Various public key screenings.  (Right now just ROCA).  With
- * COLON_MODE set the output is formatted for use in the compliance
- * field of a colon listing.
+ * COLON_MODE set the output is appended to the colon record for use
+ * in the compliance field.
  */
 static void
 print_pk_screening (PKT_public_key *pk, int colon_mode)
@@ -986,7 +1254,7 @@ print_pk_screening (PKT_public_key *pk, int colon_mode)
       else if (gpg_err_code (err) == GPG_ERR_TRUE)
         {
           if (colon_mode)
-            es_fprintf (es_stdout, colon_mode > 1? " %d":"%d", 6001);
+            colrec_puts (colon_mode > 1? " 6001":"6001");
           else
             es_fprintf (es_stdout,
                         "      Screening: ROCA vulnerability detected\n");
@@ -1006,14 +1274,14 @@ print_capabilities (ctrl_t ctrl, PKT_public_key *pk, KBNODE keyblock)
   int c_printed = 0;
 
   if (use & PUBKEY_USAGE_ENC)
-    es_putc ('e', es_stdout);
+    colrec_putc ('e');
 
   if (use & PUBKEY_USAGE_SIG)
     {
-      es_putc ('s', es_stdout);
+      colrec_putc ('s');
       if (pk->flags.primary)
         {
-          es_putc ('c', es_stdout);
+          colrec_putc ('c');
           /* The PUBKEY_USAGE_CERT flag was introduced later and we
              used to always print 'c' for a primary key.  To avoid any
              regression here we better track whether we printed 'c'
@@ -1023,20 +1291,20 @@ print_capabilities (ctrl_t ctrl, PKT_public_key *pk, KBNODE keyblock)
     }
 
   if ((use & PUBKEY_USAGE_CERT) && !c_printed)
-    es_putc ('c', es_stdout);
+    colrec_putc ('c');
 
   if ((use & PUBKEY_USAGE_AUTH))
-    es_putc ('a', es_stdout);
+    colrec_putc ('a');
 
   if (use & PUBKEY_USAGE_RENC)
-    es_putc ('r', es_stdout);
+    colrec_putc ('r');
   if ((use & PUBKEY_USAGE_TIME))
-    es_putc ('t', es_stdout);
+    colrec_putc ('t');
   if ((use & PUBKEY_USAGE_GROUP))
-    es_putc ('g', es_stdout);
+    colrec_putc ('g');
 
   if ((use & PUBKEY_USAGE_UNKNOWN))
-    es_putc ('?', es_stdout);
+    colrec_putc ('?');
 
   if (keyblock)
     {
@@ -1072,18 +1340,18 @@ print_capabilities (ctrl_t ctrl, PKT_public_key *pk, KBNODE keyblock)
 	    }
 	}
       if (enc)
-	es_putc ('E', es_stdout);
+	colrec_putc ('E');
       if (sign)
-	es_putc ('S', es_stdout);
+	colrec_putc ('S');
       if (cert)
-	es_putc ('C', es_stdout);
+	colrec_putc ('C');
       if (auth)
-	es_putc ('A', es_stdout);
+	colrec_putc ('A');
       if (disabled)
-	es_putc ('D', es_stdout);
+	colrec_putc ('D');
     }
 
-  es_putc (':', es_stdout);
+  colrec_putc (':');
 }
 
 
@@ -1790,8 +2058,7 @@ list_keyblock_simple (ctrl_t ctrl, kbnode_t keyblock)
 void
 print_revokers (estream_t fp, int colon_mode, PKT_public_key * pk)
 {
-  int i, j;
-  const byte *p;
+  int i;
 
   if (!pk->revkey && pk->numrevkeys)
     BUG ();
@@ -1800,18 +2067,20 @@ print_revokers (estream_t fp, int colon_mode, PKT_public_key * pk)
     {
       if (colon_mode)
         {
-          es_fprintf (fp, "rvk:::%d::::::", pk->revkey[i].algid);
-          p = pk->revkey[i].fpr;
-          for (j = 0; j < pk->revkey[i].fprlen; j++, p++)
-            es_fprintf (fp, "%02X", *p);
-          es_fprintf (fp, ":%02x%s:\n",
-                      pk->revkey[i].class,
-                      (pk->revkey[i].class & 0x40) ? "s" : "");
+          colrec_puts ("rvk:::");
+          colrec_int (pk->revkey[i].algid);
+          colrec_puts ("::::::");
+          colrec_hex (pk->revkey[i].fpr, pk->revkey[i].fprlen);
+          colrec_putc (':');
+          colrec_hexbyte (pk->revkey[i].class);
+          if ((pk->revkey[i].class & 0x40))
+            colrec_putc ('s');
+          colrec_puts (":\n");
+          colrec_flush (fp);
         }
       else
         {
           es_fprintf (fp, "%*s%s", 6, "", _("Revocable by: "));
-          p = pk->revkey[i].fpr;
           es_write_hexstring (fp, pk->revkey[i].fpr, pk->revkey[i].fprlen,
                               0, NULL);
           if ((pk->revkey[i].class & 0x40))
@@ -1827,10 +2096,11 @@ print_revokers (estream_t fp, int colon_mode, PKT_public_key * pk)
 }
 
 
-/* Print the compliance flags to field 18.  PK is the public key.
- * KEYLENGTH is the length of the key in bits and CURVENAME is either
- * NULL or the name of the curve.  The latter two args are here
- * merely because the caller has already computed them.  */
+/* Append the compliance flags for field 18 to the colon record.  PK
+ * is the public key.  KEYLENGTH is the length of the key in bits and
+ * CURVENAME is either NULL or the name of the curve.  The latter two
+ * args are here merely because the caller has already computed
+ * them.  */
 static void
 print_compliance_flags (PKT_public_key *pk,
                         unsigned int keylength, const char *curvename)
@@ -1842,14 +2112,15 @@ print_compliance_flags (PKT_public_key *pk,
 
   if (pk->version == 5)
     {
-      es_fputs (gnupg_status_compliance_flag (CO_GNUPG), es_stdout);
+      colrec_puts (gnupg_status_compliance_flag (CO_GNUPG));
       any++;
     }
   if (gnupg_pk_is_compliant (CO_DE_VS, pk->pubkey_algo, 0, pk->pkey,
 			     keylength, curvename))
     {
-      es_fprintf (es_stdout, any ? " %s" : "%s",
-		  gnupg_status_compliance_flag (CO_DE_VS));
+      if (any)
+        colrec_putc (' ');
+      colrec_puts (gnupg_status_compliance_flag (CO_DE_VS));
       any++;
     }
 
@@ -1874,7 +2145,6 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
   int trustletter_print;
   int ownertrust_print;
   int ulti_hack = 0;
-  int i;
   char *hexgrip_buffer = NULL;
   const char *hexgrip = NULL;
   char *serialno = NULL;
@@ -1933,35 +2203,41 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 
   keylength = nbits_from_pk (pk);
 
-  es_fputs (secret? "sec:":"pub:", es_stdout);
+  colrec_puts (secret? "sec:":"pub:");
   if (trustletter_print)
-    es_putc (trustletter_print, es_stdout);
-  es_fprintf (es_stdout, ":%u:%d:%08lX%08lX:%s:%s::",
-              keylength,
-              pk->pubkey_algo,
-              (ulong) keyid[0], (ulong) keyid[1],
-              colon_datestr_from_pk (pk), colon_strtime (pk->expiredate));
+    colrec_putc (trustletter_print);
+  colrec_putc (':');
+  colrec_ulong (keylength);
+  colrec_putc (':');
+  colrec_int (pk->pubkey_algo);
+  colrec_putc (':');
+  colrec_keyid (keyid);
+  colrec_putc (':');
+  colrec_ulong (pk->timestamp);
+  colrec_putc (':');
+  colrec_time (pk->expiredate);
+  colrec_puts ("::");
 
   if (ownertrust_print)
-    es_putc (ownertrust_print, es_stdout);
-  es_putc (':', es_stdout);
+    colrec_putc (ownertrust_print);
+  colrec_putc (':');
 
-  es_putc (':', es_stdout);
-  es_putc (':', es_stdout);
+  colrec_putc (':');
+  colrec_putc (':');
   print_capabilities (ctrl, pk, keyblock);
-  es_putc (':', es_stdout);		/* End of field 13. */
-  es_putc (':', es_stdout);		/* End of field 14. */
+  colrec_putc (':');		/* End of field 13. */
+  colrec_putc (':');		/* End of field 14. */
   if (secret || has_secret)
     {
       if (stubkey)
-	es_putc ('#', es_stdout);
+	colrec_putc ('#');
       else if (serialno)
-        es_fputs (serialno, es_stdout);
+        colrec_puts (serialno);
       else if (has_secret)
-        es_putc ('+', es_stdout);
+        colrec_putc ('+');
     }
-  es_putc (':', es_stdout);		/* End of field 15. */
-  es_putc (':', es_stdout);		/* End of field 16. */
+  colrec_putc (':');		/* End of field 15. */
+  colrec_putc (':');		/* End of field 16. */
   if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA
       || pk->pubkey_algo == PUBKEY_ALGO_EDDSA
       || pk->pubkey_algo == PUBKEY_ALGO_ECDH)
@@ -1970,7 +2246,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
       curvename = openpgp_oid_to_curve (curve, 0);
       if (!curvename)
         curvename = curve;
-      es_fputs (curvename, es_stdout);
+      colrec_puts (curvename);
     }
   else if (pk->pubkey_algo == PUBKEY_ALGO_KYBER)
     {
@@ -1978,25 +2254,32 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
        * the primary key and Kyber is not able to certify.  But we
        * prepare it here for future composite algorithms and in case
        * of faulty packets. */
-      es_fputs (pubkey_string (pk, pkstrbuf, sizeof pkstrbuf), es_stdout);
+      colrec_puts (pubkey_string (pk, pkstrbuf, sizeof pkstrbuf));
     }
-  es_putc (':', es_stdout);		/* End of field 17. */
+  colrec_putc (':');		/* End of field 17. */
   print_compliance_flags (pk, keylength, curvename);
-  es_putc (':', es_stdout);		/* End of field 18 (compliance). */
-  if (pk->keyupdate)
-    es_fputs (colon_strtime (pk->keyupdate), es_stdout);
-  es_putc (':', es_stdout);		/* End of field 19 (last_update). */
-  es_fprintf (es_stdout, "%d%s", pk->keyorg, pk->updateurl? " ":"");
+  colrec_putc (':');		/* End of field 18 (compliance). */
+  colrec_time (pk->keyupdate);
+  colrec_putc (':');		/* End of field 19 (last_update). */
+  colrec_int (pk->keyorg);
   if (pk->updateurl)
-    es_write_sanitized (es_stdout, pk->updateurl, strlen (pk->updateurl),
-                        ":", NULL);
-  es_putc (':', es_stdout);		/* End of field 20 (origin). */
-  es_putc ('\n', es_stdout);
+    {
+      colrec_putc (' ');
+      colrec_sanitized (pk->updateurl, strlen (pk->updateurl));
+    }
+  colrec_putc (':');		/* End of field 20 (origin). */
+  colrec_putc ('\n');
+  colrec_flush (es_stdout);
 
   print_revokers (es_stdout, 1, pk);
   print_fingerprint (ctrl, NULL, pk, 0);
   if (hexgrip)
-    es_fprintf (es_stdout, "grp:::::::::%s:\n", hexgrip);
+    {
+      colrec_puts ("grp:::::::::");
+      colrec_puts (hexgrip);
+      colrec_puts (":\n");
+      colrec_flush (es_stdout);
+    }
   if (opt.with_key_data)
     print_key_data (pk);
 
@@ -2021,36 +2304,41 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
           else
             uid_validity = get_validity_info (ctrl, keyblock, pk, uid);
 
-          es_fputs (uid->attrib_data? "uat:":"uid:", es_stdout);
+          colrec_puts (uid->attrib_data? "uat:":"uid:");
           if (uid_validity)
-            es_putc (uid_validity, es_stdout);
-          es_fputs ("::::", es_stdout);
+            colrec_putc (uid_validity);
+          colrec_puts ("::::");
 
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->created));
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->expiredate));
+	  colrec_time (uid->created);
+	  colrec_putc (':');
+	  colrec_time (uid->expiredate);
+	  colrec_putc (':');
 
 	  namehash_from_uid (uid);
+	  colrec_hex (uid->namehash, 20);
 
-	  for (i = 0; i < 20; i++)
-	    es_fprintf (es_stdout, "%02X", uid->namehash[i]);
-
-	  es_fprintf (es_stdout, "::");
+	  colrec_puts ("::");
 
 	  if (uid->attrib_data)
-	    es_fprintf (es_stdout, "%u %lu", uid->numattribs, uid->attrib_len);
+	    {
+	      colrec_ulong (uid->numattribs);
+	      colrec_putc (' ');
+	      colrec_ulong (uid->attrib_len);
+	    }
 	  else
-	    es_write_sanitized (es_stdout, uid->name, uid->len, ":", NULL);
-	  es_fputs (":::::::::", es_stdout);
-          if (uid->keyupdate)
-            es_fputs (colon_strtime (uid->keyupdate), es_stdout);
-          es_putc (':', es_stdout);	/* End of field 19 (last_update). */
-          es_fprintf (es_stdout, "%d%s", uid->keyorg, uid->updateurl? " ":"");
+	    colrec_sanitized (uid->name, uid->len);
+	  colrec_puts (":::::::::");
+          colrec_time (uid->keyupdate);
+          colrec_putc (':');	/* End of field 19 (last_update). */
+          colrec_int (uid->keyorg);
           if (uid->updateurl)
-            es_write_sanitized (es_stdout,
-                                uid->updateurl, strlen (uid->updateurl),
-                                ":", NULL);
-          es_putc (':', es_stdout);	/* End of field 20 (origin). */
-	  es_putc ('\n', es_stdout);
+            {
+              colrec_putc (' ');
+              colrec_sanitized (uid->updateurl, strlen (uid->updateurl));
+            }
+          colrec_putc (':');	/* End of field 20 (origin). */
+	  colrec_putc ('\n');
+	  colrec_flush (es_stdout);
 #ifdef USE_TOFU
 	  if (!uid->attrib_data && opt.with_tofu_info
               && (opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP))
@@ -2084,42 +2372,47 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
             stubkey = 1;  /* Key not found.  */
 
 	  keyid_from_pk (pk2, keyid2);
-	  es_fputs (secret? "ssb:":"sub:", es_stdout);
+	  colrec_puts (secret? "ssb:":"sub:");
 	  if (!pk2->flags.valid)
-	    es_putc ('i', es_stdout);
+	    colrec_putc ('i');
 	  else if (pk2->flags.revoked)
-	    es_putc ('r', es_stdout);
+	    colrec_putc ('r');
 	  else if (pk2->has_expired)
-	    es_putc ('e', es_stdout);
+	    colrec_putc ('e');
 	  else if (opt.fast_list_mode || opt.no_expensive_trust_checks)
 	    ;
 	  else
 	    {
 	      /* TRUSTLETTER should always be defined here. */
 	      if (trustletter)
-		es_fprintf (es_stdout, "%c", trustletter);
+		colrec_putc (trustletter);
 	    }
           keylength = nbits_from_pk (pk2);
-	  es_fprintf (es_stdout, ":%u:%d:%08lX%08lX:%s:%s:::::",
-                      keylength,
-                      pk2->pubkey_algo,
-                      (ulong) keyid2[0], (ulong) keyid2[1],
-                      colon_datestr_from_pk (pk2),
-                      colon_strtime (pk2->expiredate));
+	  colrec_putc (':');
+	  colrec_ulong (keylength);
+	  colrec_putc (':');
+	  colrec_int (pk2->pubkey_algo);
+	  colrec_putc (':');
+	  colrec_keyid (keyid2);
+	  colrec_putc (':');
+	  colrec_ulong (pk2->timestamp);
+	  colrec_putc (':');
+	  colrec_time (pk2->expiredate);
+	  colrec_puts (":::::");
 	  print_capabilities (ctrl, pk2, NULL);
-          es_putc (':', es_stdout);	/* End of field 13. */
-          es_putc (':', es_stdout);	/* End of field 14. */
+          colrec_putc (':');	/* End of field 13. */
+          colrec_putc (':');	/* End of field 14. */
           if (secret || has_secret)
             {
               if (stubkey)
-                es_putc ('#', es_stdout);
+                colrec_putc ('#');
               else if (serialno)
-                es_fputs (serialno, es_stdout);
+                colrec_puts (serialno);
               else if (has_secret)
-                es_putc ('+', es_stdout);
+                colrec_putc ('+');
             }
-          es_putc (':', es_stdout);	/* End of field 15. */
-          es_putc (':', es_stdout);	/* End of field 16. */
+          colrec_putc (':');	/* End of field 15. */
+          colrec_putc (':');	/* End of field 16. */
           if (pk2->pubkey_algo == PUBKEY_ALGO_ECDSA
               || pk2->pubkey_algo == PUBKEY_ALGO_EDDSA
               || pk2->pubkey_algo == PUBKEY_ALGO_ECDH)
@@ -2129,20 +2422,25 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
               curvename = openpgp_oid_to_curve (curve, 0);
               if (!curvename)
                 curvename = curve;
-              es_fputs (curvename, es_stdout);
+              colrec_puts (curvename);
             }
           else if (pk2->pubkey_algo == PUBKEY_ALGO_KYBER)
             {
-              es_fputs (pubkey_string (pk2, pkstrbuf, sizeof pkstrbuf),
-                        es_stdout);
+              colrec_puts (pubkey_string (pk2, pkstrbuf, sizeof pkstrbuf));
             }
-          es_putc (':', es_stdout);	/* End of field 17. */
+          colrec_putc (':');	/* End of field 17. */
           print_compliance_flags (pk2, keylength, curvename);
-          es_putc (':', es_stdout);	/* End of field 18. */
-	  es_putc ('\n', es_stdout);
+          colrec_putc (':');	/* End of field 18. */
+	  colrec_putc ('\n');
+	  colrec_flush (es_stdout);
           print_fingerprint (ctrl, NULL, pk2, 0);
           if (hexgrip)
-            es_fprintf (es_stdout, "grp:::::::::%s:\n", hexgrip);
+            {
+              colrec_puts ("grp:::::::::");
+              colrec_puts (hexgrip);
+              colrec_puts (":\n");
+              colrec_flush (es_stdout);
+            }
           if (opt.with_key_data)
             print_key_data (pk2);
 	}
@@ -2177,8 +2475,11 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	    sigstr = "sig";
 	  else
 	    {
-	      es_fprintf (es_stdout, "sig::::::::::%02x%c:\n",
-		      sig->sig_class, sig->flags.exportable ? 'x' : 'l');
+	      colrec_puts ("sig::::::::::");
+	      colrec_hexbyte (sig->sig_class);
+	      colrec_putc (sig->flags.exportable ? 'x' : 'l');
+	      colrec_puts (":\n");
+	      colrec_flush (es_stdout);
 	      continue;
 	    }
 
@@ -2239,53 +2540,68 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
             }
 
 
-	  es_fputs (sigstr, es_stdout);
-	  es_putc (':', es_stdout);
+	  colrec_puts (sigstr);
+	  colrec_putc (':');
 	  if (sigrc != ' ')
-	    es_putc (sigrc, es_stdout);
-	  es_fprintf (es_stdout, "::%d:%08lX%08lX:%s:%s:", sig->pubkey_algo,
-		  (ulong) sig->keyid[0], (ulong) sig->keyid[1],
-		  colon_datestr_from_sig (sig),
-		  colon_expirestr_from_sig (sig));
+	    colrec_putc (sigrc);
+	  colrec_puts ("::");
+	  colrec_int (sig->pubkey_algo);
+	  colrec_putc (':');
+	  colrec_keyid (sig->keyid);
+	  colrec_putc (':');
+	  colrec_ulong (sig->timestamp);
+	  colrec_putc (':');
+	  colrec_time (sig->expiredate);
+	  colrec_putc (':');
 
 	  if (sig->trust_depth || sig->trust_value)
-	    es_fprintf (es_stdout, "%d %d", sig->trust_depth, sig->trust_value);
-	  es_fprintf (es_stdout, ":");
+	    {
+	      colrec_int (sig->trust_depth);
+	      colrec_putc (' ');
+	      colrec_int (sig->trust_value);
+	    }
+	  colrec_putc (':');
 
 	  if (sig->trust_regexp)
-	    es_write_sanitized (es_stdout, sig->trust_regexp,
-                                strlen (sig->trust_regexp), ":", NULL);
-	  es_fprintf (es_stdout, ":");
+	    colrec_sanitized (sig->trust_regexp, strlen (sig->trust_regexp));
+	  colrec_putc (':');
 
 	  if (sigrc == '%')
-	    es_fprintf (es_stdout, "[%s] ", gpg_strerror (rc));
+	    {
+	      colrec_putc ('[');
+	      colrec_puts (gpg_strerror (rc));
+	      colrec_puts ("] ");
+	    }
 	  else if (siguid)
-            es_write_sanitized (es_stdout, siguid, siguidlen, ":", NULL);
+            colrec_sanitized (siguid, siguidlen);
 
-	  es_fprintf (es_stdout, ":%02x%c", sig->sig_class,
-                      sig->flags.exportable ? 'x' : 'l');
+	  colrec_putc (':');
+	  colrec_hexbyte (sig->sig_class);
+	  colrec_putc (sig->flags.exportable ? 'x' : 'l');
           if (reason_text)
-            es_fprintf (es_stdout, ",%02x", reason_code);
-          es_fputs ("::", es_stdout);
+            {
+              colrec_putc (',');
+              colrec_hexbyte (reason_code);
+            }
+          colrec_puts ("::");
 
 	  if (opt.no_sig_cache && opt.check_sigs && fprokay)
-	    {
-	      for (i = 0; i < fplen; i++)
-		es_fprintf (es_stdout, "%02X", fparray[i]);
-	    }
+	    colrec_hex (fparray, fplen);
           else if ((issuer_fpr = issuer_fpr_string (sig)))
-            es_fputs (issuer_fpr, es_stdout);
+            colrec_puts (issuer_fpr);
 
-	  es_fprintf (es_stdout, ":::%d:", sig->digest_algo);
+	  colrec_puts (":::");
+	  colrec_int (sig->digest_algo);
+	  colrec_putc (':');
 
           if (reason_comment)
             {
-              es_fputs ("::::", es_stdout);
-              es_write_sanitized (es_stdout, reason_comment, reason_commentlen,
-                                  ":", NULL);
-              es_putc (':', es_stdout);
+              colrec_puts ("::::");
+              colrec_sanitized (reason_comment, reason_commentlen);
+              colrec_putc (':');
             }
-          es_putc ('\n', es_stdout);
+          colrec_putc ('\n');
+          colrec_flush (es_stdout);
 
 	  if (opt.show_subpackets)
 	    print_subpackets_colon (sig);
@@ -2556,18 +2872,29 @@ print_fingerprint (ctrl_t ctrl, estream_t override_fp,
         text = _("      Key fingerprint =");
     }
 
-  hexfingerprint (pk, hexfpr, sizeof hexfpr);
   if (with_colons && !mode)
     {
-      es_fprintf (fp, "fpr:::::::::%s:", hexfpr);
+      byte fprbuf[MAX_FINGERPRINT_LEN];
+      size_t fprlen;
+
+      fingerprint_from_pk (pk, fprbuf, &fprlen);
+      colrec_puts ("fpr:::::::::");
+      colrec_hex (fprbuf, fprlen);
+      colrec_puts (":\n");
       if (opt.with_v5_fingerprint && pk->version == 4)
         {
           char *v5fpr = v5hexfingerprint (pk, NULL, 0);
-          es_fprintf (fp, "\nfp2:::::::::%s:", v5fpr);
+          colrec_puts ("fp2:::::::::");
+          colrec_puts (v5fpr);
+          colrec_puts (":\n");
           xfree (v5fpr);
         }
+      colrec_flush (fp);
+      return;
     }
-  else if (compact && !opt.fingerprint && !opt.with_fingerprint)
+
+  hexfingerprint (pk, hexfpr, sizeof hexfpr);
+  if (compact && !opt.fingerprint && !opt.with_fingerprint)
     {
       tty_fprintf (fp, "%*s%s", 6, "", hexfpr);
     }
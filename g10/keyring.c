@@ -24,11 +24,17 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
 
 #include "lcr.h"
 #include "../common/util.h"
+#include "../common/host2net.h"
 #include "keyring.h"
 #include "packet.h"
 #include "keydb.h"
@@ -38,6 +44,12 @@
 #include "../kbx/keybox.h"
 
 
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+struct kr_index_s;
+
 typedef struct keyring_resource *KR_RESOURCE;
 struct keyring_resource
 {
@@ -46,6 +58,7 @@ struct keyring_resource
   dotlock_t lockhd;
   int is_locked;
   int did_full_scan;
+  struct kr_index_s *index;  /* The cached index of the keyring.  */
   char fname[1];
 };
 typedef struct keyring_resource const * CONST_KR_RESOURCE;
@@ -177,6 +190,576 @@ key_present_hash_update_from_kb (key_present_hash_t tbl, KBNODE node)
     }
 }
 
+/* An index file FNAME.idx maps the fingerprints and the long key IDs
+ * of the keys in the keyring FNAME to the offsets of their keyblocks.
+ * It allows a fresh process to look up a key by one of these
+ * identifiers with a single seek instead of scanning the keyring.
+ * The search still runs the regular comparisons on the keyblocks
+ * found that way; thus the index only needs to list a superset of
+ * the matching keyblocks and it stores just the 20 byte prefix of
+ * each fingerprint, which is also what a search for a 20 byte
+ * fingerprint compares.
+ *
+ * The index records the size, modification time and inode of the
+ * keyring it describes and is ignored if they do not match anymore.
+ * A changed keyring is not re-indexed in place: our own updates
+ * remove the index and the next lookup builds a new one.
+ *
+ * The index file format:
+ *
+ *   - b4   Magic 'KRXi'
+ *   - byte Version number (1)
+ *   - b3   RFU
+ *   - u32  [NENTRIES] Number of entries
+ *   - u32  RFU
+ *   - u64  Size of the keyring file
+ *   - u64  Modification time of the keyring file
+ *   - u64  Inode number of the keyring file
+ *   - NENTRIES times, sorted by their bytes:
+ *     - byte Type of the item: 1 = fingerprint, 2 = long keyid
+ *     - b20  The first 20 bytes of the fingerprint or the keyid in
+ *            network byte order right padded with zeroes.
+ *     - b3   RFU
+ *     - u64  Offset of the keyblock in the keyring file.
+ */
+#define INDEX_HEADER_LEN 40
+#define INDEX_ENTRY_LEN  32
+#define INDEX_KEY_LEN    21  /* The type and the prefix of the item.  */
+#define INDEX_OFF_POS    24  /* The position of the offset.  */
+
+#define INDEX_TYPE_FPR   1
+#define INDEX_TYPE_KID   2
+
+#define INDEX_VERSION    1
+
+/* What identifies the keyring an index was built for.  */
+struct kr_index_stamp_s
+{
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ino;
+};
+
+/* The index of a keyring.  IMAGE has the layout of the index file.  */
+struct kr_index_s
+{
+  struct kr_index_stamp_s stamp;
+  unsigned char *image;
+  size_t imagelen;
+  size_t nentries;
+  unsigned int valid:1;   /* IMAGE is the index for STAMP.  */
+  unsigned int mapped:1;  /* IMAGE is mmapped.  */
+  unsigned int failed:1;  /* No index can be had for STAMP.  */
+};
+
+/* A growing array of index entries.  */
+struct kr_entries_s
+{
+  unsigned char *buf;   /* The header followed by the entries.  */
+  size_t nentries;
+  size_t allocated;
+};
+
+/* Whether to use index files.  */
+static int use_index;
+
+
+/* Enable the use of index files for all keyrings.  */
+void
+keyring_set_use_index (int yes)
+{
+  use_index = !!yes;
+}
+
+
+static char *
+index_name (const char *fname)
+{
+  return strconcat (fname, ".idx", NULL);
+}
+
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return ((uint64_t)buf32_to_u32 (p) << 32) | buf32_to_u32 (p + 4);
+}
+
+
+static void
+put32 (unsigned char *p, u32 val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >> 8;
+  p[3] = val;
+}
+
+
+static void
+put64 (unsigned char *p, uint64_t val)
+{
+  put32 (p, val >> 32);
+  put32 (p + 4, val);
+}
+
+
+static void
+stamp_from_stat (struct kr_index_stamp_s *stamp, const struct stat *st)
+{
+  stamp->size = st->st_size;
+  stamp->mtime = st->st_mtime;
+  stamp->ino = st->st_ino;
+}
+
+
+static int
+same_file_stamp (const struct kr_index_stamp_s *a,
+                 const struct kr_index_stamp_s *b)
+{
+  return a->size == b->size && a->mtime == b->mtime && a->ino == b->ino;
+}
+
+
+/* Release the image of the index IDX.  */
+static void
+release_index_image (struct kr_index_s *idx)
+{
+#ifdef USE_MMAP
+  if (idx->mapped)
+    munmap (idx->image, idx->imagelen);
+  else
+#endif
+    xfree (idx->image);
+  idx->image = NULL;
+  idx->imagelen = 0;
+  idx->nentries = 0;
+  idx->valid = idx->mapped = idx->failed = 0;
+}
+
+
+/* Remove the index file of the keyring FNAME.  This is called after
+ * the keyring has been rewritten.  */
+static void
+remove_index (const char *fname)
+{
+  char *idxname;
+
+  idxname = index_name (fname);
+  if (idxname)
+    gnupg_remove (idxname);
+  xfree (idxname);
+}
+
+
+static gpg_error_t
+add_index_entry (struct kr_entries_s *e, int type, const unsigned char *item,
+                 size_t itemlen, off_t off)
+{
+  unsigned char *p;
+
+  if (e->nentries == e->allocated)
+    {
+      e->allocated = e->allocated? e->allocated * 2 : 1024;
+      p = xtryrealloc (e->buf,
+                       INDEX_HEADER_LEN + e->allocated * INDEX_ENTRY_LEN);
+      if (!p)
+        return gpg_error_from_syserror ();
+      e->buf = p;
+    }
+
+  p = e->buf + INDEX_HEADER_LEN + e->nentries * INDEX_ENTRY_LEN;
+  memset (p, 0, INDEX_ENTRY_LEN);
+  p[0] = type;
+  memcpy (p + 1, item, itemlen < INDEX_KEY_LEN - 1? itemlen : INDEX_KEY_LEN-1);
+  put64 (p + INDEX_OFF_POS, off);
+  e->nentries++;
+  return 0;
+}
+
+
+/* Add the entries for the key PK of the keyblock at offset OFF.  */
+static gpg_error_t
+add_key_entries (struct kr_entries_s *e, PKT_public_key *pk, off_t off)
+{
+  gpg_error_t err;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  byte kidbuf[8];
+  size_t fprlen;
+  u32 kid[2];
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  keyid_from_pk (pk, kid);
+  put32 (kidbuf, kid[0]);
+  put32 (kidbuf + 4, kid[1]);
+  err = add_index_entry (e, INDEX_TYPE_FPR, fpr, fprlen, off);
+  if (!err)
+    err = add_index_entry (e, INDEX_TYPE_KID, kidbuf, 8, off);
+  return err;
+}
+
+
+static int
+cmp_index_entries (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_ENTRY_LEN);
+}
+
+
+/* Write the index E of the keyring FNAME.  A failure is not an error
+ * because the index will then be rebuilt by the next process.  */
+static void
+write_index (const char *fname, struct kr_entries_s *e)
+{
+  char *idxname, *tmpname;
+  estream_t fp;
+  size_t n;
+
+  idxname = index_name (fname);
+  tmpname = xtryasprintf ("%s.idx-%lu", fname, (unsigned long)getpid ());
+  if (!idxname || !tmpname)
+    goto leave;
+
+  fp = es_fopen (tmpname, "wb");
+  if (!fp)
+    goto leave;
+  n = INDEX_HEADER_LEN + e->nentries * INDEX_ENTRY_LEN;
+  if (es_fwrite (e->buf, n, 1, fp) != 1)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpname);
+      goto leave;
+    }
+  if (es_fclose (fp) || gnupg_rename_file (tmpname, idxname, NULL))
+    {
+      log_info ("can't write '%s': %s\n", idxname,
+                gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpname);
+    }
+
+ leave:
+  xfree (tmpname);
+  xfree (idxname);
+}
+
+
+/* Build the index for the keyring of resource KR whose stamp is
+ * STAMP and store it at IDX.  The index is also written to disk.  */
+static gpg_error_t
+build_index (CONST_KR_RESOURCE kr, const struct kr_index_stamp_s *stamp,
+             struct kr_index_s *idx)
+{
+  gpg_error_t err;
+  IOBUF a;
+  PACKET pkt;
+  struct parse_packet_ctx_s parsectx;
+  struct kr_entries_s e;
+  struct kr_index_stamp_s fstamp;
+  struct stat st;
+  off_t offset, main_offset = 0;
+  int initial_skip = 1;
+  int save_mode;
+  unsigned char *h;
+
+  memset (&e, 0, sizeof e);
+  err = add_index_entry (&e, 0, NULL, 0, 0);  /* Allocate the header.  */
+  if (err)
+    return err;
+  e.nentries = 0;
+
+  a = iobuf_open (kr->fname);
+  if (!a)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (e.buf);
+      return err;
+    }
+#ifdef HAVE_W32_SYSTEM
+  if (gnupg_stat (kr->fname, &st))
+#else
+  if (iobuf_get_fd (a) == GNUPG_INVALID_FD || fstat (iobuf_get_fd (a), &st))
+#endif
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      iobuf_close (a);
+      xfree (e.buf);
+      return err;
+    }
+  stamp_from_stat (&fstamp, &st);
+  if (!same_file_stamp (&fstamp, stamp))
+    {
+      /* The keyring has just been replaced.  */
+      iobuf_close (a);
+      xfree (e.buf);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  init_packet (&pkt);
+  save_mode = set_packet_list_mode (0);
+  init_parse_packet (&parsectx, a);
+  while (!(err = search_packet (&parsectx, &pkt, &offset, 0))
+         || gpg_err_code (err) == GPG_ERR_LEGACY_KEY)
+    {
+      if (err)
+        ;  /* A legacy key is never found by a search.  */
+      else if (pkt.pkttype == PKT_PUBLIC_KEY || pkt.pkttype == PKT_SECRET_KEY)
+        {
+          main_offset = offset;
+          initial_skip = 0;
+        }
+      if (!err && !initial_skip
+          && (pkt.pkttype == PKT_PUBLIC_KEY
+              || pkt.pkttype == PKT_PUBLIC_SUBKEY
+              || pkt.pkttype == PKT_SECRET_KEY
+              || pkt.pkttype == PKT_SECRET_SUBKEY))
+        err = add_key_entries (&e, pkt.pkt.public_key, main_offset);
+      free_packet (&pkt, &parsectx);
+      if (err && gpg_err_code (err) != GPG_ERR_LEGACY_KEY)
+        break;
+    }
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  set_packet_list_mode (save_mode);
+  iobuf_close (a);
+  if (err != -1)
+    {
+      xfree (e.buf);
+      return err;
+    }
+
+  qsort (e.buf + INDEX_HEADER_LEN, e.nentries, INDEX_ENTRY_LEN,
+         cmp_index_entries);
+  h = e.buf;
+  memset (h, 0, INDEX_HEADER_LEN);
+  memcpy (h, "KRXi", 4);
+  h[4] = INDEX_VERSION;
+  put32 (h + 8, e.nentries);
+  put64 (h + 16, stamp->size);
+  put64 (h + 24, stamp->mtime);
+  put64 (h + 32, stamp->ino);
+
+  if (!kr->read_only)
+    write_index (kr->fname, &e);
+
+  idx->image = e.buf;
+  idx->imagelen = INDEX_HEADER_LEN + e.nentries * INDEX_ENTRY_LEN;
+  idx->nentries = e.nentries;
+  if (DBG_KEYDB)
+    log_debug ("%s: indexed %zu keys of '%s'\n",
+               __func__, e.nentries / 2, kr->fname);
+  return 0;
+}
+
+
+/* Check that the index IMAGE of LENGTH bytes is well formed and
+ * matches the keyring described by STAMP.  */
+static int
+check_index_image (const unsigned char *image, size_t length,
+                   const struct kr_index_stamp_s *stamp)
+{
+  size_t nentries;
+
+  if (length < INDEX_HEADER_LEN
+      || memcmp (image, "KRXi", 4) || image[4] != INDEX_VERSION)
+    return 0;
+  nentries = buf32_to_size_t (image + 8);
+  if (length != INDEX_HEADER_LEN + nentries * (uint64_t)INDEX_ENTRY_LEN)
+    return 0;
+  return (get64 (image + 16) == stamp->size
+          && get64 (image + 24) == stamp->mtime
+          && get64 (image + 32) == stamp->ino);
+}
+
+
+/* Map or read the index file of the keyring FNAME into IDX.  */
+static gpg_error_t
+load_index (const char *fname, const struct kr_index_stamp_s *stamp,
+            struct kr_index_s *idx)
+{
+  gpg_error_t err = 0;
+  char *idxname;
+  struct stat st;
+  int fd;
+
+  idxname = index_name (fname);
+  if (!idxname)
+    return gpg_error_from_syserror ();
+  fd = gnupg_open (idxname, O_RDONLY | O_BINARY, 0);
+  xfree (idxname);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (st.st_size < INDEX_HEADER_LEN || (uint64_t)st.st_size > SIZE_MAX)
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+  idx->imagelen = st.st_size;
+
+#ifdef USE_MMAP
+  idx->image = mmap (NULL, idx->imagelen, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (idx->image == MAP_FAILED)
+    idx->image = NULL;
+  else
+    idx->mapped = 1;
+#endif
+  if (!idx->image)
+    {
+      idx->image = xtrymalloc (idx->imagelen);
+      if (!idx->image)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (read (fd, idx->image, idx->imagelen) != (ssize_t)idx->imagelen)
+        {
+          err = gpg_error (GPG_ERR_TOO_SHORT);
+          goto leave;
+        }
+    }
+
+  if (!check_index_image (idx->image, idx->imagelen, stamp))
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+  idx->nentries = buf32_to_size_t (idx->image + 8);
+
+ leave:
+  if (err)
+    release_index_image (idx);
+  close (fd);
+  return err;
+}
+
+
+/* Return a valid index for the keyring currently searched by HD or
+ * NULL.  */
+static struct kr_index_s *
+get_index (KEYRING_HANDLE hd)
+{
+  CONST_KR_RESOURCE kr = hd->current.kr;
+  struct kr_index_s *idx = kr->index;
+  struct kr_index_stamp_s stamp;
+  struct stat st;
+
+  /* Stat the open file so that the index matches what we read.  */
+#ifdef HAVE_W32_SYSTEM
+  if (gnupg_stat (kr->fname, &st))
+    return NULL;
+#else
+  if (iobuf_get_fd (hd->current.iobuf) == GNUPG_INVALID_FD
+      || fstat (iobuf_get_fd (hd->current.iobuf), &st))
+    return NULL;
+#endif
+  stamp_from_stat (&stamp, &st);
+  if ((idx->valid || idx->failed) && same_file_stamp (&stamp, &idx->stamp))
+    return idx->valid? idx : NULL;
+
+  release_index_image (idx);
+  idx->stamp = stamp;
+  if (!load_index (kr->fname, &stamp, idx))
+    {
+      if (DBG_KEYDB)
+        log_debug ("%s: loaded index of '%s'\n", __func__, kr->fname);
+    }
+  else if (build_index (kr, &stamp, idx))
+    {
+      /* Don't try again until the keyring changes.  */
+      idx->failed = 1;
+      return NULL;
+    }
+  idx->valid = 1;
+  return idx;
+}
+
+
+/* Make the index key for the search description DESC.  Returns false
+ * if the index can't be used for DESC.  */
+static int
+make_search_key (KEYDB_SEARCH_DESC *desc, unsigned char *key)
+{
+  memset (key, 0, INDEX_ENTRY_LEN);
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      key[0] = INDEX_TYPE_KID;
+      put32 (key + 1, desc->u.kid[0]);
+      put32 (key + 5, desc->u.kid[1]);
+      return 1;
+    case KEYDB_SEARCH_MODE_FPR:
+      if (desc->fprlen != 20 && desc->fprlen != 32)
+        return 0;
+      key[0] = INDEX_TYPE_FPR;
+      memcpy (key + 1, desc->u.fpr, INDEX_KEY_LEN - 1);
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+/* Position the search of HD at the next keyblock which may match the
+ * single description DESC.  Returns 0 on success, -1 if there is no
+ * such keyblock after the current position, and GPG_ERR_NOT_SUPPORTED
+ * if the index can't be used.  */
+static int
+index_seek (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc)
+{
+  struct kr_index_s *idx;
+  unsigned char key[INDEX_ENTRY_LEN];
+  const unsigned char *entries, *p;
+  size_t lo, hi, mid;
+  off_t pos, off;
+
+  if (!use_index || desc->skipfnc || !make_search_key (desc, key))
+    return GPG_ERR_NOT_SUPPORTED;
+  idx = get_index (hd);
+  if (!idx)
+    return GPG_ERR_NOT_SUPPORTED;
+
+  /* Find the first entry for KEY with an offset not less than the
+   * current position.  The entries of one key are sorted by their
+   * offsets.  */
+  pos = iobuf_tell (hd->current.iobuf);
+  put64 (key + INDEX_OFF_POS, pos);
+  entries = idx->image + INDEX_HEADER_LEN;
+  lo = 0;
+  hi = idx->nentries;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (memcmp (entries + mid * INDEX_ENTRY_LEN, key, INDEX_ENTRY_LEN) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  p = entries + lo * INDEX_ENTRY_LEN;
+  if (lo == idx->nentries || memcmp (p, key, INDEX_KEY_LEN))
+    {
+      if (DBG_KEYDB)
+        log_debug ("%s: index says not present\n", __func__);
+      return -1;
+    }
+
+  off = get64 (p + INDEX_OFF_POS);
+  if (DBG_KEYDB)
+    log_debug ("%s: index says keyblock at offset %lld\n",
+               __func__, (long long)off);
+  if (off != pos && iobuf_seek (hd->current.iobuf, off))
+    {
+      log_error ("can't seek '%s'\n", hd->current.kr->fname);
+      return GPG_ERR_KEYRING_OPEN;
+    }
+  return 0;
+}
+
+
 /*
  * Register a filename for plain keyring files.  ptr is set to a
  * pointer to be used to create a handles etc, or the already-issued
@@ -210,6 +793,7 @@ keyring_register_filename (const char *fname, int read_only, void **ptr)
     kr->lockhd = NULL;
     kr->is_locked = 0;
     kr->did_full_scan = 0;
+    kr->index = xmalloc_clear (sizeof *kr->index);
     /* keep a list of all issued pointers */
     kr->next = kr_resources;
     kr_resources = kr;
@@ -232,6 +816,32 @@ keyring_is_writable (void *token)
 }
 
 
+/* Forget which keys are present in the keyrings.  This is required
+   if another process modified a keyring because the hash is then
+   not complete anymore.  The next full scan fills it again.  */
+void
+keyring_flush_present_hash (void)
+{
+  struct key_present *k, *knext;
+  KR_RESOURCE kr;
+  int i;
+
+  if (key_present_hash)
+    for (i=0; i < KEY_PRESENT_HASH_BUCKETS; i++)
+      {
+        for (k = key_present_hash[i]; k; k = knext)
+          {
+            knext = k->next;
+            xfree (k);
+          }
+        key_present_hash[i] = NULL;
+      }
+  key_present_hash_ready = 0;
+  for (kr=kr_resources; kr; kr = kr->next)
+    kr->did_full_scan = 0;
+}
+
+
 
 /* Create a new handle for the resource associated with TOKEN.
    On error NULL is returned and ERRNO is set.
@@ -372,10 +982,11 @@ keyring_lock (KEYRING_HANDLE hd, int yes)
  * Return the last found keyblock.  Caller must free it.
  * The returned keyblock has the kbode flag bit 0 set for the node with
  * the public key used to locate the keyblock or flag bit 1 set for
- * the user ID node.
+ * the user ID node.  Packets selected by PARSE_MASK are skipped.
  */
 int
-keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
+keyring_get_keyblock (KEYRING_HANDLE hd, unsigned int parse_mask,
+                      KBNODE *ret_kb)
 {
     PACKET *pkt;
     struct parse_packet_ctx_s parsectx;
@@ -406,9 +1017,15 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
 	return GPG_ERR_KEYRING_OPEN;
     }
 
-    pkt = xmalloc (sizeof *pkt);
-    init_packet (pkt);
+    pkt = alloc_kbnode_packet ();
+    if (!pkt)
+      {
+        rc = gpg_error_from_syserror ();
+        iobuf_close (a);
+        return rc;
+      }
     init_parse_packet (&parsectx, a);
+    parsectx.parse_mask = parse_mask;
     hd->found.n_packets = 0;
     lastnode = NULL;
     save_mode = set_packet_list_mode(0);
@@ -500,8 +1117,11 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
             break;
           }
 
-        pkt = xmalloc (sizeof *pkt);
-        init_packet(pkt);
+        pkt = alloc_kbnode_packet ();
+        if (!pkt) {
+            rc = gpg_error_from_syserror ();
+            break;
+        }
     }
     set_packet_list_mode(save_mode);
 
@@ -540,7 +1160,7 @@ keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb)
 
     if (!hd->found.n_packets) {
         /* need to know the number of packets - do a dummy get_keyblock*/
-        rc = keyring_get_keyblock (hd, NULL);
+        rc = keyring_get_keyblock (hd, 0, NULL);
         if (rc) {
             log_error ("re-reading keyblock failed: %s\n", gpg_strerror (rc));
             return rc;
@@ -627,7 +1247,7 @@ keyring_delete_keyblock (KEYRING_HANDLE hd)
 
     if (!hd->found.n_packets) {
         /* need to know the number of packets - do a dummy get_keyblock*/
-        rc = keyring_get_keyblock (hd, NULL);
+        rc = keyring_get_keyblock (hd, 0, NULL);
         if (rc) {
             log_error ("re-reading keyblock failed: %s\n", gpg_strerror (rc));
             return rc;
@@ -1067,6 +1687,23 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
        */
     }
 
+  if (ndesc == 1)
+    {
+      rc = index_seek (hd, desc);
+      if (rc == -1)
+        {
+          hd->found.kr = NULL;
+          hd->current.eof = 1;
+          return -1;
+        }
+      else if (rc && rc != GPG_ERR_NOT_SUPPORTED)
+        {
+          hd->current.error = rc;
+          return rc;
+        }
+      rc = 0;
+    }
+
   if (need_words)
     {
       const char *name = NULL;
@@ -1371,6 +2008,8 @@ rename_tmp_file (const char *bakfname, const char *tmpfname, const char *fname)
       goto fail;
     }
 
+  remove_index (fname);
+
   /* Now make sure the file has the same permissions as the original */
 #ifndef HAVE_DOSISH_SYSTEM
   {
@@ -1481,7 +2120,7 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
         }
 
       release_kbnode (keyblock);
-      rc = keyring_get_keyblock (hd, &keyblock);
+      rc = keyring_get_keyblock (hd, 0, &keyblock);
       if (rc)
         {
           if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
@@ -1659,6 +2298,7 @@ do_copy (int mode, const char *fname, KBNODE root,
 	    log_error ("%s: close failed: %s\n", fname, strerror(errno));
 	    return rc;
 	}
+        remove_index (fname);
 	return 0; /* ready */
     }
 
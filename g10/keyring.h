@@ -26,6 +26,8 @@ typedef struct keyring_handle *KEYRING_HANDLE;
 
 int keyring_register_filename (const char *fname, int read_only, void **ptr);
 int keyring_is_writable (void *token);
+void keyring_flush_present_hash (void);
+void keyring_set_use_index (int yes);
 
 KEYRING_HANDLE keyring_new (void *token);
 void keyring_release (KEYRING_HANDLE hd);
@@ -33,7 +35,8 @@ void keyring_push_found_state (KEYRING_HANDLE hd);
 void keyring_pop_found_state (KEYRING_HANDLE hd);
 const char *keyring_get_resource_name (KEYRING_HANDLE hd);
 int keyring_lock (KEYRING_HANDLE hd, int yes);
-int keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb);
+int keyring_get_keyblock (KEYRING_HANDLE hd, unsigned int parse_mask,
+                          KBNODE *ret_kb);
 int keyring_update_keyblock (KEYRING_HANDLE hd, KBNODE kb);
 int keyring_insert_keyblock (KEYRING_HANDLE hd, KBNODE kb);
 int keyring_delete_keyblock (KEYRING_HANDLE hd);
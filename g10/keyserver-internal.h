@@ -27,6 +27,7 @@
 /* Flags for the keyserver import functions.  */
 #define KEYSERVER_IMPORT_FLAG_QUICK 1
 #define KEYSERVER_IMPORT_FLAG_LDAP  2
+#define KEYSERVER_IMPORT_FLAG_IF_CHANGED 4
 
 int parse_keyserver_options(char *options);
 void free_keyserver_spec(struct keyserver_spec *keyserver);
@@ -59,5 +60,17 @@ gpg_error_t keyserver_import_mbox (ctrl_t ctrl, const char *mbox,
                                    unsigned char **fpr,size_t *fpr_len,
                                    struct keyserver_spec *keyserver,
                                    unsigned int flags);
+void keyserver_prefetch_cert (ctrl_t ctrl, const char *name, int dane_mode);
+void keyserver_prefetch_wkd (ctrl_t ctrl, const char *name,
+                             unsigned int flags);
+void keyserver_prefetch_mbox (ctrl_t ctrl, const char *mbox,
+                              struct keyserver_spec *keyserver,
+                              unsigned int flags);
+void keyserver_prefetch_fpr (ctrl_t ctrl, const byte *fpr, size_t fprlen,
+                             struct keyserver_spec *keyserver,
+                             unsigned int flags);
+void keyserver_prefetch_ntds (ctrl_t ctrl, const char *mbox,
+                              const byte *fpr, size_t fprlen);
+void keyserver_prefetch_cancel (ctrl_t ctrl);
 
 #endif /* !_KEYSERVER_INTERNAL_H_ */
@@ -99,6 +99,8 @@ static struct parse_options keyserver_opts[]=
      N_("automatically retrieve keys when verifying signatures")},
     {"honor-keyserver-url",KEYSERVER_HONOR_KEYSERVER_URL,NULL,
      N_("honor the preferred keyserver URL set on the key")},
+    {"refresh-if-changed",KEYSERVER_REFRESH_IF_CHANGED,NULL,
+     NULL},
     {NULL,0,NULL,NULL}
   };
 
@@ -1183,6 +1185,8 @@ keyserver_refresh (ctrl_t ctrl, strlist_t users)
   int count, numdesc;
   KEYDB_SEARCH_DESC *desc;
   unsigned int options=opt.keyserver_options.import_options;
+  unsigned int flags = 0;
+  int batch = 0;
 
   /* We switch merge-only on during a refresh, as 'refresh' should
      never import new keys, even if their keyids match. */
@@ -1194,11 +1198,26 @@ keyserver_refresh (ctrl_t ctrl, strlist_t users)
      the end here. */
   opt.keyserver_options.import_options|=IMPORT_FAST;
 
+  /* Let the dirmngr skip the keys which did not change since it
+     fetched them the last time.  */
+  if ((opt.keyserver_options.options & KEYSERVER_REFRESH_IF_CHANGED))
+    flags |= KEYSERVER_IMPORT_FLAG_IF_CHANGED;
 
   err = keyidlist (ctrl, users, &desc, &numdesc);
   if (err)
     return err;
 
+  /* With bulk import all refreshed keys are written in one batch.  */
+  if ((options & IMPORT_BULK) && numdesc > 0)
+    {
+      err = keydb_begin_batch (ctrl);
+      if (err)
+        log_info ("error starting a key database batch: %s\n",
+                  gpg_strerror (err));
+      else
+        batch = 1;
+    }
+
   count=numdesc;
   if(count>0)
     {
@@ -1219,7 +1238,8 @@ keyserver_refresh (ctrl_t ctrl, strlist_t users)
 	      /* We use the keyserver structure we parsed out before.
 		 Note that a preferred keyserver without a scheme://
 		 will be interpreted as hkp:// */
-	      err = keyserver_get (ctrl, &desc[i], 1, keyserver, 0, NULL, NULL);
+	      err = keyserver_get (ctrl, &desc[i], 1, keyserver, flags,
+                                   NULL, NULL);
 	      if (err)
 		log_info(_("WARNING: unable to refresh key %s"
 			   " via %s: %s\n"),keystr_from_desc(&desc[i]),
@@ -1253,12 +1273,15 @@ keyserver_refresh (ctrl_t ctrl, strlist_t users)
             }
           xfree (tmpuri);
 
-          err = keyserver_get (ctrl, desc, numdesc, NULL, 0, NULL, NULL);
+          err = keyserver_get (ctrl, desc, numdesc, NULL, flags, NULL, NULL);
         }
     }
 
   xfree(desc);
 
+  if (batch)
+    keydb_end_batch ();
+
   opt.keyserver_options.import_options=options;
 
   /* If the original options didn't have fast import, and the trustdb
@@ -1499,7 +1522,9 @@ keyserver_get_chunk (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, int ndesc,
 
 
 
-  if (!err)
+  if (!err && !datastream)
+    ; /* With KEYSERVER_IMPORT_FLAG_IF_CHANGED no key changed.  */
+  else if (!err)
     {
       struct ks_retrieval_screener_arg_s screenerarg;
       unsigned int options;
@@ -1864,3 +1889,100 @@ keyserver_import_wkd (ctrl_t ctrl, const char *name, unsigned int flags,
   xfree (mbox);
   return err;
 }
+
+
+
+/* The next functions start the dirmngr request done by the
+ * corresponding keyserver_import function so that it runs while the
+ * caller is still busy with other mechanisms.  The import function
+ * then takes the result.  Errors are ignored because the import
+ * function then does the request the regular way.  */
+
+/* Start the request of keyserver_import_cert.  */
+void
+keyserver_prefetch_cert (ctrl_t ctrl, const char *name, int dane_mode)
+{
+  char *look, *domain;
+
+  look = xtrystrdup (name);
+  if (!look)
+    return;
+  if (!dane_mode && (domain = strrchr (look, '@')))
+    *domain = '.';
+  gpg_dirmngr_prefetch_dns_cert (ctrl, look, dane_mode? NULL : "*");
+  xfree (look);
+}
+
+
+/* Start the request of keyserver_import_wkd.  */
+void
+keyserver_prefetch_wkd (ctrl_t ctrl, const char *name, unsigned int flags)
+{
+  char *mbox;
+
+  mbox = mailbox_from_userid (name, 0);
+  if (!mbox)
+    return;
+  gpg_dirmngr_prefetch_wkd_get (ctrl, mbox, flags);
+  xfree (mbox);
+}
+
+
+/* Start the request of keyserver_import_mbox.  */
+void
+keyserver_prefetch_mbox (ctrl_t ctrl, const char *mbox,
+                         struct keyserver_spec *keyserver, unsigned int flags)
+{
+  char *pattern;
+
+  /* This is the pattern keyserver_get_chunk creates.  */
+  if (*mbox == '<')
+    pattern = xtrystrdup (mbox);
+  else
+    pattern = strconcat ("<", mbox, ">", NULL);
+  if (!pattern)
+    return;
+  gpg_dirmngr_prefetch_ks_get (ctrl, pattern, keyserver, flags);
+  xfree (pattern);
+}
+
+
+/* Start the request of keyserver_import_fpr.  */
+void
+keyserver_prefetch_fpr (ctrl_t ctrl, const byte *fpr, size_t fprlen,
+                        struct keyserver_spec *keyserver, unsigned int flags)
+{
+  char pattern[2 + 2 * MAX_FINGERPRINT_LEN + 1];
+
+  if (fprlen != 16 && fprlen != 20 && fprlen != 32)
+    return;
+
+  strcpy (pattern, "0x");
+  bin2hex (fpr, fprlen, pattern + 2);
+  gpg_dirmngr_prefetch_ks_get (ctrl, pattern, keyserver, flags);
+}
+
+
+/* Start the request of keyserver_import_ntds or, if FPR is not NULL,
+ * of keyserver_import_fpr_ntds.  */
+void
+keyserver_prefetch_ntds (ctrl_t ctrl, const char *mbox,
+                         const byte *fpr, size_t fprlen)
+{
+  struct keyserver_spec keyserver = { NULL, "ldap:///" };
+
+  if (fpr)
+    keyserver_prefetch_fpr (ctrl, fpr, fprlen,
+                            &keyserver, KEYSERVER_IMPORT_FLAG_LDAP);
+  else
+    keyserver_prefetch_mbox (ctrl, mbox, &keyserver, 0);
+}
+
+
+/* Cancel the requests started by the keyserver_prefetch functions
+ * which have not been used.  */
+void
+keyserver_prefetch_cancel (ctrl_t ctrl)
+{
+  gpg_dirmngr_prefetch_cancel (ctrl);
+}
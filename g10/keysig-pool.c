@@ -0,0 +1,431 @@
+/* keysig-pool.c - Worker threads to check key signatures
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Nearly all the time of an import is spent in the public key
+ * operations of the self-signature checks.  These checks are
+ * independent of each other.  This module first computes the digests
+ * of all self-signatures of a keyblock in the main thread and then
+ * runs the public key operations on a set of worker threads.  The
+ * results are cached in the signature packets the same way
+ * check_key_signature does, so that the following regular checks by
+ * chk_self_sigs in import.c only evaluate those cached results.
+ * Signatures which are not simple self-signatures or which would
+ * print a diagnostic are left to the regular check.  The workers only
+ * read the public key parameters and the signature values which are
+ * not modified while they run.
+ *
+ * The key listing does the same for a batch of keyblocks and, with
+ * --check-sigs, also for the user id certifications by other keys.
+ * The signing keys of those are looked up in the main thread before
+ * the workers are started.
+ *
+ * With --batch-verify the Ed25519 signatures are first verified in
+ * batches by the main thread; only those which could not be verified
+ * that way are passed to the workers.  This is also done with only
+ * one thread.
+ *
+ * The signatures of a message are verified the same way by
+ * keysig_pool_verify_items; there the caller computes the values to
+ * verify and remembers the results.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "options.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "pkglue.h"
+#include "keysig-pool.h"
+#include "sigbatch.h"
+
+
+/* Do not start threads for fewer signatures than this.  */
+#define MIN_JOBS 4
+
+
+struct keysig_job_s
+{
+  kbnode_t root;           /* The keyblock.  */
+  kbnode_t node;           /* The signature.  */
+  PKT_public_key *signer;  /* The signing key or NULL for a self-sig.  */
+  gcry_mpi_t hash;         /* The value to verify.  */
+  int rc;                  /* The result of pk_verify.  */
+  int done;                /* Already verified in a batch.  */
+};
+
+
+struct keysig_pool_s
+{
+  npth_mutex_t mutex;
+  unsigned int next;       /* The next job to process.  */
+  unsigned int njobs;
+  struct keysig_job_s *jobs;
+};
+
+
+/* Process jobs until all are done.  This is run by the workers and
+ * by the main thread.  */
+static void *
+keysig_worker (void *arg)
+{
+  struct keysig_pool_s *pool = arg;
+  struct keysig_job_s *job;
+  PKT_public_key *pk;
+  int rc;
+
+  for (;;)
+    {
+      rc = npth_mutex_lock (&pool->mutex);
+      if (rc)
+        log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+                   gpg_strerror (gpg_error_from_errno (rc)));
+      job = pool->next < pool->njobs? pool->jobs + pool->next++ : NULL;
+      rc = npth_mutex_unlock (&pool->mutex);
+      if (rc)
+        log_fatal ("%s: failed to release mutex: %s\n", __func__,
+                   gpg_strerror (gpg_error_from_errno (rc)));
+      if (!job)
+        break;
+      if (job->done)
+        continue;
+
+      pk = job->signer? job->signer : job->root->pkt->pkt.public_key;
+      npth_unprotect ();
+      job->rc = pk_verify (pk->pubkey_algo, job->hash,
+                           job->node->pkt->pkt.signature->data, pk->pkey);
+      npth_protect ();
+    }
+
+  return NULL;
+}
+
+
+/* Return a copy of the key which issued the user id certification
+ * SIG on a key in KEYBLOCK or NULL if that is not available.  */
+static PKT_public_key *
+get_certifier (ctrl_t ctrl, kbnode_t keyblock, PKT_signature *sig)
+{
+  PKT_public_key *signer;
+  kbnode_t n;
+
+  /* Certifications by a subkey are left to the regular check.  */
+  for (n = keyblock; n; n = n->next)
+    if ((n->pkt->pkttype == PKT_PUBLIC_KEY
+         || n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        && !keyid_cmp (pk_keyid (n->pkt->pkt.public_key), sig->keyid))
+      return NULL;
+
+  signer = xtrycalloc (1, sizeof *signer);
+  if (!signer)
+    return NULL;
+  signer->req_usage = PUBKEY_USAGE_CERT;
+  if (get_pubkey_for_sig (ctrl, signer, sig, NULL))
+    {
+      free_public_key (signer);
+      return NULL;
+    }
+  return signer;
+}
+
+
+/* Add the jobs for the signatures of KEYBLOCK to POOL.  With CTRL
+ * given user id certifications by other keys are also added.  */
+static void
+add_keyblock_jobs (ctrl_t ctrl, struct keysig_pool_s *pool, kbnode_t keyblock)
+{
+  kbnode_t n, target;
+  kbnode_t unode = NULL;
+  kbnode_t knode = NULL;
+  PKT_public_key *signer;
+  PKT_signature *sig;
+  gcry_mpi_t hash;
+
+  /* The target of a signature is determined the same way
+   * check_key_signature2 does it.  */
+  for (n = keyblock->next; n; n = n->next)
+    {
+      if (n->pkt->pkttype == PKT_USER_ID)
+        unode = n;
+      else if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        knode = n;
+      if (n->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+
+      sig = n->pkt->pkt.signature;
+      if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+        target = keyblock;
+      else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+        target = knode;
+      else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+        target = unode;
+      else
+        target = NULL;
+      if (!target || sig->flags.checked)
+        continue;
+
+      signer = NULL;
+      if (keyid_cmp (pk_keyid (keyblock->pkt->pkt.public_key), sig->keyid))
+        {
+          if (!ctrl || target != unode
+              || !(signer = get_certifier (ctrl, keyblock, sig)))
+            continue;
+        }
+      if (prepare_key_sig_check (keyblock, n, target->pkt, signer, &hash))
+        {
+          free_public_key (signer);
+          continue;
+        }
+      pool->jobs[pool->njobs].root = keyblock;
+      pool->jobs[pool->njobs].node = n;
+      pool->jobs[pool->njobs].signer = signer;
+      pool->jobs[pool->njobs].hash = hash;
+      pool->njobs++;
+    }
+}
+
+
+/* Verify the Ed25519 signatures of the jobs in POOL in batches and
+ * mark the valid ones as done.  Returns the number of jobs which are
+ * not done.  */
+static unsigned int
+batch_verify_jobs (struct keysig_pool_s *pool)
+{
+  struct sigbatch_item_s *items;
+  PKT_public_key *pk;
+  unsigned int i;
+  unsigned int nleft = pool->njobs;
+
+  items = xtrycalloc (pool->njobs, sizeof *items);
+  if (!items)
+    return nleft;
+  for (i = 0; i < pool->njobs; i++)
+    {
+      pk = (pool->jobs[i].signer? pool->jobs[i].signer
+            : pool->jobs[i].root->pkt->pkt.public_key);
+      items[i].pubkey_algo = pk->pubkey_algo;
+      items[i].pkey = pk->pkey;
+      items[i].hash = pool->jobs[i].hash;
+      items[i].data = pool->jobs[i].node->pkt->pkt.signature->data;
+    }
+  sigbatch_verify (items, pool->njobs);
+  for (i = 0; i < pool->njobs; i++)
+    if (items[i].verified)
+      {
+        pool->jobs[i].rc = 0;
+        pool->jobs[i].done = 1;
+        nleft--;
+      }
+  xfree (items);
+  return nleft;
+}
+
+
+/* Check the signatures of the NKEYBLOCKS keyblocks at KEYBLOCKS using
+ * NTHREADS threads and cache the results in the signature packets.
+ * Only self-signatures are checked unless CTRL is given; then user id
+ * certifications by other keys which are available are checked as
+ * well.  NTHREADS is limited to KEYSIG_POOL_MAX_THREADS; with less
+ * than 2 threads the main thread does all checks.  Errors are
+ * not returned; signatures not checked here are checked later by the
+ * regular code.  */
+void
+keysig_pool_check_keyblocks (ctrl_t ctrl, kbnode_t *keyblocks,
+                             unsigned int nkeyblocks, unsigned int nthreads)
+{
+  struct keysig_pool_s pool;
+  npth_t thds[KEYSIG_POOL_MAX_THREADS];
+  npth_attr_t tattr;
+  unsigned int nthds = 0;
+  unsigned int nleft;
+  unsigned int i;
+  kbnode_t n;
+  int rc;
+
+  if ((nthreads < 2 && !opt.batch_verify) || opt.no_sig_cache)
+    return;
+  if (!nthreads)
+    nthreads = 1;
+  if (nthreads > KEYSIG_POOL_MAX_THREADS)
+    nthreads = KEYSIG_POOL_MAX_THREADS;
+
+  memset (&pool, 0, sizeof pool);
+  for (i = 0; i < nkeyblocks; i++)
+    {
+      if (keyblocks[i]->pkt->pkttype != PKT_PUBLIC_KEY)
+        continue;
+      for (n = keyblocks[i]->next; n; n = n->next)
+        if (n->pkt->pkttype == PKT_SIGNATURE)
+          pool.njobs++;
+    }
+  if (pool.njobs < MIN_JOBS)
+    return;
+  pool.jobs = xtrycalloc (pool.njobs, sizeof *pool.jobs);
+  if (!pool.jobs)
+    return;
+
+  pool.njobs = 0;
+  for (i = 0; i < nkeyblocks; i++)
+    if (keyblocks[i]->pkt->pkttype == PKT_PUBLIC_KEY)
+      add_keyblock_jobs (ctrl, &pool, keyblocks[i]);
+  if (pool.njobs < MIN_JOBS)
+    goto leave;
+
+  nleft = opt.batch_verify? batch_verify_jobs (&pool) : pool.njobs;
+
+  rc = npth_mutex_init (&pool.mutex, NULL);
+  if (rc)
+    goto leave;
+
+  /* The main thread is one of the workers.  */
+  if (nthreads > nleft)
+    nthreads = nleft? nleft : 1;
+  if (!npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; nthds < nthreads - 1; nthds++)
+        if (npth_create (thds + nthds, &tattr, keysig_worker, &pool))
+          break;
+      npth_attr_destroy (&tattr);
+    }
+  keysig_worker (&pool);
+  for (i = 0; i < nthds; i++)
+    npth_join (thds[i], NULL);
+  npth_mutex_destroy (&pool.mutex);
+
+  for (i = 0; i < pool.njobs; i++)
+    finish_key_sig_check (pool.jobs[i].root, pool.jobs[i].node,
+                          pool.jobs[i].signer, pool.jobs[i].hash,
+                          pool.jobs[i].rc);
+
+ leave:
+  for (i = 0; i < pool.njobs; i++)
+    {
+      gcry_mpi_release (pool.jobs[i].hash);
+      free_public_key (pool.jobs[i].signer);
+    }
+  xfree (pool.jobs);
+}
+
+
+struct item_pool_s
+{
+  npth_mutex_t mutex;
+  unsigned int next;       /* The next item to process.  */
+  unsigned int nitems;
+  struct sigbatch_item_s *items;
+};
+
+
+/* Process items until all are done.  This is run by the workers and
+ * by the main thread.  */
+static void *
+item_worker (void *arg)
+{
+  struct item_pool_s *pool = arg;
+  struct sigbatch_item_s *item;
+  int rc;
+
+  for (;;)
+    {
+      rc = npth_mutex_lock (&pool->mutex);
+      if (rc)
+        log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+                   gpg_strerror (gpg_error_from_errno (rc)));
+      item = pool->next < pool->nitems? pool->items + pool->next++ : NULL;
+      rc = npth_mutex_unlock (&pool->mutex);
+      if (rc)
+        log_fatal ("%s: failed to release mutex: %s\n", __func__,
+                   gpg_strerror (gpg_error_from_errno (rc)));
+      if (!item)
+        break;
+      if (item->verified)
+        continue;
+
+      npth_unprotect ();
+      item->verified = !pk_verify (item->pubkey_algo, item->hash,
+                                   item->data, item->pkey);
+      npth_protect ();
+    }
+
+  return NULL;
+}
+
+
+/* Verify those of the NITEMS signatures at ITEMS which are not yet
+ * marked as verified using NTHREADS threads and set the VERIFIED
+ * flag of the valid ones.  NTHREADS is limited to
+ * KEYSIG_POOL_MAX_THREADS; nothing is done with less than 2 threads
+ * or when the threads can't be started.  */
+void
+keysig_pool_verify_items (struct sigbatch_item_s *items, unsigned int nitems,
+                          unsigned int nthreads)
+{
+  struct item_pool_s pool;
+  npth_t thds[KEYSIG_POOL_MAX_THREADS];
+  npth_attr_t tattr;
+  unsigned int nthds = 0;
+  unsigned int i, nleft;
+
+  for (i = nleft = 0; i < nitems; i++)
+    if (!items[i].verified)
+      nleft++;
+  if (nthreads < 2 || nleft < 2)
+    return;
+  if (nthreads > KEYSIG_POOL_MAX_THREADS)
+    nthreads = KEYSIG_POOL_MAX_THREADS;
+  if (nthreads > nleft)
+    nthreads = nleft;
+
+  memset (&pool, 0, sizeof pool);
+  pool.nitems = nitems;
+  pool.items = items;
+  if (npth_mutex_init (&pool.mutex, NULL))
+    return;
+
+  /* The main thread is one of the workers.  */
+  if (!npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; nthds < nthreads - 1; nthds++)
+        if (npth_create (thds + nthds, &tattr, item_worker, &pool))
+          break;
+      npth_attr_destroy (&tattr);
+    }
+  if (nthds)
+    item_worker (&pool);
+  for (i = 0; i < nthds; i++)
+    npth_join (thds[i], NULL);
+  npth_mutex_destroy (&pool.mutex);
+}
+
+
+/* Check the self-signatures of KEYBLOCK using NTHREADS threads and
+ * cache the results in the signature packets.  See
+ * keysig_pool_check_keyblocks.  */
+void
+keysig_pool_check_self_sigs (kbnode_t keyblock, unsigned int nthreads)
+{
+  keysig_pool_check_keyblocks (NULL, &keyblock, 1, nthreads);
+}
@@ -0,0 +1,36 @@
+/* keysig-pool.h - Worker threads to check key signatures
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_KEYSIG_POOL_H
+#define G10_KEYSIG_POOL_H
+
+/* The maximum number of worker threads.  */
+#define KEYSIG_POOL_MAX_THREADS 64
+
+
+struct sigbatch_item_s;
+
+/*-- keysig-pool.c --*/
+void keysig_pool_check_self_sigs (kbnode_t keyblock, unsigned int nthreads);
+void keysig_pool_check_keyblocks (ctrl_t ctrl, kbnode_t *keyblocks,
+                                  unsigned int nkeyblocks,
+                                  unsigned int nthreads);
+void keysig_pool_verify_items (struct sigbatch_item_s *items,
+                               unsigned int nitems, unsigned int nthreads);
+
+#endif /*G10_KEYSIG_POOL_H*/
@@ -49,6 +49,7 @@
 #include "main.h"
 #include "options.h"
 #include "keydb.h"
+#include "keyring.h"
 #include "trustdb.h"
 #include "filter.h"
 #include "../common/ttyio.h"
@@ -62,12 +63,18 @@
 #include "call-dirmngr.h"
 #include "tofu.h"
 #include "objcache.h"
+#include "sig-cache.h"
+#include "ecdh-pool.h"
+#include "sigbatch.h"
 #include "../common/init.h"
 #include "../common/mbox-util.h"
 #include "../common/zb32.h"
 #include "../common/shareddefs.h"
 #include "../common/compliance.h"
 #include "../common/comopt.h"
+#include "../common/tstats.h"
+#include "../common/memstat.h"
+#include "../common/starttrace.h"
 #include "../kbx/keybox.h"
 
 #if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
@@ -107,7 +114,15 @@ enum cmd_and_opt_values
     oBatch	  = 500,
     oMaxOutput,
     oInputSizeHint,
+    oInputMmapThreshold,
+    oAsyncIO,
     oChunkSize,
+    oAEADThreads,
+    oImportThreads,
+    oListThreads,
+    oVerifyThreads,
+    oBatchVerify,
+    oParallelKeygen,
     oSigNotation,
     oCertNotation,
     oShowNotation,
@@ -240,6 +255,7 @@ enum cmd_and_opt_values
     oDebugSetIobufSize,
     oDebugAllowLargeChunks,
     oDebugIgnoreExpiration,
+    oTimingStats,
     oStatusFD,
     oStatusFile,
     oAttributeFD,
@@ -269,6 +285,13 @@ enum cmd_and_opt_values
     oCompressLevel,
     oBZ2CompressLevel,
     oBZ2DecompressLowmem,
+    oCompressThreads,
+    oCompressAdaptive,
+    oHashThreads,
+    oEncryptThreads,
+    oEphemeralKeyPool,
+    oPipelineFilters,
+    oMultifileJobs,
     oPassphrase,
     oPassphraseFD,
     oPassphraseFile,
@@ -279,6 +302,8 @@ enum cmd_and_opt_values
     oQuickRandom,
     oNoVerbose,
     oTrustDBName,
+    oTrustDBCacheSize,
+    oPkCacheSize,
     oNoSecmemWarn,
     oRequireSecmem,
     oNoRequireSecmem,
@@ -357,6 +382,7 @@ enum cmd_and_opt_values
     oNoAllowFreeformUID,
     oAllowSecretKeyImport,
     oAllowOldCipherAlgos,
+    oAllowZstdCompression,
     oEnableSpecialFilenames,
     oDisableFdTranslation,
     oNoLiteral,
@@ -388,6 +414,8 @@ enum cmd_and_opt_values
     oFixedListMode,
     oLegacyListMode,
     oNoSigCache,
+    oPersistentSigCache,
+    oPersistentUidCache,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
     oPreservePermissions,
@@ -417,6 +445,7 @@ enum cmd_and_opt_values
     oMultifile,
     oKeyidFormat,
     oExitOnStatusWriteError,
+    oBufferedStatus,
     oLimitCardInsertTries,
     oReaderPort,
     octapiDriver,
@@ -426,6 +455,7 @@ enum cmd_and_opt_values
     oNoRequireCrossCert,
     oAutoKeyLocate,
     oNoAutoKeyLocate,
+    oAutoKeyLocateParallel,
     oEnableLargeRSA,
     oDisableLargeRSA,
     oEnableDSA2,
@@ -460,6 +490,8 @@ enum cmd_and_opt_values
     oAssertSigner,
     oAssertPubkeyAlgo,
     oKbxBufferSize,
+    oKeyboxIndex,
+    oKeyboxAppendUpdates,
     oRequirePQCEncryption,
     oDisablePQCEncryption,
     oProcAllSigs,
@@ -614,6 +646,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDebugIOLBF, "debug-iolbf", "@"),
   ARGPARSE_s_u (oDebugSetIobufSize, "debug-set-iobuf-size", "@"),
   ARGPARSE_s_u (oDebugAllowLargeChunks, "debug-allow-large-chunks", "@"),
+  ARGPARSE_s_n (oTimingStats, "timing-stats", "@"),
   ARGPARSE_s_s (oDisplayCharset, "display-charset", "@"),
   ARGPARSE_s_s (oDisplayCharset, "charset", "@"),
   ARGPARSE_conffile (oOptions, "options", N_("|FILE|read options from FILE")),
@@ -669,6 +702,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oKeyboxdProgram, "keyboxd-program", "@"),
   ARGPARSE_s_s (oDirmngrProgram, "dirmngr-program", "@"),
   ARGPARSE_s_n (oExitOnStatusWriteError, "exit-on-status-write-error", "@"),
+  ARGPARSE_s_n (oBufferedStatus, "buffered-status", "@"),
   ARGPARSE_s_i (oLimitCardInsertTries, "limit-card-insert-tries", "@"),
   ARGPARSE_s_n (oEnableProgressFilter, "enable-progress-filter", "@"),
   ARGPARSE_s_s (oTempDir,  "temp-directory", "@"),
@@ -722,6 +756,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_i (oMaxCertDepth,	"max-cert-depth", "@" ),
 #ifndef NO_TRUST_MODELS
   ARGPARSE_s_s (oTrustDBName, "trustdb-name", "@"),
+  ARGPARSE_s_u (oTrustDBCacheSize, "trustdb-cache-size", "@"),
   ARGPARSE_s_n (oAutoCheckTrustDB, "auto-check-trustdb", "@"),
   ARGPARSE_s_n (oNoAutoCheckTrustDB, "no-auto-check-trustdb", "@"),
   ARGPARSE_s_s (oForceOwnertrust, "force-ownertrust", "@"),
@@ -734,7 +769,10 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_header ("Input", N_("Options controlling the input")),
 
   ARGPARSE_s_n (oMultifile, "multifile", "@"),
+  ARGPARSE_s_u (oMultifileJobs, "multifile-jobs", "@"),
   ARGPARSE_s_s (oInputSizeHint, "input-size-hint", "@"),
+  ARGPARSE_s_u (oInputMmapThreshold, "input-mmap-threshold", "@"),
+  ARGPARSE_s_n (oAsyncIO, "async-io", "@"),
   ARGPARSE_s_n (oUtf8Strings,      "utf8-strings", "@"),
   ARGPARSE_s_n (oNoUtf8Strings, "no-utf8-strings", "@"),
   ARGPARSE_p_u (oSetFilesize, "set-filesize", "@"),
@@ -783,6 +821,12 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oMangleDosFilenames,      "mangle-dos-filenames", "@"),
   ARGPARSE_s_n (oNoMangleDosFilenames, "no-mangle-dos-filenames", "@"),
   ARGPARSE_s_i (oChunkSize, "chunk-size", "@"),
+  ARGPARSE_s_u (oAEADThreads, "aead-threads", "@"),
+  ARGPARSE_s_u (oImportThreads, "import-threads", "@"),
+  ARGPARSE_s_u (oListThreads, "list-threads", "@"),
+  ARGPARSE_s_u (oVerifyThreads, "verify-threads", "@"),
+  ARGPARSE_s_n (oBatchVerify, "batch-verify", "@"),
+  ARGPARSE_s_n (oParallelKeygen, "parallel-keygen", "@"),
   ARGPARSE_s_n (oNoSymkeyCache, "no-symkey-cache", "@"),
   ARGPARSE_s_n (oSkipVerify, "skip-verify", "@"),
   ARGPARSE_s_n (oListOnly, "list-only", "@"),
@@ -790,6 +834,12 @@ static gpgrt_opt_t opts[] = {
                 N_("|N|set compress level to N (0 disables)")),
   ARGPARSE_s_i (oCompressLevel, "compress-level", "@"),
   ARGPARSE_s_i (oBZ2CompressLevel, "bzip2-compress-level", "@"),
+  ARGPARSE_s_u (oCompressThreads, "compress-threads", "@"),
+  ARGPARSE_s_n (oCompressAdaptive, "compress-adaptive", "@"),
+  ARGPARSE_s_u (oHashThreads, "hash-threads", "@"),
+  ARGPARSE_s_u (oEncryptThreads, "encrypt-threads", "@"),
+  ARGPARSE_s_u (oEphemeralKeyPool, "ephemeral-key-pool", "@"),
+  ARGPARSE_s_n (oPipelineFilters, "pipeline-filters", "@"),
   ARGPARSE_s_n (oDisableSignerUID, "disable-signer-uid", "@"),
 
   ARGPARSE_header ("ImportExport",
@@ -798,6 +848,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oAutoKeyLocate, "auto-key-locate",
               N_("|MECHANISMS|use MECHANISMS to locate keys by mail address")),
   ARGPARSE_s_n (oNoAutoKeyLocate, "no-auto-key-locate", "@"),
+  ARGPARSE_s_n (oAutoKeyLocateParallel, "auto-key-locate-parallel", "@"),
   ARGPARSE_s_n (oAutoKeyImport,   "auto-key-import",
                 N_("import missing key from a signature")),
   ARGPARSE_s_n (oNoAutoKeyImport, "no-auto-key-import", "@"),
@@ -893,10 +944,14 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oAllowWeakKeySignatures, "allow-weak-key-signatures", "@"),
   ARGPARSE_s_n (oAllowWeakDigestAlgos, "allow-weak-digest-algos", "@"),
   ARGPARSE_s_n (oAllowOldCipherAlgos, "allow-old-cipher-algos", "@"),
+  ARGPARSE_s_n (oAllowZstdCompression, "allow-zstd-compression", "@"),
   ARGPARSE_s_s (oWeakDigest, "weak-digest","@"),
   ARGPARSE_s_s (oVerifyOptions, "verify-options", "@"),
   ARGPARSE_s_n (oNoRandomSeedFile,  "no-random-seed-file", "@"),
   ARGPARSE_s_n (oNoSigCache,         "no-sig-cache", "@"),
+  ARGPARSE_s_n (oPersistentSigCache, "persistent-sig-cache", "@"),
+  ARGPARSE_s_n (oPersistentUidCache, "persistent-uid-cache", "@"),
+  ARGPARSE_s_u (oPkCacheSize,        "pk-cache-size", "@"),
   ARGPARSE_s_n (oIgnoreTimeConflict, "ignore-time-conflict", "@"),
   ARGPARSE_s_n (oIgnoreValidFrom,    "ignore-valid-from", "@"),
   ARGPARSE_s_n (oIgnoreCrcError, "ignore-crc-error", "@"),
@@ -943,6 +998,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oChUid,      "chuid",      "@"),
   ARGPARSE_s_n (oNoAutostart, "no-autostart", "@"),
   ARGPARSE_s_n (oUseKeyboxd,    "use-keyboxd", "@"),
+  ARGPARSE_s_n (oKeyboxIndex,   "keybox-index", "@"),
+  ARGPARSE_s_n (oKeyboxAppendUpdates, "keybox-append-updates", "@"),
   ARGPARSE_s_n (oForbidGenKey,  "forbid-gen-key", "@"),
   ARGPARSE_s_n (oRequireCompliance, "require-compliance", "@"),
   ARGPARSE_s_s (oCompatibilityFlags, "compatibility-flags", "@"),
@@ -2378,6 +2435,7 @@ gpg_deinit_default_ctrl (ctrl_t ctrl)
 #endif
   gpg_dirmngr_deinit_session_data (ctrl);
 
+  getkey_prefetch_release (ctrl);
   keydb_release (ctrl->cached_getkey_kdb);
   gpg_keyboxd_deinit_session_data (ctrl);
   xfree (ctrl->secret_keygrips);
@@ -2569,6 +2627,7 @@ main (int argc, char **argv)
       }
     /* Reset the flags.  */
     pargs.flags &= ~(ARGPARSE_FLAG_KEEP | ARGPARSE_FLAG_NOVERSION);
+    STARTTRACE_MARK ("command line");
 
 #ifdef HAVE_DOSISH_SYSTEM
     /* FIXME: Do we still need this?  No: gnupg_homedir calls
@@ -2634,6 +2693,7 @@ main (int argc, char **argv)
 
     /* By this point we have a homedir, and cannot change it. */
     check_permissions (gnupg_homedir (), 0);
+    STARTTRACE_MARK ("secmem and homedir");
 
     /* The configuration directories for use by gpgrt_argparser.  */
     gpgrt_set_confdir (GPGRT_CONFDIR_SYS, gnupg_sysconfdir ());
@@ -2803,10 +2863,38 @@ main (int argc, char **argv)
             opt.input_size_hint = string_to_u64 (pargs.r.ret_str);
             break;
 
+          case oInputMmapThreshold:
+            iobuf_set_mmap_threshold (pargs.r.ret_ulong);
+            break;
+
+          case oAsyncIO:
+            iobuf_set_async_io (1);
+            break;
+
           case oChunkSize:
             opt.chunk_size = pargs.r.ret_int;
+            opt.explicit_chunk_size = 1;
+            break;
+
+          case oAEADThreads:
+            opt.aead_threads = pargs.r.ret_ulong;
+            break;
+
+          case oImportThreads:
+            opt.import_threads = pargs.r.ret_ulong;
+            break;
+
+          case oListThreads:
+            opt.list_threads = pargs.r.ret_ulong;
             break;
 
+          case oVerifyThreads:
+            opt.verify_threads = pargs.r.ret_ulong;
+            break;
+
+          case oBatchVerify: opt.batch_verify = 1; break;
+          case oParallelKeygen: opt.parallel_keygen = 1; break;
+
 	  case oQuiet: opt.quiet = 1; break;
 	  case oNoTTY: tty_no_terminal(1); break;
 	  case oDryRun: opt.dry_run = 1; break;
@@ -2891,6 +2979,8 @@ main (int argc, char **argv)
             opt_set_iobuf_size_used = 1;
             break;
 
+          case oTimingStats: tstat_enable (); break;
+
           case oDebugAllowLargeChunks:
             allow_large_chunks = 1;
             break;
@@ -3002,6 +3092,9 @@ main (int argc, char **argv)
 
 #ifndef NO_TRUST_MODELS
 	  case oTrustDBName: trustdb_name = pargs.r.ret_str; break;
+	  case oTrustDBCacheSize:
+            opt.trustdb_cache_size = pargs.r.ret_ulong;
+            break;
 
 #endif /*!NO_TRUST_MODELS*/
 	  case oDefaultKey:
@@ -3302,6 +3395,20 @@ main (int argc, char **argv)
 	  case oCompressLevel: opt.compress_level = pargs.r.ret_int; break;
 	  case oBZ2CompressLevel: opt.bz2_compress_level = pargs.r.ret_int; break;
 	  case oBZ2DecompressLowmem: opt.bz2_decompress_lowmem=1; break;
+	  case oCompressAdaptive: opt.compress_adaptive = 1; break;
+	  case oCompressThreads:
+	    opt.compress_threads = pargs.r.ret_ulong;
+	    break;
+	  case oHashThreads:
+	    opt.hash_threads = pargs.r.ret_ulong;
+	    break;
+	  case oEncryptThreads:
+	    opt.encrypt_threads = pargs.r.ret_ulong;
+	    break;
+	  case oEphemeralKeyPool:
+	    opt.ephemeral_key_pool = pargs.r.ret_ulong;
+	    break;
+	  case oPipelineFilters: opt.pipeline_filters = 1; break;
 	  case oPassphrase:
             set_passphrase_from_string (pargs.r_type ? pargs.r.ret_str : "");
 	    break;
@@ -3555,6 +3662,9 @@ main (int argc, char **argv)
             }
             break;
           case oNoSigCache: opt.no_sig_cache = 1; break;
+          case oPersistentSigCache: opt.persistent_sig_cache = 1; break;
+          case oPersistentUidCache: opt.persistent_uid_cache = 1; break;
+          case oPkCacheSize: opt.pk_cache_size = pargs.r.ret_ulong; break;
 	  case oAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid = 1; break;
 	  case oNoAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid=0; break;
 	  case oAllowFreeformUID: opt.allow_freeform_uid = 1; break;
@@ -3701,6 +3811,7 @@ main (int argc, char **argv)
           case oNoMangleDosFilenames: opt.mangle_dos_filenames = 0; break;
           case oEnableProgressFilter: opt.enable_progress_filter = 1; break;
 	  case oMultifile: multifile=1; break;
+	  case oMultifileJobs: opt.multifile_jobs = pargs.r.ret_ulong; break;
 	  case oKeyidFormat:
 	    if(ascii_strcasecmp(pargs.r.ret_str,"short")==0)
 	      opt.keyid_format=KF_SHORT;
@@ -3720,6 +3831,10 @@ main (int argc, char **argv)
             opt.exit_on_status_write_error = 1;
             break;
 
+          case oBufferedStatus:
+            opt.status_buffered = 1;
+            break;
+
 	  case oLimitCardInsertTries:
             opt.limit_card_insert_tries = pargs.r.ret_int;
             break;
@@ -3747,6 +3862,7 @@ main (int argc, char **argv)
 	  case oNoAutoKeyLocate:
 	    release_akl();
 	    break;
+          case oAutoKeyLocateParallel: opt.flags.akl_parallel = 1; break;
 
 	  case oKeyOrigin:
 	    if(!parse_key_origin (pargs.r.ret_str))
@@ -3785,6 +3901,10 @@ main (int argc, char **argv)
             opt.flags.allow_old_cipher_algos = 1;
             break;
 
+          case oAllowZstdCompression:
+            opt.flags.allow_zstd_compression = 1;
+            break;
+
           case oFakedSystemTime:
             {
               size_t len = strlen (pargs.r.ret_str);
@@ -3864,6 +3984,15 @@ main (int argc, char **argv)
             keybox_set_buffersize (pargs.r.ret_ulong, 0);
             break;
 
+          case oKeyboxIndex:
+            keybox_set_use_index (1);
+            keyring_set_use_index (1);
+            break;
+
+          case oKeyboxAppendUpdates:
+            keybox_set_append_updates (1);
+            break;
+
 	  case oNoop: break;
 
 	  default:
@@ -3882,6 +4011,7 @@ main (int argc, char **argv)
       }
 
     gpgrt_argparse (NULL, &pargs, NULL);  /* Release internal state.  */
+    STARTTRACE_MARK ("option files");
 
     if (log_get_errorcount (0))
       {
@@ -3903,6 +4033,7 @@ main (int argc, char **argv)
         write_status_failure ("option-parser", gpg_error(GPG_ERR_GENERAL));
         g10_exit(2);
       }
+    STARTTRACE_MARK ("common options");
 
     if (opt.use_keyboxd)
       log_info ("Note: Please move option \"%s\" to \"common.conf\"\n",
@@ -4163,7 +4294,7 @@ main (int argc, char **argv)
 	switch(cmd)
 	  {
 	  case aSign:
-	    cmdname="--sign";
+	    cmdname = detached_sig? NULL : "--sign";
 	    break;
 	  case aSignEncr:
 	    cmdname="--sign --encrypt";
@@ -4171,9 +4302,6 @@ main (int argc, char **argv)
 	  case aClearsign:
 	    cmdname="--clear-sign";
 	    break;
-	  case aDetachedSign:
-	    cmdname="--detach-sign";
-	    break;
 	  case aSym:
 	    cmdname="--symmetric";
 	    break;
@@ -4332,18 +4460,31 @@ main (int argc, char **argv)
     if( opt.verbose > 1 )
 	set_packet_list_mode(1);
 
+    STARTTRACE_MARK ("option processing");
+
     /* Add the keyrings, but not for some special commands.  We always
      * need to add the keyrings if we are running under SELinux, this
      * is so that the rings are added to the list of secured files.
-     * We do not add any keyring if --no-keyring or --use-keyboxd has
-     * been used.  Note that keydb_add_resource may create a new
-     * homedir and also tries to write a common.conf to enable the use
-     * of the keyboxd - in this case a special error code is returned
-     * and use_keyboxd is then also set.  */
+     * Otherwise the keyrings are registered with the first use of
+     * the key database.  We do not add any keyring if --no-keyring
+     * or --use-keyboxd has been used.  Note that keydb_add_resource
+     * may create a new homedir and also tries to write a common.conf
+     * to enable the use of the keyboxd - in this case a special error
+     * code is returned and use_keyboxd is then also set.  */
     if (!opt.use_keyboxd
         && default_keyring >= 0
-        && (ALWAYS_ADD_KEYRINGS
-            || (cmd != aDeArmor && cmd != aEnArmor && cmd != aGPGConfTest)))
+        && !ALWAYS_ADD_KEYRINGS
+        && cmd != aDeArmor && cmd != aEnArmor && cmd != aGPGConfTest)
+      {
+	if (!nrings || default_keyring > 0)  /* Add default ring. */
+          keydb_defer_resource ("pubring" EXTSEP_S GPGEXT_GPG,
+                                KEYDB_RESOURCE_FLAG_DEFAULT);
+        for (sl = nrings; sl; sl = sl->next )
+          keydb_defer_resource (sl->d, sl->flags);
+      }
+    else if (!opt.use_keyboxd
+             && default_keyring >= 0
+             && ALWAYS_ADD_KEYRINGS)
       {
         tmperr = 0;
 	if (!nrings || default_keyring > 0)  /* Add default ring. */
@@ -4358,6 +4499,7 @@ main (int argc, char **argv)
           }
       }
     FREE_STRLIST(nrings);
+    STARTTRACE_MARK ("keyring registration");
 
     /* In loopback mode, never ask for the password multiple times.  */
     if (opt.pinentry_mode == PINENTRY_MODE_LOOPBACK)
@@ -4377,6 +4519,10 @@ main (int argc, char **argv)
     if (cmd == aGPGConfTest)
       g10_exit(0);
 
+    /* Start to precompute ephemeral keys in the background.  */
+    if (opt.ephemeral_key_pool)
+      ecdh_pool_start (opt.ephemeral_key_pool);
+
 
     if (pwfd != -1)  /* Read the passphrase now. */
       read_passphrase_from_fd (pwfd);
@@ -4426,6 +4572,8 @@ main (int argc, char **argv)
       log_error (_("failed to initialize the TrustDB: %s\n"),
                  gpg_strerror (rc));
 #endif /*!NO_TRUST_MODELS*/
+    STARTTRACE_MARK ("trustdb");
+    starttrace_dump ();
 
     switch (cmd)
       {
@@ -4579,6 +4727,11 @@ main (int argc, char **argv)
 	break;
 
       case aSign: /* sign the given file */
+        if (multifile && detached_sig)
+          {
+            sign_files (ctrl, argc, argv, locusr);
+            break;
+          }
 	sl = NULL;
 	if( detached_sig ) { /* sign all files */
 	    for( ; argc; argc--, argv++ )
@@ -4706,6 +4859,12 @@ main (int argc, char **argv)
         {
           const char *fpr;
 
+          if (multifile)
+            {
+              keyedit_quick_sign_keys (ctrl, argc, argv, locusr,
+                                       (cmd == aQuickLSignKey));
+              break;
+            }
           if (argc < 1)
             wrong_args ("--quick-[l]sign-key fingerprint [userids]");
           fpr = *argv++; argc--;
@@ -5638,16 +5797,25 @@ g10_exit( int rc )
    * status line. */
   if (rc)
     write_status_failure ("gpg-exit", gpg_error (GPG_ERR_GENERAL));
+  flush_status_fd ();
 
   gcry_control (GCRYCTL_UPDATE_RANDOM_SEED_FILE);
+  sig_cache_flush ();
+  objcache_flush ();
+  tstat_dump ();
   if (DBG_CLOCK)
     log_clock ("stop");
 
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
       keydb_dump_stats ();
+      getkey_dump_stats ();
       sig_check_dump_stats ();
+      sig_cache_dump_stats ();
       objcache_dump_stats ();
+      ecdh_pool_dump_stats ();
+      sigbatch_dump_stats ();
+      memstat_dump ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
@@ -115,6 +115,9 @@ struct server_control_s
   /* This is used to cache a key data base handle.  */
   KEYDB_HANDLE cached_getkey_kdb;
 
+  /* Keyblocks looked up in advance by getkey_prefetch.  */
+  struct getkey_prefetch_s *getkey_prefetch;
+
   /* Cached results from HAVEKEY --list.  They are used if the pointer
    * is not NULL.  The length gives the length in bytes and is a
    * multiple of 20.  If the no_more flag is set the list shall not
@@ -43,6 +43,7 @@
 #include "main.h"
 #include "options.h"
 #include "keydb.h"
+#include "../kbx/keybox.h"
 #include "trustdb.h"
 #include "filter.h"
 #include "../common/ttyio.h"
@@ -51,6 +52,7 @@
 #include "../common/status.h"
 #include "call-agent.h"
 #include "../common/init.h"
+#include "../common/starttrace.h"
 
 
 enum cmd_and_opt_values {
@@ -69,11 +71,14 @@ enum cmd_and_opt_values {
   oEnableSpecialFilenames,
   oDebug,
   oAssertPubkeyAlgo,
+  aCompileKeyring,
   aTest
 };
 
 
 static gpgrt_opt_t opts[] = {
+  ARGPARSE_c (aCompileKeyring, "compile-keyring", "@"),
+
   ARGPARSE_group (300, N_("@\nOptions:\n ")),
 
   ARGPARSE_s_n (oVerbose, "verbose", N_("verbose")),
@@ -171,6 +176,157 @@ my_strusage( int level )
 }
 
 
+/* Verify the self-signatures of KEYBLOCK so that their status is
+ * stored with the keyblock.  The status of other signatures is
+ * cleared because we do not check them.  */
+static void
+check_self_signatures (ctrl_t ctrl, kbnode_t keyblock)
+{
+  u32 *kid = pk_keyid (keyblock->pkt->pkt.public_key);
+  kbnode_t node;
+  PKT_signature *sig;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      sig->flags.checked = sig->flags.valid = 0;
+      if (!keyid_cmp (sig->keyid, kid))
+        check_key_signature (ctrl, keyblock, node, NULL);
+    }
+}
+
+
+/* Write the keys of all keyrings to the keybox FNAME along with an
+ * index.  The keyblocks carry the result of checking their
+ * self-signatures in ring trust packets and the header has the
+ * compiled flag, which tells us to use these results.  Thus a
+ * verification using the compiled keyring needs to verify only the
+ * signature itself.  */
+static void
+compile_keyring (ctrl_t ctrl, const char *fname)
+{
+  gpg_error_t err;
+  char *tmpfname;
+  estream_t fp;
+  void *token;
+  KEYBOX_HANDLE kbx = NULL;
+  KEYDB_HANDLE hd = NULL;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock;
+  iobuf_t iobuf;
+  int saved_append;
+  unsigned int count = 0;
+  unsigned long skipped;
+
+  tmpfname = xstrconcat (fname, ".tmp", NULL);
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't create '%s': %s\n"), tmpfname, gpg_strerror (err));
+      goto leave;
+    }
+  err = _keybox_write_header_blob (fp, 1);
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = keybox_register_file (tmpfname, 0, &token);
+  if (!err)
+    {
+      kbx = keybox_new_openpgp (token, 0);
+      if (!kbx)
+        err = gpg_error_from_syserror ();
+    }
+  if (!err)
+    {
+      hd = keydb_new (ctrl);
+      if (!hd)
+        err = gpg_error_from_syserror ();
+    }
+  if (err)
+    {
+      log_error ("error creating '%s': %s\n", tmpfname, gpg_strerror (err));
+      goto leave;
+    }
+  keydb_disable_caching (hd);
+
+  saved_append = keybox_set_append_updates (1);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!(err = keydb_search (hd, &desc, 1, NULL)))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      err = keydb_get_keyblock (hd, &keyblock);
+      if (err)
+        {
+          log_error (_("error reading keyblock: %s\n"), gpg_strerror (err));
+          break;
+        }
+      check_self_signatures (ctrl, keyblock);
+      err = build_keyblock_image (keyblock, &iobuf);
+      if (!err)
+        {
+          err = keybox_insert_keyblock (kbx, iobuf_get_temp_buffer (iobuf),
+                                        iobuf_get_temp_length (iobuf));
+          iobuf_close (iobuf);
+        }
+      release_kbnode (keyblock);
+      if (err)
+        {
+          log_error ("error writing '%s': %s\n", tmpfname, gpg_strerror (err));
+          break;
+        }
+      count++;
+    }
+  keybox_set_append_updates (saved_append);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    err = 0;
+  else if (err)
+    goto leave;
+  keydb_release (hd);
+  hd = NULL;
+  keybox_release (kbx);
+  kbx = NULL;
+
+  err = keybox_set_header_flags (tmpfname, KEYBOX_HEADER_FLAG_COMPILED);
+  if (!err)
+    err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    {
+      log_error ("error writing '%s': %s\n", fname, gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Build the index now; the directory may not be writable at the
+   * time of a verification.  A search by key ID builds it.  */
+  keybox_set_use_index (1);
+  err = keybox_register_file (fname, 0, &token);
+  if (!err || gpg_err_code (err) == GPG_ERR_EEXIST)
+    {
+      kbx = keybox_new_openpgp (token, 0);
+      memset (&desc, 0, sizeof desc);
+      desc.mode = KEYDB_SEARCH_MODE_LONG_KID;
+      if (kbx)
+        keybox_search (kbx, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, &skipped);
+    }
+  err = 0;
+
+  if (!opt.quiet)
+    log_info ("%u keys written to '%s'\n", count, fname);
+
+ leave:
+  keydb_release (hd);
+  keybox_release (kbx);
+  if (err)
+    {
+      gnupg_remove (tmpfname);
+      g10_errors_seen = 1;
+    }
+  xfree (tmpfname);
+}
+
 
 int
 main( int argc, char **argv )
@@ -180,6 +336,7 @@ main( int argc, char **argv )
   strlist_t sl;
   strlist_t nrings = NULL;
   ctrl_t ctrl;
+  int cmd = 0;
 
   early_system_init ();
   gpgrt_set_strusage (my_strusage);
@@ -219,6 +376,8 @@ main( int argc, char **argv )
         {
         case ARGPARSE_CONFFILE: break;
 
+        case aCompileKeyring: cmd = pargs.r_opt; break;
+
         case oQuiet: opt.quiet = 1; break;
         case oVerbose:
           opt.verbose++;
@@ -272,6 +431,7 @@ main( int argc, char **argv )
     }
 
   gpgrt_argparse (NULL, &pargs, NULL);  /* Release internal state.  */
+  STARTTRACE_MARK ("options");
 
   if (log_get_errorcount (0))
     g10_exit(2);
@@ -288,11 +448,33 @@ main( int argc, char **argv )
     keydb_add_resource (sl->d, KEYDB_RESOURCE_FLAG_READONLY);
 
   FREE_STRLIST (nrings);
+  STARTTRACE_MARK ("keyring registration");
+  starttrace_dump ();
 
   ctrl = xcalloc (1, sizeof *ctrl);
 
-  if ((rc = verify_signatures (ctrl, argc, argv)))
-    log_error("verify signatures failed: %s\n", gpg_strerror (rc) );
+  if (cmd == aCompileKeyring)
+    {
+      if (argc != 1)
+        log_error ("usage: gpgv --compile-keyring FILE\n");
+      else
+        compile_keyring (ctrl, *argv);
+    }
+  else
+    {
+      /* The signature cache flags of a compiled keyring have been
+       * set by us; there is no need to check the self-signatures
+       * again.  */
+      if (keydb_all_compiled ())
+        {
+          if (opt.verbose)
+            log_info ("using the signature cache of the compiled keyring\n");
+          opt.no_sig_cache = 0;
+          keybox_set_use_index (1);
+        }
+      if ((rc = verify_signatures (ctrl, argc, argv)))
+        log_error("verify signatures failed: %s\n", gpg_strerror (rc) );
+    }
 
   keydb_release (ctrl->cached_getkey_kdb);
   xfree (ctrl);
@@ -721,6 +903,14 @@ dotlock_take (dotlock_t h, long timeout)
   return 0;
 }
 
+int
+dotlock_take_shared (dotlock_t h, long timeout)
+{
+  (void)h;
+  (void)timeout;
+  return 0;
+}
+
 int
 dotlock_release (dotlock_t h)
 {
@@ -760,6 +950,17 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
   return gpg_error (GPG_ERR_NO_SECKEY);
 }
 
+int
+agent_is_connected (void)
+{
+  return 0;
+}
+
+void
+tdbio_reset_after_fork (void)
+{
+}
+
 gpg_error_t
 export_pubkey_buffer (ctrl_t ctrl, const char *keyspec, unsigned int options,
                       const void *prefix, size_t prefixlen,
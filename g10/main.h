@@ -201,6 +201,8 @@ unsigned int ecdsa_qbits_from_Q (unsigned int qbits);
 /*-- cpr.c --*/
 void set_status_fd ( int fd );
 int  is_status_enabled ( void );
+int  get_status_fd (void);
+void flush_status_fd (void);
 void write_status ( int no );
 void write_status_error (const char *where, gpg_error_t err);
 void write_status_errcode (const char *where, int errcode);
@@ -262,6 +264,7 @@ int write_pubkey_enc (ctrl_t ctrl, PKT_public_key *pk, int throw_keyid,
 /*-- sign.c --*/
 int sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	       int do_encrypt, strlist_t remusr, const char *outfile );
+void sign_files (ctrl_t ctrl, int nfiles, char **files, strlist_t locusr);
 int clearsign_file (ctrl_t ctrl,
                     const char *fname, strlist_t locusr, const char *outfile);
 int sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr);
@@ -302,6 +305,18 @@ gpg_error_t check_signature_over_key_or_uid (ctrl_t ctrl,
                                              int *is_selfsig,
                                              PKT_public_key *ret_pk);
 
+/* Helpers for the parallel check of key signatures in
+   keysig-pool.c.  */
+gpg_error_t prepare_key_sig_check (kbnode_t root, kbnode_t node,
+                                   PACKET *packet, PKT_public_key *signer,
+                                   gcry_mpi_t *r_hash);
+void finish_key_sig_check (kbnode_t root, kbnode_t node,
+                           PKT_public_key *signer, gcry_mpi_t hash, int rc);
+
+/* Verify data signatures in batches; see sigbatch.c.  */
+void batch_check_data_sigs (ctrl_t ctrl, PKT_signature **sigs,
+                            unsigned int nsigs, gcry_md_hd_t md);
+
 
 /*-- delkey.c --*/
 gpg_error_t delete_keys (ctrl_t ctrl,
@@ -512,6 +527,13 @@ gpg_error_t decrypt_message_fd (ctrl_t ctrl, gnupg_fd_t input_fd,
                                 gnupg_fd_t output_fd);
 void decrypt_messages (ctrl_t ctrl, int nfiles, char *files[]);
 
+/*-- multifile.c --*/
+int multifile_usable (ctrl_t ctrl);
+gpg_error_t multifile_process (ctrl_t ctrl, int nfiles, char **files,
+                               gpg_error_t (*fnc) (ctrl_t, const char *,
+                                                   void *),
+                               void *opaque);
+
 /*-- plaintext.c --*/
 int hash_datafiles( gcry_md_hd_t md, gcry_md_hd_t md2,
 		    strlist_t files, const char *sigfilename, int textmode);
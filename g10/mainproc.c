@@ -1902,6 +1902,7 @@ static void
 print_good_bad_signature (int statno, const char *keyid_str, kbnode_t un,
                           PKT_signature *sig, int rc)
 {
+  char buffer[256];
   char *p;
 
   write_status_text_and_buffer (statno, keyid_str,
@@ -1910,10 +1911,11 @@ print_good_bad_signature (int statno, const char *keyid_str, kbnode_t un,
                                 -1);
 
   if (un)
-    p = utf8_to_native (un->pkt->pkt.user_id->name,
-                        un->pkt->pkt.user_id->len, 0);
+    p = utf8_to_native_buf (un->pkt->pkt.user_id->name,
+                            un->pkt->pkt.user_id->len, 0,
+                            buffer, sizeof buffer);
   else
-    p = xstrdup ("[?]");
+    p = strcpy (buffer, "[?]");
 
   if (rc)
     log_info (_("BAD signature from \"%s\""), p);
@@ -1922,7 +1924,8 @@ print_good_bad_signature (int statno, const char *keyid_str, kbnode_t un,
   else
     log_info (_("Good signature from \"%s\""), p);
 
-  xfree (p);
+  if (p != buffer)
+    xfree (p);
 }
 
 
@@ -2399,6 +2402,7 @@ check_sig_and_print (CTX c, kbnode_t node)
           && !rc
           && !(opt.verify_options & VERIFY_SHOW_PRIMARY_UID_ONLY))
         {
+          char buffer[256];
           char *p;
           for( un=keyblock; un; un = un->next)
             {
@@ -2425,10 +2429,12 @@ check_sig_and_print (CTX c, kbnode_t node)
                                  mainpk ,un->pkt->pkt.user_id);
                 }
 
-              p = utf8_to_native (un->pkt->pkt.user_id->name,
-				  un->pkt->pkt.user_id->len, 0);
+              p = utf8_to_native_buf (un->pkt->pkt.user_id->name,
+                                      un->pkt->pkt.user_id->len, 0,
+                                      buffer, sizeof buffer);
               log_info (_("                aka \"%s\""), p);
-              xfree (p);
+              if (p != buffer)
+                xfree (p);
 
               if ((opt.verify_options & VERIFY_SHOW_UID_VALIDITY))
                 {
@@ -2633,6 +2639,38 @@ check_sig_and_print (CTX c, kbnode_t node)
 }
 
 
+/* With --batch-verify or --verify-threads, verify the signatures
+ * starting at NODE ahead of check_sig_and_print which then checks
+ * them one by one.  */
+static void
+batch_check_sigs (CTX c, kbnode_t node)
+{
+  PKT_signature **sigs;
+  unsigned int nsigs = 0;
+  kbnode_t n;
+
+  if ((!opt.batch_verify && opt.verify_threads < 2)
+      || opt.skip_verify || !c->mfx.md)
+    return;
+
+  for (n = node; n; n = find_next_kbnode (n, PKT_SIGNATURE))
+    if (n->pkt->pkttype == PKT_SIGNATURE)
+      nsigs++;
+  if (nsigs < 2)
+    return;
+  sigs = xtrycalloc (nsigs, sizeof *sigs);
+  if (!sigs)
+    return;
+  nsigs = 0;
+  for (n = node; n; n = find_next_kbnode (n, PKT_SIGNATURE))
+    if (n->pkt->pkttype == PKT_SIGNATURE)
+      sigs[nsigs++] = n->pkt->pkt.signature;
+
+  batch_check_data_sigs (c->ctrl, sigs, nsigs, c->mfx.md);
+  xfree (sigs);
+}
+
+
 /*
  * Process the tree which starts at node
  */
@@ -2724,6 +2762,7 @@ proc_tree (CTX c, kbnode_t node)
           return;
         }
 
+      batch_check_sigs (c, node);
       for (n1 = node; (n1 = find_next_kbnode (n1, PKT_SIGNATURE));)
         if (check_sig_and_print (c, n1) && opt.batch
             && !opt.flags.proc_all_sigs)
@@ -2745,6 +2784,7 @@ proc_tree (CTX c, kbnode_t node)
           return;
         }
 
+      batch_check_sigs (c, node);
       for (n1 = node; (n1 = find_next_kbnode (n1, PKT_SIGNATURE));)
         if (check_sig_and_print (c, n1) && opt.batch
             && !opt.flags.proc_all_sigs)
@@ -2875,6 +2915,7 @@ proc_tree (CTX c, kbnode_t node)
 
       if (multiple_ok)
         {
+          batch_check_sigs (c, node);
           for (n1 = node; n1; (n1 = find_next_kbnode(n1, PKT_SIGNATURE)))
 	    if (check_sig_and_print (c, n1) && opt.batch
                 && !opt.flags.proc_all_sigs)
@@ -0,0 +1,338 @@
+/* md-pool.c - Compute several message digests on worker threads
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* A gcry_md handle with several algorithms enabled runs them one
+ * after the other over each buffer.  If the signers of a message use
+ * different digest algorithms this module distributes the algorithms
+ * over worker threads, each with its own handle.  All workers hash
+ * the same sequence of buffers; the data is copied once into a ring
+ * of buffers and a buffer is refilled only after all workers are done
+ * with it.  Thus the time to hash the data is bound by the slowest
+ * algorithm and not by the sum of them.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "md-pool.h"
+
+/* The size and the number of the buffers in the ring.  */
+#define BUFSIZE (64*1024)
+#define NBUFS   4
+
+
+struct md_buffer_s
+{
+  size_t len;
+  unsigned int pending;   /* Number of workers still to hash it.  */
+  byte data[BUFSIZE];
+};
+
+
+struct md_worker_s
+{
+  md_pool_t pool;
+  npth_t thd;
+  unsigned int started : 1;
+  gcry_md_hd_t md;
+  unsigned long seq;      /* Number of buffers hashed so far.  */
+};
+
+
+struct md_pool_s
+{
+  npth_mutex_t mutex;
+  npth_cond_t work_cond;      /* Signaled when a buffer is submitted.  */
+  npth_cond_t done_cond;      /* Signaled when a worker is done with one.  */
+  unsigned int stop : 1;      /* Tell the workers to terminate.  */
+
+  struct md_buffer_s *bufs;
+  unsigned long nsubmitted;   /* Number of buffers submitted so far.  */
+  size_t filllen;             /* Bytes in the buffer being filled.  */
+
+  unsigned int nworkers;
+  struct md_worker_s workers[1];
+};
+
+
+static void
+lock_pool (md_pool_t pool)
+{
+  int rc = npth_mutex_lock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pool (md_pool_t pool)
+{
+  int rc = npth_mutex_unlock (&pool->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void *
+md_worker (void *arg)
+{
+  struct md_worker_s *wk = arg;
+  md_pool_t pool = wk->pool;
+  struct md_buffer_s *b;
+
+  for (;;)
+    {
+      lock_pool (pool);
+      while (!pool->stop && wk->seq == pool->nsubmitted)
+        npth_cond_wait (&pool->work_cond, &pool->mutex);
+      if (wk->seq == pool->nsubmitted)
+        {
+          unlock_pool (pool);
+          break;
+        }
+      b = pool->bufs + wk->seq % NBUFS;
+      unlock_pool (pool);
+
+      npth_unprotect ();
+      gcry_md_write (wk->md, b->data, b->len);
+      npth_protect ();
+
+      lock_pool (pool);
+      wk->seq++;
+      b->pending--;
+      npth_cond_broadcast (&pool->done_cond);
+      unlock_pool (pool);
+    }
+
+  return NULL;
+}
+
+
+/* Create a new pool to compute the NALGOS digest algorithms ALGOS
+ * using up to NTHREADS worker threads.  If there are more algorithms
+ * than threads a worker computes several of them.  NTHREADS is
+ * limited to MD_POOL_MAX_THREADS.  */
+gpg_error_t
+md_pool_new (md_pool_t *r_pool, const int *algos, int nalgos,
+             unsigned int nthreads)
+{
+  gpg_error_t err = 0;
+  md_pool_t pool;
+  npth_attr_t tattr;
+  unsigned int i;
+  int j, rc;
+
+  *r_pool = NULL;
+  if (!nthreads || nalgos < 1)
+    return gpg_error (GPG_ERR_INV_ARG);
+  if (nthreads > MD_POOL_MAX_THREADS)
+    nthreads = MD_POOL_MAX_THREADS;
+  if (nthreads > (unsigned int)nalgos)
+    nthreads = nalgos;
+
+  pool = xtrycalloc (1, sizeof *pool + (nthreads - 1) * sizeof *pool->workers);
+  if (!pool)
+    return gpg_error_from_syserror ();
+
+  rc = npth_mutex_init (&pool->mutex, NULL);
+  if (rc)
+    {
+      xfree (pool);
+      return gpg_error_from_errno (rc);
+    }
+  npth_cond_init (&pool->work_cond, NULL);
+  npth_cond_init (&pool->done_cond, NULL);
+
+  pool->bufs = xtrycalloc (NBUFS, sizeof *pool->bufs);
+  if (!pool->bufs)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (i = 0; i < nthreads; i++)
+    {
+      struct md_worker_s *wk = pool->workers + i;
+
+      wk->pool = pool;
+      err = gcry_md_open (&wk->md, 0, 0);
+      if (err)
+        goto leave;
+      pool->nworkers++;
+      for (j = i; j < nalgos; j += nthreads)
+        {
+          err = gcry_md_enable (wk->md, algos[j]);
+          if (err)
+            goto leave;
+        }
+    }
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      goto leave;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i = 0; i < pool->nworkers; i++)
+    {
+      rc = npth_create (&pool->workers[i].thd, &tattr, md_worker,
+                        pool->workers + i);
+      if (rc)
+        {
+          err = gpg_error_from_errno (rc);
+          break;
+        }
+      pool->workers[i].started = 1;
+    }
+  npth_attr_destroy (&tattr);
+
+ leave:
+  if (err)
+    {
+      log_error ("error creating hashing worker pool: %s\n",
+                 gpg_strerror (err));
+      md_pool_release (pool);
+    }
+  else
+    *r_pool = pool;
+  return err;
+}
+
+
+/* Stop all workers and release POOL.  */
+void
+md_pool_release (md_pool_t pool)
+{
+  unsigned int i;
+
+  if (!pool)
+    return;
+
+  lock_pool (pool);
+  pool->stop = 1;
+  npth_cond_broadcast (&pool->work_cond);
+  unlock_pool (pool);
+  for (i = 0; i < pool->nworkers; i++)
+    {
+      if (pool->workers[i].started)
+        npth_join (pool->workers[i].thd, NULL);
+      gcry_md_close (pool->workers[i].md);
+    }
+
+  if (pool->bufs)
+    {
+      /* The buffers hold plaintext.  */
+      wipememory (pool->bufs, NBUFS * sizeof *pool->bufs);
+      xfree (pool->bufs);
+    }
+  npth_cond_destroy (&pool->work_cond);
+  npth_cond_destroy (&pool->done_cond);
+  npth_mutex_destroy (&pool->mutex);
+  xfree (pool);
+}
+
+
+/* Hand the buffer being filled to the workers.  */
+static void
+submit_buffer (md_pool_t pool)
+{
+  struct md_buffer_s *b = pool->bufs + pool->nsubmitted % NBUFS;
+
+  lock_pool (pool);
+  b->len = pool->filllen;
+  b->pending = pool->nworkers;
+  pool->nsubmitted++;
+  npth_cond_broadcast (&pool->work_cond);
+  unlock_pool (pool);
+  pool->filllen = 0;
+}
+
+
+/* Hash the LEN bytes of BUF with all algorithms of POOL.  This waits
+ * if the workers are too far behind.  */
+void
+md_pool_write (md_pool_t pool, const void *buf, size_t len)
+{
+  const byte *p = buf;
+  struct md_buffer_s *b;
+  size_t n;
+
+  while (len)
+    {
+      b = pool->bufs + pool->nsubmitted % NBUFS;
+      if (!pool->filllen)
+        {
+          lock_pool (pool);
+          while (b->pending)
+            npth_cond_wait (&pool->done_cond, &pool->mutex);
+          unlock_pool (pool);
+        }
+
+      n = BUFSIZE - pool->filllen;
+      if (n > len)
+        n = len;
+      memcpy (b->data + pool->filllen, p, n);
+      pool->filllen += n;
+      p += n;
+      len -= n;
+      if (pool->filllen == BUFSIZE)
+        submit_buffer (pool);
+    }
+}
+
+
+/* Wait until all data written to POOL has been hashed.  More data
+ * may be written afterwards.  */
+void
+md_pool_finish (md_pool_t pool)
+{
+  unsigned int i;
+
+  if (pool->filllen)
+    submit_buffer (pool);
+
+  lock_pool (pool);
+  for (i = 0; i < pool->nworkers; i++)
+    while (pool->workers[i].seq != pool->nsubmitted)
+      npth_cond_wait (&pool->done_cond, &pool->mutex);
+  unlock_pool (pool);
+}
+
+
+/* Return the handle of POOL which computes ALGO or NULL if ALGO is
+ * not computed by POOL.  The handle is owned by POOL and may only be
+ * used after md_pool_finish.  */
+gcry_md_hd_t
+md_pool_get_md (md_pool_t pool, int algo)
+{
+  unsigned int i;
+
+  for (i = 0; i < pool->nworkers; i++)
+    if (gcry_md_is_enabled (pool->workers[i].md, algo))
+      return pool->workers[i].md;
+  return NULL;
+}
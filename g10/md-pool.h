@@ -0,0 +1,37 @@
+/* md-pool.h - Compute several message digests on worker threads
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_MD_POOL_H
+#define G10_MD_POOL_H
+
+/* The maximum number of worker threads.  */
+#define MD_POOL_MAX_THREADS 16
+
+struct md_pool_s;
+typedef struct md_pool_s *md_pool_t;
+
+
+/*-- md-pool.c --*/
+gpg_error_t md_pool_new (md_pool_t *r_pool, const int *algos, int nalgos,
+                         unsigned int nthreads);
+void md_pool_write (md_pool_t pool, const void *buf, size_t len);
+void md_pool_finish (md_pool_t pool);
+gcry_md_hd_t md_pool_get_md (md_pool_t pool, int algo);
+void md_pool_release (md_pool_t pool);
+
+#endif /*G10_MD_POOL_H*/
@@ -29,6 +29,7 @@
 #include "../common/iobuf.h"
 #include "../common/util.h"
 #include "filter.h"
+#include "md-pool.h"
 
 
 
@@ -49,7 +50,10 @@ md_filter( void *opaque, int control,
 	i = iobuf_read( a, buf, size );
 	if( i == -1 ) i = 0;
 	if( i ) {
-	    gcry_md_write(mfx->md, buf, i );
+	    if( mfx->pool )
+		md_pool_write (mfx->pool, buf, i);
+	    else
+		gcry_md_write(mfx->md, buf, i );
 	    if( mfx->md2 )
 		gcry_md_write(mfx->md2, buf, i );
 	}
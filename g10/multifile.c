@@ -0,0 +1,599 @@
+/* multifile.c - Process the files of a --multifile command in parallel
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* With --multifile-jobs the files of --verify-files, --encrypt-files
+ * and --decrypt-files are handed to a pool of worker processes.  The
+ * processing state of gpg (the caches in getkey.c, the trustdb, the
+ * status and log streams, the literal packet tracking of mainproc.c)
+ * is process global and not meant for concurrent use; worker threads
+ * would need all of it locked and under npth would not run the public
+ * key operations in parallel anyway.  Forked workers instead get
+ * their own copy of that state, including their own CTRL object, and
+ * share the key caches filled so far with the parent copy-on-write.
+ * Each worker opens the keyrings and the trustdb itself.  Libgcrypt
+ * detects the fork and reseeds its RNG, thus the session keys created
+ * by the workers are independent.
+ *
+ * The parent reads the file names, queues them to the workers, and
+ * writes their output in the order of the file names.  For each file
+ * a worker captures everything it writes to stdout, stderr, the log
+ * and the status stream in temporary files and sends it back as one
+ * record.  Thus the output is the same as with sequential
+ * processing.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/wait.h>
+#endif
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/sysutils.h"
+#include "../common/i18n.h"
+#include "options.h"
+#include "keydb.h"
+#include "main.h"
+#include "call-agent.h"
+#include "tdbio.h"
+
+
+/* The maximum number of worker processes.  */
+#define MULTIFILE_MAX_JOBS 64
+
+/* The maximum number of files queued for one worker.  */
+#define MAX_QUEUED 4
+
+/* Longer file names are only queued for an idle worker so that a
+ * write to the job pipe never blocks.  */
+#define MAX_QUEUED_NAMELEN 1024
+
+/* The size of the output chunks sent back by a worker.  */
+#define CHUNKSIZE 8192
+
+/* Stdout, stderr, the log and the status fd.  */
+#define MAX_CAPTURE 4
+
+
+#ifndef HAVE_W32_SYSTEM
+
+struct worker_s
+{
+  pid_t pid;
+  int jobfd;              /* Write end of the job pipe.  */
+  int resfd;              /* Read end of the result pipe.  */
+  unsigned int dead:1;    /* The worker terminated unexpectedly.  */
+  unsigned int queued;    /* The number of files queued.  */
+};
+
+
+/* A queued file.  */
+struct pending_s
+{
+  char *name;
+  int worker;             /* Index of the worker or -1 if not queued.  */
+};
+
+
+/* The header of a chunk of output in a result record.  A chunk with
+ * FD -1 terminates the record and is followed by a struct
+ * result_s.  */
+struct chunk_hdr_s
+{
+  int fd;
+  unsigned int len;
+};
+
+
+struct result_s
+{
+  gpg_error_t rc;
+  unsigned int errorcount;  /* The number of errors logged.  */
+  int errors_seen;          /* The value of g10_errors_seen.  */
+};
+
+
+/* An output fd redirected to a temporary file.  */
+struct capture_s
+{
+  int fd;
+  int saved;
+  FILE *fp;
+};
+
+
+static int
+writen (int fd, const void *buffer, size_t length)
+{
+  const char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      n = write (fd, p, length);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1)
+        return -1;
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Read exactly LENGTH bytes.  Returns -1 on error or early EOF.  */
+static int
+readn (int fd, void *buffer, size_t length)
+{
+  char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      n = read (fd, p, length);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+static void
+flush_all_output (void)
+{
+  log_flush ();
+  es_fflush (NULL);
+  fflush (NULL);
+}
+
+
+/* Redirect the output fds to temporary files.  Returns the number of
+ * entries stored at CAP or -1 on error.  */
+static int
+begin_capture (struct capture_s *cap)
+{
+  int fds[MAX_CAPTURE];
+  int i, j, ncap = 0;
+
+  fds[0] = 1;
+  fds[1] = 2;
+  fds[2] = log_get_fd ();
+  fds[3] = get_status_fd ();
+
+  flush_all_output ();
+  for (i = 0; i < DIM (fds); i++)
+    {
+      if (fds[i] == -1)
+        continue;
+      for (j = 0; j < ncap && cap[j].fd != fds[i]; j++)
+        ;
+      if (j < ncap)
+        continue;  /* Already captured.  */
+
+      cap[ncap].fp = gnupg_tmpfile ();
+      if (!cap[ncap].fp)
+        return -1;
+      cap[ncap].saved = dup (fds[i]);
+      if (cap[ncap].saved == -1 || dup2 (fileno (cap[ncap].fp), fds[i]) == -1)
+        return -1;
+      cap[ncap].fd = fds[i];
+      ncap++;
+    }
+
+  return ncap;
+}
+
+
+/* Restore the output fds and send the captured output to RESFD.  */
+static int
+end_capture (struct capture_s *cap, int ncap, int resfd)
+{
+  struct chunk_hdr_s hdr;
+  char buffer[CHUNKSIZE];
+  size_t n;
+  int i, rc = 0;
+
+  flush_all_output ();
+  for (i = 0; i < ncap; i++)
+    {
+      if (dup2 (cap[i].saved, cap[i].fd) == -1)
+        rc = -1;
+      close (cap[i].saved);
+      rewind (cap[i].fp);
+      hdr.fd = cap[i].fd;
+      while (!rc && (n = fread (buffer, 1, sizeof buffer, cap[i].fp)))
+        {
+          hdr.len = n;
+          if (writen (resfd, &hdr, sizeof hdr) || writen (resfd, buffer, n))
+            rc = -1;
+        }
+      fclose (cap[i].fp);
+    }
+
+  return rc;
+}
+
+
+/* The main loop of a worker process.  Does not return.  */
+static void
+worker_main (ctrl_t ctrl, int jobfd, int resfd,
+             gpg_error_t (*fnc) (ctrl_t, const char *, void *),
+             void *opaque)
+{
+  struct capture_s cap[MAX_CAPTURE];
+  struct chunk_hdr_s hdr;
+  struct result_s res;
+  unsigned int len, nerrors;
+  char *name;
+  int ncap;
+
+  /* Open the trustdb again instead of sharing the file offset with
+   * the other processes.  */
+  tdbio_reset_after_fork ();
+
+  while (!readn (jobfd, &len, sizeof len))
+    {
+      name = xtrymalloc (len + 1);
+      if (!name || readn (jobfd, name, len))
+        _exit (2);
+      name[len] = 0;
+
+      nerrors = log_get_errorcount (0);
+      g10_errors_seen = 0;
+      ncap = begin_capture (cap);
+      if (ncap == -1)
+        _exit (2);
+      res.rc = fnc (ctrl, name, opaque);
+      if (end_capture (cap, ncap, resfd))
+        _exit (2);
+      res.errorcount = log_get_errorcount (0) - nerrors;
+      res.errors_seen = g10_errors_seen;
+
+      hdr.fd = -1;
+      hdr.len = 0;
+      if (writen (resfd, &hdr, sizeof hdr) || writen (resfd, &res, sizeof res))
+        _exit (2);
+      xfree (name);
+    }
+
+  /* Don't run the parent's atexit handlers.  */
+  _exit (0);
+}
+
+
+/* Read the next file name from FILES or, if NFILES is 0, from stdin
+ * into a malloced string.  Returns 0 and sets R_NAME to NULL if there
+ * are no more files.  */
+static gpg_error_t
+next_name (int *nfiles, char ***files, int use_stdin, unsigned int *lno,
+           char **r_name)
+{
+  char line[2048];
+  size_t n;
+
+  *r_name = NULL;
+  if (!use_stdin)
+    {
+      if (!*nfiles)
+        return 0;
+      *r_name = xtrystrdup (**files);
+      (*nfiles)--;
+      (*files)++;
+    }
+  else
+    {
+      if (!fgets (line, DIM(line), stdin))
+        return 0;
+      ++*lno;
+      n = strlen (line);
+      if (!n || line[n-1] != '\n')
+        {
+          log_error (_("input line %u too long or missing LF\n"), *lno);
+          return gpg_error (GPG_ERR_GENERAL);
+        }
+      line[n-1] = 0;
+      *r_name = xtrystrdup (line);
+    }
+
+  return *r_name? 0 : gpg_error_from_syserror ();
+}
+
+
+/* Write the output of the oldest queued file PEND and return its
+ * status code.  */
+static gpg_error_t
+emit_result (struct worker_s *workers, struct pending_s *pend)
+{
+  struct worker_s *w;
+  struct chunk_hdr_s hdr;
+  struct result_s res;
+  char buffer[CHUNKSIZE];
+
+  if (pend->worker == -1)
+    goto failed;
+  w = workers + pend->worker;
+  if (w->dead)
+    goto failed;
+
+  w->queued--;
+  for (;;)
+    {
+      if (readn (w->resfd, &hdr, sizeof hdr))
+        goto died;
+      if (hdr.fd == -1)
+        break;
+      if (hdr.len > sizeof buffer || readn (w->resfd, buffer, hdr.len))
+        goto died;
+      if (writen (hdr.fd, buffer, hdr.len))
+        log_error ("error writing to fd %d: %s\n", hdr.fd, strerror (errno));
+    }
+  if (readn (w->resfd, &res, sizeof res))
+    goto died;
+
+  while (res.errorcount--)
+    log_inc_errorcount ();
+  if (res.errors_seen)
+    g10_errors_seen = 1;
+  return res.rc;
+
+ died:
+  w->dead = 1;
+ failed:
+  log_error (_("error processing '%s': %s\n"), print_fname_stdin (pend->name),
+             _("worker process terminated unexpectedly"));
+  flush_all_output ();
+  return gpg_error (GPG_ERR_GENERAL);
+}
+
+
+/* Start NJOBS workers.  Returns the number of workers started.  */
+static int
+start_workers (ctrl_t ctrl, struct worker_s *workers, int njobs,
+               gpg_error_t (*fnc) (ctrl_t, const char *, void *),
+               void *opaque)
+{
+  int jobpipe[2], respipe[2];
+  int i, j;
+  pid_t pid;
+
+  /* The workers must open the keyring files themselves.  */
+  keydb_release (ctrl->cached_getkey_kdb);
+  ctrl->cached_getkey_kdb = NULL;
+  flush_all_output ();
+
+  for (i = 0; i < njobs; i++)
+    {
+      if (pipe (jobpipe))
+        break;
+      if (pipe (respipe))
+        {
+          close (jobpipe[0]);
+          close (jobpipe[1]);
+          break;
+        }
+
+      pid = fork ();
+      if (pid == -1)
+        {
+          log_error ("error forking worker process: %s\n", strerror (errno));
+          close (jobpipe[0]);
+          close (jobpipe[1]);
+          close (respipe[0]);
+          close (respipe[1]);
+          break;
+        }
+      if (!pid)
+        {
+          /* Close the parent's ends so that the workers see an EOF on
+           * their job pipe once the parent is done.  */
+          for (j = 0; j < i; j++)
+            {
+              close (workers[j].jobfd);
+              close (workers[j].resfd);
+            }
+          close (jobpipe[1]);
+          close (respipe[0]);
+          worker_main (ctrl, jobpipe[0], respipe[1], fnc, opaque);
+        }
+
+      close (jobpipe[0]);
+      close (respipe[1]);
+      workers[i].pid = pid;
+      workers[i].jobfd = jobpipe[1];
+      workers[i].resfd = respipe[0];
+      workers[i].dead = 0;
+      workers[i].queued = 0;
+    }
+
+  return i;
+}
+
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+/* Return true if the files of a --multifile command shall be
+ * processed by multifile_process.  */
+int
+multifile_usable (ctrl_t ctrl)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)ctrl;
+  return 0;
+#else
+  if (opt.multifile_jobs < 2)
+    return 0;
+  /* Workers can't prompt and must not share a connection.  */
+  if (!opt.batch || agent_is_connected () || ctrl->dirmngr_local)
+    {
+      if (opt.verbose)
+        log_info ("note: %s ignored in this mode\n", "--multifile-jobs");
+      return 0;
+    }
+  return 1;
+#endif
+}
+
+
+/* Call FNC for each file in FILES or, if NFILES is 0, for each file
+ * named on stdin using a pool of --multifile-jobs worker processes.
+ * The caller needs to check multifile_usable first.  Returns the
+ * first error returned by FNC.  */
+gpg_error_t
+multifile_process (ctrl_t ctrl, int nfiles, char **files,
+                   gpg_error_t (*fnc) (ctrl_t, const char *, void *),
+                   void *opaque)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)ctrl;
+  (void)nfiles;
+  (void)files;
+  (void)fnc;
+  (void)opaque;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#else
+  struct worker_s *workers;
+  struct pending_s *pending;
+  unsigned int njobs, npending, lno = 0;
+  unsigned int head = 0, count = 0, nextw = 0;
+  gpg_error_t err, rc;
+  gpg_error_t first_rc = 0;
+  char *name;
+  struct pending_s *p;
+  struct worker_s *w;
+  unsigned int len, i;
+  int use_stdin = !nfiles;
+  int status;
+
+  njobs = opt.multifile_jobs;
+  if (njobs > MULTIFILE_MAX_JOBS)
+    njobs = MULTIFILE_MAX_JOBS;
+
+  workers = xtrycalloc (njobs, sizeof *workers);
+  if (!workers)
+    return gpg_error_from_syserror ();
+  npending = njobs * MAX_QUEUED;
+  pending = xtrycalloc (npending, sizeof *pending);
+  if (!pending)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (workers);
+      return err;
+    }
+
+  njobs = start_workers (ctrl, workers, njobs, fnc, opaque);
+  if (!njobs)
+    {
+      /* Process the files ourself.  */
+      while (!(err = next_name (&nfiles, &files, use_stdin, &lno, &name))
+             && name)
+        {
+          rc = fnc (ctrl, name, opaque);
+          if (!first_rc)
+            first_rc = rc;
+          xfree (name);
+        }
+      xfree (pending);
+      xfree (workers);
+      return first_rc? first_rc : err;
+    }
+
+  for (;;)
+    {
+      err = next_name (&nfiles, &files, use_stdin, &lno, &name);
+      if (err && !first_rc)
+        first_rc = err;
+      if (!name)
+        break;
+      len = strlen (name);
+
+      /* Find a worker with room, writing out results until there is
+       * one.  */
+      for (;;)
+        {
+          for (i = 0; i < njobs; i++)
+            {
+              w = workers + (nextw + i) % njobs;
+              if (!w->dead
+                  && w->queued < MAX_QUEUED
+                  && !(w->queued && len > MAX_QUEUED_NAMELEN))
+                break;
+            }
+          if (i < njobs && count < npending)
+            break;
+          if (!count)
+            {
+              w = NULL;  /* All workers are dead.  */
+              break;
+            }
+          p = pending + head;
+          rc = emit_result (workers, p);
+          if (!first_rc)
+            first_rc = rc;
+          xfree (p->name);
+          head = (head + 1) % npending;
+          count--;
+        }
+
+      p = pending + (head + count) % npending;
+      p->name = name;
+      p->worker = -1;
+      if (w && !writen (w->jobfd, &len, sizeof len)
+          && !writen (w->jobfd, name, len))
+        {
+          p->worker = w - workers;
+          w->queued++;
+          nextw = (p->worker + 1) % njobs;
+        }
+      else if (w)
+        w->dead = 1;
+      count++;
+    }
+
+  for (i = 0; i < njobs; i++)
+    close (workers[i].jobfd);
+  for (; count; count--)
+    {
+      p = pending + head;
+      rc = emit_result (workers, p);
+      if (!first_rc)
+        first_rc = rc;
+      xfree (p->name);
+      head = (head + 1) % npending;
+    }
+  for (i = 0; i < njobs; i++)
+    {
+      close (workers[i].resfd);
+      while (waitpid (workers[i].pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    }
+
+  xfree (pending);
+  xfree (workers);
+  return first_rc;
+#endif /*!HAVE_W32_SYSTEM*/
+}
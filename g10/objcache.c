@@ -22,14 +22,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "lcr.h"
 #include "../common/util.h"
+#include "../common/sysutils.h"
+#include "../common/memstat.h"
 #include "packet.h"
 #include "keydb.h"
 #include "options.h"
 #include "objcache.h"
 
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
 /* Note that max value for uid_items is actually the threshold when
  * we start to look for items which can be removed.  */
 #define NO_OF_UID_ITEM_BUCKETS    107
@@ -78,6 +88,38 @@ static unsigned int key_table_dropped;/* # of items dropped.  */
 static key_item_t key_item_attic;     /* List of freed items.  */
 
 
+/* With --persistent-uid-cache the associations of fingerprints and
+ * user ids are in addition kept in the file UID_CACHE_NAME in the
+ * home directory so that a new process does not start with an empty
+ * cache.  The file starts with a record holding the magic and
+ * version, followed by fixed size records with the length of the
+ * fingerprint, the fingerprint, the length of the user id and the
+ * user id.  Longer user ids and keys without a v4 or v5 fingerprint
+ * are not stored.  New entries are appended on exit using a single
+ * write, the same way as done for the signature cache.  Whenever a
+ * keyblock is inserted, updated or deleted the file is removed.  */
+#define SNAP_RECLEN      256
+#define SNAP_UIDOFF      (2 + MAX_FINGERPRINT_LEN)
+#define SNAP_MAXUIDLEN   (SNAP_RECLEN - SNAP_UIDOFF)
+#define SNAP_MAX_ENTRIES (16 * 1024)
+#define SNAP_MAGIC       "LCRuidcache"
+#define SNAP_VERSION     1
+
+static struct
+{
+  int loaded;     /* The file has been read.  */
+  int existed;    /* The file existed when we read it.  */
+  int invalid;    /* The keyring has changed; don't write the file.  */
+  unsigned int nloaded;  /* # of items read from the file.  */
+  unsigned int nstored;  /* # of items written to the file.  */
+
+  /* The records to be appended on exit.  */
+  byte *pending;
+  unsigned int npending;
+  unsigned int pendingsize;
+} snap;
+
+
 
 /* Dump stats.  */
 void
@@ -143,6 +185,10 @@ objcache_dump_stats (void)
             count, uid_table_added, uid_table_dropped,
             empty, minlen > 0? minlen : 0, maxlen,
             uid_table_size, uid_table_max);
+
+  if (opt.persistent_uid_cache)
+    log_info ("objcache: file loaded=%u stored=%u%s\n",
+              snap.nloaded, snap.nstored, snap.invalid? " invalidated":"");
 }
 
 
@@ -180,6 +226,7 @@ uid_table_init (void)
   uid_table_size = NO_OF_UID_ITEM_BUCKETS;
   uid_table_max = MAX_UID_ITEMS_PER_BUCKET;
   uid_table = xcalloc (uid_table_size, sizeof *uid_table);
+  memstat_alloc (MEMSTAT_OBJCACHE, uid_table_size * sizeof *uid_table);
 }
 
 
@@ -260,6 +307,7 @@ uid_table_put (const char *name, unsigned int namelen)
       for (ui = drop_head; ui; ui = ui_next)
         {
           ui_next = ui->next;
+          memstat_free (MEMSTAT_OBJCACHE, sizeof *ui + ui->namelen);
           xfree (ui);
           uid_table_dropped++;
         }
@@ -291,6 +339,7 @@ uid_table_put (const char *name, unsigned int namelen)
   ui->next = uid_table[hash];
   uid_table[hash] = ui;
   uid_table_added++;
+  memstat_alloc (MEMSTAT_OBJCACHE, sizeof *ui + namelen);
   return ui;
 }
 
@@ -320,6 +369,7 @@ key_table_init (void)
   key_table_size = NO_OF_KEY_ITEM_BUCKETS;
   key_table_max  = MAX_KEY_ITEMS_PER_BUCKET;
   key_table = xcalloc (key_table_size, sizeof *key_table);
+  memstat_alloc (MEMSTAT_OBJCACHE, key_table_size * sizeof *key_table);
 }
 
 
@@ -396,24 +446,20 @@ compare_key_items (const void *arg_a, const void *arg_b)
 }
 
 
-/* Put PK into the KEY_TABLE and return a key item.  The reference
- * count for that item is incremented.  If UI is given it is put into
- * the entry.  NULL is return on an allocation error.  */
+/* Put the key with fingerprint (FPR,FPRLEN) and KEYID into the
+ * KEY_TABLE and return a key item.  If UI is given it is put into the
+ * entry.  NULL is return on an allocation error.  */
 static key_item_t
-key_table_put (PKT_public_key *pk, uid_item_t ui)
+key_table_put_fpr (const byte *fpr, size_t fprlen, u32 *keyid,
+                   uid_item_t ui)
 {
   unsigned int hash;
   key_item_t ki;
-  u32 keyid[2];
-  byte fpr[MAX_FINGERPRINT_LEN];
-  size_t fprlen;
   unsigned int count, n;
 
   if (!key_table)
     key_table_init ();
 
-  fingerprint_from_pk (pk, fpr, &fprlen);
-  keyid_from_pk (pk, keyid);
   hash = key_table_hasher (keyid);
   for (ki = key_table[hash], count=0; ki; ki = ki->next, count++)
     if (ki->fprlen == fprlen && !memcmp (ki->fpr, fpr, fprlen))
@@ -495,6 +541,7 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
       kiblock = xtrymalloc (kiblocksize * sizeof *kiblock);
       if (!kiblock)
         return NULL;  /* Out of core.  */
+      memstat_alloc (MEMSTAT_OBJCACHE, kiblocksize * sizeof *kiblock);
       for (n = 0; n < kiblocksize; n++)
         {
           ki = kiblock + n;
@@ -527,6 +574,258 @@ key_table_put (PKT_public_key *pk, uid_item_t ui)
 }
 
 
+/* Put PK into the KEY_TABLE and return a key item.  If UI is given it
+ * is put into the entry.  NULL is return on an allocation error.  */
+static key_item_t
+key_table_put (PKT_public_key *pk, uid_item_t ui)
+{
+  u32 keyid[2];
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  keyid_from_pk (pk, keyid);
+  return key_table_put_fpr (fpr, fprlen, keyid, ui);
+}
+
+
+
+static char *
+snapshot_filename (void)
+{
+  return make_filename (gnupg_homedir (), UID_CACHE_NAME, NULL);
+}
+
+
+/* Read the user id cache file into the tables.  */
+static void
+snapshot_load (void)
+{
+  char *fname;
+  estream_t fp;
+  byte rec[SNAP_RECLEN];
+  unsigned int n = 0;
+  size_t fprlen, uidlen;
+  u32 keyid[2];
+  uid_item_t ui;
+
+  snap.loaded = 1;
+  fname = snapshot_filename ();
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      xfree (fname);
+      return;
+    }
+  snap.existed = 1;
+
+  if (es_fread (rec, SNAP_RECLEN, 1, fp) != 1
+      || memcmp (rec, SNAP_MAGIC, strlen (SNAP_MAGIC))
+      || rec[SNAP_RECLEN-1] != SNAP_VERSION)
+    {
+      log_info ("ignoring invalid user id cache '%s'\n", fname);
+      es_fclose (fp);
+      gnupg_remove (fname);
+      snap.existed = 0;
+      xfree (fname);
+      return;
+    }
+
+  while (es_fread (rec, SNAP_RECLEN, 1, fp) == 1)
+    {
+      if (++n > SNAP_MAX_ENTRIES)
+        {
+          if (opt.verbose)
+            log_info ("removing the full user id cache '%s'\n", fname);
+          gnupg_remove (fname);
+          snap.existed = 0;
+          break;
+        }
+      fprlen = rec[0];
+      uidlen = rec[SNAP_UIDOFF-1];
+      if ((fprlen != 20 && fprlen != 32) || !uidlen)
+        continue;  /* Padding of a truncated record or garbage.  */
+
+      keyid_from_fingerprint (NULL, rec + 1, fprlen, keyid);
+      ui = uid_table_put ((char *)rec + SNAP_UIDOFF, uidlen);
+      if (!ui)
+        break;
+      if (key_table_put_fpr (rec + 1, fprlen, keyid, ui))
+        snap.nloaded++;
+      uid_item_unref (ui);
+    }
+  es_fclose (fp);
+  xfree (fname);
+}
+
+
+/* Read the user id cache file if this has not yet been done.  */
+static inline void
+snapshot_init (void)
+{
+  if (opt.persistent_uid_cache && !snap.loaded)
+    snapshot_load ();
+}
+
+
+/* Queue the new key item KI for the user id cache file.  */
+static void
+snapshot_add (key_item_t ki)
+{
+  byte *rec;
+
+  if (!opt.persistent_uid_cache || snap.invalid || !ki->ui)
+    return;
+  if ((ki->fprlen != 20 && ki->fprlen != 32)
+      || !ki->ui->namelen || ki->ui->namelen > SNAP_MAXUIDLEN)
+    return;
+
+  if (snap.npending == snap.pendingsize)
+    {
+      unsigned int newsize = snap.pendingsize? 2 * snap.pendingsize : 64;
+      byte *p = xtryrealloc (snap.pending, newsize * SNAP_RECLEN);
+
+      if (!p)
+        return;
+      snap.pending = p;
+      snap.pendingsize = newsize;
+    }
+  rec = snap.pending + snap.npending * SNAP_RECLEN;
+  memset (rec, 0, SNAP_RECLEN);
+  rec[0] = ki->fprlen;
+  memcpy (rec + 1, ki->fpr, ki->fprlen);
+  rec[SNAP_UIDOFF-1] = ki->ui->namelen;
+  memcpy (rec + SNAP_UIDOFF, ki->ui->name, ki->ui->namelen);
+  snap.npending++;
+}
+
+
+/* Append the new entries to the user id cache file.  If the file
+ * existed when we read it but it has been removed in the meantime,
+ * the keyring has changed and the entries are dropped.  */
+void
+objcache_flush (void)
+{
+  char *fname;
+  int fd;
+  struct stat st;
+  byte *buf = NULL;
+  size_t len = 0;
+  size_t n;
+  ssize_t nwritten;
+
+  if (!snap.npending || snap.invalid)
+    return;
+
+  fname = snapshot_filename ();
+  fd = gnupg_open (fname, (O_WRONLY|O_APPEND|O_BINARY
+                           | (snap.existed? 0 : O_CREAT)), 0600);
+  if (fd == -1)
+    {
+      if (!snap.existed || errno != ENOENT)
+        log_info ("can't open '%s': %s\n", fname,
+                  gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+  if (fstat (fd, &st))
+    goto leave;
+
+  /* Room for the header or for the padding of a truncated record
+   * from an interrupted write.  */
+  buf = xtrycalloc (snap.npending + 1, SNAP_RECLEN);
+  if (!buf)
+    goto leave;
+  if (!st.st_size)
+    {
+      memcpy (buf, SNAP_MAGIC, strlen (SNAP_MAGIC));
+      buf[SNAP_RECLEN-1] = SNAP_VERSION;
+      len = SNAP_RECLEN;
+    }
+  else if (st.st_size % SNAP_RECLEN)
+    len = SNAP_RECLEN - st.st_size % SNAP_RECLEN;
+  memcpy (buf + len, snap.pending, snap.npending * SNAP_RECLEN);
+  len += snap.npending * SNAP_RECLEN;
+
+  for (n = 0; n < len; n += nwritten)
+    {
+      nwritten = write (fd, buf + n, len - n);
+      if (nwritten < 0)
+        {
+          log_info ("error writing '%s': %s\n", fname,
+                    gpg_strerror (gpg_error_from_syserror ()));
+          break;
+        }
+    }
+  snap.nstored += snap.npending;
+  snap.npending = 0;
+  snap.existed = 1;
+
+ leave:
+  if (fd != -1)
+    close (fd);
+  xfree (buf);
+  xfree (fname);
+}
+
+
+/* Remove the user id cache file because the keyring has been
+ * changed.  This is called before keyblocks are inserted, updated or
+ * deleted.  */
+void
+objcache_invalidate_file (void)
+{
+  char *fname;
+
+  if (!opt.persistent_uid_cache || snap.invalid)
+    return;
+
+  snap.invalid = 1;
+  snap.npending = 0;
+  fname = snapshot_filename ();
+  if (gnupg_remove (fname) && errno != ENOENT)
+    log_info ("error removing '%s': %s\n", fname,
+              gpg_strerror (gpg_error_from_syserror ()));
+  xfree (fname);
+}
+
+
+/* Release all cached items and reset the state of the user id cache
+ * file.  Entries not yet written to the file are dropped.  */
+void
+objcache_release (void)
+{
+  size_t idx;
+  key_item_t ki, ki_next;
+  uid_item_t ui, ui_next;
+
+  for (idx = 0; idx < key_table_size; idx++)
+    for (ki = key_table[idx]; ki; ki = ki_next)
+      {
+        ki_next = ki->next;
+        key_item_free (ki);
+      }
+  memstat_free (MEMSTAT_OBJCACHE, key_table_size * sizeof *key_table);
+  xfree (key_table);
+  key_table = NULL;
+  key_table_size = 0;
+
+  for (idx = 0; idx < uid_table_size; idx++)
+    for (ui = uid_table[idx]; ui; ui = ui_next)
+      {
+        ui_next = ui->next;
+        memstat_free (MEMSTAT_OBJCACHE, sizeof *ui + ui->namelen);
+        xfree (ui);
+      }
+  memstat_free (MEMSTAT_OBJCACHE, uid_table_size * sizeof *uid_table);
+  xfree (uid_table);
+  uid_table = NULL;
+  uid_table_size = 0;
+
+  xfree (snap.pending);
+  memset (&snap, 0, sizeof snap);
+}
+
+
 
 /* Return the user ID from the given keyblock.  We use the primary uid
  * flag which should have already been set.  The returned value is
@@ -558,6 +857,8 @@ cache_put_keyblock (kbnode_t keyblock)
   uid_item_t ui = NULL;
   kbnode_t k;
 
+  snapshot_init ();
+
  restart:
   for (k = keyblock; k; k = k->next)
     {
@@ -590,12 +891,18 @@ cache_put_keyblock (kbnode_t keyblock)
             }
           else /* With a UID we use the update cache mode.  */
             {
-              if (!key_table_put (k->pkt->pkt.public_key, ui))
+              unsigned int added = key_table_added;
+              key_item_t ki;
+
+              ki = key_table_put (k->pkt->pkt.public_key, ui);
+              if (!ki)
                 {
                   log_info ("Note: failed to cache a key: %s\n",
                             gpg_strerror (gpg_error_from_syserror ()));
                   goto leave;
                 }
+              if (added != key_table_added)
+                snapshot_add (ki);
             }
         }
     }
@@ -620,6 +927,7 @@ cache_get_uid_bykid (u32 *keyid, unsigned int *r_length)
   if (r_length)
     *r_length = 0;
 
+  snapshot_init ();
   ki = key_table_get (NULL, keyid);
   if (!ki)
     return NULL; /* Not found or duplicate keyid.  */
@@ -659,6 +967,7 @@ cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length)
   if (r_length)
     *r_length = 0;
 
+  snapshot_init ();
   if (!key_table)
     return NULL;
 
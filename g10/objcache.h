@@ -21,7 +21,13 @@
 #ifndef GNUPG_G10_OBJCACHE_H
 #define GNUPG_G10_OBJCACHE_H
 
+/* The name of the user id cache file in the home directory.  */
+#define UID_CACHE_NAME "uidcache.dat"
+
 void objcache_dump_stats (void);
+void objcache_flush (void);
+void objcache_invalidate_file (void);
+void objcache_release (void);
 void cache_put_keyblock (kbnode_t keyblock);
 char *cache_get_uid_bykid (u32 *keyid, unsigned int *r_length);
 char *cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length);
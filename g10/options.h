@@ -81,6 +81,45 @@ struct
 
   /* The AEAD chunk size expressed as a power of 2.  */
   int chunk_size;
+  int explicit_chunk_size;  /* --chunk-size was given.  */
+
+  /* The number of worker threads for AEAD chunks; 0 or 1 processes
+   * the chunks in the main thread.  */
+  unsigned int aead_threads;
+
+  /* The number of threads to check the self-signatures of an
+   * imported key; 0 or 1 checks them in the main thread.  */
+  unsigned int import_threads;
+
+  /* The number of threads to check the signatures of the keys listed
+   * by a listing of all keys; 0 or 1 checks them in the main
+   * thread.  */
+  unsigned int list_threads;
+
+  /* Verify the Ed25519 signatures of keys and messages in batches.  */
+  int batch_verify;
+
+  /* The number of threads to verify the signatures of a message with
+   * several signatures; 0 or 1 verifies them in the main thread.  */
+  unsigned int verify_threads;
+
+  /* Let the agent generate the RSA keys of a parameter file ahead of
+     time and write the keys in one batch.  */
+  int parallel_keygen;
+
+  /* The number of threads to compute the digests for signers using
+   * different digest algorithms; 0 or 1 computes them in the main
+   * thread.  With 2 or more the MDC of a CFB message is computed on
+   * a separate thread.  */
+  unsigned int hash_threads;
+
+  /* The number of threads to encrypt the session key for the
+   * recipients; 0 or 1 encrypts it in the main thread.  */
+  unsigned int encrypt_threads;
+
+  /* The number of ephemeral ECDH keys per curve to precompute in the
+   * background; 0 disables the pool.  */
+  unsigned int ephemeral_key_pool;
 
   int dry_run;
   int autostart;
@@ -122,6 +161,10 @@ struct
   int explicit_compress_option; /* A compress option was explicitly given. */
   int compress_level;
   int bz2_compress_level;
+  unsigned int compress_threads;
+  int compress_adaptive;  /* Store incompressible parts of the input.  */
+  int pipeline_filters;
+  unsigned int multifile_jobs;
   int bz2_decompress_lowmem;
   strlist_t def_secret_key;
   char *def_recipient;
@@ -146,6 +189,8 @@ struct
   int marginals_needed;
   int completes_needed;
   int max_cert_depth;
+  unsigned int trustdb_cache_size; /* Records in the trustdb cache.  */
+  unsigned int pk_cache_size; /* Entries in the public key cache.  */
   char *agent_program;
   char *keyboxd_program;
   char *dirmngr_program;
@@ -241,6 +286,8 @@ struct
   int try_all_secrets;
   int no_expensive_trust_checks;
   int no_sig_cache;
+  int persistent_sig_cache; /* Also cache key signature checks in a file. */
+  int persistent_uid_cache; /* Also cache user ids in a file.  */
   int no_auto_check_trustdb;
   int preserve_permissions;
   int no_homedir_creation;
@@ -256,6 +303,9 @@ struct
   /* If true, let write failures on the status-fd exit the process. */
   int exit_on_status_write_error;
 
+  /* If true, do not flush the status-fd after each line.  */
+  int status_buffered;
+
   /* If > 0, limit the number of card insertion prompts to this
      value. */
   int limit_card_insert_tries;
@@ -279,6 +329,7 @@ struct
     unsigned int utf8_filename:1;
     unsigned int dsa2:1;
     unsigned int allow_old_cipher_algos:1;
+    unsigned int allow_zstd_compression:1;
     unsigned int allow_weak_digest_algos:1;
     unsigned int allow_weak_key_signatures:1;
     unsigned int large_rsa:1;
@@ -313,6 +364,8 @@ struct
     unsigned int disable_pqc_encryption:1;
     /* Process all signatures even in batch mode.  */
     unsigned int proc_all_sigs:1;
+    /* Start the network auto-key-locate mechanisms concurrently.  */
+    unsigned int akl_parallel:1;
   } flags;
 
   /* Linked list of ways to find a key if the key isn't on the local
@@ -479,6 +532,7 @@ EXTERN_UNLESS_MAIN_MODULE int memory_stat_debug_mode;
 #define KEYSERVER_ADD_FAKE_V3            (1<<2)
 #define KEYSERVER_AUTO_KEY_RETRIEVE      (1<<3)
 #define KEYSERVER_HONOR_KEYSERVER_URL    (1<<4)
+#define KEYSERVER_REFRESH_IF_CHANGED     (1<<5)
 
 
 #endif /*G10_OPTIONS_H*/
@@ -0,0 +1,432 @@
+/* packet-bench.c - Benchmark the packet layer
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This program measures the packet layer on a corpus of OpenPGP
+ * files, for example keyrings or signatures.  The files are read
+ * into memory first so that neither process startup nor disk I/O is
+ * measured.  It is not run by "make check"; use for example
+ *
+ *   make -C g10 packet-bench
+ *   g10/packet-bench --iterations 20 tests/openpgp/pubring.asc
+ *
+ * The operations are
+ *
+ *   parse  - parse_packet on all packets of the corpus.
+ *   build  - build_packet of the parsed packets.
+ *   merge  - merge_keys_and_selfsig on the keyblocks of the corpus;
+ *            this includes checking the self-signatures.
+ *   check  - check_key_signature on all self-signatures.
+ *
+ * For each operation the time and the number of allocations through
+ * Libgcrypt's allocator, which is used by xmalloc and friends, per
+ * packet or signature are reported as JSON.  Armored files are
+ * dearmored while reading them.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define INCLUDED_BY_MAIN_MODULE 1
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/membuf.h"
+#include "options.h"
+#include "packet.h"
+#include "keydb.h"
+#include "filter.h"
+#include "main.h"
+
+#define PGM "packet-bench"
+
+static int verbose;
+static FILE *jsonfp;
+static int nresults;
+
+/* The number of calls to the allocation functions.  */
+static unsigned long long n_allocs;
+
+
+/* The corpus read into memory.  */
+struct corpus_s
+{
+  char *data;
+  size_t datalen;
+  unsigned int npackets;
+};
+
+
+/* The allocation handlers for Libgcrypt which count all
+ * allocations.  */
+static void *
+count_malloc (size_t n)
+{
+  n_allocs++;
+  return malloc (n);
+}
+
+static int
+count_is_secure (const void *p)
+{
+  (void)p;
+  return 0;
+}
+
+static void *
+count_realloc (void *p, size_t n)
+{
+  n_allocs++;
+  return realloc (p, n);
+}
+
+static void
+count_free (void *p)
+{
+  free (p);
+}
+
+
+static unsigned long long
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* Write the result of operation OP which processed COUNT items in
+ * NS nanoseconds and did ALLOCS allocations.  */
+static void
+emit_result (const char *op, unsigned long long count,
+             unsigned long long ns, unsigned long long allocs)
+{
+  double per = count? (double)ns / count : 0.0;
+  double aper = count? (double)allocs / count : 0.0;
+
+  fprintf (jsonfp, "%s\n    { \"op\": \"%s\", \"count\": %llu,"
+           " \"total_ms\": %.3f, \"ns_per_item\": %.1f,"
+           " \"allocs_per_item\": %.2f }",
+           nresults? ",":"", op, count, ns / 1e6, per, aper);
+  nresults++;
+
+  if (verbose)
+    fprintf (stderr, PGM ": %-6s %10llu items %12.1f ns/item"
+             " %8.2f allocs/item\n", op, count, per, aper);
+}
+
+
+/* Append the file FNAME to CORPUS.  */
+static void
+read_file (const char *fname, membuf_t *mb)
+{
+  iobuf_t inp;
+  armor_filter_context_t *afx;
+  char buffer[8192];
+  int n;
+
+  inp = iobuf_open (fname);
+  if (!inp)
+    log_fatal ("can't open '%s': %s\n", fname,
+               gpg_strerror (gpg_error_from_syserror ()));
+  afx = new_armor_context ();
+  push_armor_filter (afx, inp);
+  release_armor_context (afx);
+  while ((n = iobuf_read (inp, buffer, sizeof buffer)) != -1)
+    put_membuf (mb, buffer, n);
+  iobuf_close (inp);
+}
+
+
+/* Parse all packets of CORPUS.  If R_KEYBLOCKS is not NULL the
+ * packets are collected into keyblocks which are stored there as an
+ * array of NKEYBLOCKS items.  If R_PACKETS is not NULL all packets
+ * are stored there as an array with CORPUS->NPACKETS items.  Only one
+ * of them may be given.  */
+static void
+parse_corpus (struct corpus_s *corpus, kbnode_t **r_keyblocks,
+              unsigned int *r_nkeyblocks, PACKET **r_packets)
+{
+  struct parse_packet_ctx_s parsectx;
+  iobuf_t inp;
+  PACKET *pkt;
+  kbnode_t *keyblocks = NULL;
+  PACKET *packets = NULL;
+  unsigned int nkeyblocks = 0;
+  unsigned int npackets = 0;
+  size_t allocated = 0;
+  int err;
+
+  inp = iobuf_temp_with_content (corpus->data, corpus->datalen);
+  pkt = xmalloc (sizeof *pkt);
+  init_packet (pkt);
+  init_parse_packet (&parsectx, inp);
+  while ((err = parse_packet (&parsectx, pkt)) != -1)
+    {
+      if (err)
+        {
+          free_packet (pkt, &parsectx);
+          init_packet (pkt);
+          continue;
+        }
+
+      npackets++;
+      if (r_packets)
+        {
+          /* The array takes over the content of PKT.  */
+          if (npackets > allocated)
+            {
+              allocated = allocated? allocated * 2 : 1024;
+              packets = xrealloc (packets, allocated * sizeof *packets);
+            }
+          packets[npackets-1] = *pkt;
+        }
+      else if (r_keyblocks
+               && (pkt->pkttype == PKT_PUBLIC_KEY
+                   || pkt->pkttype == PKT_SECRET_KEY))
+        {
+          keyblocks = xrealloc (keyblocks,
+                                (nkeyblocks + 1) * sizeof *keyblocks);
+          keyblocks[nkeyblocks++] = new_kbnode (pkt);
+          pkt = xmalloc (sizeof *pkt);
+        }
+      else if (r_keyblocks && nkeyblocks)
+        {
+          add_kbnode (keyblocks[nkeyblocks-1], new_kbnode (pkt));
+          pkt = xmalloc (sizeof *pkt);
+        }
+      else
+        free_packet (pkt, &parsectx);
+      init_packet (pkt);
+    }
+  free_packet (pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  xfree (pkt);
+  iobuf_close (inp);
+
+  corpus->npackets = npackets;
+  if (r_keyblocks)
+    {
+      *r_keyblocks = keyblocks;
+      *r_nkeyblocks = nkeyblocks;
+    }
+  if (r_packets)
+    *r_packets = packets;
+}
+
+
+static void
+bench_parse (struct corpus_s *corpus, unsigned int iterations)
+{
+  unsigned long long start, allocs, count = 0;
+  unsigned int i;
+
+  allocs = n_allocs;
+  start = now_ns ();
+  for (i = 0; i < iterations; i++)
+    {
+      parse_corpus (corpus, NULL, NULL, NULL);
+      count += corpus->npackets;
+    }
+  emit_result ("parse", count, now_ns () - start, n_allocs - allocs);
+}
+
+
+static void
+bench_build (struct corpus_s *corpus, unsigned int iterations)
+{
+  unsigned long long start, allocs, count = 0;
+  PACKET *packets;
+  iobuf_t out;
+  unsigned int i, n;
+  int err;
+
+  parse_corpus (corpus, NULL, NULL, &packets);
+
+  allocs = n_allocs;
+  start = now_ns ();
+  for (i = 0; i < iterations; i++)
+    {
+      out = iobuf_temp ();
+      for (n = 0; n < corpus->npackets; n++)
+        {
+          err = build_packet (out, packets + n);
+          if (err)
+            log_fatal ("build_packet failed: %s\n", gpg_strerror (err));
+        }
+      iobuf_close (out);
+      count += corpus->npackets;
+    }
+  emit_result ("build", count, now_ns () - start, n_allocs - allocs);
+
+  for (n = 0; n < corpus->npackets; n++)
+    free_packet (packets + n, NULL);
+  xfree (packets);
+}
+
+
+static void
+release_keyblocks (kbnode_t *keyblocks, unsigned int nkeyblocks)
+{
+  unsigned int n;
+
+  for (n = 0; n < nkeyblocks; n++)
+    release_kbnode (keyblocks[n]);
+  xfree (keyblocks);
+}
+
+
+static void
+bench_merge (ctrl_t ctrl, struct corpus_s *corpus, unsigned int iterations)
+{
+  unsigned long long start, ns = 0, allocs = 0, count = 0;
+  kbnode_t *keyblocks;
+  unsigned int i, n, nkeyblocks;
+
+  for (i = 0; i < iterations; i++)
+    {
+      /* Parse again so that no cached results are used.  */
+      parse_corpus (corpus, &keyblocks, &nkeyblocks, NULL);
+      allocs -= n_allocs;
+      start = now_ns ();
+      for (n = 0; n < nkeyblocks; n++)
+        merge_keys_and_selfsig (ctrl, keyblocks[n]);
+      ns += now_ns () - start;
+      allocs += n_allocs;
+      count += nkeyblocks;
+      release_keyblocks (keyblocks, nkeyblocks);
+    }
+  emit_result ("merge", count, ns, allocs);
+}
+
+
+static void
+bench_check (ctrl_t ctrl, struct corpus_s *corpus, unsigned int iterations)
+{
+  unsigned long long start, ns = 0, allocs = 0, count = 0;
+  kbnode_t *keyblocks, node;
+  unsigned int i, n, nkeyblocks;
+  u32 mainkid[2];
+  PKT_signature *sig;
+  int is_selfsig;
+
+  for (i = 0; i < iterations; i++)
+    {
+      parse_corpus (corpus, &keyblocks, &nkeyblocks, NULL);
+      allocs -= n_allocs;
+      start = now_ns ();
+      for (n = 0; n < nkeyblocks; n++)
+        {
+          keyid_from_pk (keyblocks[n]->pkt->pkt.public_key, mainkid);
+          for (node = keyblocks[n]->next; node; node = node->next)
+            {
+              if (node->pkt->pkttype != PKT_SIGNATURE)
+                continue;
+              sig = node->pkt->pkt.signature;
+              if (sig->keyid[0] != mainkid[0] || sig->keyid[1] != mainkid[1])
+                continue;
+              check_key_signature (ctrl, keyblocks[n], node, &is_selfsig);
+              count++;
+            }
+        }
+      ns += now_ns () - start;
+      allocs += n_allocs;
+      release_keyblocks (keyblocks, nkeyblocks);
+    }
+  emit_result ("check", count, ns, allocs);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *output = NULL;
+  unsigned int iterations = 10;
+  struct corpus_s corpus;
+  membuf_t mb;
+  ctrl_t ctrl;
+
+  gcry_set_allocation_handler (count_malloc, count_malloc, count_is_secure,
+                               count_realloc, count_free);
+
+  for (argc--, argv++; argc && **argv == '-'; argc--, argv++)
+    {
+      if (!strcmp (*argv, "--verbose"))
+        verbose = 1;
+      else if (argc > 1 && !strcmp (*argv, "--iterations"))
+        {
+          iterations = strtoul (*++argv, NULL, 10); argc--;
+        }
+      else if (argc > 1 && !strcmp (*argv, "--output"))
+        {
+          output = *++argv; argc--;
+        }
+      else
+        argc = 0;
+    }
+  if (!argc || !iterations)
+    {
+      fputs ("usage: " PGM " [--iterations N] [--output FILE] [--verbose]"
+             " FILES\n", stderr);
+      exit (2);
+    }
+
+  log_set_prefix (PGM, GPGRT_LOG_WITH_PREFIX);
+  opt.no_sig_cache = 1;
+
+  init_membuf (&mb, 65536);
+  for (; argc; argc--, argv++)
+    read_file (*argv, &mb);
+  corpus.data = get_membuf (&mb, &corpus.datalen);
+  if (!corpus.data)
+    log_fatal ("error reading the corpus: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+  corpus.npackets = 0;
+
+  if (output)
+    {
+      jsonfp = fopen (output, "w");
+      if (!jsonfp)
+        log_fatal ("can't create '%s': %s\n", output, strerror (errno));
+    }
+  else
+    jsonfp = stdout;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  parse_corpus (&corpus, NULL, NULL, NULL);
+  fprintf (jsonfp, "{\n  \"bytes\": %lu, \"packets\": %u,"
+           " \"iterations\": %u,\n  \"results\": [",
+           (unsigned long)corpus.datalen, corpus.npackets, iterations);
+  bench_parse (&corpus, iterations);
+  bench_build (&corpus, iterations);
+  bench_merge (ctrl, &corpus, iterations);
+  bench_check (ctrl, &corpus, iterations);
+  fputs ("\n  ]\n}\n", jsonfp);
+  if (jsonfp != stdout && fclose (jsonfp))
+    log_fatal ("error writing '%s': %s\n", output, strerror (errno));
+
+  xfree (ctrl);
+  xfree (corpus.data);
+  return 0;
+}
@@ -413,6 +413,10 @@ typedef struct
   u32     keyid[2];
   /* Fingerprint of the key.  Only valid if FPRLEN is not 0.  */
   byte    fpr[MAX_FINGERPRINT_LEN];
+  /* Keygrips of the key and of the second algorithm of a dual key.
+     Never access these values directly; use keygrip_from_pk().  */
+  byte    grip[KEYGRIP_LEN];
+  byte    grip2[KEYGRIP_LEN];
   prefitem_t *prefs;      /* list of preferences (may be NULL) */
   struct
   {
@@ -432,6 +436,8 @@ typedef struct
     unsigned int backsig:2;       /* 0=none, 1=bad, 2=good.  */
     unsigned int serialno_valid:1;/* SERIALNO below is valid.  */
     unsigned int exact:1;         /* Found via exact (!) search.  */
+    unsigned int grip_valid:1;    /* GRIP above is valid.  */
+    unsigned int grip2_valid:1;   /* GRIP2 above is valid.  */
   } flags;
   PKT_user_id *user_id;   /* If != NULL: found by that uid. */
   struct revocation_key *revkey;
@@ -668,6 +674,13 @@ void register_known_notation (const char *string);
 int set_packet_list_mode( int mode );
 
 
+/* Flags for the parse mask of a parse context.  Packets selected by
+   the mask are skipped instead of being returned.  They are still
+   counted in N_PARSED_PACKETS.  */
+#define PARSE_SKIP_ATTRIBUTES  1  /* Attribute packets (photo IDs).  */
+#define PARSE_SKIP_SIGS        2  /* All signature packets.  */
+#define PARSE_SKIP_OTHER_CERTS 4  /* User ID certifications by other keys.  */
+
 /* A context used with parse_packet.  */
 struct parse_packet_ctx_s
 {
@@ -678,6 +691,8 @@ struct parse_packet_ctx_s
   int only_fookey_enc;  /* Stop if the packet is not {sym,pub}key_enc. */
   unsigned int n_parsed_packets;	/* Number of parsed packets.  */
   int last_ctb;      /* The last CTB read.  */
+  unsigned int parse_mask;  /* PARSE_SKIP_* flags.  */
+  u32 primary_keyid[2];     /* Used with PARSE_SKIP_OTHER_CERTS.  */
 };
 typedef struct parse_packet_ctx_s *parse_packet_ctx_t;
 
@@ -690,6 +705,7 @@ typedef struct parse_packet_ctx_s *parse_packet_ctx_t;
     (a)->only_fookey_enc = 0;       \
     (a)->n_parsed_packets = 0;      \
     (a)->last_ctb = 1;              \
+    (a)->parse_mask = 0;            \
   } while (0)
 
 #define deinit_parse_packet(a) do { \
@@ -981,6 +997,8 @@ gpg_error_t update_keysig_packet (ctrl_t ctrl,
                       PKT_public_key *pksk,
                       int (*mksubpkt)(PKT_signature *, void *),
                       void *opaque   );
+void keysig_batch_begin (void);
+gpg_error_t keysig_batch_end (ctrl_t ctrl);
 
 /*-- keygen.c --*/
 PKT_user_id *generate_user_id (kbnode_t keyblock, const char *uidstr);
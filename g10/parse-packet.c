@@ -29,6 +29,7 @@
 #include "../common/util.h"
 #include "packet.h"
 #include "../common/iobuf.h"
+#include "../common/tstats.h"
 #include "filter.h"
 #include "photoid.h"
 #include "options.h"
@@ -744,6 +745,7 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
 
   *skip = 0;
   inp = ctx->inp;
+  TSTAT_ENTER (TSTAT_PARSE_PACKET);
 
  again:
   log_assert (!pkt->pkt.generic);
@@ -956,6 +958,22 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
       goto leave;
     }
 
+  if ((pkttype == PKT_ATTRIBUTE
+       && (ctx->parse_mask & PARSE_SKIP_ATTRIBUTES))
+      || (pkttype == PKT_SIGNATURE
+          && (ctx->parse_mask & PARSE_SKIP_SIGS)))
+    {
+      /* The caller does not want this packet.  Also forget the
+       * previous packet so that a following ring trust packet is not
+       * applied to it.  */
+      iobuf_skip_rest (inp, pktlen, partial);
+      ctx->n_parsed_packets++;
+      free_packet (NULL, ctx);
+      *skip = 1;
+      rc = 0;
+      goto leave;
+    }
+
   if (DBG_PACKET)
     {
 #if DEBUG_PARSE_PACKET
@@ -1049,6 +1067,26 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
       break;
     }
 
+  if (!rc && (ctx->parse_mask & PARSE_SKIP_OTHER_CERTS))
+    {
+      if (pkttype == PKT_PUBLIC_KEY || pkttype == PKT_SECRET_KEY)
+        keyid_from_pk (pkt->pkt.public_key, ctx->primary_keyid);
+      else if (pkttype == PKT_SIGNATURE
+               && ((pkt->pkt.signature->sig_class & ~3) == 0x10
+                   || pkt->pkt.signature->sig_class == 0x30)
+               && (pkt->pkt.signature->keyid[0]
+                   || pkt->pkt.signature->keyid[1])
+               && (pkt->pkt.signature->keyid[0] != ctx->primary_keyid[0]
+                   || pkt->pkt.signature->keyid[1] != ctx->primary_keyid[1]))
+        {
+          /* A certification by another key which is not wanted.  */
+          free_packet (pkt, NULL);
+          free_packet (NULL, ctx);
+          *skip = 1;
+          goto leave;
+        }
+    }
+
   /* Store a shallow copy of certain packets in the context.  */
   free_packet (NULL, ctx);
   if (!rc && (pkttype == PKT_PUBLIC_KEY
@@ -1065,6 +1103,8 @@ parse (parse_packet_ctx_t ctx, PACKET *pkt, int onlykeypkts, off_t * retpos,
   if (!rc && iobuf_error (inp))
     rc = GPG_ERR_INV_KEYRING;
 
+  TSTAT_LEAVE (TSTAT_PARSE_PACKET);
+
   /* FIXME: We use only the error code for now to avoid problems with
      callers which have not been checked to always use gpg_err_code()
      when comparing error codes.  */
@@ -2212,6 +2252,160 @@ parse_revkeys (PKT_signature * sig)
 }
 
 
+/* The subpackets parse_signature extracts.  */
+static const sigsubpkttype_t scanned_subpkt_types[] =
+  {
+    SIGSUBPKT_SIG_CREATED, SIGSUBPKT_SIG_EXPIRE, SIGSUBPKT_EXPORTABLE,
+    SIGSUBPKT_TRUST, SIGSUBPKT_REGEXP, SIGSUBPKT_REVOCABLE,
+    SIGSUBPKT_POLICY, SIGSUBPKT_PREF_KS, SIGSUBPKT_ISSUER,
+    SIGSUBPKT_NOTATION, SIGSUBPKT_SIGNERS_UID, SIGSUBPKT_ISSUER_FPR,
+    SIGSUBPKT_KEY_BLOCK
+  };
+
+/* The result of a single walk over a subpacket area: the first
+ * occurrence of each of the above types and whether there is a
+ * critical subpacket we do not understand.  */
+struct subpkt_scan_s
+{
+  int unknown_critical;
+  struct {
+    int seen;
+    const byte *data;  /* NULL for a malformed subpacket.  */
+    size_t n;
+  } item[DIM (scanned_subpkt_types)];
+};
+
+
+static int
+scanned_subpkt_index (int type)
+{
+  int i;
+
+  for (i = 0; i < DIM (scanned_subpkt_types); i++)
+    if (scanned_subpkt_types[i] == type)
+      return i;
+  return -1;
+}
+
+
+/* Walk over the hashed or unhashed subpacket area of SIG once and
+ * fill SCAN.  This gives the same results as separate calls of
+ * enum_sig_subpkt for each of the types but parses the area only a
+ * single time.  */
+static void
+scan_sig_subpkts (PKT_signature *sig, int want_hashed,
+                  struct subpkt_scan_s *scan)
+{
+  const subpktarea_t *pktbuf = want_hashed? sig->hashed : sig->unhashed;
+  const byte *buffer;
+  int buflen;
+  int type, critical, idx;
+  size_t n;
+
+  memset (scan, 0, sizeof *scan);
+  if (!pktbuf)
+    return;
+
+  buffer = pktbuf->data;
+  buflen = pktbuf->len;
+  while (buflen)
+    {
+      n = *buffer++;
+      buflen--;
+      if (n == 255) /* 4 byte length header.  */
+	{
+	  if (buflen < 4)
+	    goto too_short;
+	  n = buf32_to_size_t (buffer);
+	  buffer += 4;
+	  buflen -= 4;
+	}
+      else if (n >= 192) /* 4 byte special encoded length header.  */
+	{
+	  if (buflen < 2)
+	    goto too_short;
+	  n = ((n - 192) << 8) + *buffer + 192;
+	  buffer++;
+	  buflen--;
+	}
+      if (buflen < n)
+	goto too_short;
+      if (!buflen)
+        goto no_type_byte;
+      type = *buffer;
+      critical = !!(type & 0x80);
+      type &= 0x7f;
+
+      if (critical && !scan->unknown_critical)
+        {
+          if (n - 1 > buflen + 1)
+            scan->unknown_critical = 1;
+          else if (!can_handle_critical (buffer + 1, n - 1, type))
+            {
+              if (opt.verbose && !glo_ctrl.silence_parse_warnings)
+                log_info (_("subpacket of type %d has "
+                            "critical bit set\n"), type);
+              scan->unknown_critical = 1;
+            }
+        }
+
+      idx = scanned_subpkt_index (type);
+      if (idx != -1 && !scan->item[idx].seen)
+        {
+          scan->item[idx].seen = 1;
+          if (n)
+            {
+              scan->item[idx].data = buffer + 1;
+              scan->item[idx].n = n - 1;
+            }
+        }
+
+      buffer += n;
+      buflen -= n;
+    }
+  return;
+
+ too_short:
+  if (opt.debug && !glo_ctrl.silence_parse_warnings)
+    {
+      es_fflush (es_stdout);
+      log_printhex (pktbuf->data, pktbuf->len > 16? 16 : pktbuf->len,
+                    "buffer shorter than subpacket (%zu/%d/%zu); dump:",
+                    pktbuf->len, buflen, n);
+    }
+  scan->unknown_critical = 1;
+  return;
+
+ no_type_byte:
+  if (opt.verbose && !glo_ctrl.silence_parse_warnings)
+    log_info ("type octet missing in subpacket\n");
+  scan->unknown_critical = 1;
+}
+
+
+/* Return the subpacket of TYPE from SCAN like parse_sig_subpkt.  */
+static const byte *
+scanned_subpkt (struct subpkt_scan_s *scan, sigsubpkttype_t type,
+                size_t *ret_n)
+{
+  int idx = scanned_subpkt_index (type);
+  int offset;
+
+  log_assert (idx != -1);
+  if (!scan->item[idx].data)
+    return NULL;
+  if (ret_n)
+    *ret_n = scan->item[idx].n;
+  offset = parse_one_sig_subpkt (scan->item[idx].data, scan->item[idx].n,
+                                 type);
+  if (offset == -2)
+    log_error ("subpacket of type %d too short\n", type);
+  if (offset < 0)
+    return NULL;
+  return scan->item[idx].data + offset;
+}
+
+
 int
 parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 		 PKT_signature * sig)
@@ -2347,16 +2541,21 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 
   if (is_v4or5 && sig->pubkey_algo)  /* Extract required information.  */
     {
+      struct subpkt_scan_s hashed, unhashed;
       const byte *p;
       size_t len;
 
+      /* Walk over both areas only once instead of searching them for
+       * every subpacket type.  */
+      scan_sig_subpkts (sig, 1, &hashed);
+      scan_sig_subpkts (sig, 0, &unhashed);
+
       /* Set sig->flags.unknown_critical if there is a critical bit
        * set for packets which we do not understand.  */
-      if (!parse_sig_subpkt (sig, 1, SIGSUBPKT_TEST_CRITICAL, NULL)
-	  || !parse_sig_subpkt (sig, 0, SIGSUBPKT_TEST_CRITICAL, NULL))
+      if (hashed.unknown_critical || unhashed.unknown_critical)
 	sig->flags.unknown_critical = 1;
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIG_CREATED, NULL);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_SIG_CREATED, NULL);
       if (p)
 	sig->timestamp = buf32_to_u32 (p);
       else if (!(sig->pubkey_algo >= 100 && sig->pubkey_algo <= 110)
@@ -2366,7 +2565,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
       /* Set the key id.  We first try the issuer fingerprint and if
        * it is a v4 signature the fallback to the issuer.  Note that
        * only the issuer packet is also searched in the unhashed area.  */
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_ISSUER_FPR, &len);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_ISSUER_FPR, &len);
       if (p && len == 21 && p[0] == 4)
         {
           sig->keyid[0] = buf32_to_u32 (p + 1 + 12);
@@ -2377,7 +2576,8 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
           sig->keyid[0] = buf32_to_u32 (p + 1 );
 	  sig->keyid[1] = buf32_to_u32 (p + 1 + 4);
 	}
-      else if ((p = parse_sig_subpkt2 (sig, SIGSUBPKT_ISSUER)))
+      else if ((p = scanned_subpkt (&hashed, SIGSUBPKT_ISSUER, NULL))
+               || (p = scanned_subpkt (&unhashed, SIGSUBPKT_ISSUER, NULL)))
         {
           sig->keyid[0] = buf32_to_u32 (p);
 	  sig->keyid[1] = buf32_to_u32 (p + 4);
@@ -2386,21 +2586,21 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	       && opt.verbose > 1 && !glo_ctrl.silence_parse_warnings)
 	log_info ("signature packet without keyid\n");
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIG_EXPIRE, NULL);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_SIG_EXPIRE, NULL);
       if (p && buf32_to_u32 (p))
 	sig->expiredate = sig->timestamp + buf32_to_u32 (p);
       if (sig->expiredate && sig->expiredate <= make_timestamp ())
 	sig->flags.expired = 1;
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_POLICY, NULL);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_POLICY, NULL);
       if (p)
 	sig->flags.policy_url = 1;
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_PREF_KS, NULL);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_PREF_KS, NULL);
       if (p)
 	sig->flags.pref_ks = 1;
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_SIGNERS_UID, &len);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_SIGNERS_UID, &len);
       if (p && len)
         {
           char *mbox;
@@ -2419,19 +2619,19 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
             }
         }
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_KEY_BLOCK, NULL);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_KEY_BLOCK, NULL);
       if (p)
         sig->flags.key_block = 1;
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_NOTATION, NULL);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_NOTATION, NULL);
       if (p)
 	sig->flags.notation = 1;
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_REVOCABLE, NULL);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_REVOCABLE, NULL);
       if (p && *p == 0)
 	sig->flags.revocable = 0;
 
-      p = parse_sig_subpkt (sig, 1, SIGSUBPKT_TRUST, &len);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_TRUST, &len);
       if (p && len == 2)
 	{
 	  sig->trust_depth = p[0];
@@ -2440,7 +2640,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	  /* Only look for a regexp if there is also a trust
 	     subpacket. */
 	  sig->trust_regexp =
-	    parse_sig_subpkt (sig, 1, SIGSUBPKT_REGEXP, &len);
+	    scanned_subpkt (&hashed, SIGSUBPKT_REGEXP, &len);
 
 	  /* If the regular expression is of 0 length, there is no
 	     regular expression. */
@@ -2453,7 +2653,9 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
          unhashed area.  In theory, anyway, we should never see this
          packet off of a local keyring. */
 
-      p = parse_sig_subpkt2 (sig, SIGSUBPKT_EXPORTABLE);
+      p = scanned_subpkt (&hashed, SIGSUBPKT_EXPORTABLE, NULL);
+      if (!p)
+        p = scanned_subpkt (&unhashed, SIGSUBPKT_EXPORTABLE, NULL);
       if (p && *p == 0)
 	sig->flags.exportable = 0;
 
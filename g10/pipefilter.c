@@ -0,0 +1,385 @@
+/* pipefilter.c - Run the lower part of a filter chain on a thread
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The pipe_thd_filter does not change the data.  It decouples the
+ * filters above it from the filters below it by a small ring of
+ * buffers, and a thread which runs the filters below it.  On output
+ * that thread writes the queued buffers to the chain; on input it
+ * reads ahead from the chain.  Thus, for example, compression on the
+ * main thread can proceed while the thread encrypts and writes the
+ * previous buffers.
+ *
+ * Because of the npth model only one of the threads runs at a time,
+ * except while one of them is in a system call or in a section
+ * explicitly unprotected, like the hashing in mdfilter.c or the
+ * worker pools.  The filter code thus needs no additional locking.
+ * However, as long as the filter is pushed, nothing else may use the
+ * chain below it.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/iobuf.h"
+#include "../common/util.h"
+#include "filter.h"
+
+
+/* The number of buffers in the ring.  */
+#define NSLOTS 4
+
+
+struct pipe_thd_filter_context {
+  npth_t thd;
+  iobuf_t chain;
+  npth_mutex_t mutex;
+  npth_cond_t  cond;
+  unsigned int started : 1;   /* The thread has been created.  */
+  unsigned int output : 1;    /* The thread is a writer.  */
+  unsigned int eof : 1;       /* No more data will be produced.  */
+  unsigned int stop : 1;      /* Tell the thread to terminate.  */
+  gpg_error_t err;            /* The first error from the chain.  */
+  unsigned int head;          /* The oldest filled slot.  */
+  unsigned int nfilled;       /* The number of filled slots.  */
+  size_t offset;              /* The consumed bytes of the head slot.  */
+  size_t used[NSLOTS];
+  size_t bufsize;
+  unsigned char buf[1];
+};
+
+
+static void
+lock_pipe (pipe_thd_filter_context_t pfx)
+{
+  int rc = npth_mutex_lock (&pfx->mutex);
+  if (rc)
+    log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static void
+unlock_pipe (pipe_thd_filter_context_t pfx)
+{
+  int rc = npth_mutex_unlock (&pfx->mutex);
+  if (rc)
+    log_fatal ("%s: failed to release mutex: %s\n", __func__,
+               gpg_strerror (gpg_error_from_errno (rc)));
+}
+
+
+static unsigned char *
+slot_buffer (pipe_thd_filter_context_t pfx, unsigned int slot)
+{
+  return pfx->buf + slot * pfx->bufsize;
+}
+
+
+/* The thread writing the queued buffers to the chain.  */
+static void *
+pipe_writer (void *arg)
+{
+  pipe_thd_filter_context_t pfx = arg;
+  unsigned int slot;
+  int rc;
+
+  lock_pipe (pfx);
+  for (;;)
+    {
+      while (!pfx->nfilled && !pfx->eof && !pfx->stop)
+        npth_cond_wait (&pfx->cond, &pfx->mutex);
+      if (pfx->stop || !pfx->nfilled)
+        break;
+      slot = pfx->head;
+      unlock_pipe (pfx);
+
+      rc = iobuf_write (pfx->chain, slot_buffer (pfx, slot), pfx->used[slot]);
+
+      lock_pipe (pfx);
+      if (rc)
+        {
+          pfx->err = rc;
+          pfx->stop = 1;
+        }
+      pfx->head = (pfx->head + 1) % NSLOTS;
+      pfx->nfilled--;
+      npth_cond_broadcast (&pfx->cond);
+    }
+  unlock_pipe (pfx);
+  return NULL;
+}
+
+
+/* The thread reading ahead from the chain.  */
+static void *
+pipe_reader (void *arg)
+{
+  pipe_thd_filter_context_t pfx = arg;
+  unsigned int slot;
+  int n;
+
+  lock_pipe (pfx);
+  for (;;)
+    {
+      while (pfx->nfilled == NSLOTS && !pfx->stop)
+        npth_cond_wait (&pfx->cond, &pfx->mutex);
+      if (pfx->stop)
+        break;
+      /* The consumer only frees slots at the head, thus this slot
+       * is ours until we count it as filled.  */
+      slot = (pfx->head + pfx->nfilled) % NSLOTS;
+      unlock_pipe (pfx);
+
+      n = iobuf_read (pfx->chain, slot_buffer (pfx, slot), pfx->bufsize);
+
+      lock_pipe (pfx);
+      if (n == -1)
+        {
+          pfx->err = iobuf_error (pfx->chain);
+          pfx->eof = 1;
+          npth_cond_broadcast (&pfx->cond);
+          break;
+        }
+      pfx->used[slot] = n;
+      pfx->nfilled++;
+      npth_cond_broadcast (&pfx->cond);
+    }
+  unlock_pipe (pfx);
+  return NULL;
+}
+
+
+static gpg_error_t
+start_thread (pipe_thd_filter_context_t pfx, iobuf_t chain,
+              void *(*func) (void *))
+{
+  npth_attr_t tattr;
+  int rc;
+
+  pfx->chain = chain;
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    return gpg_error_from_errno (rc);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  /* Set before the thread runs; it shares a word with the flags.  */
+  pfx->started = 1;
+  rc = npth_create (&pfx->thd, &tattr, func, pfx);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    {
+      pfx->started = 0;
+      return gpg_error_from_errno (rc);
+    }
+  return 0;
+}
+
+
+/* Tell the thread to terminate once it has nothing more to do and
+ * wait for it.  If CANCEL is set queued data is dropped.  */
+static void
+stop_thread (pipe_thd_filter_context_t pfx, int cancel)
+{
+  if (!pfx->started)
+    return;
+
+  lock_pipe (pfx);
+  if (cancel)
+    pfx->stop = 1;
+  else
+    pfx->eof = 1;
+  npth_cond_broadcast (&pfx->cond);
+  unlock_pipe (pfx);
+  npth_join (pfx->thd, NULL);
+  pfx->started = 0;
+}
+
+
+/* Queue SIZE bytes from BUF for the writer thread.  */
+static gpg_error_t
+pipe_flush (pipe_thd_filter_context_t pfx, iobuf_t chain,
+            const byte *buf, size_t size)
+{
+  gpg_error_t err;
+  unsigned int slot;
+  size_t n;
+
+  lock_pipe (pfx);
+  if (pfx->stop)
+    {
+      unlock_pipe (pfx);
+      return pfx->err;  /* Canceled; drop the data.  */
+    }
+  unlock_pipe (pfx);
+  if (!pfx->started)
+    {
+      pfx->output = 1;
+      err = start_thread (pfx, chain, pipe_writer);
+      if (err)
+        return err;
+    }
+
+  while (size)
+    {
+      lock_pipe (pfx);
+      while (pfx->nfilled == NSLOTS && !pfx->err)
+        npth_cond_wait (&pfx->cond, &pfx->mutex);
+      if (pfx->err)
+        {
+          unlock_pipe (pfx);
+          return pfx->err;
+        }
+      slot = (pfx->head + pfx->nfilled) % NSLOTS;
+      n = size < pfx->bufsize? size : pfx->bufsize;
+      memcpy (slot_buffer (pfx, slot), buf, n);
+      pfx->used[slot] = n;
+      pfx->nfilled++;
+      npth_cond_broadcast (&pfx->cond);
+      unlock_pipe (pfx);
+      buf += n;
+      size -= n;
+    }
+
+  return 0;
+}
+
+
+/* Return up to *RET_LEN bytes read ahead by the reader thread.  */
+static int
+pipe_underflow (pipe_thd_filter_context_t pfx, iobuf_t chain,
+                byte *buf, size_t *ret_len)
+{
+  gpg_error_t err;
+  unsigned char *p;
+  size_t n;
+  int start;
+  int rc = 0;
+
+  lock_pipe (pfx);
+  start = !pfx->started && !pfx->eof && !pfx->stop;
+  unlock_pipe (pfx);
+  if (start)
+    {
+      err = start_thread (pfx, chain, pipe_reader);
+      if (err)
+        {
+          *ret_len = 0;
+          return err;
+        }
+    }
+
+  lock_pipe (pfx);
+  while (!pfx->nfilled && !pfx->eof && pfx->started)
+    npth_cond_wait (&pfx->cond, &pfx->mutex);
+  if (pfx->nfilled)
+    {
+      p = slot_buffer (pfx, pfx->head);
+      n = pfx->used[pfx->head] - pfx->offset;
+      if (n > *ret_len)
+        n = *ret_len;
+      memcpy (buf, p + pfx->offset, n);
+      pfx->offset += n;
+      if (pfx->offset == pfx->used[pfx->head])
+        {
+          pfx->offset = 0;
+          pfx->head = (pfx->head + 1) % NSLOTS;
+          pfx->nfilled--;
+          npth_cond_broadcast (&pfx->cond);
+        }
+      *ret_len = n;
+    }
+  else
+    {
+      *ret_len = 0;
+      rc = pfx->err? pfx->err : -1;
+    }
+  unlock_pipe (pfx);
+
+  return rc;
+}
+
+
+int
+pipe_thd_filter (void *opaque, int control,
+                 iobuf_t chain, byte *buf, size_t *ret_len)
+{
+  pipe_thd_filter_context_t pfx = opaque;
+  int rc = 0;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    rc = pipe_underflow (pfx, chain, buf, ret_len);
+  else if (control == IOBUFCTRL_FLUSH)
+    rc = pipe_flush (pfx, chain, buf, *ret_len);
+  else if (control == IOBUFCTRL_CANCEL)
+    stop_thread (pfx, 1);
+  else if (control == IOBUFCTRL_FREE)
+    {
+      /* On output this waits for the queued data to be written.  On
+       * input the reader is stopped; if the consumer did not read up
+       * to the EOF the buffered data is lost as it would be with any
+       * other filter.  */
+      stop_thread (pfx, !pfx->output);
+      rc = pfx->err;
+      npth_cond_destroy (&pfx->cond);
+      npth_mutex_destroy (&pfx->mutex);
+      wipememory (pfx->buf, NSLOTS * pfx->bufsize);
+      xfree (pfx);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    mem2str (buf, "pipe_thd_filter", *ret_len);
+
+  return rc;
+}
+
+
+/* Push a pipe_thd_filter onto A.  The filter releases its context
+ * itself.  */
+int
+push_pipe_filter (iobuf_t a)
+{
+  pipe_thd_filter_context_t pfx;
+  size_t n;
+  int rc;
+
+  n = iobuf_set_buffer_size (0) * 1024;
+  pfx = xtrycalloc (1, NSLOTS * n
+                    + offsetof (struct pipe_thd_filter_context, buf));
+  if (!pfx)
+    return gpg_error_from_syserror ();
+  pfx->bufsize = n;
+
+  rc = npth_mutex_init (&pfx->mutex, NULL);
+  if (rc)
+    {
+      xfree (pfx);
+      return gpg_error_from_errno (rc);
+    }
+  rc = npth_cond_init (&pfx->cond, NULL);
+  if (rc)
+    {
+      npth_mutex_destroy (&pfx->mutex);
+      xfree (pfx);
+      return gpg_error_from_errno (rc);
+    }
+
+  return iobuf_push_filter (a, pipe_thd_filter, pfx);
+}
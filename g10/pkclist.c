@@ -1008,6 +1008,10 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
      select the best key.  If a key specification is ambiguous and we
      are in batch mode, die.  */
 
+  /* Recipients given by fingerprint or key id are looked up with a
+   * single pass over the keyring.  */
+  getkey_prefetch (ctrl, remusr);
+
   if (opt.encrypt_to_default_key)
     {
       static int warned;
@@ -1385,6 +1389,7 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
 
  fail:
 
+  getkey_prefetch_release (ctrl);
   if ( rc )
     release_pk_list( pk_list );
   else
@@ -0,0 +1,159 @@
+/* pkenc-pool.c - Worker threads to encrypt the session key
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* When encrypting to many recipients most of the time before the
+ * first byte of the payload is written is spent in the public key
+ * encryption of the session key, which for ECDH includes the
+ * generation of an ephemeral key and a KDF for each recipient.  These
+ * operations are independent of each other.  This module runs them on
+ * a set of worker threads; the caller then writes the PKESK packets
+ * in the order of the recipients.  The workers only read the public
+ * keys and the DEK; the fingerprints used by the ECDH KDF are
+ * computed in the main thread before the workers start.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "options.h"
+#include "packet.h"
+#include "main.h"
+#include "pkglue.h"
+#include "pkenc-pool.h"
+
+
+struct pkenc_pool_s
+{
+  npth_mutex_t mutex;
+  unsigned int next;       /* The next job to process.  */
+  unsigned int njobs;
+  PKT_public_key **pks;
+  PKT_pubkey_enc **encs;
+  gpg_error_t *rcs;
+  DEK *dek;
+};
+
+
+/* Encrypt the session key of POOL for the recipient with index I.  */
+static void
+encrypt_one (struct pkenc_pool_s *pool, unsigned int i)
+{
+  PKT_public_key *pk = pool->pks[i];
+  gcry_mpi_t frame;
+
+  frame = encode_session_key (pk->pubkey_algo, pool->dek,
+                              pubkey_nbits (pk->pubkey_algo, pk->pkey));
+  pool->rcs[i] = pk_encrypt (pk, frame, pool->dek->algo,
+                             pool->encs[i]->data);
+  gcry_mpi_release (frame);
+}
+
+
+/* Process jobs until all are done.  This is run by the workers and
+ * by the main thread.  */
+static void *
+pkenc_worker (void *arg)
+{
+  struct pkenc_pool_s *pool = arg;
+  unsigned int i;
+  int rc;
+
+  for (;;)
+    {
+      rc = npth_mutex_lock (&pool->mutex);
+      if (rc)
+        log_fatal ("%s: failed to acquire mutex: %s\n", __func__,
+                   gpg_strerror (gpg_error_from_errno (rc)));
+      i = pool->next < pool->njobs? pool->next++ : pool->njobs;
+      rc = npth_mutex_unlock (&pool->mutex);
+      if (rc)
+        log_fatal ("%s: failed to release mutex: %s\n", __func__,
+                   gpg_strerror (gpg_error_from_errno (rc)));
+      if (i == pool->njobs)
+        break;
+
+      npth_unprotect ();
+      encrypt_one (pool, i);
+      npth_protect ();
+    }
+
+  return NULL;
+}
+
+
+/* Encrypt the session key DEK for the N public keys at PKS using
+ * NTHREADS threads.  The encrypted values are stored in the data
+ * field of the corresponding packets at ENCS and the result of each
+ * encryption at RCS.  NTHREADS is limited to PKENC_POOL_MAX_THREADS;
+ * with fewer than 2 threads, fewer than PKENC_POOL_MIN_JOBS keys or
+ * crypto debugging enabled, which would interleave the debug output,
+ * the keys are processed in the main thread.  */
+void
+pkenc_pool_encrypt (PKT_public_key **pks, PKT_pubkey_enc **encs,
+                    gpg_error_t *rcs, unsigned int n, DEK *dek,
+                    unsigned int nthreads)
+{
+  struct pkenc_pool_s pool;
+  npth_t thds[PKENC_POOL_MAX_THREADS];
+  npth_attr_t tattr;
+  unsigned int nthds = 0;
+  unsigned int i;
+  byte fpr[MAX_FINGERPRINT_LEN];
+
+  memset (&pool, 0, sizeof pool);
+  pool.njobs = n;
+  pool.pks = pks;
+  pool.encs = encs;
+  pool.rcs = rcs;
+  pool.dek = dek;
+
+  if (nthreads > PKENC_POOL_MAX_THREADS)
+    nthreads = PKENC_POOL_MAX_THREADS;
+  if (nthreads > n)
+    nthreads = n;
+  if (nthreads < 2 || n < PKENC_POOL_MIN_JOBS || DBG_CRYPTO
+      || npth_mutex_init (&pool.mutex, NULL))
+    {
+      for (i = 0; i < n; i++)
+        encrypt_one (&pool, i);
+      return;
+    }
+
+  /* The fingerprint is cached in the key on first use.  */
+  for (i = 0; i < n; i++)
+    fingerprint_from_pk (pks[i], fpr, NULL);
+
+  /* The main thread is one of the workers.  */
+  if (!npth_attr_init (&tattr))
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; nthds < nthreads - 1; nthds++)
+        if (npth_create (thds + nthds, &tattr, pkenc_worker, &pool))
+          break;
+      npth_attr_destroy (&tattr);
+    }
+  pkenc_worker (&pool);
+  for (i = 0; i < nthds; i++)
+    npth_join (thds[i], NULL);
+  npth_mutex_destroy (&pool.mutex);
+}
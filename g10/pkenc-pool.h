@@ -0,0 +1,34 @@
+/* pkenc-pool.h - Worker threads to encrypt the session key
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_PKENC_POOL_H
+#define G10_PKENC_POOL_H
+
+/* The maximum number of worker threads.  */
+#define PKENC_POOL_MAX_THREADS 64
+
+/* Do not start threads for fewer recipients than this.  */
+#define PKENC_POOL_MIN_JOBS 4
+
+
+/*-- pkenc-pool.c --*/
+void pkenc_pool_encrypt (PKT_public_key **pks, PKT_pubkey_enc **encs,
+                         gpg_error_t *rcs, unsigned int n, DEK *dek,
+                         unsigned int nthreads);
+
+#endif /*G10_PKENC_POOL_H*/
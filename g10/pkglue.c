@@ -31,6 +31,7 @@
 #include "pkglue.h"
 #include "main.h"
 #include "options.h"
+#include "ecdh-pool.h"
 
 
 /* Maximum buffer sizes required for ECC KEM.  */
@@ -789,6 +790,21 @@ do_encrypt_ecdh (PKT_public_key *pk, gcry_mpi_t data,  gcry_mpi_t *resarr)
   size_t nshared;
   unsigned int nbits;
 
+  /* Try a precomputed ephemeral key first.  */
+  err = ecdh_pool_compute (pkey, &public, &shared, &nshared);
+  if (!err)
+    {
+      if (DBG_CRYPTO)
+        {
+          log_debug ("ECDH ephemeral key from pool:");
+          gcry_mpi_dump (public);
+          log_printf ("\n");
+        }
+      goto have_shared;
+    }
+  if (gpg_err_code (err) != GPG_ERR_NO_DATA)
+    goto leave;
+
   err = pk_ecdh_generate_ephemeral_key (pkey, &k);
   if (err)
     goto leave;
@@ -841,6 +857,7 @@ do_encrypt_ecdh (PKT_public_key *pk, gcry_mpi_t data,  gcry_mpi_t *resarr)
       log_printf ("\n");
     }
 
+ have_shared:
   fingerprint_from_pk (pk, fp, NULL);
 
   p = gcry_mpi_get_opaque (data, &nbits);
@@ -24,6 +24,8 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #ifdef HAVE_DOSISH_SYSTEM
 # include <fcntl.h> /* for setmode() */
 #endif
@@ -39,6 +41,17 @@
 #include "../common/i18n.h"
 
 
+/* The size of the buffer used to copy binary plaintext to the output;
+ * it is used only if it is larger than the iobuf buffer size.  Large
+ * buffers let the output be written with few, large write calls at
+ * offsets which are a multiple of the buffer size.  */
+#define PLAINTEXT_BUFFER_SIZE (1024*1024)
+
+/* Output files are preallocated only for literal data of at least
+ * this size.  */
+#define PLAINTEXT_PREALLOC_MIN (1024*1024)
+
+
 /* Get the output filename.  On success, the actual filename that is
    used is set in *FNAMEP and a filepointer is returned in *FP.
 
@@ -175,6 +188,99 @@ get_output_file (const byte *embedded_name, int embedded_namelen,
   return 0;
 }
 
+/* Allocate a buffer for copying LEN bytes of binary plaintext; a LEN
+ * of 0 stands for an unknown length.  The size of the buffer is
+ * stored at R_SIZE.  If the large buffer can't be allocated a buffer
+ * of the iobuf buffer size is tried.  */
+static byte *
+alloc_plaintext_buffer (size_t len, size_t *r_size)
+{
+  size_t size = iobuf_set_buffer_size (0) * 1024;
+  size_t want = size;
+  byte *buffer;
+
+  if (want < PLAINTEXT_BUFFER_SIZE)
+    want = PLAINTEXT_BUFFER_SIZE;
+  if (len && len < want)
+    want = len > size? len : size;
+
+  buffer = want > size? xtrymalloc (want) : NULL;
+  if (buffer)
+    size = want;
+  else
+    buffer = xtrymalloc (size);
+  *r_size = size;
+  return buffer;
+}
+
+
+/* Preallocate LEN bytes of the file backing FP starting at the
+ * current position so that large outputs are written to contiguous
+ * space and a full disk is noticed early.  This is only done for
+ * regular files.  Returns the original size of the file if space has
+ * been allocated and -1 otherwise.  */
+static off_t
+preallocate_output (estream_t fp, const char *fname, size_t len)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+  struct stat st;
+  off_t pos;
+  int fd, rc;
+
+  if (len < PLAINTEXT_PREALLOC_MIN
+      || (opt.max_output && len > opt.max_output))
+    return -1;
+  fd = es_fileno (fp);
+  if (fd == -1 || fstat (fd, &st) || !S_ISREG (st.st_mode))
+    return -1;
+  pos = es_ftello (fp);
+  if (pos == -1)
+    return -1;
+
+  rc = posix_fallocate (fd, pos, len);
+  if (rc)
+    {
+      if (opt.verbose && rc != EINVAL && rc != EOPNOTSUPP)
+        log_info ("can't preallocate %lu bytes for '%s': %s\n",
+                  (unsigned long)len, fname, strerror (rc));
+      return -1;
+    }
+  return st.st_size;
+#else
+  (void)fp;
+  (void)fname;
+  (void)len;
+  return -1;
+#endif
+}
+
+
+/* Undo the effect of preallocate_output on the file backing FP after
+ * an error: cut off the space behind the data actually written and
+ * the original content of the file, ORIG_SIZE.  */
+static void
+truncate_preallocated (estream_t fp, off_t orig_size)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+  off_t pos;
+
+  if (es_fflush (fp))
+    return;
+  pos = es_ftello (fp);
+  if (pos == -1)
+    return;
+  if (pos < orig_size)
+    pos = orig_size;
+  if (ftruncate (es_fileno (fp), pos))
+    log_error ("error truncating output: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+#else
+  (void)fp;
+  (void)orig_size;
+#endif
+}
+
+
 /* Handle a plaintext packet.  If MFX is not NULL, update the MDs
  * Note: We should have used the filter stuff here, but we have to add
  * some easy mimic to set a read limit, so we calculate only the bytes
@@ -186,6 +292,7 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
   char *fname = NULL;
   estream_t fp = NULL;
   static off_t count = 0;
+  off_t prealloc_size = -1;
   int err = 0;
   int c;
   int convert;
@@ -284,7 +391,7 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 	}
       else  /* Binary mode.  */
 	{
-	  size_t temp_size = iobuf_set_buffer_size(0) * 1024;
+	  size_t temp_size;
 	  byte *buffer;
 
 	  if (fp)
@@ -292,9 +399,10 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 	      /* Disable buffering in estream as we are passing large
 	       * buffers to es_fwrite. */
 	      es_setbuf (fp, NULL);
+	      prealloc_size = preallocate_output (fp, fname, pt->len);
 	    }
 
-	  buffer = xmalloc (temp_size);
+	  buffer = alloc_plaintext_buffer (pt->len, &temp_size);
           if (!buffer)
             {
               err = gpg_error_from_syserror ();
@@ -375,7 +483,7 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 	}
       else
 	{			/* binary mode */
-	  size_t temp_size = iobuf_set_buffer_size(0) * 1024;
+	  size_t temp_size;
 	  byte *buffer;
 	  int eof_seen = 0;
 
@@ -386,7 +494,7 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 	      es_setbuf (fp, NULL);
 	    }
 
-          buffer = xtrymalloc (temp_size);
+          buffer = alloc_plaintext_buffer (0, &temp_size);
           if (!buffer)
             {
               err = gpg_error_from_syserror ();
@@ -516,6 +624,8 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
                  gpg_strerror (err));
     }
 
+  if (fp && prealloc_size != -1)
+    truncate_preallocated (fp, prealloc_size);
   if (fp && fp != es_stdout && fp != opt.outfp)
     es_fclose (fp);
   xfree (fname);
@@ -523,12 +633,27 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 }
 
 
+/* Callback for iobuf_read_direct.  */
+static void
+hash_block (void *opaque, const void *buf, size_t len)
+{
+  gcry_md_write (opaque, buf, len);
+}
+
+
 static void
 do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
 {
   text_filter_context_t tfx;
   int c;
 
+  /* In binary mode and without a progress filter the data can be
+   * hashed straight from the file's mapping or from large reads.  */
+  if (!textmode && !md2 && md
+      && gpg_err_code (iobuf_read_direct (fp, hash_block, md))
+      != GPG_ERR_NOT_SUPPORTED)
+    return;
+
   if (textmode)
     {
       memset (&tfx, 0, sizeof tfx);
@@ -40,6 +40,11 @@
 
 static gpg_error_t get_it (ctrl_t ctrl, struct pubkey_enc_list *k,
                            DEK *dek, PKT_public_key *sk, u32 *keyid);
+static gpg_error_t make_ciphertext (struct pubkey_enc_list *enc,
+                                    PKT_public_key *sk, gcry_sexp_t *r_data);
+static gpg_error_t decode_frame (ctrl_t ctrl, struct pubkey_enc_list *enc,
+                                 DEK *dek, PKT_public_key *sk, u32 *keyid,
+                                 byte *frame, size_t nframe, int padding);
 
 
 /* Check that the given algo is mentioned in one of the valid user-ids. */
@@ -67,6 +72,247 @@ is_algo_in_prefs (kbnode_t keyblock, preftype_t type, int algo)
 }
 
 
+/* Return true if the secret key SK may be used for decryption in the
+ * current compliance mode.  */
+static int
+is_decryption_allowed (PKT_public_key *sk)
+{
+  if (! gnupg_pk_is_allowed (opt.compliance, PK_USE_DECRYPTION,
+                             sk->pubkey_algo, 0,
+                             sk->pkey, nbits_from_pk (sk), NULL))
+    {
+      log_info (_("key %s is not suitable for decryption"
+                  " in %s mode\n"),
+                keystr_from_pk (sk),
+                gnupg_compliance_option_string (opt.compliance));
+      return 0;
+    }
+  return 1;
+}
+
+
+/* Return true if the secret key SK with KEYID shall be tried for the
+ * encrypted session key K.  */
+static int
+match_recipient (struct pubkey_enc_list *k, PKT_public_key *sk, u32 *keyid)
+{
+  if (!(k->d.pubkey_algo == PUBKEY_ALGO_ELGAMAL_E
+        || k->d.pubkey_algo == PUBKEY_ALGO_ECDH
+        || k->d.pubkey_algo == PUBKEY_ALGO_KYBER
+        || k->d.pubkey_algo == PUBKEY_ALGO_RSA
+        || k->d.pubkey_algo == PUBKEY_ALGO_RSA_E
+        || k->d.pubkey_algo == PUBKEY_ALGO_ELGAMAL))
+    return 0;
+
+  if (openpgp_pk_test_algo2 (k->d.pubkey_algo, PUBKEY_USAGE_ENC))
+    return 0;
+
+  if (sk->pubkey_algo != k->d.pubkey_algo)
+    return 0;
+
+  if (!k->d.keyid[0] && !k->d.keyid[1])
+    return !opt.skip_hidden_recipients;
+
+  return (opt.try_all_secrets
+          || (k->d.keyid[0] == keyid[0] && k->d.keyid[1] == keyid[1]));
+}
+
+
+/* Print the notes for trying the secret key SK with KEYID for K.  */
+static void
+note_trial (struct pubkey_enc_list *k, PKT_public_key *sk, u32 *keyid)
+{
+  if (opt.quiet)
+    ;
+  else if (!k->d.keyid[0] && !k->d.keyid[1])
+    log_info (_("anonymous recipient; trying secret key %s ...\n"),
+              keystr (keyid));
+  else if (!(sk->pubkey_usage & PUBKEY_USAGE_XENC_MASK))
+    log_info (_("used key is not marked for encryption use.\n"));
+}
+
+
+/* Print the notes for a successful decryption of K with SK.  */
+static void
+note_success (struct pubkey_enc_list *k, PKT_public_key *sk)
+{
+  if (!opt.quiet && !k->d.keyid[0] && !k->d.keyid[1])
+    {
+      log_info (_("okay, we are the anonymous recipient.\n"));
+      if (!(sk->pubkey_usage & PUBKEY_USAGE_XENC_MASK))
+        log_info (_("used key is not marked for encryption use.\n"));
+    }
+}
+
+
+/* A secret key to try for an encrypted session key.  */
+struct try_key_s
+{
+  struct pubkey_enc_list *k;
+  PKT_public_key *sk;
+  u32 keyid[2];
+  int tried;
+};
+
+
+/* Try up to AGENT_PKDECRYPT_ANY_MAX of the N candidates at CANDS in
+ * one request to the agent.
+ * The agent only tries the keys it can use without user interaction
+ * and does this concurrently; the results are then checked in order.
+ * Return true if the session key has been found.  */
+static int
+try_keys_batched (ctrl_t ctrl, struct try_key_s *cands, unsigned int n,
+                  DEK *dek, gpg_error_t *r_err)
+{
+  char *grips[AGENT_PKDECRYPT_ANY_MAX];
+  gcry_sexp_t s_data[AGENT_PKDECRYPT_ANY_MAX];
+  struct try_key_s *batch[AGENT_PKDECRYPT_ANY_MAX];
+  unsigned char *bufs[AGENT_PKDECRYPT_ANY_MAX];
+  size_t buflens[AGENT_PKDECRYPT_ANY_MAX];
+  gpg_error_t errs[AGENT_PKDECRYPT_ANY_MAX];
+  struct try_key_s *c;
+  unsigned int i, nbatch;
+  gpg_error_t err;
+  int found = 0;
+
+  for (nbatch=0, i=0; i < n && i < AGENT_PKDECRYPT_ANY_MAX; i++)
+    {
+      c = cands + i;
+      /* Dual keys need an extra parameter and are left to get_it.  */
+      if (c->sk->pubkey_algo == PUBKEY_ALGO_KYBER)
+        continue;
+      if (hexkeygrip_from_pk (c->sk, &grips[nbatch]))
+        continue;
+      if (make_ciphertext (c->k, c->sk, &s_data[nbatch]))
+        {
+          xfree (grips[nbatch]);
+          continue;
+        }
+      batch[nbatch++] = c;
+    }
+  if (!nbatch)
+    return 0;
+
+  err = agent_pkdecrypt_any (ctrl, nbatch, grips, s_data,
+                             bufs, buflens, errs);
+  for (i=0; i < nbatch; i++)
+    {
+      xfree (grips[i]);
+      gcry_sexp_release (s_data[i]);
+    }
+  if (err)
+    {
+      if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        log_info ("trying several keys at once failed: %s\n",
+                  gpg_strerror (err));
+      return 0;  /* The keys are then tried one by one.  */
+    }
+
+  for (i=0; i < nbatch; i++)
+    {
+      c = batch[i];
+      if (found || gpg_err_code (errs[i]) == GPG_ERR_NOT_SUPPORTED)
+        {
+          xfree (bufs[i]);
+          continue;
+        }
+      c->tried = 1;
+      note_trial (c->k, c->sk, c->keyid);
+      if (errs[i])
+        err = errs[i];
+      else
+        err = decode_frame (ctrl, c->k, dek, c->sk, c->keyid,
+                            bufs[i], buflens[i], -1);
+      c->k->result = err;
+      if (!err)
+        {
+          note_success (c->k, c->sk);
+          *r_err = 0;
+          found = 1;
+        }
+    }
+  return found;
+}
+
+
+/* Get the session key for LIST by trying all matching secret keys.
+ * This is used with anonymous recipients and --try-all-secrets where
+ * many keys may need to be tried.  The keys which can be used
+ * without user interaction are tried first and in batches by the
+ * agent; the remaining keys are then tried one by one.  */
+static gpg_error_t
+get_session_key_any (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
+{
+  struct try_key_s *cands = NULL;
+  unsigned int ncands = 0;
+  unsigned int nalloced = 0;
+  void *enum_context = NULL;
+  PKT_public_key *sk;
+  struct pubkey_enc_list *k;
+  u32 keyid[2];
+  gpg_error_t err;
+  unsigned int i;
+
+  for (;;)
+    {
+      sk = xmalloc_clear (sizeof *sk);
+      err = enum_secret_keys (ctrl, &enum_context, sk);
+      if (err)
+        break;
+      if (!is_decryption_allowed (sk))
+        continue;
+
+      keyid_from_pk (sk, keyid);
+      for (k = list; k; k = k->next)
+        {
+          if (!match_recipient (k, sk, keyid))
+            continue;
+          if (ncands == nalloced)
+            {
+              nalloced += 32;
+              cands = xrealloc (cands, nalloced * sizeof *cands);
+            }
+          cands[ncands].k = k;
+          cands[ncands].sk = sk;
+          cands[ncands].keyid[0] = keyid[0];
+          cands[ncands].keyid[1] = keyid[1];
+          cands[ncands].tried = 0;
+          ncands++;
+        }
+    }
+  if (gpg_err_code (err) != GPG_ERR_EOF)
+    goto leave;
+  err = gpg_error (GPG_ERR_EOF);
+
+  for (i=0; i < ncands; i += AGENT_PKDECRYPT_ANY_MAX)
+    if (try_keys_batched (ctrl, cands + i, ncands - i, dek, &err))
+      goto leave;
+
+  for (i=0; i < ncands; i++)
+    {
+      if (cands[i].tried)
+        continue;
+      note_trial (cands[i].k, cands[i].sk, cands[i].keyid);
+      err = get_it (ctrl, cands[i].k, dek, cands[i].sk, cands[i].keyid);
+      cands[i].k->result = err;
+      if (!err)
+        {
+          note_success (cands[i].k, cands[i].sk);
+          goto leave;
+        }
+      else if (gpg_err_code (err) == GPG_ERR_FULLY_CANCELED)
+        goto leave;  /* Don't try any more secret keys.  */
+    }
+  err = gpg_error (GPG_ERR_EOF);
+
+ leave:
+  /* The keys are owned by the enumeration context.  */
+  enum_secret_keys (ctrl, &enum_context, NULL);
+  xfree (cands);
+  return err;
+}
+
+
 /*
  * Get the session key from a pubkey enc packet and return it in DEK,
  * which should have been allocated in secure memory by the caller.
@@ -79,11 +325,22 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
   void *enum_context = NULL;
   u32 keyid[2];
   int search_for_secret_keys = 1;
+  int any_hidden = 0;
   struct pubkey_enc_list *k;
 
   if (DBG_CLOCK)
     log_clock ("get_session_key enter");
 
+  for (k = list; k; k = k->next)
+    if (!k->d.keyid[0] && !k->d.keyid[1])
+      any_hidden = 1;
+
+  if (opt.try_all_secrets || (any_hidden && !opt.skip_hidden_recipients))
+    {
+      err = get_session_key_any (ctrl, list, dek);
+      goto leave;
+    }
+
   while (search_for_secret_keys)
     {
       sk = xmalloc_clear (sizeof *sk);
@@ -92,16 +349,8 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
         break;
 
       /* Check compliance.  */
-      if (! gnupg_pk_is_allowed (opt.compliance, PK_USE_DECRYPTION,
-                                 sk->pubkey_algo, 0,
-                                 sk->pkey, nbits_from_pk (sk), NULL))
-        {
-          log_info (_("key %s is not suitable for decryption"
-                      " in %s mode\n"),
-                    keystr_from_pk (sk),
-                    gnupg_compliance_option_string (opt.compliance));
-          continue;
-        }
+      if (!is_decryption_allowed (sk))
+        continue;
 
       /* FIXME: The list needs to be sorted so that we try the keys in
        * an appropriate order.  For example:
@@ -112,54 +361,20 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
        * - On-card keys from cards which are not plugged it.  Here a
        *   cancel-all button should stop asking for other cards.
        * Without any anonymous keys the sorting can be skipped.
+       * get_session_key_any does the first two steps.
        */
+      keyid_from_pk (sk, keyid);
       for (k = list; k; k = k->next)
         {
-          if (!(k->d.pubkey_algo == PUBKEY_ALGO_ELGAMAL_E
-                || k->d.pubkey_algo == PUBKEY_ALGO_ECDH
-                || k->d.pubkey_algo == PUBKEY_ALGO_KYBER
-                || k->d.pubkey_algo == PUBKEY_ALGO_RSA
-                || k->d.pubkey_algo == PUBKEY_ALGO_RSA_E
-                || k->d.pubkey_algo == PUBKEY_ALGO_ELGAMAL))
-            continue;
-
-          if (openpgp_pk_test_algo2 (k->d.pubkey_algo, PUBKEY_USAGE_ENC))
-            continue;
-
-          if (sk->pubkey_algo != k->d.pubkey_algo)
-            continue;
-
-          keyid_from_pk (sk, keyid);
-
-          if (!k->d.keyid[0] && !k->d.keyid[1])
-            {
-              if (opt.skip_hidden_recipients)
-                continue;
-
-              if (!opt.quiet)
-                log_info (_("anonymous recipient; trying secret key %s ...\n"),
-                          keystr (keyid));
-            }
-          else if (opt.try_all_secrets
-                   || (k->d.keyid[0] == keyid[0] && k->d.keyid[1] == keyid[1]))
-            {
-              if (!opt.quiet && !(sk->pubkey_usage & PUBKEY_USAGE_XENC_MASK))
-                log_info (_("used key is not marked for encryption use.\n"));
-            }
-          else
+          if (!match_recipient (k, sk, keyid))
             continue;
 
+          note_trial (k, sk, keyid);
           err = get_it (ctrl, k, dek, sk, keyid);
           k->result = err;
           if (!err)
             {
-              if (!opt.quiet && !k->d.keyid[0] && !k->d.keyid[1])
-                {
-                  log_info (_("okay, we are the anonymous recipient.\n"));
-                  if (!(sk->pubkey_usage & PUBKEY_USAGE_XENC_MASK))
-                    log_info (_("used key is not marked for encryption use.\n")
-                              );
-                }
+              note_success (k, sk);
               search_for_secret_keys = 0;
               break;
             }
@@ -172,6 +387,7 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
     }
   enum_secret_keys (ctrl, &enum_context, NULL);  /* free context */
 
+ leave:
   if (gpg_err_code (err) == GPG_ERR_EOF)
     {
       err = gpg_error (GPG_ERR_NO_SECKEY);
@@ -188,37 +404,22 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
 }
 
 
+/* Convert the encrypted session key of ENC for the secret key SK to
+ * the S-expression used by the agent and store it at R_DATA.  */
 static gpg_error_t
-get_it (ctrl_t ctrl,
-        struct pubkey_enc_list *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
+make_ciphertext (struct pubkey_enc_list *enc, PKT_public_key *sk,
+                 gcry_sexp_t *r_data)
 {
   gpg_error_t err;
-  byte *frame = NULL;
-  unsigned int frameidx;
-  size_t nframe;
-  u16 csum, csum2;
-  int padding;
-  gcry_sexp_t s_data;
-  char *desc;
-  char *keygrip;
-  byte fp[MAX_FINGERPRINT_LEN];
-
-  if (DBG_CLOCK)
-    log_clock ("decryption start");
 
-  /* Get the keygrip.  */
-  err = hexkeygrip_from_pk (sk, &keygrip);
-  if (err)
-    goto leave;
-
-  /* Convert the data to an S-expression.  */
+  *r_data = NULL;
   if (sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL
       || sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
     {
       if (!enc->d.data[0] || !enc->d.data[1])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(elg(a%m)(b%m)))",
+        err = gcry_sexp_build (r_data, NULL, "(enc-val(elg(a%m)(b%m)))",
                                enc->d.data[0], enc->d.data[1]);
     }
   else if (sk->pubkey_algo == PUBKEY_ALGO_RSA
@@ -227,7 +428,7 @@ get_it (ctrl_t ctrl,
       if (!enc->d.data[0])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(rsa(a%m)))",
+        err = gcry_sexp_build (r_data, NULL, "(enc-val(rsa(a%m)))",
                                enc->d.data[0]);
     }
   else if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
@@ -235,7 +436,7 @@ get_it (ctrl_t ctrl,
       if (!enc->d.data[0] || !enc->d.data[1])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
+        err = gcry_sexp_build (r_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
                                enc->d.data[1], enc->d.data[0]);
     }
   else if (sk->pubkey_algo == PUBKEY_ALGO_KYBER)
@@ -259,7 +460,7 @@ get_it (ctrl_t ctrl,
       if (!enc->d.data[0] || !enc->d.data[1] || !enc->d.data[2])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL,
+        err = gcry_sexp_build (r_data, NULL,
                            "(enc-val(pqc(e%m)(k%m)(s%m)(c%d)(fixed-info%b)))",
                            enc->d.data[0], enc->d.data[1], enc->d.data[2],
                            enc->d.seskey_algo, fixedlen, fixedinfo);
@@ -267,11 +468,37 @@ get_it (ctrl_t ctrl,
   else
     err = gpg_error (GPG_ERR_BUG);
 
+  return err;
+}
+
+
+static gpg_error_t
+get_it (ctrl_t ctrl,
+        struct pubkey_enc_list *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
+{
+  gpg_error_t err;
+  byte *frame = NULL;
+  size_t nframe;
+  int padding;
+  gcry_sexp_t s_data;
+  char *desc;
+  char *keygrip;
+
+  if (DBG_CLOCK)
+    log_clock ("decryption start");
+
+  /* Get the keygrip.  */
+  err = hexkeygrip_from_pk (sk, &keygrip);
   if (err)
-    goto leave;
+    return err;
 
-  if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
-    fingerprint_from_pk (sk, fp, NULL);
+  /* Convert the data to an S-expression.  */
+  err = make_ciphertext (enc, sk, &s_data);
+  if (err)
+    {
+      xfree (keygrip);
+      return err;
+    }
 
   /* Decrypt. */
   desc = gpg_format_keydesc (ctrl, sk, FORMAT_KEYDESC_NORMAL, 1);
@@ -281,8 +508,29 @@ get_it (ctrl_t ctrl,
                          s_data, &frame, &nframe, &padding);
   xfree (desc);
   gcry_sexp_release (s_data);
+  xfree (keygrip);
   if (err)
-    goto leave;
+    return err;
+
+  return decode_frame (ctrl, enc, dek, sk, keyid, frame, nframe, padding);
+}
+
+
+/* Get the DEK from the FRAME of NFRAME bytes as returned by the agent
+ * for ENC and the secret key SK with KEYID.  PADDING is the padding
+ * information from the agent.  FRAME is released.  */
+static gpg_error_t
+decode_frame (ctrl_t ctrl, struct pubkey_enc_list *enc, DEK *dek,
+              PKT_public_key *sk, u32 *keyid,
+              byte *frame, size_t nframe, int padding)
+{
+  gpg_error_t err;
+  unsigned int frameidx;
+  u16 csum, csum2;
+  byte fp[MAX_FINGERPRINT_LEN];
+
+  if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
+    fingerprint_from_pk (sk, fp, NULL);
 
   /* Now get the DEK (data encryption key) from the frame
    *
@@ -531,7 +779,6 @@ get_it (ctrl_t ctrl,
 
  leave:
   xfree (frame);
-  xfree (keygrip);
   return err;
 }
 
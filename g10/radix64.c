@@ -0,0 +1,704 @@
+/* radix64.c - Block radix64 encoder and decoder
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This module provides the bulk conversion between binary data and
+ * the radix64 alphabet as used by the armor filter.  The functions
+ * here do not know anything about armor lines, padding or checksums;
+ * they convert runs of complete groups and return to the caller at
+ * the first character which is not part of the alphabet.  All the
+ * special cases are left to armor.c.
+ *
+ * The SIMD kernels follow the well known approach of Wojciech Mula
+ * and Alfred Klomp: a nibble based classification with PSHUFB for
+ * validation and translation and multiply-add instructions to pack
+ * the 6 bit values.  On x86 the best kernel is selected at runtime;
+ * on AArch64 NEON is always available.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/types.h"
+#include "radix64.h"
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define USE_X86_SIMD 1
+# include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+# define USE_NEON 1
+# include <arm_neon.h>
+#endif
+
+
+static const byte bintoasc[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                 "abcdefghijklmnopqrstuvwxyz"
+                                 "0123456789+/";
+
+/* Radix64 to binary tables for the scalar code; invalid characters
+ * are mapped to 0xffffffff so that a single compare of the or-ed
+ * values detects them.  */
+static u32 asctobin[4][256];
+
+/* Tables for a slicing-by-8 CRC24 as used by the armor checksum.
+ * The CRC is kept in the upper 24 bits of an u32 so that the usual
+ * MSB first table algorithm can be used.  */
+#define CRC24_POLY 0x864cfb00
+static u32 crc24_table[8][256];
+
+
+typedef size_t (*r64_fnc_t) (byte *out, const byte *in, size_t inlen);
+
+/* The implementation table.  */
+struct r64_impl_s
+{
+  int impl;
+  const char *name;
+  r64_fnc_t decode;
+  r64_fnc_t encode;
+  int (*available) (void);
+};
+
+static const struct r64_impl_s *selected_impl;
+
+
+
+static void
+init_tables (void)
+{
+  static int initialized;
+  u32 i;
+
+  if (initialized)
+    return;
+
+  memset (asctobin, 0xff, sizeof asctobin);
+  for (i = 0; i < 64; i++)
+    {
+      asctobin[0][bintoasc[i]] = i << (0 * 6);
+      asctobin[1][bintoasc[i]] = i << (1 * 6);
+      asctobin[2][bintoasc[i]] = i << (2 * 6);
+      asctobin[3][bintoasc[i]] = i << (3 * 6);
+    }
+
+  for (i = 0; i < 256; i++)
+    {
+      u32 c = i << 24;
+      int j;
+
+      for (j = 0; j < 8; j++)
+        c = (c & 0x80000000) ? (c << 1) ^ CRC24_POLY : (c << 1);
+      crc24_table[0][i] = c;
+    }
+  for (i = 0; i < 256; i++)
+    {
+      int j;
+
+      for (j = 1; j < 8; j++)
+        crc24_table[j][i] = ((crc24_table[j-1][i] << 8)
+                             ^ crc24_table[0][crc24_table[j-1][i] >> 24]);
+    }
+
+  initialized = 1;
+}
+
+
+static int
+always_available (void)
+{
+  return 1;
+}
+
+
+static size_t
+decode_scalar (byte *out, const byte *in, size_t inlen)
+{
+  size_t n;
+  u32 v;
+
+  for (n = 0; n + 4 <= inlen; n += 4, in += 4, out += 3)
+    {
+      v  = asctobin[3][in[0]];
+      v |= asctobin[2][in[1]];
+      v |= asctobin[1][in[2]];
+      v |= asctobin[0][in[3]];
+      if (v > 0xffffff)
+        break;
+      out[0] = v >> 16;
+      out[1] = v >> 8;
+      out[2] = v;
+    }
+  return n;
+}
+
+
+static size_t
+encode_scalar (byte *out, const byte *in, size_t inlen)
+{
+  size_t n;
+  u32 v;
+
+  for (n = 0; n + 3 <= inlen; n += 3, in += 3, out += 4)
+    {
+      v = ((u32)in[0] << 16) | ((u32)in[1] << 8) | in[2];
+      out[0] = bintoasc[(v >> 18) & 077];
+      out[1] = bintoasc[(v >> 12) & 077];
+      out[2] = bintoasc[(v >> 6) & 077];
+      out[3] = bintoasc[v & 077];
+    }
+  return n;
+}
+
+
+
+#ifdef USE_X86_SIMD
+
+static int
+ssse3_available (void)
+{
+  __builtin_cpu_init ();
+  return !!__builtin_cpu_supports ("ssse3");
+}
+
+static int
+avx2_available (void)
+{
+  __builtin_cpu_init ();
+  return !!__builtin_cpu_supports ("avx2");
+}
+
+
+/* Translate 16 radix64 characters in STR to their 6 bit values.
+ * Returns false if any of the characters is invalid.  */
+static inline __attribute__ ((target ("ssse3"), always_inline)) int
+ssse3_dec_translate (__m128i *str)
+{
+  const __m128i lut_lo = _mm_setr_epi8
+    (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+     0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8
+    (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+     0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8
+    (0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+  __m128i hi_nibbles, lo_nibbles, hi, lo, eq_2f, roll;
+
+  hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (*str, 4), mask_2f);
+  lo_nibbles = _mm_and_si128 (*str, mask_2f);
+  hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+  lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+  if (_mm_movemask_epi8 (_mm_cmpgt_epi8 (_mm_and_si128 (lo, hi),
+                                         _mm_setzero_si128 ())))
+    return 0;
+  eq_2f = _mm_cmpeq_epi8 (*str, mask_2f);
+  roll = _mm_shuffle_epi8 (lut_roll, _mm_add_epi8 (eq_2f, hi_nibbles));
+  *str = _mm_add_epi8 (*str, roll);
+  return 1;
+}
+
+
+/* Decode 16 characters at IN to 12 bytes at OUT; if ROOM is set 16
+ * bytes may be written to OUT.  Returns false if IN has an invalid
+ * character.  */
+static inline __attribute__ ((target ("ssse3"), always_inline)) int
+ssse3_dec_block (byte *out, const byte *in, int room)
+{
+  const __m128i pack_shuf = _mm_setr_epi8
+    (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  __m128i str;
+  byte tmp[16];
+
+  str = _mm_loadu_si128 ((const __m128i *)in);
+  if (!ssse3_dec_translate (&str))
+    return 0;
+  str = _mm_maddubs_epi16 (str, _mm_set1_epi32 (0x01400140));
+  str = _mm_madd_epi16 (str, _mm_set1_epi32 (0x00011000));
+  str = _mm_shuffle_epi8 (str, pack_shuf);
+  if (room)
+    _mm_storeu_si128 ((__m128i *)out, str);
+  else
+    {
+      _mm_storeu_si128 ((__m128i *)tmp, str);
+      memcpy (out, tmp, 12);
+    }
+  return 1;
+}
+
+
+/* Convert the 16 6 bit values in IN to radix64 characters.  */
+static inline __attribute__ ((target ("ssse3"), always_inline)) __m128i
+ssse3_enc_translate (__m128i in)
+{
+  const __m128i lut = _mm_setr_epi8
+    (65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  __m128i indices, mask;
+
+  indices = _mm_subs_epu8 (in, _mm_set1_epi8 (51));
+  mask = _mm_cmpgt_epi8 (in, _mm_set1_epi8 (25));
+  indices = _mm_sub_epi8 (indices, mask);
+  return _mm_add_epi8 (in, _mm_shuffle_epi8 (lut, indices));
+}
+
+
+/* Encode 12 bytes to 16 characters at OUT.  The 16 bytes loaded from
+ * IN are used starting at offset 0 or, if SHIFTED is set, at offset
+ * 4.  The latter is used for the last block of a buffer so that we
+ * do not read beyond its end.  */
+static inline __attribute__ ((target ("ssse3"), always_inline)) void
+ssse3_enc_block (byte *out, const byte *in, int shifted)
+{
+  __m128i str, t0, t1, t2, t3;
+
+  str = _mm_loadu_si128 ((const __m128i *)in);
+  if (shifted)
+    str = _mm_shuffle_epi8 (str, _mm_set_epi8 (14, 15, 13, 14, 11, 12, 10, 11,
+                                               8, 9, 7, 8, 5, 6, 4, 5));
+  else
+    str = _mm_shuffle_epi8 (str, _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7,
+                                               4, 5, 3, 4, 1, 2, 0, 1));
+  t0 = _mm_and_si128 (str, _mm_set1_epi32 (0x0fc0fc00));
+  t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+  t2 = _mm_and_si128 (str, _mm_set1_epi32 (0x003f03f0));
+  t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+  str = ssse3_enc_translate (_mm_or_si128 (t1, t3));
+  _mm_storeu_si128 ((__m128i *)out, str);
+}
+
+
+/* The loops over 16 byte blocks.  They are inlined into the SSSE3
+ * and the AVX2 functions so that the AVX2 code does not suffer from
+ * SSE/AVX transition penalties.  */
+static inline __attribute__ ((target ("ssse3"), always_inline)) size_t
+ssse3_decode_loop (byte *out, const byte *in, size_t inlen)
+{
+  size_t n;
+
+  for (n = 0; n + 16 <= inlen; n += 16, in += 16, out += 12)
+    if (!ssse3_dec_block (out, in, n + 24 <= inlen))
+      break;
+  return n;
+}
+
+static inline __attribute__ ((target ("ssse3"), always_inline)) size_t
+ssse3_encode_loop (byte *out, const byte *in, size_t inlen, size_t n)
+{
+  for (; n + 12 <= inlen; n += 12, in += 12, out += 16)
+    {
+      if (n + 16 <= inlen)
+        ssse3_enc_block (out, in, 0);
+      else if (n >= 4)
+        ssse3_enc_block (out, in - 4, 1);
+      else
+        break;
+    }
+  return n;
+}
+
+
+static __attribute__ ((target ("ssse3"))) size_t
+decode_ssse3 (byte *out, const byte *in, size_t inlen)
+{
+  size_t n;
+
+  n = ssse3_decode_loop (out, in, inlen);
+  return n + decode_scalar (out + n / 4 * 3, in + n, inlen - n);
+}
+
+
+static __attribute__ ((target ("ssse3"))) size_t
+encode_ssse3 (byte *out, const byte *in, size_t inlen)
+{
+  size_t n;
+
+  n = ssse3_encode_loop (out, in, inlen, 0);
+  return n + encode_scalar (out + n / 3 * 4, in + n, inlen - n);
+}
+
+
+static __attribute__ ((target ("avx2"))) size_t
+decode_avx2 (byte *out, const byte *in, size_t inlen)
+{
+  const __m256i lut_lo = _mm256_setr_epi8
+    (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+     0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+     0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+     0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8
+    (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+     0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+     0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+     0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8
+    (0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack_shuf = _mm256_setr_epi8
+    (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+     2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i mask_2f = _mm256_set1_epi8 (0x2f);
+  __m256i str, hi_nibbles, lo_nibbles, hi, lo, eq_2f, roll;
+  byte tmp[32];
+  size_t n;
+
+  for (n = 0; n + 32 <= inlen; n += 32, in += 32, out += 24)
+    {
+      str = _mm256_loadu_si256 ((const __m256i *)in);
+      hi_nibbles = _mm256_and_si256 (_mm256_srli_epi32 (str, 4), mask_2f);
+      lo_nibbles = _mm256_and_si256 (str, mask_2f);
+      hi = _mm256_shuffle_epi8 (lut_hi, hi_nibbles);
+      lo = _mm256_shuffle_epi8 (lut_lo, lo_nibbles);
+      if (!_mm256_testz_si256 (lo, hi))
+        break;
+      eq_2f = _mm256_cmpeq_epi8 (str, mask_2f);
+      roll = _mm256_shuffle_epi8 (lut_roll,
+                                  _mm256_add_epi8 (eq_2f, hi_nibbles));
+      str = _mm256_add_epi8 (str, roll);
+      str = _mm256_maddubs_epi16 (str, _mm256_set1_epi32 (0x01400140));
+      str = _mm256_madd_epi16 (str, _mm256_set1_epi32 (0x00011000));
+      str = _mm256_shuffle_epi8 (str, pack_shuf);
+      str = _mm256_permutevar8x32_epi32
+        (str, _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, -1, -1));
+      /* We may only write beyond the 24 result bytes if the caller's
+       * buffer has room for them.  */
+      if (n + 44 <= inlen)
+        _mm256_storeu_si256 ((__m256i *)out, str);
+      else
+        {
+          _mm256_storeu_si256 ((__m256i *)tmp, str);
+          memcpy (out, tmp, 24);
+        }
+    }
+
+  if (n + 32 > inlen)
+    {
+      size_t k = ssse3_decode_loop (out, in, inlen - n);
+      n += k;
+      in += k;
+      out += k / 4 * 3;
+    }
+  _mm256_zeroupper ();
+  return n + decode_scalar (out, in, inlen - n);
+}
+
+
+static __attribute__ ((target ("avx2"))) size_t
+encode_avx2 (byte *out, const byte *in, size_t inlen)
+{
+  const __m256i shuf = _mm256_set_epi8
+    (10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+     10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m256i lut = _mm256_setr_epi8
+    (65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+     65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+  __m256i str, t0, t1, t2, t3, indices, mask;
+  size_t n;
+
+  /* We load 32 bytes but use only 24 of them; the permutation moves
+   * bytes 12 to 23 into the upper lane.  For the last block we load
+   * from 8 bytes before the block to stay within the buffer.  */
+  for (n = 0; n + 24 <= inlen; n += 24, in += 24, out += 32)
+    {
+      if (n + 32 <= inlen)
+        {
+          str = _mm256_loadu_si256 ((const __m256i *)in);
+          str = _mm256_permutevar8x32_epi32
+            (str, _mm256_setr_epi32 (0, 1, 2, 2, 3, 4, 5, 5));
+        }
+      else if (n >= 8)
+        {
+          str = _mm256_loadu_si256 ((const __m256i *)(in - 8));
+          str = _mm256_permutevar8x32_epi32
+            (str, _mm256_setr_epi32 (2, 3, 4, 4, 5, 6, 7, 7));
+        }
+      else
+        break;
+      str = _mm256_shuffle_epi8 (str, shuf);
+      t0 = _mm256_and_si256 (str, _mm256_set1_epi32 (0x0fc0fc00));
+      t1 = _mm256_mulhi_epu16 (t0, _mm256_set1_epi32 (0x04000040));
+      t2 = _mm256_and_si256 (str, _mm256_set1_epi32 (0x003f03f0));
+      t3 = _mm256_mullo_epi16 (t2, _mm256_set1_epi32 (0x01000010));
+      str = _mm256_or_si256 (t1, t3);
+      indices = _mm256_subs_epu8 (str, _mm256_set1_epi8 (51));
+      mask = _mm256_cmpgt_epi8 (str, _mm256_set1_epi8 (25));
+      indices = _mm256_sub_epi8 (indices, mask);
+      str = _mm256_add_epi8 (str, _mm256_shuffle_epi8 (lut, indices));
+      _mm256_storeu_si256 ((__m256i *)out, str);
+    }
+
+  {
+    /* The remaining 12 byte block, if any.  */
+    size_t k = ssse3_encode_loop (out, in, inlen, n);
+    in += k - n;
+    out += (k - n) / 3 * 4;
+    n = k;
+  }
+  _mm256_zeroupper ();
+  return n + encode_scalar (out, in, inlen - n);
+}
+
+#endif /*USE_X86_SIMD*/
+
+
+
+#ifdef USE_NEON
+
+/* Lookup tables for vqtbl4q_u8; the decode tables are split into the
+ * ASCII ranges 0..63 and 64..127.  */
+static byte neon_dec_lo[64];
+static byte neon_dec_hi[64];
+
+static inline uint8x16x4_t
+neon_load_tbl (const byte *p)
+{
+  uint8x16x4_t t;
+
+  t.val[0] = vld1q_u8 (p);
+  t.val[1] = vld1q_u8 (p + 16);
+  t.val[2] = vld1q_u8 (p + 32);
+  t.val[3] = vld1q_u8 (p + 48);
+  return t;
+}
+
+/* Translate 16 characters in C; sets bits in *BAD for invalid ones.  */
+static inline uint8x16_t
+neon_dec_translate (uint8x16_t c, uint8x16x4_t tlo, uint8x16x4_t thi,
+                    uint8x16_t *bad)
+{
+  uint8x16_t v;
+
+  v = vorrq_u8 (vqtbl4q_u8 (tlo, c),
+                vqtbl4q_u8 (thi, veorq_u8 (c, vdupq_n_u8 (0x40))));
+  *bad = vorrq_u8 (*bad, vcgtq_u8 (v, vdupq_n_u8 (63)));
+  *bad = vorrq_u8 (*bad, vcgeq_u8 (c, vdupq_n_u8 (128)));
+  return v;
+}
+
+static size_t
+decode_neon (byte *out, const byte *in, size_t inlen)
+{
+  static int initialized;
+  uint8x16x4_t tlo, thi, s;
+  uint8x16x3_t d;
+  uint8x16_t bad;
+  size_t n;
+  int i;
+
+  if (!initialized)
+    {
+      for (i = 0; i < 64; i++)
+        {
+          neon_dec_lo[i] = asctobin[0][i];
+          neon_dec_hi[i] = asctobin[0][i + 64];
+        }
+      initialized = 1;
+    }
+  tlo = neon_load_tbl (neon_dec_lo);
+  thi = neon_load_tbl (neon_dec_hi);
+
+  for (n = 0; n + 64 <= inlen; n += 64, in += 64, out += 48)
+    {
+      s = vld4q_u8 (in);
+      bad = vdupq_n_u8 (0);
+      for (i = 0; i < 4; i++)
+        s.val[i] = neon_dec_translate (s.val[i], tlo, thi, &bad);
+      if (vmaxvq_u8 (bad))
+        break;
+      d.val[0] = vorrq_u8 (vshlq_n_u8 (s.val[0], 2),
+                           vshrq_n_u8 (s.val[1], 4));
+      d.val[1] = vorrq_u8 (vshlq_n_u8 (s.val[1], 4),
+                           vshrq_n_u8 (s.val[2], 2));
+      d.val[2] = vorrq_u8 (vshlq_n_u8 (s.val[2], 6), s.val[3]);
+      vst3q_u8 (out, d);
+    }
+
+  return n + decode_scalar (out, in, inlen - n);
+}
+
+static size_t
+encode_neon (byte *out, const byte *in, size_t inlen)
+{
+  uint8x16x4_t tbl, idx;
+  uint8x16x3_t s;
+  size_t n;
+  int i;
+
+  tbl = neon_load_tbl (bintoasc);
+  for (n = 0; n + 48 <= inlen; n += 48, in += 48, out += 64)
+    {
+      s = vld3q_u8 (in);
+      idx.val[0] = vshrq_n_u8 (s.val[0], 2);
+      idx.val[1] = vorrq_u8 (vshrq_n_u8 (s.val[1], 4),
+                             vandq_u8 (vshlq_n_u8 (s.val[0], 4),
+                                       vdupq_n_u8 (0x30)));
+      idx.val[2] = vorrq_u8 (vshrq_n_u8 (s.val[2], 6),
+                             vandq_u8 (vshlq_n_u8 (s.val[1], 2),
+                                       vdupq_n_u8 (0x3c)));
+      idx.val[3] = vandq_u8 (s.val[2], vdupq_n_u8 (0x3f));
+      for (i = 0; i < 4; i++)
+        idx.val[i] = vqtbl4q_u8 (tbl, idx.val[i]);
+      vst4q_u8 (out, idx);
+    }
+
+  return n + encode_scalar (out, in, inlen - n);
+}
+
+#endif /*USE_NEON*/
+
+
+
+/* The list of implementations, best first.  */
+static const struct r64_impl_s impl_table[] =
+  {
+#ifdef USE_X86_SIMD
+    { RADIX64_IMPL_AVX2,  "avx2", decode_avx2, encode_avx2, avx2_available },
+    { RADIX64_IMPL_SSSE3, "ssse3", decode_ssse3, encode_ssse3,
+      ssse3_available },
+#endif
+#ifdef USE_NEON
+    { RADIX64_IMPL_NEON,  "neon", decode_neon, encode_neon, always_available },
+#endif
+    { RADIX64_IMPL_SCALAR, "scalar", decode_scalar, encode_scalar,
+      always_available }
+  };
+
+
+/* Select the implementation IMPL.  With RADIX64_IMPL_AUTO the best
+ * implementation supported by the CPU is used.  Returns 0 on success
+ * or -1 if IMPL is not available on this system.  */
+int
+radix64_set_impl (int impl)
+{
+  size_t i;
+
+  init_tables ();
+  for (i = 0; i < sizeof impl_table / sizeof *impl_table; i++)
+    if ((impl == RADIX64_IMPL_AUTO || impl == impl_table[i].impl)
+        && impl_table[i].available ())
+      {
+        selected_impl = impl_table + i;
+        return 0;
+      }
+  return -1;
+}
+
+
+/* Return the name of the implementation in use.  */
+const char *
+radix64_impl_name (void)
+{
+  if (!selected_impl)
+    radix64_set_impl (RADIX64_IMPL_AUTO);
+  return selected_impl->name;
+}
+
+
+/* Decode the radix64 characters at IN of length INLEN to OUT.  Only
+ * complete groups of four valid characters are decoded; decoding
+ * stops at the first group which has a character not in the radix64
+ * alphabet (e.g. white space or a pad character).  Returns the
+ * number of characters consumed which is always a multiple of 4; the
+ * number of bytes stored at OUT is 3/4 of that.  OUT must provide
+ * space for 3*(INLEN/4) bytes; bytes beyond the decoded length may be
+ * clobbered.  */
+size_t
+radix64_decode_block (unsigned char *out, const unsigned char *in,
+                      size_t inlen)
+{
+  if (!selected_impl)
+    radix64_set_impl (RADIX64_IMPL_AUTO);
+  return selected_impl->decode (out, in, inlen);
+}
+
+
+/* Encode the complete groups of three bytes from IN of length INLEN
+ * to radix64 characters at OUT.  No line breaks or padding are
+ * emitted.  Returns the number of bytes consumed which is always a
+ * multiple of 3; 4/3 of that are stored at OUT.  */
+size_t
+radix64_encode_block (unsigned char *out, const unsigned char *in,
+                      size_t inlen)
+{
+  if (!selected_impl)
+    radix64_set_impl (RADIX64_IMPL_AUTO);
+  return selected_impl->encode (out, in, inlen);
+}
+
+
+/* Update the CRC24 value CRC with LEN bytes from BUF and return the
+ * new value.  The initial value is RADIX64_CRC24_INIT; the result is
+ * the 24 bit checksum as transmitted in the armor.  */
+u32
+radix64_crc24 (u32 crc, const unsigned char *buf, size_t len)
+{
+  u32 c;
+
+  init_tables ();
+  c = crc << 8;
+  for (; len >= 8; len -= 8, buf += 8)
+    {
+      c ^= (((u32)buf[0] << 24) | ((u32)buf[1] << 16)
+            | ((u32)buf[2] << 8) | buf[3]);
+      c = (crc24_table[7][c >> 24]
+           ^ crc24_table[6][(c >> 16) & 0xff]
+           ^ crc24_table[5][(c >> 8) & 0xff]
+           ^ crc24_table[4][c & 0xff]
+           ^ crc24_table[3][buf[4]]
+           ^ crc24_table[2][buf[5]]
+           ^ crc24_table[1][buf[6]]
+           ^ crc24_table[0][buf[7]]);
+    }
+  for (; len; len--, buf++)
+    c = (c << 8) ^ crc24_table[0][(c >> 24) ^ *buf];
+  return (c >> 8) & 0xffffff;
+}
+
+
+/* Same as radix64_decode_block but also update the CRC24 at R_CRC
+ * with the decoded bytes.  The checksum is computed in small steps
+ * while the just decoded data is still in the L1 cache.  */
+size_t
+radix64_decode_block_crc (unsigned char *out, const unsigned char *in,
+                          size_t inlen, u32 *r_crc)
+{
+  size_t n, chunk, used;
+  u32 crc = *r_crc;
+
+  if (!selected_impl)
+    radix64_set_impl (RADIX64_IMPL_AUTO);
+  for (n = 0; n + 4 <= inlen; n += used, in += used, out += used / 4 * 3)
+    {
+      chunk = inlen - n;
+      if (chunk > 256)
+        chunk = 256;
+      used = selected_impl->decode (out, in, chunk);
+      crc = radix64_crc24 (crc, out, used / 4 * 3);
+      if (used < chunk)
+        {
+          n += used;
+          break;
+        }
+    }
+  *r_crc = crc;
+  return n;
+}
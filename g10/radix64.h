@@ -0,0 +1,48 @@
+/* radix64.h - Block radix64 encoder and decoder
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_RADIX64_H
+#define G10_RADIX64_H
+
+/* The available implementations.  */
+enum radix64_impls
+  {
+    RADIX64_IMPL_AUTO = 0,  /* Select the best available one.  */
+    RADIX64_IMPL_SCALAR,
+    RADIX64_IMPL_SSSE3,
+    RADIX64_IMPL_AVX2,
+    RADIX64_IMPL_NEON
+  };
+
+int radix64_set_impl (int impl);
+const char *radix64_impl_name (void);
+
+size_t radix64_decode_block (unsigned char *out,
+                             const unsigned char *in, size_t inlen);
+size_t radix64_encode_block (unsigned char *out,
+                             const unsigned char *in, size_t inlen);
+
+/* The initial value for the armor checksum.  */
+#define RADIX64_CRC24_INIT 0xb704ce
+
+u32 radix64_crc24 (u32 crc, const unsigned char *buf, size_t len);
+size_t radix64_decode_block_crc (unsigned char *out,
+                                 const unsigned char *in, size_t inlen,
+                                 u32 *r_crc);
+
+#endif /*G10_RADIX64_H*/
@@ -35,6 +35,9 @@
 #include "../common/server-help.h"
 #include "../common/sysutils.h"
 #include "../common/status.h"
+#include "keydb.h"
+#include "objcache.h"
+#include "tdbio.h"
 
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
@@ -116,6 +119,39 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 }
 
 
+/* Drop the cached data about keys so that the next commands read it
+   again from the key database and the trustdb.  The connections to
+   the agent and the dirmngr are kept.  */
+static void
+flush_caches (void)
+{
+  keydb_flush_caches ();
+  getkey_flush_caches ();
+  objcache_flush ();
+  objcache_release ();
+  tdbio_invalidate_cache ();
+}
+
+
+/* Called by libassuan before each command.  The server is a long
+   running process and thus we check whether the key database has
+   been changed by another process.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  (void)ctx;
+  (void)cmd;
+
+  if (keydb_check_changes ())
+    {
+      if (DBG_CACHE)
+        log_debug ("server: key database changed - flushing caches\n");
+      flush_caches ();
+    }
+  return 0;
+}
+
+
 /* Called by libassuan for RESET commands. */
 static gpg_error_t
 reset_notify (assuan_context_t ctx, char *line)
@@ -572,6 +608,23 @@ cmd_getinfo (assuan_context_t ctx, char *line)
   return rc;
 }
 
+static const char hlp_flushcaches[] =
+  "FLUSHCACHES\n"
+  "\n"
+  "Drop the cached data about keys.  Changes of the keyring files\n"
+  "are detected before each command; this command is required to\n"
+  "see changes done through the keyboxd by other processes.";
+static gpg_error_t
+cmd_flushcaches (assuan_context_t ctx, char *line)
+{
+  (void)ctx;
+  (void)line;
+
+  flush_caches ();
+  return 0;
+}
+
+
 static const char hlp_passwd[] =
   "PASSWD <userID>\n"
   "\n"
@@ -621,6 +674,7 @@ register_commands (assuan_context_t ctx)
     { "DELKEYS",       cmd_delkeys   },
     { "GETINFO",       cmd_getinfo   },
     { "PASSWD",        cmd_passwd,  hlp_passwd},
+    { "FLUSHCACHES",   cmd_flushcaches, hlp_flushcaches },
     { NULL }
   };
   int i, rc;
@@ -705,6 +759,7 @@ gpg_server (ctrl_t ctrl)
   else
     assuan_set_hello_line (ctx, hello);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_input_notify (ctx, input_notify);
   assuan_register_output_notify (ctx, output_notify);
   assuan_register_option_handler (ctx, option_handler);
@@ -718,6 +773,9 @@ gpg_server (ctrl_t ctrl)
   ctrl->server_local->assuan_ctx = ctx;
   ctrl->server_local->message_fd = GNUPG_INVALID_FD;
 
+  /* Record the state of the key database files.  */
+  keydb_check_changes ();
+
   for (;;)
     {
       rc = assuan_accept (ctx);
@@ -0,0 +1,413 @@
+/* sig-cache.c - Persistent cache of key signature checks
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The cached verification status of key signatures in ring trust
+ * packets is only available for keyrings and gets lost with a fresh
+ * import or when using the keyboxd.  With --persistent-sig-cache the
+ * results of the public key operations for key signatures are in
+ * addition kept in the file SIG_CACHE_NAME in the home directory.
+ *
+ * An entry is looked up by the SHA-256 hash over the fingerprint of
+ * the signing key, the digest of the signed data as given to
+ * pk_verify, and the signature values.  The digest covers the signed
+ * key or user ID and the signature meta data; thus an entry only
+ * matches for exactly the same verification.
+ *
+ * The file starts with a record holding the magic and version,
+ * followed by records of a key and the result.  New entries are only
+ * appended, on exit, using a single write; concurrent processes may
+ * thus add entries to the same file.  A truncated last record is
+ * padded by the next writer.  If the file grows too large it is removed and a new
+ * cache started.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "main.h"
+#include "options.h"
+#include "sig-cache.h"
+
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+/* The length of the key of an entry and the size of a record.  */
+#define KEYLEN   20
+#define RECLEN   24
+
+/* Files with more records are removed.  */
+#define MAX_ENTRIES (1024 * 1024)
+
+/* The magic in the first record.  */
+#define MAGIC "LCRsigcache"
+#define CACHE_VERSION 1
+
+/* The results stored in a record.  */
+#define RESULT_GOOD 1
+#define RESULT_BAD  2
+
+
+static struct
+{
+  unsigned int lookups;
+  unsigned int hits;
+  unsigned int stored;
+} cache_stats;
+
+
+/* The in-memory table, indexed by the first bytes of the key.  Each
+ * slot holds a record or all zeroes; ENTRIES is less than half of
+ * SIZE.  */
+static struct
+{
+  int loaded;
+  unsigned int size;
+  unsigned int entries;
+  byte *slots;
+
+  /* The records to be appended on exit.  */
+  byte *pending;
+  unsigned int npending;
+  unsigned int pendingsize;
+} tbl;
+
+
+static char *
+cache_filename (void)
+{
+  return make_filename (gnupg_homedir (), SIG_CACHE_NAME, NULL);
+}
+
+
+/* Add the value of A to MD.  */
+static void
+hash_mpi (gcry_md_hd_t md, gcry_mpi_t a)
+{
+  const void *p;
+  unsigned int nbits;
+  byte *buf;
+  size_t n;
+
+  if (!a)
+    gcry_md_putc (md, 0);
+  else if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      p = gcry_mpi_get_opaque (a, &nbits);
+      gcry_md_putc (md, 1);
+      gcry_md_putc (md, nbits >> 8);
+      gcry_md_putc (md, nbits);
+      if (p)
+        gcry_md_write (md, p, (nbits + 7) / 8);
+    }
+  else if (!gcry_mpi_aprint (GCRYMPI_FMT_PGP, &buf, &n, a))
+    {
+      gcry_md_putc (md, 2);
+      gcry_md_write (md, buf, n);
+      gcry_free (buf);
+    }
+}
+
+
+/* Compute the key of the entry for the verification of SIG by PK
+ * with the encoded digest HASH.  */
+static void
+make_key (byte *key, PKT_public_key *pk, PKT_signature *sig, gcry_mpi_t hash)
+{
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  int i, nsig;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    BUG ();
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_putc (md, fprlen);
+  gcry_md_write (md, fpr, fprlen);
+  gcry_md_putc (md, sig->pubkey_algo);
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_putc (md, sig->sig_class);
+  hash_mpi (md, hash);
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  for (i = 0; i < nsig && i < PUBKEY_MAX_NSIG; i++)
+    hash_mpi (md, sig->data[i]);
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA256), KEYLEN);
+  gcry_md_close (md);
+}
+
+
+/* Return the slot for KEY; this is either the one holding KEY or the
+ * empty one where it would be inserted.  */
+static byte *
+find_slot (const byte *key)
+{
+  unsigned int idx = buf32_to_uint (key) & (tbl.size - 1);
+  byte *slot;
+
+  for (;;)
+    {
+      slot = tbl.slots + idx * RECLEN;
+      if (!slot[KEYLEN] || !memcmp (slot, key, KEYLEN))
+        return slot;
+      idx = (idx + 1) & (tbl.size - 1);
+    }
+}
+
+
+/* Insert or update the record REC.  Returns false on OOM.  */
+static int
+insert_record (const byte *rec)
+{
+  byte *slot;
+
+  if (2 * (tbl.entries + 1) > tbl.size)
+    {
+      byte *old = tbl.slots;
+      unsigned int oldsize = tbl.size;
+      unsigned int i;
+
+      tbl.slots = xtrycalloc (oldsize? 2 * oldsize : 1024, RECLEN);
+      if (!tbl.slots)
+        {
+          tbl.slots = old;
+          return 0;
+        }
+      tbl.size = oldsize? 2 * oldsize : 1024;
+      for (i = 0; i < oldsize; i++)
+        if (old[i * RECLEN + KEYLEN])
+          memcpy (find_slot (old + i * RECLEN), old + i * RECLEN, RECLEN);
+      xfree (old);
+    }
+
+  slot = find_slot (rec);
+  if (!slot[KEYLEN])
+    tbl.entries++;
+  memcpy (slot, rec, RECLEN);
+  return 1;
+}
+
+
+/* Read the cache file into the table.  */
+static void
+load_cache (void)
+{
+  char *fname;
+  estream_t fp;
+  byte rec[RECLEN];
+  unsigned int n = 0;
+
+  tbl.loaded = 1;
+  fname = cache_filename ();
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      xfree (fname);
+      return;
+    }
+
+  if (es_fread (rec, RECLEN, 1, fp) != 1
+      || memcmp (rec, MAGIC, strlen (MAGIC))
+      || rec[RECLEN-1] != CACHE_VERSION)
+    {
+      log_info ("ignoring invalid signature cache '%s'\n", fname);
+      es_fclose (fp);
+      gnupg_remove (fname);
+      xfree (fname);
+      return;
+    }
+
+  while (es_fread (rec, RECLEN, 1, fp) == 1)
+    {
+      if (++n > MAX_ENTRIES)
+        {
+          if (opt.verbose)
+            log_info ("removing the full signature cache '%s'\n", fname);
+          es_fclose (fp);
+          gnupg_remove (fname);
+          xfree (fname);
+          sig_cache_release ();
+          tbl.loaded = 1;
+          return;
+        }
+      if ((rec[KEYLEN] == RESULT_GOOD || rec[KEYLEN] == RESULT_BAD)
+          && !insert_record (rec))
+        break;
+    }
+  es_fclose (fp);
+  xfree (fname);
+}
+
+
+/* Check whether the verification of SIG by PK with the encoded
+ * digest HASH is cached.  If so, return true and store the result at
+ * R_RC.  */
+int
+sig_cache_lookup (PKT_public_key *pk, PKT_signature *sig,
+                  gcry_mpi_t hash, int *r_rc)
+{
+  byte key[KEYLEN];
+  byte *slot;
+
+  if (!opt.persistent_sig_cache || opt.no_sig_cache)
+    return 0;
+  if (!tbl.loaded)
+    load_cache ();
+  cache_stats.lookups++;
+  if (!tbl.entries)
+    return 0;
+
+  make_key (key, pk, sig, hash);
+  slot = find_slot (key);
+  if (!slot[KEYLEN])
+    return 0;
+  cache_stats.hits++;
+  *r_rc = slot[KEYLEN] == RESULT_GOOD? 0 : gpg_error (GPG_ERR_BAD_SIGNATURE);
+  return 1;
+}
+
+
+/* Store the result RC of the verification of SIG by PK with the
+ * encoded digest HASH.  Only good and bad signatures are cached.  */
+void
+sig_cache_store (PKT_public_key *pk, PKT_signature *sig,
+                 gcry_mpi_t hash, int rc)
+{
+  byte rec[RECLEN];
+
+  if (!opt.persistent_sig_cache || opt.no_sig_cache)
+    return;
+  if (rc && gpg_err_code (rc) != GPG_ERR_BAD_SIGNATURE)
+    return;
+  if (!tbl.loaded)
+    load_cache ();
+
+  memset (rec, 0, RECLEN);
+  make_key (rec, pk, sig, hash);
+  rec[KEYLEN] = rc? RESULT_BAD : RESULT_GOOD;
+
+  if (tbl.npending == tbl.pendingsize)
+    {
+      unsigned int newsize = tbl.pendingsize? 2 * tbl.pendingsize : 64;
+      byte *p = xtryrealloc (tbl.pending, newsize * RECLEN);
+
+      if (!p)
+        return;
+      tbl.pending = p;
+      tbl.pendingsize = newsize;
+    }
+  if (!insert_record (rec))
+    return;
+  memcpy (tbl.pending + tbl.npending * RECLEN, rec, RECLEN);
+  tbl.npending++;
+  cache_stats.stored++;
+}
+
+
+/* Append the new entries to the cache file.  They are written with
+ * a single write so that the records of concurrent processes do not
+ * get mixed up.  */
+void
+sig_cache_flush (void)
+{
+  char *fname;
+  int fd;
+  struct stat st;
+  byte *buf = NULL;
+  size_t len = 0;
+  size_t n;
+  ssize_t nwritten;
+
+  if (!tbl.npending)
+    return;
+
+  fname = cache_filename ();
+  fd = gnupg_open (fname, O_WRONLY|O_CREAT|O_APPEND|O_BINARY, 0600);
+  if (fd == -1 || fstat (fd, &st))
+    {
+      log_info ("can't open '%s': %s\n", fname,
+                gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+
+  /* Room for the header or for the padding of a truncated record
+   * from an interrupted write.  */
+  buf = xtrycalloc (tbl.npending + 1, RECLEN);
+  if (!buf)
+    goto leave;
+  if (!st.st_size)
+    {
+      memcpy (buf, MAGIC, strlen (MAGIC));
+      buf[RECLEN-1] = CACHE_VERSION;
+      len = RECLEN;
+    }
+  else if (st.st_size % RECLEN)
+    len = RECLEN - st.st_size % RECLEN;
+  memcpy (buf + len, tbl.pending, tbl.npending * RECLEN);
+  len += tbl.npending * RECLEN;
+
+  for (n = 0; n < len; n += nwritten)
+    {
+      nwritten = write (fd, buf + n, len - n);
+      if (nwritten < 0)
+        {
+          log_info ("error writing '%s': %s\n", fname,
+                    gpg_strerror (gpg_error_from_syserror ()));
+          break;
+        }
+    }
+  tbl.npending = 0;
+
+ leave:
+  if (fd != -1)
+    close (fd);
+  xfree (buf);
+  xfree (fname);
+}
+
+
+/* Release the in-memory table; new entries not yet written to the
+ * file are dropped.  */
+void
+sig_cache_release (void)
+{
+  xfree (tbl.slots);
+  xfree (tbl.pending);
+  memset (&tbl, 0, sizeof tbl);
+}
+
+
+void
+sig_cache_dump_stats (void)
+{
+  if (opt.persistent_sig_cache)
+    log_info ("sig_cache_file: lookups=%u hits=%u stored=%u entries=%u\n",
+              cache_stats.lookups, cache_stats.hits, cache_stats.stored,
+              tbl.entries);
+}
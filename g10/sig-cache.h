@@ -0,0 +1,34 @@
+/* sig-cache.h - Persistent cache of key signature checks
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_SIG_CACHE_H
+#define G10_SIG_CACHE_H
+
+/* The name of the cache file in the home directory.  */
+#define SIG_CACHE_NAME "sigcache.dat"
+
+/*-- sig-cache.c --*/
+int sig_cache_lookup (PKT_public_key *pk, PKT_signature *sig,
+                      gcry_mpi_t hash, int *r_rc);
+void sig_cache_store (PKT_public_key *pk, PKT_signature *sig,
+                      gcry_mpi_t hash, int rc);
+void sig_cache_flush (void);
+void sig_cache_release (void);
+void sig_cache_dump_stats (void);
+
+#endif /*G10_SIG_CACHE_H*/
@@ -34,6 +34,10 @@
 #include "options.h"
 #include "pkglue.h"
 #include "../common/compliance.h"
+#include "../common/tstats.h"
+#include "sig-cache.h"
+#include "sigbatch.h"
+#include "keysig-pool.h"
 
 static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 				gcry_md_hd_t digest,
@@ -45,6 +49,15 @@ static int check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
                                        gcry_md_hd_t digest,
                                        const void *extrahash,
                                        size_t extrahashlen);
+static int prepare_signature_end (PKT_public_key *pk, PKT_signature *sig,
+                                  gcry_md_hd_t digest,
+                                  const void *extrahash, size_t extrahashlen,
+                                  gcry_mpi_t *r_result);
+static int final_signature_result (PKT_public_key *pk, PKT_signature *sig,
+                                   int rc);
+static void hash_key_sig_data (gcry_md_hd_t md, PKT_signature *sig,
+                               PKT_public_key *pripk, PKT_public_key *signer,
+                               PACKET *packet);
 
 
 /* Statistics for signature verification.  */
@@ -500,9 +513,56 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
                             gcry_md_hd_t digest,
                             const void *extrahash, size_t extrahashlen)
 {
-  gcry_mpi_t result = NULL;
+  gcry_mpi_t result;
+  int rc;
+
+  rc = prepare_signature_end (pk, sig, digest, extrahash, extrahashlen,
+                              &result);
+  if (rc)
+    return rc;
+
+  /* Key signatures are also cached in a file.  */
+  if ((IS_CERT (sig) || IS_BACK_SIG (sig))
+      && sig_cache_lookup (pk, sig, result, &rc))
+    {
+      gcry_mpi_release (result);
+      return final_signature_result (pk, sig, rc);
+    }
+
+  /* Verify the signature unless that has already been done by a
+   * batch.  */
+  if (DBG_CLOCK && sig->sig_class <= 0x01)
+    log_clock ("enter pk_verify");
+  TSTAT_ENTER (TSTAT_SIG_CHECK);
+  if ((opt.batch_verify || opt.verify_threads > 1)
+      && sigbatch_lookup (pk->pubkey_algo, pk->pkey, result, sig->data))
+    rc = 0;
+  else
+    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
+  TSTAT_LEAVE (TSTAT_SIG_CHECK);
+  if (DBG_CLOCK && sig->sig_class <= 0x01)
+    log_clock ("leave pk_verify");
+  if (IS_CERT (sig) || IS_BACK_SIG (sig))
+    sig_cache_store (pk, sig, result, rc);
+  gcry_mpi_release (result);
+
+  return final_signature_result (pk, sig, rc);
+}
+
+
+/* The first part of check_signature_end_simple: Check that PK may
+ * have made SIG, complete DIGEST and store the value to be verified
+ * at R_RESULT.  The caller must release it.  */
+static int
+prepare_signature_end (PKT_public_key *pk, PKT_signature *sig,
+                       gcry_md_hd_t digest,
+                       const void *extrahash, size_t extrahashlen,
+                       gcry_mpi_t *r_result)
+{
   int rc = 0;
 
+  *r_result = NULL;
+
   if (!opt.flags.allow_weak_digest_algos)
     {
       if (is_weak_digest (sig->digest_algo))
@@ -623,18 +683,102 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     gcry_md_final( digest );
 
     /* Convert the digest to an MPI.  */
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
+    *r_result = encode_md_value (pk, digest, sig->digest_algo );
+    if (!*r_result)
         return GPG_ERR_GENERAL;
 
-    /* Verify the signature.  */
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("enter pk_verify");
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("leave pk_verify");
-    gcry_mpi_release (result);
+  return 0;
+}
+
+
+/* Verify the NSIGS data signatures at SIGS over the data hashed into
+ * MD ahead of the regular checks and remember the valid ones.  The
+ * following regular checks of these signatures then skip the public
+ * key operation.  The digest of each signature is completed on a
+ * copy of MD.  With --batch-verify the Ed25519 signatures are then
+ * verified in batches and with --verify-threads the others are
+ * verified in parallel.  Only signatures which the regular check
+ * would verify with MD and without diagnostics are considered; all
+ * others are left alone.  */
+void
+batch_check_data_sigs (ctrl_t ctrl, PKT_signature **sigs, unsigned int nsigs,
+                       gcry_md_hd_t md)
+{
+  struct sigbatch_item_s *items;
+  PKT_public_key **pks;
+  PKT_signature *sig;
+  gcry_md_hd_t md2;
+  gcry_mpi_t hash;
+  unsigned int i, n;
+
+  if (nsigs < 2 || !md)
+    return;
+  items = xtrycalloc (nsigs, sizeof *items);
+  pks = xtrycalloc (nsigs, sizeof *pks);
+  if (!items || !pks)
+    goto leave;
+
+  for (i = n = 0; i < nsigs; i++)
+    {
+      sig = sigs[i];
+      if (sig->version != 4
+          || (sig->sig_class != 0x00 && sig->sig_class != 0x01)
+          || openpgp_md_test_algo (sig->digest_algo)
+          || !gcry_md_is_enabled (md, sig->digest_algo)
+          || (!opt.flags.allow_weak_digest_algos
+              && is_weak_digest (sig->digest_algo))
+          || !(pks[n] = xtrycalloc (1, sizeof **pks)))
+        continue;
+      if (get_pubkey_for_sig (ctrl, pks[n], sig, NULL)
+          || !((opt.batch_verify
+                && sigbatch_supported (pks[n]->pubkey_algo, pks[n]->pkey))
+               || opt.verify_threads > 1)
+          || !(pks[n]->pubkey_usage & PUBKEY_USAGE_SIG)
+          || gcry_md_copy (&md2, md))
+        {
+          free_public_key (pks[n]);
+          pks[n] = NULL;
+          continue;
+        }
+      hash = NULL;
+      prepare_signature_end (pks[n], sig, md2, NULL, 0, &hash);
+      gcry_md_close (md2);
+      if (!hash)
+        {
+          free_public_key (pks[n]);
+          pks[n] = NULL;
+          continue;
+        }
+      items[n].pubkey_algo = pks[n]->pubkey_algo;
+      items[n].pkey = pks[n]->pkey;
+      items[n].hash = hash;
+      items[n].data = sig->data;
+      n++;
+    }
+
+  TSTAT_ENTER (TSTAT_SIG_CHECK);
+  if (opt.batch_verify)
+    sigbatch_verify (items, n);
+  keysig_pool_verify_items (items, n, opt.verify_threads);
+  TSTAT_LEAVE (TSTAT_SIG_CHECK);
+  for (i = 0; i < n; i++)
+    {
+      sigbatch_remember (items + i);
+      gcry_mpi_release (items[i].hash);
+      free_public_key (pks[i]);
+    }
 
+ leave:
+  xfree (items);
+  xfree (pks);
+}
+
+
+/* Return the result of the signature check of SIG by PK given the
+ * return code RC of pk_verify.  */
+static int
+final_signature_result (PKT_public_key *pk, PKT_signature *sig, int rc)
+{
   if (!rc && sig->flags.unknown_critical)
     {
       log_info(_("assuming bad signature from key %s"
@@ -866,6 +1010,47 @@ check_key_signature (ctrl_t ctrl, kbnode_t root, kbnode_t node,
 }
 
 
+/* Hash the data signed by the key signature SIG into MD.  PACKET is
+ * the key, subkey or uid over which SIG has been made, PRIPK the
+ * primary key of the keyblock and SIGNER the key which made SIG.  The
+ * caller must have checked that PACKET fits to the class of SIG.  */
+static void
+hash_key_sig_data (gcry_md_hd_t md, PKT_signature *sig,
+                   PKT_public_key *pripk, PKT_public_key *signer,
+                   PACKET *packet)
+{
+  if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
+      hash_public_key (md, packet->pkt.public_key);
+    }
+  else if (IS_BACK_SIG (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
+      hash_public_key (md, packet->pkt.public_key);
+      hash_public_key (md, signer);
+    }
+  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
+      hash_public_key (md, pripk);
+      hash_public_key (md, packet->pkt.public_key);
+    }
+  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+    {
+      log_assert (packet->pkttype == PKT_USER_ID);
+      hash_public_key (md, pripk);
+      hash_uid_packet (packet->pkt.user_id, md, sig);
+    }
+  else
+    {
+      /* We should never get here.  (The caller should have already
+       * caught this error.)  */
+      BUG ();
+    }
+}
+
+
 /* Returns whether SIGNER generated the signature SIG over the packet
  * PACKET, which is a key, subkey or uid, and comes from the key block
  * KB.  (KB is PACKET's corresponding keyblock; we don't assume that
@@ -1026,51 +1211,21 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
 
   /* Hash the relevant data.  */
 
-  if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+  if ((IS_UID_SIG (sig) || IS_UID_REV (sig))
+      && sig->digest_algo == DIGEST_ALGO_SHA1 && !*is_selfsig
+      && !opt.flags.allow_weak_key_signatures)
     {
-      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_BACK_SIG (sig))
-    {
-      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      hash_public_key (md, signer);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
-    {
-      log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
-      hash_public_key (md, pripk);
-      hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-    }
-  else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
-    {
-      log_assert (packet->pkttype == PKT_USER_ID);
-      if (sig->digest_algo == DIGEST_ALGO_SHA1 && !*is_selfsig
-          && !opt.flags.allow_weak_key_signatures)
-        {
-          /* If the signature was created using SHA-1 we consider this
-           * signature invalid because it makes it possible to mount a
-           * chosen-prefix collision.  We don't do this for
-           * self-signatures, though.  */
-          print_sha1_keysig_rejected_note ();
-          rc = gpg_error (GPG_ERR_DIGEST_ALGO);
-        }
-      else
-        {
-          hash_public_key (md, pripk);
-          hash_uid_packet (packet->pkt.user_id, md, sig);
-          rc = check_signature_end_simple (signer, sig, md, NULL, 0);
-        }
+      /* If the signature was created using SHA-1 we consider this
+       * signature invalid because it makes it possible to mount a
+       * chosen-prefix collision.  We don't do this for
+       * self-signatures, though.  */
+      print_sha1_keysig_rejected_note ();
+      rc = gpg_error (GPG_ERR_DIGEST_ALGO);
     }
   else
     {
-      /* We should never get here.  (The first if above should have
-       * already caught this error.)  */
-      BUG ();
+      hash_key_sig_data (md, sig, pripk, signer, packet);
+      rc = check_signature_end_simple (signer, sig, md, NULL, 0);
     }
 
   gcry_md_close (md);
@@ -1286,3 +1441,102 @@ check_key_signature2 (ctrl_t ctrl,
 
   return rc;
 }
+
+
+/* Prepare the check of the key signature NODE over PACKET, which are
+ * both part of the keyblock ROOT, so that only the public key
+ * operation remains.  SIGNER is the key which issued the signature;
+ * NULL is used for a self-signature by the primary key of ROOT.
+ * Signatures of other keys are only handled if they certify a user
+ * id.  This is used by keysig-pool.c to run those operations in
+ * parallel.  On success the value to be verified is stored at R_HASH;
+ * the caller must pass it along with the result of pk_verify to
+ * finish_key_sig_check and then release it.  GPG_ERR_NOT_SUPPORTED
+ * is returned for signatures which need to be checked by
+ * check_key_signature; this is also the case for all signatures
+ * which would print a diagnostic.  It is also returned if the result
+ * was found in the signature cache file; the result is then already
+ * cached in the signature packet.  */
+gpg_error_t
+prepare_key_sig_check (kbnode_t root, kbnode_t node, PACKET *packet,
+                       PKT_public_key *signer, gcry_mpi_t *r_hash)
+{
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  gcry_md_hd_t md;
+  int rc;
+
+  *r_hash = NULL;
+  log_assert (root->pkt->pkttype == PKT_PUBLIC_KEY);
+  log_assert (node->pkt->pkttype == PKT_SIGNATURE);
+  pk = root->pkt->pkt.public_key;
+  sig = node->pkt->pkt.signature;
+  if (!signer)
+    signer = pk;
+
+  if (opt.no_sig_cache || sig->flags.checked)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (keyid_cmp (pk_keyid (signer), sig->keyid))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if ((IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+      ? packet->pkttype != PKT_PUBLIC_KEY
+      : (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+      ? packet->pkttype != PKT_PUBLIC_SUBKEY
+      : (IS_UID_SIG (sig) || IS_UID_REV (sig))
+      ? packet->pkttype != PKT_USER_ID
+      : 1)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (signer != pk)
+    {
+      /* Certifications by other keys; SHA-1 and a missing cert usage
+       * are reported by the regular check.  */
+      if (!(IS_UID_SIG (sig) || IS_UID_REV (sig)))
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      if (sig->digest_algo == DIGEST_ALGO_SHA1
+          && !opt.flags.allow_weak_key_signatures)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      if (!signer->flags.primary
+          && !(signer->pubkey_usage & PUBKEY_USAGE_CERT))
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  if (openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (!opt.flags.allow_weak_digest_algos && is_weak_digest (sig->digest_algo))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  /* The time conflicts detected by check_signature_metadata_validity
+   * are left to the regular check as well.  */
+  if (pk->timestamp > sig->timestamp || pk->timestamp > make_timestamp ())
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    BUG ();
+  hash_key_sig_data (md, sig, pk, signer, packet);
+  rc = prepare_signature_end (signer, sig, md, NULL, 0, r_hash);
+  gcry_md_close (md);
+  if (!rc && sig_cache_lookup (signer, sig, *r_hash, &rc))
+    {
+      cache_sig_result (sig, final_signature_result (signer, sig, rc));
+      gcry_mpi_release (*r_hash);
+      *r_hash = NULL;
+      rc = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  return rc;
+}
+
+
+/* Store the result RC of the pk_verify of HASH for a signature
+ * prepared with prepare_key_sig_check in the signature packet of
+ * NODE.  SIGNER is the same as given to prepare_key_sig_check.  The
+ * next check_key_signature of NODE uses this cached result.  */
+void
+finish_key_sig_check (kbnode_t root, kbnode_t node, PKT_public_key *signer,
+                      gcry_mpi_t hash, int rc)
+{
+  PKT_public_key *pk = signer? signer : root->pkt->pkt.public_key;
+  PKT_signature *sig = node->pkt->pkt.signature;
+
+  sig_cache_store (pk, sig, hash, rc);
+  cache_sig_result (sig, final_signature_result (pk, sig, rc));
+}
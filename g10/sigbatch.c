@@ -0,0 +1,633 @@
+/* sigbatch.c - Batch verification of Ed25519 signatures
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* An Ed25519 signature (R,S) over M by the key A is valid if
+ *
+ *   [8][S]B = [8]R + [8][h]A   with h = SHA512(R || A || M)
+ *
+ * For a set of signatures and random 128 bit factors z_i this module
+ * checks the single equation
+ *
+ *   [8]([sum z_i S_i]B - sum [z_i]R_i - sum [z_i h_i]A_i) = 0
+ *
+ * which holds if all signatures are valid and, if one is not, with a
+ * probability of at most 2^-125.  The multiples are computed in one
+ * pass of doublings with the bits of all factors (Straus' method) and
+ * the factors of signatures by the same key are summed up, so that a
+ * signature costs the decoding of R and about 64 point additions
+ * instead of two full scalar multiplications.  If a batch fails it is
+ * split in halves until the bad signatures are isolated in sets
+ * smaller than SIGBATCH_MIN_ITEMS; those are left unverified for the
+ * regular check by pk_verify which also yields the diagnostics.
+ *
+ * The cofactored equation is the one RFC 8032 allows for batches.  It
+ * accepts every signature libgcrypt accepts; in addition it would
+ * accept a signature whose R carries a small order component, which
+ * only the holder of the secret key is able to create.  Non-canonical
+ * encodings of R and values of S not less than the group order are
+ * left to the regular check.
+ *
+ * Verified signatures can be remembered so that a later pk_verify of
+ * the same signature by check_signature_end_simple is skipped.  The
+ * memo is keyed by a digest over all inputs of the verification.  It
+ * also takes signatures of other algorithms which have been verified
+ * ahead of time on worker threads.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/openpgpdefs.h"
+#include "sigbatch.h"
+
+
+/* The maximum number of signatures verified in one batch.  */
+#define MAX_BATCH 64
+
+/* The number of remembered signatures.  */
+#define MEMO_SIZE 256
+
+
+/* A signature prepared for the batch.  */
+struct prepared_s
+{
+  unsigned int idx;         /* Index into the items.  */
+  unsigned int key;         /* Index into the keys.  */
+  gcry_mpi_point_t r;       /* The decoded R.  */
+  gcry_mpi_t s;             /* S.  */
+  gcry_mpi_t h;             /* The challenge reduced modulo L.  */
+  gcry_mpi_t z;             /* The random factor.  */
+};
+
+
+/* A distinct key in a batch.  */
+struct batchkey_s
+{
+  byte a[32];               /* The encoded point A.  */
+  gcry_mpi_point_t point;   /* The decoded point A.  */
+  gcry_mpi_t coeff;         /* The summed up factor.  */
+};
+
+
+struct batch_s
+{
+  gcry_ctx_t ctx;
+  gcry_mpi_t p;             /* The field prime.  */
+  gcry_mpi_t l;             /* The order of B.  */
+  gcry_mpi_point_t b;       /* The base point.  */
+  unsigned int nsigs;
+  struct prepared_s sigs[MAX_BATCH];
+  unsigned int nkeys;
+  struct batchkey_s keys[MAX_BATCH];
+};
+
+
+static byte memo[MEMO_SIZE][32];
+static unsigned int memo_used;
+static unsigned int memo_next;
+
+static struct
+{
+  unsigned long batches;
+  unsigned long failed;
+  unsigned long verified;
+  unsigned long memo_hits;
+} stats;
+
+
+
+/* Store the value of A left padded to LEN bytes at BUF.  Returns
+ * false if A does not fit.  */
+static int
+get_fixed (gcry_mpi_t a, byte *buf, size_t len)
+{
+  const byte *p;
+  unsigned int nbits;
+  size_t n;
+
+  if (!a)
+    return 0;
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      p = gcry_mpi_get_opaque (a, &nbits);
+      n = (nbits + 7) / 8;
+      if (!p || n > len)
+        return 0;
+      memset (buf, 0, len - n);
+      memcpy (buf + len - n, p, n);
+      return 1;
+    }
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, NULL, 0, &n, a) || n > len)
+    return 0;
+  memset (buf, 0, len - n);
+  return !gcry_mpi_print (GCRYMPI_FMT_USG, buf + len - n, n, NULL, a);
+}
+
+
+/* Return an MPI with the little endian number of LEN bytes at BUF.  */
+static gcry_mpi_t
+mpi_from_le (const byte *buf, size_t len)
+{
+  byte tmp[64];
+  gcry_mpi_t a;
+  size_t i;
+
+  log_assert (len <= sizeof tmp);
+  for (i = 0; i < len; i++)
+    tmp[i] = buf[len - 1 - i];
+  if (gcry_mpi_scan (&a, GCRYMPI_FMT_USG, tmp, len, NULL))
+    return NULL;
+  return a;
+}
+
+
+/* Return true if the signature with the public key PKEY can be
+ * verified by this module.  */
+int
+sigbatch_supported (int pubkey_algo, gcry_mpi_t *pkey)
+{
+  return (pubkey_algo == PUBKEY_ALGO_EDDSA
+          && openpgp_oid_is_ed25519 (pkey[0]));
+}
+
+
+/* Return the message to be verified, that is the value of the opaque
+ * MPI HASH, and store its length at R_LEN.  */
+static const byte *
+get_message (gcry_mpi_t hash, size_t *r_len)
+{
+  const byte *p;
+  unsigned int nbits;
+
+  if (!hash || !gcry_mpi_get_flag (hash, GCRYMPI_FLAG_OPAQUE))
+    return NULL;
+  p = gcry_mpi_get_opaque (hash, &nbits);
+  *r_len = (nbits + 7) / 8;
+  return p;
+}
+
+
+/* Return true if the 32 bytes at R are the canonical encoding of a
+ * point; see RFC 8032, section 5.1.3.  */
+static int
+is_canonical (struct batch_s *batch, const byte *r)
+{
+  byte tmp[32];
+  gcry_mpi_t y;
+  int ok;
+
+  memcpy (tmp, r, 32);
+  tmp[31] &= 0x7f;
+  y = mpi_from_le (tmp, 32);
+  if (!y)
+    return 0;
+  ok = gcry_mpi_cmp (y, batch->p) < 0;
+  if (ok && (r[31] & 0x80))
+    {
+      /* X is zero for Y = 1 and Y = P - 1; its sign bit must be 0.  */
+      gcry_mpi_add_ui (y, y, 1);
+      ok = gcry_mpi_cmp_ui (y, 2) && gcry_mpi_cmp (y, batch->p);
+    }
+  gcry_mpi_release (y);
+  return ok;
+}
+
+
+static void
+release_prepared (struct batch_s *batch)
+{
+  unsigned int i;
+
+  for (i = 0; i < batch->nsigs; i++)
+    {
+      gcry_mpi_point_release (batch->sigs[i].r);
+      gcry_mpi_release (batch->sigs[i].s);
+      gcry_mpi_release (batch->sigs[i].h);
+      gcry_mpi_release (batch->sigs[i].z);
+    }
+  batch->nsigs = 0;
+  for (i = 0; i < batch->nkeys; i++)
+    {
+      gcry_mpi_point_release (batch->keys[i].point);
+      gcry_mpi_release (batch->keys[i].coeff);
+    }
+  batch->nkeys = 0;
+}
+
+
+/* Return the index of the key encoded at A in BATCH; it is added if
+ * needed.  Returns -1 if A is not a valid point.  */
+static int
+find_key (struct batch_s *batch, const byte *a)
+{
+  struct batchkey_s *key;
+  gcry_mpi_t v;
+  unsigned int i;
+
+  for (i = 0; i < batch->nkeys; i++)
+    if (!memcmp (batch->keys[i].a, a, 32))
+      return i;
+
+  key = batch->keys + batch->nkeys;
+  memcpy (key->a, a, 32);
+  key->point = gcry_mpi_point_new (0);
+  v = gcry_mpi_set_opaque_copy (NULL, a, 256);
+  if (!v || gcry_mpi_ec_decode_point (key->point, v, batch->ctx))
+    {
+      gcry_mpi_release (v);
+      gcry_mpi_point_release (key->point);
+      return -1;
+    }
+  gcry_mpi_release (v);
+  key->coeff = gcry_mpi_new (0);
+  return batch->nkeys++;
+}
+
+
+/* Add ITEMS[IDX] to BATCH.  Returns false if the signature can't be
+ * verified in a batch.  */
+static int
+prepare_item (struct batch_s *batch, struct sigbatch_item_s *items,
+              unsigned int idx)
+{
+  struct sigbatch_item_s *item = items + idx;
+  struct prepared_s *sig = batch->sigs + batch->nsigs;
+  byte q[33], r[32], s[32], digest[64], z[16];
+  const byte *m;
+  size_t mlen;
+  gcry_buffer_t iov[3];
+  gcry_mpi_t v;
+  int key;
+
+  if (!sigbatch_supported (item->pubkey_algo, item->pkey)
+      || !get_fixed (item->pkey[1], q, sizeof q) || q[0] != 0x40
+      || !get_fixed (item->data[0], r, sizeof r)
+      || !get_fixed (item->data[1], s, sizeof s)
+      || !(m = get_message (item->hash, &mlen))
+      || !is_canonical (batch, r))
+    return 0;
+
+  memset (sig, 0, sizeof *sig);
+  sig->idx = idx;
+  sig->s = mpi_from_le (s, 32);
+  if (!sig->s || gcry_mpi_cmp (sig->s, batch->l) >= 0)
+    goto fail;
+
+  key = find_key (batch, q + 1);
+  if (key < 0)
+    goto fail;
+  sig->key = key;
+
+  sig->r = gcry_mpi_point_new (0);
+  v = gcry_mpi_set_opaque_copy (NULL, r, 256);
+  if (!v || gcry_mpi_ec_decode_point (sig->r, v, batch->ctx))
+    {
+      gcry_mpi_release (v);
+      goto fail;
+    }
+  gcry_mpi_release (v);
+
+  memset (iov, 0, sizeof iov);
+  iov[0].data = r;
+  iov[0].len = 32;
+  iov[1].data = q + 1;
+  iov[1].len = 32;
+  iov[2].data = (void *)m;
+  iov[2].len = mlen;
+  if (gcry_md_hash_buffers (GCRY_MD_SHA512, 0, digest, iov, 3))
+    goto fail;
+  sig->h = mpi_from_le (digest, 64);
+  if (!sig->h)
+    goto fail;
+  gcry_mpi_mod (sig->h, sig->h, batch->l);
+
+  gcry_create_nonce (z, sizeof z);
+  z[0] |= 0x80;
+  if (gcry_mpi_scan (&sig->z, GCRYMPI_FMT_USG, z, sizeof z, NULL))
+    goto fail;
+
+  batch->nsigs++;
+  return 1;
+
+ fail:
+  gcry_mpi_point_release (sig->r);
+  gcry_mpi_release (sig->s);
+  gcry_mpi_release (sig->h);
+  gcry_mpi_release (sig->z);
+  return 0;
+}
+
+
+/* Check the batch equation for the prepared signatures FIRST to
+ * FIRST+COUNT-1.  Returns true if it holds.  */
+static int
+check_range (struct batch_s *batch, unsigned int first, unsigned int count)
+{
+  gcry_mpi_point_t points[2 * MAX_BATCH + 1];
+  gcry_mpi_t coeffs[2 * MAX_BATCH + 1];
+  gcry_mpi_t sum, tmp, x, y;
+  gcry_mpi_point_t acc;
+  struct prepared_s *sig;
+  unsigned int npoints = 0;
+  unsigned int maxbits = 0;
+  unsigned int i, n;
+  int bit;
+  int ok;
+
+  sum = gcry_mpi_new (0);
+  tmp = gcry_mpi_new (0);
+  for (i = 0; i < batch->nkeys; i++)
+    gcry_mpi_set_ui (batch->keys[i].coeff, 0);
+
+  for (i = first; i < first + count; i++)
+    {
+      sig = batch->sigs + i;
+      gcry_mpi_mulm (tmp, sig->z, sig->s, batch->l);
+      gcry_mpi_addm (sum, sum, tmp, batch->l);
+      gcry_mpi_mulm (tmp, sig->z, sig->h, batch->l);
+      gcry_mpi_addm (batch->keys[sig->key].coeff,
+                     batch->keys[sig->key].coeff, tmp, batch->l);
+      points[npoints] = sig->r;
+      coeffs[npoints++] = sig->z;
+    }
+  for (i = 0; i < batch->nkeys; i++)
+    if (gcry_mpi_cmp_ui (batch->keys[i].coeff, 0))
+      {
+        points[npoints] = batch->keys[i].point;
+        coeffs[npoints++] = batch->keys[i].coeff;
+      }
+  /* The base point gets the factor -sum so that the total is zero.  */
+  gcry_mpi_sub (sum, batch->l, sum);
+  points[npoints] = batch->b;
+  coeffs[npoints++] = sum;
+
+  for (i = 0; i < npoints; i++)
+    if ((n = gcry_mpi_get_nbits (coeffs[i])) > maxbits)
+      maxbits = n;
+
+  /* The neutral element is (0,1).  */
+  x = gcry_mpi_set_ui (NULL, 0);
+  y = gcry_mpi_set_ui (NULL, 1);
+  acc = gcry_mpi_point_set (NULL, x, y, y);
+  for (bit = maxbits - 1; bit >= 0; bit--)
+    {
+      gcry_mpi_ec_dup (acc, acc, batch->ctx);
+      for (i = 0; i < npoints; i++)
+        if (gcry_mpi_test_bit (coeffs[i], bit))
+          gcry_mpi_ec_add (acc, acc, points[i], batch->ctx);
+    }
+  /* Multiply by the cofactor.  */
+  for (i = 0; i < 3; i++)
+    gcry_mpi_ec_dup (acc, acc, batch->ctx);
+
+  ok = (!gcry_mpi_ec_get_affine (x, y, acc, batch->ctx)
+        && !gcry_mpi_cmp_ui (x, 0) && !gcry_mpi_cmp_ui (y, 1));
+
+  gcry_mpi_point_release (acc);
+  gcry_mpi_release (x);
+  gcry_mpi_release (y);
+  gcry_mpi_release (sum);
+  gcry_mpi_release (tmp);
+  return ok;
+}
+
+
+/* Verify the prepared signatures FIRST to FIRST+COUNT-1 and mark the
+ * valid ones in ITEMS.  */
+static unsigned int
+verify_range (struct batch_s *batch, struct sigbatch_item_s *items,
+              unsigned int first, unsigned int count)
+{
+  unsigned int i, half;
+
+  if (count < SIGBATCH_MIN_ITEMS)
+    return 0;  /* Leave them to the regular check.  */
+
+  stats.batches++;
+  if (check_range (batch, first, count))
+    {
+      for (i = first; i < first + count; i++)
+        items[batch->sigs[i].idx].verified = 1;
+      return count;
+    }
+  stats.failed++;
+
+  half = count / 2;
+  return (verify_range (batch, items, first, half)
+          + verify_range (batch, items, first + half, count - half));
+}
+
+
+/* Verify the NITEMS signatures at ITEMS in batches and set the
+ * VERIFIED flag of those which are valid.  Signatures which are not
+ * supported, invalid or could not be isolated from invalid ones are
+ * not marked and need to be checked by pk_verify.  Returns the number
+ * of verified signatures.  */
+unsigned int
+sigbatch_verify (struct sigbatch_item_s *items, unsigned int nitems)
+{
+  struct batch_s *batch;
+  unsigned int i, count;
+  unsigned int nverified = 0;
+
+  for (i = count = 0; i < nitems; i++)
+    if (sigbatch_supported (items[i].pubkey_algo, items[i].pkey))
+      count++;
+  if (count < SIGBATCH_MIN_ITEMS)
+    return 0;
+
+  batch = xtrycalloc (1, sizeof *batch);
+  if (!batch)
+    return 0;
+  if (gcry_mpi_ec_new (&batch->ctx, NULL, "Ed25519"))
+    {
+      xfree (batch);
+      return 0;
+    }
+  batch->p = gcry_mpi_ec_get_mpi ("p", batch->ctx, 1);
+  batch->l = gcry_mpi_ec_get_mpi ("n", batch->ctx, 1);
+  batch->b = gcry_mpi_ec_get_point ("g", batch->ctx, 1);
+
+  for (i = 0; i < nitems; i++)
+    {
+      if (items[i].verified || !prepare_item (batch, items, i))
+        continue;
+      if (batch->nsigs == MAX_BATCH)
+        {
+          nverified += verify_range (batch, items, 0, batch->nsigs);
+          release_prepared (batch);
+        }
+    }
+  nverified += verify_range (batch, items, 0, batch->nsigs);
+  release_prepared (batch);
+
+  gcry_mpi_release (batch->p);
+  gcry_mpi_release (batch->l);
+  gcry_mpi_point_release (batch->b);
+  gcry_ctx_release (batch->ctx);
+  xfree (batch);
+  stats.verified += nverified;
+  return nverified;
+}
+
+
+/* Write the MPI A prefixed with its length to MD.  Returns false on
+ * error.  */
+static int
+memo_write_mpi (gcry_md_hd_t md, gcry_mpi_t a)
+{
+  const byte *p;
+  byte *buf = NULL;
+  unsigned int nbits;
+  size_t n;
+  byte len[4];
+
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      p = gcry_mpi_get_opaque (a, &nbits);
+      n = (nbits + 7) / 8;
+    }
+  else if (gcry_mpi_aprint (GCRYMPI_FMT_USG, &buf, &n, a))
+    return 0;
+  else
+    p = buf;
+  len[0] = n >> 24;
+  len[1] = n >> 16;
+  len[2] = n >> 8;
+  len[3] = n;
+  gcry_md_write (md, len, 4);
+  if (p)
+    gcry_md_write (md, p, n);
+  gcry_free (buf);
+  return 1;
+}
+
+
+/* Compute the memo digest for a verification by an algorithm not
+ * supported by the batches.  The arrays PKEY and DATA end at the
+ * first NULL.  */
+static int
+memo_digest_generic (int pubkey_algo, gcry_mpi_t *pkey, gcry_mpi_t hash,
+                     gcry_mpi_t *data, byte *digest)
+{
+  gcry_md_hd_t md;
+  byte algo = pubkey_algo;
+  int i, ok = 1;
+
+  if (!pkey[0] || !hash || !data[0]
+      || gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return 0;
+  gcry_md_write (md, &algo, 1);
+  for (i = 0; ok && i < OPENPGP_MAX_NPKEY && pkey[i]; i++)
+    ok = memo_write_mpi (md, pkey[i]);
+  gcry_md_write (md, "", 1);
+  if (ok)
+    ok = memo_write_mpi (md, hash);
+  for (i = 0; ok && i < OPENPGP_MAX_NSIG && data[i]; i++)
+    ok = memo_write_mpi (md, data[i]);
+  if (ok)
+    memcpy (digest, gcry_md_read (md, 0), 32);
+  gcry_md_close (md);
+  return ok;
+}
+
+
+/* Compute the memo digest for a verification.  */
+static int
+memo_digest (int pubkey_algo, gcry_mpi_t *pkey, gcry_mpi_t hash,
+             gcry_mpi_t *data, byte *digest)
+{
+  byte q[33], r[32], s[32], mlen[4];
+  const byte *m;
+  size_t len;
+  gcry_buffer_t iov[5];
+
+  if (!sigbatch_supported (pubkey_algo, pkey))
+    return memo_digest_generic (pubkey_algo, pkey, hash, data, digest);
+  if (!get_fixed (pkey[1], q, sizeof q)
+      || !get_fixed (data[0], r, sizeof r)
+      || !get_fixed (data[1], s, sizeof s)
+      || !(m = get_message (hash, &len)))
+    return 0;
+  mlen[0] = len >> 24;
+  mlen[1] = len >> 16;
+  mlen[2] = len >> 8;
+  mlen[3] = len;
+
+  memset (iov, 0, sizeof iov);
+  iov[0].data = q;
+  iov[0].len = sizeof q;
+  iov[1].data = r;
+  iov[1].len = sizeof r;
+  iov[2].data = s;
+  iov[2].len = sizeof s;
+  iov[3].data = mlen;
+  iov[3].len = sizeof mlen;
+  iov[4].data = (void *)m;
+  iov[4].len = len;
+  return !gcry_md_hash_buffers (GCRY_MD_SHA256, 0, digest, iov, 5);
+}
+
+
+/* Remember that the signature ITEM has been verified.  */
+void
+sigbatch_remember (const struct sigbatch_item_s *item)
+{
+  if (!item->verified
+      || !memo_digest (item->pubkey_algo, item->pkey, item->hash,
+                       item->data, memo[memo_next]))
+    return;
+  memo_next = (memo_next + 1) % MEMO_SIZE;
+  if (memo_used < MEMO_SIZE)
+    memo_used++;
+}
+
+
+/* Return true if the signature given by the arguments of pk_verify
+ * has been verified and remembered.  */
+int
+sigbatch_lookup (int pubkey_algo, gcry_mpi_t *pkey, gcry_mpi_t hash,
+                 gcry_mpi_t *data)
+{
+  byte digest[32];
+  unsigned int i;
+
+  if (!memo_used || !memo_digest (pubkey_algo, pkey, hash, data, digest))
+    return 0;
+  for (i = 0; i < memo_used; i++)
+    if (!memcmp (memo[i], digest, 32))
+      {
+        stats.memo_hits++;
+        return 1;
+      }
+  return 0;
+}
+
+
+void
+sigbatch_dump_stats (void)
+{
+  if (stats.batches)
+    log_info ("sigbatch: %lu batches, %lu failed, %lu sigs verified,"
+              " %lu memo hits\n",
+              stats.batches, stats.failed, stats.verified, stats.memo_hits);
+}
@@ -0,0 +1,47 @@
+/* sigbatch.h - Batch verification of Ed25519 signatures
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef G10_SIGBATCH_H
+#define G10_SIGBATCH_H
+
+/* Do not try a batch with fewer signatures than this.  */
+#define SIGBATCH_MIN_ITEMS 4
+
+
+/* A signature to be verified in a batch.  The first four fields are
+ * the arguments of pk_verify.  */
+struct sigbatch_item_s
+{
+  int pubkey_algo;
+  gcry_mpi_t *pkey;
+  gcry_mpi_t hash;
+  gcry_mpi_t *data;
+  int verified;     /* Set if the signature has been verified.  */
+};
+
+
+/*-- sigbatch.c --*/
+int sigbatch_supported (int pubkey_algo, gcry_mpi_t *pkey);
+unsigned int sigbatch_verify (struct sigbatch_item_s *items,
+                              unsigned int nitems);
+void sigbatch_remember (const struct sigbatch_item_s *item);
+int sigbatch_lookup (int pubkey_algo, gcry_mpi_t *pkey, gcry_mpi_t hash,
+                     gcry_mpi_t *data);
+void sigbatch_dump_stats (void);
+
+#endif /*G10_SIGBATCH_H*/
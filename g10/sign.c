@@ -42,6 +42,7 @@
 #include "call-agent.h"
 #include "../common/mbox-util.h"
 #include "../common/compliance.h"
+#include "md-pool.h"
 
 #ifdef HAVE_DOSISH_SYSTEM
 #define LF "\r\n"
@@ -399,18 +400,12 @@ hash_sigversion_to_magic (gcry_md_hd_t md, const PKT_signature *sig,
 }
 
 
-/* Perform the sign operation.  If CACHE_NONCE is given the agent is
- * advised to use that cached passphrase for the key.  SIGNHINTS has
- * hints so that we can do some additional checks. */
-static int
-do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
-	 gcry_md_hd_t md, int mdalgo,
-         const char *cache_nonce, unsigned int signhints)
+/* Check that the key PKSK is not newer than the signature SIG.
+ * SIGNHINTS are the hints as used by do_sign.  */
+static gpg_error_t
+check_sig_timestamp (PKT_public_key *pksk, PKT_signature *sig,
+                     unsigned int signhints)
 {
-  gpg_error_t err;
-  byte *dp;
-  char *hexgrip;
-
   /* An ADSK key commonly has a creation date older than the primary
    * key.  For example because the ADSK is used as an archive key for
    * a group of users.  */
@@ -425,6 +420,19 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
       if (!opt.ignore_time_conflict)
         return gpg_error (GPG_ERR_TIME_CONFLICT);
     }
+  return 0;
+}
+
+
+/* Check that the key PKSK and the digest algorithm MDALGO may be
+ * used to create the signature SIG and prepare SIG for the digest
+ * in MD.  If MDALGO is 0 the algorithm of MD is used.  SIGNHINTS are
+ * the hints as used by do_sign.  */
+static gpg_error_t
+prepare_sign (PKT_public_key *pksk, PKT_signature *sig,
+              gcry_md_hd_t md, int mdalgo, unsigned int signhints)
+{
+  byte *dp;
 
   print_pubkey_algo_note (pksk->pubkey_algo);
 
@@ -440,8 +448,7 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
        * that this will render dsa1024 keys unsuitable for such
        * keysigs and in turn the WoT. */
       print_sha1_keysig_rejected_note ();
-      err = gpg_error (GPG_ERR_DIGEST_ALGO);
-      goto leave;
+      return gpg_error (GPG_ERR_DIGEST_ALGO);
     }
 
   /* Check compliance but always allow for key revocations. */
@@ -451,8 +458,7 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
       log_error (_("digest algorithm '%s' may not be used in %s mode\n"),
 		 gcry_md_algo_name (mdalgo),
 		 gnupg_compliance_option_string (opt.compliance));
-      err = gpg_error (GPG_ERR_DIGEST_ALGO);
-      goto leave;
+      return gpg_error (GPG_ERR_DIGEST_ALGO);
     }
 
   if (!IS_KEY_REV (sig)
@@ -463,18 +469,18 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
       log_error (_("key %s may not be used for signing in %s mode\n"),
                  keystr_from_pk (pksk),
                  gnupg_compliance_option_string (opt.compliance));
-      err = gpg_error (GPG_ERR_PUBKEY_ALGO);
-      goto leave;
+      return gpg_error (GPG_ERR_PUBKEY_ALGO);
     }
 
   if (!gnupg_rng_is_compliant (opt.compliance))
     {
-      err = gpg_error (GPG_ERR_FORBIDDEN);
+      gpg_error_t err = gpg_error (GPG_ERR_FORBIDDEN);
+
       log_error (_("%s is not compliant with %s mode\n"),
                  "RNG",
                  gnupg_compliance_option_string (opt.compliance));
       write_status_error ("random-compliance", err);
-      goto leave;
+      return err;
     }
 
   print_digest_algo_note (mdalgo);
@@ -487,6 +493,258 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
   mpi_release (sig->data[1]);
   sig->data[1] = NULL;
 
+  return 0;
+}
+
+
+/* Store the signature values from the S-expression S_SIGVAL as
+ * returned by the agent for the key PKSK in SIG.  */
+static gpg_error_t
+store_sigval (PKT_public_key *pksk, PKT_signature *sig, gcry_sexp_t s_sigval)
+{
+  gpg_error_t err = 0;
+
+  if (pksk->pubkey_algo == GCRY_PK_RSA
+      || pksk->pubkey_algo == GCRY_PK_RSA_S)
+    sig->data[0] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
+  else if (pksk->pubkey_algo == PUBKEY_ALGO_EDDSA
+           && openpgp_oid_is_ed25519 (pksk->pkey[0]))
+    {
+      err = sexp_extract_param_sos_nlz (s_sigval, "r", &sig->data[0]);
+      if (!err)
+        err = sexp_extract_param_sos_nlz (s_sigval, "s", &sig->data[1]);
+    }
+  else if (pksk->pubkey_algo == PUBKEY_ALGO_ECDSA
+           || pksk->pubkey_algo == PUBKEY_ALGO_EDDSA)
+    {
+      err = sexp_extract_param_sos (s_sigval, "r", &sig->data[0]);
+      if (!err)
+        err = sexp_extract_param_sos (s_sigval, "s", &sig->data[1]);
+    }
+  else
+    {
+      sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_USG);
+      sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
+    }
+
+  return err;
+}
+
+
+/* Print the info about the created signature SIG in verbose mode.  */
+static void
+print_sig_created_info (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig)
+{
+  if (opt.verbose)
+    {
+      char *ustr = get_user_id_string_native (ctrl, sig->keyid);
+      log_info (_("%s/%s signature from: \"%s\"\n"),
+                openpgp_pk_algo_name (pksk->pubkey_algo),
+                openpgp_md_algo_name (sig->digest_algo),
+                ustr);
+      xfree (ustr);
+    }
+}
+
+
+/* A key signature whose creation has been deferred to
+ * keysig_batch_end.  */
+struct keysig_batch_item_s
+{
+  PKT_signature *sig;   /* The signature; owned by the caller.  */
+  PKT_public_key *pksk; /* A copy of the signing key.  */
+  char *hexgrip;        /* The keygrip of PKSK.  */
+  byte *digest;         /* The digest to sign.  */
+  int done;             /* Set when sent to the agent.  */
+};
+
+/* The key signatures collected between keysig_batch_begin and
+ * keysig_batch_end.  */
+static struct
+{
+  int active;
+  struct keysig_batch_item_s *items;
+  unsigned int nitems;
+  unsigned int size;
+} keysig_batch;
+
+
+/* Start collecting the third-party key signatures created by
+ * make_keysig_packet.  Their signature values are not requested from
+ * the agent but only with the next keysig_batch_end.  Until then the
+ * signatures must not be used for anything but storing them in a
+ * keyblock.  This allows signing many keys with one request to the
+ * agent per signing key.  */
+void
+keysig_batch_begin (void)
+{
+  log_assert (!keysig_batch.active);
+  keysig_batch.active = 1;
+}
+
+
+/* Queue the signature SIG with the digest in MD for the key PKSK;
+ * the caller already called prepare_sign.  */
+static gpg_error_t
+keysig_batch_add (PKT_public_key *pksk, PKT_signature *sig, gcry_md_hd_t md)
+{
+  gpg_error_t err;
+  struct keysig_batch_item_s *item;
+  size_t dlen = gcry_md_get_algo_dlen (sig->digest_algo);
+
+  if (keysig_batch.nitems == keysig_batch.size)
+    {
+      unsigned int n = keysig_batch.size? 2 * keysig_batch.size : 64;
+
+      item = xtryreallocarray (keysig_batch.items, keysig_batch.size, n,
+                               sizeof *item);
+      if (!item)
+        return gpg_error_from_syserror ();
+      keysig_batch.items = item;
+      keysig_batch.size = n;
+    }
+
+  item = keysig_batch.items + keysig_batch.nitems;
+  memset (item, 0, sizeof *item);
+  err = hexkeygrip_from_pk (pksk, &item->hexgrip);
+  if (err)
+    return err;
+  item->digest = xtrymalloc (dlen);
+  if (!item->digest)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (item->hexgrip);
+      return err;
+    }
+  memcpy (item->digest, gcry_md_read (md, sig->digest_algo), dlen);
+  item->pksk = copy_public_key (NULL, pksk);
+  item->sig = sig;
+  keysig_batch.nitems++;
+  return 0;
+}
+
+
+/* Create the signature values for all key signatures collected
+ * since keysig_batch_begin.  The signatures for the same key and
+ * digest algorithm are created with one request to the agent.  On
+ * error some of the signatures stay without a value and all of them
+ * must be discarded.  */
+gpg_error_t
+keysig_batch_end (ctrl_t ctrl)
+{
+  gpg_error_t err = 0;
+  struct keysig_batch_item_s *items = keysig_batch.items;
+  unsigned int nitems = keysig_batch.nitems;
+  unsigned int *map = NULL;
+  gcry_sexp_t *sigvals = NULL;
+  byte *digests = NULL;
+  unsigned int i, j, n;
+
+  log_assert (keysig_batch.active);
+  keysig_batch.active = 0;
+
+  if (nitems)
+    {
+      map = xtrycalloc (nitems, sizeof *map);
+      sigvals = xtrycalloc (nitems, sizeof *sigvals);
+      if (!map || !sigvals)
+        err = gpg_error_from_syserror ();
+    }
+
+  for (i=0; !err && i < nitems; i++)
+    {
+      PKT_public_key *pksk = items[i].pksk;
+      int mdalgo = items[i].sig->digest_algo;
+      size_t dlen = gcry_md_get_algo_dlen (mdalgo);
+      char *desc;
+
+      if (items[i].done)
+        continue;
+
+      /* Collect all items for the same key and algorithm.  */
+      for (j = i, n = 0; j < nitems; j++)
+        if (!items[j].done && items[j].sig->digest_algo == mdalgo
+            && !strcmp (items[j].hexgrip, items[i].hexgrip))
+          {
+            items[j].done = 1;
+            map[n++] = j;
+          }
+
+      xfree (digests);
+      digests = xtrymalloc (n * dlen);
+      if (!digests)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      for (j=0; j < n; j++)
+        memcpy (digests + j * dlen, items[map[j]].digest, dlen);
+
+      desc = gpg_format_keydesc (ctrl, pksk, FORMAT_KEYDESC_NORMAL, 1);
+      err = agent_pksign_multi (NULL/*ctrl*/, NULL, items[i].hexgrip, desc,
+                                pksk->keyid, pksk->main_keyid,
+                                pksk->pubkey_algo, digests, dlen, n,
+                                mdalgo, sigvals);
+      xfree (desc);
+
+      for (j=0; j < n; j++)
+        {
+          if (!err)
+            {
+              err = store_sigval (pksk, items[map[j]].sig, sigvals[j]);
+              if (!err)
+                print_sig_created_info (ctrl, pksk, items[map[j]].sig);
+            }
+          gcry_sexp_release (sigvals[j]);
+          sigvals[j] = NULL;
+        }
+    }
+  if (err)
+    log_error (_("signing failed: %s\n"), gpg_strerror (err));
+
+  for (i=0; i < nitems; i++)
+    {
+      free_public_key (items[i].pksk);
+      xfree (items[i].hexgrip);
+      xfree (items[i].digest);
+    }
+  xfree (items);
+  keysig_batch.items = NULL;
+  keysig_batch.nitems = keysig_batch.size = 0;
+  xfree (digests);
+  xfree (sigvals);
+  xfree (map);
+  return err;
+}
+
+
+/* Perform the sign operation.  If CACHE_NONCE is given the agent is
+ * advised to use that cached passphrase for the key.  SIGNHINTS has
+ * hints so that we can do some additional checks. */
+static int
+do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
+	 gcry_md_hd_t md, int mdalgo,
+         const char *cache_nonce, unsigned int signhints)
+{
+  gpg_error_t err;
+  char *hexgrip;
+
+  err = check_sig_timestamp (pksk, sig, signhints);
+  if (err)
+    return err;
+
+  err = prepare_sign (pksk, sig, md, mdalgo, signhints);
+  if (err)
+    goto leave;
+
+  if (keysig_batch.active
+      && (signhints & SIGNHINT_KEYSIG) && !(signhints & SIGNHINT_SELFSIG))
+    {
+      err = keysig_batch_add (pksk, sig, md);
+      if (err)
+        log_error (_("signing failed: %s\n"), gpg_strerror (err));
+      return err;
+    }
 
   err = hexkeygrip_from_pk (pksk, &hexgrip);
   if (!err)
@@ -498,34 +756,14 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
       /* FIXME: Eventually support dual keys.  */
       err = agent_pksign (NULL/*ctrl*/, cache_nonce, hexgrip, desc,
                           pksk->keyid, pksk->main_keyid, pksk->pubkey_algo,
-                          dp, gcry_md_get_algo_dlen (mdalgo), mdalgo,
+                          gcry_md_read (md, sig->digest_algo),
+                          gcry_md_get_algo_dlen (sig->digest_algo),
+                          sig->digest_algo,
                           &s_sigval);
       xfree (desc);
 
-      if (err)
-        ;
-      else if (pksk->pubkey_algo == GCRY_PK_RSA
-               || pksk->pubkey_algo == GCRY_PK_RSA_S)
-        sig->data[0] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
-      else if (pksk->pubkey_algo == PUBKEY_ALGO_EDDSA
-               && openpgp_oid_is_ed25519 (pksk->pkey[0]))
-        {
-          err = sexp_extract_param_sos_nlz (s_sigval, "r", &sig->data[0]);
-          if (!err)
-            err = sexp_extract_param_sos_nlz (s_sigval, "s", &sig->data[1]);
-        }
-      else if (pksk->pubkey_algo == PUBKEY_ALGO_ECDSA
-               || pksk->pubkey_algo == PUBKEY_ALGO_EDDSA)
-        {
-          err = sexp_extract_param_sos (s_sigval, "r", &sig->data[0]);
-          if (!err)
-            err = sexp_extract_param_sos (s_sigval, "s", &sig->data[1]);
-        }
-      else
-        {
-          sig->data[0] = get_mpi_from_sexp (s_sigval, "r", GCRYMPI_FMT_USG);
-          sig->data[1] = get_mpi_from_sexp (s_sigval, "s", GCRYMPI_FMT_USG);
-        }
+      if (!err)
+        err = store_sigval (pksk, sig, s_sigval);
 
       gcry_sexp_release (s_sigval);
     }
@@ -535,17 +773,7 @@ do_sign (ctrl_t ctrl, PKT_public_key *pksk, PKT_signature *sig,
   if (err)
     log_error (_("signing failed: %s\n"), gpg_strerror (err));
   else
-    {
-      if (opt.verbose)
-        {
-          char *ustr = get_user_id_string_native (ctrl, sig->keyid);
-          log_info (_("%s/%s signature from: \"%s\"\n"),
-                    openpgp_pk_algo_name (pksk->pubkey_algo),
-                    openpgp_md_algo_name (sig->digest_algo),
-                    ustr);
-          xfree (ustr);
-	}
-    }
+    print_sig_created_info (ctrl, pksk, sig);
   return err;
 }
 
@@ -917,15 +1145,117 @@ write_plaintext_packet (iobuf_t out, iobuf_t inp,
 }
 
 
+/* Create a new signature packet with the key PK for the data hashed
+ * in HASH and store it at R_SIG.  A copy of HASH finalized with the
+ * signature fields is stored at R_MD; the caller needs to close it.
+ * SIGCLASS, TIMESTAMP and DURATION are the values for the signature
+ * and EXTRAHASH is the extra data hashed for v5 signatures.  */
+static gpg_error_t
+make_data_sig (ctrl_t ctrl, PKT_public_key *pk, gcry_md_hd_t hash,
+               pt_extra_hash_data_t extrahash,
+               int sigclass, u32 timestamp, u32 duration,
+               PKT_signature **r_sig, gcry_md_hd_t *r_md)
+{
+  PKT_signature *sig;
+  gcry_md_hd_t md;
+  gpg_error_t err;
+
+  *r_sig = NULL;
+  *r_md = NULL;
+
+  /* Build the signature packet.  */
+  sig = xtrycalloc (1, sizeof *sig);
+  if (!sig)
+    return gpg_error_from_syserror ();
+
+  if (pk->version >= 5)
+    sig->version = 5;  /* Required for v5 keys.  */
+  else
+    sig->version = 4;  /* Required.  */
+
+  keyid_from_pk (pk, sig->keyid);
+  sig->digest_algo = hash_for (pk);
+  sig->pubkey_algo = pk->pubkey_algo;
+  if (timestamp)
+    sig->timestamp = timestamp;
+  else
+    sig->timestamp = make_timestamp();
+  if (duration)
+    sig->expiredate = sig->timestamp + duration;
+  sig->sig_class = sigclass;
+
+  if (gcry_md_copy (&md, hash))
+    BUG ();
+
+  build_sig_subpkt_from_sig (sig, pk, 0);
+  mk_notation_policy_etc (ctrl, sig, NULL, pk);
+  if (opt.flags.include_key_block && IS_SIG (sig))
+    err = mk_sig_subpkt_key_block (ctrl, sig, pk);
+  else
+    err = 0;
+  hash_sigversion_to_magic (md, sig, extrahash);
+  gcry_md_final (md);
+
+  if (err)
+    {
+      gcry_md_close (md);
+      free_seckey_enc (sig);
+      return err;
+    }
+
+  *r_sig = sig;
+  *r_md = md;
+  return 0;
+}
+
+
+/* Return a pool to compute the digests for the signers in SK_LIST on
+ * worker threads or NULL if that is not requested or there is only
+ * one digest algorithm.  */
+static md_pool_t
+new_md_pool (SK_LIST sk_list)
+{
+  int algos[MD_POOL_MAX_THREADS];
+  int nalgos = 0;
+  int algo, i;
+  SK_LIST sk_rover;
+  md_pool_t pool;
+
+  if (opt.hash_threads < 2)
+    return NULL;
+
+  for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    {
+      algo = hash_for (sk_rover->pk);
+      for (i = 0; i < nalgos; i++)
+        if (algos[i] == algo)
+          break;
+      if (i < nalgos)
+        continue;
+      if (nalgos == DIM (algos))
+        return NULL;  /* Too many - hash them the usual way.  */
+      algos[nalgos++] = algo;
+    }
+  if (nalgos < 2)
+    return NULL;
+
+  if (md_pool_new (&pool, algos, nalgos, opt.hash_threads))
+    return NULL;
+  return pool;
+}
+
+
 /*
  * Write the signatures from the SK_LIST to OUT. HASH must be a
- * non-finalized hash which will not be changes here.  EXTRAHASH is
- * either NULL or the extra data tro be hashed into v5 signatures.
+ * non-finalized hash which will not be changes here.  If MDPOOL is
+ * not NULL the digests have instead been computed by that pool.
+ * EXTRAHASH is either NULL or the extra data tro be hashed into v5
+ * signatures.
  */
 static int
 write_signature_packets (ctrl_t ctrl,
                          SK_LIST sk_list, IOBUF out, gcry_md_hd_t hash,
-                         pt_extra_hash_data_t extrahash,
+                         md_pool_t mdpool, pt_extra_hash_data_t extrahash,
                          int sigclass, u32 timestamp, u32 duration,
 			 int status_letter, const char *cache_nonce)
 {
@@ -941,41 +1271,14 @@ write_signature_packets (ctrl_t ctrl,
 
       pk = sk_rover->pk;
 
-      /* Build the signature packet.  */
-      sig = xtrycalloc (1, sizeof *sig);
-      if (!sig)
-        return gpg_error_from_syserror ();
-
-      if (pk->version >= 5)
-        sig->version = 5;  /* Required for v5 keys.  */
-      else
-        sig->version = 4;  /* Required.  */
-
-      keyid_from_pk (pk, sig->keyid);
-      sig->digest_algo = hash_for (pk);
-      sig->pubkey_algo = pk->pubkey_algo;
-      if (timestamp)
-        sig->timestamp = timestamp;
-      else
-        sig->timestamp = make_timestamp();
-      if (duration)
-        sig->expiredate = sig->timestamp + duration;
-      sig->sig_class = sigclass;
-
-      if (gcry_md_copy (&md, hash))
-        BUG ();
-
-      build_sig_subpkt_from_sig (sig, pk, 0);
-      mk_notation_policy_etc (ctrl, sig, NULL, pk);
-      if (opt.flags.include_key_block && IS_SIG (sig))
-        err = mk_sig_subpkt_key_block (ctrl, sig, pk);
-      else
-        err = 0;
-      hash_sigversion_to_magic (md, sig, extrahash);
-      gcry_md_final (md);
+      err = make_data_sig (ctrl, pk,
+                           mdpool? md_pool_get_md (mdpool, hash_for (pk)) : hash,
+                           extrahash, sigclass,
+                           timestamp, duration, &sig, &md);
+      if (err)
+        return err;
 
-      if (!err)
-        err = do_sign (ctrl, pk, sig, md, hash_for (pk), cache_nonce, 0);
+      err = do_sign (ctrl, pk, sig, md, hash_for (pk), cache_nonce, 0);
       gcry_md_close (md);
       if (!err)
         {
@@ -1234,6 +1537,9 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
   for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
     gcry_md_enable (md, hash_for (sk_rover->pk));
 
+  if (!(encryptflag && (opt.compat_flags & COMPAT_PARALLELIZED)))
+    mfx.pool = new_md_pool (sk_list);
+
   if (!multifile)
     {
       if (encryptflag && (opt.compat_flags & COMPAT_PARALLELIZED))
@@ -1258,6 +1564,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
     {
       efx.pk_list = pk_list;
       /* fixme: set efx.cfx.datalen if known */
+      efx.cfx.interactive = aead_interactive_input (inp);
       iobuf_push_filter (out, encrypt_filter, &efx);
     }
 
@@ -1387,7 +1694,9 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
     goto leave;
 
   /* Write the signatures. */
-  rc = write_signature_packets (ctrl, sk_list, out, md, extrahash,
+  if (mfx.pool)
+    md_pool_finish (mfx.pool);
+  rc = write_signature_packets (ctrl, sk_list, out, md, mfx.pool, extrahash,
                                 opt.textmode && !outfile? 0x01 : 0x00,
                                 0, duration, detached ? 'D':'S', NULL);
   if (rc)
@@ -1404,6 +1713,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
         write_status (STATUS_END_ENCRYPTION);
     }
   iobuf_close (inp);
+  md_pool_release (mfx.pool);
   gcry_md_close (md);
   release_sk_list (sk_list);
   release_pk_list (pk_list);
@@ -1414,6 +1724,342 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
   return rc;
 }
 
+/* The maximum number of files signed with one request to the agent
+ * by sign_files.  */
+#define SIGN_FILES_BATCH 64
+
+/* Information about one file to be signed by sign_files.  */
+struct sign_files_item_s
+{
+  char *fname;
+  gpg_error_t err;
+  PKT_signature **sigs;   /* One for each secret key.  */
+  byte **digests;         /* Ditto.  */
+};
+
+
+/* Hash the file ITEM->FNAME and prepare a detached signature for
+ * each of the NSK keys in SK_LIST.  */
+static gpg_error_t
+hash_file_for_signing (ctrl_t ctrl, SK_LIST sk_list,
+                       struct sign_files_item_s *item, u32 duration)
+{
+  gpg_error_t err = 0;
+  progress_filter_context_t *pfx;
+  text_filter_context_t tfx;
+  md_filter_context_t mfx;
+  size_t iobuf_size = iobuf_set_buffer_size(0) * 1024;
+  gcry_md_hd_t md = NULL;
+  gcry_md_hd_t md2;
+  iobuf_t inp;
+  SK_LIST sk_rover;
+  int i;
+
+  inp = iobuf_open (item->fname);
+  if (inp && is_secured_file (iobuf_get_fd (inp)))
+    {
+      iobuf_close (inp);
+      inp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!inp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't open '%s': %s\n"), item->fname, gpg_strerror (err));
+      return err;
+    }
+
+  pfx = new_progress_context ();
+  handle_progress (pfx, inp, item->fname);
+  if (opt.textmode)
+    {
+      memset (&tfx, 0, sizeof tfx);
+      iobuf_push_filter (inp, text_filter, &tfx);
+    }
+
+  if (gcry_md_open (&md, 0, 0))
+    BUG ();
+  if (DBG_HASHING)
+    gcry_md_debug (md, "sign");
+  for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    gcry_md_enable (md, hash_for (sk_rover->pk));
+
+  memset (&mfx, 0, sizeof mfx);
+  iobuf_push_filter (inp, md_filter, &mfx);
+  mfx.md = md;
+
+  write_status_begin_signing (md);
+
+  while (iobuf_read (inp, NULL, iobuf_size) != -1)
+    ;
+  iobuf_close (inp);
+  release_progress_context (pfx);
+
+  for (sk_rover = sk_list, i = 0; sk_rover && !err;
+       sk_rover = sk_rover->next, i++)
+    {
+      PKT_public_key *pk = sk_rover->pk;
+      int mdalgo = hash_for (pk);
+
+      err = make_data_sig (ctrl, pk, md, NULL, opt.textmode? 0x01 : 0x00,
+                           0, duration, &item->sigs[i], &md2);
+      if (err)
+        break;
+      err = check_sig_timestamp (pk, item->sigs[i], 0);
+      if (!err)
+        err = prepare_sign (pk, item->sigs[i], md2, mdalgo, 0);
+      if (!err)
+        {
+          item->digests[i] = xtrymalloc (gcry_md_get_algo_dlen (mdalgo));
+          if (!item->digests[i])
+            err = gpg_error_from_syserror ();
+          else
+            memcpy (item->digests[i], gcry_md_read (md2, mdalgo),
+                    gcry_md_get_algo_dlen (mdalgo));
+        }
+      gcry_md_close (md2);
+    }
+
+  gcry_md_close (md);
+  return err;
+}
+
+
+/* Write the detached signatures prepared for ITEM to the signature
+ * file for ITEM->FNAME.  */
+static gpg_error_t
+write_detached_sig_file (ctrl_t ctrl, SK_LIST sk_list,
+                         struct sign_files_item_s *item)
+{
+  gpg_error_t err;
+  armor_filter_context_t *afx;
+  iobuf_t out;
+  SK_LIST sk_rover;
+  PACKET pkt;
+  int i;
+
+  err = open_outfile (GNUPG_INVALID_FD, item->fname, opt.armor? 1 : 2, 0, &out);
+  if (err)
+    return err;
+
+  afx = new_armor_context ();
+  afx->what = 2;
+  if (opt.armor)
+    push_armor_filter (afx, out);
+
+  for (sk_rover = sk_list, i = 0; sk_rover && !err;
+       sk_rover = sk_rover->next, i++)
+    {
+      init_packet (&pkt);
+      pkt.pkttype = PKT_SIGNATURE;
+      pkt.pkt.signature = item->sigs[i];
+      err = build_packet (out, &pkt);
+      if (err)
+        log_error ("build signature packet failed: %s\n",
+                   gpg_strerror (err));
+      else
+        {
+          print_sig_created_info (ctrl, sk_rover->pk, item->sigs[i]);
+          if (is_status_enabled())
+            print_status_sig_created (sk_rover->pk, item->sigs[i], 'D');
+        }
+    }
+
+  if (err)
+    iobuf_cancel (out);
+  else
+    iobuf_close (out);
+  release_armor_context (afx);
+  return err;
+}
+
+
+/* Create detached signatures for the NITEMS files in ITEMS.  The
+ * files are hashed first and then all digests for one key are
+ * signed with a single request to the agent.  */
+static void
+sign_files_batch (ctrl_t ctrl, SK_LIST sk_list, int nsk,
+                  struct sign_files_item_s *items, int nitems, u32 duration)
+{
+  gpg_error_t err;
+  SK_LIST sk_rover;
+  unsigned char *digests = NULL;
+  gcry_sexp_t *sigvals = NULL;
+  int *map = NULL;
+  int i, j, n;
+
+  for (i=0; i < nitems; i++)
+    {
+      items[i].sigs = xcalloc (nsk, sizeof *items[i].sigs);
+      items[i].digests = xcalloc (nsk, sizeof *items[i].digests);
+      print_file_status (STATUS_FILE_START, items[i].fname, 4);
+      items[i].err = hash_file_for_signing (ctrl, sk_list, items + i,
+                                            duration);
+      write_status (STATUS_FILE_DONE);
+    }
+
+  map = xcalloc (nitems, sizeof *map);
+  sigvals = xcalloc (nitems, sizeof *sigvals);
+  for (sk_rover = sk_list, j = 0; sk_rover; sk_rover = sk_rover->next, j++)
+    {
+      PKT_public_key *pk = sk_rover->pk;
+      int mdalgo = hash_for (pk);
+      size_t dlen = gcry_md_get_algo_dlen (mdalgo);
+      char *hexgrip, *desc;
+
+      for (i = n = 0; i < nitems; i++)
+        if (!items[i].err)
+          map[n++] = i;
+      if (!n)
+        break;
+
+      xfree (digests);
+      digests = xmalloc (n * dlen);
+      for (i=0; i < n; i++)
+        memcpy (digests + i * dlen, items[map[i]].digests[j], dlen);
+
+      err = hexkeygrip_from_pk (pk, &hexgrip);
+      if (!err)
+        {
+          desc = gpg_format_keydesc (ctrl, pk, FORMAT_KEYDESC_NORMAL, 1);
+          err = agent_pksign_multi (NULL/*ctrl*/, NULL, hexgrip, desc,
+                                    pk->keyid, pk->main_keyid,
+                                    pk->pubkey_algo, digests, dlen, n,
+                                    mdalgo, sigvals);
+          xfree (desc);
+          xfree (hexgrip);
+        }
+
+      for (i=0; i < n; i++)
+        {
+          struct sign_files_item_s *item = items + map[i];
+
+          if (err)
+            item->err = err;
+          else
+            item->err = store_sigval (pk, item->sigs[j], sigvals[i]);
+          gcry_sexp_release (sigvals[i]);
+          sigvals[i] = NULL;
+        }
+    }
+
+  for (i=0; i < nitems; i++)
+    {
+      if (!items[i].err)
+        items[i].err = write_detached_sig_file (ctrl, sk_list, items + i);
+      if (items[i].err)
+        {
+          write_status_failure ("sign", items[i].err);
+          log_error ("%s: signing failed: %s\n",
+                     print_fname_stdin (items[i].fname),
+                     gpg_strerror (items[i].err));
+        }
+
+      for (j=0; j < nsk; j++)
+        {
+          if (items[i].sigs[j])
+            free_seckey_enc (items[i].sigs[j]);
+          xfree (items[i].digests[j]);
+        }
+      xfree (items[i].sigs);
+      xfree (items[i].digests);
+      items[i].sigs = NULL;
+      items[i].digests = NULL;
+    }
+
+  xfree (digests);
+  xfree (sigvals);
+  xfree (map);
+}
+
+
+/*
+ * Create a detached signature for each of the NFILES files in FILES
+ * using all secret keys which can be taken from LOCUSR; if this is
+ * NULL, use the default secret key.  If NFILES is 0 the file names
+ * are read from stdin, one per line.  The signature for a file is
+ * written to that file with the suffix ".sig" or, with --armor,
+ * ".asc".  The files are processed in batches so that the agent is
+ * asked only once per batch and key.  This is used for
+ * --detach-sign --multifile.
+ */
+void
+sign_files (ctrl_t ctrl, int nfiles, char **files, strlist_t locusr)
+{
+  struct sign_files_item_s items[SIGN_FILES_BATCH];
+  SK_LIST sk_list = NULL;
+  SK_LIST sk_rover;
+  gpg_error_t err;
+  u32 duration;
+  int nsk, nitems, i;
+  char line[2048];
+  unsigned int lno = 0;
+  int from_args = !!nfiles;
+
+  if (opt.outfile)
+    {
+      log_error (_("--output doesn't work for this command\n"));
+      return;
+    }
+
+  if (opt.ask_sig_expire && !opt.batch)
+    duration = ask_expire_interval(1,opt.def_sig_expire);
+  else
+    duration = parse_expire_string(opt.def_sig_expire);
+
+  if ((err = build_sk_list (ctrl, locusr, &sk_list, PUBKEY_USAGE_SIG)))
+    {
+      write_status_failure ("sign", err);
+      log_error ("signing failed: %s\n", gpg_strerror (err));
+      return;
+    }
+  for (nsk = 0, sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
+    nsk++;
+
+  memset (items, 0, sizeof items);
+  nitems = 0;
+  for (;;)
+    {
+      const char *name = NULL;
+
+      if (from_args)
+        {
+          if (nfiles)
+            {
+              name = *files++;
+              nfiles--;
+            }
+        }
+      else if (fgets (line, DIM(line), stdin))
+        {
+          lno++;
+          if (!*line || line[strlen(line)-1] != '\n')
+            log_error ("input line %u too long or missing LF\n", lno);
+          else
+            {
+              line[strlen(line)-1] = '\0';
+              name = line;
+            }
+        }
+
+      if (name)
+        items[nitems++].fname = xstrdup (name);
+      if (nitems && (!name || nitems == SIGN_FILES_BATCH))
+        {
+          sign_files_batch (ctrl, sk_list, nsk, items, nitems, duration);
+          for (i=0; i < nitems; i++)
+            xfree (items[i].fname);
+          memset (items, 0, sizeof items);
+          nitems = 0;
+        }
+      if (!name)
+        break;
+    }
+
+  release_sk_list (sk_list);
+}
+
+
 
 /*
  * Make a clear signature.  Note that opt.armor is not needed.
@@ -1556,7 +2202,7 @@ clearsign_file (ctrl_t ctrl,
     }
 
   /* Write the signatures.  */
-  rc = write_signature_packets (ctrl, sk_list, out, textmd, extrahash,
+  rc = write_signature_packets (ctrl, sk_list, out, textmd, NULL, extrahash,
                                 0x01, 0, duration, 'C', NULL);
   if (rc)
     goto leave;
@@ -1713,6 +2359,7 @@ sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr)
   }
 
   /* Push the encryption filter */
+  cfx.interactive = aead_interactive_input (inp);
   iobuf_push_filter (out,
                      cfx.dek->use_aead? cipher_filter_aead
                      /**/             : cipher_filter_cfb,
@@ -1744,7 +2391,7 @@ sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr)
 
   /* Write the signatures.  */
   /* (current filters: zip - encrypt - armor) */
-  rc = write_signature_packets (ctrl, sk_list, out, md, extrahash,
+  rc = write_signature_packets (ctrl, sk_list, out, md, NULL, extrahash,
                                 opt.textmode? 0x01 : 0x00,
                                 0, duration, 'S', NULL);
   if (rc)
@@ -0,0 +1,202 @@
+/* t-aead-pool.c - Module test for aead-pool.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/openpgpdefs.h"
+#include "aead-pool.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                       exit (1);                                 \
+                    } while(0)
+
+#define NCHUNKS    37
+#define CHUNKBYTE  0   /* 64 byte chunks.  */
+#define CHUNKSIZE  64
+
+static int verbose;
+
+static byte key[16];
+static byte startiv[16];
+static byte plain[NCHUNKS][CHUNKSIZE];
+static size_t plainlen[NCHUNKS];
+static byte cipher[NCHUNKS][CHUNKSIZE];
+static byte tags[NCHUNKS][16];
+
+
+/* Encrypt the test data chunk by chunk as done by cipher-aead.c
+ * without threads.  */
+static void
+encrypt_reference (int aead_algo, int mode)
+{
+  gcry_cipher_hd_t hd;
+  byte nonce[16];
+  byte ad[13];
+  uint64_t idx;
+  int i, n;
+
+  if (gcry_cipher_open (&hd, GCRY_CIPHER_AES128, mode, 0)
+      || gcry_cipher_setkey (hd, key, sizeof key))
+    fail (0);
+  for (idx = 0; idx < NCHUNKS; idx++)
+    {
+      n = aead_algo == AEAD_ALGO_OCB? 15 : 16;
+      memcpy (nonce, startiv, n);
+      for (i = 0; i < 8; i++)
+        nonce[n - 8 + i] ^= idx >> (56 - 8 * i);
+      ad[0] = 0xc0 | PKT_ENCRYPTED_AEAD;
+      ad[1] = 1;
+      ad[2] = CIPHER_ALGO_AES;
+      ad[3] = aead_algo;
+      ad[4] = CHUNKBYTE;
+      for (i = 0; i < 8; i++)
+        ad[5 + i] = idx >> (56 - 8 * i);
+      if (gcry_cipher_setiv (hd, nonce, n)
+          || gcry_cipher_authenticate (hd, ad, sizeof ad))
+        fail (1);
+      gcry_cipher_final (hd);
+      if (gcry_cipher_encrypt (hd, cipher[idx], plainlen[idx],
+                               plain[idx], plainlen[idx])
+          || gcry_cipher_gettag (hd, tags[idx], 16))
+        fail (2);
+    }
+  gcry_cipher_close (hd);
+}
+
+
+/* Run all chunks through a pool with NTHREADS threads.  If DECRYPT
+ * is set the reference ciphertext is decrypted and the tag of chunk
+ * BADTAG (if not negative) is corrupted.  */
+static void
+run_pool (int aead_algo, int mode, unsigned int nthreads, int decrypt,
+          int badtag)
+{
+  struct aead_pool_parm_s parm;
+  aead_pool_t pool;
+  aead_pool_job_t job;
+  int nin = 0, nout = 0;
+
+  memset (&parm, 0, sizeof parm);
+  parm.decrypt = decrypt;
+  parm.gcry_algo = GCRY_CIPHER_AES128;
+  parm.gcry_mode = mode;
+  parm.cipher_algo = CIPHER_ALGO_AES;
+  parm.aead_algo = aead_algo;
+  parm.chunkbyte = CHUNKBYTE;
+  parm.startiv = startiv;
+  parm.key = key;
+  parm.keylen = sizeof key;
+  if (aead_pool_new (&pool, nthreads, &parm))
+    fail (10);
+
+  while (nout < NCHUNKS)
+    {
+      if (nin < NCHUNKS && (job = aead_pool_get_job (pool)))
+        {
+          job->chunkindex = nin;
+          job->len = plainlen[nin];
+          if (decrypt)
+            {
+              memcpy (job->buffer, cipher[nin], job->len);
+              memcpy (job->tag, tags[nin], 16);
+              if (nin == badtag)
+                job->tag[5] ^= 1;
+            }
+          else
+            memcpy (job->buffer, plain[nin], job->len);
+          aead_pool_submit (pool, job);
+          nin++;
+          continue;
+        }
+
+      job = aead_pool_next_result (pool);
+      if (!job || job->chunkindex != nout || job->len != plainlen[nout])
+        fail (11);
+      if (nout == badtag)
+        {
+          if (gpg_err_code (job->err) != GPG_ERR_CHECKSUM)
+            fail (12);
+        }
+      else if (job->err)
+        fail (13);
+      else if (decrypt && memcmp (job->buffer, plain[nout], job->len))
+        fail (14);
+      else if (!decrypt && (memcmp (job->buffer, cipher[nout], job->len)
+                            || memcmp (job->tag, tags[nout], 16)))
+        fail (15);
+      aead_pool_put_job (pool, job);
+      nout++;
+    }
+  if (aead_pool_next_result (pool))
+    fail (16);
+  aead_pool_release (pool);
+}
+
+
+static void
+test_algo (int aead_algo, int mode)
+{
+  static const unsigned int nthreads[] = { 1, 2, 5 };
+  int i;
+
+  encrypt_reference (aead_algo, mode);
+  for (i = 0; i < DIM (nthreads); i++)
+    {
+      if (verbose)
+        printf ("testing aead algo %d with %u threads\n",
+                aead_algo, nthreads[i]);
+      run_pool (aead_algo, mode, nthreads[i], 0, -1);
+      run_pool (aead_algo, mode, nthreads[i], 1, -1);
+      run_pool (aead_algo, mode, nthreads[i], 1, 7);
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  npth_init ();
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  gcry_randomize (key, sizeof key, GCRY_WEAK_RANDOM);
+  gcry_randomize (startiv, sizeof startiv, GCRY_WEAK_RANDOM);
+  gcry_randomize (plain, sizeof plain, GCRY_WEAK_RANDOM);
+  for (i = 0; i < NCHUNKS; i++)
+    plainlen[i] = CHUNKSIZE;
+  plainlen[NCHUNKS-1] = 23; /* The last chunk is usually shorter.  */
+
+  test_algo (AEAD_ALGO_OCB, GCRY_CIPHER_MODE_OCB);
+  test_algo (AEAD_ALGO_EAX, GCRY_CIPHER_MODE_EAX);
+
+  return 0;
+}
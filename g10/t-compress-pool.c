@@ -0,0 +1,179 @@
+/* t-compress-pool.c - Module test for compress-pool.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+#ifdef HAVE_ZIP
+# include <zlib.h>
+#endif
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/iobuf.h"
+#include "../common/openpgpdefs.h"
+#include "compress-pool.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                       exit (1);                                 \
+                    } while(0)
+
+static int verbose;
+
+#ifdef HAVE_ZIP
+
+/* Compress DATALEN bytes of DATA with a pool of NTHREADS threads,
+ * feeding it in pieces of WRITELEN bytes, and check that zlib
+ * inflates it back to DATA.  Returns the length of the compressed
+ * data.  */
+static size_t
+run_pool (int algo, unsigned int nthreads, const byte *data, size_t datalen,
+          size_t writelen, int adaptive)
+{
+  compress_pool_t pool;
+  iobuf_t a;
+  z_stream zs;
+  byte *out;
+  size_t off, n, outlen;
+  int zrc;
+
+  if (verbose)
+    printf ("testing algo %d with %u threads and %zu bytes\n",
+            algo, nthreads, datalen);
+
+  a = iobuf_temp ();
+  if (compress_pool_new (&pool, algo, 6, adaptive, nthreads))
+    fail (1);
+  for (off = 0; off < datalen; off += n)
+    {
+      n = datalen - off < writelen? datalen - off : writelen;
+      if (compress_pool_write (pool, a, data + off, n))
+        fail (2);
+    }
+  if (compress_pool_finish (pool, a))
+    fail (3);
+  compress_pool_release (pool);
+
+  out = xmalloc (datalen + 1);
+  memset (&zs, 0, sizeof zs);
+  if (inflateInit2 (&zs, algo == COMPRESS_ALGO_ZIP? -15 : 15) != Z_OK)
+    fail (4);
+  zs.next_in = iobuf_get_temp_buffer (a);
+  zs.avail_in = outlen = iobuf_get_temp_length (a);
+  zs.next_out = out;
+  zs.avail_out = datalen + 1;
+  zrc = inflate (&zs, Z_FINISH);
+  if (zrc != Z_STREAM_END)
+    fail (5);
+  if (zs.avail_in || zs.total_out != datalen || memcmp (out, data, datalen))
+    fail (6);
+  inflateEnd (&zs);
+  xfree (out);
+  iobuf_close (a);
+  return outlen;
+}
+
+
+static void
+test_algo (int algo)
+{
+  static const unsigned int nthreads[] = { 1, 2, 5 };
+  static const size_t lengths[] = { 0, 1, 1000, 128*1024, 1000*1000 };
+  byte *data;
+  size_t i, j, maxlen = 1000*1000;
+
+  /* Repetitive data so that back references across the block
+   * boundaries are used.  */
+  data = xmalloc (maxlen);
+  gcry_create_nonce (data, 4096);
+  for (i = 4096; i < maxlen; i++)
+    data[i] = data[(i * 7) % 4096] ^ (i / 50000);
+
+  for (i = 0; i < DIM (nthreads); i++)
+    for (j = 0; j < DIM (lengths); j++)
+      {
+        run_pool (algo, nthreads[i], data, lengths[j], 8192, 0);
+        run_pool (algo, nthreads[i], data, lengths[j], 300*1000, 0);
+        run_pool (algo, nthreads[i], data, lengths[j], 300*1000, 1);
+      }
+  xfree (data);
+}
+
+
+/* Check the estimate of the compressibility and that incompressible
+ * blocks are stored.  */
+static void
+test_adaptive (void)
+{
+  size_t i, len = 1000*1000;
+  size_t plain, adaptive;
+  byte *data;
+
+  data = xmalloc (len);
+  gcry_create_nonce (data, len);
+  if (!compress_is_incompressible (data, len))
+    fail (10);
+  if (compress_is_incompressible (data, 1000))
+    fail (11);
+
+  /* Storing must not be larger than compressing random data.  */
+  plain = run_pool (COMPRESS_ALGO_ZIP, 2, data, len, 8192, 0);
+  adaptive = run_pool (COMPRESS_ALGO_ZIP, 2, data, len, 8192, 1);
+  if (adaptive > plain || adaptive > len + len / 100)
+    fail (12);
+
+  /* Uniformly distributed bytes with many repeats.  */
+  for (i = 4096; i < len; i++)
+    data[i] = data[(i * 7) % 4096];
+  if (compress_is_incompressible (data, len))
+    fail (13);
+
+  /* Text.  */
+  for (i = 0; i < len; i++)
+    data[i] = "etaoin shrdlu cmfwyp vbgkqj xz\n"[(i * i + i / 7) % 32];
+  if (compress_is_incompressible (data, len))
+    fail (14);
+  if (run_pool (COMPRESS_ALGO_ZIP, 2, data, len, 8192, 1) > len / 2)
+    fail (15);
+
+  xfree (data);
+}
+
+#endif /*HAVE_ZIP*/
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  npth_init ();
+#ifdef HAVE_ZIP
+  test_algo (COMPRESS_ALGO_ZIP);
+  test_algo (COMPRESS_ALGO_ZLIB);
+  test_adaptive ();
+#endif
+
+  return 0;
+}
@@ -0,0 +1,194 @@
+/* t-ecdh-pool.c - Tests for the pool of ephemeral ECDH keys
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include <npth.h>
+#include "options.h"
+#include "ecdh-pool.h"
+
+#define POOLSIZE 4
+#define NTAKE    10
+
+
+/* Return PKEY for the OpenPGP curve OID and the public key in KEY.  */
+static int
+make_pkey (gcry_sexp_t key, const char *oid, gcry_mpi_t *pkey)
+{
+  gcry_sexp_t l;
+  const char *q;
+  size_t qlen;
+
+  pkey[0] = pkey[1] = NULL;
+  if (openpgp_oid_from_str (oid, pkey))
+    return -1;
+  l = gcry_sexp_find_token (key, "q", 0);
+  q = l? gcry_sexp_nth_data (l, 1, &qlen) : NULL;
+  if (q)
+    pkey[1] = gcry_mpi_set_opaque_copy (NULL, q, 8 * qlen);
+  gcry_sexp_release (l);
+  return pkey[1]? 0 : -1;
+}
+
+
+/* Take a key from the pool, waiting for the pool to be filled.  */
+static gpg_error_t
+take_key (gcry_mpi_t *pkey, gcry_mpi_t *r_public,
+          byte **r_shared, size_t *r_nshared)
+{
+  gpg_error_t err;
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      err = ecdh_pool_compute (pkey, r_public, r_shared, r_nshared);
+      if (gpg_err_code (err) != GPG_ERR_NO_DATA)
+        break;
+      npth_usleep (10000);
+    }
+  return err;
+}
+
+
+/* Take NTAKE keys for the curve given by the key parameters GENKEY
+ * and OID, and check that the shared secrets match those computed
+ * with the secret key.  Returns the number of good keys.  */
+static int
+run_curve (const char *genkey, const char *oid)
+{
+  gcry_sexp_t parms, key, pub, sec, s_data, s_plain, l;
+  gcry_mpi_t pkey[2];
+  gcry_mpi_t public, last = NULL;
+  const unsigned char *e;
+  unsigned int nbits;
+  const char *value;
+  size_t vlen;
+  byte *shared;
+  size_t nshared;
+  int i, ngood = 0;
+
+  if (gcry_sexp_new (&parms, genkey, 0, 1)
+      || gcry_pk_genkey (&key, parms))
+    ABORT ("Failed to create an ECC key.");
+  gcry_sexp_release (parms);
+  pub = gcry_sexp_find_token (key, "public-key", 0);
+  sec = gcry_sexp_find_token (key, "private-key", 0);
+  if (!pub || !sec || make_pkey (pub, oid, pkey))
+    ABORT ("Failed to extract the ECC key.");
+
+  for (i = 0; i < NTAKE; i++)
+    {
+      if (take_key (pkey, &public, &shared, &nshared))
+        continue;
+      e = gcry_mpi_get_opaque (public, &nbits);
+      s_plain = NULL;
+      if (!gcry_sexp_build (&s_data, NULL, "(enc-val(ecdh(e%b)))",
+                            (int)(nbits+7)/8, e))
+        {
+          gcry_pk_decrypt (&s_plain, s_data, sec);
+          gcry_sexp_release (s_data);
+        }
+      l = s_plain? gcry_sexp_find_token (s_plain, "value", 0) : NULL;
+      value = l? gcry_sexp_nth_data (l, 1, &vlen) : NULL;
+      /* The shared point may be returned with a prefix.  */
+      if (value && vlen > nshared)
+        {
+          value += vlen - nshared;
+          vlen = nshared;
+        }
+      if (value && vlen == nshared && !memcmp (value, shared, nshared)
+          && (!last || gcry_mpi_cmp (last, public)))
+        ngood++;
+      gcry_sexp_release (l);
+      gcry_sexp_release (s_plain);
+      gcry_mpi_release (last);
+      last = public;
+      xfree (shared);
+    }
+
+  gcry_mpi_release (last);
+  gcry_mpi_release (pkey[0]);
+  gcry_mpi_release (pkey[1]);
+  gcry_sexp_release (pub);
+  gcry_sexp_release (sec);
+  gcry_sexp_release (key);
+  return ngood;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  gcry_sexp_t parms, key, pub;
+  gcry_mpi_t pkey[2];
+  gcry_mpi_t public;
+  byte *shared;
+  size_t nshared;
+
+  (void) argc;
+  (void) argv;
+
+  npth_init ();
+  gcry_control (GCRYCTL_INIT_SECMEM, 32768, 0);
+
+  if (gcry_sexp_new (&parms, "(genkey(ecc(curve Curve25519)"
+                     "(flags djb-tweak comp)))", 0, 1)
+      || gcry_pk_genkey (&key, parms))
+    ABORT ("Failed to create an ECC key.");
+  gcry_sexp_release (parms);
+  pub = gcry_sexp_find_token (key, "public-key", 0);
+  if (!pub || make_pkey (pub, "1.3.6.1.4.1.3029.1.5.1", pkey))
+    ABORT ("Failed to extract the ECC key.");
+
+  TEST_GROUP ("pool not started");
+  TEST ("no key", gpg_err_code (ecdh_pool_compute (pkey, &public, &shared,
+                                                    &nshared)),
+        GPG_ERR_NO_DATA);
+  gcry_mpi_release (pkey[0]);
+  gcry_mpi_release (pkey[1]);
+  gcry_sexp_release (pub);
+  gcry_sexp_release (key);
+
+  TEST ("pool started", ecdh_pool_start (POOLSIZE), 0);
+
+  TEST_GROUP ("Curve25519");
+  TEST ("good keys",
+        run_curve ("(genkey(ecc(curve Curve25519)(flags djb-tweak comp)))",
+                   "1.3.6.1.4.1.3029.1.5.1"), NTAKE);
+
+  TEST_GROUP ("X448");
+  TEST ("good keys", run_curve ("(genkey(ecc(curve X448)))", "1.3.101.111"),
+        NTAKE);
+
+  TEST_GROUP ("curve not pooled");
+  if (gcry_sexp_new (&parms, "(genkey(ecc(curve nistp256)))", 0, 1)
+      || gcry_pk_genkey (&key, parms))
+    ABORT ("Failed to create an ECC key.");
+  gcry_sexp_release (parms);
+  pub = gcry_sexp_find_token (key, "public-key", 0);
+  if (!pub || make_pkey (pub, "1.2.840.10045.3.1.7", pkey))
+    ABORT ("Failed to extract the ECC key.");
+  TEST ("no key", gpg_err_code (ecdh_pool_compute (pkey, &public, &shared,
+                                                    &nshared)),
+        GPG_ERR_NO_DATA);
+  gcry_mpi_release (pkey[0]);
+  gcry_mpi_release (pkey[1]);
+  gcry_sexp_release (pub);
+  gcry_sexp_release (key);
+}
@@ -0,0 +1,124 @@
+/* t-keydb-batch.c - Module test for batch key lookups
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "test.c"
+
+#include "keydb.h"
+#include "main.h"
+
+#define FPR_PRIMARY "80615870F5BAD690333686D0F2AD85AC1E42B367"
+#define FPR_SUBKEY  "7BF806237C8EFE1873B326DE8117B6EBFA8FE1F9"
+#define FPR_MISSING "0123456789ABCDEF0123456789ABCDEF01234567"
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  static const char *names[] =
+    { FPR_PRIMARY, "0xDF7B7722C193565B", FPR_MISSING,
+      FPR_PRIMARY, "C193565B", FPR_SUBKEY };
+  ctrl_t ctrl;
+  char *fname;
+  int rc, i;
+  KEYDB_SEARCH_DESC desc[DIM (names)];
+  kbnode_t keyblocks[DIM (names)];
+  kbnode_t keyblock;
+  strlist_t sl = NULL;
+  getkey_ctx_t ctx;
+  PKT_public_key *pk;
+  u32 kid[2];
+
+  (void) argc;
+  (void) argv;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  fname = prepend_srcdir ("t-keydb-get-keyblock.gpg");
+  rc = keydb_add_resource (fname, KEYDB_RESOURCE_FLAG_READONLY);
+  test_free (fname);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+
+  for (i = 0; i < DIM (names); i++)
+    if (classify_user_id (names[i], desc + i, 1))
+      ABORT ("Failed to classify a name.");
+
+  TEST_GROUP ("keydb_search_batch");
+  rc = keydb_search_batch (ctrl, desc, DIM (names), keyblocks);
+  TEST ("search", rc, 0);
+  for (i = 0; i < DIM (names); i++)
+    {
+      if (i == 2)
+        {
+          TEST_P ("missing key", !keyblocks[i]);
+          continue;
+        }
+      TEST_P ("key found", keyblocks[i]);
+      if (!keyblocks[i])
+        continue;
+      keyid_from_pk (keyblocks[i]->pkt->pkt.public_key, kid);
+      TEST ("primary key", kid[1], 0x1E42B367);
+    }
+  TEST_P ("separate keyblocks", keyblocks[0] != keyblocks[3]);
+  for (i = 0; i < DIM (names); i++)
+    release_kbnode (keyblocks[i]);
+
+  desc[0].mode = KEYDB_SEARCH_MODE_MAIL;
+  rc = keydb_search_batch (ctrl, desc, DIM (names), keyblocks);
+  TEST ("other modes", gpg_err_code (rc), GPG_ERR_INV_ARG);
+
+  TEST_GROUP ("getkey_prefetch");
+  for (i = DIM (names) - 1; i >= 0; i--)
+    add_to_strlist (&sl, names[i]);
+  add_to_strlist (&sl, "<nobody@example.org>");
+  TEST ("prefetched", getkey_prefetch (ctrl, sl), 4);
+
+  pk = xcalloc (1, sizeof *pk);
+  rc = getkey_byname (ctrl, NULL, pk, FPR_PRIMARY, 0, &keyblock);
+  TEST ("lookup", rc, 0);
+  TEST ("keyid", pk_keyid (pk)[1], 0x1E42B367);
+  release_kbnode (keyblock);
+  free_public_key (pk);
+
+  /* The keyblock for the second name has been looked up separately.
+   * A missing key falls back to the regular search.  */
+  pk = xcalloc (1, sizeof *pk);
+  rc = getkey_byname (ctrl, NULL, pk, FPR_PRIMARY, 0, NULL);
+  TEST ("duplicate", rc, 0);
+  free_public_key (pk);
+  pk = xcalloc (1, sizeof *pk);
+  rc = getkey_byname (ctrl, NULL, pk, FPR_MISSING, 0, NULL);
+  TEST ("not found", gpg_err_code (rc), GPG_ERR_NO_PUBKEY);
+  free_public_key (pk);
+
+  /* Continuing the search must not return the keyblock again.  */
+  rc = getkey_byname (ctrl, &ctx, NULL, FPR_SUBKEY, 0, NULL);
+  TEST ("with context", rc, 0);
+  rc = getkey_next (ctrl, ctx, NULL, NULL);
+  TEST ("next", gpg_err_code (rc), GPG_ERR_NO_PUBKEY);
+  getkey_end (ctrl, ctx);
+
+  getkey_prefetch_release (ctrl);
+  TEST_P ("released", !ctrl->getkey_prefetch);
+
+  free_strlist (sl);
+  keydb_release (ctrl->cached_getkey_kdb);
+  xfree (ctrl);
+}
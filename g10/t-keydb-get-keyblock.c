@@ -22,6 +22,41 @@
 #include "keydb.h"
 
 
+/* Count the keys, user ids, signatures and certifications by other
+ * keys in KEYBLOCK.  */
+static void
+count_packets (kbnode_t keyblock, int *r_keys, int *r_uids, int *r_sigs,
+               int *r_other)
+{
+  kbnode_t n;
+  PKT_signature *sig;
+  u32 kid[2];
+
+  *r_keys = *r_uids = *r_sigs = *r_other = 0;
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+  for (n = keyblock; n; n = n->next)
+    switch (n->pkt->pkttype)
+      {
+      case PKT_PUBLIC_KEY:
+      case PKT_PUBLIC_SUBKEY:
+        ++*r_keys;
+        break;
+      case PKT_USER_ID:
+        ++*r_uids;
+        break;
+      case PKT_SIGNATURE:
+        ++*r_sigs;
+        sig = n->pkt->pkt.signature;
+        if ((IS_UID_SIG (sig) || IS_UID_REV (sig))
+            && (sig->keyid[0] != kid[0] || sig->keyid[1] != kid[1]))
+          ++*r_other;
+        break;
+      default:
+        break;
+      }
+}
+
+
 static void
 do_test (int argc, char *argv[])
 {
@@ -62,8 +97,47 @@ do_test (int argc, char *argv[])
 
   rc = keydb_get_keyblock (hd1, &kb1);
   TEST_P ("", ! rc);
-
   keydb_release (hd1);
+  if (rc)
+    ABORT ("Failed to get keyblock for 1E42B367");
+
+  {
+    static const unsigned int masks[] =
+      { PARSE_SKIP_SIGS, PARSE_SKIP_OTHER_CERTS,
+        PARSE_SKIP_ATTRIBUTES | PARSE_SKIP_SIGS };
+    int keys, uids, sigs, other;
+    int keys2, uids2, sigs2, other2;
+    kbnode_t kb2;
+    int i;
+
+    count_packets (kb1, &keys, &uids, &sigs, &other);
+    for (i = 0; i < DIM (masks); i++)
+      {
+        TEST_GROUP ("parse mask");
+        hd1 = keydb_new (ctrl);
+        if (!hd1)
+          ABORT ("");
+        keydb_set_parse_mask (hd1, masks[i]);
+        rc = keydb_search (hd1, &desc1, 1, NULL);
+        TEST ("search", rc, 0);
+        rc = keydb_get_keyblock (hd1, &kb2);
+        TEST ("get keyblock", rc, 0);
+        keydb_release (hd1);
+        if (rc)
+          continue;
+
+        count_packets (kb2, &keys2, &uids2, &sigs2, &other2);
+        TEST ("keys", keys2, keys);
+        TEST ("user ids", uids2, uids);
+        TEST ("other certifications", other2, 0);
+        if ((masks[i] & PARSE_SKIP_SIGS))
+          TEST ("signatures", sigs2, 0);
+        else
+          TEST ("signatures", sigs2, sigs - other);
+        release_kbnode (kb2);
+      }
+  }
+
   release_kbnode (kb1);
   xfree (ctrl);
 }
@@ -85,6 +85,52 @@ test_compare_pubkey_string (void)
 }
 
 
+/* Check that the keygrip is computed once and then taken from the
+ * cache in the public key.  */
+static void
+test_keygrip_cache (void)
+{
+  PKT_public_key *pk;
+  gcry_sexp_t s_pkey;
+  unsigned char grip[KEYGRIP_LEN], expected[KEYGRIP_LEN];
+  char hexexpected[2 * KEYGRIP_LEN + 1];
+  char *hexgrip;
+
+  pk = xmalloc_clear (sizeof *pk);
+  pk->version = 4;
+  pk->pubkey_algo = PUBKEY_ALGO_RSA;
+  pk->pkey[0] = gcry_mpi_new (1024);
+  gcry_mpi_randomize (pk->pkey[0], 1024, GCRY_WEAK_RANDOM);
+  gcry_mpi_set_highbit (pk->pkey[0], 1023);
+  pk->pkey[1] = gcry_mpi_set_ui (NULL, 65537);
+
+  if (gcry_sexp_build (&s_pkey, NULL, "(public-key(rsa(n%m)(e%m)))",
+                       pk->pkey[0], pk->pkey[1])
+      || !gcry_pk_get_keygrip (s_pkey, expected))
+    {
+      fail (0);
+      return;
+    }
+  gcry_sexp_release (s_pkey);
+  bin2hex (expected, KEYGRIP_LEN, hexexpected);
+
+  if (keygrip_from_pk (pk, grip, 0) || memcmp (grip, expected, KEYGRIP_LEN))
+    fail (1);
+  if (keygrip_from_pk (pk, grip, 1) != gpg_error (GPG_ERR_FALSE))
+    fail (2);
+
+  /* Change the key; the cached keygrip must be returned.  */
+  gcry_mpi_add_ui (pk->pkey[1], pk->pkey[1], 2);
+  if (keygrip_from_pk (pk, grip, 0) || memcmp (grip, expected, KEYGRIP_LEN))
+    fail (3);
+  if (hexkeygrip_from_pk (pk, &hexgrip) || strcmp (hexgrip, hexexpected))
+    fail (4);
+  xfree (hexgrip);
+
+  free_public_key (pk);
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -129,6 +175,7 @@ main (int argc, char **argv)
     }
 
   test_compare_pubkey_string ();
+  test_keygrip_cache ();
 
   return !!errcount;
 }
@@ -0,0 +1,138 @@
+/* t-keyring-index.c - Tests for the index of keyring files
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include "test.c"
+
+#include "keydb.h"
+#include "keyring.h"
+
+#define KEYRING     "./t-keyring-index.gpg"
+#define INDEX       KEYRING ".idx"
+#define FPR_PRIMARY "80615870F5BAD690333686D0F2AD85AC1E42B367"
+#define FPR_SUBKEY  "7BF806237C8EFE1873B326DE8117B6EBFA8FE1F9"
+#define FPR_MISSING "0123456789ABCDEF0123456789ABCDEF01234567"
+#define KID_SUBKEY  "0xDF7B7722C193565B"
+
+
+/* Copy the test keyring to KEYRING.  */
+static void
+copy_keyring (void)
+{
+  char *fname;
+  estream_t in, out;
+  char buffer[4096];
+  size_t n;
+
+  fname = prepend_srcdir ("t-keydb-get-keyblock.gpg");
+  in = es_fopen (fname, "rb");
+  test_free (fname);
+  out = es_fopen (KEYRING, "wb");
+  if (!in || !out)
+    ABORT ("Failed to copy the keyring.");
+  while ((n = es_fread (buffer, 1, sizeof buffer, in)))
+    if (es_fwrite (buffer, n, 1, out) != 1)
+      ABORT ("Failed to copy the keyring.");
+  es_fclose (in);
+  if (es_fclose (out))
+    ABORT ("Failed to copy the keyring.");
+}
+
+
+/* Look up NAME in HD and return the low keyid of the primary key or
+ * 0 if it was not found.  */
+static u32
+lookup (KEYDB_HANDLE hd, const char *name)
+{
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock;
+  u32 kid[2];
+
+  if (classify_user_id (name, &desc, 1))
+    ABORT ("Failed to classify a name.");
+  keydb_search_reset (hd);
+  if (keydb_search (hd, &desc, 1, NULL))
+    return 0;
+  if (keydb_get_keyblock (hd, &keyblock))
+    ABORT ("Failed to get the keyblock.");
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+  release_kbnode (keyblock);
+  return kid[1];
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  ctrl_t ctrl;
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock;
+  int rc;
+
+  (void) argc;
+  (void) argv;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+  copy_keyring ();
+  gnupg_remove (INDEX);
+  keyring_set_use_index (1);
+  rc = keydb_add_resource (KEYRING, 0);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+
+  TEST_GROUP ("build");
+  TEST ("primary", lookup (hd, FPR_PRIMARY), 0x1E42B367);
+  TEST ("written", gnupg_access (INDEX, F_OK), 0);
+  TEST ("subkey", lookup (hd, FPR_SUBKEY), 0x1E42B367);
+  TEST ("long keyid", lookup (hd, KID_SUBKEY), 0x1E42B367);
+  TEST ("missing", lookup (hd, FPR_MISSING), 0);
+
+  /* Continuing the search must not return the keyblock again.  */
+  TEST_GROUP ("next");
+  keydb_disable_caching (hd);
+  classify_user_id (FPR_PRIMARY, &desc, 1);
+  keydb_search_reset (hd);
+  TEST ("first", keydb_search (hd, &desc, 1, NULL), 0);
+  TEST ("again", gpg_err_code (keydb_search (hd, &desc, 1, NULL)),
+        GPG_ERR_NOT_FOUND);
+
+  /* An update rewrites the keyring; its index must not be used.  */
+  TEST_GROUP ("update");
+  keydb_search_reset (hd);
+  if (keydb_search (hd, &desc, 1, NULL) || keydb_get_keyblock (hd, &keyblock))
+    ABORT ("Failed to get the keyblock.");
+  TEST ("updated", keydb_update_keyblock (ctrl, hd, keyblock), 0);
+  release_kbnode (keyblock);
+  TEST_P ("removed", gnupg_access (INDEX, F_OK));
+  TEST ("rebuilt", lookup (hd, FPR_SUBKEY), 0x1E42B367);
+  TEST ("written", gnupg_access (INDEX, F_OK), 0);
+  TEST ("missing", lookup (hd, FPR_MISSING), 0);
+
+  keydb_release (hd);
+  xfree (ctrl);
+  gnupg_remove (INDEX);
+  gnupg_remove (KEYRING);
+  gnupg_remove ("./t-keyring-index.bak");
+  gnupg_remove (KEYRING ".lock");
+}
@@ -0,0 +1,123 @@
+/* t-keysig-pool.c - Module test for keysig-pool.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include <npth.h>
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "keysig-pool.h"
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  ctrl_t ctrl;
+  char *fname;
+  int rc;
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock, n, target;
+  kbnode_t unode = NULL;
+  kbnode_t knode = NULL;
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  int nuids = 0;
+  int nchecked = 0;
+  int nbad = 0;
+  int nmismatch = 0;
+
+  (void) argc;
+  (void) argv;
+
+  npth_init ();
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  fname = prepend_srcdir ("t-keydb-get-keyblock.gpg");
+  rc = keydb_add_resource (fname, KEYDB_RESOURCE_FLAG_READONLY);
+  test_free (fname);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+  rc = classify_user_id ("8061 5870 F5BA D690 3336  86D0 F2AD 85AC 1E42 B367",
+			 &desc, 0);
+  if (rc)
+    ABORT ("Failed to convert fingerprint for 1E42B367");
+  rc = keydb_search (hd, &desc, 1, NULL);
+  if (rc)
+    ABORT ("Failed to lookup key associated with 1E42B367");
+  rc = keydb_get_keyblock (hd, &keyblock);
+  if (rc)
+    ABORT ("Failed to get keyblock for 1E42B367");
+  pk = keyblock->pkt->pkt.public_key;
+
+  /* Spoil the self-signatures of the second user ID and drop the
+   * results cached in the keyring.  */
+  for (n = keyblock; n; n = n->next)
+    if (n->pkt->pkttype == PKT_USER_ID && ++nuids == 2)
+      n->pkt->pkt.user_id->name[0] ^= 0x20;
+    else if (n->pkt->pkttype == PKT_SIGNATURE)
+      {
+        n->pkt->pkt.signature->flags.checked = 0;
+        n->pkt->pkt.signature->flags.valid = 0;
+      }
+
+  keysig_pool_check_self_sigs (keyblock, 4);
+
+  /* Compare the cached results with uncached checks.  */
+  for (n = keyblock->next; n; n = n->next)
+    {
+      if (n->pkt->pkttype == PKT_USER_ID)
+        unode = n;
+      else if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        knode = n;
+      if (n->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = n->pkt->pkt.signature;
+      if (!sig->flags.checked)
+        continue;
+
+      if (IS_KEY_SIG (sig) || IS_KEY_REV (sig))
+        target = keyblock;
+      else if (IS_SUBKEY_SIG (sig) || IS_SUBKEY_REV (sig))
+        target = knode;
+      else
+        target = unode;
+      rc = check_signature_over_key_or_uid (ctrl, pk, sig, keyblock,
+                                            target->pkt, NULL, NULL);
+      nchecked++;
+      if (!sig->flags.valid)
+        nbad++;
+      if (!sig->flags.valid != !!rc)
+        nmismatch++;
+    }
+
+  TEST_GROUP ("cached results");
+  TEST_P ("signatures checked", nchecked >= 4);
+  TEST_P ("bad signatures detected", nbad > 0);
+  TEST ("results match", nmismatch, 0);
+
+  keydb_release (hd);
+  release_kbnode (keyblock);
+  xfree (ctrl);
+}
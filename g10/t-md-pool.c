@@ -0,0 +1,108 @@
+/* t-md-pool.c - Module test for md-pool.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "md-pool.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                       exit (1);                                 \
+                    } while(0)
+
+static int verbose;
+
+
+/* Hash DATALEN bytes of DATA with the algorithms ALGOS using a pool
+ * of NTHREADS threads, feeding it in pieces of WRITELEN bytes, and
+ * compare the digests against gcry_md_hash_buffer.  */
+static void
+run_pool (const int *algos, int nalgos, unsigned int nthreads,
+          const byte *data, size_t datalen, size_t writelen)
+{
+  md_pool_t pool;
+  gcry_md_hd_t md;
+  byte digest[64];
+  size_t off, n;
+  int i;
+
+  if (verbose)
+    printf ("testing %d algos with %u threads and %zu bytes\n",
+            nalgos, nthreads, datalen);
+
+  if (md_pool_new (&pool, algos, nalgos, nthreads))
+    fail (1);
+  for (off = 0; off < datalen; off += n)
+    {
+      n = datalen - off < writelen? datalen - off : writelen;
+      md_pool_write (pool, data + off, n);
+    }
+  md_pool_finish (pool);
+
+  for (i = 0; i < nalgos; i++)
+    {
+      md = md_pool_get_md (pool, algos[i]);
+      if (!md)
+        fail (2);
+      gcry_md_hash_buffer (algos[i], digest, data, datalen);
+      if (memcmp (gcry_md_read (md, algos[i]), digest,
+                  gcry_md_get_algo_dlen (algos[i])))
+        fail (3);
+    }
+  if (md_pool_get_md (pool, GCRY_MD_SHA224))
+    fail (4);
+  md_pool_release (pool);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  static const int algos[] = { GCRY_MD_SHA256, GCRY_MD_SHA512,
+                               GCRY_MD_SHA384, GCRY_MD_SHA1 };
+  static const unsigned int nthreads[] = { 1, 2, 4, 7 };
+  static const size_t lengths[] = { 0, 1, 1000, 64*1024, 1000*1000 };
+  byte *data;
+  size_t i, j, maxlen = 1000*1000;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  npth_init ();
+
+  data = xmalloc (maxlen);
+  gcry_create_nonce (data, maxlen);
+
+  for (i = 0; i < DIM (nthreads); i++)
+    for (j = 0; j < DIM (lengths); j++)
+      {
+        run_pool (algos, DIM (algos), nthreads[i], data, lengths[j], 8192);
+        run_pool (algos, 2, nthreads[i], data, lengths[j], 300*1000);
+      }
+  xfree (data);
+
+  return 0;
+}
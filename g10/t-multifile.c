@@ -0,0 +1,117 @@
+/* t-multifile.c - Module test for multifile.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include <unistd.h>
+#include "main.h"
+#include "options.h"
+#include "../common/status.h"
+#include "../common/sysutils.h"
+
+#define NFILES 100
+
+
+/* Emit a status line for NAME.  Files processed later finish
+ * earlier, so that the workers complete out of order.  */
+static gpg_error_t
+process_file (ctrl_t ctrl, const char *name, void *opaque)
+{
+  (void)ctrl;
+  (void)opaque;
+
+  usleep ((NFILES - atoi (name + 1)) * 100);
+  write_status_text (STATUS_FILE_START, name);
+  if (*name == 'b')
+    {
+      g10_errors_seen = 1;
+      return gpg_error (GPG_ERR_BAD_SIGNATURE);
+    }
+  return 0;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  static const unsigned int njobs[] = { 2, 3, 8 };
+  ctrl_t ctrl;
+  char *files[NFILES];
+  char *expected, *p, *buffer;
+  size_t explen;
+  FILE *fp;
+  int i, k, fd;
+  gpg_error_t rc;
+
+  (void) argc;
+  (void) argv;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+  opt.batch = 1;
+
+  expected = xcalloc (NFILES, 40);
+  p = expected;
+  for (i = 0; i < NFILES; i++)
+    {
+      files[i] = xasprintf ("%c%03d", i % 17 == 5? 'b' : 'f', i);
+      p += sprintf (p, "[GNUPG:] FILE_START %s\n", files[i]);
+    }
+  explen = p - expected;
+  buffer = xmalloc (explen + 1);
+
+  fp = gnupg_tmpfile ();
+  if (!fp)
+    ABORT ("can't create a temporary file");
+  fd = dup (fileno (fp));
+  set_status_fd (fd);
+
+  for (k = 0; k < DIM (njobs); k++)
+    {
+      TEST_GROUP ("ordered output");
+      opt.multifile_jobs = njobs[k];
+      if (ftruncate (fileno (fp), 0))
+        ABORT ("ftruncate failed");
+      rewind (fp);
+      g10_errors_seen = 0;
+
+      TEST_P ("usable", multifile_usable (ctrl));
+      rc = multifile_process (ctrl, NFILES, files, process_file, NULL);
+      TEST ("first error", gpg_err_code (rc), GPG_ERR_BAD_SIGNATURE);
+      TEST ("errors seen", g10_errors_seen, 1);
+
+      rewind (fp);
+      TEST ("output length", fread (buffer, 1, explen + 1, fp), explen);
+      TEST ("output", memcmp (buffer, expected, explen), 0);
+    }
+
+  TEST_GROUP ("sequential");
+  opt.multifile_jobs = 1;
+  TEST ("not usable", multifile_usable (ctrl), 0);
+  opt.multifile_jobs = 2;
+  opt.batch = 0;
+  TEST ("not usable without --batch", multifile_usable (ctrl), 0);
+
+  set_status_fd (-1);
+  fclose (fp);
+  for (i = 0; i < NFILES; i++)
+    xfree (files[i]);
+  xfree (buffer);
+  xfree (expected);
+  xfree (ctrl);
+}
@@ -0,0 +1,129 @@
+/* t-objcache.c - Module test for the user id cache file of objcache.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include <unistd.h>
+
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "../common/sysutils.h"
+#include "objcache.h"
+
+
+/* Return true if the user id cached for FPR is the one of UID.  */
+static int
+cached_uid_is (const byte *fpr, size_t fprlen, PKT_user_id *uid)
+{
+  char *name;
+  size_t namelen;
+  int result;
+
+  name = cache_get_uid_byfpr (fpr, fprlen, &namelen);
+  result = (name && namelen == uid->len
+            && !memcmp (name, uid->name, namelen));
+  xfree (name);
+  return result;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  ctrl_t ctrl;
+  char *fname, *homedir;
+  int rc;
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock, n;
+  PKT_user_id *user_id = NULL;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+
+  (void) argc;
+  (void) argv;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  fname = prepend_srcdir ("t-keydb-get-keyblock.gpg");
+  rc = keydb_add_resource (fname, KEYDB_RESOURCE_FLAG_READONLY);
+  test_free (fname);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+  rc = classify_user_id ("8061 5870 F5BA D690 3336  86D0 F2AD 85AC 1E42 B367",
+			 &desc, 0);
+  if (rc)
+    ABORT ("Failed to convert fingerprint for 1E42B367");
+  rc = keydb_search (hd, &desc, 1, NULL);
+  if (!rc)
+    rc = keydb_get_keyblock (hd, &keyblock);
+  if (rc)
+    ABORT ("Failed to get keyblock for 1E42B367");
+  for (n = keyblock; n && !user_id; n = n->next)
+    if (n->pkt->pkttype == PKT_USER_ID)
+      user_id = n->pkt->pkt.user_id;
+  if (!user_id)
+    ABORT ("No user id found");
+  /* The keyblock has not been merged; thus set the flag here.  */
+  user_id->flags.primary = 1;
+  fingerprint_from_pk (keyblock->pkt->pkt.public_key, fpr, &fprlen);
+
+  homedir = xstrdup ("t-objcache-XXXXXX");
+  if (!gnupg_mkdtemp (homedir))
+    ABORT ("Failed to create a home directory");
+  gnupg_set_homedir (homedir);
+  fname = make_filename (homedir, UID_CACHE_NAME, NULL);
+  opt.persistent_uid_cache = 1;
+
+  TEST_GROUP ("memory");
+  TEST ("empty cache", cached_uid_is (fpr, fprlen, user_id), 0);
+  cache_put_keyblock (keyblock);
+  TEST ("cached user id", cached_uid_is (fpr, fprlen, user_id), 1);
+
+  TEST_GROUP ("file");
+  objcache_flush ();
+  objcache_release ();
+  TEST ("user id from the file", cached_uid_is (fpr, fprlen, user_id), 1);
+  objcache_release ();
+  opt.persistent_uid_cache = 0;
+  TEST ("file not used without the option",
+        cached_uid_is (fpr, fprlen, user_id), 0);
+  opt.persistent_uid_cache = 1;
+
+  TEST_GROUP ("invalidate");
+  objcache_release ();
+  objcache_invalidate_file ();
+  TEST ("file removed", !gnupg_access (fname, F_OK), 0);
+  cache_put_keyblock (keyblock);
+  objcache_flush ();
+  TEST ("no new file after a change", !gnupg_access (fname, F_OK), 0);
+
+  objcache_release ();
+  gnupg_remove (fname);
+  gnupg_rmdir (homedir);
+  xfree (fname);
+  xfree (homedir);
+  keydb_release (hd);
+  release_kbnode (keyblock);
+  xfree (ctrl);
+}
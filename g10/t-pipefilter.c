@@ -0,0 +1,151 @@
+/* t-pipefilter.c - Module test for pipefilter.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/iobuf.h"
+#include "filter.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                       exit (1);                                 \
+                    } while(0)
+
+#define DATALEN (1000*1000)
+
+static int verbose;
+static byte *data;
+
+
+/* Write LEN bytes through one or two pipe filters into a temp
+ * buffer in pieces of WRITELEN bytes.  */
+static void
+test_output (size_t len, size_t writelen, int nstages)
+{
+  iobuf_t a;
+  size_t off, n;
+  int i;
+
+  if (verbose)
+    printf ("output: %zu bytes, %d stages\n", len, nstages);
+
+  a = iobuf_temp ();
+  for (i = 0; i < nstages; i++)
+    if (push_pipe_filter (a))
+      fail (1);
+  for (off = 0; off < len; off += n)
+    {
+      n = len - off < writelen? len - off : writelen;
+      if (iobuf_write (a, data + off, n))
+        fail (2);
+    }
+  for (i = 0; i < nstages; i++)
+    if (iobuf_pop_filter (a, pipe_thd_filter, NULL))
+      fail (3);
+  if (iobuf_get_temp_length (a) != len
+      || memcmp (iobuf_get_temp_buffer (a), data, len))
+    fail (4);
+  iobuf_close (a);
+}
+
+
+/* Read LEN bytes through one or two pipe filters in pieces of
+ * READLEN bytes.  */
+static void
+test_input (size_t len, size_t readlen, int nstages)
+{
+  iobuf_t a;
+  byte *buf;
+  size_t off;
+  int i, n;
+
+  if (verbose)
+    printf ("input: %zu bytes, %d stages\n", len, nstages);
+
+  buf = xmalloc (readlen);
+  a = iobuf_temp_with_content ((const char *)data, len);
+  for (i = 0; i < nstages; i++)
+    if (push_pipe_filter (a))
+      fail (10);
+  for (off = 0; (n = iobuf_read (a, buf, readlen)) != -1; off += n)
+    {
+      if (off + n > len || memcmp (buf, data + off, n))
+        fail (11);
+    }
+  if (off != len || iobuf_error (a))
+    fail (12);
+  iobuf_close (a);
+  xfree (buf);
+}
+
+
+/* Close an input pipe before reading everything.  */
+static void
+test_input_early_close (void)
+{
+  iobuf_t a;
+  byte buf[100];
+
+  a = iobuf_temp_with_content ((const char *)data, DATALEN);
+  if (push_pipe_filter (a))
+    fail (20);
+  if (iobuf_read (a, buf, sizeof buf) != sizeof buf
+      || memcmp (buf, data, sizeof buf))
+    fail (21);
+  iobuf_close (a);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  static const size_t lengths[] = { 0, 1, 1000, 8192, 65536, DATALEN };
+  size_t i;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  npth_init ();
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  data = xmalloc (DATALEN);
+  gcry_create_nonce (data, DATALEN);
+
+  for (i = 0; i < DIM (lengths); i++)
+    {
+      test_output (lengths[i], 1000, 1);
+      test_output (lengths[i], 100000, 2);
+      if (!lengths[i])
+        continue;  /* A temp iobuf can't be created without content.  */
+      test_input (lengths[i], 777, 1);
+      test_input (lengths[i], 100000, 2);
+    }
+  test_input_early_close ();
+
+  xfree (data);
+  return 0;
+}
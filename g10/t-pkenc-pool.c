@@ -0,0 +1,157 @@
+/* t-pkenc-pool.c - Module test for pkenc-pool.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include <npth.h>
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "pkenc-pool.h"
+
+#define NKEYS 9
+
+
+/* Decrypt the RSA value ENC with SKEY and return true if it carries
+ * the session key of DEK.  */
+static int
+check_frame (gcry_sexp_t skey, PKT_pubkey_enc *enc, DEK *dek)
+{
+  gcry_sexp_t s_data = NULL;
+  gcry_sexp_t s_plain = NULL;
+  gcry_mpi_t plain = NULL;
+  unsigned char buf[256];
+  size_t n;
+  u16 csum = 0;
+  int i, ok = 0;
+
+  if (!enc->data[0]
+      || gcry_sexp_build (&s_data, NULL, "(enc-val(rsa(a%m)))",
+                          enc->data[0])
+      || gcry_pk_decrypt (&s_plain, s_data, skey))
+    goto leave;
+  plain = gcry_sexp_nth_mpi (s_plain, 0, GCRYMPI_FMT_USG);
+  if (!plain
+      || gcry_mpi_print (GCRYMPI_FMT_USG, buf, sizeof buf, &n, plain)
+      || n < dek->keylen + 4)
+    goto leave;
+
+  for (i = 0; i < dek->keylen; i++)
+    csum += dek->key[i];
+  ok = (!buf[n - dek->keylen - 4]
+        && buf[n - dek->keylen - 3] == dek->algo
+        && !memcmp (buf + n - dek->keylen - 2, dek->key, dek->keylen)
+        && buf[n - 2] == (csum >> 8) && buf[n - 1] == (csum & 0xff));
+
+ leave:
+  gcry_mpi_release (plain);
+  gcry_sexp_release (s_plain);
+  gcry_sexp_release (s_data);
+  return ok;
+}
+
+
+/* Encrypt DEK for NKEYS copies of the RSA key KEY using NTHREADS
+ * threads and return the number of correctly encrypted keys.  */
+static int
+run_pool (gcry_sexp_t key, DEK *dek, unsigned int nthreads, int *r_nerr)
+{
+  gcry_sexp_t pkey, skey;
+  PKT_public_key *pks[NKEYS];
+  PKT_pubkey_enc *encs[NKEYS];
+  gpg_error_t rcs[NKEYS];
+  gcry_mpi_t n, e;
+  int i, ngood = 0;
+
+  pkey = gcry_sexp_find_token (key, "public-key", 0);
+  skey = gcry_sexp_find_token (key, "private-key", 0);
+  if (!pkey || !skey
+      || gcry_sexp_extract_param (pkey, NULL, "ne", &n, &e, NULL))
+    ABORT ("Failed to extract the key parameters.");
+
+  for (i = 0; i < NKEYS; i++)
+    {
+      pks[i] = xcalloc (1, sizeof **pks);
+      pks[i]->version = 4;
+      pks[i]->timestamp = 1136073600 + i;
+      pks[i]->pubkey_algo = PUBKEY_ALGO_RSA;
+      pks[i]->pkey[0] = gcry_mpi_copy (n);
+      pks[i]->pkey[1] = gcry_mpi_copy (e);
+      encs[i] = xcalloc (1, sizeof **encs);
+      encs[i]->pubkey_algo = PUBKEY_ALGO_RSA;
+    }
+
+  pkenc_pool_encrypt (pks, encs, rcs, NKEYS, dek, nthreads);
+
+  *r_nerr = 0;
+  for (i = 0; i < NKEYS; i++)
+    {
+      if (rcs[i])
+        ++*r_nerr;
+      else if (check_frame (skey, encs[i], dek))
+        ngood++;
+      free_pubkey_enc (encs[i]);
+      free_public_key (pks[i]);
+    }
+
+  gcry_mpi_release (n);
+  gcry_mpi_release (e);
+  gcry_sexp_release (pkey);
+  gcry_sexp_release (skey);
+  return ngood;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  gcry_sexp_t parms, key;
+  DEK dek;
+  int nerr;
+
+  (void) argc;
+  (void) argv;
+
+  npth_init ();
+  gcry_control (GCRYCTL_INIT_SECMEM, 32768, 0);
+
+  if (gcry_sexp_build (&parms, NULL, "(genkey(rsa(nbits 4:1024)))")
+      || gcry_pk_genkey (&key, parms))
+    ABORT ("Failed to create an RSA key.");
+  gcry_sexp_release (parms);
+
+  memset (&dek, 0, sizeof dek);
+  dek.algo = CIPHER_ALGO_AES256;
+  dek.keylen = 32;
+  gcry_randomize (dek.key, dek.keylen, GCRY_STRONG_RANDOM);
+
+  TEST_GROUP ("main thread");
+  TEST ("keys encrypted", run_pool (key, &dek, 1, &nerr), NKEYS);
+  TEST ("no errors", nerr, 0);
+
+  TEST_GROUP ("worker threads");
+  TEST ("keys encrypted", run_pool (key, &dek, 4, &nerr), NKEYS);
+  TEST ("no errors", nerr, 0);
+
+  TEST_GROUP ("more threads than keys");
+  TEST ("keys encrypted", run_pool (key, &dek, 64, &nerr), NKEYS);
+  TEST ("no errors", nerr, 0);
+
+  gcry_sexp_release (key);
+}
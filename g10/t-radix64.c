@@ -0,0 +1,183 @@
+/* t-radix64.c - Module test for radix64.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/types.h"
+#include "radix64.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                       exit (1);                                 \
+                    } while(0)
+
+static int verbose;
+
+
+/* A tiny deterministic PRNG so that the test is reproducible.  */
+static unsigned int
+prng (void)
+{
+  static unsigned int state = 4711;
+
+  state = state * 1103515245 + 12345;
+  return (state >> 16) & 0x7fff;
+}
+
+
+static void
+test_vectors (void)
+{
+  static struct
+  {
+    const char *data;
+    const char *expect;
+  } testtbl[] =
+    {
+      { "", "" },
+      { "foo", "Zm9v" },
+      { "foobar", "Zm9vYmFy" },
+      { "\xfb\xff\xbf", "+/+/" },
+      { NULL, NULL }
+    };
+  unsigned char buf[64];
+  int idx;
+  size_t n, len;
+
+  for (idx=0; testtbl[idx].data; idx++)
+    {
+      len = strlen (testtbl[idx].data);
+      n = radix64_encode_block (buf, (const unsigned char *)testtbl[idx].data,
+                                len);
+      if (n != len || memcmp (buf, testtbl[idx].expect, n/3*4))
+        fail (idx);
+      len = strlen (testtbl[idx].expect);
+      n = radix64_decode_block (buf, (const unsigned char *)testtbl[idx].expect,
+                                len);
+      if (n != len || memcmp (buf, testtbl[idx].data, n/4*3))
+        fail (idx);
+    }
+}
+
+
+static void
+test_crc24 (void)
+{
+  static unsigned char data[1000], enc[1400], dec[1000];
+  u32 crc, crc2;
+  size_t i, n;
+
+  if (radix64_crc24 (RADIX64_CRC24_INIT, NULL, 0) != 0xb704ce)
+    fail (0);
+  if (radix64_crc24 (RADIX64_CRC24_INIT,
+                     (const unsigned char *)"123456789", 9) != 0x21cf02)
+    fail (1);
+
+  for (i = 0; i < sizeof data; i++)
+    data[i] = prng ();
+  /* Byte-wise updates must give the same result as one call.  */
+  crc = RADIX64_CRC24_INIT;
+  for (i = 0; i < sizeof data; i++)
+    crc = radix64_crc24 (crc, data + i, 1);
+  if (crc != radix64_crc24 (RADIX64_CRC24_INIT, data, sizeof data))
+    fail (2);
+
+  /* The fused decoder must compute the CRC over the decoded part.  */
+  n = radix64_encode_block (enc, data, 999);
+  enc[1000] = '=';
+  crc2 = RADIX64_CRC24_INIT;
+  n = radix64_decode_block_crc (dec, enc, 1332, &crc2);
+  if (n != 1000 || memcmp (dec, data, 750)
+      || crc2 != radix64_crc24 (RADIX64_CRC24_INIT, data, 750))
+    fail (3);
+}
+
+
+/* Compare the selected implementation against the scalar one.  */
+static void
+test_impl (int impl)
+{
+  enum { MAXLEN = 1000 };
+  static unsigned char data[MAXLEN], enc[MAXLEN*2], ref[MAXLEN*2];
+  static unsigned char dec[MAXLEN + 64];
+  size_t len, n, nref, pos;
+  int round, c;
+
+  for (round = 0; round < 200; round++)
+    {
+      len = prng () % MAXLEN;
+      for (n = 0; n < len; n++)
+        data[n] = prng ();
+
+      radix64_set_impl (RADIX64_IMPL_SCALAR);
+      nref = radix64_encode_block (ref, data, len);
+      radix64_set_impl (impl);
+      n = radix64_encode_block (enc, data, len);
+      if (n != nref || n != len/3*3 || memcmp (enc, ref, n/3*4))
+        fail (impl);
+
+      memset (dec, 0, sizeof dec);
+      n = radix64_decode_block (dec, enc, nref/3*4);
+      if (n != nref/3*4 || memcmp (dec, data, nref))
+        fail (impl);
+
+      /* Replace one character by a random, possibly invalid, one and
+       * check that all implementations stop at the same place.  */
+      if (!nref)
+        continue;
+      pos = prng () % (nref/3*4);
+      c = prng () & 0xff;
+      enc[pos] = c;
+      radix64_set_impl (RADIX64_IMPL_SCALAR);
+      nref = radix64_decode_block (ref, enc, n);
+      radix64_set_impl (impl);
+      n = radix64_decode_block (dec, enc, n);
+      if (n != nref || memcmp (dec, ref, n/4*3))
+        fail (impl);
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  static const int impls[] = { RADIX64_IMPL_SCALAR, RADIX64_IMPL_SSSE3,
+                               RADIX64_IMPL_AVX2, RADIX64_IMPL_NEON };
+  int i;
+
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  test_vectors ();
+  test_crc24 ();
+  for (i = 0; i < sizeof impls / sizeof *impls; i++)
+    {
+      if (radix64_set_impl (impls[i]))
+        continue;
+      if (verbose)
+        printf ("testing %s\n", radix64_impl_name ());
+      test_impl (impls[i]);
+    }
+
+  return 0;
+}
@@ -0,0 +1,136 @@
+/* t-sig-cache.c - Module test for sig-cache.c
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include "keydb.h"
+#include "main.h"
+#include "options.h"
+#include "../common/sysutils.h"
+#include "sig-cache.h"
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  ctrl_t ctrl;
+  char *fname, *homedir;
+  int rc, result;
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t keyblock, n;
+  PKT_public_key *pk;
+  PKT_signature *sig = NULL;
+  gcry_mpi_t good, bad, other;
+  estream_t fp;
+
+  (void) argc;
+  (void) argv;
+
+  ctrl = xcalloc (1, sizeof *ctrl);
+
+  fname = prepend_srcdir ("t-keydb-get-keyblock.gpg");
+  rc = keydb_add_resource (fname, KEYDB_RESOURCE_FLAG_READONLY);
+  test_free (fname);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+  hd = keydb_new (ctrl);
+  if (!hd)
+    ABORT ("");
+  rc = classify_user_id ("8061 5870 F5BA D690 3336  86D0 F2AD 85AC 1E42 B367",
+			 &desc, 0);
+  if (rc)
+    ABORT ("Failed to convert fingerprint for 1E42B367");
+  rc = keydb_search (hd, &desc, 1, NULL);
+  if (!rc)
+    rc = keydb_get_keyblock (hd, &keyblock);
+  if (rc)
+    ABORT ("Failed to get keyblock for 1E42B367");
+  pk = keyblock->pkt->pkt.public_key;
+  for (n = keyblock; n && !sig; n = n->next)
+    if (n->pkt->pkttype == PKT_SIGNATURE)
+      sig = n->pkt->pkt.signature;
+  if (!sig)
+    ABORT ("No signature found");
+
+  homedir = xstrdup ("t-sig-cache-XXXXXX");
+  if (!gnupg_mkdtemp (homedir))
+    ABORT ("Failed to create a home directory");
+  gnupg_set_homedir (homedir);
+  fname = make_filename (homedir, SIG_CACHE_NAME, NULL);
+  opt.persistent_sig_cache = 1;
+
+  /* The digests stand in for the values passed to pk_verify.  */
+  good = gcry_mpi_set_ui (NULL, 4711);
+  bad = gcry_mpi_set_ui (NULL, 42);
+  other = gcry_mpi_set_ui (NULL, 17);
+
+  TEST_GROUP ("lookup");
+  TEST ("empty cache", sig_cache_lookup (pk, sig, good, &result), 0);
+  sig_cache_store (pk, sig, good, 0);
+  sig_cache_store (pk, sig, bad, gpg_error (GPG_ERR_BAD_SIGNATURE));
+  sig_cache_store (pk, sig, other, gpg_error (GPG_ERR_NO_PUBKEY));
+  result = -1;
+  TEST ("good entry", sig_cache_lookup (pk, sig, good, &result), 1);
+  TEST ("good result", result, 0);
+  TEST ("bad entry", sig_cache_lookup (pk, sig, bad, &result), 1);
+  TEST ("bad result", gpg_err_code (result), GPG_ERR_BAD_SIGNATURE);
+  TEST ("other errors are not cached",
+        sig_cache_lookup (pk, sig, other, &result), 0);
+
+  TEST_GROUP ("file");
+  sig_cache_flush ();
+  sig_cache_release ();
+  result = -1;
+  TEST ("good entry", sig_cache_lookup (pk, sig, good, &result), 1);
+  TEST ("good result", result, 0);
+  TEST ("bad entry", sig_cache_lookup (pk, sig, bad, &result), 1);
+  TEST ("bad result", gpg_err_code (result), GPG_ERR_BAD_SIGNATURE);
+
+  /* Simulate an interrupted write.  */
+  sig_cache_release ();
+  fp = es_fopen (fname, "ab");
+  if (!fp || es_fwrite ("\x01\x02\x03", 3, 1, fp) != 1 || es_fclose (fp))
+    ABORT ("Failed to append to the cache file");
+  sig_cache_store (pk, sig, other, 0);
+  sig_cache_flush ();
+  sig_cache_release ();
+  TEST ("entry after truncated record",
+        sig_cache_lookup (pk, sig, other, &result), 1);
+  TEST ("entry before truncated record",
+        sig_cache_lookup (pk, sig, good, &result), 1);
+
+  TEST_GROUP ("disabled");
+  opt.no_sig_cache = 1;
+  TEST ("no lookup with --no-sig-cache",
+        sig_cache_lookup (pk, sig, good, &result), 0);
+  opt.no_sig_cache = 0;
+
+  sig_cache_release ();
+  gnupg_remove (fname);
+  gnupg_rmdir (homedir);
+  xfree (fname);
+  xfree (homedir);
+  gcry_mpi_release (good);
+  gcry_mpi_release (bad);
+  gcry_mpi_release (other);
+  keydb_release (hd);
+  release_kbnode (keyblock);
+  xfree (ctrl);
+}
@@ -0,0 +1,289 @@
+/* t-sigbatch.c - Tests for the batch verification of signatures
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include "lcr.h"
+#include "../common/util.h"
+#include "../common/openpgpdefs.h"
+#include "sigbatch.h"
+
+#define NKEYS 3
+#define NSIGS 40
+
+
+struct testkey_s
+{
+  gcry_sexp_t sec;
+  gcry_mpi_t pkey[2];
+};
+
+static struct testkey_s keys[NKEYS];
+static struct sigbatch_item_s items[NSIGS];
+static gcry_mpi_t sigdata[NSIGS][2];
+
+
+/* Create the Ed25519 key number I.  */
+static void
+make_key (int i)
+{
+  gcry_sexp_t parms, key, l;
+  const char *q;
+  size_t qlen;
+  byte buf[33];
+
+  if (gcry_sexp_new (&parms, "(genkey(ecc(curve Ed25519)(flags eddsa)))",
+                     0, 1)
+      || gcry_pk_genkey (&key, parms))
+    ABORT ("Failed to create an Ed25519 key.");
+  gcry_sexp_release (parms);
+  keys[i].sec = gcry_sexp_find_token (key, "private-key", 0);
+  l = gcry_sexp_find_token (key, "q", 0);
+  q = l? gcry_sexp_nth_data (l, 1, &qlen) : NULL;
+  if (!keys[i].sec || !q || (qlen != 32 && qlen != 33))
+    ABORT ("Failed to extract the Ed25519 key.");
+  buf[0] = 0x40;
+  memcpy (buf + 33 - qlen, q, qlen);
+  keys[i].pkey[1] = gcry_mpi_set_opaque_copy (NULL, buf, 8 * sizeof buf);
+  if (openpgp_oid_from_str ("1.3.6.1.4.1.11591.15.1", keys[i].pkey))
+    ABORT ("Failed to create the curve OID.");
+  gcry_sexp_release (l);
+  gcry_sexp_release (key);
+}
+
+
+/* Sign a random digest with KEY and store it as item number I the
+ * way the OpenPGP signature parser does.  */
+static void
+make_sig (int i, struct testkey_s *key)
+{
+  gcry_sexp_t s_data, s_sig, l;
+  byte digest[32];
+  const char *v;
+  size_t vlen;
+  int j;
+
+  gcry_randomize (digest, sizeof digest, GCRY_WEAK_RANDOM);
+  if (gcry_sexp_build (&s_data, NULL,
+                       "(data(flags eddsa)(hash-algo sha512)(value %b))",
+                       (int)sizeof digest, digest)
+      || gcry_pk_sign (&s_sig, s_data, key->sec))
+    ABORT ("Failed to sign.");
+  for (j = 0; j < 2; j++)
+    {
+      l = gcry_sexp_find_token (s_sig, j? "s" : "r", 0);
+      v = l? gcry_sexp_nth_data (l, 1, &vlen) : NULL;
+      if (!v
+          || gcry_mpi_scan (&sigdata[i][j], GCRYMPI_FMT_USG, v, vlen, NULL))
+        ABORT ("Failed to extract the signature.");
+      gcry_sexp_release (l);
+    }
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_data);
+
+  items[i].pubkey_algo = PUBKEY_ALGO_EDDSA;
+  items[i].pkey = key->pkey;
+  items[i].hash = gcry_mpi_set_opaque_copy (NULL, digest, 8 * sizeof digest);
+  items[i].data = sigdata[i];
+  items[i].verified = 0;
+}
+
+
+/* Return the number of verified items.  */
+static int
+count_verified (void)
+{
+  int i, n = 0;
+
+  for (i = 0; i < NSIGS; i++)
+    n += !!items[i].verified;
+  return n;
+}
+
+
+static void
+reset_items (void)
+{
+  int i;
+
+  for (i = 0; i < NSIGS; i++)
+    items[i].verified = 0;
+}
+
+
+/* Return the value S + L for the signature value S which is stored
+ * as little endian number.  Such an S satisfies the verification
+ * equation but is not valid.  */
+static gcry_mpi_t
+add_order (gcry_mpi_t s)
+{
+  byte buf[32], tmp[32];
+  gcry_mpi_t l, a;
+  size_t n;
+  int i;
+
+  memset (buf, 0, sizeof buf);
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, NULL, 0, &n, s) || n > 32
+      || gcry_mpi_print (GCRYMPI_FMT_USG, buf + 32 - n, n, NULL, s))
+    ABORT ("Failed to print S.");
+  for (i = 0; i < 32; i++)
+    tmp[i] = buf[31 - i];
+  if (gcry_mpi_scan (&a, GCRYMPI_FMT_USG, tmp, 32, NULL)
+      || gcry_mpi_scan (&l, GCRYMPI_FMT_HEX,
+                        "1000000000000000000000000000000014DEF9DEA2F79CD6"
+                        "5812631A5CF5D3ED", 0, NULL))
+    ABORT ("Failed to scan S.");
+  gcry_mpi_add (a, a, l);
+  memset (tmp, 0, sizeof tmp);
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, NULL, 0, &n, a) || n > 32
+      || gcry_mpi_print (GCRYMPI_FMT_USG, tmp + 32 - n, n, NULL, a))
+    ABORT ("S + L does not fit.");
+  for (i = 0; i < 32; i++)
+    buf[i] = tmp[31 - i];
+  gcry_mpi_release (a);
+  gcry_mpi_release (l);
+  if (gcry_mpi_scan (&a, GCRYMPI_FMT_USG, buf, 32, NULL))
+    ABORT ("Failed to scan S + L.");
+  return a;
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  gcry_mpi_t saved;
+  gcry_mpi_t p256[2];
+  int i;
+
+  (void) argc;
+  (void) argv;
+
+  for (i = 0; i < NKEYS; i++)
+    make_key (i);
+  /* Most signatures are from the first key.  */
+  for (i = 0; i < NSIGS; i++)
+    make_sig (i, keys + (i % 4 < NKEYS? i % 4 : 0));
+
+  TEST_GROUP ("good signatures");
+  TEST ("supported", sigbatch_supported (items[0].pubkey_algo, keys[0].pkey),
+        1);
+  TEST ("all verified", sigbatch_verify (items, NSIGS), NSIGS);
+  TEST ("all marked", count_verified (), NSIGS);
+
+  TEST_GROUP ("too few signatures");
+  reset_items ();
+  TEST ("none verified", sigbatch_verify (items, SIGBATCH_MIN_ITEMS - 1), 0);
+
+  TEST_GROUP ("one bad signature");
+  reset_items ();
+  saved = items[17].hash;
+  items[17].hash = items[18].hash;
+  TEST ("others verified", sigbatch_verify (items, NSIGS) < NSIGS, 1);
+  TEST ("bad one not marked", items[17].verified, 0);
+  TEST ("most marked", count_verified () >= NSIGS - 2 * SIGBATCH_MIN_ITEMS,
+        1);
+  items[17].hash = saved;
+
+  TEST_GROUP ("wrong key");
+  reset_items ();
+  items[5].pkey = keys[(5 % 4 + 1) % NKEYS].pkey;
+  sigbatch_verify (items, NSIGS);
+  TEST ("bad one not marked", items[5].verified, 0);
+  items[5].pkey = keys[5 % 4 < NKEYS? 5 % 4 : 0].pkey;
+
+  TEST_GROUP ("non-canonical S");
+  reset_items ();
+  saved = sigdata[9][1];
+  sigdata[9][1] = add_order (saved);
+  TEST ("others verified", sigbatch_verify (items, NSIGS), NSIGS - 1);
+  TEST ("S + L not marked", items[9].verified, 0);
+  gcry_mpi_release (sigdata[9][1]);
+  sigdata[9][1] = saved;
+
+  TEST_GROUP ("memo");
+  reset_items ();
+  sigbatch_verify (items, NSIGS);
+  for (i = 0; i < NSIGS; i++)
+    sigbatch_remember (items + i);
+  TEST ("remembered", sigbatch_lookup (PUBKEY_ALGO_EDDSA, items[3].pkey,
+                                       items[3].hash, items[3].data), 1);
+  TEST ("other hash", sigbatch_lookup (PUBKEY_ALGO_EDDSA, items[3].pkey,
+                                       items[4].hash, items[3].data), 0);
+  TEST ("other key", sigbatch_lookup (PUBKEY_ALGO_EDDSA,
+                                      keys[(3 % 4 + 1) % NKEYS].pkey,
+                                      items[3].hash, items[3].data), 0);
+
+  TEST_GROUP ("memo for other algorithms");
+  {
+    struct sigbatch_item_s rsa;
+    gcry_mpi_t rsakey[3], rsasig[2], othersig[2];
+
+    rsakey[0] = gcry_mpi_new (2048);
+    gcry_mpi_randomize (rsakey[0], 2048, GCRY_WEAK_RANDOM);
+    rsakey[1] = gcry_mpi_set_ui (NULL, 65537);
+    rsakey[2] = NULL;
+    rsasig[0] = gcry_mpi_new (2048);
+    gcry_mpi_randomize (rsasig[0], 2048, GCRY_WEAK_RANDOM);
+    rsasig[1] = NULL;
+    othersig[0] = gcry_mpi_copy (rsasig[0]);
+    gcry_mpi_add_ui (othersig[0], othersig[0], 1);
+    othersig[1] = NULL;
+    memset (&rsa, 0, sizeof rsa);
+    rsa.pubkey_algo = PUBKEY_ALGO_RSA;
+    rsa.pkey = rsakey;
+    rsa.hash = items[0].hash;
+    rsa.data = rsasig;
+
+    sigbatch_remember (&rsa);
+    TEST ("not verified", sigbatch_lookup (PUBKEY_ALGO_RSA, rsakey,
+                                           rsa.hash, rsasig), 0);
+    rsa.verified = 1;
+    sigbatch_remember (&rsa);
+    TEST ("remembered", sigbatch_lookup (PUBKEY_ALGO_RSA, rsakey,
+                                         rsa.hash, rsasig), 1);
+    TEST ("other signature", sigbatch_lookup (PUBKEY_ALGO_RSA, rsakey,
+                                              rsa.hash, othersig), 0);
+    TEST ("other hash", sigbatch_lookup (PUBKEY_ALGO_RSA, rsakey,
+                                         items[1].hash, rsasig), 0);
+    gcry_mpi_release (rsakey[0]);
+    gcry_mpi_release (rsakey[1]);
+    gcry_mpi_release (rsasig[0]);
+    gcry_mpi_release (othersig[0]);
+  }
+
+  TEST_GROUP ("unsupported curve");
+  if (openpgp_oid_from_str ("1.2.840.10045.3.1.7", p256))
+    ABORT ("Failed to create the curve OID.");
+  p256[1] = keys[0].pkey[1];
+  TEST ("not supported", sigbatch_supported (PUBKEY_ALGO_EDDSA, p256), 0);
+  gcry_mpi_release (p256[0]);
+
+  for (i = 0; i < NSIGS; i++)
+    {
+      gcry_mpi_release (items[i].hash);
+      gcry_mpi_release (sigdata[i][0]);
+      gcry_mpi_release (sigdata[i][1]);
+    }
+  for (i = 0; i < NKEYS; i++)
+    {
+      gcry_sexp_release (keys[i].sec);
+      gcry_mpi_release (keys[i].pkey[0]);
+      gcry_mpi_release (keys[i].pkey[1]);
+    }
+}
@@ -50,33 +50,54 @@
 
 
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache.  Each cached record is kept in a hash table
+ * indexed by its record number and on one of two LRU lists: one for
+ * clean records and one for dirty records.  When the cache is full
+ * the least recently used clean record is recycled.  Dirty records
+ * are never written one by one; instead all of them are written back
+ * in a batch ordered by their record numbers.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct
 {
-  CACHE_CTRL next;
+  CACHE_CTRL next;      /* Next item in the same hash bucket.  */
+  CACHE_CTRL lru_prev;  /* Next more recently used item.  */
+  CACHE_CTRL lru_next;  /* Next less recently used item.  */
   struct {
-    unsigned used:1;
     unsigned dirty:1;
   } flags;
   ulong recno;
   char data[TRUST_RECORD_LEN];
 };
 
-/* Size of the cache.  The SOFT value is the general one.  While in a
-   transaction this may not be sufficient and thus we may increase it
-   then up to the HARD limit.  */
-#define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+/* A list of cache items with the most recently used one at HEAD.  */
+struct cache_lru_s
+{
+  CACHE_CTRL head;
+  CACHE_CTRL tail;
+  unsigned int count;
+};
+
+/* Size of the cache in records.  The default may be changed with
+   --trustdb-cache-size.  While in a transaction dirty records are
+   not written back and thus the cache may grow up to HARD_FACTOR
+   times that size.  */
+#define DEFAULT_CACHE_ENTRIES  4096
+#define MIN_CACHE_ENTRIES        64
+#define MAX_CACHE_ENTRIES      (1u << 22)
+#define CACHE_HARD_FACTOR        16
 
+/* The maximum number of adjacent records combined into one write.  */
+#define MAX_WRITE_BATCH          64
 
-/* The cache is controlled by these variables.  */
-static CACHE_CTRL cache_list;
-static int cache_entries;
-static int cache_is_dirty;
+
+/* The cache is controlled by these variables.  The size of the hash
+   table is always a power of 2.  */
+static CACHE_CTRL *cache_table;
+static unsigned int cache_table_size;
+static unsigned int cache_limit;
+static struct cache_lru_s cache_clean;
+static struct cache_lru_s cache_dirty;
 
 
 /* An object to pass information to cmp_krec_fpr. */
@@ -107,12 +128,47 @@ static unsigned int is_locked;
 /* The file descriptor of the trustdb.  */
 static int  db_fd = -1;
 
-/* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+/* A flag indicating that a transaction is active and a flag telling
+   that records have already been written during that transaction.  */
+static int in_transaction;
+static int tx_written;
+
+
+/*
+ * An in-memory index of the trust records.  This is an open
+ * addressing hash table mapping fingerprints to record numbers.  It
+ * is built by a linear scan of the trustdb once a process does more
+ * than a few lookups and then kept in sync whenever a trust record
+ * is written or deleted.  The on-disk hash table is still maintained
+ * because other processes and versions rely on it.
+ */
+struct trust_index_slot_s
+{
+  u32 recno;      /* 0 for an empty slot or TRUST_INDEX_DELETED.  */
+  byte fpr[20];
+};
+#define TRUST_INDEX_DELETED   0xffffffff
+#define TRUST_INDEX_MIN_SIZE  1024
+
+/* The number of lookups done via the on-disk hash table before the
+   index is built.  This avoids the scan for short running commands. */
+#define TRUST_INDEX_THRESHOLD   32
+
+static struct
+{
+  struct trust_index_slot_s *slots;
+  unsigned int size;      /* Number of slots; always a power of 2.  */
+  unsigned int used;      /* Number of slots with a record.  */
+  unsigned int filled;    /* USED plus the number of deleted slots.  */
+  unsigned int lookups;   /* Lookups done without the index.  */
+  off_t file_size;        /* Size and mtime of the trustdb after the */
+  time_t file_mtime;      /* last write by this process.             */
+} trust_index;
 
 
 
 static void open_db (void);
+static void trust_index_note_write (void);
 static void create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type);
 
 
@@ -153,6 +209,35 @@ take_write_lock (void)
 }
 
 
+/*
+ * Take a shared lock on the trustdb file name.  This only waits for
+ * processes holding the write lock.  It must not be used while the
+ * write lock is held and is released with release_read_lock.  If the
+ * lock can't be taken the function terminates the process.
+ */
+static void
+take_read_lock (void)
+{
+  if (!lockhandle)
+    lockhandle = dotlock_create (db_name, 0);
+  if (!lockhandle)
+    log_fatal ( _("can't create lock for '%s'\n"), db_name );
+
+  log_assert (!is_locked);
+  if (dotlock_take_shared (lockhandle, -1))
+    log_fatal ( _("can't lock '%s'\n"), db_name );
+}
+
+
+/* Release the lock taken by take_read_lock.  */
+static void
+release_read_lock (void)
+{
+  if (dotlock_release (lockhandle))
+    log_error ("Oops, tdbio:release_read_lock failed\n");
+}
+
+
 /*
  * Release a lock from the trustdb file unless the global option
  * --lock-once has been used.
@@ -181,6 +266,123 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
+/* Allocate the hash table of the cache on first use.  */
+static void
+init_cache (void)
+{
+  unsigned int n;
+
+  if (cache_table)
+    return;
+
+  cache_limit = opt.trustdb_cache_size;
+  if (!cache_limit)
+    cache_limit = DEFAULT_CACHE_ENTRIES;
+  else if (cache_limit < MIN_CACHE_ENTRIES)
+    cache_limit = MIN_CACHE_ENTRIES;
+  else if (cache_limit > MAX_CACHE_ENTRIES)
+    cache_limit = MAX_CACHE_ENTRIES;
+
+  for (n = MIN_CACHE_ENTRIES; n < cache_limit; n <<= 1)
+    ;
+  cache_table_size = n;
+  cache_table = xcalloc (cache_table_size, sizeof *cache_table);
+}
+
+
+/* Remove item R from the list LRU.  */
+static void
+lru_unlink (struct cache_lru_s *lru, CACHE_CTRL r)
+{
+  if (r->lru_prev)
+    r->lru_prev->lru_next = r->lru_next;
+  else
+    lru->head = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    lru->tail = r->lru_prev;
+  r->lru_prev = r->lru_next = NULL;
+  lru->count--;
+}
+
+
+/* Insert item R as the most recently used one into the list LRU.  */
+static void
+lru_push (struct cache_lru_s *lru, CACHE_CTRL r)
+{
+  r->lru_prev = NULL;
+  r->lru_next = lru->head;
+  if (lru->head)
+    lru->head->lru_prev = r;
+  else
+    lru->tail = r;
+  lru->head = r;
+  lru->count++;
+}
+
+
+/* Return the LRU list holding item R.  */
+static struct cache_lru_s *
+lru_of (CACHE_CTRL r)
+{
+  return r->flags.dirty? &cache_dirty : &cache_clean;
+}
+
+
+/* Return the hash bucket for record number RECNO.  */
+static CACHE_CTRL *
+cache_bucket (ulong recno)
+{
+  return cache_table + (recno & (cache_table_size - 1));
+}
+
+
+/* Remove item R from the hash table.  */
+static void
+cache_unhash (CACHE_CTRL r)
+{
+  CACHE_CTRL *rp;
+
+  for (rp = cache_bucket (r->recno); *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  r->next = NULL;
+}
+
+
+/* Drop all clean records from the cache.  */
+static void
+drop_clean_records (void)
+{
+  CACHE_CTRL r;
+
+  while ((r = cache_clean.head))
+    {
+      lru_unlink (&cache_clean, r);
+      cache_unhash (r);
+      xfree (r);
+    }
+}
+
+
+/* Return the cache item for record RECNO or NULL.  */
+static CACHE_CTRL
+lookup_cache_item (ulong recno)
+{
+  CACHE_CTRL r;
+
+  init_cache ();
+  for (r = *cache_bucket (recno); r; r = r->next)
+    if (r->recno == recno)
+      return r;
+  return NULL;
+}
+
+
 /*
  * Get the data from the record cache and return a pointer into that
  * cache.  Caller should copy the returned data.  NULL is returned on
@@ -191,225 +393,236 @@ get_record_from_cache (ulong recno)
 {
   CACHE_CTRL r;
 
-  for (r = cache_list; r; r = r->next)
+  r = lookup_cache_item (recno);
+  if (!r)
+    return NULL;
+  if (lru_of (r)->head != r)
     {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
+      lru_unlink (lru_of (r), r);
+      lru_push (lru_of (r), r);
     }
-  return NULL;
+  return r->data;
 }
 
 
 /*
- * Write a cached item back to the trustdb file.
+ * Write the N records in BUFFER starting at record number RECNO to
+ * the trustdb file.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-write_cache_item (CACHE_CTRL r)
+write_records (ulong recno, const char *buffer, unsigned int n)
 {
   gpg_error_t err;
-  int n;
+  int nwritten;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+  if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
+                 recno, strerror (errno));
       return err;
     }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
-  if (n != TRUST_RECORD_LEN)
+  nwritten = write (db_fd, buffer, n * TRUST_RECORD_LEN);
+  if (nwritten != n * TRUST_RECORD_LEN)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
+                 recno, nwritten, strerror (errno) );
       return err;
     }
-  r->flags.dirty = 0;
+  trust_index_note_write ();
   return 0;
 }
 
 
+/* qsort helper to sort cache items by their record number.  */
+static int
+cmp_cache_recno (const void *a, const void *b)
+{
+  CACHE_CTRL ra = *(const CACHE_CTRL *)a;
+  CACHE_CTRL rb = *(const CACHE_CTRL *)b;
+
+  return ra->recno < rb->recno? -1 : ra->recno > rb->recno;
+}
+
+
 /*
- * Put data into the cache.  This function may flush
- * some cache entries if the cache is filled up.
+ * Write all dirty records back to the trustdb file.  The records are
+ * written in the order of their record numbers and runs of adjacent
+ * records are combined into one write.  The written records stay in
+ * the cache as clean records.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-put_record_into_cache (ulong recno, const char *data)
+write_dirty_records (void)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  gpg_error_t err = 0;
+  char buffer[MAX_WRITE_BATCH * TRUST_RECORD_LEN];
+  CACHE_CTRL *vec, r, rprev;
+  unsigned int nvec, i, j, n;
 
-  /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  if (!cache_dirty.count)
+    return 0;
+
+  nvec = cache_dirty.count;
+  vec = xtrymalloc (nvec * sizeof *vec);
+  if (!vec)
+    return gpg_error_from_syserror ();
+  for (n = 0, r = cache_dirty.head; r; r = r->lru_next)
+    vec[n++] = r;
+  log_assert (n == nvec);
+  qsort (vec, nvec, sizeof *vec, cmp_cache_recno);
+
+  take_write_lock ();
+  for (i = 0; i < nvec && !err; i = j)
     {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
-        {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
+      for (j = i + 1; (j < nvec && j - i < MAX_WRITE_BATCH
+                       && vec[j]->recno == vec[j-1]->recno + 1); j++)
+        ;
+      for (n = i; n < j; n++)
+        memcpy (buffer + (n - i) * TRUST_RECORD_LEN,
+                vec[n]->data, TRUST_RECORD_LEN);
+      err = write_records (vec[i]->recno, buffer, j - i);
+      if (!err)
+        for (n = i; n < j; n++)
+          vec[n]->flags.dirty = 0;
     }
+  release_write_lock ();
+  xfree (vec);
 
-  /* Not in the cache: add a new entry. */
-  if (unused)
+  if (in_transaction)
+    tx_written = 1;
+
+  /* Move the written records to the clean list.  Walking from the
+   * tail keeps their relative order of use.  */
+  for (r = cache_dirty.tail; r; r = rprev)
     {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      rprev = r->lru_prev;
+      if (!r->flags.dirty)
+        {
+          lru_unlink (&cache_dirty, r);
+          lru_push (&cache_clean, r);
+        }
     }
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
+  return err;
+}
+
+
+/*
+ * Return an unused cache item.  If the cache is full the least
+ * recently used clean item is recycled.  If there are no clean items
+ * the cache grows while in a transaction or all dirty records are
+ * written back first.  If ONLY_CLEAN is set NULL is returned instead
+ * of growing the cache or writing records; this is used to cache
+ * records read from the file.
+ */
+static CACHE_CTRL
+new_cache_item (int only_clean, gpg_error_t *r_err)
+{
+  CACHE_CTRL r;
+  unsigned int nentries = cache_clean.count + cache_dirty.count;
+
+  *r_err = 0;
+  if (nentries >= cache_limit && !cache_clean.count)
     {
-      /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      if (only_clean)
+        return NULL;
+      if (!in_transaction || nentries >= cache_limit * CACHE_HARD_FACTOR)
+        {
+          if (in_transaction && DBG_CACHE)
+            log_debug ("tdbio: transaction too large for the cache;"
+                       " writing %u records\n", cache_dirty.count);
+          *r_err = write_dirty_records ();
+          if (*r_err)
+            return NULL;
+        }
     }
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
+  if (nentries >= cache_limit && cache_clean.count)
     {
-      int n;
+      r = cache_clean.tail;
+      lru_unlink (&cache_clean, r);
+      cache_unhash (r);
+      return r;
+    }
 
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
-      if (!n)
-        n = 1;
+  r = xtrycalloc (1, sizeof *r);
+  if (!r)
+    *r_err = gpg_error_from_syserror ();
+  return r;
+}
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
+/* Insert a new cache item for record RECNO with DATA.  */
+static void
+insert_cache_item (CACHE_CTRL r, ulong recno, const char *data, int dirty)
+{
+  CACHE_CTRL *bucket = cache_bucket (recno);
+
+  r->recno = recno;
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  r->flags.dirty = !!dirty;
+  r->next = *bucket;
+  *bucket = r;
+  lru_push (lru_of (r), r);
+}
 
-  /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
-  if (in_transaction)
+
+/*
+ * Put DATA of the record RECNO into the cache.  This function may
+ * write back dirty entries if the cache is filled up.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+put_record_into_cache (ulong recno, const char *data)
+{
+  gpg_error_t err;
+  CACHE_CTRL r;
+
+  init_cache ();
+
+  /* See whether we already cached this one.  */
+  for (r = *cache_bucket (recno); r; r = r->next)
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
+      if (r->recno == recno)
         {
-          if (opt.debug && !(cache_entries % 100))
-            log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
+          lru_unlink (lru_of (r), r);
+          /* A record which did not change stays clean.  */
+          if (memcmp (r->data, data, TRUST_RECORD_LEN))
+            {
+              memcpy (r->data, data, TRUST_RECORD_LEN);
+              r->flags.dirty = 1;
+            }
+          lru_push (lru_of (r), r);
           return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+        }
     }
-#endif
 
-  if (dirty_count)
-    {
-      int n;
-
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
-      if (!n)
-        n = 1;
+  /* Not in the cache: add a new entry. */
+  r = new_cache_item (0, &err);
+  if (!r)
+    return err;
+  insert_cache_item (r, recno, data, 1);
+  return 0;
+}
 
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              int rc;
 
-              rc = write_cache_item (r);
-              if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-      release_write_lock ();
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
+/* Put the just read DATA of record RECNO into the cache as long as
+ * this does not require to write back dirty records.  */
+static void
+put_clean_record_into_cache (ulong recno, const char *data)
+{
+  gpg_error_t err;
+  CACHE_CTRL r;
 
-  /* We should never reach this.  */
-  BUG();
+  r = new_cache_item (1, &err);
+  if (r)
+    insert_cache_item (r, recno, data, 0);
 }
 
 
@@ -417,58 +630,38 @@ put_record_into_cache (ulong recno, const char *data)
 int
 tdbio_is_dirty (void)
 {
-  return cache_is_dirty;
+  return !!cache_dirty.count;
 }
 
 
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction this does nothing; the
+ * records are then written by tdbio_end_transaction.
  */
 int
 tdbio_sync (void)
 {
-    CACHE_CTRL r;
-    int did_lock = 0;
-
-    if( db_fd == -1 )
-	open_db();
-#if 0 /* Transactions are not yet used.  */
-    if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
-
-    if( !cache_is_dirty )
-	return 0;
-
-    if (!take_write_lock ())
-        did_lock = 1;
-
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
-    cache_is_dirty = 0;
-    if (did_lock)
-        release_write_lock ();
+  if (db_fd == -1)
+    open_db ();
 
+  if (in_transaction)
     return 0;
+
+  return write_dirty_records ();
 }
 
 
-#if 0  /* Not yet used.  */
 /*
  * Simple transactions system:
  * Everything between begin_transaction and end/cancel_transaction
  * is not immediately written but at the time of end_transaction.
- *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * There all records are written in one ordered batch followed by a
+ * single fsync.  If a transaction grows beyond the hard limit of the
+ * cache, dirty records are written early; they are thus not undone
+ * by a cancel.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_transaction (void)
 {
   int rc;
 
@@ -479,27 +672,41 @@ tdbio_begin_transaction ()  /* Not yet used.  */
   if (rc)
     return rc;
   in_transaction = 1;
+  tx_written = 0;
   return 0;
 }
 
+
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction (void)
 {
   int rc;
+  int need_fsync;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
+  in_transaction = 0;
+  need_fsync = tx_written || cache_dirty.count;
   take_write_lock ();
   gnupg_block_all_signals ();
-  in_transaction = 0;
-  rc = tdbio_sync();
+  rc = write_dirty_records ();
+#ifdef HAVE_FSYNC
+  if (!rc && need_fsync && fsync (db_fd))
+    {
+      rc = gpg_error_from_syserror ();
+      log_error (_("trustdb: fsync failed: %s\n"), gpg_strerror (rc));
+    }
+#else
+  (void)need_fsync;
+#endif
   gnupg_unblock_all_signals();
   release_write_lock ();
   return rc;
 }
 
+
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction (void)
 {
   CACHE_CTRL r;
 
@@ -508,26 +715,240 @@ tdbio_cancel_transaction () /* Not yet used.  */
 
   /* Remove all dirty marked entries, so that the original ones are
    * read back the next time.  */
-  if (cache_is_dirty)
+  while ((r = cache_dirty.head))
     {
-      for (r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
-	}
-      cache_is_dirty = 0;
+      lru_unlink (&cache_dirty, r);
+      cache_unhash (r);
+      xfree (r);
     }
 
   in_transaction = 0;
   return 0;
 }
-#endif  /* Not yet used.  */
 
 
-
+
+/*************************************
+ ************* trust index ***********
+ *************************************/
+
+/* Release the trust index.  */
+static void
+trust_index_release (void)
+{
+  xfree (trust_index.slots);
+  trust_index.slots = NULL;
+  trust_index.size = trust_index.used = trust_index.filled = 0;
+}
+
+
+/* Remember the state of the trustdb file after a write by us so that
+ * changes by other processes can be detected.  */
+static void
+trust_index_note_write (void)
+{
+  struct stat st;
+
+  if (!trust_index.slots)
+    return;
+  if (fstat (db_fd, &st))
+    trust_index_release ();
+  else
+    {
+      trust_index.file_size = st.st_size;
+      trust_index.file_mtime = st.st_mtime;
+    }
+}
+
+
+/* Return true if the trustdb file was changed by another process
+ * since we built the index or wrote to it.  */
+static int
+trust_index_is_stale (void)
+{
+  struct stat st;
+
+  if (fstat (db_fd, &st))
+    return 1;
+  return (st.st_size != trust_index.file_size
+          || st.st_mtime != trust_index.file_mtime);
+}
+
+
+/* Return the slot for fingerprint FPR.  This is either the slot
+ * holding FPR or the slot where FPR shall be inserted.  */
+static struct trust_index_slot_s *
+trust_index_find (const byte *fpr)
+{
+  struct trust_index_slot_s *slot, *unused = NULL;
+  unsigned int mask = trust_index.size - 1;
+  unsigned int idx;
+
+  for (idx = buf32_to_uint (fpr) & mask; ; idx = (idx + 1) & mask)
+    {
+      slot = trust_index.slots + idx;
+      if (!slot->recno)
+        return unused? unused : slot;
+      if (slot->recno == TRUST_INDEX_DELETED)
+        {
+          if (!unused)
+            unused = slot;
+        }
+      else if (!memcmp (slot->fpr, fpr, 20))
+        return slot;
+    }
+}
+
+
+/* Resize the index so that it has room for at least one more record.
+ * Returns false on a memory shortage.  */
+static int
+trust_index_make_room (void)
+{
+  struct trust_index_slot_s *oldslots = trust_index.slots;
+  unsigned int oldsize = trust_index.size;
+  unsigned int newsize, i;
+
+  /* Keep the load including the deleted slots below one half.  */
+  if ((trust_index.filled + 1) * 2 <= trust_index.size)
+    return 1;
+
+  for (newsize = TRUST_INDEX_MIN_SIZE;
+       newsize < (trust_index.used + 1) * 4; newsize <<= 1)
+    ;
+  trust_index.slots = xtrycalloc (newsize, sizeof *trust_index.slots);
+  if (!trust_index.slots)
+    {
+      trust_index.slots = oldslots;
+      return 0;
+    }
+  trust_index.size = newsize;
+  trust_index.filled = trust_index.used;
+  for (i = 0; i < oldsize; i++)
+    if (oldslots[i].recno && oldslots[i].recno != TRUST_INDEX_DELETED)
+      *trust_index_find (oldslots[i].fpr) = oldslots[i];
+  xfree (oldslots);
+  return 1;
+}
+
+
+/* Record that the trust record for FPR is at RECNO.  */
+static void
+trust_index_put (const byte *fpr, ulong recno)
+{
+  struct trust_index_slot_s *slot;
+
+  if (!trust_index.slots)
+    return;
+  if (!trust_index_make_room ())
+    {
+      trust_index_release ();
+      return;
+    }
+
+  slot = trust_index_find (fpr);
+  if (!slot->recno || slot->recno == TRUST_INDEX_DELETED)
+    {
+      if (!slot->recno)
+        trust_index.filled++;
+      trust_index.used++;
+      memcpy (slot->fpr, fpr, 20);
+    }
+  slot->recno = recno;
+}
+
+
+/* Remove the trust record RECNO for FPR from the index.  */
+static void
+trust_index_drop (const byte *fpr, ulong recno)
+{
+  struct trust_index_slot_s *slot;
+
+  if (!trust_index.slots)
+    return;
+  slot = trust_index_find (fpr);
+  if (slot->recno == recno)
+    {
+      slot->recno = TRUST_INDEX_DELETED;
+      trust_index.used--;
+    }
+}
+
+
+/*
+ * Build the trust index by reading the entire trustdb.  Records
+ * still dirty in the cache take precedence over the file.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static gpg_error_t
+build_trust_index (void)
+{
+  gpg_error_t err = 0;
+  enum { NRECS = 256 };
+  char *buffer;
+  const char *p;
+  CACHE_CTRL r;
+  ulong recno = 0;
+  int i, n;
+
+  trust_index_release ();
+  trust_index.size = TRUST_INDEX_MIN_SIZE;
+  trust_index.slots = xtrycalloc (trust_index.size, sizeof *trust_index.slots);
+  buffer = xtrymalloc (NRECS * TRUST_RECORD_LEN);
+  if (!trust_index.slots || !buffer)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  trust_index_note_write ();
+
+  for (;;)
+    {
+      if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb: lseek failed: %s\n"), strerror (errno));
+          goto leave;
+        }
+      n = read (db_fd, buffer, NRECS * TRUST_RECORD_LEN);
+      if (n < 0)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb: read failed (n=%d): %s\n"),
+                     n, strerror (errno));
+          goto leave;
+        }
+      n /= TRUST_RECORD_LEN;
+      if (!n)
+        break;
+      for (i = 0; i < n; i++, recno++)
+        {
+          r = lookup_cache_item (recno);
+          p = r? r->data : buffer + i * TRUST_RECORD_LEN;
+          if (*p == RECTYPE_TRUST)
+            trust_index_put (p + 2, recno);
+        }
+      if (!trust_index.slots)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  if (DBG_CACHE)
+    log_debug ("tdbio: trust index built with %u of %lu records\n",
+               trust_index.used, recno);
+
+ leave:
+  if (err)
+    trust_index_release ();
+  xfree (buffer);
+  return err;
+}
+
+
+
 /********************************************************
  **************** cached I/O functions ******************
  ********************************************************/
@@ -712,6 +1133,22 @@ tdbio_set_dbname (ctrl_t ctrl, const char *new_dbname,
     }
   *p = save_slash;
 
+  /* Usually the trustdb exists; then we only need to wait for a
+   * process creating it and a shared lock suffices.  This way
+   * processes which only read don't serialize here.  */
+  if (!opt.lock_once && !is_locked)
+    {
+      int exists;
+
+      take_read_lock ();
+      exists = (!gnupg_access (fname, R_OK)
+                && !gnupg_stat (fname, &statbuf)
+                && statbuf.st_size);
+      release_read_lock ();
+      if (exists)
+        return 0;
+    }
+
   take_write_lock ();
 
   if (gnupg_access (fname, R_OK)
@@ -806,6 +1243,43 @@ open_db (void)
 }
 
 
+/*
+ * Forget the trustdb handles inherited from the parent process so
+ * that a forked process opens the trustdb itself and does not share
+ * the file offset with the parent.  The lock handle is dropped
+ * without releasing it because the lock files belong to the parent.
+ */
+void
+tdbio_reset_after_fork (void)
+{
+  if (db_fd != -1)
+    {
+      close (db_fd);
+      db_fd = -1;
+    }
+  if (!is_locked)
+    lockhandle = NULL;
+
+  /* Other processes may now change the trustdb; thus do not trust
+   * records we read earlier.  */
+  drop_clean_records ();
+  trust_index_release ();
+}
+
+
+/*
+ * Drop the cached records and the trust index because another
+ * process may have changed the trustdb.  Records not yet written are
+ * kept.
+ */
+void
+tdbio_invalidate_cache (void)
+{
+  drop_clean_records ();
+  trust_index_release ();
+}
+
+
 /*
  * Append a new empty hashtable to the trustdb.  TYPE gives the type
  * of the hash table.  The only defined type is 0 for a trust hash.
@@ -842,10 +1316,12 @@ create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type)
         log_fatal (_("%s: failed to create hashtable: %s\n"),
                    db_name, gpg_strerror (rc));
     }
-  /* Update the version record and flush. */
+  /* Update the version record and flush.  This is done even while in
+   * a transaction because the next record allocated at the end of the
+   * file must not overlap the new hash table.  */
   rc = tdbio_write_record (ctrl, vr);
   if (!rc)
-    rc = tdbio_sync ();
+    rc = write_dirty_records ();
   if (rc)
     log_fatal (_("%s: error updating version record: %s\n"),
                db_name, gpg_strerror (rc));
@@ -1397,6 +1873,7 @@ lookup_hashtable (ulong table, const byte *key, size_t keylen,
 static int
 update_trusthashtbl (ctrl_t ctrl, TRUSTREC *tr)
 {
+  trust_index_put (tr->r.trust.fingerprint, tr->recnum);
   return upd_hashtable (ctrl, get_trusthashrec (ctrl),
                         tr->r.trust.fingerprint, 20, tr->recnum);
 }
@@ -1518,6 +1995,7 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
           return err;
 	}
       buf = readbuf;
+      put_clean_record_into_cache (recnum, readbuf);
     }
   rec->recnum = recnum;
   rec->dirty = 0;
@@ -1742,6 +2220,7 @@ tdbio_delete_record (ctrl_t ctrl, ulong recnum)
     ;
   else if (rec.rectype == RECTYPE_TRUST)
     {
+      trust_index_drop (rec.r.trust.fingerprint, recnum);
       rc = drop_from_hashtable (ctrl, get_trusthashrec (ctrl),
                                 rec.r.trust.fingerprint, 20, rec.recnum);
     }
@@ -1836,6 +2315,8 @@ tdbio_new_recnum (ctrl_t ctrl)
               log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
                          recnum, n, gpg_strerror (rc));
 	    }
+          else
+            trust_index_note_write ();
 	}
 
       if (rc)
@@ -1876,6 +2357,36 @@ tdbio_search_trust_byfpr (ctrl_t ctrl, const byte *fpr, unsigned int fprlen,
       fpr = fingerprint;
     }
 
+  if (db_fd == -1)
+    open_db ();
+
+  /* If another process changed the trustdb our index and the cached
+   * records may be outdated.  */
+  if (trust_index.slots && trust_index_is_stale ())
+    {
+      trust_index_release ();
+      drop_clean_records ();
+    }
+
+  if (!trust_index.slots && trust_index.lookups++ >= TRUST_INDEX_THRESHOLD)
+    build_trust_index ();
+
+  if (trust_index.slots)
+    {
+      struct trust_index_slot_s *slot = trust_index_find (fpr);
+
+      if (!slot->recno || slot->recno == TRUST_INDEX_DELETED)
+        return gpg_error (GPG_ERR_NOT_FOUND);
+      rc = tdbio_read_record (slot->recno, rec, RECTYPE_TRUST);
+      if (!rc && cmp_trec_fpr (fpr, rec))
+        return 0;
+      /* The index is out of sync; build it again later.  */
+      if (DBG_CACHE)
+        log_debug ("tdbio: trust index out of sync\n");
+      trust_index_release ();
+      trust_index.lookups = 0;
+    }
+
   /* Locate the trust record using the hash table */
   rc = lookup_hashtable (get_trusthashrec (ctrl), fpr, 20,
                          cmp_trec_fpr, fpr, rec);
@@ -118,6 +118,8 @@ gpg_error_t tdbio_search_trust_bypk (ctrl_t ctrl, PKT_public_key *pk,
                                      TRUSTREC *rec);
 
 void tdbio_how_to_fix (void);
+void tdbio_reset_after_fork (void);
+void tdbio_invalidate_cache (void);
 void tdbio_invalid(void);
 
 #endif /*G10_TDBIO_H*/
@@ -462,6 +462,14 @@ dotlock_take (dotlock_t h, long timeout)
   return 0;
 }
 
+int
+dotlock_take_shared (dotlock_t h, long timeout)
+{
+  (void)h;
+  (void)timeout;
+  return 0;
+}
+
 int
 dotlock_release (dotlock_t h)
 {
@@ -501,6 +509,17 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
   return gpg_error (GPG_ERR_NO_SECKEY);
 }
 
+int
+agent_is_connected (void)
+{
+  return 0;
+}
+
+void
+tdbio_reset_after_fork (void)
+{
+}
+
 gpg_error_t
 export_pubkey_buffer (ctrl_t ctrl, const char *keyspec, unsigned int options,
                       const void *prefix, size_t prefixlen,
@@ -42,22 +42,18 @@
 			  /* to make sure that a warning is displayed while */
 			  /* creating a message */
 
+/* Return the length of LINE without the trailing characters in
+ * TRIMCHARS.  We scan backwards so that the cost does not depend on
+ * the length of the line.  */
 static unsigned
-len_without_trailing_chars( byte *line, unsigned len, const char *trimchars )
+len_without_trailing_chars (const byte *line, unsigned len,
+                            const char *trimchars)
 {
-    byte *p, *mark;
     unsigned n;
 
-    for(mark=NULL, p=line, n=0; n < len; n++, p++ ) {
-	if( strchr( trimchars, *p ) ) {
-	    if( !mark )
-		mark = p;
-	}
-	else
-	    mark = NULL;
-    }
-
-    return mark? (mark - line) : len;
+    for (n = len; n && strchr (trimchars, line[n-1]); n--)
+	;
+    return n;
 }
 
 
@@ -74,8 +70,15 @@ standard( text_filter_context_t *tfx, IOBUF a,
     while( !rc && len < size ) {
 	int lf_seen;
 
-	while( len < size && tfx->buffer_pos < tfx->buffer_len )
-	    buf[len++] = tfx->buffer[tfx->buffer_pos++];
+	if (tfx->buffer_pos < tfx->buffer_len) {
+	    size_t n = tfx->buffer_len - tfx->buffer_pos;
+
+	    if (n > size - len)
+		n = size - len;
+	    memcpy (buf + len, tfx->buffer + tfx->buffer_pos, n);
+	    len += n;
+	    tfx->buffer_pos += n;
+	}
 	if( len >= size )
 	    continue;
 
@@ -165,6 +168,7 @@ copy_clearsig_text( IOBUF out, IOBUF inp, gcry_md_hd_t md,
     unsigned int maxlen;
     byte *buffer = NULL;      /* malloced buffer */
     unsigned int bufsize = 0; /* and size of this buffer */
+    const byte *line;         /* the line; may point into INP */
     unsigned int n;
     int truncated = 0;
     int pending_lf = 0;
@@ -176,7 +180,7 @@ copy_clearsig_text( IOBUF out, IOBUF inp, gcry_md_hd_t md,
 
     for(;;) {
 	maxlen = MAX_LINELEN;
-	n = iobuf_read_line( inp, &buffer, &bufsize, &maxlen );
+	n = iobuf_scan_line (inp, &line, &buffer, &bufsize, &maxlen);
 	if( !maxlen )
 	    truncated++;
 
@@ -189,16 +193,16 @@ copy_clearsig_text( IOBUF out, IOBUF inp, gcry_md_hd_t md,
 		gcry_md_putc ( md, '\r' );
 		gcry_md_putc ( md, '\n' );
 	    }
-	    gcry_md_write ( md, buffer,
-                            len_without_trailing_chars (buffer, n, " \t\r\n"));
+	    gcry_md_write ( md, line,
+                            len_without_trailing_chars (line, n, " \t\r\n"));
 	}
 	else
-            gcry_md_write ( md, buffer, n );
-	pending_lf = buffer[n-1] == '\n';
+            gcry_md_write ( md, line, n );
+	pending_lf = line[n-1] == '\n';
 
 	/* write the output */
-	if(    ( escape_dash && *buffer == '-')
-	    || ( escape_from && n > 4 && !memcmp(buffer, "From ", 5 ) ) ) {
+	if(    ( escape_dash && *line == '-')
+	    || ( escape_from && n > 4 && !memcmp(line, "From ", 5 ) ) ) {
 	    iobuf_put( out, '-' );
 	    iobuf_put( out, ' ' );
 	}
@@ -226,7 +230,7 @@ copy_clearsig_text( IOBUF out, IOBUF inp, gcry_md_hd_t md,
 	    iobuf_write( out, buffer, n );
 
 #else
-	iobuf_write( out, buffer, n );
+	iobuf_write( out, line, n );
 #endif
     }
 
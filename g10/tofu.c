@@ -55,6 +55,40 @@
  * indicate that a lot of history is available.  */
 #define FULL_TRUST_THRESHOLD  21
 
+/* The number of rows inserted by one statement when writing the
+ * signatures and encryptions collected in batch mode.  */
+#define BATCH_INSERT_ROWS  64
+
+/* Size of the hash table and the maximum number of entries of the
+ * cache for get_trust results.  */
+#define TRUST_CACHE_BUCKETS  256
+#define TRUST_CACHE_MAX      4096
+
+
+/* A signature or encryption collected in batch mode and not yet
+ * written to the database.  For encryptions only FINGERPRINT, EMAIL
+ * and TIME are used.  */
+struct pending_reg_s
+{
+  struct pending_reg_s *next;
+  char *fingerprint;
+  char *email;
+  char *sig_digest;
+  char *origin;
+  long long sig_time;
+  long long time;
+};
+
+
+/* An entry in the cache for get_trust results.  */
+struct trust_cache_s
+{
+  struct trust_cache_s *next;
+  int trust_level;
+  enum tofu_policy policy;
+  char key[1];  /* The fingerprint, a space and the mail address.  */
+};
+
 
 /* A struct with data pertaining to the tofu DB.  There is one such
    struct per session and it is cached in session's ctrl structure.
@@ -81,12 +115,29 @@ struct tofu_dbs_s
     sqlite3_stmt *get_trust_gather_encryption_stats;
     sqlite3_stmt *register_already_seen;
     sqlite3_stmt *register_signature;
-    sqlite3_stmt *register_encryption;
+    sqlite3_stmt *register_signature_batch;
+    sqlite3_stmt *register_encryption_batch;
+    sqlite3_stmt *data_version;
+    sqlite3_stmt *show_statistics;
   } s;
 
   int in_batch_transaction;
   int in_transaction;
   time_t batch_update_started;
+
+  /* Signatures and encryptions collected in batch mode.  The lists
+   * are in reverse order of registration.  */
+  struct pending_reg_s *pending_sigs;
+  struct pending_reg_s *pending_encs;
+  unsigned int n_pending_sigs;
+  unsigned int n_pending_encs;
+
+  /* Results of get_trust for bindings with a fixed policy.  The
+   * cache is cleared whenever a binding changes and when another
+   * process modified the database as told by DATA_VERSION.  */
+  struct trust_cache_s *trust_cache[TRUST_CACHE_BUCKETS];
+  unsigned int trust_cache_count;
+  long data_version;
 };
 
 
@@ -110,6 +161,8 @@ struct tofu_dbs_s
 
 /* Local prototypes.  */
 static gpg_error_t end_transaction (ctrl_t ctrl, int only_batch);
+static gpg_error_t flush_pending_regs (tofu_dbs_t dbs);
+static void trust_cache_clear (tofu_dbs_t dbs);
 static char *email_from_user_id (const char *user_id);
 static int show_statistics (tofu_dbs_t dbs,
                             const char *fingerprint, const char *email,
@@ -289,7 +342,8 @@ end_transaction (ctrl_t ctrl, int only_batch)
           && dbs->in_batch_transaction)
         {
           /* The batch transaction is still in open, but we've left
-           * batch mode.  */
+           * batch mode.  Write what we collected before committing.  */
+          flush_pending_regs (dbs);
           dbs->in_batch_transaction = 0;
           dbs->in_transaction = 0;
 
@@ -346,6 +400,7 @@ rollback_transaction (ctrl_t ctrl)
   rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
                            "rollback to inner%d;",
                            dbs->in_transaction);
+  trust_cache_clear (dbs);
 
   dbs->in_transaction --;
 
@@ -656,6 +711,131 @@ check_utks (sqlite3 *db)
   return rc;
 }
 
+/* Create the tables with the per-binding statistics if they do not
+ * yet exist and fill them from the signatures and encryptions tables.
+ * Triggers keep them up to date so that show_statistics does not need
+ * to aggregate the entire history of a binding.
+ *
+ * BINDING_STATS has one row per binding which has been used.
+ *
+ *   BINDING refers to bindings.oid.
+ *
+ *   SIG_COUNT, SIG_FIRST and SIG_LAST are the number of signatures
+ *   and the times the first and the most recent one were registered.
+ *
+ *   SIG_DAYS is the number of different days on which signatures
+ *   were registered.
+ *
+ *   ENC_COUNT, ENC_FIRST, ENC_LAST and ENC_DAYS are the same for
+ *   encryptions.
+ *
+ * BINDING_DAYS has a row for each day on which a signature (KIND 0)
+ * or an encryption (KIND 1) was registered for BINDING.  It is used to
+ * maintain the SIG_DAYS and ENC_DAYS counters.
+ *
+ * Return 0 on success.  */
+static int
+init_binding_stats (sqlite3 *db)
+{
+  char *err = NULL;
+  unsigned long int count;
+  int rc;
+
+  rc = sqlite3_exec (db,
+                     "select count(*) from sqlite_master"
+                     " where type='table' and name='binding_stats';",
+                     get_single_unsigned_long_cb, &count, &err);
+  if (rc)
+    {
+      log_error (_("error reading TOFU database: %s\n"), err);
+      print_further_info ("query available tables");
+      sqlite3_free (err);
+      return rc;
+    }
+  if (count)
+    return 0;
+
+  rc = sqlite3_exec
+    (db,
+     "create table binding_stats\n"
+     " (binding INTEGER PRIMARY KEY,\n"
+     "  sig_count INTEGER NOT NULL DEFAULT 0,\n"
+     "  sig_first INTEGER, sig_last INTEGER,\n"
+     "  sig_days INTEGER NOT NULL DEFAULT 0,\n"
+     "  enc_count INTEGER NOT NULL DEFAULT 0,\n"
+     "  enc_first INTEGER, enc_last INTEGER,\n"
+     "  enc_days INTEGER NOT NULL DEFAULT 0);\n"
+     "create table binding_days\n"
+     " (binding INTEGER NOT NULL, kind INTEGER NOT NULL,\n"
+     "  day INTEGER NOT NULL,\n"
+     "  primary key (binding, kind, day));\n"
+     /* Take over the existing data.  */
+     "insert into binding_days\n"
+     " select distinct binding, 0, time / 86400 from signatures;\n"
+     "insert into binding_days\n"
+     " select distinct binding, 1, time / 86400 from encryptions;\n"
+     "insert into binding_stats (binding)\n"
+     " select binding from signatures union select binding from encryptions;\n"
+     "update binding_stats set\n"
+     "  sig_count = (select count(*) from signatures s\n"
+     "               where s.binding = binding_stats.binding),\n"
+     "  sig_first = (select min(time) from signatures s\n"
+     "               where s.binding = binding_stats.binding),\n"
+     "  sig_last = (select max(time) from signatures s\n"
+     "              where s.binding = binding_stats.binding),\n"
+     "  sig_days = (select count(*) from binding_days d\n"
+     "              where d.binding = binding_stats.binding\n"
+     "               and d.kind = 0),\n"
+     "  enc_count = (select count(*) from encryptions e\n"
+     "               where e.binding = binding_stats.binding),\n"
+     "  enc_first = (select min(time) from encryptions e\n"
+     "               where e.binding = binding_stats.binding),\n"
+     "  enc_last = (select max(time) from encryptions e\n"
+     "              where e.binding = binding_stats.binding),\n"
+     "  enc_days = (select count(*) from binding_days d\n"
+     "              where d.binding = binding_stats.binding\n"
+     "               and d.kind = 1);\n"
+     /* And maintain it from now on.  */
+     "create trigger binding_stats_signature after insert on signatures\n"
+     " begin\n"
+     "  insert or ignore into binding_stats (binding) values (new.binding);\n"
+     "  update binding_stats set\n"
+     "    sig_count = sig_count + 1,\n"
+     "    sig_first = min (coalesce (sig_first, new.time), new.time),\n"
+     "    sig_last = max (coalesce (sig_last, new.time), new.time)\n"
+     "   where binding = new.binding;\n"
+     "  insert or ignore into binding_days\n"
+     "   values (new.binding, 0, new.time / 86400);\n"
+     " end;\n"
+     "create trigger binding_stats_encryption after insert on encryptions\n"
+     " begin\n"
+     "  insert or ignore into binding_stats (binding) values (new.binding);\n"
+     "  update binding_stats set\n"
+     "    enc_count = enc_count + 1,\n"
+     "    enc_first = min (coalesce (enc_first, new.time), new.time),\n"
+     "    enc_last = max (coalesce (enc_last, new.time), new.time)\n"
+     "   where binding = new.binding;\n"
+     "  insert or ignore into binding_days\n"
+     "   values (new.binding, 1, new.time / 86400);\n"
+     " end;\n"
+     "create trigger binding_stats_day after insert on binding_days\n"
+     " begin\n"
+     "  update binding_stats set\n"
+     "    sig_days = sig_days + (new.kind = 0),\n"
+     "    enc_days = enc_days + (new.kind = 1)\n"
+     "   where binding = new.binding;\n"
+     " end;\n",
+     NULL, NULL, &err);
+  if (rc)
+    {
+      log_error (_("error initializing TOFU database: %s\n"), err);
+      print_further_info ("create binding_stats");
+      sqlite3_free (err);
+    }
+  return rc;
+}
+
+
 /* If the DB is new, initialize it.  Otherwise, check the DB's
    version.
 
@@ -876,6 +1056,9 @@ initdb (sqlite3 *db)
 	}
     }
 
+  if (! rc)
+    rc = init_binding_stats (db);
+
   if (! rc)
     rc = check_utks (db);
 
@@ -1002,6 +1185,7 @@ tofu_closedbs (ctrl_t ctrl)
 
   log_assert (dbs->in_transaction == 0);
 
+  flush_pending_regs (dbs);
   end_transaction (ctrl, 2);
 
   /* Arghh, that is a surprising use of the struct.  */
@@ -1011,6 +1195,7 @@ tofu_closedbs (ctrl_t ctrl)
     sqlite3_finalize (*statements);
 
   sqlite3_close (dbs->db);
+  trust_cache_clear (dbs);
   xfree (dbs->want_lock_file);
   xfree (dbs);
   ctrl->tofu.dbs = NULL;
@@ -1042,6 +1227,385 @@ get_single_long_cb2 (void *cookie, int argc, char **argv, char **azColName,
   return get_single_long_cb (cookie, argc, argv, azColName);
 }
 
+
+/* Release the list of pending registrations ITEM.  */
+static void
+release_pending_regs (struct pending_reg_s *item)
+{
+  struct pending_reg_s *next;
+
+  for (; item; item = next)
+    {
+      next = item->next;
+      xfree (item->fingerprint);
+      xfree (item->email);
+      xfree (item->sig_digest);
+      xfree (item->origin);
+      xfree (item);
+    }
+}
+
+
+/* Return a string with the SQL to insert NROWS pending registrations.
+ * If FOR_SIGS is set the SQL is for signatures, else for encryptions.
+ * Rows for which no binding exists are skipped; signatures which are
+ * already in the table are skipped as well.  */
+static char *
+build_batch_insert_sql (int for_sigs, unsigned int nrows)
+{
+  const char *head, *row, *tail;
+  char *sql, *p;
+  unsigned int i;
+
+  if (for_sigs)
+    {
+      head = ("insert or ignore into signatures\n"
+              " (binding, sig_digest, origin, sig_time, time)\n"
+              " select b.oid, v.column3, v.column4, v.column5, v.column6\n"
+              "  from (values ");
+      row  = "(?,?,?,?,?,?)";
+      tail = (") as v\n"
+              "  join bindings b\n"
+              "   on b.fingerprint = v.column1 and b.email = v.column2\n"
+              "  where not exists\n"
+              "   (select 1 from signatures s\n"
+              "     where s.binding = b.oid and s.sig_time = v.column5\n"
+              "      and s.sig_digest = v.column3);");
+    }
+  else
+    {
+      head = ("insert into encryptions (binding, time)\n"
+              " select b.oid, v.column3\n"
+              "  from (values ");
+      row  = "(?,?,?)";
+      tail = (") as v\n"
+              "  join bindings b\n"
+              "   on b.fingerprint = v.column1 and b.email = v.column2;");
+    }
+
+  sql = xmalloc (strlen (head) + nrows * (strlen (row) + 1) + strlen (tail) + 1);
+  p = stpcpy (sql, head);
+  for (i = 0; i < nrows; i++)
+    {
+      if (i)
+        *p++ = ',';
+      p = stpcpy (p, row);
+    }
+  strcpy (p, tail);
+  return sql;
+}
+
+
+/* Insert the NROWS registrations starting at ITEMS with a single
+ * statement.  The statement for BATCH_INSERT_ROWS rows is kept in
+ * *STMTP.  Returns 0 on success.  */
+static int
+insert_pending_regs (tofu_dbs_t dbs, int for_sigs, sqlite3_stmt **stmtp,
+                     struct pending_reg_s *items, unsigned int nrows)
+{
+  sqlite3_stmt *stmt = NULL;
+  char *sql;
+  unsigned int i;
+  int col = 1;
+  int rc;
+
+  if (nrows == BATCH_INSERT_ROWS && *stmtp)
+    stmt = *stmtp;
+  else
+    {
+      sql = build_batch_insert_sql (for_sigs, nrows);
+      rc = sqlite3_prepare_v2 (dbs->db, sql, -1, &stmt, NULL);
+      xfree (sql);
+      if (rc)
+        return rc;
+      if (nrows == BATCH_INSERT_ROWS)
+        *stmtp = stmt;
+    }
+
+  for (i = 0; i < nrows; i++, items = items->next)
+    {
+      sqlite3_bind_text (stmt, col++, items->fingerprint, -1, SQLITE_STATIC);
+      sqlite3_bind_text (stmt, col++, items->email, -1, SQLITE_STATIC);
+      if (for_sigs)
+        {
+          sqlite3_bind_text (stmt, col++, items->sig_digest, -1,
+                             SQLITE_STATIC);
+          sqlite3_bind_text (stmt, col++, items->origin, -1, SQLITE_STATIC);
+          sqlite3_bind_int64 (stmt, col++, items->sig_time);
+        }
+      sqlite3_bind_int64 (stmt, col++, items->time);
+    }
+
+  rc = sqlite3_step (stmt);
+  if (rc == SQLITE_DONE)
+    rc = 0;
+  if (stmt == *stmtp)
+    {
+      sqlite3_reset (stmt);
+      sqlite3_clear_bindings (stmt);
+    }
+  else
+    sqlite3_finalize (stmt);
+  return rc;
+}
+
+
+/* Write the registrations in the list *LISTP with multi-row inserts
+ * and release the list.  */
+static gpg_error_t
+flush_pending_list (tofu_dbs_t dbs, int for_sigs,
+                    struct pending_reg_s **listp, unsigned int *countp)
+{
+  struct pending_reg_s *list, *item, *prev, *next;
+  unsigned int n;
+  int rc = 0;
+
+  /* Restore the order of registration.  */
+  for (prev = NULL, item = *listp; item; item = next)
+    {
+      next = item->next;
+      item->next = prev;
+      prev = item;
+    }
+  list = prev;
+  *listp = NULL;
+
+  if (DBG_TRUST && *countp)
+    log_debug ("TOFU: Saving %u %s\n", *countp,
+               for_sigs? "signatures" : "encryptions");
+
+  for (item = list; item && !rc; )
+    {
+      struct pending_reg_s *start = item;
+
+      for (n = 0; item && n < BATCH_INSERT_ROWS; n++)
+        item = item->next;
+      rc = insert_pending_regs (dbs, for_sigs,
+                                for_sigs? &dbs->s.register_signature_batch
+                                /**/    : &dbs->s.register_encryption_batch,
+                                start, n);
+    }
+  release_pending_regs (list);
+  *countp = 0;
+
+  if (rc)
+    {
+      log_error (_("error updating TOFU database: %s\n"),
+                 sqlite3_errmsg (dbs->db));
+      print_further_info (for_sigs? "insert signatures"
+                          /**/    : "insert encryption");
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+  return 0;
+}
+
+
+/* Write all signatures and encryptions collected in batch mode.  This
+ * needs to be called before the batch transaction is committed and
+ * before reading the signatures or encryptions tables.  */
+static gpg_error_t
+flush_pending_regs (tofu_dbs_t dbs)
+{
+  gpg_error_t err, err2;
+
+  if (!dbs)
+    return 0;
+  err = flush_pending_list (dbs, 1, &dbs->pending_sigs, &dbs->n_pending_sigs);
+  err2 = flush_pending_list (dbs, 0, &dbs->pending_encs, &dbs->n_pending_encs);
+  return err? err : err2;
+}
+
+
+/* Return true if the signature <FINGERPRINT, EMAIL, SIG_TIME,
+ * SIG_DIGEST> is in the list of pending signatures LIST.  */
+static int
+pending_sig_p (struct pending_reg_s *list,
+               const char *fingerprint, const char *email,
+               long long sig_time, const char *sig_digest)
+{
+  struct pending_reg_s *item;
+
+  for (item = list; item; item = item->next)
+    if (item->sig_time == sig_time
+        && !strcmp (item->sig_digest, sig_digest)
+        && !strcmp (item->fingerprint, fingerprint)
+        && !strcmp (item->email, email))
+      return 1;
+  return 0;
+}
+
+
+/* Create a pending registration item.  SIG_DIGEST and ORIGIN may be
+ * NULL.  */
+static struct pending_reg_s *
+new_pending_reg (const char *fingerprint, const char *email,
+                 const char *sig_digest, const char *origin,
+                 long long sig_time, long long now)
+{
+  struct pending_reg_s *item;
+
+  item = xmalloc_clear (sizeof *item);
+  item->fingerprint = xstrdup (fingerprint);
+  item->email = xstrdup (email);
+  if (sig_digest)
+    item->sig_digest = xstrdup (sig_digest);
+  if (origin)
+    item->origin = xstrdup (origin);
+  item->sig_time = sig_time;
+  item->time = now;
+  return item;
+}
+
+
+/* Append the registrations in LIST to the pending list *LISTP.  If
+ * the pending list gets too large it is written out.  Both lists are
+ * in reverse order.  */
+static gpg_error_t
+add_pending_regs (tofu_dbs_t dbs, int for_sigs, struct pending_reg_s *list)
+{
+  struct pending_reg_s **listp, *item;
+  unsigned int *countp;
+
+  listp = for_sigs? &dbs->pending_sigs : &dbs->pending_encs;
+  countp = for_sigs? &dbs->n_pending_sigs : &dbs->n_pending_encs;
+  if (!list)
+    return 0;
+
+  for (item = list; ; item = item->next)
+    {
+      ++*countp;
+      if (!item->next)
+        break;
+    }
+  item->next = *listp;
+  *listp = list;
+
+  if (*countp >= 16 * BATCH_INSERT_ROWS)
+    return flush_pending_list (dbs, for_sigs, listp, countp);
+  return 0;
+}
+
+
+/* Compute the hash bucket for the binding <FINGERPRINT, EMAIL>.  */
+static unsigned int
+trust_cache_hash (const char *fingerprint, const char *email)
+{
+  unsigned int h = 5381;
+  const char *s;
+
+  for (s = fingerprint; *s; s++)
+    h = (h << 5) + h + (unsigned char)*s;
+  for (s = email; *s; s++)
+    h = (h << 5) + h + (unsigned char)*s;
+  return h % TRUST_CACHE_BUCKETS;
+}
+
+
+/* Clear the cache of get_trust results.  */
+static void
+trust_cache_clear (tofu_dbs_t dbs)
+{
+  struct trust_cache_s *item, *next;
+  int i;
+
+  if (!dbs || !dbs->trust_cache_count)
+    return;
+  for (i = 0; i < TRUST_CACHE_BUCKETS; i++)
+    {
+      for (item = dbs->trust_cache[i]; item; item = next)
+        {
+          next = item->next;
+          xfree (item);
+        }
+      dbs->trust_cache[i] = NULL;
+    }
+  dbs->trust_cache_count = 0;
+}
+
+
+/* Look up the binding <FINGERPRINT, EMAIL> in the cache of get_trust
+ * results.  On success store the result at R_TRUST_LEVEL and
+ * R_POLICY and return true.  */
+static int
+trust_cache_get (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+                 int *r_trust_level, enum tofu_policy *r_policy)
+{
+  struct trust_cache_s *item;
+  size_t fprlen = strlen (fingerprint);
+  long data_version = 0;
+  char *err = NULL;
+
+  if (!dbs->trust_cache_count)
+    return 0;
+
+  /* Drop the cache if another process changed the database.  */
+  if (gpgsql_stepx (dbs->db, &dbs->s.data_version,
+                    get_single_long_cb2, &data_version, &err,
+                    "pragma data_version;", GPGSQL_ARG_END))
+    {
+      sqlite3_free (err);
+      trust_cache_clear (dbs);
+      return 0;
+    }
+  if (data_version != dbs->data_version)
+    {
+      trust_cache_clear (dbs);
+      dbs->data_version = data_version;
+      return 0;
+    }
+
+  for (item = dbs->trust_cache[trust_cache_hash (fingerprint, email)];
+       item; item = item->next)
+    {
+      if (!strncmp (item->key, fingerprint, fprlen)
+          && item->key[fprlen] == ' '
+          && !strcmp (item->key + fprlen + 1, email))
+        {
+          *r_trust_level = item->trust_level;
+          *r_policy = item->policy;
+          return 1;
+        }
+    }
+  return 0;
+}
+
+
+/* Store the get_trust result TRUST_LEVEL and POLICY for the binding
+ * <FINGERPRINT, EMAIL> in the cache.  */
+static void
+trust_cache_put (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+                 int trust_level, enum tofu_policy policy)
+{
+  struct trust_cache_s *item;
+  unsigned int h = trust_cache_hash (fingerprint, email);
+  char *err = NULL;
+
+  if (dbs->trust_cache_count >= TRUST_CACHE_MAX)
+    trust_cache_clear (dbs);
+
+  if (!dbs->trust_cache_count)
+    {
+      /* Remember the version the cached data belongs to.  */
+      if (gpgsql_stepx (dbs->db, &dbs->s.data_version,
+                        get_single_long_cb2, &dbs->data_version, &err,
+                        "pragma data_version;", GPGSQL_ARG_END))
+        {
+          sqlite3_free (err);
+          return;
+        }
+    }
+
+  item = xtrymalloc (sizeof *item + strlen (fingerprint) + strlen (email) + 1);
+  if (!item)
+    return;
+  item->trust_level = trust_level;
+  item->policy = policy;
+  strcpy (stpcpy (stpcpy (item->key, fingerprint), " "), email);
+  item->next = dbs->trust_cache[h];
+  dbs->trust_cache[h] = item;
+  dbs->trust_cache_count++;
+}
+
 /* Record (or update) a trust policy about a (possibly new)
    binding.
 
@@ -1112,6 +1676,10 @@ record_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
       goto leave;
     }
 
+  /* A changed binding may change the effective policy of other
+   * bindings with the same mail address.  */
+  trust_cache_clear (dbs);
+
   rc = gpgsql_stepx
     (dbs->db, &dbs->s.record_binding_update, NULL, NULL, &err,
      "insert or replace into bindings\n"
@@ -1578,6 +2146,9 @@ ask_about_binding (ctrl_t ctrl,
   log_assert (dbs);
   log_assert (dbs->in_transaction == 0);
 
+  /* The statistics shall include what we collected in batch mode.  */
+  flush_pending_regs (dbs);
+
   fp = es_fopenmem (0, "rw,samethread");
   if (!fp)
     log_fatal ("error creating memory stream: %s\n",
@@ -2668,6 +3239,7 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
 {
   tofu_dbs_t dbs = ctrl->tofu.dbs;
   int in_transaction = 0;
+  int cacheable = 0;
   enum tofu_policy policy;
   int rc;
   char *sqerr = NULL;
@@ -2695,6 +3267,17 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
               && _tofu_GET_TRUST_ERROR != TRUST_FULLY
               && _tofu_GET_TRUST_ERROR != TRUST_ULTIMATE);
 
+  /* A binding with a fixed policy needs no further database queries
+   * as long as no binding changes.  */
+  if (trust_cache_get (dbs, fingerprint, email, &trust_level, &policy))
+    {
+      if (policyp)
+        *policyp = policy;
+      if (conflict_setp)
+        *conflict_setp = NULL;
+      return trust_level;
+    }
+
   begin_transaction (ctrl, 0);
   in_transaction = 1;
 
@@ -2721,6 +3304,7 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
       {
         trust_level = TRUST_ULTIMATE;
         policy = TOFU_POLICY_GOOD;
+        cacheable = 1;
         goto out;
       }
   }
@@ -2754,6 +3338,7 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
 	log_debug ("TOFU: Known binding <key: %s, user id: %s>'s policy: %s\n",
 		   fingerprint, email, tofu_policy_str (policy));
       trust_level = tofu_policy_to_trust_level (policy);
+      cacheable = 1;
       goto out;
 
     case TOFU_POLICY_ASK:
@@ -2817,6 +3402,7 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
    * the current key.  */
   log_assert (conflict_set);
 
+  trust_cache_clear (dbs);
   for (iter = conflict_set->next; iter; iter = iter->next)
     {
       /* We don't immediately set the effective policy to 'ask,
@@ -2845,6 +3431,9 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
   if (in_transaction)
     end_transaction (ctrl, 0);
 
+  if (cacheable && !conflict_set)
+    trust_cache_put (dbs, fingerprint, email, trust_level, policy);
+
   if (policyp)
     *policyp = policy;
 
@@ -3008,92 +3597,26 @@ show_statistics (tofu_dbs_t dbs,
   if (only_status_fd && ! is_status_enabled ())
     return 0;
 
-  fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
+  flush_pending_regs (dbs);
 
-  /* Get the signature stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (signatures.time), 0),\n"
-     "  coalesce (max (signatures.time), 0)\n"
-     " from signatures\n"
-     " left join bindings on signatures.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting signature statistics");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*) from\n"
-     "  (select round(signatures.time / (24 * 60 * 60)) day\n"
-     "    from signatures\n"
-     "    left join bindings on signatures.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
-     "    group by day);",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting signature statistics (by day)");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
-
-  if (strlist)
-    {
-      /* We expect exactly 4 elements.  */
-      log_assert (strlist->next);
-      log_assert (strlist->next->next);
-      log_assert (strlist->next->next->next);
-      log_assert (! strlist->next->next->next->next);
-
-      string_to_ulong (&signature_days, strlist->d, -1, __LINE__);
-      string_to_ulong (&signature_count, strlist->next->d, -1, __LINE__);
-      string_to_ulong (&signature_first_seen,
-                       strlist->next->next->d, -1, __LINE__);
-      string_to_ulong (&signature_most_recent,
-                       strlist->next->next->next->d, -1, __LINE__);
-
-      free_strlist (strlist);
-      strlist = NULL;
-    }
+  fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
-  /* Get the encryption stats.  */
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (encryptions.time), 0),\n"
-     "  coalesce (max (encryptions.time), 0)\n"
-     " from encryptions\n"
-     " left join bindings on encryptions.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting encryption statistics");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*) from\n"
-     "  (select round(encryptions.time / (24 * 60 * 60)) day\n"
-     "    from encryptions\n"
-     "    left join bindings on encryptions.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
-     "    group by day);",
-     fingerprint, email);
+  /* Get the signature and encryption stats.  */
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.show_statistics, strings_collect_cb2, &strlist, &err,
+     "select coalesce (s.sig_count, 0), coalesce (s.sig_first, 0),\n"
+     "  coalesce (s.sig_last, 0), coalesce (s.sig_days, 0),\n"
+     "  coalesce (s.enc_count, 0), coalesce (s.enc_first, 0),\n"
+     "  coalesce (s.enc_last, 0), coalesce (s.enc_days, 0)\n"
+     " from bindings b left join binding_stats s on s.binding = b.oid\n"
+     " where b.fingerprint = ? and b.email = ?;",
+     GPGSQL_ARG_STRING, fingerprint,
+     GPGSQL_ARG_STRING, email,
+     GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting encryption statistics (by day)");
+      print_further_info ("getting statistics");
       sqlite3_free (err);
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
@@ -3101,18 +3624,23 @@ show_statistics (tofu_dbs_t dbs,
 
   if (strlist)
     {
-      /* We expect exactly 4 elements.  */
-      log_assert (strlist->next);
-      log_assert (strlist->next->next);
-      log_assert (strlist->next->next->next);
-      log_assert (! strlist->next->next->next->next);
-
-      string_to_ulong (&encryption_days, strlist->d, -1, __LINE__);
-      string_to_ulong (&encryption_count, strlist->next->d, -1, __LINE__);
-      string_to_ulong (&encryption_first_done,
-                       strlist->next->next->d, -1, __LINE__);
-      string_to_ulong (&encryption_most_recent,
-                       strlist->next->next->next->d, -1, __LINE__);
+      unsigned long values[8];
+      strlist_t sl;
+      int i;
+
+      /* We expect exactly 8 elements.  */
+      for (i = 0, sl = strlist; sl && i < DIM (values); i++, sl = sl->next)
+        string_to_ulong (&values[i], sl->d, -1, __LINE__);
+      log_assert (i == DIM (values) && !sl);
+
+      signature_count = values[0];
+      signature_first_seen = values[1];
+      signature_most_recent = values[2];
+      signature_days = values[3];
+      encryption_count = values[4];
+      encryption_first_done = values[5];
+      encryption_most_recent = values[6];
+      encryption_days = values[7];
 
       free_strlist (strlist);
       strlist = NULL;
@@ -3334,6 +3862,7 @@ tofu_register_signature (ctrl_t ctrl,
   char *sqlerr = NULL;
   char *sig_digest = NULL;
   unsigned long c;
+  struct pending_reg_s *newsigs = NULL, *item;
 
   dbs = opendbs (ctrl);
   if (! dbs)
@@ -3388,6 +3917,25 @@ tofu_register_signature (ctrl_t ctrl,
           break;
         }
 
+      /* In batch mode the signature is inserted later together with
+       * other signatures.  Signatures already in the database are
+       * skipped at that time.  */
+      if (ctrl->tofu.batch_updated_wanted && !opt.dry_run)
+        {
+          if (!pending_sig_p (dbs->pending_sigs, fingerprint, email,
+                              sig_time, sig_digest)
+              && !pending_sig_p (newsigs, fingerprint, email,
+                                 sig_time, sig_digest))
+            {
+              item = new_pending_reg (fingerprint, email, sig_digest, origin,
+                                      sig_time, now);
+              item->next = newsigs;
+              newsigs = item;
+            }
+          xfree (email);
+          continue;
+        }
+
       /* If we've already seen this signature before, then don't add
          it again.  */
       rc = gpgsql_stepx
@@ -3472,6 +4020,13 @@ tofu_register_signature (ctrl_t ctrl,
     }
 
  leave:
+  if (!rc)
+    {
+      rc = add_pending_regs (dbs, 1, newsigs);
+      newsigs = NULL;
+    }
+  release_pending_regs (newsigs);
+
   if (rc)
     rollback_transaction (ctrl);
   else
@@ -3495,8 +4050,8 @@ tofu_register_encryption (ctrl_t ctrl,
   int free_user_id_list = 0;
   char *fingerprint = NULL;
   strlist_t user_id;
-  char *sqlerr = NULL;
   int in_batch = 0;
+  struct pending_reg_s *newencs = NULL, *item;
 
   dbs = opendbs (ctrl);
   if (! dbs)
@@ -3591,29 +4146,20 @@ tofu_register_encryption (ctrl_t ctrl,
 
       free_strlist (conflict_set);
 
-      rc = gpgsql_stepx
-        (dbs->db, &dbs->s.register_encryption, NULL, NULL, &sqlerr,
-         "insert into encryptions\n"
-         " (binding, time)\n"
-         " values\n"
-         " ((select oid from bindings\n"
-         "    where fingerprint = ? and email = ?),\n"
-         "  ?);",
-         GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
-         GPGSQL_ARG_LONG_LONG, (long long) now,
-         GPGSQL_ARG_END);
-      if (rc)
-        {
-          log_error (_("error updating TOFU database: %s\n"), sqlerr);
-          print_further_info ("insert encryption");
-          sqlite3_free (sqlerr);
-          rc = gpg_error (GPG_ERR_GENERAL);
-        }
+      /* The encryptions are inserted with one statement when the
+       * batch update ends.  */
+      item = new_pending_reg (fingerprint, email, NULL, NULL, 0, now);
+      item->next = newencs;
+      newencs = item;
 
       xfree (email);
     }
 
+  rc = add_pending_regs (dbs, 0, newencs);
+  newencs = NULL;
+
  leave:
+  release_pending_regs (newencs);
   if (in_batch)
     tofu_end_batch_update (ctrl);
 
@@ -3918,6 +4464,7 @@ tofu_set_policy (ctrl_t ctrl, kbnode_t kb, enum tofu_policy policy)
     return gpg_error_from_syserror ();
 
   begin_transaction (ctrl, 0);
+  trust_cache_clear (dbs);
 
   for (; kb; kb = kb->next)
     {
@@ -4026,6 +4573,7 @@ tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
   if (!fingerprint)
     return gpg_error_from_syserror ();
 
+  trust_cache_clear (dbs);
   rc = gpgsql_stepx (dbs->db, NULL, NULL, NULL, &sqlerr,
                      "update bindings set effective_policy = ?"
                      " where fingerprint = ?;",
@@ -33,6 +33,7 @@
 #include "../common/i18n.h"
 #include "trustdb.h"
 #include "../common/host2net.h"
+#include "../common/tstats.h"
 
 
 /* Return true if key is disabled.  Note that this is usually used via
@@ -297,6 +298,18 @@ revalidation_mark (ctrl_t ctrl)
 }
 
 
+void
+revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+#ifndef NO_TRUST_MODELS
+  tdb_revalidation_mark_key (ctrl, pk);
+#else
+  (void)ctrl;
+  (void)pk;
+#endif
+}
+
+
 void
 check_trustdb_stale (ctrl_t ctrl)
 {
@@ -374,7 +387,9 @@ get_validity (ctrl_t ctrl, kbnode_t kb, PKT_public_key *pk, PKT_user_id *uid,
 #ifdef NO_TRUST_MODELS
   validity = TRUST_UNKNOWN;
 #else
+  TSTAT_ENTER (TSTAT_TRUSTDB);
   validity = tdb_get_validity_core (ctrl, kb, pk, uid, main_pk, sig, may_ask);
+  TSTAT_LEAVE (TSTAT_TRUSTDB);
 #endif
 
  leave:
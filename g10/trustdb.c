@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "lcr.h"
 #include "../common/status.h"
@@ -78,7 +79,9 @@ static int pending_check_trustdb;
 
 
 static void write_record (ctrl_t ctrl, TRUSTREC *rec);
+static void flush_validity_memo (void);
 static void do_sync (void);
+static void do_end_transaction (void);
 static int validate_keys (ctrl_t ctrl, int interactive);
 
 
@@ -528,7 +531,10 @@ read_record (ulong recno, TRUSTREC *rec, int rectype )
 static void
 write_record (ctrl_t ctrl, TRUSTREC *rec)
 {
-  int rc = tdbio_write_record (ctrl, rec);
+  int rc;
+
+  flush_validity_memo ();
+  rc = tdbio_write_record (ctrl, rec);
   if (rc)
     {
       log_error(_("trust record %lu, type %d: write failed: %s\n"),
@@ -551,6 +557,18 @@ do_sync(void)
       }
 }
 
+/* Write out the records of the current tdbio transaction.  */
+static void
+do_end_transaction (void)
+{
+  int rc = tdbio_end_transaction ();
+  if (rc)
+    {
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc));
+      g10_exit (2);
+    }
+}
+
 const char *
 trust_model_string (int model)
 {
@@ -740,18 +758,89 @@ update_trustdb (ctrl_t ctrl)
 	      trust_model_string(opt.trust_model));
 }
 
+/* Return the name of the file listing the keys which changed since
+ * the last validation.  The caller must free the result.  */
+static char *
+changed_keys_fname (void)
+{
+  return xstrconcat (tdbio_get_dbname (), ".changed", NULL);
+}
+
+
 void
 tdb_revalidation_mark (ctrl_t ctrl)
 {
+  char *fname;
+
   init_trustdb (ctrl, 0);
   if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
     return;
 
+  /* A full check is required thus we can drop the list of changed
+   * keys.  */
+  fname = changed_keys_fname ();
+  if (!gnupg_access (fname, F_OK) && gnupg_remove (fname))
+    log_error (_("can't remove '%s': %s\n"),
+               fname, gpg_strerror (gpg_error_from_syserror ()));
+  xfree (fname);
+
   /* We simply set the time for the next check to 1 (far back in 1970)
      so that a --update-trustdb will be scheduled.  */
   if (tdbio_write_nextcheck (ctrl, 1))
     do_sync ();
   pending_check_trustdb = 1;
+  flush_validity_memo ();
+}
+
+
+/* Schedule a trustdb check due to a change of the key PK.  Unlike
+ * tdb_revalidation_mark the key is recorded in a file next to the
+ * trustdb so that the check can be restricted to the changed keys.
+ * The file starts with the value of nextcheck from before the first
+ * change; each further line has the fingerprint of a changed key.  */
+void
+tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+  char hexfpr[2*MAX_FINGERPRINT_LEN+1];
+  char *fname;
+  estream_t fp = NULL;
+  ulong nextcheck;
+  int exists;
+  int okay = 0;
+
+  init_trustdb (ctrl, 0);
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  fname = changed_keys_fname ();
+  exists = !gnupg_access (fname, F_OK);
+  nextcheck = tdbio_read_nextcheck ();
+  /* If a check is already scheduled without a list of changed keys,
+   * we don't know the reason and thus a full check is needed.  */
+  if (exists || nextcheck != 1)
+    fp = es_fopen (fname, "a");
+  if (fp)
+    {
+      if (!exists)
+        es_fprintf (fp, "nextcheck %lu\n", nextcheck);
+      es_fprintf (fp, "%s\n", hexfingerprint (pk, hexfpr, sizeof hexfpr));
+      if (es_fclose (fp))
+        log_error (_("error writing '%s': %s\n"),
+                   fname, gpg_strerror (gpg_error_from_syserror ()));
+      else
+        okay = 1;
+    }
+  xfree (fname);
+  if (!okay)
+    {
+      tdb_revalidation_mark (ctrl);
+      return;
+    }
+
+  if (tdbio_write_nextcheck (ctrl, 1))
+    do_sync ();
+  pending_check_trustdb = 1;
+  flush_validity_memo ();
 }
 
 int
@@ -911,6 +1000,7 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust,
   if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
     return;
 
+  flush_validity_memo ();
   err = read_trust_record (ctrl, pk, &rec);
   if (!err)
     {
@@ -1225,6 +1315,108 @@ tdb_check_trustdb_stale (ctrl_t ctrl)
     }
 }
 
+/* A memo of the validities returned by tdb_get_validity_core for the
+ * classic, PGP and direct trust models, where the validity depends
+ * only on the trustdb.  An entry is keyed by the fingerprint of the
+ * primary key and the namehash of the user ID; for a request without
+ * a user ID the namehash is all zeroes.  The memo is only valid for
+ * this process and flushed whenever a trust record is written, the
+ * ownertrust is changed, or a revalidation is scheduled.  */
+#define VALIDITY_MEMO_BUCKETS 1024
+#define VALIDITY_MEMO_MAX     8192
+
+struct validity_memo_s
+{
+  struct validity_memo_s *next;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  byte namehash[20];
+  unsigned int validity;      /* Without TRUST_FLAG_PENDING_CHECK.  */
+  unsigned int disabled_valid:1;  /* The flags to set in the PK.  */
+  unsigned int disabled:1;
+};
+static struct validity_memo_s *validity_memo[VALIDITY_MEMO_BUCKETS];
+static unsigned int validity_memo_count;
+
+
+static void
+flush_validity_memo (void)
+{
+  struct validity_memo_s *m;
+  int i;
+
+  if (!validity_memo_count)
+    return;
+  for (i = 0; i < VALIDITY_MEMO_BUCKETS; i++)
+    while ((m = validity_memo[i]))
+      {
+        validity_memo[i] = m->next;
+        xfree (m);
+      }
+  validity_memo_count = 0;
+}
+
+
+/* Compute the memo key for MAIN_PK and UID into FPR and NAMEHASH and
+ * return the bucket.  Returns -1 if the validity shall not be
+ * memoized.  */
+static int
+validity_memo_key (PKT_public_key *main_pk, PKT_user_id *uid,
+                   byte *fpr, byte *namehash)
+{
+  size_t fprlen;
+
+  if (opt.trust_model != TM_CLASSIC && opt.trust_model != TM_PGP
+      && opt.trust_model != TM_DIRECT)
+    return -1;
+
+  memset (fpr, 0, MAX_FINGERPRINT_LEN);
+  fingerprint_from_pk (main_pk, fpr, &fprlen);
+  if (uid)
+    memcpy (namehash, uid->namehash, 20);
+  else
+    memset (namehash, 0, 20);
+  return ((fpr[fprlen-2] << 8 | fpr[fprlen-1]) ^ namehash[19])
+          % VALIDITY_MEMO_BUCKETS;
+}
+
+
+static struct validity_memo_s *
+lookup_validity_memo (int bucket, const byte *fpr, const byte *namehash)
+{
+  struct validity_memo_s *m;
+
+  for (m = validity_memo[bucket]; m; m = m->next)
+    if (!memcmp (m->fpr, fpr, MAX_FINGERPRINT_LEN)
+        && !memcmp (m->namehash, namehash, 20))
+      return m;
+  return NULL;
+}
+
+
+/* Store VALIDITY for the memo key.  DISABLED is the value set for
+ * the disabled flag of the key or -1 if it was not set.  */
+static void
+store_validity_memo (int bucket, const byte *fpr, const byte *namehash,
+                     unsigned int validity, int disabled)
+{
+  struct validity_memo_s *m;
+
+  if (validity_memo_count >= VALIDITY_MEMO_MAX)
+    flush_validity_memo ();
+  m = xtrycalloc (1, sizeof *m);
+  if (!m)
+    return;
+  memcpy (m->fpr, fpr, MAX_FINGERPRINT_LEN);
+  memcpy (m->namehash, namehash, 20);
+  m->validity = validity;
+  m->disabled_valid = disabled != -1;
+  m->disabled = disabled == 1;
+  m->next = validity_memo[bucket];
+  validity_memo[bucket] = m;
+  validity_memo_count++;
+}
+
+
 /*
  * Return the validity information for KB/PK (at least one of them
  * must be non-NULL).  This is the core of get_validity.  If SIG is
@@ -1248,6 +1440,11 @@ tdb_get_validity_core (ctrl_t ctrl,
   int free_kb = 0;
 #endif
   unsigned int validity = TRUST_UNKNOWN;
+  struct validity_memo_s *memo;
+  byte memo_fpr[MAX_FINGERPRINT_LEN];
+  byte memo_namehash[20];
+  int memo_bucket;
+  int disabled = -1;
 
   if (kb && pk)
     log_assert (keyid_cmp (pk_main_keyid (pk),
@@ -1275,6 +1472,19 @@ tdb_get_validity_core (ctrl_t ctrl,
 
   check_trustdb_stale (ctrl);
 
+  memo_bucket = validity_memo_key (main_pk, uid, memo_fpr, memo_namehash);
+  if (memo_bucket != -1
+      && (memo = lookup_validity_memo (memo_bucket, memo_fpr, memo_namehash)))
+    {
+      if (memo->disabled_valid)
+        {
+          pk->flags.disabled = memo->disabled;
+          pk->flags.disabled_valid = 1;
+        }
+      validity = memo->validity;
+      goto leave_memo;
+    }
+
   if(opt.trust_model==TM_DIRECT)
     {
       /* Note that this happens BEFORE any user ID stuff is checked.
@@ -1454,6 +1664,7 @@ tdb_get_validity_core (ctrl_t ctrl,
       else
 	pk->flags.disabled = 0;
       pk->flags.disabled_valid = 1;
+      disabled = pk->flags.disabled;
     }
 
  leave:
@@ -1470,6 +1681,11 @@ tdb_get_validity_core (ctrl_t ctrl,
     validity |= TRUST_EXPIRED;
 #endif /*!USE_TOFU*/
 
+  if (memo_bucket != -1)
+    store_validity_memo (memo_bucket, memo_fpr, memo_namehash,
+                         validity, disabled);
+
+ leave_memo:
   if (opt.trust_model != TM_TOFU
       && pending_check_trustdb)
     validity |= TRUST_FLAG_PENDING_CHECK;
@@ -1768,6 +1984,72 @@ sanitize_regexp(const char *old)
 }
 
 
+/* The maximum number of compiled trust regexps kept in the cache.  */
+#define REGEXP_CACHE_SIZE 64
+
+/* A compiled trust regexp.  The cache is kept for the length of a
+ * validation run because the same few scoped trust signatures are
+ * usually evaluated for many keys.  */
+struct regexp_cache_s
+{
+  struct regexp_cache_s *next;
+  char *regexp;     /* The sanitized expression.  */
+  int compiled;     /* PAT is valid; otherwise regcomp failed.  */
+  regex_t pat;
+  char expr[1];     /* The expression from the trust signature.  */
+};
+static struct regexp_cache_s *regexp_cache;
+static unsigned int regexp_cache_count;
+
+
+/* Release the cache of compiled trust regexps.  */
+static void
+release_regexp_cache (void)
+{
+  struct regexp_cache_s *r;
+
+  while ((r = regexp_cache))
+    {
+      regexp_cache = r->next;
+      if (r->compiled)
+        regfree (&r->pat);
+      xfree (r->regexp);
+      xfree (r);
+    }
+  regexp_cache_count = 0;
+}
+
+
+/* Return the cache entry for the trust regexp EXPR; it is compiled
+ * and added to the cache on first use.  If the cache is full, an
+ * entry which is not cached is returned and needs to be released by
+ * the caller; this is indicated by setting R_UNCACHED.  */
+static struct regexp_cache_s *
+get_cached_regexp (const char *expr, int *r_uncached)
+{
+  struct regexp_cache_s *r;
+
+  *r_uncached = 0;
+  for (r = regexp_cache; r; r = r->next)
+    if (!strcmp (r->expr, expr))
+      return r;
+
+  r = xmalloc_clear (sizeof *r + strlen (expr));
+  strcpy (r->expr, expr);
+  r->regexp = sanitize_regexp (expr);
+  r->compiled = !regcomp (&r->pat, r->regexp, (REG_ICASE|REG_EXTENDED));
+  if (regexp_cache_count < REGEXP_CACHE_SIZE)
+    {
+      r->next = regexp_cache;
+      regexp_cache = r;
+      regexp_cache_count++;
+    }
+  else
+    *r_uncached = 1;
+  return r;
+}
+
+
 /* Used by validate_one_keyblock to confirm a regexp within a trust
  * signature.  Returns 1 for match, and 0 for no match or regex
  * error. */
@@ -1775,16 +2057,16 @@ static int
 check_regexp (const char *expr,const char *string)
 {
   int ret;
-  char *regexp;
+  struct regexp_cache_s *r;
+  int uncached;
   char *stringbuf = NULL;
-  regex_t pat;
 
-  regexp = sanitize_regexp (expr);
+  r = get_cached_regexp (expr, &uncached);
 
-  ret = regcomp (&pat, regexp, (REG_ICASE|REG_EXTENDED));
-  if (!ret)
+  ret = 1;
+  if (r->compiled)
     {
-      if (*regexp == '<' && !strchr (string, '<')
+      if (*r->regexp == '<' && !strchr (string, '<')
           && is_valid_mailbox (string))
         {
           /* The R.E. starts with an angle bracket but STRING seems to
@@ -1795,17 +2077,23 @@ check_regexp (const char *expr,const char *string)
           stringbuf = xstrconcat ("<", string, ">", NULL);
           string = stringbuf;
         }
-      ret = regexec (&pat, string, 0, NULL, 0);
-      regfree (&pat);
+      ret = regexec (&r->pat, string, 0, NULL, 0);
     }
 
   ret = !ret;
 
   if (DBG_TRUST)
     log_debug ("regexp '%s' ('%s') on '%s'%s: %s\n",
-               regexp, expr, string, stringbuf? " (fixed)":"", ret? "YES":"NO");
+               r->regexp, expr, string, stringbuf? " (fixed)":"",
+               ret? "YES":"NO");
 
-  xfree (regexp);
+  if (uncached)
+    {
+      if (r->compiled)
+        regfree (&r->pat);
+      xfree (r->regexp);
+      xfree (r);
+    }
   xfree (stringbuf);
   return ret;
 }
@@ -2167,6 +2455,348 @@ reset_trust_records (ctrl_t ctrl)
     }
 }
 
+/* Return the highest validity stored for any user ID of the key
+ * with the trust record TREC.  */
+static unsigned int
+stored_validity (TRUSTREC *trec)
+{
+  TRUSTREC vrec;
+  ulong recno;
+  unsigned int validity = TRUST_UNKNOWN;
+
+  for (recno = trec->r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK) > validity)
+        validity = (vrec.r.valid.validity & TRUST_MASK);
+    }
+  return validity;
+}
+
+
+/* Clear the validity records of the key with the trust record TREC
+ * the same way reset_trust_records does.  Caller must sync.  */
+static void
+reset_validity (ctrl_t ctrl, TRUSTREC *trec)
+{
+  TRUSTREC vrec;
+  ulong recno;
+
+  for (recno = trec->r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK)
+          || vrec.r.valid.marginal_count || vrec.r.valid.full_count)
+        {
+          vrec.r.valid.validity &= ~TRUST_MASK;
+          vrec.r.valid.marginal_count = vrec.r.valid.full_count = 0;
+          write_record (ctrl, &vrec);
+        }
+    }
+}
+
+
+/* Build the list of keys which certified a user ID of KEYBLOCK and
+ * were used as trusted introducers by the last validation.  This is
+ * the union of the klists validate_keys would use for KEYBLOCK.  The
+ * depth at which KEYBLOCK would be validated last is stored at
+ * R_DEPTH.  Returns an error if that can't be decided from the
+ * trustdb alone.  */
+static gpg_error_t
+collect_introducers (ctrl_t ctrl, kbnode_t keyblock, u32 *main_kid,
+                     struct key_item **r_klist, int *r_depth)
+{
+  gpg_error_t err = 0;
+  struct key_item *klist = NULL;
+  struct key_item *k;
+  kbnode_t node, snode;
+  PKT_signature *sig;
+  PKT_public_key *spk = NULL;
+  TRUSTREC trec;
+  u32 kid[2];
+
+  *r_depth = 0;
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (!IS_UID_SIG (sig)
+          || (sig->keyid[0] == main_kid[0] && sig->keyid[1] == main_kid[1]))
+        continue;
+      for (k = klist; k; k = k->next)
+        if (k->kid[0] == sig->keyid[0] && k->kid[1] == sig->keyid[1])
+          break;
+      if (k)
+        continue;  /* Already in the list.  */
+
+      /* An ultimately trusted signer makes the key fully valid and
+       * thus an introducer itself.  */
+      if (tdb_keyid_is_utk (sig->keyid))
+        {
+          err = gpg_error (GPG_ERR_TRUE);
+          goto leave;
+        }
+
+      free_public_key (spk);
+      spk = xmalloc_clear (sizeof *spk);
+      if (get_pubkey (ctrl, spk, sig->keyid) || !pk_is_primary (spk))
+        continue;
+      keyid_from_pk (spk, kid);
+      if (kid[0] != sig->keyid[0] || kid[1] != sig->keyid[1])
+        continue;
+      if (read_trust_record (ctrl, spk, &trec))
+        continue;
+      if (stored_validity (&trec) < TRUST_FULLY)
+        continue;  /* Not an introducer.  */
+
+      /* The stored depth is the one of the last validation of the
+       * signer, which may be larger than the one of the first.  Only
+       * if it is below the limit we know that the signer was used. */
+      if (trec.r.trust.depth + 1 >= opt.max_cert_depth)
+        {
+          err = gpg_error (GPG_ERR_TRUE);
+          goto leave;
+        }
+
+      /* Trust signatures on the signer change its klist values;
+       * these are not stored in the trustdb.  */
+      if (opt.trust_model == TM_PGP || opt.trust_model == TM_TOFU_PGP)
+        {
+          kbnode_t skb = get_pubkeyblock (ctrl, kid);
+
+          for (snode = skb; snode; snode = snode->next)
+            if (snode->pkt->pkttype == PKT_SIGNATURE
+                && snode->pkt->pkt.signature->trust_depth)
+              break;
+          release_kbnode (skb);
+          if (snode)
+            {
+              err = gpg_error (GPG_ERR_TRUE);
+              goto leave;
+            }
+        }
+
+      k = new_key_item ();
+      k->kid[0] = kid[0];
+      k->kid[1] = kid[1];
+      k->ownertrust = (trec.r.trust.ownertrust & TRUST_MASK);
+      k->min_ownertrust = trec.r.trust.min_ownertrust;
+      k->next = klist;
+      klist = k;
+      if (trec.r.trust.depth + 1 > *r_depth)
+        *r_depth = trec.r.trust.depth + 1;
+    }
+
+ leave:
+  free_public_key (spk);
+  if (err)
+    release_key_items (klist);
+  else
+    *r_klist = klist;
+  return err;
+}
+
+
+/* Validate the key with the fingerprint HEXFPR which changed since
+ * the last validation.  This is only possible if the key neither was
+ * nor is a trusted introducer, because then no other key depends on
+ * it.  Returns an error if a full validation is required.  */
+static gpg_error_t
+validate_changed_key (ctrl_t ctrl, const char *hexfpr,
+                      u32 curtime, u32 *next_expire)
+{
+  gpg_error_t err;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  int fprlen;
+  PKT_public_key *pk;
+  kbnode_t keyblock = NULL;
+  kbnode_t node;
+  struct key_item *klist = NULL;
+  TRUSTREC trec;
+  u32 kid[2];
+  int depth;
+
+  fprlen = strlen (hexfpr) / 2;
+  if ((fprlen != 20 && fprlen != 32) || hex2bin (hexfpr, fpr, fprlen) < 0)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  err = get_pubkey_byfpr (ctrl, NULL, &keyblock, fpr, fprlen);
+  if (gpg_err_code (err) == GPG_ERR_NO_PUBKEY
+      || gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      /* The key has been deleted; that matters only for an
+       * introducer.  */
+      err = tdbio_search_trust_byfpr (ctrl, fpr, fprlen, &trec);
+      if (!err && stored_validity (&trec) >= TRUST_FULLY)
+        err = gpg_error (GPG_ERR_TRUE);
+      else if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+        err = 0;
+      goto leave;
+    }
+  if (err)
+    goto leave;
+
+  merge_keys_and_selfsig (ctrl, keyblock);
+  clear_kbnode_flags (keyblock);
+  pk = keyblock->pkt->pkt.public_key;
+  keyid_from_pk (pk, kid);
+  if (tdb_keyid_is_utk (kid))
+    {
+      err = gpg_error (GPG_ERR_TRUE);
+      goto leave;
+    }
+  err = read_trust_record (ctrl, pk, &trec);
+  if (!err)
+    {
+      if (stored_validity (&trec) >= TRUST_FULLY)
+        {
+          err = gpg_error (GPG_ERR_TRUE);
+          goto leave;
+        }
+      /* validate_one_keyblock adds to the stored counts.  */
+      reset_validity (ctrl, &trec);
+    }
+  else if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    goto leave;
+
+  /* Revoked and expired keys get no validity (step 5).  */
+  if (pk->has_expired || pk->flags.revoked)
+    {
+      err = 0;
+      goto leave;
+    }
+
+  err = collect_introducers (ctrl, keyblock, kid, &klist, &depth);
+  if (err || !klist)
+    goto leave;
+
+  if (validate_one_keyblock (ctrl, keyblock, klist, curtime, next_expire))
+    {
+      for (node = keyblock; node; node = node->next)
+        if (node->pkt->pkttype == PKT_USER_ID && (node->flag & 4))
+          {
+            /* The key became an introducer.  */
+            err = gpg_error (GPG_ERR_TRUE);
+            goto leave;
+          }
+
+      if (pk->expiredate && pk->expiredate >= curtime
+          && pk->expiredate < *next_expire)
+        *next_expire = pk->expiredate;
+      store_validation_status (ctrl, depth, keyblock);
+    }
+
+ leave:
+  if (err && opt.verbose)
+    log_info ("key %s: %s\n", hexfpr,
+              gpg_err_code (err) == GPG_ERR_TRUE
+              ? "affects other keys" : gpg_strerror (err));
+  release_key_items (klist);
+  release_kbnode (keyblock);
+  return err;
+}
+
+
+/* Try to bring the trustdb up to date by validating only the keys
+ * recorded by tdb_revalidation_mark_key.  Returns 0 on success or an
+ * error code if a full validation is required.  */
+static gpg_error_t
+validate_changed_keys (ctrl_t ctrl)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  estream_t fp;
+  char line[256];
+  strlist_t keys = NULL;
+  strlist_t sl;
+  ulong nextcheck;
+  u32 curtime, next_expire;
+  int nkeys = 0;
+
+  if (opt.trust_model != TM_PGP && opt.trust_model != TM_CLASSIC
+      && opt.trust_model != TM_TOFU_PGP)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (!tdbio_db_matches_options () || tdbio_read_nextcheck () != 1)
+    return gpg_error (GPG_ERR_TRUE);
+
+  fname = changed_keys_fname ();
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!es_fgets (line, sizeof line, fp)
+      || strncmp (line, "nextcheck ", 10))
+    {
+      err = gpg_error (GPG_ERR_INV_VALUE);
+      goto leave;
+    }
+  nextcheck = strtoul (line + 10, NULL, 10);
+  while (es_fgets (line, sizeof line, fp))
+    {
+      trim_spaces (line);
+      if (*line && !strlist_find (keys, line))
+        add_to_strlist (&keys, line);
+    }
+  if (es_ferror (fp))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* A scheduled check is due for another reason.  */
+  curtime = make_timestamp ();
+  if (nextcheck && nextcheck <= curtime)
+    {
+      err = gpg_error (GPG_ERR_TRUE);
+      goto leave;
+    }
+
+  next_expire = 0xffffffff;
+  err = tdbio_begin_transaction ();
+  if (err)
+    goto leave;
+  for (sl = keys; sl; sl = sl->next, nkeys++)
+    {
+      err = validate_changed_key (ctrl, sl->d, curtime, &next_expire);
+      if (err)
+        break;
+    }
+  do_end_transaction ();
+  if (err)
+    goto leave;
+
+  if (next_expire != 0xffffffff && next_expire >= curtime
+      && (!nextcheck || next_expire < nextcheck))
+    nextcheck = next_expire;
+  tdbio_write_nextcheck (ctrl, nextcheck);
+  if (!opt.quiet)
+    {
+      log_info (ngettext ("%d changed key validated\n",
+                          "%d changed keys validated\n", nkeys), nkeys);
+      if (nextcheck)
+        log_info (_("next trustdb check due at %s\n"),
+                  strtimestamp (nextcheck));
+    }
+  do_sync ();
+  es_fclose (fp);
+  fp = NULL;
+  if (gnupg_remove (fname))
+    log_error (_("can't remove '%s': %s\n"),
+               fname, gpg_strerror (gpg_error_from_syserror ()));
+  pending_check_trustdb = 0;
+
+ leave:
+  release_regexp_cache ();
+  es_fclose (fp);
+  xfree (fname);
+  free_strlist (keys);
+  return err;
+}
+
+
 /*
  * Run the key validation procedure.
  *
@@ -2207,6 +2837,12 @@ validate_keys (ctrl_t ctrl, int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable used, full_trust;
   u32 start_time, next_expire;
+  char *fname;
+
+  /* If only some keys changed since the last run and none of them is
+   * a trusted introducer, it suffices to validate just those keys.  */
+  if (!interactive && !validate_changed_keys (ctrl))
+    return 0;
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
@@ -2219,6 +2855,14 @@ validate_keys (ctrl_t ctrl, int interactive)
   if (!kdb)
     return gpg_error_from_syserror ();
 
+  /* Collect all updates and write them in one go at the end.  */
+  rc = tdbio_begin_transaction ();
+  if (rc)
+    {
+      keydb_release (kdb);
+      return rc;
+    }
+
   start_time = make_timestamp ();
   next_expire = 0xffffffff; /* set next expire to the year 2106 */
   used = new_key_hash_table ();
@@ -2445,6 +3089,9 @@ validate_keys (ctrl_t ctrl, int interactive)
   release_key_items (valid_utk_list);
   release_key_hash_table (full_trust);
   release_key_hash_table (used);
+  release_regexp_cache ();
+  /* Write the validity records before the next check is stored.  */
+  do_end_transaction ();
   if (!rc && !quit) /* mark trustDB as checked */
     {
       int rc2;
@@ -2469,6 +3116,12 @@ validate_keys (ctrl_t ctrl, int interactive)
 
       do_sync ();
       pending_check_trustdb = 0;
+
+      fname = changed_keys_fname ();
+      if (!gnupg_access (fname, F_OK) && gnupg_remove (fname))
+        log_error (_("can't remove '%s': %s\n"),
+                   fname, gpg_strerror (gpg_error_from_syserror ()));
+      xfree (fname);
     }
 
   return rc;
@@ -38,6 +38,7 @@
 #include "filter.h"
 #include "../common/ttyio.h"
 #include "../common/i18n.h"
+#include "tofu.h"
 
 
 /****************
@@ -111,7 +112,14 @@ verify_signatures (ctrl_t ctrl, int nfiles, char **files )
     sl = NULL;
     for(i=nfiles-1 ; i > 0 ; i-- )
 	add_to_strlist( &sl, files[i] );
+#ifdef USE_TOFU
+    /* Register the TOFU data of all signatures in one go.  */
+    tofu_begin_batch_update (ctrl);
+#endif
     rc = proc_signature_packets (ctrl, NULL, fp, sl, sigfile );
+#ifdef USE_TOFU
+    tofu_end_batch_update (ctrl);
+#endif
     free_strlist(sl);
     iobuf_close(fp);
     if( (afx && afx->no_openpgp_data && rc == -1)
@@ -186,6 +194,15 @@ verify_one_file (ctrl_t ctrl, const char *name )
     return rc;
 }
 
+
+static gpg_error_t
+verify_one_file_cb (ctrl_t ctrl, const char *name, void *opaque)
+{
+  (void)opaque;
+  return verify_one_file (ctrl, name);
+}
+
+
 /****************
  * Verify each file given in the files array or read the names of the
  * files from stdin.
@@ -197,6 +214,14 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
     int i, rc;
     int first_rc = 0;
 
+    if (multifile_usable (ctrl))
+      return multifile_process (ctrl, nfiles, files, verify_one_file_cb, NULL);
+
+#ifdef USE_TOFU
+    /* Register the TOFU data of all files in one go.  */
+    tofu_begin_batch_update (ctrl);
+#endif
+
     if( !nfiles ) { /* read the filenames from stdin */
 	char line[2048];
 	unsigned int lno = 0;
@@ -205,7 +230,8 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
 	    lno++;
 	    if( !*line || line[strlen(line)-1] != '\n' ) {
 		log_error(_("input line %u too long or missing LF\n"), lno );
-		return GPG_ERR_GENERAL;
+                first_rc = GPG_ERR_GENERAL;
+                break;
 	    }
 	    /* This code does not work on MSDOS but hwo cares there are
 	     * also no script languages available.  We don't strip any
@@ -226,6 +252,9 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
           }
     }
 
+#ifdef USE_TOFU
+    tofu_end_batch_update (ctrl);
+#endif
     return first_rc;
 }
 
@@ -597,6 +597,59 @@ g13_syshelp_i_know_what_i_am_doing (void)
 /* Parse the /etc/gnupg/g13tab for user USERNAME.  Return a table for
    the user on success.  Return NULL on error and print
    diagnostics. */
+/* Parse the comma delimited options field of a g13tab line and
+ * store them in TI; if TI is NULL only check the syntax.  The options
+ * are:
+ *
+ *   discard          - Discard a new container before writing the
+ *                      setup area and allow discards on the mapped
+ *                      device.
+ *   no-workqueue     - Process the I/O of the mapped device directly
+ *                      instead of using the dm-crypt work queues.
+ *   sector-size=<n>  - Create new containers with a dm-crypt sector
+ *                      size of N bytes; N is 512 or 4096.
+ *
+ * Returns 0 on success.  */
+static int
+parse_tab_options (char *string, tab_item_t ti)
+{
+  char *p, *pend;
+  int rc = 0;
+
+  for (p = string; p && *p; p = pend)
+    {
+      pend = strchr (p, ',');
+      if (pend)
+        *pend = 0;
+      if (!strcmp (p, "discard"))
+        {
+          if (ti)
+            ti->discard = 1;
+        }
+      else if (!strcmp (p, "no-workqueue"))
+        {
+          if (ti)
+            ti->no_workqueue = 1;
+        }
+      else if (!strcmp (p, "sector-size=512"))
+        {
+          if (ti)
+            ti->sector_size = 512;
+        }
+      else if (!strcmp (p, "sector-size=4096"))
+        {
+          if (ti)
+            ti->sector_size = 4096;
+        }
+      else
+        rc = -1;
+      if (pend)
+        *pend++ = ',';
+    }
+  return rc;
+}
+
+
 static tab_item_t
 parse_g13tab (const char *username)
 {
@@ -649,7 +702,7 @@ parse_g13tab (const char *username)
         continue;
 
       /* Parse the line.  The format is
-       * <username> <blockdev> [<label>|"-" [<mountpoint>]]
+       * <username> <blockdev> [<label>|"-" [<mountpoint>|"-" [<options>]]]
        */
       xfree (words);
       words = strtokenize (p, " \t");
@@ -681,13 +734,20 @@ parse_g13tab (const char *username)
               continue;
             }
 
-          if (words[3] && *words[3] != '/')
+          if (words[3] && *words[3] != '/' && strcmp (words[3], "-"))
             {
               log_error (_("file '%s', line %d: %s\n"),
                          fname, lnr, "Invalid mountpoint syntax");
               continue;
             }
         }
+      if (words[2] && words[3] && words[4]
+          && parse_tab_options (words[4], NULL))
+        {
+          log_error (_("file '%s', line %d: %s\n"),
+                     fname, lnr, "Invalid options");
+          continue;
+        }
       if (strcmp (words[0], username))
         continue; /* Skip entries for other usernames!  */
 
@@ -700,6 +760,9 @@ parse_g13tab (const char *username)
       ti->next = NULL;
       ti->label = NULL;
       ti->mountpoint = NULL;
+      ti->discard = 0;
+      ti->no_workqueue = 0;
+      ti->sector_size = 0;
       strcpy (ti->blockdev, *words[1]=='/'? words[1] : words[1]+9);
       if (words[2])
         {
@@ -710,13 +773,16 @@ parse_g13tab (const char *username)
               xfree (ti);
               break;
             }
-          if (words[3] && !(ti->mountpoint = xtrystrdup (words[3])))
+          if (words[3] && strcmp (words[3], "-")
+              && !(ti->mountpoint = xtrystrdup (words[3])))
             {
               err = gpg_error_from_syserror ();
               xfree (ti->label);
               xfree (ti);
               break;
             }
+          if (words[3] && words[4])
+            parse_tab_options (words[4], ti);
         }
       *tabletail = ti;
       tabletail = &ti->next;
@@ -31,6 +31,10 @@ struct tab_item_s
   tab_item_t next;
   char *label;       /* Optional malloced label for that entry.  */
   char *mountpoint;  /* NULL or a malloced mountpoint.  */
+  unsigned int discard:1;      /* Discard new containers and allow
+                                  discards on the mapped device.  */
+  unsigned int no_workqueue:1; /* Bypass the dm-crypt work queues.  */
+  unsigned int sector_size;    /* Sector size for new containers or 0.  */
   char blockdev[1];  /* String with the name of the block device.  If
                         it starts with a slash it is a regular device
                         name, otherwise it is a PARTUUID.  */
@@ -79,6 +83,8 @@ gpg_error_t sh_encrypt_keyblob (ctrl_t ctrl,
 
 /*-- sh-blockdev.c --*/
 gpg_error_t sh_blockdev_getsz (const char *name, unsigned long long *r_nblocks);
+gpg_error_t sh_blockdev_discard (int fd, unsigned long long offset,
+                                 unsigned long long nblocks);
 gpg_error_t sh_is_empty_partition (const char *name);
 
 /*-- sh-dmcrypt.c --*/
@@ -99,6 +99,11 @@
 /* For a dm-crypt container this is the used algorithm string.  For
    example: "aes-cbc-essiv:sha256".  */
 
+#define KEYBLOB_TAG_SECTOR_SIZE 11
+/* For a dm-crypt container the sector size in bytes used for the
+   encryption.  If this tag is missing the size is 512.  The size and
+   the offset of the encrypted data are multiples of it.  */
+
 #define KEYBLOB_TAG_KEYNO  16
 /* This tag indicates a new key.  The value is a 4 byte big endian
    integer giving the key number.  If the container type does only
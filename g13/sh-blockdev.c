@@ -25,6 +25,13 @@
 #include <errno.h>
 #include <assert.h>
 #include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
 
 #include "g13-syshelp.h"
 #include <assuan.h>
@@ -50,6 +57,27 @@ sh_blockdev_getsz (const char *name, unsigned long long *r_nblocks)
   char *result;
 
   *r_nblocks = 0;
+
+#ifdef BLKGETSIZE64
+  /* Ask the kernel directly to save the spawning of blockdev.  */
+  {
+    int fd;
+    uint64_t nbytes;
+
+    fd = open (name, O_RDONLY);
+    if (fd != -1)
+      {
+        if (!ioctl (fd, BLKGETSIZE64, &nbytes))
+          {
+            close (fd);
+            *r_nblocks = nbytes / 512;
+            return 0;
+          }
+        close (fd);
+      }
+  }
+#endif /*BLKGETSIZE64*/
+
   argv[0] = "--getsz";
   argv[1] = name;
   argv[2] = NULL;
@@ -69,6 +97,34 @@ sh_blockdev_getsz (const char *name, unsigned long long *r_nblocks)
 }
 
 
+/* Discard NBLOCKS 512 byte sectors starting at sector OFFSET of the
+   block device open as FD.  Returns GPG_ERR_NOT_SUPPORTED if the
+   device or the system does not support this.  */
+gpg_error_t
+sh_blockdev_discard (int fd, unsigned long long offset,
+                     unsigned long long nblocks)
+{
+#ifdef BLKDISCARD
+  uint64_t range[2];
+
+  range[0] = offset * 512;
+  range[1] = nblocks * 512;
+  if (ioctl (fd, BLKDISCARD, range))
+    {
+      if (errno == EOPNOTSUPP || errno == ENOTTY)
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      return gpg_error_from_syserror ();
+    }
+  return 0;
+#else
+  (void)fd;
+  (void)offset;
+  (void)nblocks;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
 /* Return 0 if the device NAME looks like an empty partition. */
 gpg_error_t
 sh_is_empty_partition (const char *name)
@@ -220,6 +220,46 @@ mk_setup_area_prefix (size_t *r_length)
 }
 
 
+/* Build the dm-crypt table for an encrypted area of NBLOCKS sectors
+   on DEVNAME using the algorithm string ALGOSTR of length ALGOSTRLEN
+   and the hex encoded key HEXKEY.  SECTOR_SIZE is the encryption
+   sector size and TI gives the performance options from the g13tab.
+   Returns NULL on error and sets ERRNO.  */
+static char *
+mk_dmcrypt_table (unsigned long long nblocks,
+                  const char *algostr, size_t algostrlen,
+                  const char *hexkey, const char *devname,
+                  unsigned int sector_size, tab_item_t ti)
+{
+  char sectorarg[30];
+  int nopt = 0;
+
+  if (ti->discard)
+    nopt++;
+  if (ti->no_workqueue)
+    nopt += 2;
+  if (sector_size != SECTOR_SIZE)
+    {
+      snprintf (sectorarg, sizeof sectorarg, " sector_size:%u", sector_size);
+      nopt++;
+    }
+  else
+    *sectorarg = 0;
+
+  if (!nopt)
+    return es_bsprintf ("0 %llu crypt %.*s %s 0 %s %d",
+                        nblocks, (int)algostrlen, algostr,
+                        hexkey, devname, HEADER_SECTORS);
+  return es_bsprintf ("0 %llu crypt %.*s %s 0 %s %d %d%s%s%s",
+                      nblocks, (int)algostrlen, algostr,
+                      hexkey, devname, HEADER_SECTORS, nopt,
+                      ti->discard? " allow_discards" : "",
+                      ti->no_workqueue?
+                      " no_read_workqueue no_write_workqueue" : "",
+                      sectorarg);
+}
+
+
 /* Create a new g13 style DM-Crypt container on device DEVNAME.  */
 gpg_error_t
 sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
@@ -243,12 +283,17 @@ sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
   const char *s;
   unsigned char *packet;
   int copy;
+  unsigned int sector_size;
+  unsigned long long totalblocks;
 
   if (!ctrl->devti)
     return gpg_error (GPG_ERR_INV_ARG);
 
   g13_syshelp_i_know_what_i_am_doing ();
 
+  sector_size = ctrl->devti->sector_size? ctrl->devti->sector_size
+    /**/                                : SECTOR_SIZE;
+
   header_space_size = SETUP_AREA_SECTORS * SECTOR_SIZE;
   header_space = xtrymalloc (header_space_size);
   if (!header_space)
@@ -323,9 +368,15 @@ sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
       goto leave;
     }
   append_tuple_uint (&keyblob, KEYBLOB_TAG_CONT_NSEC, nblocks);
+  totalblocks = nblocks;
   nblocks -= HEADER_SECTORS + FOOTER_SECTORS;
+  /* With larger sectors the encrypted area must be a multiple of
+     them; the rest is left unused.  */
+  nblocks -= nblocks % (sector_size / SECTOR_SIZE);
   append_tuple_uint (&keyblob, KEYBLOB_TAG_ENC_NSEC, nblocks);
   append_tuple_uint (&keyblob, KEYBLOB_TAG_ENC_OFF, HEADER_SECTORS);
+  if (sector_size != SECTOR_SIZE)
+    append_tuple_uint (&keyblob, KEYBLOB_TAG_SECTOR_SIZE, sector_size);
 
   /* Device mapper needs a name for the device: Take it from the label
      or use "0".  */
@@ -355,8 +406,8 @@ sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
   /* Build dmcrypt table. */
   s = "aes-cbc-essiv:sha256";
   append_tuple (&keyblob, KEYBLOB_TAG_ALGOSTR, s, strlen (s));
-  table = es_bsprintf ("0 %llu crypt %s %s 0 %s %d",
-                       nblocks, s, hexkey, devname, HEADER_SECTORS);
+  table = mk_dmcrypt_table (nblocks, s, strlen (s), hexkey, devname,
+                            sector_size, ctrl->devti);
   if (!table)
     {
       err = gpg_error_from_syserror ();
@@ -431,6 +482,24 @@ sh_dmcrypt_create_container (ctrl_t ctrl, const char *devname, estream_t devfp)
   if (header_space_used != header_space_size)
     BUG ();
 
+  /* Discarding the device is much faster than any kind of
+     initialization and gives the flash translation layer of an SSD
+     the free space back.  Note that this makes it visible which parts
+     of the container have been written.  */
+  if (ctrl->devti->discard)
+    {
+      err = sh_blockdev_discard (es_fileno (devfp), 0, totalblocks);
+      if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+        log_info ("device '%s' does not support discard\n", devname);
+      else if (err)
+        {
+          log_error ("error discarding '%s': %s\n",
+                     devname, gpg_strerror (err));
+          goto leave;
+        }
+      err = 0;
+    }
+
   /* Create the container.  */
   {
     const char *argv[3];
@@ -555,12 +624,30 @@ sh_dmcrypt_mount_container (ctrl_t ctrl, const char *devname,
   const char *s;
   const char *algostr;
   size_t algostrlen;
+  unsigned long long sector_size;
 
   if (!ctrl->devti)
     return gpg_error (GPG_ERR_INV_ARG);
 
   g13_syshelp_i_know_what_i_am_doing ();
 
+  /* Get the sector size.  */
+  err = find_tuple_uint (keyblob, KEYBLOB_TAG_SECTOR_SIZE, &sector_size);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      sector_size = SECTOR_SIZE;
+      err = 0;
+    }
+  else if (!err && sector_size != SECTOR_SIZE
+           && sector_size != PHY_SECTOR_SIZE)
+    err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (err)
+    {
+      log_error ("error getting sector size from keyblob: %s\n",
+                 gpg_strerror (err));
+      goto leave;
+    }
+
   /* Check that the device is not yet used by device mapper. */
   err = check_blockdev (devname, 0);
   if (err)
@@ -597,6 +684,7 @@ sh_dmcrypt_mount_container (ctrl_t ctrl, const char *devname,
       goto leave;
     }
   nblocks -= HEADER_SECTORS + FOOTER_SECTORS;
+  nblocks -= nblocks % (sector_size / SECTOR_SIZE);
   err = find_tuple_uint (keyblob, KEYBLOB_TAG_ENC_NSEC, &nblocks2);
   if (err)
     {
@@ -666,9 +754,8 @@ sh_dmcrypt_mount_container (ctrl_t ctrl, const char *devname,
   bin2hex (s, 16, hexkey);
 
   /* Build dmcrypt table. */
-  table = es_bsprintf ("0 %llu crypt %.*s %s 0 %s %d",
-                       nblocks, (int)algostrlen, algostr,
-                       hexkey, devname, HEADER_SECTORS);
+  table = mk_dmcrypt_table (nblocks, algostr, algostrlen, hexkey, devname,
+                            (unsigned int)sector_size, ctrl->devti);
   wipememory (hexkey, sizeof hexkey);
   if (!table)
     {
@@ -30,20 +30,24 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include "../common/i18n.h"
 #include "../common/host2net.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
 #include "backend.h"
 #include "keybox-defs.h"
 
 
-/* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
-#define NO_OF_KEY_ITEM_BUCKETS          383
-#define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
-#define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
+/* The default memory limit of the cache in MiB.  The size of the
+ * hash tables is derived from the limit using the average size of a
+ * blob and the average number of keys per blob.  */
+#define DEFAULT_CACHE_SIZE  32
+#define AVG_BLOB_SIZE       4096
+#define AVG_KEYS_PER_BLOB   4
+#define MIN_BUCKETS         383
 
 
 /* Our definition of the backend handle.  */
@@ -58,9 +62,11 @@ struct backend_handle_s
 typedef struct blob_s
 {
   struct blob_s *next;
+  struct blob_s *lru_prev;    /* Links for the LRU list.  */
+  struct blob_s *lru_next;
+  unsigned long lastuse;      /* Value of the cache clock at last use.  */
   enum pubkey_types pktype;
   unsigned int refcount;
-  unsigned int usecount;
   unsigned int datalen;
   unsigned char *data;        /* The actual data of length DATALEN.  */
   unsigned char ubid[UBID_LEN];
@@ -69,9 +75,8 @@ typedef struct blob_s
 
 static blob_t *blob_table;                /* Hash table with the blobs.   */
 static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int blob_table_added;     /* Number of items added.       */
-static unsigned int blob_table_dropped;   /* Number of items dropped.     */
+static blob_t blob_lru_head;              /* Most recently used blob.     */
+static blob_t blob_lru_tail;              /* Least recently used blob.    */
 static blob_t blob_attic;                 /* List of freed blobs.         */
 
 
@@ -106,8 +111,10 @@ static bloblist_t bloblist_attic;  /* List of freed items.  */
 typedef struct key_item_s
 {
   struct key_item_s *next;
+  struct key_item_s *lru_prev; /* Links for the LRU list.  */
+  struct key_item_s *lru_next;
+  unsigned long lastuse;   /* Value of the cache clock at last use.  */
   bloblist_t  blist;       /* List of blobs or NULL for not-found.  */
-  unsigned int usecount;
   unsigned int refcount;   /* Reference counter for this item.  */
   u32 kid_h;               /* Upper 4 bytes of the keyid.  */
   u32 kid_l;               /* Lower 4 bytes of the keyid.  */
@@ -115,32 +122,51 @@ typedef struct key_item_s
 
 static key_item_t *key_table;            /* Hash table with the keys.    */
 static size_t key_table_size;            /* Number of allocated buckets. */
-static unsigned int key_table_threshold; /* Max. # of items per bucket.  */
-static unsigned int key_table_added;     /* Number of items added.       */
-static unsigned int key_table_dropped;   /* Number of items dropped.     */
+static key_item_t key_lru_head;          /* Most recently used item.     */
+static key_item_t key_lru_tail;          /* Least recently used item.    */
 static key_item_t key_item_attic;        /* List of freed items.         */
 
 
+/* The memory accounting and the statistics of the cache.  Blobs and
+ * key items are kept on separate LRU lists but share the memory
+ * limit; the clock allows to evict the older of the two tails.  */
+static struct
+{
+  size_t limit;                 /* Memory limit in bytes.  */
+  size_t used;                  /* Memory used by the cached items.  */
+  unsigned long clock;          /* Incremented on each use of an item.  */
+  unsigned int nblobs;          /* Number of cached blobs.  */
+  unsigned int nkeys;           /* Number of cached key items.  */
+  unsigned long hits;           /* Searches answered from the cache.  */
+  unsigned long misses;         /* Searches passed on to the database.  */
+  unsigned long blobs_evicted;  /* Number of blobs evicted.  */
+  unsigned long keys_evicted;   /* Number of key items evicted.  */
+} cache;
+
+
+static void cache_shrink (void);
+
+
 
-
 /* The hash function we use for the key_table.  Must not call a system
  * function.  */
 static inline unsigned int
 blob_table_hasher (const unsigned char *ubid)
 {
-  return (ubid[0] << 16 | ubid[1]) % blob_table_size;
+  return buf32_to_uint (ubid) % blob_table_size;
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the blob table.  Its size is derived from
+ * the memory limit of the cache.  */
 static gpg_error_t
 blob_table_init (void)
 {
   if (blob_table)
     return 0;
-  blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
+  blob_table_size = cache.limit / AVG_BLOB_SIZE;
+  if (blob_table_size < MIN_BUCKETS)
+    blob_table_size = MIN_BUCKETS;
   blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
   if (!blob_table)
     return gpg_error_from_syserror ();
@@ -167,6 +193,59 @@ blob_unref (blob_t blob)
 }
 
 
+/* Remove the blob B from the LRU list.  */
+static void
+blob_lru_unlink (blob_t b)
+{
+  if (b->lru_prev)
+    b->lru_prev->lru_next = b->lru_next;
+  else
+    blob_lru_head = b->lru_next;
+  if (b->lru_next)
+    b->lru_next->lru_prev = b->lru_prev;
+  else
+    blob_lru_tail = b->lru_prev;
+  b->lru_prev = b->lru_next = NULL;
+}
+
+
+/* Put the blob B at the head of the LRU list.  */
+static void
+blob_lru_push (blob_t b)
+{
+  b->lastuse = ++cache.clock;
+  b->lru_prev = NULL;
+  b->lru_next = blob_lru_head;
+  if (blob_lru_head)
+    blob_lru_head->lru_prev = b;
+  else
+    blob_lru_tail = b;
+  blob_lru_head = b;
+}
+
+
+/* Remove the blob B from the cache.  */
+static void
+blob_evict (blob_t b)
+{
+  blob_t *bp;
+
+  for (bp = &blob_table[blob_table_hasher (b->ubid)]; *bp; bp = &(*bp)->next)
+    if (*bp == b)
+      {
+        *bp = b->next;
+        break;
+      }
+  b->next = NULL;
+  blob_lru_unlink (b);
+  cache.used -= sizeof *b + b->datalen;
+  memstat_free (MEMSTAT_KBX_CACHE, sizeof *b + b->datalen);
+  cache.nblobs--;
+  cache.blobs_evicted++;
+  blob_unref (b);
+}
+
+
 /* Given the hash value and the ubid, find the blob in the bucket.
  * Returns NULL if not found or the blob item if found.  Always
  * returns the the number of items searched, which is in the case of a
@@ -187,23 +266,6 @@ find_blob (unsigned int hash, const unsigned char *ubid,
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
-{
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
-
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
-}
-
-
 /* Put the blob (BLOBDATA, BLOBDATALEN) into the cache using UBID as
  * the index.  If it is already in the cache nothing happens.  */
 static void
@@ -212,12 +274,12 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
 {
   unsigned int hash;
   blob_t b;
-  unsigned int count, n;
+  unsigned int n;
   void *blobdatacopy = NULL;
 
   hash = blob_table_hasher (ubid);
  find_again:
-  b = find_blob (hash, ubid, &count);
+  b = find_blob (hash, ubid, NULL);
   if (b)
     {
       xfree (blobdatacopy);
@@ -237,72 +299,6 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
       memcpy (blobdatacopy, blobdata, blobdatalen);
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
-    {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
-        {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
-        }
-    }
-
   /* Add an item to the bucket.  We allocate a whole block of items
    * for cache performance reasons.  */
   if (!blob_attic)
@@ -339,11 +335,15 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
   b->data = blobdatacopy;
   b->datalen = blobdatalen;
   memcpy (b->ubid, ubid, UBID_LEN);
-  b->usecount = 1;
   b->refcount = 1;
   b->next = blob_table[hash];
   blob_table[hash] = b;
-  blob_table_added++;
+  blob_lru_push (b);
+  cache.used += sizeof *b + blobdatalen;
+  memstat_alloc (MEMSTAT_KBX_CACHE, sizeof *b + blobdatalen);
+  cache.nblobs++;
+
+  cache_shrink ();
 }
 
 
@@ -359,7 +359,8 @@ blob_table_get (const unsigned char *ubid)
   b = find_blob (hash, ubid, NULL);
   if (b)
     {
-      b->usecount++;
+      blob_lru_unlink (b);
+      blob_lru_push (b);
       b->refcount++;
       return b;  /* Found  */
     }
@@ -378,15 +379,16 @@ key_table_hasher (u32 kid_l)
 }
 
 
-/* Runtime allocation of the key table.  This allows us to eventually
- * add an option to control the size.  */
+/* Runtime allocation of the key table.  Its size is derived from
+ * the memory limit of the cache.  */
 static gpg_error_t
 key_table_init (void)
 {
   if (key_table)
     return 0;
-  key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_threshold  = KEY_ITEMS_PER_BUCKET_THRESHOLD;
+  key_table_size = cache.limit / AVG_BLOB_SIZE * AVG_KEYS_PER_BLOB;
+  if (key_table_size < MIN_BUCKETS)
+    key_table_size = MIN_BUCKETS;
   key_table = xtrycalloc (key_table_size, sizeof *key_table);
   if (!key_table)
     return gpg_error_from_syserror ();
@@ -441,20 +443,82 @@ find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l,
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_key_items (const void *arg_a, const void *arg_b)
+/* Remove the key item KI from the LRU list.  */
+static void
+key_lru_unlink (key_item_t ki)
 {
-  const key_item_t a = *(const key_item_t *)arg_a;
-  const key_item_t b = *(const key_item_t *)arg_b;
+  if (ki->lru_prev)
+    ki->lru_prev->lru_next = ki->lru_next;
+  else
+    key_lru_head = ki->lru_next;
+  if (ki->lru_next)
+    ki->lru_next->lru_prev = ki->lru_prev;
+  else
+    key_lru_tail = ki->lru_prev;
+  ki->lru_prev = ki->lru_next = NULL;
+}
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
+
+/* Put the key item KI at the head of the LRU list.  */
+static void
+key_lru_push (key_item_t ki)
+{
+  ki->lastuse = ++cache.clock;
+  ki->lru_prev = NULL;
+  ki->lru_next = key_lru_head;
+  if (key_lru_head)
+    key_lru_head->lru_prev = ki;
   else
-    return 1;
+    key_lru_tail = ki;
+  key_lru_head = ki;
+}
+
+
+/* Remove the key item KI from the cache.  */
+static void
+key_item_evict (key_item_t ki)
+{
+  key_item_t *kip;
+  bloblist_t bl;
+
+  for (kip = &key_table[key_table_hasher (ki->kid_l)]; *kip;
+       kip = &(*kip)->next)
+    if (*kip == ki)
+      {
+        *kip = ki->next;
+        break;
+      }
+  ki->next = NULL;
+  key_lru_unlink (ki);
+  cache.used -= sizeof *ki;
+  memstat_free (MEMSTAT_KBX_CACHE, sizeof *ki);
+  for (bl = ki->blist; bl; bl = bl->next)
+    {
+      cache.used -= sizeof *bl;
+      memstat_free (MEMSTAT_KBX_CACHE, sizeof *bl);
+    }
+  cache.nkeys--;
+  cache.keys_evicted++;
+  key_item_unref (ki);
+}
+
+
+/* Evict the least recently used blobs and key items until the memory
+ * used by the cache is within its limit.  No system calls are done
+ * here.  */
+static void
+cache_shrink (void)
+{
+  while (cache.used > cache.limit)
+    {
+      if (blob_lru_tail
+          && (!key_lru_tail || blob_lru_tail->lastuse < key_lru_tail->lastuse))
+        blob_evict (blob_lru_tail);
+      else if (key_lru_tail)
+        key_item_evict (key_lru_tail);
+      else
+        break;
+    }
 }
 
 
@@ -545,85 +609,6 @@ new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
 }
 
 
-/* If the list of key item in the bucken HASH is full remove a couple
- * of them.  On error a diagnostic is printed and an error code
- * return.  Note that the error code GPG_ERR_TRUE is returned if any
- * flush and thus system calls were done.
- */
-static gpg_error_t
-maybe_flush_some_key_buckets (unsigned int hash, unsigned int count)
-{
-  gpg_error_t err;
-  key_item_t ki, list_head, *list_tailp, ki_next;
-  key_item_t *array;
-  int narray, idx;
-
-  if (count < key_table_threshold)
-    return 0;  /* Nothing to do.  */
-
-  /* Unlink from the global list so that other threads don't disturb
-   * us.  If another thread adds or removes something only one will be
-   * the winner.  Bad luck for the dropped cache items but after all
-   * it is just a cache.  */
-  list_head = key_table[hash];
-  key_table[hash] = NULL;
-
-  /* Put all items into an array for sorting.  */
-  array = xtrycalloc (count, sizeof *array);
-  if (!array)
-    {
-      /* That's bad; give up all items of the bucket.  */
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while purging from the cache: %s\n",
-                gpg_strerror (err));
-      goto leave;
-    }
-  narray = 0;
-  for (ki = list_head; ki; ki = ki_next)
-    {
-      ki_next = ki->next;
-      array[narray++] = ki;
-      ki->next = NULL;
-    }
-  log_assert (narray == count);
-
-  /* Sort the array and put half of it onto a new list.  */
-  qsort (array, narray, sizeof *array, compare_key_items);
-  list_head = NULL;
-  list_tailp = &list_head;
-  for (idx=0; idx < narray/2; idx++)
-    {
-      *list_tailp = array[idx];
-      list_tailp = &array[idx]->next;
-    }
-
-  /* Put the new list into the bucket.  */
-  ki = key_table[hash];
-  key_table[hash] = list_head;
-  list_head = ki;
-
-  /* Free the remaining items and the array.  */
-  for (; idx < narray; idx++)
-    {
-      key_item_unref (array[idx]);
-      key_table_dropped++;
-    }
-  xfree (array);
-  err = gpg_error (GPG_ERR_TRUE);
-
- leave:
-  /* Free any items added in the meantime by other threads.  This is
-   * also used in case of a malloc problem (which won't update the
-   * counters, though). */
-  for ( ; list_head; list_head = ki_next)
-    {
-      ki_next = list_head->next;
-      key_item_unref (list_head);
-    }
-  return err;
-}
-
-
 /* This is the core of
  *   key_table_put,
  *   key_table_put_no_fpr,
@@ -637,14 +622,13 @@ do_key_table_put (u32 kid_h, u32 kid_l,
   unsigned int hash;
   key_item_t ki;
   bloblist_t bl, bl_tail;
-  unsigned int count;
   int do_find_again;
   int mark_not_found = !fpr;
 
   hash = key_table_hasher (kid_l);
  find_again:
   do_find_again = 0;
-  ki = find_in_chain (hash, kid_h, kid_l, &count);
+  ki = find_in_chain (hash, kid_h, kid_l, NULL);
   if (ki)
     {
       if (mark_not_found)
@@ -673,18 +657,15 @@ do_key_table_put (u32 kid_h, u32 kid_l,
         bl_tail->next = bl;
       else
         ki->blist = bl;
+      key_lru_unlink (ki);
+      key_lru_push (ki);
+      cache.used += sizeof *bl;
+      memstat_alloc (MEMSTAT_KBX_CACHE, sizeof *bl);
 
+      cache_shrink ();
       return;
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (maybe_flush_some_key_buckets (hash, count))
-    {
-      /* During the function call another thread might have changed
-       * the bucket.  Thus we need to start over.  */
-      do_find_again = 1;
-    }
-
   if (!key_item_attic)
     {
       if (alloc_more_key_items ())
@@ -715,12 +696,21 @@ do_key_table_put (u32 kid_h, u32 kid_l,
 
   ki->kid_h = kid_h;
   ki->kid_l = kid_l;
-  ki->usecount = 1;
   ki->refcount = 1;
 
   ki->next = key_table[hash];
   key_table[hash] = ki;
-  key_table_added++;
+  key_lru_push (ki);
+  cache.used += sizeof *ki;
+  memstat_alloc (MEMSTAT_KBX_CACHE, sizeof *ki);
+  if (ki->blist)
+    {
+      cache.used += sizeof *ki->blist;
+      memstat_alloc (MEMSTAT_KBX_CACHE, sizeof *ki->blist);
+    }
+  cache.nkeys++;
+
+  cache_shrink ();
 }
 
 
@@ -796,7 +786,8 @@ key_table_get (u32 kid_h, u32 kid_l)
   ki = find_in_chain (hash, kid_h, kid_l, NULL);
   if (ki)
     {
-      ki->usecount++;
+      key_lru_unlink (ki);
+      key_lru_push (ki);
       ki->refcount++;
       return ki;  /* Found  */
     }
@@ -846,12 +837,55 @@ query_by_fpr (const unsigned char *fpr, unsigned int fprlen)
 
 
 
-/* Make sure the tables are initialized.  */
+/* Make sure the tables are initialized.  The memory limit is taken
+ * from --cache-size at the first call.  */
+static unsigned long long
+metric_hits (void)
+{
+  return cache.hits;
+}
+
+static unsigned long long
+metric_misses (void)
+{
+  return cache.misses;
+}
+
+static unsigned long long
+metric_evicted (void)
+{
+  return cache.blobs_evicted;
+}
+
+static unsigned long long
+metric_used (void)
+{
+  return cache.used;
+}
+
+
 gpg_error_t
 be_cache_initialize (void)
 {
   gpg_error_t err;
 
+  if (!cache.limit)
+    {
+      cache.limit = opt.cache_size? opt.cache_size : DEFAULT_CACHE_SIZE;
+      if (cache.limit > ((size_t)-1 >> 20))
+        cache.limit = ((size_t)-1 >> 20);
+      cache.limit <<= 20;
+
+      metrics_fnc ("cache_hits_total", METRIC_COUNTER,
+                   "Lookups found in the key cache.", metric_hits);
+      metrics_fnc ("cache_misses_total", METRIC_COUNTER,
+                   "Lookups not found in the key cache.", metric_misses);
+      metrics_fnc ("cache_evictions_total", METRIC_COUNTER,
+                   "Blobs evicted from the key cache.", metric_evicted);
+      metrics_fnc ("cache_used_bytes", METRIC_GAUGE,
+                   "Memory used by the key cache.", metric_used);
+    }
+
   err = blob_table_init ();
   if (!err)
     err = key_table_init ();
@@ -1079,10 +1113,34 @@ be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd, db_request_t request,
     err = gpg_error (GPG_ERR_EOF);
 
  leave:
+  if (desc)
+    {
+      if (!err || gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+        cache.hits++;
+      else if (gpg_err_code (err) == GPG_ERR_EOF
+               || gpg_err_code (err) == GPG_ERR_MISSING_VALUE)
+        cache.misses++;
+    }
   return err;
 }
 
 
+/* Return a malloced string with the statistics of the cache or NULL
+ * on error.  The string consists of space separated NAME=VALUE
+ * items.  */
+char *
+be_cache_stats (void)
+{
+  return xtryasprintf ("limit=%lu used=%lu blobs=%u keys=%u"
+                       " hits=%lu misses=%lu"
+                       " blobs_evicted=%lu keys_evicted=%lu",
+                       (unsigned long)cache.limit, (unsigned long)cache.used,
+                       cache.nblobs, cache.nkeys,
+                       cache.hits, cache.misses,
+                       cache.blobs_evicted, cache.keys_evicted);
+}
+
+
 /* Mark the last cached item as the final item.  This is called when
  * the actual database returned EOF in respond to a restart from the
  * last cached UBID.  */
@@ -1149,7 +1207,11 @@ be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
       struct _keybox_openpgp_info info;
       struct _keybox_openpgp_key_info *kinfo;
 
+      /* Parse without holding the nPth lock; the tables are only
+       * touched after that.  */
+      npth_unprotect ();
       err = _keybox_parse_openpgp (blob, bloblen, NULL, &info);
+      npth_protect ();
       if (err)
         {
           log_info ("cache: error parsing OpenPGP blob: %s\n",
@@ -29,6 +29,7 @@
 #include "keyboxd.h"
 #include "../common/i18n.h"
 #include "../common/mbox-util.h"
+#include "../common/membuf.h"
 #include "backend.h"
 #include "keybox-search-desc.h"
 #include "keybox-defs.h"  /* (for the openpgp parser) */
@@ -45,11 +46,49 @@ struct backend_handle_s
 };
 
 
+/* The maximum number of prepared select statements we keep for a
+ * read-only connection.  */
+#define MAX_CACHED_SELECTS 16
+
+/* The maximum number of search descriptions combined into one select
+ * using an IN list.  */
+#define MAX_IN_DESCS 32
+
+/* A read-only connection along with the select statements prepared
+ * on it.  The statements are keyed by the search mode, the filter
+ * flags and the number of descriptions in the IN list.  The oldest
+ * entry comes first.  */
+struct reader_s
+{
+  sqlite3 *db;
+  unsigned int nstmts;
+  struct {
+    KeydbSearchMode mode;
+    unsigned int filter;
+    unsigned int nin;
+    sqlite3_stmt *stmt;
+  } stmts[MAX_CACHED_SELECTS];
+};
+typedef struct reader_s *reader_t;
+
+
 /* Definition of local request data.  */
 struct be_sqlite_local_s
 {
-  /* The statement object of the current select command.  */
+  /* The statement object of the current select command and the
+   * connection it has been prepared on.  */
   sqlite3_stmt *select_stmt;
+  sqlite3 *select_db;
+
+  /* The read-only connection used by this request or NULL.  */
+  reader_t reader;
+
+  /* Flag indicating that SELECT_STMT is owned by the statement cache
+   * of READER.  */
+  unsigned int select_cached : 1;
+
+  /* The number of descriptions handled by the current select.  */
+  unsigned int select_nin;
 
   /* The column numbers for UIDNO and SUBKEY or 0.  */
   int select_col_uidno;
@@ -82,15 +121,43 @@ struct be_sqlite_local_s
 };
 
 
-/* The Mutex we use to protect all our SQLite calls.  */
+/* The Mutex we use to protect all calls using DATABASE_HD.  */
 static npth_mutex_t database_mutex = NPTH_MUTEX_INITIALIZER;
-/* The one and only database handle. */
+/* The one and only database handle used for writing.  */
 static sqlite3 *database_hd;
+/* Searches use their own read-only connections so that they can run
+ * concurrently with each other and with a writer.  The connections
+ * of finished requests are kept here for reuse.  */
+#define MAX_IDLE_READERS 8
+static reader_t idle_readers[MAX_IDLE_READERS];
+static unsigned int n_idle_readers;
+
+/* The statements used with DATABASE_HD to store keys; see
+ * get_writer_stmt.  */
+enum writer_stmt_ids
+  {
+    WSTMT_PUBKEY_UPDATE,
+    WSTMT_PUBKEY_INSERT,
+    WSTMT_PUBKEY_AUTO,
+    WSTMT_FINGERPRINT,
+    WSTMT_USERID,
+    WSTMT_ISSUER,
+    WSTMT_DEL_FINGERPRINT,
+    WSTMT_DEL_USERID,
+    WSTMT_DEL_ISSUER,
+    WSTMT_SAVEPOINT,
+    WSTMT_RELEASE,
+    WSTMT_ROLLBACK_TO,
+    WSTMT_LAST
+  };
+static sqlite3_stmt *writer_stmts[WSTMT_LAST];
+
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
 
-/* The version of our current database schema.  */
-#define DATABASE_VERSION 1
+/* The version of our current database schema.  Version 2 added the
+ * metadata columns to the fingerprint and userid tables.  */
+#define DATABASE_VERSION 2
 
 /* Table definitions for the database.  */
 static struct
@@ -141,7 +208,19 @@ static struct
       * order number for the keys similar to uidno.  */
      "subkey INTEGER NOT NULL,"
      /* The Unique Blob ID (possibly truncated fingerprint).  */
-     "ubid BLOB NOT NULL REFERENCES pubkey"
+     "ubid BLOB NOT NULL REFERENCES pubkey,"
+     /* The following columns are computed from the verified
+      * self-signatures of OpenPGP keys; they are NULL for X.509 and
+      * if no valid self-signature was found.  See also
+      * upgrade_database.  */
+     /* The creation time of the key.  */
+     "created INTEGER,"
+     /* The expiration time of the key or 0 for none.  */
+     "expires INTEGER,"
+     /* The OpenPGP key flags.  */
+     "keyflags INTEGER,"
+     /* 1 if the key has been revoked.  */
+     "revoked INTEGER"
      ")"  },
 
    /* Indices for the fingerprint table.  */
@@ -163,7 +242,12 @@ static struct
       * with 1 for the first user id in the keyblock.  */
      "uidno INTEGER NOT NULL,"
      /* The Unique Blob ID (possibly truncated fingerprint).  */
-     "ubid BLOB NOT NULL REFERENCES pubkey"
+     "ubid BLOB NOT NULL REFERENCES pubkey,"
+     /* 1 if this is the primary user id and 1 if it has been
+      * revoked.  As with the fingerprint table these are NULL if
+      * not known.  */
+     "isprimary INTEGER,"
+     "revoked INTEGER"
      ")"  },
 
    /* Indices for the userid table.  */
@@ -185,6 +269,27 @@ static struct
   };
 
 
+/* Optional full-text indices over the uid column of the userid
+ * table.  They are FTS5 tables using the userid table as external
+ * content and are kept in sync by triggers, so that any insert or
+ * delete of a user id also updates the indices.  The trigram index
+ * is used for substring searches and the unicode61 index for word
+ * searches.  An index is not used if it could not be created; for
+ * example because the sqlite library lacks FTS5 support.  */
+#define UID_INDEX_SUBSTR 0
+#define UID_INDEX_WORDS  1
+static struct
+{
+  const char *name;
+  const char *tokenizer;
+  int available;
+} uid_indices[] =
+  {
+   { "uidsubstr", "trigram" },
+   { "uidwords",  "unicode61 remove_diacritics 0" }
+  };
+
+
 /*-- prototypes --*/
 static gpg_error_t get_config_value (const char *name, char **r_value);
 static gpg_error_t set_config_value (const char *name, const char *value);
@@ -315,11 +420,12 @@ run_sql_reset (sqlite3_stmt *stmt)
 }
 
 
-/* Run an SQL prepare for SQLSTR and return a statement at R_STMT.  If
- * EXTRA or EXTRA2 are not NULL these parts are appended to the SQL
- * statement.  */
+/* Run an SQL prepare for SQLSTR on the connection DB and return a
+ * statement at R_STMT.  If EXTRA or EXTRA2 are not NULL these parts
+ * are appended to the SQL statement.  */
 static gpg_error_t
-run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
+run_sql_prepare (sqlite3 *db, const char *sqlstr,
+                 const char *extra, const char *extra2,
                  sqlite3_stmt **r_stmt)
 {
   gpg_error_t err;
@@ -334,7 +440,7 @@ run_sql_prepare (const char *sqlstr, const char *extra, const char *extra2,
       sqlstr = buffer;
     }
 
-  res = sqlite3_prepare_v2 (database_hd, sqlstr, -1, r_stmt, NULL);
+  res = sqlite3_prepare_v2 (db, sqlstr, -1, r_stmt, NULL);
   if (res)
     err = diag_prepare_err (res, sqlstr);
   else
@@ -377,6 +483,22 @@ run_sql_bind_int (sqlite3_stmt *stmt, int no, int value)
 }
 
 
+/* Helper to bind a 64 bit INTEGER parameter to a statement.  */
+static gpg_error_t
+run_sql_bind_int64 (sqlite3_stmt *stmt, int no, sqlite3_int64 value)
+{
+  gpg_error_t err;
+  int res;
+
+  res = sqlite3_bind_int64 (stmt, no, value);
+  if (res)
+    err = diag_bind_err (res, stmt);
+  else
+    err = 0;
+  return err;
+}
+
+
 /* Helper to bind a string parameter to a statement.  VALUE is allowed
  * to be NULL to bind NULL.  */
 static gpg_error_t
@@ -439,6 +561,54 @@ run_sql_bind_text_like (sqlite3_stmt *stmt, int no, const char *value)
 }
 
 
+/* Helper to bind a word search for VALUE to a statement.  VALUE is
+ * split into words the same way keyring.c does it for WORDS searches
+ * and a full-text query requiring all words is bound.  */
+static gpg_error_t
+run_sql_bind_words_match (sqlite3_stmt *stmt, int no, const char *value)
+{
+  gpg_error_t err;
+  int res;
+  char *buf, *p;
+  const unsigned char *s;
+
+  /* In the worst case a one octet word and its delimiter expand to
+   * four octets.  */
+  buf = xtrymalloc (3 * strlen (value) + 1);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  p = buf;
+  for (s = (const unsigned char *)value; *s; )
+    {
+      if (!alnump (s) && *s < 0x80)
+        {
+          s++;
+          continue;
+        }
+      if (p != buf)
+        *p++ = ' ';
+      *p++ = '\"';
+      while (*s && (alnump (s) || *s >= 0x80))
+        *p++ = *s++;
+      *p++ = '\"';
+    }
+  *p = 0;
+  if (!*buf)
+    {
+      xfree (buf);
+      return gpg_error (GPG_ERR_INV_USER_ID);
+    }
+
+  res = sqlite3_bind_text (stmt, no, buf, strlen (buf), SQLITE_TRANSIENT);
+  if (res)
+    err = diag_bind_err (res, stmt);
+  else
+    err = 0;
+  xfree (buf);
+  return err;
+}
+
+
 /* Wrapper around sqlite3_step for use with simple functions.  */
 static gpg_error_t
 run_sql_step (sqlite3_stmt *stmt)
@@ -447,7 +617,9 @@ run_sql_step (sqlite3_stmt *stmt)
   int res;
 
   show_sqlstmt (stmt);
+  npth_unprotect ();
   res = sqlite3_step (stmt);
+  npth_protect ();
   if (res != SQLITE_DONE)
     err = diag_step_err (res, stmt);
   else
@@ -465,7 +637,9 @@ run_sql_step_for_select (sqlite3_stmt *stmt)
   gpg_error_t err;
   int res;
 
+  npth_unprotect ();
   res = sqlite3_step (stmt);
+  npth_protect ();
   if (res == SQLITE_DONE || res == SQLITE_ROW)
     err = gpg_error (gpg_err_code_from_sqlite (res));
   else
@@ -492,7 +666,7 @@ run_sql_statement_bind_ubid (const char *sqlstr, const unsigned char *ubid)
   gpg_error_t err;
   sqlite3_stmt *stmt;
 
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  err = run_sql_prepare (database_hd, sqlstr, NULL, NULL, &stmt);
   if (err)
     goto leave;
   if (ubid)
@@ -521,6 +695,62 @@ run_sql_statement (const char *sqlstr)
 }
 
 
+/* Return the prepared statement ID for SQLSTR on DATABASE_HD at
+ * R_STMT.  The statements used to store keys are prepared only once
+ * and kept for the lifetime of the process.  Must be called with the
+ * database mutex held; after use the statement must be passed to
+ * release_writer_stmt.  */
+static gpg_error_t
+get_writer_stmt (enum writer_stmt_ids id, const char *sqlstr,
+                 sqlite3_stmt **r_stmt)
+{
+  gpg_error_t err;
+
+  if (!writer_stmts[id])
+    {
+      err = run_sql_prepare (database_hd, sqlstr, NULL, NULL,
+                             writer_stmts + id);
+      if (err)
+        {
+          writer_stmts[id] = NULL;
+          return err;
+        }
+    }
+  *r_stmt = writer_stmts[id];
+  return 0;
+}
+
+
+/* Make the statement STMT from get_writer_stmt ready for reuse.  */
+static void
+release_writer_stmt (sqlite3_stmt *stmt)
+{
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+}
+
+
+/* Run the cached statement ID for SQLSTR with UBID bound to the first
+ * parameter.  UBID may be NULL for a statement without parameters.  */
+static gpg_error_t
+run_writer_stmt_bind_ubid (enum writer_stmt_ids id, const char *sqlstr,
+                           const unsigned char *ubid)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+
+  err = get_writer_stmt (id, sqlstr, &stmt);
+  if (err)
+    return err;
+  if (ubid)
+    err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
+  if (!err)
+    err = run_sql_step (stmt);
+  release_writer_stmt (stmt);
+  return err;
+}
+
+
 static int
 dblock_info_cb (dotlock_t h, void *opaque, enum dotlock_reasons reason,
                 const char *format, ...)
@@ -555,6 +785,214 @@ dblock_info_cb (dotlock_t h, void *opaque, enum dotlock_reasons reason,
   return rc;
 }
 
+/* Make sure that the user id index number IDX exists and mark it as
+ * available.  A newly created index is filled from the existing user
+ * ids.  Errors are not fatal because we can always fall back to a
+ * plain scan of the userid table.  */
+static void
+create_uid_index (int idx)
+{
+  const char *name = uid_indices[idx].name;
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+  char *sqlstr;
+  char *errmsg = NULL;
+  int res;
+
+  uid_indices[idx].available = 0;
+
+  err = run_sql_prepare (database_hd,
+                         "SELECT 1 FROM sqlite_master"
+                         " WHERE type = 'table' AND name = ?1",
+                         NULL, NULL, &stmt);
+  if (err)
+    return;
+  err = run_sql_bind_text (stmt, 1, name);
+  if (!err)
+    err = run_sql_step_for_select (stmt);
+  sqlite3_finalize (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      uid_indices[idx].available = 1;
+      return;
+    }
+  else if (gpg_err_code (err) != GPG_ERR_SQL_DONE)
+    return;
+
+  /* The table and its triggers are created in one transaction so
+   * that an existing table always comes with its triggers.  */
+  sqlstr = xtryasprintf
+    ("BEGIN;"
+     "CREATE VIRTUAL TABLE %s USING fts5("
+     "uid, content='userid', content_rowid='rowid', tokenize='%s');"
+     "INSERT INTO %s(%s) VALUES('rebuild');"
+     "CREATE TRIGGER %s_ai AFTER INSERT ON userid BEGIN"
+     " INSERT INTO %s(rowid, uid) VALUES (new.rowid, new.uid);"
+     " END;"
+     "CREATE TRIGGER %s_ad AFTER DELETE ON userid BEGIN"
+     " INSERT INTO %s(%s, rowid, uid) VALUES ('delete', old.rowid, old.uid);"
+     " END;"
+     "COMMIT",
+     name, uid_indices[idx].tokenizer,
+     name, name,
+     name, name,
+     name, name, name);
+  if (!sqlstr)
+    {
+      log_error ("error creating index '%s': %s\n",
+                 name, gpg_strerror (gpg_error_from_syserror ()));
+      return;
+    }
+  show_sqlstr (sqlstr);
+  npth_unprotect ();
+  res = sqlite3_exec (database_hd, sqlstr, NULL, NULL, &errmsg);
+  npth_protect ();
+  xfree (sqlstr);
+  if (res)
+    {
+      log_info ("index '%s' not available: %s\n",
+                name, errmsg? errmsg : sqlite3_errstr (res));
+      sqlite3_free (errmsg);
+      if (!sqlite3_get_autocommit (database_hd))
+        sqlite3_exec (database_hd, "ROLLBACK", NULL, NULL, NULL);
+      return;
+    }
+  if (opt.verbose)
+    log_info ("index '%s' created\n", name);
+  uid_indices[idx].available = 1;
+}
+
+
+/* Upgrade the database from version 1 by adding the metadata columns
+ * to the fingerprint and userid tables and computing their values for
+ * the stored OpenPGP keys.  Must be called with the mutex held.  */
+static gpg_error_t
+upgrade_database (void)
+{
+  static const char *alter_stmts[] =
+    {
+     "ALTER TABLE fingerprint ADD COLUMN created INTEGER",
+     "ALTER TABLE fingerprint ADD COLUMN expires INTEGER",
+     "ALTER TABLE fingerprint ADD COLUMN keyflags INTEGER",
+     "ALTER TABLE fingerprint ADD COLUMN revoked INTEGER",
+     "ALTER TABLE userid ADD COLUMN isprimary INTEGER",
+     "ALTER TABLE userid ADD COLUMN revoked INTEGER"
+    };
+  gpg_error_t err;
+  sqlite3_stmt *stmt = NULL;
+  sqlite3_stmt *fprstmt = NULL;
+  sqlite3_stmt *uidstmt = NULL;
+  const unsigned char *ubid, *blob;
+  size_t bloblen;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *kinfo;
+  struct _keybox_openpgp_uid_info *u;
+  unsigned int nkeys = 0;
+  int idx, uidno;
+
+  log_info ("upgrading database to version %d\n", DATABASE_VERSION);
+
+  err = run_sql_statement ("begin transaction");
+  if (err)
+    return err;
+  for (idx=0; idx < DIM (alter_stmts); idx++)
+    {
+      err = run_sql_statement (alter_stmts[idx]);
+      if (err)
+        goto leave;
+    }
+
+  err = run_sql_prepare (database_hd,
+                         "SELECT ubid, keyblob FROM pubkey WHERE type = 1",
+                         NULL, NULL, &stmt);
+  if (!err)
+    err = run_sql_prepare (database_hd,
+                           "UPDATE fingerprint SET created = ?2,"
+                           " expires = ?3, keyflags = ?4, revoked = ?5"
+                           " WHERE fpr = ?1", NULL, NULL, &fprstmt);
+  if (!err)
+    err = run_sql_prepare (database_hd,
+                           "UPDATE userid SET isprimary = ?3, revoked = ?4"
+                           " WHERE ubid = ?1 AND uidno = ?2",
+                           NULL, NULL, &uidstmt);
+  if (err)
+    goto leave;
+
+  while (gpg_err_code (err = run_sql_step_for_select (stmt))
+         == GPG_ERR_SQL_ROW)
+    {
+      ubid = sqlite3_column_blob (stmt, 0);
+      blob = sqlite3_column_blob (stmt, 1);
+      bloblen = sqlite3_column_bytes (stmt, 1);
+      if (!ubid || sqlite3_column_bytes (stmt, 0) != UBID_LEN || !blob
+          || _keybox_parse_openpgp_meta (blob, bloblen, NULL, &info))
+        continue;  /* Keep the NULLs.  */
+
+      err = 0;
+      for (kinfo = &info.primary; !err && kinfo;
+           kinfo = (kinfo == &info.primary
+                    ? (info.nsubkeys? &info.subkeys : NULL) : kinfo->next))
+        {
+          if (!kinfo->have_meta)
+            continue;
+          err = run_sql_bind_blob (fprstmt, 1, kinfo->fpr, kinfo->fprlen);
+          if (!err)
+            err = run_sql_bind_int64 (fprstmt, 2, kinfo->created);
+          if (!err)
+            err = run_sql_bind_int64 (fprstmt, 3, kinfo->expires);
+          if (!err)
+            err = run_sql_bind_int (fprstmt, 4, kinfo->usage);
+          if (!err)
+            err = run_sql_bind_int (fprstmt, 5, kinfo->revoked);
+          if (!err)
+            err = run_sql_step (fprstmt);
+          run_sql_reset (fprstmt);
+        }
+      for (u = info.nuids? &info.uids : NULL, uidno = 1; !err && u;
+           u = u->next, uidno++)
+        {
+          if (!u->have_meta)
+            continue;
+          err = run_sql_bind_blob (uidstmt, 1, ubid, UBID_LEN);
+          if (!err)
+            err = run_sql_bind_int (uidstmt, 2, uidno);
+          if (!err)
+            err = run_sql_bind_int (uidstmt, 3, u->is_primary);
+          if (!err)
+            err = run_sql_bind_int (uidstmt, 4, u->revoked);
+          if (!err)
+            err = run_sql_step (uidstmt);
+          run_sql_reset (uidstmt);
+        }
+      _keybox_destroy_openpgp_info (&info);
+      if (err)
+        goto leave;
+      nkeys++;
+    }
+  if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
+    err = 0;
+
+ leave:
+  if (stmt)
+    sqlite3_finalize (stmt);
+  if (fprstmt)
+    sqlite3_finalize (fprstmt);
+  if (uidstmt)
+    sqlite3_finalize (uidstmt);
+  if (!err)
+    err = run_sql_statement ("commit");
+  else if (run_sql_statement ("rollback"))
+    log_error ("Warning: database rollback failed - should not happen!\n");
+  if (!err)
+    err = set_config_value ("dbversion", STR2(DATABASE_VERSION));
+  if (err)
+    log_error ("error upgrading the database: %s\n", gpg_strerror (err));
+  else
+    log_info ("metadata of %u keys computed\n", nkeys);
+  return err;
+}
+
+
 /* Create and initialize a new SQL database file if it does not
  * exists; else open it and check that all required objects are
  * available.  */
@@ -565,7 +1003,7 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   int res;
   int idx;
   char *value;
-  int dbversion;
+  int dbversion = 0;
   int setdbversion = 0;
 
   acquire_mutex ();
@@ -613,8 +1051,9 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   /* Database has not yet been opened.  Open or create it, make sure
    * the tables exist, and prepare the required statements.  We use
    * our own locking instead of the more complex serialization sqlite
-   * would have to do and it avoid that we call
-   * npth_unprotect/protect.  */
+   * would have to do: All connections are opened in multi-thread
+   * mode and each one is used by only one thread at a time; this
+   * allows us to call npth_unprotect/protect around the steps.  */
   res = sqlite3_open_v2 (filename,
                          &database_hd,
                          (SQLITE_OPEN_READWRITE
@@ -630,6 +1069,14 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
   /* Enable extended error codes.  */
   sqlite3_extended_result_codes (database_hd, 1);
 
+  /* In WAL mode readers do not block the writer and vice versa.  The
+   * mode is persistent and thus also used by the reader connections.  */
+  res = sqlite3_exec (database_hd, "PRAGMA journal_mode=WAL",
+                      NULL, NULL, NULL);
+  if (res)
+    log_info ("error switching '%s' to WAL mode: %s\n",
+              filename, sqlite3_errstr (res));
+
   /* Create the tables if needed.  */
   for (idx=0; idx < DIM(table_definitions); idx++)
     {
@@ -674,6 +1121,16 @@ create_or_open_database (ctrl_t ctrl, const char *filename)
         }
     }
 
+  if (!setdbversion && dbversion == 1)
+    {
+      err = upgrade_database ();
+      if (err)
+        goto leave;
+    }
+
+  for (idx=0; idx < DIM(uid_indices); idx++)
+    create_uid_index (idx);
+
   if (!opt.quiet)
     log_info (_("database '%s' created\n"), filename);
 
@@ -753,12 +1210,124 @@ be_sqlite_init_local (backend_handle_t backend_hd, db_request_part_t part)
 }
 
 
+/* Get a read-only connection for FILENAME from the idle list or open a
+ * new one and store it at R_READER.  */
+static gpg_error_t
+acquire_reader (const char *filename, reader_t *r_reader)
+{
+  gpg_error_t err;
+  reader_t reader;
+  int res;
+
+  if (n_idle_readers)
+    {
+      *r_reader = idle_readers[--n_idle_readers];
+      return 0;
+    }
+
+  *r_reader = NULL;
+  reader = xtrycalloc (1, sizeof *reader);
+  if (!reader)
+    return gpg_error_from_syserror ();
+  res = sqlite3_open_v2 (filename, &reader->db,
+                         (SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX),
+                         NULL);
+  if (res)
+    {
+      err = gpg_error (gpg_err_code_from_sqlite (res));
+      log_error ("error opening '%s': %s\n", filename, sqlite3_errstr (res));
+      sqlite3_close (reader->db);
+      xfree (reader);
+      return err;
+    }
+  sqlite3_extended_result_codes (reader->db, 1);
+  /* A checkpoint may briefly lock out readers.  */
+  sqlite3_busy_timeout (reader->db, 5000);
+  *r_reader = reader;
+  return 0;
+}
+
+
+/* Put the read-only connection READER back to the idle list.  */
+static void
+release_reader (reader_t reader)
+{
+  unsigned int i;
+
+  if (n_idle_readers < MAX_IDLE_READERS)
+    {
+      idle_readers[n_idle_readers++] = reader;
+      return;
+    }
+
+  for (i=0; i < reader->nstmts; i++)
+    sqlite3_finalize (reader->stmts[i].stmt);
+  sqlite3_close (reader->db);
+  xfree (reader);
+}
+
+
+/* Return the cached select statement of READER for MODE, FILTER and
+ * NIN or NULL if there is none.  */
+static sqlite3_stmt *
+lookup_cached_select (reader_t reader, KeydbSearchMode mode,
+                      unsigned int filter, unsigned int nin)
+{
+  unsigned int i;
+
+  for (i=0; i < reader->nstmts; i++)
+    if (reader->stmts[i].mode == mode
+        && reader->stmts[i].filter == filter
+        && reader->stmts[i].nin == nin)
+      return reader->stmts[i].stmt;
+  return NULL;
+}
+
+
+/* Add STMT to the statement cache of READER.  If the cache is full
+ * the oldest statement is finalized.  */
+static void
+cache_select (reader_t reader, KeydbSearchMode mode,
+              unsigned int filter, unsigned int nin, sqlite3_stmt *stmt)
+{
+  if (reader->nstmts == MAX_CACHED_SELECTS)
+    {
+      sqlite3_finalize (reader->stmts[0].stmt);
+      memmove (reader->stmts, reader->stmts + 1,
+               (MAX_CACHED_SELECTS - 1) * sizeof *reader->stmts);
+      reader->nstmts--;
+    }
+  reader->stmts[reader->nstmts].mode = mode;
+  reader->stmts[reader->nstmts].filter = filter;
+  reader->stmts[reader->nstmts].nin = nin;
+  reader->stmts[reader->nstmts].stmt = stmt;
+  reader->nstmts++;
+}
+
+
+/* Stop using the current select statement of CTX.  A cached statement
+ * is only reset so that it can be used again.  */
+static void
+drop_select_stmt (be_sqlite_local_t ctx)
+{
+  if (!ctx->select_stmt)
+    return;
+  if (ctx->select_cached)
+    sqlite3_reset (ctx->select_stmt);
+  else
+    sqlite3_finalize (ctx->select_stmt);
+  ctx->select_stmt = NULL;
+  ctx->select_cached = 0;
+}
+
+
 /* Release local data of a sqlite request part.  */
 void
 be_sqlite_release_local (be_sqlite_local_t ctx)
 {
-  if (ctx->select_stmt)
-    sqlite3_finalize (ctx->select_stmt);
+  drop_select_stmt (ctx);
+  if (ctx->reader)
+    release_reader (ctx->reader);
   xfree (ctx);
 }
 
@@ -766,6 +1335,8 @@ be_sqlite_release_local (be_sqlite_local_t ctx)
 gpg_error_t
 be_sqlite_rollback (void)
 {
+  gpg_error_t err;
+
   opt.in_transaction = 0;
   if (!opt.active_transaction)
     return 0;  /* Nothing to do.  */
@@ -777,13 +1348,18 @@ be_sqlite_rollback (void)
     }
 
   opt.active_transaction = 0;
-  return run_sql_statement ("rollback");
+  acquire_mutex ();
+  err = run_sql_statement ("rollback");
+  release_mutex ();
+  return err;
 }
 
 
 gpg_error_t
 be_sqlite_commit (void)
 {
+  gpg_error_t err;
+
   opt.in_transaction = 0;
   if (!opt.active_transaction)
     return 0;  /* Nothing to do.  */
@@ -795,7 +1371,10 @@ be_sqlite_commit (void)
     }
 
   opt.active_transaction = 0;
-  return run_sql_statement ("commit");
+  acquire_mutex ();
+  err = run_sql_statement ("commit");
+  release_mutex ();
+  return err;
 }
 
 
@@ -816,7 +1395,7 @@ get_config_value (const char *name, char **r_value)
   if (!sqlstr)
     return gpg_error_from_syserror ();
 
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  err = run_sql_prepare (database_hd, sqlstr, NULL, NULL, &stmt);
   xfree (sqlstr);
   if (err)
     return err;
@@ -849,7 +1428,8 @@ set_config_value (const char *name, const char *value)
   gpg_error_t err;
   sqlite3_stmt *stmt;
 
-  err = run_sql_prepare ("INSERT OR REPLACE INTO config(name,value)"
+  err = run_sql_prepare (database_hd,
+                         "INSERT OR REPLACE INTO config(name,value)"
                          " VALUES(?1,?2)", NULL, NULL, &stmt);
   if (err)
     return err;
@@ -866,46 +1446,158 @@ set_config_value (const char *name, const char *value)
 }
 
 
-/* Run a select for the search given by (DESC,NDESC).  The data is not
- * returned but stored in the request item.  */
-static gpg_error_t
-run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
-                      KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
+/* Return the number of descriptions starting at DESC which can be
+ * handled by one select using an IN list.  N is the number of
+ * available descriptions.  */
+static unsigned int
+count_in_descs (KEYDB_SEARCH_DESC *desc, unsigned int n)
 {
-  gpg_error_t err = 0;
-  unsigned int descidx;
-  const char *extra = NULL;
-  unsigned char kidbuf[8];
-  const char *s;
-  size_t n;
-
+  unsigned int i;
 
-  descidx = ctx->descidx;
-  if (descidx >= ndesc)
+  switch (desc[0].mode)
     {
-      err = gpg_error (GPG_ERR_EOF);
-      goto leave;
-    }
-
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+    case KEYDB_SEARCH_MODE_LONG_KID:
+    case KEYDB_SEARCH_MODE_FPR:
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+    case KEYDB_SEARCH_MODE_UBID:
+      break;
+    default:
+      return 1;
+    }
+
+  if (n > MAX_IN_DESCS)
+    n = MAX_IN_DESCS;
+  for (i=1; i < n; i++)
+    if (desc[i].mode != desc[0].mode)
+      break;
+  return i;
+}
+
+
+/* Prepare the select statement of CTX for SQLSTR which ends in the
+ * column to compare.  The comparison with CTX->SELECT_NIN parameters
+ * is appended and then EXTRA and EXTRA2 as with run_sql_prepare.  */
+static gpg_error_t
+prepare_in_select (be_sqlite_local_t ctx, const char *sqlstr,
+                   const char *extra, const char *extra2)
+{
+  gpg_error_t err;
+  membuf_t mb;
+  char *buffer;
+  unsigned int i;
+
+  init_membuf (&mb, 256);
+  put_membuf_str (&mb, sqlstr);
+  if (ctx->select_nin == 1)
+    put_membuf_str (&mb, " = ?1");
+  else
+    {
+      put_membuf_str (&mb, " IN (");
+      for (i=1; i <= ctx->select_nin; i++)
+        put_membuf_printf (&mb, i > 1? ",?%u" : "?%u", i);
+      put_membuf_str (&mb, ")");
+    }
+  put_membuf (&mb, "", 1);
+  buffer = get_membuf (&mb, NULL);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+
+  err = run_sql_prepare (ctx->select_db, buffer, extra, extra2,
+                         &ctx->select_stmt);
+  xfree (buffer);
+  return err;
+}
+
+
+/* Bind the key ids, fingerprints, keygrips or UBIDs of the
+ * CTX->SELECT_NIN descriptions at DESC to the select statement.  */
+static gpg_error_t
+bind_in_descs (be_sqlite_local_t ctx, KEYDB_SEARCH_DESC *desc)
+{
+  gpg_error_t err = 0;
+  unsigned char kidbuf[8];
+  unsigned int i;
+
+  for (i=0; !err && i < ctx->select_nin; i++)
+    switch (desc[i].mode)
+      {
+      case KEYDB_SEARCH_MODE_SHORT_KID:
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 kid_from_u32 (desc[i].u.kid, kidbuf)+4, 4);
+        break;
+      case KEYDB_SEARCH_MODE_LONG_KID:
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 kid_from_u32 (desc[i].u.kid, kidbuf), 8);
+        break;
+      case KEYDB_SEARCH_MODE_FPR:
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 desc[i].u.fpr, desc[i].fprlen);
+        break;
+      case KEYDB_SEARCH_MODE_KEYGRIP:
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 desc[i].u.grip, KEYGRIP_LEN);
+        break;
+      case KEYDB_SEARCH_MODE_UBID:
+        err = run_sql_bind_blob (ctx->select_stmt, i+1,
+                                 desc[i].u.ubid, UBID_LEN);
+        break;
+      default:
+        err = gpg_error (GPG_ERR_INTERNAL);
+        break;
+      }
+
+  return err;
+}
+
+
+/* Run a select for the search given by (DESC,NDESC).  The data is not
+ * returned but stored in the request item.  Select statements
+ * prepared on a read-only connection are kept in its cache.  */
+static gpg_error_t
+run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
+                      KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
+{
+  gpg_error_t err = 0;
+  unsigned int descidx, nin, filter;
+  const char *extra = NULL;
+  const char *s;
+  size_t n;
+
+
+  descidx = ctx->descidx;
+  if (descidx >= ndesc)
+    {
+      err = gpg_error (GPG_ERR_EOF);
+      goto leave;
+    }
+  nin = count_in_descs (desc + descidx, ndesc - descidx);
+
   /* Check whether we can reuse the current select statement.  */
   if (!ctx->select_stmt)
     ;
-  else if (ctx->select_mode != desc[descidx].mode)
-    {
-      sqlite3_finalize (ctx->select_stmt);
-      ctx->select_stmt = NULL;
-    }
+  else if (ctx->select_mode != desc[descidx].mode
+           || ctx->select_nin != nin)
+    drop_select_stmt (ctx);
   else if (ctx->filter_opgp != ctrl->filter_opgp
            || ctx->filter_x509 != ctrl->filter_x509)
     {
       /* The filter flags changed, thus we can't reuse the statement.  */
-      sqlite3_finalize (ctx->select_stmt);
-      ctx->select_stmt = NULL;
+      drop_select_stmt (ctx);
     }
 
   ctx->select_mode = desc[descidx].mode;
+  ctx->select_nin = nin;
   ctx->filter_opgp = ctrl->filter_opgp;
   ctx->filter_x509 = ctrl->filter_x509;
+  filter = (ctx->filter_opgp | (ctx->filter_x509 << 1));
+
+  /* Try the statement cache of the connection.  */
+  if (!ctx->select_stmt && ctx->reader && ctx->select_db == ctx->reader->db
+      && (ctx->select_stmt = lookup_cached_select (ctx->reader,
+                                                   ctx->select_mode,
+                                                   filter, nin)))
+    ctx->select_cached = 1;
 
   /* Prepare the select and bind the parameters.  */
   if (ctx->select_stmt)
@@ -938,7 +1630,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_EXACT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.uid = ?1",
@@ -949,7 +1642,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_MAIL:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
@@ -974,7 +1668,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_MAILSUB:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
@@ -986,8 +1681,20 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_SUBSTR:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+      if (ctx->select_stmt)
+        ;
+      else if (uid_indices[UID_INDEX_SUBSTR].available)
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                               " p.keyblob, u.uidno"
+                               " FROM pubkey as p, userid as u"
+                               " WHERE p.ubid = u.ubid AND u.rowid IN"
+                               " (SELECT rowid FROM uidsubstr"
+                               "  WHERE uid LIKE ?1)",
+                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      else
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
@@ -997,14 +1704,35 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
                                       desc[descidx].u.name);
       break;
 
-    case KEYDB_SEARCH_MODE_MAILEND:
     case KEYDB_SEARCH_MODE_WORDS:
+      if (!uid_indices[UID_INDEX_WORDS].available)
+        {
+          err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+          break;
+        }
+      ctx->select_col_uidno = 5;
+      if (!ctx->select_stmt)
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                               " p.keyblob, u.uidno"
+                               " FROM pubkey as p, userid as u"
+                               " WHERE p.ubid = u.ubid AND u.rowid IN"
+                               " (SELECT rowid FROM uidwords"
+                               "  WHERE uidwords MATCH ?1)",
+                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+      if (!err)
+        err = run_sql_bind_words_match (ctx->select_stmt, 1,
+                                        desc[descidx].u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
       err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
       break;
 
     case KEYDB_SEARCH_MODE_ISSUER:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob"
                                " FROM pubkey as p, issuer as i"
                                " WHERE p.ubid = i.ubid"
@@ -1025,7 +1753,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       else
         {
           if (!ctx->select_stmt)
-            err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
+            err = run_sql_prepare (ctx->select_db,
+                                   "SELECT p.ubid, p.type, p.ephemeral,"
                                    " p.revoked, p.keyblob"
                                    " FROM pubkey as p, issuer as i"
                                    " WHERE p.ubid = i.ubid"
@@ -1051,7 +1780,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SUBJECT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+        err = run_sql_prepare (ctx->select_db,
+                               "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
                                " p.keyblob, u.uidno"
                                " FROM pubkey as p, userid as u"
                                " WHERE p.ubid = u.ubid"
@@ -1065,67 +1795,61 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SHORT_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND"
-                               " substr(f.kid,5) = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = prepare_in_select (ctx, "SELECT p.ubid, p.type, p.ephemeral,"
+                                 " p.revoked, p.keyblob, f.subkey"
+                                 " FROM pubkey as p, fingerprint as f"
+                                 " WHERE p.ubid = f.ubid AND"
+                                 " substr(f.kid,5)",
+                                 extra, " ORDER BY p.ubid");
       if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 kid_from_u32 (desc[descidx].u.kid, kidbuf)+4,
-                                 4);
+        err = bind_in_descs (ctx, desc + descidx);
       break;
 
     case KEYDB_SEARCH_MODE_LONG_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.kid = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = prepare_in_select (ctx, "SELECT p.ubid, p.type, p.ephemeral,"
+                                 " p.revoked, p.keyblob, f.subkey"
+                                 " FROM pubkey as p, fingerprint as f"
+                                 " WHERE p.ubid = f.ubid AND f.kid",
+                                 extra, " ORDER BY p.ubid");
       if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 kid_from_u32 (desc[descidx].u.kid, kidbuf),
-                                 8);
+        err = bind_in_descs (ctx, desc + descidx);
       break;
 
     case KEYDB_SEARCH_MODE_FPR:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.fpr = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = prepare_in_select (ctx, "SELECT p.ubid, p.type, p.ephemeral,"
+                                 " p.revoked, p.keyblob, f.subkey"
+                                 " FROM pubkey as p, fingerprint as f"
+                                 " WHERE p.ubid = f.ubid AND f.fpr",
+                                 extra, " ORDER BY p.ubid");
       if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 desc[descidx].u.fpr, desc[descidx].fprlen);
+        err = bind_in_descs (ctx, desc + descidx);
       break;
 
     case KEYDB_SEARCH_MODE_KEYGRIP:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
-                               extra, " ORDER BY p.ubid", &ctx->select_stmt);
+        err = prepare_in_select (ctx, "SELECT p.ubid, p.type, p.ephemeral,"
+                                 " p.revoked, p.keyblob, f.subkey"
+                                 " FROM pubkey as p, fingerprint as f"
+                                 " WHERE p.ubid = f.ubid AND f.keygrip",
+                                 extra, " ORDER BY p.ubid");
       if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 desc[descidx].u.grip, KEYGRIP_LEN);
+        err = bind_in_descs (ctx, desc + descidx);
       break;
 
     case KEYDB_SEARCH_MODE_UBID:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
-                               " FROM pubkey as p"
-                               " WHERE ubid = ?1",
-                               extra, NULL, &ctx->select_stmt);
+        err = prepare_in_select (ctx, "SELECT ubid, type, ephemeral, revoked,"
+                                 " keyblob"
+                                 " FROM pubkey as p"
+                                 " WHERE ubid",
+                                 extra, nin > 1? " ORDER BY ubid" : NULL);
       if (!err)
-        err = run_sql_bind_blob (ctx->select_stmt, 1,
-                                 desc[descidx].u.ubid, UBID_LEN);
+        err = bind_in_descs (ctx, desc + descidx);
       break;
 
     case KEYDB_SEARCH_MODE_FIRST:
@@ -1140,7 +1864,8 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
           else
             extra = " ORDER by ubid";
 
-          err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
+          err = run_sql_prepare (ctx->select_db,
+                                 "SELECT ubid, type, ephemeral, revoked,"
                                  " keyblob"
                                  " FROM pubkey as p",
                                  extra, NULL, &ctx->select_stmt);
@@ -1156,11 +1881,95 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       break;
     }
 
+
+  /* Keep a newly prepared statement for later use.  */
+  if (!err && ctx->select_stmt && !ctx->select_cached
+      && ctx->reader && ctx->select_db == ctx->reader->db)
+    {
+      cache_select (ctx->reader, ctx->select_mode, filter, nin,
+                    ctx->select_stmt);
+      ctx->select_cached = 1;
+    }
+
  leave:
   return err;
 }
 
 
+/* Emit the KEY_META and UID_META status lines for the OpenPGP key
+ * UBID from the database connection DB.  The numbers used in these
+ * lines are those also used in PUBKEY_INFO.  */
+static gpg_error_t
+return_meta (ctrl_t ctrl, sqlite3 *db, const unsigned char *ubid)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt = NULL;
+  unsigned int keyflags;
+  char usage[5], *p;
+
+  err = run_sql_prepare (db, "SELECT subkey, keyflags, expires, revoked"
+                         " FROM fingerprint"
+                         " WHERE ubid = ?1 AND keyflags NOT NULL",
+                         NULL, " ORDER BY subkey", &stmt);
+  if (!err)
+    err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
+  if (err)
+    goto leave;
+  while (gpg_err_code (err = run_sql_step_for_select (stmt))
+         == GPG_ERR_SQL_ROW)
+    {
+      keyflags = sqlite3_column_int (stmt, 1);
+      p = usage;
+      if ((keyflags & 0x01))
+        *p++ = 'c';
+      if ((keyflags & 0x02))
+        *p++ = 's';
+      if ((keyflags & 0x0c))
+        *p++ = 'e';
+      if ((keyflags & 0x20))
+        *p++ = 'a';
+      if (p == usage)
+        *p++ = '-';
+      *p = 0;
+      err = kbxd_status_printf (ctrl, "KEY_META", "%d %s %lld %c",
+                                sqlite3_column_int (stmt, 0) + 1, usage,
+                                (long long)sqlite3_column_int64 (stmt, 2),
+                                sqlite3_column_int (stmt, 3)? 'r':'-');
+      if (err)
+        goto leave;
+    }
+  if (gpg_err_code (err) != GPG_ERR_SQL_DONE)
+    goto leave;
+  sqlite3_finalize (stmt);
+  stmt = NULL;
+
+  err = run_sql_prepare (db, "SELECT uidno, isprimary, revoked FROM userid"
+                         " WHERE ubid = ?1 AND isprimary NOT NULL",
+                         NULL, " ORDER BY uidno", &stmt);
+  if (!err)
+    err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
+  if (err)
+    goto leave;
+  while (gpg_err_code (err = run_sql_step_for_select (stmt))
+         == GPG_ERR_SQL_ROW)
+    {
+      err = kbxd_status_printf (ctrl, "UID_META", "%d %c%c",
+                                sqlite3_column_int (stmt, 0) + 1,
+                                sqlite3_column_int (stmt, 1)? 'p':'-',
+                                sqlite3_column_int (stmt, 2)? 'r':'-');
+      if (err)
+        goto leave;
+    }
+  if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
+    err = 0;
+
+ leave:
+  if (stmt)
+    sqlite3_finalize (stmt);
+  return err;
+}
+
+
 /* Search for the keys described by (DESC,NDESC) and return them to
  * the caller.  BACKEND_HD is the handle for this backend and REQUEST
  * is the current database request object.  */
@@ -1172,6 +1981,8 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  sqlite3 *db;
+  int got_mutex = 0;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
@@ -1180,14 +1991,39 @@ be_sqlite_search (ctrl_t ctrl,
   if (err)
     return err;
 
-  acquire_mutex ();
-
   /* Find the specific request part or allocate it.  */
   err = be_find_request_part (backend_hd, request, &part);
   if (err)
     goto leave;
   ctx = part->besqlite;
 
+  /* Only the client running a global transaction needs to see its
+   * not yet committed changes; all other searches are done on a
+   * read-only connection.  A running select is continued on the
+   * connection it has been started on.  */
+  if (ctx->select_done && ctx->select_stmt)
+    db = ctx->select_db;
+  else if (kbxd_is_transaction_owner (ctrl))
+    db = database_hd;
+  else
+    {
+      if (!ctx->reader)
+        {
+          err = acquire_reader (backend_hd->filename, &ctx->reader);
+          if (err)
+            goto leave;
+        }
+      db = ctx->reader->db;
+    }
+  if (db == database_hd)
+    {
+      acquire_mutex ();
+      got_mutex = 1;
+    }
+  if (ctx->select_db != db)
+    drop_select_stmt (ctx);
+  ctx->select_db = db;
+
   if (!desc)
     {
       /* Reset */
@@ -1207,7 +2043,7 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
   /* Start a global transaction if needed.  */
-  if (!opt.active_transaction && opt.in_transaction)
+  if (got_mutex && !opt.active_transaction && opt.in_transaction)
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -1243,7 +2079,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
       if (!ubid || n < 0)
         {
-          if (!ubid && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!ubid && sqlite3_errcode (db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1276,7 +2112,7 @@ be_sqlite_search (ctrl_t ctrl,
       ctx->lastubid_valid = 1;
 
       n = sqlite3_column_int (ctx->select_stmt, 1);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1287,7 +2123,7 @@ be_sqlite_search (ctrl_t ctrl,
       pubkey_type = n;
 
       n = sqlite3_column_int (ctx->select_stmt, 2);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1298,7 +2134,7 @@ be_sqlite_search (ctrl_t ctrl,
       is_ephemeral = !!n;
 
       n = sqlite3_column_int (ctx->select_stmt, 3);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1312,7 +2148,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 4);
       if (!keyblob || n < 0)
         {
-          if (!keyblob && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!keyblob && sqlite3_errcode (db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1326,7 +2162,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_uidno)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_uidno);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1345,7 +2181,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_subkey)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_subkey);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1361,6 +2197,12 @@ be_sqlite_search (ctrl_t ctrl,
       else
         pk_no = 0;
 
+      if (ctrl->meta_return && pubkey_type == PUBKEY_TYPE_OPGP)
+        {
+          err = return_meta (ctrl, db, ubid);
+          if (err)
+            goto leave;
+        }
       err = be_return_pubkey (ctrl, keyblob, keybloblen, pubkey_type,
                               ubid, is_ephemeral, is_revoked, uid_no, pk_no);
       if (!err)
@@ -1368,7 +2210,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
   else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
     {
-      if (++ctx->descidx < ndesc)
+      ctx->descidx += ctx->select_nin;
+      if (ctx->descidx < ndesc)
         {
           ctx->select_done = 0;
           goto again;
@@ -1382,7 +2225,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
  leave:
-  release_mutex ();
+  if (got_mutex)
+    release_mutex ();
   return err;
 }
 
@@ -1396,17 +2240,21 @@ store_into_pubkey (enum kbxd_store_modes mode,
                    const void *blob, size_t bloblen)
 {
   gpg_error_t err;
-  const char *sqlstr;
   sqlite3_stmt *stmt = NULL;
 
   if (mode == KBXD_STORE_UPDATE)
-    sqlstr = ("UPDATE pubkey set keyblob = ?3, type = ?2 WHERE ubid = ?1");
+    err = get_writer_stmt
+      (WSTMT_PUBKEY_UPDATE,
+       "UPDATE pubkey set keyblob = ?3, type = ?2 WHERE ubid = ?1", &stmt);
   else if (mode == KBXD_STORE_INSERT)
-    sqlstr = ("INSERT INTO pubkey(ubid,type,keyblob) VALUES(?1,?2,?3)");
+    err = get_writer_stmt
+      (WSTMT_PUBKEY_INSERT,
+       "INSERT INTO pubkey(ubid,type,keyblob) VALUES(?1,?2,?3)", &stmt);
   else /* Auto */
-    sqlstr = ("INSERT OR REPLACE INTO pubkey(ubid,type,keyblob)"
-              " VALUES(?1,?2,?3)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+    err = get_writer_stmt
+      (WSTMT_PUBKEY_AUTO,
+       "INSERT OR REPLACE INTO pubkey(ubid,type,keyblob) VALUES(?1,?2,?3)",
+       &stmt);
   if (err)
     goto leave;
   err = run_sql_bind_blob (stmt, 1, ubid, UBID_LEN);
@@ -1423,26 +2271,29 @@ store_into_pubkey (enum kbxd_store_modes mode,
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_writer_stmt (stmt);
   return err;
 }
 
 
 /* Helper for be_sqlite_store to update or insert a row in the
- * fingerprint table.  */
+ * fingerprint table.  KINFO is the parsed OpenPGP key to take the
+ * metadata from or NULL.  */
 static gpg_error_t
 store_into_fingerprint (const unsigned char *ubid, int subkey,
                         const unsigned char *keygrip,
                         const unsigned char *kid,
-                        const unsigned char *fpr, int fprlen)
+                        const unsigned char *fpr, int fprlen,
+                        const struct _keybox_openpgp_key_info *kinfo)
 {
   gpg_error_t err;
   const char *sqlstr;
   sqlite3_stmt *stmt = NULL;
 
-  sqlstr = ("INSERT OR REPLACE INTO fingerprint(fpr,kid,keygrip,subkey,ubid)"
-            " VALUES(?1,?2,?3,?4,?5)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  sqlstr = ("INSERT OR REPLACE INTO fingerprint(fpr,kid,keygrip,subkey,ubid,"
+            "created,expires,keyflags,revoked)"
+            " VALUES(?1,?2,?3,?4,?5,?6,?7,?8,?9)");
+  err = get_writer_stmt (WSTMT_FINGERPRINT, sqlstr, &stmt);
   if (err)
     goto leave;
   err = run_sql_bind_blob (stmt, 1, fpr, fprlen);
@@ -1460,31 +2311,46 @@ store_into_fingerprint (const unsigned char *ubid, int subkey,
   err = run_sql_bind_blob (stmt, 5, ubid, UBID_LEN);
   if (err)
     goto leave;
+  if (kinfo && kinfo->have_meta)
+    {
+      err = run_sql_bind_int64 (stmt, 6, kinfo->created);
+      if (!err)
+        err = run_sql_bind_int64 (stmt, 7, kinfo->expires);
+      if (!err)
+        err = run_sql_bind_int (stmt, 8, kinfo->usage);
+      if (!err)
+        err = run_sql_bind_int (stmt, 9, kinfo->revoked);
+      if (err)
+        goto leave;
+    }
 
   err = run_sql_step (stmt);
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_writer_stmt (stmt);
   return err;
 }
 
 
 /* Helper for be_sqlite_store to update or insert a row in the userid
  * table.  If OVERRIDE_MBOX is set, that value is used instead of a
- * value extracted from UID. */
+ * value extracted from UID.  UINFO is the parsed OpenPGP user id to
+ * take the metadata from or NULL.  */
 static gpg_error_t
 store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
-                   const char *uid, int uidno, const char *override_mbox)
+                   const char *uid, int uidno, const char *override_mbox,
+                   const struct _keybox_openpgp_uid_info *uinfo)
 {
   gpg_error_t err;
   const char *sqlstr;
   sqlite3_stmt *stmt = NULL;
   char *addrspec = NULL;
 
-  sqlstr = ("INSERT OR REPLACE INTO userid(uid,addrspec,type,ubid,uidno)"
-            " VALUES(?1,?2,?3,?4,?5)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  sqlstr = ("INSERT OR REPLACE INTO userid(uid,addrspec,type,ubid,uidno,"
+            "isprimary,revoked)"
+            " VALUES(?1,?2,?3,?4,?5,?6,?7)");
+  err = get_writer_stmt (WSTMT_USERID, sqlstr, &stmt);
   if (err)
     goto leave;
 
@@ -1511,12 +2377,20 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
   err = run_sql_bind_int (stmt, 5, uidno);
   if (err)
     goto leave;
+  if (uinfo && uinfo->have_meta)
+    {
+      err = run_sql_bind_int (stmt, 6, uinfo->is_primary);
+      if (!err)
+        err = run_sql_bind_int (stmt, 7, uinfo->revoked);
+      if (err)
+        goto leave;
+    }
 
   err = run_sql_step (stmt);
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_writer_stmt (stmt);
   xfree (addrspec);
   return err;
 }
@@ -1535,7 +2409,7 @@ store_into_issuer (const unsigned char *ubid,
 
   sqlstr = ("INSERT OR REPLACE INTO issuer(sn,dn,ubid)"
             " VALUES(?1,?2,?3)");
-  err = run_sql_prepare (sqlstr, NULL, NULL, &stmt);
+  err = get_writer_stmt (WSTMT_ISSUER, sqlstr, &stmt);
   if (err)
     goto leave;
 
@@ -1553,110 +2427,53 @@ store_into_issuer (const unsigned char *ubid,
 
  leave:
   if (stmt)
-    sqlite3_finalize (stmt);
+    release_writer_stmt (stmt);
   xfree (addrspec);
   return err;
 }
 
 
-/* Store (BLOB,BLOBLEN) into the database.  UBID is the UBID matching
- * that blob.  BACKEND_HD is the handle for this backend and REQUEST
- * is the current database request object.  MODE is the store
- * mode.  */
-gpg_error_t
-be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
-                 db_request_t request, enum kbxd_store_modes mode,
-                 enum pubkey_types pktype, const unsigned char *ubid,
-                 const void *blob, size_t bloblen)
+/* Write the rows for the blob (BLOB,BLOBLEN) with UBID into the
+ * pubkey table and its related tables.  CERT is the parsed X.509
+ * certificate or NULL in which case INFO is the parsed OpenPGP
+ * keyblock.  Must be called with the mutex held and within a
+ * transaction.  */
+static gpg_error_t
+store_blob_rows (enum kbxd_store_modes mode, enum pubkey_types pktype,
+                 const unsigned char *ubid, const void *blob, size_t bloblen,
+                 ksba_cert_t cert, struct _keybox_openpgp_info *info)
 {
   gpg_error_t err;
-  db_request_part_t part;
-  /* be_sqlite_local_t ctx; */
-  int got_mutex = 0;
-  int in_transaction = 0;
-  int info_valid = 0;
-  struct _keybox_openpgp_info info;
-  ksba_cert_t cert = NULL;
   char *sn = NULL;
   char *dn = NULL;
   char *kludge_mbox = NULL;
   int uidno;
 
-  (void)ctrl;
-
-  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
-  log_assert (request);
-
-  /* Fixme: The code below is duplicated in be_ubid_from_blob - we
-   * should have only one function and pass the passed info around
-   * with the BLOB.  */
-
-  if (be_is_x509_blob (blob, bloblen))
-    {
-      log_assert (pktype == PUBKEY_TYPE_X509);
-
-      err = ksba_cert_new (&cert);
-      if (err)
-        goto leave;
-      err = ksba_cert_init_from_mem (cert, blob, bloblen);
-      if (err)
-        goto leave;
-    }
-  else
-    {
-      err = _keybox_parse_openpgp (blob, bloblen, NULL, &info);
-      if (err)
-        {
-          log_info ("error parsing OpenPGP blob: %s\n", gpg_strerror (err));
-          err = gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
-          goto leave;
-        }
-      info_valid = 1;
-      log_assert (pktype == PUBKEY_TYPE_OPGP);
-      log_assert (info.primary.fprlen >= 20);
-      log_assert (!memcmp (ubid, info.primary.fpr, UBID_LEN));
-    }
-
-
-  acquire_mutex ();
-  got_mutex = 1;
-
-  /* Find the specific request part or allocate it.  */
-  err = be_find_request_part (backend_hd, request, &part);
-  if (err)
-    goto leave;
-  /* ctx = part->besqlite; */
-
-  if (!opt.active_transaction)
-    {
-      err = run_sql_statement ("begin transaction");
-      if (err)
-        goto leave;
-      if (opt.in_transaction)
-        opt.active_transaction = 1;
-    }
-  in_transaction = 1;
-
   err = store_into_pubkey (mode, pktype, ubid, blob, bloblen);
   if (err)
     goto leave;
 
   /* Delete all related rows so that we can freshly add possibly added
-   * or changed user ids and subkeys.  */
-  err = run_sql_statement_bind_ubid
-    ("DELETE FROM fingerprint WHERE ubid = ?1", ubid);
-  if (err)
-    goto leave;
-  err = run_sql_statement_bind_ubid
-    ("DELETE FROM userid WHERE ubid = ?1", ubid);
-  if (err)
-    goto leave;
-  if (cert)
+   * or changed user ids and subkeys.  A newly inserted blob has no
+   * such rows.  */
+  if (mode != KBXD_STORE_INSERT)
     {
-      err = run_sql_statement_bind_ubid
-        ("DELETE FROM issuer WHERE ubid = ?1", ubid);
+      err = run_writer_stmt_bind_ubid
+        (WSTMT_DEL_FINGERPRINT, "DELETE FROM fingerprint WHERE ubid = ?1",
+         ubid);
+      if (err)
+        goto leave;
+      err = run_writer_stmt_bind_ubid
+        (WSTMT_DEL_USERID, "DELETE FROM userid WHERE ubid = ?1", ubid);
       if (err)
         goto leave;
+      if (cert)
+        {
+          err = run_writer_stmt_bind_ubid
+            (WSTMT_DEL_ISSUER, "DELETE FROM issuer WHERE ubid = ?1", ubid);
+          if (err)
+            goto leave;
+        }
     }
 
   if (cert)  /* X.509 */
@@ -1671,7 +2488,7 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
       /* Note that for X.509 the UBID is also the fingerprint.  */
       err = store_into_fingerprint (ubid, 0, grip,
                                     ubid+12,
-                                    ubid, UBID_LEN);
+                                    ubid, UBID_LEN, NULL);
       if (err)
         goto leave;
 
@@ -1702,7 +2519,8 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
           if (kludge_mbox && !strcmp (kludge_mbox, dn))
             continue;
 
-          err = store_into_userid (ubid, PUBKEY_TYPE_X509, dn, ++uidno, NULL);
+          err = store_into_userid (ubid, PUBKEY_TYPE_X509, dn, ++uidno,
+                                   NULL, NULL);
           if (err)
             goto leave;
 
@@ -1712,7 +2530,7 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
               if (kludge_mbox)
                 {
                   err = store_into_userid (ubid, PUBKEY_TYPE_X509,
-                                           dn, ++uidno, kludge_mbox);
+                                           dn, ++uidno, kludge_mbox, NULL);
                   if (err)
                     goto leave;
                 }
@@ -1723,32 +2541,33 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
     {
       struct _keybox_openpgp_key_info *kinfo;
 
-      kinfo = &info.primary;
+      kinfo = &info->primary;
       err = store_into_fingerprint (ubid, 0, kinfo->grip,
                                     kinfo->keyid,
-                                    kinfo->fpr, kinfo->fprlen);
+                                    kinfo->fpr, kinfo->fprlen, kinfo);
       if (err)
         goto leave;
 
-      if (info.nsubkeys)
+      if (info->nsubkeys)
         {
           int subkey = 1;
-          for (kinfo = &info.subkeys; kinfo; kinfo = kinfo->next, subkey++)
+          for (kinfo = &info->subkeys; kinfo; kinfo = kinfo->next, subkey++)
             {
               err = store_into_fingerprint (ubid, subkey, kinfo->grip,
                                             kinfo->keyid,
-                                            kinfo->fpr, kinfo->fprlen);
+                                            kinfo->fpr, kinfo->fprlen,
+                                            kinfo);
               if (err)
                 goto leave;
             }
         }
 
-      if (info.nuids)
+      if (info->nuids)
         {
           struct _keybox_openpgp_uid_info *u;
 
           uidno = 0;
-          u = &info.uids;
+          u = &info->uids;
           do
             {
               log_assert (u->off <= bloblen);
@@ -1764,7 +2583,8 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
                 uid[u->len] = 0;
                 /* Note that we ignore embedded zeros in the user id;
                  * this is what we do all over the place.  */
-                err = store_into_userid (ubid, pktype, uid, ++uidno, NULL);
+                err = store_into_userid (ubid, pktype, uid, ++uidno,
+                                         NULL, u);
                 xfree (uid);
               }
               if (err)
@@ -1776,6 +2596,96 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
         }
     }
 
+ leave:
+  ksba_free (dn);
+  xfree (sn);
+  xfree (kludge_mbox);
+  return err;
+}
+
+
+/* Store (BLOB,BLOBLEN) into the database.  UBID is the UBID matching
+ * that blob.  BACKEND_HD is the handle for this backend and REQUEST
+ * is the current database request object.  MODE is the store
+ * mode.  */
+gpg_error_t
+be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
+                 db_request_t request, enum kbxd_store_modes mode,
+                 enum pubkey_types pktype, const unsigned char *ubid,
+                 const void *blob, size_t bloblen)
+{
+  gpg_error_t err;
+  db_request_part_t part;
+  /* be_sqlite_local_t ctx; */
+  int got_mutex = 0;
+  int in_transaction = 0;
+  int info_valid = 0;
+  struct _keybox_openpgp_info info;
+  ksba_cert_t cert = NULL;
+
+  (void)ctrl;
+
+  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
+  log_assert (request);
+
+  /* Fixme: The code below is duplicated in be_ubid_from_blob - we
+   * should have only one function and pass the passed info around
+   * with the BLOB.  The parsing includes the verification of the
+   * self-signatures and is thus done without holding the nPth lock
+   * and before the database mutex is taken.  */
+
+  if (be_is_x509_blob (blob, bloblen))
+    {
+      log_assert (pktype == PUBKEY_TYPE_X509);
+
+      err = ksba_cert_new (&cert);
+      if (err)
+        goto leave;
+      npth_unprotect ();
+      err = ksba_cert_init_from_mem (cert, blob, bloblen);
+      npth_protect ();
+      if (err)
+        goto leave;
+    }
+  else
+    {
+      npth_unprotect ();
+      err = _keybox_parse_openpgp_meta (blob, bloblen, NULL, &info);
+      npth_protect ();
+      if (err)
+        {
+          log_info ("error parsing OpenPGP blob: %s\n", gpg_strerror (err));
+          err = gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+          goto leave;
+        }
+      info_valid = 1;
+      log_assert (pktype == PUBKEY_TYPE_OPGP);
+      log_assert (info.primary.fprlen >= 20);
+      log_assert (!memcmp (ubid, info.primary.fpr, UBID_LEN));
+    }
+
+
+  acquire_mutex ();
+  got_mutex = 1;
+
+  /* Find the specific request part or allocate it.  */
+  err = be_find_request_part (backend_hd, request, &part);
+  if (err)
+    goto leave;
+  /* ctx = part->besqlite; */
+
+  if (!opt.active_transaction)
+    {
+      err = run_sql_statement ("begin transaction");
+      if (err)
+        goto leave;
+      if (opt.in_transaction)
+        opt.active_transaction = 1;
+    }
+  in_transaction = 1;
+
+  err = store_blob_rows (mode, pktype, ubid, blob, bloblen, cert, &info);
+
  leave:
   if (in_transaction && !err)
     {
@@ -1797,9 +2707,96 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
     _keybox_destroy_openpgp_info (&info);
   if (cert)
     ksba_cert_release (cert);
-  ksba_free (dn);
-  xfree (sn);
-  xfree (kludge_mbox);
+  return err;
+}
+
+
+/* Store the NITEMS OpenPGP keyblocks at ITEMS into the database.
+ * The items have been parsed by be_parse_store_items.  All items are
+ * stored within one transaction; an item which can't be stored is
+ * rolled back to a savepoint and its error code is stored in its ERR
+ * field.  BACKEND_HD is the handle for this backend and REQUEST is
+ * the current database request object.  MODE is the store mode.  An
+ * error is only returned if the transaction itself failed.  */
+gpg_error_t
+be_sqlite_store_multi (ctrl_t ctrl, backend_handle_t backend_hd,
+                       db_request_t request, enum kbxd_store_modes mode,
+                       struct be_store_item_s *items, unsigned int nitems)
+{
+  gpg_error_t err;
+  db_request_part_t part;
+  int in_transaction = 0;
+  struct be_store_item_s *item;
+  unsigned int i;
+
+  (void)ctrl;
+
+  log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
+  log_assert (request);
+
+  acquire_mutex ();
+
+  /* Find the specific request part or allocate it.  */
+  err = be_find_request_part (backend_hd, request, &part);
+  if (err)
+    goto leave;
+
+  if (!opt.active_transaction)
+    {
+      err = run_sql_statement ("begin transaction");
+      if (err)
+        goto leave;
+      if (opt.in_transaction)
+        opt.active_transaction = 1;
+    }
+  in_transaction = 1;
+
+  for (i = 0; i < nitems; i++)
+    {
+      item = items + i;
+      if (item->err)
+        continue;  /* Parse error.  */
+      log_assert (item->info);
+
+      err = run_writer_stmt_bind_ubid (WSTMT_SAVEPOINT,
+                                       "SAVEPOINT storeitem", NULL);
+      if (err)
+        goto leave;
+      item->err = store_blob_rows (mode, PUBKEY_TYPE_OPGP, item->ubid,
+                                   item->blob, item->bloblen,
+                                   NULL, item->info);
+      if (item->err)
+        {
+          if (opt.verbose)
+            log_info ("error storing keyblock %u: %s\n",
+                      i, gpg_strerror (item->err));
+          err = run_writer_stmt_bind_ubid (WSTMT_ROLLBACK_TO,
+                                           "ROLLBACK TO storeitem", NULL);
+          if (err)
+            goto leave;
+        }
+      err = run_writer_stmt_bind_ubid (WSTMT_RELEASE,
+                                       "RELEASE storeitem", NULL);
+      if (err)
+        goto leave;
+    }
+
+ leave:
+  if (in_transaction && !err)
+    {
+      if (opt.active_transaction)
+        ; /* We are in a global transaction.  */
+      else
+        err = run_sql_statement ("commit");
+    }
+  else if (in_transaction)
+    {
+      if (opt.active_transaction)
+        ; /* We are in a global transaction.  */
+      else if (run_sql_statement ("rollback"))
+        log_error ("Warning: database rollback failed - should not happen!\n");
+    }
+  release_mutex ();
   return err;
 }
 
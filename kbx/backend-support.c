@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include "../common/i18n.h"
@@ -275,7 +276,10 @@ be_ubid_from_blob (const void *blob, size_t bloblen,
     {
       struct _keybox_openpgp_info info;
 
+      /* The parser does not access any shared data.  */
+      npth_unprotect ();
       err = _keybox_parse_openpgp (blob, bloblen, NULL, &info);
+      npth_protect ();
       if (err)
         {
           log_info ("error parsing OpenPGP blob: %s\n", gpg_strerror (err));
@@ -295,6 +299,166 @@ be_ubid_from_blob (const void *blob, size_t bloblen,
 
 
 
+/* Split IMAGE of length IMAGELEN which holds concatenated OpenPGP
+ * keyblocks into an array of items stored at R_ITEMS; their number
+ * is stored at R_NITEMS.  The items point into IMAGE.  The caller
+ * must release them with be_release_store_items.  */
+gpg_error_t
+be_split_store_items (const void *image, size_t imagelen,
+                      struct be_store_item_s **r_items,
+                      unsigned int *r_nitems)
+{
+  gpg_error_t err;
+  const unsigned char *p;
+  size_t n, len;
+  struct be_store_item_s *items = NULL;
+  unsigned int nitems, i;
+
+  *r_items = NULL;
+  *r_nitems = 0;
+
+  /* First count them.  */
+  for (nitems = 0, p = image, n = imagelen; n; nitems++, p += len, n -= len)
+    {
+      err = _keybox_openpgp_keyblock_len (p, n, &len);
+      if (err)
+        {
+          log_info ("error splitting OpenPGP keyblocks: %s\n",
+                    gpg_strerror (err));
+          return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+        }
+    }
+  if (!nitems)
+    return gpg_error (GPG_ERR_MISSING_VALUE);
+
+  items = xtrycalloc (nitems, sizeof *items);
+  if (!items)
+    return gpg_error_from_syserror ();
+  for (i = 0, p = image, n = imagelen; i < nitems; i++, p += len, n -= len)
+    {
+      _keybox_openpgp_keyblock_len (p, n, &len);
+      items[i].blob = p;
+      items[i].bloblen = len;
+    }
+
+  *r_items = items;
+  *r_nitems = nitems;
+  return 0;
+}
+
+
+/* Parse the item ITEM for be_parse_store_items.  This is called
+ * without the nPth lock.  */
+static void
+parse_store_item (struct be_store_item_s *item)
+{
+  struct _keybox_openpgp_info *info;
+
+  info = xtrymalloc (sizeof *info);
+  if (!info)
+    {
+      item->err = gpg_error_from_syserror ();
+      return;
+    }
+  item->err = _keybox_parse_openpgp_meta (item->blob, item->bloblen,
+                                          NULL, info);
+  if (item->err)
+    {
+      xfree (info);
+      item->err = gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+      return;
+    }
+  log_assert (info->primary.fprlen >= 20);
+  memcpy (item->ubid, info->primary.fpr, UBID_LEN);
+  item->info = info;
+}
+
+
+/* The maximum number of threads used by be_parse_store_items and the
+ * minimum number of items for each thread.  */
+#define PARSE_THREADS 4
+#define PARSE_THREAD_MIN_ITEMS 64
+
+struct parse_job_s
+{
+  struct be_store_item_s *items;
+  unsigned int nitems;
+};
+
+static void *
+parse_store_items_thread (void *arg)
+{
+  struct parse_job_s *job = arg;
+  unsigned int i;
+
+  npth_unprotect ();
+  for (i = 0; i < job->nitems; i++)
+    parse_store_item (job->items + i);
+  npth_protect ();
+  return NULL;
+}
+
+
+/* Parse the NITEMS keyblocks at ITEMS.  This sets the INFO and the
+ * UBID or the ERR field of each item.  Large sets of items are parsed
+ * by several threads.  */
+void
+be_parse_store_items (struct be_store_item_s *items, unsigned int nitems)
+{
+  struct parse_job_s jobs[PARSE_THREADS];
+  npth_t threads[PARSE_THREADS];
+  int started[PARSE_THREADS];
+  npth_attr_t tattr;
+  unsigned int njobs, per_job, i;
+
+  njobs = nitems / PARSE_THREAD_MIN_ITEMS;
+  if (njobs > PARSE_THREADS)
+    njobs = PARSE_THREADS;
+  if (njobs < 2 || npth_attr_init (&tattr))
+    {
+      for (i = 0; i < nitems; i++)
+        parse_store_item (items + i);
+      return;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+
+  /* The first job is done by this thread.  */
+  per_job = (nitems + njobs - 1) / njobs;
+  for (i = 0; i < njobs; i++)
+    {
+      jobs[i].items = items + i * per_job;
+      jobs[i].nitems = (i + 1 < njobs)? per_job : nitems - i * per_job;
+      started[i] = (i && !npth_create (threads + i, &tattr,
+                                       parse_store_items_thread, jobs + i));
+    }
+  npth_attr_destroy (&tattr);
+  for (i = 0; i < njobs; i++)
+    if (!started[i])
+      parse_store_items_thread (jobs + i);
+  for (i = 1; i < njobs; i++)
+    if (started[i])
+      npth_join (threads[i], NULL);
+}
+
+
+/* Release the array of NITEMS items at ITEMS.  */
+void
+be_release_store_items (struct be_store_item_s *items, unsigned int nitems)
+{
+  unsigned int i;
+
+  if (!items)
+    return;
+  for (i = 0; i < nitems; i++)
+    if (items[i].info)
+      {
+        _keybox_destroy_openpgp_info (items[i].info);
+        xfree (items[i].info);
+      }
+  xfree (items);
+}
+
+
 /* Return a certificates serial number in hex encoding.  Caller must
  * free the returned string.  NULL is returned on error but ERRNO
  * might not be set if the certificate and thus Libksba is broken.  */
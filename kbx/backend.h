@@ -100,6 +100,17 @@ struct db_request_s
 
 
 
+/* A keyblock of a STORE --multi request.  */
+struct be_store_item_s
+{
+  const unsigned char *blob;  /* The keyblock.  */
+  size_t bloblen;
+  struct _keybox_openpgp_info *info;  /* The parsed keyblock or NULL.  */
+  unsigned char ubid[UBID_LEN];
+  gpg_error_t err;            /* The result for this keyblock.  */
+};
+
+
 /*-- backend-support.c --*/
 const char *strdbtype (enum database_types t);
 unsigned int be_new_backend_id (void);
@@ -118,6 +129,12 @@ gpg_error_t be_ubid_from_blob (const void *blob, size_t bloblen,
                                enum pubkey_types *r_pktype, char *r_ubid);
 char *be_get_x509_serial (ksba_cert_t cert);
 gpg_error_t be_get_x509_keygrip (ksba_cert_t cert, unsigned char *keygrip);
+gpg_error_t be_split_store_items (const void *image, size_t imagelen,
+                                  struct be_store_item_s **r_items,
+                                  unsigned int *r_nitems);
+void be_parse_store_items (struct be_store_item_s *items, unsigned int nitems);
+void be_release_store_items (struct be_store_item_s *items,
+                             unsigned int nitems);
 
 
 /*-- backend-cache.c --*/
@@ -128,6 +145,7 @@ gpg_error_t be_cache_search (ctrl_t ctrl, backend_handle_t backend_hd,
                              db_request_t request,
                              KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
 void be_cache_mark_final (ctrl_t ctrl, db_request_t request);
+char *be_cache_stats (void);
 void be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                       const void *blob, unsigned int bloblen,
                       enum pubkey_types pubkey_type);
@@ -176,6 +194,11 @@ gpg_error_t be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
                              enum pubkey_types pktype,
                              const unsigned char *ubid,
                              const void *blob, size_t bloblen);
+gpg_error_t be_sqlite_store_multi (ctrl_t ctrl, backend_handle_t backend_hd,
+                                   db_request_t request,
+                                   enum kbxd_store_modes mode,
+                                   struct be_store_item_s *items,
+                                   unsigned int nitems);
 gpg_error_t be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
                               db_request_t request, const unsigned char *ubid);
 
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <npth.h>
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -41,12 +42,31 @@ struct
 
 
 
+/* The lock used with DB_TYPE_KBX.  The keybox backend rewrites the
+ * file on an update and thus readers and writers are serialized.
+ * The sqlite backend does not need a frontend lock: The writer is
+ * protected by its own mutex and each reader uses its own connection
+ * so that a long running write does not block a search.  The cache
+ * keeps a reference on the blobs it returns and thus needs no lock
+ * either.  */
+static npth_rwlock_t kbx_rwlock;
+
+
 /* Take a lock for reading the databases.  */
 static void
 take_read_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  log_assert (!ctrl->db_lock);
+  if (the_database.db_type != DB_TYPE_KBX)
+    return;
+
+  res = npth_rwlock_rdlock (&kbx_rwlock);
+  if (res)
+    log_fatal ("failed to acquire the database read lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_lock = 1;
 }
 
 
@@ -54,8 +74,17 @@ take_read_lock (ctrl_t ctrl)
 static void
 take_read_write_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  log_assert (!ctrl->db_lock);
+  if (the_database.db_type != DB_TYPE_KBX)
+    return;
+
+  res = npth_rwlock_wrlock (&kbx_rwlock);
+  if (res)
+    log_fatal ("failed to acquire the database write lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_lock = 2;
 }
 
 
@@ -64,8 +93,16 @@ take_read_write_lock (ctrl_t ctrl)
 static void
 release_lock (ctrl_t ctrl)
 {
-  /* FIXME */
-  (void)ctrl;
+  int res;
+
+  if (!ctrl->db_lock)
+    return;
+
+  res = npth_rwlock_unlock (&kbx_rwlock);
+  if (res)
+    log_fatal ("failed to release the database lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+  ctrl->db_lock = 0;
 }
 
 
@@ -135,6 +172,11 @@ kbxd_set_database (ctrl_t ctrl, const char *filename_arg, int readonly)
       break;
 
     case DB_TYPE_KBX:
+      if (npth_rwlock_init (&kbx_rwlock, NULL))
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
       err = be_kbx_add_resource (ctrl, &handle, filename, readonly);
       break;
 
@@ -187,6 +229,14 @@ kbxd_commit (void)
 }
 
 
+/* Return a malloced string with the statistics of the cache.  */
+char *
+kbxd_cache_stats (void)
+{
+  return be_cache_stats ();
+}
+
+
 
 static void
 dump_search_desc (struct keydb_search_desc *desc)
@@ -402,6 +452,135 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
 
 
 
+/* Store (BLOB,BLOBLEN) with UBID and PKTYPE in the keybox
+ * database.  This is the part of kbxd_store for DB_TYPE_KBX.  */
+static gpg_error_t
+kbx_store (ctrl_t ctrl, db_request_t request, enum kbxd_store_modes mode,
+           enum pubkey_types pktype, const char *ubid,
+           const void *blob, size_t bloblen)
+{
+  gpg_error_t err;
+  int insert = 0;
+
+  err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
+  if (!err)
+    ; /* Found - need to update.  */
+  else if (gpg_err_code (err) == GPG_ERR_EOF)
+    insert = 1; /* Not found - need to insert.  */
+  else
+    {
+      log_debug ("%s: searching fingerprint failed: %s\n",
+                 __func__, gpg_strerror (err));
+      return err;
+    }
+
+  if (insert)
+    {
+      if (mode == KBXD_STORE_UPDATE)
+        err = gpg_error (GPG_ERR_CONFLICT);
+      else
+        err = be_kbx_insert (ctrl, the_database.backend_handle, request,
+                             pktype, blob, bloblen);
+    }
+  else /* Update.  */
+    {
+      if (mode == KBXD_STORE_INSERT)
+        err = gpg_error (GPG_ERR_CONFLICT);
+      else
+        err = be_kbx_update (ctrl, the_database.backend_handle, request,
+                             pktype, blob, bloblen);
+    }
+  return err;
+}
+
+
+/* A store which is currently in progress.  Many clients which
+ * retrieved the same key at the same time store the very same blob;
+ * such a store waits for the one in progress and returns its result
+ * instead of writing the blob again.  This is only done for the
+ * modes which allow an update because a repeated insert must fail.  */
+struct store_flight_s
+{
+  struct store_flight_s *next;
+  unsigned int refcount;  /* The storing session and all waiting ones.  */
+  int done;               /* ERR is valid.  */
+  gpg_error_t err;
+  enum kbxd_store_modes mode;
+  unsigned char ubid[UBID_LEN];
+  const void *blob;       /* Owned by the storing session.  */
+  size_t bloblen;
+};
+static struct store_flight_s *store_flights;
+static npth_mutex_t store_flights_lock = NPTH_MUTEX_INITIALIZER;
+static npth_cond_t store_flights_cond = NPTH_COND_INITIALIZER;
+
+
+/* Wait for an identical store in progress and return its flight with
+ * a reference taken.  If there is none, a new flight is registered
+ * for the caller and stored at R_OWN and NULL is returned.  On error
+ * NULL is also stored at R_OWN.  */
+static struct store_flight_s *
+join_store_flight (enum kbxd_store_modes mode, const unsigned char *ubid,
+                   const void *blob, size_t bloblen,
+                   struct store_flight_s **r_own)
+{
+  struct store_flight_s *fl;
+
+  *r_own = NULL;
+  npth_mutex_lock (&store_flights_lock);
+  for (fl = store_flights; fl; fl = fl->next)
+    if (fl->mode == mode && fl->bloblen == bloblen
+        && !memcmp (fl->ubid, ubid, UBID_LEN)
+        && !memcmp (fl->blob, blob, bloblen))
+      break;
+  if (fl)
+    {
+      fl->refcount++;
+      while (!fl->done)
+        npth_cond_wait (&store_flights_cond, &store_flights_lock);
+    }
+  else if ((*r_own = xtrycalloc (1, sizeof **r_own)))
+    {
+      (*r_own)->refcount = 1;
+      (*r_own)->mode = mode;
+      memcpy ((*r_own)->ubid, ubid, UBID_LEN);
+      (*r_own)->blob = blob;
+      (*r_own)->bloblen = bloblen;
+      (*r_own)->next = store_flights;
+      store_flights = *r_own;
+    }
+  npth_mutex_unlock (&store_flights_lock);
+  return fl;
+}
+
+
+/* Release a reference on FL.  If DONE is set the owner of FL records
+ * the result ERR and wakes up the waiting sessions.  */
+static void
+leave_store_flight (struct store_flight_s *fl, int done, gpg_error_t err)
+{
+  struct store_flight_s **flp;
+
+  if (!fl)
+    return;
+  npth_mutex_lock (&store_flights_lock);
+  if (done)
+    {
+      for (flp = &store_flights; *flp && *flp != fl; flp = &(*flp)->next)
+        ;
+      if (*flp)
+        *flp = fl->next;
+      fl->blob = NULL;
+      fl->err = err;
+      fl->done = 1;
+      npth_cond_broadcast (&store_flights_cond);
+    }
+  if (!--fl->refcount)
+    xfree (fl);
+  npth_mutex_unlock (&store_flights_lock);
+}
+
+
 /* Store; that is insert or update the key (BLOB,BLOBLEN).  MODE
  * controls whether only updates or only inserts are allowed.  */
 gpg_error_t
@@ -412,11 +591,31 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
   db_request_t request;
   char ubid[UBID_LEN];
   enum pubkey_types pktype;
-  int insert = 0;
+  struct store_flight_s *flight, *own_flight = NULL;
 
   if (DBG_CLOCK)
     log_clock ("%s: enter", __func__);
 
+  /* Check whether to insert or update.  We do this before taking
+   * the lock because it requires parsing the blob.  */
+  err = be_ubid_from_blob (blob, bloblen, &pktype, ubid);
+  if (err)
+    goto leave;
+
+  if (mode != KBXD_STORE_INSERT)
+    {
+      flight = join_store_flight (mode, (const unsigned char *)ubid,
+                                  blob, bloblen, &own_flight);
+      if (flight)
+        {
+          err = flight->err;
+          leave_store_flight (flight, 0, 0);
+          if (DBG_CLOCK)
+            log_clock ("%s: leave (coalesced)", __func__);
+          return err;
+        }
+    }
+
   take_read_write_lock (ctrl);
 
   /* Allocate a handle object if none exists for this context.  */
@@ -438,46 +637,103 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
       goto leave;
     }
 
-  /* Check whether to insert or update.  */
-  err = be_ubid_from_blob (blob, bloblen, &pktype, ubid);
+  if (the_database.db_type == DB_TYPE_KBX)
+    {
+      err = kbx_store (ctrl, request, mode, pktype, ubid, blob, bloblen);
+    }
+  else if (the_database.db_type == DB_TYPE_SQLITE)
+    {
+      err = be_sqlite_store (ctrl, the_database.backend_handle, request,
+                             mode, pktype, ubid, blob, bloblen);
+    }
+  else
+    {
+      log_error ("%s: unsupported database type %d\n",
+                 __func__, the_database.db_type);
+      err = gpg_error (GPG_ERR_INTERNAL);
+    }
+
+
+ leave:
+  release_lock (ctrl);
+  leave_store_flight (own_flight, 1, err);
+  if (DBG_CLOCK)
+    log_clock ("%s: leave", __func__);
+  return err;
+}
+
+
+
+/* Store the concatenated OpenPGP keyblocks in (IMAGE,IMAGELEN) the
+ * same way as kbxd_store stores a single one.  The keyblocks are
+ * parsed before the database lock is taken and stored with one
+ * transaction.  On success an array with the result for each
+ * keyblock is stored at R_ERRORS and the number of keyblocks at
+ * R_COUNT; the caller must xfree that array.  */
+gpg_error_t
+kbxd_store_multi (ctrl_t ctrl, const void *image, size_t imagelen,
+                  enum kbxd_store_modes mode,
+                  gpg_error_t **r_errors, unsigned int *r_count)
+{
+  gpg_error_t err;
+  db_request_t request;
+  struct be_store_item_s *items = NULL;
+  unsigned int nitems = 0;
+  gpg_error_t *errors = NULL;
+  unsigned int i;
+
+  *r_errors = NULL;
+  *r_count = 0;
+
+  if (DBG_CLOCK)
+    log_clock ("%s: enter", __func__);
+
+  err = be_split_store_items (image, imagelen, &items, &nitems);
   if (err)
     goto leave;
+  errors = xtrycalloc (nitems, sizeof *errors);
+  if (!errors)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  be_parse_store_items (items, nitems);
+  if (DBG_CLOCK)
+    log_clock ("%s: parsed %u keyblocks", __func__, nitems);
 
-  if (the_database.db_type == DB_TYPE_KBX)
+  take_read_write_lock (ctrl);
+
+  /* Allocate a handle object if none exists for this context.  */
+  if (!ctrl->db_req)
     {
-      err = be_kbx_seek (ctrl, the_database.backend_handle, request, ubid);
-      if (!err)
-        ; /* Found - need to update.  */
-      else if (gpg_err_code (err) == GPG_ERR_EOF)
-        insert = 1; /* Not found - need to insert.  */
-      else
+      ctrl->db_req = xtrycalloc (1, sizeof *ctrl->db_req);
+      if (!ctrl->db_req)
         {
-          log_debug ("%s: searching fingerprint failed: %s\n",
-                     __func__, gpg_strerror (err));
-          goto leave;
+          err = gpg_error_from_syserror ();
+          goto leave_locked;
         }
+    }
+  request = ctrl->db_req;
 
-      if (insert)
-        {
-          if (mode == KBXD_STORE_UPDATE)
-            err = gpg_error (GPG_ERR_CONFLICT);
-          else
-            err = be_kbx_insert (ctrl, the_database.backend_handle, request,
-                                 pktype, blob, bloblen);
-        }
-      else /* Update.  */
-        {
-          if (mode == KBXD_STORE_INSERT)
-            err = gpg_error (GPG_ERR_CONFLICT);
-          else
-            err = be_kbx_update (ctrl, the_database.backend_handle, request,
-                                 pktype, blob, bloblen);
-        }
+  if (!the_database.db_type)
+    {
+      log_error ("%s: error: no database configured\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+      goto leave_locked;
+    }
+
+  if (the_database.db_type == DB_TYPE_KBX)
+    {
+      for (i = 0; i < nitems; i++)
+        if (!items[i].err)
+          items[i].err = kbx_store (ctrl, request, mode, PUBKEY_TYPE_OPGP,
+                                    (const char *)items[i].ubid,
+                                    items[i].blob, items[i].bloblen);
     }
   else if (the_database.db_type == DB_TYPE_SQLITE)
     {
-      err = be_sqlite_store (ctrl, the_database.backend_handle, request,
-                             mode, pktype, ubid, blob, bloblen);
+      err = be_sqlite_store_multi (ctrl, the_database.backend_handle,
+                                   request, mode, items, nitems);
     }
   else
     {
@@ -486,9 +742,19 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
       err = gpg_error (GPG_ERR_INTERNAL);
     }
 
-
- leave:
+ leave_locked:
   release_lock (ctrl);
+ leave:
+  if (!err)
+    {
+      for (i = 0; i < nitems; i++)
+        errors[i] = items[i].err;
+      *r_errors = errors;
+      *r_count = nitems;
+    }
+  else
+    xfree (errors);
+  be_release_store_items (items, nitems);
   if (DBG_CLOCK)
     log_clock ("%s: leave", __func__);
   return err;
@@ -30,11 +30,15 @@ void kbxd_release_session_info (ctrl_t ctrl);
 
 gpg_error_t kbxd_rollback (void);
 gpg_error_t kbxd_commit (void);
+char *kbxd_cache_stats (void);
 gpg_error_t kbxd_search (ctrl_t ctrl,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
                          int reset);
 gpg_error_t kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                         enum kbxd_store_modes mode);
+gpg_error_t kbxd_store_multi (ctrl_t ctrl, const void *image, size_t imagelen,
+                              enum kbxd_store_modes mode,
+                              gpg_error_t **r_errors, unsigned int *r_count);
 gpg_error_t kbxd_delete (ctrl_t ctrl, const unsigned char *ubid);
 
 
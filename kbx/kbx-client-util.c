@@ -25,6 +25,12 @@
 #include <string.h>
 #include <npth.h>
 #include <assuan.h>
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP)
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# define USE_SHM_OUTPUT 1
+#endif
 
 #include "../common/util.h"
 #include "../common/membuf.h"
@@ -56,13 +62,19 @@ struct kbx_client_data_s
   npth_cond_t  cond;
   npth_t thd;
 
-  /* The data received from the keyboxd and an error code if there was
-   * a problem (in which case DATA is also set to NULL.  This is only
-   * used if FP is not NULL.  */
-  char *data;
-  size_t datalen;
+  /* The queue of data blobs received from the keyboxd but not yet
+   * taken by kbx_client_data_wait.  A search may return several
+   * blobs with one command; thus we need a queue.  DATAERR is set if
+   * we were not able to queue a received blob.  This is only used if
+   * FP is not NULL.  */
+  struct kbx_client_blob_s *queue;
+  struct kbx_client_blob_s **queue_tail;
   gpg_error_t dataerr;
 
+  /* If not NULL the ring buffer shared with the keyboxd; see
+   * kbx-client-util.h.  Only used if FP is not NULL.  */
+  unsigned char *shmbuf;
+
   /* Helper variables in case D-lines are used (FP is NULL)  */
   char *dlinedata;
   size_t dlinedatalen;
@@ -71,6 +83,16 @@ struct kbx_client_data_s
 
 
 
+/* An item of the data queue.  DATA is NULL if ERR is set.  */
+struct kbx_client_blob_s
+{
+  struct kbx_client_blob_s *next;
+  char *data;
+  size_t datalen;
+  gpg_error_t err;
+};
+
+
 static void *datastream_thread (void *arg);
 
 
@@ -96,6 +118,55 @@ unlock_datastream (kbx_client_data_t kcd)
 
 
 
+#ifdef USE_SHM_OUTPUT
+/* Try to setup a shared ring buffer for the data sent over the pipe.
+ * This is an optional optimization; on error the blobs are simply
+ * sent through the pipe.  */
+static void
+prepare_shm_buffer (kbx_client_data_t kcd)
+{
+  gpg_error_t err;
+  int fd;
+  void *p;
+
+  fd = memfd_create ("kbx-output", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return;
+  if (ftruncate (fd, KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE)
+      || fcntl (fd, F_ADD_SEALS, (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)))
+    {
+      close (fd);
+      return;
+    }
+  p = mmap (NULL, KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE,
+            PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    {
+      close (fd);
+      return;
+    }
+
+  err = assuan_sendfd (kcd->ctx, fd);
+  if (!err)
+    err = assuan_transact (kcd->ctx, "SHMOUTPUT FD",
+                           NULL, NULL, NULL, NULL, NULL, NULL);
+  close (fd);
+  if (err)
+    {
+      /* Older keyboxd versions do not know this command.  */
+      if (gpg_err_code (err) != GPG_ERR_ASS_UNKNOWN_CMD
+          && gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        log_info ("keyboxd does not accept our memfd: %s <%s>\n",
+                  gpg_strerror (err), gpg_strsource (err));
+      munmap (p, KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE);
+      return;
+    }
+
+  kcd->shmbuf = p;
+}
+#endif /*USE_SHM_OUTPUT*/
+
+
 /* Setup the pipe used for receiving data from the keyboxd.  Store the
  * info on KCD.  */
 static gpg_error_t
@@ -108,8 +179,8 @@ prepare_data_pipe (kbx_client_data_t kcd)
   npth_attr_t tattr;
 
   kcd->fp = NULL;
-  kcd->data = NULL;
-  kcd->datalen = 0;
+  kcd->queue = NULL;
+  kcd->queue_tail = &kcd->queue;
   kcd->dataerr = 0;
 
   err = gnupg_create_inbound_pipe (&inpipe, &infp, 0);
@@ -155,6 +226,10 @@ prepare_data_pipe (kbx_client_data_t kcd)
 #endif
   kcd->fp = infp;
 
+#ifdef USE_SHM_OUTPUT
+  prepare_shm_buffer (kcd);
+#endif
+
   rc = npth_attr_init (&tattr);
   if (rc)
     {
@@ -192,7 +267,9 @@ datastream_thread (void *arg)
   unsigned char lenbuf[4];
   size_t nread, datalen;
   char *data = NULL;
-  char *tmpdata;
+  struct kbx_client_blob_s *item;
+  int shmrecord;
+  u32 shmstart = 0;
 
   /* log_debug ("%s: started\n", __func__); */
   while (kcd->fp)
@@ -212,6 +289,16 @@ datastream_thread (void *arg)
         break;
 
       datalen = buf32_to_size_t (lenbuf);
+      shmrecord = 0;
+      if (kcd->shmbuf && (datalen & KBX_SHM_FLAG))
+        {
+          /* The blob is in the shared buffer; get its position.  */
+          if (es_read (kcd->fp, lenbuf, 4, &nread) || nread < 4)
+            break;
+          shmrecord = 1;
+          datalen &= ~KBX_SHM_FLAG;
+          shmstart = buf32_to_u32 (lenbuf);
+        }
       /* log_debug ("keyboxd announced %zu bytes\n", datalen); */
       if (!datalen)
         {
@@ -228,6 +315,25 @@ datastream_thread (void *arg)
         {
           err = gpg_error_from_syserror ();
         }
+      else if (shmrecord)
+        {
+          size_t off = shmstart % KBX_SHM_BUFSIZE;
+
+          if (off + datalen > KBX_SHM_BUFSIZE)
+            err = gpg_error (GPG_ERR_INV_RESPONSE);
+          else
+            {
+              memcpy (data, kcd->shmbuf + KBX_SHM_HDRSIZE + off, datalen);
+              err = 0;
+            }
+          /* Tell the keyboxd that it may reuse this part of the ring.  */
+#ifdef __GNUC__
+          __atomic_store_n ((u32 *)kcd->shmbuf, (u32)(shmstart + datalen),
+                            __ATOMIC_RELEASE);
+#else
+          *(volatile u32 *)kcd->shmbuf = shmstart + datalen;
+#endif
+        }
       else if (es_read (kcd->fp, data, datalen, &nread))
         {
           err = gpg_error_from_syserror ();
@@ -252,16 +358,24 @@ datastream_thread (void *arg)
           /* log_debug ("parsing datastream succeeded\n"); */
         }
 
-      /* Thread-safe assignment to the result var:  */
-      tmpdata = kcd->data;
-      kcd->data = data;
-      kcd->datalen = datalen;
-      kcd->dataerr = err;
-      xfree (tmpdata);
-      data = NULL;
-
-      /* Tell the main thread.  */
+      /* Append the blob to the queue and tell the main thread.  */
+      item = xtrymalloc (sizeof *item);
       lock_datastream (kcd);
+      if (!item)
+        {
+          kcd->dataerr = gpg_error_from_syserror ();
+          xfree (data);
+        }
+      else
+        {
+          item->next = NULL;
+          item->data = data;
+          item->datalen = datalen;
+          item->err = err;
+          *kcd->queue_tail = item;
+          kcd->queue_tail = &item->next;
+        }
+      data = NULL;
       rc = npth_cond_signal (&kcd->cond);
       if (rc)
         {
@@ -333,6 +447,7 @@ void
 kbx_client_data_release (kbx_client_data_t kcd)
 {
   estream_t fp;
+  struct kbx_client_blob_s *item;
 
   if (!kcd)
     return;
@@ -349,6 +464,16 @@ kbx_client_data_release (kbx_client_data_t kcd)
 
   kcd->fp = NULL;
   es_fclose (fp);
+  while ((item = kcd->queue))
+    {
+      kcd->queue = item->next;
+      xfree (item->data);
+      xfree (item);
+    }
+#ifdef USE_SHM_OUTPUT
+  if (kcd->shmbuf)
+    munmap (kcd->shmbuf, KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE);
+#endif
 
   npth_cond_destroy (&kcd->cond);
   npth_mutex_destroy (&kcd->mutex);
@@ -444,6 +569,7 @@ gpg_error_t
 kbx_client_data_wait (kbx_client_data_t kcd, char **r_data, size_t *r_datalen)
 {
   gpg_error_t err = 0;
+  struct kbx_client_blob_s *item;
   int rc;
 
   *r_data = NULL;
@@ -451,7 +577,7 @@ kbx_client_data_wait (kbx_client_data_t kcd, char **r_data, size_t *r_datalen)
   if (kcd->fp)
     {
       lock_datastream (kcd);
-      if (!kcd->data && !kcd->dataerr)
+      while (!kcd->queue && !kcd->dataerr)
         {
           /* log_debug ("%s: waiting on datastream_cond ...\n", __func__); */
           rc = npth_cond_wait (&kcd->cond, &kcd->mutex);
@@ -460,14 +586,26 @@ kbx_client_data_wait (kbx_client_data_t kcd, char **r_data, size_t *r_datalen)
               err = gpg_error_from_errno (rc);
               log_error ("%s: waiting on condition failed: %s\n",
                          __func__, gpg_strerror (err));
+              break;
             }
           /* else */
           /*   log_debug ("%s: waiting on datastream.cond done\n", __func__); */
         }
-      *r_data = kcd->data;
-      kcd->data = NULL;
-      *r_datalen = kcd->datalen;
-      err = err? err : kcd->dataerr;
+      if ((item = kcd->queue))
+        {
+          kcd->queue = item->next;
+          if (!kcd->queue)
+            kcd->queue_tail = &kcd->queue;
+          *r_data = item->data;
+          *r_datalen = item->datalen;
+          err = err? err : item->err;
+          xfree (item);
+        }
+      else if (!err)
+        {
+          err = kcd->dataerr;
+          kcd->dataerr = 0;
+        }
 
       unlock_datastream (kcd);
     }
@@ -481,3 +619,22 @@ kbx_client_data_wait (kbx_client_data_t kcd, char **r_data, size_t *r_datalen)
 
   return err;
 }
+
+
+/* Wait for and drop the next NBLOBS data blobs from the server.  This
+ * is used to skip the not yet taken results of a batched search.  */
+void
+kbx_client_data_discard (kbx_client_data_t kcd, unsigned int nblobs)
+{
+  char *data;
+  size_t datalen;
+
+  if (!kcd->fp)
+    return;  /* D-lines are never batched.  */
+
+  for (; nblobs; nblobs--)
+    {
+      kbx_client_data_wait (kcd, &data, &datalen);
+      xfree (data);
+    }
+}
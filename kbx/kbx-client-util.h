@@ -21,6 +21,17 @@
 #ifndef GNUPG_KBX_CLIENT_UTIL_H
 #define GNUPG_KBX_CLIENT_UTIL_H 1
 
+/* If the client passed a sealed memfd with the SHMOUTPUT command,
+ * the keyboxd copies result blobs into that shared ring buffer and
+ * writes only a record header to the OUTPUT pipe: the 4 byte length
+ * with KBX_SHM_FLAG set, followed by the 4 byte ring position of the
+ * blob.  The first KBX_SHM_HDRSIZE bytes of the buffer are owned by
+ * the client which stores there the ring position up to which it has
+ * consumed the data.  KBX_SHM_BUFSIZE must be a power of two.  */
+#define KBX_SHM_BUFSIZE  (1024*1024)
+#define KBX_SHM_HDRSIZE  64
+#define KBX_SHM_FLAG     0x80000000
+
 
 struct kbx_client_data_s;
 typedef struct kbx_client_data_s *kbx_client_data_t;
@@ -35,6 +46,7 @@ gpg_error_t kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
                                  void *status_cb_value);
 gpg_error_t kbx_client_data_wait (kbx_client_data_t kcd,
                                   char **r_data, size_t *r_datalen);
+void kbx_client_data_discard (kbx_client_data_t kcd, unsigned int nblobs);
 
 
 
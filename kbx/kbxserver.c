@@ -28,6 +28,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP)
+# include <fcntl.h>
+# include <sys/mman.h>
+# define USE_SHM_OUTPUT 1
+#endif
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -36,9 +41,15 @@
 #include "../common/userids.h"
 #include "../common/asshelp.h"
 #include "../common/host2net.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
 #include "frontend.h"
+#include "kbx-client-util.h"
+
 
 
+/* The maximum number of results returned by one SEARCH or NEXT.  */
+#define MAX_SEARCH_BATCH 1000
 
 #define PARM_ERROR(t) assuan_set_error (ctx, \
                                         gpg_error (GPG_ERR_ASS_PARAMETER), (t))
@@ -103,6 +114,11 @@ struct server_local_s
 
   /* If not NULL write output to this stream instead of using D lines.  */
   estream_t outstream;
+
+  /* If not NULL the shared ring buffer set by SHMOUTPUT.  SHMPOS is
+   * the ring position for the next blob.  */
+  unsigned char *shmbuf;
+  u32 shmpos;
 };
 
 
@@ -177,6 +193,60 @@ kbxd_writen (estream_t fp, const void *buffer, size_t length)
   return err;
 }
 
+#ifdef USE_SHM_OUTPUT
+/* Try to put BUFFER of LENGTH into the shared ring buffer and write
+ * the record header to the output stream.  Returns -1 if the blob
+ * does not fit into the free part of the ring; the caller then needs
+ * to send it inline.  */
+static int
+kbxd_write_shm (ctrl_t ctrl, const void *buffer, size_t length,
+                gpg_error_t *r_err)
+{
+  struct server_local_s *sl = ctrl->server_local;
+  unsigned char hdr[8];
+  u32 start, consumed, off;
+
+  if (length > KBX_SHM_BUFSIZE)
+    return -1;
+
+  start = sl->shmpos;
+  off = start % KBX_SHM_BUFSIZE;
+  if (off + length > KBX_SHM_BUFSIZE)
+    {
+      /* Blobs are never split; skip to the begin of the ring.  */
+      start += KBX_SHM_BUFSIZE - off;
+      off = 0;
+    }
+
+#ifdef __GNUC__
+  consumed = __atomic_load_n ((u32 *)sl->shmbuf, __ATOMIC_ACQUIRE);
+#else
+  consumed = *(volatile u32 *)sl->shmbuf;
+#endif
+  if ((u32)(start + length - consumed) > KBX_SHM_BUFSIZE)
+    return -1;  /* The client has not yet consumed enough.  */
+
+  memcpy (sl->shmbuf + KBX_SHM_HDRSIZE + off, buffer, length);
+  sl->shmpos = start + length;
+
+  ulongtobuf (hdr, (length | KBX_SHM_FLAG));
+  ulongtobuf (hdr+4, start);
+  *r_err = kbxd_writen (sl->outstream, hdr, 8);
+  return 0;
+}
+#endif /*USE_SHM_OUTPUT*/
+
+
+/* Return true if the client of CTRL has requested the current global
+ * transaction.  */
+int
+kbxd_is_transaction_owner (ctrl_t ctrl)
+{
+  return (opt.in_transaction && ctrl && ctrl->server_local
+          && opt.transaction_pid == ctrl->server_local->client_pid);
+}
+
+
 /* This status functions expects a printf style format string.  */
 gpg_error_t
 kbxd_status_printf (ctrl_t ctrl, const char *keyword, const char *format, ...)
@@ -212,10 +282,16 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
     {
       unsigned char lenbuf[4];
 
-      ulongtobuf (lenbuf, size);
-      err = kbxd_writen (ctrl->server_local->outstream, lenbuf, 4);
-      if (!err)
-        err = kbxd_writen (ctrl->server_local->outstream, buffer, size);
+#ifdef USE_SHM_OUTPUT
+      if (!ctrl->server_local->shmbuf
+          || kbxd_write_shm (ctrl, buffer, size, &err))
+#endif
+        {
+          ulongtobuf (lenbuf, size);
+          err = kbxd_writen (ctrl->server_local->outstream, lenbuf, 4);
+          if (!err)
+            err = kbxd_writen (ctrl->server_local->outstream, buffer, size);
+        }
       if (!err && es_fflush (ctrl->server_local->outstream))
         {
           err = gpg_error_from_syserror ();
@@ -320,26 +396,100 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Parse the --batch option from LINE and return the number of
+ * results to return with one command.  Batching requires the
+ * length framing of the OUTPUT fd; thus it is only done if an output
+ * stream has been prepared.  */
+static unsigned int
+get_batch_option (ctrl_t ctrl, const char *line)
+{
+  const char *s;
+  int n;
+
+  s = option_value (line, "--batch");
+  if (!s || !ctrl->server_local->outstream)
+    return 1;
+  n = atoi (s);
+  if (n < 1)
+    return 1;
+  return n > MAX_SEARCH_BATCH? MAX_SEARCH_BATCH : n;
+}
+
+
+/* Run the search (DESC,NDESC) and return up to NBATCH results.  The
+ * first search is done with RESET as given; the following ones
+ * continue that search.  In batch mode a BATCH_INFO status with the
+ * number of returned results and a flag telling whether the search
+ * has been exhausted is emitted; a final not-found is then not
+ * returned as error.  */
+static gpg_error_t
+search_batch (ctrl_t ctrl, KEYBOX_SEARCH_DESC *desc, unsigned int ndesc,
+              int reset, unsigned int nbatch)
+{
+  gpg_error_t err;
+  unsigned int n;
+  int eof = 0;
+
+  err = kbxd_search (ctrl, desc, ndesc, reset);
+  if (err || nbatch < 2)
+    return err;
+
+  for (n = 1; n < nbatch; n++)
+    {
+      if (desc[0].mode == KEYDB_SEARCH_MODE_FIRST)
+        desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
+      err = kbxd_search (ctrl, desc, ndesc, 0);
+      if (err)
+        break;
+    }
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      eof = 1;
+      err = 0;
+    }
+  if (!err)
+    err = kbxd_status_printf (ctrl, "BATCH_INFO", "%u %d", n, eof);
+
+  return err;
+}
+
+
 static const char hlp_search[] =
-  "SEARCH [--no-data] [--openpgp|--x509] [[--more] PATTERN]\n"
+  "SEARCH [--no-data] [--meta] [--openpgp|--x509] [--batch=N]\n"
+  "       [[--more] PATTERN]\n"
   "\n"
   "Search for the keys identified by PATTERN.  With --more more\n"
   "patterns to be used for the search are expected with the next\n"
   "command.  With --no-data only the search status is returned but\n"
   "not the actual data.  With --openpgp or --x509 only the respective\n"
-  "keys are returned.  See also \"NEXT\".";
+  "keys are returned.  With --batch up to N results are returned at\n"
+  "once if an OUTPUT fd is used; they are followed by the status line\n"
+  "  BATCH_INFO <count> <eof>\n"
+  "where a non-zero EOF indicates that the search is exhausted.\n"
+  "With --meta the metadata computed from the self-signatures of an\n"
+  "OpenPGP key is returned before its PUBKEY_INFO using the lines\n"
+  "  KEY_META <pk_no> <usage> <expires> <flags>\n"
+  "  UID_META <uid_no> <flags>\n"
+  "for each key and user id with known metadata.  USAGE is made up\n"
+  "of the letters c, s, e and a, EXPIRES is the expiration time or 0,\n"
+  "and FLAGS has an 'r' for revoked and for user ids a 'p' for the\n"
+  "primary one.  This is only supported by the SQLite database.\n"
+  "See also \"NEXT\".";
 static gpg_error_t
 cmd_search (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_more, opt_no_data, opt_openpgp, opt_x509;
+  int opt_more, opt_no_data, opt_meta, opt_openpgp, opt_x509;
+  const char *opt_batch;
   gpg_error_t err;
   unsigned int n, k;
 
   opt_no_data = has_option (line, "--no-data");
+  opt_meta = has_option (line, "--meta");
   opt_more = has_option (line, "--more");
   opt_openpgp = has_option (line, "--openpgp");
   opt_x509 = has_option (line, "--x509");
+  opt_batch = line;
   line = skip_options (line);
 
   ctrl->server_local->search_any_found = 0;
@@ -480,16 +630,19 @@ cmd_search (assuan_context_t ctx, char *line)
   ctrl->server_local->inhibit_data_logging_now = 0;
   ctrl->server_local->inhibit_data_logging_count = 0;
   ctrl->no_data_return = opt_no_data;
+  ctrl->meta_return = opt_meta;
   ctrl->filter_opgp = opt_openpgp;
   ctrl->filter_x509 = opt_x509;
   err = prepare_outstream (ctrl);
   if (err)
     ;
   else if (ctrl->server_local->multi_search_desc_len)
-    err = kbxd_search (ctrl, ctrl->server_local->multi_search_desc,
-                       ctrl->server_local->multi_search_desc_len, 1);
+    err = search_batch (ctrl, ctrl->server_local->multi_search_desc,
+                        ctrl->server_local->multi_search_desc_len, 1,
+                        get_batch_option (ctrl, opt_batch));
   else
-    err = kbxd_search (ctrl, &ctrl->server_local->search_desc, 1, 1);
+    err = search_batch (ctrl, &ctrl->server_local->search_desc, 1, 1,
+                        get_batch_option (ctrl, opt_batch));
   if (err)
     goto leave;
 
@@ -500,23 +653,28 @@ cmd_search (assuan_context_t ctx, char *line)
   if (err)
     ctrl->server_local->multi_search_desc_len = 0;
   ctrl->no_data_return = 0;
+  ctrl->meta_return = 0;
   ctrl->server_local->inhibit_data_logging = 0;
   return leave_cmd (ctx, err);
 }
 
 
 static const char hlp_next[] =
-  "NEXT [--no-data]\n"
+  "NEXT [--no-data] [--meta] [--batch=N]\n"
   "\n"
-  "Get the next search result from a previous search.";
+  "Get the next search result from a previous search.  With --batch\n"
+  "up to N results are returned as described for \"SEARCH\".";
 static gpg_error_t
 cmd_next (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_no_data;
+  int opt_no_data, opt_meta;
+  const char *opt_batch;
   gpg_error_t err;
 
   opt_no_data = has_option (line, "--no-data");
+  opt_meta = has_option (line, "--meta");
+  opt_batch = line;
   line = skip_options (line);
 
   if (*line)
@@ -535,6 +693,7 @@ cmd_next (assuan_context_t ctx, char *line)
   ctrl->server_local->inhibit_data_logging_now = 0;
   ctrl->server_local->inhibit_data_logging_count = 0;
   ctrl->no_data_return = opt_no_data;
+  ctrl->meta_return = opt_meta;
   err = prepare_outstream (ctrl);
   if (err)
     ;
@@ -546,8 +705,9 @@ cmd_next (assuan_context_t ctx, char *line)
           == KEYDB_SEARCH_MODE_FIRST)
         ctrl->server_local->multi_search_desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
 
-      err = kbxd_search (ctrl, ctrl->server_local->multi_search_desc,
-                         ctrl->server_local->multi_search_desc_len, 0);
+      err = search_batch (ctrl, ctrl->server_local->multi_search_desc,
+                          ctrl->server_local->multi_search_desc_len, 0,
+                          get_batch_option (ctrl, opt_batch));
     }
   else
     {
@@ -555,32 +715,96 @@ cmd_next (assuan_context_t ctx, char *line)
       if (ctrl->server_local->search_desc.mode == KEYDB_SEARCH_MODE_FIRST)
         ctrl->server_local->search_desc.mode = KEYDB_SEARCH_MODE_NEXT;
 
-      err = kbxd_search (ctrl, &ctrl->server_local->search_desc, 1, 0);
+      err = search_batch (ctrl, &ctrl->server_local->search_desc, 1, 0,
+                          get_batch_option (ctrl, opt_batch));
     }
   if (err)
     goto leave;
 
  leave:
   ctrl->no_data_return = 0;
+  ctrl->meta_return = 0;
   ctrl->server_local->inhibit_data_logging = 0;
   return leave_cmd (ctx, err);
 }
 
 
+/* The core of STORE --multi.  */
+static gpg_error_t
+store_multi (assuan_context_t ctx, ctrl_t ctrl, enum kbxd_store_modes mode)
+{
+  gpg_error_t err;
+  unsigned char *value;
+  size_t valuelen;
+  gpg_error_t *errors;
+  unsigned int count, i;
+  unsigned int total = 0;
+  unsigned int failed = 0;
+
+  for (;;)
+    {
+      err = assuan_inquire (ctx, "BLOBS", &value, &valuelen, 0);
+      if (err)
+        {
+          log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+          return err;
+        }
+      if (!valuelen) /* End of data.  */
+        {
+          xfree (value);
+          break;
+        }
+
+      err = kbxd_store_multi (ctrl, value, valuelen, mode, &errors, &count);
+      xfree (value);
+      if (err)
+        return err;
+      for (i = 0; i < count && !err; i++)
+        if (errors[i])
+          {
+            failed++;
+            err = kbxd_status_printf (ctrl, "STORE_ERROR", "%u %u",
+                                      total + i, errors[i]);
+          }
+      xfree (errors);
+      if (err)
+        return err;
+      total += count;
+    }
+
+  if (!total)
+    return gpg_error (GPG_ERR_MISSING_VALUE);
+  return kbxd_status_printf (ctrl, "STORE_INFO", "%u %u", total, failed);
+}
+
+
 static const char hlp_store[] =
-  "STORE [--update|--insert]\n"
+  "STORE [--update|--insert] [--multi]\n"
   "\n"
   "Insert a key into the database.  Whether to insert or update\n"
   "the key is decided by looking at the primary key's fingerprint.\n"
   "With option --update the key must already exist.\n"
   "With option --insert the key must not already exist.\n"
   "The actual key material is requested by this function using\n"
-  "  INQUIRE BLOB";
+  "  INQUIRE BLOB\n"
+  "\n"
+  "With option --multi any number of concatenated OpenPGP keyblocks\n"
+  "are requested using\n"
+  "  INQUIRE BLOBS\n"
+  "which is repeated until an empty response is received.  The\n"
+  "keyblocks of each response are stored with one database\n"
+  "transaction; use TRANSACTION to store all of them with one\n"
+  "transaction.  A failed keyblock does not stop the command; for it\n"
+  "the status line\n"
+  "  STORE_ERROR <index> <errorcode>\n"
+  "is emitted with INDEX counting all keyblocks from 0.  Finally\n"
+  "  STORE_INFO <count> <failed>\n"
+  "gives the number of keyblocks and the number of failed ones.";
 static gpg_error_t
 cmd_store (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_update, opt_insert;
+  int opt_update, opt_insert, opt_multi;
   enum kbxd_store_modes mode;
   gpg_error_t err;
   unsigned char *value = NULL;
@@ -588,6 +812,7 @@ cmd_store (assuan_context_t ctx, char *line)
 
   opt_update = has_option (line, "--update");
   opt_insert = has_option (line, "--insert");
+  opt_multi = has_option (line, "--multi");
   line = skip_options (line);
   if (*line)
     {
@@ -601,6 +826,12 @@ cmd_store (assuan_context_t ctx, char *line)
   else
     mode = KBXD_STORE_AUTO;
 
+  if (opt_multi)
+    {
+      err = store_multi (ctx, ctrl, mode);
+      goto leave;
+    }
+
   /* Ask for the key material.  */
   err = assuan_inquire (ctx, "BLOB", &value, &valuelen, 0);
   if (err)
@@ -746,6 +977,11 @@ static const char hlp_getinfo[] =
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
   "connections - Return number of active connections.\n"
+  "cache_stats - Return the statistics of the key cache.\n"
+  "metrics     - Return the metrics in the Prometheus text format.\n"
+  "cmdstats    - Return the statistics of the commands; with --reset\n"
+  "              reset them.\n"
+  "memstat     - Return the memory used by the subsystems.\n"
   "getenv NAME - Return value of envvar NAME\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -799,6 +1035,52 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 get_kbxd_active_connection_count ());
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char *s = kbxd_cache_stats ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *s = metrics_format ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "cmdstats") || !strcmp (line, "cmdstats --reset"))
+    {
+      char *s = metrics_format_cmdstats ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+      if (!err && line[8])
+        metrics_reset_commands ();
+    }
+  else if (!strcmp (line, "memstat"))
+    {
+      char *s = memstat_format ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
   else
     err = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
 
@@ -841,6 +1123,69 @@ cmd_reloadkeyboxd (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_shmoutput[] =
+  "SHMOUTPUT FD[=<n>]\n"
+  "\n"
+  "Use the sealed memfd N as a shared ring buffer for the result blobs\n"
+  "written to the OUTPUT fd.  The buffer must have a size of exactly\n"
+  "64 bytes header plus 1 MiB and may not be shrunk.  Only the blob\n"
+  "position is then written to the OUTPUT fd.  Blobs which do not fit\n"
+  "into the free part of the ring are still written inline.";
+static gpg_error_t
+cmd_shmoutput (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  gnupg_fd_t fd;
+#ifdef USE_SHM_OUTPUT
+  struct stat st;
+  int seals;
+  void *p;
+#endif
+
+  err = assuan_command_parse_fd (ctx, line, &fd);
+  if (err)
+    return err;
+  if (fd == GNUPG_INVALID_FD)
+    return set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+
+#ifdef USE_SHM_OUTPUT
+  /* We map the buffer into our own address space; thus the client
+   * must not be able to shrink it under our feet.  */
+  seals = fcntl (fd, F_GET_SEALS);
+  if (seals == -1 || !(seals & F_SEAL_SHRINK) || !(seals & F_SEAL_SEAL))
+    err = set_error (GPG_ERR_INV_ARG, "memfd not sealed");
+  else if (fstat (fd, &st))
+    err = gpg_error_from_syserror ();
+  else if (st.st_size != KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE)
+    err = set_error (GPG_ERR_INV_LENGTH, "bad size of memfd");
+  else if ((p = mmap (NULL, KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE,
+                      PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0))
+           == MAP_FAILED)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      if (ctrl->server_local->shmbuf)
+        munmap (ctrl->server_local->shmbuf,
+                KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE);
+      ctrl->server_local->shmbuf = p;
+      ctrl->server_local->shmpos = 0;
+    }
+  close (fd);
+#else
+  (void)ctrl;
+#ifdef HAVE_W32_SYSTEM
+  CloseHandle (fd);
+#else
+  close (fd);
+#endif
+  err = set_error (GPG_ERR_NOT_SUPPORTED, NULL);
+#endif
+
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_output[] =
   "OUTPUT FD[=<n>]\n"
   "\n"
@@ -865,6 +1210,7 @@ register_commands (assuan_context_t ctx)
     { "TRANSACTION",cmd_transaction,hlp_transaction },
     { "GETINFO",    cmd_getinfo,    hlp_getinfo },
     { "OUTPUT",     NULL,           hlp_output },
+    { "SHMOUTPUT",  cmd_shmoutput,  hlp_shmoutput },
     { "KILLKEYBOXD",cmd_killkeyboxd,hlp_killkeyboxd },
     { "RELOADKEYBOXD",cmd_reloadkeyboxd,hlp_reloadkeyboxd },
     { NULL, NULL }
@@ -895,6 +1241,25 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  metrics_command_begin (ctx, cmd);
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  (void)err;
+
+  metrics_command_end (ctx);
+}
+
+
 /* This function is called by our assuan log handler to test whether a
  * log message shall really be printed.  The function must return
  * false to inhibit the logging of MSG.  CAT gives the requested log
@@ -996,6 +1361,8 @@ kbxd_start_command_handler (ctrl_t ctrl, gnupg_fd_t fd, unsigned int session_id)
   assuan_set_hello_line (ctx, hello_line);
   assuan_register_option_handler (ctx, option_handler);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
 
   ctrl->server_local->session_id = session_id;
 
@@ -1078,6 +1445,11 @@ kbxd_start_command_handler (ctrl_t ctrl, gnupg_fd_t fd, unsigned int session_id)
           sl->next_session = ctrl->server_local->next_session;
         }
 
+#ifdef USE_SHM_OUTPUT
+      if (ctrl->server_local->shmbuf)
+        munmap (ctrl->server_local->shmbuf,
+                KBX_SHM_HDRSIZE + KBX_SHM_BUFSIZE);
+#endif
       xfree (ctrl->server_local->multi_search_desc);
       if (ctrl->server_local->multi_search_store)
         {
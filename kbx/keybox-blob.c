@@ -45,8 +45,11 @@
    - u16  Header flags
           bit 0 - RFU
           bit 1 - Is being or has been used for OpenPGP blobs
+          bit 2 - Written by lcrv --compile-keyring; the signature
+                  cache flags of the keyblocks may be used by lcrv
    - b4   Magic 'KBXf'
-   - u32  RFU
+   - u32  Generation counter; incremented with each update of the
+          file and used to validate the index file (keybox-index.c).
    - u32  file_created_at
    - u32  last_maintenance_run
    - u32  RFU
@@ -227,6 +230,7 @@ struct keyboxblob {
   byte *blob;
   size_t bloblen;
   off_t fileoffset;
+  int borrowed;  /* BLOB is not owned by this object.  */
 
   /* stuff used only by keybox_create_blob */
   unsigned char *serialbuf;
@@ -1063,11 +1067,68 @@ _keybox_new_blob (KEYBOXBLOB *r_blob,
 }
 
 
+/* Create a blob object for images owned by someone else, like a
+ * mapped file.  Such a blob is set to an image with
+ * _keybox_set_borrowed_blob.  _keybox_release_blob does nothing for
+ * it; use _keybox_release_borrowed_blob instead.  */
+gpg_error_t
+_keybox_new_borrowed_blob (KEYBOXBLOB *r_blob)
+{
+  gpg_error_t err;
+
+  err = _keybox_new_blob (r_blob, NULL, 0, 0);
+  if (!err)
+    (*r_blob)->borrowed = 1;
+  return err;
+}
+
+
+void
+_keybox_set_borrowed_blob (KEYBOXBLOB blob, const unsigned char *image,
+                           size_t imagelen, off_t off)
+{
+  log_assert (blob->borrowed);
+  blob->blob = (unsigned char *)image;
+  blob->bloblen = imagelen;
+  blob->fileoffset = off;
+}
+
+
+void
+_keybox_release_borrowed_blob (KEYBOXBLOB blob)
+{
+  if (!blob)
+    return;
+  blob->blob = NULL;
+  blob->borrowed = 0;
+  _keybox_release_blob (blob);
+}
+
+
+/* Store a copy of BLOB, which may be a borrowed one, at R_BLOB.  */
+gpg_error_t
+_keybox_copy_blob (KEYBOXBLOB *r_blob, KEYBOXBLOB blob)
+{
+  gpg_error_t err;
+  unsigned char *image;
+
+  *r_blob = NULL;
+  image = xtrymalloc (blob->bloblen);
+  if (!image)
+    return gpg_error_from_syserror ();
+  memcpy (image, blob->blob, blob->bloblen);
+  err = _keybox_new_blob (r_blob, image, blob->bloblen, blob->fileoffset);
+  if (err)
+    xfree (image);
+  return err;
+}
+
+
 void
 _keybox_release_blob (KEYBOXBLOB blob)
 {
   int i;
-  if (!blob)
+  if (!blob || blob->borrowed)
     return;
   if (blob->buf)
     {
@@ -34,6 +34,7 @@
 
 
 typedef struct keyboxblob *KEYBOXBLOB;
+typedef struct keybox_map_s *keybox_map_t;
 
 
 typedef struct keybox_name *KB_NAME;
@@ -61,6 +62,9 @@ struct keybox_name
   /* Not yet used.  */
   int did_full_scan;
 
+  /* The cached index of the resource or NULL.  */
+  struct keybox_index_s *index;
+
   /* The name of the resource file. */
   char fname[1];
 };
@@ -81,6 +85,10 @@ struct keybox_handle {
   int error;
   int ephemeral;
   int for_openpgp;        /* Used by gpg.  */
+  int use_mmap;           /* Map the file instead of reading it.  */
+  keybox_map_t map;       /* The mapped file or NULL.  */
+  size_t mapidx;          /* Index of the next blob in MAP.  */
+  off_t mappos;           /* The current offset in MAP.  */
   struct keybox_found_s found;
   struct keybox_found_s saved_found;
   struct {
@@ -100,6 +108,17 @@ struct _keybox_openpgp_key_info
   unsigned char keyid[8];
   int fprlen;  /* Either 16, 20 or 32 */
   unsigned char fpr[32];
+  u32 created;  /* The creation time of the key.  */
+
+  /* The following fields are only set by _keybox_parse_openpgp_meta
+   * and only if HAVE_META is set.  They are taken from the verified
+   * self-signatures.  */
+  u32 expires;            /* Expiration time or 0 for none.  */
+  unsigned int usage;     /* The OpenPGP key flags.  */
+  unsigned int revoked:1;
+  unsigned int have_meta:1;
+  unsigned int have_usage:1;  /* Internal: USAGE is from a signature. */
+  u32 sigtime;            /* Internal: creation time of the selfsig.  */
 };
 
 struct _keybox_openpgp_uid_info
@@ -107,6 +126,13 @@ struct _keybox_openpgp_uid_info
   struct _keybox_openpgp_uid_info *next;
   size_t off;
   size_t len;
+
+  /* Set by _keybox_parse_openpgp_meta similar to the key info.  */
+  unsigned int is_primary:1;
+  unsigned int revoked:1;
+  unsigned int have_meta:1;
+  u32 sigtime;            /* Internal: creation time of the selfsig.  */
+  u32 revtime;            /* Internal: creation time of the revocation.  */
 };
 
 struct _keybox_openpgp_info
@@ -147,6 +173,28 @@ gpg_error_t _keybox_ll_close (estream_t fp);
 void _keybox_close_file (KEYBOX_HANDLE hd);
 
 
+/*-- keybox-index.c --*/
+
+/* What identifies the keybox an index was built for.  */
+struct keybox_index_stamp_s
+{
+  u32 generation;   /* From the header blob.  */
+  uint64_t size;
+  uint64_t mtime;
+  uint64_t ino;
+};
+
+gpg_error_t _keybox_index_get_stamp (const char *fname,
+                                     struct keybox_index_stamp_s *stamp);
+void _keybox_index_bump_generation (unsigned char *buffer, size_t length);
+gpg_error_t _keybox_index_lookup (KB_NAME kb,
+                                  KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                                  off_t **r_offsets, size_t *r_count);
+void _keybox_index_update (const char *fname,
+                           const struct keybox_index_stamp_s *oldstamp,
+                           off_t off, size_t oldlen, KEYBOXBLOB blob);
+
+
 /*-- keybox-blob.c --*/
 gpg_error_t _keybox_create_openpgp_blob (KEYBOXBLOB *r_blob,
                                          keybox_openpgp_info_t info,
@@ -167,16 +215,31 @@ void _keybox_release_blob (KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
 void _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp);
+gpg_error_t _keybox_new_borrowed_blob (KEYBOXBLOB *r_blob);
+void _keybox_set_borrowed_blob (KEYBOXBLOB blob, const unsigned char *image,
+                                size_t imagelen, off_t off);
+void _keybox_release_borrowed_blob (KEYBOXBLOB blob);
+gpg_error_t _keybox_copy_blob (KEYBOXBLOB *r_blob, KEYBOXBLOB blob);
 
 /*-- keybox-openpgp.c --*/
 gpg_error_t _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
                                    size_t *nparsed,
                                    keybox_openpgp_info_t info);
+gpg_error_t _keybox_parse_openpgp_meta (const unsigned char *image,
+                                        size_t imagelen, size_t *nparsed,
+                                        keybox_openpgp_info_t info);
+gpg_error_t _keybox_openpgp_keyblock_len (const unsigned char *image,
+                                          size_t imagelen, size_t *r_len);
 void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 
 
 /*-- keybox-file.c --*/
 int _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted);
+gpg_error_t _keybox_map_open (keybox_map_t *r_map, const char *fname);
+void _keybox_map_close (keybox_map_t map);
+size_t _keybox_map_seek (keybox_map_t map, off_t off);
+int _keybox_map_read_blob (keybox_map_t map, size_t *idx, off_t *r_endoff,
+                           KEYBOXBLOB *r_blob);
 int _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp);
 
 /*-- keybox-search.c --*/
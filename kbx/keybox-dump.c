@@ -141,6 +141,13 @@ dump_header_blob (const byte *buffer, size_t length, FILE *fp)
           fputs ("openpgp", fp);
           any++;
         }
+      if ((n & 4))
+        {
+          if (any)
+            putc (',', fp);
+          fputs ("compiled", fp);
+          any++;
+        }
       putc (')', fp);
     }
   putc ('\n', fp);
@@ -152,6 +159,9 @@ dump_header_blob (const byte *buffer, size_t length, FILE *fp)
   fprintf( fp, "created-at: %lu\n", n );
   n = get32 (buffer+20);
   fprintf( fp, "last-maint: %lu\n", n );
+  n = get32 (buffer+12);
+  if (n)
+    fprintf (fp, "generation: %lu\n", n);
 
   return 0;
 }
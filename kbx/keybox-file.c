@@ -23,8 +23,16 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
 
 #include "keybox-defs.h"
+#include "../common/host2net.h"
 
 
 #define IMAGELEN_LIMIT (5*1024*1024)
@@ -128,6 +136,189 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, estream_t fp, int *skipped_deleted)
 }
 
 
+/* A read-only mapping of a keybox file.  OFFSETS lists the start of
+ * each non-deleted blob; a blob ends where the next one in the file
+ * starts, which is not necessarily the next listed one.  */
+struct keybox_map_s
+{
+  unsigned char *image;
+  size_t imagelen;
+  size_t nblobs;
+  size_t *offsets;
+  size_t endoff;         /* Offset after the last valid blob.  */
+  gpg_error_t enderr;    /* Error at ENDOFF or -1 for end of file.  */
+  KEYBOXBLOB blob;       /* Borrowed blob describing mapped images.  */
+};
+
+
+/* Map the keybox file FNAME and build its offset table.  Returns
+ * GPG_ERR_NOT_SUPPORTED if the file can't be mapped; the caller
+ * should then read it with _keybox_ll_open.  */
+gpg_error_t
+_keybox_map_open (keybox_map_t *r_map, const char *fname)
+{
+#ifdef USE_MMAP
+  gpg_error_t err;
+  keybox_map_t map;
+  struct stat st;
+  size_t pos, len, allocated;
+  size_t *tmp;
+  int fd;
+
+  *r_map = NULL;
+  fd = gnupg_open (fname, O_RDONLY, 0);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  if (!st.st_size || (uint64_t)st.st_size > SIZE_MAX)
+    {
+      close (fd);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  map = xtrycalloc (1, sizeof *map);
+  if (!map)
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  map->imagelen = st.st_size;
+  map->image = mmap (NULL, map->imagelen, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map->image == MAP_FAILED)
+    {
+      xfree (map);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  err = _keybox_new_borrowed_blob (&map->blob);
+  if (err)
+    goto leave;
+
+  /* Build the offset table.  This stops at the first bad length
+   * field; reading from there returns the error _keybox_read_blob
+   * would return.  */
+  allocated = 0;
+  map->enderr = -1;
+  for (pos = 0; pos < map->imagelen; pos += len)
+    {
+      if (map->imagelen - pos < 5)
+        {
+          map->enderr = gpg_error (GPG_ERR_TOO_SHORT);
+          break;
+        }
+      len = buf32_to_size_t (map->image + pos);
+      if (len < 5 || len > map->imagelen - pos)
+        {
+          map->enderr = gpg_error (GPG_ERR_TOO_SHORT);
+          break;
+        }
+      if (!map->image[pos + 4])
+        continue;  /* Deleted blob.  */
+      if (map->nblobs == allocated)
+        {
+          allocated = allocated? allocated * 2 : 256;
+          tmp = xtryrealloc (map->offsets, allocated * sizeof *tmp);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          map->offsets = tmp;
+        }
+      map->offsets[map->nblobs++] = pos;
+    }
+  map->endoff = pos;
+
+ leave:
+  if (err)
+    {
+      _keybox_map_close (map);
+      return err;
+    }
+  *r_map = map;
+  return 0;
+#else
+  (void)fname;
+  *r_map = NULL;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
+void
+_keybox_map_close (keybox_map_t map)
+{
+  if (!map)
+    return;
+#ifdef USE_MMAP
+  munmap (map->image, map->imagelen);
+#endif
+  _keybox_release_borrowed_blob (map->blob);
+  xfree (map->offsets);
+  xfree (map);
+}
+
+
+/* Return the index of the first blob at or after the file offset
+ * OFF.  */
+size_t
+_keybox_map_seek (keybox_map_t map, off_t off)
+{
+  size_t lo = 0, hi = map->nblobs, mid;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if ((off_t)map->offsets[mid] < off)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+
+/* The counterpart of _keybox_read_blob for a mapped file: Return
+ * the blob with index *IDX, advance *IDX and store the offset after
+ * the blob at R_ENDOFF.  The blob stored at R_BLOB points into the
+ * mapping and is only valid until the next call; it may be released
+ * but _keybox_copy_blob is required to keep it.  R_BLOB may be NULL
+ * to skip the blob.  */
+int
+_keybox_map_read_blob (keybox_map_t map, size_t *idx, off_t *r_endoff,
+                       KEYBOXBLOB *r_blob)
+{
+  size_t pos, len;
+
+  if (r_blob)
+    *r_blob = NULL;
+  if (*idx >= map->nblobs)
+    {
+      *r_endoff = map->endoff;
+      return map->enderr;
+    }
+
+  pos = map->offsets[(*idx)++];
+  len = buf32_to_size_t (map->image + pos);
+  *r_endoff = pos + len;
+  if (len > IMAGELEN_LIMIT)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  if (r_blob)
+    {
+      _keybox_set_borrowed_blob (map->blob, map->image + pos, len, pos);
+      *r_blob = map->blob;
+    }
+  return 0;
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, estream_t fp, FILE *outfp)
@@ -188,3 +379,31 @@ _keybox_write_header_blob (estream_t fp, int for_openpgp)
 
   return 0;
 }
+
+
+/* Set the FLAGS in the header blob of the keybox FNAME.  */
+gpg_error_t
+keybox_set_header_flags (const char *fname, unsigned int flags)
+{
+  gpg_error_t err = 0;
+  unsigned char image[32];
+  estream_t fp;
+
+  fp = es_fopen (fname, "r+b");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (es_fread (image, sizeof image, 1, fp) != 1)
+    err = gpg_error (GPG_ERR_TOO_SHORT);
+  else if (image[4] != KEYBOX_BLOBTYPE_HEADER || memcmp (image+8, "KBXf", 4))
+    err = gpg_error (GPG_ERR_INV_KEYRING);
+  else
+    {
+      image[6] |= flags >> 8;
+      image[7] |= flags;
+      if (es_fseek (fp, 0, SEEK_SET) || es_fwrite (image, 8, 1, fp) != 1)
+        err = gpg_error_from_syserror ();
+    }
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  return err;
+}
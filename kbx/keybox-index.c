@@ -0,0 +1,964 @@
+/* keybox-index.c - Sidecar index for keybox files
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The index file FNAME.idx maps the fingerprints, the long keyids
+ * and the keygrips of the keys in the keybox FNAME to the offsets of
+ * their blobs.  For X.509 blobs it also maps the issuer, the issuer
+ * along with the serial number, and the subject; these are stored as
+ * hashes so that the same fixed length entries can be used.  A search for one of these items then only reads the
+ * blobs at the listed offsets instead of scanning the entire keybox.
+ * Because the search still runs the regular comparisons on those
+ * blobs, the index only needs to list a superset of the matching
+ * blobs.  Thus it stores just a prefix of each item.
+ *
+ * The index records the size, modification time and inode of the
+ * keybox it describes and the generation counter from the keybox
+ * header blob, which is incremented by each update done by this
+ * code.  An index not matching its keybox is ignored and rebuilt by
+ * the next search.  Inserts, updates and deletes keep a valid index
+ * up to date.
+ *
+ * The index file format:
+ *
+ *   - b4   Magic 'KBXi'
+ *   - byte Version number (2)
+ *   - byte Flags
+ *          bit 0 - Keygrips of X.509 blobs are missing
+ *   - u16  RFU
+ *   - u32  Generation counter of the keybox
+ *   - u32  [NENTRIES] Number of entries
+ *   - u64  Size of the keybox file
+ *   - u64  Modification time of the keybox file
+ *   - u64  Inode number of the keybox file
+ *   - u64  RFU
+ *   - NENTRIES times, sorted by their bytes:
+ *     - byte Type of the item: 1 = fingerprint, 2 = long keyid,
+ *            3 = keygrip, 4 = issuer, 5 = issuer and serial number,
+ *            6 = subject
+ *     - b11  The first 11 bytes of the item; a keyid is right padded
+ *            with zeroes.  For the types 4 to 6 the item is the SHA-1
+ *            hash of the DN string as stored in the blob; for type 5
+ *            followed by a nul byte and the binary serial number.
+ *     - u32  Offset of the blob in the keybox file.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
+
+#include "keybox-defs.h"
+#include "../common/host2net.h"
+#include "../common/sysutils.h"
+
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#define INDEX_HEADER_LEN 48
+#define INDEX_ENTRY_LEN  16
+#define INDEX_KEY_LEN    12  /* The type and the prefix of the item.  */
+
+#define INDEX_TYPE_FPR   1
+#define INDEX_TYPE_KID   2
+#define INDEX_TYPE_GRIP  3
+#define INDEX_TYPE_ISSUER     4
+#define INDEX_TYPE_ISSUER_SN  5
+#define INDEX_TYPE_SUBJECT    6
+
+#define INDEX_VERSION    2
+
+#define INDEX_FLAG_NOGRIP 1
+
+#define get16(a) buf16_to_ulong ((a))
+#define get32(a) buf32_to_ulong ((a))
+
+
+/* An index in memory.  IMAGE has the layout of the index file.  */
+struct keybox_index_s
+{
+  struct keybox_index_stamp_s stamp;
+  unsigned char *image;
+  size_t imagelen;
+  unsigned int mapped:1;  /* IMAGE is mmapped.  */
+  unsigned int nogrip:1;  /* Keygrips are not complete.  */
+  unsigned int failed:1;  /* No index can be built for STAMP.  */
+  size_t nentries;
+};
+
+
+/* A growing array of index entries.  */
+struct entries_s
+{
+  unsigned char *buf;   /* The header followed by the entries.  */
+  size_t nentries;
+  size_t allocated;
+  int nogrip;
+};
+
+
+/* Whether to use index files.  */
+static int use_index;
+
+
+/* Enable the use of index files for all keyboxes.  */
+void
+keybox_set_use_index (int yes)
+{
+  use_index = !!yes;
+}
+
+
+static char *
+index_name (const char *fname)
+{
+  return strconcat (fname, ".idx", NULL);
+}
+
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return ((uint64_t)get32 (p) << 32) | get32 (p + 4);
+}
+
+
+static void
+put32 (unsigned char *p, u32 val)
+{
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >> 8;
+  p[3] = val;
+}
+
+
+static void
+put64 (unsigned char *p, uint64_t val)
+{
+  put32 (p, val >> 32);
+  put32 (p + 4, val);
+}
+
+
+static void
+stamp_from_stat (struct keybox_index_stamp_s *stamp, const struct stat *st)
+{
+  stamp->size = st->st_size;
+  stamp->mtime = st->st_mtime;
+  stamp->ino = st->st_ino;
+}
+
+
+/* Return true if the file described by STAMP did not change since
+ * OLDSTAMP.  The generation counter is ignored.  */
+static int
+same_file_stamp (const struct keybox_index_stamp_s *stamp,
+                 const struct keybox_index_stamp_s *oldstamp)
+{
+  return (stamp->size == oldstamp->size
+          && stamp->mtime == oldstamp->mtime
+          && stamp->ino == oldstamp->ino);
+}
+
+
+/* Read the generation counter from the header blob of the keybox
+ * FP.  */
+static u32
+read_generation (estream_t fp)
+{
+  unsigned char buffer[32];
+
+  if (es_fseeko (fp, 0, SEEK_SET)
+      || es_fread (buffer, sizeof buffer, 1, fp) != 1
+      || buffer[4] != KEYBOX_BLOBTYPE_HEADER
+      || memcmp (buffer + 8, "KBXf", 4))
+    return 0;
+  return get32 (buffer + 12);
+}
+
+
+/* Store the stamp of the keybox FNAME at STAMP.  Fails if indexes
+ * are not used.  */
+gpg_error_t
+_keybox_index_get_stamp (const char *fname, struct keybox_index_stamp_s *stamp)
+{
+  gpg_error_t err;
+  estream_t fp;
+  struct stat st;
+
+  memset (stamp, 0, sizeof *stamp);
+  if (!use_index)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  err = _keybox_ll_open (&fp, fname, 0);
+  if (err)
+    return err;
+  if (fstat (es_fileno (fp), &st))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      stamp_from_stat (stamp, &st);
+      stamp->generation = read_generation (fp);
+    }
+  _keybox_ll_close (fp);
+  return err;
+}
+
+
+/* Increment the generation counter in the header blob at BUFFER of
+ * LENGTH bytes.  */
+void
+_keybox_index_bump_generation (unsigned char *buffer, size_t length)
+{
+  if (length < 32
+      || buffer[4] != KEYBOX_BLOBTYPE_HEADER
+      || memcmp (buffer + 8, "KBXf", 4))
+    return;
+  put32 (buffer + 12, get32 (buffer + 12) + 1);
+}
+
+
+static gpg_error_t
+add_entry (struct entries_s *e, int type, const unsigned char *item,
+           size_t itemlen, off_t off)
+{
+  unsigned char *p;
+
+  if ((uint64_t)off > 0xffffffff)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  if (e->nentries == e->allocated)
+    {
+      e->allocated = e->allocated? e->allocated * 2 : 1024;
+      p = xtryrealloc (e->buf,
+                       INDEX_HEADER_LEN + e->allocated * INDEX_ENTRY_LEN);
+      if (!p)
+        return gpg_error_from_syserror ();
+      e->buf = p;
+    }
+
+  p = e->buf + INDEX_HEADER_LEN + e->nentries * INDEX_ENTRY_LEN;
+  memset (p, 0, INDEX_ENTRY_LEN);
+  p[0] = type;
+  memcpy (p + 1, item, itemlen < INDEX_KEY_LEN - 1? itemlen : INDEX_KEY_LEN-1);
+  put32 (p + INDEX_KEY_LEN, off);
+  e->nentries++;
+  return 0;
+}
+
+
+/* Store the SHA-1 hash of the DN NAME of NAMELEN bytes at DIGEST.  If
+ * SN is not NULL, a nul byte and the SNLEN bytes of SN are hashed
+ * too.  */
+static void
+hash_dn (unsigned char *digest, const void *name, size_t namelen,
+         const void *sn, size_t snlen)
+{
+  gcry_buffer_t iov[3];
+  int iovcnt = 1;
+
+  memset (iov, 0, sizeof iov);
+  iov[0].data = (void *)name;
+  iov[0].len = namelen;
+  if (sn)
+    {
+      iov[1].data = "";
+      iov[1].len = 1;
+      iov[2].data = (void *)sn;
+      iov[2].len = snlen;
+      iovcnt = 3;
+    }
+  gcry_md_hash_buffers (GCRY_MD_SHA1, 0, digest, iov, iovcnt);
+}
+
+
+/* Add the issuer and subject entries of the X.509 blob IMAGE of
+ * LENGTH bytes at offset OFF.  The parsing mirrors blob_cmp_name and
+ * blob_cmp_sn.  */
+static gpg_error_t
+add_x509_entries (struct entries_s *e, const unsigned char *image,
+                  size_t length, off_t off)
+{
+  gpg_error_t err;
+  size_t pos, nkeys, keyinfolen, nserial, snpos, nuids, uidinfolen;
+  size_t noff, nlen, idx;
+  unsigned char digest[20];
+
+  if (length < 40)
+    return 0;
+  nkeys = get16 (image + 16);
+  keyinfolen = get16 (image + 18);
+  if (keyinfolen < 28)
+    return 0;
+  pos = 20 + keyinfolen * nkeys;
+  if ((uint64_t)pos + 2 > (uint64_t)length)
+    return 0;
+  nserial = get16 (image + pos);
+  snpos = pos + 2;
+  pos += 2 + nserial;
+  if (pos + 4 > length)
+    return 0;
+  nuids = get16 (image + pos);
+  uidinfolen = get16 (image + pos + 2);
+  pos += 4;
+  if (uidinfolen < 12 || pos + (uint64_t)uidinfolen * nuids > length)
+    return 0;
+
+  /* The issuer is the first and the subject the second name.  */
+  for (idx = 0; idx < 2 && idx < nuids; idx++)
+    {
+      noff = get32 (image + pos + idx * uidinfolen);
+      nlen = get32 (image + pos + idx * uidinfolen + 4);
+      if ((uint64_t)noff + (uint64_t)nlen > (uint64_t)length || !nlen)
+        continue;
+      if (!idx)
+        {
+          hash_dn (digest, image + noff, nlen, NULL, 0);
+          err = add_entry (e, INDEX_TYPE_ISSUER, digest, 20, off);
+          if (!err)
+            {
+              hash_dn (digest, image + noff, nlen, image + snpos, nserial);
+              err = add_entry (e, INDEX_TYPE_ISSUER_SN, digest, 20, off);
+            }
+        }
+      else
+        {
+          hash_dn (digest, image + noff, nlen, NULL, 0);
+          err = add_entry (e, INDEX_TYPE_SUBJECT, digest, 20, off);
+        }
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+/* Add the entries for the blob IMAGE of LENGTH bytes at offset OFF.
+ * This mirrors the checks done by the search functions.  */
+static gpg_error_t
+add_blob_entries (struct entries_s *e, const unsigned char *image,
+                  size_t length, off_t off)
+{
+  gpg_error_t err;
+  size_t nkeys, keyinfolen, pos, idx, cert_off, cert_len;
+  const unsigned char *fpr;
+  int fpr32;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *k;
+
+  if (length < 40)
+    return 0;
+  if (image[4] != KEYBOX_BLOBTYPE_PGP && image[4] != KEYBOX_BLOBTYPE_X509)
+    return 0;
+  fpr32 = image[5] == 2;
+
+  nkeys = get16 (image + 16);
+  keyinfolen = get16 (image + 18);
+  if (keyinfolen < (fpr32? 56 : 28))
+    return 0;
+  pos = 20;
+  if (pos + (uint64_t)keyinfolen * nkeys > (uint64_t)length)
+    return 0;
+
+  for (idx = 0; idx < nkeys; idx++)
+    {
+      fpr = image + pos + idx * keyinfolen;
+      err = add_entry (e, INDEX_TYPE_FPR, fpr, 32, off);
+      if (!err)
+        {
+          if (fpr32 && (fpr[32 + 1] & 0x80))
+            err = add_entry (e, INDEX_TYPE_KID, fpr, 8, off);
+          else
+            err = add_entry (e, INDEX_TYPE_KID, fpr + 12, 8, off);
+        }
+      if (err)
+        return err;
+    }
+
+  if (image[4] != KEYBOX_BLOBTYPE_PGP)
+    {
+      /* We would need to parse the certificate to get the keygrip.  */
+      e->nogrip = 1;
+      return add_x509_entries (e, image, length, off);
+    }
+
+  /* The keygrips are not stored in the blob; get them from the
+   * keyblock.  */
+  cert_off = get32 (image + 8);
+  cert_len = get32 (image + 12);
+  if ((uint64_t)cert_off + (uint64_t)cert_len > (uint64_t)length)
+    return 0;
+  if (_keybox_parse_openpgp (image + cert_off, cert_len, NULL, &info))
+    return 0;
+  err = add_entry (e, INDEX_TYPE_GRIP, info.primary.grip, 20, off);
+  if (!err && info.nsubkeys)
+    for (k = &info.subkeys; k && !err; k = k->next)
+      err = add_entry (e, INDEX_TYPE_GRIP, k->grip, 20, off);
+  _keybox_destroy_openpgp_info (&info);
+  return err;
+}
+
+
+static int
+cmp_entries (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_ENTRY_LEN);
+}
+
+
+/* Sort the entries and fill in the header.  */
+static void
+finish_entries (struct entries_s *e, const struct keybox_index_stamp_s *stamp)
+{
+  unsigned char *h = e->buf;
+
+  qsort (e->buf + INDEX_HEADER_LEN, e->nentries, INDEX_ENTRY_LEN,
+         cmp_entries);
+
+  memset (h, 0, INDEX_HEADER_LEN);
+  memcpy (h, "KBXi", 4);
+  h[4] = INDEX_VERSION;
+  h[5] = e->nogrip? INDEX_FLAG_NOGRIP : 0;
+  put32 (h + 8, stamp->generation);
+  put32 (h + 12, e->nentries);
+  put64 (h + 16, stamp->size);
+  put64 (h + 24, stamp->mtime);
+  put64 (h + 32, stamp->ino);
+}
+
+
+/* Write the index E of the keybox FNAME.  A failure is not an error
+ * because the index will then be rebuilt by the next search.  */
+static void
+write_index (const char *fname, struct entries_s *e)
+{
+  char *idxname, *tmpname;
+  estream_t fp;
+  size_t n;
+
+  idxname = index_name (fname);
+  tmpname = xtryasprintf ("%s.idx-%lu", fname, (unsigned long)getpid ());
+  if (!idxname || !tmpname)
+    goto leave;
+
+  fp = es_fopen (tmpname, "wb");
+  if (!fp)
+    goto leave;
+  n = INDEX_HEADER_LEN + e->nentries * INDEX_ENTRY_LEN;
+  if (es_fwrite (e->buf, n, 1, fp) != 1)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpname);
+      goto leave;
+    }
+  if (es_fclose (fp) || gnupg_rename_file (tmpname, idxname, NULL))
+    {
+      log_info ("can't write '%s': %s\n", idxname,
+                gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpname);
+    }
+
+ leave:
+  xfree (tmpname);
+  xfree (idxname);
+}
+
+
+static void
+release_index (struct keybox_index_s *idx)
+{
+  if (!idx)
+    return;
+#ifdef USE_MMAP
+  if (idx->mapped)
+    munmap (idx->image, idx->imagelen);
+  else
+#endif
+    xfree (idx->image);
+  xfree (idx);
+}
+
+
+/* Create an index object for the index image E.  */
+static gpg_error_t
+new_index (struct entries_s *e, const struct keybox_index_stamp_s *stamp,
+           struct keybox_index_s **r_idx)
+{
+  struct keybox_index_s *idx;
+
+  idx = xtrycalloc (1, sizeof *idx);
+  if (!idx)
+    return gpg_error_from_syserror ();
+  idx->stamp = *stamp;
+  idx->image = e->buf;
+  idx->imagelen = INDEX_HEADER_LEN + e->nentries * INDEX_ENTRY_LEN;
+  idx->nentries = e->nentries;
+  idx->nogrip = e->nogrip;
+  e->buf = NULL;
+  *r_idx = idx;
+  return 0;
+}
+
+
+/* Build the index for the keybox FNAME.  The index is also written
+ * to disk.  */
+static gpg_error_t
+build_index (const char *fname, struct keybox_index_s **r_idx)
+{
+  gpg_error_t err;
+  estream_t fp;
+  KEYBOXBLOB blob = NULL;
+  struct entries_s e;
+  struct keybox_index_stamp_s stamp;
+  struct stat st;
+  const unsigned char *image;
+  size_t length;
+
+  *r_idx = NULL;
+  memset (&e, 0, sizeof e);
+  err = add_entry (&e, 0, NULL, 0, 0);  /* Allocate the header.  */
+  if (err)
+    return err;
+  e.nentries = 0;
+
+  err = _keybox_ll_open (&fp, fname, 0);
+  if (err)
+    {
+      xfree (e.buf);
+      return err;
+    }
+  if (fstat (es_fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  stamp_from_stat (&stamp, &st);
+  stamp.generation = read_generation (fp);
+  if (es_fseeko (fp, 0, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (;;)
+    {
+      _keybox_release_blob (blob);
+      err = _keybox_read_blob (&blob, fp, NULL);
+      if (gpg_err_code (err) == GPG_ERR_TOO_LARGE
+          && gpg_err_source (err) == GPG_ERR_SOURCE_KEYBOX)
+        continue;
+      if (err == -1)
+        {
+          err = 0;
+          break;
+        }
+      if (err)
+        goto leave;
+      image = _keybox_get_blob_image (blob, &length);
+      err = add_blob_entries (&e, image, length,
+                              _keybox_get_blob_fileoffset (blob));
+      if (err)
+        goto leave;
+    }
+
+  finish_entries (&e, &stamp);
+  write_index (fname, &e);
+  err = new_index (&e, &stamp, r_idx);
+
+ leave:
+  _keybox_release_blob (blob);
+  _keybox_ll_close (fp);
+  xfree (e.buf);
+  return err;
+}
+
+
+/* Check that the index IMAGE of LENGTH bytes is well formed and
+ * matches the keybox described by STAMP.  */
+static int
+check_index_image (const unsigned char *image, size_t length,
+                   const struct keybox_index_stamp_s *stamp)
+{
+  size_t nentries;
+
+  if (length < INDEX_HEADER_LEN
+      || memcmp (image, "KBXi", 4) || image[4] != INDEX_VERSION)
+    return 0;
+  nentries = get32 (image + 12);
+  if (length != INDEX_HEADER_LEN + nentries * (uint64_t)INDEX_ENTRY_LEN)
+    return 0;
+  return (get32 (image + 8) == stamp->generation
+          && get64 (image + 16) == stamp->size
+          && get64 (image + 24) == stamp->mtime
+          && get64 (image + 32) == stamp->ino);
+}
+
+
+/* Read the index file of the keybox FNAME.  If FOR_UPDATE is set it
+ * is read into memory, otherwise it may be mapped.  */
+static gpg_error_t
+load_index (const char *fname, const struct keybox_index_stamp_s *stamp,
+            int for_update, struct keybox_index_s **r_idx)
+{
+  gpg_error_t err = 0;
+  struct keybox_index_s *idx;
+  char *idxname;
+  struct stat st;
+  int fd;
+
+  *r_idx = NULL;
+  idxname = index_name (fname);
+  if (!idxname)
+    return gpg_error_from_syserror ();
+  fd = gnupg_open (idxname, O_RDONLY | O_BINARY, 0);
+  xfree (idxname);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+
+  idx = xtrycalloc (1, sizeof *idx);
+  if (!idx)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (st.st_size < INDEX_HEADER_LEN || (uint64_t)st.st_size > SIZE_MAX)
+    {
+      err = gpg_error (GPG_ERR_INV_OBJ);
+      goto leave;
+    }
+  idx->imagelen = st.st_size;
+
+#ifdef USE_MMAP
+  if (!for_update)
+    {
+      idx->image = mmap (NULL, idx->imagelen, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (idx->image == MAP_FAILED)
+        idx->image = NULL;
+      else
+        idx->mapped = 1;
+    }
+#else
+  (void)for_update;
+#endif
+  if (!idx->image)
+    {
+      idx->image = xtrymalloc (idx->imagelen);
+      if (!idx->image)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (read (fd, idx->image, idx->imagelen) != (ssize_t)idx->imagelen)
+        {
+          err = gpg_error (GPG_ERR_TOO_SHORT);
+          goto leave;
+        }
+    }
+
+  if (!check_index_image (idx->image, idx->imagelen, stamp))
+    {
+      err = gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+      goto leave;
+    }
+  idx->stamp = *stamp;
+  idx->nentries = get32 (idx->image + 12);
+  idx->nogrip = !!(idx->image[5] & INDEX_FLAG_NOGRIP);
+  *r_idx = idx;
+  idx = NULL;
+
+ leave:
+  release_index (idx);
+  close (fd);
+  return err;
+}
+
+
+/* Return a valid index for the keybox KB or NULL.  */
+static struct keybox_index_s *
+get_index (KB_NAME kb)
+{
+  struct keybox_index_stamp_s stamp;
+  struct keybox_index_s *idx;
+  struct stat st;
+
+  if (gnupg_stat (kb->fname, &st))
+    return NULL;
+  stamp_from_stat (&stamp, &st);
+  if (kb->index && same_file_stamp (&stamp, &kb->index->stamp))
+    return kb->index->failed? NULL : kb->index;
+
+  release_index (kb->index);
+  kb->index = NULL;
+  if (_keybox_index_get_stamp (kb->fname, &stamp))
+    return NULL;
+  if (load_index (kb->fname, &stamp, 0, &idx)
+      && build_index (kb->fname, &idx))
+    {
+      /* Don't try again until the keybox changes.  */
+      idx = xtrycalloc (1, sizeof *idx);
+      if (!idx)
+        return NULL;
+      idx->stamp = stamp;
+      idx->failed = 1;
+      kb->index = idx;
+      return NULL;
+    }
+  if (!same_file_stamp (&stamp, &idx->stamp))
+    {
+      /* Changed while building; the next search will try again.  */
+      release_index (idx);
+      return NULL;
+    }
+  kb->index = idx;
+  return idx;
+}
+
+
+/* Make the index key for the search description DESC.  Returns false
+ * if the index can't be used for DESC.  */
+static int
+make_search_key (KEYBOX_SEARCH_DESC *desc, unsigned char *key)
+{
+  unsigned char digest[20];
+
+  memset (key, 0, INDEX_KEY_LEN);
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      key[0] = INDEX_TYPE_KID;
+      put32 (key + 1, desc->u.kid[0]);
+      put32 (key + 5, desc->u.kid[1]);
+      return 1;
+    case KEYDB_SEARCH_MODE_FPR:
+      if (desc->fprlen != 20 && desc->fprlen != 32)
+        return 0;
+      key[0] = INDEX_TYPE_FPR;
+      memcpy (key + 1, desc->u.fpr, INDEX_KEY_LEN - 1);
+      return 1;
+    case KEYDB_SEARCH_MODE_UBID:
+      /* The UBID is the start of the primary fingerprint.  */
+      key[0] = INDEX_TYPE_FPR;
+      memcpy (key + 1, desc->u.ubid, INDEX_KEY_LEN - 1);
+      return 1;
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      key[0] = INDEX_TYPE_GRIP;
+      memcpy (key + 1, desc->u.grip, INDEX_KEY_LEN - 1);
+      return 1;
+    case KEYDB_SEARCH_MODE_ISSUER:
+      if (!desc->u.name || !*desc->u.name)
+        return 0;
+      key[0] = INDEX_TYPE_ISSUER;
+      hash_dn (digest, desc->u.name, strlen (desc->u.name), NULL, 0);
+      memcpy (key + 1, digest, INDEX_KEY_LEN - 1);
+      return 1;
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+      /* A serial number given in hex is only converted by the
+       * search function; we use the index only for a binary one.  */
+      if (!desc->u.name || !*desc->u.name || !desc->sn || desc->snhex)
+        return 0;
+      key[0] = INDEX_TYPE_ISSUER_SN;
+      hash_dn (digest, desc->u.name, strlen (desc->u.name),
+               desc->sn, desc->snlen);
+      memcpy (key + 1, digest, INDEX_KEY_LEN - 1);
+      return 1;
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      if (!desc->u.name || !*desc->u.name)
+        return 0;
+      key[0] = INDEX_TYPE_SUBJECT;
+      hash_dn (digest, desc->u.name, strlen (desc->u.name), NULL, 0);
+      memcpy (key + 1, digest, INDEX_KEY_LEN - 1);
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+static int
+cmp_offsets (const void *a, const void *b)
+{
+  off_t x = *(const off_t *)a;
+  off_t y = *(const off_t *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Look up the blobs which may match one of the NDESC descriptions in
+ * DESC.  On success an array with the ascending offsets of these
+ * blobs is stored at R_OFFSETS and their number at R_COUNT.  Returns
+ * GPG_ERR_NOT_SUPPORTED if the keybox needs to be scanned.  */
+gpg_error_t
+_keybox_index_lookup (KB_NAME kb, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                      off_t **r_offsets, size_t *r_count)
+{
+  struct keybox_index_s *idx;
+  unsigned char key[INDEX_KEY_LEN];
+  const unsigned char *entries, *p;
+  size_t lo, hi, mid, n, count, allocated;
+  off_t *offsets = NULL, *tmp;
+
+  *r_offsets = NULL;
+  *r_count = 0;
+  if (!use_index || !ndesc || kb->secret)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  for (n = 0; n < ndesc; n++)
+    if (!make_search_key (desc + n, key))
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  idx = get_index (kb);
+  if (!idx)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  for (n = 0; n < ndesc; n++)
+    if (desc[n].mode == KEYDB_SEARCH_MODE_KEYGRIP && idx->nogrip)
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  entries = idx->image + INDEX_HEADER_LEN;
+  count = allocated = 0;
+  for (n = 0; n < ndesc; n++)
+    {
+      make_search_key (desc + n, key);
+
+      /* Find the first entry not less than KEY.  */
+      lo = 0;
+      hi = idx->nentries;
+      while (lo < hi)
+        {
+          mid = lo + (hi - lo) / 2;
+          if (memcmp (entries + mid * INDEX_ENTRY_LEN, key, INDEX_KEY_LEN) < 0)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+
+      for (; lo < idx->nentries; lo++)
+        {
+          p = entries + lo * INDEX_ENTRY_LEN;
+          if (memcmp (p, key, INDEX_KEY_LEN))
+            break;
+          if (count == allocated)
+            {
+              allocated = allocated? allocated * 2 : 8;
+              tmp = xtryrealloc (offsets, allocated * sizeof *offsets);
+              if (!tmp)
+                {
+                  xfree (offsets);
+                  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+                }
+              offsets = tmp;
+            }
+          offsets[count++] = get32 (p + INDEX_KEY_LEN);
+        }
+    }
+
+  if (ndesc > 1 && count > 1)
+    {
+      qsort (offsets, count, sizeof *offsets, cmp_offsets);
+      for (lo = 0, n = 1; n < count; n++)
+        if (offsets[n] != offsets[lo])
+          offsets[++lo] = offsets[n];
+      count = lo + 1;
+    }
+
+  *r_offsets = offsets;
+  *r_count = count;
+  return 0;
+}
+
+
+/* Update the index of the keybox FNAME after the blob at offset OFF
+ * of OLDLEN bytes has been replaced by BLOB.  For an insert OFF is
+ * the old end of the file and OLDLEN is 0.  BLOB is NULL for a
+ * delete; OLDLEN is 0 if the blob was only marked as deleted.
+ * OLDSTAMP describes the keybox before the change; if the index did
+ * not match it, it is removed.  */
+void
+_keybox_index_update (const char *fname,
+                      const struct keybox_index_stamp_s *oldstamp,
+                      off_t off, size_t oldlen, KEYBOXBLOB blob)
+{
+  struct keybox_index_s *idx = NULL;
+  struct keybox_index_stamp_s stamp;
+  struct entries_s e;
+  const unsigned char *image, *p;
+  size_t length = 0;
+  size_t n;
+  int64_t delta;
+  uint64_t o;
+  char *idxname;
+
+  if (!use_index)
+    return;
+
+  memset (&e, 0, sizeof e);
+  if (load_index (fname, oldstamp, 1, &idx)
+      || _keybox_index_get_stamp (fname, &stamp))
+    goto failed;
+
+  image = blob? _keybox_get_blob_image (blob, &length) : NULL;
+  delta = (int64_t)length - (int64_t)oldlen;
+
+  if (add_entry (&e, 0, NULL, 0, 0))
+    goto failed;
+  e.nentries = 0;
+  e.nogrip = idx->nogrip;
+  for (n = 0; n < idx->nentries; n++)
+    {
+      p = idx->image + INDEX_HEADER_LEN + n * INDEX_ENTRY_LEN;
+      o = get32 (p + INDEX_KEY_LEN);
+      if (o == (uint64_t)off)
+        continue;  /* The replaced or deleted blob.  */
+      if (o > (uint64_t)off)
+        o += delta;
+      if (add_entry (&e, p[0], p + 1, INDEX_KEY_LEN - 1, o))
+        goto failed;
+    }
+  if (image && add_blob_entries (&e, image, length, off))
+    goto failed;
+
+  finish_entries (&e, &stamp);
+  write_index (fname, &e);
+  release_index (idx);
+  xfree (e.buf);
+  return;
+
+ failed:
+  /* Remove a stale index so that it will be rebuilt.  */
+  release_index (idx);
+  xfree (e.buf);
+  idxname = index_name (fname);
+  if (idxname)
+    gnupg_remove (idxname);
+  xfree (idxname);
+}
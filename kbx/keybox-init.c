@@ -82,6 +82,7 @@ keybox_register_file (const char *fname, int secret, void **r_token)
   kr->lockhd = NULL;
   kr->is_locked = 0;
   kr->did_full_scan = 0;
+  kr->index = NULL;
   /* keep a list of all issued pointers */
   kr->next = kb_names;
   kb_names = kr;
@@ -211,6 +212,7 @@ keybox_release (KEYBOX_HANDLE hd)
       _keybox_ll_close (hd->fp);
       hd->fp = NULL;
     }
+  _keybox_map_close (hd->map);
   xfree (hd->word_match.name);
   xfree (hd->word_match.pattern);
   xfree (hd);
@@ -264,6 +266,25 @@ keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes)
 }
 
 
+/* Let searches on HD map the file into memory and parse the blobs in
+ * place instead of reading them.  This is only safe if the file is
+ * not truncated while mapped; our updates replace the file by a
+ * rename.  If the file can't be mapped it is read as usual.  */
+int
+keybox_set_mmap (KEYBOX_HANDLE hd, int yes)
+{
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  hd->use_mmap = yes;
+  if (!yes && hd->map)
+    {
+      _keybox_map_close (hd->map);
+      hd->map = NULL;
+    }
+  return 0;
+}
+
+
 /* Low-level open function to be used for keybox files.  This function
  * also manages custom buffering.  On success 0 is returned and a new
  * file pointer stored at RFP; on error an error code is returned and
@@ -378,8 +399,13 @@ _keybox_close_file (KEYBOX_HANDLE hd)
             _keybox_ll_close (roverhd->fp);
             roverhd->fp = NULL;
           }
+        if (roverhd->map)
+          {
+            _keybox_map_close (roverhd->map);
+            roverhd->map = NULL;
+          }
       }
-  log_assert (!hd->fp);
+  log_assert (!hd->fp && !hd->map);
 }
 
 
@@ -172,11 +172,14 @@ next_packet (unsigned char const **bufptr, size_t *buflen,
 }
 
 
-/* Take a list of key parameters KP for the OpenPGP ALGO and compute
- * the keygrip which will be stored at GRIP.  GRIP needs to be a
- * buffer of 20 bytes.  */
+/* Take a list of key parameters KP for the OpenPGP ALGO and build
+ * the S-expression of the public key which will be stored at R_PKEY.
+ * The keygrip is computed and stored at GRIP.  GRIP needs to be a
+ * buffer of 20 bytes.  If R_PKEY is NULL the S-expression is only
+ * used for the keygrip.  */
 static gpg_error_t
-keygrip_from_keyparm (int algo, struct keyparm_s *kp, unsigned char *grip)
+keygrip_from_keyparm (int algo, struct keyparm_s *kp, unsigned char *grip,
+                      gcry_sexp_t *r_pkey)
 {
   gpg_error_t err;
   gcry_sexp_t s_pkey = NULL;
@@ -272,7 +275,10 @@ keygrip_from_keyparm (int algo, struct keyparm_s *kp, unsigned char *grip)
         }
     }
 
-  gcry_sexp_release (s_pkey);
+  if (!err && r_pkey)
+    *r_pkey = s_pkey;
+  else
+    gcry_sexp_release (s_pkey);
 
   if (err)
     memset (grip, 0, 20);
@@ -280,10 +286,12 @@ keygrip_from_keyparm (int algo, struct keyparm_s *kp, unsigned char *grip)
 }
 
 
-/* Parse a key packet and store the information in KI. */
+/* Parse a key packet and store the information in KI.  If R_PKEY is
+ * not NULL the public key of a v4 key is stored there as
+ * S-expression; NULL is stored for other versions.  */
 static gpg_error_t
 parse_key (const unsigned char *data, size_t datalen,
-           struct _keybox_openpgp_key_info *ki)
+           struct _keybox_openpgp_key_info *ki, gcry_sexp_t *r_pkey)
 {
   gpg_error_t err;
   const unsigned char *data_start = data;
@@ -306,7 +314,7 @@ parse_key (const unsigned char *data, size_t datalen,
     return gpg_error (GPG_ERR_INV_PACKET); /* Invalid version. */
   is_v5 = version == 5;
 
-  /*timestamp = ((data[0]<<24)|(data[1]<<16)|(data[2]<<8)|(data[3]));*/
+  ki->created = buf32_to_u32 (data);
   data +=4; datalen -=4;
 
   if (version < 4)
@@ -436,7 +444,10 @@ parse_key (const unsigned char *data, size_t datalen,
           }
       }
 
-  err = keygrip_from_keyparm (algorithm, keyparm, ki->grip);
+  if (r_pkey)
+    *r_pkey = NULL;
+  err = keygrip_from_keyparm (algorithm, keyparm, ki->grip,
+                              version == 4? r_pkey : NULL);
   if (err)
     goto leave;
 
@@ -535,21 +546,462 @@ parse_key (const unsigned char *data, size_t datalen,
  leave:
   for (i=0; i < npkey; i++)
     xfree (helpmpibuf[i]);
+  if (err && r_pkey)
+    {
+      gcry_sexp_release (*r_pkey);
+      *r_pkey = NULL;
+    }
 
   return err;
 }
 
 
 
+/* The parts of a v4 signature packet used to compute the key
+ * metadata.  */
+struct sig_info_s
+{
+  int sigclass;
+  int pubkey_algo;
+  int digest_algo;
+  size_t hashedlen;             /* Length of the hashed part.  */
+  u32 created;
+  u32 keyexpire;                /* 0 for none.  */
+  unsigned int keyflags;
+  unsigned int have_keyflags:1;
+  unsigned int primary_uid:1;
+  unsigned int have_issuer:1;
+  unsigned char issuer[8];      /* The issuer's keyid.  */
+  unsigned char digest_start[2];
+  const unsigned char *mpi[2];  /* The signature values.  */
+  size_t mpilen[2];
+};
+
+
+/* State of parse_openpgp to compute the metadata of a keyblock from
+ * its self-signatures.  */
+struct meta_state_s
+{
+  gcry_sexp_t s_pkey;               /* The primary key or NULL.  */
+  const unsigned char *pkdata;      /* The primary key packet.  */
+  size_t pkdatalen;
+  int cur_pkttype;                  /* PKT_USER_ID, PKT_PUBLIC_SUBKEY or 0. */
+  const unsigned char *curdata;     /* The user id or subkey packet.  */
+  size_t curdatalen;
+  struct _keybox_openpgp_key_info *cur_key;
+  struct _keybox_openpgp_uid_info *cur_uid;
+  int primary_uid;                  /* The primary key's selfsig is from
+                                     * a primary user id.  */
+};
+
+
+/* Parse the subpackets (DATA,DATALEN) of a signature and store the
+ * values in SIG.  HASHED is true for the hashed area.  */
+static gpg_error_t
+parse_sig_subpkts (const unsigned char *data, size_t datalen, int hashed,
+                   struct sig_info_s *sig)
+{
+  size_t n;
+  int type;
+
+  while (datalen)
+    {
+      n = *data++; datalen--;
+      if (n >= 192 && n < 255)
+        {
+          if (!datalen)
+            return gpg_error (GPG_ERR_INV_PACKET);
+          n = ((n - 192) << 8) + *data++ + 192;
+          datalen--;
+        }
+      else if (n == 255)
+        {
+          if (datalen < 4)
+            return gpg_error (GPG_ERR_INV_PACKET);
+          n = buf32_to_size_t (data);
+          data += 4; datalen -= 4;
+        }
+      if (!n || n > datalen)
+        return gpg_error (GPG_ERR_INV_PACKET);
+      type = (*data & 0x7f);
+      data++; datalen--; n--;
+
+      if (type == SIGSUBPKT_ISSUER && n == 8)
+        {
+          memcpy (sig->issuer, data, 8);
+          sig->have_issuer = 1;
+        }
+      else if (type == SIGSUBPKT_ISSUER_FPR && n == 21 && data[0] == 4)
+        {
+          memcpy (sig->issuer, data + 13, 8);
+          sig->have_issuer = 1;
+        }
+      else if (!hashed)
+        ; /* Only the issuer is taken from the unhashed area.  */
+      else if (type == SIGSUBPKT_SIG_CREATED && n == 4)
+        sig->created = buf32_to_u32 (data);
+      else if (type == SIGSUBPKT_KEY_EXPIRE && n == 4)
+        sig->keyexpire = buf32_to_u32 (data);
+      else if (type == SIGSUBPKT_KEY_FLAGS && n)
+        {
+          sig->keyflags = data[0];
+          sig->have_keyflags = 1;
+        }
+      else if (type == SIGSUBPKT_PRIMARY_UID && n == 1)
+        sig->primary_uid = !!data[0];
+
+      data += n; datalen -= n;
+    }
+
+  return 0;
+}
+
+
+/* Parse the v4 signature packet (DATA,DATALEN) into SIG.  */
+static gpg_error_t
+parse_sig (const unsigned char *data, size_t datalen, struct sig_info_s *sig)
+{
+  gpg_error_t err;
+  const unsigned char *p;
+  size_t n, len;
+  int i;
+
+  memset (sig, 0, sizeof *sig);
+  if (datalen < 6 || data[0] != 4)
+    return gpg_error (GPG_ERR_UNSUPPORTED_PROTOCOL);
+  sig->sigclass = data[1];
+  sig->pubkey_algo = data[2];
+  sig->digest_algo = data[3];
+  n = buf16_to_uint (data + 4);
+  if (6 + n + 2 > datalen)
+    return gpg_error (GPG_ERR_INV_PACKET);
+  err = parse_sig_subpkts (data + 6, n, 1, sig);
+  if (err)
+    return err;
+  sig->hashedlen = 6 + n;
+
+  p = data + sig->hashedlen;
+  len = datalen - sig->hashedlen;
+  n = buf16_to_uint (p);
+  p += 2; len -= 2;
+  if (n + 2 > len)
+    return gpg_error (GPG_ERR_INV_PACKET);
+  err = parse_sig_subpkts (p, n, 0, sig);
+  if (err)
+    return err;
+  p += n; len -= n;
+
+  memcpy (sig->digest_start, p, 2);
+  p += 2; len -= 2;
+
+  for (i = 0; i < 2 && len; i++)
+    {
+      if (len < 2)
+        return gpg_error (GPG_ERR_INV_PACKET);
+      n = (buf16_to_uint (p) + 7) / 8;
+      p += 2; len -= 2;
+      if (n > len)
+        return gpg_error (GPG_ERR_INV_PACKET);
+      sig->mpi[i] = p;
+      sig->mpilen[i] = n;
+      p += n; len -= n;
+    }
+  if (!sig->mpi[0])
+    return gpg_error (GPG_ERR_INV_PACKET);
+
+  return 0;
+}
+
+
+/* Hash the key packet (DATA,DATALEN) into MD the way it is done for
+ * v4 signatures.  */
+static void
+hash_key_packet (gcry_md_hd_t md, const unsigned char *data, size_t datalen)
+{
+  gcry_md_putc (md, 0x99);
+  gcry_md_putc (md, datalen >> 8);
+  gcry_md_putc (md, datalen);
+  gcry_md_write (md, data, datalen);
+}
+
+
+/* Return true if the v4 signature SIG with the packet data SIGDATA is
+ * a valid signature of the primary key from MS over the user id or
+ * subkey packet (DATA,DATALEN) of type PKTTYPE.  PKTTYPE is 0 for
+ * signatures over the primary key alone.  */
+static int
+check_selfsig (struct meta_state_s *ms, struct sig_info_s *sig,
+               const unsigned char *sigdata, int pkttype,
+               const unsigned char *data, size_t datalen)
+{
+  gcry_md_hd_t md;
+  const unsigned char *digest;
+  unsigned int dlen;
+  unsigned char buf[6];
+  gcry_sexp_t s_sig = NULL;
+  gcry_sexp_t s_data = NULL;
+  gcry_mpi_t a = NULL;
+  gcry_mpi_t b = NULL;
+  unsigned char r[32], s[32];
+  const char *curve;
+  int okay = 0;
+
+  if (sig->digest_algo == DIGEST_ALGO_MD5
+      || gcry_md_test_algo (sig->digest_algo)
+      || gcry_md_open (&md, sig->digest_algo, 0))
+    return 0;
+
+  hash_key_packet (md, ms->pkdata, ms->pkdatalen);
+  if (pkttype == PKT_USER_ID)
+    {
+      buf[0] = 0xb4;
+      buf[1] = datalen >> 24;
+      buf[2] = datalen >> 16;
+      buf[3] = datalen >> 8;
+      buf[4] = datalen;
+      gcry_md_write (md, buf, 5);
+      gcry_md_write (md, data, datalen);
+    }
+  else if (pkttype == PKT_PUBLIC_SUBKEY)
+    hash_key_packet (md, data, datalen);
+  gcry_md_write (md, sigdata, sig->hashedlen);
+  buf[0] = 4;
+  buf[1] = 0xff;
+  buf[2] = sig->hashedlen >> 24;
+  buf[3] = sig->hashedlen >> 16;
+  buf[4] = sig->hashedlen >> 8;
+  buf[5] = sig->hashedlen;
+  gcry_md_write (md, buf, 6);
+  digest = gcry_md_read (md, 0);
+  dlen = gcry_md_get_algo_dlen (sig->digest_algo);
+
+  if (memcmp (digest, sig->digest_start, 2))
+    goto leave;
+
+  switch (sig->pubkey_algo)
+    {
+    case PUBKEY_ALGO_RSA:
+    case PUBKEY_ALGO_RSA_S:
+      if (gcry_mpi_scan (&a, GCRYMPI_FMT_USG, sig->mpi[0], sig->mpilen[0],
+                         NULL)
+          || gcry_sexp_build (&s_sig, NULL, "(sig-val(rsa(s%m)))", a)
+          || gcry_sexp_build (&s_data, NULL, "(data(flags pkcs1)(hash %s %b))",
+                              gcry_md_algo_name (sig->digest_algo),
+                              (int)dlen, digest))
+        goto leave;
+      break;
+
+    case PUBKEY_ALGO_DSA:
+    case PUBKEY_ALGO_ECDSA:
+      if (!sig->mpi[1]
+          || gcry_mpi_scan (&a, GCRYMPI_FMT_USG, sig->mpi[0], sig->mpilen[0],
+                            NULL)
+          || gcry_mpi_scan (&b, GCRYMPI_FMT_USG, sig->mpi[1], sig->mpilen[1],
+                            NULL)
+          || gcry_sexp_build (&s_sig, NULL,
+                              sig->pubkey_algo == PUBKEY_ALGO_DSA
+                              ? "(sig-val(dsa(r%m)(s%m)))"
+                              : "(sig-val(ecdsa(r%m)(s%m)))", a, b))
+        goto leave;
+      gcry_mpi_release (a);
+      if (gcry_mpi_scan (&a, GCRYMPI_FMT_USG, digest, dlen, NULL)
+          || gcry_sexp_build (&s_data, NULL, "(data(flags raw)(value %m))", a))
+        goto leave;
+      break;
+
+    case PUBKEY_ALGO_EDDSA:
+      /* Only Ed25519 is supported here.  */
+      curve = gcry_pk_get_curve (ms->s_pkey, 0, NULL);
+      if (!curve || strcmp (curve, "Ed25519") || !sig->mpi[1]
+          || sig->mpilen[0] > 32 || sig->mpilen[1] > 32)
+        goto leave;
+      memset (r, 0, sizeof r);
+      memset (s, 0, sizeof s);
+      memcpy (r + 32 - sig->mpilen[0], sig->mpi[0], sig->mpilen[0]);
+      memcpy (s + 32 - sig->mpilen[1], sig->mpi[1], sig->mpilen[1]);
+      if (gcry_sexp_build (&s_sig, NULL, "(sig-val(eddsa(r%b)(s%b)))",
+                           32, r, 32, s)
+          || gcry_sexp_build (&s_data, NULL,
+                              "(data(flags eddsa)(hash-algo sha512)"
+                              "(value %b))", (int)dlen, digest))
+        goto leave;
+      break;
+
+    default:
+      goto leave;
+    }
+
+  okay = !gcry_pk_verify (s_sig, s_data, ms->s_pkey);
+
+ leave:
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_data);
+  gcry_mpi_release (a);
+  gcry_mpi_release (b);
+  gcry_md_close (md);
+  return okay;
+}
+
+
+/* Return the expiration time for a key created at CREATED which
+ * expires EXPIRE seconds later.  */
+static u32
+key_expiration (u32 created, u32 expire)
+{
+  if (!expire)
+    return 0;
+  if (created + expire < created)
+    return (u32)(-1);
+  return created + expire;
+}
+
+
+/* Process the signature packet (DATA,DATALEN) of the keyblock
+ * described by INFO to compute the metadata.  */
+static void
+meta_process_sig (struct meta_state_s *ms, keybox_openpgp_info_t info,
+                  const unsigned char *data, size_t datalen)
+{
+  struct _keybox_openpgp_key_info *pk = &info->primary;
+  struct sig_info_s sig;
+  int pkttype;
+
+  if (!ms->s_pkey || parse_sig (data, datalen, &sig))
+    return;
+  if (sig.have_issuer && memcmp (sig.issuer, pk->keyid, 8))
+    return;  /* Not a self-signature.  */
+
+  switch (sig.sigclass)
+    {
+    case 0x10: case 0x11: case 0x12: case 0x13: case 0x30:
+      if (ms->cur_pkttype != PKT_USER_ID || !ms->cur_uid)
+        return;
+      break;
+    case 0x18: case 0x28:
+      if (ms->cur_pkttype != PKT_PUBLIC_SUBKEY || !ms->cur_key)
+        return;
+      break;
+    case 0x1f: case 0x20:
+      break;
+    default:
+      return;
+    }
+
+  pkttype = (sig.sigclass == 0x1f || sig.sigclass == 0x20)? 0
+            : ms->cur_pkttype;
+  if (!check_selfsig (ms, &sig, data, pkttype, ms->curdata, ms->curdatalen))
+    return;
+
+  switch (sig.sigclass)
+    {
+    case 0x10: case 0x11: case 0x12: case 0x13: case 0x1f:
+      if (sig.sigclass != 0x1f && sig.created >= ms->cur_uid->sigtime)
+        {
+          ms->cur_uid->sigtime = sig.created;
+          ms->cur_uid->is_primary = sig.primary_uid;
+          ms->cur_uid->have_meta = 1;
+        }
+      /* The selfsig of the primary user id or else the latest one
+       * decides about the primary key.  */
+      if (!pk->have_meta
+          || (sig.sigclass != 0x1f && sig.primary_uid > ms->primary_uid)
+          || ((sig.sigclass == 0x1f || sig.primary_uid == ms->primary_uid)
+              && sig.created >= pk->sigtime))
+        {
+          if (sig.sigclass != 0x1f)
+            ms->primary_uid = sig.primary_uid;
+          pk->sigtime = sig.created;
+          pk->expires = key_expiration (pk->created, sig.keyexpire);
+          pk->usage = sig.keyflags;
+          pk->have_usage = sig.have_keyflags;
+          pk->have_meta = 1;
+        }
+      break;
+
+    case 0x30:
+      if (sig.created >= ms->cur_uid->revtime)
+        ms->cur_uid->revtime = sig.created;
+      ms->cur_uid->have_meta = 1;
+      break;
+
+    case 0x18:
+      if (!ms->cur_key->have_meta || sig.created >= ms->cur_key->sigtime)
+        {
+          ms->cur_key->sigtime = sig.created;
+          ms->cur_key->expires = key_expiration (ms->cur_key->created,
+                                                 sig.keyexpire);
+          ms->cur_key->usage = sig.keyflags;
+          ms->cur_key->have_usage = sig.have_keyflags;
+          ms->cur_key->have_meta = 1;
+        }
+      break;
+
+    case 0x28:
+      ms->cur_key->revoked = 1;
+      ms->cur_key->have_meta = 1;
+      break;
+
+    case 0x20:
+      pk->revoked = 1;
+      pk->have_meta = 1;
+      break;
+    }
+}
+
+
+/* Return the key flags implied by the public key algorithm ALGO.  */
+static unsigned int
+usage_from_algo (int algo)
+{
+  switch (algo)
+    {
+    case PUBKEY_ALGO_RSA:   return 0x2f;
+    case PUBKEY_ALGO_RSA_S: return 0x03;
+    case PUBKEY_ALGO_DSA:
+    case PUBKEY_ALGO_ECDSA:
+    case PUBKEY_ALGO_EDDSA: return 0x23;
+    case PUBKEY_ALGO_RSA_E:
+    case PUBKEY_ALGO_ELGAMAL_E:
+    case PUBKEY_ALGO_ELGAMAL:
+    case PUBKEY_ALGO_ECDH:
+    case PUBKEY_ALGO_KYBER: return 0x0c;
+    default:                return 0;
+    }
+}
+
+
+/* Finish the metadata of INFO after all packets have been
+ * processed.  */
+static void
+meta_finish (keybox_openpgp_info_t info)
+{
+  struct _keybox_openpgp_key_info *k;
+  struct _keybox_openpgp_uid_info *u;
+
+  if (info->primary.have_meta)
+    {
+      if (!info->primary.have_usage)
+        info->primary.usage = usage_from_algo (info->primary.algo);
+      info->primary.usage |= 0x01;  /* The primary key may certify.  */
+    }
+  for (k = info->nsubkeys? &info->subkeys : NULL; k; k = k->next)
+    if (k->have_meta && !k->have_usage)
+      k->usage = usage_from_algo (k->algo);
+  for (u = info->nuids? &info->uids : NULL; u; u = u->next)
+    if (u->have_meta)
+      u->revoked = (u->revtime && u->revtime >= u->sigtime);
+}
+
+
 /* The caller must pass the address of an INFO structure which will
    get filled on success with information pertaining to the OpenPGP
    keyblock IMAGE of length IMAGELEN.  Note that a caller does only
    need to release this INFO structure if the function returns
    success.  If NPARSED is not NULL the actual number of bytes parsed
    will be stored at this address.  */
-gpg_error_t
-_keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
-                       size_t *nparsed, keybox_openpgp_info_t info)
+static gpg_error_t
+parse_openpgp (const unsigned char *image, size_t imagelen,
+               size_t *nparsed, keybox_openpgp_info_t info, int want_meta)
 {
   gpg_error_t err = 0;
   const unsigned char *image_start, *data;
@@ -559,8 +1011,10 @@ _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
   int read_error = 0;
   struct _keybox_openpgp_key_info *k, **ktail = NULL;
   struct _keybox_openpgp_uid_info *u, **utail = NULL;
+  struct meta_state_s ms;
 
   memset (info, 0, sizeof *info);
+  memset (&ms, 0, sizeof ms);
   if (nparsed)
     *nparsed = 0;
 
@@ -597,8 +1051,9 @@ _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
 
       if (pkttype == PKT_SIGNATURE)
         {
-          /* For now we only count the total number of signatures. */
           info->nsigs++;
+          if (want_meta)
+            meta_process_sig (&ms, info, data, datalen);
         }
       else if (pkttype == PKT_USER_ID)
         {
@@ -622,25 +1077,39 @@ _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
               *utail = u;
               utail = &u->next;
             }
+          ms.cur_pkttype = PKT_USER_ID;
+          ms.cur_uid = info->nuids == 1? &info->uids : u;
+          ms.curdata = data;
+          ms.curdatalen = datalen;
         }
+      else if (pkttype == PKT_ATTRIBUTE)
+        ms.cur_pkttype = 0;
       else if (pkttype == PKT_PUBLIC_KEY || pkttype == PKT_SECRET_KEY)
         {
-          err = parse_key (data, datalen, &info->primary);
+          err = parse_key (data, datalen, &info->primary,
+                           (want_meta && !info->is_secret)? &ms.s_pkey : NULL);
           if (err)
             break;
+          ms.pkdata = data;
+          ms.pkdatalen = datalen;
         }
       else if( pkttype == PKT_PUBLIC_SUBKEY && datalen && *data == '#' )
         {
           /* Early versions of GnuPG used old PGP comment packets;
            * luckily all those comments are prefixed by a hash
            * sign - ignore these packets. */
+          ms.cur_pkttype = 0;
         }
       else if (pkttype == PKT_PUBLIC_SUBKEY || pkttype == PKT_SECRET_SUBKEY)
         {
+          ms.cur_pkttype = PKT_PUBLIC_SUBKEY;
+          ms.cur_key = NULL;
+          ms.curdata = data;
+          ms.curdatalen = datalen;
           info->nsubkeys++;
           if (info->nsubkeys == 1)
             {
-              err = parse_key (data, datalen, &info->subkeys);
+              err = parse_key (data, datalen, &info->subkeys, NULL);
               if (err)
                 {
                   info->nsubkeys--;
@@ -652,7 +1121,10 @@ _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
                     break;
                 }
               else
-                ktail = &info->subkeys.next;
+                {
+                  ktail = &info->subkeys.next;
+                  ms.cur_key = &info->subkeys;
+                }
             }
           else
             {
@@ -662,7 +1134,7 @@ _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
                   err = gpg_error_from_syserror ();
                   break;
                 }
-              err = parse_key (data, datalen, k);
+              err = parse_key (data, datalen, k, NULL);
               if (err)
                 {
                   xfree (k);
@@ -678,11 +1150,16 @@ _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
                 {
                   *ktail = k;
                   ktail = &k->next;
+                  ms.cur_key = k;
                 }
             }
         }
     }
 
+  gcry_sexp_release (ms.s_pkey);
+  if (!err && want_meta)
+    meta_finish (info);
+
   if (err)
     {
       _keybox_destroy_openpgp_info (info);
@@ -709,6 +1186,59 @@ _keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
 }
 
 
+gpg_error_t
+_keybox_parse_openpgp (const unsigned char *image, size_t imagelen,
+                       size_t *nparsed, keybox_openpgp_info_t info)
+{
+  return parse_openpgp (image, imagelen, nparsed, info, 0);
+}
+
+
+/* Same as _keybox_parse_openpgp but also verify the self-signatures
+   of a v4 public keyblock and set the metadata of the keys and user
+   ids from them.  */
+gpg_error_t
+_keybox_parse_openpgp_meta (const unsigned char *image, size_t imagelen,
+                            size_t *nparsed, keybox_openpgp_info_t info)
+{
+  return parse_openpgp (image, imagelen, nparsed, info, 1);
+}
+
+
+/* Store the length of the first keyblock in IMAGE of length IMAGELEN
+   at R_LEN.  Only the packet headers are looked at; this is used to
+   split a sequence of keyblocks before parsing them.  */
+gpg_error_t
+_keybox_openpgp_keyblock_len (const unsigned char *image, size_t imagelen,
+                              size_t *r_len)
+{
+  gpg_error_t err;
+  const unsigned char *data;
+  size_t n, datalen;
+  int pkttype;
+  int first = 1;
+
+  *r_len = 0;
+  while (image)
+    {
+      err = next_packet (&image, &imagelen, &data, &datalen, &pkttype, &n);
+      if (err)
+        return err;
+      if (first)
+        {
+          if (pkttype != PKT_PUBLIC_KEY && pkttype != PKT_SECRET_KEY)
+            return gpg_error (GPG_ERR_UNEXPECTED);
+          first = 0;
+        }
+      else if (pkttype == PKT_PUBLIC_KEY || pkttype == PKT_SECRET_KEY)
+        break; /* Next keyblock encountered - ready. */
+      *r_len += n;
+    }
+
+  return 0;
+}
+
+
 /* Release any malloced data in INFO but not INFO itself! */
 void
 _keybox_destroy_openpgp_info (keybox_openpgp_info_t info)
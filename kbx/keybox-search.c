@@ -877,6 +877,64 @@ release_sn_array (struct sn_array_s *array, size_t size)
  *
  */
 
+/* Open the file of HD.  This maps the file if requested.  */
+static gpg_error_t
+handle_open (KEYBOX_HANDLE hd)
+{
+  gpg_error_t err;
+
+  if (hd->use_mmap)
+    {
+      err = _keybox_map_open (&hd->map, hd->kb->fname);
+      if (!err)
+        {
+          hd->mapidx = 0;
+          hd->mappos = 0;
+          return 0;
+        }
+      if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        return err;
+    }
+  return _keybox_ll_open (&hd->fp, hd->kb->fname, 0);
+}
+
+
+/* Return the current offset in the opened file of HD.  */
+static off_t
+handle_tell (KEYBOX_HANDLE hd)
+{
+  if (hd->map)
+    return hd->mappos;
+  return es_ftello (hd->fp);
+}
+
+
+static gpg_error_t
+handle_seek (KEYBOX_HANDLE hd, off_t offset)
+{
+  if (hd->map)
+    {
+      hd->mapidx = _keybox_map_seek (hd->map, offset);
+      hd->mappos = offset;
+      return 0;
+    }
+  if (es_fseeko (hd->fp, offset, SEEK_SET))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Read the next blob from the opened file of HD.  A blob from a
+ * mapped file is a borrowed one; see _keybox_map_read_blob.  */
+static int
+handle_read_blob (KEYBOX_HANDLE hd, KEYBOXBLOB *r_blob)
+{
+  if (hd->map)
+    return _keybox_map_read_blob (hd->map, &hd->mapidx, &hd->mappos, r_blob);
+  return _keybox_read_blob (r_blob, hd->fp, NULL);
+}
+
+
 gpg_error_t
 keybox_search_reset (KEYBOX_HANDLE hd)
 {
@@ -889,7 +947,9 @@ keybox_search_reset (KEYBOX_HANDLE hd)
       hd->found.blob = NULL;
     }
 
-  if (hd->fp)
+  if (hd->map)
+    hd->mapidx = hd->mappos = 0;
+  else if (hd->fp)
     {
       if (es_fseeko (hd->fp, 0, SEEK_SET))
         {
@@ -922,6 +982,9 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
   off_t lastfoundoff;
+  off_t *candidates = NULL;
+  size_t ncandidates = 0, candidx = 0;
+  int use_candidates = 0;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -971,9 +1034,9 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   (void)need_words;  /* Not yet implemented.  */
 
-  if (!hd->fp)
+  if (!hd->fp && !hd->map)
     {
-      rc = _keybox_ll_open (&hd->fp, hd->kb->fname, 0);
+      rc = handle_open (hd);
       if (rc)
         {
           xfree (sn_array);
@@ -986,9 +1049,9 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
            * returned a blob which also was not the first one.  We now
            * need to skip over that blob and hope that the file has
            * not changed.  */
-          if (es_fseeko (hd->fp, lastfoundoff, SEEK_SET))
+          rc = handle_seek (hd, lastfoundoff);
+          if (rc)
             {
-              rc = gpg_error_from_syserror ();
               log_debug ("%s: seeking to last found offset failed: %s\n",
                          __func__, gpg_strerror (rc));
               xfree (sn_array);
@@ -996,7 +1059,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
             }
           /* log_debug ("%s: re-opened file and sought to last offset\n", */
           /*            __func__); */
-          rc = _keybox_read_blob (NULL, hd->fp, NULL);
+          rc = handle_read_blob (hd, NULL);
           if (rc)
             {
               log_debug ("%s: skipping last found blob failed: %s\n",
@@ -1067,6 +1130,10 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  /* The index tells us which blobs may match; skip all others.  */
+  if (hd->kb && !_keybox_index_lookup (hd->kb, desc, ndesc,
+                                       &candidates, &ncandidates))
+    use_candidates = 1;
 
   pk_no = uid_no = 0;
   for (;;)
@@ -1075,7 +1142,28 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       int blobtype;
 
       _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp, NULL);
+      if (use_candidates)
+        {
+          off_t pos = handle_tell (hd);
+
+          if (pos == (off_t)-1)
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+          while (candidx < ncandidates && candidates[candidx] < pos)
+            candidx++;
+          if (candidx == ncandidates)
+            {
+              rc = -1;
+              break;
+            }
+          if (candidates[candidx] != pos
+              && (rc = handle_seek (hd, candidates[candidx])))
+            break;
+          candidx++;
+        }
+      rc = handle_read_blob (hd, &blob);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
@@ -1201,6 +1289,13 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         break; /* got it */
     }
 
+  if (!rc && hd->map)
+    {
+      /* Keep the found blob independent of the mapping.  */
+      KEYBOXBLOB tmpblob = blob;
+
+      rc = _keybox_copy_blob (&blob, tmpblob);
+    }
   if (!rc)
     {
       hd->found.blob = blob;
@@ -1220,6 +1315,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  xfree (candidates);
 
   return rc;
 }
@@ -1451,9 +1547,9 @@ keybox_get_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int *value)
 off_t
 keybox_offset (KEYBOX_HANDLE hd)
 {
-  if (!hd->fp)
+  if (!hd->fp && !hd->map)
     return 0;
-  return es_ftello (hd->fp);
+  return handle_tell (hd);
 }
 
 gpg_error_t
@@ -1464,7 +1560,7 @@ keybox_seek (KEYBOX_HANDLE hd, off_t offset)
   if (hd->error)
     return hd->error; /* still in error state */
 
-  if (! hd->fp)
+  if (!hd->fp && !hd->map)
     {
       if (!offset)
         {
@@ -1473,13 +1569,12 @@ keybox_seek (KEYBOX_HANDLE hd, off_t offset)
           return 0;
         }
 
-      err = _keybox_ll_open (&hd->fp, hd->kb->fname, 0);
+      err = handle_open (hd);
       if (err)
         return err;
     }
 
-  err = es_fseeko (hd->fp, offset, SEEK_SET);
-  hd->error = gpg_error_from_errno (err);
+  hd->error = handle_seek (hd, offset);
 
   return hd->error;
 }
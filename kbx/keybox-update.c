@@ -37,6 +37,15 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+#if defined(HAVE_DOSISH_SYSTEM) && !defined(ftruncate)
+#define ftruncate chsize
+#endif
+
+
+/* If set inserts and updates append to the keybox instead of
+ * rewriting it.  */
+static int append_updates;
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -167,12 +176,18 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
   char *tmpfname = NULL;
   char buffer[4096];  /* (Must be at least 32 bytes) */
   int nread, nbytes;
+  struct keybox_index_stamp_s oldstamp;
+  off_t blob_offset = start_offset;
+  size_t oldlen = 0;
 
   /* Open the source file. Because we do a rename, we have to check the
      permissions of the file */
   if ((ec = gnupg_access (fname, W_OK)))
     return gpg_error (ec);
 
+  /* Needed to check that the index is up to date.  */
+  _keybox_index_get_stamp (fname, &oldstamp);
+
   rc = _keybox_ll_open (&fp, fname, 0);
   if (mode == FILECOPY_INSERT && gpg_err_code (rc) == GPG_ERR_ENOENT)
     {
@@ -232,11 +247,12 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
          failsafe the blob type.) */
       while ( (nread = es_fread (buffer, 1, DIM(buffer), fp)) > 0 )
         {
-          if (first_record && for_openpgp
-              && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+          if (first_record)
             {
               first_record = 0;
-              buffer[7] |= 0x02; /* OpenPGP data may be available.  */
+              _keybox_index_bump_generation (buffer, nread);
+              if (for_openpgp && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
+                buffer[7] |= 0x02; /* OpenPGP data may be available.  */
             }
 
           if (es_fwrite (buffer, nread, 1, newfp) != 1)
@@ -270,6 +286,8 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
           nread = es_fread (buffer, 1, nbytes, fp);
           if (!nread)
             break;
+          if (!current)
+            _keybox_index_bump_generation (buffer, nread);
           current += nread;
 
           if (es_fwrite (buffer, nread, 1, newfp) != 1)
@@ -296,7 +314,10 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
           _keybox_ll_close (newfp);
           goto leave;
         }
+      oldlen = es_ftello (fp) - start_offset;
     }
+  else
+    blob_offset = es_ftello (newfp);
 
   /* Do an insert or update. */
   if ( mode == FILECOPY_INSERT || mode == FILECOPY_UPDATE )
@@ -344,6 +365,9 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
     goto leave;
 
   rc = rename_tmp_file (bakfname, tmpfname, fname, secret);
+  if (!rc && !secret)
+    _keybox_index_update (fname, &oldstamp, blob_offset, oldlen,
+                          mode == FILECOPY_DELETE? NULL : blob);
 
  leave:
   xfree(bakfname);
@@ -352,6 +376,107 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 }
 
 
+/* Append BLOB to the keybox FNAME in place.  If OLDOFF is not -1 the
+ * blob at this offset is then marked as deleted; keybox_compress
+ * reclaims its space later.  The order of the writes makes sure that
+ * a crash does not lose a keyblock; at worst an old copy stays.  */
+static gpg_error_t
+blob_append (const char *fname, KEYBOXBLOB blob, int secret, off_t oldoff)
+{
+  gpg_error_t err, err2;
+  gpg_err_code_t ec;
+  estream_t fp;
+  struct keybox_index_stamp_s stamp;
+  unsigned char header[32];
+  off_t off;
+  int appended = 0;
+  int marked = 0;
+
+  if ((ec = gnupg_access (fname, W_OK)))
+    return gpg_error (ec);
+
+  _keybox_index_get_stamp (fname, &stamp);
+  err = _keybox_ll_open (&fp, fname, KEYBOX_LL_OPEN_UPDATE);
+  if (err)
+    return err;
+
+  /* Update the header blob like blob_filecopy does.  */
+  if (es_fread (header, sizeof header, 1, fp) != 1)
+    {
+      err = es_ferror (fp)? gpg_error_from_syserror ()
+                          : gpg_error (GPG_ERR_TOO_SHORT);
+      goto leave;
+    }
+  if (header[4] == KEYBOX_BLOBTYPE_HEADER)
+    {
+      _keybox_index_bump_generation (header, sizeof header);
+      header[7] |= 0x02; /* OpenPGP data may be available.  */
+      if (es_fseeko (fp, 0, SEEK_SET)
+          || es_fwrite (header, sizeof header, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  if (es_fseeko (fp, 0, SEEK_END) || (off = es_ftello (fp)) == (off_t)-1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = _keybox_write_blob (blob, fp, NULL);
+  if (!err && es_fflush (fp))
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      /* Do not leave a partial blob at the end.  */
+      es_clearerr (fp);
+      if (ftruncate (es_fileno (fp), off))
+        log_error ("error truncating '%s': %s\n", fname,
+                   gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+  appended = 1;
+
+  if (oldoff != -1)
+    {
+      if (es_fseeko (fp, oldoff + 4, SEEK_SET) || es_fputc (0, fp) == EOF)
+        err = gpg_error_from_syserror ();
+      else
+        marked = 1;
+    }
+
+ leave:
+  err2 = _keybox_ll_close (fp);
+  if (!err)
+    err = err2;
+  if (!secret && appended)
+    {
+      _keybox_index_update (fname, &stamp, off, 0, blob);
+      if (marked)
+        {
+          _keybox_index_get_stamp (fname, &stamp);
+          _keybox_index_update (fname, &stamp, oldoff, 0, NULL);
+        }
+    }
+  return err;
+}
+
+
+/* Let keybox_insert_keyblock and keybox_update_keyblock append the
+ * new blob to the file and mark a replaced one as deleted instead of
+ * rewriting the entire file.  This is not used for X.509
+ * certificates.  Returns the previous mode.  */
+int
+keybox_set_append_updates (int yes)
+{
+  int old = append_updates;
+
+  append_updates = !!yes;
+  return old;
+}
+
+
 /* Insert the OpenPGP keyblock {IMAGE,IMAGELEN} into HD. */
 gpg_error_t
 keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
@@ -385,7 +510,10 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      if (append_updates && !gnupg_access (fname, F_OK))
+        err = blob_append (fname, blob, hd->secret, -1);
+      else
+        err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -438,7 +566,11 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   /* Update the keyblock.  */
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
+      if (append_updates)
+        err = blob_append (fname, blob, hd->secret, off);
+      else
+        err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret,
+                             1, off);
       _keybox_release_blob (blob);
     }
   return err;
@@ -585,6 +717,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   const char *fname;
   estream_t fp;
   int rc, rc2;
+  struct keybox_index_stamp_s oldstamp;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -599,14 +732,14 @@ keybox_delete (KEYBOX_HANDLE hd)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
-  off += 4;
+  _keybox_index_get_stamp (fname, &oldstamp);
 
   _keybox_close_file (hd);
   rc = _keybox_ll_open (&fp, hd->kb->fname, KEYBOX_LL_OPEN_UPDATE);
   if (rc)
     return rc;
 
-  if (es_fseeko (fp, off, SEEK_SET))
+  if (es_fseeko (fp, off + 4, SEEK_SET))
     rc = gpg_error_from_syserror ();
   else if (es_fputc (0, fp) == EOF)
     rc = gpg_error_from_syserror ();
@@ -619,15 +752,18 @@ keybox_delete (KEYBOX_HANDLE hd)
       if (!rc)
         rc = rc2;
     }
+  if (!rc && !hd->secret)
+    _keybox_index_update (fname, &oldstamp, off, 0, NULL);
 
   return rc;
 }
 
 
 /* Compress the keybox file.  This should be run with the file
-   locked. */
-int
-keybox_compress (KEYBOX_HANDLE hd)
+   locked.  Unless FORCE is set this is only done if the last run was
+   more than 3 hours ago. */
+static int
+do_compress (KEYBOX_HANDLE hd, int force)
 {
   gpg_err_code_t ec;
   int read_rc, rc, rc2;
@@ -666,7 +802,7 @@ keybox_compress (KEYBOX_HANDLE hd)
 
   /* A quick test to see if we need to compress the file at all.  We
      schedule a compress run after 3 hours. */
-  if ( !_keybox_read_blob (&blob, fp, NULL) )
+  if (!force && !_keybox_read_blob (&blob, fp, NULL) )
     {
       const unsigned char *buffer;
       size_t length;
@@ -796,3 +932,20 @@ keybox_compress (KEYBOX_HANDLE hd)
   xfree(tmpfname);
   return rc;
 }
+
+
+int
+keybox_compress (KEYBOX_HANDLE hd)
+{
+  return do_compress (hd, 0);
+}
+
+
+/* Compress the keybox file right away; for example to reclaim the
+ * space of the blobs replaced in append mode.  This should be run
+ * with the file locked.  */
+int
+keybox_compress_now (KEYBOX_HANDLE hd)
+{
+  return do_compress (hd, 1);
+}
@@ -75,13 +75,22 @@ void keybox_push_found_state (KEYBOX_HANDLE hd);
 void keybox_pop_found_state (KEYBOX_HANDLE hd);
 const char *keybox_get_resource_name (KEYBOX_HANDLE hd);
 int keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes);
+int keybox_set_mmap (KEYBOX_HANDLE hd, int yes);
 
 gpg_error_t keybox_lock (KEYBOX_HANDLE hd, int yes, long timeout);
 
+/*-- keybox-index.c --*/
+void keybox_set_use_index (int yes);
+
 /*-- keybox-file.c --*/
+/* Flags of the header blob.  */
+#define KEYBOX_HEADER_FLAG_OPENPGP   0x0002
+#define KEYBOX_HEADER_FLAG_COMPILED  0x0004
+
 /* Fixme: This function does not belong here: Provide a better
    interface to create a new keybox file.  */
 gpg_error_t _keybox_write_header_blob (estream_t fp, int openpgp_flag);
+gpg_error_t keybox_set_header_flags (const char *fname, unsigned int flags);
 
 /*-- keybox-search.c --*/
 gpg_error_t keybox_get_data (KEYBOX_HANDLE hd,
@@ -119,7 +128,9 @@ int keybox_update_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
 int keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value);
 
 int keybox_delete (KEYBOX_HANDLE hd);
+int keybox_set_append_updates (int yes);
 int keybox_compress (KEYBOX_HANDLE hd);
+int keybox_compress_now (KEYBOX_HANDLE hd);
 
 
 /*--  --*/
@@ -58,6 +58,9 @@
 #include "../common/gc-opt-flags.h"
 #include "../common/exechelp.h"
 #include "../common/comopt.h"
+#include "../common/metrics.h"
+#include "../common/memstat.h"
+#include "../common/thread-pool.h"
 #include "frontend.h"
 
 
@@ -90,6 +93,7 @@ enum cmd_and_opt_values
     oFakedSystemTime,
     oListenBacklog,
     oDisableCheckOwnSocket,
+    oCacheSize,
 
     oDummy
   };
@@ -123,6 +127,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
+  ARGPARSE_s_u (oCacheSize, "cache-size",
+                N_("|N|limit the key cache to N MiB")),
 
   ARGPARSE_end () /* End of list */
 };
@@ -423,6 +429,18 @@ finalize_rereadable_options (void)
 }
 
 
+/* The post system call clamp.  This also accounts the time spent
+ * waiting for the nPth lock.  */
+static void
+post_syscall (void)
+{
+  unsigned long long start = metrics_clock ();
+
+  npth_protect ();
+  metrics_lock_wait (start);
+}
+
+
 static void
 thread_init_once (void)
 {
@@ -433,7 +451,7 @@ thread_init_once (void)
       npth_initialized++;
       npth_init ();
     }
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  gpgrt_set_syscall_clamp (npth_unprotect, post_syscall);
   /* Now that we have set the syscall clamp we need to tell Libgcrypt
    * that it should get them from libgpg-error.  Note that Libgcrypt
    * has already been initialized but at that point nPth was not
@@ -444,10 +462,20 @@ thread_init_once (void)
 }
 
 
+static unsigned long long
+metric_connections (void)
+{
+  return active_connections;
+}
+
+
 static void
 initialize_modules (void)
 {
   thread_init_once ();
+  metrics_init ("lcr_keyboxd");
+  metrics_fnc ("connections", METRIC_GAUGE,
+               "Number of active connections.", metric_connections);
 }
 
 
@@ -587,6 +615,8 @@ main (int argc, char **argv )
           listen_backlog = pargs.r.ret_int;
           break;
 
+        case oCacheSize: opt.cache_size = pargs.r.ret_ulong; break;
+
         default:
           if (configname)
             pargs.err = ARGPARSE_PRINT_WARNING;
@@ -863,7 +893,10 @@ kbxd_exit (int rc)
 
   /* at this time a bit annoying */
   if ((opt.debug & DBG_MEMSTAT_VALUE))
-    gcry_control (GCRYCTL_DUMP_MEMORY_STATS );
+    {
+      memstat_dump ();
+      gcry_control (GCRYCTL_DUMP_MEMORY_STATS );
+    }
   rc = rc? rc : log_get_errorcount(0)? 2 : 0;
   exit (rc);
 }
@@ -1718,7 +1751,6 @@ handle_connections (gnupg_fd_t listen_fd)
         {
           int idx;
           ctrl_t ctrl;
-          npth_t thread;
 
           for (idx=0; idx < DIM(listentbl); idx++)
             {
@@ -1744,8 +1776,7 @@ handle_connections (gnupg_fd_t listen_fd)
               else
                 {
                   ctrl->thread_startup.fd = fd;
-                  ret = npth_create (&thread, &tattr,
-                                     listentbl[idx].func, ctrl);
+                  ret = thread_pool_run (&tattr, listentbl[idx].func, ctrl);
                   if (ret)
                     {
                       log_error ("error spawning connection handler for %s:"
@@ -42,6 +42,8 @@ struct
   int dry_run;         /* Don't change any persistent data */
   /* True if we are running detached from the tty. */
   int running_detached;
+  /* The memory limit for the cache in MiB or 0 for the default.  */
+  unsigned int cache_size;
 
   /*
    * Global state variables.
@@ -117,6 +119,10 @@ struct server_control_s
    * auto-created as needed.  */
   db_request_t db_req;
 
+  /* The database lock held by the frontend: 0 = none, 1 = read lock,
+   * 2 = write lock.  */
+  int db_lock;
+
   /* Flags for the current request.  */
 
   /* If the any of the filter flags are set a search returns only
@@ -125,6 +131,7 @@ struct server_control_s
   unsigned int filter_x509 : 1;
   /* Used by SEARCH and NEXT.  */
   unsigned int no_data_return : 1;
+  unsigned int meta_return : 1;
 
 };
 
@@ -171,6 +178,7 @@ void kbxd_sighup_action (void);
 
 
 /*-- kbxserver.c --*/
+int kbxd_is_transaction_owner (ctrl_t ctrl);
 gpg_error_t kbxd_status_printf (ctrl_t ctrl, const char *keyword,
                                 const char *format, ...);
 gpg_error_t kbxd_write_data_line (ctrl_t ctrl,
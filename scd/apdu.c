@@ -46,6 +46,7 @@
 #endif /*GNUPG_MAJOR_VERSION*/
 
 #include "../common/host2net.h"
+#include "../common/membuf.h"
 
 #include "iso7816.h"
 #include "apdu.h"
@@ -86,8 +87,15 @@ static struct pcsc_global_data {
   HANDLE context;
   int count;
   const char *rdrname[MAX_READER];
+  HANDLE watch_context;  /* Context used by the status watcher.  */
+  int watch_alive;       /* The status watcher thread is running.  */
 } pcsc;
 
+/* Timeout in milliseconds for the status watcher's
+ * SCardGetStatusChange.  The watcher is woken up by SCardCancel if
+ * the set of readers changes, thus this can be long.  */
+#define PCSC_WATCH_TIMEOUT 60000
+
 /* A structure to collect information pertaining to one reader
    slot. */
 struct reader_table_s {
@@ -120,6 +128,7 @@ struct reader_table_s {
     int pinmin;
     int pinmax;
     pcsc_dword_t current_state;
+    pcsc_dword_t watch_state;  /* State last seen by the watcher. */
   } pcsc;
 #ifdef USE_G10CODE_RAPDU
   struct {
@@ -136,6 +145,9 @@ struct reader_table_s {
   size_t atrlen;           /* A zero length indicates that the ATR has
                               not yet been read; i.e. the card is not
                               ready for use. */
+  struct scd_stats_s stats;     /* Latency of the APDU exchanges.  */
+  unsigned long long bytes_out; /* Number of bytes sent to the card.  */
+  unsigned long long bytes_in;  /* Number of bytes received.  */
 #ifdef USE_NPTH
   npth_mutex_t lock;
 #endif
@@ -455,6 +467,9 @@ new_reader_slot (void)
       return -1;
     }
 
+  memset (&reader_table[reader].stats, 0, sizeof reader_table[reader].stats);
+  reader_table[reader].bytes_out = 0;
+  reader_table[reader].bytes_in = 0;
   reader_table[reader].connect_card = NULL;
   reader_table[reader].disconnect_card = NULL;
   reader_table[reader].close_reader = NULL;
@@ -476,6 +491,7 @@ new_reader_slot (void)
   reader_table[reader].pcsc.pinmin = -1;
   reader_table[reader].pcsc.pinmax = -1;
   reader_table[reader].pcsc.current_state = PCSC_STATE_UNAWARE;
+  reader_table[reader].pcsc.watch_state = PCSC_STATE_UNAWARE;
 
   return reader;
 }
@@ -841,11 +857,153 @@ release_pcsc_context (void)
   pcsc.context = 0;
 }
 
+
+#ifdef USE_NPTH
+/* The PC/SC status watcher thread.  Instead of having the ticker
+ * poll the status of all PC/SC readers, this thread waits in
+ * SCardGetStatusChange for a status change of any of the open
+ * readers and then kicks the main loop so that the status is updated
+ * by scd_update_reader_status_file.  The thread terminates after the
+ * last PC/SC reader has been closed.  */
+static void *
+pcsc_watch_thread (void *arg)
+{
+  struct pcsc_readerstate_s rdrstates[MAX_READER];
+  int slots[MAX_READER];
+  int slot, n, i, changed;
+  long err;
+
+  (void)arg;
+
+  for (;;)
+    {
+      n = 0;
+      for (slot = 0; slot < MAX_READER; slot++)
+        if (reader_table[slot].used
+            && reader_table[slot].get_status_reader == pcsc_get_status
+            && reader_table[slot].rdrname)
+          {
+            memset (&rdrstates[n], 0, sizeof rdrstates[n]);
+            /* Use a copy because the reader may be closed while we
+             * are waiting.  */
+            rdrstates[n].reader = xtrystrdup (reader_table[slot].rdrname);
+            if (!rdrstates[n].reader)
+              continue;
+            rdrstates[n].current_state = reader_table[slot].pcsc.watch_state;
+            slots[n++] = slot;
+          }
+      if (!n)
+        break;
+
+      npth_unprotect ();
+      err = pcsc_get_status_change (pcsc.watch_context, PCSC_WATCH_TIMEOUT,
+                                    rdrstates, n);
+      npth_protect ();
+
+      changed = 0;
+      if (!err)
+        {
+          for (i = 0; i < n; i++)
+            if ((rdrstates[i].event_state & PCSC_STATE_CHANGED))
+              {
+                slot = slots[i];
+                if (reader_table[slot].used)
+                  reader_table[slot].pcsc.watch_state =
+                    (rdrstates[i].event_state & ~PCSC_STATE_CHANGED);
+                changed = 1;
+              }
+        }
+      else if (err != PCSC_E_TIMEOUT && err != PCSC_E_CANCELLED)
+        {
+          log_error ("pcsc_get_status_change failed in watcher: %s (0x%lx)\n",
+                     pcsc_error_string (err), err);
+          /* Fall back to checking the status once a second.  */
+          changed = 1;
+          npth_sleep (1);
+        }
+
+      for (i = 0; i < n; i++)
+        xfree ((char *)rdrstates[i].reader);
+
+      if (changed)
+        scd_kick_the_loop ();
+    }
+
+  pcsc_release_context (pcsc.watch_context);
+  pcsc.watch_context = 0;
+  pcsc.watch_alive = 0;
+  return NULL;
+}
+#endif /*USE_NPTH*/
+
+
+/* Start the PC/SC status watcher or, if it is already running, tell
+ * it that the set of readers has changed.  Returns true if the
+ * watcher is running so that the ticker does not need to poll the
+ * readers.  */
+static int
+pcsc_watch_update (void)
+{
+#ifdef USE_NPTH
+  long err;
+  npth_t thread;
+  npth_attr_t tattr;
+
+  if (pcsc.watch_alive)
+    {
+      err = pcsc_cancel (pcsc.watch_context);
+      if (err)
+        log_error ("pcsc_cancel failed: %s (0x%lx)\n",
+                   pcsc_error_string (err), err);
+      return 1;
+    }
+
+  /* Without SCardCancel we can't wake up the watcher.  */
+  if (!pcsc_cancel)
+    return 0;
+
+  err = pcsc_establish_context (PCSC_SCOPE_SYSTEM, NULL, NULL,
+                                &pcsc.watch_context);
+  if (err)
+    {
+      log_error ("pcsc_establish_context failed: %s (0x%lx)\n",
+                 pcsc_error_string (err), err);
+      return 0;
+    }
+
+  if (npth_attr_init (&tattr))
+    {
+      pcsc_release_context (pcsc.watch_context);
+      pcsc.watch_context = 0;
+      return 0;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  err = npth_create (&thread, &tattr, pcsc_watch_thread, NULL);
+  npth_attr_destroy (&tattr);
+  if (err)
+    {
+      log_error ("error spawning pcsc watcher: %s\n", strerror (err));
+      pcsc_release_context (pcsc.watch_context);
+      pcsc.watch_context = 0;
+      return 0;
+    }
+  npth_setname_np (thread, "pcsc-watcher");
+  pcsc.watch_alive = 1;
+  return 1;
+#else
+  return 0;
+#endif /*USE_NPTH*/
+}
+
+
 static int
 close_pcsc_reader (int slot)
 {
   /*log_debug ("%s: count=%d (ctx=%x)\n", __func__, pcsc.count, pcsc.context);*/
   (void)slot;
+  /* Let the watcher drop this reader.  */
+  if (pcsc.watch_alive)
+    pcsc_watch_update ();
   log_assert (pcsc.count > 0);
   if (!--pcsc.count)
     release_pcsc_context ();
@@ -1266,6 +1424,11 @@ open_pcsc_reader (const char *rdrname)
   reader_table[slot].send_apdu_reader = pcsc_send_apdu;
   reader_table[slot].dump_status_reader = dump_pcsc_reader_status;
 
+  /* Status changes are reported by the watcher thread, thus there is
+   * no need to poll the reader.  */
+  if (pcsc_watch_update ())
+    reader_table[slot].require_get_status = 0;
+
   dump_reader_status (slot);
   unlock_slot (slot);
   return slot;
@@ -2801,16 +2964,26 @@ static int
 send_apdu (int slot, unsigned char *apdu, size_t apdulen,
            unsigned char *buffer, size_t *buflen, pininfo_t *pininfo)
 {
+  unsigned long long started;
+  int sw;
+
   if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used )
     return SW_HOST_NO_DRIVER;
 
-  if (reader_table[slot].send_apdu_reader)
-    return reader_table[slot].send_apdu_reader (slot,
-                                                apdu, apdulen,
-                                                buffer, buflen,
-                                                pininfo);
-  else
+  if (!reader_table[slot].send_apdu_reader)
     return SW_HOST_NOT_SUPPORTED;
+
+  started = scd_stats_now ();
+  sw = reader_table[slot].send_apdu_reader (slot,
+                                            apdu, apdulen,
+                                            buffer, buflen,
+                                            pininfo);
+  scd_stats_add (&reader_table[slot].stats, started, !!sw);
+  reader_table[slot].bytes_out += apdulen;
+  if (!sw)
+    reader_table[slot].bytes_in += *buflen;
+
+  return sw;
 }
 
 
@@ -3490,6 +3663,46 @@ apdu_get_reader_name (int slot)
   return reader_table[slot].rdrname;
 }
 
+
+/* Return a malloced string with one line for each open reader of the
+ * form "apdu:SLOT:STATS:BYTES_OUT:BYTES_IN:READER" where STATS is
+ * described at scd_stats_string.  Returns NULL on error or if no
+ * reader is open.  */
+char *
+apdu_get_stats (void)
+{
+  membuf_t mb;
+  char *stats;
+  int slot;
+
+  init_membuf (&mb, 256);
+  for (slot = 0; slot < MAX_READER; slot++)
+    {
+      if (!reader_table[slot].used)
+        continue;
+      stats = scd_stats_string (&reader_table[slot].stats);
+      if (!stats)
+        {
+          xfree (get_membuf (&mb, NULL));
+          return NULL;
+        }
+      put_membuf_printf (&mb, "apdu:%d:%s:%llu:%llu:%s\n", slot, stats,
+                         reader_table[slot].bytes_out,
+                         reader_table[slot].bytes_in,
+                         reader_table[slot].rdrname?
+                         reader_table[slot].rdrname : "");
+      xfree (stats);
+    }
+  put_membuf (&mb, "", 1);
+  stats = get_membuf (&mb, NULL);
+  if (stats && !*stats)
+    {
+      xfree (stats);
+      stats = NULL;
+    }
+  return stats;
+}
+
 gpg_error_t
 apdu_init (void)
 {
@@ -120,6 +120,20 @@ struct card_ctx_s {
   unsigned int reset_requested:1;
   unsigned int periodical_check_needed:1;
   unsigned int maybe_check_aid:1;
+
+  /* For the card pool mode: the number of requests waiting for the
+   * lock and a ring of keygrips recently found on this card.  */
+  unsigned int pool_waiting;
+  unsigned int pool_next_grip;
+  char pool_grips[4][41];
+
+  /* The application last used for signing and the time the card was
+   * last used.  If PRESELECT_PENDING is set another application is
+   * active and the signing application shall be re-selected once the
+   * card is idle.  */
+  apptype_t sign_apptype;
+  time_t last_use;
+  unsigned int preselect_pending:1;
 };
 
 
@@ -164,6 +164,7 @@ struct app_local_s {
   struct
   {
     int read_done;   /* True if we have at least tried to read them.  */
+    int no_key;      /* True if the card told us that there is no key.  */
     unsigned char *key; /* This is a malloced buffer with a canonical
                            encoded S-expression encoding a public
                            key. Might be NULL if key is not
@@ -360,6 +361,7 @@ do_deinit (app_t app)
         {
           xfree (app->app_local->pk[i].key);
           app->app_local->pk[i].read_done = 0;
+          app->app_local->pk[i].no_key = 0;
         }
       xfree (app->app_local);
       app->app_local = NULL;
@@ -1983,6 +1985,8 @@ get_public_key (app_t app, int keyno)
   /* Already cached? */
   if (app->app_local->pk[keyno].read_done)
     return 0;
+  if (app->app_local->pk[keyno].no_key)
+    return gpg_error (GPG_ERR_NO_OBJ);
 
   xfree (app->app_local->pk[keyno].key);
   app->app_local->pk[keyno].key = NULL;
@@ -2110,9 +2114,13 @@ get_public_key (app_t app, int keyno)
     }
 
  leave:
-  /* Set a flag to indicate that we tried to read the key.  */
+  /* Set a flag to indicate that we tried to read the key.  A missing
+   * key is also remembered so that keygrip lookups over all cards do
+   * not ask for it again.  */
   if (!err)
     app->app_local->pk[keyno].read_done = 1;
+  else if (gpg_err_code (err) == GPG_ERR_NO_OBJ)
+    app->app_local->pk[keyno].no_key = 1;
 
   xfree (buffer);
   return err;
@@ -4498,6 +4506,7 @@ rsa_writekey (app_t app, ctrl_t ctrl,
   app->app_local->pk[keyno].key = NULL;
   app->app_local->pk[keyno].keylen = 0;
   app->app_local->pk[keyno].read_done = 0;
+  app->app_local->pk[keyno].no_key = 0;
 
 
   if (app->app_local->extcap.is_v2)
@@ -4878,6 +4887,7 @@ ecc_writekey (app_t app, ctrl_t ctrl,
   app->app_local->pk[keyno].key = NULL;
   app->app_local->pk[keyno].keylen = 0;
   app->app_local->pk[keyno].read_done = 0;
+  app->app_local->pk[keyno].no_key = 0;
 
   if (app->app_local->extcap.is_v2)
     {
@@ -5072,6 +5082,7 @@ do_genkey (app_t app, ctrl_t ctrl,  const char *keyref, const char *keyalgo,
   app->app_local->pk[keyno].key = NULL;
   app->app_local->pk[keyno].keylen = 0;
   app->app_local->pk[keyno].read_done = 0;
+  app->app_local->pk[keyno].no_key = 0;
 
   /* Check whether a key already exists.  */
   err = does_key_exist (app, keyno, 1, force);
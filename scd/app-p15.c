@@ -532,9 +532,60 @@ struct app_local_s
   /* Information on all authentication objects. */
   aodf_object_t auth_object_info;
 
+  /* The file cache entry of this card or NULL.  */
+  struct p15_cache_s *cache;
+
+  /* The EF last requested by select_and_read_binary or
+   * select_and_read_record and a flag telling that it has not yet
+   * been selected on the card because the data was taken from the
+   * cache.  */
+  unsigned short cur_efid;
+  unsigned int cur_efid_pending : 1;
+
+  /* If TRACK_DF is set the DF given by CUR_DF and CUR_DFLEN is known
+   * to be the current DF; this is only used while reading the
+   * directory files.  */
+  unsigned int track_df : 1;
+  unsigned short cur_df[8];
+  size_t cur_dflen;
 };
 
 
+/* The data read from a file or a record.  */
+struct p15_cached_file_s
+{
+  struct p15_cached_file_s *next;
+  int recno;            /* The record number or 0 for a binary read.  */
+  unsigned long off;    /* The offset and length of a binary read.  */
+  unsigned long len;
+  unsigned int not_found : 1;  /* The record does not exist.  */
+  size_t pathlen;
+  unsigned short *path; /* Malloced.  */
+  size_t datalen;
+  unsigned char data[1];
+};
+typedef struct p15_cached_file_s *p15_cached_file_t;
+
+/* The files of one card.  The card is identified by the entire
+ * content of its EF(TokenInfo), which includes the serial number and,
+ * if provided by the card, the lastUpdate time.  The cache is kept
+ * over the lifetime of scdaemon so that a re-inserted card does not
+ * need to read all directory files and certificates again.  */
+struct p15_cache_s
+{
+  struct p15_cache_s *next;
+  unsigned int refcount;  /* Number of apps using this entry.  */
+  size_t tokeninfolen;
+  unsigned char *tokeninfo;
+  p15_cached_file_t files;
+};
+
+/* Maximum number of cards kept in the cache.  */
+#define P15_CACHE_MAX_CARDS 8
+
+static struct p15_cache_s *p15_cache;
+
+
 /*** Local prototypes.  ***/
 static gpg_error_t select_ef_by_path (app_t app, const unsigned short *path,
                                       size_t pathlen);
@@ -665,6 +716,205 @@ release_lists (app_t app)
 }
 
 
+static void
+release_cached_files (p15_cached_file_t a)
+{
+  while (a)
+    {
+      p15_cached_file_t tmp = a->next;
+      xfree (a->path);
+      xfree (a);
+      a = tmp;
+    }
+}
+
+
+/* Attach the cache entry for the card with the EF(TokenInfo) given
+ * by (TOKENINFO,TOKENINFOLEN) to APP.  A new entry is created if
+ * needed; if the cache is full an unused entry is dropped.  */
+static void
+p15_cache_attach (app_t app, const unsigned char *tokeninfo,
+                  size_t tokeninfolen)
+{
+  struct p15_cache_s *c, *cprev, *unused, *unusedprev;
+  int count;
+
+  if (app->app_local->cache || !tokeninfolen)
+    return;
+
+  unused = unusedprev = NULL;
+  for (c = p15_cache, cprev = NULL, count = 0; c; cprev = c, c = c->next)
+    {
+      if (c->tokeninfolen == tokeninfolen
+          && !memcmp (c->tokeninfo, tokeninfo, tokeninfolen))
+        break;
+      if (!c->refcount)
+        {
+          unused = c;
+          unusedprev = cprev;
+        }
+      count++;
+    }
+
+  if (!c)
+    {
+      if (count >= P15_CACHE_MAX_CARDS)
+        {
+          if (!unused)
+            return;  /* All entries are in use.  */
+          if (unusedprev)
+            unusedprev->next = unused->next;
+          else
+            p15_cache = unused->next;
+          release_cached_files (unused->files);
+          xfree (unused->tokeninfo);
+          xfree (unused);
+        }
+
+      c = xtrycalloc (1, sizeof *c);
+      if (!c)
+        return;
+      c->tokeninfo = xtrymalloc (tokeninfolen);
+      if (!c->tokeninfo)
+        {
+          xfree (c);
+          return;
+        }
+      memcpy (c->tokeninfo, tokeninfo, tokeninfolen);
+      c->tokeninfolen = tokeninfolen;
+      c->next = p15_cache;
+      p15_cache = c;
+    }
+  else if (opt.verbose)
+    log_info ("p15: using cached card data\n");
+
+  c->refcount++;
+  app->app_local->cache = c;
+}
+
+
+/* Detach the cache entry from APP.  */
+static void
+p15_cache_detach (app_t app)
+{
+  if (app->app_local->cache)
+    {
+      log_assert (app->app_local->cache->refcount);
+      app->app_local->cache->refcount--;
+      app->app_local->cache = NULL;
+    }
+}
+
+
+/* Remove all cached files of the card used by APP.  */
+static void
+p15_cache_flush (app_t app)
+{
+  if (app->app_local->cache)
+    {
+      release_cached_files (app->app_local->cache->files);
+      app->app_local->cache->files = NULL;
+    }
+}
+
+
+/* Return the cached file object for the file PATH,PATHLEN with the
+ * record RECNO or the binary data at OFF and LEN.  Returns NULL if
+ * not cached.  */
+static p15_cached_file_t
+p15_cache_get (app_t app, const unsigned short *path, size_t pathlen,
+               int recno, unsigned long off, unsigned long len)
+{
+  p15_cached_file_t f;
+
+  if (!app->app_local->cache || !pathlen)
+    return NULL;
+
+  for (f = app->app_local->cache->files; f; f = f->next)
+    if (f->recno == recno && f->off == off && f->len == len
+        && f->pathlen == pathlen
+        && !memcmp (f->path, path, pathlen * sizeof *path))
+      return f;
+  return NULL;
+}
+
+
+/* Store (DATA,DATALEN) in the cache for the given file.  If DATA is
+ * NULL a not_found marker is stored.  */
+static void
+p15_cache_put (app_t app, const unsigned short *path, size_t pathlen,
+               int recno, unsigned long off, unsigned long len,
+               const unsigned char *data, size_t datalen)
+{
+  p15_cached_file_t f;
+
+  if (!app->app_local->cache || !pathlen
+      || p15_cache_get (app, path, pathlen, recno, off, len))
+    return;
+
+  f = xtrycalloc (1, sizeof *f + datalen);
+  if (!f)
+    return;
+  f->path = xtrycalloc (pathlen, sizeof *path);
+  if (!f->path)
+    {
+      xfree (f);
+      return;
+    }
+  memcpy (f->path, path, pathlen * sizeof *path);
+  f->pathlen = pathlen;
+  f->recno = recno;
+  f->off = off;
+  f->len = len;
+  if (data)
+    memcpy (f->data, data, datalen);
+  else
+    f->not_found = 1;
+  f->datalen = datalen;
+  f->next = app->app_local->cache->files;
+  app->app_local->cache->files = f;
+}
+
+
+/* Return a malloced copy of the data of the cache object F at
+ * (R_BUFFER,R_BUFLEN).  */
+static gpg_error_t
+copy_cached_file (p15_cached_file_t f,
+                  unsigned char **r_buffer, size_t *r_buflen)
+{
+  *r_buffer = xtrymalloc (f->datalen? f->datalen : 1);
+  if (!*r_buffer)
+    return gpg_error_from_syserror ();
+  memcpy (*r_buffer, f->data, f->datalen);
+  *r_buflen = f->datalen;
+  return 0;
+}
+
+
+/* Select the EF requested by the last select_and_read_binary or
+ * select_and_read_record call if that has been served from the
+ * cache.  */
+static gpg_error_t
+select_pending_ef (app_t app, const char *efid_desc)
+{
+  gpg_error_t err;
+  unsigned short efid = app->app_local->cur_efid;
+
+  if (!app->app_local->cur_efid_pending)
+    return 0;
+
+  err = select_ef_by_path (app, &efid, 1);
+  if (err)
+    {
+      log_error ("p15: error selecting %s (0x%04X): %s\n",
+                 efid_desc, efid, gpg_strerror (err));
+      return err;
+    }
+  app->app_local->cur_efid = efid;
+  return 0;
+}
+
+
 static void
 release_tokeninfo (app_t app)
 {
@@ -676,6 +926,7 @@ release_tokeninfo (app_t app)
   app->app_local->tokenflags = NULL;
   xfree (app->app_local->serialno);
   app->app_local->serialno = NULL;
+  p15_cache_detach (app);
 }
 
 
@@ -703,23 +954,31 @@ select_and_read_binary (app_t app, unsigned short efid, const char *efid_desc,
 {
   gpg_error_t err;
   int sw;
+  p15_cached_file_t cached;
 
   if (efid)
     {
-      err = select_ef_by_path (app, &efid, 1);
-      if (err)
-        {
-          log_error ("p15: error selecting %s (0x%04X): %s\n",
-                     efid_desc, efid, gpg_strerror (err));
-          return err;
-        }
+      app->app_local->cur_efid = efid;
+      app->app_local->cur_efid_pending = 1;
     }
+  else
+    efid = app->app_local->cur_efid;
+
+  if (efid && (cached = p15_cache_get (app, &efid, 1, 0, 0, 0))
+      && !cached->not_found)
+    return copy_cached_file (cached, buffer, buflen);
+
+  err = select_pending_ef (app, efid_desc);
+  if (err)
+    return err;
 
   err = iso7816_read_binary_ext (app_get_slot (app),
                                  0, 0, 0, buffer, buflen, &sw);
   if (err)
     log_error ("p15: error reading %s (0x%04X): %s (sw=%04X)\n",
                efid_desc, efid, gpg_strerror (err), sw);
+  else if (efid)
+    p15_cache_put (app, &efid, 1, 0, 0, 0, *buffer, *buflen);
   return err;
 }
 
@@ -735,25 +994,47 @@ select_and_read_record (app_t app, unsigned short efid, int recno,
 {
   gpg_error_t err;
   int sw = 0;
+  p15_cached_file_t cached;
 
   if (r_sw)
     *r_sw = 0x9000;
 
   if (efid)
     {
-      err = select_ef_by_path (app, &efid, 1);
-      if (err)
+      app->app_local->cur_efid = efid;
+      app->app_local->cur_efid_pending = 1;
+    }
+  else
+    efid = app->app_local->cur_efid;
+
+  if (efid && (cached = p15_cache_get (app, &efid, 1, recno, 0, 0)))
+    {
+      if (cached->not_found)
         {
-          log_error ("p15: error selecting %s (0x%04X): %s\n",
-                     efid_desc, efid, gpg_strerror (err));
           if (r_sw)
-            *r_sw = sw;
-          return err;
+            *r_sw = SW_RECORD_NOT_FOUND;
+          return gpg_error (GPG_ERR_NOT_FOUND);
         }
+      err = copy_cached_file (cached, buffer, buflen);
+      if (err)
+        return err;
+      goto strip_prefix;
+    }
+
+  err = select_pending_ef (app, efid_desc);
+  if (err)
+    {
+      if (r_sw)
+        *r_sw = sw;
+      return err;
     }
 
   err = iso7816_read_record_ext (app_get_slot (app),
                                  recno, 1, 0, buffer, buflen, &sw);
+  if (efid && !err)
+    p15_cache_put (app, &efid, 1, recno, 0, 0, *buffer, *buflen);
+  else if (efid && gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    p15_cache_put (app, &efid, 1, recno, 0, 0, NULL, 0);
   if (err)
     {
       if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
@@ -767,6 +1048,8 @@ select_and_read_record (app_t app, unsigned short efid, int recno,
         *r_sw = sw;
       return err;
     }
+
+ strip_prefix:
   /* On CardOS with a Linear TLV file structure the records starts
    * with some tag (often the record number) followed by the length
    * byte for this record.  Detect and remove this prefix.  */
@@ -803,6 +1086,10 @@ select_by_path (app_t app, const unsigned short *path, size_t pathlen,
   if (!pathlen)
     return gpg_error (GPG_ERR_INV_VALUE);
 
+  /* Any explicit select overrides a pending select.  */
+  app->app_local->cur_efid = 0;
+  app->app_local->cur_efid_pending = 0;
+
   if (opt.debug)
     {
       log_debug ("%s: path=", __func__);
@@ -828,6 +1115,7 @@ select_by_path (app_t app, const unsigned short *path, size_t pathlen,
           err = iso7816_select_path (app_get_slot (app), path, pathlen,
                                      app->app_local->home_df);
         }
+      app->app_local->cur_dflen = 0;
       if (err)
         {
           log_error ("p15: error selecting path ");
@@ -839,8 +1127,19 @@ select_by_path (app_t app, const unsigned short *path, size_t pathlen,
       if (pathlen && *path != 0x3f00 )
         log_error ("p15: warning: relative path select not yet implemented\n");
 
+      /* Skip the selection of the DF if it is already the current
+       * one.  */
+      i = 0;
+      if (app->app_local->track_df && !expect_df
+          && pathlen > 1 && *path == 0x3f00
+          && app->app_local->cur_dflen == pathlen - 1
+          && !memcmp (app->app_local->cur_df, path,
+                      (pathlen - 1) * sizeof *path))
+        i = pathlen - 1;
+      app->app_local->cur_dflen = 0;
+
       /* FIXME: Use home_df.  */
-      for (i=0; i < pathlen; i++)
+      for (; i < pathlen; i++)
         {
           err = iso7816_select_file (app_get_slot (app),
                                      path[i], (expect_df || (i+1 < pathlen)));
@@ -850,6 +1149,13 @@ select_by_path (app_t app, const unsigned short *path, size_t pathlen,
               goto err_print_path;
             }
         }
+
+      if (!expect_df && pathlen > 1 && *path == 0x3f00
+          && pathlen - 1 <= DIM (app->app_local->cur_df))
+        {
+          memcpy (app->app_local->cur_df, path, (pathlen - 1) * sizeof *path);
+          app->app_local->cur_dflen = pathlen - 1;
+        }
     }
   return 0;
 
@@ -3642,6 +3948,10 @@ read_ef_tokeninfo (app_t app)
 
 
  leave:
+  /* Use the TokenInfo to identify the card in the file cache.  We
+   * do this only if it has a serial number.  */
+  if (!err && app->app_local->serialno)
+    p15_cache_attach (app, buffer, buflen);
   xfree (buffer);
   return err;
 }
@@ -3651,7 +3961,7 @@ read_ef_tokeninfo (app_t app)
    structure and initialize our local context.  This is used once at
    application initialization. */
 static gpg_error_t
-read_p15_info (app_t app)
+read_p15_info_internal (app_t app)
 {
   gpg_error_t err;
   prkdf_object_t prkdf;
@@ -4015,6 +4325,22 @@ read_p15_info (app_t app)
 }
 
 
+/* Wrapper around read_p15_info_internal to track the current DF while
+ * reading the directory files.  */
+static gpg_error_t
+read_p15_info (app_t app)
+{
+  gpg_error_t err;
+
+  app->app_local->track_df = 1;
+  app->app_local->cur_dflen = 0;
+  err = read_p15_info_internal (app);
+  app->app_local->track_df = 0;
+  app->app_local->cur_dflen = 0;
+  return err;
+}
+
+
 /* Helper to do_learn_status: Send information about all certificates
    listed in CERTINFO back.  Use CERTTYPE as type of the
    certificate. */
@@ -4336,6 +4662,7 @@ do_learn_status (app_t app, ctrl_t ctrl, unsigned int flags)
 
   if (flags & APP_LEARN_FLAG_REREAD)
     {
+      p15_cache_flush (app);
       err = read_p15_info (app);
       if (err)
         return err;
@@ -4386,6 +4713,7 @@ readcert_by_cdf (app_t app, cdf_object_t cdf,
   size_t totobjlen, objlen, hdrlen;
   int rootca;
   int i;
+  p15_cached_file_t cached;
 
   if (r_cert)
     *r_cert = NULL;
@@ -4439,16 +4767,26 @@ readcert_by_cdf (app_t app, cdf_object_t cdf,
   /* Read the entire file.  fixme: This could be optimized by first
      reading the header to figure out how long the certificate
      actually is. */
-  err = select_ef_by_path (app, cdf->path, cdf->pathlen);
-  if (err)
-    goto leave;
-
-  if (app->app_local->no_extended_mode || !cdf->len)
-    err = iso7816_read_binary_ext (app_get_slot (app), 0, cdf->off, 0,
-                                   &buffer, &buflen, NULL);
+  cached = p15_cache_get (app, cdf->path, cdf->pathlen, 0, cdf->off, cdf->len);
+  if (cached && !cached->not_found)
+    err = copy_cached_file (cached, &buffer, &buflen);
   else
-    err = iso7816_read_binary_ext (app_get_slot (app), 1, cdf->off, cdf->len,
-                                   &buffer, &buflen, NULL);
+    {
+      err = select_ef_by_path (app, cdf->path, cdf->pathlen);
+      if (err)
+        goto leave;
+
+      if (app->app_local->no_extended_mode || !cdf->len)
+        err = iso7816_read_binary_ext (app_get_slot (app), 0, cdf->off, 0,
+                                       &buffer, &buflen, NULL);
+      else
+        err = iso7816_read_binary_ext (app_get_slot (app), 1,
+                                       cdf->off, cdf->len,
+                                       &buffer, &buflen, NULL);
+      if (!err)
+        p15_cache_put (app, cdf->path, cdf->pathlen, 0, cdf->off, cdf->len,
+                       buffer, buflen);
+    }
   if (!err && (!buflen || *buffer == 0xff))
     err = gpg_error (GPG_ERR_NOT_FOUND);
   if (err)
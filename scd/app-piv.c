@@ -64,6 +64,7 @@
 #include "../common/tlv.h"
 #include "../common/host2net.h"
 #include "apdu.h" /* We use apdu_send_direct.  */
+#include "atr.h"
 
 #define PIV_ALGORITHM_3DES_ECB_0 0x00
 #define PIV_ALGORITHM_2DES_ECB   0x01
@@ -197,6 +198,8 @@ static struct data_object_s data_objects[] = {
 struct cache_s {
   struct cache_s *next;
   int tag;
+  gpg_error_t err;         /* Error for a DO not on the card or 0.  */
+  char keygripstr[2*KEYGRIP_LEN+1]; /* Keygrip of the DO or empty.  */
   size_t length;
   unsigned char data[1];
 };
@@ -211,6 +214,7 @@ struct app_local_s {
   struct
   {
     unsigned int yubikey:1;  /* This is on a Yubikey.  */
+    unsigned int ext_lc_le:1;/* Use extended length APDUs.  */
   } flags;
 
   /* Keep track on whether we cache a certain PIN so that we get it
@@ -228,6 +232,19 @@ struct app_local_s {
     unsigned int maybe_9B:1;
   } pincache;
 
+  /* Keep track of the PINs which have been verified during this
+   * session of the application so that we do not need to ask the
+   * card for the verification status before each operation.  The
+   * flags are cleared if the PIN is changed or cleared or if another
+   * application has been selected; a reset or removal of the card
+   * releases the application anyway.  */
+  struct
+  {
+    unsigned int chv_00:1;
+    unsigned int chv_80:1;
+    unsigned int chv_81:1;
+  } verified;
+
 };
 
 
@@ -263,6 +280,62 @@ do_deinit (app_t app)
 }
 
 
+/* Return the extended_mode to be used for commands which may send
+ * or return large objects.  If extended length APDUs are not usable
+ * DFLT is returned.  */
+static int
+ext_mode (app_t app, int dflt)
+{
+  return app->app_local->flags.ext_lc_le? 1 : dflt;
+}
+
+
+/* Return the Le to be used along with ext_mode so that a large
+ * response is returned with a single APDU.  */
+static int
+ext_le (app_t app)
+{
+  return app->app_local->flags.ext_lc_le? 4096 : 0;
+}
+
+
+/* Read the data object TAG into a malloced buffer and store it at
+ * (R_BUFFER,R_BUFLEN).  If the card supports extended length APDUs
+ * the object is read with a single command; if that fails for a
+ * reason other than a missing object (e.g. a T=0 reader or a reader
+ * restricted to short APDUs) extended length is disabled for this
+ * application and the short APDU with GET RESPONSE chaining is
+ * used.  */
+static gpg_error_t
+get_data_odd (app_t app, int tag, unsigned char **r_buffer, size_t *r_buflen)
+{
+  gpg_error_t err;
+
+  if (app->app_local->flags.ext_lc_le)
+    {
+      err = iso7816_get_data_odd (app_get_slot (app), 1, tag,
+                                  r_buffer, r_buflen);
+      switch (gpg_err_code (err))
+        {
+        case 0:
+        case GPG_ERR_ENOENT:
+        case GPG_ERR_NO_OBJ:
+        case GPG_ERR_CARD_REMOVED:
+        case GPG_ERR_CARD_NOT_PRESENT:
+          return err;
+        default:
+          break;
+        }
+      if (opt.verbose)
+        log_info ("piv: extended length GET DATA failed (%s)"
+                  " - using short APDUs\n", gpg_strerror (err));
+      app->app_local->flags.ext_lc_le = 0;
+    }
+
+  return iso7816_get_data_odd (app_get_slot (app), 0, tag, r_buffer, r_buflen);
+}
+
+
 /* Wrapper around iso7816_get_data which first tries to get the data
  * from the cache.  With GET_IMMEDIATE passed as true, the cache is
  * bypassed.  The tag-53 container is also removed.  */
@@ -286,6 +359,8 @@ get_cached_data (app_t app, int tag,
       for (c=app->app_local->cache; c; c = c->next)
         if (c->tag == tag)
           {
+            if (c->err)
+              return c->err;
             if(c->length)
               {
                 p = xtrymalloc (c->length);
@@ -301,9 +376,29 @@ get_cached_data (app_t app, int tag,
           }
     }
 
-  err = iso7816_get_data_odd (app_get_slot (app), 0, tag, &p, &len);
+  err = get_data_odd (app, tag, &p, &len);
   if (err)
-    return err;
+    {
+      /* Also remember that the DO does not exist so that a lookup
+       * over all keypairs does not need to ask the card again.  */
+      if (!get_immediate
+          && (gpg_err_code (err) == GPG_ERR_ENOENT
+              || gpg_err_code (err) == GPG_ERR_NO_OBJ))
+        {
+          for (i=0; data_objects[i].tag; i++)
+            if (data_objects[i].tag == tag)
+              break;
+          if (data_objects[i].tag && !data_objects[i].dont_cache
+              && (c = xtrycalloc (1, sizeof *c)))
+            {
+              c->tag = tag;
+              c->err = err;
+              c->next = app->app_local->cache;
+              app->app_local->cache = c;
+            }
+        }
+      return err;
+    }
 
   /* Unless the Discovery Object or the BIT Group Template is
    * requested, remove the outer container.
@@ -345,6 +440,8 @@ get_cached_data (app_t app, int tag,
         xfree (p);
       c->length = len;
       c->tag = tag;
+      c->err = 0;
+      *c->keygripstr = 0;
       c->next = app->app_local->cache;
       app->app_local->cache = c;
     }
@@ -360,8 +457,18 @@ flush_cached_data (app_t app, int tag)
 {
   struct cache_s *c, *cprev;
 
+  if (!tag)
+    {
+      while ((c = app->app_local->cache))
+        {
+          app->app_local->cache = c->next;
+          xfree (c);
+        }
+      return;
+    }
+
   for (c=app->app_local->cache, cprev=NULL; c; cprev=c, c = c->next)
-    if (c->tag == tag || !tag)
+    if (c->tag == tag)
       {
         if (cprev)
           cprev->next = c->next;
@@ -1256,15 +1363,25 @@ get_keygrip_by_tag (app_t app, unsigned int tag,
   gcry_sexp_t s_pkey = NULL;
   ksba_cert_t cert = NULL;
   unsigned char grip[KEYGRIP_LEN];
+  struct cache_s *c;
 
   *r_got_cert = 0;
   *r_keygripstr = xtrymalloc (2*KEYGRIP_LEN+1);
-  if (!r_keygripstr)
+  if (!*r_keygripstr)
     {
       err = gpg_error_from_syserror ();
       goto leave;
     }
 
+  /* Computing the keygrip requires parsing the certificate; thus we
+   * keep it along with the cached DO.  */
+  for (c=app->app_local->cache; c; c = c->next)
+    if (c->tag == tag && *c->keygripstr)
+      {
+        strcpy (*r_keygripstr, c->keygripstr);
+        return 0;
+      }
+
   /* We need to get the public key from the certificate.  */
   err = readcert_by_tag (app, tag, &certbuf, &certbuflen, &mechanism);
   if (err)
@@ -1302,6 +1419,14 @@ get_keygrip_by_tag (app_t app, unsigned int tag,
       err = app_help_get_keygrip_string (cert, *r_keygripstr, NULL, NULL);
     }
 
+  if (!err)
+    for (c=app->app_local->cache; c; c = c->next)
+      if (c->tag == tag && !c->err)
+        {
+          strcpy (c->keygripstr, *r_keygripstr);
+          break;
+        }
+
  leave:
   gcry_sexp_release (s_pkey);
   ksba_cert_release (cert);
@@ -1942,6 +2067,38 @@ ask_and_prepare_chv (app_t app, ctrl_t ctrl,
 }
 
 
+/* Set the verification state of the PIN KEYREF to VALUE.  */
+static void
+set_verified (app_t app, int keyref, int value)
+{
+  switch (keyref)
+    {
+    case 0x00: app->app_local->verified.chv_00 = !!value; break;
+    case 0x80: app->app_local->verified.chv_80 = !!value; break;
+    case 0x81: app->app_local->verified.chv_81 = !!value; break;
+    }
+}
+
+
+/* Return true if we know that the PIN KEYREF has been verified.  In
+ * shared mode another process may have reset the card and thus we
+ * never claim that.  */
+static int
+is_verified (app_t app, int keyref)
+{
+  if (opt.pcsc_shared)
+    return 0;
+
+  switch (keyref)
+    {
+    case 0x00: return app->app_local->verified.chv_00;
+    case 0x80: return app->app_local->verified.chv_80;
+    case 0x81: return app->app_local->verified.chv_81;
+    default: return 0;
+    }
+}
+
+
 /* Verify the card holder verification identified by KEYREF.  This is
  * either the Application PIN or the Global PIN.  If FORCE is true a
  * verification is always done.  */
@@ -1954,12 +2111,19 @@ verify_chv (app_t app, ctrl_t ctrl, int keyref, int force,
   char *pin = NULL;
   unsigned int pinlen, unpaddedpinlen;
 
+  /* A PIN we verified in this session needs no further check.  */
+  if (!force && is_verified (app, keyref))
+    return 0;
+
   /* First check whether a verify is at all needed.  */
   remaining = iso7816_verify_status (app_get_slot (app), keyref);
   if (remaining == ISO7816_VERIFY_NOT_NEEDED)
     {
       if (!force) /* No need to verification.  */
-        return 0;  /* All fine.  */
+        {
+          set_verified (app, keyref, 1);
+          return 0;  /* All fine.  */
+        }
       remaining = -1;
     }
   else if (remaining < 0)  /* We don't care about other errors. */
@@ -1978,9 +2142,13 @@ verify_chv (app_t app, ctrl_t ctrl, int keyref, int force,
       log_error ("CHV %02X verification failed: %s\n",
                  keyref, gpg_strerror (err));
       cache_pin (app, ctrl, keyref, NULL, 0);
+      set_verified (app, keyref, 0);
     }
   else
-    cache_pin (app, ctrl, keyref, pin, unpaddedpinlen);
+    {
+      cache_pin (app, ctrl, keyref, pin, unpaddedpinlen);
+      set_verified (app, keyref, 1);
+    }
 
   wipememory (pin, pinlen);
   xfree (pin);
@@ -2033,6 +2201,7 @@ do_change_chv (app_t app, ctrl_t ctrl, const char *pwidstr,
     }
 
   cache_pin (app, ctrl, keyref, NULL, 0);
+  set_verified (app, keyref, 0);
 
   /* First see whether the special --clear mode has been requested.  */
   if ((flags & APP_CHANGE_FLAG_CLEAR))
@@ -2368,13 +2537,21 @@ do_sign (app_t app, ctrl_t ctrl, const char *keyidstr, int hashalgo,
   if (err)
     goto leave;
 
-  /* Note: the -1 requests command chaining.  */
-  err = iso7816_general_authenticate (app_get_slot (app), -1,
+  /* Note: the -1 requests command chaining if extended length
+   * APDUs can't be used.  */
+  err = iso7816_general_authenticate (app_get_slot (app), ext_mode (app, -1),
                                       mechanism, keyref,
-                                      apdudata, (int)apdudatalen, 0,
+                                      apdudata, (int)apdudatalen,
+                                      ext_le (app),
                                       &outdata, &outdatalen);
   if (err)
-    goto leave;
+    {
+      /* The card may have lost the verification state; e.g. due to
+       * a PIN policy.  Check it again with the next operation.  */
+      if (gpg_err_code (err) == GPG_ERR_BAD_PIN)
+        set_verified (app, 0x80, 0);
+      goto leave;
+    }
 
   /* Parse the response.  */
   if (outdatalen && *outdata == 0x7c
@@ -2594,13 +2771,21 @@ do_decipher (app_t app, ctrl_t ctrl, const char *keyidstr,
   if (err)
     goto leave;
 
-  /* Note: the -1 requests command chaining.  */
-  err = iso7816_general_authenticate (app_get_slot (app), -1,
+  /* Note: the -1 requests command chaining if extended length
+   * APDUs can't be used.  */
+  err = iso7816_general_authenticate (app_get_slot (app), ext_mode (app, -1),
                                       mechanism, keyref,
-                                      apdudata, (int)apdudatalen, 0,
+                                      apdudata, (int)apdudatalen,
+                                      ext_le (app),
                                       &outdata, &outdatalen);
   if (err)
-    goto leave;
+    {
+      /* The card may have lost the verification state; e.g. due to
+       * a PIN policy.  Check it again with the next operation.  */
+      if (gpg_err_code (err) == GPG_ERR_BAD_PIN)
+        set_verified (app, 0x80, 0);
+      goto leave;
+    }
 
   /* Parse the response.  */
   if (outdatalen && *outdata == 0x7c
@@ -3283,8 +3468,10 @@ do_genkey (app_t app, ctrl_t ctrl, const char *keyrefstr, const char *keytype,
   tmpl[3] = 1;
   tmpl[4] = mechanism;
   tmpllen = 5;
-  err = iso7816_generate_keypair (app_get_slot (app), 0, 0, keyref,
-                                  tmpl, tmpllen, 0, &buffer, &buflen);
+  err = iso7816_generate_keypair (app_get_slot (app), ext_mode (app, 0),
+                                  0, keyref,
+                                  tmpl, tmpllen, ext_le (app),
+                                  &buffer, &buflen);
   if (err)
     {
       /* A PIN is not required, thus use a better error code.  */
@@ -3609,6 +3796,9 @@ do_reselect (app_t app, ctrl_t ctrl)
   if (!app->app_local->flags.yubikey)
     return gpg_error (GPG_ERR_NOT_SUPPORTED);
 
+  /* Selecting another application has reset the security status.  */
+  memset (&app->app_local->verified, 0, sizeof app->app_local->verified);
+
   err = iso7816_select_application (app_get_slot (app),
                                     piv_aid, sizeof piv_aid, 0x0001);
   return err;
@@ -3727,6 +3917,24 @@ app_select_piv (app_t app)
   if (app->card->cardtype == CARDTYPE_YUBIKEY)
     app->app_local->flags.yubikey = 1;
 
+  /* Check the card capabilities from the historical bytes so that we
+   * can read certificates with a single extended length APDU instead
+   * of a long series of GET RESPONSE commands.  */
+  {
+    unsigned char *atr;
+    size_t atrlen;
+    unsigned int caps;
+
+    atr = apdu_get_atr (slot, &atrlen);
+    if (atr && !atr_get_card_capabilities (atr, atrlen, &caps)
+        && (caps & 0x40))
+      app->app_local->flags.ext_lc_le = 1;
+    xfree (atr);
+    if (opt.verbose)
+      log_info ("piv: extended length APDUs %sused\n",
+                app->app_local->flags.ext_lc_le? "":"not ");
+  }
+
   /* If we don't have a s/n construct it from the CHUID.  */
   if (!APP_CARD(app)->serialno)
     {
@@ -88,6 +88,62 @@ static struct mrsw_lock card_list_lock;
  * (described by app_t) on the same physical token. */
 static card_t card_top;
 
+/* Number of seconds a card needs to be idle before the application
+ * last used for signing is re-selected.  */
+#define PRESELECT_IDLE_SECS 2
+
+/* Latency statistics for the app_ entry points; see app_get_stats.  */
+enum
+  {
+    APP_STATS_LEARN,
+    APP_STATS_READCERT,
+    APP_STATS_READKEY,
+    APP_STATS_GETATTR,
+    APP_STATS_SETATTR,
+    APP_STATS_SIGN,
+    APP_STATS_AUTH,
+    APP_STATS_DECIPHER,
+    APP_STATS_WRITECERT,
+    APP_STATS_WRITEKEY,
+    APP_STATS_GENKEY,
+    APP_STATS_CHANGE_PIN,
+    APP_STATS_CHECK_PIN,
+    APP_STATS_LAST
+  };
+static const char *app_stats_names[APP_STATS_LAST] =
+  {
+    "learn", "readcert", "readkey", "getattr", "setattr", "sign", "auth",
+    "decipher", "writecert", "writekey", "genkey", "change_pin", "check_pin"
+  };
+static struct scd_stats_s app_stats[APP_STATS_LAST];
+
+/* A small memory of the application which was selected for a card
+ * the last time it was seen.  The card is identified by its serial
+ * number or, if the card has no GDO, by its ATR.  This is used to
+ * try that application first when the card is inserted again.  */
+#define APP_PROBE_MEMORY_SIZE 16
+static struct
+{
+  unsigned char *key;
+  size_t keylen;
+  apptype_t apptype;
+} app_probe_memory[APP_PROBE_MEMORY_SIZE];
+static int app_probe_memory_next;
+
+/* Object used to probe one reader slot in select_application.  */
+struct card_probe_s
+{
+  struct card_probe_s *next;
+  int slot;
+  ctrl_t ctrl;
+  const char *name;
+  int have_thread; /* THREAD is valid.  */
+  npth_t thread;
+  int connected;   /* A card is present in the reader.  */
+  gpg_error_t err;
+  card_t card;     /* The new card object on success.  */
+};
+
 
 /* The list of application names and their select function.  If no
  * specific application is selected the first available application on
@@ -316,6 +372,21 @@ lock_card (card_t card, ctrl_t ctrl)
 }
 
 
+/* Same as lock_card but return GPG_ERR_EBUSY instead of waiting if
+ * the card is in use.  */
+static gpg_error_t
+trylock_card (card_t card, ctrl_t ctrl)
+{
+  if (npth_mutex_trylock (&card->lock))
+    return gpg_error (GPG_ERR_EBUSY);
+
+  apdu_set_progress_cb (card->slot, print_progress_line, ctrl);
+  apdu_set_prompt_cb (card->slot, popup_prompt, ctrl);
+
+  return 0;
+}
+
+
 /* Release a lock on a card.  See lock_reader(). */
 static void
 unlock_card (card_t card)
@@ -490,6 +561,44 @@ app_dump_state (void)
 }
 
 
+/* Return a malloced string with the statistics for GETINFO stats.
+ * There is one line "op:NAME:STATS" for each operation which has been
+ * used and one line for each open reader as described for
+ * apdu_get_stats.  STATS is described at scd_stats_string.  Note that
+ * the time of an operation includes the time to ask for a PIN.
+ * Returns NULL on error.  */
+char *
+app_get_stats (void)
+{
+  membuf_t mb;
+  char *p;
+  int i;
+
+  init_membuf (&mb, 512);
+  for (i = 0; i < APP_STATS_LAST; i++)
+    {
+      if (!app_stats[i].count)
+        continue;
+      p = scd_stats_string (&app_stats[i]);
+      if (!p)
+        {
+          xfree (get_membuf (&mb, NULL));
+          return NULL;
+        }
+      put_membuf_printf (&mb, "op:%s:%s\n", app_stats_names[i], p);
+      xfree (p);
+    }
+  p = apdu_get_stats ();
+  if (p)
+    {
+      put_membuf_str (&mb, p);
+      xfree (p);
+    }
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
 /*
  * Send information for all available cards.
  *
@@ -682,9 +791,94 @@ atr_to_cardtype (int slot, const unsigned char *atr, size_t atrlen)
 
 
 
+/* Return a malloced key to identify CARD in the app probe memory.
+ * This is the serial number or, if not available, the ATR.  */
+static unsigned char *
+app_probe_memory_key (card_t card, size_t *r_keylen)
+{
+  unsigned char *key;
+
+  if (card->serialno && card->serialnolen)
+    {
+      key = xtrymalloc (card->serialnolen);
+      if (key)
+        {
+          memcpy (key, card->serialno, card->serialnolen);
+          *r_keylen = card->serialnolen;
+        }
+      return key;
+    }
+
+  return apdu_get_atr (card->slot, r_keylen);
+}
+
+
+/* Return the application type recorded for (KEY,KEYLEN) or
+ * APPTYPE_NONE.  */
+static apptype_t
+app_probe_memory_get (const unsigned char *key, size_t keylen)
+{
+  int i;
+
+  if (!key)
+    return APPTYPE_NONE;
+  for (i=0; i < APP_PROBE_MEMORY_SIZE; i++)
+    if (app_probe_memory[i].key && app_probe_memory[i].keylen == keylen
+        && !memcmp (app_probe_memory[i].key, key, keylen))
+      return app_probe_memory[i].apptype;
+  return APPTYPE_NONE;
+}
+
+
+/* Record that application APPTYPE has been selected for the card
+ * identified by (KEY,KEYLEN).  The key is computed before application
+ * selection because the selection may update the serial number.
+ * Takes ownership of KEY.  */
+static void
+app_probe_memory_put (unsigned char *key, size_t keylen, apptype_t apptype)
+{
+  int i;
+
+  if (!key)
+    return;
+  for (i=0; i < APP_PROBE_MEMORY_SIZE; i++)
+    if (app_probe_memory[i].key && app_probe_memory[i].keylen == keylen
+        && !memcmp (app_probe_memory[i].key, key, keylen))
+      break;
+  if (i == APP_PROBE_MEMORY_SIZE)
+    {
+      i = app_probe_memory_next;
+      app_probe_memory_next = (i + 1) % APP_PROBE_MEMORY_SIZE;
+    }
+  xfree (app_probe_memory[i].key);
+  app_probe_memory[i].key = key;
+  app_probe_memory[i].keylen = keylen;
+  app_probe_memory[i].apptype = apptype;
+}
+
+
+/* Return the application to try first for a card of CARDTYPE.  Only
+ * tokens which are known to carry just one application are listed so
+ * that this does not change the outcome of the priority list.  */
+static apptype_t
+cardtype_to_apptype (cardtype_t cardtype)
+{
+  switch (cardtype)
+    {
+    case CARDTYPE_GNUK:
+    case CARDTYPE_ZEITCONTROL: return APPTYPE_OPENPGP;
+    default: return APPTYPE_NONE;
+    }
+}
+
+
+/* Allocate a new card object for SLOT and select an application.  On
+ * success the new card is stored at R_CARD; it is not yet linked into
+ * the list of cards.  This function does not require the card list
+ * lock and may thus be run for several slots concurrently.  */
 static gpg_error_t
 app_new_register (int slot, ctrl_t ctrl, const char *name,
-                  int periodical_check_needed)
+                  int periodical_check_needed, card_t *r_card)
 {
   gpg_error_t err = 0;
   card_t card = NULL;
@@ -692,8 +886,13 @@ app_new_register (int slot, ctrl_t ctrl, const char *name,
   unsigned char *result = NULL;
   size_t resultlen;
   int want_undefined;
+  apptype_t first_apptype = APPTYPE_NONE;
+  unsigned char *memkey = NULL;
+  size_t memkeylen = 0;
   int i;
 
+  *r_card = NULL;
+
   /* Need to allocate a new card object  */
   card = xtrycalloc (1, sizeof *card);
   if (!card)
@@ -893,16 +1092,50 @@ app_new_register (int slot, ctrl_t ctrl, const char *name,
       /* Set a default error so that we run through the application
        * selection chain.  */
       err = gpg_error (GPG_ERR_NOT_FOUND);
+
+      /* Without a requested NAME, first try the application found the
+       * last time this card was seen or the one indicated by the
+       * ATR.  This avoids running the select commands of all the
+       * other applications.  */
+      if (!name)
+        {
+          memkey = app_probe_memory_key (card, &memkeylen);
+          first_apptype = app_probe_memory_get (memkey, memkeylen);
+          if (!first_apptype)
+            first_apptype = cardtype_to_apptype (card->cardtype);
+        }
+    }
+
+  if (first_apptype)
+    {
+      for (i=0; app_priority_list[i].name; i++)
+        if (app_priority_list[i].apptype == first_apptype)
+          break;
+      if (app_priority_list[i].name
+          && is_app_allowed (app_priority_list[i].name))
+        {
+          if (opt.verbose)
+            log_info ("trying application '%s' first\n",
+                      app_priority_list[i].name);
+          err = app_priority_list[i].select_func (app);
+        }
     }
 
   /* Find the first available app if NAME is NULL or the matching
    * NAME but only if that application is also enabled.  */
   for (i=0; err && app_priority_list[i].name; i++)
     {
+      if (app_priority_list[i].apptype == first_apptype)
+        continue;
       if (is_app_allowed (app_priority_list[i].name)
           && (!name || !strcmp (name, app_priority_list[i].name)))
         err = app_priority_list[i].select_func (app);
     }
+  if (!err && memkey)
+    {
+      app_probe_memory_put (memkey, memkeylen, app->apptype);
+      memkey = NULL;
+    }
   if (err && name && gpg_err_code (err) != GPG_ERR_OBJ_TERM_STATE)
     err = gpg_error (GPG_ERR_NOT_SUPPORTED);
 
@@ -916,20 +1149,47 @@ app_new_register (int slot, ctrl_t ctrl, const char *name,
         log_info ("no supported card application found: %s\n",
                   gpg_strerror (err));
       unlock_card (card);
+      xfree (memkey);
       xfree (app);
       xfree (card);
       return err;
     }
 
   card->periodical_check_needed = periodical_check_needed;
-  card->next = card_top;
-  card_top = card;
-
   unlock_card (card);
+  *r_card = card;
   return 0;
 }
 
 
+/* Connect to the card in the reader of PROBE and register it.  */
+static void
+probe_slot (struct card_probe_s *probe)
+{
+  int periodical_check_needed;
+
+  periodical_check_needed = apdu_connect (probe->slot);
+  if (periodical_check_needed < 0)
+    {
+      /* We close a reader with no card.  */
+      probe->err = gpg_error (GPG_ERR_ENODEV);
+      return;
+    }
+
+  probe->connected = 1;
+  probe->err = app_new_register (probe->slot, probe->ctrl, probe->name,
+                                 periodical_check_needed, &probe->card);
+}
+
+
+static void *
+probe_slot_thread (void *arg)
+{
+  probe_slot (arg);
+  return NULL;
+}
+
+
 /* If called with NAME as NULL, select the best fitting application
  * and return its card context; otherwise select the application with
  * NAME and return its card context.  Returns an error code and stores
@@ -948,6 +1208,8 @@ select_application (ctrl_t ctrl, const char *name,
     {
       struct dev_list *l;
       int new_card = 0;
+      struct card_probe_s *probes = NULL;
+      struct card_probe_s *probe, **probe_tail = &probes;
 
       npth_mutex_lock (&new_card_lock);
       /* Scan the devices to find new device(s).  */
@@ -958,38 +1220,85 @@ select_application (ctrl_t ctrl, const char *name,
           return err;
         }
 
+      /* Open all readers first so that the cards can be probed
+       * concurrently; with many readers running the select commands
+       * one after the other takes seconds.  */
       while (1)
         {
           int slot;
-          int periodical_check_needed_this;
 
           slot = apdu_open_reader (l);
           if (slot < 0)
             break;
 
-          periodical_check_needed_this = apdu_connect (slot);
-          if (periodical_check_needed_this < 0)
+          probe = xtrycalloc (1, sizeof *probe);
+          if (!probe)
             {
-              /* We close a reader with no card.  */
-              err = gpg_error (GPG_ERR_ENODEV);
+              err = gpg_error_from_syserror ();
+              log_error ("error allocating probe object: %s\n",
+                         gpg_strerror (err));
+              apdu_close_reader (slot);
+              break;
             }
-          else
+          probe->slot = slot;
+          probe->ctrl = ctrl;
+          probe->name = name;
+          *probe_tail = probe;
+          probe_tail = &probe->next;
+        }
+
+      apdu_dev_list_finish (l);
+
+      if (probes && probes->next)
+        {
+          npth_attr_t tattr;
+
+          if (!npth_attr_init (&tattr))
+            {
+              npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+              for (probe = probes; probe; probe = probe->next)
+                if (!npth_create (&probe->thread, &tattr,
+                                  probe_slot_thread, probe))
+                  probe->have_thread = 1;
+              npth_attr_destroy (&tattr);
+            }
+        }
+
+      /* Run the probes for which no thread could be created and wait
+       * for the others.  */
+      for (probe = probes; probe; probe = probe->next)
+        if (!probe->have_thread)
+          probe_slot (probe);
+      for (probe = probes; probe; probe = probe->next)
+        if (probe->have_thread)
+          npth_join (probe->thread, NULL);
+
+      /* Link the new cards in the order of the slots.  */
+      card_list_w_lock ();
+      for (probe = probes; probe; probe = probe->next)
+        {
+          if (probe->connected)
+            new_card++;
+          if (probe->card)
             {
-              card_list_w_lock ();
-              err = app_new_register (slot, ctrl, name,
-                                      periodical_check_needed_this);
-              card_list_w_unlock ();
-              new_card++;
+              probe->card->next = card_top;
+              card_top = probe->card;
             }
+        }
+      card_list_w_unlock ();
 
+      while ((probe = probes))
+        {
+          probes = probe->next;
+          err = probe->err;
           if (err)
             {
-              pincache_put (ctrl, slot, NULL, NULL, NULL, 0);
-              apdu_close_reader (slot);
+              pincache_put (ctrl, probe->slot, NULL, NULL, NULL, 0);
+              apdu_close_reader (probe->slot);
             }
+          xfree (probe);
         }
 
-      apdu_dev_list_finish (l);
       npth_mutex_unlock (&new_card_lock);
 
       /* If new device(s), kick the scdaemon loop.  */
@@ -1341,69 +1650,149 @@ deallocate_card (card_t card)
 }
 
 
+/* Run the keygrip ACTION on the apps of the locked card C.  Returns
+ * the app for which the action succeeded or NULL.  */
+static app_t
+card_with_keygrip (ctrl_t ctrl, card_t c, int action,
+                   const char *keygrip_str, int capability)
+{
+  app_t a, a_prev;
+
+  a_prev = NULL;
+  for (a = c->app; a; a = a->next)
+    {
+      if (!a->fnc.with_keygrip || a->need_reset)
+        continue;
+
+      /* Note that we need to do a re-select even for the current
+       * app because the last selected application (e.g. after
+       * init) might be a different one and we do not run
+       * maybe_switch_app here.  Of course we we do this only iff
+       * we have an additional app. */
+      if (c->app->next)
+        {
+          if (run_reselect (ctrl, c, a, a_prev))
+            continue;
+        }
+      a_prev = a;
+
+      if (DBG_APP)
+        log_debug ("slot %d, app %s: calling with_keygrip(%s)\n",
+                   c->slot, xstrapptype (a),
+                   action == KEYGRIP_ACTION_SEND_DATA? "send_data":
+                   action == KEYGRIP_ACTION_WRITE_STATUS? "status":
+                   action == KEYGRIP_ACTION_LOOKUP? "lookup":"?");
+      if (!a->fnc.with_keygrip (a, ctrl, action, keygrip_str, capability))
+        return a; /* ACTION_LOOKUP succeeded.  */
+    }
+
+  /* Select the first app again.  */
+  if (c->app->next)
+    run_reselect (ctrl, c, c->app, a_prev);
+
+  return NULL;
+}
+
+
 static card_t
 do_with_keygrip (ctrl_t ctrl, int action, const char *keygrip_str,
                  int capability)
 {
-  int locked = 0;
   card_t c;
-  app_t a, a_prev;
+  app_t a = NULL;
 
   for (c = card_top; c; c = c->next)
     {
       if (lock_card (c, ctrl))
-        {
-          c = NULL;
-          goto leave_the_loop;
-        }
-      locked = 1;
-      a_prev = NULL;
-      for (a = c->app; a; a = a->next)
-        {
-          if (!a->fnc.with_keygrip || a->need_reset)
-            continue;
+        return NULL;
+      a = card_with_keygrip (ctrl, c, action, keygrip_str, capability);
+      if (a)
+        break;
+      unlock_card (c);
+    }
 
-          /* Note that we need to do a re-select even for the current
-           * app because the last selected application (e.g. after
-           * init) might be a different one and we do not run
-           * maybe_switch_app here.  Of course we we do this only iff
-           * we have an additional app. */
-          if (c->app->next)
-            {
-              if (run_reselect (ctrl, c, a, a_prev))
-                continue;
-            }
-          a_prev = a;
+  if (c)
+    {
+      /* Force switching of the app if the selected one is not the
+       * current one.  Changing the current apptype is sufficient to
+       * do this.  */
+      if (c->app && c->app->apptype != a->apptype)
+        ctrl->current_apptype = a->apptype;
+      unlock_card (c);
+    }
+  return c;
+}
 
-          if (DBG_APP)
-            log_debug ("slot %d, app %s: calling with_keygrip(%s)\n",
-                       c->slot, xstrapptype (a),
-                       action == KEYGRIP_ACTION_SEND_DATA? "send_data":
-                       action == KEYGRIP_ACTION_WRITE_STATUS? "status":
-                       action == KEYGRIP_ACTION_LOOKUP? "lookup":"?");
-          if (!a->fnc.with_keygrip (a, ctrl, action, keygrip_str, capability))
-            goto leave_the_loop; /* ACTION_LOOKUP succeeded.  */
-        }
 
-      /* Select the first app again.  */
-      if (c->app->next)
-        run_reselect (ctrl, c, c->app, a_prev);
+/* Return true if KEYGRIP has recently been found on card C.  */
+static int
+pool_has_keygrip (card_t c, const char *keygrip)
+{
+  int i;
+
+  for (i=0; i < DIM (c->pool_grips); i++)
+    if (!strcmp (c->pool_grips[i], keygrip))
+      return 1;
+  return 0;
+}
+
+
+/* Find and lock a card holding KEYGRIP for the card pool mode.  The
+ * first card not in use which has the key is taken.  If all cards
+ * with that key are busy we queue on the one with the fewest waiting
+ * requests.  Returns NULL if no card was found this way; the caller
+ * should then use the standard lookup.  The card list must be
+ * locked.  */
+static card_t
+pool_card_get (ctrl_t ctrl, const char *keygrip)
+{
+  card_t c, best = NULL;
+  app_t a;
+  gpg_error_t err;
+
+  if (strlen (keygrip) != 40)
+    return NULL;
 
+  for (c = card_top; c; c = c->next)
+    {
+      if (trylock_card (c, ctrl))
+        continue;
+      a = card_with_keygrip (ctrl, c, KEYGRIP_ACTION_LOOKUP, keygrip, 0);
+      if (a)
+        goto found;
       unlock_card (c);
-      locked = 0;
     }
 
- leave_the_loop:
-  /* Force switching of the app if the selected one is not the current
-   * one.  Changing the current apptype is sufficient to do this.  */
-  if (c && c->app && c->app->apptype != a->apptype)
-    ctrl->current_apptype = a->apptype;
+  for (c = card_top; c; c = c->next)
+    if (pool_has_keygrip (c, keygrip)
+        && (!best || c->pool_waiting < best->pool_waiting))
+      best = c;
+  if (!best)
+    return NULL;
 
-  if (locked && c)
+  c = best;
+  c->pool_waiting++;
+  err = lock_card (c, ctrl);
+  c->pool_waiting--;
+  if (err)
+    return NULL;
+  a = card_with_keygrip (ctrl, c, KEYGRIP_ACTION_LOOKUP, keygrip, 0);
+  if (!a)
     {
       unlock_card (c);
-      locked = 0;
+      return NULL;
+    }
+
+ found:
+  if (!pool_has_keygrip (c, keygrip))
+    {
+      strcpy (c->pool_grips[c->pool_next_grip], keygrip);
+      c->pool_next_grip = (c->pool_next_grip + 1) % DIM (c->pool_grips);
     }
+  if (c->app && c->app->apptype != a->apptype)
+    ctrl->current_apptype = a->apptype;
+  if (DBG_APP)
+    log_debug ("slot %d: selected from the card pool\n", c->slot);
   return c;
 }
 
@@ -1415,6 +1804,12 @@ card_get (ctrl_t ctrl, const char *keygrip)
   card_t card;
 
   card_list_r_lock ();
+  if (keygrip && opt.card_pool)
+    {
+      card = pool_card_get (ctrl, keygrip);
+      if (card)
+        return card;  /* Already locked.  */
+    }
   if (keygrip)
     card = do_with_keygrip (ctrl, KEYGRIP_ACTION_LOOKUP, keygrip, 0);
   else
@@ -1791,6 +2186,8 @@ maybe_switch_app (ctrl_t ctrl, card_t card, const char *keyref)
   if (!card->app)
     return gpg_error (GPG_ERR_CARD_NOT_INITIALIZED);
 
+  card->last_use = gnupg_get_time ();
+
   if (card->maybe_check_aid && card->app->fnc.reselect
       && check_external_interference (card->app, ctrl))
     {
@@ -1898,6 +2295,57 @@ maybe_switch_app (ctrl_t ctrl, card_t card, const char *keyref)
 
   ctrl->current_apptype = app->apptype;
 
+  /* Switch back to the signing application when the card is idle
+   * again; see maybe_preselect_sign_app.  */
+  if (card->sign_apptype && app->apptype != card->sign_apptype)
+    {
+      card->preselect_pending = 1;
+      scd_kick_the_loop ();
+    }
+
+  return 0;
+}
+
+
+/* If another application than the one last used for signing is
+ * active on CARD and the card has been idle for some time, re-select
+ * the signing application so that the next signature request does
+ * not need to switch applications.  Returns true if this needs to be
+ * checked again later.  This function must be called with the card
+ * lock held.  */
+static int
+maybe_preselect_sign_app (card_t card)
+{
+  app_t app, app_prev;
+
+  if (!card->preselect_pending)
+    return 0;
+  if (!card->app || card->app->apptype == card->sign_apptype)
+    {
+      card->preselect_pending = 0;
+      return 0;
+    }
+  if (gnupg_get_time () - card->last_use < PRESELECT_IDLE_SECS)
+    return 1;
+  card->preselect_pending = 0;
+
+  app_prev = card->app;
+  for (app = app_prev->next; app; app_prev = app, app = app->next)
+    if (app->apptype == card->sign_apptype)
+      break;
+  if (!app || app->need_reset)
+    return 0;
+
+  if (run_reselect (NULL, card, app, card->app))
+    return 0;
+
+  app_prev->next = app->next;
+  app->next = card->app;
+  card->app = app;
+
+  if (opt.verbose)
+    log_info ("slot %d, app %s: pre-selected for signing\n",
+              card->slot, xstrapptype (app));
   return 0;
 }
 
@@ -1940,6 +2388,7 @@ gpg_error_t
 app_write_learn_status (card_t card, ctrl_t ctrl, unsigned int flags)
 {
   gpg_error_t err, err2, tmperr;
+  unsigned long long started = scd_stats_now ();
   app_t app, last_app;
   int any_reselect = 0;
 
@@ -2004,6 +2453,7 @@ app_write_learn_status (card_t card, ctrl_t ctrl, unsigned int flags)
         }
     }
 
+  scd_stats_add (&app_stats[APP_STATS_LEARN], started, !!err);
   return err;
 }
 
@@ -2017,6 +2467,7 @@ app_readcert (card_t card, ctrl_t ctrl, const char *certid,
               unsigned char **cert, size_t *certlen)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if ((err = maybe_switch_app (ctrl, card, certid)))
     ;
@@ -2033,6 +2484,7 @@ app_readcert (card_t card, ctrl_t ctrl, const char *certid,
         err = card->app->fnc.readcert (card->app, certid, cert, certlen);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_READCERT], started, !!err);
   return err;
 }
 
@@ -2050,6 +2502,7 @@ app_readkey (card_t card, ctrl_t ctrl, const char *keyid, unsigned int flags,
              unsigned char **pk, size_t *pklen)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (pk)
     *pk = NULL;
@@ -2074,6 +2527,7 @@ app_readkey (card_t card, ctrl_t ctrl, const char *keyid, unsigned int flags,
         err = card->app->fnc.readkey (card->app, ctrl, keyid, flags, pk, pklen);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_READKEY], started, !!err);
   return err;
 }
 
@@ -2083,6 +2537,7 @@ gpg_error_t
 app_getattr (card_t card, ctrl_t ctrl, const char *name)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!name || !*name)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2123,6 +2578,7 @@ app_getattr (card_t card, ctrl_t ctrl, const char *name)
         err = card->app->fnc.getattr (card->app, ctrl, name);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_GETATTR], started, !!err);
   return err;
 }
 
@@ -2135,6 +2591,7 @@ app_setattr (card_t card, ctrl_t ctrl, const char *name,
              const unsigned char *value, size_t valuelen)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!name || !*name || !value)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2155,6 +2612,7 @@ app_setattr (card_t card, ctrl_t ctrl, const char *name,
                                       value, valuelen);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_SETATTR], started, !!err);
   return err;
 }
 
@@ -2170,6 +2628,7 @@ app_sign (card_t card, ctrl_t ctrl, const char *keyidstr, int hashalgo,
           unsigned char **outdata, size_t *outdatalen )
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!indata || !indatalen || !outdata || !outdatalen || !pincb)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2190,8 +2649,11 @@ app_sign (card_t card, ctrl_t ctrl, const char *keyidstr, int hashalgo,
                                    pincb, pincb_arg,
                                    indata, indatalen,
                                    outdata, outdatalen);
+      if (!err)
+        card->sign_apptype = card->app->apptype;
     }
 
+  scd_stats_add (&app_stats[APP_STATS_SIGN], started, !!err);
   if (opt.verbose)
     log_info ("operation sign result: %s\n", gpg_strerror (err));
   return err;
@@ -2210,6 +2672,7 @@ app_auth (card_t card, ctrl_t ctrl, const char *keyidstr,
           unsigned char **outdata, size_t *outdatalen )
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!outdata || !outdatalen || !pincb)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2236,6 +2699,7 @@ app_auth (card_t card, ctrl_t ctrl, const char *keyidstr,
                                    outdata, outdatalen);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_AUTH], started, !!err);
   if (opt.verbose)
     log_info ("operation auth result: %s\n", gpg_strerror (err));
   return err;
@@ -2254,6 +2718,7 @@ app_decipher (card_t card, ctrl_t ctrl, const char *keyidstr,
               unsigned int *r_info)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   *r_info = 0;
 
@@ -2279,6 +2744,7 @@ app_decipher (card_t card, ctrl_t ctrl, const char *keyidstr,
                                        r_info);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_DECIPHER], started, !!err);
   if (opt.verbose)
     log_info ("operation decipher result: %s\n", gpg_strerror (err));
   return err;
@@ -2294,6 +2760,7 @@ app_writecert (card_t card, ctrl_t ctrl,
                const unsigned char *data, size_t datalen)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!certidstr || !*certidstr || !pincb)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2314,6 +2781,7 @@ app_writecert (card_t card, ctrl_t ctrl,
                                         pincb, pincb_arg, data, datalen);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_WRITECERT], started, !!err);
   if (opt.verbose)
     log_info ("operation writecert result: %s\n", gpg_strerror (err));
   return err;
@@ -2329,6 +2797,7 @@ app_writekey (card_t card, ctrl_t ctrl,
               const unsigned char *keydata, size_t keydatalen)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!keyidstr || !*keyidstr || !pincb)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2349,6 +2818,7 @@ app_writekey (card_t card, ctrl_t ctrl,
                                        pincb, pincb_arg, keydata, keydatalen);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_WRITEKEY], started, !!err);
   if (opt.verbose)
     log_info ("operation writekey result: %s\n", gpg_strerror (err));
   return err;
@@ -2363,6 +2833,7 @@ app_genkey (card_t card, ctrl_t ctrl, const char *keynostr,
             void *pincb_arg)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!keynostr || !*keynostr || !pincb)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2383,6 +2854,7 @@ app_genkey (card_t card, ctrl_t ctrl, const char *keynostr,
                                      createtime, pincb, pincb_arg);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_GENKEY], started, !!err);
   if (opt.verbose)
     log_info ("operation genkey result: %s\n", gpg_strerror (err));
   return err;
@@ -2412,6 +2884,7 @@ app_change_pin (card_t card, ctrl_t ctrl, const char *chvnostr,
                 void *pincb_arg)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!chvnostr || !*chvnostr || !pincb)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2432,6 +2905,7 @@ app_change_pin (card_t card, ctrl_t ctrl, const char *chvnostr,
                                          chvnostr, flags, pincb, pincb_arg);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_CHANGE_PIN], started, !!err);
   if (opt.verbose)
     log_info ("operation change_pin result: %s\n", gpg_strerror (err));
   return err;
@@ -2447,6 +2921,7 @@ app_check_pin (card_t card, ctrl_t ctrl, const char *keyidstr,
                void *pincb_arg)
 {
   gpg_error_t err;
+  unsigned long long started = scd_stats_now ();
 
   if (!keyidstr || !*keyidstr || !pincb)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -2467,6 +2942,7 @@ app_check_pin (card_t card, ctrl_t ctrl, const char *keyidstr,
                                         pincb, pincb_arg);
     }
 
+  scd_stats_add (&app_stats[APP_STATS_CHECK_PIN], started, !!err);
   if (opt.verbose)
     log_info ("operation check_pin result: %s\n", gpg_strerror (err));
   return err;
@@ -2605,6 +3081,8 @@ scd_update_reader_status_file (void)
         {
           if (card->periodical_check_needed)
             periodical_check_needed = 1;
+          if (maybe_preselect_sign_app (card))
+            periodical_check_needed = 1;
           unlock_card (card);
         }
     }
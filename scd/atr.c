@@ -287,3 +287,83 @@ atr_dump (const void *buffer, size_t buflen)
 
   return result;
 }
+
+
+/* Parse the ATR in (BUFFER,BUFLEN) and return the third software
+ * function table byte of the card capabilities (compact-TLV tag 0x73
+ * of the historical bytes, ISO 7816-4, 8.1.1.2.7) at R_CAPS.  Bit 0x80
+ * of that byte indicates command chaining and bit 0x40 extended Lc
+ * and Le fields.  Returns 0 on success or -1 if the ATR does not
+ * provide the card capabilities.  */
+int
+atr_get_card_capabilities (const void *buffer, size_t buflen,
+                           unsigned int *r_caps)
+{
+  const unsigned char *atr = buffer;
+  size_t atrlen = buflen;
+  int have_ta, have_tb, have_tc, have_td;
+  size_t n_historical;
+  unsigned int tag, len;
+
+  *r_caps = 0;
+
+  /* Skip TS and get the format character T0.  */
+  if (atrlen < 2)
+    return -1;
+  atr++;
+  atrlen--;
+  n_historical = (*atr & 0x0f);
+  have_td = 1;
+  while (have_td)
+    {
+      have_ta = !!(*atr & 0x10);
+      have_tb = !!(*atr & 0x20);
+      have_tc = !!(*atr & 0x40);
+      have_td = !!(*atr & 0x80);
+      atr++;
+      atrlen--;
+      if (have_ta + have_tb + have_tc + have_td > atrlen)
+        return -1;
+      atr += have_ta + have_tb + have_tc;
+      atrlen -= have_ta + have_tb + have_tc;
+      /* If TDi is present ATR now points to it and the loop takes
+       * the indicators of the next interface bytes from there.  */
+    }
+
+  if (n_historical > atrlen || n_historical < 2)
+    return -1;
+  atrlen = n_historical;
+
+  /* Only the category indicators 0x00 and 0x80 use compact-TLV
+   * objects.  With 0x00 the last three bytes are the status
+   * indicator.  */
+  if (*atr == 0x00)
+    {
+      if (atrlen < 4)
+        return -1;
+      atrlen -= 3;
+    }
+  else if (*atr != 0x80)
+    return -1;
+  atr++;
+  atrlen--;
+
+  while (atrlen)
+    {
+      tag = (*atr & 0xf0) >> 4;
+      len = (*atr & 0x0f);
+      if (len + 1 > atrlen)
+        return -1;
+      atr++;
+      atrlen--;
+      if (tag == 7 && len == 3)
+        {
+          *r_caps = atr[2];
+          return 0;
+        }
+      atr += len;
+      atrlen -= len;
+    }
+
+  return -1;
+}
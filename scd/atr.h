@@ -21,6 +21,8 @@
 #define ATR_H
 
 char *atr_dump (const void *buffer, size_t buflen);
+int atr_get_card_capabilities (const void *buffer, size_t buflen,
+                               unsigned int *r_caps);
 
 
 
@@ -42,6 +42,7 @@
 #include "../common/asshelp.h"
 #include "../common/server-help.h"
 #include "../common/ssh-utils.h"
+#include "../common/metrics.h"
 
 /* Maximum length allowed as a PIN; used for INQUIRE NEEDPIN.  That
  * length needs to small compared to the maximum Assuan line length.  */
@@ -190,6 +191,32 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  metrics_command_begin (ctx, cmd);
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  const char *name;
+
+  (void)err;
+
+  metrics_command_end (ctx);
+
+  /* An output descriptor is only used by the next command.  */
+  name = assuan_get_command_name (ctx);
+  if (!name || strcmp (name, "OUTPUT"))
+    assuan_close_output_fd (ctx);
+}
+
+
 static gpg_error_t
 option_handler (assuan_context_t ctx, const char *key, const char *value)
 {
@@ -636,7 +663,9 @@ cmd_learn (assuan_context_t ctx, char *line)
 static const char hlp_readcert[] =
   "READCERT <hexified_certid>|<keyid>|<oid>\n"
   "\n"
-  "Note, that this function may even be used on a locked card.";
+  "Note, that this function may even be used on a locked card.\n"
+  "If an OUTPUT descriptor has been set, the certificate is written\n"
+  "to it instead of being returned as D lines.";
 static gpg_error_t
 cmd_readcert (assuan_context_t ctx, char *line)
 {
@@ -672,7 +701,7 @@ cmd_readcert (assuan_context_t ctx, char *line)
   line = NULL;
   if (!rc)
     {
-      rc = assuan_send_data (ctx, cert, ncert);
+      rc = send_data_or_output (ctx, cert, ncert);
       xfree (cert);
       if (rc)
         return rc;
@@ -756,7 +785,8 @@ static const char hlp_readkey[] =
   "S-expression.  With --format option, it may be returned in advanced\n"
   "S-expression format, or SSH format.  With --info a KEYPAIRINFO\n"
   "status line is also emitted; with --info-only the regular output is\n"
-  "suppressed.";
+  "suppressed.  An S-expression is written to the OUTPUT descriptor\n"
+  "if one has been set.";
 static gpg_error_t
 cmd_readkey (assuan_context_t ctx, char *line)
 {
@@ -869,7 +899,7 @@ cmd_readkey (assuan_context_t ctx, char *line)
       xfree (pkadv);
     }
   else
-    err = assuan_send_data (ctx, pk, pklen);
+    err = send_data_or_output (ctx, pk, pklen);
 
  leave:
   xfree (pk);
@@ -1881,7 +1911,13 @@ static const char hlp_getinfo[] =
   "  manufacturer NUMBER\n"
   "              - Return a description of the OpenPGP manufacturer id.\n"
   "  apdu_strerror NUMBER\n"
-  "              - Return a string for a status word.\n";
+  "              - Return a string for a status word.\n"
+  "  stats       - Return latency statistics of the operations and of\n"
+  "                the APDU exchanges of all open readers.\n"
+  "  metrics     - Return the metrics in the Prometheus text format.\n"
+  "  cmdstats [--reset]\n"
+  "              - Return the statistics of the commands and optionally\n"
+  "                reset them.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -2022,6 +2058,38 @@ cmd_getinfo (assuan_context_t ctx, char *line)
     {
       app_dump_state ();
     }
+  else if (!strcmp (line, "stats"))
+    {
+      char *p = app_get_stats ();
+
+      if (!p)
+        rc = gpg_error_from_syserror ();
+      else if (*p)
+        rc = assuan_send_data (ctx, p, strlen (p));
+      xfree (p);
+    }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *p = metrics_format ();
+
+      if (!p)
+        rc = gpg_error_from_syserror ();
+      else
+        rc = assuan_send_data (ctx, p, strlen (p));
+      xfree (p);
+    }
+  else if (!strcmp (line, "cmdstats") || !strcmp (line, "cmdstats --reset"))
+    {
+      char *p = metrics_format_cmdstats ();
+
+      if (!p)
+        rc = gpg_error_from_syserror ();
+      else
+        rc = assuan_send_data (ctx, p, strlen (p));
+      xfree (p);
+      if (!rc && line[8])
+        metrics_reset_commands ();
+    }
   else
     rc = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
   return rc;
@@ -2480,6 +2548,8 @@ register_commands (assuan_context_t ctx)
   assuan_set_hello_line (ctx, "GNU Privacy Guard's Smartcard server ready");
 
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_option_handler (ctx, option_handler);
   return 0;
 }
@@ -56,6 +56,7 @@
 #include "../common/exechelp.h"
 #include "../common/comopt.h"
 #include "../common/init.h"
+#include "../common/metrics.h"
 
 #ifndef ENAMETOOLONG
 # define ENAMETOOLONG EINVAL
@@ -96,6 +97,7 @@ enum cmd_and_opt_values
   octapiDriver,
   opcscDriver,
   opcscShared,
+  oCardPool,
   oDisableCCID,
   oDisableOpenSC,
   oDisablePinpad,
@@ -155,6 +157,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (opcscDriver, "pcsc-driver",
                 N_("|NAME|use NAME as PC/SC driver")),
   ARGPARSE_s_n (opcscShared, "pcsc-shared", "@"),
+  ARGPARSE_s_n (oCardPool, "card-pool", "@"),
   ARGPARSE_s_n (oDisableCCID, "disable-ccid",
 #ifdef HAVE_LIBUSB
                                     N_("do not use the internal CCID driver")
@@ -440,6 +443,26 @@ setup_signal_mask (void)
 #endif
 }
 
+
+/* The post system call clamp.  This also accounts the time spent
+ * waiting for the nPth lock.  */
+static void
+post_syscall (void)
+{
+  unsigned long long start = metrics_clock ();
+
+  npth_protect ();
+  metrics_lock_wait (start);
+}
+
+
+static unsigned long long
+metric_connections (void)
+{
+  return active_connections;
+}
+
+
 int
 main (int argc, char **argv )
 {
@@ -614,6 +637,7 @@ main (int argc, char **argv )
         case octapiDriver: opt.ctapi_driver = pargs.r.ret_str; break;
         case opcscDriver: opt.pcsc_driver = pargs.r.ret_str; break;
         case opcscShared: opt.pcsc_shared = 1; break;
+        case oCardPool: opt.card_pool = 1; break;
         case oDisableCCID: opt.disable_ccid = 1; break;
         case oDisableOpenSC: break;
 
@@ -714,6 +738,10 @@ main (int argc, char **argv )
 
   set_debug (debug_level);
 
+  metrics_init ("lcr_scdaemon");
+  metrics_fnc ("connections", METRIC_GAUGE,
+               "Number of active connections.", metric_connections);
+
   if (initialize_module_command ())
     {
       log_error ("initialization failed\n");
@@ -775,7 +803,7 @@ main (int argc, char **argv )
 
       npth_init ();
       setup_signal_mask ();
-      gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+      gpgrt_set_syscall_clamp (npth_unprotect, post_syscall);
       assuan_control (ASSUAN_CONTROL_REINIT_SYSCALL_CLAMP, NULL);
 
       /* If --debug-allow-core-dump has been given we also need to
@@ -917,7 +945,7 @@ main (int argc, char **argv )
 
       npth_init ();
       setup_signal_mask ();
-      gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+      gpgrt_set_syscall_clamp (npth_unprotect, post_syscall);
       assuan_control (ASSUAN_CONTROL_REINIT_SYSCALL_CLAMP, NULL);
 
       /* Detach from tty and put process into a new session. */
@@ -1268,6 +1296,64 @@ start_connection_thread (void *arg)
 }
 
 
+/* Return a monotonic time stamp in microseconds for use with
+ * scd_stats_add.  */
+unsigned long long
+scd_stats_now (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  return (unsigned long long)gnupg_get_time () * 1000000;
+}
+
+
+/* Account an operation started at STARTED (as returned by
+ * scd_stats_now) to the statistics ST.  FAILED is true if the
+ * operation returned an error.  */
+void
+scd_stats_add (struct scd_stats_s *st, unsigned long long started,
+               int failed)
+{
+  unsigned long long now, usec, limit;
+  int i;
+
+  now = scd_stats_now ();
+  usec = now > started? now - started : 0;
+
+  st->count++;
+  if (failed)
+    st->errors++;
+  st->total_usec += usec;
+  for (i = 0, limit = 1000; i < SCD_STATS_BUCKETS - 1; i++, limit *= 2)
+    if (usec < limit)
+      break;
+  st->hist[i]++;
+}
+
+
+/* Return the statistics ST as a malloced string of the form
+ * "COUNT:ERRORS:TOTAL_MS:H0,H1,...".  Returns NULL on error.  */
+char *
+scd_stats_string (const struct scd_stats_s *st)
+{
+  char histbuf[SCD_STATS_BUCKETS * 21];
+  char *p;
+  int i;
+
+  p = histbuf;
+  for (i = 0; i < SCD_STATS_BUCKETS; i++)
+    p += snprintf (p, sizeof histbuf - (p - histbuf), "%s%lu",
+                   i? ",":"", st->hist[i]);
+
+  return xtryasprintf ("%lu:%lu:%llu:%s", st->count, st->errors,
+                       st->total_usec / 1000, histbuf);
+}
+
+
 void
 scd_kick_the_loop (void)
 {
@@ -63,6 +63,7 @@ struct
   int allow_admin;     /* Allow the use of admin commands for certain
                           cards. */
   int pcsc_shared;     /* Use shared PC/SC access.  */
+  int card_pool;       /* Spread keygrip operations over all cards.  */
   strlist_t disabled_applications;  /* Card applications we do not
                                        want to use. */
   unsigned long card_timeout; /* Disconnect after N seconds of inactivity.  */
@@ -135,9 +136,26 @@ struct server_control_s
 };
 
 
+/* Latency statistics as shown by GETINFO stats.  Bucket I of the
+ * histogram counts operations which took less than 2^I milliseconds;
+ * the last bucket counts all slower ones.  */
+#define SCD_STATS_BUCKETS 12
+struct scd_stats_s
+{
+  unsigned long count;
+  unsigned long errors;
+  unsigned long long total_usec;
+  unsigned long hist[SCD_STATS_BUCKETS];
+};
+
+
 /*-- scdaemon.c --*/
 void scd_exit (int rc);
 const char *scd_get_socket_name (void);
+unsigned long long scd_stats_now (void);
+void scd_stats_add (struct scd_stats_s *st, unsigned long long started,
+                    int failed);
+char *scd_stats_string (const struct scd_stats_s *st);
 #ifdef HAVE_W32_SYSTEM
 void scd_init_event (HANDLE *e_p, HANDLE events[2]);
 #endif
@@ -172,5 +190,6 @@ int get_active_connection_count (void);
 /*-- app.c --*/
 int scd_update_reader_status_file (void);
 gpg_error_t app_send_devinfo (ctrl_t ctrl, int keep_looping);
+char *app_get_stats (void);
 
 #endif /*SCDAEMON_H*/
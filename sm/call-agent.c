@@ -37,6 +37,7 @@
 #include "keydb.h" /* fixme: Move this to import.c */
 #include "../common/membuf.h"
 #include "../common/shareddefs.h"
+#include "../common/starttrace.h"
 #include "passphrase.h"
 
 
@@ -181,6 +182,13 @@ start_agent (ctrl_t ctrl)
                     suitable given that the agent is not MT. */
   else
     {
+      unsigned long long start = starttrace_clock ();
+
+      /* The connection is kept for the lifetime of the process; thus
+       * in server mode the handshake is done only once.  Use "--debug
+       * clock" to see what it costs for each short-lived process.  */
+      if (DBG_CLOCK)
+        log_clock ("enter agent session setup");
       rc = start_new_gpg_agent (&agent_ctx,
                                 GPG_ERR_SOURCE_DEFAULT,
                                 opt.agent_program,
@@ -256,6 +264,9 @@ start_agent (ctrl_t ctrl)
 #endif /*HAVE_W32_SYSTEM*/
 
         }
+      if (DBG_CLOCK)
+        log_clock ("leave agent session setup");
+      starttrace_phase ("agent connect", start);
     }
 
   if (!ctrl->agent_seen)
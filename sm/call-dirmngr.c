@@ -45,13 +45,12 @@ struct membuf {
 
 
 
-/* fixme: We need a context for each thread or serialize the access to
-   the dirmngr.  */
-static assuan_context_t dirmngr_ctx = NULL;
-static assuan_context_t dirmngr2_ctx = NULL;
-
-static int dirmngr_ctx_locked;
-static int dirmngr2_ctx_locked;
+/* The connections to the dirmngr.  Usually only the first one is
+   used; the others are used by the workers of a parallel key listing
+   which query the dirmngr concurrently.  */
+#define MAX_DIRMNGR_CTX 16
+static assuan_context_t dirmngr_ctx[MAX_DIRMNGR_CTX];
+static int dirmngr_ctx_locked[MAX_DIRMNGR_CTX];
 
 struct inq_certificate_parm_s {
   ctrl_t ctrl;
@@ -223,9 +222,6 @@ start_dirmngr_ext (ctrl_t ctrl, assuan_context_t *ctx_r)
   if (*ctx_r)
     return 0;
 
-  /* Note: if you change this to multiple connections, you also need
-     to take care of the implicit option sending caching. */
-
   err = start_new_dirmngr (&ctx, GPG_ERR_SOURCE_DEFAULT,
                            opt.dirmngr_program,
                            opt.autostart?ASSHELP_FLAG_AUTOSTART:0,
@@ -250,59 +246,54 @@ start_dirmngr_ext (ctrl_t ctrl, assuan_context_t *ctx_r)
 }
 
 
+/* Lock a connection to the dirmngr and store it at R_CTX.  */
 static int
-start_dirmngr (ctrl_t ctrl)
+start_dirmngr (ctrl_t ctrl, assuan_context_t *r_ctx)
 {
   gpg_error_t err;
+  int idx, is_new;
 
-  log_assert (! dirmngr_ctx_locked);
-  dirmngr_ctx_locked = 1;
+  *r_ctx = NULL;
+  for (idx=0; idx < MAX_DIRMNGR_CTX && dirmngr_ctx_locked[idx]; idx++)
+    ;
+  log_assert (idx < MAX_DIRMNGR_CTX);
+  dirmngr_ctx_locked[idx] = 1;
 
-  err = start_dirmngr_ext (ctrl, &dirmngr_ctx);
+  is_new = !dirmngr_ctx[idx];
+  err = start_dirmngr_ext (ctrl, &dirmngr_ctx[idx]);
   /* We do not check ERR but the existence of a context because the
      error might come from a failed command send to the dirmngr.
      Fixme: Why don't we close the drimngr context if we encountered
      an error in prepare_dirmngr?  */
-  if (!dirmngr_ctx)
-    dirmngr_ctx_locked = 0;
+  if (!dirmngr_ctx[idx])
+    dirmngr_ctx_locked[idx] = 0;
+  else
+    {
+      /* It is sufficient to send the options once per connection.  */
+      if (is_new && opt.force_crl_refresh)
+        assuan_transact (dirmngr_ctx[idx], "OPTION force-crl-refresh=1",
+                         NULL, NULL, NULL, NULL, NULL, NULL);
+      *r_ctx = dirmngr_ctx[idx];
+    }
   return err;
 }
 
 
+/* Unlock the connection CTX returned by start_dirmngr.  */
 static void
-release_dirmngr (ctrl_t ctrl)
-{
-  (void)ctrl;
-
-  if (!dirmngr_ctx_locked)
-    log_error ("WARNING: trying to release a non-locked dirmngr ctx\n");
-  dirmngr_ctx_locked = 0;
-}
-
-
-static int
-start_dirmngr2 (ctrl_t ctrl)
+release_dirmngr (ctrl_t ctrl, assuan_context_t ctx)
 {
-  gpg_error_t err;
-
-  log_assert (! dirmngr2_ctx_locked);
-  dirmngr2_ctx_locked = 1;
-
-  err = start_dirmngr_ext (ctrl, &dirmngr2_ctx);
-  if (!dirmngr2_ctx)
-    dirmngr2_ctx_locked = 0;
-  return err;
-}
-
+  int idx;
 
-static void
-release_dirmngr2 (ctrl_t ctrl)
-{
   (void)ctrl;
 
-  if (!dirmngr2_ctx_locked)
-    log_error ("WARNING: trying to release a non-locked dirmngr2 ctx\n");
-  dirmngr2_ctx_locked = 0;
+  for (idx=0; idx < MAX_DIRMNGR_CTX; idx++)
+    if (dirmngr_ctx[idx] == ctx && dirmngr_ctx_locked[idx])
+      break;
+  if (idx == MAX_DIRMNGR_CTX)
+    log_error ("WARNING: trying to release a non-locked dirmngr ctx\n");
+  else
+    dirmngr_ctx_locked[idx] = 0;
 }
 
 
@@ -473,19 +464,37 @@ warning_and_note_printer (const char *line)
 }
 
 
+/* The inquiry callback for ISVALID.  The command is run without the
+   key listing lock which we need to take while processing the
+   inquiry.  */
+static gpg_error_t
+isvalid_inq_cb (void *opaque, const char *line)
+{
+  struct inq_certificate_parm_s *parm = opaque;
+  gpg_error_t err;
+
+  gpgsm_list_lock (parm->ctrl);
+  err = inq_certificate (opaque, line);
+  gpgsm_list_unlock (parm->ctrl);
+  return err;
+}
+
+
 static gpg_error_t
 isvalid_status_cb (void *opaque, const char *line)
 {
   struct isvalid_status_parm_s *parm = opaque;
+  gpg_error_t err = 0;
   const char *s;
 
+  gpgsm_list_lock (parm->ctrl);
   if ((s = has_leading_keyword (line, "PROGRESS")))
     {
       if (parm->ctrl)
         {
           line = s;
           if (gpgsm_status (parm->ctrl, STATUS_PROGRESS, line))
-            return gpg_error (GPG_ERR_ASS_CANCELED);
+            err = gpg_error (GPG_ERR_ASS_CANCELED);
         }
     }
   else if ((s = has_leading_keyword (line, "ONLY_VALID_IF_CERT_VALID")))
@@ -510,8 +519,9 @@ isvalid_status_cb (void *opaque, const char *line)
   else if (warning_and_note_printer (line))
     {
     }
+  gpgsm_list_unlock (parm->ctrl);
 
-  return 0;
+  return err;
 }
 
 
@@ -539,7 +549,7 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
                        ksba_cert_t cert, ksba_cert_t issuer_cert, int use_ocsp,
                        gnupg_isotime_t r_revoked_at, char **r_reason)
 {
-  static int did_options;
+  assuan_context_t ctx;
   int rc;
   char *certid, *certfpr;
   char line[ASSUAN_LINELENGTH];
@@ -551,7 +561,7 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
   if (r_reason)
     *r_reason = NULL;
 
-  rc = start_dirmngr (ctrl);
+  rc = start_dirmngr (ctrl, &ctx);
   if (rc)
     return rc;
 
@@ -560,7 +570,7 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
   if (!certid)
     {
       log_error ("error getting the certificate ID\n");
-      release_dirmngr (ctrl);
+      release_dirmngr (ctrl, ctx);
       return gpg_error (GPG_ERR_GENERAL);
     }
 
@@ -572,7 +582,7 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
       xfree (fpr);
     }
 
-  parm.ctx = dirmngr_ctx;
+  parm.ctx = ctx;
   parm.ctrl = ctrl;
   parm.cert = cert;
   parm.issuer_cert = issuer_cert;
@@ -583,15 +593,6 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
   stparm.revoked_at[0] = 0;
   stparm.revocation_reason = NULL;
 
-  /* It is sufficient to send the options only once because we have
-   * one connection per process only.  */
-  if (!did_options)
-    {
-      if (opt.force_crl_refresh)
-        assuan_transact (dirmngr_ctx, "OPTION force-crl-refresh=1",
-                         NULL, NULL, NULL, NULL, NULL, NULL);
-      did_options = 1;
-    }
   snprintf (line, DIM(line), "ISVALID%s %s%s%s",
             (use_ocsp == 2 || opt.no_crl_check) ? " --only-ocsp":"",
             certid,
@@ -600,9 +601,13 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
   xfree (certid);
   xfree (certfpr);
 
-  rc = assuan_transact (dirmngr_ctx, line, NULL, NULL,
-                        inq_certificate, &parm,
+  /* Let other workers of a parallel key listing run while we wait
+     for the dirmngr.  */
+  gpgsm_list_unlock (ctrl);
+  rc = assuan_transact (ctx, line, NULL, NULL,
+                        isvalid_inq_cb, &parm,
                         isvalid_status_cb, &stparm);
+  gpgsm_list_lock (ctrl);
   if (opt.verbose > 1)
     log_info ("response of dirmngr: %s\n", rc? gpg_strerror (rc): "okay");
 
@@ -631,7 +636,7 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
         {
           ksba_cert_t rspcert = NULL;
 
-          if (get_cached_cert (dirmngr_ctx, stparm.fpr, &rspcert))
+          if (get_cached_cert (ctx, stparm.fpr, &rspcert))
             {
               /* Ooops: Something went wrong getting the certificate
                  from the dirmngr.  Try our own cert store now.  */
@@ -677,7 +682,7 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
         }
     }
 
-  release_dirmngr (ctrl);
+  release_dirmngr (ctrl, ctx);
   xfree (stparm.revocation_reason);
   return rc;
 }
@@ -843,36 +848,18 @@ gpgsm_dirmngr_lookup (ctrl_t ctrl, strlist_t names, const char *uri,
     return gpg_error (GPG_ERR_INV_ARG);
 
   /* The lookup function can be invoked from the callback of a lookup
-     function, for example to walk the chain.  */
-  if (!dirmngr_ctx_locked)
-    {
-      rc = start_dirmngr (ctrl);
-      if (rc)
-	return rc;
-      ctx = dirmngr_ctx;
-    }
-  else if (!dirmngr2_ctx_locked)
-    {
-      rc = start_dirmngr2 (ctrl);
-      if (rc)
-	return rc;
-      ctx = dirmngr2_ctx;
-    }
-  else
-    {
-      log_fatal ("both dirmngr contexts are in use\n");
-    }
+     function, for example to walk the chain; start_dirmngr then
+     returns another connection.  */
+  rc = start_dirmngr (ctrl, &ctx);
+  if (rc)
+    return rc;
 
   if (names)
     {
       char *pattern = pattern_from_strlist (names);
       if (!pattern)
         {
-          if (ctx == dirmngr_ctx)
-            release_dirmngr (ctrl);
-          else
-            release_dirmngr2 (ctrl);
-
+          release_dirmngr (ctrl, ctx);
           return out_of_core ();
         }
       snprintf (line, DIM(line), "LOOKUP%s %s",
@@ -884,10 +871,7 @@ gpgsm_dirmngr_lookup (ctrl_t ctrl, strlist_t names, const char *uri,
       for (s=uri; *s; s++)
         if (*s <= ' ')
           {
-            if (ctx == dirmngr_ctx)
-              release_dirmngr (ctrl);
-            else
-              release_dirmngr2 (ctrl);
+            release_dirmngr (ctrl, ctx);
             return gpg_error (GPG_ERR_INV_URI);
           }
       snprintf (line, DIM(line), "LOOKUP --url %s", uri);
@@ -904,10 +888,7 @@ gpgsm_dirmngr_lookup (ctrl_t ctrl, strlist_t names, const char *uri,
                         NULL, NULL, lookup_status_cb, &parm);
   xfree (get_membuf (&parm.data, &len));
 
-  if (ctx == dirmngr_ctx)
-    release_dirmngr (ctrl);
-  else
-    release_dirmngr2 (ctrl);
+  release_dirmngr (ctrl, ctx);
 
   if (rc)
       return rc;
@@ -1141,15 +1122,16 @@ gpgsm_dirmngr_run_command (ctrl_t ctrl, const char *command,
   char *line, *p;
   size_t len;
   struct run_command_parm_s parm;
+  assuan_context_t ctx;
 
-  rc = start_dirmngr (ctrl);
+  rc = start_dirmngr (ctrl, &ctx);
   if (gpg_err_code (rc) == GPG_ERR_NO_DIRMNGR)
     fputs (_("no dirmngr running in this session\n"), stdout);
   if (rc)
     return rc;
 
   parm.ctrl = ctrl;
-  parm.ctx = dirmngr_ctx;
+  parm.ctx = ctx;
 
   len = strlen (command) + 1;
   for (i=0; i < argc; i++)
@@ -1157,7 +1139,7 @@ gpgsm_dirmngr_run_command (ctrl_t ctrl, const char *command,
   line = xtrymalloc (len);
   if (!line)
     {
-      release_dirmngr (ctrl);
+      release_dirmngr (ctrl, ctx);
       return out_of_core ();
     }
 
@@ -1182,12 +1164,12 @@ gpgsm_dirmngr_run_command (ctrl_t ctrl, const char *command,
     }
   *p = 0;
 
-  rc = assuan_transact (dirmngr_ctx, line,
+  rc = assuan_transact (ctx, line,
                         run_command_cb, NULL,
                         run_command_inq_cb, &parm,
                         run_command_status_cb, ctrl);
   xfree (line);
   log_info ("response of dirmngr: %s\n", rc? gpg_strerror (rc): "okay");
-  release_dirmngr (ctrl);
+  release_dirmngr (ctrl, ctx);
   return rc;
 }
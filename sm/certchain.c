@@ -41,6 +41,14 @@
 static const char oidstr_caIssuers[] = "1.3.6.1.5.5.7.48.2";
 
 
+/* The maximum number of items in the validation cache and the number
+ * of seconds a successful validation result is reused.  Revocation
+ * and trustlist changes are only noticed after an item expired; thus
+ * we keep this short.  */
+#define VALIDATION_CACHE_MAX_ITEMS  256
+#define VALIDATION_CACHE_TTL        120
+
+
 /* Object to keep track of certain root certificates. */
 struct marktrusted_info_s
 {
@@ -1558,6 +1566,7 @@ ask_marktrusted (ctrl_t ctrl, ksba_cert_t cert, int listmode)
   if (!rc)
     {
       log_info (_("root certificate has now been marked as trusted\n"));
+      gpgsm_flush_validation_cache (ctrl);
       success = 1;
     }
   else if (!listmode)
@@ -1587,6 +1596,134 @@ ask_marktrusted (ctrl_t ctrl, ksba_cert_t cert, int listmode)
 }
 
 
+/* Return a bit vector with the options affecting the result of a
+ * chain validation.  */
+static unsigned int
+validation_settings (ctrl_t ctrl)
+{
+  return ((!!ctrl->use_ocsp)
+          | ((!!ctrl->offline) << 1)
+          | ((!!opt.no_crl_check) << 2)
+          | ((!!opt.no_trusted_cert_crl_check) << 3)
+          | ((!!opt.no_policy_check) << 4)
+          | ((!!opt.ignore_expiration) << 5));
+}
+
+
+/* Flush the cache of validated chains.  This needs to be called
+ * whenever the trustlist or the set of known certificates changed.
+ * The resolved recipients depend on the latter and are thus flushed
+ * as well.  */
+void
+gpgsm_flush_validation_cache (ctrl_t ctrl)
+{
+  validation_cache_item_t vi;
+
+  while ((vi = ctrl->validation_cache))
+    {
+      ctrl->validation_cache = vi->next;
+      xfree (vi);
+    }
+  ctrl->validation_cache_count = 0;
+  gpgsm_flush_recipient_cache (ctrl);
+}
+
+
+/* Return the validation cache item for CERT validated with FLAGS at
+ * CHECKTIME.  Expired items are removed on the fly.  */
+static validation_cache_item_t
+get_validation_cache_item (ctrl_t ctrl, ksba_cert_t cert, unsigned int flags,
+                           const char *checktime)
+{
+  validation_cache_item_t vi, viprev, vinext;
+  unsigned char fpr[20];
+  unsigned int settings;
+  ksba_isotime_t current_time;
+  time_t now;
+
+  if ((opt.compat_flags & COMPAT_NO_VALIDATION_CACHE)
+      || !ctrl->validation_cache)
+    return NULL;
+
+  now = gnupg_get_time ();
+  gnupg_get_isotime (current_time);
+  gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, fpr, NULL);
+  settings = validation_settings (ctrl);
+  for (vi = ctrl->validation_cache, viprev = NULL; vi; vi = vinext)
+    {
+      vinext = vi->next;
+      if (vi->expires < now
+          || (*vi->exptime && strcmp (current_time, vi->exptime) > 0))
+        {
+          if (viprev)
+            viprev->next = vinext;
+          else
+            ctrl->validation_cache = vinext;
+          xfree (vi);
+          ctrl->validation_cache_count--;
+          continue;
+        }
+      if (!memcmp (vi->fpr, fpr, 20)
+          && vi->flags == flags
+          && vi->settings == settings
+          && !strcmp (vi->checktime, checktime))
+        return vi;
+      viprev = vi;
+    }
+  return NULL;
+}
+
+
+/* Store the successful validation of CERT in the cache.  */
+static void
+put_validation_cache_item (ctrl_t ctrl, ksba_cert_t cert, unsigned int flags,
+                           const char *checktime, const char *exptime,
+                           unsigned int retflags)
+{
+  validation_cache_item_t vi, viprev;
+  unsigned char buf[1];
+  size_t buflen;
+
+  if ((opt.compat_flags & COMPAT_NO_VALIDATION_CACHE))
+    return;
+  if (strlen (checktime) >= sizeof vi->checktime)
+    return;
+
+  if (ctrl->validation_cache_count >= VALIDATION_CACHE_MAX_ITEMS)
+    {
+      /* Drop the oldest item which is the last one.  */
+      for (vi = ctrl->validation_cache, viprev = NULL; vi && vi->next;
+           viprev = vi, vi = vi->next)
+        ;
+      if (viprev)
+        viprev->next = NULL;
+      else
+        ctrl->validation_cache = NULL;
+      xfree (vi);
+      ctrl->validation_cache_count--;
+    }
+
+  vi = xtrycalloc (1, sizeof *vi);
+  if (!vi)
+    return;  /* Not having a cache item is not an error.  */
+  gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, vi->fpr, NULL);
+  vi->flags = flags;
+  vi->retflags = retflags;
+  vi->settings = validation_settings (ctrl);
+  vi->expires = gnupg_get_time () + VALIDATION_CACHE_TTL;
+  strcpy (vi->checktime, checktime);
+  gnupg_copy_time (vi->exptime, exptime);
+  if (!ksba_cert_get_user_data (cert, "is_qualified", buf, sizeof buf, &buflen)
+      && buflen)
+    vi->is_qualified = !!*buf;
+  else
+    vi->is_qualified = -1;
+  vi->next = ctrl->validation_cache;
+  ctrl->validation_cache = vi;
+  ctrl->validation_cache_count++;
+}
+
+
 
 
 /* Validate a chain and optionally return the nearest expiration time
@@ -2284,6 +2421,10 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
   int rc;
   struct rootca_flags_s rootca_flags;
   unsigned int dummy_retflags;
+  unsigned int orig_flags;
+  ksba_isotime_t exptime;
+  validation_cache_item_t vi;
+  int use_cache;
 
   if (!retflags)
     retflags = &dummy_retflags;
@@ -2301,6 +2442,38 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
 
   memset (&rootca_flags, 0, sizeof rootca_flags);
 
+  /* A cached result can only be used if nothing needs to be printed
+   * or recorded in an audit log.  The checktime is only used by the
+   * chain model and thus only then part of the key for the cache.
+   * Because the root CA may switch us to the chain model we also need
+   * to look for an item with the checktime in the shell model.  */
+  use_cache = (!listmode && !ctrl->audit && !opt.no_chain_validation
+               && !(flags & VALIDATE_FLAG_BYPASS));
+  orig_flags = flags;
+  vi = NULL;
+  if (use_cache && !(flags & VALIDATE_FLAG_CHAIN_MODEL))
+    vi = get_validation_cache_item (ctrl, cert, flags, "");
+  if (use_cache && !vi)
+    vi = get_validation_cache_item (ctrl, cert, flags, checktime);
+  if (vi)
+    {
+      unsigned char buf[1];
+
+      if (opt.verbose)
+        log_info ("chain validation result taken from the cache\n");
+      if (vi->is_qualified != -1)
+        {
+          buf[0] = vi->is_qualified;
+          ksba_cert_set_user_data (cert, "is_qualified", buf, 1);
+        }
+      if (r_exptime)
+        gnupg_copy_time (r_exptime, vi->exptime);
+      *retflags = vi->retflags;
+      return 0;
+    }
+  if (!r_exptime)
+    r_exptime = exptime;
+
   if ((flags & VALIDATE_FLAG_BYPASS))
     {
       *retflags |= VALIDATE_FLAG_BYPASS;
@@ -2338,6 +2511,12 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
              (*retflags & VALIDATE_FLAG_CHAIN_MODEL)?
              _("chain"):_("shell"));
 
+  if (!rc && use_cache)
+    put_validation_cache_item (ctrl, cert, orig_flags,
+                               (*retflags & VALIDATE_FLAG_CHAIN_MODEL)?
+                               checktime : "",
+                               r_exptime, *retflags);
+
   return rc;
 }
 
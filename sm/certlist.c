@@ -42,6 +42,12 @@
 #define USE_MODE_CERT 4
 #define USE_MODE_OCSP 5
 
+/* The maximum number of items in the recipient cache and the number
+ * of seconds a resolved recipient is reused.  The chain is validated
+ * again for each use.  */
+#define RECIPIENT_CACHE_MAX_ITEMS  64
+#define RECIPIENT_CACHE_TTL        300
+
 /* OIDs we use here.  */
 static const char oid_kp_serverAuth[]     = "1.3.6.1.5.5.7.3.1";
 static const char oid_kp_clientAuth[]     = "1.3.6.1.5.5.7.3.2";
@@ -325,10 +331,150 @@ gpgsm_add_cert_to_certlist (ctrl_t ctrl, ksba_cert_t cert,
    return 0;
 }
 
+/* Flush the cache of resolved recipients.  */
+void
+gpgsm_flush_recipient_cache (ctrl_t ctrl)
+{
+  recipient_cache_item_t ri;
+
+  while ((ri = ctrl->recipient_cache))
+    {
+      ctrl->recipient_cache = ri->next;
+      ksba_cert_release (ri->cert);
+      xfree (ri);
+    }
+  ctrl->recipient_cache_count = 0;
+}
+
+
+/* Return a new reference to the certificate cached for the recipient
+ * NAME or NULL.  Expired items are removed on the fly.  */
+static ksba_cert_t
+get_recipient_cache_item (ctrl_t ctrl, const char *name)
+{
+  recipient_cache_item_t ri, riprev, rinext;
+  time_t now;
+
+  if ((opt.compat_flags & COMPAT_NO_RECIPIENT_CACHE)
+      || !ctrl->recipient_cache)
+    return NULL;
+
+  now = gnupg_get_time ();
+  for (ri = ctrl->recipient_cache, riprev = NULL; ri; ri = rinext)
+    {
+      rinext = ri->next;
+      if (ri->expires < now)
+        {
+          if (riprev)
+            riprev->next = rinext;
+          else
+            ctrl->recipient_cache = rinext;
+          ksba_cert_release (ri->cert);
+          xfree (ri);
+          ctrl->recipient_cache_count--;
+          continue;
+        }
+      if (!strcmp (ri->name, name))
+        {
+          ksba_cert_ref (ri->cert);
+          return ri->cert;
+        }
+      riprev = ri;
+    }
+  return NULL;
+}
+
+
+/* Store CERT as the resolved recipient NAME in the cache.  */
+static void
+put_recipient_cache_item (ctrl_t ctrl, const char *name, ksba_cert_t cert)
+{
+  recipient_cache_item_t ri, riprev;
+
+  if ((opt.compat_flags & COMPAT_NO_RECIPIENT_CACHE))
+    return;
+
+  if (ctrl->recipient_cache_count >= RECIPIENT_CACHE_MAX_ITEMS)
+    {
+      /* Drop the oldest item which is the last one.  */
+      for (ri = ctrl->recipient_cache, riprev = NULL; ri && ri->next;
+           riprev = ri, ri = ri->next)
+        ;
+      if (riprev)
+        riprev->next = NULL;
+      else
+        ctrl->recipient_cache = NULL;
+      ksba_cert_release (ri->cert);
+      xfree (ri);
+      ctrl->recipient_cache_count--;
+    }
+
+  ri = xtrycalloc (1, sizeof *ri + strlen (name));
+  if (!ri)
+    return;  /* Not having a cache item is not an error.  */
+  strcpy (ri->name, name);
+  ksba_cert_ref (cert);
+  ri->cert = cert;
+  ri->expires = gnupg_get_time () + RECIPIENT_CACHE_TTL;
+  ri->next = ctrl->recipient_cache;
+  ctrl->recipient_cache = ri;
+  ctrl->recipient_cache_count++;
+}
+
+
+/* Check that CERT is valid and add it to the list at LISTADDR.  See
+   gpgsm_add_to_certlist for SECRET and IS_ENCRYPT_TO.  */
+static int
+add_validated_cert (ctrl_t ctrl, ksba_cert_t cert, int secret,
+                    certlist_t *listaddr, int is_encrypt_to)
+{
+  unsigned int valflags = 0;
+  int rc = 0;
+
+  if (!secret && (opt.always_trust || ctrl->always_trust))
+    valflags |= VALIDATE_FLAG_BYPASS;
+
+  if (secret)
+    {
+      char *p;
+
+      rc = gpg_error (GPG_ERR_NO_SECKEY);
+      p = gpgsm_get_keygrip_hexstring (cert);
+      if (p)
+        {
+          if (!gpgsm_agent_havekey (ctrl, p))
+            rc = 0;
+          xfree (p);
+        }
+    }
+
+  if (!rc)
+    rc = gpgsm_validate_chain (ctrl, cert, GNUPG_ISOTIME_NONE, NULL,
+                               0, NULL, valflags, NULL);
+  if (!rc)
+    {
+      certlist_t cl = xtrycalloc (1, sizeof *cl);
+      if (!cl)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          ksba_cert_ref (cert);
+          cl->cert = cert;
+          cl->next = *listaddr;
+          cl->is_encrypt_to = is_encrypt_to;
+          *listaddr = cl;
+        }
+    }
+  return rc;
+}
+
+
 /* Add a certificate to a list of certificate and make sure that it is
    a valid certificate.  With SECRET set to true a secret key must be
    available for the certificate. IS_ENCRYPT_TO sets the corresponding
-   flag in the new create LISTADDR item.  */
+   flag in the new create LISTADDR item.  Recipients resolved this way
+   are cached for the session; the chain is however validated for
+   each call.  */
 int
 gpgsm_add_to_certlist (ctrl_t ctrl, const char *name, int secret,
                        certlist_t *listaddr, int is_encrypt_to)
@@ -338,6 +484,18 @@ gpgsm_add_to_certlist (ctrl_t ctrl, const char *name, int secret,
   KEYDB_HANDLE kh = NULL;
   ksba_cert_t cert = NULL;
 
+  if (!secret && (cert = get_recipient_cache_item (ctrl, name)))
+    {
+      /* The lookup, the key usage and the ambiguity checks have
+       * already been done for NAME.  */
+      if (is_cert_in_certlist (cert, *listaddr))
+        rc = 0;
+      else
+        rc = add_validated_cert (ctrl, cert, 0, listaddr, is_encrypt_to);
+      ksba_cert_release (cert);
+      return rc;
+    }
+
   rc = classify_user_id (name, &desc, 0);
   if (!rc)
     {
@@ -448,41 +606,10 @@ gpgsm_add_to_certlist (ctrl_t ctrl, const char *name, int secret,
 
           if (!rc && !is_cert_in_certlist (cert, *listaddr))
             {
-              unsigned int valflags = 0;
-
-              if (!secret && (opt.always_trust || ctrl->always_trust))
-                valflags |= VALIDATE_FLAG_BYPASS;
-
-              if (!rc && secret)
-                {
-                  char *p;
-
-                  rc = gpg_error (GPG_ERR_NO_SECKEY);
-                  p = gpgsm_get_keygrip_hexstring (cert);
-                  if (p)
-                    {
-                      if (!gpgsm_agent_havekey (ctrl, p))
-                        rc = 0;
-                      xfree (p);
-                    }
-                }
-
-              if (!rc)
-                rc = gpgsm_validate_chain (ctrl, cert, GNUPG_ISOTIME_NONE, NULL,
-                                           0, NULL, valflags, NULL);
-              if (!rc)
-                {
-                  certlist_t cl = xtrycalloc (1, sizeof *cl);
-                  if (!cl)
-                    rc = gpg_error_from_syserror ();
-                  else
-                    {
-                      cl->cert = cert; cert = NULL;
-                      cl->next = *listaddr;
-                      cl->is_encrypt_to = is_encrypt_to;
-                      *listaddr = cl;
-                    }
-                }
+              rc = add_validated_cert (ctrl, cert, secret,
+                                       listaddr, is_encrypt_to);
+              if (!rc && !secret)
+                put_recipient_cache_item (ctrl, name, cert);
             }
         }
     }
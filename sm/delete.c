@@ -135,6 +135,7 @@ delete_one (ctrl_t ctrl, const char *username)
       rc = keydb_delete (kh);
       if (rc)
         goto leave;
+      gpgsm_flush_validation_cache (ctrl);
       if (opt.verbose)
         {
           if (duplicates)
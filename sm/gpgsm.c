@@ -48,6 +48,8 @@
 #include "../common/init.h"
 #include "../common/compliance.h"
 #include "../common/comopt.h"
+#include "../common/metrics.h"
+#include "../common/starttrace.h"
 #include "minip12.h"
 
 #ifndef O_BINARY
@@ -194,6 +196,7 @@ enum cmd_and_opt_values {
   oWithColons,
   oWithKeyData,
   oWithValidation,
+  oValidationJobs,
   oWithEphemeralKeys,
   oSkipVerify,
   oValidationModel,
@@ -220,6 +223,7 @@ enum cmd_and_opt_values {
   oAlwaysTrust,
   oNoAutostart,
   oAssertSigner,
+  oKeyboxIndex,
 
   oNoop
  };
@@ -322,6 +326,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oNoAutostart, "no-autostart", "@"),
   ARGPARSE_s_s (oAgentProgram, "agent-program", "@"),
   ARGPARSE_s_s (oKeyboxdProgram, "keyboxd-program", "@"),
+  ARGPARSE_s_n (oKeyboxIndex, "keybox-index", "@"),
   ARGPARSE_s_s (oDirmngrProgram, "dirmngr-program", "@"),
   ARGPARSE_s_s (oProtectToolProgram, "protect-tool-program", "@"),
 
@@ -389,6 +394,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oWithColons, "with-colons", "@"),
   ARGPARSE_s_n (oWithKeyData,"with-key-data", "@"),
   ARGPARSE_s_n (oWithValidation, "with-validation", "@"),
+  ARGPARSE_s_i (oValidationJobs, "validation-jobs", "@"),
   ARGPARSE_s_n (oWithMD5Fingerprint, "with-md5-fingerprint", "@"),
   ARGPARSE_s_n (oWithEphemeralKeys,  "with-ephemeral-keys", "@"),
   ARGPARSE_s_n (oSkipVerify, "skip-verify", "@"),
@@ -504,6 +510,8 @@ static struct compatibility_flags_s compatibility_flags [] =
     { COMPAT_ALLOW_KA_TO_ENCR, "allow-ka-to-encr" },
     { COMPAT_NO_CHAIN_CACHE, "no-chain-cache"     },
     { COMPAT_NO_KEYINFO_CACHE, "no-keyinfo-cache" },
+    { COMPAT_NO_VALIDATION_CACHE, "no-validation-cache" },
+    { COMPAT_NO_RECIPIENT_CACHE, "no-recipient-cache" },
     { 0, NULL }
   };
 
@@ -878,6 +886,18 @@ parse_validation_model (const char *model)
 }
 
 
+/* The post system call clamp.  This also accounts the time spent
+ * waiting for the nPth lock.  */
+static void
+post_syscall (void)
+{
+  unsigned long long start = metrics_clock ();
+
+  npth_protect ();
+  metrics_lock_wait (start);
+}
+
+
 
 int
 main ( int argc, char **argv)
@@ -967,6 +987,7 @@ main ( int argc, char **argv)
   /* Note: If you change this default cipher algorithm , please
      remember to update the Gpgconflist entry as well.  */
   opt.def_cipher_algoid = DEFAULT_CIPHER_ALGO;
+  opt.validation_jobs = 4;
 
 
   /* First check whether we have a config file on the commandline */
@@ -1007,6 +1028,7 @@ main ( int argc, char **argv)
  leave_cmdline_parser:
   /* Reset the flags.  */
   pargs.flags &= ~(ARGPARSE_FLAG_KEEP | ARGPARSE_FLAG_NOVERSION);
+  STARTTRACE_MARK ("command line");
 
   /* Initialize the secure memory. */
   gcry_control (GCRYCTL_INIT_SECMEM, 16384, 0);
@@ -1029,6 +1051,7 @@ main ( int argc, char **argv)
   if (changeuser && gnupg_chuid (changeuser, 0))
     log_inc_errorcount (); /* Force later termination.  */
   gnupg_set_homedir (homedirvalue);
+  STARTTRACE_MARK ("secmem and homedir");
 
   /* Setup a default control structure for command line mode */
   memset (&ctrl, 0, sizeof ctrl);
@@ -1294,6 +1317,7 @@ main ( int argc, char **argv)
 
         case oKeyring: append_to_strlist (&nrings, pargs.r.ret_str); break;
         case oUseKeyboxd: opt.use_keyboxd = 1; break;
+        case oKeyboxIndex: keybox_set_use_index (1); break;
 
         case oDebug:
           if (parse_debug_flag (pargs.r.ret_str, &debug_value, debug_flags))
@@ -1424,6 +1448,7 @@ main ( int argc, char **argv)
         case oWithColons: ctrl.with_colons = 1; break;
         case oWithSecret: ctrl.with_secret = 1; break;
         case oWithValidation: ctrl.with_validation=1; break;
+        case oValidationJobs: opt.validation_jobs = pargs.r.ret_int; break;
         case oWithEphemeralKeys: ctrl.with_ephemeral_keys=1; break;
 
         case oSkipVerify: opt.skip_verify=1; break;
@@ -1558,6 +1583,7 @@ main ( int argc, char **argv)
     }
 
   gpgrt_argparse (NULL, &pargs, NULL);  /* Release internal state.  */
+  STARTTRACE_MARK ("option files");
 
   if (!last_configname)
     opt.config_filename = gpgrt_fnameconcat (gnupg_homedir (),
@@ -1636,7 +1662,7 @@ main ( int argc, char **argv)
 
 
   npth_init ();
-  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  gpgrt_set_syscall_clamp (npth_unprotect, post_syscall);
   assuan_control (ASSUAN_CONTROL_REINIT_SYSCALL_CLAMP, NULL);
 
 
@@ -1809,10 +1835,14 @@ main ( int argc, char **argv)
       gnupg_inhibit_set_foregound_window (1);
     }
 
+  STARTTRACE_MARK ("common options");
+
   /* Better make sure that we have a statusfp so that a failure status
    * in gpgsm_exit can work even w/o any preeding status messages. */
   gpgsm_init_statusfp (&ctrl);
 
+  STARTTRACE_MARK ("option processing");
+
   /* Add default keybox. */
   if (!nrings && default_keyring && !opt.use_keyboxd)
     {
@@ -1841,6 +1871,7 @@ main ( int argc, char **argv)
         keydb_add_resource (&ctrl, sl->d, 0, NULL);
     }
   FREE_STRLIST(nrings);
+  STARTTRACE_MARK ("keybox registration");
 
 
   /* Prepare the audit log feature for certain commands.  */
@@ -1910,6 +1941,8 @@ main ( int argc, char **argv)
 
   if (log_get_errorcount(0))
     gpgsm_exit(1); /* Must stop for invalid recipients. */
+  STARTTRACE_MARK ("key setup");
+  starttrace_dump ();
 
   /* Dispatch command.  */
   switch (cmd)
@@ -2407,6 +2440,7 @@ gpgsm_deinit_default_ctrl (ctrl_t ctrl)
 
   gpgsm_keydb_deinit_session_data (ctrl);
   gpgsm_flush_keyinfo_cache (ctrl);
+  gpgsm_flush_validation_cache (ctrl);
   xfree (ctrl->revocation_reason);
   ctrl->revocation_reason = NULL;
   n = 0;
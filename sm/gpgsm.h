@@ -135,6 +135,9 @@ struct
 
   int auto_issuer_key_retrieve; /* try to retrieve a missing issuer key. */
 
+  int validation_jobs;      /* Number of certificates validated
+                               concurrently by a key listing.  */
+
   int qualsig_approval;     /* Set to true if this software has
                                officially been approved to create an
                                verify qualified signatures.  This is a
@@ -225,6 +228,10 @@ struct
 #define COMPAT_NO_CHAIN_CACHE     2
 /* Ditto.  But here to disable the keyinfo and istrusted cache.  */
 #define COMPAT_NO_KEYINFO_CACHE   4
+/* Ditto.  But here to disable the chain validation result cache.  */
+#define COMPAT_NO_VALIDATION_CACHE 8
+/* Ditto.  But here to disable the resolved recipient cache.  */
+#define COMPAT_NO_RECIPIENT_CACHE 16
 
 /* Forward declaration for an object defined in server.c */
 struct server_local_s;
@@ -243,6 +250,31 @@ struct cert_cache_item_s
 };
 typedef struct cert_cache_item_s *cert_cache_item_t;
 
+/* An object used to keep track of successfully validated chains.  */
+struct validation_cache_item_s
+{
+  struct validation_cache_item_s *next;
+  unsigned char fpr[20];     /* The fingerprint of the target cert.  */
+  unsigned int flags;        /* The VALIDATE_FLAGs used.  */
+  unsigned int retflags;     /* The returned VALIDATE_FLAGs.  */
+  unsigned int settings;     /* Snapshot of the relevant options.  */
+  int is_qualified;          /* -1 = unknown, 0 = no, 1 = yes.  */
+  time_t expires;            /* Expiration time of this item.  */
+  ksba_isotime_t checktime;  /* The checktime used or empty.  */
+  ksba_isotime_t exptime;    /* The nearest expiration time.  */
+};
+typedef struct validation_cache_item_s *validation_cache_item_t;
+
+/* An object used to keep track of resolved recipients.  */
+struct recipient_cache_item_s
+{
+  struct recipient_cache_item_s *next;
+  ksba_cert_t cert;          /* The certificate found for NAME.  */
+  time_t expires;            /* Expiration time of this item.  */
+  char name[1];              /* The user id as given.  */
+};
+typedef struct recipient_cache_item_s *recipient_cache_item_t;
+
 /* On object used to keep a KEYINFO data from the agent. */
 struct keyinfo_cache_item_s
 {
@@ -313,6 +345,14 @@ struct server_control_s
   /* The cache used to find the parent cert.  */
   cert_cache_item_t parent_cert_cache;
 
+  /* The cache of validated chains and the number of its items.  */
+  validation_cache_item_t validation_cache;
+  unsigned int validation_cache_count;
+
+  /* The cache of resolved recipients and the number of its items.  */
+  recipient_cache_item_t recipient_cache;
+  unsigned int recipient_cache_count;
+
   /* Cache of recently gathered KEYINFO data.  */
   keyinfo_cache_item_t keyinfo_cache;
   int keyinfo_cache_valid;
@@ -442,6 +482,7 @@ int gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert,
                           int listmode, estream_t listfp,
                           unsigned int flags, unsigned int *retflags);
 int gpgsm_basic_cert_check (ctrl_t ctrl, ksba_cert_t cert);
+void gpgsm_flush_validation_cache (ctrl_t ctrl);
 
 /*-- certlist.c --*/
 int gpgsm_cert_use_sign_p (ksba_cert_t cert, int silent);
@@ -456,6 +497,7 @@ int gpgsm_add_cert_to_certlist (ctrl_t ctrl, ksba_cert_t cert,
                                 certlist_t *listaddr, int is_encrypt_to);
 int gpgsm_add_to_certlist (ctrl_t ctrl, const char *name, int secret,
                            certlist_t *listaddr, int is_encrypt_to);
+void gpgsm_flush_recipient_cache (ctrl_t ctrl);
 void gpgsm_release_certlist (certlist_t list);
 
 #define FIND_CERT_ALLOW_AMBIG 1
@@ -468,6 +510,8 @@ gpg_error_t gpgsm_list_keys (ctrl_t ctrl, strlist_t names,
                              estream_t fp, unsigned int mode);
 gpg_error_t gpgsm_show_certs (ctrl_t ctrl, int nfiles, char **files,
                               estream_t fp);
+void gpgsm_list_unlock (ctrl_t ctrl);
+void gpgsm_list_lock (ctrl_t ctrl);
 
 /*-- import.c --*/
 int gpgsm_import (ctrl_t ctrl, estream_t in_fp, int reimport_mode);
@@ -43,6 +43,23 @@
 /* The arbitrary limit of one PKCS#12 object.  */
 #define MAX_P12OBJ_SIZE 128 /*kb*/
 
+/* The maximum number of certificates collected for a bulk import
+ * before they are written.  */
+#define MAX_PENDING_CERTS 1000
+
+
+/* A certificate collected for a bulk import.  */
+struct pending_cert_s
+{
+  struct pending_cert_s *next;
+  ksba_cert_t cert;
+  unsigned char fpr[20];
+  gpg_error_t rc;      /* Result of the basic checks.  */
+  int existed;         /* The certificate was already in the DB.  */
+  int store_failed;    /* Storing the certificate failed.  */
+};
+typedef struct pending_cert_s *pending_cert_t;
+
 
 struct stats_s {
   unsigned long count;
@@ -52,6 +69,13 @@ struct stats_s {
   unsigned long secret_read;
   unsigned long secret_imported;
   unsigned long secret_dups;
+
+  /* If BULK is set the certificates are collected in PENDING and
+   * written in one go by flush_pending_certs.  */
+  int bulk;
+  unsigned int npending;
+  pending_cert_t pending;
+  pending_cert_t *pending_tail;
  };
 
 
@@ -68,6 +92,9 @@ struct rsa_secret_key_s
 
 static gpg_error_t parse_p12 (ctrl_t ctrl, ksba_reader_t reader,
                               struct stats_s *stats);
+static void add_pending_cert (ctrl_t ctrl, struct stats_s *stats,
+                              ksba_cert_t cert);
+static void flush_pending_certs (ctrl_t ctrl, struct stats_s *stats);
 
 
 
@@ -171,6 +198,12 @@ check_and_store (ctrl_t ctrl, struct stats_s *stats,
 {
   int rc;
 
+  if (stats && stats->bulk && !depth)
+    {
+      add_pending_cert (ctrl, stats, cert);
+      return;
+    }
+
   if (stats)
     stats->count++;
   if ( depth >= 50 )
@@ -208,6 +241,8 @@ check_and_store (ctrl_t ctrl, struct stats_s *stats,
 
           if (!existed)
             {
+              /* A new certificate may change the chain.  */
+              gpgsm_flush_validation_cache (ctrl);
               print_imported_status (ctrl, cert, 1);
               if (stats)
                 stats->imported++;
@@ -271,6 +306,233 @@ check_and_store (ctrl_t ctrl, struct stats_s *stats,
 
 
 
+/* Add CERT to the certificates of a bulk import.  Duplicates are
+ * detected here and handled the same way as certificates which are
+ * already in the DB.  */
+static void
+add_pending_cert (ctrl_t ctrl, struct stats_s *stats, ksba_cert_t cert)
+{
+  pending_cert_t pc;
+  unsigned char fpr[20];
+
+  stats->count++;
+  if (!gpgsm_get_fingerprint (cert, 0, fpr, NULL))
+    {
+      log_error (_("failed to get the fingerprint\n"));
+      stats->not_imported++;
+      print_import_problem (ctrl, cert, 0);
+      return;
+    }
+  for (pc = stats->pending; pc; pc = pc->next)
+    if (!memcmp (pc->fpr, fpr, 20))
+      {
+        print_imported_status (ctrl, cert, 0);
+        stats->unchanged++;
+        return;
+      }
+
+  pc = xtrycalloc (1, sizeof *pc);
+  if (!pc)
+    {
+      log_error ("error allocating memory: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      stats->not_imported++;
+      print_import_problem (ctrl, cert, 4);
+      return;
+    }
+  ksba_cert_ref (cert);
+  pc->cert = cert;
+  memcpy (pc->fpr, fpr, 20);
+  if (!stats->pending_tail)
+    stats->pending_tail = &stats->pending;
+  *stats->pending_tail = pc;
+  stats->pending_tail = &pc->next;
+  stats->npending++;
+
+  if (stats->npending >= MAX_PENDING_CERTS)
+    flush_pending_certs (ctrl, stats);
+}
+
+
+/* Run the basic checks for the pending certificate PC.  This is
+ * similar to gpgsm_basic_cert_check but also uses the other pending
+ * certificates to find the issuer; thus the order of the
+ * certificates in a bundle does not matter.  */
+static gpg_error_t
+check_pending_cert (ctrl_t ctrl, struct stats_s *stats, pending_cert_t pc)
+{
+  gpg_error_t err;
+  pending_cert_t pi;
+  char *issuer, *subject;
+  int found = 0;
+
+  issuer = ksba_cert_get_issuer (pc->cert, 0);
+  if (!issuer || opt.no_chain_validation)
+    {
+      xfree (issuer);
+      return gpgsm_basic_cert_check (ctrl, pc->cert);
+    }
+
+  err = 0;
+  for (pi = stats->pending; pi; pi = pi->next)
+    {
+      if (pi == pc)
+        continue;
+      subject = ksba_cert_get_subject (pi->cert, 0);
+      if (subject && !strcmp (subject, issuer))
+        {
+          found = 1;
+          err = gpgsm_check_cert_sig (pi->cert, pc->cert);
+        }
+      xfree (subject);
+      if (found && !err)
+        break;
+    }
+  xfree (issuer);
+
+  if (!found)
+    return gpgsm_basic_cert_check (ctrl, pc->cert);
+  if (err)
+    {
+      log_error ("certificate has a BAD signature: %s\n", gpg_strerror (err));
+      return gpg_error (GPG_ERR_BAD_CERT);
+    }
+  return 0;
+}
+
+
+/* Store all the certificates collected for a bulk import.  After
+ * running the checks, the certificates are written using only one
+ * locked pass over the keybox.  */
+static void
+flush_pending_certs (ctrl_t ctrl, struct stats_s *stats)
+{
+  gpg_error_t err, rc;
+  KEYDB_HANDLE kh = NULL;
+  pending_cert_t pc, pcnext;
+  unsigned int flags;
+  int any_new = 0;
+
+  if (!stats->pending)
+    return;
+
+  for (pc = stats->pending; pc; pc = pc->next)
+    pc->rc = check_pending_cert (ctrl, stats, pc);
+
+  kh = keydb_new (ctrl);
+  if (!kh)
+    {
+      log_error (_("failed to allocate keyDB handle\n"));
+      err = gpg_error (GPG_ERR_ENOMEM);
+    }
+  else
+    {
+      keydb_set_ephemeral (kh, 1);
+      err = keydb_lock (kh);
+      if (err)
+        log_error (_("error locking keybox: %s\n"), gpg_strerror (err));
+    }
+
+  for (pc = stats->pending; pc; pc = pc->next)
+    {
+      if (pc->rc && gpg_err_code (pc->rc) != GPG_ERR_MISSING_CERT
+          && gpg_err_code (pc->rc) != GPG_ERR_MISSING_ISSUER_CERT)
+        continue;  /* Failed the checks.  */
+      pc->rc = 0;
+      if (err)
+        {
+          pc->store_failed = 1;
+          continue;
+        }
+
+      keydb_search_reset (kh);
+      rc = keydb_search_fpr (ctrl, kh, pc->fpr);
+      if (!rc)
+        {
+          /* Remove an ephemeral flag to "store" it permanently.  */
+          pc->existed = 1;
+          rc = keydb_get_flags (kh, KEYBOX_FLAG_BLOB, 0, &flags);
+          if (!rc && (flags & KEYBOX_FLAG_BLOB_EPHEMERAL))
+            rc = keydb_set_flags (kh, KEYBOX_FLAG_BLOB, 0,
+                                  flags & ~KEYBOX_FLAG_BLOB_EPHEMERAL);
+          if (rc)
+            log_error ("clearing ephemeral flag failed: %s\n",
+                       gpg_strerror (rc));
+        }
+      else if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+        {
+          keydb_set_ephemeral (kh, 0);
+          rc = keydb_locate_writable (kh, 0);
+          if (rc)
+            log_error (_("error finding writable keyDB: %s\n"),
+                       gpg_strerror (rc));
+          else if ((rc = keydb_insert_cert (kh, pc->cert)))
+            log_error (_("error storing certificate: %s\n"),
+                       gpg_strerror (rc));
+          keydb_set_ephemeral (kh, 1);
+          if (!rc)
+            any_new = 1;
+        }
+      else
+        log_error (_("problem looking for existing certificate: %s\n"),
+                   gpg_strerror (rc));
+      if (rc)
+        pc->store_failed = 1;
+    }
+  keydb_release (kh);
+  if (any_new)
+    gpgsm_flush_validation_cache (ctrl);
+
+  /* Print the results and, as in check_and_store, walk up the chain
+   * to also import certificates from the ephemeral keybox.  */
+  for (pc = stats->pending; pc; pc = pcnext)
+    {
+      pcnext = pc->next;
+      if (pc->store_failed)
+        {
+          log_error (_("error storing certificate\n"));
+          stats->not_imported++;
+          print_import_problem (ctrl, pc->cert, 4);
+        }
+      else if (!pc->rc)
+        {
+          ksba_cert_t next = NULL;
+
+          print_imported_status (ctrl, pc->cert, !pc->existed);
+          if (pc->existed)
+            stats->unchanged++;
+          else
+            stats->imported++;
+          if (opt.verbose > 1 && pc->existed)
+            log_info ("certificate already in DB\n");
+          else if (opt.verbose && !pc->existed)
+            log_info ("certificate imported\n");
+
+          if (!gpgsm_walk_cert_chain (ctrl, pc->cert, &next))
+            {
+              check_and_store (ctrl, NULL, next, 1);
+              ksba_cert_release (next);
+            }
+        }
+      else
+        {
+          log_error (_("basic certificate checks failed - not imported\n"));
+          stats->not_imported++;
+          print_import_problem
+            (ctrl, pc->cert,
+             gpg_err_code (pc->rc) == GPG_ERR_MISSING_ISSUER_CERT? 2 :
+             gpg_err_code (pc->rc) == GPG_ERR_MISSING_CERT? 2 :
+             gpg_err_code (pc->rc) == GPG_ERR_BAD_CERT?     1 : 0);
+        }
+      ksba_cert_release (pc->cert);
+      xfree (pc);
+    }
+  stats->pending = NULL;
+  stats->pending_tail = NULL;
+  stats->npending = 0;
+}
+
+
 static int
 import_one (ctrl_t ctrl, struct stats_s *stats, estream_t fp)
 {
@@ -506,7 +768,11 @@ gpgsm_import (ctrl_t ctrl, estream_t in_fp, int reimport_mode)
   if (reimport_mode)
     rc = reimport_one (ctrl, &stats, in_fp);
   else
-    rc = import_one (ctrl, &stats, in_fp);
+    {
+      stats.bulk = !ctrl->with_validation;
+      rc = import_one (ctrl, &stats, in_fp);
+      flush_pending_certs (ctrl, &stats);
+    }
   print_imported_summary (ctrl, &stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
@@ -525,6 +791,10 @@ gpgsm_import_files (ctrl_t ctrl, int nfiles, char **files,
   struct stats_s stats;
 
   memset (&stats, 0, sizeof stats);
+  /* A full validation requires that each certificate is stored before
+   * the next one is checked; thus we can do a bulk import only
+   * without it.  */
+  stats.bulk = !ctrl->with_validation;
 
   if (!nfiles)
     {
@@ -544,6 +814,7 @@ gpgsm_import_files (ctrl_t ctrl, int nfiles, char **files,
             rc = 0;
         }
     }
+  flush_pending_certs (ctrl, &stats);
   print_imported_summary (ctrl, &stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
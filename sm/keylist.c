@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <npth.h>
 
 #include "gpgsm.h"
 
@@ -49,6 +50,55 @@ struct list_external_parm_s
 };
 
 
+/* The maximum number of workers of a parallel listing.  */
+#define MAX_VALIDATION_JOBS 8
+
+/* A certificate to be listed by a worker of a parallel listing.  */
+struct list_job_s
+{
+  struct list_job_s *next;
+  ksba_cert_t cert;
+  unsigned int validity;
+  int have_secret;
+  estream_t fp;   /* The output for this certificate.  */
+  int done;
+};
+
+/* The state of a parallel listing.  */
+struct list_parallel_s
+{
+  ctrl_t ctrl;
+  struct list_job_s *jobs;  /* The jobs not yet written out.  */
+  struct list_job_s **tail; /* The end of that list.  */
+  struct list_job_s *next;  /* The next job to start.  */
+  unsigned int njobs;       /* Number of items in JOBS.  */
+  unsigned int nthreads;    /* Number of running workers.  */
+  int stop;                 /* Make the workers terminate.  */
+  npth_cond_t cond;
+};
+
+/* The parts of CTRL a worker needs to keep while it does not hold
+ * the lock.  */
+struct list_worker_state_s
+{
+  gnupg_isotime_t revoked_at;
+  char *revocation_reason;
+};
+
+
+/* With --with-validation a key listing spends most of its time
+ * waiting for the dirmngr.  Thus several certificates are listed
+ * concurrently by worker threads.  The workers and the main thread
+ * hold LIST_LOCK all the time except while waiting for the dirmngr so
+ * that the listing code and the caches in CTRL need no further
+ * protection.  LIST_LOCK_USED is set while a parallel listing is
+ * active.  */
+static npth_mutex_t list_lock = NPTH_MUTEX_INITIALIZER;
+static int list_lock_used;
+static npth_key_t list_worker_key;
+static int list_worker_key_valid;
+
+
 /* Do not print this extension in the list of extensions.  This is set
    for oids which are already available via ksba functions. */
 #define OID_FLAG_SKIP 1
@@ -1542,6 +1592,261 @@ list_cert_chain (ctrl_t ctrl, KEYDB_HANDLE hd,
 
 
 
+/* List CERT to FP in the format selected by CTRL.  VALIDITY is the
+ * validity flag from the keybox and HD the handle of the keybox
+ * where CERT has been found.  */
+static void
+list_cert (ctrl_t ctrl, KEYDB_HANDLE hd, ksba_cert_t cert,
+           unsigned int validity, estream_t fp, int have_secret,
+           int raw_mode)
+{
+  if (ctrl->with_colons)
+    list_cert_colon (ctrl, cert, validity, fp, have_secret);
+  else if (ctrl->with_chain)
+    list_cert_chain (ctrl, hd, cert,
+                     raw_mode, fp, ctrl->with_validation);
+  else
+    {
+      if (raw_mode)
+        list_cert_raw (ctrl, hd, cert, fp, have_secret,
+                       ctrl->with_validation);
+      else
+        list_cert_std (ctrl, cert, fp, have_secret,
+                       ctrl->with_validation);
+      es_putc ('\n', fp);
+    }
+}
+
+
+/* Release the lock of a parallel key listing before waiting for an
+ * external process.  The state of CTRL which belongs to this worker
+ * is saved.  This is a no-op if no parallel listing is active.  */
+void
+gpgsm_list_unlock (ctrl_t ctrl)
+{
+  struct list_worker_state_s *state;
+
+  if (!list_lock_used)
+    return;
+
+  state = npth_getspecific (list_worker_key);
+  if (state && ctrl)
+    {
+      gnupg_copy_time (state->revoked_at, ctrl->revoked_at);
+      state->revocation_reason = ctrl->revocation_reason;
+      ctrl->revocation_reason = NULL;
+    }
+  npth_mutex_unlock (&list_lock);
+}
+
+
+/* Take the lock released by gpgsm_list_unlock again.  */
+void
+gpgsm_list_lock (ctrl_t ctrl)
+{
+  struct list_worker_state_s *state;
+
+  if (!list_lock_used)
+    return;
+
+  npth_mutex_lock (&list_lock);
+  state = npth_getspecific (list_worker_key);
+  if (state && ctrl)
+    {
+      gnupg_copy_time (ctrl->revoked_at, state->revoked_at);
+      xfree (ctrl->revocation_reason);
+      ctrl->revocation_reason = state->revocation_reason;
+      state->revocation_reason = NULL;
+    }
+}
+
+
+/* Worker thread for a parallel key listing.  */
+static void *
+list_worker (void *arg)
+{
+  struct list_parallel_s *parm = arg;
+  struct list_worker_state_s state;
+  struct list_job_s *job;
+
+  memset (&state, 0, sizeof state);
+  npth_mutex_lock (&list_lock);
+  npth_setspecific (list_worker_key, &state);
+  for (;;)
+    {
+      while (!parm->stop && !parm->next)
+        npth_cond_wait (&parm->cond, &list_lock);
+      if (!parm->next)
+        break;
+      job = parm->next;
+      parm->next = job->next;
+
+      if (job->cert)
+        list_cert (parm->ctrl, NULL, job->cert, job->validity, job->fp,
+                   job->have_secret, 0);
+      job->done = 1;
+      npth_cond_broadcast (&parm->cond);
+    }
+  npth_setspecific (list_worker_key, NULL);
+  xfree (state.revocation_reason);
+  parm->nthreads--;
+  npth_cond_broadcast (&parm->cond);
+  npth_mutex_unlock (&list_lock);
+  return NULL;
+}
+
+
+/* Start a parallel listing with up to NTHREADS workers.  Returns false
+ * if that is not possible.  */
+static int
+list_parallel_start (struct list_parallel_s *parm, ctrl_t ctrl,
+                     unsigned int nthreads)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+
+  memset (parm, 0, sizeof *parm);
+  parm->ctrl = ctrl;
+  parm->tail = &parm->jobs;
+  if (!list_worker_key_valid)
+    {
+      if (npth_key_create (&list_worker_key, NULL))
+        return 0;
+      list_worker_key_valid = 1;
+    }
+  if (npth_cond_init (&parm->cond, NULL))
+    return 0;
+
+  list_lock_used = 1;
+  npth_mutex_lock (&list_lock);
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  while (parm->nthreads < nthreads)
+    {
+      parm->nthreads++;
+      if (npth_create (&thread, &tattr, list_worker, parm))
+        {
+          parm->nthreads--;
+          break;
+        }
+    }
+  npth_attr_destroy (&tattr);
+  if (!parm->nthreads)
+    {
+      npth_mutex_unlock (&list_lock);
+      list_lock_used = 0;
+      npth_cond_destroy (&parm->cond);
+      return 0;
+    }
+  return 1;
+}
+
+
+/* Wait for the oldest job of PARM and write its output to FP.  */
+static gpg_error_t
+list_parallel_flush_one (struct list_parallel_s *parm, estream_t fp)
+{
+  struct list_job_s *job = parm->jobs;
+  gpg_error_t err = 0;
+  void *buffer;
+  size_t buflen;
+
+  while (!job->done)
+    npth_cond_wait (&parm->cond, &list_lock);
+  parm->jobs = job->next;
+  if (!parm->jobs)
+    parm->tail = &parm->jobs;
+  parm->njobs--;
+
+  if (es_fclose_snatch (job->fp, &buffer, &buflen))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      if (buflen && es_write (fp, buffer, buflen, NULL))
+        err = gpg_error_from_syserror ();
+      es_free (buffer);
+    }
+  ksba_cert_release (job->cert);
+  xfree (job);
+  return err;
+}
+
+
+/* Queue CERT for listing by the workers of PARM.  The output is
+ * written to FP in the order the certificates were queued.  HEADER
+ * is printed before the certificate if not NULL.  CERT may be NULL
+ * to print only the header.  */
+static gpg_error_t
+list_parallel_add (struct list_parallel_s *parm, estream_t fp,
+                   ksba_cert_t cert, unsigned int validity, int have_secret,
+                   const char *header)
+{
+  gpg_error_t err = 0;
+  struct list_job_s *job;
+  int i;
+
+  job = xtrycalloc (1, sizeof *job);
+  if (!job)
+    return gpg_error_from_syserror ();
+  job->fp = es_fopenmem (0, "w+b");
+  if (!job->fp)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (job);
+      return err;
+    }
+  if (header)
+    {
+      es_fprintf (job->fp, "%s\n", header);
+      for (i=strlen (header); i; i--)
+        es_putc ('-', job->fp);
+      es_putc ('\n', job->fp);
+    }
+  if (cert)
+    ksba_cert_ref (cert);
+  job->cert = cert;
+  job->validity = validity;
+  job->have_secret = have_secret;
+
+  *parm->tail = job;
+  parm->tail = &job->next;
+  parm->njobs++;
+  if (!parm->next)
+    parm->next = job;
+  npth_cond_broadcast (&parm->cond);
+
+  /* Do not read too far ahead.  */
+  while (!err && parm->njobs > 4 * parm->nthreads)
+    err = list_parallel_flush_one (parm, fp);
+  return err;
+}
+
+
+/* Write out all jobs of PARM to FP and terminate the workers.  */
+static gpg_error_t
+list_parallel_finish (struct list_parallel_s *parm, estream_t fp)
+{
+  gpg_error_t err = 0;
+  gpg_error_t tmperr;
+
+  while (parm->jobs)
+    {
+      tmperr = list_parallel_flush_one (parm, fp);
+      if (!err)
+        err = tmperr;
+    }
+
+  parm->stop = 1;
+  npth_cond_broadcast (&parm->cond);
+  while (parm->nthreads)
+    npth_cond_wait (&parm->cond, &list_lock);
+  npth_mutex_unlock (&list_lock);
+  list_lock_used = 0;
+  npth_cond_destroy (&parm->cond);
+  return err;
+}
+
+
 /* List all internal keys or just the keys given as NAMES.  MODE is a
    bit vector to specify what keys are to be included; see
    gpgsm_list_keys (below) for details.  If RAW_MODE is true, the raw
@@ -1561,6 +1866,8 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
   const char *lastresname, *resname;
   int have_secret;
   int want_ephemeral = ctrl->with_ephemeral_keys;
+  struct list_parallel_s parallel;
+  int use_parallel = 0;
 
   hd = keydb_new (ctrl);
   if (!hd)
@@ -1630,11 +1937,21 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
      currently we stop at the first match.  To do this we need an
      extra flag to enable this feature so */
 
+  /* Validate the certificates concurrently if we list to a file or
+     the terminal.  In server mode the status lines emitted by the
+     validation would get out of order with the data.  */
+  if (ctrl->with_validation && ctrl->no_server && !raw_mode
+      && !ctrl->with_chain && opt.validation_jobs > 1)
+    use_parallel = list_parallel_start (&parallel, ctrl,
+                                        MIN (opt.validation_jobs,
+                                             MAX_VALIDATION_JOBS));
+
   /* Suppress duplicates at least when they follow each other.  */
   lastresname = NULL;
   while (!(rc = keydb_search (ctrl, hd, desc, ndesc)))
     {
       unsigned int validity;
+      const char *header = NULL;
 
       if (!names)
         desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
@@ -1664,18 +1981,19 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
       resname = keydb_get_resource_name (hd);
 
       es_clearerr (fp);
-      if (lastresname != resname )
+      if (lastresname != resname && ctrl->no_server)
+        {
+          header = resname;
+          lastresname = resname;
+        }
+      if (header && !use_parallel)
         {
           int i;
 
-          if (ctrl->no_server)
-            {
-              es_fprintf (fp, "%s\n", resname );
-              for (i=strlen(resname); i; i-- )
-                es_putc ('-', fp);
-              es_putc ('\n', fp);
-              lastresname = resname;
-            }
+          es_fprintf (fp, "%s\n", header);
+          for (i=strlen (header); i; i--)
+            es_putc ('-', fp);
+          es_putc ('\n', fp);
         }
 
       have_secret = 0;
@@ -1697,22 +2015,14 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
       if (!mode          || ((mode & 1) && !have_secret)
           || ((mode & 2) && have_secret)  )
         {
-          if (ctrl->with_colons)
-            list_cert_colon (ctrl, cert, validity, fp, have_secret);
-          else if (ctrl->with_chain)
-            list_cert_chain (ctrl, hd, cert,
-                             raw_mode, fp, ctrl->with_validation);
+          if (use_parallel)
+            rc = list_parallel_add (&parallel, fp, cert, validity,
+                                    have_secret, header);
           else
-            {
-              if (raw_mode)
-                list_cert_raw (ctrl, hd, cert, fp, have_secret,
-                               ctrl->with_validation);
-              else
-                list_cert_std (ctrl, cert, fp, have_secret,
-                               ctrl->with_validation);
-              es_putc ('\n', fp);
-            }
+            list_cert (ctrl, hd, cert, validity, fp, have_secret, raw_mode);
         }
+      else if (use_parallel && header)
+        rc = list_parallel_add (&parallel, fp, NULL, 0, 0, header);
 
       ksba_cert_release (lastcert);
       lastcert = cert;
@@ -1738,6 +2048,16 @@ list_internal_keys (ctrl_t ctrl, strlist_t names, estream_t fp,
     log_error ("keydb_search failed: %s\n", gpg_strerror (rc));
 
  leave:
+  if (use_parallel)
+    {
+      gpg_error_t err = list_parallel_finish (&parallel, fp);
+
+      if (err && !rc)
+        {
+          rc = err;
+          log_error (_("error writing to output: %s\n"), gpg_strerror (rc));
+        }
+    }
   ksba_cert_release (cert);
   ksba_cert_release (lastcert);
   xfree (desc);
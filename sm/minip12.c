@@ -38,6 +38,9 @@
 #include <errno.h>
 
 #include <ksba.h>
+#ifndef WITHOUT_NPTH
+# include <npth.h>
+#endif
 
 #include "../common/util.h"
 #include "../common/logging.h"
@@ -147,6 +150,28 @@ struct buffer_s
 };
 
 
+/* A cache for derived keys.  The bags of a PKCS#12 file are often
+ * encrypted using the same salt and iteration count, and each failed
+ * attempt in decrypt_block derives the keys anew; for an ASCII
+ * passphrase all the charset conversions yield the same string.  The
+ * items are allocated in secure memory.  */
+struct kdf_cache_s
+{
+  struct kdf_cache_s *next;
+  int id;            /* The PKCS#12 KDF id or 0 for PBKDF2.  */
+  int digest_algo;   /* The digest algorithm used with PBKDF2.  */
+  int iter;
+  size_t saltlen;
+  size_t pwlen;
+  size_t keylen;
+  unsigned char data[1];  /* The salt, the passphrase and the key.  */
+};
+typedef struct kdf_cache_s *kdf_cache_t;
+
+/* The maximum number of items in a kdf cache.  */
+#define KDF_CACHE_MAX_ITEMS 16
+
+
 /* Parser communication object.  */
 struct p12_parse_ctx_s
 {
@@ -168,6 +193,9 @@ struct p12_parse_ctx_s
 
   /* A second private key as an MPI array.   */
   gcry_mpi_t *privatekey2;
+
+  /* The keys derived so far.  */
+  kdf_cache_t kdf_cache;
 };
 
 
@@ -323,6 +351,79 @@ builder_add_mpi (tlv_builder_t tb, int class, int tag, gcry_mpi_t mpi,
 }
 
 
+/* Return the key for ID and DIGEST_ALGO derived from PW, SALT of
+ * SALTLEN bytes and ITER with a length of KEYLEN bytes from CACHE or
+ * NULL if it has not yet been derived.  */
+static const unsigned char *
+kdf_cache_get (kdf_cache_t cache, int id, int digest_algo,
+               const char *salt, size_t saltlen, int iter,
+               const char *pw, size_t keylen)
+{
+  size_t pwlen = strlen (pw);
+
+  for (; cache; cache = cache->next)
+    if (cache->id == id && cache->digest_algo == digest_algo
+        && cache->iter == iter && cache->keylen == keylen
+        && cache->saltlen == saltlen && cache->pwlen == pwlen
+        && !memcmp (cache->data, salt, saltlen)
+        && !memcmp (cache->data + saltlen, pw, pwlen))
+      return cache->data + saltlen + pwlen;
+  return NULL;
+}
+
+
+/* Store the KEY of KEYLEN bytes in the cache at R_CACHE.  See
+ * kdf_cache_get for the other args.  R_CACHE may be NULL to disable
+ * caching.  */
+static void
+kdf_cache_put (kdf_cache_t *r_cache, int id, int digest_algo,
+               const char *salt, size_t saltlen, int iter,
+               const char *pw, const unsigned char *key, size_t keylen)
+{
+  kdf_cache_t item;
+  size_t pwlen;
+  int count = 0;
+
+  if (!r_cache)
+    return;
+  for (item = *r_cache; item; item = item->next)
+    if (++count >= KDF_CACHE_MAX_ITEMS)
+      return;
+
+  pwlen = strlen (pw);
+  item = gcry_malloc_secure (sizeof *item + saltlen + pwlen + keylen);
+  if (!item)
+    return;  /* Not having an item is not an error.  */
+  item->id = id;
+  item->digest_algo = digest_algo;
+  item->iter = iter;
+  item->saltlen = saltlen;
+  item->pwlen = pwlen;
+  item->keylen = keylen;
+  memcpy (item->data, salt, saltlen);
+  memcpy (item->data + saltlen, pw, pwlen);
+  memcpy (item->data + saltlen + pwlen, key, keylen);
+  item->next = *r_cache;
+  *r_cache = item;
+}
+
+
+/* Wipe and release all items of CACHE.  */
+static void
+kdf_cache_release (kdf_cache_t cache)
+{
+  kdf_cache_t next;
+
+  for (; cache; cache = next)
+    {
+      next = cache->next;
+      wipememory (cache, sizeof *cache
+                  + cache->saltlen + cache->pwlen + cache->keylen);
+      gcry_free (cache);
+    }
+}
+
+
 static int
 string_to_key (int id, char *salt, size_t saltlen, int iter, const char *pw,
                int req_keylen, unsigned char *keybuf)
@@ -421,41 +522,154 @@ string_to_key (int id, char *salt, size_t saltlen, int iter, const char *pw,
 }
 
 
+/* The arguments and the result of a string_to_key run.  */
+struct s2k_job_s
+{
+  int id;
+  char *salt;
+  size_t saltlen;
+  int iter;
+  const char *pw;
+  int keylen;
+  unsigned char *keybuf;
+  int rc;
+};
+
+
+/* Run the string_to_key JOB.  The iterated hashing is done without
+ * holding the npth lock so that it can run in parallel to other
+ * jobs.  */
+static void *
+s2k_worker (void *arg)
+{
+  struct s2k_job_s *job = arg;
+
+#ifndef WITHOUT_NPTH
+  npth_unprotect ();
+#endif
+  job->rc = string_to_key (job->id, job->salt, job->saltlen, job->iter,
+                           job->pw, job->keylen, job->keybuf);
+#ifndef WITHOUT_NPTH
+  npth_protect ();
+#endif
+  return NULL;
+}
+
+
 static int
 set_key_iv (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
-            const char *pw, int keybytes)
+            const char *pw, int keybytes, kdf_cache_t *kdf_cache)
 {
   unsigned char keybuf[24];
-  int rc;
+  unsigned char ivbuf[8];
+  const unsigned char *key, *iv;
+  struct s2k_job_s jobs[2];
+  int njobs = 0;
+  int i, rc;
 
   log_assert (keybytes == 5 || keybytes == 24);
-  if (string_to_key (1, salt, saltlen, iter, pw, keybytes, keybuf))
-    return -1;
-  rc = gcry_cipher_setkey (chd, keybuf, keybytes);
+  key = kdf_cache? kdf_cache_get (*kdf_cache, 1, 0, salt, saltlen, iter,
+                                  pw, keybytes) : NULL;
+  iv = kdf_cache? kdf_cache_get (*kdf_cache, 2, 0, salt, saltlen, iter,
+                                 pw, 8) : NULL;
+  if (!key)
+    {
+      jobs[njobs].id = 1;
+      jobs[njobs].keylen = keybytes;
+      jobs[njobs].keybuf = keybuf;
+      njobs++;
+    }
+  if (!iv)
+    {
+      jobs[njobs].id = 2;
+      jobs[njobs].keylen = 8;
+      jobs[njobs].keybuf = ivbuf;
+      njobs++;
+    }
+  for (i=0; i < njobs; i++)
+    {
+      jobs[i].salt = salt;
+      jobs[i].saltlen = saltlen;
+      jobs[i].iter = iter;
+      jobs[i].pw = pw;
+      jobs[i].rc = -1;
+    }
+
+  /* The key and the IV are derived independently; thus we use a
+   * second thread for the IV.  */
+#ifndef WITHOUT_NPTH
+  if (njobs == 2)
+    {
+      npth_t thd;
+      npth_attr_t tattr;
+      int started = 0;
+
+      if (!npth_attr_init (&tattr))
+        {
+          npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+          started = !npth_create (&thd, &tattr, s2k_worker, jobs + 1);
+          npth_attr_destroy (&tattr);
+        }
+      s2k_worker (jobs);
+      if (started)
+        npth_join (thd, NULL);
+      else
+        s2k_worker (jobs + 1);
+    }
+  else
+#endif
+    for (i=0; i < njobs; i++)
+      s2k_worker (jobs + i);
+
+  rc = 0;
+  for (i=0; i < njobs; i++)
+    if (jobs[i].rc)
+      rc = -1;
+  if (rc)
+    goto leave;
+
+  if (!key)
+    {
+      kdf_cache_put (kdf_cache, 1, 0, salt, saltlen, iter, pw,
+                     keybuf, keybytes);
+      key = keybuf;
+    }
+  if (!iv)
+    {
+      kdf_cache_put (kdf_cache, 2, 0, salt, saltlen, iter, pw, ivbuf, 8);
+      iv = ivbuf;
+    }
+
+  rc = gcry_cipher_setkey (chd, key, keybytes);
   if (rc)
     {
       log_error ( "gcry_cipher_setkey failed: %s\n", gpg_strerror (rc));
-      return -1;
+      rc = -1;
+      goto leave;
     }
 
-  if (string_to_key (2, salt, saltlen, iter, pw, 8, keybuf))
-    return -1;
-  rc = gcry_cipher_setiv (chd, keybuf, 8);
+  rc = gcry_cipher_setiv (chd, iv, 8);
   if (rc)
     {
       log_error ("gcry_cipher_setiv failed: %s\n", gpg_strerror (rc));
-      return -1;
+      rc = -1;
+      goto leave;
     }
-  return 0;
+
+ leave:
+  wipememory (keybuf, sizeof keybuf);
+  wipememory (ivbuf, sizeof ivbuf);
+  return rc;
 }
 
 
 static int
 set_key_iv_pbes2 (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
                   const void *iv, size_t ivlen, const char *pw,
-                  int cipher_algo, int digest_algo)
+                  int cipher_algo, int digest_algo, kdf_cache_t *kdf_cache)
 {
   unsigned char *keybuf;
+  const unsigned char *key;
   size_t keylen;
   int rc;
 
@@ -466,14 +680,23 @@ set_key_iv_pbes2 (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
   if (!keybuf)
     return -1;
 
-  rc = gcry_kdf_derive (pw, strlen (pw),
-                        GCRY_KDF_PBKDF2, digest_algo,
-                        salt, saltlen, iter, keylen, keybuf);
-  if (rc)
+  key = kdf_cache? kdf_cache_get (*kdf_cache, 0, digest_algo, salt, saltlen,
+                                  iter, pw, keylen) : NULL;
+  if (key)
+    memcpy (keybuf, key, keylen);
+  else
     {
-      log_error ("gcry_kdf_derive failed: %s\n", gpg_strerror (rc));
-      gcry_free (keybuf);
-      return -1;
+      rc = gcry_kdf_derive (pw, strlen (pw),
+                            GCRY_KDF_PBKDF2, digest_algo,
+                            salt, saltlen, iter, keylen, keybuf);
+      if (rc)
+        {
+          log_error ("gcry_kdf_derive failed: %s\n", gpg_strerror (rc));
+          gcry_free (keybuf);
+          return -1;
+        }
+      kdf_cache_put (kdf_cache, 0, digest_algo, salt, saltlen, iter, pw,
+                     keybuf, keylen);
     }
 
   rc = gcry_cipher_setkey (chd, keybuf, keylen);
@@ -498,7 +721,8 @@ set_key_iv_pbes2 (gcry_cipher_hd_t chd, char *salt, size_t saltlen, int iter,
 static void
 crypt_block (unsigned char *buffer, size_t length, char *salt, size_t saltlen,
              int iter, const void *iv, size_t ivlen,
-             const char *pw, int cipher_algo, int digest_algo, int encrypt)
+             const char *pw, int cipher_algo, int digest_algo, int encrypt,
+             kdf_cache_t *kdf_cache)
 {
   gcry_cipher_hd_t chd;
   int rc;
@@ -513,9 +737,9 @@ crypt_block (unsigned char *buffer, size_t length, char *salt, size_t saltlen,
 
   if ((cipher_algo == GCRY_CIPHER_AES128 || cipher_algo == GCRY_CIPHER_AES256)
       ? set_key_iv_pbes2 (chd, salt, saltlen, iter, iv, ivlen, pw,
-                          cipher_algo, digest_algo)
+                          cipher_algo, digest_algo, kdf_cache)
       : set_key_iv (chd, salt, saltlen, iter, pw,
-                    cipher_algo == GCRY_CIPHER_RFC2268_40? 5:24))
+                    cipher_algo == GCRY_CIPHER_RFC2268_40? 5:24, kdf_cache))
     {
       wipememory (buffer, length);
       goto leave;
@@ -544,14 +768,16 @@ crypt_block (unsigned char *buffer, size_t length, char *salt, size_t saltlen,
    and CIPHER_ALGO is the algorithm id to use.  CHECK_FNC is a
    function called with the plaintext and used to check whether the
    decryption succeeded; i.e. that a correct passphrase has been
-   given.  The function returns the length of the unpadded plaintext
-   or 0 on error.  */
+   given.  Derived keys are taken from and stored in KDF_CACHE.  The
+   function returns the length of the unpadded plaintext or 0 on
+   error.  */
 static size_t
 decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
                char *salt, size_t saltlen,
                int iter, const void *iv, size_t ivlen,
                const char *pw, int cipher_algo, int digest_algo,
-               int (*check_fnc) (const void *, size_t))
+               int (*check_fnc) (const void *, size_t),
+               kdf_cache_t *kdf_cache)
 {
   static const char * const charsets[] = {
     "",   /* No conversion - use the UTF-8 passphrase direct.  */
@@ -623,7 +849,8 @@ decrypt_block (const void *ciphertext, unsigned char *plaintext, size_t length,
         }
       memcpy (plaintext, ciphertext, length);
       crypt_block (plaintext, length, salt, saltlen, iter, iv, ivlen,
-                   convertedpw? convertedpw:pw, cipher_algo, digest_algo, 0);
+                   convertedpw? convertedpw:pw, cipher_algo, digest_algo, 0,
+                   kdf_cache);
       dump_to_file (plaintext, length, "raw-decrypt");
       if (check_fnc (plaintext, length))
         {
@@ -947,7 +1174,7 @@ parse_bag_encrypted_data (struct p12_parse_ctx_s *ctx, tlv_parser_t tlv)
                  is_pbes2 ? (is_aes256?GCRY_CIPHER_AES256:GCRY_CIPHER_AES128) :
                  is_3des  ? GCRY_CIPHER_3DES : GCRY_CIPHER_RFC2268_40,
                  digest_algo,
-                 bag_decrypted_data_p);
+                 bag_decrypted_data_p, &ctx->kdf_cache);
   if (!datalen)
     {
       err = gpg_error (GPG_ERR_DECRYPT_FAILED);
@@ -1473,7 +1700,7 @@ parse_shrouded_key_bag (struct p12_parse_ctx_s *ctx, tlv_parser_t tlv)
                  is_pbes2 ? (is_aes256?GCRY_CIPHER_AES256:GCRY_CIPHER_AES128)
                           : GCRY_CIPHER_3DES,
                  digest_algo,
-                 bag_data_p);
+                 bag_data_p, &ctx->kdf_cache);
   if (!datalen)
     {
       err = gpg_error (GPG_ERR_DECRYPT_FAILED);
@@ -2102,6 +2329,7 @@ p12_parse (const unsigned char *buffer, size_t length, const char *pw,
         log_debug ("parser context released\n");
     }
   tlv_parser_release (tlv);
+  kdf_cache_release (ctx.kdf_cache);
   if (r_curve)
     *r_curve = ctx.curve;
   else
@@ -2148,6 +2376,7 @@ p12_parse (const unsigned char *buffer, size_t length, const char *pw,
       ctx.privatekey2 = NULL;
     }
   tlv_parser_release (tlv);
+  kdf_cache_release (ctx.kdf_cache);
   gcry_free (ctx.curve);
   if (r_curve)
     *r_curve = NULL;
@@ -3105,7 +3334,7 @@ p12_build (gcry_mpi_t *kparms, const void *cert, size_t certlen,
       /* Encrypt it. */
       gcry_randomize (salt, 8, GCRY_STRONG_RANDOM);
       crypt_block (buffer, buflen, salt, 8, 2048, NULL, 0, pw,
-                   GCRY_CIPHER_RFC2268_40, GCRY_MD_SHA1, 1);
+                   GCRY_CIPHER_RFC2268_40, GCRY_MD_SHA1, 1, NULL);
 
       /* Encode the encrypted stuff into a bag. */
       seqlist[seqlistidx].buffer = build_cert_bag (buffer, buflen, salt, &n);
@@ -3137,7 +3366,7 @@ p12_build (gcry_mpi_t *kparms, const void *cert, size_t certlen,
       /* Encrypt it. */
       gcry_randomize (salt, 8, GCRY_STRONG_RANDOM);
       crypt_block (buffer, buflen, salt, 8, 2048, NULL, 0,
-                   pw, GCRY_CIPHER_3DES, GCRY_MD_SHA1, 1);
+                   pw, GCRY_CIPHER_3DES, GCRY_MD_SHA1, 1, NULL);
 
       /* Encode the encrypted stuff into a bag. */
       if (cert && certlen)
@@ -33,9 +33,20 @@
 #include "../common/server-help.h"
 #include "../common/asshelp.h"
 #include "../common/shareddefs.h"
+#include "../common/host2net.h"
+#include "../common/metrics.h"
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
 
+/* The operations which can be run on a stream of messages.  The
+ * values are those used with the FILE_START status.  */
+#define STREAM_OP_VERIFY   1
+#define STREAM_OP_ENCRYPT  2
+#define STREAM_OP_DECRYPT  3
+
+/* The maximum length of a single message in a message stream.  */
+#define MAX_STREAM_MESSAGE_LEN  (256*1024*1024)
+
 
 /* Used to track whether we printed any FAILURE status in non-server
  * mode.  */
@@ -351,6 +362,25 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  metrics_command_begin (ctx, cmd);
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  (void)err;
+
+  metrics_command_end (ctx);
+}
+
+
 static gpg_error_t
 input_notify (assuan_context_t ctx, char *line)
 {
@@ -456,8 +486,148 @@ cmd_signer (assuan_context_t ctx, char *line)
 }
 
 
+/* Run the operation OP on each message read from INP_FP and write
+ * the results in the same order to OUT_FP.  Each message is framed
+ * by a 4 byte big endian length; a zero length or EOF ends the
+ * stream.  Each result is framed by a 4 byte big endian length
+ * followed by a 4 byte big endian error code; the output of a failed
+ * operation is not returned.  OUT_FP may be NULL for a verify.  The
+ * status lines of each message are enclosed in FILE_START and
+ * FILE_DONE status lines.  An error is only returned if the stream
+ * itself could not be processed.  */
+static gpg_error_t
+process_message_stream (ctrl_t ctrl, int op, estream_t inp_fp,
+                        estream_t out_fp)
+{
+  gpg_error_t err = 0;
+  gpg_error_t rc;
+  unsigned char hdr[8];
+  char opbuf[5], numbuf[20];
+  char *buffer;
+  size_t nread, n, msglen;
+  unsigned int msgno;
+  estream_t msg_fp = NULL;
+  estream_t res_fp = NULL;
+  void *result = NULL;
+  size_t resultlen;
+
+  buffer = xtrymalloc (64*1024);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+
+  snprintf (opbuf, sizeof opbuf, "%d", op);
+  for (msgno = 1; ; msgno++)
+    {
+      if (es_read (inp_fp, hdr, 4, &nread))
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      if (!nread)
+        break;
+      msglen = buf32_to_size_t (hdr);
+      if (nread != 4 || msglen > MAX_STREAM_MESSAGE_LEN)
+        {
+          err = gpg_error (GPG_ERR_INV_LENGTH);
+          break;
+        }
+      if (!msglen)
+        break;
+
+      msg_fp = es_fopenmem (0, "w+b");
+      res_fp = es_fopenmem (0, "w+b");
+      if (!msg_fp || !res_fp)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      for (; msglen; msglen -= nread)
+        {
+          n = msglen < 64*1024? msglen : 64*1024;
+          if (es_read (inp_fp, buffer, n, &nread))
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          if (!nread)
+            {
+              err = gpg_error (GPG_ERR_EOF);
+              break;
+            }
+          if (es_write (msg_fp, buffer, nread, NULL))
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+        }
+      if (err)
+        break;
+      es_rewind (msg_fp);
+
+      snprintf (numbuf, sizeof numbuf, "%u", msgno);
+      gpgsm_status2 (ctrl, STATUS_FILE_START, opbuf, numbuf, NULL);
+      /* The recipients of an encryption may already have been logged
+       * to the audit session.  */
+      rc = (op == STREAM_OP_ENCRYPT && msgno == 1 && ctrl->audit)
+           ? 0 : start_audit_session (ctrl);
+      if (!rc)
+        {
+          switch (op)
+            {
+            case STREAM_OP_VERIFY:
+              rc = gpgsm_verify (ctrl, msg_fp, NULL, res_fp);
+              break;
+            case STREAM_OP_ENCRYPT:
+              rc = gpgsm_encrypt (ctrl, ctrl->server_local->recplist,
+                                  msg_fp, res_fp);
+              break;
+            case STREAM_OP_DECRYPT:
+              rc = gpgsm_decrypt (ctrl, msg_fp, res_fp);
+              break;
+            default:
+              rc = gpg_error (GPG_ERR_BUG);
+              break;
+            }
+        }
+      gpgsm_status (ctrl, STATUS_FILE_DONE, NULL);
+      es_fclose (msg_fp);
+      msg_fp = NULL;
+
+      if (es_fclose_snatch (res_fp, &result, &resultlen))
+        {
+          res_fp = NULL;
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      res_fp = NULL;
+      if (rc)
+        resultlen = 0;  /* Never return partial output.  */
+      if (out_fp)
+        {
+          ulongtobuf (hdr, resultlen);
+          ulongtobuf (hdr + 4, rc);
+          if (es_write (out_fp, hdr, 8, NULL)
+              || (resultlen && es_write (out_fp, result, resultlen, NULL))
+              || es_fflush (out_fp))
+            err = gpg_error_from_syserror ();
+        }
+      if (result)
+        wipememory (result, resultlen);
+      es_free (result);
+      result = NULL;
+      if (err)
+        break;
+    }
+
+  es_fclose (msg_fp);
+  es_fclose (res_fp);
+  xfree (buffer);
+  return err;
+}
+
+
 static const char hlp_encrypt[] =
-  "ENCRYPT \n"
+  "ENCRYPT [--multi]\n"
   "\n"
   "Do the actual encryption process. Takes the plaintext from the INPUT\n"
   "command, writes to the ciphertext to the file descriptor set with\n"
@@ -469,7 +639,14 @@ static const char hlp_encrypt[] =
   "\n"
   "This command should in general not fail, as all necessary checks\n"
   "have been done while setting the recipients.  The input and output\n"
-  "pipes are closed.";
+  "pipes are closed.\n"
+  "\n"
+  "With --multi the input is a stream of messages, each prefixed by its\n"
+  "length as a 4 byte big endian number and terminated by a zero length\n"
+  "or EOF.  Each message is encrypted to the same recipients and the\n"
+  "results are written in order, each prefixed by its length and an\n"
+  "error code as 4 byte big endian numbers.  The status lines of a\n"
+  "message are enclosed in FILE_START and FILE_DONE.";
 static gpg_error_t
 cmd_encrypt (assuan_context_t ctx, char *line)
 {
@@ -479,10 +656,9 @@ cmd_encrypt (assuan_context_t ctx, char *line)
   gnupg_fd_t out_fd;
   estream_t inp_fp;
   estream_t out_fp;
+  int multi;
   int rc;
 
-  (void)line;
-
   inp_fd = assuan_get_input_fd (ctx);
   if (inp_fd == GNUPG_INVALID_FD)
     return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
@@ -498,6 +674,8 @@ cmd_encrypt (assuan_context_t ctx, char *line)
   if (!out_fp)
     return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
 
+  multi = has_option (line, "--multi");
+
   /* Now add all encrypt-to marked recipients from the default
      list. */
   rc = 0;
@@ -508,9 +686,11 @@ cmd_encrypt (assuan_context_t ctx, char *line)
           rc = gpgsm_add_cert_to_certlist (ctrl, cl->cert,
                                            &ctrl->server_local->recplist, 1);
     }
-  if (!rc)
+  if (!rc && multi)
+    rc = process_message_stream (ctrl, STREAM_OP_ENCRYPT, inp_fp, out_fp);
+  else if (!rc)
     rc = ctrl->audit? 0 : start_audit_session (ctrl);
-  if (!rc)
+  if (!rc && !multi)
     rc = gpgsm_encrypt (assuan_get_pointer (ctx),
                         ctrl->server_local->recplist,
                         inp_fp, out_fp);
@@ -529,13 +709,15 @@ cmd_encrypt (assuan_context_t ctx, char *line)
 
 
 static const char hlp_decrypt[] =
-  "DECRYPT\n"
+  "DECRYPT [--multi]\n"
   "\n"
   "This performs the decrypt operation after doing some check on the\n"
   "internal state. (e.g. that only needed data has been set).  Because\n"
   "it utilizes the GPG-Agent for the session key decryption, there is\n"
   "no need to ask the client for a protecting passphrase - GPG-Agent\n"
-  "does take care of this by requesting this from the user.";
+  "does take care of this by requesting this from the user.\n"
+  "\n"
+  "With --multi a stream of messages is decrypted; see ENCRYPT.";
 static gpg_error_t
 cmd_decrypt (assuan_context_t ctx, char *line)
 {
@@ -546,8 +728,6 @@ cmd_decrypt (assuan_context_t ctx, char *line)
   estream_t out_fp;
   int rc;
 
-  (void)line;
-
   inp_fd = assuan_get_input_fd (ctx);
   if (inp_fd == GNUPG_INVALID_FD)
     return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
@@ -563,9 +743,14 @@ cmd_decrypt (assuan_context_t ctx, char *line)
   if (!out_fp)
     return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
 
-  rc = start_audit_session (ctrl);
-  if (!rc)
-    rc = gpgsm_decrypt (ctrl, inp_fp, out_fp);
+  if (has_option (line, "--multi"))
+    rc = process_message_stream (ctrl, STREAM_OP_DECRYPT, inp_fp, out_fp);
+  else
+    {
+      rc = start_audit_session (ctrl);
+      if (!rc)
+        rc = gpgsm_decrypt (ctrl, inp_fp, out_fp);
+    }
   es_fclose (inp_fp);
   es_fclose (out_fp);
 
@@ -579,14 +764,18 @@ cmd_decrypt (assuan_context_t ctx, char *line)
 
 
 static const char hlp_verify[] =
-  "VERIFY\n"
+  "VERIFY [--multi]\n"
   "\n"
   "This does a verify operation on the message send to the input FD.\n"
   "The result is written out using status lines.  If an output FD was\n"
   "given, the signed text will be written to that.\n"
   "\n"
   "If the signature is a detached one, the server will inquire about\n"
-  "the signed material and the client must provide it.";
+  "the signed material and the client must provide it.\n"
+  "\n"
+  "With --multi a stream of messages with opaque signatures is\n"
+  "verified; see ENCRYPT.  Detached signatures are not supported in\n"
+  "this mode.";
 static gpg_error_t
 cmd_verify (assuan_context_t ctx, char *line)
 {
@@ -596,11 +785,13 @@ cmd_verify (assuan_context_t ctx, char *line)
   gnupg_fd_t out_fd = assuan_get_output_fd (ctx);
   estream_t fp = NULL;
   estream_t out_fp = NULL;
-
-  (void)line;
+  int multi = has_option (line, "--multi");
 
   if (fd == GNUPG_INVALID_FD)
     return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+  if (multi && ctrl->server_local->message_fp)
+    return set_error (GPG_ERR_NOT_SUPPORTED,
+                      "detached signatures with --multi");
 
   fp = open_stream_nc (fd, "r");
   if (!fp)
@@ -613,10 +804,15 @@ cmd_verify (assuan_context_t ctx, char *line)
         return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
     }
 
-  rc = start_audit_session (ctrl);
-  if (!rc)
-    rc = gpgsm_verify (assuan_get_pointer (ctx), fp,
-                       ctrl->server_local->message_fp, out_fp);
+  if (multi)
+    rc = process_message_stream (ctrl, STREAM_OP_VERIFY, fp, out_fp);
+  else
+    {
+      rc = start_audit_session (ctrl);
+      if (!rc)
+        rc = gpgsm_verify (assuan_get_pointer (ctx), fp,
+                           ctrl->server_local->message_fp, out_fp);
+    }
   es_fclose (fp);
   es_fclose (out_fp);
 
@@ -1247,7 +1443,10 @@ static const char hlp_getinfo[] =
   "  cmd_has_option CMD OPT\n"
   "              - Returns OK if the command CMD implements the option OPT.\n"
   "  offline     - Returns OK if the connection is in offline mode."
-  "  always-trust- Returns OK if the connection is in always-trust mode.";
+  "  always-trust- Returns OK if the connection is in always-trust mode.\n"
+  "  cmdstats [--reset]\n"
+  "              - Return the statistics of the commands and optionally\n"
+  "                reset them.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -1311,6 +1510,18 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       rc = (ctrl->always_trust || opt.always_trust)? 0
            /**/                                    : gpg_error (GPG_ERR_FALSE);
     }
+  else if (!strcmp (line, "cmdstats") || !strcmp (line, "cmdstats --reset"))
+    {
+      char *buf = metrics_format_cmdstats ();
+
+      if (!buf)
+        rc = gpg_error_from_syserror ();
+      else
+        rc = assuan_send_data (ctx, buf, strlen (buf));
+      xfree (buf);
+      if (!rc && line[8])
+        metrics_reset_commands ();
+    }
   else
     rc = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
 
@@ -1478,6 +1689,8 @@ gpgsm_server (certlist_t default_recplist)
     assuan_set_hello_line (ctx, hello);
 
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_input_notify (ctx, input_notify);
   assuan_register_output_notify (ctx, output_notify);
   assuan_register_option_handler (ctx, option_handler);
@@ -56,17 +56,30 @@ strtimestamp_r (ksba_isotime_t atime)
 
 
 
+/* The size of the buffer used to hash the signed data.  */
+#define HASH_DATA_BUFSIZE (64*1024)
+
 /* Hash the data for a detached signature.  Returns 0 on success.  */
 static gpg_error_t
 hash_data (estream_t fp, gcry_md_hd_t md)
 {
   gpg_error_t err = 0;
-  char buffer[4096];
-  int nread;
+  char *buffer;
+  size_t nread;
 
+  /* Detached signatures are often used for large files; thus we use
+   * a large buffer to save on calls.  */
+  buffer = xtrymalloc (HASH_DATA_BUFSIZE);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error allocating buffer: %s\n", gpg_strerror (err));
+      return err;
+    }
   do
     {
-      nread = es_fread (buffer, 1, DIM(buffer), fp);
+      if (es_read (fp, buffer, HASH_DATA_BUFSIZE, &nread))
+        break;
       gcry_md_write (md, buffer, nread);
     }
   while (nread);
@@ -75,6 +88,7 @@ hash_data (estream_t fp, gcry_md_hd_t md)
       err = gpg_error_from_syserror ();
       log_error ("read error on fp %p: %s\n", fp, gpg_strerror (err));
     }
+  xfree (buffer);
   return err;
 }
 
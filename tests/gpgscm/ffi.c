@@ -33,7 +33,11 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
 
 #if HAVE_LIBREADLINE
 #define GNUPG_LIBREADLINE_H_INCLUDED
@@ -541,6 +545,49 @@ do_get_time (scheme *sc, pointer args)
   FFI_RETURN_INT (sc, gnupg_get_time ());
 }
 
+/* Return a monotonic time in seconds with microsecond resolution.  */
+static pointer
+do_get_clock (scheme *sc, pointer args)
+{
+  FFI_PROLOG ();
+  double value;
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+#endif
+  FFI_ARGS_DONE_OR_RETURN (sc, args);
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    value = ts.tv_sec + ts.tv_nsec / 1e9;
+  else
+#endif
+    value = gnupg_get_time ();
+  FFI_RETURN_POINTER (sc, mk_real (sc, value));
+}
+
+/* Return the CPU time in seconds used by this process and by its
+ * terminated and waited for children.  */
+static pointer
+do_get_cpu_time (scheme *sc, pointer args)
+{
+  FFI_PROLOG ();
+  double value;
+#ifdef HAVE_GETRUSAGE
+  struct rusage self, children;
+#endif
+  FFI_ARGS_DONE_OR_RETURN (sc, args);
+#ifdef HAVE_GETRUSAGE
+  if (getrusage (RUSAGE_SELF, &self) || getrusage (RUSAGE_CHILDREN, &children))
+    FFI_RETURN_ERR (sc, gpg_error_from_syserror ());
+  value = (self.ru_utime.tv_sec + self.ru_stime.tv_sec
+           + children.ru_utime.tv_sec + children.ru_stime.tv_sec
+           + (self.ru_utime.tv_usec + self.ru_stime.tv_usec
+              + children.ru_utime.tv_usec + children.ru_stime.tv_usec) / 1e6);
+#else
+  value = (double)clock () / CLOCKS_PER_SEC;
+#endif
+  FFI_RETURN_POINTER (sc, mk_real (sc, value));
+}
+
 static pointer
 do_getpid (scheme *sc, pointer args)
 {
@@ -1681,6 +1728,8 @@ ffi_init (scheme *sc, const char *argv0, const char *scriptname,
   ffi_define_function (sc, rmdir);
   ffi_define_function (sc, get_isotime);
   ffi_define_function (sc, get_time);
+  ffi_define_function (sc, get_clock);
+  ffi_define_function (sc, get_cpu_time);
   ffi_define_function (sc, getpid);
 
   /* Random numbers.  */
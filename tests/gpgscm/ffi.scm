@@ -49,3 +49,10 @@
 
 ;; Get the current time in seconds since the epoch.
 (ffi-define (get-time))
+
+;; Get a monotonic time in seconds with microsecond resolution.
+(ffi-define (get-clock))
+
+;; Get the CPU time in seconds used by this process and its finished
+;; children.
+(ffi-define (get-cpu-time))
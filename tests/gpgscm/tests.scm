@@ -791,6 +791,49 @@
 		   (list (xx::textnode (read-all (open-input-file log-file-name)))))
 	  (xx::tag 'system-err '() (list (xx::textnode "")))))))))))
 
+;; Performance tests.
+;;
+;; (perf-test NAME BODY ...) evaluates BODY and reports the wall and
+;; the CPU time it took.  The CPU time includes the programs spawned
+;; and waited for by BODY.  If the environment variable perf_baseline
+;; names an absolute directory, the times are compared with the ones
+;; stored there for NAME and the test fails if one of them exceeds the
+;; baseline by more than perf_threshold percent (default 25) plus a
+;; slack of 0.1 seconds.  If perf_record is also set, the times are
+;; stored as the new baseline instead.
+(define-macro (perf-test name . body)
+  `(perf-test' ,name (lambda () ,@body)))
+
+(define (perf-test' name thunk)
+  (let ((wall (get-clock))
+	(cpu (get-cpu-time)))
+    (thunk)
+    (perf-check name (- (get-clock) wall) (- (get-cpu-time) cpu))))
+
+(define (perf-baseline-file name)
+  (path-join (getenv "perf_baseline")
+	     (string-append (string-translate name " /" "__") ".perf")))
+
+(define (perf-check name wall cpu)
+  (let ((threshold (or (string->number (getenv "perf_threshold")) 25)))
+    (define (regression? value reference)
+      (> value (+ (* reference (+ 1 (/ threshold 100))) 0.1)))
+    (info "perf:" name "wall" wall "cpu" cpu)
+    (cond
+     ((string=? (getenv "perf_baseline") "")
+      #t)
+     ((not (string=? (getenv "perf_record") ""))
+      (call-with-output-file (perf-baseline-file name)
+	(lambda (port)
+	  (write (list wall cpu) port)
+	  (newline port))))
+     ((file-exists? (perf-baseline-file name))
+      (let ((reference (call-with-input-file (perf-baseline-file name) read)))
+	(if (or (regression? wall (car reference))
+		(regression? cpu (cadr reference)))
+	    (fail "Performance regression in" name "- baseline wall"
+		  (car reference) "cpu" (cadr reference))))))))
+
 ;; Run the setup target to create an environment, then run all given
 ;; tests in parallel.
 (define (run-tests-parallel tests n)
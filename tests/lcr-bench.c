@@ -0,0 +1,684 @@
+/* lcr-bench.c - Throughput benchmark for the OpenPGP data pipeline
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This is a stand-alone program to measure the throughput of lcr for
+   encryption, decryption, signing and verification.  It runs the
+   given lcr binary in a fresh home directory over a generated input
+   file and records the wall clock time and the CPU time used by the
+   child process.  The results are written as JSON so that they can
+   be compared between builds:
+
+     lcr-bench --lcr ../g10/lcr --output bench.json
+
+   Encryption and decryption use a symmetric key so that no agent is
+   needed; CFB and OCB mode are selected with and without --force-ocb.
+   For signing a key is created with the given agent; if that fails
+   the signing tests are skipped.  For each operation all combinations
+   of the requested cipher algorithms, modes, compression levels,
+   armor settings and IOBUF buffer sizes are measured.  Lists are
+   given as comma separated values, a buffer size of 0 means the
+   default size of lcr.
+
+   Options:
+
+   --lcr FILE            The lcr binary to benchmark.
+   --agent FILE          The agent to use for the signing key.
+   --connect-agent FILE  Used to terminate the agent at the end.
+   --size N              Size of the input in MiB (default 16).
+   --runs N              Number of runs per test (default 3).
+   --data random|text    Kind of the input data (default text).
+   --ops LIST            Operations (default encrypt,decrypt,sign,verify).
+   --ciphers LIST        Cipher algorithms (default AES128,AES256).
+   --modes LIST          Encryption modes (default cfb,ocb).
+   --levels LIST         Compression levels (default 0,1,6,9).
+   --armor LIST          Armor settings (default 0,1).
+   --bufsizes LIST       IOBUF sizes in KiB (default 0,64,1024).
+   --digests LIST        Digest algorithms for signing (default SHA256).
+   --output FILE         Write the JSON to FILE instead of stdout.
+   --verbose             Print progress to stderr.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define PGM "lcr-bench"
+
+#define MAX_ARGS   64
+#define MAX_LIST   16
+#define MAX_RUNS   100
+
+/* The result of one run of lcr.  */
+struct measure_s
+{
+  double wall;   /* Elapsed time in seconds.  */
+  double cpu;    /* User plus system time in seconds.  */
+};
+
+/* A comma separated list given on the command line.  */
+struct list_s
+{
+  int n;
+  char *item[MAX_LIST];
+};
+
+static int verbose;
+static const char *lcr_program = "../g10/lcr";
+static const char *agent_program = "../agent/lcr-agent";
+static const char *connect_agent_program = "../tools/lcr-connect-agent";
+static unsigned long data_size_mb = 16;
+static int nruns = 3;
+static const char *data_kind = "text";
+static struct list_s ops, ciphers, modes, levels, armors, bufsizes, digests;
+
+static char homedir[256];
+static int have_key;
+static int nresults;
+static FILE *jsonfp;
+
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  fflush (stdout);
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  putc ('\n', stderr);
+
+  exit (1);
+}
+
+
+static void
+info (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  if (!verbose)
+    return;
+  fprintf (stderr, "%s: ", PGM);
+  va_start (arg_ptr, format);
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  putc ('\n', stderr);
+}
+
+
+/* Split the comma separated STRING into LIST.  */
+static void
+parse_list (struct list_s *list, const char *string)
+{
+  char *buffer, *p;
+
+  buffer = strdup (string);
+  if (!buffer)
+    die ("out of core");
+  list->n = 0;
+  for (p = strtok (buffer, ","); p; p = strtok (NULL, ","))
+    {
+      if (list->n == MAX_LIST)
+        die ("too many items in list '%s'", string);
+      list->item[list->n++] = p;
+    }
+  if (!list->n)
+    die ("empty list given");
+}
+
+
+static int
+list_has (struct list_s *list, const char *item)
+{
+  int i;
+
+  for (i = 0; i < list->n; i++)
+    if (!strcmp (list->item[i], item))
+      return 1;
+  return 0;
+}
+
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Build a file name below the home directory.  */
+static const char *
+hfile (const char *name)
+{
+  static char buffer[4][520];
+  static int idx;
+
+  idx = (idx + 1) % 4;
+  snprintf (buffer[idx], sizeof buffer[idx], "%s/%s", homedir, name);
+  return buffer[idx];
+}
+
+
+/* Run PROGRAM with the NULL terminated ARGV.  Stdin is connected to
+   /dev/null and stdout and stderr to the file "log" in the home
+   directory.  On success the times are stored at R_MEASURE.  Returns
+   the exit status of the program.  */
+static int
+run_program (const char *program, const char **argv,
+             struct measure_s *r_measure)
+{
+  pid_t pid;
+  int status, fd;
+  struct rusage ru;
+  double start;
+
+  start = now ();
+  pid = fork ();
+  if (pid == (pid_t)(-1))
+    die ("fork failed: %s", strerror (errno));
+  if (!pid)
+    {
+      fd = open ("/dev/null", O_RDONLY);
+      if (fd == -1 || dup2 (fd, 0) == -1)
+        _exit (126);
+      fd = open (hfile ("log"), O_WRONLY|O_CREAT|O_TRUNC, 0600);
+      if (fd == -1 || dup2 (fd, 1) == -1 || dup2 (fd, 2) == -1)
+        _exit (126);
+      execv (program, (char **)argv);
+      _exit (127);
+    }
+
+  while (wait4 (pid, &status, 0, &ru) == (pid_t)(-1))
+    if (errno != EINTR)
+      die ("waiting for '%s' failed: %s", program, strerror (errno));
+
+  if (r_measure)
+    {
+      r_measure->wall = now () - start;
+      r_measure->cpu = (ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+                        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+    }
+
+  if (!WIFEXITED (status))
+    return -1;
+  return WEXITSTATUS (status);
+}
+
+
+/* Run lcr with the standard options followed by the NULL terminated
+   list of arguments.  */
+static int
+run_lcr (struct measure_s *r_measure, const char *arg, ...)
+{
+  const char *argv[MAX_ARGS];
+  va_list arg_ptr;
+  int argc = 0;
+
+  argv[argc++] = lcr_program;
+  argv[argc++] = "--no-options";
+  argv[argc++] = "--homedir";
+  argv[argc++] = homedir;
+  argv[argc++] = "--batch";
+  argv[argc++] = "--no-tty";
+  argv[argc++] = "--yes";
+  argv[argc++] = "--agent-program";
+  argv[argc++] = agent_program;
+  argv[argc++] = "--pinentry-mode";
+  argv[argc++] = "loopback";
+  argv[argc++] = "--passphrase";
+  argv[argc++] = "bench";
+  argv[argc++] = "--always-trust";
+
+  va_start (arg_ptr, arg);
+  for (; arg; arg = va_arg (arg_ptr, const char *))
+    {
+      if (argc >= MAX_ARGS - 1)
+        die ("too many arguments");
+      if (*arg)  /* Empty strings are placeholders for unused options.  */
+        argv[argc++] = arg;
+    }
+  va_end (arg_ptr);
+  argv[argc] = NULL;
+
+  return run_program (lcr_program, argv, r_measure);
+}
+
+
+/* Create the input file with DATA_SIZE_MB MiB of data.  Text data
+   is compressible; random data is not.  */
+static void
+make_input (void)
+{
+  static const char *words[] = {
+    "the ", "pipeline ", "of ", "packets ", "is ", "compressed ",
+    "and ", "encrypted ", "with ", "a ", "session ", "key ", "for ",
+    "each ", "recipient ", "\n"
+  };
+  unsigned long long total = (unsigned long long)data_size_mb << 20;
+  unsigned long long n;
+  unsigned int state = 0x12345678;
+  char buffer[8192];
+  size_t len;
+  FILE *fp;
+
+  fp = fopen (hfile ("plain"), "wb");
+  if (!fp)
+    die ("can't create '%s': %s", hfile ("plain"), strerror (errno));
+  for (n = 0; n < total; n += len)
+    {
+      len = 0;
+      while (len < sizeof buffer)
+        {
+          /* xorshift32 */
+          state ^= state << 13;
+          state ^= state >> 17;
+          state ^= state << 5;
+          if (!strcmp (data_kind, "random"))
+            buffer[len++] = state;
+          else
+            {
+              const char *w = words[state % (sizeof words/sizeof *words)];
+              size_t wlen = strlen (w);
+
+              if (len + wlen > sizeof buffer)
+                wlen = sizeof buffer - len;
+              memcpy (buffer + len, w, wlen);
+              len += wlen;
+            }
+        }
+      if (len > total - n)
+        len = total - n;
+      if (fwrite (buffer, len, 1, fp) != 1)
+        die ("error writing '%s': %s", hfile ("plain"), strerror (errno));
+    }
+  if (fclose (fp))
+    die ("error writing '%s': %s", hfile ("plain"), strerror (errno));
+}
+
+
+/* Create the signing key.  */
+static void
+make_key (void)
+{
+  int rc;
+
+  rc = run_lcr (NULL, "--quick-gen-key", "Bench <bench@example.org>",
+                "ed25519", "sign", "never", NULL);
+  if (rc)
+    fprintf (stderr, "%s: creating the signing key failed (rc=%d)"
+             " - sign and verify skipped\n", PGM, rc);
+  else
+    have_key = 1;
+}
+
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+static void
+json_string (const char *name, const char *value)
+{
+  /* No quoting needed; all values are our own.  */
+  fprintf (jsonfp, ", \"%s\": \"%s\"", name, value);
+}
+
+
+/* Write the result for the runs in M to the JSON file.  BYTES is the
+   size of the plaintext.  */
+static void
+emit_result (const char *op, const char *cipher, const char *mode,
+             const char *digest, const char *level, const char *armor,
+             const char *bufsize, struct measure_s *m, int n, int failed)
+{
+  double wall[MAX_RUNS], cpu[MAX_RUNS];
+  double bytes = (double)data_size_mb * 1024 * 1024;
+  double wmed, cmed;
+  int i;
+
+  fprintf (jsonfp, "%s\n    { \"op\": \"%s\"", nresults? ",":"", op);
+  nresults++;
+  if (cipher)
+    {
+      json_string ("cipher", cipher);
+      json_string ("mode", mode);
+    }
+  if (digest)
+    json_string ("digest", digest);
+  fprintf (jsonfp, ", \"compress_level\": %s, \"armor\": %s,"
+           " \"iobuf_kb\": %s", level, atoi (armor)? "true":"false", bufsize);
+
+  if (failed || !n)
+    {
+      fputs (", \"error\": true }", jsonfp);
+      return;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      wall[i] = m[i].wall;
+      cpu[i] = m[i].cpu;
+    }
+  qsort (wall, n, sizeof *wall, cmp_double);
+  qsort (cpu, n, sizeof *cpu, cmp_double);
+  wmed = n % 2? wall[n/2] : (wall[n/2-1] + wall[n/2]) / 2;
+  cmed = n % 2? cpu[n/2] : (cpu[n/2-1] + cpu[n/2]) / 2;
+
+  fprintf (jsonfp, ", \"runs\": %d, \"wall_s\": %.4f, \"wall_min_s\": %.4f,"
+           " \"cpu_s\": %.4f, \"mb_per_s\": %.2f, \"cpu_ns_per_byte\": %.3f }",
+           n, wmed, wall[0], cmed,
+           wmed > 0? bytes / (1024*1024) / wmed : 0.0,
+           cmed * 1e9 / bytes);
+
+  info ("%-7s %-8s %-4s %-6s z=%s a=%s buf=%-5s %8.2f MB/s %7.3f ns/B",
+        op, cipher? cipher : "", mode? mode : "", digest? digest : "",
+        level, armor, bufsize,
+        wmed > 0? bytes / (1024*1024) / wmed : 0.0, cmed * 1e9 / bytes);
+}
+
+
+/* Measure encryption and decryption for one combination.  */
+static void
+bench_crypt (const char *cipher, const char *mode, const char *level,
+             const char *armor, const char *bufsize)
+{
+  struct measure_s enc[MAX_RUNS], dec[MAX_RUNS];
+  int i, encfail = 0, decfail = 0;
+  int ocb = !strcmp (mode, "ocb");
+  int arm = atoi (armor);
+  int bs = atoi (bufsize);
+
+  for (i = 0; i < nruns && !encfail; i++)
+    {
+      encfail = !!run_lcr (enc + i, "--symmetric", "--cipher-algo", cipher,
+                           ocb? "--force-ocb" : "", "--compress-level", level,
+                           arm? "--armor" : "",
+                           bs? "--debug-set-iobuf-size" : "", bs? bufsize : "",
+                           "--s2k-count", "65536",
+                           "--output", hfile ("cipher"), hfile ("plain"),
+                           NULL);
+      if (encfail)
+        break;
+      if (!list_has (&ops, "decrypt"))
+        continue;
+      decfail |= !!run_lcr (dec + i, "--decrypt",
+                            bs? "--debug-set-iobuf-size" : "", bs? bufsize:"",
+                            "--output", hfile ("decrypted"), hfile ("cipher"),
+                            NULL);
+    }
+
+  if (list_has (&ops, "encrypt"))
+    emit_result ("encrypt", cipher, mode, NULL, level, armor, bufsize,
+                 enc, i, encfail);
+  if (list_has (&ops, "decrypt"))
+    emit_result ("decrypt", cipher, mode, NULL, level, armor, bufsize,
+                 dec, i, encfail || decfail);
+}
+
+
+/* Measure signing and verification for one combination.  */
+static void
+bench_sign (const char *digest, const char *level, const char *armor,
+            const char *bufsize)
+{
+  struct measure_s sig[MAX_RUNS], ver[MAX_RUNS];
+  int i, sigfail = 0, verfail = 0;
+  int arm = atoi (armor);
+  int bs = atoi (bufsize);
+
+  for (i = 0; i < nruns && !sigfail; i++)
+    {
+      sigfail = !!run_lcr (sig + i, "--sign", "--digest-algo", digest,
+                           "--compress-level", level, arm? "--armor" : "",
+                           bs? "--debug-set-iobuf-size" : "", bs? bufsize : "",
+                           "--output", hfile ("signed"), hfile ("plain"),
+                           NULL);
+      if (sigfail)
+        break;
+      if (!list_has (&ops, "verify"))
+        continue;
+      verfail |= !!run_lcr (ver + i, "--verify",
+                            bs? "--debug-set-iobuf-size" : "", bs? bufsize:"",
+                            hfile ("signed"), NULL);
+    }
+
+  if (list_has (&ops, "sign"))
+    emit_result ("sign", NULL, NULL, digest, level, armor, bufsize,
+                 sig, i, sigfail);
+  if (list_has (&ops, "verify"))
+    emit_result ("verify", NULL, NULL, digest, level, armor, bufsize,
+                 ver, i, sigfail || verfail);
+}
+
+
+/* Remove the home directory and all files in it.  */
+static void
+cleanup (void)
+{
+  const char *argv[6];
+  DIR *dir;
+  struct dirent *de;
+
+  if (!*homedir)
+    return;
+
+  if (have_key)
+    {
+      argv[0] = connect_agent_program;
+      argv[1] = "--homedir";
+      argv[2] = homedir;
+      argv[3] = "KILLAGENT";
+      argv[4] = "/bye";
+      argv[5] = NULL;
+      run_program (connect_agent_program, argv, NULL);
+    }
+
+  dir = opendir (homedir);
+  if (dir)
+    {
+      while ((de = readdir (dir)))
+        if (strcmp (de->d_name, ".") && strcmp (de->d_name, ".."))
+          {
+            const char *fname = hfile (de->d_name);
+
+            if (remove (fname))
+              {
+                /* The agent creates a sub directory for the keys.  */
+                DIR *sub = opendir (fname);
+                struct dirent *se;
+                char name[800];
+
+                if (sub)
+                  {
+                    while ((se = readdir (sub)))
+                      {
+                        snprintf (name, sizeof name, "%s/%s",
+                                  fname, se->d_name);
+                        remove (name);
+                      }
+                    closedir (sub);
+                  }
+                remove (fname);
+              }
+          }
+      closedir (dir);
+    }
+  rmdir (homedir);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *output = NULL;
+  const char *tmpdir;
+  int a, b, c, d, e;
+
+  parse_list (&ops, "encrypt,decrypt,sign,verify");
+  parse_list (&ciphers, "AES128,AES256");
+  parse_list (&modes, "cfb,ocb");
+  parse_list (&levels, "0,1,6,9");
+  parse_list (&armors, "0,1");
+  parse_list (&bufsizes, "0,64,1024");
+  parse_list (&digests, "SHA256");
+
+  if (argc)
+    {
+      argc--; argv++;
+    }
+  for (; argc; argc--, argv++)
+    {
+      const char *s = *argv;
+      const char *v = argc > 1? argv[1] : NULL;
+
+      if (!strcmp (s, "--verbose"))
+        {
+          verbose = 1;
+          continue;
+        }
+      if (!strcmp (s, "--help"))
+        {
+          puts ("usage: " PGM " [--lcr FILE] [--agent FILE] "
+                "[--connect-agent FILE]\n"
+                "       [--size MIB] [--runs N] [--data random|text]"
+                " [--ops LIST]\n"
+                "       [--ciphers LIST] [--modes LIST] [--levels LIST]"
+                " [--armor LIST]\n"
+                "       [--bufsizes LIST] [--digests LIST]"
+                " [--output FILE] [--verbose]");
+          exit (0);
+        }
+      if (!v)
+        die ("option '%s' requires an argument or is unknown", s);
+      if (!strcmp (s, "--lcr"))
+        lcr_program = v;
+      else if (!strcmp (s, "--agent"))
+        agent_program = v;
+      else if (!strcmp (s, "--connect-agent"))
+        connect_agent_program = v;
+      else if (!strcmp (s, "--size"))
+        data_size_mb = strtoul (v, NULL, 10);
+      else if (!strcmp (s, "--runs"))
+        nruns = atoi (v);
+      else if (!strcmp (s, "--data"))
+        data_kind = v;
+      else if (!strcmp (s, "--ops"))
+        parse_list (&ops, v);
+      else if (!strcmp (s, "--ciphers"))
+        parse_list (&ciphers, v);
+      else if (!strcmp (s, "--modes"))
+        parse_list (&modes, v);
+      else if (!strcmp (s, "--levels"))
+        parse_list (&levels, v);
+      else if (!strcmp (s, "--armor"))
+        parse_list (&armors, v);
+      else if (!strcmp (s, "--bufsizes"))
+        parse_list (&bufsizes, v);
+      else if (!strcmp (s, "--digests"))
+        parse_list (&digests, v);
+      else if (!strcmp (s, "--output"))
+        output = v;
+      else
+        die ("unknown option '%s'", s);
+      argc--; argv++;
+    }
+  if (!data_size_mb)
+    die ("invalid size given");
+  if (nruns < 1 || nruns > MAX_RUNS)
+    die ("number of runs must be between 1 and %d", MAX_RUNS);
+  for (a = 0; a < modes.n; a++)
+    if (strcmp (modes.item[a], "cfb") && strcmp (modes.item[a], "ocb"))
+      die ("invalid mode '%s'", modes.item[a]);
+  if (strcmp (data_kind, "text") && strcmp (data_kind, "random"))
+    die ("invalid data kind '%s'", data_kind);
+  if (access (lcr_program, X_OK))
+    die ("can't execute '%s': %s", lcr_program, strerror (errno));
+
+  tmpdir = getenv ("TMPDIR");
+  snprintf (homedir, sizeof homedir, "%s/" PGM "-XXXXXX",
+            tmpdir && *tmpdir? tmpdir : "/tmp");
+  if (!mkdtemp (homedir))
+    die ("can't create home directory: %s", strerror (errno));
+  atexit (cleanup);
+
+  if (output)
+    {
+      jsonfp = fopen (output, "w");
+      if (!jsonfp)
+        die ("can't create '%s': %s", output, strerror (errno));
+    }
+  else
+    jsonfp = stdout;
+
+  info ("creating %lu MiB of %s data", data_size_mb, data_kind);
+  make_input ();
+  if (list_has (&ops, "sign") || list_has (&ops, "verify"))
+    make_key ();
+
+  fprintf (jsonfp, "{\n  \"program\": \"%s\", \"size_bytes\": %llu,"
+           " \"data\": \"%s\", \"runs\": %d,\n  \"results\": [",
+           lcr_program, (unsigned long long)data_size_mb << 20,
+           data_kind, nruns);
+
+  if (list_has (&ops, "encrypt") || list_has (&ops, "decrypt"))
+    for (a = 0; a < ciphers.n; a++)
+      for (b = 0; b < modes.n; b++)
+        for (c = 0; c < levels.n; c++)
+          for (d = 0; d < armors.n; d++)
+            for (e = 0; e < bufsizes.n; e++)
+              bench_crypt (ciphers.item[a], modes.item[b], levels.item[c],
+                           armors.item[d], bufsizes.item[e]);
+
+  if (have_key)
+    for (a = 0; a < digests.n; a++)
+      for (c = 0; c < levels.n; c++)
+        for (d = 0; d < armors.n; d++)
+          for (e = 0; e < bufsizes.n; e++)
+            bench_sign (digests.item[a], levels.item[c],
+                        armors.item[d], bufsizes.item[e]);
+
+  fputs ("\n  ]\n}\n", jsonfp);
+  if (jsonfp != stdout && fclose (jsonfp))
+    die ("error writing '%s': %s", output, strerror (errno));
+
+  return 0;
+}
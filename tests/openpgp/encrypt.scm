@@ -20,15 +20,17 @@
 (load (in-srcdir "tests" "openpgp" "defs.scm"))
 (setup-legacy-environment)
 
-(for-each-p
- "Checking encryption"
- (lambda (source)
-   (tr:do
-    (tr:open source)
-    (tr:gpg "" `(--yes --encrypt --recipient ,usrname2))
-    (tr:gpg "" '(--yes --decrypt))
-    (tr:assert-identity source)))
- (append plain-files data-files))
+(perf-test
+ "encrypt"
+ (for-each-p
+  "Checking encryption"
+  (lambda (source)
+    (tr:do
+     (tr:open source)
+     (tr:gpg "" `(--yes --encrypt --recipient ,usrname2))
+     (tr:gpg "" '(--yes --decrypt))
+     (tr:assert-identity source)))
+  (append plain-files data-files)))
 
 (for-each-p
  "Checking encryption using a specific cipher algorithm"
@@ -59,3 +59,21 @@
 		 (string-split-newlines c))))
       (unless (= 2 (length keys))
 	      (fail "Importing keys with long id collision failed"))))))
+
+(info "Checking import and listing of the sample keys.")
+(define sample-keys
+  '("ecc-sample-1-pub.asc" "ecc-sample-2-pub.asc" "ecc-sample-3-pub.asc"
+    "ed25519-cv25519-sample-1.asc" "ed25519-cv25519-sample-2.asc"
+    "rsa-rsa-sample-1.asc" "whats-new-in-2.1.asc"))
+(perf-test
+ "import"
+ (for-each
+  (lambda (name)
+    (call-check `(,(tool 'gpg) --import
+		  ,(in-srcdir "tests" "openpgp" "samplekeys" name))))
+  sample-keys))
+(perf-test
+ "keylist"
+ (call-check `(,(tool 'gpg) --list-keys --with-colons))
+ ;; Some of the keys have bad signatures; thus ignore the status.
+ (call `(,(tool 'gpg) --check-sigs --with-colons)))
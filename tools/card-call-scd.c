@@ -1884,3 +1884,34 @@ scd_apdu_strerror (unsigned int sw)
   buf = get_membuf (&data, NULL);
   return buf;
 }
+
+
+/* Return the statistics of scdaemon as a malloced string at R_STATS.
+ * For the format see GETINFO stats in scdaemon.  */
+gpg_error_t
+scd_get_stats (char **r_stats)
+{
+  gpg_error_t err;
+  membuf_t data;
+
+  *r_stats = NULL;
+
+  err = start_agent (0);
+  if (err)
+    return err;
+
+  init_membuf (&data, 256);
+  err = assuan_transact (agent_ctx, "SCD GETINFO stats", put_membuf_cb, &data,
+                         NULL, NULL, NULL, NULL);
+  if (err)
+    {
+      xfree (get_membuf (&data, NULL));
+      return err;
+    }
+
+  put_membuf (&data, "", 1);
+  *r_stats = get_membuf (&data, NULL);
+  if (!*r_stats)
+    return gpg_error_from_syserror ();
+  return 0;
+}
@@ -3795,6 +3795,111 @@ cmd_apdu (card_info_t info, char *argstr)
 }
 
 
+/* Print the histogram HIST, a comma delimited list of counters with
+ * the buckets starting at 1ms and doubling.  */
+static void
+print_stats_histogram (estream_t fp, char *hist)
+{
+  const char *fields[16];
+  int i, n;
+  unsigned long limit = 1;
+
+  n = 0;
+  for (fields[n++] = hist; *hist && n < DIM (fields); hist++)
+    if (*hist == ',')
+      {
+        *hist = 0;
+        fields[n++] = hist + 1;
+      }
+
+  for (i=0; i < n; i++, limit *= 2)
+    {
+      if (!strcmp (fields[i], "0"))
+        continue;
+      if (i + 1 < n)
+        tty_fprintf (fp, "  <%lums:%s", limit, fields[i]);
+      else
+        tty_fprintf (fp, "  >=%lums:%s", limit/2, fields[i]);
+    }
+}
+
+
+static gpg_error_t
+cmd_stats (card_info_t info, char *argstr)
+{
+  gpg_error_t err;
+  estream_t fp = opt.interactive? NULL : es_stdout;
+  char *stats = NULL;
+  char *line, *next, *p;
+  const char *fields[9];
+  const char *reader;
+  unsigned long count;
+  int n;
+
+  (void)argstr;
+
+  if (!info)
+    return print_help
+      ("STATS\n"
+       "\n"
+       "Show the latency statistics collected by scdaemon.  For each\n"
+       "card operation and each reader the number of calls, the number\n"
+       "of errors, the average time and a histogram of the times are\n"
+       "shown.",
+       0);
+
+  err = scd_get_stats (&stats);
+  if (err)
+    goto leave;
+
+  for (line = stats; line && *line; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next)
+        *next++ = 0;
+
+      if (!strncmp (line, "apdu:", 5))
+        {
+          /* The reader name is the last field and may contain colons;
+           * thus cut it off before splitting.  */
+          for (p=line, n=0; n < 8 && (p = strchr (p, ':')); n++)
+            p++;
+          if (!p)
+            continue;
+          reader = p;
+          p[-1] = 0;
+          if (split_fields_colon (line, fields, 8) < 8)
+            continue;
+          count = strtoul (fields[2], NULL, 10);
+          tty_fprintf (fp, "Reader %s: %s\n", fields[1], reader);
+          tty_fprintf (fp, "  APDUs: %lu  errors: %s  avg: %.2fms"
+                       "  sent: %s bytes  received: %s bytes\n",
+                       count, fields[3],
+                       count? strtod (fields[4], NULL)/count : 0.0,
+                       fields[6], fields[7]);
+        }
+      else if (!strncmp (line, "op:", 3))
+        {
+          if (split_fields_colon (line, fields, 6) < 6)
+            continue;
+          count = strtoul (fields[2], NULL, 10);
+          tty_fprintf (fp, "%-10s calls: %lu  errors: %s  avg: %.2fms\n",
+                       fields[1], count, fields[3],
+                       count? strtod (fields[4], NULL)/count : 0.0);
+        }
+      else
+        continue;
+
+      print_stats_histogram (fp, (char*)fields[5]);
+      tty_fprintf (fp, "\n");
+    }
+
+ leave:
+  xfree (stats);
+  return err;
+}
+
+
 static gpg_error_t
 cmd_gpg (card_info_t info, char *argstr, int use_gpgsm)
 {
@@ -3887,7 +3992,7 @@ enum cmdids
     cmdFORCESIG, cmdGENERATE, cmdPASSWD, cmdPRIVATEDO, cmdWRITECERT,
     cmdREADCERT, cmdWRITEKEY,  cmdUNBLOCK, cmdFACTRST, cmdKDFSETUP,
     cmdUIF, cmdAUTH, cmdYUBIKEY, cmdAPDU, cmdGPG, cmdGPGSM, cmdHISTORY,
-    cmdCHECKKEYS,
+    cmdCHECKKEYS, cmdSTATS,
     cmdINVCMD
   };
 
@@ -3932,6 +4037,7 @@ static struct
   { "gpg",       cmdGPG,        NULL},
   { "gpgsm",     cmdGPGSM,      NULL},
   { "apdu",      cmdAPDU,       NULL},
+  { "stats",     cmdSTATS,      NULL},
   { "history",   cmdHISTORY,    N_("manage the command history")},
   { NULL, cmdINVCMD, NULL }
 };
@@ -4061,6 +4167,7 @@ dispatch_command (card_info_t info, const char *orig_command)
     case cmdUIF:          err = cmd_uif (info, argstr); break;
     case cmdYUBIKEY:      err = cmd_yubikey (info, argstr); break;
     case cmdAPDU:         err = cmd_apdu (info, argstr); break;
+    case cmdSTATS:        err = cmd_stats (info, argstr); break;
     case cmdGPG:          err = cmd_gpg (info, argstr, 0); break;
     case cmdGPGSM:        err = cmd_gpg (info, argstr, 1); break;
     case cmdHISTORY:      err = 0; break; /* Only used in interactive mode.  */
@@ -4321,6 +4428,7 @@ interactive_loop (void)
         case cmdUIF:       err = cmd_uif (info, argstr); break;
         case cmdYUBIKEY:   err = cmd_yubikey (info, argstr); break;
         case cmdAPDU:      err = cmd_apdu (info, argstr); break;
+        case cmdSTATS:     err = cmd_stats (info, argstr); break;
         case cmdGPG:       err = cmd_gpg (info, argstr, 0); break;
         case cmdGPGSM:     err = cmd_gpg (info, argstr, 1); break;
         case cmdHISTORY:   err = cmd_history (info, argstr); break;
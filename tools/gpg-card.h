@@ -252,6 +252,7 @@ gpg_error_t scd_delete_key (const unsigned char *grip, int force);
 unsigned long agent_get_s2k_count (void);
 
 char *scd_apdu_strerror (unsigned int sw);
+gpg_error_t scd_get_stats (char **r_stats);
 
 
 /*-- card-yubikey.c --*/
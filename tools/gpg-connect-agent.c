@@ -28,6 +28,7 @@
 #include <assuan.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 
 #define INCLUDED_BY_MAIN_MODULE 1
 #include "../common/i18n.h"
@@ -38,6 +39,7 @@
 #include "../common/ttyio.h"
 #include "../common/init.h"
 #include "../common/comopt.h"
+#include "../common/starttrace.h"
 
 
 #define CONTROL_D ('D' - 'A' + 1)
@@ -45,6 +47,11 @@
 
 #define HISTORYNAME ".gpg-connect_history"
 
+/* The maximum number of commands sent ahead in pipeline mode.  This
+ * is limited so that the commands will always fit into the socket
+ * buffer; otherwise server and client may block on each other.  */
+#define MAX_PIPELINE 256
+
 
 /* Constants to identify the commands and options. */
 enum cmd_and_opt_values
@@ -73,6 +80,7 @@ enum cmd_and_opt_values
     oNoHistory,
     oNoAutostart,
     oChUid,
+    oPipeline,
 
     oNoop
   };
@@ -111,6 +119,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oKeyboxdProgram, "keyboxd-program", "@"),
   ARGPARSE_s_s (oChUid,          "chuid",           "@"),
   ARGPARSE_s_n (oUnBuffered,     "unbuffered", "@"),
+  ARGPARSE_s_i (oPipeline,       "pipeline",   "@"),
 
   ARGPARSE_end ()
 };
@@ -139,6 +148,7 @@ struct
   int trim_leading_spaces;
   int no_history;
   int unbuffered; /* Set if unbuffered mode for stdin/out is preferred.  */
+  int pipeline;   /* Number of commands to send ahead.  */
 } opt;
 
 
@@ -186,6 +196,37 @@ static pid_t server_pid = (pid_t)(-1);
 /* The current datasink file or NULL.  */
 static estream_t current_datasink;
 
+/* A command sent to the server whose response has not yet been
+   read.  Up to opt.pipeline commands are sent ahead.  */
+struct pending_cmd_s
+{
+  struct pending_cmd_s *next;
+  int withhash;             /* Print the comment lines of the response. */
+  unsigned long long sent;  /* Time the command was sent.  */
+  char verb[1];             /* The command name.  */
+};
+typedef struct pending_cmd_s *pending_cmd_t;
+
+static pending_cmd_t pending_list;
+static pending_cmd_t *pending_tail = &pending_list;
+static int pending_count;
+
+/* The latencies of the commands recorded by /bench.  */
+struct bench_s
+{
+  struct bench_s *next;
+  unsigned long long *samples;  /* Latencies in microseconds.  */
+  size_t nsamples;
+  size_t allocated;
+  char verb[1];                 /* The command name.  */
+};
+typedef struct bench_s *bench_t;
+
+static bench_t bench_list;
+static int bench_active;
+static unsigned long bench_count;
+static unsigned long long bench_start;
+
 /* A list of open file descriptors. */
 static struct
 {
@@ -1206,6 +1247,200 @@ help_cmd_p (const char *line)
 }
 
 
+/* Set the number of commands to send ahead to N.  */
+static void
+set_pipeline (int n)
+{
+  if (n > MAX_PIPELINE)
+    {
+      log_info ("pipeline depth limited to %d\n", MAX_PIPELINE);
+      n = MAX_PIPELINE;
+    }
+  opt.pipeline = n < 0? 0 : n;
+}
+
+
+/* Return a monotonic time in microseconds.  */
+static unsigned long long
+get_usecs (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+#endif
+  return (unsigned long long)time (NULL) * 1000000ull;
+}
+
+
+/* Record a latency of USECS microseconds for the command VERB.  */
+static void
+bench_record (const char *verb, unsigned long long usecs)
+{
+  bench_t b;
+
+  for (b = bench_list; b; b = b->next)
+    if (!strcmp (b->verb, verb))
+      break;
+  if (!b)
+    {
+      b = xcalloc (1, sizeof *b + strlen (verb));
+      strcpy (b->verb, verb);
+      b->next = bench_list;
+      bench_list = b;
+    }
+  if (b->nsamples == b->allocated)
+    {
+      b->allocated += 1024;
+      b->samples = xreallocarray (b->samples, b->nsamples, b->allocated,
+                                  sizeof *b->samples);
+    }
+  b->samples[b->nsamples++] = usecs;
+  bench_count++;
+}
+
+
+/* Release all recorded latencies.  */
+static void
+bench_reset (void)
+{
+  bench_t b;
+
+  while ((b = bench_list))
+    {
+      bench_list = b->next;
+      xfree (b->samples);
+      xfree (b);
+    }
+  bench_count = 0;
+  bench_start = get_usecs ();
+}
+
+
+/* Helper for bench_show.  */
+static int
+cmp_usecs (const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/* Return the Pth percentile of the sorted array SAMPLES with N
+ * items.  */
+static unsigned long long
+percentile (const unsigned long long *samples, size_t n, unsigned int p)
+{
+  size_t idx;
+
+  idx = (n * p + 99) / 100;
+  return samples[idx? idx - 1 : 0];
+}
+
+
+/* Print the latency statistics recorded since "/bench on".  */
+static void
+bench_show (void)
+{
+  bench_t b;
+  unsigned long long elapsed;
+
+  elapsed = get_usecs () - bench_start;
+  printf ("%lu commands in %.3fs (%.1f/s) with pipeline depth %d\n",
+          bench_count, elapsed / 1e6,
+          elapsed? bench_count * 1e6 / elapsed : 0.0,
+          opt.pipeline? opt.pipeline : 1);
+  for (b = bench_list; b; b = b->next)
+    {
+      qsort (b->samples, b->nsamples, sizeof *b->samples, cmp_usecs);
+      printf ("%-20s n=%-8lu min=%.3fms p50=%.3fms p90=%.3fms"
+              " p99=%.3fms max=%.3fms\n",
+              b->verb, (unsigned long)b->nsamples,
+              b->samples[0] / 1e3,
+              percentile (b->samples, b->nsamples, 50) / 1e3,
+              percentile (b->samples, b->nsamples, 90) / 1e3,
+              percentile (b->samples, b->nsamples, 99) / 1e3,
+              b->samples[b->nsamples-1] / 1e3);
+    }
+}
+
+
+/* Remember that LINE has been sent to the server and its response
+ * still needs to be read.  */
+static void
+push_pending (const char *line)
+{
+  pending_cmd_t pc;
+  size_t n;
+
+  for (n=0; line[n] && !spacep (line+n) && n < 32; n++)
+    ;
+  pc = xmalloc (sizeof *pc + n);
+  pc->next = NULL;
+  pc->withhash = help_cmd_p (line);
+  memcpy (pc->verb, line, n);
+  pc->verb[n] = 0;
+  ascii_strupr (pc->verb);
+  pc->sent = get_usecs ();
+  *pending_tail = pc;
+  pending_tail = &pc->next;
+  pending_count++;
+}
+
+
+/* Read the response for the oldest pending command.  Sets R_GOTERR
+ * if the server returned an error.  */
+static gpg_error_t
+pop_pending (assuan_context_t ctx, int *r_goterr)
+{
+  gpg_error_t rc;
+  pending_cmd_t pc = pending_list;
+
+  *r_goterr = 0;
+  if (!pc)
+    return 0;
+
+  rc = read_and_print_response (ctx, pc->withhash, r_goterr);
+  if (bench_active)
+    bench_record (pc->verb, get_usecs () - pc->sent);
+
+  pending_list = pc->next;
+  if (!pending_list)
+    pending_tail = &pending_list;
+  pending_count--;
+  xfree (pc);
+  return rc;
+}
+
+
+/* Read the responses for all pending commands.  Sets R_GOTERR if
+ * the server returned an error for one of them.  */
+static gpg_error_t
+drain_pending (assuan_context_t ctx, int *r_goterr)
+{
+  gpg_error_t rc, firstrc = 0;
+  int goterr;
+
+  *r_goterr = 0;
+  while (pending_list)
+    {
+      rc = pop_pending (ctx, &goterr);
+      if (rc)
+        {
+          log_info (_("receiving line failed: %s\n"), gpg_strerror (rc) );
+          if (!firstrc)
+            firstrc = rc;
+        }
+      if (goterr)
+        *r_goterr = 1;
+    }
+  return firstrc;
+}
+
+
 /* gpg-connect-agent's entry point. */
 int
 main (int argc, char **argv)
@@ -1293,11 +1528,13 @@ main (int argc, char **argv)
           break;
         case oChUid:     changeuser = pargs.r.ret_str; break;
         case oUnBuffered: opt.unbuffered = 1; break;
+        case oPipeline:  set_pipeline (pargs.r.ret_int); break;
 
         default: pargs.err = 2; break;
 	}
     }
   gpgrt_argparse (NULL, &pargs, NULL);  /* Release internal state.  */
+  STARTTRACE_MARK ("options");
 
   if (changeuser && gnupg_chuid (changeuser, 0))
     log_inc_errorcount (); /* Force later termination.  */
@@ -1311,6 +1548,7 @@ main (int argc, char **argv)
   gpgrt_set_confdir (GPGRT_CONFDIR_USER, gnupg_homedir ());
   if (parse_comopt (GNUPG_MODULE_NAME_CONNECT_AGENT, opt.verbose > 1))
     exit(2);
+  STARTTRACE_MARK ("common options");
 
   if (comopt.no_autostart)
      opt.autostart = 0;
@@ -1452,6 +1690,8 @@ main (int argc, char **argv)
     }
   else
     ctx = start_agent ();
+  STARTTRACE_MARK ("connect");
+  starttrace_dump ();
 
   /* See whether there is a line pending from the server (in case
      assuan did not run the initial handshaking).  */
@@ -1506,6 +1746,7 @@ main (int argc, char **argv)
         }
       else if (use_tty && !script_fp)
         {
+          drain_pending (ctx, &cmderr);
           keep_line = 0;
           xfree (line);
           if (!historyname && !opt.no_history)
@@ -1608,6 +1849,19 @@ main (int argc, char **argv)
           loopidx++;
         }
 
+      if (*line == '/' && pending_list)
+        {
+          /* Control commands may depend on the results of the
+           * commands sent ahead.  */
+          drain_pending (ctx, &cmderr);
+          if (cmderr && script_fp)
+            {
+              log_error ("stopping script execution\n");
+              gpgrt_fclose (script_fp);
+              script_fp = NULL;
+            }
+        }
+
       if (*line == '/')
         {
           /* Handle control commands. */
@@ -1912,6 +2166,29 @@ main (int argc, char **argv)
             {
               gnupg_sleep (1);
             }
+          else if (!strcmp (cmd, "pipeline"))
+            {
+              if (*p)
+                set_pipeline (atoi (p));
+              else
+                printf ("pipeline depth is %d\n", opt.pipeline);
+            }
+          else if (!strcmp (cmd, "bench"))
+            {
+              if (!strcmp (p, "on"))
+                {
+                  bench_reset ();
+                  bench_active = 1;
+                }
+              else if (!strcmp (p, "off"))
+                bench_active = 0;
+              else if (!strcmp (p, "reset"))
+                bench_reset ();
+              else if (!*p || !strcmp (p, "show"))
+                bench_show ();
+              else
+                log_error ("Usage: /bench [on|off|reset|show]\n");
+            }
           else if (!strcmp (cmd, "history"))
             {
               if (!strcmp (p, "--clear"))
@@ -1948,6 +2225,8 @@ main (int argc, char **argv)
 "/while VAR             Begin loop controlled by VAR.\n"
 "/end                   End loop or condition\n"
 "/history               Manage the history\n"
+"/pipeline [N]          Send up to N commands ahead.\n"
+"/bench [on|off|show]   Record and show command latencies.\n"
 "/bye                   Terminate gpg-connect-agent.\n"
 "/help                  Print this help.");
             }
@@ -1976,11 +2255,20 @@ main (int argc, char **argv)
       if (*line == '#' || !*line)
         continue; /* Don't expect a response for a comment line. */
 
-      rc = read_and_print_response (ctx, help_cmd_p (line), &cmderr);
-      if (rc)
-        log_info (_("receiving line failed: %s\n"), gpg_strerror (rc) );
+      /* Only read responses once the pipeline is full.  Without a
+       * pipeline this reads the response right away.  */
+      push_pending (line);
+      rc = 0;
+      cmderr = 0;
+      while (!rc && !cmderr && pending_count >= (opt.pipeline? opt.pipeline:1))
+        {
+          rc = pop_pending (ctx, &cmderr);
+          if (rc)
+            log_info (_("receiving line failed: %s\n"), gpg_strerror (rc) );
+        }
       if ((rc || cmderr) && script_fp)
         {
+          drain_pending (ctx, &cmderr);
           log_error ("stopping script execution\n");
           gpgrt_fclose (script_fp);
           script_fp = NULL;
@@ -1994,6 +2282,8 @@ main (int argc, char **argv)
 	 early.  */
     }
 
+  drain_pending (ctx, &cmderr);
+
   if (opt.verbose)
     log_info ("closing connection to %s\n",
               opt.use_dirmngr? "dirmngr" :
@@ -2305,6 +2595,8 @@ read_and_print_response (assuan_context_t ctx, int withhash, int *r_goterr)
                   fwrite (line, linelen, 1, stdout);
                   putchar ('\n');
                 }
+              if (pending_count > 1)
+                log_info ("warning: inquiry while commands are pipelined\n");
               if (!handle_inquire (ctx, line))
                 assuan_write_line (ctx, "CANCEL");
             }
@@ -407,6 +407,48 @@ mail_tube_message_cb (void *opaque,
 }
 
 
+/* Copy the rest of FPIN to FPOUT and make sure that all lines are
+ * terminated by CR,LF.  The data is processed in blocks so that long
+ * lines and large attachments do not need to be split into lines
+ * first.  */
+static gpg_error_t
+copy_body (estream_t fpin, estream_t fpout)
+{
+  char buffer[32768];
+  size_t nread, n;
+  const char *p, *lf;
+  int last_cr = 0;  /* The last byte written was a CR.  */
+  int pending = 0;  /* An unterminated line has been written.  */
+
+  while (!es_read (fpin, buffer, sizeof buffer, &nread) && nread)
+    {
+      for (p = buffer; nread; p += n, nread -= n)
+        {
+          lf = memchr (p, '\n', nread);
+          n = lf? (size_t)(lf - p) : nread;
+          if (n)
+            {
+              es_write (fpout, p, n, NULL);
+              last_cr = (p[n-1] == '\r');
+              pending = 1;
+            }
+          if (!lf)
+            break;
+          es_write (fpout, last_cr? "\n" : "\r\n", last_cr? 1 : 2, NULL);
+          last_cr = pending = 0;
+          n++;
+        }
+    }
+  if (es_ferror (fpin))
+    return gpg_error_from_syserror ();
+  if (pending)
+    es_write (fpout, last_cr? "\n" : "\r\n", last_cr? 1 : 2, NULL);
+  if (es_ferror (fpout))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
 /* Receive a mail from FPIN and process to STDOUT.  RECIPIENTS is a
  * string list with the recipients of for this message. */
 static gpg_error_t
@@ -623,19 +665,11 @@ mail_tube_encrypt (estream_t fpin, strlist_t recipients)
     }
 
   /* Read the remaining input and feed it to gpg.  */
-  while (es_fgets (ctx->line, sizeof (ctx->line), fpin))
+  err = copy_body (fpin, gpginfp);
+  if (err)
     {
-      lineno++;
-      line = ctx->line;
-      length = strlen (line);
-      if (length && line[length - 1] == '\n')
-	line[--length] = 0;
-      else
-        log_error ("mail parser detected too long or"
-                   " non terminated last line (lnr=%u)\n", lineno);
-      if (length && line[length - 1] == '\r')
-	line[--length] = 0;
-      es_fprintf (gpginfp, "%s\r\n", line);
+      log_error ("error writing to pipe: %s\n", gpg_strerror (err));
+      goto leave;
     }
 
   /* Wait for gpg to finish.  */
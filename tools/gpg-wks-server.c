@@ -389,10 +389,12 @@ main (int argc, char **argv)
     case aInstallKey:
       if (!argc)
         err = wks_cmd_install_key (NULL, NULL);
+      else if (argc == 1)
+        err = wks_cmd_install_keydir (*argv);
       else if (argc == 2)
         err = wks_cmd_install_key (*argv, argv[1]);
       else
-        wrong_args ("--install-key [FILE|FINGERPRINT USER-ID]");
+        wrong_args ("--install-key [DIR|FILE|FINGERPRINT USER-ID]");
       break;
 
     case aRemoveKey:
@@ -114,6 +114,7 @@ gpg_error_t wks_fname_from_userid (const char *userid, int hash_only,
 gpg_error_t wks_compute_hu_fname (char **r_fname, const char *addrspec);
 gpg_error_t wks_install_key_core (estream_t key, const char *addrspec);
 gpg_error_t wks_cmd_install_key (const char *fname, const char *userid);
+gpg_error_t wks_cmd_install_keydir (const char *dirname);
 gpg_error_t wks_cmd_remove_key (const char *userid);
 gpg_error_t wks_cmd_print_wkd_hash (const char *userid);
 gpg_error_t wks_cmd_print_wkd_url (const char *userid);
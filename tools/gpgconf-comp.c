@@ -29,6 +29,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <time.h>
 #include <stdarg.h>
@@ -48,6 +49,7 @@
 #include "../common/i18n.h"
 #include "../common/sysutils.h"
 #include "../common/status.h"
+#include "../common/membuf.h"
 
 #include "../common/gc-opt-flags.h"
 #include "gpgconf.h"
@@ -709,6 +711,37 @@ struct error_line_s
 };
 
 
+/* The output of a component program as stored in the output cache.  */
+struct output_cache_item_s;
+typedef struct output_cache_item_s *output_cache_item_t;
+struct output_cache_item_s
+{
+  output_cache_item_t next;
+  int exitcode;        /* The exit code of the program.  */
+  size_t length;       /* The length of DATA.  */
+  char kind[5];        /* The kind of output: "dump", "list" or "test".  */
+  char data[1];        /* The captured output.  */
+};
+
+/* The output cache for each component.  Running the component
+ * programs is the expensive part of gpgconf and frontends tend to
+ * call gpgconf many times in a row.  Thus we keep the output of these
+ * runs in a file per component in the socket directory.  The cache
+ * is keyed by the inode, size and times of the program and its config
+ * files as well as by the homedir and the locale.  */
+static struct
+{
+  char *key;       /* The key of the loaded cache file or NULL.  */
+  int racy;        /* A file of the key has been modified just now.  */
+  output_cache_item_t items;
+} output_cache[GC_COMPONENT_NR];
+
+#define OUTPUT_CACHE_MAGIC "GPGCONF-CACHE 1"
+
+/* The maximum size of a cache file we are willing to read.  */
+#define OUTPUT_CACHE_MAX_SIZE (4 * 1024 * 1024)
+
+
 
 
 /* Initialization and finalization.  */
@@ -723,12 +756,31 @@ gc_option_free (gc_option_t *o)
   gc_option_free (o + 1);
 }
 
+/* Release the in-core output cache of COMPONENT.  */
+static void
+output_cache_clear (gc_component_id_t component)
+{
+  output_cache_item_t item;
+
+  while ((item = output_cache[component].items))
+    {
+      output_cache[component].items = item->next;
+      xfree (item);
+    }
+  xfree (output_cache[component].key);
+  output_cache[component].key = NULL;
+  output_cache[component].racy = 0;
+}
+
 static void
 gc_components_free (void)
 {
   int i;
   for (i = 0; i < DIM (gc_component); i++)
-    gc_option_free (gc_component[i].options);
+    {
+      gc_option_free (gc_component[i].options);
+      output_cache_clear (i);
+    }
 }
 
 void
@@ -739,14 +791,111 @@ gc_components_init (void)
 
 
 
+/* Helper processes.  The runtime change and launch commands are
+ * implemented by running gpg-connect-agent.  To avoid waiting for one
+ * daemon after the other these processes are started in parallel and
+ * then waited for with a common deadline.  */
+
+/* The number of seconds to wait for all pending helper processes.  */
+#define HELPER_TIMEOUT 30
+
+/* A started but not yet finished helper process.  */
+struct pending_helper_s;
+typedef struct pending_helper_s *pending_helper_t;
+struct pending_helper_s
+{
+  pending_helper_t next;
+  gpgrt_process_t proc;
+  char what[1];        /* Description used for diagnostics.  */
+};
+
+/* The list of pending helper processes.  */
+static pending_helper_t pending_helpers;
+
+
+/* Start the program PGMNAME with ARGV in the background.  WHAT
+ * describes the action for diagnostics.  Use wait_helpers to wait
+ * for its termination.  */
+static gpg_error_t
+start_helper (const char *pgmname, const char *argv[], const char *what)
+{
+  gpg_error_t err;
+  gpgrt_process_t proc;
+  pending_helper_t helper;
+  char *desc;
+
+  desc = xstrconcat (pgmname, " ", what, NULL);
+  err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
+  if (err)
+    {
+      gc_error (0, 0, "error running '%s': %s", desc, gpg_strerror (err));
+      xfree (desc);
+      return err;
+    }
+
+  helper = xmalloc (sizeof *helper + strlen (desc));
+  strcpy (helper->what, desc);
+  xfree (desc);
+  helper->proc = proc;
+  helper->next = pending_helpers;
+  pending_helpers = helper;
+  return 0;
+}
+
+
+/* Wait for all helpers started by start_helper.  Helpers which did
+ * not finish within the deadline are terminated.  Returns the first
+ * error seen.  */
+static gpg_error_t
+wait_helpers (void)
+{
+  gpg_error_t firsterr = 0;
+  gpg_error_t err;
+  pending_helper_t helper, *hp;
+  time_t deadline;
+
+  deadline = time (NULL) + HELPER_TIMEOUT;
+  while (pending_helpers)
+    {
+      for (hp = &pending_helpers; (helper = *hp); )
+        {
+          err = gpgrt_process_wait (helper->proc, 0);
+          if (gpg_err_code (err) == GPG_ERR_TIMEOUT
+              && time (NULL) < deadline)
+            {
+              hp = &helper->next;
+              continue;  /* Still running.  */
+            }
+          if (gpg_err_code (err) == GPG_ERR_TIMEOUT)
+            {
+              gpgrt_process_terminate (helper->proc);
+              gpgrt_process_wait (helper->proc, 1);
+            }
+          if (err)
+            {
+              gc_error (0, 0, "error running '%s': %s",
+                        helper->what, gpg_strerror (err));
+              if (!firsterr)
+                firsterr = err;
+            }
+          gpgrt_process_release (helper->proc);
+          *hp = helper->next;
+          xfree (helper);
+        }
+      if (pending_helpers)
+        gnupg_usleep (20000);
+    }
+
+  return firsterr;
+}
+
+
 /* Engine specific support.  */
 static void
 gpg_agent_runtime_change (int killflag)
 {
-  gpg_error_t err = 0;
   const char *pgmname;
   const char *argv[5];
-  gpgrt_process_t proc = NULL;
   int i = 0;
   int cmdidx;
 
@@ -762,24 +911,15 @@ gpg_agent_runtime_change (int killflag)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
-  if (!err)
-    err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
-  if (!err)
-    err = gpgrt_process_wait (proc, 1);
-  if (err)
-    gc_error (0, 0, "error running '%s %s': %s",
-              pgmname, argv[cmdidx], gpg_strerror (err));
-  gpgrt_process_release (proc);
+  start_helper (pgmname, argv, argv[cmdidx]);
 }
 
 
 static void
 scdaemon_runtime_change (int killflag)
 {
-  gpg_error_t err = 0;
   const char *pgmname;
   const char *argv[9];
-  gpgrt_process_t proc = NULL;
   int i = 0;
   int cmdidx;
 
@@ -806,14 +946,7 @@ scdaemon_runtime_change (int killflag)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
-  if (!err)
-    err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
-  if (!err)
-    err = gpgrt_process_wait (proc, 1);
-  if (err)
-    gc_error (0, 0, "error running '%s %s': %s",
-              pgmname, argv[cmdidx], gpg_strerror (err));
-  gpgrt_process_release (proc);
+  start_helper (pgmname, argv, argv[cmdidx]);
 }
 
 
@@ -821,10 +954,8 @@ scdaemon_runtime_change (int killflag)
 static void
 tpm2daemon_runtime_change (int killflag)
 {
-  gpg_error_t err = 0;
   const char *pgmname;
   const char *argv[9];
-  gpgrt_process_t proc = NULL;
   int i = 0;
   int cmdidx;
 
@@ -851,14 +982,7 @@ tpm2daemon_runtime_change (int killflag)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
-  if (!err)
-    err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
-  if (!err)
-    err = gpgrt_process_wait (proc, 1);
-  if (err)
-    gc_error (0, 0, "error running '%s %s': %s",
-              pgmname, argv[cmdidx], gpg_strerror (err));
-  gpgrt_process_release (proc);
+  start_helper (pgmname, argv, argv[cmdidx]);
 }
 #endif
 
@@ -866,10 +990,8 @@ tpm2daemon_runtime_change (int killflag)
 static void
 dirmngr_runtime_change (int killflag)
 {
-  gpg_error_t err = 0;
   const char *pgmname;
   const char *argv[6];
-  gpgrt_process_t proc = NULL;
   int i = 0;
   int cmdidx;
 
@@ -886,24 +1008,15 @@ dirmngr_runtime_change (int killflag)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
-  if (!err)
-    err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
-  if (!err)
-    err = gpgrt_process_wait (proc, 1);
-  if (err)
-    gc_error (0, 0, "error running '%s %s': %s",
-              pgmname, argv[cmdidx], gpg_strerror (err));
-  gpgrt_process_release (proc);
+  start_helper (pgmname, argv, argv[cmdidx]);
 }
 
 
 static void
 keyboxd_runtime_change (int killflag)
 {
-  gpg_error_t err = 0;
   const char *pgmname;
   const char *argv[6];
-  gpgrt_process_t proc = NULL;
   int i = 0;
   int cmdidx;
 
@@ -920,36 +1033,18 @@ keyboxd_runtime_change (int killflag)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
-  if (!err)
-    err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
-  if (!err)
-    err = gpgrt_process_wait (proc, 1);
-  if (err)
-    gc_error (0, 0, "error running '%s %s': %s",
-              pgmname, argv[cmdidx], gpg_strerror (err));
-  gpgrt_process_release (proc);
+  start_helper (pgmname, argv, argv[cmdidx]);
 }
 
 
-/* Launch the gpg-agent or the dirmngr if not already running.  */
-gpg_error_t
-gc_component_launch (int component)
+/* Start a helper process to launch the gpg-agent, the keyboxd or the
+ * dirmngr.  */
+static gpg_error_t
+start_launch (int component)
 {
-  gpg_error_t err;
   const char *pgmname;
   const char *argv[6];
   int i;
-  gpgrt_process_t proc = NULL;
-
-  if (component < 0)
-    {
-      err = gc_component_launch (GC_COMPONENT_GPG_AGENT);
-      if (!err)
-        err = gc_component_launch (GC_COMPONENT_KEYBOXD);
-      if (!err)
-        err = gc_component_launch (GC_COMPONENT_DIRMNGR);
-      return err;
-    }
 
   if (!(component == GC_COMPONENT_GPG_AGENT
         || component == GC_COMPONENT_KEYBOXD
@@ -987,17 +1082,37 @@ gc_component_launch (int component)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
-  err = gpgrt_process_spawn (pgmname, argv, 0, NULL, &proc);
+  return start_helper (pgmname, argv,
+                       (component == GC_COMPONENT_DIRMNGR? "--dirmngr NOP"
+                        : component == GC_COMPONENT_KEYBOXD? "--keyboxd NOP"
+                        : "NOP"));
+}
+
+
+/* Launch the gpg-agent, the keyboxd or the dirmngr if not already
+ * running.  With COMPONENT -1 all of them are launched in
+ * parallel.  */
+gpg_error_t
+gc_component_launch (int component)
+{
+  gpg_error_t err, err2;
+
+  if (component < 0)
+    {
+      err = start_launch (GC_COMPONENT_GPG_AGENT);
+      err2 = start_launch (GC_COMPONENT_KEYBOXD);
+      if (!err)
+        err = err2;
+      err2 = start_launch (GC_COMPONENT_DIRMNGR);
+      if (!err)
+        err = err2;
+    }
+  else
+    err = start_launch (component);
+
+  err2 = wait_helpers ();
   if (!err)
-    err = gpgrt_process_wait (proc, 1);
-  if (err)
-    gc_error (0, 0, "error running '%s%s%s': %s",
-              pgmname,
-              component == GC_COMPONENT_DIRMNGR? " --dirmngr"
-              : component == GC_COMPONENT_KEYBOXD? " --keyboxd":"",
-              " NOP",
-              gpg_strerror (err));
-  gpgrt_process_release (proc);
+    err = err2;
   return err;
 }
 
@@ -1018,12 +1133,17 @@ do_runtime_change (int component, int killflag)
       runtime [component] = 1;
     }
 
-  /* Do the restart for the selected components.  */
+  /* Do the restart for the selected components.  The helpers run in
+   * parallel but the daemons controlled via the gpg-agent need to be
+   * handled before the agent itself.  */
   for (component = GC_COMPONENT_NR-1; component >= 0; component--)
     {
+      if (component == GC_COMPONENT_GPG_AGENT)
+        wait_helpers ();
       if (runtime[component] && gc_component[component].runtime_change)
         (*gc_component[component].runtime_change) (killflag);
     }
+  wait_helpers ();
 }
 
 
@@ -1327,29 +1447,468 @@ collect_error_output (estream_t fp, const char *tag)
 }
 
 
-/* Check the options of a single component.  If CONF_FILE is NULL the
- * standard config file is used.  If OUT is not NULL the output is
- * written to that stream.  Returns 0 if everything is OK.  */
-int
-gc_component_check_options (int component, estream_t out, const char *conf_file)
+/* Append the identity of the file FNAME to the cache key in MB.
+ * Sets R_RACY if the file has been modified so recently that a later
+ * modification might not change its time.  Returns false if the file
+ * does not exist.  */
+static int
+output_cache_put_stat (membuf_t *mb, const char *fname, int *r_racy)
+{
+  struct stat st;
+  time_t now;
+
+  if (gnupg_stat (fname, &st))
+    {
+      put_membuf_str (mb, " -");
+      return 0;
+    }
+
+  put_membuf_printf (mb, " %lu/%lu/%lu/%lu/%lu",
+                     (unsigned long)st.st_dev, (unsigned long)st.st_ino,
+                     (unsigned long)st.st_size, (unsigned long)st.st_mtime,
+                     (unsigned long)st.st_ctime);
+  now = time (NULL);
+  if (st.st_mtime + 1 >= now || st.st_ctime + 1 >= now)
+    *r_racy = 1;
+  return 1;
+}
+
+
+/* Return the cache key for COMPONENT with the program PGMNAME or
+ * NULL if the output of this program can't be cached.  */
+static char *
+output_cache_key (gc_component_id_t component, const char *pgmname,
+                  int *r_racy)
+{
+  static const char *envvars[] =
+    { "LANGUAGE", "LC_ALL", "LC_MESSAGES", "LANG", NULL };
+  const char *config_name = gc_component[component].option_config_filename;
+  membuf_t mb;
+  char *fname;
+  char *key;
+  const char *s;
+  int i;
+
+  *r_racy = 0;
+  if (opt.no_cache)
+    return NULL;
+
+  init_membuf (&mb, 256);
+  put_membuf_str (&mb, gc_component[component].program);
+  if (!output_cache_put_stat (&mb, pgmname, r_racy))
+    {
+      xfree (get_membuf (&mb, NULL));
+      return NULL;  /* Not a file - we can't track changes.  */
+    }
+  if (config_name)
+    {
+      fname = make_filename (gnupg_sysconfdir (), config_name, NULL);
+      output_cache_put_stat (&mb, fname, r_racy);
+      xfree (fname);
+      fname = make_filename (gnupg_homedir (), config_name, NULL);
+      output_cache_put_stat (&mb, fname, r_racy);
+      xfree (fname);
+    }
+  fname = make_filename (gnupg_homedir (), "common.conf", NULL);
+  output_cache_put_stat (&mb, fname, r_racy);
+  xfree (fname);
+
+  put_membuf_printf (&mb, " %s", gnupg_homedir ());
+  for (i=0; envvars[i]; i++)
+    {
+      s = getenv (envvars[i]);
+      put_membuf_printf (&mb, " %s=%s", envvars[i], s? s : "");
+    }
+  put_membuf (&mb, "", 1);
+
+  key = get_membuf (&mb, NULL);
+  if (key && strchr (key, '\n'))
+    {
+      xfree (key);
+      key = NULL;
+    }
+  return key;
+}
+
+
+/* Return the name of the cache file of COMPONENT.  */
+static char *
+output_cache_fname (gc_component_id_t component)
+{
+  char *tmp, *fname;
+
+  tmp = xstrconcat (GPGCONF_NAME "-", gc_component[component].program,
+                    ".cache", NULL);
+  fname = make_filename (gnupg_socketdir (), tmp, NULL);
+  xfree (tmp);
+  return fname;
+}
+
+
+/* Parse the cache file content in DATA of length DATALEN into the
+ * items of COMPONENT.  Invalid files are silently ignored.  DATA
+ * will be modified.  */
+static void
+output_cache_parse (gc_component_id_t component, char *data, size_t datalen)
+{
+  char *p, *end, *nl, *field;
+  output_cache_item_t item, items, *tail;
+  unsigned long length;
+  int exitcode;
+
+  items = NULL;
+  tail = &items;
+  p = data;
+  end = data + datalen;
+
+  if (!(nl = memchr (p, '\n', end - p)))
+    return;
+  *nl = 0;
+  if (strcmp (p, OUTPUT_CACHE_MAGIC))
+    return;
+  p = nl + 1;
+  if (!(nl = memchr (p, '\n', end - p)))
+    return;
+  *nl = 0;
+  if (strncmp (p, "key ", 4) || strcmp (p+4, output_cache[component].key))
+    return; /* Outdated.  */
+  p = nl + 1;
+
+  while (p < end)
+    {
+      /* Each item is a line "KIND EXITCODE LENGTH" followed by
+       * LENGTH bytes of output and a LF.  */
+      if (!(nl = memchr (p, '\n', end - p)))
+        goto bad;
+      *nl = 0;
+      field = strchr (p, ' ');
+      if (!field || (size_t)(field - p) >= sizeof item->kind)
+        goto bad;
+      *field++ = 0;
+      exitcode = atoi (field);
+      if (!(field = strchr (field, ' ')))
+        goto bad;
+      length = strtoul (field+1, NULL, 10);
+      if (length >= (size_t)(end - (nl + 1)) || nl[1 + length] != '\n')
+        goto bad;
+
+      item = xmalloc (sizeof *item + length);
+      item->next = NULL;
+      strcpy (item->kind, p);
+      item->exitcode = exitcode;
+      item->length = length;
+      memcpy (item->data, nl + 1, length);
+      *tail = item;
+      tail = &item->next;
+      p = nl + 1 + length + 1;
+    }
+
+  output_cache[component].items = items;
+  return;
+
+ bad:
+  while ((item = items))
+    {
+      items = item->next;
+      xfree (item);
+    }
+}
+
+
+/* Make sure that the output cache of COMPONENT matches the current
+ * state of the program PGMNAME and its config files.  */
+static void
+output_cache_load (gc_component_id_t component, const char *pgmname)
+{
+  char *key, *fname;
+  int racy;
+  estream_t fp;
+  membuf_t mb;
+  char buffer[4096];
+  size_t nread;
+  char *data;
+  size_t datalen;
+
+  key = output_cache_key (component, pgmname, &racy);
+  if (key && output_cache[component].key
+      && !strcmp (key, output_cache[component].key))
+    {
+      xfree (key);
+      output_cache[component].racy = racy;
+      return;  /* Still valid.  */
+    }
+
+  output_cache_clear (component);
+  if (!key)
+    return;
+  output_cache[component].key = key;
+  output_cache[component].racy = racy;
+
+  fname = output_cache_fname (component);
+  fp = es_fopen (fname, "rb");
+  xfree (fname);
+  if (!fp)
+    return;
+
+  init_membuf (&mb, 16384);
+  while (!es_read (fp, buffer, sizeof buffer, &nread) && nread)
+    {
+      if (get_membuf_len (&mb) + nread > OUTPUT_CACHE_MAX_SIZE)
+        break;
+      put_membuf (&mb, buffer, nread);
+    }
+  if (es_ferror (fp) || !es_feof (fp))
+    {
+      es_fclose (fp);
+      xfree (get_membuf (&mb, NULL));
+      return;
+    }
+  es_fclose (fp);
+
+  data = get_membuf (&mb, &datalen);
+  if (data)
+    output_cache_parse (component, data, datalen);
+  xfree (data);
+}
+
+
+/* Write the output cache of COMPONENT to its file.  Errors are not
+ * fatal because the cache will simply be rebuilt.  */
+static void
+output_cache_write (gc_component_id_t component)
 {
   gpg_error_t err;
-  unsigned int result;
+  output_cache_item_t item;
+  char *fname, *tmpname;
+  estream_t fp;
+
+  fname = output_cache_fname (component);
+  tmpname = xasprintf ("%s.%u.tmp", fname, (unsigned int)getpid ());
+  fp = es_fopen (tmpname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  es_fprintf (fp, "%s\nkey %s\n",
+              OUTPUT_CACHE_MAGIC, output_cache[component].key);
+  for (item = output_cache[component].items; item; item = item->next)
+    {
+      es_fprintf (fp, "%s %d %lu\n",
+                  item->kind, item->exitcode, (unsigned long)item->length);
+      es_fwrite (item->data, item->length, 1, fp);
+      es_putc ('\n', fp);
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      gnupg_remove (tmpname);
+      goto leave;
+    }
+
+  err = gnupg_rename_file (tmpname, fname, NULL);
+  if (err)
+    gnupg_remove (tmpname);
+
+ leave:
+  if (err && opt.verbose)
+    log_info ("error writing '%s': %s\n", fname, gpg_strerror (err));
+  xfree (tmpname);
+  xfree (fname);
+}
+
+
+/* State of a component program started by run_program_start.  */
+struct program_run_s
+{
+  gc_component_id_t component;
+  const char *kind;        /* The kind of output for the cache or NULL.  */
+  gpgrt_process_t proc;    /* The running process or NULL if cached.  */
+  estream_t fp;            /* The pipe or the cached output.  */
+  int exitcode;            /* The exit code of a cached run.  */
+};
+
+
+/* Start the program PGMNAME of COMPONENT with ARGV and capture its
+ * stdout or, if USE_STDERR is set, its stderr.  If KIND is not NULL
+ * the output is taken from the output cache if possible.  The result
+ * must be retrieved using run_program_finish.  */
+static gpg_error_t
+run_program_start (gc_component_id_t component, const char *kind,
+                   const char *pgmname, const char *argv[], int use_stderr,
+                   struct program_run_s *run)
+{
+  gpg_error_t err;
+  output_cache_item_t item;
+
+  memset (run, 0, sizeof *run);
+  run->component = component;
+  run->kind = kind;
+
+  if (kind)
+    {
+      output_cache_load (component, pgmname);
+      for (item = output_cache[component].items; item; item = item->next)
+        if (!strcmp (item->kind, kind))
+          {
+            if (opt.verbose > 1)
+              log_info ("using cached output of '%s'\n", pgmname);
+            run->fp = es_fopenmem_init (0, "rb", item->data, item->length);
+            if (!run->fp)
+              return gpg_error_from_syserror ();
+            run->exitcode = item->exitcode;
+            return 0;
+          }
+    }
+
+  err = gpgrt_process_spawn (pgmname, argv,
+                             (use_stderr? GPGRT_PROCESS_STDERR_PIPE
+                              /*     */ : GPGRT_PROCESS_STDOUT_PIPE),
+                             NULL, &run->proc);
+  if (err)
+    return err;
+
+  if (use_stderr)
+    gpgrt_process_get_streams (run->proc, 0, NULL, NULL, &run->fp);
+  else
+    gpgrt_process_get_streams (run->proc, 0, NULL, &run->fp, NULL);
+  return 0;
+}
+
+
+/* Wait for the program started with run_program_start and store a
+ * memory stream with its output at R_FP.  The exit code of the
+ * program is stored at R_EXITCODE; -1 indicates that the program
+ * terminated abnormally.  */
+static gpg_error_t
+run_program_finish (struct program_run_s *run,
+                    estream_t *r_fp, int *r_exitcode)
+{
+  gpg_error_t err = 0;
+  gc_component_id_t component = run->component;
+  output_cache_item_t item;
+  membuf_t mb;
+  char buffer[4096];
+  size_t nread;
+  char *data;
+  size_t datalen;
+  int exitcode = 0;
+  int cacheable = 0;
+
+  *r_fp = NULL;
+  *r_exitcode = 0;
+
+  if (!run->proc)
+    {
+      *r_fp = run->fp;
+      *r_exitcode = run->exitcode;
+      run->fp = NULL;
+      return 0;
+    }
+
+  init_membuf (&mb, 16384);
+  while (!es_read (run->fp, buffer, sizeof buffer, &nread) && nread)
+    put_membuf (&mb, buffer, nread);
+  if (es_ferror (run->fp))
+    err = gpg_error_from_syserror ();
+  es_fclose (run->fp);
+  run->fp = NULL;
+
+  if (!gpgrt_process_wait (run->proc, 1))
+    {
+      gpgrt_process_ctl (run->proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
+      cacheable = (exitcode != -1);
+    }
+  gpgrt_process_release (run->proc);
+  run->proc = NULL;
+
+  data = get_membuf (&mb, &datalen);
+  if (!data)
+    return err? err : gpg_error_from_syserror ();
+  if (err)
+    goto leave;
+
+  if (run->kind && cacheable && output_cache[component].key)
+    {
+      item = xmalloc (sizeof *item + datalen);
+      strcpy (item->kind, run->kind);
+      item->exitcode = exitcode;
+      item->length = datalen;
+      memcpy (item->data, data, datalen);
+      item->next = output_cache[component].items;
+      output_cache[component].items = item;
+      if (!output_cache[component].racy && !opt.dry_run)
+        output_cache_write (component);
+    }
+
+  *r_fp = es_fopenmem_init (0, "rb", data, datalen);
+  if (!*r_fp)
+    err = gpg_error_from_syserror ();
+  else
+    *r_exitcode = exitcode;
+
+ leave:
+  xfree (data);
+  return err;
+}
+
+
+/* Run the program PGMNAME of COMPONENT with ARGV and store a memory
+ * stream with its stdout or, if USE_STDERR is set, with its stderr
+ * at R_FP.  The exit code of the program is stored at R_EXITCODE; -1
+ * indicates that the program terminated abnormally.  If KIND is not
+ * NULL the output is taken from or stored in the output cache.  */
+static gpg_error_t
+run_program_cached (gc_component_id_t component, const char *kind,
+                    const char *pgmname, const char *argv[], int use_stderr,
+                    estream_t *r_fp, int *r_exitcode)
+{
+  gpg_error_t err;
+  struct program_run_s run;
+
+  *r_fp = NULL;
+  *r_exitcode = 0;
+  err = run_program_start (component, kind, pgmname, argv, use_stderr, &run);
+  if (!err)
+    err = run_program_finish (&run, r_fp, r_exitcode);
+  return err;
+}
+
+
+/* State of a config check started by check_options_start.  */
+struct check_run_s
+{
+  gc_component_id_t component;
+  int skip;                 /* There is nothing to check.  */
+  gpg_error_t err;          /* Error starting the program.  */
   const char *pgmname;
+  struct program_run_s run;
+};
+
+
+/* Start the check of the options of COMPONENT.  If CONF_FILE is NULL
+ * the standard config file is used.  The result needs to be collected
+ * with check_options_finish.  */
+static void
+check_options_start (gc_component_id_t component, const char *conf_file,
+                     struct check_run_s *chk)
+{
   const char *argv[6];
   int i;
-  gpgrt_process_t proc;
-  estream_t errfp;
-  error_line_t errlines;
 
   log_assert (component >= 0 && component < GC_COMPONENT_NR);
 
-  if (!gc_component[component].program)
-    return 0;
-  if (!gc_component[component].module_name)
-    return 0;
+  memset (chk, 0, sizeof *chk);
+  chk->component = component;
+  if (!gc_component[component].program
+      || !gc_component[component].module_name)
+    {
+      chk->skip = 1;
+      return;
+    }
 
-  pgmname = gnupg_module_name (gc_component[component].module_name);
+  chk->pgmname = gnupg_module_name (gc_component[component].module_name);
   i = 0;
   if (!gnupg_default_homedir_p ()
       && component != GC_COMPONENT_PINENTRY)
@@ -1369,29 +1928,41 @@ gc_component_check_options (int component, estream_t out, const char *conf_file)
   argv[i] = NULL;
   log_assert (i < DIM(argv));
 
+  /* The result for an explicit CONF_FILE is never cached because we
+   * don't track that file.  */
+  chk->err = run_program_start (component, conf_file? NULL : "test",
+                                chk->pgmname, argv, 1, &chk->run);
+}
+
+
+/* Finish the check started by check_options_start.  If OUT is not
+ * NULL the output is written to that stream.  Returns 0 if everything
+ * is OK.  */
+static int
+check_options_finish (struct check_run_s *chk, estream_t out)
+{
+  gc_component_id_t component = chk->component;
+  unsigned int result;
+  int exitcode;
+  estream_t errfp;
+  error_line_t errlines;
+
+  if (chk->skip)
+    return 0;
+
   result = 0;
   errlines = NULL;
-  err = gpgrt_process_spawn (pgmname, argv, GPGRT_PROCESS_STDERR_PIPE,
-                             NULL, &proc);
-  if (err)
+  if (chk->err || run_program_finish (&chk->run, &errfp, &exitcode))
     result |= 1; /* Program could not be run.  */
   else
     {
-      gpgrt_process_get_streams (proc, 0, NULL, NULL, &errfp);
       errlines = collect_error_output (errfp,
 				       gc_component[component].name);
-      if (!gpgrt_process_wait (proc, 1))
-	{
-          int exitcode;
-
-          gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
-	  if (exitcode == -1)
-	    result |= 1; /* Program could not be run or it
-			    terminated abnormally.  */
-          else if (exitcode)
-            result |= 2; /* Program returned an error.  */
-	}
-      gpgrt_process_release (proc);
+      if (exitcode == -1)
+        result |= 1; /* Program could not be run or it
+                        terminated abnormally.  */
+      else if (exitcode)
+        result |= 2; /* Program returned an error.  */
       es_fclose (errfp);
     }
 
@@ -1409,7 +1980,7 @@ gc_component_check_options (int component, estream_t out, const char *conf_file)
       desc = my_dgettext (gc_component[component].desc_domain, desc);
       es_fprintf (out, "%s:%s:",
                   gc_component[component].program, gc_percent_escape (desc));
-      es_fputs (gc_percent_escape (pgmname), out);
+      es_fputs (gc_percent_escape (chk->pgmname), out);
       es_fprintf (out, ":%d:%d:", !(result & 1), !(result & 2));
       for (errptr = errlines; errptr; errptr = errptr->next)
 	{
@@ -1438,19 +2009,37 @@ gc_component_check_options (int component, estream_t out, const char *conf_file)
 }
 
 
+/* Check the options of a single component.  If CONF_FILE is NULL the
+ * standard config file is used.  If OUT is not NULL the output is
+ * written to that stream.  Returns 0 if everything is OK.  */
+int
+gc_component_check_options (int component, estream_t out, const char *conf_file)
+{
+  struct check_run_s chk;
+
+  check_options_start (component, conf_file, &chk);
+  return check_options_finish (&chk, out);
+}
+
+
 
-/* Check all components that are available.  */
+/* Check all components that are available.  The checks are run in
+ * parallel but the output is printed in the order of the
+ * components.  */
 void
 gc_check_programs (estream_t out)
 {
   gc_component_id_t component;
+  struct check_run_s chk[GC_COMPONENT_NR];
 
   for (component = 0; component < GC_COMPONENT_NR; component++)
-    gc_component_check_options (component, out, NULL);
+    check_options_start (component, NULL, &chk[component]);
+  for (component = 0; component < GC_COMPONENT_NR; component++)
+    check_options_finish (&chk[component], out);
 }
 
 
-
+
 /* Find the component with the name NAME.  Returns -1 if not
    found.  */
 int
@@ -1731,7 +2320,7 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
   const char *pgmname;
   const char *argv[2];
   estream_t outfp;
-  gpgrt_process_t proc;
+  int exitcode;
   known_option_t *known_option;
   gc_option_t *option;
   char *line = NULL;
@@ -1764,16 +2353,14 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
   /* First we need to read the option table from the program.  */
   argv[0] = "--dump-option-table";
   argv[1] = NULL;
-  err = gpgrt_process_spawn (pgmname, argv, GPGRT_PROCESS_STDOUT_PIPE,
-                             NULL, &proc);
+  err = run_program_cached (component, "dump", pgmname, argv, 0,
+                            &outfp, &exitcode);
   if (err)
     {
       gc_error (1, 0, "could not gather option table from '%s': %s",
                 pgmname, gpg_strerror (err));
     }
 
-  gpgrt_process_get_streams (proc, 0, NULL, &outfp, NULL);
-
   read_line_parm.pgmname = pgmname;
   read_line_parm.fp = outfp;
   read_line_parm.line = line;
@@ -1932,17 +2519,8 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
   line_len = read_line_parm.line_len;
   log_assert (opt_table_used + pseudo_count == opt_info_used);
 
-  err = gpgrt_process_wait (proc, 1);
-  if (!err)
-    {
-      int exitcode;
-
-      gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
-      if (exitcode)
-        gc_error (1, 0, "running %s failed (exitcode=%d): %s",
-                  pgmname, exitcode, gpg_strerror (err));
-    }
-  gpgrt_process_release (proc);
+  if (exitcode)
+    gc_error (1, 0, "running %s failed (exitcode=%d)", pgmname, exitcode);
 
   /* Make the gpgrt option table and the internal option table available.  */
   gc_component[component].opt_table = opt_table;
@@ -1952,16 +2530,14 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
   /* Now read the default options.  */
   argv[0] = "--gpgconf-list";
   argv[1] = NULL;
-  err = gpgrt_process_spawn (pgmname, argv, GPGRT_PROCESS_STDOUT_PIPE,
-                             NULL, &proc);
+  err = run_program_cached (component, "list", pgmname, argv, 0,
+                            &outfp, &exitcode);
   if (err)
     {
       gc_error (1, 0, "could not gather active options from '%s': %s",
                 pgmname, gpg_strerror (err));
     }
 
-  gpgrt_process_get_streams (proc, 0, NULL, &outfp, NULL);
-
   while ((length = es_read_line (outfp, &line, &line_len, NULL)) > 0)
     {
       char *linep;
@@ -2044,17 +2620,8 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
   if (es_fclose (outfp))
     gc_error (1, errno, "error closing %s", pgmname);
 
-  err = gpgrt_process_wait (proc, 1);
-  if (!err)
-    {
-      int exitcode;
-
-      gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
-      if (exitcode)
-        gc_error (1, 0, "running %s failed (exitcode=%d): %s",
-                  pgmname, exitcode, gpg_strerror (err));
-    }
-  gpgrt_process_release (proc);
+  if (exitcode)
+    gc_error (1, 0, "running %s failed (exitcode=%d)", pgmname, exitcode);
 
 
   /* At this point, we can parse the configuration file.  */
@@ -3415,6 +3982,7 @@ gc_process_gpgconf_conf (const char *fname_arg, int update, int defaults,
             if (runtime[component_id]
                 && gc_component[component_id].runtime_change)
               (*gc_component[component_id].runtime_change) (0);
+          wait_helpers ();
         }
     }
 
@@ -3619,6 +4187,7 @@ gc_apply_profile (const char *fname)
             if (runtime[component_id]
                 && gc_component[component_id].runtime_change)
               (*gc_component[component_id].runtime_change) (0);
+          wait_helpers ();
         }
     }
 
@@ -32,6 +32,7 @@
 #include "../common/i18n.h"
 #include "../common/sysutils.h"
 #include "../common/init.h"
+#include "../common/starttrace.h"
 #include "../common/status.h"
 #include "../common/dotlock.h"
 
@@ -62,6 +63,7 @@ enum cmd_and_opt_values
     oStatusFD,
     oShowSocket,
     oChUid,
+    oNoCache,
 
     aListComponents,
     aCheckPrograms,
@@ -134,6 +136,7 @@ static gpgrt_opt_t opts[] =
     ARGPARSE_s_n (oNoVerbose, "no-verbose", "@"),
     ARGPARSE_s_n (oShowSocket, "show-socket", "@"),
     ARGPARSE_s_s (oChUid, "chuid", "@"),
+    ARGPARSE_s_n (oNoCache, "no-cache", "@"),
 
     ARGPARSE_end ()
   };
@@ -724,6 +727,7 @@ main (int argc, char **argv)
           break;
         case oShowSocket: show_socket = 1; break;
         case oChUid:      changeuser = pargs.r.ret_str; break;
+        case oNoCache:    opt.no_cache = 1; break;
 
 	case aListDirs:
         case aListComponents:
@@ -754,6 +758,8 @@ main (int argc, char **argv)
     }
 
   gpgrt_argparse (NULL, &pargs, NULL);  /* Release internal state.  */
+  STARTTRACE_MARK ("options");
+  starttrace_dump ();
 
   if (log_get_errorcount (0))
     gpgconf_failure (GPG_ERR_USER_2);
@@ -31,6 +31,7 @@ struct
   int dry_run;		/* Don't change any persistent data.  */
   int runtime;		/* Make changes active at runtime.  */
   int null;             /* Option -0 active.  */
+  int no_cache;         /* Do not use the output cache.  */
   char *outfile;	/* Name of output file.  */
 
   int component;	/* The active component.  */
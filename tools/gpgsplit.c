@@ -34,9 +34,11 @@
 #ifdef HAVE_ZIP
 # include <zlib.h>
 #endif
+#include <npth.h>
 
 #define INCLUDED_BY_MAIN_MODULE 1
 #include "../common/util.h"
+#include "../common/membuf.h"
 #include "../common/openpgpdefs.h"
 
 #ifdef HAVE_BZIP2
@@ -48,9 +50,100 @@ static const char *opt_prefix = "";
 static int opt_uncompress;
 static int opt_secret_to_public;
 static int opt_no_split;
+static int opt_threads;
+
+/* The maximum number of worker threads for --threads.  */
+#define MAX_THREADS 32
+
+/* The size of the stdio buffer used for reading the input.  */
+#define READ_BUFSIZE (256*1024)
+
+/* The size of the chunks used to copy packet bodies.  */
+#define COPY_BUFSIZE (64*1024)
+
+/* Limits for the packets read in advance but not yet written by a
+ * worker.  */
+#define MAX_QUEUED_JOBS  (8*MAX_THREADS)
+#define MAX_QUEUED_BYTES (64*1024*1024)
+
+
+/* The source of a compressed packet: Either a stream or a memory
+ * buffer.  UNPROTECTED is set if the npth lock has been released by
+ * the caller.  */
+struct insrc_s
+{
+  FILE *fp;
+  const unsigned char *buf;
+  size_t len;
+  size_t off;
+  int unprotected;
+};
+typedef struct insrc_s *insrc_t;
+
+/* The sink for a packet: Either a stream or, for a worker, a memory
+ * buffer.  */
+struct outsink_s
+{
+  FILE *fp;
+  membuf_t mb;
+};
+typedef struct outsink_s *outsink_t;
+
+/* A job of the worker pool.  */
+struct pool_job_s;
+typedef struct pool_job_s *pool_job_t;
+struct pool_job_s
+{
+  pool_job_t next;
+  void (*fnc) (void *opaque);
+  void *opaque;
+  int done;
+};
+
+/* The worker pool.  With NTHREADS being 0 the packets are written
+ * directly by write_part.  */
+static struct
+{
+  int nthreads;
+  npth_t threads[MAX_THREADS];
+  npth_mutex_t lock;
+  npth_cond_t cond;       /* Signaled when a job is queued.  */
+  npth_cond_t done_cond;  /* Signaled when a job is done.  */
+  pool_job_t head;
+  pool_job_t *tail;
+  int shutdown;
+} pool;
+
+/* A packet handed over to a worker for writing.  */
+struct split_job_s;
+typedef struct split_job_s *split_job_t;
+struct split_job_s
+{
+  split_job_t next;
+  struct pool_job_s job;
+  int algo;                /* If not 0 uncompress DATA using ALGO.  */
+  unsigned char *data;     /* Malloced packet data.  */
+  size_t datalen;
+  const char *failed;      /* Set to the failed operation.  */
+  unsigned int open_failed:1;
+  int saved_errno;         /* The errno of that operation.  */
+  char fname[1];
+};
+
+/* The queue of jobs in the order of the part numbers.  */
+static struct
+{
+  split_job_t head;
+  split_job_t *tail;
+  unsigned int count;
+  size_t bytes;
+} queue = { NULL, &queue.head };
 
 static void g10_exit( int rc );
 static void split_packets (const char *fname);
+static void pool_start (int nthreads);
+static void pool_stop (void);
+static void queue_flush (unsigned int maxjobs, size_t maxbytes);
 
 
 enum cmd_and_opt_values {
@@ -60,6 +153,7 @@ enum cmd_and_opt_values {
   oUncompress   = 500,
   oSecretToPublic,
   oNoSplit,
+  oThreads,
 
   aTest
 };
@@ -74,6 +168,7 @@ static gpgrt_opt_t opts[] = {
     { oUncompress, "uncompress", 0, "uncompress a packet"},
     { oSecretToPublic, "secret-to-public", 0, "convert secret keys to public keys"},
     { oNoSplit, "no-split", 0, "write to stdout and don't actually split"},
+    { oThreads, "threads", 1, "@"},
 
     ARGPARSE_end ()
 };
@@ -136,6 +231,13 @@ main (int argc, char **argv)
         case oUncompress: opt_uncompress = 1; break;
         case oSecretToPublic: opt_secret_to_public = 1; break;
         case oNoSplit: opt_no_split = 1; break;
+        case oThreads:
+          opt_threads = pargs.r.ret_int;
+          if (opt_threads < 0)
+            opt_threads = 0;
+          else if (opt_threads > MAX_THREADS)
+            opt_threads = MAX_THREADS;
+          break;
         default : pargs.err = 2; break;
 	}
     }
@@ -144,6 +246,15 @@ main (int argc, char **argv)
   if (log_get_errorcount(0))
     g10_exit (2);
 
+  /* With --no-split everything goes to stdout in order; a worker
+   * would not help.  */
+  if (opt_threads && !opt_no_split)
+    {
+      npth_init ();
+      gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+      pool_start (opt_threads);
+    }
+
   if (!argc)
     split_packets (NULL);
   else
@@ -152,6 +263,7 @@ main (int argc, char **argv)
         split_packets (*argv);
     }
 
+  pool_stop ();
   g10_exit (0);
   return 0;
 }
@@ -219,6 +331,202 @@ create_filename (int pkttype)
   return name;
 }
 
+/* The worker thread of the pool.  */
+static void *
+pool_worker (void *arg)
+{
+  pool_job_t job;
+
+  (void)arg;
+
+  npth_mutex_lock (&pool.lock);
+  for (;;)
+    {
+      while (!pool.head && !pool.shutdown)
+        npth_cond_wait (&pool.cond, &pool.lock);
+      if (!(job = pool.head))
+        break;  /* Shutdown.  */
+      pool.head = job->next;
+      if (!pool.head)
+        pool.tail = &pool.head;
+      npth_mutex_unlock (&pool.lock);
+
+      job->fnc (job->opaque);
+
+      npth_mutex_lock (&pool.lock);
+      job->done = 1;
+      npth_cond_broadcast (&pool.done_cond);
+    }
+  npth_mutex_unlock (&pool.lock);
+  return NULL;
+}
+
+
+/* Start NTHREADS worker threads.  On error fewer or no threads are
+ * started; this is not an error because the packets are then written
+ * directly.  */
+static void
+pool_start (int nthreads)
+{
+  npth_attr_t tattr;
+  int rc;
+
+  memset (&pool, 0, sizeof pool);
+  pool.tail = &pool.head;
+  if (nthreads <= 0)
+    return;
+
+  if (npth_mutex_init (&pool.lock, NULL)
+      || npth_cond_init (&pool.cond, NULL)
+      || npth_cond_init (&pool.done_cond, NULL)
+      || npth_attr_init (&tattr))
+    {
+      log_error ("error initializing the worker pool\n");
+      return;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (; pool.nthreads < nthreads && pool.nthreads < DIM (pool.threads);
+       pool.nthreads++)
+    {
+      rc = npth_create (&pool.threads[pool.nthreads], &tattr,
+                        pool_worker, NULL);
+      if (rc)
+        {
+          log_error ("error spawning worker thread: %s\n", strerror (rc));
+          break;
+        }
+    }
+  npth_attr_destroy (&tattr);
+}
+
+
+/* Write all queued packets and terminate all worker threads.  */
+static void
+pool_stop (void)
+{
+  int i;
+
+  if (!pool.nthreads)
+    return;
+
+  queue_flush (0, 0);
+  npth_mutex_lock (&pool.lock);
+  pool.shutdown = 1;
+  npth_cond_broadcast (&pool.cond);
+  npth_mutex_unlock (&pool.lock);
+  for (i=0; i < pool.nthreads; i++)
+    npth_join (pool.threads[i], NULL);
+  pool.nthreads = 0;
+}
+
+
+/* Queue JOB to run FNC with OPAQUE.  */
+static void
+pool_put (pool_job_t job, void (*fnc)(void *), void *opaque)
+{
+  job->next = NULL;
+  job->fnc = fnc;
+  job->opaque = opaque;
+  job->done = 0;
+
+  npth_mutex_lock (&pool.lock);
+  *pool.tail = job;
+  pool.tail = &job->next;
+  npth_cond_signal (&pool.cond);
+  npth_mutex_unlock (&pool.lock);
+}
+
+
+/* Wait until JOB has been done.  */
+static void
+pool_wait (pool_job_t job)
+{
+  npth_mutex_lock (&pool.lock);
+  while (!job->done)
+    npth_cond_wait (&pool.done_cond, &pool.lock);
+  npth_mutex_unlock (&pool.lock);
+}
+
+
+/* Put the octet C into OUT.  Returns EOF on error.  */
+static int
+sink_putc (outsink_t out, int c)
+{
+  unsigned char buf[1];
+
+  if (out->fp)
+    return putc (c, out->fp);
+
+  buf[0] = c;
+  put_membuf (&out->mb, buf, 1);
+  return c & 0xff;
+}
+
+
+/* Write BUFLEN octets from BUF to OUT.  Returns 0 on success.  */
+static int
+sink_write (outsink_t out, const void *buf, size_t buflen)
+{
+  if (out->fp)
+    return fwrite (buf, buflen, 1, out->fp) != 1;
+
+  put_membuf (&out->mb, buf, buflen);
+  return 0;
+}
+
+
+/* Copy N octets from FPIN to OUT; if N is (size_t)(-1) copy up to
+ * EOF.  Returns 0 on success, -1 on a read error or a premature EOF,
+ * and 1 on a write error.  */
+static int
+copy_bytes (FILE *fpin, outsink_t out, size_t n)
+{
+  static unsigned char *buffer;
+  size_t nread, want;
+  int to_eof = (n == (size_t)(-1));
+
+  if (!buffer)
+    buffer = xmalloc (COPY_BUFSIZE);
+
+  while (n)
+    {
+      want = n < COPY_BUFSIZE? n : COPY_BUFSIZE;
+      nread = fread (buffer, 1, want, fpin);
+      if (nread && sink_write (out, buffer, nread))
+        return 1;
+      if (nread < want)
+        return (to_eof && !ferror (fpin))? 0 : -1;
+      if (!to_eof)
+        n -= nread;
+    }
+  return 0;
+}
+
+
+/* Get the next octet from SRC or EOF.  */
+static int
+src_getc (insrc_t src)
+{
+  if (src->fp)
+    return getc (src->fp);
+  if (src->off < src->len)
+    return src->buf[src->off++];
+  return EOF;
+}
+
+
+/* Re-acquire the npth lock before logging from a worker.  */
+static void
+src_protect (insrc_t src)
+{
+  if (src->unprotected)
+    {
+      npth_protect ();
+      src->unprotected = 0;
+    }
+}
+
+
 static int
 read_u16 (FILE *fp, size_t *rn)
 {
@@ -248,7 +556,7 @@ read_u32 (FILE *fp, unsigned long *rn)
 }
 
 static int
-write_old_header (FILE *fp, int pkttype, unsigned int len)
+write_old_header (outsink_t out, int pkttype, unsigned int len)
 {
   int ctb = (0x80 | ((pkttype & 15)<<2));
 
@@ -259,56 +567,56 @@ write_old_header (FILE *fp, int pkttype, unsigned int len)
   else
     ctb |= 2;
 
-  if ( putc ( ctb, fp) == EOF )
+  if ( sink_putc (out, ctb) == EOF )
     return -1;
 
   if ( (ctb & 2) )
     {
-      if (putc ((len>>24), fp) == EOF)
+      if (sink_putc (out, (len>>24)) == EOF)
         return -1;
-      if (putc ((len>>16), fp) == EOF)
+      if (sink_putc (out, (len>>16)) == EOF)
         return -1;
     }
   if ( (ctb & 3) )
     {
-      if (putc ((len>>8), fp) == EOF)
+      if (sink_putc (out, (len>>8)) == EOF)
         return -1;
     }
-  if (putc ((len&0xff), fp) == EOF)
+  if (sink_putc (out, (len&0xff)) == EOF)
     return -1;
   return 0;
 }
 
 static int
-write_new_header (FILE *fp, int pkttype, unsigned int len)
+write_new_header (outsink_t out, int pkttype, unsigned int len)
 {
-  if ( putc ((0xc0 | (pkttype & 0x3f)), fp) == EOF )
+  if ( sink_putc (out, (0xc0 | (pkttype & 0x3f))) == EOF )
     return -1;
 
   if (len < 192)
     {
-      if (putc (len, fp) == EOF)
+      if (sink_putc (out, len) == EOF)
         return -1;
     }
   else if (len < 8384)
     {
       len -= 192;
-      if (putc ((len/256)+192, fp) == EOF)
+      if (sink_putc (out, (len/256)+192) == EOF)
         return -1;
-      if (putc ((len%256), fp) == EOF)
+      if (sink_putc (out, (len%256)) == EOF)
         return -1;
     }
   else
     {
-      if (putc ( 0xff, fp) == EOF)
+      if (sink_putc (out, 0xff) == EOF)
         return -1;
-      if (putc ( (len >> 24), fp) == EOF)
+      if (sink_putc (out, (len >> 24)) == EOF)
         return -1;
-      if (putc ( (len >> 16), fp) == EOF)
+      if (sink_putc (out, (len >> 16)) == EOF)
         return -1;
-      if (putc ( (len >> 8), fp) == EOF)
+      if (sink_putc (out, (len >> 8)) == EOF)
         return -1;
-      if (putc ( (len & 0xff), fp) == EOF)
+      if (sink_putc (out, (len & 0xff)) == EOF)
         return -1;
     }
   return 0;
@@ -372,7 +680,7 @@ public_key_length (const unsigned char *buf, size_t buflen)
 
 #ifdef HAVE_ZIP
 static int
-handle_zlib(int algo,FILE *fpin,FILE *fpout)
+handle_zlib (int algo, insrc_t src, FILE *fpout)
 {
   z_stream zs;
   byte *inbuf, *outbuf;
@@ -397,7 +705,7 @@ handle_zlib(int algo,FILE *fpin,FILE *fpout)
 	    zs.next_in = (Bytef *) inbuf;
 	  count = inbufsize - n;
 	  for (nread=0;
-	       nread < count && (c=getc (fpin)) != EOF;
+	       nread < count && (c=src_getc (src)) != EOF;
 	       nread++)
 	    inbuf[n+nread] = c;
 
@@ -418,6 +726,7 @@ handle_zlib(int algo,FILE *fpin,FILE *fpout)
 		 : inflateInit ( &zs ));
 	  if (zrc != Z_OK)
 	    {
+	      src_protect (src);
 	      log_fatal ("zlib problem: %s\n", zs.msg? zs.msg :
 			 zrc == Z_MEM_ERROR ? "out of core" :
 			 zrc == Z_VERSION_ERROR ?
@@ -437,6 +746,7 @@ handle_zlib(int algo,FILE *fpin,FILE *fpout)
 	    ; /* eof */
 	  else if (zrc != Z_OK && zrc != Z_BUF_ERROR)
 	    {
+	      src_protect (src);
 	      if (zs.msg)
 		log_fatal ("zlib inflate problem: %s\n", zs.msg );
 	      else
@@ -445,7 +755,11 @@ handle_zlib(int algo,FILE *fpin,FILE *fpout)
 	  for (n=0; n < outbufsize - zs.avail_out; n++)
 	    {
 	      if (putc (outbuf[n], fpout) == EOF )
-		return 1;
+		{
+		  xfree (inbuf);
+		  xfree (outbuf);
+		  return 1;
+		}
 	    }
 	}
     }
@@ -460,6 +774,8 @@ handle_zlib(int algo,FILE *fpin,FILE *fpout)
 
   }
   inflateEnd (&zs);
+  xfree (inbuf);
+  xfree (outbuf);
 
   return 0;
 }
@@ -467,7 +783,7 @@ handle_zlib(int algo,FILE *fpin,FILE *fpout)
 
 #ifdef HAVE_BZIP2
 static int
-handle_bzip2(int algo,FILE *fpin,FILE *fpout)
+handle_bzip2 (int algo, insrc_t src, FILE *fpout)
 {
   bz_stream bzs;
   byte *inbuf, *outbuf;
@@ -492,7 +808,7 @@ handle_bzip2(int algo,FILE *fpin,FILE *fpout)
 	    bzs.next_in = inbuf;
 	  count = inbufsize - n;
 	  for (nread=0;
-	       nread < count && (c=getc (fpin)) != EOF;
+	       nread < count && (c=src_getc (src)) != EOF;
 	       nread++)
 	    inbuf[n+nread] = c;
 
@@ -511,7 +827,10 @@ handle_bzip2(int algo,FILE *fpin,FILE *fpout)
 	{
 	  zrc = BZ2_bzDecompressInit(&bzs,0,0);
 	  if (zrc != BZ_OK)
-	    log_fatal ("bz2lib problem: %d\n",zrc);
+	    {
+	      src_protect (src);
+	      log_fatal ("bz2lib problem: %d\n",zrc);
+	    }
 	  zinit_done = 1;
 	}
       else
@@ -520,39 +839,205 @@ handle_bzip2(int algo,FILE *fpin,FILE *fpout)
 	  if (zrc == BZ_STREAM_END)
 	    ; /* eof */
 	  else if (zrc != BZ_OK && zrc != BZ_PARAM_ERROR)
-	    log_fatal ("bz2lib inflate problem: %d\n", zrc );
+	    {
+	      src_protect (src);
+	      log_fatal ("bz2lib inflate problem: %d\n", zrc );
+	    }
 	  for (n=0; n < outbufsize - bzs.avail_out; n++)
 	    {
 	      if (putc (outbuf[n], fpout) == EOF )
-		return 1;
+		{
+		  xfree (inbuf);
+		  xfree (outbuf);
+		  return 1;
+		}
 	    }
 	}
     }
   while (zrc != BZ_STREAM_END && zrc != BZ_PARAM_ERROR);
   BZ2_bzDecompressEnd(&bzs);
+  xfree (inbuf);
+  xfree (outbuf);
 
   return 0;
 }
 #endif /* HAVE_BZIP2 */
 
+/* Return true if packets compressed with ALGO can be uncompressed.  */
+static int
+uncompress_supported (int algo)
+{
+#ifdef HAVE_ZIP
+  if (algo == 1 || algo == 2)
+    return 1;
+#endif
+#ifdef HAVE_BZIP2
+  if (algo == 3)
+    return 1;
+#endif
+  (void)algo;
+  return 0;
+}
+
+
+/* Uncompress the packet data from SRC using ALGO and write it to
+ * FPOUT.  Returns 0 on success.  */
+static int
+uncompress_packet (int algo, insrc_t src, FILE *fpout)
+{
+#ifdef HAVE_ZIP
+  if (algo == 1 || algo == 2)
+    return handle_zlib (algo, src, fpout);
+#endif
+#ifdef HAVE_BZIP2
+  if (algo == 3)
+    return handle_bzip2 (algo, src, fpout);
+#endif
+  (void)src;
+  (void)fpout;
+  return 1;
+}
+
+
+/* Write the packet data of JOB to its file.  This runs in a worker
+ * thread.  */
+static void
+split_job_run (void *opaque)
+{
+  split_job_t job = opaque;
+  FILE *fp;
+
+  /* Only stdio and the compression libraries are used here; thus we
+   * can let the other threads run.  */
+  npth_unprotect ();
+  fp = fopen (job->fname, "wb");
+  if (!fp)
+    {
+      job->failed = "creating";
+      job->open_failed = 1;
+      job->saved_errno = errno;
+      npth_protect ();
+      return;
+    }
+
+  if (job->algo)
+    {
+      struct insrc_s src;
+      int rc;
+
+      memset (&src, 0, sizeof src);
+      src.buf = job->data;
+      src.len = job->datalen;
+      src.unprotected = 1;
+      rc = uncompress_packet (job->algo, &src, fp);
+      if (!src.unprotected)
+        npth_unprotect ();
+      if (rc)
+        {
+          job->failed = "writing";
+          job->saved_errno = errno;
+        }
+    }
+  else if (job->datalen && fwrite (job->data, job->datalen, 1, fp) != 1)
+    {
+      job->failed = "writing";
+      job->saved_errno = errno;
+    }
+
+  if (fclose (fp) && !job->failed)
+    {
+      job->failed = "closing";
+      job->saved_errno = errno;
+    }
+  npth_protect ();
+
+  xfree (job->data);
+  job->data = NULL;
+}
+
+
+/* Wait for the oldest queued jobs until not more than MAXJOBS jobs
+ * with not more than MAXBYTES are left.  Errors are reported here in
+ * the order of the part numbers.  */
+static void
+queue_flush (unsigned int maxjobs, size_t maxbytes)
+{
+  split_job_t job;
+
+  while ((job = queue.head)
+         && (queue.count > maxjobs || queue.bytes > maxbytes))
+    {
+      pool_wait (&job->job);
+      queue.head = job->next;
+      if (!queue.head)
+        queue.tail = &queue.head;
+      queue.count--;
+      queue.bytes -= job->datalen;
+
+      if (job->failed)
+        {
+          log_error ("error %s '%s': %s\n",
+                     job->failed, job->fname, strerror (job->saved_errno));
+          /* Creating failed: stop right now, otherwise we would mess
+           * up the sequence of the part numbers.  */
+          if (job->open_failed)
+            g10_exit (1);
+        }
+      xfree (job);
+    }
+}
+
+
+/* Hand the data collected in OUT for JOB over to a worker.  */
+static void
+queue_job (split_job_t job, outsink_t out)
+{
+  job->data = get_membuf (&out->mb, &job->datalen);
+  if (!job->data)
+    {
+      log_error ("error collecting '%s': %s\n", job->fname, strerror (errno));
+      xfree (job);
+      g10_exit (1);
+    }
+
+  job->next = NULL;
+  *queue.tail = job;
+  queue.tail = &job->next;
+  queue.count++;
+  queue.bytes += job->datalen;
+  pool_put (&job->job, split_job_run, job);
+
+  queue_flush (MAX_QUEUED_JOBS, MAX_QUEUED_BYTES);
+}
+
+
 /* hdr must point to a buffer large enough to hold all header bytes */
 static int
 write_part (FILE *fpin, unsigned long pktlen,
             int pkttype, int partial, unsigned char *hdr, size_t hdrlen)
 {
-  FILE *fpout;
-  int c, first;
-  unsigned char *p;
+  struct outsink_s outbuf;
+  outsink_t out = &outbuf;
+  split_job_t job = NULL;
+  int c, first, rc;
   const char *outname = create_filename (pkttype);
 
+  memset (&outbuf, 0, sizeof outbuf);
+  if (opt_verbose && !opt_no_split)
+    log_info ("writing '%s'\n", outname);
   if (opt_no_split)
-    fpout = stdout;
+    out->fp = stdout;
+  else if (pool.nthreads)
+    {
+      /* Collect the packet in memory; a worker writes it.  */
+      job = xcalloc (1, sizeof *job + strlen (outname));
+      strcpy (job->fname, outname);
+      init_membuf (&out->mb, hdrlen + (pktlen < 65536? pktlen : 65536) + 1);
+    }
   else
     {
-      if (opt_verbose)
-        log_info ("writing '%s'\n", outname);
-      fpout = fopen (outname, "wb");
-      if (!fpout)
+      out->fp = fopen (outname, "wb");
+      if (!out->fp)
         {
           log_error ("error creating '%s': %s\n", outname, strerror(errno));
           /* stop right now, otherwise we would mess up the sequence
@@ -565,19 +1050,14 @@ write_part (FILE *fpin, unsigned long pktlen,
       && (pkttype == PKT_SECRET_KEY || pkttype == PKT_SECRET_SUBKEY))
     {
       unsigned char *blob = xmalloc (pktlen);
-      int i, len;
+      int len;
 
       pkttype = pkttype == PKT_SECRET_KEY? PKT_PUBLIC_KEY:PKT_PUBLIC_SUBKEY;
 
-      for (i=0; i < pktlen; i++)
+      if (pktlen && fread (blob, pktlen, 1, fpin) != 1)
         {
-          c = getc (fpin);
-          if (c == EOF)
-            {
-              xfree (blob);
-              goto read_error;
-            }
-          blob[i] = c;
+          xfree (blob);
+          goto read_error;
         }
       len = public_key_length (blob, pktlen);
       if (!len)
@@ -587,7 +1067,7 @@ write_part (FILE *fpin, unsigned long pktlen,
         }
       if ( (hdr[0] & 0x40) )
         {
-          if (write_new_header (fpout, pkttype, len))
+          if (write_new_header (out, pkttype, len))
             {
               xfree (blob);
               goto write_error;
@@ -595,20 +1075,17 @@ write_part (FILE *fpin, unsigned long pktlen,
         }
       else
         {
-          if (write_old_header (fpout, pkttype, len))
+          if (write_old_header (out, pkttype, len))
             {
               xfree (blob);
               goto write_error;
             }
         }
 
-      for (i=0; i < len; i++)
+      if (sink_write (out, blob, len))
         {
-          if ( putc (blob[i], fpout) == EOF )
-            {
-              xfree (blob);
-              goto write_error;
-            }
+          xfree (blob);
+          goto write_error;
         }
 
       xfree (blob);
@@ -618,11 +1095,9 @@ write_part (FILE *fpin, unsigned long pktlen,
 
   if (!opt_uncompress)
     {
-      for (p=hdr; hdrlen; p++, hdrlen--)
-        {
-          if ( putc (*p, fpout) == EOF )
-            goto write_error;
-        }
+      if (hdrlen && sink_write (out, hdr, hdrlen))
+        goto write_error;
+      hdrlen = 0;
     }
 
   first = 1;
@@ -669,19 +1144,15 @@ write_part (FILE *fpin, unsigned long pktlen,
             }
           else
             { /* next partial body length */
-              for (p=hdr; hdrlen; p++, hdrlen--)
-                {
-                  if ( putc (*p, fpout) == EOF )
-                    goto write_error;
-                }
+              if (hdrlen && sink_write (out, hdr, hdrlen))
+                goto write_error;
+              hdrlen = 0;
               partlen = 1 << (c & 0x1f);
-              for (; partlen; partlen--)
-                {
-                  if ((c = getc (fpin)) == EOF)
-                    goto read_error;
-                  if ( putc (c, fpout) == EOF )
-                    goto write_error;
-                }
+              rc = copy_bytes (fpin, out, partlen);
+              if (rc < 0)
+                goto read_error;
+              if (rc)
+                goto write_error;
             }
         }
       else if (partial == 2)
@@ -691,21 +1162,16 @@ write_part (FILE *fpin, unsigned long pktlen,
             goto read_error;
           hdr[hdrlen++] = partlen >> 8;
           hdr[hdrlen++] = partlen;
-          for (p=hdr; hdrlen; p++, hdrlen--)
-            {
-              if ( putc (*p, fpout) == EOF )
-                goto write_error;
-            }
+          if (sink_write (out, hdr, hdrlen))
+            goto write_error;
+          hdrlen = 0;
           if (!partlen)
             partial = 0; /* end of packet */
-          for (; partlen; partlen--)
-            {
-              c = getc (fpin);
-              if (c == EOF)
-                goto read_error;
-              if ( putc (c, fpout) == EOF )
-                goto write_error;
-            }
+          rc = copy_bytes (fpin, out, partlen);
+          if (rc < 0)
+            goto read_error;
+          if (rc)
+            goto write_error;
         }
       else
         { /* compressed: read to end */
@@ -717,75 +1183,82 @@ write_part (FILE *fpin, unsigned long pktlen,
               if ((c = getc (fpin)) == EOF)
                 goto read_error;
 
-	      if (0)
-                ;
-#ifdef HAVE_ZIP
-	      else if(c==1 || c==2)
-		{
-		  if(handle_zlib(c,fpin,fpout))
-		    goto write_error;
-		}
-#endif /* HAVE_ZIP */
-#ifdef HAVE_BZIP2
-	      else if(c==3)
-		{
-		  if(handle_bzip2(c,fpin,fpout))
-		    goto write_error;
-		}
-#endif /* HAVE_BZIP2 */
-	      else
+              if (!uncompress_supported (c))
 		{
 		  log_error("invalid compression algorithm (%d)\n",c);
 		  goto read_error;
 		}
-            }
-          else
-            {
-              while ( (c=getc (fpin)) != EOF )
+
+              if (job)
                 {
-                  if ( putc (c, fpout) == EOF )
+                  /* Let the worker uncompress it.  */
+                  job->algo = c;
+                  rc = copy_bytes (fpin, out, (size_t)(-1));
+                  if (rc < 0)
+                    goto read_error;
+                }
+              else
+                {
+                  struct insrc_s src;
+
+                  memset (&src, 0, sizeof src);
+                  src.fp = fpin;
+                  if (uncompress_packet (c, &src, out->fp))
                     goto write_error;
                 }
             }
+          else
+            {
+              rc = copy_bytes (fpin, out, (size_t)(-1));
+              if (rc < 0)
+                goto read_error;
+              if (rc)
+                goto write_error;
+            }
           if (!feof (fpin))
             goto read_error;
 	}
     }
 
-  for (p=hdr; hdrlen; p++, hdrlen--)
-    {
-      if ( putc (*p, fpout) == EOF )
-        goto write_error;
-    }
+  if (hdrlen && sink_write (out, hdr, hdrlen))
+    goto write_error;
 
   /* standard packet or last segment of partial length encoded packet */
-  for (; pktlen; pktlen--)
-    {
-      c = getc (fpin);
-      if (c == EOF)
-        goto read_error;
-      if ( putc (c, fpout) == EOF )
-        goto write_error;
-    }
+  rc = copy_bytes (fpin, out, pktlen);
+  if (rc < 0)
+    goto read_error;
+  if (rc)
+    goto write_error;
 
  ready:
-  if ( !opt_no_split && fclose (fpout) )
+  if (job)
+    queue_job (job, out);
+  else if ( !opt_no_split && fclose (out->fp) )
     log_error ("error closing '%s': %s\n", outname, strerror (errno));
   return 0;
 
  write_error:
   log_error ("error writing '%s': %s\n", outname, strerror (errno));
-  if (!opt_no_split)
-    fclose (fpout);
+  if (job)
+    {
+      xfree (get_membuf (&out->mb, NULL));
+      xfree (job);
+    }
+  else if (!opt_no_split)
+    fclose (out->fp);
   return 2;
 
  read_error:
-  if (!opt_no_split)
-    {
-      int save = errno;
-      fclose (fpout);
-      errno = save;
-    }
+  {
+    int save = errno;
+
+    /* Write what we got so far like in the unthreaded case.  */
+    if (job)
+      queue_job (job, out);
+    else if (!opt_no_split)
+      fclose (out->fp);
+    errno = save;
+  }
   return -1;
 }
 
@@ -877,6 +1350,7 @@ do_split (FILE *fp)
 static void
 split_packets (const char *fname)
 {
+  static int stdin_used;
   FILE *fp;
   int rc;
 
@@ -891,6 +1365,13 @@ split_packets (const char *fname)
       return;
     }
 
+  /* Scan the input with a large buffer.  Stdin may only be changed
+   * before its first use.  */
+  if (fp != stdin || !stdin_used)
+    setvbuf (fp, NULL, _IOFBF, READ_BUFSIZE);
+  if (fp == stdin)
+    stdin_used = 1;
+
   while ( !(rc = do_split (fp)) )
     ;
   if ( rc > 0 )
@@ -900,6 +1381,9 @@ split_packets (const char *fname)
   else
     log_error ("premature EOF while reading '%s'\n", fname );
 
+  /* Report errors of the queued packets before the next file.  */
+  queue_flush (0, 0);
+
   if ( fp != stdin )
     fclose (fp);
 }
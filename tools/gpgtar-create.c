@@ -29,6 +29,8 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <npth.h>
 #ifdef HAVE_W32_SYSTEM
 # define WIN32_LEAN_AND_MEAN
 # include <windows.h>
@@ -61,6 +63,75 @@ static unsigned long long global_total_data;
 /* Number of data bytes written so far.  */
 static unsigned long long global_written_data;
 
+/* Number of deletion records written so far.  */
+static unsigned long global_written_deletions;
+
+/* If set the content of regular files is hashed into this context
+ * for the manifest of an incremental archive.  */
+static gcry_md_hd_t content_md;
+
+/* Files up to this size are read in advance by the worker threads.
+ * Larger files are read while they are written.  */
+#define READAHEAD_MAX_FILESIZE (1024*1024)
+
+/* Limit for the data held in read ahead buffers.  */
+#define READAHEAD_MAX_BYTES (64*1024*1024)
+
+/* Maximum number of files read in advance per thread.  */
+#define READAHEAD_FILES_PER_THREAD 16
+
+
+/* A job for the worker threads.  */
+struct pool_job_s;
+typedef struct pool_job_s *pool_job_t;
+struct pool_job_s
+{
+  pool_job_t next;
+  void (*fnc) (void *opaque);
+  void *opaque;
+  int done;
+};
+
+/* The worker pool.  With NTHREADS being 0 all jobs are run directly
+ * by pool_put.  */
+static struct
+{
+  int nthreads;
+  npth_t threads[GPGTAR_MAX_THREADS];
+  npth_mutex_t lock;
+  npth_cond_t cond;       /* Signaled when a job is queued.  */
+  npth_cond_t done_cond;  /* Signaled when a job is done.  */
+  pool_job_t head;
+  pool_job_t *tail;
+  int shutdown;
+} pool;
+
+
+/* Data read in advance for a regular file.  */
+struct readahead_s;
+typedef struct readahead_s *readahead_t;
+struct readahead_s
+{
+  readahead_t next;
+  struct pool_job_s job;
+  tar_header_t hdr;
+  unsigned int open_failed:1;  /* ERR is the error from open.  */
+  gpg_error_t err;             /* Error from open or read.  */
+  gpg_error_t close_err;       /* Error from close.  */
+  size_t buflen;               /* Number of bytes read.  */
+  unsigned char *buffer;       /* Malloced; HDR->SIZE + 1 bytes.  */
+};
+
+/* The queue of files read in advance in the order of the file list.  */
+struct readahead_ctl_s
+{
+  readahead_t head;
+  readahead_t *tail;
+  tar_header_t cursor;        /* Next header to consider.  */
+  unsigned int count;         /* Number of queued items.  */
+  unsigned long long bytes;   /* Sum of the file sizes of the items.  */
+};
+
 
 
 /* Object to control the file scanning.  */
@@ -75,6 +146,132 @@ struct scanctrl_s
 };
 
 
+/* The worker thread of the pool.  */
+static void *
+pool_worker (void *arg)
+{
+  pool_job_t job;
+
+  (void)arg;
+
+  npth_mutex_lock (&pool.lock);
+  for (;;)
+    {
+      while (!pool.head && !pool.shutdown)
+        npth_cond_wait (&pool.cond, &pool.lock);
+      if (!(job = pool.head))
+        break;  /* Shutdown.  */
+      pool.head = job->next;
+      if (!pool.head)
+        pool.tail = &pool.head;
+      npth_mutex_unlock (&pool.lock);
+
+      job->fnc (job->opaque);
+
+      npth_mutex_lock (&pool.lock);
+      job->done = 1;
+      npth_cond_broadcast (&pool.done_cond);
+    }
+  npth_mutex_unlock (&pool.lock);
+  return NULL;
+}
+
+
+/* Start NTHREADS worker threads.  On error fewer or no threads are
+ * started; this is not an error because the jobs are then run
+ * directly.  */
+static void
+pool_start (int nthreads)
+{
+  npth_attr_t tattr;
+  int rc;
+
+  memset (&pool, 0, sizeof pool);
+  pool.tail = &pool.head;
+  if (nthreads <= 0)
+    return;
+
+  if (npth_mutex_init (&pool.lock, NULL)
+      || npth_cond_init (&pool.cond, NULL)
+      || npth_cond_init (&pool.done_cond, NULL)
+      || npth_attr_init (&tattr))
+    {
+      log_error ("error initializing the worker pool\n");
+      return;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (; pool.nthreads < nthreads && pool.nthreads < DIM (pool.threads);
+       pool.nthreads++)
+    {
+      rc = npth_create (&pool.threads[pool.nthreads], &tattr,
+                        pool_worker, NULL);
+      if (rc)
+        {
+          log_error ("error spawning worker thread: %s\n", strerror (rc));
+          break;
+        }
+    }
+  npth_attr_destroy (&tattr);
+}
+
+
+/* Terminate all worker threads.  All jobs must have been waited for.  */
+static void
+pool_stop (void)
+{
+  int i;
+
+  if (!pool.nthreads)
+    return;
+
+  npth_mutex_lock (&pool.lock);
+  pool.shutdown = 1;
+  npth_cond_broadcast (&pool.cond);
+  npth_mutex_unlock (&pool.lock);
+  for (i=0; i < pool.nthreads; i++)
+    npth_join (pool.threads[i], NULL);
+  pool.nthreads = 0;
+}
+
+
+/* Queue JOB to run FNC with OPAQUE.  */
+static void
+pool_put (pool_job_t job, void (*fnc)(void *), void *opaque)
+{
+  job->next = NULL;
+  job->fnc = fnc;
+  job->opaque = opaque;
+  job->done = 0;
+
+  if (!pool.nthreads)
+    {
+      fnc (opaque);
+      job->done = 1;
+      return;
+    }
+
+  npth_mutex_lock (&pool.lock);
+  *pool.tail = job;
+  pool.tail = &job->next;
+  npth_cond_signal (&pool.cond);
+  npth_mutex_unlock (&pool.lock);
+}
+
+
+/* Wait until JOB has been done.  */
+static void
+pool_wait (pool_job_t job)
+{
+  if (!pool.nthreads)
+    return;
+
+  npth_mutex_lock (&pool.lock);
+  while (!job->done)
+    npth_cond_wait (&pool.done_cond, &pool.lock);
+  npth_mutex_unlock (&pool.lock);
+}
+
+
 /* See ../g10/progress.c:write_status_progress for some background.  */
 static void
 write_progress (int countmode, unsigned long long current,
@@ -241,9 +438,17 @@ fillup_entry_posix (tar_header_t hdr)
 {
   gpg_error_t err;
   struct stat sbuf;
-
-  if (lstat (hdr->name, &sbuf))
+  int rc, saved_errno;
+
+  /* This may be called by a worker thread; thus allow other threads
+   * to run while waiting for the file system.  */
+  npth_unprotect ();
+  rc = lstat (hdr->name, &sbuf);
+  saved_errno = errno;
+  npth_protect ();
+  if (rc)
     {
+      gpg_err_set_errno (saved_errno);
       err = gpg_error_from_syserror ();
       log_error ("error stat-ing '%s': %s\n", hdr->name, gpg_strerror (err));
       return err;
@@ -264,7 +469,8 @@ fillup_entry_posix (tar_header_t hdr)
   else
     hdr->typeflag = TF_NOTSUP;
 
-  /* FIXME: Save DEV and INO? */
+  hdr->dev = sbuf.st_dev;
+  hdr->ino = sbuf.st_ino;
 
   /* Set the USTAR defined mode bits using the system macros.  */
   if (sbuf.st_mode & S_IRUSR)
@@ -314,14 +520,12 @@ fillup_entry_posix (tar_header_t hdr)
 #endif /*!HAVE_W32_SYSTEM*/
 
 
-/* Add a new entry.  The name of a directory entry is ENTRYNAME; if
-   that is NULL, DNAME is the name of the directory itself.  Under
-   Windows ENTRYNAME shall have backslashes replaced by standard
-   slashes.  */
-static gpg_error_t
-add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
+/* Allocate a new header object with only the name set.  The name of
+   a directory entry is ENTRYNAME; if that is NULL, DNAME is the name
+   of the directory itself.  */
+static tar_header_t
+new_entry (const char *dname, const char *entryname)
 {
-  gpg_error_t err;
   tar_header_t hdr;
   char *p;
   size_t dnamelen = strlen (dname);
@@ -331,7 +535,7 @@ add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
   hdr = xtrycalloc (1, sizeof *hdr + dnamelen + 1
                     + (entryname? strlen (entryname) : 0) + 1);
   if (!hdr)
-    return gpg_error_from_syserror ();
+    return NULL;
 
   p = stpcpy (hdr->name, dname);
   if (entryname)
@@ -345,37 +549,145 @@ add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
       if (hdr->name[dnamelen-1] == '/')
         hdr->name[dnamelen-1] = 0;
     }
+  return hdr;
+}
+
+
+static gpg_error_t
+fillup_entry (tar_header_t hdr)
+{
 #ifdef HAVE_DOSISH_SYSTEM
-  err = fillup_entry_w32 (hdr);
+  return fillup_entry_w32 (hdr);
 #else
-  err = fillup_entry_posix (hdr);
+  return fillup_entry_posix (hdr);
 #endif
-  if (err)
+}
+
+
+/* Append the filled up HDR to the file list.  */
+static void
+link_entry (tar_header_t hdr, scanctrl_t scanctrl)
+{
+  /* FIXME: We don't have the extended info yet available so we
+   * can't print them.  */
+  if (opt.verbose)
+    gpgtar_print_header (hdr, NULL, log_get_stream ());
+  *scanctrl->flist_tail = hdr;
+  scanctrl->flist_tail = &hdr->next;
+  scanctrl->file_count++;
+  /* Print a progress line during scnanning in increments of 5000
+   * and not of 100 as we doing during write: Scanning is of
+   * course much faster.  */
+  if (!(scanctrl->file_count % 5000))
+    write_progress (1, scanctrl->file_count, 0);
+}
+
+
+/* Add a new entry.  The name of a directory entry is ENTRYNAME; if
+   that is NULL, DNAME is the name of the directory itself.  Under
+   Windows ENTRYNAME shall have backslashes replaced by standard
+   slashes.  */
+static gpg_error_t
+add_entry (const char *dname, const char *entryname, scanctrl_t scanctrl)
+{
+  tar_header_t hdr;
+
+  hdr = new_entry (dname, entryname);
+  if (!hdr)
+    return gpg_error_from_syserror ();
+
+  if (fillup_entry (hdr))
     xfree (hdr);
   else
+    link_entry (hdr, scanctrl);
+
+  return 0;
+}
+
+
+/* The entries of a directory are first collected in an object of
+ * this type and then filled up by the worker threads.  */
+struct entry_batch_s
+{
+  size_t count;
+  size_t size;
+  struct entry_batch_item_s
+  {
+    struct pool_job_s job;
+    tar_header_t hdr;
+    gpg_error_t err;
+  } *items;
+};
+
+
+/* Add an entry to BATCH; see add_entry for the args.  */
+static gpg_error_t
+batch_add_entry (struct entry_batch_s *batch,
+                 const char *dname, const char *entryname)
+{
+  tar_header_t hdr;
+
+  if (batch->count == batch->size)
     {
-      /* FIXME: We don't have the extended info yet available so we
-       * can't print them.  */
-      if (opt.verbose)
-        gpgtar_print_header (hdr, NULL, log_get_stream ());
-      *scanctrl->flist_tail = hdr;
-      scanctrl->flist_tail = &hdr->next;
-      scanctrl->file_count++;
-      /* Print a progress line during scnanning in increments of 5000
-       * and not of 100 as we doing during write: Scanning is of
-       * course much faster.  */
-      if (!(scanctrl->file_count % 5000))
-        write_progress (1, scanctrl->file_count, 0);
+      size_t newsize = batch->size? 2 * batch->size : 64;
+      void *tmp;
+
+      tmp = xtryrealloc (batch->items, newsize * sizeof *batch->items);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      batch->items = tmp;
+      batch->size = newsize;
     }
 
+  hdr = new_entry (dname, entryname);
+  if (!hdr)
+    return gpg_error_from_syserror ();
+  batch->items[batch->count].hdr = hdr;
+  batch->items[batch->count].err = 0;
+  batch->count++;
   return 0;
 }
 
 
+static void
+batch_fillup_job (void *opaque)
+{
+  struct entry_batch_item_s *item = opaque;
+
+  item->err = fillup_entry (item->hdr);
+}
+
+
+/* Fill up all entries of BATCH using the worker threads, add them in
+ * order to the file list and release BATCH.  */
+static void
+batch_finish (struct entry_batch_s *batch, scanctrl_t scanctrl)
+{
+  size_t i;
+
+  for (i=0; i < batch->count; i++)
+    pool_put (&batch->items[i].job, batch_fillup_job, batch->items + i);
+  for (i=0; i < batch->count; i++)
+    pool_wait (&batch->items[i].job);
+
+  for (i=0; i < batch->count; i++)
+    {
+      if (batch->items[i].err)
+        xfree (batch->items[i].hdr);
+      else
+        link_entry (batch->items[i].hdr, scanctrl);
+    }
+  xfree (batch->items);
+  batch->items = NULL;
+  batch->count = batch->size = 0;
+}
+
+
 static gpg_error_t
 scan_directory (const char *dname, scanctrl_t scanctrl)
 {
   gpg_error_t err = 0;
+  struct entry_batch_s batch = { 0 };
 
 #ifdef HAVE_W32_SYSTEM
   /* Note that we introduced gnupg_opendir only after we had deployed
@@ -447,9 +759,9 @@ scan_directory (const char *dname, scanctrl_t scanctrl)
       if (!strcmp (fname, "." ) || !strcmp (fname, ".."))
         err = 0; /* Skip self and parent dir entry.  */
       else if (!strncmp (dname, "./", 2) && dname[2])
-        err = add_entry (dname+2, fname, scanctrl);
+        err = batch_add_entry (&batch, dname+2, fname);
       else
-        err = add_entry (dname, fname, scanctrl);
+        err = batch_add_entry (&batch, dname, fname);
       xfree (fname);
     }
   while (!err && FindNextFileW (hd, &fi));
@@ -467,6 +779,7 @@ scan_directory (const char *dname, scanctrl_t scanctrl)
  leave:
   if (hd != INVALID_HANDLE_VALUE)
     FindClose (hd);
+  batch_finish (&batch, scanctrl);
 
 #else /*!HAVE_W32_SYSTEM*/
   DIR *dir;
@@ -489,13 +802,14 @@ scan_directory (const char *dname, scanctrl_t scanctrl)
       if (!strcmp (de->d_name, "." ) || !strcmp (de->d_name, ".."))
         continue; /* Skip self and parent dir entry.  */
 
-      err = add_entry (dname, de->d_name, scanctrl);
+      err = batch_add_entry (&batch, dname, de->d_name);
       if (err)
         goto leave;
      }
 
  leave:
   closedir (dir);
+  batch_finish (&batch, scanctrl);
 #endif /*!HAVE_W32_SYSTEM*/
   return err;
 }
@@ -900,6 +1214,8 @@ write_extended_header (estream_t stream, const void *record, strlist_t exthdr)
         add_extended_header_record (&mb, "path", sl->d);
       else if (sl->flags == 2)
         add_extended_header_record (&mb, "linkpath", sl->d);
+      else if (sl->flags == 3)
+        add_extended_header_record (&mb, "GPGTAR.deleted", sl->d);
     }
 
   buffer = get_membuf (&mb, &buflen);
@@ -946,13 +1262,180 @@ write_extended_header (estream_t stream, const void *record, strlist_t exthdr)
 }
 
 
+/* The job to read the file of RA.  */
+static void
+readahead_job (void *opaque)
+{
+  readahead_t ra = opaque;
+  size_t want = ra->hdr->size + 1;  /* One extra to detect growth.  */
+#ifdef HAVE_W32_SYSTEM
+  estream_t fp;
+
+  fp = es_fopen (ra->hdr->name, "rb,sysopen");
+  if (!fp)
+    {
+      ra->err = gpg_error_from_syserror ();
+      ra->open_failed = 1;
+      return;
+    }
+  ra->buffer = xtrymalloc (want);
+  if (!ra->buffer)
+    {
+      ra->err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      return;
+    }
+  ra->buflen = es_fread (ra->buffer, 1, want, fp);
+  if (ra->buflen < ra->hdr->size)
+    ra->err = gpg_error_from_syserror ();
+  if (es_fclose (fp))
+    ra->close_err = gpg_error_from_syserror ();
+#else /*!HAVE_W32_SYSTEM*/
+  int fd, saved_errno, close_errno = 0;
+  ssize_t n = 0;
+
+  ra->buffer = xtrymalloc (want);
+  if (!ra->buffer)
+    {
+      ra->err = gpg_error_from_syserror ();
+      return;
+    }
+
+  /* Use plain system calls so that the other threads can run while
+   * we are waiting for the file system.  */
+  npth_unprotect ();
+  fd = open (ra->hdr->name, O_RDONLY);
+  saved_errno = errno;
+  if (fd != -1)
+    {
+      while (ra->buflen < want)
+        {
+          n = read (fd, ra->buffer + ra->buflen, want - ra->buflen);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n <= 0)
+            break;
+          ra->buflen += n;
+        }
+      saved_errno = n < 0? errno : 0;
+      if (close (fd))
+        close_errno = errno;
+    }
+  npth_protect ();
+
+  if (fd == -1)
+    {
+      gpg_err_set_errno (saved_errno);
+      ra->err = gpg_error_from_syserror ();
+      ra->open_failed = 1;
+      return;
+    }
+  if (ra->buflen < ra->hdr->size)
+    {
+      gpg_err_set_errno (saved_errno);
+      ra->err = gpg_error_from_syserror ();
+    }
+  if (close_errno)
+    {
+      gpg_err_set_errno (close_errno);
+      ra->close_err = gpg_error_from_syserror ();
+    }
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
+static void
+readahead_release (readahead_t ra)
+{
+  if (ra)
+    {
+      xfree (ra->buffer);
+      xfree (ra);
+    }
+}
+
+
+/* Queue read ahead jobs for the files following RACTL->CURSOR until
+ * the limits are reached.  */
+static void
+readahead_fill (struct readahead_ctl_s *ractl)
+{
+  tar_header_t hdr;
+  readahead_t ra;
+
+  for (; (hdr = ractl->cursor); ractl->cursor = hdr->next)
+    {
+      if (hdr->typeflag != TF_REGULAR || hdr->size > READAHEAD_MAX_FILESIZE)
+        continue;
+      if (ractl->count
+          && (ractl->count >= pool.nthreads * READAHEAD_FILES_PER_THREAD
+              || ractl->bytes + hdr->size > READAHEAD_MAX_BYTES))
+        break;
+
+      ra = xtrycalloc (1, sizeof *ra);
+      if (!ra)
+        break;  /* Simply read the file later.  */
+      ra->hdr = hdr;
+      *ractl->tail = ra;
+      ractl->tail = &ra->next;
+      ractl->count++;
+      ractl->bytes += hdr->size;
+      pool_put (&ra->job, readahead_job, ra);
+    }
+}
+
+
+/* Return the read ahead object for HDR or NULL if it has not been
+ * read in advance.  */
+static readahead_t
+readahead_get (struct readahead_ctl_s *ractl, tar_header_t hdr)
+{
+  readahead_t ra;
+
+  readahead_fill (ractl);
+  ra = ractl->head;
+  if (!ra || ra->hdr != hdr)
+    return NULL;
+
+  ractl->head = ra->next;
+  if (!ractl->head)
+    ractl->tail = &ractl->head;
+  ractl->count--;
+  ractl->bytes -= hdr->size;
+  pool_wait (&ra->job);
+  return ra;
+}
+
+
+/* Wait for all queued read ahead jobs and release them.  */
+static void
+readahead_cleanup (struct readahead_ctl_s *ractl)
+{
+  readahead_t ra;
+
+  while ((ra = ractl->head))
+    {
+      ractl->head = ra->next;
+      pool_wait (&ra->job);
+      readahead_release (ra);
+    }
+  ractl->tail = &ractl->head;
+  ractl->count = 0;
+  ractl->bytes = 0;
+}
+
+
+/* Write the header and the data for HDR to STREAM.  If RA is not
+ * NULL the data has already been read into it.  */
 static gpg_error_t
-write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
+write_file (estream_t stream, tar_header_t hdr, readahead_t ra,
+            unsigned int *skipped_open)
 {
   gpg_error_t err;
   char record[RECORDSIZE];
   estream_t infp;
   size_t nread, nbytes;
+  size_t raoff = 0;
   strlist_t exthdr = NULL;
   int any;
 
@@ -969,10 +1452,18 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
 
   if (hdr->typeflag == TF_REGULAR)
     {
-      infp = es_fopen (hdr->name, "rb,sysopen");
-      if (!infp)
+      if (ra)
+        {
+          infp = NULL;
+          err = ra->open_failed? ra->err : 0;
+        }
+      else
+        {
+          infp = es_fopen (hdr->name, "rb,sysopen");
+          err = infp? 0 : gpg_error_from_syserror ();
+        }
+      if (err)
         {
-          err = gpg_error_from_syserror ();
           log_info ("can't open '%s': %s - skipped\n",
                      hdr->name, gpg_strerror (err));
           ++*skipped_open;
@@ -997,21 +1488,73 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
     {
       hdr->nrecords = (hdr->size + RECORDSIZE-1)/RECORDSIZE;
       any = 0;
+      if (content_md)
+        gcry_md_reset (content_md);
+      /* Zero-copy is not possible if we need to hash the content.  */
+      if (!ra && hdr->size >= GPGTAR_ZEROCOPY_MIN_SIZE && !content_md
+          && es_fileno (stream) != -1)
+        {
+          /* Let the kernel move all but the last record directly
+           * from the file to the pipe.  The last record needs
+           * padding and is written below along with the check for a
+           * grown file.  */
+          unsigned long long want, copied;
+
+          want = (hdr->nrecords - 1) * RECORDSIZE;
+          if (es_fflush (stream))
+            {
+              err = gpg_error_from_syserror ();
+              log_error ("error writing '%s': %s\n",
+                         es_fname_get (stream), gpg_strerror (err));
+              goto leave;
+            }
+          err = gpgtar_copy_fd (es_fileno (infp), es_fileno (stream),
+                                want, &copied);
+          if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+            err = 0;
+          else if (err)
+            {
+              if (gpg_err_code (err) == GPG_ERR_EOF)
+                err = gpg_error (GPG_ERR_TRUNCATED);
+              log_error ("error copying file '%s': %s%s\n",
+                         hdr->name, gpg_strerror (err),
+                         copied? " (file shrunk?)":"");
+              goto leave;
+            }
+          else
+            {
+              hdr->nrecords -= want / RECORDSIZE;
+              global_written_data += want;
+              write_progress (0, global_written_data, global_total_data);
+              any = 1;
+            }
+        }
       while (hdr->nrecords--)
         {
           nbytes = hdr->nrecords? RECORDSIZE : (hdr->size % RECORDSIZE);
           if (!nbytes)
             nbytes = RECORDSIZE;
-          nread = es_fread (record, 1, nbytes, infp);
+          if (ra)
+            {
+              nread = ra->buflen - raoff;
+              if (nread > nbytes)
+                nread = nbytes;
+              memcpy (record, ra->buffer + raoff, nread);
+              raoff += nread;
+            }
+          else
+            nread = es_fread (record, 1, nbytes, infp);
           if (nread != nbytes)
             {
-              err = gpg_error_from_syserror ();
+              err = ra? ra->err : gpg_error_from_syserror ();
               log_error ("error reading file '%s': %s%s\n",
                          hdr->name, gpg_strerror (err),
                          any? " (file shrunk?)":"");
               goto leave;
             }
-          else if (nbytes < RECORDSIZE)
+          if (content_md)
+            gcry_md_write (content_md, record, nbytes);
+          if (nbytes < RECORDSIZE)
             memset (record + nbytes, 0, RECORDSIZE - nbytes);
           any = 1;
           err = write_record (stream, record);
@@ -1021,7 +1564,10 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
           if (!((global_written_data/nbytes) % (2048*100)))
             write_progress (0, global_written_data, global_total_data);
         }
-      nread = es_fread (record, 1, 1, infp);
+      if (ra)
+        nread = ra->buflen > hdr->size;
+      else
+        nread = es_fread (record, 1, 1, infp);
       if (nread)
         log_info ("note: file '%s' has grown\n", hdr->name);
     }
@@ -1029,7 +1575,7 @@ write_file (estream_t stream, tar_header_t hdr, unsigned int *skipped_open)
  leave:
   if (err)
     es_fclose (infp);
-  else if ((err = es_fclose (infp)))
+  else if ((err = es_fclose (infp)) || (ra && (err = ra->close_err)))
     log_error ("error closing file '%s': %s\n", hdr->name, gpg_strerror (err));
 
   free_strlist (exthdr);
@@ -1052,6 +1598,131 @@ write_eof_mark (estream_t stream)
 
 
 
+/* Write a member to STREAM which records that NAME has been deleted
+ * since the last incremental run.  The name is stored in an extended
+ * header; the member itself is an empty file with a placeholder name
+ * so that other tar implementations do not resurrect the file.  */
+static gpg_error_t
+write_deletion (estream_t stream, const char *name)
+{
+  gpg_error_t err;
+  char record[RECORDSIZE];
+  tar_header_t hdr;
+  strlist_t exthdr = NULL;
+  strlist_t sl;
+
+  hdr = xtrycalloc (1, sizeof *hdr + 40);
+  if (!hdr)
+    return gpg_error_from_syserror ();
+  snprintf (hdr->name, 40, "_@deleted.%u.%lu",
+            (unsigned int)getpid (), ++global_written_deletions);
+  hdr->typeflag = TF_REGULAR;
+  hdr->mode = 0600;
+  hdr->mtime = gnupg_get_time ();
+
+  err = build_header (record, hdr, &exthdr);
+  if (!err)
+    {
+      sl = add_to_strlist_try (&exthdr, name);
+      if (!sl)
+        err = gpg_error_from_syserror ();
+      else
+        sl->flags = 3;  /* Mark as deleted path.  */
+    }
+  if (!err)
+    err = write_extended_header (stream, record, exthdr);
+  if (!err)
+    err = write_record (stream, record);
+  if (!err && opt.verbose)
+    log_info ("recorded deletion of '%s'\n", name);
+
+  free_strlist (exthdr);
+  xfree (hdr);
+  return err;
+}
+
+
+/* Remove all entries from the file list of SCANCTRL which are
+ * unchanged according to MANIFEST and carry them over to the new
+ * manifest.  Directories are always archived so that an extraction
+ * of the increment creates them with their current properties.  */
+static void
+drop_unchanged (scanctrl_t scanctrl, gpgtar_manifest_t manifest)
+{
+  tar_header_t hdr, *link;
+  unsigned long ndropped = 0;
+
+  for (link = &scanctrl->flist; (hdr = *link); )
+    {
+      if (gpgtar_manifest_check (manifest, hdr)
+          && hdr->typeflag != TF_DIRECTORY)
+        {
+          gpgtar_manifest_keep (manifest);
+          *link = hdr->next;
+          xfree (hdr);
+          ndropped++;
+        }
+      else
+        link = &hdr->next;
+    }
+  scanctrl->flist_tail = link;
+  if (opt.verbose)
+    log_info ("skipping %lu unchanged files\n", ndropped);
+}
+
+
+/* Return the arguments to run gpg for creating the archive with the
+ * output going to OUTFILE.  */
+static const char **
+build_gpg_argv (int encrypt, int sign, const char *outfile)
+{
+  strlist_t arg;
+  ccparray_t ccp;
+  static char tmpbuf[40];
+
+  ccparray_init (&ccp, 0);
+  if (opt.batch)
+    ccparray_put (&ccp, "--batch");
+  if (opt.answer_yes)
+    ccparray_put (&ccp, "--yes");
+  if (opt.answer_no)
+    ccparray_put (&ccp, "--no");
+  if (opt.require_compliance)
+    ccparray_put (&ccp, "--require-compliance");
+  if (opt.status_fd)
+    {
+      snprintf (tmpbuf, sizeof tmpbuf, "--status-fd=%s", opt.status_fd);
+      ccparray_put (&ccp, tmpbuf);
+    }
+
+  ccparray_put (&ccp, "--output");
+  ccparray_put (&ccp, outfile);
+  if (encrypt)
+    ccparray_put (&ccp, "--encrypt");
+  if (sign)
+    ccparray_put (&ccp, "--sign");
+  if (opt.user)
+    {
+      ccparray_put (&ccp, "--local-user");
+      ccparray_put (&ccp, opt.user);
+    }
+  if (opt.symmetric)
+    ccparray_put (&ccp, "--symmetric");
+  for (arg = opt.recipients; arg; arg = arg->next)
+    {
+      ccparray_put (&ccp, "--recipient");
+      ccparray_put (&ccp, arg->d);
+    }
+  if (opt.no_compress)
+    ccparray_put (&ccp, "-z0");
+  for (arg = opt.gpg_arguments; arg; arg = arg->next)
+    ccparray_put (&ccp, arg->d);
+
+  ccparray_put (&ccp, NULL);
+  return ccparray_get (&ccp, NULL);
+}
+
+
 /* Create a new tarball using the names in the array INPATTERN.  If
    INPATTERN is NULL take the pattern as null terminated strings from
    stdin or from the file specified by FILES_FROM.  If NULL_NAMES is
@@ -1070,9 +1741,18 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
   int eof_seen = 0;
   gpgrt_process_t proc = NULL;
   unsigned int skipped_open = 0;
+  struct readahead_ctl_s ractl = { NULL };
+  readahead_t ra;
+  gpgtar_index_t index = NULL;
+  estream_t tarstream;
+  int crypto = 0;
+  gpgtar_manifest_t manifest = NULL;
+  unsigned long nwritten;
+  const char *name;
 
   memset (scanctrl, 0, sizeof *scanctrl);
   scanctrl->flist_tail = &scanctrl->flist;
+  ractl.tail = &ractl.head;
 
   if (!inpattern)
     {
@@ -1101,6 +1781,10 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
       return err;
     }
 
+  /* The worker threads are used to stat the directory entries and to
+   * read the files in advance.  */
+  pool_start (opt.threads);
+
   while (!eof_seen)
     {
       char *pat, *p;
@@ -1212,6 +1896,20 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
   if (files_from_stream && files_from_stream != es_stdin)
     es_fclose (files_from_stream);
 
+  if (opt.manifest)
+    {
+      err = gpgtar_manifest_load (opt.manifest, &manifest);
+      if (err)
+        goto leave;
+      drop_unchanged (scanctrl, manifest);
+      err = gcry_md_open (&content_md, GCRY_MD_SHA256, 0);
+      if (err)
+        {
+          log_error ("error creating hash context: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+    }
+
   global_total_files = global_total_data = 0;
   global_written_files = global_written_data = 0;
   for (hdr = scanctrl->flist; hdr; hdr = hdr->next)
@@ -1223,10 +1921,14 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
   write_progress (0, 0, global_total_data);
 
 
-  if (encrypt || sign)
+  /* '--encrypt' may be combined with '--symmetric', but 'encrypt'
+   * is set either way.  Clear it if no recipients are specified.  */
+  crypto = encrypt || sign;
+  if (opt.symmetric && opt.recipients == NULL)
+    encrypt = 0;
+
+  if (crypto && !opt.indexed)
     {
-      strlist_t arg;
-      ccparray_t ccp;
 #ifdef HAVE_W32_SYSTEM
       HANDLE except[2] = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE };
 #else
@@ -1235,28 +1937,10 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
       const char **argv;
       gpgrt_spawn_actions_t act = NULL;
 
-      /* '--encrypt' may be combined with '--symmetric', but 'encrypt'
-       * is set either way.  Clear it if no recipients are specified.
-       */
-      if (opt.symmetric && opt.recipients == NULL)
-        encrypt = 0;
-
-      ccparray_init (&ccp, 0);
-      if (opt.batch)
-        ccparray_put (&ccp, "--batch");
-      if (opt.answer_yes)
-        ccparray_put (&ccp, "--yes");
-      if (opt.answer_no)
-        ccparray_put (&ccp, "--no");
-      if (opt.require_compliance)
-        ccparray_put (&ccp, "--require-compliance");
       if (opt.status_fd)
         {
-          static char tmpbuf[40];
           es_syshd_t hd;
 
-          snprintf (tmpbuf, sizeof tmpbuf, "--status-fd=%s", opt.status_fd);
-          ccparray_put (&ccp, tmpbuf);
           es_syshd (opt.status_stream, &hd);
 #ifdef HAVE_W32_SYSTEM
           except[0] = hd.u.handle;
@@ -1265,31 +1949,7 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
 #endif
         }
 
-      ccparray_put (&ccp, "--output");
-      ccparray_put (&ccp, opt.outfile? opt.outfile : "-");
-      if (encrypt)
-        ccparray_put (&ccp, "--encrypt");
-      if (sign)
-        ccparray_put (&ccp, "--sign");
-      if (opt.user)
-        {
-          ccparray_put (&ccp, "--local-user");
-          ccparray_put (&ccp, opt.user);
-        }
-      if (opt.symmetric)
-        ccparray_put (&ccp, "--symmetric");
-      for (arg = opt.recipients; arg; arg = arg->next)
-        {
-          ccparray_put (&ccp, "--recipient");
-          ccparray_put (&ccp, arg->d);
-        }
-      if (opt.no_compress)
-        ccparray_put (&ccp, "-z0");
-      for (arg = opt.gpg_arguments; arg; arg = arg->next)
-        ccparray_put (&ccp, arg->d);
-
-      ccparray_put (&ccp, NULL);
-      argv = ccparray_get (&ccp, NULL);
+      argv = build_gpg_argv (encrypt, sign, opt.outfile? opt.outfile : "-");
       if (!argv)
         {
           err = gpg_error_from_syserror ();
@@ -1319,6 +1979,7 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
       /* Note that OUTSTREAM is our tar output which is fed to gpg.  */
       gpgrt_process_get_streams (proc, 0, &outstream, NULL, NULL);
       es_set_binary (outstream);
+      gpgtar_tune_pipe (outstream);
     }
   else if (opt.outfile) /* No crypto  */
     {
@@ -1341,15 +2002,61 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
       es_set_binary (outstream);
     }
 
+  if (crypto && opt.indexed)
+    {
+      /* The segments are written by separate gpg processes to
+       * OUTSTREAM which has been opened above like a plain output.  */
+      const char **argv = build_gpg_argv (encrypt, sign, "-");
+
+      if (!argv)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = gpgtar_index_new (&index, argv, outstream);
+      if (err)
+        goto leave;
+    }
+
   skipped_open = 0;
+  tarstream = outstream;
+  ractl.cursor = pool.nthreads? scanctrl->flist : NULL;
   for (hdr = scanctrl->flist; hdr; hdr = hdr->next)
     {
-      err = write_file (outstream, hdr, &skipped_open);
+      ra = readahead_get (&ractl, hdr);
+      if (index)
+        err = gpgtar_index_begin_member (index, &tarstream);
+      nwritten = global_written_files;
+      if (!err)
+        err = write_file (tarstream, hdr, ra, &skipped_open);
+      readahead_release (ra);
+      if (!err && index)
+        err = gpgtar_index_end_member (index, hdr);
+      if (err)
+        goto leave;
+      if (manifest && global_written_files != nwritten)
+        gpgtar_manifest_add (manifest, hdr,
+                             hdr->typeflag == TF_REGULAR
+                             ? gcry_md_read (content_md, GCRY_MD_SHA256)
+                             : NULL);
+    }
+
+  while (manifest && (name = gpgtar_manifest_next_deleted (manifest)))
+    {
+      if (index)
+        err = gpgtar_index_begin_member (index, &tarstream);
+      if (!err)
+        err = write_deletion (tarstream, name);
       if (err)
         goto leave;
     }
 
-  err = write_eof_mark (outstream);
+  if (index)
+    err = gpgtar_index_begin_member (index, &tarstream);
+  if (!err)
+    err = write_eof_mark (tarstream);
+  if (!err && index)
+    err = gpgtar_index_finish (index);
   if (err)
     goto leave;
 
@@ -1384,6 +2091,9 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
     }
 
  leave:
+  /* This needs to be done first because the index may still write
+   * to OUTSTREAM.  */
+  gpgtar_index_release (index);
   if (!err)
     {
       gpg_error_t first_err;
@@ -1395,6 +2105,23 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
       if (! err)
         err = first_err;
     }
+  if (!err && manifest)
+    {
+      /* Replace the manifest only after the archive has been
+       * completed.  It is encrypted like the archive.  */
+      char *tmpfname = xtrystrconcat (opt.manifest, ".tmp", NULL);
+      const char **argv = NULL;
+
+      if (!tmpfname)
+        err = gpg_error_from_syserror ();
+      else if (crypto && (encrypt || opt.symmetric)
+               && !(argv = build_gpg_argv (encrypt, 0, tmpfname)))
+        err = gpg_error_from_syserror ();
+      if (!err)
+        err = gpgtar_manifest_save (manifest, opt.manifest, argv, tmpfname);
+      xfree (argv);
+      xfree (tmpfname);
+    }
   if (err)
     {
       log_error ("creating tarball '%s' failed: %s\n",
@@ -1404,6 +2131,11 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
       if (opt.outfile)
         gnupg_remove (opt.outfile);
     }
+  gpgtar_manifest_release (manifest);
+  gcry_md_close (content_md);
+  content_md = NULL;
+  readahead_cleanup (&ractl);
+  pool_stop ();
   scanctrl->flist_tail = NULL;
   while ( (hdr = scanctrl->flist) )
     {
@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <npth.h>
 
 #include "../common/i18n.h"
 #include <gpg-error.h>
@@ -121,6 +122,461 @@ try_mkdir_p (const char *directory, size_t prefixlen, int strip, int verbose)
 
 
 
+/* The input stream which has been set up for zero-copy reads.  */
+static estream_t zerocopy_stream;
+
+
+/* Prepare the pipe STREAM from gpg so that extract_regular can move
+ * file data with splice.  This requires an unbuffered stream because
+ * otherwise the stream would already hold data which splice does not
+ * see.  Must be called before anything is read from STREAM.  */
+static void
+setup_zerocopy (estream_t stream)
+{
+  gpgtar_tune_pipe (stream);
+#ifdef HAVE_SPLICE
+  if (!es_setvbuf (stream, NULL, _IONBF, 0))
+    zerocopy_stream = stream;
+#endif
+}
+
+
+
+/* Maximum number of files written behind per thread.  */
+#define WRITEBEHIND_FILES_PER_THREAD 16
+
+/* Files up to this size are written behind.  */
+#define WRITEBEHIND_MAX_FILESIZE (1024*1024)
+
+/* Maximum number of bytes held for files written behind.  */
+#define WRITEBEHIND_MAX_BYTES (64*1024*1024)
+
+
+/* A job for the worker threads.  */
+struct pool_job_s;
+typedef struct pool_job_s *pool_job_t;
+struct pool_job_s
+{
+  pool_job_t next;
+  void (*fnc) (void *opaque);
+  void *opaque;
+  int done;
+};
+
+/* The worker pool.  With NTHREADS being 0 all jobs are run directly
+ * by pool_put.  */
+static struct
+{
+  int nthreads;
+  npth_t threads[GPGTAR_MAX_THREADS];
+  npth_mutex_t lock;
+  npth_cond_t cond;       /* Signaled when a job is queued.  */
+  npth_cond_t done_cond;  /* Signaled when a job is done.  */
+  pool_job_t head;
+  pool_job_t *tail;
+  int shutdown;
+} pool;
+
+
+/* A directory or a regular file which is created by a worker thread
+ * while the main thread goes on reading the archive.  */
+struct writebehind_s;
+typedef struct writebehind_s *writebehind_t;
+struct writebehind_s
+{
+  writebehind_t next;
+  struct pool_job_s job;
+  char *fname;                 /* Malloced full name of the file.  */
+  size_t prefixlen;            /* Length of the extract directory part.  */
+  unsigned int is_dir:1;       /* Create a directory.  */
+  unsigned int open_failed:1;  /* ERR is the error from open.  */
+  gpg_error_t err;             /* Error from open, write or close.  */
+  gpg_error_t remove_err;      /* Error removing the incomplete file.  */
+  size_t buflen;               /* Number of bytes to write.  */
+  unsigned char *buffer;       /* Malloced file content.  */
+};
+
+/* The queue of files written behind in the order of the archive.  */
+static struct
+{
+  writebehind_t head;
+  writebehind_t *tail;
+  unsigned int count;         /* Number of queued items.  */
+  unsigned long long bytes;   /* Sum of the file sizes of the items.  */
+  int cancel;                 /* Set after an error to skip the rest.  */
+} wbctl = { NULL, &wbctl.head, 0, 0, 0 };
+
+
+/* The worker thread of the pool.  */
+static void *
+pool_worker (void *arg)
+{
+  pool_job_t job;
+
+  (void)arg;
+
+  npth_mutex_lock (&pool.lock);
+  for (;;)
+    {
+      while (!pool.head && !pool.shutdown)
+        npth_cond_wait (&pool.cond, &pool.lock);
+      if (!(job = pool.head))
+        break;  /* Shutdown.  */
+      pool.head = job->next;
+      if (!pool.head)
+        pool.tail = &pool.head;
+      npth_mutex_unlock (&pool.lock);
+
+      job->fnc (job->opaque);
+
+      npth_mutex_lock (&pool.lock);
+      job->done = 1;
+      npth_cond_broadcast (&pool.done_cond);
+    }
+  npth_mutex_unlock (&pool.lock);
+  return NULL;
+}
+
+
+/* Start NTHREADS worker threads.  On error fewer or no threads are
+ * started; this is not an error because the files are then written
+ * directly.  */
+static void
+pool_start (int nthreads)
+{
+  npth_attr_t tattr;
+  int rc;
+
+  memset (&pool, 0, sizeof pool);
+  pool.tail = &pool.head;
+  if (nthreads <= 0)
+    return;
+
+  if (npth_mutex_init (&pool.lock, NULL)
+      || npth_cond_init (&pool.cond, NULL)
+      || npth_cond_init (&pool.done_cond, NULL)
+      || npth_attr_init (&tattr))
+    {
+      log_error ("error initializing the worker pool\n");
+      return;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (; pool.nthreads < nthreads && pool.nthreads < DIM (pool.threads);
+       pool.nthreads++)
+    {
+      rc = npth_create (&pool.threads[pool.nthreads], &tattr,
+                        pool_worker, NULL);
+      if (rc)
+        {
+          log_error ("error spawning worker thread: %s\n", strerror (rc));
+          break;
+        }
+    }
+  npth_attr_destroy (&tattr);
+}
+
+
+/* Terminate all worker threads.  All jobs must have been waited for.  */
+static void
+pool_stop (void)
+{
+  int i;
+
+  if (!pool.nthreads)
+    return;
+
+  npth_mutex_lock (&pool.lock);
+  pool.shutdown = 1;
+  npth_cond_broadcast (&pool.cond);
+  npth_mutex_unlock (&pool.lock);
+  for (i=0; i < pool.nthreads; i++)
+    npth_join (pool.threads[i], NULL);
+  pool.nthreads = 0;
+}
+
+
+/* Queue JOB to run FNC with OPAQUE.  */
+static void
+pool_put (pool_job_t job, void (*fnc)(void *), void *opaque)
+{
+  job->next = NULL;
+  job->fnc = fnc;
+  job->opaque = opaque;
+  job->done = 0;
+
+  if (!pool.nthreads)
+    {
+      fnc (opaque);
+      job->done = 1;
+      return;
+    }
+
+  npth_mutex_lock (&pool.lock);
+  *pool.tail = job;
+  pool.tail = &job->next;
+  npth_cond_signal (&pool.cond);
+  npth_mutex_unlock (&pool.lock);
+}
+
+
+/* Return true if JOB has been done.  */
+static int
+pool_test (pool_job_t job)
+{
+  int done;
+
+  if (!pool.nthreads)
+    return 1;
+
+  npth_mutex_lock (&pool.lock);
+  done = job->done;
+  npth_mutex_unlock (&pool.lock);
+  return done;
+}
+
+
+/* Wait until JOB has been done.  */
+static void
+pool_wait (pool_job_t job)
+{
+  if (!pool.nthreads)
+    return;
+
+  npth_mutex_lock (&pool.lock);
+  while (!job->done)
+    npth_cond_wait (&pool.done_cond, &pool.lock);
+  npth_mutex_unlock (&pool.lock);
+}
+
+
+static void
+writebehind_release (writebehind_t wb)
+{
+  if (!wb)
+    return;
+  xfree (wb->fname);
+  xfree (wb->buffer);
+  xfree (wb);
+}
+
+
+/* The job function to create the directory or to write the file of
+ * the write-behind item OPAQUE.  This runs in a worker thread and
+ * must not print diagnostics; they are printed by
+ * writebehind_finish in the order of the archive.  */
+static void
+writebehind_job (void *opaque)
+{
+  writebehind_t wb = opaque;
+  estream_t outfp;
+
+  /* Like the direct extraction we stop at the first error.  */
+  if (wbctl.cancel)
+    {
+      wb->err = gpg_error (GPG_ERR_CANCELED);
+      return;
+    }
+
+  if (wb->is_dir)
+    {
+      if (gnupg_mkdir (wb->fname, "-rwx------"))
+        {
+          wb->err = gpg_error_from_syserror ();
+          /* Ignore existing directories while extracting.  */
+          if (gpg_err_code (wb->err) == GPG_ERR_EEXIST)
+            wb->err = 0;
+          else if (gpg_err_code (wb->err) == GPG_ERR_ENOENT
+                   && !try_mkdir_p (wb->fname, wb->prefixlen, 0, 0))
+            wb->err = 0;
+        }
+      return;
+    }
+
+  outfp = es_fopen (wb->fname, "wb,sysopen");
+  if (!outfp && errno == ENOENT
+      && !try_mkdir_p (wb->fname, wb->prefixlen, 1, 0))
+    outfp = es_fopen (wb->fname, "wb,sysopen");
+  if (!outfp)
+    {
+      wb->err = gpg_error_from_syserror ();
+      wb->open_failed = 1;
+      return;
+    }
+
+  if (es_fwrite (wb->buffer, 1, wb->buflen, outfp) != wb->buflen)
+    wb->err = gpg_error_from_syserror ();
+  /* The data is buffered; thus errors may also show up on close.  */
+  if (es_fclose (outfp) && !wb->err)
+    wb->err = gpg_error_from_syserror ();
+  if (wb->err && gnupg_remove (wb->fname))
+    wb->remove_err = gpg_error_from_syserror ();
+}
+
+
+/* Print the diagnostics for the finished item WB and update the
+ * counters in INFO.  Returns the error of the item.  */
+static gpg_error_t
+writebehind_finish (tarinfo_t info, writebehind_t wb)
+{
+  gpg_error_t err = wb->err;
+
+  if (gpg_err_code (err) == GPG_ERR_CANCELED)
+    ;
+  else if (wb->is_dir)
+    {
+      if (err)
+        log_error ("error creating directory '%s': %s\n",
+                   wb->fname, gpg_strerror (err));
+      else if (opt.verbose)
+        log_info ("created   '%s/'\n", wb->fname);
+    }
+  else if (err)
+    {
+      if (wb->open_failed)
+        log_error ("error creating '%s': %s\n", wb->fname, gpg_strerror (err));
+      else
+        log_error ("error writing '%s': %s\n", wb->fname, gpg_strerror (err));
+      if (wb->remove_err)
+        log_error ("error removing incomplete file '%s': %s\n",
+                   wb->fname, gpg_strerror (wb->remove_err));
+    }
+  else
+    {
+      if (opt.verbose)
+        log_info ("extracted '%s'\n", wb->fname);
+      info->nextracted++;
+    }
+  return err;
+}
+
+
+/* Return true if a queued item is for FNAME or for a file below or
+ * above FNAME.  Such an item must be finished before FNAME is
+ * touched so that the result is the same as with extracting in
+ * order.  A directory does not conflict with the files below it
+ * because the parent directories are created as needed.  IS_DIR
+ * tells whether FNAME is a directory.  */
+static int
+writebehind_conflict (const char *fname, int is_dir)
+{
+  writebehind_t wb;
+  size_t n, len;
+
+  len = strlen (fname);
+  for (wb = wbctl.head; wb; wb = wb->next)
+    {
+      n = strlen (wb->fname);
+      if (n > len)
+        {
+          if (!is_dir
+              && !strncmp (wb->fname, fname, len) && wb->fname[len] == '/')
+            return 1;
+        }
+      else if (!strncmp (wb->fname, fname, n)
+               && (!fname[n] || (fname[n] == '/' && !wb->is_dir)))
+        return 1;
+    }
+  return 0;
+}
+
+
+/* Finish the queued items in archive order.  If FNAME is NULL wait
+ * for all items.  Otherwise finish only the items which are already
+ * done and wait until no item conflicts with FNAME, which is a
+ * directory if IS_DIR is set; if QUEUE is also set wait until there
+ * is room for another item of SIZE bytes.  Returns the first error
+ * of the finished items.  */
+static gpg_error_t
+writebehind_wait (tarinfo_t info, const char *fname, int is_dir,
+                  int queue, size_t size)
+{
+  gpg_error_t err = 0;
+  gpg_error_t tmperr;
+  writebehind_t wb;
+
+  while ((wb = wbctl.head))
+    {
+      if (!pool_test (&wb->job))
+        {
+          if (fname
+              && !writebehind_conflict (fname, is_dir)
+              && (!queue
+                  || (wbctl.count < pool.nthreads*WRITEBEHIND_FILES_PER_THREAD
+                      && wbctl.bytes + size <= WRITEBEHIND_MAX_BYTES)))
+            break;
+          pool_wait (&wb->job);
+        }
+      wbctl.head = wb->next;
+      if (!wbctl.head)
+        wbctl.tail = &wbctl.head;
+      wbctl.count--;
+      wbctl.bytes -= wb->buflen;
+      tmperr = writebehind_finish (info, wb);
+      if (tmperr)
+        wbctl.cancel = 1;
+      if (!err)
+        err = tmperr;
+      writebehind_release (wb);
+    }
+  return err;
+}
+
+
+/* Create a write-behind item for FNAME below DIRNAME and queue it
+ * after reading its content of HDR->SIZE bytes from STREAM.  If
+ * IS_DIR is set a directory is created instead.  */
+static gpg_error_t
+writebehind_put (estream_t stream, const char *dirname, tarinfo_t info,
+                 tar_header_t hdr, const char *fname, int is_dir)
+{
+  gpg_error_t err;
+  writebehind_t wb;
+  unsigned long long n;
+
+  err = writebehind_wait (info, fname, is_dir, 1, is_dir? 0 : hdr->size);
+  if (err)
+    return err;
+
+  wb = xtrycalloc (1, sizeof *wb);
+  if (!wb || !(wb->fname = xtrystrdup (fname)))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  wb->prefixlen = strlen (dirname) + 1;
+  wb->is_dir = !!is_dir;
+  if (!is_dir)
+    {
+      wb->buffer = xtrymalloc (hdr->nrecords * RECORDSIZE + 1);
+      if (!wb->buffer)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      for (n=0; n < hdr->nrecords; n++)
+        {
+          err = read_record (stream, wb->buffer + n * RECORDSIZE);
+          if (err)
+            goto leave;
+          info->nblocks++;
+        }
+      wb->buflen = hdr->size;
+    }
+
+  wb->next = NULL;
+  *wbctl.tail = wb;
+  wbctl.tail = &wb->next;
+  wbctl.count++;
+  wbctl.bytes += wb->buflen;
+  pool_put (&wb->job, writebehind_job, wb);
+  wb = NULL;
+
+ leave:
+  writebehind_release (wb);
+  return err;
+}
+
+
 static gpg_error_t
 extract_regular (estream_t stream, const char *dirname,
                  tarinfo_t info, tar_header_t hdr, strlist_t exthdr)
@@ -151,6 +607,22 @@ extract_regular (estream_t stream, const char *dirname,
     }
   fname = fname_buffer;
 
+  /* Small files are handed over to the worker threads; large files
+   * and those which can be copied without the buffers are written
+   * directly.  */
+  if (pool.nthreads && !opt.dry_run
+      && hdr->size <= WRITEBEHIND_MAX_FILESIZE
+      && !(stream == zerocopy_stream
+           && hdr->size >= GPGTAR_ZEROCOPY_MIN_SIZE))
+    {
+      err = writebehind_put (stream, dirname, info, hdr, fname, 0);
+      xfree (fname_buffer);
+      return err;
+    }
+  err = writebehind_wait (info, fname, 0, 0, 0);
+  if (err)
+    goto leave;
+
   if (opt.dry_run)
     outfp = es_fopen ("/dev/null", "wb");
   else
@@ -172,7 +644,33 @@ extract_regular (estream_t stream, const char *dirname,
         }
     }
 
-  for (n=0; n < hdr->nrecords;)
+  n = 0;
+  if (stream == zerocopy_stream && hdr->size >= GPGTAR_ZEROCOPY_MIN_SIZE)
+    {
+      /* Move all but the last record directly from the pipe to the
+       * file; the last record carries the padding.  */
+      unsigned long long want, copied;
+
+      want = (hdr->nrecords - 1) * RECORDSIZE;
+      err = gpgtar_copy_fd (es_fileno (stream), es_fileno (outfp),
+                            want, &copied);
+      if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED && !copied)
+        err = 0;
+      else if (err)
+        {
+          if (gpg_err_code (err) == GPG_ERR_EOF)
+            err = gpg_error (GPG_ERR_TRUNCATED);
+          log_error ("error writing '%s': %s\n", fname, gpg_strerror (err));
+          goto leave;
+        }
+      else
+        {
+          n = want / RECORDSIZE;
+          info->nblocks += n;
+        }
+    }
+
+  for (; n < hdr->nrecords;)
     {
       err = read_record (stream, record);
       if (err)
@@ -242,6 +740,13 @@ extract_directory (const char *dirname, tarinfo_t info,
   if (fname[strlen (fname)-1] == '/')
     fname[strlen (fname)-1] = 0;
 
+  if (pool.nthreads && !opt.dry_run)
+    {
+      err = writebehind_put (NULL, dirname, info, hdr, fname, 1);
+      xfree (fname);
+      return err;
+    }
+
   if (!opt.dry_run && gnupg_mkdir (fname, "-rwx------"))
     {
       err = gpg_error_from_syserror ();
@@ -269,12 +774,63 @@ extract_directory (const char *dirname, tarinfo_t info,
 }
 
 
+/* Process a deletion record of an incremental archive by removing
+ * NAME below DIRNAME.  This has only an effect when extracting into
+ * an existing directory tree.  */
+static gpg_error_t
+extract_deletion (estream_t stream, const char *dirname, tarinfo_t info,
+                  tar_header_t hdr, const char *name)
+{
+  gpg_error_t err;
+  char record[RECORDSIZE];
+  char *fname;
+  size_t n;
+
+  for (err = 0, n=0; !err && n < hdr->nrecords; n++)
+    {
+      err = read_record (stream, record);
+      if (!err)
+        info->nblocks++;
+    }
+  if (err)
+    return err;
+
+  /* The files written behind must not be created after the deletion.  */
+  err = writebehind_wait (info, NULL, 0, 0, 0);
+  if (err)
+    return err;
+
+  if (check_suspicious_name (name, info))
+    return 0;
+  fname = strconcat (dirname, "/", name, NULL);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  if (opt.dry_run)
+    ;
+  else if (!gnupg_remove (fname) || !gnupg_rmdir (fname))
+    {
+      if (opt.verbose)
+        log_info ("deleted   '%s'\n", fname);
+    }
+  else if (errno != ENOENT)
+    log_info ("error deleting '%s': %s\n",
+              fname, gpg_strerror (gpg_error_from_syserror ()));
+  xfree (fname);
+  return 0;
+}
+
+
 static gpg_error_t
 extract (estream_t stream, const char *dirname, tarinfo_t info,
          tar_header_t hdr, strlist_t exthdr)
 {
   gpg_error_t err;
   size_t n;
+  strlist_t sl;
+
+  for (sl = exthdr; sl; sl = sl->next)
+    if (sl->flags == 3)
+      return extract_deletion (stream, dirname, info, hdr, sl->d);
 
   if (hdr->typeflag == TF_REGULAR || hdr->typeflag == TF_UNKNOWN)
     err = extract_regular (stream, dirname, info, hdr, exthdr);
@@ -303,6 +859,125 @@ extract (estream_t stream, const char *dirname, tarinfo_t info,
 }
 
 
+/* Return true if the member NAME of type TYPEFLAG is selected by one
+ * of the names in MEMBERS.  A name selects the member itself, all
+ * members below it and the directories leading to it.  If a name
+ * matches its entry in MATCHED is set.  */
+static int
+member_selected (const char *name, typeflag_t typeflag, char **members,
+                 char *matched)
+{
+  size_t namelen = strlen (name);
+  size_t len;
+  int i, selected = 0;
+
+  for (i=0; members[i]; i++)
+    {
+      len = strlen (members[i]);
+      while (len > 1 && members[i][len-1] == '/')
+        len--;
+      if (!strncmp (name, members[i], len)
+          && (!name[len] || name[len] == '/'))
+        {
+          matched[i] = 1;
+          selected = 1;
+        }
+      else if (typeflag == TF_DIRECTORY && namelen < len
+               && !strncmp (name, members[i], namelen)
+               && members[i][namelen] == '/')
+        selected = 1;
+    }
+  return selected;
+}
+
+
+/* Extract the indexed archive FILENAME with TOC to DIRNAME.  If
+ * MEMBERS is not NULL only the members selected by it are extracted
+ * and only segments holding such members are decrypted.  */
+static gpg_error_t
+extract_indexed (const char *filename, gpgtar_toc_t toc, char **members,
+                 const char *dirname, tarinfo_t info)
+{
+  gpg_error_t err = 0;
+  char *wanted = NULL;
+  char *matched = NULL;
+  unsigned long n, first, end;
+  unsigned int segno;
+  int i, any;
+  gpgtar_segment_t seg;
+  estream_t stream;
+  tar_header_t header = NULL;
+  strlist_t extheader = NULL;
+  char record[RECORDSIZE];
+  unsigned long long nrec;
+
+  for (i=0; members && members[i]; i++)
+    ;
+  wanted = xtrycalloc (1, toc->nmembers + 1);
+  matched = xtrycalloc (1, i + 1);
+  if (!wanted || !matched)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (n=0; n < toc->nmembers; n++)
+    wanted[n] = !members || member_selected (toc->members[n].hdr->name,
+                                             toc->members[n].hdr->typeflag,
+                                             members, matched);
+  for (i=0; members && members[i]; i++)
+    if (!matched[i])
+      log_error ("'%s' not found in archive\n", members[i]);
+
+  for (end=0, segno=0; !err && segno < toc->nsegments; segno++)
+    {
+      first = end;
+      for (any=0; end < toc->nmembers && toc->members[end].segno == segno;
+           end++)
+        any |= wanted[end];
+      if (!any)
+        continue;
+
+      err = gpgtar_index_open_segment (filename, toc, segno, &seg, &stream);
+      if (err)
+        break;
+      setup_zerocopy (stream);
+      for (n=first; !err && n < end; n++)
+        {
+          err = gpgtar_read_header (stream, info, &header, &extheader);
+          if (!err && !header)
+            err = gpg_error (GPG_ERR_TRUNCATED);
+          if (err)
+            break;
+          if (wanted[n])
+            err = extract (stream, dirname, info, header, extheader);
+          else
+            {
+              for (nrec=0; !err && nrec < header->nrecords; nrec++)
+                {
+                  err = read_record (stream, record);
+                  if (!err)
+                    info->nblocks++;
+                }
+            }
+          free_strlist (extheader);
+          extheader = NULL;
+          xfree (header);
+          header = NULL;
+        }
+      zerocopy_stream = NULL;
+      if (err)
+        gpgtar_index_close_segment (seg, 1);
+      else
+        err = gpgtar_index_close_segment (seg, 0);
+    }
+
+ leave:
+  xfree (wanted);
+  xfree (matched);
+  return err;
+}
+
+
 /* Create a new directory to be used for extracting the tarball.
    Returns the name of the directory which must be freed by the
    caller.  In case of an error a diagnostic is printed and NULL
@@ -370,10 +1045,14 @@ create_directory (const char *dirprefix)
 
 
 
+/* Extract the tarball FILENAME or, if FILENAME is NULL, the tarball
+ * read from stdin.  MEMBERS is an optional NULL terminated array with
+ * the names of the members to extract; this is only supported for
+ * indexed archives.  */
 gpg_error_t
-gpgtar_extract (const char *filename, int decrypt)
+gpgtar_extract (const char *filename, int decrypt, char **members)
 {
-  gpg_error_t err;
+  gpg_error_t err, tmperr;
   estream_t stream = NULL;
   tar_header_t header = NULL;
   strlist_t extheader = NULL;
@@ -384,9 +1063,23 @@ gpgtar_extract (const char *filename, int decrypt)
   gpgrt_process_t proc;
   char *logfilename = NULL;
   unsigned long long notextracted;
+  gpgtar_toc_t toc = NULL;
 
   memset (&tarinfo_buffer, 0, sizeof tarinfo_buffer);
 
+  if (decrypt && filename)
+    {
+      err = gpgtar_index_read (filename, &toc);
+      if (err)
+        goto leave;
+    }
+  if (members && !toc)
+    {
+      log_error ("selecting members requires an indexed archive\n");
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
   if (opt.directory)
     dirname = xtrystrdup (opt.directory);
   else
@@ -422,6 +1115,14 @@ gpgtar_extract (const char *filename, int decrypt)
   if (opt.verbose)
     log_info ("extracting to '%s/'\n", dirname);
 
+  pool_start (opt.threads);
+
+  if (toc)
+    {
+      err = extract_indexed (filename, toc, members, dirname, tarinfo);
+      goto leave;
+    }
+
   if (decrypt)
     {
       strlist_t arg;
@@ -499,6 +1200,7 @@ gpgtar_extract (const char *filename, int decrypt)
         goto leave;
       gpgrt_process_get_streams (proc, 0, NULL, &stream, NULL);
       es_set_binary (stream);
+      setup_zerocopy (stream);
     }
   else if (filename)
     {
@@ -559,6 +1261,13 @@ gpgtar_extract (const char *filename, int decrypt)
     }
 
  leave:
+  /* Finish all files in the order of the archive before the totals
+   * are printed.  */
+  tmperr = writebehind_wait (tarinfo, NULL, 0, 0, 0);
+  if (!err)
+    err = tmperr;
+  pool_stop ();
+
   notextracted  = tarinfo->skipped_badname;
   notextracted += tarinfo->skipped_suspicious;
   notextracted += tarinfo->skipped_symlinks;
@@ -593,6 +1302,8 @@ gpgtar_extract (const char *filename, int decrypt)
   xfree (header);
   xfree (dirname);
   xfree (logfilename);
+  gpgtar_index_release_toc (toc);
+  zerocopy_stream = NULL;
   if (stream != es_stdin)
     es_fclose (stream);
   return err;
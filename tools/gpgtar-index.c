@@ -0,0 +1,841 @@
+/* gpgtar-index.c - Indexed encrypted archives
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* An indexed archive is a sequence of independent OpenPGP messages
+ * followed by a plain trailer:
+ *
+ *   SEGMENT_1 ... SEGMENT_n TOC TRAILER
+ *
+ * Each segment is a message created by gpg whose plaintext is a run
+ * of complete tar members; the concatenated plaintexts of all
+ * segments form a regular tarball.  The TOC is another message whose
+ * plaintext is a list of lines:
+ *
+ *   GPGTAR-INDEX 1
+ *   S <offset> <length>
+ *   M <segno> <typeflag> <mode> <uid> <gid> <size> <mtime> <name>
+ *
+ * There is one S line for each segment in the order of the segments
+ * and one M line for each member in the order of the tarball.  All
+ * numbers are decimal except for MODE which is octal; NAME is
+ * percent-plus escaped.  The TRAILER is a record of TRAILER_LEN bytes
+ * "GPGTAR-INDEX-1 <tocoff> <toclen>" with both values given as 16 hex
+ * digits, padded with spaces and terminated by a LF.  A reader thus
+ * needs to decrypt only the TOC to list the archive and only the
+ * segments holding the requested members to extract them.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <npth.h>
+
+#include "../common/i18n.h"
+#include <gpg-error.h>
+#include "../common/sysutils.h"
+#include "../common/ccparray.h"
+#include "../common/membuf.h"
+#include "gpgtar.h"
+
+
+/* The magic at the start of the TOC plaintext.  */
+#define TOC_MAGIC "GPGTAR-INDEX 1"
+
+/* The magic at the start of the trailer and the trailer's length.  */
+#define TRAILER_MAGIC "GPGTAR-INDEX-1 "
+#define TRAILER_LEN 64
+
+/* The maximum length of a TOC line.  */
+#define TOC_MAX_LINE 16384
+
+
+/* A gpg process with a helper thread copying data from or to it.  */
+struct gpgtar_segment_s
+{
+  gpgrt_process_t proc;
+  estream_t to_gpg;          /* Pipe to gpg's stdin.  */
+  estream_t from_gpg;        /* Pipe from gpg's stdout.  */
+  estream_t other;           /* The archive; sink or source.  */
+  unsigned long long limit;  /* Number of bytes to feed to gpg.  */
+  unsigned long long count;  /* Number of bytes copied.  */
+  gpg_error_t err;           /* Error of the helper thread.  */
+  npth_t thread;
+  unsigned int reader:1;     /* Decrypting from the archive.  */
+};
+
+
+/* The context used to write an indexed archive.  */
+struct gpgtar_index_s
+{
+  const char **argv;         /* The gpg arguments for a segment.  */
+  estream_t archive;         /* The output stream.  */
+  unsigned long long archoff;/* Number of bytes written to ARCHIVE.  */
+  gpgtar_segment_t seg;      /* The active segment or NULL.  */
+  estream_t tarstream;       /* Counting stream writing to SEG.  */
+  unsigned long long segbytes; /* Plaintext bytes in the segment.  */
+  unsigned long long memberstart; /* Value of SEGBYTES at member start.  */
+  unsigned int nsegments;    /* Number of finished segments.  */
+  membuf_t slines;           /* The S lines of the TOC.  */
+  membuf_t mlines;           /* The M lines of the TOC.  */
+};
+
+
+
+/* Wait for the gpg process of SEG and release it.  */
+static gpg_error_t
+wait_gpg (gpgtar_segment_t seg)
+{
+  gpg_error_t err;
+  int exitcode;
+
+  err = gpgrt_process_wait (seg->proc, 1);
+  if (!err)
+    {
+      gpgrt_process_ctl (seg->proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
+      if (exitcode)
+        {
+          log_error ("running %s failed (exitcode=%d)\n",
+                     opt.gpg_program, exitcode);
+          err = gpg_error (GPG_ERR_GENERAL);
+        }
+    }
+  gpgrt_process_release (seg->proc);
+  seg->proc = NULL;
+  return err;
+}
+
+
+/* Thread copying the output of gpg to the archive.  After a write
+ * error the output is still drained so that gpg does not block.  */
+static void *
+segment_sink_thread (void *arg)
+{
+  gpgtar_segment_t seg = arg;
+  char buffer[16384];
+  size_t nread;
+
+  while ((nread = es_fread (buffer, 1, sizeof buffer, seg->from_gpg)))
+    {
+      if (seg->err)
+        continue;
+      if (es_fwrite (buffer, 1, nread, seg->other) != nread)
+        seg->err = gpg_error_from_syserror ();
+      else
+        seg->count += nread;
+    }
+  if (!seg->err && es_ferror (seg->from_gpg))
+    seg->err = gpg_error_from_syserror ();
+  return NULL;
+}
+
+
+/* Thread feeding LIMIT bytes from the archive to gpg.  */
+static void *
+segment_feed_thread (void *arg)
+{
+  gpgtar_segment_t seg = arg;
+  char buffer[16384];
+  size_t n, nread;
+
+  while (seg->count < seg->limit)
+    {
+      n = sizeof buffer;
+      if (n > seg->limit - seg->count)
+        n = seg->limit - seg->count;
+      nread = es_fread (buffer, 1, n, seg->other);
+      if (!nread)
+        {
+          seg->err = es_ferror (seg->other)? gpg_error_from_syserror ()
+            /**/                           : gpg_error (GPG_ERR_TRUNCATED);
+          break;
+        }
+      if (es_fwrite (buffer, 1, nread, seg->to_gpg) != nread)
+        {
+          seg->err = gpg_error_from_syserror ();
+          break;
+        }
+      seg->count += nread;
+    }
+  /* Closing the pipe signals EOF to gpg.  */
+  if (es_fclose (seg->to_gpg) && !seg->err)
+    seg->err = gpg_error_from_syserror ();
+  seg->to_gpg = NULL;
+  return NULL;
+}
+
+
+/* Spawn gpg with ARGV and a thread running FNC with the new segment
+ * object.  OTHER is the archive stream used by that thread.  */
+static gpg_error_t
+segment_new (const char **argv, estream_t other, unsigned long long limit,
+             void *(*fnc)(void *), gpgtar_segment_t *r_seg)
+{
+  gpg_error_t err;
+  gpgtar_segment_t seg;
+  npth_attr_t tattr;
+  int rc;
+
+  *r_seg = NULL;
+  seg = xtrycalloc (1, sizeof *seg);
+  if (!seg)
+    return gpg_error_from_syserror ();
+  seg->other = other;
+  seg->limit = limit;
+  seg->reader = (fnc == segment_feed_thread);
+
+  err = gpgtar_spawn_gpg (argv, (GPGRT_PROCESS_STDIN_PIPE
+                                 | GPGRT_PROCESS_STDOUT_PIPE
+                                 | GPGRT_PROCESS_STDERR_KEEP), &seg->proc);
+  if (err)
+    {
+      log_error ("error running '%s': %s\n",
+                 opt.gpg_program, gpg_strerror (err));
+      xfree (seg);
+      return err;
+    }
+  gpgrt_process_get_streams (seg->proc, 0, &seg->to_gpg, &seg->from_gpg,
+                             NULL);
+  es_set_binary (seg->to_gpg);
+  es_set_binary (seg->from_gpg);
+  gpgtar_tune_pipe (seg->to_gpg);
+  gpgtar_tune_pipe (seg->from_gpg);
+
+  rc = npth_attr_init (&tattr);
+  if (!rc)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      rc = npth_create (&seg->thread, &tattr, fnc, seg);
+      npth_attr_destroy (&tattr);
+    }
+  if (rc)
+    {
+      err = gpg_error_from_errno (rc);
+      log_error ("error spawning thread: %s\n", gpg_strerror (err));
+      es_fclose (seg->to_gpg);
+      es_fclose (seg->from_gpg);
+      gpgrt_process_terminate (seg->proc);
+      gpgrt_process_wait (seg->proc, 1);
+      gpgrt_process_release (seg->proc);
+      xfree (seg);
+      return err;
+    }
+
+  *r_seg = seg;
+  return 0;
+}
+
+
+/* Finish and release SEG and store the number of copied bytes at
+ * R_COUNT.  If CANCEL is set gpg is terminated and any error is
+ * ignored.  Otherwise the remaining output of a decrypting gpg is
+ * read and discarded.  */
+static gpg_error_t
+segment_release (gpgtar_segment_t seg, int cancel,
+                 unsigned long long *r_count)
+{
+  gpg_error_t err = 0;
+  gpg_error_t err2;
+  char buffer[4096];
+
+  if (r_count)
+    *r_count = 0;
+  if (!seg)
+    return 0;
+
+  if (!seg->reader)
+    {
+      /* Closing the pipe signals EOF to gpg.  */
+      if (es_fclose (seg->to_gpg))
+        err = gpg_error_from_syserror ();
+      seg->to_gpg = NULL;
+    }
+  if (cancel)
+    gpgrt_process_terminate (seg->proc);
+  else if (seg->reader)
+    {
+      while (es_fread (buffer, 1, sizeof buffer, seg->from_gpg))
+        ;
+    }
+  npth_join (seg->thread, NULL);
+  if (!err)
+    err = seg->err;
+  if (r_count)
+    *r_count = seg->count;
+  es_fclose (seg->to_gpg);
+  es_fclose (seg->from_gpg);
+  if (seg->reader)
+    es_fclose (seg->other);
+  err2 = wait_gpg (seg);
+  if (!err)
+    err = err2;
+  xfree (seg);
+  return cancel? 0 : err;
+}
+
+
+
+/* The write handler of the counting stream used for the members.  */
+static gpgrt_ssize_t
+index_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  gpgtar_index_t idx = cookie;
+
+  if (!size)
+    return 0;  /* Flush request.  */
+  if (es_write (idx->seg->to_gpg, buffer, size, NULL))
+    return -1;
+  idx->segbytes += size;
+  return (gpgrt_ssize_t)size;
+}
+
+
+static es_cookie_io_functions_t index_cookie_functions =
+  {
+    NULL,
+    index_cookie_write,
+    NULL,
+    NULL
+  };
+
+
+/* Start a new segment for IDX.  */
+static gpg_error_t
+index_start_segment (gpgtar_index_t idx)
+{
+  gpg_error_t err;
+
+  err = segment_new (idx->argv, idx->archive, 0, segment_sink_thread,
+                     &idx->seg);
+  if (err)
+    return err;
+  idx->tarstream = es_fopencookie (idx, "wb", index_cookie_functions);
+  if (!idx->tarstream)
+    {
+      err = gpg_error_from_syserror ();
+      segment_release (idx->seg, 1, NULL);
+      idx->seg = NULL;
+      return err;
+    }
+  idx->segbytes = 0;
+  return 0;
+}
+
+
+/* Finish the active segment of IDX and record it in the TOC.  */
+static gpg_error_t
+index_finish_segment (gpgtar_index_t idx)
+{
+  gpg_error_t err, err2;
+  unsigned long long length;
+
+  err = es_fclose (idx->tarstream)? gpg_error_from_syserror () : 0;
+  idx->tarstream = NULL;
+  err2 = segment_release (idx->seg, !!err, &length);
+  idx->seg = NULL;
+  if (!err)
+    err = err2;
+  if (err)
+    return err;
+
+  put_membuf_printf (&idx->slines, "S %llu %llu\n", idx->archoff, length);
+  idx->archoff += length;
+  idx->nsegments++;
+  return 0;
+}
+
+
+/* Create a new context to write an indexed archive to ARCHIVE.  ARGV
+ * are the arguments to run gpg for one segment with the output going
+ * to stdout; they are taken over by this function.  */
+gpg_error_t
+gpgtar_index_new (gpgtar_index_t *r_idx, const char **argv, estream_t archive)
+{
+  gpg_error_t err;
+  gpgtar_index_t idx;
+
+  *r_idx = NULL;
+  idx = xtrycalloc (1, sizeof *idx);
+  if (!idx)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (argv);
+      return err;
+    }
+  idx->argv = argv;
+  idx->archive = archive;
+  init_membuf (&idx->slines, 256);
+  init_membuf (&idx->mlines, 4096);
+  *r_idx = idx;
+  return 0;
+}
+
+
+/* Return the stream to which the next member shall be written.  A
+ * new segment is started if the current one is full.  */
+gpg_error_t
+gpgtar_index_begin_member (gpgtar_index_t idx, estream_t *r_stream)
+{
+  gpg_error_t err;
+
+  *r_stream = NULL;
+  if (idx->seg && idx->segbytes >= GPGTAR_SEGMENT_SIZE)
+    {
+      err = index_finish_segment (idx);
+      if (err)
+        return err;
+    }
+  if (!idx->seg)
+    {
+      err = index_start_segment (idx);
+      if (err)
+        return err;
+    }
+  idx->memberstart = idx->segbytes;
+  *r_stream = idx->tarstream;
+  return 0;
+}
+
+
+/* Record HDR in the TOC if the member has actually been written.  */
+gpg_error_t
+gpgtar_index_end_member (gpgtar_index_t idx, tar_header_t hdr)
+{
+  char *name;
+
+  if (es_fflush (idx->tarstream))
+    return gpg_error_from_syserror ();
+  if (idx->segbytes == idx->memberstart)
+    return 0;  /* Skipped.  */
+
+  name = percent_plus_escape (hdr->name);
+  if (!name)
+    return gpg_error_from_syserror ();
+  put_membuf_printf (&idx->mlines, "M %u %d %lo %lu %lu %llu %llu %s\n",
+                     idx->nsegments, (int)hdr->typeflag, hdr->mode,
+                     hdr->uid, hdr->gid, hdr->size, hdr->mtime, name);
+  xfree (name);
+  return 0;
+}
+
+
+/* Finish the last segment of IDX and write the TOC and the trailer.
+ * The caller should already have written the EOF mark to the last
+ * member stream.  */
+gpg_error_t
+gpgtar_index_finish (gpgtar_index_t idx)
+{
+  gpg_error_t err;
+  gpgtar_segment_t seg;
+  void *buf;
+  size_t len;
+  unsigned long long toclen;
+  char trailer[TRAILER_LEN+1];
+
+  if (idx->seg)
+    {
+      err = index_finish_segment (idx);
+      if (err)
+        return err;
+    }
+
+  err = segment_new (idx->argv, idx->archive, 0, segment_sink_thread, &seg);
+  if (err)
+    return err;
+  es_fputs (TOC_MAGIC "\n", seg->to_gpg);
+  buf = get_membuf (&idx->slines, &len);
+  if (buf)
+    {
+      es_fwrite (buf, 1, len, seg->to_gpg);
+      xfree (buf);
+      buf = get_membuf (&idx->mlines, &len);
+    }
+  if (!buf)
+    {
+      err = gpg_error_from_syserror ();
+      segment_release (seg, 1, NULL);
+      return err;
+    }
+  es_fwrite (buf, 1, len, seg->to_gpg);
+  xfree (buf);
+  if (es_fflush (seg->to_gpg))
+    {
+      err = gpg_error_from_syserror ();
+      segment_release (seg, 1, NULL);
+      return err;
+    }
+  err = segment_release (seg, 0, &toclen);
+  if (err)
+    return err;
+
+  snprintf (trailer, sizeof trailer, TRAILER_MAGIC "%016llx %016llx",
+            idx->archoff, toclen);
+  memset (trailer + strlen (trailer), ' ', TRAILER_LEN - strlen (trailer));
+  trailer[TRAILER_LEN-1] = '\n';
+  if (es_fwrite (trailer, 1, TRAILER_LEN, idx->archive) != TRAILER_LEN)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Release IDX.  A still active segment is cancelled.  */
+void
+gpgtar_index_release (gpgtar_index_t idx)
+{
+  if (!idx)
+    return;
+  if (idx->seg)
+    {
+      es_fclose (idx->tarstream);
+      segment_release (idx->seg, 1, NULL);
+    }
+  xfree (get_membuf (&idx->slines, NULL));
+  xfree (get_membuf (&idx->mlines, NULL));
+  xfree (idx->argv);
+  xfree (idx);
+}
+
+
+
+/* Return the arguments to decrypt a message read from stdin.  */
+static const char **
+build_decrypt_argv (void)
+{
+  ccparray_t ccp;
+  strlist_t arg;
+  static char tmpbuf[40];
+
+  ccparray_init (&ccp, 0);
+  if (opt.batch)
+    ccparray_put (&ccp, "--batch");
+  if (opt.require_compliance)
+    ccparray_put (&ccp, "--require-compliance");
+  if (opt.status_fd)
+    {
+      snprintf (tmpbuf, sizeof tmpbuf, "--status-fd=%s", opt.status_fd);
+      ccparray_put (&ccp, tmpbuf);
+    }
+  ccparray_put (&ccp, "--output");
+  ccparray_put (&ccp, "-");
+  ccparray_put (&ccp, "--decrypt");
+  for (arg = opt.gpg_arguments; arg; arg = arg->next)
+    ccparray_put (&ccp, arg->d);
+  ccparray_put (&ccp, NULL);
+  return ccparray_get (&ccp, NULL);
+}
+
+
+/* Start decrypting LENGTH bytes at OFFSET of FILENAME.  The
+ * plaintext can be read from the from_gpg stream of the returned
+ * segment object.  */
+static gpg_error_t
+open_range (const char *filename, unsigned long long offset,
+            unsigned long long length, gpgtar_segment_t *r_seg)
+{
+  gpg_error_t err;
+  estream_t fp;
+  const char **argv;
+
+  *r_seg = NULL;
+  fp = es_fopen (filename, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error opening '%s': %s\n", filename, gpg_strerror (err));
+      return err;
+    }
+  if (es_fseeko (fp, (gpgrt_off_t)offset, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error seeking in '%s': %s\n", filename, gpg_strerror (err));
+      es_fclose (fp);
+      return err;
+    }
+
+  argv = build_decrypt_argv ();
+  if (!argv)
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      return err;
+    }
+  err = segment_new (argv, fp, length, segment_feed_thread, r_seg);
+  xfree (argv);
+  if (err)
+    es_fclose (fp);
+  return err;
+}
+
+
+/* Check whether FILENAME is an indexed archive and store the
+ * location of the TOC at R_OFFSET and R_LENGTH.  Returns
+ * GPG_ERR_NOT_FOUND for other archives.  */
+static gpg_error_t
+read_trailer (const char *filename,
+              unsigned long long *r_offset, unsigned long long *r_length)
+{
+  struct stat st;
+  estream_t fp;
+  char buffer[TRAILER_LEN];
+  unsigned long long filesize, offset, length;
+  const char *s;
+  char *endp;
+
+  /* Do not even open a FIFO because that would already consume
+   * data.  */
+  if (gnupg_stat (filename, &st) || !S_ISREG (st.st_mode)
+      || st.st_size < TRAILER_LEN)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  fp = es_fopen (filename, "rb");
+  if (!fp)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  if (es_fseeko (fp, -TRAILER_LEN, SEEK_END)
+      || es_fread (buffer, 1, TRAILER_LEN, fp) != TRAILER_LEN)
+    {
+      es_fclose (fp);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  filesize = es_ftello (fp);
+  es_fclose (fp);
+
+  if (memcmp (buffer, TRAILER_MAGIC, strlen (TRAILER_MAGIC))
+      || buffer[TRAILER_LEN-1] != '\n')
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  s = buffer + strlen (TRAILER_MAGIC);
+  offset = strtoull (s, &endp, 16);
+  if (endp != s + 16 || *endp != ' ')
+    return gpg_error (GPG_ERR_INV_DATA);
+  s = endp + 1;
+  length = strtoull (s, &endp, 16);
+  if (endp != s + 16 || *endp != ' ')
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  filesize -= TRAILER_LEN;
+  if (offset > filesize || length > filesize - offset)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  *r_offset = offset;
+  *r_length = length;
+  return 0;
+}
+
+
+/* Parse one S or M line of the TOC into TOC.  */
+static gpg_error_t
+parse_toc_line (gpgtar_toc_t toc, char *line, unsigned long long tocoff)
+{
+  const char *fields[10];
+  int nfields;
+  void *p;
+  tar_header_t hdr;
+  unsigned long segno;
+  int typeflag;
+
+  nfields = split_fields (line, fields, DIM (fields));
+  if (nfields == 3 && !strcmp (fields[0], "S"))
+    {
+      struct gpgtar_toc_segment_s *sp;
+
+      if (toc->nmembers)
+        return gpg_error (GPG_ERR_INV_DATA); /* S after an M line.  */
+      p = xtryrealloc (toc->segments,
+                       (toc->nsegments + 1) * sizeof *toc->segments);
+      if (!p)
+        return gpg_error_from_syserror ();
+      toc->segments = p;
+      sp = toc->segments + toc->nsegments;
+      sp->offset = strtoull (fields[1], NULL, 10);
+      sp->length = strtoull (fields[2], NULL, 10);
+      if (sp->offset > tocoff || sp->length > tocoff - sp->offset)
+        return gpg_error (GPG_ERR_INV_DATA);
+      toc->nsegments++;
+      return 0;
+    }
+
+  if (nfields != 9 || strcmp (fields[0], "M"))
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  segno = strtoul (fields[1], NULL, 10);
+  typeflag = atoi (fields[2]);
+  if (segno >= toc->nsegments
+      || (toc->nmembers && segno < toc->members[toc->nmembers-1].segno)
+      || typeflag < 0 || typeflag > TF_NOTSUP)
+    return gpg_error (GPG_ERR_INV_DATA);
+
+  if (!(toc->nmembers % 256))
+    {
+      p = xtryrealloc (toc->members,
+                       (toc->nmembers + 256) * sizeof *toc->members);
+      if (!p)
+        return gpg_error_from_syserror ();
+      toc->members = p;
+    }
+
+  hdr = xtrycalloc (1, sizeof *hdr + strlen (fields[8]));
+  if (!hdr)
+    return gpg_error_from_syserror ();
+  strcpy (hdr->name, fields[8]);
+  percent_plus_unescape_inplace (hdr->name, 0);
+  hdr->typeflag = typeflag;
+  hdr->mode  = strtoul (fields[3], NULL, 8);
+  hdr->uid   = strtoul (fields[4], NULL, 10);
+  hdr->gid   = strtoul (fields[5], NULL, 10);
+  hdr->size  = strtoull (fields[6], NULL, 10);
+  hdr->mtime = strtoull (fields[7], NULL, 10);
+
+  toc->members[toc->nmembers].segno = segno;
+  toc->members[toc->nmembers].hdr = hdr;
+  toc->nmembers++;
+  return 0;
+}
+
+
+/* Check whether FILENAME is an indexed archive and if so, decrypt
+ * its TOC and store it at R_TOC.  For other archives 0 is returned
+ * and NULL stored at R_TOC.  */
+gpg_error_t
+gpgtar_index_read (const char *filename, gpgtar_toc_t *r_toc)
+{
+  gpg_error_t err;
+  unsigned long long tocoff, toclen;
+  gpgtar_segment_t seg = NULL;
+  gpgtar_toc_t toc;
+  char *line = NULL;
+  size_t linelen = 0;
+  size_t maxlen;
+  gpgrt_ssize_t len;
+  unsigned int lineno = 0;
+
+  *r_toc = NULL;
+  err = read_trailer (filename, &tocoff, &toclen);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    return 0;
+  if (err)
+    {
+      log_error ("invalid index trailer in '%s'\n", filename);
+      return err;
+    }
+  if (opt.verbose)
+    log_info ("reading index of '%s'\n", filename);
+
+  toc = xtrycalloc (1, sizeof *toc);
+  if (!toc)
+    return gpg_error_from_syserror ();
+
+  err = open_range (filename, tocoff, toclen, &seg);
+  if (err)
+    goto leave;
+
+  maxlen = TOC_MAX_LINE;
+  while ((len = es_read_line (seg->from_gpg, &line, &linelen, &maxlen)) > 0)
+    {
+      lineno++;
+      if (!maxlen)
+        {
+          err = gpg_error (GPG_ERR_LINE_TOO_LONG);
+          break;
+        }
+      if (line[len-1] == '\n')
+        line[--len] = 0;
+      if (lineno == 1)
+        {
+          if (strcmp (line, TOC_MAGIC))
+            {
+              err = gpg_error (GPG_ERR_INV_DATA);
+              break;
+            }
+        }
+      else if ((err = parse_toc_line (toc, line, tocoff)))
+        break;
+    }
+  if (!err && len < 0)
+    err = gpg_error_from_syserror ();
+  else if (!err && !lineno)
+    err = gpg_error (GPG_ERR_NO_DATA);
+  if (!err)
+    err = segment_release (seg, 0, NULL);
+  else
+    segment_release (seg, 1, NULL);
+  if (err)
+    log_error ("error reading index of '%s' (line %u): %s\n",
+               filename, lineno, gpg_strerror (err));
+
+ leave:
+  xfree (line);
+  if (err)
+    gpgtar_index_release_toc (toc);
+  else
+    *r_toc = toc;
+  return err;
+}
+
+
+/* Release a TOC object.  */
+void
+gpgtar_index_release_toc (gpgtar_toc_t toc)
+{
+  unsigned long n;
+
+  if (!toc)
+    return;
+  for (n=0; n < toc->nmembers; n++)
+    xfree (toc->members[n].hdr);
+  xfree (toc->members);
+  xfree (toc->segments);
+  xfree (toc);
+}
+
+
+/* Start decrypting segment SEGNO of the indexed archive FILENAME with
+ * TOC.  The plaintext tar members are read from the stream stored at
+ * R_STREAM, which is valid until gpgtar_index_close_segment is called
+ * with the object stored at R_SEG.  */
+gpg_error_t
+gpgtar_index_open_segment (const char *filename, gpgtar_toc_t toc,
+                           unsigned int segno, gpgtar_segment_t *r_seg,
+                           estream_t *r_stream)
+{
+  gpg_error_t err;
+
+  *r_stream = NULL;
+  if (segno >= toc->nsegments)
+    return gpg_error (GPG_ERR_INV_ARG);
+  if (opt.verbose)
+    log_info ("decrypting segment %u\n", segno);
+  err = open_range (filename, toc->segments[segno].offset,
+                    toc->segments[segno].length, r_seg);
+  if (!err)
+    *r_stream = (*r_seg)->from_gpg;
+  return err;
+}
+
+
+/* Finish reading the segment SEG.  If CANCEL is set the remaining
+ * data of the segment is not needed.  */
+gpg_error_t
+gpgtar_index_close_segment (gpgtar_segment_t seg, int cancel)
+{
+  return segment_release (seg, cancel, NULL);
+}
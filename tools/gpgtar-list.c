@@ -229,7 +229,8 @@ parse_extended_header (const char *fname,
       /* P points to the begin of the keyword and RECLEN is the
        * remaining length of the record excluding the LF.  */
       if (memchr (p, 0, reclen-1)
-          && (!strncmp (p, "path=", 5) || !strncmp (p, "linkpath=", 9)))
+          && (!strncmp (p, "path=", 5) || !strncmp (p, "linkpath=", 9)
+              || !strncmp (p, "GPGTAR.deleted=", 15)))
         {
           log_error ("%s: extended header record has an embedded nul"
                      " - ignoring\n", fname);
@@ -248,6 +249,13 @@ parse_extended_header (const char *fname,
             return gpg_error_from_syserror ();
           sl->flags = 2;  /* Mark as linkpath */
         }
+      else if (!strncmp (p, "GPGTAR.deleted=", 15))
+        {
+          sl = add_to_strlist_try (r_exthdr, p+15);
+          if (!sl)
+            return gpg_error_from_syserror ();
+          sl->flags = 3;  /* Mark as deleted path.  */
+        }
 
       buffer = p + reclen;
       buflen -= reclen;
@@ -398,6 +406,7 @@ print_header (tar_header_t header, strlist_t extheader, estream_t out)
   int i;
   strlist_t sl;
   const char *name, *linkname;
+  int deleted = 0;
 
   *modestr = '?';
   switch (header->typeflag)
@@ -436,14 +445,20 @@ print_header (tar_header_t header, strlist_t extheader, estream_t out)
         name = sl->d;
       else if (sl->flags == 2)
         linkname = sl->d;
+      else if (sl->flags == 3)
+        {
+          name = sl->d;
+          deleted = 1;
+        }
     }
 
-  es_fprintf (out, "%s %lu %lu/%lu %12llu %s %s%s%s\n",
+  es_fprintf (out, "%s %lu %lu/%lu %12llu %s %s%s%s%s\n",
               modestr, header->nlink, header->uid, header->gid, header->size,
               isotimestamp (header->mtime),
               name,
               linkname? " -> " : "",
-              linkname? linkname : "");
+              linkname? linkname : "",
+              deleted? " (deleted)" : "");
 }
 
 
@@ -463,6 +478,24 @@ gpgtar_list (const char *filename, int decrypt)
 
   memset (&tarinfo_buffer, 0, sizeof tarinfo_buffer);
 
+  /* An indexed archive is listed from its TOC alone.  */
+  if (decrypt && filename)
+    {
+      gpgtar_toc_t toc;
+      unsigned long n;
+
+      err = gpgtar_index_read (filename, &toc);
+      if (err)
+        return err;
+      if (toc)
+        {
+          for (n=0; n < toc->nmembers; n++)
+            print_header (toc->members[n].hdr, NULL, es_stdout);
+          gpgtar_index_release_toc (toc);
+          return 0;
+        }
+    }
+
   if (decrypt)
     {
       strlist_t arg;
@@ -534,6 +567,7 @@ gpgtar_list (const char *filename, int decrypt)
         goto leave;
       gpgrt_process_get_streams (proc, 0, NULL, &stream, NULL);
       es_set_binary (stream);
+      gpgtar_tune_pipe (stream);
     }
   else if (filename)  /* No decryption requested.  */
     {
@@ -0,0 +1,511 @@
+/* gpgtar-manifest.c - Manifest for incremental archives
+ * Copyright (C) 2025 Hasanur Rahevy
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The manifest describes the state of the files at the time of the
+ * last incremental run.  It is a list of lines
+ *
+ *   GPGTAR-MANIFEST 1
+ *   <typeflag> <size> <mtime> <dev> <ino> <sha256> <name>
+ *
+ * with all numbers in decimal, the SHA-256 of the content in hex or
+ * "-" for non-regular files, and NAME percent-plus escaped.  If the
+ * archive is encrypted the manifest is encrypted the same way;
+ * otherwise it is stored as plain text.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/i18n.h"
+#include <gpg-error.h>
+#include "../common/sysutils.h"
+#include "../common/ccparray.h"
+#include "../common/membuf.h"
+#include "gpgtar.h"
+
+
+/* The magic in the first line of a manifest.  */
+#define MANIFEST_MAGIC "GPGTAR-MANIFEST 1"
+
+/* The maximum length of a manifest line.  */
+#define MANIFEST_MAX_LINE 16384
+
+
+/* An entry of the old manifest.  */
+struct manifest_entry_s
+{
+  char *line;                /* The raw line for copying.  */
+  typeflag_t typeflag;
+  unsigned long long size;
+  unsigned long long mtime;
+  unsigned long long dev;
+  unsigned long long ino;
+  unsigned int seen:1;       /* Found in the current scan.  */
+  char name[1];
+};
+typedef struct manifest_entry_s *manifest_entry_t;
+
+
+struct gpgtar_manifest_s
+{
+  manifest_entry_t *entries; /* Old entries sorted by name.  */
+  size_t nentries;
+  manifest_entry_t last;     /* Result of the last lookup.  */
+  size_t nextdel;            /* Cursor for gpgtar_manifest_next_deleted.  */
+  membuf_t newlines;         /* The lines of the new manifest.  */
+};
+
+
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  const manifest_entry_t *ea = a;
+  const manifest_entry_t *eb = b;
+
+  return strcmp ((*ea)->name, (*eb)->name);
+}
+
+
+/* Parse the manifest LINE and return a new entry or NULL.  */
+static manifest_entry_t
+parse_line (char *line)
+{
+  const char *fields[8];
+  manifest_entry_t ent;
+  char *copy;
+  int typeflag;
+
+  copy = xtrystrdup (line);
+  if (!copy)
+    return NULL;
+  if (split_fields (line, fields, DIM (fields)) != 7)
+    {
+      xfree (copy);
+      gpg_err_set_errno (EINVAL);
+      return NULL;
+    }
+  typeflag = atoi (fields[0]);
+  if (typeflag < 0 || typeflag > TF_NOTSUP)
+    {
+      xfree (copy);
+      gpg_err_set_errno (EINVAL);
+      return NULL;
+    }
+
+  ent = xtrycalloc (1, sizeof *ent + strlen (fields[6]));
+  if (!ent)
+    {
+      xfree (copy);
+      return NULL;
+    }
+  ent->line = copy;
+  ent->typeflag = typeflag;
+  ent->size  = strtoull (fields[1], NULL, 10);
+  ent->mtime = strtoull (fields[2], NULL, 10);
+  ent->dev   = strtoull (fields[3], NULL, 10);
+  ent->ino   = strtoull (fields[4], NULL, 10);
+  strcpy (ent->name, fields[6]);
+  percent_plus_unescape_inplace (ent->name, 0);
+  return ent;
+}
+
+
+/* Read the lines of the manifest from FP into MF.  */
+static gpg_error_t
+read_manifest (gpgtar_manifest_t mf, estream_t fp, const char *fname)
+{
+  gpg_error_t err = 0;
+  char *line = NULL;
+  size_t linelen = 0;
+  size_t maxlen, nalloced = 0;
+  gpgrt_ssize_t len;
+  unsigned int lineno = 0;
+  manifest_entry_t ent;
+  void *p;
+
+  maxlen = MANIFEST_MAX_LINE;
+  while ((len = es_read_line (fp, &line, &linelen, &maxlen)) > 0)
+    {
+      lineno++;
+      if (!maxlen)
+        {
+          err = gpg_error (GPG_ERR_LINE_TOO_LONG);
+          break;
+        }
+      if (line[len-1] == '\n')
+        line[--len] = 0;
+      if (lineno == 1)
+        {
+          if (strcmp (line, MANIFEST_MAGIC))
+            {
+              err = gpg_error (GPG_ERR_INV_DATA);
+              break;
+            }
+          continue;
+        }
+
+      if (mf->nentries == nalloced)
+        {
+          nalloced += 1024;
+          p = xtryrealloc (mf->entries, nalloced * sizeof *mf->entries);
+          if (!p)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          mf->entries = p;
+        }
+      ent = parse_line (line);
+      if (!ent)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      mf->entries[mf->nentries++] = ent;
+    }
+  if (!err && len < 0)
+    err = gpg_error_from_syserror ();
+  else if (!err && !lineno)
+    err = gpg_error (GPG_ERR_NO_DATA);
+  if (err)
+    log_error ("error reading manifest '%s' (line %u): %s\n",
+               fname, lineno, gpg_strerror (err));
+  xfree (line);
+
+  if (!err && mf->nentries)
+    qsort (mf->entries, mf->nentries, sizeof *mf->entries, compare_entries);
+  return err;
+}
+
+
+/* Load the manifest FNAME.  If the file does not exist an empty
+ * manifest is returned so that the first run archives everything.
+ * An encrypted manifest is decrypted using gpg.  */
+gpg_error_t
+gpgtar_manifest_load (const char *fname, gpgtar_manifest_t *r_mf)
+{
+  gpg_error_t err;
+  gpgtar_manifest_t mf;
+  estream_t fp;
+  char buffer[sizeof MANIFEST_MAGIC];
+  size_t n;
+
+  *r_mf = NULL;
+  mf = xtrycalloc (1, sizeof *mf);
+  if (!mf)
+    return gpg_error_from_syserror ();
+  init_membuf (&mf->newlines, 4096);
+  put_membuf_str (&mf->newlines, MANIFEST_MAGIC "\n");
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        {
+          if (opt.verbose)
+            log_info ("manifest '%s' not found - archiving everything\n",
+                      fname);
+          *r_mf = mf;
+          return 0;
+        }
+      log_error ("error opening '%s': %s\n", fname, gpg_strerror (err));
+      gpgtar_manifest_release (mf);
+      return err;
+    }
+
+  n = es_fread (buffer, 1, sizeof buffer - 1, fp);
+  if (n == sizeof buffer - 1 && !memcmp (buffer, MANIFEST_MAGIC, n))
+    {
+      es_rewind (fp);
+      err = read_manifest (mf, fp, fname);
+      es_fclose (fp);
+    }
+  else
+    {
+      ccparray_t ccp;
+      strlist_t arg;
+      const char **argv;
+      gpgrt_process_t proc;
+      estream_t plain;
+      int exitcode;
+
+      es_fclose (fp);
+      ccparray_init (&ccp, 0);
+      if (opt.batch)
+        ccparray_put (&ccp, "--batch");
+      ccparray_put (&ccp, "--output");
+      ccparray_put (&ccp, "-");
+      ccparray_put (&ccp, "--decrypt");
+      for (arg = opt.gpg_arguments; arg; arg = arg->next)
+        ccparray_put (&ccp, arg->d);
+      ccparray_put (&ccp, "--");
+      ccparray_put (&ccp, fname);
+      ccparray_put (&ccp, NULL);
+      argv = ccparray_get (&ccp, NULL);
+      if (!argv)
+        {
+          err = gpg_error_from_syserror ();
+          gpgtar_manifest_release (mf);
+          return err;
+        }
+      err = gpgtar_spawn_gpg (argv, GPGRT_PROCESS_STDOUT_PIPE, &proc);
+      xfree (argv);
+      if (err)
+        {
+          log_error ("error running '%s': %s\n",
+                     opt.gpg_program, gpg_strerror (err));
+          gpgtar_manifest_release (mf);
+          return err;
+        }
+      gpgrt_process_get_streams (proc, 0, NULL, &plain, NULL);
+      err = read_manifest (mf, plain, fname);
+      if (err)
+        gpgrt_process_terminate (proc);
+      es_fclose (plain);
+      if (!gpgrt_process_wait (proc, 1) && !err)
+        {
+          gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
+          if (exitcode)
+            {
+              log_error ("decrypting manifest '%s' failed\n", fname);
+              err = gpg_error (GPG_ERR_GENERAL);
+            }
+        }
+      gpgrt_process_release (proc);
+    }
+
+  if (err)
+    gpgtar_manifest_release (mf);
+  else
+    *r_mf = mf;
+  return err;
+}
+
+
+/* Look up HDR in the old manifest and mark it as seen.  Returns true
+ * if the entry is unchanged, i.e. type, size, mtime, device and inode
+ * are the same.  */
+int
+gpgtar_manifest_check (gpgtar_manifest_t mf, tar_header_t hdr)
+{
+  manifest_entry_t ent;
+  size_t lo, hi, mid;
+  int cmp;
+
+  mf->last = NULL;
+  lo = 0;
+  hi = mf->nentries;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      cmp = strcmp (hdr->name, mf->entries[mid]->name);
+      if (!cmp)
+        {
+          mf->last = mf->entries[mid];
+          break;
+        }
+      if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  ent = mf->last;
+  if (!ent)
+    return 0;
+
+  ent->seen = 1;
+  return (ent->typeflag == hdr->typeflag
+          && ent->size == hdr->size
+          && ent->mtime == hdr->mtime
+          && ent->dev == hdr->dev
+          && ent->ino == hdr->ino);
+}
+
+
+/* Copy the entry found by the last gpgtar_manifest_check to the new
+ * manifest.  */
+void
+gpgtar_manifest_keep (gpgtar_manifest_t mf)
+{
+  if (mf->last)
+    {
+      put_membuf_str (&mf->newlines, mf->last->line);
+      put_membuf (&mf->newlines, "\n", 1);
+    }
+}
+
+
+/* Add HDR with the SHA-256 content hash HASH (or NULL) to the new
+ * manifest.  */
+void
+gpgtar_manifest_add (gpgtar_manifest_t mf, tar_header_t hdr,
+                     const unsigned char *hash)
+{
+  char hexhash[2*32+1];
+  char *name;
+
+  name = percent_plus_escape (hdr->name);
+  if (!name)
+    {
+      set_membuf_err (&mf->newlines, gpg_error_from_syserror ());
+      return;
+    }
+  if (hash)
+    bin2hex (hash, 32, hexhash);
+  else
+    strcpy (hexhash, "-");
+  put_membuf_printf (&mf->newlines, "%d %llu %llu %llu %llu %s %s\n",
+                     (int)hdr->typeflag, hdr->size, hdr->mtime,
+                     hdr->dev, hdr->ino, hexhash, name);
+  xfree (name);
+}
+
+
+/* Return the next entry of the old manifest which has not been seen
+ * in the current scan, or NULL if there are no more.  The entries
+ * are returned in reverse order so that files are listed before the
+ * directories containing them.  */
+const char *
+gpgtar_manifest_next_deleted (gpgtar_manifest_t mf)
+{
+  manifest_entry_t ent;
+
+  if (!mf->nextdel)
+    mf->nextdel = mf->nentries + 1;
+  while (mf->nextdel > 1)
+    {
+      ent = mf->entries[--mf->nextdel - 1];
+      if (!ent->seen)
+        return ent->name;
+    }
+  return NULL;
+}
+
+
+/* Write the new manifest to FNAME.  If ARGV is not NULL, gpg is run
+ * with these arguments and the output going to a temporary file to
+ * encrypt it.  The old manifest is replaced only on success.  */
+gpg_error_t
+gpgtar_manifest_save (gpgtar_manifest_t mf, const char *fname,
+                      const char **argv, const char *tmpfname)
+{
+  gpg_error_t err;
+  void *buf;
+  size_t len;
+  estream_t fp;
+  gpgrt_process_t proc = NULL;
+  int exitcode;
+
+  buf = get_membuf (&mf->newlines, &len);
+  if (!buf)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error building manifest: %s\n", gpg_strerror (err));
+      return err;
+    }
+
+  gnupg_remove (tmpfname);
+  if (argv)
+    {
+      err = gpgtar_spawn_gpg (argv, (GPGRT_PROCESS_STDIN_PIPE
+                                     | GPGRT_PROCESS_STDOUT_KEEP
+                                     | GPGRT_PROCESS_STDERR_KEEP), &proc);
+      if (err)
+        {
+          log_error ("error running '%s': %s\n",
+                     opt.gpg_program, gpg_strerror (err));
+          goto leave;
+        }
+      gpgrt_process_get_streams (proc, 0, &fp, NULL, NULL);
+    }
+  else
+    {
+      fp = es_fopen (tmpfname, "wb");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error creating '%s': %s\n", tmpfname, gpg_strerror (err));
+          goto leave;
+        }
+    }
+
+  if (es_fwrite (buf, 1, len, fp) != len)
+    err = gpg_error_from_syserror ();
+  else
+    err = 0;
+  if (es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (proc)
+    {
+      if (!gpgrt_process_wait (proc, 1))
+        {
+          gpgrt_process_ctl (proc, GPGRT_PROCESS_GET_EXIT_ID, &exitcode);
+          if (exitcode && !err)
+            {
+              log_error ("running %s failed (exitcode=%d)\n",
+                         opt.gpg_program, exitcode);
+              err = gpg_error (GPG_ERR_GENERAL);
+            }
+        }
+      gpgrt_process_release (proc);
+    }
+  if (err)
+    {
+      log_error ("error writing '%s': %s\n", tmpfname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    {
+      log_error ("error renaming '%s' to '%s': %s\n",
+                 tmpfname, fname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+    }
+
+ leave:
+  xfree (buf);
+  return err;
+}
+
+
+/* Release the manifest object MF.  */
+void
+gpgtar_manifest_release (gpgtar_manifest_t mf)
+{
+  size_t n;
+
+  if (!mf)
+    return;
+  for (n=0; n < mf->nentries; n++)
+    {
+      xfree (mf->entries[n]->line);
+      xfree (mf->entries[n]);
+    }
+  xfree (mf->entries);
+  xfree (get_membuf (&mf->newlines, NULL));
+  xfree (mf);
+}
@@ -34,6 +34,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <npth.h>
 
 #define INCLUDED_BY_MAIN_MODULE 1
 #include "../common/util.h"
@@ -84,6 +89,9 @@ enum cmd_and_opt_values
     oStatusFD,
     oRequireCompliance,
     oWithLog,
+    oThreads,
+    oIndexed,
+    oListedIncremental,
 
     /* Compatibility with gpg-zip.  */
     oGpgArgs,
@@ -130,6 +138,9 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oStatusFD, "status-fd", "@"),
   ARGPARSE_s_n (oRequireCompliance, "require-compliance", "@"),
   ARGPARSE_s_n (oWithLog, "with-log", "@"),
+  ARGPARSE_s_i (oThreads, "threads", "@"),
+  ARGPARSE_s_n (oIndexed, "indexed", "@"),
+  ARGPARSE_s_s (oListedIncremental, "listed-incremental", "@"),
 
   ARGPARSE_group (302, N_("@\nTar options:\n ")),
 
@@ -401,6 +412,15 @@ parse_arguments (gpgrt_argparse_t *pargs, gpgrt_opt_t *popts)
         case oStatusFD: opt.status_fd = pargs->r.ret_str; break;
         case oRequireCompliance: opt.require_compliance = 1; break;
         case oWithLog: opt.with_log = 1; break;
+        case oThreads:
+          opt.threads = pargs->r.ret_int;
+          if (opt.threads < 0)
+            opt.threads = 0;
+          else if (opt.threads > GPGTAR_MAX_THREADS)
+            opt.threads = GPGTAR_MAX_THREADS;
+          break;
+        case oIndexed: opt.indexed = 1; break;
+        case oListedIncremental: opt.manifest = pargs->r.ret_str; break;
 
         case oGpgArgs:;
           {
@@ -475,12 +495,15 @@ main (int argc, char **argv)
   /* Make sure that our subsystems are ready.  */
   i18n_init();
   init_common_subsystems (&argc, &argv);
+  npth_init ();
+  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
   gnupg_init_signals (0, NULL);
 
   log_assert (sizeof (struct ustar_raw_header) == 512);
 
   /* Set default options */
   opt.status_fd = NULL;
+  opt.threads = GPGTAR_DEFAULT_THREADS;
 
   /* The configuration directories for use by gpgrt_argparser.  */
   gpgrt_set_confdir (GPGRT_CONFDIR_SYS, gnupg_sysconfdir ());
@@ -554,7 +577,8 @@ main (int argc, char **argv)
     {
     case aDecrypt:
     case aList:
-      if (argc > 1)
+      /* Members to extract may only be given for indexed archives.  */
+      if (argc > 1 && (cmd == aList || !strcmp (*argv, "-")))
         gpgrt_usage (1);
       fname = (argc && strcmp (*argv, "-"))? *argv : NULL;
       if (opt.filename)
@@ -563,7 +587,8 @@ main (int argc, char **argv)
         log_info ("note: ignoring option --files-from\n");
       if (cmd == aDecrypt)
         {
-          err = gpgtar_extract (fname, !skip_crypto);
+          err = gpgtar_extract (fname, !skip_crypto,
+                                argc > 1? argv + 1 : NULL);
           if (err && !log_get_errorcount (0))
             log_error ("extracting archive failed: %s\n", gpg_strerror (err));
         }
@@ -583,6 +608,11 @@ main (int argc, char **argv)
         gpgrt_usage (1);
       if (opt.filename)
         log_info ("note: ignoring option --set-filename\n");
+      if (opt.indexed && skip_crypto)
+        {
+          log_error ("option --indexed requires encryption or signing\n");
+          break;
+        }
       err = gpgtar_create (files_from? NULL : argv,
                            files_from,
                            null_names,
@@ -664,6 +694,141 @@ write_record (estream_t stream, const void *record)
 }
 
 
+/* Spawn gpg with ARGV and FLAGS and store the process at R_PROC.  The
+ * status fd, if any, is inherited by gpg.  */
+gpg_error_t
+gpgtar_spawn_gpg (const char **argv, unsigned int flags,
+                  gpgrt_process_t *r_proc)
+{
+  gpg_error_t err;
+#ifdef HAVE_W32_SYSTEM
+  HANDLE except[2] = { INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE };
+#else
+  int except[2] = { -1, -1 };
+#endif
+  gpgrt_spawn_actions_t act = NULL;
+
+  if (opt.status_fd)
+    {
+      es_syshd_t hd;
+
+      es_syshd (opt.status_stream, &hd);
+#ifdef HAVE_W32_SYSTEM
+      except[0] = hd.u.handle;
+#else
+      except[0] = hd.u.fd;
+#endif
+    }
+
+  err = gpgrt_spawn_actions_new (&act);
+  if (err)
+    return err;
+#ifdef HAVE_W32_SYSTEM
+  gpgrt_spawn_actions_set_inherit_handles (act, except);
+#else
+  gpgrt_spawn_actions_set_inherit_fds (act, except);
+#endif
+  err = gpgrt_process_spawn (opt.gpg_program, argv, flags, act, r_proc);
+  gpgrt_spawn_actions_release (act);
+  return err;
+}
+
+
+/* Tune the pipe STREAM to or from gpg so that fewer syscalls and
+ * context switches are needed: The stream gets a buffer of
+ * GPGTAR_STREAM_BUFSIZE and the kernel pipe is enlarged to
+ * GPGTAR_PIPE_SIZE.  Must be called before STREAM is used.  Errors
+ * are ignored because this is only an optimization.  */
+void
+gpgtar_tune_pipe (estream_t stream)
+{
+#ifdef F_SETPIPE_SZ
+  int fd = es_fileno (stream);
+
+  if (fd != -1)
+    fcntl (fd, F_SETPIPE_SZ, GPGTAR_PIPE_SIZE);
+#endif
+  es_setvbuf (stream, NULL, _IOFBF, GPGTAR_STREAM_BUFSIZE);
+}
+
+
+/* Copy LENGTH bytes from the file descriptor INFD to OUTFD without
+ * going through a user space buffer and store the number of copied
+ * bytes at R_COPIED.  splice is used if one of the descriptors is a
+ * pipe and copy_file_range otherwise.  GPG_ERR_NOT_SUPPORTED is
+ * returned if this is not possible for these descriptors and nothing
+ * has been copied; the caller should then fall back to regular reads
+ * and writes.  GPG_ERR_EOF is returned if INFD hits EOF early.  */
+gpg_error_t
+gpgtar_copy_fd (int infd, int outfd, unsigned long long length,
+                unsigned long long *r_copied)
+{
+#if defined(HAVE_SPLICE) || defined(HAVE_COPY_FILE_RANGE)
+  struct stat st;
+  int use_splice = 0;
+  size_t chunk;
+  ssize_t n;
+  int saved_errno;
+
+  *r_copied = 0;
+  if (infd == -1 || outfd == -1)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if ((!fstat (infd, &st) && S_ISFIFO (st.st_mode))
+      || (!fstat (outfd, &st) && S_ISFIFO (st.st_mode)))
+    use_splice = 1;
+#ifndef HAVE_SPLICE
+  if (use_splice)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+#ifndef HAVE_COPY_FILE_RANGE
+  if (!use_splice)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+
+  while (*r_copied < length)
+    {
+      chunk = (length - *r_copied > 0x40000000)? 0x40000000
+        /**/                                 : (size_t)(length - *r_copied);
+      npth_unprotect ();
+#ifdef HAVE_SPLICE
+      if (use_splice)
+        n = splice (infd, NULL, outfd, NULL, chunk, SPLICE_F_MORE);
+      else
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+        n = copy_file_range (infd, NULL, outfd, NULL, chunk, 0);
+#else
+        n = -1;
+#endif
+      saved_errno = errno;
+      npth_protect ();
+      if (n < 0)
+        {
+          if (saved_errno == EINTR || saved_errno == EAGAIN)
+            continue;
+          if (!*r_copied
+              && (saved_errno == EINVAL || saved_errno == ENOSYS
+                  || saved_errno == EXDEV || saved_errno == EBADF
+                  || saved_errno == EOPNOTSUPP))
+            return gpg_error (GPG_ERR_NOT_SUPPORTED);
+          return gpg_error_from_errno (saved_errno);
+        }
+      if (!n)
+        return gpg_error (GPG_ERR_EOF);
+      *r_copied += n;
+    }
+  return 0;
+
+#else /*!HAVE_SPLICE && !HAVE_COPY_FILE_RANGE*/
+  (void)infd;
+  (void)outfd;
+  (void)length;
+  *r_copied = 0;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
 /* Return true if FP is an unarmored OpenPGP message.  Note that this
    function reads a few bytes from FP but pushes them back.  */
 #if 0
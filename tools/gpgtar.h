@@ -24,6 +24,24 @@
 #include "../common/strlist.h"
 
 
+/* The default and maximum number of threads used by --create to
+ * stat and read files in advance and by --extract to write files.  */
+#define GPGTAR_DEFAULT_THREADS 4
+#define GPGTAR_MAX_THREADS    32
+
+/* The plaintext size after which a new segment of an indexed archive
+ * is started.  */
+#define GPGTAR_SEGMENT_SIZE   (64*1024*1024)
+
+/* The size we request for the pipes to and from gpg and the size of
+ * the stream buffers used for them.  */
+#define GPGTAR_PIPE_SIZE      (1024*1024)
+#define GPGTAR_STREAM_BUFSIZE (256*1024)
+
+/* Files of at least this size are copied with splice or
+ * copy_file_range if possible.  */
+#define GPGTAR_ZEROCOPY_MIN_SIZE (64*1024)
+
 /* We keep all global options in the structure OPT.  */
 EXTERN_UNLESS_MAIN_MODULE
 struct
@@ -49,6 +67,9 @@ struct
   estream_t status_stream;
   int require_compliance;
   int with_log;
+  int threads;  /* Number of threads used to read or write files.  */
+  int indexed;  /* Create an indexed archive.  */
+  const char *manifest;  /* Manifest file for incremental archives.  */
 } opt;
 
 
@@ -135,6 +156,8 @@ struct tar_header_s
                                times beyond 2106.  */
   typeflag_t typeflag;      /* The type of the file.  */
 
+  unsigned long long dev;   /* Device and inode number; used to detect  */
+  unsigned long long ino;   /* changed files for incremental archives.  */
 
   unsigned long long nrecords; /* Number of data records.  */
 
@@ -142,16 +165,49 @@ struct tar_header_s
 };
 
 
+/* The table of contents of an indexed archive.  */
+struct gpgtar_toc_segment_s
+{
+  unsigned long long offset;  /* Offset of the segment in the archive.  */
+  unsigned long long length;  /* Length of the encrypted segment.  */
+};
+
+struct gpgtar_toc_member_s
+{
+  unsigned int segno;         /* Segment holding the member.  */
+  tar_header_t hdr;           /* Header info; NRECORDS is not set.  */
+};
+
+struct gpgtar_toc_s
+{
+  unsigned int nsegments;
+  struct gpgtar_toc_segment_s *segments;
+  unsigned long nmembers;
+  struct gpgtar_toc_member_s *members;
+};
+typedef struct gpgtar_toc_s *gpgtar_toc_t;
+
+typedef struct gpgtar_index_s *gpgtar_index_t;
+typedef struct gpgtar_manifest_s *gpgtar_manifest_t;
+typedef struct gpgtar_segment_s *gpgtar_segment_t;
+
+
 /*-- gpgtar.c --*/
 gpg_error_t read_record (estream_t stream, void *record);
 gpg_error_t write_record (estream_t stream, const void *record);
+gpg_error_t gpgtar_spawn_gpg (const char **argv, unsigned int flags,
+                              gpgrt_process_t *r_proc);
+void gpgtar_tune_pipe (estream_t stream);
+gpg_error_t gpgtar_copy_fd (int infd, int outfd, unsigned long long length,
+                            unsigned long long *r_copied);
 
 /*-- gpgtar-create.c --*/
 gpg_error_t gpgtar_create (char **inpattern, const char *files_from,
                            int null_names, int encrypt, int sign);
 
 /*-- gpgtar-extract.c --*/
-gpg_error_t gpgtar_extract (const char *filename, int decrypt);
+gpg_error_t gpgtar_extract (const char *filename, int decrypt,
+                            char **members);
 
 /*-- gpgtar-list.c --*/
 gpg_error_t gpgtar_list (const char *filename, int decrypt);
@@ -160,5 +216,32 @@ gpg_error_t gpgtar_read_header (estream_t stream, tarinfo_t info,
 void gpgtar_print_header (tar_header_t header, strlist_t extheader,
                           estream_t out);
 
+/*-- gpgtar-index.c --*/
+gpg_error_t gpgtar_index_new (gpgtar_index_t *r_idx, const char **argv,
+                              estream_t archive);
+gpg_error_t gpgtar_index_begin_member (gpgtar_index_t idx,
+                                       estream_t *r_stream);
+gpg_error_t gpgtar_index_end_member (gpgtar_index_t idx, tar_header_t hdr);
+gpg_error_t gpgtar_index_finish (gpgtar_index_t idx);
+void gpgtar_index_release (gpgtar_index_t idx);
+gpg_error_t gpgtar_index_read (const char *filename, gpgtar_toc_t *r_toc);
+void gpgtar_index_release_toc (gpgtar_toc_t toc);
+gpg_error_t gpgtar_index_open_segment (const char *filename,
+                                       gpgtar_toc_t toc, unsigned int segno,
+                                       gpgtar_segment_t *r_seg,
+                                       estream_t *r_stream);
+gpg_error_t gpgtar_index_close_segment (gpgtar_segment_t seg, int cancel);
+
+/*-- gpgtar-manifest.c --*/
+gpg_error_t gpgtar_manifest_load (const char *fname, gpgtar_manifest_t *r_mf);
+int gpgtar_manifest_check (gpgtar_manifest_t mf, tar_header_t hdr);
+void gpgtar_manifest_keep (gpgtar_manifest_t mf);
+void gpgtar_manifest_add (gpgtar_manifest_t mf, tar_header_t hdr,
+                          const unsigned char *hash);
+const char *gpgtar_manifest_next_deleted (gpgtar_manifest_t mf);
+gpg_error_t gpgtar_manifest_save (gpgtar_manifest_t mf, const char *fname,
+                                  const char **argv, const char *tmpfname);
+void gpgtar_manifest_release (gpgtar_manifest_t mf);
+
 
 #endif /*GPGTAR_H*/
@@ -31,6 +31,8 @@
 #include "../common/userids.h"
 #include "../common/mbox-util.h"
 #include "../common/sysutils.h"
+#include "../common/membuf.h"
+#include "../common/host2net.h"
 #include "mime-maker.h"
 #include "send-mail.h"
 #include "gpg-wks.h"
@@ -1223,12 +1225,15 @@ install_key_from_spec_file (const char *fname)
 }
 
 
-/* The core of the code to install a key as a file.  */
+/* The core of the code to install a key as a file.  The key is
+ * first written to a temporary file which is then renamed so that a
+ * web server never sees a partly written key.  */
 gpg_error_t
 wks_install_key_core (estream_t key, const char *addrspec)
 {
   gpg_error_t err;
   char *huname = NULL;
+  char *tmpname = NULL;
 
   /* Hash user ID and create filename.  */
   err = wks_compute_hu_fname (&huname, addrspec);
@@ -1241,8 +1246,15 @@ wks_install_key_core (estream_t key, const char *addrspec)
   if (err)
     goto leave;
 
+  tmpname = xtryasprintf ("%s.tmp%u", huname, (unsigned int)getpid ());
+  if (!tmpname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
   /* Publish.  */
-  err = wks_write_to_file (key, huname);
+  err = wks_write_to_file (key, tmpname);
   if (err)
     {
       log_error ("copying key to '%s' failed: %s\n", huname,gpg_strerror (err));
@@ -1250,11 +1262,21 @@ wks_install_key_core (estream_t key, const char *addrspec)
     }
 
   /* Make sure it is world readable.  */
-  if (gnupg_chmod (huname, "-rw-r--r--"))
+  if (gnupg_chmod (tmpname, "-rw-r--r--"))
     log_error ("can't set permissions of '%s': %s\n",
                huname, gpg_strerror (gpg_err_code_from_syserror()));
 
+  err = gnupg_rename_file (tmpname, huname, NULL);
+  if (err)
+    {
+      log_error ("renaming '%s' to '%s' failed: %s\n",
+                 tmpname, huname, gpg_strerror (err));
+      gnupg_remove (tmpname);
+      goto leave;
+    }
+
  leave:
+  xfree (tmpname);
   xfree (huname);
   return err;
 }
@@ -1403,6 +1425,936 @@ wks_cmd_install_key (const char *fname, const char *userid)
 }
 
 
+/* Batch installation of keys.
+ *
+ * Installing a single key requires two or three runs of gpg.  For a
+ * large number of keys the batch mode processes the key files of a
+ * directory in chunks.  Each chunk needs one run to convert all keys
+ * to binary keyblocks, one run to list them and a few runs to filter
+ * the user ids of many keys at once.  */
+
+/* The number of key files processed in one chunk.  */
+#define BATCH_CHUNK_FILES 512
+
+/* The maximum number of keys filtered by one run of gpg.  */
+#define BATCH_MAX_FILTER  256
+
+/* A key of a chunk.  */
+struct batch_key_s
+{
+  const unsigned char *blob; /* The binary keyblock.  */
+  size_t bloblen;            /* Its length.  */
+  char *fpr;                 /* The fingerprint or NULL.  */
+  uidinfo_list_t uids;       /* Its user ids.  */
+};
+typedef struct batch_key_s *batch_key_t;
+
+/* A user id to be published.  */
+struct batch_job_s
+{
+  batch_key_t key;           /* The key of the user id.  */
+  const char *uid;           /* The user id (points into KEY->UIDS).  */
+  const char *mbox;          /* Its mailbox (points into KEY->UIDS).  */
+  int single;                /* Filter this one separately.  */
+  void *result;              /* The filtered keyblock or NULL.  */
+  size_t resultlen;          /* Its length.  */
+};
+typedef struct batch_job_s *batch_job_t;
+
+/* Counters for the summary.  */
+struct batch_stats_s
+{
+  unsigned int published;
+  unsigned int failed;
+};
+
+
+/* Run gpg with the standard options and the NULL terminated list of
+ * ARGS on INPUT and append its output to OUTPUT.  FUNC is used for
+ * debug output.  */
+static gpg_error_t
+batch_run_gpg (const char *func, estream_t input, estream_t output,
+               const char **args)
+{
+  gpg_error_t err;
+  ccparray_t ccp;
+  const char **argv;
+  int i;
+
+  ccparray_init (&ccp, 0);
+
+  ccparray_put (&ccp, "--no-options");
+  if (opt.verbose < 2)
+    ccparray_put (&ccp, "--quiet");
+  else
+    ccparray_put (&ccp, "--verbose");
+  ccparray_put (&ccp, "--batch");
+  ccparray_put (&ccp, "--status-fd=2");
+  ccparray_put (&ccp, "--always-trust");
+  for (i=0; args[i]; i++)
+    ccparray_put (&ccp, args[i]);
+
+  ccparray_put (&ccp, NULL);
+  argv = ccparray_get (&ccp, NULL);
+  if (!argv)
+    return gpg_error_from_syserror ();
+  debug_gpg_invocation (func, argv);
+  err = gnupg_exec_tool_stream (opt.gpg_program, argv, input,
+                                NULL, output,
+                                key_status_cb, NULL);
+  xfree (argv);
+  return err;
+}
+
+
+/* Return the length of the OpenPGP packet at BUF which has LEN bytes
+ * and store its tag at R_TAG.  Returns 0 for an invalid packet.  */
+static size_t
+batch_packet_length (const unsigned char *buf, size_t len, int *r_tag)
+{
+  size_t hdrlen, pktlen;
+  size_t i;
+
+  if (len < 2 || !(buf[0] & 0x80))
+    return 0;
+
+  if ((buf[0] & 0x40))  /* New format.  */
+    {
+      *r_tag = (buf[0] & 0x3f);
+      if (buf[1] < 192)
+        {
+          hdrlen = 2;
+          pktlen = buf[1];
+        }
+      else if (buf[1] < 224)
+        {
+          if (len < 3)
+            return 0;
+          hdrlen = 3;
+          pktlen = ((buf[1] - 192) << 8) + buf[2] + 192;
+        }
+      else if (buf[1] == 255)
+        {
+          if (len < 6)
+            return 0;
+          hdrlen = 6;
+          pktlen = buf32_to_size_t (buf+2);
+        }
+      else
+        return 0;  /* Partial lengths are not used for keyblocks.  */
+    }
+  else  /* Old format.  */
+    {
+      *r_tag = ((buf[0] >> 2) & 0x0f);
+      switch ((buf[0] & 3))
+        {
+        case 0: hdrlen = 2; break;
+        case 1: hdrlen = 3; break;
+        case 2: hdrlen = 5; break;
+        default: return 0;  /* Indeterminate length.  */
+        }
+      if (len < hdrlen)
+        return 0;
+      for (pktlen = 0, i = 1; i < hdrlen; i++)
+        pktlen = (pktlen << 8) | buf[i];
+    }
+
+  if (pktlen > len - hdrlen)
+    return 0;
+  return hdrlen + pktlen;
+}
+
+
+/* Split the binary keyblocks in BUFFER of length BUFLEN into the
+ * array of keys stored at R_KEYS.  The keys point into BUFFER.  */
+static gpg_error_t
+batch_split_keyblocks (const unsigned char *buffer, size_t buflen,
+                       batch_key_t *r_keys, size_t *r_nkeys)
+{
+  batch_key_t keys = NULL;
+  size_t nkeys = 0;
+  size_t allocated = 0;
+  size_t off, n;
+  int tag;
+
+  *r_keys = NULL;
+  *r_nkeys = 0;
+
+  for (off = 0; off < buflen; off += n)
+    {
+      n = batch_packet_length (buffer + off, buflen - off, &tag);
+      if (!n)
+        {
+          log_error ("invalid packet in gpg output at offset %zu\n", off);
+          xfree (keys);
+          return gpg_error (GPG_ERR_INV_PACKET);
+        }
+      if (tag == 6)  /* A public key starts a new keyblock.  */
+        {
+          if (nkeys == allocated)
+            {
+              batch_key_t tmp;
+
+              allocated += 64;
+              tmp = xtryreallocarray (keys, nkeys, allocated, sizeof *keys);
+              if (!tmp)
+                {
+                  gpg_error_t err = gpg_error_from_syserror ();
+                  xfree (keys);
+                  return err;
+                }
+              keys = tmp;
+            }
+          memset (keys + nkeys, 0, sizeof *keys);
+          keys[nkeys].blob = buffer + off;
+          nkeys++;
+        }
+      else if (!nkeys)
+        {
+          log_error ("gpg output does not start with a public key\n");
+          return gpg_error (GPG_ERR_INV_PACKET);
+        }
+      keys[nkeys-1].bloblen += n;
+    }
+
+  *r_keys = keys;
+  *r_nkeys = nkeys;
+  return 0;
+}
+
+
+/* Run gpg to list the NKEYS keys at KEYS which are stored
+ * consecutively in BUFFER of BUFLEN bytes and set their fingerprint
+ * and user ids.  */
+static gpg_error_t
+batch_list_keys (batch_key_t keys, size_t nkeys,
+                 const void *buffer, size_t buflen)
+{
+  static const char *args[] =
+    { "--with-colons", "--dry-run",
+      "--import-options=import-minimal,import-show", "--import", NULL };
+  gpg_error_t err;
+  estream_t input, listing;
+  char *line = NULL;
+  size_t length_of_line = 0;
+  size_t maxlen;
+  ssize_t len;
+  char **fields = NULL;
+  int nfields;
+  batch_key_t key = NULL;
+  size_t idx = 0;
+  int in_subkey = 0;
+  int expired = 0;
+  int revoked = 0;
+
+  input = es_fopenmem_init (0, "rb", buffer, buflen);
+  listing = es_fopenmem (0, "w+b");
+  if (!input || !listing)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error allocating memory buffer: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  err = batch_run_gpg (__func__, input, listing, args);
+  if (err)
+    {
+      log_error ("import failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  es_rewind (listing);
+  maxlen = 2048; /* Set limit.  */
+  while ((len = es_read_line (listing, &line, &length_of_line, &maxlen)) > 0)
+    {
+      if (!maxlen)
+        {
+          log_error ("received line too long\n");
+          err = gpg_error (GPG_ERR_LINE_TOO_LONG);
+          goto leave;
+        }
+      while (len > 0
+	     && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+	line[--len] = '\0';
+
+      xfree (fields);
+      fields = strtokenize_nt (line, ":");
+      if (!fields)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("strtokenize failed: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+      for (nfields = 0; fields[nfields]; nfields++)
+        ;
+      if (!nfields)
+        {
+          err = gpg_error (GPG_ERR_INV_ENGINE);
+          goto leave;
+        }
+
+      if (!strcmp (fields[0], "pub") || !strcmp (fields[0], "sec"))
+        {
+          if (idx >= nkeys)
+            {
+              err = gpg_error (GPG_ERR_TOO_MANY);
+              goto leave;
+            }
+          key = keys + idx++;
+          in_subkey = 0;
+          if (nfields > 1)
+            set_expired_revoked (fields[1], &expired, &revoked);
+          else
+            expired = revoked = 0;
+        }
+      else if (!key)
+        {
+          /* First record is not a public key.  */
+          err = gpg_error (GPG_ERR_INV_ENGINE);
+          goto leave;
+        }
+      else if (!strcmp (fields[0], "sub") || !strcmp (fields[0], "ssb"))
+        in_subkey = 1;
+      else if (in_subkey)
+        ;
+      else if (!strcmp (fields[0], "fpr") && nfields > 9 && !key->fpr)
+        {
+          key->fpr = xtrystrdup (fields[9]);
+          if (!key->fpr)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+        }
+      else if (!strcmp (fields[0], "uid") && nfields > 9)
+        {
+          int uidexpired, uidrevoked;
+
+          set_expired_revoked (fields[1], &uidexpired, &uidrevoked);
+          if (!append_to_uidinfo_list (&key->uids, fields[9],
+                                       parse_timestamp (fields[5], NULL),
+                                       expired || uidexpired,
+                                       revoked || uidrevoked))
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+        }
+    }
+  if (len < 0 || es_ferror (listing))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error reading memory stream\n");
+      goto leave;
+    }
+  if (idx != nkeys)
+    {
+      log_error ("gpg listed %zu of %zu keys\n", idx, nkeys);
+      err = gpg_error (GPG_ERR_INV_ENGINE);
+      goto leave;
+    }
+
+ leave:
+  xfree (fields);
+  es_free (line);
+  es_fclose (listing);
+  es_fclose (input);
+  return err;
+}
+
+
+/* Return true if a directory for the domain of MBOX exists.  */
+static int
+batch_domain_served (const char *mbox)
+{
+  const char *domain;
+  char *fname;
+  struct stat sb;
+  int yes;
+
+  domain = strchr (mbox, '@');
+  if (!domain || !domain[1] || domain == mbox)
+    return 0;
+  domain++;
+  if (strchr (domain, '/') || strchr (domain, '\\'))
+    return 0;
+
+  fname = make_filename_try (opt.directory, domain, NULL);
+  yes = fname && !gnupg_stat (fname, &sb) && S_ISDIR (sb.st_mode);
+  xfree (fname);
+  return yes;
+}
+
+
+/* Create the list of user ids to be published for the NKEYS keys at
+ * KEYS.  For each mailbox of a served domain the newest not expired
+ * user id is used.  */
+static gpg_error_t
+batch_select_uids (batch_key_t keys, size_t nkeys,
+                   batch_job_t *r_jobs, size_t *r_njobs)
+{
+  batch_job_t jobs = NULL;
+  size_t njobs = 0;
+  size_t allocated = 0;
+  size_t i;
+  uidinfo_list_t uid, uid2, thisuid;
+
+  *r_jobs = NULL;
+  *r_njobs = 0;
+
+  for (i=0; i < nkeys; i++)
+    {
+      if (!keys[i].fpr)
+        continue;
+      for (uid = keys[i].uids; uid; uid = uid->next)
+        {
+          if (!uid->mbox)
+            continue;
+          for (uid2 = keys[i].uids; uid2 != uid; uid2 = uid2->next)
+            if (uid2->mbox && !ascii_strcasecmp (uid2->mbox, uid->mbox))
+              break;
+          if (uid2 != uid)
+            continue;  /* Mailbox already handled.  */
+          if (!batch_domain_served (uid->mbox))
+            {
+              if (opt.verbose)
+                log_info ("key %s: domain of '%s' not served\n",
+                          keys[i].fpr, uid->mbox);
+              continue;
+            }
+
+          thisuid = NULL;
+          for (uid2 = uid; uid2; uid2 = uid2->next)
+            {
+              if (!uid2->mbox || ascii_strcasecmp (uid2->mbox, uid->mbox))
+                continue;
+              if (uid2->expired)
+                {
+                  if (opt.verbose)
+                    log_info ("ignoring expired user id '%s'\n", uid2->uid);
+                  continue;
+                }
+              if (!thisuid || uid2->created > thisuid->created)
+                thisuid = uid2;
+            }
+          if (!thisuid)
+            continue;
+
+          if (njobs == allocated)
+            {
+              batch_job_t tmp;
+
+              allocated += 64;
+              tmp = xtryreallocarray (jobs, njobs, allocated, sizeof *jobs);
+              if (!tmp)
+                {
+                  gpg_error_t err = gpg_error_from_syserror ();
+                  xfree (jobs);
+                  return err;
+                }
+              jobs = tmp;
+            }
+          memset (jobs + njobs, 0, sizeof *jobs);
+          jobs[njobs].key = keys + i;
+          jobs[njobs].uid = thisuid->uid;
+          jobs[njobs].mbox = thisuid->mbox;
+          /* User ids which can't be expressed in a filter or which
+           * would also match another user id of the key are
+           * filtered separately.  */
+          if (strstr (thisuid->uid, "&&") || strstr (thisuid->uid, "||")
+              || spacep (thisuid->uid) || !*thisuid->uid
+              || spacep (thisuid->uid + strlen (thisuid->uid) - 1))
+            jobs[njobs].single = 1;
+          njobs++;
+        }
+    }
+
+  *r_jobs = jobs;
+  *r_njobs = njobs;
+  return 0;
+}
+
+
+/* Return true if any user id of KEY other than UID matches one of
+ * the N user ids of the jobs at JOBS.  */
+static int
+batch_uid_conflict (batch_key_t key, const char *uid, batch_job_t *jobs,
+                    size_t n)
+{
+  uidinfo_list_t u;
+  size_t i;
+
+  for (u = key->uids; u; u = u->next)
+    {
+      if (!strcmp (u->uid, uid))
+        continue;
+      for (i=0; i < n; i++)
+        if (!ascii_strcasecmp (u->uid, jobs[i]->uid))
+          return 1;
+    }
+  return 0;
+}
+
+
+/* Filter the N jobs at ROUND with one run of gpg.  Each key may
+ * appear only once in ROUND.  */
+static gpg_error_t
+batch_filter_round (batch_job_t *round, size_t n)
+{
+  gpg_error_t err;
+  membuf_t mb;
+  char *filterexp = NULL;
+  estream_t input = NULL;
+  estream_t output = NULL;
+  void *buffer = NULL;
+  size_t buflen;
+  batch_key_t keys = NULL;
+  size_t nkeys;
+  const char *args[5];
+  size_t i;
+
+  init_membuf (&mb, 4096);
+  put_membuf_str (&mb, "keep-uid=");
+  for (i=0; i < n; i++)
+    {
+      if (i)
+        put_membuf_str (&mb, " || ");
+      put_membuf_str (&mb, "uid = ");
+      put_membuf_str (&mb, round[i]->uid);
+    }
+  put_membuf (&mb, "", 1);
+  filterexp = get_membuf (&mb, NULL);
+  input = es_fopenmem (0, "w+b");
+  output = es_fopenmem (0, "w+b");
+  if (!filterexp || !input || !output)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  for (i=0; i < n; i++)
+    es_fwrite (round[i]->key->blob, round[i]->key->bloblen, 1, input);
+  if (es_ferror (input))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  es_rewind (input);
+
+  args[0] = "--import-options=import-export";
+  args[1] = "--import-filter";
+  args[2] = filterexp;
+  args[3] = "--import";
+  args[4] = NULL;
+  err = batch_run_gpg (__func__, input, output, args);
+  if (err)
+    goto leave;
+
+  if (es_fclose_snatch (output, &buffer, &buflen))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  output = NULL;
+  err = batch_split_keyblocks (buffer, buflen, &keys, &nkeys);
+  if (err)
+    goto leave;
+  if (nkeys != n)
+    {
+      err = gpg_error (GPG_ERR_INV_ENGINE);
+      goto leave;
+    }
+
+  for (i=0; i < n; i++)
+    {
+      round[i]->result = xtrymalloc (keys[i].bloblen);
+      if (!round[i]->result)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      memcpy (round[i]->result, keys[i].blob, keys[i].bloblen);
+      round[i]->resultlen = keys[i].bloblen;
+    }
+
+ leave:
+  xfree (keys);
+  gpgrt_free (buffer);
+  es_fclose (output);
+  es_fclose (input);
+  xfree (filterexp);
+  return err;
+}
+
+
+/* Filter a single JOB using wks_filter_uid.  */
+static gpg_error_t
+batch_filter_single (batch_job_t job)
+{
+  gpg_error_t err;
+  estream_t key, newkey;
+
+  key = es_fopenmem_init (0, "rb", job->key->blob, job->key->bloblen);
+  if (!key)
+    return gpg_error_from_syserror ();
+  err = wks_filter_uid (&newkey, key, job->uid, 1);
+  es_fclose (key);
+  if (err)
+    return err;
+  if (es_fclose_snatch (newkey, &job->result, &job->resultlen))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Filter the user ids of the NJOBS jobs at JOBS.  */
+static void
+batch_filter_uids (batch_job_t jobs, size_t njobs)
+{
+  gpg_error_t err;
+  batch_job_t *round;
+  size_t n, i, j;
+  size_t remaining;
+  int *done;
+
+  round = xcalloc (BATCH_MAX_FILTER, sizeof *round);
+  done = xcalloc (njobs? njobs : 1, sizeof *done);
+
+  remaining = 0;
+  for (i=0; i < njobs; i++)
+    if (jobs[i].single)
+      {
+        err = batch_filter_single (jobs + i);
+        if (err)
+          log_error ("error filtering key %s for '%s': %s\n",
+                     jobs[i].key->fpr, jobs[i].mbox, gpg_strerror (err));
+        done[i] = 1;
+      }
+    else
+      remaining++;
+
+  while (remaining)
+    {
+      /* Collect a round of jobs with distinct keys.  */
+      n = 0;
+      for (i=0; i < njobs && n < BATCH_MAX_FILTER; i++)
+        {
+          if (done[i])
+            continue;
+          for (j=0; j < n; j++)
+            if (round[j]->key == jobs[i].key)
+              break;
+          if (j < n)
+            continue;  /* Key already used in this round.  */
+          round[n++] = jobs + i;
+          done[i] = 1;
+          remaining--;
+        }
+
+      /* Move jobs whose keys would keep more than one user id to the
+       * slow method.  */
+      for (i=0; i < n; )
+        {
+          if (!batch_uid_conflict (round[i]->key, round[i]->uid, round, n))
+            {
+              i++;
+              continue;
+            }
+          err = batch_filter_single (round[i]);
+          if (err)
+            log_error ("error filtering key %s for '%s': %s\n",
+                       round[i]->key->fpr, round[i]->mbox,
+                       gpg_strerror (err));
+          round[i] = round[--n];
+        }
+
+      if (n && batch_filter_round (round, n))
+        {
+          /* Retry this round one by one.  */
+          for (i=0; i < n; i++)
+            {
+              xfree (round[i]->result);
+              round[i]->result = NULL;
+              err = batch_filter_single (round[i]);
+              if (err)
+                log_error ("error filtering key %s for '%s': %s\n",
+                           round[i]->key->fpr, round[i]->mbox,
+                           gpg_strerror (err));
+            }
+        }
+    }
+
+  xfree (done);
+  xfree (round);
+}
+
+
+/* Convert the keys in the files FILES with armored or binary data to
+ * binary keyblocks and append them to OUTPUT.  */
+static gpg_error_t
+batch_read_keys (strlist_t files, estream_t output)
+{
+  static const char *args[] =
+    { "--import-options=import-export", "--import", NULL };
+  gpg_error_t err;
+  strlist_t sl;
+  estream_t input[2] = { NULL, NULL };  /* Binary and armored.  */
+  estream_t fp;
+  char buffer[4096];
+  size_t nread;
+  int c, i;
+
+  for (i=0; i < 2; i++)
+    if (!(input[i] = es_fopenmem (0, "w+b")))
+      {
+        err = gpg_error_from_syserror ();
+        goto leave;
+      }
+
+  for (sl = files; sl; sl = sl->next)
+    {
+      fp = es_fopen (sl->d, "rb");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error reading '%s': %s\n", sl->d, gpg_strerror (err));
+          continue;
+        }
+      c = es_getc (fp);
+      if (c != EOF)
+        {
+          i = !(c & 0x80);
+          es_putc (c, input[i]);
+          while ((nread = es_fread (buffer, 1, sizeof buffer, fp)))
+            es_fwrite (buffer, 1, nread, input[i]);
+          if (i)
+            es_putc ('\n', input[i]);  /* Separate armored blocks.  */
+        }
+      if (es_ferror (fp))
+        log_error ("error reading '%s': %s\n",
+                   sl->d, gpg_strerror (gpg_error_from_syserror ()));
+      es_fclose (fp);
+    }
+
+  err = 0;
+  for (i=0; i < 2; i++)
+    {
+      if (es_ftell (input[i]) <= 0)
+        continue;
+      es_rewind (input[i]);
+      err = batch_run_gpg (__func__, input[i], output, args);
+      if (err)
+        {
+          log_error ("error reading keys: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+    }
+
+ leave:
+  es_fclose (input[0]);
+  es_fclose (input[1]);
+  return err;
+}
+
+
+/* Publish all keys in the files FILES.  */
+static void
+batch_install_chunk (strlist_t files, struct batch_stats_s *stats)
+{
+  gpg_error_t err;
+  estream_t output;
+  estream_t fp;
+  void *buffer = NULL;
+  size_t buflen;
+  batch_key_t keys = NULL;
+  size_t nkeys = 0;
+  batch_job_t jobs = NULL;
+  size_t njobs = 0;
+  strlist_t sl;
+  size_t i;
+
+  output = es_fopenmem (0, "w+b");
+  if (!output)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = batch_read_keys (files, output);
+  if (err)
+    {
+      /* Try the files one by one to skip over broken files.  */
+      es_fclose (output);
+      output = es_fopenmem (0, "w+b");
+      if (!output)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      for (sl = files; sl; sl = sl->next)
+        {
+          strlist_t next = sl->next;
+
+          sl->next = NULL;
+          if (batch_read_keys (sl, output))
+            {
+              log_error ("skipping '%s'\n", sl->d);
+              stats->failed++;
+            }
+          sl->next = next;
+        }
+    }
+
+  if (es_fclose_snatch (output, &buffer, &buflen))
+    {
+      err = gpg_error_from_syserror ();
+      output = NULL;
+      goto leave;
+    }
+  output = NULL;
+
+  if (!buflen)
+    goto leave;
+  err = batch_split_keyblocks (buffer, buflen, &keys, &nkeys);
+  if (!err)
+    err = batch_list_keys (keys, nkeys, buffer, buflen);
+  if (!err)
+    err = batch_select_uids (keys, nkeys, &jobs, &njobs);
+  if (err)
+    goto leave;
+
+  batch_filter_uids (jobs, njobs);
+
+  for (i=0; i < njobs; i++)
+    {
+      if (!jobs[i].result)
+        {
+          stats->failed++;
+          continue;
+        }
+      fp = es_fopenmem (0, "w+b");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      es_fwrite (jobs[i].result, jobs[i].resultlen, 1, fp);
+      err = 0;
+      if (opt.add_revocs)
+        {
+          err = wks_find_add_revocs (fp, jobs[i].mbox);
+          if (err)
+            log_error ("error finding revocations for '%s': %s\n",
+                       jobs[i].mbox, gpg_strerror (err));
+        }
+      if (!err)
+        {
+          es_rewind (fp);
+          err = wks_install_key_core (fp, jobs[i].mbox);
+        }
+      es_fclose (fp);
+      if (err)
+        stats->failed++;
+      else
+        {
+          stats->published++;
+          if (opt.verbose)
+            log_info ("key %s published for '%s'\n",
+                      jobs[i].key->fpr, jobs[i].mbox);
+        }
+    }
+  err = 0;
+
+ leave:
+  if (err)
+    {
+      log_error ("error installing keys: %s\n", gpg_strerror (err));
+      stats->failed++;
+    }
+  for (i=0; i < njobs; i++)
+    xfree (jobs[i].result);
+  xfree (jobs);
+  for (i=0; i < nkeys; i++)
+    {
+      xfree (keys[i].fpr);
+      free_uidinfo_list (keys[i].uids);
+    }
+  xfree (keys);
+  gpgrt_free (buffer);
+  es_fclose (output);
+}
+
+
+/* Install all keys found in the files of the directory DIRNAME into
+ * the WKD.  Each key is published for all its mail addresses in the
+ * domains served by the WKD.  */
+gpg_error_t
+wks_cmd_install_keydir (const char *dirname)
+{
+  gpg_error_t err;
+  gnupg_dir_t dir;
+  gnupg_dirent_t dentry;
+  struct stat sb;
+  char *fname;
+  strlist_t files = NULL;
+  unsigned int nfiles = 0;
+  struct batch_stats_s stats = { 0, 0 };
+
+  dir = gnupg_opendir (dirname);
+  if (!dir)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error opening directory '%s': %s\n",
+                 dirname, gpg_strerror (err));
+      return err;
+    }
+
+  while ((dentry = gnupg_readdir (dir)))
+    {
+      if (*dentry->d_name == '.')
+        continue;
+      fname = make_filename_try (dirname, dentry->d_name, NULL);
+      if (!fname)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (gnupg_stat (fname, &sb) || !S_ISREG (sb.st_mode))
+        {
+          xfree (fname);
+          continue;
+        }
+      if (!append_to_strlist_try (&files, fname))
+        {
+          err = gpg_error_from_syserror ();
+          xfree (fname);
+          goto leave;
+        }
+      xfree (fname);
+      if (++nfiles == BATCH_CHUNK_FILES)
+        {
+          batch_install_chunk (files, &stats);
+          free_strlist (files);
+          files = NULL;
+          nfiles = 0;
+        }
+    }
+  if (files)
+    batch_install_chunk (files, &stats);
+  err = 0;
+
+  if (!opt.quiet)
+    log_info ("%u keys published, %u failed\n",
+              stats.published, stats.failed);
+  if (stats.failed)
+    err = gpg_error (GPG_ERR_GENERAL);
+
+ leave:
+  free_strlist (files);
+  gnupg_closedir (dir);
+  return err;
+}
+
+
 /* Remove the key with mail address in USERID.  */
 gpg_error_t
 wks_cmd_remove_key (const char *userid)
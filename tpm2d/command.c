@@ -248,21 +248,14 @@ cmd_pksign (assuan_context_t ctx, char *line)
   if (rc)
     goto out_freeshadow;
 
-  rc = tpm2_start (&tssc);
+  rc = tpm2_acquire_key (&tssc, shadow_info, len, &key, &type);
   if (rc)
     goto out;
 
-  rc = tpm2_load_key (tssc, shadow_info, &key, &type);
-  if (rc)
-    goto end_out;
-
   rc = tpm2_sign (ctrl, tssc, key, pin_cb, type, digest, digestlen,
 		 &sig, &siglen);
 
-  tpm2_flush_handle (tssc, key);
-
- end_out:
-  tpm2_end (tssc);
+  tpm2_release_key (tssc, key, rc == GPG_ERR_CARD);
 
   if (rc)
     goto out;
@@ -315,14 +308,10 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
   if (rc)
     goto out;
 
-  rc = tpm2_start (&tssc);
+  rc = tpm2_acquire_key (&tssc, shadow_info, len, &key, &type);
   if (rc)
     goto out;
 
-  rc = tpm2_load_key (tssc, shadow_info, &key, &type);
-  if (rc)
-    goto end_out;
-
   if (type == TPM_ALG_RSA)
     rc = tpm2_rsa_decrypt (ctrl, tssc, key, pin_cb, crypto,
 			   cryptolen, &buf, &buflen);
@@ -330,15 +319,9 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
     rc = tpm2_ecc_decrypt (ctrl, tssc, key, pin_cb, crypto,
 			   cryptolen, &buf, &buflen);
   else
-    {
-      rc = GPG_ERR_PUBKEY_ALGO;
-      goto end_out;
-    }
+    rc = GPG_ERR_PUBKEY_ALGO;
 
-  tpm2_flush_handle (tssc, key);
-
- end_out:
-  tpm2_end (tssc);
+  tpm2_release_key (tssc, key, rc == GPG_ERR_CARD);
 
   if (rc)
     goto out;
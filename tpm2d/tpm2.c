@@ -288,6 +288,146 @@ tpm2_load_key (TSS_CONTEXT *tssc, const unsigned char *shadow_info,
   return 0;
 }
 
+/*
+ * Cache of loaded keys.  Creating the primary key and loading the
+ * wrapped key takes far longer than the actual operation, thus the
+ * keys used by PKSIGN and PKDECRYPT are kept loaded in a TSS context
+ * which is shared by all connections.  The TPM guarantees only three
+ * transient objects and loading a key requires its parent in another
+ * slot.  A key which is in use by a command waiting for its
+ * passphrase is never evicted.
+ */
+#define TPM2_KEY_CACHE_SIZE 2
+
+struct tpm2_key_cache_s
+{
+  int used;
+  unsigned char hash[32];  /* SHA-256 of the shadow info.  */
+  TPM_HANDLE key;
+  TPMI_ALG_PUBLIC type;
+  unsigned int refcount;
+  unsigned long lru;
+  int failed;              /* Flush the key when released.  */
+};
+
+static struct tpm2_key_cache_s tpm2_key_cache[TPM2_KEY_CACHE_SIZE];
+static unsigned long tpm2_key_cache_tick;
+static TSS_CONTEXT *tpm2_cache_tssc;
+
+
+/* Get the key described by (SHADOW_INFO,SHADOW_LEN) loaded into the
+ * TPM and return its handle at KEY and its type at TYPE.  The TSS
+ * context to be used with KEY is stored at TSSC.  The key must be
+ * released with tpm2_release_key.  */
+int
+tpm2_acquire_key (TSS_CONTEXT **tssc,
+                  const unsigned char *shadow_info, size_t shadow_len,
+                  TPM_HANDLE *key, TPMI_ALG_PUBLIC *type)
+{
+  unsigned char hash[32];
+  struct tpm2_key_cache_s *item, *victim;
+  int i, ret;
+
+  if (!tpm2_cache_tssc)
+    {
+      ret = tpm2_start (&tpm2_cache_tssc);
+      if (ret)
+        {
+          tpm2_cache_tssc = NULL;
+          return ret;
+        }
+    }
+  *tssc = tpm2_cache_tssc;
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, hash, shadow_info, shadow_len);
+  for (i = 0; i < TPM2_KEY_CACHE_SIZE; i++)
+    {
+      item = tpm2_key_cache + i;
+      if (item->used && !item->failed
+          && !memcmp (item->hash, hash, sizeof hash))
+        {
+          item->refcount++;
+          item->lru = ++tpm2_key_cache_tick;
+          *key = item->key;
+          *type = item->type;
+          return 0;
+        }
+    }
+
+  /* Make room for the key and its parent.  */
+  victim = NULL;
+  for (i = 0; i < TPM2_KEY_CACHE_SIZE; i++)
+    {
+      item = tpm2_key_cache + i;
+      if (item->refcount)
+        continue;
+      if (!item->used)
+        {
+          victim = item;
+          break;
+        }
+      if (!victim || item->lru < victim->lru)
+        victim = item;
+    }
+  if (victim && victim->used)
+    {
+      tpm2_flush_handle (tpm2_cache_tssc, victim->key);
+      victim->used = 0;
+    }
+
+  ret = tpm2_load_key (tpm2_cache_tssc, shadow_info, key, type);
+  if (ret)
+    return ret;
+
+  /* If all slots are busy the key is not cached but flushed by
+   * tpm2_release_key.  */
+  if (victim)
+    {
+      memcpy (victim->hash, hash, sizeof hash);
+      victim->key = *key;
+      victim->type = *type;
+      victim->refcount = 1;
+      victim->lru = ++tpm2_key_cache_tick;
+      victim->failed = 0;
+      victim->used = 1;
+    }
+
+  return 0;
+}
+
+
+/* Release the KEY acquired by tpm2_acquire_key.  If FAILED is true
+ * the operation using the key failed and the key is removed from the
+ * cache so that it will be loaded again for the next operation.  */
+void
+tpm2_release_key (TSS_CONTEXT *tssc, TPM_HANDLE key, int failed)
+{
+  struct tpm2_key_cache_s *item;
+  int i;
+
+  for (i = 0; i < TPM2_KEY_CACHE_SIZE; i++)
+    {
+      item = tpm2_key_cache + i;
+      if (item->used && item->key == key)
+        {
+          if (item->refcount)
+            item->refcount--;
+          if (failed)
+            item->failed = 1;
+          if (item->failed && !item->refcount)
+            {
+              tpm2_flush_handle (tssc, item->key);
+              item->used = 0;
+            }
+          return;
+        }
+    }
+
+  /* Not cached.  */
+  tpm2_flush_handle (tssc, key);
+}
+
+
 int
 tpm2_sign (ctrl_t ctrl, TSS_CONTEXT *tssc, TPM_HANDLE key,
 	   gpg_error_t (*pin_cb)(ctrl_t ctrl, const char *info,
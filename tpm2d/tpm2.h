@@ -33,6 +33,10 @@ void tpm2_end (TSS_CONTEXT *tssc);
 void tpm2_flush_handle (TSS_CONTEXT *tssc, TPM_HANDLE h);
 int tpm2_load_key (TSS_CONTEXT *tssc, const unsigned char *shadow_info,
 		   TPM_HANDLE *key, TPMI_ALG_PUBLIC *type);
+int tpm2_acquire_key (TSS_CONTEXT **tssc,
+		      const unsigned char *shadow_info, size_t shadow_len,
+		      TPM_HANDLE *key, TPMI_ALG_PUBLIC *type);
+void tpm2_release_key (TSS_CONTEXT *tssc, TPM_HANDLE key, int failed);
 int tpm2_sign (ctrl_t ctrl, TSS_CONTEXT *tssc, TPM_HANDLE key,
 	       gpg_error_t (*pin_cb)(ctrl_t ctrl, const char *info,
 				     char **retstr),